@@ -14,6 +14,9 @@
 */
 #include "lsmInt.h"
 
+#include <errno.h>
+#include <stdio.h>
+
 
 #ifdef LSM_DEBUG
 /*
@@ -1006,3 +1009,28 @@ int lsm_set_user_version(lsm_db *pDb, unsigned int iUsr){
 
   return rc;
 }
+
+static int removeFile(const char *zFile){
+  if( remove(zFile)!=0 && errno!=ENOENT ) return LSM_IOERR_BKPT;
+  return LSM_OK;
+}
+
+int lsm_destroy(const char *zFilename){
+  static const char *azSuffix[] = { "-log", "-shm", "" };
+  char zPath[1024];
+  int nName = (int)strlen(zFilename);
+  int rc = LSM_OK;
+  int i;
+
+  if( nName+5>(int)sizeof(zPath) ) return LSM_MISUSE_BKPT;
+
+  /* The database file goes last: if anything fails, the database is
+  ** left in a state lsm_open() can recover from. */
+  for(i=0; rc==LSM_OK && i<(int)(sizeof(azSuffix)/sizeof(azSuffix[0])); i++){
+    memcpy(zPath, zFilename, nName);
+    memcpy(&zPath[nName], azSuffix[i], strlen(azSuffix[i])+1);
+    rc = removeFile(zPath);
+  }
+
+  return rc;
+}
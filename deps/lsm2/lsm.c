@@ -176,6 +176,29 @@ lsm_open(lsm_db *db, const char *file) {
   return handle_error(err);
 }
 
+int
+lsm_destroy(const char *file) {
+  leveldb_options_t *options;
+  size_t len = strlen(file);
+  char *err = NULL;
+  char path[1024];
+
+  if (len + 1 > sizeof(path))
+    return LSM_MISUSE;
+
+  memcpy(path, file, len + 1);
+
+  if (len > 4 && strcmp(path + len - 4, ".dat") == 0)
+    path[len - 4] = '\0';
+
+  options = leveldb_options_create();
+
+  leveldb_destroy_db(options, path, &err);
+  leveldb_options_destroy(options);
+
+  return handle_error(err);
+}
+
 int
 lsm_close(lsm_db *db) {
   if (db->batch != NULL) {
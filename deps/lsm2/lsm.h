@@ -129,6 +129,15 @@ int lsm_close(lsm_db *pDb);
 */
 int lsm_open(lsm_db *pDb, const char *zFilename);
 
+/*
+** CAPI: Deleting a Database
+**
+** Remove the database zFilename and every file that belongs to it (logs,
+** shared-memory and lock files). Files that do not exist are skipped. No
+** connection to the database may be open.
+*/
+int lsm_destroy(const char *zFilename);
+
 /*
 ** CAPI: Obtaining pointers to database environments
 **
@@ -0,0 +1,1021 @@
+/*!
+ * lsm.c - lmdb wrapper for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+#include <lmdb.h>
+#include "lsm.h"
+
+/*
+ * Macros
+ */
+
+#define CHECK(x) if (!(x)) abort()
+
+/* Spare read transactions kept for reuse. */
+#define MAX_READERS 8
+
+/* Deepest nested write transaction. */
+#define MAX_LEVELS 8
+
+/*
+ * Locking
+ */
+
+/* Cursors may be opened and closed from several
+ * threads at once. The lock covers the reader pool
+ * and the cursor count, which decides when the map
+ * may be resized.
+ */
+
+#if defined(_WIN32)
+typedef CRITICAL_SECTION lsm_lock;
+
+static void
+lock_init(lsm_lock *lock) {
+  InitializeCriticalSection(lock);
+}
+
+static void
+lock_destroy(lsm_lock *lock) {
+  DeleteCriticalSection(lock);
+}
+
+static void
+lock_acquire(lsm_lock *lock) {
+  EnterCriticalSection(lock);
+}
+
+static void
+lock_release(lsm_lock *lock) {
+  LeaveCriticalSection(lock);
+}
+#else
+typedef pthread_mutex_t lsm_lock;
+
+static void
+lock_init(lsm_lock *lock) {
+  CHECK(pthread_mutex_init(lock, NULL) == 0);
+}
+
+static void
+lock_destroy(lsm_lock *lock) {
+  CHECK(pthread_mutex_destroy(lock) == 0);
+}
+
+static void
+lock_acquire(lsm_lock *lock) {
+  CHECK(pthread_mutex_lock(lock) == 0);
+}
+
+static void
+lock_release(lsm_lock *lock) {
+  CHECK(pthread_mutex_unlock(lock) == 0);
+}
+#endif
+
+/*
+ * Types
+ */
+
+struct lsm_db {
+  MDB_env *env;
+  lsm_lock lock;
+  MDB_dbi dbi;
+  MDB_txn *txn;
+  MDB_txn *levels[MAX_LEVELS];
+  int level;
+  MDB_txn *readers[MAX_READERS];
+  int nreaders;
+  int cursors;
+  size_t map_size;
+  int sync;
+};
+
+struct lsm_cursor {
+  lsm_db *db;
+  MDB_txn *txn;
+  MDB_cursor *cur;
+  MDB_val key;
+  MDB_val val;
+  int valid;
+};
+
+/*
+ * Error Handling
+ */
+
+static int
+convert_error(int rc) {
+  switch (rc) {
+    case MDB_SUCCESS:
+      return LSM_OK;
+    case MDB_MAP_FULL:
+    case MDB_TXN_FULL:
+    case MDB_READERS_FULL:
+    case MDB_DBS_FULL:
+      return LSM_FULL;
+    case MDB_CORRUPTED:
+    case MDB_PAGE_NOTFOUND:
+    case MDB_PAGE_FULL:
+      return LSM_CORRUPT;
+    case MDB_INVALID:
+    case MDB_VERSION_MISMATCH:
+    case ENOENT:
+    case EACCES:
+      return LSM_CANTOPEN;
+    case MDB_BAD_VALSIZE:
+    case MDB_BAD_TXN:
+    case MDB_BAD_RSLOT:
+    case MDB_BAD_DBI:
+    case EINVAL:
+      return LSM_MISUSE;
+    case MDB_MAP_RESIZED:
+    case EAGAIN:
+    case EBUSY:
+      return LSM_BUSY;
+    case ENOMEM:
+      return LSM_NOMEM;
+    case EIO:
+      return LSM_IOERR;
+  }
+  return LSM_ERROR;
+}
+
+/*
+ * Map Size
+ */
+
+static size_t
+map_used(lsm_db *db) {
+  MDB_envinfo info;
+  MDB_stat stat;
+
+  if (mdb_env_info(db->env, &info) != 0)
+    return 0;
+
+  if (mdb_env_stat(db->env, &stat) != 0)
+    return 0;
+
+  return (info.me_last_pgno + 1) * (size_t)stat.ms_psize;
+}
+
+static int
+map_grow(lsm_db *db) {
+  /* LMDB cannot resize the map while a
+     transaction is live in this process and
+     fails any write which outgrows it. Keep
+     the map at least twice the used size
+     before each write transaction. */
+  size_t used, size;
+  int rc = LSM_OK;
+
+  lock_acquire(&db->lock);
+
+  if (db->cursors > 0)
+    goto done;
+
+  used = map_used(db);
+
+  if (used * 2 <= db->map_size)
+    goto done;
+
+  size = db->map_size;
+
+  while (used * 2 > size) {
+    if (size > ((size_t)-1) / 2) {
+      rc = LSM_FULL;
+      goto done;
+    }
+
+    size *= 2;
+  }
+
+  if (mdb_env_set_mapsize(db->env, size) != 0) {
+    rc = LSM_FULL;
+    goto done;
+  }
+
+  db->map_size = size;
+done:
+  lock_release(&db->lock);
+  return rc;
+}
+
+/*
+ * Database
+ */
+
+int
+lsm_new(lsm_env *env, lsm_db **lsm) {
+  lsm_db *db;
+  int rc;
+
+  if (env != NULL)
+    return LSM_MISUSE;
+
+  db = malloc(sizeof(lsm_db));
+
+  if (db == NULL)
+    return LSM_NOMEM;
+
+  rc = mdb_env_create(&db->env);
+
+  if (rc != 0) {
+    free(db);
+    return convert_error(rc);
+  }
+
+  lock_init(&db->lock);
+
+  db->dbi = 0;
+  db->txn = NULL;
+  db->level = 0;
+  db->nreaders = 0;
+  db->cursors = 0;
+  db->map_size = (size_t)(sizeof(void *) < 8 ? 256 : 1024) << 20;
+  db->sync = 0;
+
+  *lsm = db;
+
+  return LSM_OK;
+}
+
+int
+lsm_open(lsm_db *db, const char *file) {
+  unsigned int flags = MDB_NOSUBDIR | MDB_NOTLS | MDB_NORDAHEAD;
+  size_t len = strlen(file);
+  MDB_txn *txn;
+  char path[1024];
+  int rc;
+
+  if (len + 5 > sizeof(path))
+    return LSM_MISUSE;
+
+  memcpy(path, file, len + 1);
+
+  if (len > 4 && strcmp(path + len - 4, ".dat") == 0)
+    len -= 4;
+
+  memcpy(path + len, ".mdb", 5);
+
+  /* Only the meta page sync is deferred: a crash may
+     lose the last transaction but never tears one. */
+  if (!db->sync)
+    flags |= MDB_NOMETASYNC;
+
+  rc = mdb_env_set_mapsize(db->env, db->map_size);
+
+  if (rc != 0)
+    return convert_error(rc);
+
+  rc = mdb_env_set_maxreaders(db->env, 126);
+
+  if (rc != 0)
+    return convert_error(rc);
+
+  rc = mdb_env_open(db->env, path, flags, 0644);
+
+  if (rc != 0)
+    return convert_error(rc);
+
+  rc = mdb_txn_begin(db->env, NULL, 0, &txn);
+
+  if (rc != 0)
+    return convert_error(rc);
+
+  rc = mdb_dbi_open(txn, NULL, 0, &db->dbi);
+
+  if (rc != 0) {
+    mdb_txn_abort(txn);
+    return convert_error(rc);
+  }
+
+  rc = mdb_txn_commit(txn);
+
+  if (rc != 0)
+    return convert_error(rc);
+
+  return map_grow(db);
+}
+
+int
+lsm_destroy(const char *file) {
+  size_t len = strlen(file);
+  char path[1024];
+
+  if (len + 10 > sizeof(path))
+    return LSM_MISUSE;
+
+  memcpy(path, file, len + 1);
+
+  if (len > 4 && strcmp(path + len - 4, ".dat") == 0)
+    len -= 4;
+
+  /* The lock file is only a reader table. */
+  memcpy(path + len, ".mdb-lock", 10);
+
+  if (remove(path) != 0 && errno != ENOENT)
+    return LSM_IOERR;
+
+  memcpy(path + len, ".mdb", 5);
+
+  if (remove(path) != 0 && errno != ENOENT)
+    return LSM_IOERR;
+
+  return LSM_OK;
+}
+
+int
+lsm_close(lsm_db *db) {
+  int i;
+
+  lsm_rollback(db, 0);
+
+  for (i = 0; i < db->nreaders; i++)
+    mdb_txn_abort(db->readers[i]);
+
+  mdb_env_close(db->env);
+
+  lock_destroy(&db->lock);
+
+  free(db);
+
+  return LSM_OK;
+}
+
+int
+lsm_flush(lsm_db *db) {
+  CHECK(db != NULL);
+  return LSM_OK;
+}
+
+int
+lsm_work(lsm_db *db, int merge, int kb, int *nwrite) {
+  CHECK(db != NULL);
+
+  (void)merge;
+  (void)kb;
+
+  if (nwrite != NULL)
+    *nwrite = 0;
+
+  return LSM_OK;
+}
+
+int
+lsm_checkpoint(lsm_db *db, int *kb) {
+  if (kb != NULL)
+    *kb = 0;
+
+  return convert_error(mdb_env_sync(db->env, 1));
+}
+
+/*
+ * Config
+ */
+
+int
+lsm_config(lsm_db *db, int param, ...) {
+  int rc = LSM_OK;
+  va_list ap;
+
+  va_start(ap, param);
+
+  switch (param) {
+    case LSM_CONFIG_AUTOFLUSH:
+    case LSM_CONFIG_AUTOWORK:
+    case LSM_CONFIG_AUTOCHECKPOINT:
+    case LSM_CONFIG_PAGE_SIZE:
+    case LSM_CONFIG_BLOCK_SIZE:
+    case LSM_CONFIG_SAFETY:
+    case LSM_CONFIG_MMAP:
+    case LSM_CONFIG_USE_LOG:
+    case LSM_CONFIG_AUTOMERGE:
+    case LSM_CONFIG_MAX_FREELIST:
+    case LSM_CONFIG_MULTIPLE_PROCESSES:
+    case LSM_CONFIG_READONLY: {
+      int *ptr = va_arg(ap, int *);
+
+      if (*ptr < 0)
+        *ptr = 0;
+
+      break;
+    }
+
+    case LSM_CONFIG_MAP_SIZE: {
+      int *ptr = va_arg(ap, int *);
+
+      lock_acquire(&db->lock);
+
+      if (*ptr > 0 && db->txn == NULL && db->cursors == 0) {
+        size_t size = (size_t)*ptr << 20;
+
+        if (size > db->map_size) {
+          rc = convert_error(mdb_env_set_mapsize(db->env, size));
+
+          if (rc == LSM_OK)
+            db->map_size = size;
+        }
+      }
+
+      *ptr = (int)(db->map_size >> 20);
+
+      lock_release(&db->lock);
+
+      break;
+    }
+
+    case LSM_CONFIG_SYNC: {
+      int val = *va_arg(ap, int *);
+
+      if (val >= 0) {
+        rc = convert_error(mdb_env_set_flags(db->env, MDB_NOMETASYNC, !val));
+
+        if (rc == LSM_OK)
+          db->sync = (val != 0);
+      }
+
+      break;
+    }
+
+    default: {
+      rc = LSM_MISUSE;
+      break;
+    }
+  }
+
+  va_end(ap);
+
+  return rc;
+}
+
+void
+lsm_config_log(lsm_db *db, void (*cb)(void *, int, const char *), void *arg) {
+  CHECK(db != NULL);
+  CHECK(cb != NULL);
+  (void)arg;
+}
+
+void
+lsm_config_work_hook(lsm_db *db, void (*cb)(lsm_db *, void *), void *arg) {
+  CHECK(db != NULL);
+  (void)cb;
+  (void)arg;
+}
+
+/*
+ * Meta
+ */
+
+static const unsigned char version_key[1] = {0x00};
+
+lsm_env *
+lsm_get_env(lsm_db *db) {
+  (void)db;
+  return NULL;
+}
+
+lsm_env *
+lsm_default_env(void) {
+  return NULL;
+}
+
+int
+lsm_get_user_version(lsm_db *db, unsigned int *ptr) {
+  const unsigned char *vp;
+  MDB_txn *txn;
+  MDB_val key, val;
+  int rc;
+
+  rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+
+  if (rc != 0)
+    return convert_error(rc);
+
+  key.mv_data = (void *)version_key;
+  key.mv_size = sizeof(version_key);
+
+  rc = mdb_get(txn, db->dbi, &key, &val);
+
+  if (rc == MDB_NOTFOUND) {
+    mdb_txn_abort(txn);
+    *ptr = 0;
+    return LSM_OK;
+  }
+
+  if (rc != 0 || val.mv_size != 4) {
+    mdb_txn_abort(txn);
+    return rc != 0 ? convert_error(rc) : LSM_CORRUPT;
+  }
+
+  vp = val.mv_data;
+
+  *ptr = ((unsigned int)vp[0] << 24)
+       | ((unsigned int)vp[1] << 16)
+       | ((unsigned int)vp[2] <<  8)
+       | ((unsigned int)vp[3] <<  0);
+
+  mdb_txn_abort(txn);
+
+  return LSM_OK;
+}
+
+int
+lsm_set_user_version(lsm_db *db, unsigned int val) {
+  unsigned char vp[4];
+  MDB_val key, data;
+  MDB_txn *txn;
+  int rc;
+
+  if (db->txn != NULL)
+    return LSM_MISUSE;
+
+  vp[0] = (val >> 24) & 0xff;
+  vp[1] = (val >> 16) & 0xff;
+  vp[2] = (val >>  8) & 0xff;
+  vp[3] = (val >>  0) & 0xff;
+
+  rc = mdb_txn_begin(db->env, NULL, 0, &txn);
+
+  if (rc != 0)
+    return convert_error(rc);
+
+  key.mv_data = (void *)version_key;
+  key.mv_size = sizeof(version_key);
+  data.mv_data = vp;
+  data.mv_size = sizeof(vp);
+
+  rc = mdb_put(txn, db->dbi, &key, &data, 0);
+
+  if (rc != 0) {
+    mdb_txn_abort(txn);
+    return convert_error(rc);
+  }
+
+  return convert_error(mdb_txn_commit(txn));
+}
+
+int
+lsm_info(lsm_db *db, int param, ...) {
+  int rc = LSM_OK;
+  va_list ap;
+
+  va_start(ap, param);
+
+  switch (param) {
+    case LSM_INFO_CHECKPOINT_SIZE: {
+      *va_arg(ap, int *) = 0;
+      break;
+    }
+
+    case LSM_INFO_TREE_SIZE: {
+      *va_arg(ap, int *) = 0;
+      *va_arg(ap, int *) = 0;
+      break;
+    }
+
+    default: {
+      rc = LSM_MISUSE;
+      break;
+    }
+  }
+
+  va_end(ap);
+
+  (void)db;
+
+  return rc;
+}
+
+/*
+ * Transaction
+ */
+
+/* Levels map onto LMDB's nested transactions:
+ * level N is a child of level N-1 and commits
+ * into it, so only level 1 ever reaches disk.
+ * The semantics follow the native backend.
+ */
+
+static void
+txn_close(lsm_db *db, int level) {
+  /* Innermost first; a child must end before its parent. */
+  while (db->level > level) {
+    mdb_txn_abort(db->levels[--db->level]);
+    db->levels[db->level] = NULL;
+  }
+
+  db->txn = db->level > 0 ? db->levels[db->level - 1] : NULL;
+}
+
+static int
+txn_open(lsm_db *db, int level) {
+  MDB_txn *txn;
+  int rc;
+
+  while (db->level < level) {
+    rc = mdb_txn_begin(db->env, db->txn, 0, &txn);
+
+    if (rc != 0)
+      return convert_error(rc);
+
+    db->levels[db->level++] = txn;
+    db->txn = txn;
+  }
+
+  return LSM_OK;
+}
+
+int
+lsm_begin(lsm_db *db, int level) {
+  int base = db->level;
+  int rc;
+
+  if (level < 1 || level > MAX_LEVELS)
+    return LSM_MISUSE;
+
+  if (level <= base)
+    return LSM_OK;
+
+  if (base == 0) {
+    rc = map_grow(db);
+
+    if (rc != LSM_OK)
+      return rc;
+  }
+
+  rc = txn_open(db, level);
+
+  if (rc != LSM_OK)
+    txn_close(db, base);
+
+  return rc;
+}
+
+int
+lsm_insert(lsm_db *db, const void *kp, int kn, const void *vp, int vn) {
+  MDB_val key, val;
+
+  if (db->txn == NULL)
+    return LSM_MISUSE;
+
+  key.mv_data = (void *)kp;
+  key.mv_size = kn;
+  val.mv_data = (void *)vp;
+  val.mv_size = vn;
+
+  return convert_error(mdb_put(db->txn, db->dbi, &key, &val, 0));
+}
+
+int
+lsm_delete(lsm_db *db, const void *kp, int kn) {
+  MDB_val key;
+  int rc;
+
+  if (db->txn == NULL)
+    return LSM_MISUSE;
+
+  key.mv_data = (void *)kp;
+  key.mv_size = kn;
+
+  rc = mdb_del(db->txn, db->dbi, &key, NULL);
+
+  if (rc == MDB_NOTFOUND)
+    return LSM_OK;
+
+  return convert_error(rc);
+}
+
+static int
+compare4(const void *xp, int xn, const void *yp, int yn) {
+  int min = xn < yn ? xn : yn;
+  int cmp = 0;
+
+  if (min != 0)
+    cmp = memcmp(xp, yp, min);
+
+  if (cmp == 0)
+    cmp = xn - yn;
+
+  return cmp;
+}
+
+int
+lsm_delete_range(lsm_db *db, const void *xp, int xn,
+                             const void *yp, int yn) {
+  MDB_cursor *cur;
+  MDB_val key, val;
+  int rc;
+
+  if (db->txn == NULL)
+    return LSM_MISUSE;
+
+  rc = mdb_cursor_open(db->txn, db->dbi, &cur);
+
+  if (rc != 0)
+    return convert_error(rc);
+
+  key.mv_data = (void *)xp;
+  key.mv_size = xn;
+
+  rc = mdb_cursor_get(cur, &key, &val, MDB_SET_RANGE);
+
+  if (rc == 0 && compare4(key.mv_data, key.mv_size, xp, xn) == 0)
+    rc = mdb_cursor_get(cur, &key, &val, MDB_NEXT);
+
+  while (rc == 0) {
+    if (compare4(key.mv_data, key.mv_size, yp, yn) >= 0)
+      break;
+
+    rc = mdb_cursor_del(cur, 0);
+
+    if (rc != 0)
+      break;
+
+    /* Lands on the entry after the deleted one. */
+    rc = mdb_cursor_get(cur, &key, &val, MDB_NEXT);
+  }
+
+  mdb_cursor_close(cur);
+
+  if (rc == MDB_NOTFOUND)
+    rc = 0;
+
+  return convert_error(rc);
+}
+
+int
+lsm_commit(lsm_db *db, int level) {
+  int rc = 0;
+
+  if (level < 0)
+    return LSM_MISUSE;
+
+  while (db->level > level) {
+    rc = mdb_txn_commit(db->levels[--db->level]);
+
+    db->levels[db->level] = NULL;
+
+    if (rc != 0)
+      break;
+  }
+
+  /* A failed commit has ended its transaction; LMDB
+     has also ended the children. Drop the outer ones. */
+  if (rc != 0)
+    txn_close(db, 0);
+  else
+    txn_close(db, db->level);
+
+  return convert_error(rc);
+}
+
+int
+lsm_rollback(lsm_db *db, int level) {
+  /* Negative means the innermost level. */
+  if (level < 0)
+    level = db->level > 0 ? db->level - 1 : 0;
+
+  if (level > db->level)
+    return LSM_OK;
+
+  if (level == 0) {
+    txn_close(db, 0);
+    return LSM_OK;
+  }
+
+  /* Discard level N's writes but leave it open. */
+  txn_close(db, level - 1);
+
+  return txn_open(db, level);
+}
+
+/*
+ * Cursor
+ */
+
+/* Every cursor reads from its own snapshot, as
+ * with the native backend. Readers never block
+ * writers. Note that, like the LevelDB wrapper,
+ * a cursor does not see writes which belong to a
+ * transaction that is still open.
+ */
+
+int
+lsm_csr_open(lsm_db *db, lsm_cursor **csr) {
+  lsm_cursor *cur = malloc(sizeof(lsm_cursor));
+  MDB_txn *txn;
+  int rc;
+
+  if (cur == NULL)
+    return LSM_NOMEM;
+
+  lock_acquire(&db->lock);
+
+  if (db->nreaders > 0) {
+    txn = db->readers[--db->nreaders];
+    rc = mdb_txn_renew(txn);
+
+    if (rc != 0)
+      mdb_txn_abort(txn);
+  } else {
+    rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+  }
+
+  if (rc == 0) {
+    rc = mdb_cursor_open(txn, db->dbi, &cur->cur);
+
+    if (rc != 0)
+      mdb_txn_abort(txn);
+  }
+
+  if (rc == 0)
+    db->cursors++;
+
+  lock_release(&db->lock);
+
+  if (rc != 0) {
+    free(cur);
+    return convert_error(rc);
+  }
+
+  cur->db = db;
+  cur->txn = txn;
+  cur->valid = 0;
+
+  memset(&cur->key, 0, sizeof(cur->key));
+  memset(&cur->val, 0, sizeof(cur->val));
+
+  *csr = cur;
+
+  return LSM_OK;
+}
+
+int
+lsm_csr_close(lsm_cursor *cur) {
+  lsm_db *db = cur->db;
+
+  mdb_cursor_close(cur->cur);
+
+  lock_acquire(&db->lock);
+
+  if (db->nreaders < MAX_READERS) {
+    mdb_txn_reset(cur->txn);
+    db->readers[db->nreaders++] = cur->txn;
+  } else {
+    mdb_txn_abort(cur->txn);
+  }
+
+  db->cursors--;
+
+  lock_release(&db->lock);
+
+  free(cur);
+
+  return LSM_OK;
+}
+
+static int
+lsm_csr_get(lsm_cursor *cur, MDB_cursor_op op) {
+  int rc = mdb_cursor_get(cur->cur, &cur->key, &cur->val, op);
+
+  cur->valid = (rc == 0);
+
+  if (rc == MDB_NOTFOUND)
+    return LSM_OK;
+
+  return convert_error(rc);
+}
+
+int
+lsm_csr_seek(lsm_cursor *cur, const void *kp, int kn, int whence) {
+  cur->key.mv_data = (void *)kp;
+  cur->key.mv_size = kn;
+
+  switch (whence) {
+    case LSM_SEEK_LEFAST:
+    case LSM_SEEK_LE: {
+      int rc = lsm_csr_get(cur, MDB_SET_RANGE);
+
+      if (rc != LSM_OK)
+        return rc;
+
+      if (!cur->valid)
+        return lsm_csr_get(cur, MDB_LAST);
+
+      if (compare4(cur->key.mv_data, cur->key.mv_size, kp, kn) > 0)
+        return lsm_csr_get(cur, MDB_PREV);
+
+      return LSM_OK;
+    }
+
+    case LSM_SEEK_EQ: {
+      return lsm_csr_get(cur, MDB_SET_KEY);
+    }
+
+    case LSM_SEEK_GE: {
+      return lsm_csr_get(cur, MDB_SET_RANGE);
+    }
+  }
+
+  return LSM_MISUSE;
+}
+
+int
+lsm_csr_first(lsm_cursor *cur) {
+  return lsm_csr_get(cur, MDB_FIRST);
+}
+
+int
+lsm_csr_last(lsm_cursor *cur) {
+  return lsm_csr_get(cur, MDB_LAST);
+}
+
+int
+lsm_csr_next(lsm_cursor *cur) {
+  if (!cur->valid)
+    return LSM_MISUSE;
+
+  return lsm_csr_get(cur, MDB_NEXT);
+}
+
+int
+lsm_csr_prev(lsm_cursor *cur) {
+  if (!cur->valid)
+    return LSM_MISUSE;
+
+  return lsm_csr_get(cur, MDB_PREV);
+}
+
+int
+lsm_csr_valid(lsm_cursor *cur) {
+  return cur->valid;
+}
+
+int
+lsm_csr_key(lsm_cursor *cur, const void **kp, int *kn) {
+  if (!cur->valid)
+    return LSM_MISUSE;
+
+  *kp = cur->key.mv_data;
+  *kn = cur->key.mv_size;
+
+  return LSM_OK;
+}
+
+int
+lsm_csr_value(lsm_cursor *cur, const void **vp, int *vn) {
+  if (!cur->valid)
+    return LSM_MISUSE;
+
+  *vp = cur->val.mv_data;
+  *vn = cur->val.mv_size;
+
+  return LSM_OK;
+}
+
+int
+lsm_csr_cmp(lsm_cursor *cur, const void *kp, int kn, int *cmp) {
+  if (!cur->valid)
+    return LSM_MISUSE;
+
+  *cmp = compare4(cur->key.mv_data, cur->key.mv_size, kp, kn);
+
+  return LSM_OK;
+}
+
+/*
+ * Util
+ */
+
+void *
+lsm_malloc(lsm_env *env, size_t size) {
+  CHECK(env == NULL);
+  return malloc(size);
+}
+
+void *
+lsm_realloc(lsm_env *env, void *ptr, size_t size) {
+  CHECK(env == NULL);
+  return realloc(ptr, size);
+}
+
+void
+lsm_free(lsm_env *env, void *ptr) {
+  CHECK(env == NULL);
+
+  if (ptr != NULL)
+    free(ptr);
+}
@@ -11,6 +11,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
 #include "../mako/common.h"
 
 /*
@@ -40,11 +42,24 @@ btc_client_open(btc_client_t *client,
 BTC_EXTERN void
 btc_client_close(btc_client_t *client);
 
+BTC_EXTERN void
+btc_client_set_timeout(btc_client_t *client, int64_t msec);
+
+BTC_EXTERN void
+btc_client_set_idle(btc_client_t *client, int64_t msec);
+
 BTC_EXTERN struct _json_value *
 btc_client_call(btc_client_t *client,
                 const char *method,
                 struct _json_value *params);
 
+BTC_EXTERN int
+btc_client_batch(btc_client_t *client,
+                 const char **methods,
+                 struct _json_value **params,
+                 struct _json_value **results,
+                 size_t length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -93,6 +93,12 @@ extern "C" {
 #define BTC_LOCK_EX 1
 #define BTC_LOCK_UN 2
 
+#define BTC_ADVISE_NORMAL 0
+#define BTC_ADVISE_SEQUENTIAL 1
+#define BTC_ADVISE_RANDOM 2
+#define BTC_ADVISE_WILLNEED 3
+#define BTC_ADVISE_DONTNEED 4
+
 #define BTC_MSEC(ts) \
   (((ts)->tv_sec * 1000) + ((ts)->tv_nsec / 1000000))
 
@@ -274,9 +280,21 @@ btc_fs_fdatasync(int fd);
 BTC_EXTERN int
 btc_fs_flock(int fd, int operation);
 
+BTC_EXTERN int
+btc_fs_fallocate(int fd, int64_t pos, int64_t len);
+
+BTC_EXTERN int
+btc_fs_fadvise(int fd, int64_t pos, int64_t len, int advice);
+
 BTC_EXTERN int
 btc_fs_close(int fd);
 
+BTC_EXTERN void *
+btc_fs_mmap(int fd, size_t size);
+
+BTC_EXTERN int
+btc_fs_munmap(void *ptr, size_t size);
+
 BTC_EXTERN int
 btc_fs_read_file(const char *name, void *dst, size_t len);
 
@@ -340,9 +358,15 @@ btc_ps_daemon(void);
 BTC_EXTERN int
 btc_ps_fdlimit(int minfd);
 
+BTC_EXTERN size_t
+btc_ps_rss(void);
+
 BTC_EXTERN void
 btc_ps_onterm(void (*handler)(void *), void *arg);
 
+BTC_EXTERN void
+btc_ps_onusr1(void (*handler)(void *), void *arg);
+
 /*
  * Mutex
  */
@@ -431,6 +455,9 @@ btc_thread_detach(btc_thread_t *thread);
 BTC_EXTERN void
 btc_thread_join(btc_thread_t *thread);
 
+BTC_EXTERN int
+btc_thread_pin(btc_thread_t *thread, int cpu);
+
 /*
  * Once
  */
@@ -454,6 +481,19 @@ btc_tls_get(btc_tls_t *key);
 BTC_EXTERN void
 btc_tls_set(btc_tls_t *key, void *value);
 
+/*
+ * Atomic
+ */
+
+BTC_EXTERN long
+btc_atomic_load(const volatile long *ptr);
+
+BTC_EXTERN void
+btc_atomic_store(volatile long *ptr, long val);
+
+BTC_EXTERN void
+btc_atomic_fence(void);
+
 /*
  * Socket Address
  */
@@ -486,6 +526,12 @@ btc_sys_homedir(char *buf, size_t size);
 BTC_EXTERN int
 btc_sys_datadir(char *buf, size_t size, const char *name);
 
+BTC_EXTERN void *
+btc_sys_hugealloc(size_t *size);
+
+BTC_EXTERN void
+btc_sys_hugefree(void *ptr, size_t size);
+
 /*
  * Time
  */
@@ -93,9 +93,17 @@ typedef struct http_req {
   http_string_t body;
 } http_req_t;
 
+struct http_res;
+
+typedef int http_stream_cb(struct http_res *, void *);
+typedef void http_stream_free_cb(void *);
+
 typedef struct http_res {
   btc_socket_t *socket;
   http_head_t headers;
+  http_stream_cb *stream;
+  http_stream_free_cb *free_cb;
+  void *arg;
 } http_res_t;
 
 struct http_server;
@@ -156,9 +164,29 @@ http_res_send_data(http_res_t *res,
                    void *body,
                    size_t length);
 
+BTC_EXTERN void
+http_res_send_shared(http_res_t *res,
+                     unsigned int status,
+                     const char *type,
+                     const void *body,
+                     size_t length,
+                     http_stream_free_cb *free_cb,
+                     void *arg);
+
 BTC_EXTERN void
 http_res_error(http_res_t *res, unsigned int status);
 
+BTC_EXTERN void
+http_res_stream(http_res_t *res,
+                unsigned int status,
+                const char *type,
+                http_stream_cb *stream,
+                http_stream_free_cb *free_cb,
+                void *arg);
+
+BTC_EXTERN int
+http_res_chunk(http_res_t *res, const void *data, size_t length);
+
 /*
  * Server
  */
@@ -211,6 +239,12 @@ http_client_destroy(http_client_t *client);
 BTC_EXTERN const char *
 http_client_strerror(http_client_t *client);
 
+BTC_EXTERN void
+http_client_set_timeout(http_client_t *client, int64_t msec);
+
+BTC_EXTERN void
+http_client_set_idle(http_client_t *client, int64_t msec);
+
 BTC_EXTERN int
 http_client_open(http_client_t *client,
                  const char *hostname,
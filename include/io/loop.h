@@ -12,6 +12,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include "../mako/common.h"
 
 /*
@@ -20,16 +21,19 @@ extern "C" {
 
 typedef struct btc_loop_s btc_loop_t;
 typedef struct btc_socket_s btc_socket_t;
+typedef struct btc_timer_s btc_timer_t;
 
 struct btc_sockaddr_s;
 
 typedef void btc_loop_tick_cb(void *arg);
+typedef void btc_timer_cb(void *arg);
 typedef void btc_socket_socket_cb(btc_socket_t *, btc_socket_t *);
 typedef void btc_socket_connect_cb(btc_socket_t *);
 typedef void btc_socket_close_cb(btc_socket_t *);
 typedef void btc_socket_error_cb(btc_socket_t *);
 typedef  int btc_socket_data_cb(btc_socket_t *, const void *, size_t);
 typedef void btc_socket_drain_cb(btc_socket_t *);
+typedef void btc_socket_free_cb(void *arg);
 typedef void btc_socket_message_cb(btc_socket_t *,
                                    const void *,
                                    size_t,
@@ -87,6 +91,24 @@ btc_socket_set_nodelay(btc_socket_t *socket, int value);
 BTC_EXTERN int
 btc_socket_write(btc_socket_t *socket, void *data, size_t len);
 
+BTC_EXTERN int
+btc_socket_write_static(btc_socket_t *socket, const void *data, size_t len);
+
+BTC_EXTERN int
+btc_socket_write_shared(btc_socket_t *socket,
+                        const void *data,
+                        size_t len,
+                        btc_socket_free_cb *free_cb,
+                        void *arg);
+
+BTC_EXTERN int
+btc_socket_write_file(btc_socket_t *socket,
+                      int fd,
+                      int64_t pos,
+                      size_t len,
+                      btc_socket_free_cb *free_cb,
+                      void *arg);
+
 BTC_EXTERN int
 btc_socket_send(btc_socket_t *socket,
                 void *data,
@@ -96,6 +118,31 @@ btc_socket_send(btc_socket_t *socket,
 BTC_EXTERN void
 btc_socket_close(btc_socket_t *socket);
 
+/*
+ * Timer
+ */
+
+BTC_EXTERN btc_timer_t *
+btc_timer_create(btc_loop_t *loop, btc_timer_cb *handler, void *data);
+
+BTC_EXTERN void
+btc_timer_destroy(btc_timer_t *timer);
+
+BTC_EXTERN void
+btc_timer_start(btc_timer_t *timer, int64_t msec);
+
+BTC_EXTERN void
+btc_timer_at(btc_timer_t *timer, int64_t time);
+
+BTC_EXTERN void
+btc_timer_stop(btc_timer_t *timer);
+
+BTC_EXTERN int
+btc_timer_active(btc_timer_t *timer);
+
+BTC_EXTERN int64_t
+btc_timer_expires(btc_timer_t *timer);
+
 /*
  * Loop
  */
@@ -112,6 +159,15 @@ btc_loop_on_tick(btc_loop_t *loop, btc_loop_tick_cb *handler, void *data);
 BTC_EXTERN void
 btc_loop_off_tick(btc_loop_t *loop, btc_loop_tick_cb *handler, void *data);
 
+BTC_EXTERN int64_t
+btc_loop_busy(btc_loop_t *loop);
+
+BTC_EXTERN void
+btc_loop_wakeup(btc_loop_t *loop);
+
+BTC_EXTERN void
+btc_loop_set_spin(btc_loop_t *loop, int64_t usec);
+
 BTC_EXTERN const char *
 btc_loop_strerror(btc_loop_t *loop);
 
@@ -121,6 +177,12 @@ btc_loop_listen(btc_loop_t *loop, const struct btc_sockaddr_s *addr);
 BTC_EXTERN btc_socket_t *
 btc_loop_connect(btc_loop_t *loop, const struct btc_sockaddr_s *addr);
 
+BTC_EXTERN btc_socket_t *
+btc_loop_proxy(btc_loop_t *loop,
+               const struct btc_sockaddr_s *proxy,
+               const char *host,
+               int port);
+
 BTC_EXTERN btc_socket_t *
 btc_loop_bind(btc_loop_t *loop, const struct btc_sockaddr_s *addr);
 
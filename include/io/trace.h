@@ -0,0 +1,66 @@
+/*!
+ * trace.h - trace events for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_TRACE_H
+#define BTC_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "../mako/common.h"
+
+/*
+ * Trace Points
+ */
+
+/* Spans are recorded as begin/end pairs in the
+ * Chrome trace event format (chrome://tracing,
+ * ui.perfetto.dev). Categories must be string
+ * literals; names are copied. Building without
+ * BTC_TRACE compiles every trace point out.
+ */
+
+#ifdef BTC_TRACE
+#  define BTC_TRACE_BEGIN(cat, name) do { \
+     if (btc_trace_enabled)               \
+       btc_trace_event('B', cat, name);   \
+   } while (0)
+#  define BTC_TRACE_END(cat, name) do { \
+     if (btc_trace_enabled)             \
+       btc_trace_event('E', cat, name); \
+   } while (0)
+#else
+#  define BTC_TRACE_BEGIN(cat, name) do { } while (0)
+#  define BTC_TRACE_END(cat, name) do { } while (0)
+#endif
+
+#ifdef BTC_TRACE
+BTC_EXTERN extern volatile int btc_trace_enabled;
+#endif
+
+/*
+ * Trace
+ */
+
+BTC_EXTERN int
+btc_trace_start(size_t events);
+
+BTC_EXTERN int
+btc_trace_stop(const char *file, size_t *events);
+
+BTC_EXTERN int
+btc_trace_active(void);
+
+BTC_EXTERN void
+btc_trace_event(int phase, const char *cat, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_TRACE_H */
@@ -13,15 +13,34 @@ extern "C" {
 
 #include "../mako/common.h"
 
+/*
+ * Constants
+ */
+
+/* Workers always take the highest class queued
+ * anywhere in the pool before a lower one. */
+enum btc_work_priority {
+  BTC_WORK_HIGH, /* block validation */
+  BTC_WORK_NORMAL, /* mempool, indexing */
+  BTC_WORK_LOW, /* background scans */
+  BTC_WORK_PRIORITIES
+};
+
 /*
  * Types
  */
 
 typedef void btc_work_f(void *arg);
+typedef void btc_range_f(size_t start, size_t end, void *arg);
+
+typedef struct btc_taskgroup_s btc_taskgroup_t;
 
 typedef struct btc_work_s {
   btc_work_f *func;
   void *arg;
+  int owned;
+  int priority;
+  btc_taskgroup_t *group;
   struct btc_work_s *next;
 } btc_work_t;
 
@@ -33,6 +52,8 @@ typedef struct btc_workq_s {
 
 typedef struct btc_workers_s btc_workers_t;
 
+struct btc_loop_s;
+
 /*
  * Work Queue
  */
@@ -46,6 +67,12 @@ btc_workq_clear(btc_workq_t *queue);
 BTC_EXTERN void
 btc_workq_push(btc_workq_t *queue, btc_work_f *func, void *arg);
 
+BTC_EXTERN void
+btc_workq_append(btc_workq_t *queue,
+                 btc_work_t *work,
+                 btc_work_f *func,
+                 void *arg);
+
 /*
  * Workers
  */
@@ -56,6 +83,9 @@ btc_workers_create(int threads, int max_batch);
 BTC_EXTERN void
 btc_workers_destroy(btc_workers_t *pool);
 
+BTC_EXTERN int
+btc_workers_pin(btc_workers_t *pool, const int *cpus, size_t length);
+
 BTC_EXTERN void
 btc_workers_add(btc_workers_t *pool, btc_work_f *func, void *arg);
 
@@ -65,6 +95,56 @@ btc_workers_batch(btc_workers_t *pool, btc_workq_t *batch);
 BTC_EXTERN void
 btc_workers_wait(btc_workers_t *pool);
 
+BTC_EXTERN void
+btc_workers_notify(btc_workers_t *pool, struct btc_loop_s *loop);
+
+BTC_EXTERN int
+btc_workers_backlog(btc_workers_t *pool);
+
+BTC_EXTERN size_t
+btc_workers_queued(btc_workers_t *pool, int priority);
+
+/*
+ * Task Group
+ */
+
+BTC_EXTERN btc_taskgroup_t *
+btc_taskgroup_create(btc_workers_t *pool);
+
+BTC_EXTERN void
+btc_taskgroup_destroy(btc_taskgroup_t *group);
+
+BTC_EXTERN void
+btc_taskgroup_set_priority(btc_taskgroup_t *group, int priority);
+
+BTC_EXTERN void
+btc_taskgroup_add(btc_taskgroup_t *group, btc_work_f *func, void *arg);
+
+BTC_EXTERN void
+btc_taskgroup_batch(btc_taskgroup_t *group, btc_workq_t *batch);
+
+BTC_EXTERN void
+btc_taskgroup_wait(btc_taskgroup_t *group);
+
+/*
+ * Parallel For
+ */
+
+BTC_EXTERN void
+btc_parallel_for(btc_workers_t *pool,
+                 size_t length,
+                 size_t grain,
+                 btc_range_f *func,
+                 void *arg);
+
+BTC_EXTERN void
+btc_parallel_for_ex(btc_workers_t *pool,
+                    int priority,
+                    size_t length,
+                    size_t grain,
+                    btc_range_f *func,
+                    void *arg);
+
 #ifdef __cplusplus
 }
 #endif
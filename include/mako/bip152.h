@@ -72,6 +72,12 @@ btc_cmpct_setup(btc_cmpct_t *blk);
 BTC_EXTERN int
 btc_cmpct_fill_mempool(btc_cmpct_t *blk, btc_hashmapiter_t *iter, int witness);
 
+BTC_EXTERN int
+btc_cmpct_fill_wtxids(btc_cmpct_t *blk,
+                      const uint8_t *hashes,
+                      const btc_mpentry_t *const *entries,
+                      size_t count);
+
 BTC_EXTERN int
 btc_cmpct_fill_missing(btc_cmpct_t *blk, const btc_blocktxn_t *msg);
 
@@ -0,0 +1,50 @@
+/*!
+ * bip158.h - compact block filters for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_BIP158_H
+#define BTC_BIP158_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "common.h"
+
+/*
+ * Constants
+ */
+
+#define BTC_GCS_BASIC 0
+#define BTC_GCS_P 19
+#define BTC_GCS_M 784931
+
+/*
+ * Golomb-Coded Set
+ */
+
+BTC_EXTERN void
+btc_gcs_build(btc_buffer_t *z,
+              const btc_block_t *block,
+              const btc_undo_t *undo);
+
+BTC_EXTERN int
+btc_gcs_match(const uint8_t *data,
+              size_t length,
+              const uint8_t *block_hash,
+              const uint8_t *item,
+              size_t size);
+
+BTC_EXTERN void
+btc_gcs_header(uint8_t *out, const uint8_t *filter_hash, const uint8_t *prev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_BIP158_H */
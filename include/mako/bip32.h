@@ -147,6 +147,12 @@ btc_hdpub_derive(btc_hdnode_t *child,
                  const btc_hdnode_t *node,
                  uint32_t index);
 
+BTC_EXTERN int
+btc_hdpub_derive_range(btc_hdnode_t *children,
+                       const btc_hdnode_t *node,
+                       uint32_t start,
+                       size_t count);
+
 BTC_EXTERN int
 btc_hdpub_path(btc_hdnode_t *child,
                const btc_hdnode_t *node,
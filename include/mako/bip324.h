@@ -0,0 +1,109 @@
+/*!
+ * bip324.h - v2 transport for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_BIP324_H
+#define BTC_BIP324_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "crypto/types.h"
+
+/*
+ * Constants
+ */
+
+#define BTC_BIP324_KEY_SIZE 64
+#define BTC_BIP324_GARBAGE_MAX 4095
+#define BTC_BIP324_TERM_SIZE 16
+#define BTC_BIP324_LENGTH_SIZE 3
+#define BTC_BIP324_HEADER_SIZE 1
+#define BTC_BIP324_TAG_SIZE 16
+#define BTC_BIP324_IGNORE 0x80
+
+/* Length + header + tag. */
+#define BTC_BIP324_EXPANSION 20
+
+/*
+ * Types
+ */
+
+typedef struct btc_fschacha20_s {
+  btc_chacha20_t chacha;
+  uint32_t chunks;
+  uint64_t rekeys;
+} btc_fschacha20_t;
+
+typedef struct btc_fsaead_s {
+  uint8_t key[32];
+  uint32_t packets;
+  uint64_t rekeys;
+} btc_fsaead_t;
+
+typedef struct btc_bip324_s {
+  uint32_t magic;
+  int initiator;
+  uint8_t priv[32];
+  uint8_t ours[BTC_BIP324_KEY_SIZE];
+  btc_fschacha20_t send_len;
+  btc_fschacha20_t recv_len;
+  btc_fsaead_t send_aead;
+  btc_fsaead_t recv_aead;
+  uint8_t send_term[BTC_BIP324_TERM_SIZE];
+  uint8_t recv_term[BTC_BIP324_TERM_SIZE];
+  uint8_t session_id[32];
+} btc_bip324_t;
+
+/*
+ * BIP324
+ */
+
+BTC_EXTERN void
+btc_bip324_init(btc_bip324_t *ctx,
+                uint32_t magic,
+                int initiator,
+                const uint8_t *entropy);
+
+BTC_EXTERN int
+btc_bip324_derive(btc_bip324_t *ctx, const uint8_t *theirs);
+
+BTC_EXTERN size_t
+btc_bip324_seal(btc_bip324_t *ctx,
+                uint8_t *packet,
+                size_t len,
+                const uint8_t *aad,
+                size_t aad_len,
+                int ignore);
+
+BTC_EXTERN size_t
+btc_bip324_length(btc_bip324_t *ctx, const uint8_t *raw);
+
+BTC_EXTERN int
+btc_bip324_open(btc_bip324_t *ctx,
+                uint8_t *dst,
+                const uint8_t *src,
+                size_t len,
+                const uint8_t *aad,
+                size_t aad_len);
+
+BTC_EXTERN size_t
+btc_bip324_type_size(const char *cmd);
+
+BTC_EXTERN uint8_t *
+btc_bip324_type_write(uint8_t *zp, const char *cmd);
+
+BTC_EXTERN int
+btc_bip324_type_read(char *cmd, const uint8_t **xp, size_t *xn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_BIP324_H */
@@ -30,6 +30,13 @@ typedef struct btc_merkleblock_s {
   btc_array_t indices;
 } btc_merkleblock_t;
 
+typedef struct btc_merkletree_s {
+  uint8_t *nodes;
+  uint32_t total;
+  int32_t height;
+  size_t offsets[33];
+} btc_merkletree_t;
+
 /*
  * Merkle Block
  */
@@ -57,6 +64,12 @@ btc_merkleblock_read(btc_merkleblock_t *z, const uint8_t **xp, size_t *xn);
 BTC_EXTERN int
 btc_merkleblock_verify(btc_merkleblock_t *block);
 
+BTC_EXTERN btc_vector_t *
+btc_merkleblock_set_tree(btc_merkleblock_t *tree,
+                         const btc_block_t *block,
+                         const btc_merkletree_t *nodes,
+                         btc_bloom_t *filter);
+
 BTC_EXTERN btc_vector_t *
 btc_merkleblock_set_block(btc_merkleblock_t *tree,
                           const btc_block_t *block,
@@ -67,6 +80,24 @@ btc_merkleblock_set_hashes(btc_merkleblock_t *tree,
                            const btc_block_t *block,
                            const btc_vector_t *hashes);
 
+/*
+ * Merkle Tree
+ */
+
+BTC_EXTERN btc_merkletree_t *
+btc_merkletree_create(const btc_block_t *block);
+
+BTC_EXTERN void
+btc_merkletree_destroy(btc_merkletree_t *tree);
+
+BTC_EXTERN const uint8_t *
+btc_merkletree_node(const btc_merkletree_t *tree,
+                    int32_t height,
+                    uint32_t pos);
+
+BTC_EXTERN const uint8_t *
+btc_merkletree_root(const btc_merkletree_t *tree);
+
 #ifdef __cplusplus
 }
 #endif
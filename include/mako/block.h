@@ -32,6 +32,9 @@ btc_block_clear(btc_block_t *z);
 BTC_EXTERN void
 btc_block_copy(btc_block_t *z, const btc_block_t *x);
 
+BTC_EXTERN void
+btc_block_uncache(btc_block_t *z);
+
 BTC_EXTERN int
 btc_block_has_witness(const btc_block_t *blk);
 
@@ -53,6 +56,13 @@ btc_block_get_commitment_hash(const btc_block_t *blk);
 BTC_EXTERN int
 btc_block_check_body(btc_verify_error_t *err, const btc_block_t *blk);
 
+BTC_EXTERN int
+btc_block_check_body_ex(btc_verify_error_t *err,
+                        const btc_block_t *blk,
+                        const uint8_t *root,
+                        int mutated,
+                        size_t sane);
+
 BTC_EXTERN int32_t
 btc_block_coinbase_height(const btc_block_t *blk);
 
@@ -88,6 +98,13 @@ btc_block_inspect(const btc_block_t *block,
                   const btc_view_t *view,
                   const btc_network_t *network);
 
+BTC_EXTERN int
+btc_block_scan(const uint8_t *xp,
+               size_t xn,
+               btc_rawin_f *on_input,
+               btc_rawout_f *on_output,
+               void *arg);
+
 #ifdef __cplusplus
 }
 #endif
@@ -53,6 +53,9 @@ btc_buffer_rocopy(btc_buffer_t *z, const btc_buffer_t *x);
 BTC_EXTERN void
 btc_buffer_rwset(btc_buffer_t *z, uint8_t *zp, size_t zn);
 
+BTC_EXTERN size_t
+btc_buffer_usage(const btc_buffer_t *x);
+
 BTC_EXTERN int
 btc_buffer_equal(const btc_buffer_t *x, const btc_buffer_t *y);
 
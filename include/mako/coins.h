@@ -25,13 +25,9 @@ typedef btc_coin_t *btc_coin_read_cb(const btc_outpoint_t *prevout,
                                      void *arg1,
                                      void *arg2);
 
-struct btc_coins_s;
-
 typedef struct btc_viewiter_s {
   const struct btc_view_s *view;
-  unsigned int itv;
-  unsigned int itc;
-  struct btc_coins_s *coins;
+  size_t pos;
   const uint8_t *hash;
   uint32_t index;
 } btc_viewiter_t;
@@ -69,6 +65,18 @@ btc_coin_inspect(const btc_coin_t *coin, const btc_network_t *network);
 
 BTC_DEFINE_SERIALIZABLE_VECTOR(btc_undo, btc_coin, BTC_EXTERN)
 
+BTC_EXTERN size_t
+btc_undo_deflate(const btc_undo_t *x, int32_t height);
+
+BTC_EXTERN uint8_t *
+btc_undo_compress(uint8_t *zp, const btc_undo_t *x, int32_t height);
+
+BTC_EXTERN int
+btc_undo_decompress(btc_undo_t *z,
+                    const uint8_t **xp,
+                    size_t *xn,
+                    int32_t height);
+
 /*
  * Coin View
  */
@@ -12,6 +12,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include "common.h"
 #include "types.h"
 
@@ -23,12 +24,44 @@ struct btc_conf_s {
   const btc_network_t *network;
   char prefix[1024];
   int daemon;
+  int log_level;
+  char debug[256];
   int network_active;
   int disable_wallet;
   int checkpoints;
+  int assume_valid;
+  uint8_t assume_hash[32];
+  int assume_height;
+  char snapshot[1024];
+  char headers_file[1024];
+  char capture_file[1024];
+  int reindex;
+  char replay[1024];
+  int replay_scripts;
+  int readonly;
   int prune;
   int workers;
+  int loop_cpu;
+  int worker_cpus[256];
+  size_t worker_cpus_len;
+  int miner_cpus[256];
+  size_t miner_cpus_len;
+  int db_cache;
+  int db_mmap;
+  int db_worker;
+  int db_hugepages;
+  int db_shared;
+  int db_profile;
+  int db_autoflush;
+  int db_checkpoint;
+  int db_automerge;
+  int db_blockcache;
+  int db_buffer;
+  int db_map_coins;
+  int persist_mempool;
   int listen;
+  int net_threads;
+  int busy_poll;
   int port;
   btc_netaddr_t bind;
   btc_netaddr_t external;
@@ -38,6 +71,8 @@ struct btc_conf_s {
   int max_connections;
   int max_inbound;
   int max_outbound;
+  int max_upload;
+  int block_buffer;
   int ban_time;
   int discover;
   int upnp;
@@ -46,12 +81,30 @@ struct btc_conf_s {
   int bip37;
   int bip152;
   int bip157;
+  int bip330;
+  int filter_index;
+  int txindex;
+  int coinstats_index;
+  int coin_groups;
+  int addr_index;
   enum btc_ipnet only_net;
+  int v2transport;
+  int udp_port;
+  btc_netaddr_t udp_peers[8];
+  size_t udp_peers_len;
   int rpc_port;
   btc_netaddr_t rpc_bind;
+  int rpc_threads;
+  int rest;
+  int metrics;
+  btc_netaddr_t notify_bind;
+  btc_netaddr_t stratum_bind;
+  int stratum_diff;
   char rpc_connect[64];
   char rpc_user[64];
   char rpc_pass[64];
+  int rpc_stdin;
+  int rpc_batch;
   int version;
   int help;
   const char *method;
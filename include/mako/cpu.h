@@ -0,0 +1,88 @@
+/*!
+ * cpu.h - cpu features for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_CPU_H
+#define BTC_CPU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "common.h"
+
+/*
+ * Constants
+ */
+
+enum btc_cpu_feature {
+  BTC_CPU_SSSE3 = 1 << 0,
+  BTC_CPU_SSE41 = 1 << 1,
+  BTC_CPU_AVX2 = 1 << 2,
+  BTC_CPU_SHANI = 1 << 3,
+  BTC_CPU_BMI2 = 1 << 4,
+  BTC_CPU_ADX = 1 << 5,
+  BTC_CPU_NEON = 1 << 6,
+  BTC_CPU_SHA2 = 1 << 7
+};
+
+/*
+ * CPU
+ */
+
+/* Enabled features, -1 until the first probe. */
+BTC_EXTERN extern volatile int btc_cpu_enabled;
+
+/* For the dispatchers: a load rather than a call. */
+#define BTC_CPU_FEATURES()                     \
+  (btc_cpu_enabled >= 0 ? (unsigned int)btc_cpu_enabled \
+                        : btc_cpu_features())
+
+BTC_EXTERN unsigned int
+btc_cpu_features(void);
+
+BTC_EXTERN unsigned int
+btc_cpu_detected(void);
+
+BTC_EXTERN void
+btc_cpu_disable(unsigned int features);
+
+BTC_EXTERN const char *
+btc_cpu_feature_name(size_t index);
+
+/*
+ * Backends
+ */
+
+BTC_EXTERN const char *
+btc_cpu_backend_name(size_t index);
+
+BTC_EXTERN const char *
+btc_cpu_backend(size_t index);
+
+BTC_EXTERN const char *
+btc_sha256_backend(void);
+
+BTC_EXTERN const char *
+btc_sha256_many_backend(void);
+
+BTC_EXTERN const char *
+btc_sha512_pbkdf2_backend(void);
+
+BTC_EXTERN const char *
+btc_ripemd160_many_backend(void);
+
+BTC_EXTERN const char *
+btc_mpn_mul_backend(void);
+
+BTC_EXTERN const char *
+btc_base16_backend(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_CPU_H */
@@ -20,6 +20,7 @@ extern "C" {
  */
 
 typedef struct wei_scratch_s btc_scratch_t;
+typedef struct wei_precomp_s btc_precomp_t;
 typedef void btc_redefine_f(void *, size_t);
 
 /*
@@ -32,6 +33,19 @@ btc_scratch_create(size_t size);
 BTC_EXTERN void
 btc_scratch_destroy(btc_scratch_t *scratch);
 
+/*
+ * Precomputation API
+ */
+
+BTC_EXTERN btc_precomp_t *
+btc_precomp_create(const unsigned char *entropy);
+
+BTC_EXTERN void
+btc_precomp_destroy(btc_precomp_t *pre);
+
+BTC_EXTERN void
+btc_precomp_randomize(btc_precomp_t *pre, const unsigned char *entropy);
+
 /*
  * ECDSA
  */
@@ -101,6 +115,14 @@ btc_ecdsa_pubkey_tweak_add(unsigned char *out,
                            const unsigned char *tweak,
                            int compact);
 
+BTC_EXTERN int
+btc_ecdsa_pubkey_tweak_add_batch(unsigned char *const *outs,
+                                 const unsigned char *pub,
+                                 size_t pub_len,
+                                 const unsigned char *const *tweaks,
+                                 size_t len,
+                                 int compact);
+
 BTC_EXTERN int
 btc_ecdsa_pubkey_tweak_mul(unsigned char *out,
                            const unsigned char *pub,
@@ -157,6 +179,14 @@ btc_ecdsa_sign(unsigned char *sig,
                size_t msg_len,
                const unsigned char *priv);
 
+BTC_EXTERN int
+btc_ecdsa_sign_precomp(unsigned char *sig,
+                       unsigned int *param,
+                       const unsigned char *msg,
+                       size_t msg_len,
+                       const unsigned char *priv,
+                       const btc_precomp_t *pre);
+
 BTC_EXTERN int
 btc_ecdsa_sign_internal(unsigned char *sig,
                         unsigned int *param,
@@ -172,6 +202,14 @@ btc_ecdsa_verify(const unsigned char *msg,
                  const unsigned char *pub,
                  size_t pub_len);
 
+BTC_EXTERN int
+btc_ecdsa_verify_batch(const unsigned char *const *msgs,
+                       const size_t *msg_lens,
+                       const unsigned char *const *sigs,
+                       const unsigned char *const *pubs,
+                       const size_t *pub_lens,
+                       size_t len);
+
 BTC_EXTERN int
 btc_ecdsa_recover(unsigned char *pub,
                   const unsigned char *msg,
@@ -292,6 +330,26 @@ btc_bip340_derive(unsigned char *secret,
                   const unsigned char *pub,
                   const unsigned char *priv);
 
+/*
+ * ElligatorSwift
+ */
+
+BTC_EXTERN int
+btc_ellswift_create(unsigned char *out,
+                    const unsigned char *priv,
+                    const unsigned char *entropy);
+
+BTC_EXTERN int
+btc_ellswift_derive(unsigned char *secret,
+                    const unsigned char *pub,
+                    const unsigned char *priv);
+
+BTC_EXTERN int
+btc_ellswift_invert(unsigned char *out,
+                    const unsigned char *x,
+                    const unsigned char *u,
+                    unsigned int hint);
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,9 @@ btc_hash160_final(btc_hash160_t *ctx, uint8_t *out);
 BTC_EXTERN void
 btc_hash160(uint8_t *out, const void *data, size_t size);
 
+BTC_EXTERN void
+btc_hash160_many(uint8_t *out, const uint8_t *in, size_t len, size_t count);
+
 /*
  * Hash256
  */
@@ -64,6 +67,9 @@ btc_ripemd160_final(btc_ripemd160_t *ctx, uint8_t *out);
 BTC_EXTERN void
 btc_ripemd160(uint8_t *out, const void *data, size_t size);
 
+BTC_EXTERN void
+btc_ripemd160_many(uint8_t *out, const uint8_t *in, size_t len, size_t count);
+
 /*
  * SHA1
  */
@@ -96,6 +102,19 @@ btc_sha256_final(btc_sha256_t *ctx, uint8_t *out);
 BTC_EXTERN void
 btc_sha256(uint8_t *out, const void *data, size_t size);
 
+BTC_EXTERN void
+btc_sha256d64(uint8_t *out, const uint8_t *in, size_t blocks);
+
+BTC_EXTERN void
+btc_sha256_many(uint8_t *out, const uint8_t *in, size_t len, size_t count);
+
+BTC_EXTERN int
+btc_sha256d80_scan(uint8_t *out,
+                   uint32_t *nonce,
+                   uint32_t count,
+                   const btc_sha256_t *ctx,
+                   uint32_t hi);
+
 /*
  * SHA512
  */
@@ -112,6 +131,12 @@ btc_sha512_final(btc_sha512_t *ctx, uint8_t *out);
 BTC_EXTERN void
 btc_sha512(uint8_t *out, const void *data, size_t size);
 
+BTC_EXTERN void
+btc_sha512_pbkdf2(uint8_t *blocks,
+                  const btc_hmac512_t *hmac,
+                  size_t count,
+                  uint32_t iter);
+
 /*
  * HMAC256
  */
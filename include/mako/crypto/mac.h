@@ -0,0 +1,70 @@
+/*!
+ * mac.h - message authentication codes for mako
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_MAC_H
+#define BTC_MAC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../common.h"
+#include "types.h"
+
+/*
+ * Poly1305
+ */
+
+BTC_EXTERN void
+btc_poly1305_init(btc_poly1305_t *ctx, const uint8_t *key);
+
+BTC_EXTERN void
+btc_poly1305_update(btc_poly1305_t *ctx, const uint8_t *data, size_t len);
+
+BTC_EXTERN void
+btc_poly1305_pad(btc_poly1305_t *ctx);
+
+BTC_EXTERN void
+btc_poly1305_final(btc_poly1305_t *ctx, uint8_t *mac);
+
+/*
+ * ChaCha20-Poly1305
+ */
+
+BTC_EXTERN void
+btc_aead_init(btc_aead_t *ctx, const uint8_t *key, const uint8_t *nonce);
+
+BTC_EXTERN void
+btc_aead_aad(btc_aead_t *ctx, const uint8_t *aad, size_t len);
+
+BTC_EXTERN void
+btc_aead_encrypt(btc_aead_t *ctx,
+                 uint8_t *dst,
+                 const uint8_t *src,
+                 size_t len);
+
+BTC_EXTERN void
+btc_aead_decrypt(btc_aead_t *ctx,
+                 uint8_t *dst,
+                 const uint8_t *src,
+                 size_t len);
+
+BTC_EXTERN void
+btc_aead_auth(btc_aead_t *ctx, const uint8_t *data, size_t len);
+
+BTC_EXTERN void
+btc_aead_final(btc_aead_t *ctx, uint8_t *tag);
+
+BTC_EXTERN int
+btc_aead_verify(const uint8_t *mac1, const uint8_t *mac2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_MAC_H */
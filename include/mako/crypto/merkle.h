@@ -19,6 +19,9 @@ extern "C" {
  * Merkle
  */
 
+BTC_EXTERN int
+btc_merkle_level(uint8_t *out, const uint8_t *nodes, size_t size);
+
 BTC_EXTERN int
 btc_merkle_root(uint8_t *root, uint8_t *nodes, size_t size);
 
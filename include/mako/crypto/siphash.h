@@ -22,6 +22,12 @@ extern "C" {
 BTC_EXTERN uint64_t
 btc_siphash_sum(const uint8_t *data, size_t size, const uint8_t *key);
 
+BTC_EXTERN void
+btc_siphash_batch(uint64_t *out,
+                  const uint8_t *data,
+                  size_t count,
+                  const uint8_t *key);
+
 BTC_EXTERN uint64_t
 btc_siphash_mod(const uint8_t *data,
                 size_t size,
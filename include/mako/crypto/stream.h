@@ -34,6 +34,9 @@ btc_chacha20_crypt(btc_chacha20_t *ctx,
                    const uint8_t *src,
                    size_t len);
 
+BTC_EXTERN void
+btc_chacha20_keystream(btc_chacha20_t *ctx, uint8_t *dst, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
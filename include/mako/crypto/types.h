@@ -20,6 +20,21 @@ typedef struct btc_chacha20_s {
   size_t pos;
 } btc_chacha20_t;
 
+typedef struct btc_poly1305_s {
+  uint64_t r[5];
+  uint64_t h[5];
+  uint64_t pad[4];
+  uint8_t block[16];
+  size_t pos;
+} btc_poly1305_t;
+
+typedef struct btc_aead_s {
+  btc_chacha20_t chacha;
+  btc_poly1305_t poly;
+  uint64_t adlen;
+  uint64_t ctlen;
+} btc_aead_t;
+
 typedef struct btc_ripemd160_s {
   uint32_t state[5];
   uint8_t block[64];
@@ -21,7 +21,7 @@ extern "C" {
  * Constants
  */
 
-#define BTC_ENTRY_SIZE 132
+#define BTC_ENTRY_SIZE 152
 
 /*
  * Chain Entry
@@ -62,6 +62,12 @@ btc_entry_set_block(btc_entry_t *entry,
                     const btc_block_t *block,
                     const btc_entry_t *prev);
 
+BTC_EXTERN const btc_entry_t *
+btc_entry_get_ancestor(const btc_entry_t *entry, int32_t height);
+
+BTC_EXTERN void
+btc_entry_build_skip(btc_entry_t *entry);
+
 BTC_EXTERN int64_t
 btc_entry_median_time(const btc_entry_t *entry);
 
@@ -0,0 +1,43 @@
+/*!
+ * fec.h - erasure coding for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_FEC_H
+#define BTC_FEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Constants
+ */
+
+/* Data and parity shards per codeword. */
+#define BTC_FEC_MAX_SHARDS 255
+
+/*
+ * FEC
+ */
+
+BTC_EXTERN void
+btc_fec_encode(uint8_t *const *shards, size_t k, size_t m, size_t size);
+
+BTC_EXTERN int
+btc_fec_decode(uint8_t *const *shards,
+               const uint8_t *present,
+               size_t k,
+               size_t m,
+               size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_FEC_H */
@@ -57,11 +57,51 @@
 #define json_header_raw btc_json_header_raw
 #define json_block_base btc_json_block_base
 #define json_block_raw btc_json_block_raw
+#define json_writer_init btc_json_writer_init
+#define json_writer_clear btc_json_writer_clear
+#define json_writer_flush btc_json_writer_flush
+#define json_writer_object_begin btc_json_writer_object_begin
+#define json_writer_object_end btc_json_writer_object_end
+#define json_writer_array_begin btc_json_writer_array_begin
+#define json_writer_array_end btc_json_writer_array_end
+#define json_writer_key btc_json_writer_key
+#define json_writer_value btc_json_writer_value
+#define json_writer_string btc_json_writer_string
+#define json_writer_integer btc_json_writer_integer
+#define json_writer_amount btc_json_writer_amount
+#define json_writer_double btc_json_writer_double
+#define json_writer_boolean btc_json_writer_boolean
+#define json_writer_null btc_json_writer_null
+#define json_writer_hash btc_json_writer_hash
+#define json_writer_buffer btc_json_writer_buffer
+#define json_tx_write btc_json_tx_write
+#define json_block_write_begin btc_json_block_write_begin
+#define json_block_write_end btc_json_block_write_end
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * JSON Writer
+ */
+
+#define JSON_WRITER_CHUNK (64 << 10)
+#define JSON_WRITER_DEPTH 32
+
+typedef void json_writer_sink(void *arg, const char *data, size_t length);
+
+typedef struct json_writer {
+  char *data;
+  size_t alloc;
+  size_t length;
+  json_writer_sink *sink;
+  void *arg;
+  unsigned int depth;
+  unsigned char count[JSON_WRITER_DEPTH];
+  int keyed;
+} json_writer;
+
 /*
  * JSON Extras
  */
@@ -225,6 +265,81 @@ json_block_base(const btc_block_t *block);
 BTC_EXTERN json_value *
 json_block_raw(const btc_block_t *block);
 
+/*
+ * JSON Writer
+ */
+
+BTC_EXTERN void
+json_writer_init(json_writer *w, json_writer_sink *sink, void *arg);
+
+BTC_EXTERN void
+json_writer_clear(json_writer *w);
+
+BTC_EXTERN void
+json_writer_flush(json_writer *w);
+
+BTC_EXTERN void
+json_writer_object_begin(json_writer *w);
+
+BTC_EXTERN void
+json_writer_object_end(json_writer *w);
+
+BTC_EXTERN void
+json_writer_array_begin(json_writer *w);
+
+BTC_EXTERN void
+json_writer_array_end(json_writer *w);
+
+BTC_EXTERN void
+json_writer_key(json_writer *w, const char *name);
+
+BTC_EXTERN void
+json_writer_value(json_writer *w, json_value *value);
+
+BTC_EXTERN void
+json_writer_string(json_writer *w, const char *str);
+
+BTC_EXTERN void
+json_writer_integer(json_writer *w, int64_t x);
+
+BTC_EXTERN void
+json_writer_amount(json_writer *w, int64_t x);
+
+BTC_EXTERN void
+json_writer_double(json_writer *w, double x);
+
+BTC_EXTERN void
+json_writer_boolean(json_writer *w, int x);
+
+BTC_EXTERN void
+json_writer_null(json_writer *w);
+
+BTC_EXTERN void
+json_writer_hash(json_writer *w, const uint8_t *hash);
+
+BTC_EXTERN void
+json_writer_buffer(json_writer *w, const btc_buffer_t *item);
+
+/*
+ * JSON Streams
+ */
+
+BTC_EXTERN void
+json_tx_write(json_writer *w,
+              const btc_tx_t *tx,
+              const btc_view_t *view,
+              const btc_network_t *network);
+
+BTC_EXTERN void
+json_block_write_begin(json_writer *w,
+                       const btc_block_t *block,
+                       const btc_entry_t *entry,
+                       int confirmations,
+                       const uint8_t *next);
+
+BTC_EXTERN void
+json_block_write_end(json_writer *w);
+
 #ifdef __cplusplus
 }
 #endif
@@ -62,6 +62,8 @@
 #define json_parse_ex btc_json_parse_ex
 #define json_value_free btc_json_value_free
 #define json_value_free_ex btc_json_value_free_ex
+#define json_parse_insitu btc_json_parse_insitu
+#define json_arena_free btc_json_arena_free
 
 typedef struct
 {
@@ -290,6 +292,30 @@ void json_value_free_ex (json_settings * settings,
                          json_value *);
 
 
+/* In-place parsing: every allocation is carved from an arena sized
+ * from the input, and strings without escapes point into `json`
+ * (their closing quotes are overwritten with nulls). The input must
+ * be writable and outlive the result. The tree is released with
+ * json_arena_free, never json_value_free, whether or not parsing
+ * succeeded. mem_alloc, mem_free and user_data are ignored.
+ */
+typedef struct _json_arena
+{
+   void * head;
+   size_t size;
+} json_arena;
+
+BTC_EXTERN
+json_value * json_parse_insitu (json_settings * settings,
+                                json_arena * arena,
+                                json_char * json,
+                                size_t length,
+                                char * error);
+
+BTC_EXTERN
+void json_arena_free (json_arena * arena);
+
+
 #ifdef __cplusplus
    } /* extern "C" */
 #endif
@@ -112,6 +112,53 @@ BTC_DEFINE_MAP(btc_outmap, btc_outpoint_t *, void *, BTC_EXTERN);
 BTC_DEFINE_MAP(btc_netmap, btc_netaddr_t *, void *, BTC_EXTERN);
 BTC_DEFINE_MAP(btc_addrmap, btc_address_t *, void *, BTC_EXTERN);
 
+/*
+ * Prevout Map (Outpoint->Pointer)
+ */
+
+/* Like btc_outmap, but the outpoints are stored
+   inline: keys need not outlive the map, and the
+   outputs of one tx are kept close together. */
+
+BTC_EXTERN btc_prevmap_t *
+btc_prevmap_create(void);
+
+BTC_EXTERN void
+btc_prevmap_destroy(btc_prevmap_t *map);
+
+BTC_EXTERN void
+btc_prevmap_reset(btc_prevmap_t *map);
+
+BTC_EXTERN void
+btc_prevmap_resize(btc_prevmap_t *map, size_t size);
+
+BTC_EXTERN size_t
+btc_prevmap_size(const btc_prevmap_t *map);
+
+BTC_EXTERN size_t
+btc_prevmap_buckets(const btc_prevmap_t *map);
+
+BTC_EXTERN int
+btc_prevmap_has(const btc_prevmap_t *map, const btc_outpoint_t *key);
+
+BTC_EXTERN void *
+btc_prevmap_get(const btc_prevmap_t *map, const btc_outpoint_t *key);
+
+BTC_EXTERN int
+btc_prevmap_put(btc_prevmap_t *map, const btc_outpoint_t *key, void *val);
+
+BTC_EXTERN int
+btc_prevmap_del(btc_prevmap_t *map, const btc_outpoint_t *key);
+
+BTC_EXTERN void *
+btc_prevmap_rem(btc_prevmap_t *map, const btc_outpoint_t *key);
+
+BTC_EXTERN void
+btc_prevmap_iterate(btc_prevmapiter_t *iter, const btc_prevmap_t *map);
+
+BTC_EXTERN int
+btc_prevmap_next(btc_prevmapiter_t *iter);
+
 /*
  * Tables (Key->Integer)
  */
@@ -0,0 +1,66 @@
+/*!
+ * minisketch.h - set sketches for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_MINISKETCH_H
+#define BTC_MINISKETCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Constants
+ */
+
+/* Largest difference we are willing to decode. */
+#define BTC_MINISKETCH_MAX 256
+
+/*
+ * Types
+ */
+
+typedef struct btc_minisketch_s {
+  uint32_t *items;
+  size_t capacity;
+} btc_minisketch_t;
+
+/*
+ * Minisketch
+ */
+
+BTC_EXTERN void
+btc_minisketch_init(btc_minisketch_t *z, size_t capacity);
+
+BTC_EXTERN void
+btc_minisketch_clear(btc_minisketch_t *z);
+
+BTC_EXTERN void
+btc_minisketch_add(btc_minisketch_t *z, uint32_t element);
+
+BTC_EXTERN void
+btc_minisketch_merge(btc_minisketch_t *z, const btc_minisketch_t *x);
+
+BTC_EXTERN size_t
+btc_minisketch_size(const btc_minisketch_t *x);
+
+BTC_EXTERN uint8_t *
+btc_minisketch_write(uint8_t *zp, const btc_minisketch_t *x);
+
+BTC_EXTERN int
+btc_minisketch_import(btc_minisketch_t *z, const uint8_t *xp, size_t xn);
+
+BTC_EXTERN int
+btc_minisketch_decode(uint32_t *out, size_t *len, const btc_minisketch_t *x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_MINISKETCH_H */
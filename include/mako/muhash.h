@@ -0,0 +1,56 @@
+/*!
+ * muhash.h - muhash3072 for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_MUHASH_H
+#define BTC_MUHASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Constants
+ */
+
+#define BTC_MUHASH_SIZE 384
+
+/*
+ * Types
+ */
+
+typedef struct btc_muhash_s {
+  uint8_t num[BTC_MUHASH_SIZE];
+  uint8_t den[BTC_MUHASH_SIZE];
+} btc_muhash_t;
+
+/*
+ * MuHash3072
+ */
+
+BTC_EXTERN void
+btc_muhash_init(btc_muhash_t *ctx);
+
+BTC_EXTERN void
+btc_muhash_insert(btc_muhash_t *ctx, const void *data, size_t len);
+
+BTC_EXTERN void
+btc_muhash_remove(btc_muhash_t *ctx, const void *data, size_t len);
+
+BTC_EXTERN void
+btc_muhash_combine(btc_muhash_t *z, const btc_muhash_t *x);
+
+BTC_EXTERN void
+btc_muhash_final(const btc_muhash_t *ctx, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_MUHASH_H */
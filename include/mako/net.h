@@ -15,7 +15,7 @@ extern "C" {
  * Default protocol version.
  */
 
-#define BTC_NET_PROTOCOL_VERSION 70015
+#define BTC_NET_PROTOCOL_VERSION 70016
 
 /**
  * Minimum protocol version we're willing to talk to.
@@ -47,6 +47,12 @@ extern "C" {
 
 #define BTC_NET_SENDHEADERS_VERSION 7012
 
+/**
+ * Minimum version for bip133.
+ */
+
+#define BTC_NET_FEEFILTER_VERSION 70013
+
 /**
  * Minimum version for bip152.
  */
@@ -59,6 +65,12 @@ extern "C" {
 
 #define BTC_NET_COMPACT_WITNESS_VERSION 70015
 
+/**
+ * Minimum version for bip339.
+ */
+
+#define BTC_NET_WTXID_VERSION 70016
+
 /**
  * Service bits.
  */
@@ -88,6 +100,24 @@ enum btc_net_services {
 
   BTC_NET_SERVICE_WITNESS = 1 << 3,
 
+  /**
+   * Whether the peer serves BIP157 block filters.
+   */
+
+  BTC_NET_SERVICE_COMPACT_FILTERS = 1 << 6,
+
+  /**
+   * Whether the peer serves (at least) the last 288 blocks.
+   */
+
+  BTC_NET_SERVICE_NETWORK_LIMITED = 1 << 10,
+
+  /**
+   * Whether the peer speaks the encrypted v2 transport (BIP324).
+   */
+
+  BTC_NET_SERVICE_P2P_V2 = 1 << 11,
+
   /**
    * Default services.
    */
@@ -157,6 +187,24 @@ enum btc_net_services {
 
 #define BTC_NET_MAX_TX_REQUEST 10000
 
+/**
+ * Maximum number of filters per getcfilters (BIP157).
+ */
+
+#define BTC_NET_MAX_CFILTERS 1000
+
+/**
+ * Maximum number of filter hashes per cfheaders (BIP157).
+ */
+
+#define BTC_NET_MAX_CFHEADERS 2000
+
+/**
+ * Interval between filter header checkpoints (BIP157).
+ */
+
+#define BTC_NET_CFCHECKPT_INTERVAL 1000
+
 #ifdef __cplusplus
 }
 #endif
@@ -167,6 +167,9 @@ btc_netaddr_set_str(btc_netaddr_t *z, const char *xp);
 BTC_EXTERN size_t
 btc_netaddr_get_str(char *zp, const btc_netaddr_t *x);
 
+BTC_EXTERN size_t
+btc_netaddr_get_host(char *zp, const btc_netaddr_t *x);
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,9 @@ enum btc_msgtype {
   BTC_MSG_ADDR,
   BTC_MSG_BLOCK,
   BTC_MSG_BLOCKTXN,
+  BTC_MSG_CFCHECKPT,
+  BTC_MSG_CFHEADERS,
+  BTC_MSG_CFILTER,
   BTC_MSG_CMPCTBLOCK,
   BTC_MSG_FEEFILTER,
   BTC_MSG_FILTERADD,
@@ -33,6 +36,9 @@ enum btc_msgtype {
   BTC_MSG_GETADDR,
   BTC_MSG_GETBLOCKS,
   BTC_MSG_GETBLOCKTXN,
+  BTC_MSG_GETCFCHECKPT,
+  BTC_MSG_GETCFHEADERS,
+  BTC_MSG_GETCFILTERS,
   BTC_MSG_GETDATA,
   BTC_MSG_GETHEADERS,
   BTC_MSG_HEADERS,
@@ -42,12 +48,17 @@ enum btc_msgtype {
   BTC_MSG_NOTFOUND,
   BTC_MSG_PING,
   BTC_MSG_PONG,
+  BTC_MSG_RECONCILDIFF,
   BTC_MSG_REJECT,
+  BTC_MSG_REQRECON,
   BTC_MSG_SENDCMPCT,
   BTC_MSG_SENDHEADERS,
+  BTC_MSG_SENDTXRCNCL,
+  BTC_MSG_SKETCH,
   BTC_MSG_TX,
   BTC_MSG_VERACK,
   BTC_MSG_VERSION,
+  BTC_MSG_WTXIDRELAY,
   /* Internal */
   BTC_MSG_BLOCKTXN_BASE,
   BTC_MSG_BLOCK_BASE,
@@ -137,6 +148,7 @@ typedef struct btc_zinv_s {
   btc_zinvitem_t *items;
   size_t alloc;
   size_t length;
+  const uint8_t *raw; /* serialized items (read only) */
 } btc_zinv_t;
 
 typedef struct btc_getblocks_s {
@@ -172,15 +184,82 @@ typedef struct btc_sendcmpct_s {
   uint64_t version;
 } btc_sendcmpct_t;
 
+typedef struct btc_sendtxrcncl_s {
+  uint32_t version;
+  uint64_t salt;
+} btc_sendtxrcncl_t;
+
+typedef struct btc_reqrecon_s {
+  uint16_t set_size;
+  uint16_t q;
+} btc_reqrecon_t;
+
+typedef struct btc_sketch_s {
+  uint8_t *data;
+  size_t length;
+} btc_sketch_t;
+
+typedef struct btc_reconcildiff_s {
+  uint8_t success;
+  uint32_t *ids;
+  size_t length;
+} btc_reconcildiff_t;
+
+typedef struct btc_getcfilters_s {
+  uint8_t filter_type;
+  uint32_t start_height;
+  uint8_t stop_hash[32];
+} btc_getcfilters_t;
+
+typedef btc_getcfilters_t btc_getcfheaders_t;
+
+typedef struct btc_cfilter_s {
+  uint8_t filter_type;
+  uint8_t block_hash[32];
+  btc_buffer_t filter;
+} btc_cfilter_t;
+
+typedef struct btc_cfheaders_s {
+  uint8_t filter_type;
+  uint8_t stop_hash[32];
+  uint8_t prev_header[32];
+  uint8_t *hashes;
+  size_t length;
+} btc_cfheaders_t;
+
+typedef struct btc_getcfcheckpt_s {
+  uint8_t filter_type;
+  uint8_t stop_hash[32];
+} btc_getcfcheckpt_t;
+
+typedef struct btc_cfcheckpt_s {
+  uint8_t filter_type;
+  uint8_t stop_hash[32];
+  uint8_t *headers;
+  size_t length;
+} btc_cfcheckpt_t;
+
 typedef struct btc_unknown_s {
   uint8_t *data;
   size_t length;
 } btc_unknown_t;
 
+/* Small bodies (and inv views) are decoded into
+   the message itself rather than the heap. */
+typedef union btc_msgbody_u {
+  btc_ping_t ping;
+  btc_feefilter_t feefilter;
+  btc_sendcmpct_t sendcmpct;
+  btc_sendtxrcncl_t sendtxrcncl;
+  btc_reqrecon_t reqrecon;
+  btc_zinv_t zinv;
+} btc_msgbody_t;
+
 typedef struct btc_msg_s {
   enum btc_msgtype type;
-  char cmd[12];
+  char cmd[12 + 1];
   void *body;
+  btc_msgbody_t local;
 } btc_msg_t;
 
 /*
@@ -342,6 +421,9 @@ btc_zinv_push(btc_zinv_t *z, uint32_t type, const uint8_t *hash);
 BTC_EXTERN btc_invitem_t *
 btc_zinv_get(const btc_zinv_t *z, size_t index);
 
+BTC_EXTERN void
+btc_zinv_item(btc_zinvitem_t *item, const btc_zinv_t *z, size_t index);
+
 /*
  * GetData
  */
@@ -552,6 +634,237 @@ btc_sendcmpct_read(btc_sendcmpct_t *z, const uint8_t **xp, size_t *xn);
 
 /* TODO */
 
+/*
+ * GetCFilters
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_getcfilters, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_getcfilters_init(btc_getcfilters_t *msg);
+
+BTC_EXTERN void
+btc_getcfilters_clear(btc_getcfilters_t *msg);
+
+BTC_EXTERN void
+btc_getcfilters_copy(btc_getcfilters_t *z, const btc_getcfilters_t *x);
+
+BTC_EXTERN size_t
+btc_getcfilters_size(const btc_getcfilters_t *x);
+
+BTC_EXTERN uint8_t *
+btc_getcfilters_write(uint8_t *zp, const btc_getcfilters_t *x);
+
+BTC_EXTERN int
+btc_getcfilters_read(btc_getcfilters_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * CFilter
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_cfilter, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_cfilter_init(btc_cfilter_t *msg);
+
+BTC_EXTERN void
+btc_cfilter_clear(btc_cfilter_t *msg);
+
+BTC_EXTERN void
+btc_cfilter_copy(btc_cfilter_t *z, const btc_cfilter_t *x);
+
+BTC_EXTERN size_t
+btc_cfilter_size(const btc_cfilter_t *x);
+
+BTC_EXTERN uint8_t *
+btc_cfilter_write(uint8_t *zp, const btc_cfilter_t *x);
+
+BTC_EXTERN int
+btc_cfilter_read(btc_cfilter_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * GetCFHeaders
+ */
+
+/* inherits btc_getcfilters_t */
+
+/*
+ * CFHeaders
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_cfheaders, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_cfheaders_init(btc_cfheaders_t *msg);
+
+BTC_EXTERN void
+btc_cfheaders_clear(btc_cfheaders_t *msg);
+
+BTC_EXTERN void
+btc_cfheaders_copy(btc_cfheaders_t *z, const btc_cfheaders_t *x);
+
+BTC_EXTERN void
+btc_cfheaders_resize(btc_cfheaders_t *z, size_t length);
+
+BTC_EXTERN size_t
+btc_cfheaders_size(const btc_cfheaders_t *x);
+
+BTC_EXTERN uint8_t *
+btc_cfheaders_write(uint8_t *zp, const btc_cfheaders_t *x);
+
+BTC_EXTERN int
+btc_cfheaders_read(btc_cfheaders_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * GetCFCheckpt
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_getcfcheckpt, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_getcfcheckpt_init(btc_getcfcheckpt_t *msg);
+
+BTC_EXTERN void
+btc_getcfcheckpt_clear(btc_getcfcheckpt_t *msg);
+
+BTC_EXTERN void
+btc_getcfcheckpt_copy(btc_getcfcheckpt_t *z, const btc_getcfcheckpt_t *x);
+
+BTC_EXTERN size_t
+btc_getcfcheckpt_size(const btc_getcfcheckpt_t *x);
+
+BTC_EXTERN uint8_t *
+btc_getcfcheckpt_write(uint8_t *zp, const btc_getcfcheckpt_t *x);
+
+BTC_EXTERN int
+btc_getcfcheckpt_read(btc_getcfcheckpt_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * CFCheckpt
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_cfcheckpt, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_cfcheckpt_init(btc_cfcheckpt_t *msg);
+
+BTC_EXTERN void
+btc_cfcheckpt_clear(btc_cfcheckpt_t *msg);
+
+BTC_EXTERN void
+btc_cfcheckpt_copy(btc_cfcheckpt_t *z, const btc_cfcheckpt_t *x);
+
+BTC_EXTERN void
+btc_cfcheckpt_resize(btc_cfcheckpt_t *z, size_t length);
+
+BTC_EXTERN size_t
+btc_cfcheckpt_size(const btc_cfcheckpt_t *x);
+
+BTC_EXTERN uint8_t *
+btc_cfcheckpt_write(uint8_t *zp, const btc_cfcheckpt_t *x);
+
+BTC_EXTERN int
+btc_cfcheckpt_read(btc_cfcheckpt_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * SendTxRcncl
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_sendtxrcncl, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_sendtxrcncl_init(btc_sendtxrcncl_t *msg);
+
+BTC_EXTERN void
+btc_sendtxrcncl_clear(btc_sendtxrcncl_t *msg);
+
+BTC_EXTERN void
+btc_sendtxrcncl_copy(btc_sendtxrcncl_t *z, const btc_sendtxrcncl_t *x);
+
+BTC_EXTERN size_t
+btc_sendtxrcncl_size(const btc_sendtxrcncl_t *x);
+
+BTC_EXTERN uint8_t *
+btc_sendtxrcncl_write(uint8_t *zp, const btc_sendtxrcncl_t *x);
+
+BTC_EXTERN int
+btc_sendtxrcncl_read(btc_sendtxrcncl_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * ReqRecon
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_reqrecon, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_reqrecon_init(btc_reqrecon_t *msg);
+
+BTC_EXTERN void
+btc_reqrecon_clear(btc_reqrecon_t *msg);
+
+BTC_EXTERN void
+btc_reqrecon_copy(btc_reqrecon_t *z, const btc_reqrecon_t *x);
+
+BTC_EXTERN size_t
+btc_reqrecon_size(const btc_reqrecon_t *x);
+
+BTC_EXTERN uint8_t *
+btc_reqrecon_write(uint8_t *zp, const btc_reqrecon_t *x);
+
+BTC_EXTERN int
+btc_reqrecon_read(btc_reqrecon_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * Sketch
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_sketch, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_sketch_init(btc_sketch_t *msg);
+
+BTC_EXTERN void
+btc_sketch_clear(btc_sketch_t *msg);
+
+BTC_EXTERN void
+btc_sketch_copy(btc_sketch_t *z, const btc_sketch_t *x);
+
+BTC_EXTERN size_t
+btc_sketch_size(const btc_sketch_t *x);
+
+BTC_EXTERN uint8_t *
+btc_sketch_write(uint8_t *zp, const btc_sketch_t *x);
+
+BTC_EXTERN int
+btc_sketch_read(btc_sketch_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * ReconcilDiff
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_reconcildiff, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_reconcildiff_init(btc_reconcildiff_t *msg);
+
+BTC_EXTERN void
+btc_reconcildiff_clear(btc_reconcildiff_t *msg);
+
+BTC_EXTERN void
+btc_reconcildiff_copy(btc_reconcildiff_t *z, const btc_reconcildiff_t *x);
+
+BTC_EXTERN void
+btc_reconcildiff_resize(btc_reconcildiff_t *z, size_t length);
+
+BTC_EXTERN size_t
+btc_reconcildiff_size(const btc_reconcildiff_t *x);
+
+BTC_EXTERN uint8_t *
+btc_reconcildiff_write(uint8_t *zp, const btc_reconcildiff_t *x);
+
+BTC_EXTERN int
+btc_reconcildiff_read(btc_reconcildiff_t *z, const uint8_t **xp, size_t *xn);
+
 /*
  * Unknown
  */
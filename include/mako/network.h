@@ -90,6 +90,12 @@ struct btc_network_s {
    */
   int32_t last_checkpoint;
 
+  /**
+   * Assumed-valid block. Scripts are not
+   * verified for this block or its ancestors.
+   */
+  btc_checkpoint_t assume_valid;
+
   /**
    * Block subsidy halving interval.
    */
@@ -217,6 +223,11 @@ struct btc_network_s {
      * Block which activated bip141.
      */
     btc_checkpoint_t segwit;
+
+    /**
+     * Block which activated bip341.
+     */
+    btc_checkpoint_t taproot;
   } softforks;
 
   /**
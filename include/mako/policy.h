@@ -119,17 +119,32 @@ extern "C" {
 #define BTC_MEMPOOL_MAX_ANCESTORS 25
 
 /**
- * Default maximum mempool size in bytes.
+ * Maximum number of transactions in a cluster
+ * of connected mempool entries. Linearization
+ * relies on this fitting in a 64 bit mask.
  */
 
-#define BTC_MEMPOOL_MAX_SIZE (100 * 1000000)
+#define BTC_MEMPOOL_MAX_CLUSTER 64
 
 /**
- * Default threshold mempool size in bytes.
+ * Default maximum mempool memory usage in bytes.
+ */
+
+#define BTC_MEMPOOL_MAX_SIZE (300 * 1000000)
+
+/**
+ * Default threshold mempool memory usage in bytes.
  */
 
 #define BTC_MEMPOOL_THRESHOLD (BTC_MEMPOOL_MAX_SIZE - BTC_MEMPOOL_MAX_SIZE / 10)
 
+/**
+ * Half-life of the rolling minimum fee
+ * raised by size-based evictions.
+ */
+
+#define BTC_MEMPOOL_FEE_HALFLIFE (12 * 60 * 60)
+
 /**
  * Time at which transactions
  * fall out of the mempool.
@@ -143,6 +158,39 @@ extern "C" {
 
 #define BTC_MEMPOOL_MAX_ORPHANS 100
 
+/**
+ * Maximum number of orphan transactions from a single peer.
+ */
+
+#define BTC_MEMPOOL_MAX_PEER_ORPHANS 25
+
+/**
+ * Maximum number of transactions in a package.
+ */
+
+#define BTC_MEMPOOL_MAX_PACKAGE 25
+
+/**
+ * Maximum weight of a package.
+ */
+
+#define BTC_MEMPOOL_MAX_PACKAGE_WEIGHT 404000
+
+/**
+ * Maximum number of low-fee rejects kept
+ * around for a child to pay for.
+ */
+
+#define BTC_MEMPOOL_MAX_LOWFEE 100
+
+/**
+ * Maximum number of transactions (conflicts
+ * plus their descendants) a replacement may
+ * evict (BIP125).
+ */
+
+#define BTC_MEMPOOL_MAX_REPLACEMENTS 100
+
 /**
  * Minimum block size to create. Block will be
  * filled with free transactions until block
@@ -44,6 +44,10 @@ enum btc_script_flags {
   BTC_SCRIPT_VERIFY_NULLFAIL = (1U << 14),
   BTC_SCRIPT_VERIFY_WITNESS_PUBKEYTYPE = (1U << 15),
   BTC_SCRIPT_VERIFY_CONST_SCRIPTCODE = (1U << 16),
+  BTC_SCRIPT_VERIFY_TAPROOT = (1U << 17),
+  BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION = (1U << 18),
+  BTC_SCRIPT_VERIFY_DISCOURAGE_OP_SUCCESS = (1U << 19),
+  BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_PUBKEYTYPE = (1U << 20),
   BTC_SCRIPT_MANDATORY_VERIFY_FLAGS = BTC_SCRIPT_VERIFY_P2SH,
   BTC_SCRIPT_STANDARD_VERIFY_FLAGS = 0
     | BTC_SCRIPT_MANDATORY_VERIFY_FLAGS
@@ -60,7 +64,11 @@ enum btc_script_flags {
     | BTC_SCRIPT_VERIFY_LOW_S
     | BTC_SCRIPT_VERIFY_WITNESS
     | BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM
-    | BTC_SCRIPT_VERIFY_WITNESS_PUBKEYTYPE,
+    | BTC_SCRIPT_VERIFY_WITNESS_PUBKEYTYPE
+    | BTC_SCRIPT_VERIFY_TAPROOT
+    | BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION
+    | BTC_SCRIPT_VERIFY_DISCOURAGE_OP_SUCCESS
+    | BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_PUBKEYTYPE,
   BTC_SCRIPT_ONLY_STANDARD_VERIFY_FLAGS = BTC_SCRIPT_STANDARD_VERIFY_FLAGS
                                        & ~BTC_SCRIPT_MANDATORY_VERIFY_FLAGS
 };
@@ -126,6 +134,18 @@ enum btc_script_error {
   BTC_SCRIPT_ERR_OP_CODESEPARATOR,
   BTC_SCRIPT_ERR_SIG_FINDANDDELETE,
 
+  /* Taproot */
+  BTC_SCRIPT_ERR_SCHNORR_SIG_SIZE,
+  BTC_SCRIPT_ERR_SCHNORR_SIG_HASHTYPE,
+  BTC_SCRIPT_ERR_SCHNORR_SIG,
+  BTC_SCRIPT_ERR_TAPROOT_WRONG_CONTROL_SIZE,
+  BTC_SCRIPT_ERR_TAPSCRIPT_VALIDATION_WEIGHT,
+  BTC_SCRIPT_ERR_TAPSCRIPT_CHECKMULTISIG,
+  BTC_SCRIPT_ERR_TAPSCRIPT_MINIMALIF,
+  BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION,
+  BTC_SCRIPT_ERR_DISCOURAGE_OP_SUCCESS,
+  BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_PUBKEYTYPE,
+
   BTC_SCRIPT_ERR_ERROR_COUNT
 };
 
@@ -264,6 +284,9 @@ enum btc_opcode {
   BTC_OP_NOP9 = 0xb8,
   BTC_OP_NOP10 = 0xb9,
 
+  /* tapscript */
+  BTC_OP_CHECKSIGADD = 0xba,
+
   BTC_OP_INVALIDOPCODE = 0xff
 };
 
@@ -400,6 +423,7 @@ btc_opcode_read(btc_opcode_t *z, const uint8_t **xp, size_t *xn);
 #define btc_script_roset btc_buffer_roset
 #define btc_script_rocopy btc_buffer_rocopy
 #define btc_script_rwset btc_buffer_rwset
+#define btc_script_usage btc_buffer_usage
 #define btc_script_equal btc_buffer_equal
 #define btc_script_compare btc_buffer_compare
 #define btc_script_size btc_buffer_size
@@ -577,6 +601,38 @@ btc_scriptsig_inspect(const btc_script_t *script);
 BTC_EXTERN void
 btc_script_inspect(const btc_script_t *script, const btc_network_t *network);
 
+/*
+ * Signature Batch
+ */
+
+BTC_EXTERN btc_sigbatch_t *
+btc_sigbatch_create(void);
+
+BTC_EXTERN void
+btc_sigbatch_destroy(btc_sigbatch_t *batch);
+
+BTC_EXTERN void
+btc_sigbatch_reset(btc_sigbatch_t *batch);
+
+BTC_EXTERN size_t
+btc_sigbatch_length(const btc_sigbatch_t *batch);
+
+BTC_EXTERN void
+btc_sigbatch_push(btc_sigbatch_t *batch,
+                  const uint8_t *msg,
+                  const uint8_t *sig,
+                  const uint8_t *pub);
+
+BTC_EXTERN void
+btc_sigbatch_push_ecdsa(btc_sigbatch_t *batch,
+                        const uint8_t *msg,
+                        const uint8_t *sig,
+                        const uint8_t *pub,
+                        size_t pub_len);
+
+BTC_EXTERN int
+btc_sigbatch_verify(btc_sigbatch_t *batch);
+
 /*
  * Reader
  */
@@ -590,6 +646,37 @@ btc_reader_next(btc_opcode_t *z, btc_reader_t *x);
 BTC_EXTERN int
 btc_reader_op(btc_reader_t *z);
 
+/*
+ * Opcode Vector
+ */
+
+BTC_EXTERN void
+btc_opvec_init(btc_opvec_t *z);
+
+BTC_EXTERN void
+btc_opvec_clear(btc_opvec_t *z);
+
+BTC_EXTERN void
+btc_opvec_grow(btc_opvec_t *z, size_t zn);
+
+BTC_EXTERN void
+btc_opvec_rwset(btc_opvec_t *z, btc_opcode_t *items, size_t alloc);
+
+BTC_EXTERN size_t
+btc_opvec_count(const btc_script_t *x);
+
+BTC_EXTERN void
+btc_opvec_set(btc_opvec_t *z, const btc_script_t *x);
+
+BTC_EXTERN int
+btc_opvec_is_push_only(const btc_opvec_t *x);
+
+BTC_EXTERN int
+btc_opvec_get_redeem(btc_script_t *redeem, const btc_opvec_t *x);
+
+BTC_EXTERN int
+btc_opvec_sigops(const btc_opvec_t *x, int accurate);
+
 /*
  * Writer
  */
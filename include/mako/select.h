@@ -25,12 +25,14 @@ enum btc_selection {
   BTC_SELECT_ALL,
   BTC_SELECT_RANDOM,
   BTC_SELECT_AGE,
-  BTC_SELECT_VALUE
+  BTC_SELECT_VALUE,
+  BTC_SELECT_BNB
 };
 
 typedef struct btc_selopt_s {
   enum btc_selection strategy;
   int64_t rate;
+  int64_t ltrate;
   int64_t fee;
   int64_t maxfee;
   int32_t height;
@@ -43,6 +45,7 @@ typedef struct btc_selector_s {
   const btc_selopt_t *opt;
   enum btc_selection strategy;
   int subtract;
+  int changeless;
   btc_tx_t *tx;
   int64_t inpval;
   int64_t outval;
@@ -23,6 +23,17 @@ extern "C" {
 
 typedef int btc_derive_f(uint8_t *, const btc_address_t *, void *);
 
+typedef struct btc_signer_s btc_signer_t;
+
+struct wei_precomp_s;
+
+enum btc_prevout_type {
+  BTC_PREVOUT_UNKNOWN,
+  BTC_PREVOUT_P2PKH,
+  BTC_PREVOUT_P2SH,
+  BTC_PREVOUT_STANDARD
+};
+
 /*
  * Outpoint
  */
@@ -193,6 +204,9 @@ btc_tx_wtxid(uint8_t *hash, const btc_tx_t *tx);
 BTC_EXTERN void
 btc_tx_refresh(btc_tx_t *tx);
 
+BTC_EXTERN void
+btc_tx_uncache(btc_tx_t *tx);
+
 BTC_EXTERN void
 btc_tx_sighash(uint8_t *hash,
                const btc_tx_t *tx,
@@ -203,9 +217,38 @@ btc_tx_sighash(uint8_t *hash,
                int version,
                btc_tx_cache_t *cache);
 
+BTC_EXTERN int
+btc_tx_sighash_taproot(uint8_t *hash,
+                       const btc_tx_t *tx,
+                       size_t index,
+                       const btc_script_t *prev,
+                       int64_t value,
+                       int type,
+                       const uint8_t *annex,
+                       const uint8_t *leaf,
+                       uint32_t codesep,
+                       const btc_tx_cache_t *cache);
+
+BTC_EXTERN void
+btc_tx_cache_init(btc_tx_cache_t *cache,
+                  const btc_tx_t *tx,
+                  const btc_view_t *view);
+
+BTC_EXTERN const btc_tx_cache_t *
+btc_tx_precompute(const btc_tx_t *tx, const btc_view_t *view);
+
+BTC_EXTERN size_t
+btc_tx_cache_usage(const btc_tx_t *tx);
+
 BTC_EXTERN int
 btc_tx_verify(const btc_tx_t *tx, const btc_view_t *view, unsigned int flags);
 
+BTC_EXTERN int
+btc_tx_verify_batch(const btc_tx_t *tx,
+                    const btc_view_t *view,
+                    unsigned int flags,
+                    btc_sigbatch_t *batch);
+
 BTC_EXTERN int
 btc_tx_verify_input(const btc_tx_t *tx,
                     size_t index,
@@ -326,6 +369,9 @@ btc_tx_virtual_size(const btc_tx_t *tx);
 BTC_EXTERN size_t
 btc_tx_sigops_size(const btc_tx_t *tx, int sigops);
 
+BTC_EXTERN size_t
+btc_tx_usage(const btc_tx_t *tx);
+
 BTC_EXTERN uint8_t *
 btc_tx_base_write(uint8_t *zp, const btc_tx_t *tx);
 
@@ -335,11 +381,29 @@ btc_tx_write(uint8_t *zp, const btc_tx_t *tx);
 BTC_EXTERN int
 btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn);
 
+BTC_EXTERN int
+btc_tx_read_slab(btc_tx_t *z, const uint8_t **xp, size_t *xn);
+
 BTC_EXTERN void
 btc_tx_inspect(const btc_tx_t *tx,
                const btc_view_t *view,
                const btc_network_t *network);
 
+/*
+ * Raw Transaction Scanning
+ */
+
+BTC_EXTERN int
+btc_tx_scan(btc_rawtx_t *tx,
+            const uint8_t **xp,
+            size_t *xn,
+            btc_rawin_f *on_input,
+            btc_rawout_f *on_output,
+            void *arg);
+
+BTC_EXTERN void
+btc_rawtx_txid(uint8_t *hash, const btc_rawtx_t *tx);
+
 /*
  * Transaction Vector
  */
@@ -371,6 +435,38 @@ btc_tx_sign(btc_tx_t *tx,
             btc_derive_f *derive,
             void *arg);
 
+/*
+ * Signer
+ */
+
+BTC_EXTERN btc_signer_t *
+btc_signer_create(void);
+
+BTC_EXTERN void
+btc_signer_destroy(btc_signer_t *signer);
+
+BTC_EXTERN int
+btc_signer_add(btc_signer_t *signer, const uint8_t *priv);
+
+BTC_EXTERN void
+btc_signer_set_precomp(btc_signer_t *signer, const struct wei_precomp_s *pre);
+
+BTC_EXTERN size_t
+btc_signer_size(const btc_signer_t *signer);
+
+BTC_EXTERN int
+btc_signer_sign(const btc_signer_t *signer,
+                btc_tx_t *tx,
+                const btc_view_t *view,
+                const btc_tx_cache_t *cache,
+                size_t start,
+                size_t end);
+
+BTC_EXTERN int
+btc_signer_sign_tx(const btc_signer_t *signer,
+                   btc_tx_t *tx,
+                   const btc_view_t *view);
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,11 +36,18 @@ typedef struct name##iter_s {                    \
  * Types
  */
 
+/* Inline capacity of a buffer. Large enough for every
+ * standard output script (P2WSH and P2TR are 34 bytes)
+ * and rounds the struct up to 64 bytes on 64-bit.
+ */
+#define BTC_BUFFER_INLINE 36
+
 typedef struct btc_buffer_s {
   uint8_t *data;
   size_t alloc;
   size_t length;
   int _refs;
+  uint8_t small[BTC_BUFFER_INLINE];
 } btc_buffer_t;
 
 typedef struct btc_array_s {
@@ -67,6 +74,13 @@ typedef struct btc_opcode_s {
   size_t length;
 } btc_opcode_t;
 
+typedef struct btc_opvec_s {
+  btc_opcode_t *items;
+  size_t alloc;
+  size_t length;
+  int malformed;
+} btc_opvec_t;
+
 typedef btc_buffer_t btc_script_t;
 
 typedef struct btc_reader_s {
@@ -127,6 +141,11 @@ typedef struct btc_tx_s {
   uint32_t locktime;
   int _index;
   int _refs;
+  struct btc_tx_cache_s *_cache;
+  size_t _base_size;
+  size_t _witness_size;
+  int _sigops;
+  void *_slab;
 } btc_tx_t;
 
 typedef struct btc_txvec_s {
@@ -135,6 +154,26 @@ typedef struct btc_txvec_s {
   size_t length;
 } btc_txvec_t;
 
+typedef struct btc_rawtx_s {
+  const uint8_t *data;
+  size_t length;
+  size_t body;
+  size_t witness;
+  size_t index;
+} btc_rawtx_t;
+
+typedef void btc_rawin_f(const btc_rawtx_t *tx,
+                         size_t index,
+                         const uint8_t *prevout,
+                         void *arg);
+
+typedef void btc_rawout_f(const btc_rawtx_t *tx,
+                          size_t index,
+                          int64_t value,
+                          const uint8_t *script,
+                          size_t length,
+                          void *arg);
+
 typedef struct btc_header_s {
   uint32_t version;
   uint8_t prev_block[32];
@@ -148,6 +187,10 @@ typedef struct btc_block_s {
   btc_header_t header;
   btc_txvec_t txs;
   int _refs;
+  /* Wire encoding of `txs` (null if not read). */
+  uint8_t *_raw;
+  size_t _raw_size;
+  size_t _base_size;
 } btc_block_t;
 
 typedef struct btc_entry_s {
@@ -159,8 +202,12 @@ typedef struct btc_entry_s {
   int32_t block_pos;
   int32_t undo_file;
   int32_t undo_pos;
+  int64_t median_time;
+  uint32_t tx_count;
+  uint64_t chain_tx;
   struct btc_entry_s *prev;
   struct btc_entry_s *next;
+  struct btc_entry_s *skip;
 } btc_entry_t;
 
 typedef struct btc_coin_s {
@@ -183,6 +230,25 @@ typedef struct btc_multikey_s {
   size_t length;
 } btc_multikey_t;
 
+typedef struct btc_sigbatch_s btc_sigbatch_t;
+
+typedef struct btc_txin_info_s {
+  /* Prevout template (BTC_PREVOUT_*). */
+  int type;
+  /* Redeem script if the prevout is p2sh. */
+  btc_script_t redeem;
+  int has_redeem;
+  /* Witness program (prevout or redeem), -1 if none. */
+  int version;
+  size_t program_len;
+  /* Accurate sigops of the redeem script. */
+  int p2sh_sigops;
+  /* Sigop cost of the witness program. */
+  int witness_sigops;
+  /* Whether the witness is within policy limits. */
+  int standard_witness;
+} btc_txin_info_t;
+
 typedef struct btc_tx_cache_s {
   uint8_t prevouts[32];
   uint8_t sequences[32];
@@ -190,6 +256,19 @@ typedef struct btc_tx_cache_s {
   int has_prevouts;
   int has_sequences;
   int has_outputs;
+  /* BIP341 (single sha256). */
+  uint8_t tap_prevouts[32];
+  uint8_t tap_amounts[32];
+  uint8_t tap_scripts[32];
+  uint8_t tap_sequences[32];
+  uint8_t tap_outputs[32];
+  int has_taproot;
+  /* Defers signature checks if non-null. */
+  btc_sigbatch_t *batch;
+  /* Decoded input scripts (null if not precomputed). */
+  btc_opvec_t *scripts;
+  /* Per-input analysis (null if not precomputed). */
+  btc_txin_info_t *info;
 } btc_tx_cache_t;
 
 typedef struct btc_verify_error_s {
@@ -241,8 +320,13 @@ typedef struct btc_mpentry_s {
   int64_t time;
   uint8_t coinbase;
   uint8_t locks;
-  int64_t desc_fee;
-  int64_t desc_size;
+  int64_t chunk_fee;
+  int64_t chunk_size;
+  size_t _index;
+  size_t _heap[2];
+  struct btc_mpcluster_s *_cluster;
+  size_t _pos;
+  size_t _chunk;
 } btc_mpentry_t;
 
 /* https://github.com/satoshilabs/slips/blob/master/slip-0132.md */
@@ -293,6 +377,15 @@ BTC_DEFINE_MAP_TYPES(btc_outmap, btc_outpoint_t *, void *);
 BTC_DEFINE_MAP_TYPES(btc_netmap, btc_netaddr_t *, void *);
 BTC_DEFINE_MAP_TYPES(btc_addrmap, btc_address_t *, void *);
 
+typedef struct btc_prevmap_s btc_prevmap_t;
+
+typedef struct btc_prevmapiter_s {
+  const struct btc_prevmap_s *map;
+  unsigned int it;
+  const btc_outpoint_t *key;
+  void *val;
+} btc_prevmapiter_t;
+
 /*
  * Tables (Key->Integer)
  */
@@ -62,6 +62,14 @@ btc_murmur3_sum(const uint8_t *data, size_t len, uint32_t seed);
 BTC_EXTERN uint32_t
 btc_murmur3_tweak(const uint8_t *data, size_t len, uint32_t n, uint32_t tweak);
 
+BTC_EXTERN void
+btc_murmur3_tweaks(uint32_t *out,
+                   const uint8_t *data,
+                   size_t len,
+                   uint32_t n,
+                   size_t count,
+                   uint32_t tweak);
+
 /*
  * Memory Zero
  */
@@ -103,6 +111,56 @@ btc_memxor3(void *z, const void *x, const void *y, size_t n);
 BTC_EXTERN void *
 btc_memdup(const void *xp, size_t xn);
 
+/*
+ * Memory Usage
+ */
+
+BTC_EXTERN size_t
+btc_malloc_usage(size_t size);
+
+/*
+ * Memory Accounting
+ */
+
+/* With BTC_MEMSTATS, every allocation is charged to
+ * the tag of the thread making it (and refunded to
+ * the same tag when freed, whichever thread does it).
+ * Without it, the macros below compile to nothing.
+ */
+
+enum btc_memtag {
+  BTC_MEMTAG_OTHER,
+  BTC_MEMTAG_CHAIN,
+  BTC_MEMTAG_COINS,
+  BTC_MEMTAG_MEMPOOL,
+  BTC_MEMTAG_ORPHANS,
+  BTC_MEMTAG_NET,
+  BTC_MEMTAG_RPC,
+  BTC_MEMTAG_MAX
+};
+
+typedef struct btc_memstat_s {
+  int64_t bytes;
+  int64_t count;
+} btc_memstat_t;
+
+#ifdef BTC_MEMSTATS
+#  define BTC_MEMTAG_PUSH(old, tag) ((old) = btc_memtag_swap(tag))
+#  define BTC_MEMTAG_POP(old) ((void)btc_memtag_swap(old))
+#else
+#  define BTC_MEMTAG_PUSH(old, tag) ((old) = (tag))
+#  define BTC_MEMTAG_POP(old) ((void)(old))
+#endif
+
+BTC_EXTERN int
+btc_memtag_swap(int tag);
+
+BTC_EXTERN const char *
+btc_memtag_name(int tag);
+
+BTC_EXTERN int
+btc_memstats(btc_memstat_t *stats);
+
 /*
  * String
  */
@@ -139,6 +197,9 @@ btc_hash_export(char *zp, const uint8_t *xp);
 BTC_EXTERN void
 btc_hash_inspect(const uint8_t *xp);
 
+BTC_EXTERN uint32_t
+btc_hash_key(const uint8_t *xp, uint32_t tweak);
+
 /*
  * Time
  */
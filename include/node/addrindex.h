@@ -0,0 +1,95 @@
+/*!
+ * addrindex.h - address index for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_ADDRINDEX_H
+#define BTC_ADDRINDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "../mako/common.h"
+#include "../mako/types.h"
+
+/*
+ * Types
+ */
+
+typedef struct btc_addrtx_s {
+  uint8_t hash[32];
+  int32_t height;
+  uint32_t index;
+} btc_addrtx_t;
+
+typedef struct btc_addrcoin_s {
+  btc_outpoint_t prevout;
+  int32_t height;
+  int64_t value;
+} btc_addrcoin_t;
+
+/*
+ * Address Index
+ */
+
+BTC_EXTERN btc_addrindex_t *
+btc_addrindex_create(btc_chain_t *chain);
+
+BTC_EXTERN void
+btc_addrindex_destroy(btc_addrindex_t *db);
+
+BTC_EXTERN void
+btc_addrindex_set_logger(btc_addrindex_t *db, btc_logger_t *logger);
+
+BTC_EXTERN int
+btc_addrindex_open(btc_addrindex_t *db, const char *prefix, unsigned int flags);
+
+BTC_EXTERN void
+btc_addrindex_close(btc_addrindex_t *db);
+
+BTC_EXTERN void
+btc_addrindex_connect(btc_addrindex_t *db,
+                      const btc_entry_t *entry,
+                      const btc_block_t *block,
+                      const btc_view_t *view);
+
+BTC_EXTERN void
+btc_addrindex_disconnect(btc_addrindex_t *db,
+                         const btc_entry_t *entry,
+                         const btc_block_t *block);
+
+BTC_EXTERN int
+btc_addrindex_enabled(btc_addrindex_t *db);
+
+BTC_EXTERN int32_t
+btc_addrindex_height(btc_addrindex_t *db);
+
+BTC_EXTERN int
+btc_addrindex_syncing(btc_addrindex_t *db);
+
+BTC_EXTERN void
+btc_addrindex_hash(uint8_t *hash, const btc_script_t *script);
+
+BTC_EXTERN size_t
+btc_addrindex_history(btc_addrindex_t *db,
+                      btc_addrtx_t **items,
+                      const uint8_t *hash,
+                      int32_t start,
+                      size_t limit);
+
+BTC_EXTERN size_t
+btc_addrindex_unspents(btc_addrindex_t *db,
+                       btc_addrcoin_t **items,
+                       const uint8_t *hash,
+                       size_t limit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_ADDRINDEX_H */
@@ -44,8 +44,7 @@ typedef struct btc_addrent_s {
   int64_t last_success;
   int64_t last_attempt;
   size_t rand_pos;
-  struct btc_addrent_s *prev;
-  struct btc_addrent_s *next;
+  uint32_t bucket_pos;
 } btc_addrent_t;
 
 typedef btc_netmapiter_t btc_addriter_t;
@@ -78,6 +77,9 @@ btc_addrman_open(btc_addrman_t *man, const char *file, unsigned int flags);
 BTC_EXTERN void
 btc_addrman_close(btc_addrman_t *man);
 
+BTC_EXTERN size_t
+btc_addrman_poll(btc_addrman_t *man);
+
 BTC_EXTERN void
 btc_addrman_flush(btc_addrman_t *man);
 
@@ -110,6 +112,11 @@ btc_addrman_add(btc_addrman_t *man,
                 const btc_netaddr_t *addr,
                 const btc_netaddr_t *src);
 
+BTC_EXTERN size_t
+btc_addrman_add_many(btc_addrman_t *man,
+                     const btc_vector_t *addrs,
+                     const btc_netaddr_t *src);
+
 BTC_EXTERN int
 btc_addrman_remove(btc_addrman_t *man, const btc_netaddr_t *addr);
 
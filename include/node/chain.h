@@ -64,6 +64,23 @@ typedef void btc_chain_badorphan_cb(const btc_verify_error_t *err,
                                     unsigned int id,
                                     void *arg);
 
+typedef struct btc_chaintip_s {
+  const btc_entry_t *entry;
+  int32_t height;
+  btc_deployment_state_t state;
+  unsigned long generation;
+} btc_chaintip_t;
+
+typedef struct btc_replay_s {
+  int64_t blocks;
+  int64_t skipped;
+  int64_t txs;
+  int64_t inputs;
+  int64_t files;
+  int64_t bytes;
+  int64_t elapsed;
+} btc_replay_t;
+
 /*
  * Chain
  */
@@ -80,9 +97,32 @@ btc_chain_set_logger(btc_chain_t *chain, btc_logger_t *logger);
 BTC_EXTERN void
 btc_chain_set_timedata(btc_chain_t *chain, const btc_timedata_t *td);
 
+BTC_EXTERN void
+btc_chain_set_perf(btc_chain_t *chain, btc_perf_t *perf);
+
 BTC_EXTERN void
 btc_chain_set_threads(btc_chain_t *chain, int threads);
 
+BTC_EXTERN void
+btc_chain_set_cpus(btc_chain_t *chain, const int *cpus, size_t length);
+
+BTC_EXTERN void
+btc_chain_set_cache(btc_chain_t *chain, size_t size);
+
+BTC_EXTERN void
+btc_chain_set_prune(btc_chain_t *chain, int64_t size);
+
+BTC_EXTERN void
+btc_chain_set_tune(btc_chain_t *chain, const struct btc_dbtune_s *tune);
+
+BTC_EXTERN void
+btc_chain_set_assume_valid(btc_chain_t *chain,
+                           const uint8_t *hash,
+                           int32_t height);
+
+BTC_EXTERN void
+btc_chain_set_snapshot(btc_chain_t *chain, const char *path);
+
 BTC_EXTERN void
 btc_chain_on_block(btc_chain_t *chain, btc_chain_block_cb *handler);
 
@@ -107,6 +147,15 @@ btc_chain_open(btc_chain_t *chain, const char *prefix, unsigned int flags);
 BTC_EXTERN void
 btc_chain_close(btc_chain_t *chain);
 
+BTC_EXTERN int
+btc_chain_refresh(btc_chain_t *chain);
+
+BTC_EXTERN int
+btc_chain_write_snapshot(btc_chain_t *chain,
+                         const char *path,
+                         uint8_t *checksum,
+                         uint64_t *count);
+
 BTC_EXTERN int
 btc_chain_has_orphan(btc_chain_t *chain, const uint8_t *hash);
 
@@ -140,18 +189,51 @@ btc_chain_verify_locks(btc_chain_t *chain,
                        const btc_view_t *view,
                        unsigned int flags);
 
+BTC_EXTERN int
+btc_chain_verify_scripts(btc_chain_t *chain,
+                         const btc_tx_t *tx,
+                         const btc_view_t *view,
+                         unsigned int flags);
+
+BTC_EXTERN int
+btc_chain_has_scripts(btc_chain_t *chain,
+                      const btc_tx_t *tx,
+                      unsigned int flags);
+
+BTC_EXTERN void
+btc_chain_cache_scripts(btc_chain_t *chain,
+                        const btc_tx_t *tx,
+                        unsigned int flags);
+
+BTC_EXTERN void
+btc_chain_cache_witness(btc_chain_t *chain,
+                        const uint8_t *whash,
+                        unsigned int flags);
+
 BTC_EXTERN int
 btc_chain_add(btc_chain_t *chain,
               const btc_block_t *block,
               unsigned int flags,
               unsigned int id);
 
+BTC_EXTERN int
+btc_chain_replay(btc_chain_t *chain,
+                 const char *dir,
+                 int scripts,
+                 btc_replay_t *stats);
+
+BTC_EXTERN int
+btc_chain_reindex(btc_chain_t *chain, btc_replay_t *stats);
+
 BTC_EXTERN const btc_entry_t *
 btc_chain_tip(btc_chain_t *chain);
 
 BTC_EXTERN int32_t
 btc_chain_height(btc_chain_t *chain);
 
+BTC_EXTERN struct btc_workers_s *
+btc_chain_workers(btc_chain_t *chain);
+
 BTC_EXTERN const btc_deployment_state_t *
 btc_chain_state(btc_chain_t *chain);
 
@@ -161,12 +243,42 @@ btc_chain_error(btc_chain_t *chain);
 BTC_EXTERN double
 btc_chain_progress(btc_chain_t *chain);
 
+BTC_EXTERN void
+btc_chain_sync_stats(btc_chain_t *chain, btc_hist_t *hist);
+
+BTC_EXTERN void
+btc_chain_counters(btc_chain_t *chain, struct btc_dbstats_s *stats);
+
+BTC_EXTERN void
+btc_chain_stats(btc_chain_t *chain, struct btc_dbstats_s *stats);
+
+BTC_EXTERN int
+btc_chain_utxo_stats(btc_chain_t *chain, struct btc_utxostats_s *stats);
+
+BTC_EXTERN char *
+btc_chain_structure(btc_chain_t *chain);
+
+BTC_EXTERN const struct btc_dbtune_s *
+btc_chain_tune(btc_chain_t *chain);
+
 BTC_EXTERN int
 btc_chain_synced(btc_chain_t *chain);
 
 BTC_EXTERN int
 btc_chain_pruned(btc_chain_t *chain);
 
+BTC_EXTERN int32_t
+btc_chain_assumed(btc_chain_t *chain);
+
+BTC_EXTERN int
+btc_chain_assume_locator(btc_chain_t *chain, uint8_t *start, uint8_t *stop);
+
+BTC_EXTERN int
+btc_chain_add_assumed(btc_chain_t *chain,
+                      btc_header_t **items,
+                      const uint8_t *hashes,
+                      size_t length);
+
 BTC_EXTERN int
 btc_chain_has_hash(btc_chain_t *chain, const uint8_t *hash);
 
@@ -179,6 +291,9 @@ btc_chain_by_height(btc_chain_t *chain, int32_t height);
 BTC_EXTERN int
 btc_chain_is_main(btc_chain_t *chain, const btc_entry_t *entry);
 
+BTC_EXTERN int64_t
+btc_chain_median_time(btc_chain_t *chain, const btc_entry_t *entry);
+
 BTC_EXTERN int
 btc_chain_has_coins(btc_chain_t *chain, const btc_tx_t *tx);
 
@@ -190,12 +305,72 @@ btc_chain_get_coins(btc_chain_t *chain,
 BTC_EXTERN btc_block_t *
 btc_chain_get_block(btc_chain_t *chain, const btc_entry_t *entry);
 
+BTC_EXTERN btc_undo_t *
+btc_chain_get_undo(btc_chain_t *chain, const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_chain_has_undo(btc_chain_t *chain, const btc_entry_t *entry);
+
 BTC_EXTERN int
 btc_chain_get_raw_block(btc_chain_t *chain,
                         uint8_t **data,
                         size_t *length,
                         const btc_entry_t *entry);
 
+BTC_EXTERN const uint8_t *
+btc_chain_map_raw_block(btc_chain_t *chain,
+                        size_t *length,
+                        const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_chain_get_raw_undo(btc_chain_t *chain,
+                       uint8_t **data,
+                       size_t *length,
+                       const btc_entry_t *entry);
+
+BTC_EXTERN const uint8_t *
+btc_chain_map_raw_undo(btc_chain_t *chain,
+                       size_t *length,
+                       const btc_entry_t *entry);
+
+BTC_EXTERN btc_undo_t *
+btc_chain_decode_undo(const uint8_t *data,
+                      size_t length,
+                      const btc_entry_t *entry);
+
+BTC_EXTERN btc_blockfile_t *
+btc_chain_open_raw_block(btc_chain_t *chain,
+                         int64_t *pos,
+                         size_t *length,
+                         const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_chain_get_raw_tx(btc_chain_t *chain,
+                     uint8_t **data,
+                     size_t *length,
+                     const btc_entry_t **entry,
+                     const uint8_t *hash);
+
+BTC_EXTERN btc_tx_t *
+btc_chain_get_tx(btc_chain_t *chain,
+                 const btc_entry_t **entry,
+                 const uint8_t *hash);
+
+BTC_EXTERN void
+btc_chain_snapshot(btc_chain_t *chain, btc_chaintip_t *tip);
+
+BTC_EXTERN const btc_entry_t *
+btc_chaintip_by_height(const btc_chaintip_t *tip, int32_t height);
+
+BTC_EXTERN int
+btc_chaintip_is_main(const btc_chaintip_t *tip, const btc_entry_t *entry);
+
+BTC_EXTERN btc_chainreader_t *
+btc_chain_reader(btc_chain_t *chain);
+
+BTC_EXTERN btc_coinscan_t *
+btc_chain_coinscan(btc_chain_t *chain);
+
 BTC_EXTERN const uint8_t *
 btc_chain_get_orphan_root(btc_chain_t *chain, const uint8_t *hash);
 
@@ -12,10 +12,72 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include "types.h"
 #include "../mako/common.h"
 #include "../mako/types.h"
 
+/*
+ * Types
+ */
+
+typedef struct btc_dbstats_s {
+  int levels;
+  int segments;
+  int tree_old;
+  int tree_new;
+  int checkpoint;
+  int pages_read;
+  int pages_written;
+  size_t cache_usage;
+  size_t cache_limit;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+} btc_dbstats_t;
+
+typedef struct btc_utxostats_s {
+  uint8_t hash[32];
+  int32_t height;
+  uint64_t count;
+  int64_t amount;
+  uint8_t muhash[32];
+} btc_utxostats_t;
+
+typedef struct btc_scanitem_s {
+  btc_outpoint_t prevout;
+  btc_coin_t *coin;
+} btc_scanitem_t;
+
+enum btc_dbprofile {
+  BTC_DBPROFILE_SMALL,
+  BTC_DBPROFILE_DEFAULT,
+  BTC_DBPROFILE_LARGE
+};
+
+/* Sizes are in kilobytes, as lsm_config takes them.
+   The cache and buffer sizes apply to leveldb only.
+   A shared database may be opened by read-only
+   replicas in other processes. Safety is passed
+   through as LSM_CONFIG_SAFETY (0-2). */
+typedef struct btc_dbtune_s {
+  int cache_size;
+  int buffer_size;
+  int autoflush;
+  int bulk_flush;
+  int autocheckpoint;
+  int automerge;
+  int mmap;
+  int shared;
+  int safety;
+} btc_dbtune_t;
+
+/*
+ * Tuning
+ */
+
+BTC_EXTERN void
+btc_dbtune_init(btc_dbtune_t *tune, enum btc_dbprofile profile);
+
 /*
  * Chain Database
  */
@@ -26,12 +88,54 @@ btc_chaindb_create(const btc_network_t *network);
 BTC_EXTERN void
 btc_chaindb_destroy(btc_chaindb_t *db);
 
+BTC_EXTERN btc_entry_t *
+btc_chaindb_create_entry(btc_chaindb_t *db);
+
+BTC_EXTERN void
+btc_chaindb_destroy_entry(btc_chaindb_t *db, btc_entry_t *entry);
+
+BTC_EXTERN void
+btc_chaindb_set_cache(btc_chaindb_t *db, size_t size);
+
+BTC_EXTERN void
+btc_chaindb_set_prune(btc_chaindb_t *db, int64_t size);
+
+BTC_EXTERN void
+btc_chaindb_set_bulk(btc_chaindb_t *db, int bulk);
+
+BTC_EXTERN void
+btc_chaindb_set_tune(btc_chaindb_t *db, const btc_dbtune_t *tune);
+
+BTC_EXTERN const btc_dbtune_t *
+btc_chaindb_tune(btc_chaindb_t *db);
+
+BTC_EXTERN const char *
+btc_chaindb_prefix(btc_chaindb_t *db);
+
+BTC_EXTERN void
+btc_chaindb_counters(btc_chaindb_t *db, btc_dbstats_t *stats);
+
+BTC_EXTERN void
+btc_chaindb_stats(btc_chaindb_t *db, btc_dbstats_t *stats);
+
+BTC_EXTERN char *
+btc_chaindb_structure(btc_chaindb_t *db);
+
+BTC_EXTERN void
+btc_chaindb_sync_stats(btc_chaindb_t *db, btc_hist_t *hist);
+
 BTC_EXTERN int
 btc_chaindb_open(btc_chaindb_t *db, const char *prefix, unsigned int flags);
 
 BTC_EXTERN void
 btc_chaindb_close(btc_chaindb_t *db);
 
+BTC_EXTERN int
+btc_chaindb_reindex_path(btc_chaindb_t *db, char *path, size_t size);
+
+BTC_EXTERN void
+btc_chaindb_reindex_done(btc_chaindb_t *db);
+
 BTC_EXTERN int
 btc_chaindb_spend(btc_chaindb_t *db,
                   btc_view_t *view,
@@ -42,6 +146,11 @@ btc_chaindb_fill(btc_chaindb_t *db,
                  btc_view_t *view,
                  const btc_tx_t *tx);
 
+BTC_EXTERN void
+btc_chaindb_prefetch(btc_chaindb_t *db,
+                     btc_view_t *view,
+                     const btc_block_t *block);
+
 BTC_EXTERN int
 btc_chaindb_save(btc_chaindb_t *db,
                  btc_entry_t *entry,
@@ -59,6 +168,30 @@ btc_chaindb_disconnect(btc_chaindb_t *db,
                        btc_entry_t *entry,
                        const btc_block_t *block);
 
+BTC_EXTERN int
+btc_chaindb_begin_reorg(btc_chaindb_t *db);
+
+BTC_EXTERN int
+btc_chaindb_end_reorg(btc_chaindb_t *db);
+
+BTC_EXTERN int
+btc_chaindb_flush(btc_chaindb_t *db);
+
+BTC_EXTERN int
+btc_chaindb_refresh(btc_chaindb_t *db);
+
+BTC_EXTERN int
+btc_chaindb_write_snapshot(btc_chaindb_t *db,
+                           const char *path,
+                           uint8_t *checksum,
+                           uint64_t *count);
+
+BTC_EXTERN int
+btc_chaindb_read_snapshot(btc_chaindb_t *db, const char *path);
+
+BTC_EXTERN int
+btc_chaindb_utxo_stats(btc_chaindb_t *db, btc_utxostats_t *stats);
+
 BTC_EXTERN const btc_entry_t *
 btc_chaindb_head(btc_chaindb_t *db);
 
@@ -77,18 +210,166 @@ btc_chaindb_by_height(btc_chaindb_t *db, int32_t height);
 BTC_EXTERN int
 btc_chaindb_is_main(btc_chaindb_t *db, const btc_entry_t *entry);
 
+BTC_EXTERN int64_t
+btc_chaindb_median_time(btc_chaindb_t *db, const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_chaindb_get_state(btc_chaindb_t *db,
+                      const struct btc_deployment_s *deploy,
+                      const btc_entry_t *entry);
+
+BTC_EXTERN void
+btc_chaindb_put_state(btc_chaindb_t *db,
+                      const struct btc_deployment_s *deploy,
+                      const btc_entry_t *entry,
+                      int state);
+
 BTC_EXTERN int
 btc_chaindb_has_coins(btc_chaindb_t *db, const btc_tx_t *tx);
 
 BTC_EXTERN btc_block_t *
 btc_chaindb_get_block(btc_chaindb_t *db, const btc_entry_t *entry);
 
+BTC_EXTERN btc_undo_t *
+btc_chaindb_get_undo(btc_chaindb_t *db, const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_chaindb_has_undo(btc_chaindb_t *db, const btc_entry_t *entry);
+
 BTC_EXTERN int
 btc_chaindb_get_raw_block(btc_chaindb_t *db,
                           uint8_t **data,
                           size_t *length,
                           const btc_entry_t *entry);
 
+BTC_EXTERN const uint8_t *
+btc_chaindb_map_raw_block(btc_chaindb_t *db,
+                          size_t *length,
+                          const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_chaindb_get_raw_undo(btc_chaindb_t *db,
+                         uint8_t **data,
+                         size_t *length,
+                         const btc_entry_t *entry);
+
+BTC_EXTERN const uint8_t *
+btc_chaindb_map_raw_undo(btc_chaindb_t *db,
+                         size_t *length,
+                         const btc_entry_t *entry);
+
+BTC_EXTERN btc_undo_t *
+btc_chaindb_decode_undo(const uint8_t *data, size_t length, int32_t height);
+
+BTC_EXTERN btc_blockfile_t *
+btc_chaindb_open_raw_block(btc_chaindb_t *db,
+                           int64_t *pos,
+                           size_t *length,
+                           const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_chaindb_get_raw_tx(btc_chaindb_t *db,
+                       uint8_t **data,
+                       size_t *length,
+                       const btc_entry_t **entry,
+                       const uint8_t *hash);
+
+BTC_EXTERN btc_tx_t *
+btc_chaindb_get_tx(btc_chaindb_t *db,
+                   const btc_entry_t **entry,
+                   const uint8_t *hash);
+
+/*
+ * Block File Handle
+ */
+
+BTC_EXTERN int
+btc_blockfile_fd(const btc_blockfile_t *file);
+
+BTC_EXTERN void
+btc_blockfile_unref(btc_blockfile_t *file);
+
+/*
+ * Chain Reader
+ */
+
+BTC_EXTERN btc_chainreader_t *
+btc_chainreader_create(btc_chaindb_t *db);
+
+BTC_EXTERN void
+btc_chainreader_destroy(btc_chainreader_t *reader);
+
+BTC_EXTERN int
+btc_chainreader_fill(btc_chainreader_t *reader,
+                     btc_view_t *view,
+                     const btc_tx_t *tx);
+
+BTC_EXTERN btc_coin_t *
+btc_chainreader_get(btc_chainreader_t *reader, const btc_outpoint_t *prevout);
+
+BTC_EXTERN const uint8_t *
+btc_chainreader_tip(const btc_chainreader_t *reader, int32_t *height);
+
+BTC_EXTERN const btc_entry_t *
+btc_chainreader_by_height(btc_chainreader_t *reader, int32_t height);
+
+BTC_EXTERN const btc_entry_t *
+btc_chainreader_by_hash(btc_chainreader_t *reader, const uint8_t *hash);
+
+BTC_EXTERN int32_t
+btc_chainreader_depth(btc_chainreader_t *reader,
+                      const btc_entry_t *entry,
+                      const uint8_t **next);
+
+BTC_EXTERN int
+btc_chainreader_is_main(btc_chainreader_t *reader, const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_chainreader_read(btc_chainreader_t *reader,
+                     btc_block_t **block,
+                     btc_undo_t **undo,
+                     const btc_entry_t *entry);
+
+/*
+ * Coin Scan
+ */
+
+BTC_EXTERN btc_coinscan_t *
+btc_coinscan_create(btc_chaindb_t *db);
+
+BTC_EXTERN void
+btc_coinscan_destroy(btc_coinscan_t *scan);
+
+BTC_EXTERN void
+btc_coinscan_add(btc_coinscan_t *scan, const btc_script_t *script);
+
+BTC_EXTERN int
+btc_coinscan_start(btc_coinscan_t *scan, int ranges);
+
+BTC_EXTERN void
+btc_coinscan_abort(btc_coinscan_t *scan);
+
+BTC_EXTERN int
+btc_coinscan_done(btc_coinscan_t *scan);
+
+BTC_EXTERN int
+btc_coinscan_wait(btc_coinscan_t *scan);
+
+BTC_EXTERN double
+btc_coinscan_progress(btc_coinscan_t *scan);
+
+BTC_EXTERN const uint8_t *
+btc_coinscan_tip(const btc_coinscan_t *scan, int32_t *height);
+
+BTC_EXTERN uint64_t
+btc_coinscan_count(btc_coinscan_t *scan);
+
+BTC_EXTERN size_t
+btc_coinscan_length(const btc_coinscan_t *scan);
+
+BTC_EXTERN const btc_scanitem_t *
+btc_coinscan_item(const btc_coinscan_t *scan, size_t index);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,64 @@
+/*!
+ * fees.h - fee estimation for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_FEES_H
+#define BTC_FEES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "../mako/common.h"
+#include "../mako/types.h"
+
+/*
+ * Constants
+ */
+
+/* Longest confirmation target we track. */
+#define BTC_FEES_MAX_TARGET 25
+
+/*
+ * Fee Estimator
+ */
+
+BTC_EXTERN btc_fees_t *
+btc_fees_create(void);
+
+BTC_EXTERN void
+btc_fees_destroy(btc_fees_t *fees);
+
+BTC_EXTERN void
+btc_fees_reset(btc_fees_t *fees);
+
+BTC_EXTERN void
+btc_fees_add_tx(btc_fees_t *fees,
+                const uint8_t *hash,
+                int32_t height,
+                int64_t rate);
+
+BTC_EXTERN int
+btc_fees_remove_tx(btc_fees_t *fees, const uint8_t *hash);
+
+BTC_EXTERN void
+btc_fees_add_block(btc_fees_t *fees,
+                   int32_t height,
+                   const btc_block_t *block);
+
+BTC_EXTERN int64_t
+btc_fees_estimate(const btc_fees_t *fees, int target);
+
+BTC_EXTERN int64_t
+btc_fees_estimate_smart(const btc_fees_t *fees, int target, int *blocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_FEES_H */
@@ -0,0 +1,75 @@
+/*!
+ * filterdb.h - block filter index for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_FILTERDB_H
+#define BTC_FILTERDB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "../mako/common.h"
+#include "../mako/types.h"
+
+/*
+ * Filter Index
+ */
+
+BTC_EXTERN btc_filterdb_t *
+btc_filterdb_create(btc_chain_t *chain);
+
+BTC_EXTERN void
+btc_filterdb_destroy(btc_filterdb_t *db);
+
+BTC_EXTERN void
+btc_filterdb_set_logger(btc_filterdb_t *db, btc_logger_t *logger);
+
+BTC_EXTERN int
+btc_filterdb_open(btc_filterdb_t *db, const char *prefix, unsigned int flags);
+
+BTC_EXTERN void
+btc_filterdb_close(btc_filterdb_t *db);
+
+BTC_EXTERN void
+btc_filterdb_connect(btc_filterdb_t *db,
+                     const btc_entry_t *entry,
+                     const btc_block_t *block,
+                     const btc_view_t *view);
+
+BTC_EXTERN void
+btc_filterdb_disconnect(btc_filterdb_t *db,
+                        const btc_entry_t *entry,
+                        const btc_block_t *block);
+
+BTC_EXTERN int
+btc_filterdb_enabled(btc_filterdb_t *db);
+
+BTC_EXTERN int32_t
+btc_filterdb_height(btc_filterdb_t *db);
+
+BTC_EXTERN int
+btc_filterdb_get_filter(btc_filterdb_t *db,
+                        btc_buffer_t *filter,
+                        const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_filterdb_get_hash(btc_filterdb_t *db,
+                      uint8_t *hash,
+                      const btc_entry_t *entry);
+
+BTC_EXTERN int
+btc_filterdb_get_header(btc_filterdb_t *db,
+                        uint8_t *header,
+                        const btc_entry_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_FILTERDB_H */
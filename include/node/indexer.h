@@ -0,0 +1,89 @@
+/*!
+ * indexer.h - background index builder for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_INDEXER_H
+#define BTC_INDEXER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "../mako/common.h"
+#include "../mako/types.h"
+
+/*
+ * Types
+ */
+
+typedef struct btc_indexer_s btc_indexer_t;
+
+typedef int btc_indexer_cb(const btc_entry_t *entry,
+                           const btc_block_t *block,
+                           const btc_undo_t *undo,
+                           void *arg);
+
+/*
+ * Indexer
+ */
+
+BTC_EXTERN btc_indexer_t *
+btc_indexer_create(btc_chain_t *chain, const char *name);
+
+BTC_EXTERN void
+btc_indexer_destroy(btc_indexer_t *idx);
+
+BTC_EXTERN void
+btc_indexer_set_logger(btc_indexer_t *idx, btc_logger_t *logger);
+
+BTC_EXTERN void
+btc_indexer_on_connect(btc_indexer_t *idx, btc_indexer_cb *handler);
+
+BTC_EXTERN void
+btc_indexer_on_disconnect(btc_indexer_t *idx, btc_indexer_cb *handler);
+
+BTC_EXTERN void
+btc_indexer_set_context(btc_indexer_t *idx, void *arg);
+
+BTC_EXTERN int
+btc_indexer_start(btc_indexer_t *idx, const btc_entry_t *tip);
+
+BTC_EXTERN void
+btc_indexer_stop(btc_indexer_t *idx);
+
+BTC_EXTERN void
+btc_indexer_connect(btc_indexer_t *idx,
+                    const btc_entry_t *entry,
+                    const btc_block_t *block,
+                    const btc_view_t *view);
+
+BTC_EXTERN void
+btc_indexer_disconnect(btc_indexer_t *idx,
+                       const btc_entry_t *entry,
+                       const btc_block_t *block);
+
+BTC_EXTERN void
+btc_indexer_lock(btc_indexer_t *idx);
+
+BTC_EXTERN void
+btc_indexer_unlock(btc_indexer_t *idx);
+
+BTC_EXTERN const btc_entry_t *
+btc_indexer_tip(btc_indexer_t *idx);
+
+BTC_EXTERN int32_t
+btc_indexer_height(btc_indexer_t *idx);
+
+BTC_EXTERN int
+btc_indexer_syncing(btc_indexer_t *idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_INDEXER_H */
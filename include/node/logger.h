@@ -16,6 +16,18 @@ extern "C" {
 #include "types.h"
 #include "../mako/common.h"
 
+/*
+ * Constants
+ */
+
+enum btc_log_level {
+  BTC_LOG_ERROR,
+  BTC_LOG_WARNING,
+  BTC_LOG_INFO,
+  BTC_LOG_DEBUG,
+  BTC_LOG_SPAM
+};
+
 /*
  * Logger
  */
@@ -29,12 +41,30 @@ btc_logger_destroy(btc_logger_t *logger);
 BTC_EXTERN void
 btc_logger_set_silent(btc_logger_t *logger, int silent);
 
+BTC_EXTERN void
+btc_logger_set_level(btc_logger_t *logger, enum btc_log_level level);
+
+BTC_EXTERN void
+btc_logger_set_debug(btc_logger_t *logger, const char *names);
+
+BTC_EXTERN int
+btc_logger_enabled(const btc_logger_t *logger,
+                   enum btc_log_level level,
+                   const char *pre);
+
 BTC_EXTERN int
 btc_logger_open(btc_logger_t *logger, const char *file);
 
 BTC_EXTERN void
 btc_logger_close(btc_logger_t *logger);
 
+BTC_EXTERN void
+btc_logger_log(btc_logger_t *logger,
+               enum btc_log_level level,
+               const char *pre,
+               const char *fmt,
+               va_list ap);
+
 BTC_EXTERN void
 btc_logger_write(btc_logger_t *logger,
                  const char *pre,
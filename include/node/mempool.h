@@ -24,6 +24,8 @@ extern "C" {
 
 typedef btc_hashmapiter_t btc_mpiter_t;
 
+struct btc_loop_s;
+
 typedef void btc_mempool_tx_cb(const btc_mpentry_t *entry,
                                const btc_view_t *view,
                                void *arg);
@@ -32,6 +34,11 @@ typedef void btc_mempool_badorphan_cb(const btc_verify_error_t *err,
                                       unsigned int id,
                                       void *arg);
 
+typedef void btc_mempool_done_cb(const btc_tx_t *tx,
+                                 int result,
+                                 unsigned int id,
+                                 void *arg);
+
 /*
  * Mempool
  */
@@ -48,6 +55,18 @@ btc_mempool_set_logger(btc_mempool_t *mp, btc_logger_t *logger);
 BTC_EXTERN void
 btc_mempool_set_timedata(btc_mempool_t *mp, const btc_timedata_t *td);
 
+BTC_EXTERN void
+btc_mempool_set_perf(btc_mempool_t *mp, btc_perf_t *perf);
+
+BTC_EXTERN void
+btc_mempool_set_loop(btc_mempool_t *mp, struct btc_loop_s *loop);
+
+BTC_EXTERN void
+btc_mempool_set_threads(btc_mempool_t *mp, int threads);
+
+BTC_EXTERN void
+btc_mempool_set_cpus(btc_mempool_t *mp, const int *cpus, size_t length);
+
 BTC_EXTERN void
 btc_mempool_on_tx(btc_mempool_t *mp, btc_mempool_tx_cb *handler);
 
@@ -69,6 +88,27 @@ btc_mempool_add(btc_mempool_t *mp,
                 const btc_tx_t *tx,
                 unsigned int id);
 
+BTC_EXTERN int
+btc_mempool_add_package(btc_mempool_t *mp,
+                        const btc_txvec_t *txs,
+                        unsigned int id);
+
+BTC_EXTERN void
+btc_mempool_submit(btc_mempool_t *mp,
+                   const btc_tx_t *tx,
+                   unsigned int id,
+                   btc_mempool_done_cb *done,
+                   void *arg);
+
+BTC_EXTERN void
+btc_mempool_drain(btc_mempool_t *mp);
+
+BTC_EXTERN int64_t
+btc_mempool_cost(btc_mempool_t *mp, unsigned int id);
+
+BTC_EXTERN void
+btc_mempool_forget(btc_mempool_t *mp, unsigned int id);
+
 BTC_EXTERN void
 btc_mempool_add_block(btc_mempool_t *mp,
                       const btc_entry_t *entry,
@@ -85,30 +125,68 @@ btc_mempool_handle_reorg(btc_mempool_t *mp);
 BTC_EXTERN const btc_verify_error_t *
 btc_mempool_error(btc_mempool_t *mp);
 
+BTC_EXTERN const btc_fees_t *
+btc_mempool_fees(btc_mempool_t *mp);
+
 BTC_EXTERN size_t
 btc_mempool_size(btc_mempool_t *mp);
 
+BTC_EXTERN size_t
+btc_mempool_usage(btc_mempool_t *mp);
+
+BTC_EXTERN int64_t
+btc_mempool_min_rate(btc_mempool_t *mp);
+
+BTC_EXTERN struct btc_workers_s *
+btc_mempool_workers(btc_mempool_t *mp);
+
 BTC_EXTERN int
 btc_mempool_has(btc_mempool_t *mp, const uint8_t *hash);
 
 BTC_EXTERN const btc_mpentry_t *
 btc_mempool_get(btc_mempool_t *mp, const uint8_t *hash);
 
+BTC_EXTERN int
+btc_mempool_has_wtx(btc_mempool_t *mp, const uint8_t *whash);
+
+BTC_EXTERN const btc_mpentry_t *
+btc_mempool_get_wtx(btc_mempool_t *mp, const uint8_t *whash);
+
+BTC_EXTERN size_t
+btc_mempool_cluster(btc_mempool_t *mp, const uint8_t *hash);
+
 BTC_EXTERN int
 btc_mempool_has_orphan(btc_mempool_t *mp, const uint8_t *hash);
 
+BTC_EXTERN int
+btc_mempool_has_orphan_wtx(btc_mempool_t *mp, const uint8_t *whash);
+
 BTC_EXTERN int
 btc_mempool_has_reject(btc_mempool_t *mp, const uint8_t *hash);
 
+BTC_EXTERN int
+btc_mempool_has_spent(btc_mempool_t *mp, const btc_outpoint_t *prevout);
+
 BTC_EXTERN btc_vector_t *
 btc_mempool_missing(btc_mempool_t *mp, const btc_tx_t *tx);
 
+BTC_EXTERN size_t
+btc_mempool_wtxids(const uint8_t **hashes,
+                   const btc_mpentry_t *const **entries,
+                   btc_mempool_t *mp);
+
 BTC_EXTERN void
 btc_mempool_iterate(btc_mpiter_t *iter, btc_mempool_t *mp);
 
 BTC_EXTERN int
 btc_mempool_next(const btc_mpentry_t **entry, btc_mpiter_t *iter);
 
+BTC_EXTERN void
+btc_mempool_queue(btc_vector_t *queue, btc_mempool_t *mp);
+
+BTC_EXTERN size_t
+btc_mempool_dequeue(const btc_mpentry_t *const **chunk, btc_vector_t *queue);
+
 #ifdef __cplusplus
 }
 #endif
@@ -30,7 +30,6 @@ typedef struct btc_blockentry_s {
   size_t weight;
   int sigops;
   int64_t desc_rate;
-  int dep_count;
 } btc_blockentry_t;
 
 typedef struct btc_blockproof_s {
@@ -94,6 +93,9 @@ btc_tmpl_coinbase(const btc_tmpl_t *bt, uint32_t nonce1, uint32_t nonce2);
 BTC_EXTERN void
 btc_tmpl_compute(uint8_t *root, const btc_tmpl_t *bt, const uint8_t *hash);
 
+BTC_EXTERN uint8_t *
+btc_tmpl_branch(size_t *length, const btc_tmpl_t *bt);
+
 BTC_EXTERN void
 btc_tmpl_root(uint8_t *root,
               const btc_tmpl_t *bt,
@@ -158,6 +160,9 @@ btc_miner_set_logger(btc_miner_t *miner, btc_logger_t *logger);
 BTC_EXTERN void
 btc_miner_set_timedata(btc_miner_t *miner, const btc_timedata_t *td);
 
+BTC_EXTERN void
+btc_miner_set_cpus(btc_miner_t *miner, const int *cpus, size_t length);
+
 BTC_EXTERN int
 btc_miner_open(btc_miner_t *miner, unsigned int flags);
 
@@ -182,6 +187,17 @@ btc_miner_update_time(btc_miner_t *miner, btc_tmpl_t *bt);
 BTC_EXTERN btc_tmpl_t *
 btc_miner_template(btc_miner_t *miner);
 
+BTC_EXTERN const btc_tmpl_t *
+btc_miner_get_template(btc_miner_t *miner);
+
+BTC_EXTERN unsigned int
+btc_miner_updates(btc_miner_t *miner);
+
+BTC_EXTERN void
+btc_miner_add_tx(btc_miner_t *miner,
+                 const btc_tx_t *tx,
+                 const btc_view_t *view);
+
 BTC_EXTERN int
 btc_miner_getgenerate(btc_miner_t *miner);
 
@@ -32,12 +32,24 @@ btc_node_open(btc_node_t *node, const char *prefix, unsigned int flags);
 BTC_EXTERN void
 btc_node_close(btc_node_t *node);
 
+BTC_EXTERN int
+btc_node_replay(btc_node_t *node, const char *dir, int scripts);
+
 BTC_EXTERN void
 btc_node_start(btc_node_t *node);
 
 BTC_EXTERN void
 btc_node_stop(btc_node_t *node);
 
+BTC_EXTERN int
+btc_node_start_trace(btc_node_t *node, size_t events);
+
+BTC_EXTERN int
+btc_node_stop_trace(btc_node_t *node, const char *file, size_t *events);
+
+BTC_EXTERN void
+btc_node_toggle_trace(btc_node_t *node);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,53 @@
+/*!
+ * notify.h - notifications for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_NOTIFY_H
+#define BTC_NOTIFY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "types.h"
+#include "../mako/common.h"
+#include "../mako/types.h"
+
+/*
+ * Notify
+ */
+
+BTC_EXTERN btc_notify_t *
+btc_notify_create(struct btc_loop_s *loop);
+
+BTC_EXTERN void
+btc_notify_destroy(btc_notify_t *notify);
+
+BTC_EXTERN void
+btc_notify_set_logger(btc_notify_t *notify, btc_logger_t *logger);
+
+BTC_EXTERN void
+btc_notify_set_bind(btc_notify_t *notify, const btc_netaddr_t *addr);
+
+BTC_EXTERN int
+btc_notify_open(btc_notify_t *notify, unsigned int flags);
+
+BTC_EXTERN void
+btc_notify_close(btc_notify_t *notify);
+
+BTC_EXTERN void
+btc_notify_tx(btc_notify_t *notify, const btc_tx_t *tx);
+
+BTC_EXTERN void
+btc_notify_block(btc_notify_t *notify,
+                 const btc_entry_t *entry,
+                 const btc_block_t *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_NOTIFY_H */
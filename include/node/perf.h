@@ -0,0 +1,67 @@
+/*!
+ * perf.h - latency histograms for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_PERF_H
+#define BTC_PERF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "../mako/common.h"
+#include "../mako/impl.h"
+
+/*
+ * Histogram
+ */
+
+BTC_EXTERN void
+btc_hist_init(btc_hist_t *hist);
+
+BTC_EXTERN void
+btc_hist_record(btc_hist_t *hist, int64_t value);
+
+BTC_EXTERN void
+btc_hist_merge(btc_hist_t *z, const btc_hist_t *x);
+
+BTC_EXTERN uint64_t
+btc_hist_percentile(const btc_hist_t *hist, double rank);
+
+BTC_EXTERN uint64_t
+btc_hist_mean(const btc_hist_t *hist);
+
+BTC_EXTERN uint64_t
+btc_hist_below(const btc_hist_t *hist, uint64_t value);
+
+/*
+ * Perf
+ */
+
+BTC_DEFINE_OBJECT(btc_perf, BTC_EXTERN)
+
+BTC_EXTERN void
+btc_perf_init(btc_perf_t *perf);
+
+BTC_EXTERN void
+btc_perf_clear(btc_perf_t *perf);
+
+BTC_EXTERN void
+btc_perf_copy(btc_perf_t *z, const btc_perf_t *x);
+
+BTC_EXTERN void
+btc_perf_record(btc_perf_t *perf, enum btc_perf_stage stage, int64_t value);
+
+BTC_EXTERN const char *
+btc_perf_name(enum btc_perf_stage stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_PERF_H */
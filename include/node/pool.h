@@ -12,10 +12,97 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include "types.h"
 #include "../mako/common.h"
+#include "../mako/netmsg.h"
 #include "../mako/types.h"
 
+/*
+ * Constants
+ */
+
+/* A capture file starts with this and the network
+   magic, then holds records of
+     time (8) | peer (4) | kind (1) | size (4) | data
+   in little-endian. Time is in microseconds. Received
+   data is kept as it was read; a sent message is only
+   its command (12) and length (4). */
+#define BTC_CAPTURE_MAGIC 0x70636b6d /* "mkcp" */
+#define BTC_CAPTURE_HEADER 17
+
+enum btc_capture_kind {
+  BTC_CAPTURE_OPEN, /* outbound (1) */
+  BTC_CAPTURE_RECV,
+  BTC_CAPTURE_SEND,
+  BTC_CAPTURE_CLOSE
+};
+
+/*
+ * Types
+ */
+
+typedef struct btc_netstat_s {
+  uint64_t bytes;
+  uint64_t msgs;
+  uint64_t time; /* handling, received only (ns) */
+} btc_netstat_t;
+
+/* Indexed by message type. Commands we
+   don't know are counted as unknown. */
+#define BTC_NETSTAT_TYPES (BTC_MSG_UNKNOWN + 1)
+
+typedef struct btc_peerinfo_s {
+  unsigned int id;
+  btc_netaddr_t addr;
+  btc_netaddr_t local;
+  int inbound;
+  int block_relay;
+  int connected;
+  uint64_t services;
+  uint32_t version;
+  char agent[256 + 1];
+  int32_t height;
+  int64_t time;
+  int64_t last_send;
+  int64_t last_recv;
+  int64_t min_ping;
+  uint64_t addr_processed;
+  uint64_t addr_rate_limited;
+  int ban_score;
+  uint64_t bytes_sent;
+  uint64_t bytes_recv;
+  btc_netstat_t sent[BTC_NETSTAT_TYPES];
+  btc_netstat_t recv[BTC_NETSTAT_TYPES];
+} btc_peerinfo_t;
+
+typedef struct btc_nettotals_s {
+  uint64_t bytes_sent;
+  uint64_t bytes_recv;
+  uint64_t target;
+  int64_t timeframe;
+  uint64_t cycle_sent;
+  int64_t time_left;
+  int target_reached;
+  int serve_historical;
+  size_t inbound;
+  size_t outbound;
+  int decoding;
+  size_t send_queue;
+  size_t recv_buffer;
+  size_t block_buffer;
+  size_t block_buffer_max;
+  size_t blocks_inflight;
+  size_t blocks_held;
+  int throttled;
+  btc_netstat_t sent[BTC_NETSTAT_TYPES];
+  btc_netstat_t recv[BTC_NETSTAT_TYPES];
+} btc_nettotals_t;
+
+/*
+ * Pool
+ */
+
 BTC_EXTERN btc_pool_t *
 btc_pool_create(const btc_network_t *network,
                 struct btc_loop_s *loop,
@@ -31,6 +118,15 @@ btc_pool_set_logger(btc_pool_t *pool, btc_logger_t *logger);
 BTC_EXTERN void
 btc_pool_set_timedata(btc_pool_t *pool, btc_timedata_t *td);
 
+BTC_EXTERN void
+btc_pool_set_perf(btc_pool_t *pool, btc_perf_t *perf);
+
+BTC_EXTERN void
+btc_pool_set_filterdb(btc_pool_t *pool, btc_filterdb_t *filterdb);
+
+BTC_EXTERN void
+btc_pool_set_threads(btc_pool_t *pool, int threads);
+
 BTC_EXTERN void
 btc_pool_set_port(btc_pool_t *pool, int port);
 
@@ -55,15 +151,48 @@ btc_pool_set_maxoutbound(btc_pool_t *pool, size_t max_outbound);
 BTC_EXTERN void
 btc_pool_set_bantime(btc_pool_t *pool, int64_t ban_time);
 
+BTC_EXTERN void
+btc_pool_set_uploadtarget(btc_pool_t *pool, uint64_t target);
+
+BTC_EXTERN void
+btc_pool_set_blockbuffer(btc_pool_t *pool, size_t size);
+
 BTC_EXTERN void
 btc_pool_set_onlynet(btc_pool_t *pool, enum btc_ipnet only_net);
 
+BTC_EXTERN void
+btc_pool_set_v2(btc_pool_t *pool, int enable);
+
+BTC_EXTERN void
+btc_pool_set_relay(btc_pool_t *pool, int port);
+
+BTC_EXTERN void
+btc_pool_add_relay(btc_pool_t *pool, const btc_netaddr_t *addr);
+
+BTC_EXTERN void
+btc_pool_set_headers(btc_pool_t *pool, const char *path);
+
+BTC_EXTERN void
+btc_pool_set_capture(btc_pool_t *pool, const char *path);
+
+BTC_EXTERN int
+btc_pool_load(btc_pool_t *pool, const char *prefix, unsigned int flags);
+
+BTC_EXTERN void
+btc_pool_unload(btc_pool_t *pool);
+
 BTC_EXTERN int
 btc_pool_open(btc_pool_t *pool, const char *prefix, unsigned int flags);
 
 BTC_EXTERN void
 btc_pool_close(btc_pool_t *pool);
 
+BTC_EXTERN size_t
+btc_pool_peerinfo(btc_pool_t *pool, btc_peerinfo_t **out);
+
+BTC_EXTERN void
+btc_pool_nettotals(btc_pool_t *pool, btc_nettotals_t *out);
+
 #ifdef __cplusplus
 }
 #endif
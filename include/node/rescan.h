@@ -0,0 +1,91 @@
+/*!
+ * rescan.h - script rescanner for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_RESCAN_H
+#define BTC_RESCAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "../mako/common.h"
+#include "../mako/types.h"
+
+/*
+ * Types
+ */
+
+typedef struct btc_rescanmatch_s {
+  const btc_entry_t *entry;
+  uint8_t hash[32];
+  uint32_t index;
+  int spend;
+  btc_outpoint_t prevout;
+  int64_t value;
+  const btc_script_t *script;
+} btc_rescanmatch_t;
+
+typedef void btc_rescan_f(const btc_rescanmatch_t *match, void *arg);
+
+/*
+ * Rescan
+ */
+
+BTC_EXTERN btc_rescan_t *
+btc_rescan_create(void);
+
+BTC_EXTERN void
+btc_rescan_destroy(btc_rescan_t *scan);
+
+BTC_EXTERN int
+btc_rescan_watch(btc_rescan_t *scan, const btc_script_t *script);
+
+BTC_EXTERN size_t
+btc_rescan_size(const btc_rescan_t *scan);
+
+BTC_EXTERN int
+btc_rescan_run(btc_rescan_t *scan,
+               btc_chain_t *chain,
+               int32_t start,
+               int32_t end,
+               btc_rescan_f *callback,
+               void *arg);
+
+/*
+ * Rescan Cursor
+ */
+
+BTC_EXTERN btc_rescancursor_t *
+btc_rescancursor_create(const btc_rescan_t *scan,
+                        btc_chain_t *chain,
+                        int32_t start,
+                        int32_t end);
+
+BTC_EXTERN void
+btc_rescancursor_destroy(btc_rescancursor_t *cur);
+
+BTC_EXTERN int
+btc_rescancursor_done(const btc_rescancursor_t *cur);
+
+BTC_EXTERN int32_t
+btc_rescancursor_height(const btc_rescancursor_t *cur);
+
+BTC_EXTERN int32_t
+btc_rescancursor_missing(const btc_rescancursor_t *cur);
+
+BTC_EXTERN int
+btc_rescancursor_next(btc_rescancursor_t *cur,
+                      btc_rescan_f *callback,
+                      void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_RESCAN_H */
@@ -29,9 +29,15 @@ btc_rpc_destroy(btc_rpc_t *rpc);
 BTC_EXTERN void
 btc_rpc_set_bind(btc_rpc_t *rpc, const btc_netaddr_t *addr);
 
+BTC_EXTERN void
+btc_rpc_set_threads(btc_rpc_t *rpc, int threads);
+
 BTC_EXTERN void
 btc_rpc_set_credentials(btc_rpc_t *rpc, const char *user, const char *pass);
 
+BTC_EXTERN void
+btc_rpc_set_warmup(btc_rpc_t *rpc, const char *status);
+
 BTC_EXTERN int
 btc_rpc_open(btc_rpc_t *rpc, unsigned int flags);
 
@@ -0,0 +1,51 @@
+/*!
+ * stratum.h - stratum server for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_STRATUM_H
+#define BTC_STRATUM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "types.h"
+#include "../mako/common.h"
+#include "../mako/types.h"
+
+/*
+ * Stratum
+ */
+
+BTC_EXTERN btc_stratum_t *
+btc_stratum_create(const btc_network_t *network,
+                   struct btc_loop_s *loop,
+                   btc_chain_t *chain,
+                   btc_miner_t *miner);
+
+BTC_EXTERN void
+btc_stratum_destroy(btc_stratum_t *stratum);
+
+BTC_EXTERN void
+btc_stratum_set_logger(btc_stratum_t *stratum, btc_logger_t *logger);
+
+BTC_EXTERN void
+btc_stratum_set_bind(btc_stratum_t *stratum, const btc_netaddr_t *addr);
+
+BTC_EXTERN void
+btc_stratum_set_difficulty(btc_stratum_t *stratum, double difficulty);
+
+BTC_EXTERN int
+btc_stratum_open(btc_stratum_t *stratum, unsigned int flags);
+
+BTC_EXTERN void
+btc_stratum_close(btc_stratum_t *stratum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_STRATUM_H */
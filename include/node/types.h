@@ -24,7 +24,15 @@ enum btc_node_flags {
    */
   BTC_CHAIN_CHECKPOINTS = 1 << 0,
   BTC_CHAIN_PRUNE = 1 << 1,
-  BTC_CHAIN_DEFAULT_FLAGS = BTC_CHAIN_CHECKPOINTS,
+  BTC_CHAIN_MMAP = 1 << 16,
+  BTC_CHAIN_WORKER = 1 << 17,
+  BTC_CHAIN_TXINDEX = 1 << 22,
+  BTC_CHAIN_REINDEX = 1 << 25,
+  BTC_CHAIN_COINSTATS = 1 << 27,
+  BTC_CHAIN_COINGROUPS = 1 << 28,
+  BTC_CHAIN_HUGEPAGES = 1 << 29,
+  BTC_CHAIN_READONLY = 1 << 30,
+  BTC_CHAIN_DEFAULT_FLAGS = BTC_CHAIN_CHECKPOINTS | BTC_CHAIN_MMAP,
 
   /*
    * Mempool
@@ -48,6 +56,7 @@ enum btc_node_flags {
   BTC_POOL_BIP37 = 1 << 13,
   BTC_POOL_BIP152 = 1 << 14,
   BTC_POOL_BIP157 = 1 << 15,
+  BTC_POOL_BIP330 = 1 << 26,
   BTC_POOL_DEFAULT_FLAGS = BTC_POOL_LISTEN
                          | BTC_POOL_CHECKPOINTS
                          | BTC_POOL_DISCOVER
@@ -61,15 +70,46 @@ enum btc_node_flags {
   /*
    * RPC
    */
-  BTC_RPC_DEFAULT_FLAGS = 0
+  BTC_RPC_REST = 1 << 18,
+  BTC_RPC_METRICS = 1 << 24,
+  BTC_RPC_DEFAULT_FLAGS = 0,
+
+  /*
+   * Notify
+   */
+  BTC_NOTIFY_LISTEN = 1 << 19,
+
+  /*
+   * Stratum
+   */
+  BTC_STRATUM_LISTEN = 1 << 20,
+
+  /*
+   * Filter Index
+   */
+  BTC_FILTER_INDEX = 1 << 21,
+
+  /*
+   * Address Index
+   */
+  BTC_ADDR_INDEX = 1 << 23
 };
 
+/* Enumerators must fit in an int, which leaves
+   the top bit of the (unsigned) flags to macros. */
+#define BTC_CHAIN_MEMORY (1U << 31)
+
 /*
  * Types
  */
 
+struct btc_deployment_s;
 struct btc_network_s;
 struct btc_loop_s;
+struct btc_dbstats_s;
+struct btc_dbtune_s;
+struct btc_utxostats_s;
+struct btc_workers_s;
 
 typedef struct btc_addrman_s btc_addrman_t;
 
@@ -81,7 +121,10 @@ typedef struct btc_deployment_state_s {
   int bip148;
 } btc_deployment_state_t;
 
+typedef struct btc_blockfile_s btc_blockfile_t;
 typedef struct btc_chaindb_s btc_chaindb_t;
+typedef struct btc_chainreader_s btc_chainreader_t;
+typedef struct btc_coinscan_s btc_coinscan_t;
 typedef struct btc_chain_s btc_chain_t;
 
 typedef struct btc_logger_s btc_logger_t;
@@ -93,24 +136,77 @@ typedef struct btc_timedata_s {
   int checked;
 } btc_timedata_t;
 
+/* Log-linear buckets: exact below 8, then eight
+   per power of two (~12.5% error) up to 2^42ns. */
+#define BTC_HIST_BUCKETS 328
+
+typedef struct btc_hist_s {
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint32_t buckets[BTC_HIST_BUCKETS];
+} btc_hist_t;
+
+enum btc_perf_stage {
+  BTC_PERF_BLOCK_DECODE,
+  BTC_PERF_BLOCK_SANITY,
+  BTC_PERF_BLOCK_COINS,
+  BTC_PERF_BLOCK_SCRIPTS,
+  BTC_PERF_BLOCK_SAVE,
+  BTC_PERF_BLOCK_CONNECT,
+  BTC_PERF_TX_CHECK,
+  BTC_PERF_TX_SCRIPTS,
+  BTC_PERF_TX_ADD,
+  BTC_PERF_TX_ACCEPT,
+  BTC_PERF_LOOP_POLL,
+  BTC_PERF_MAX
+};
+
+typedef struct btc_perf_s {
+  btc_hist_t stages[BTC_PERF_MAX];
+} btc_perf_t;
+
 typedef struct btc_pool_s btc_pool_t;
 
 typedef struct btc_mempool_s btc_mempool_t;
 
+typedef struct btc_fees_s btc_fees_t;
+
 typedef struct btc_miner_s btc_miner_t;
 
 typedef struct btc_rpc_s btc_rpc_t;
 
+typedef struct btc_notify_s btc_notify_t;
+
+typedef struct btc_stratum_s btc_stratum_t;
+
+typedef struct btc_filterdb_s btc_filterdb_t;
+
+typedef struct btc_addrindex_s btc_addrindex_t;
+
+typedef struct btc_rescan_s btc_rescan_t;
+
+typedef struct btc_rescancursor_s btc_rescancursor_t;
+
 typedef struct btc_node_s {
   const struct btc_network_s *network;
   struct btc_loop_s *loop;
   btc_logger_t *logger;
   btc_timedata_t *timedata;
+  btc_perf_t *perf;
   btc_chain_t *chain;
   btc_mempool_t *mempool;
   btc_miner_t *miner;
   btc_pool_t *pool;
   btc_rpc_t *rpc;
+  btc_notify_t *notify;
+  btc_stratum_t *stratum;
+  btc_filterdb_t *filterdb;
+  btc_addrindex_t *addrindex;
+  char *trace_file;
+  volatile int trace_toggle;
+  int readonly;
+  int64_t refreshed;
 } btc_node_t;
 
 #ifdef __cplusplus
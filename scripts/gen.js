@@ -12,14 +12,15 @@ class Element {
   }
 
   encode(num, width) {
-    const space = width === 32 ? 4 : 2;
+    const word = width === 32 ? 32 : 64;
+    const space = word === 32 ? 4 : 2;
     const limbs = this.convert(num, width);
     const out = [];
 
     for (const limb of limbs) {
-      let hex = '0x' + limb.toString(16, width / 4);
+      let hex = '0x' + limb.toString(16, word / 4);
 
-      if (width === 64)
+      if (word === 64)
         hex = `UINT64_C(${hex})`;
 
       out.push(hex);
@@ -61,15 +62,22 @@ class Saturated extends Element {
 }
 
 class Unsaturated extends Element {
-  constructor(m, bounds32, bounds64) {
+  constructor(m, bounds32, bounds64, bounds52 = null) {
     super(m);
 
     this.bounds32 = bounds32.map(n => new BN(n, 16));
     this.bounds64 = bounds64.map(n => new BN(n, 16));
+    this.bounds52 = bounds52 ? bounds52.map(n => new BN(n, 16)) : null;
   }
 
   convert(num, width) {
-    const bounds = width === 32 ? this.bounds32 : this.bounds64;
+    const bounds = width === 32 ? this.bounds32
+                 : width === 52 ? this.bounds52
+                 : this.bounds64;
+
+    if (!bounds)
+      throw new Error('No limb bounds for width.');
+
     const x = num.red ? num.fromRed() : num.clone();
     const limbs = bounds.length;
     const out = new Array(limbs);
@@ -181,7 +189,10 @@ const fields = {
                               '200000', '400000', '200000', '200000'],
                              ['80000000000', '80000000000',
                               '40000000000', '80000000000',
-                              '80000000000', '40000000000']),
+                              '80000000000', '40000000000'],
+                             ['10000000000000', '10000000000000',
+                              '10000000000000', '10000000000000',
+                              '1000000000000']),
   P25519: new Unsaturated(curves.ED25519.p,
                           ['4000000', '2000000', '4000000', '2000000',
                            '4000000', '2000000', '4000000', '2000000',
@@ -407,6 +418,7 @@ function encodeFieldConstants(c) {
 function encodePrimeField(field) {
   const c32 = new FieldEncoder(field, 32);
   const c64 = new FieldEncoder(field, 64);
+  const c52 = new FieldEncoder(field, 52);
   const size = c32.m.byteLength();
 
   console.log('/*');
@@ -426,7 +438,15 @@ function encodePrimeField(field) {
 
   console.log('');
 
-  console.log('#if defined(BTC_HAVE_INT128)');
+  if (fields[field].bounds52) {
+    console.log('#if defined(BTC_HAVE_INT128) && defined(BTC_FIELD_5X52)');
+    console.log('');
+    encodeFieldConstants(c52);
+    console.log('#elif defined(BTC_HAVE_INT128)');
+  } else {
+    console.log('#if defined(BTC_HAVE_INT128)');
+  }
+
   console.log('');
   encodeFieldConstants(c64);
   console.log('#else');
@@ -538,6 +558,7 @@ function encodeShortCurveFields(curve, c) {
 function encodeCurve(curve, primeField, scalarField) {
   const c32 = new CurveEncoder(curve, primeField, scalarField, 32);
   const c64 = new CurveEncoder(curve, primeField, scalarField, 64);
+  const c52 = new CurveEncoder(curve, primeField, scalarField, 52);
 
   console.log('/*');
   console.log(' * Curve');
@@ -553,7 +574,15 @@ function encodeCurve(curve, primeField, scalarField) {
   console.log('#endif');
   console.log('');
 
-  console.log('#if defined(BTC_HAVE_INT128)');
+  if (fields[primeField].bounds52) {
+    console.log('#if defined(BTC_HAVE_INT128) && defined(BTC_FIELD_5X52)');
+    console.log('');
+    encodeShortCurveFields(curve, c52);
+    console.log('#elif defined(BTC_HAVE_INT128)');
+  } else {
+    console.log('#if defined(BTC_HAVE_INT128)');
+  }
+
   console.log('');
   encodeShortCurveFields(curve, c64);
   console.log('#else');
@@ -5,14 +5,34 @@
  *
  * Resources:
  *   https://tools.ietf.org/html/rfc4648
+ *   http://0x80.pl/notesen/2022-01-17-validating-hex-parse.html
  */
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <mako/cpu.h>
 #include <mako/encoding.h>
 #include "internal.h"
 
+/*
+ * Backends
+ */
+
+#if defined(BTC_HAVE_ASM) && (BTC_GNUC_PREREQ(4, 9) || defined(__clang__))
+#  if defined(__x86_64__) || defined(__i386__)
+#    define BASE16_HAVE_SSSE3
+#    define BASE16_HAVE_AVX2
+#    include <immintrin.h>
+#  endif
+#endif
+
+/* NEON is part of the aarch64 baseline. */
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#  define BASE16_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
 /*
  * Base16 Engine
  */
@@ -54,12 +74,406 @@ static const signed char base16_table[256] = {
   -1, -1, -1, -1, -1, -1, -1, -1
 };
 
+/*
+ * Base16 (SSSE3)
+ */
+
+/* Every backend below converts whole blocks and
+ * returns the number of bytes (or characters) it
+ * consumed, leaving the tail to the scalar loop.
+ * With `rev` set, blocks are taken from the end of
+ * the input and byte-swapped (for hashes).
+ *
+ * Decoding maps digits and letters to nibbles in
+ * parallel and folds the validity of every lane
+ * into a single mask, checked once at the end.
+ */
+
+#if defined(BASE16_HAVE_SSSE3)
+__attribute__((target("ssse3"))) static size_t
+base16_encode_ssse3(char *zp, const uint8_t *xp, size_t xn, int rev) {
+  const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+  const __m128i swap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                     7, 6, 5, 4, 3, 2, 1, 0);
+  const __m128i mask = _mm_set1_epi8(15);
+  size_t n = xn & ~(size_t)15;
+  __m128i x, hi, lo;
+  size_t i;
+
+  for (i = 0; i < n; i += 16) {
+    if (rev) {
+      x = _mm_loadu_si128((const __m128i *)(xp + xn - 16 - i));
+      x = _mm_shuffle_epi8(x, swap);
+    } else {
+      x = _mm_loadu_si128((const __m128i *)(xp + i));
+    }
+
+    hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+    lo = _mm_shuffle_epi8(lut, _mm_and_si128(x, mask));
+
+    _mm_storeu_si128((__m128i *)(zp + i * 2 + 0), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(zp + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+
+  return n;
+}
+
+__attribute__((target("ssse3"))) static __m128i
+base16_nibbles_ssse3(__m128i x, __m128i *valid) {
+  const __m128i neg = _mm_set1_epi8(-1);
+  __m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+  __m128i l = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+                           _mm_set1_epi8('a'));
+  __m128i vd = _mm_and_si128(_mm_cmpgt_epi8(d, neg),
+                             _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+  __m128i vl = _mm_and_si128(_mm_cmpgt_epi8(l, neg),
+                             _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+
+  l = _mm_add_epi8(l, _mm_set1_epi8(10));
+
+  *valid = _mm_and_si128(*valid, _mm_or_si128(vd, vl));
+
+  return _mm_or_si128(_mm_and_si128(d, vd), _mm_and_si128(l, vl));
+}
+
+__attribute__((target("ssse3"))) static size_t
+base16_decode_ssse3(uint8_t *zp, const char *xp, size_t xn, int rev, int *z) {
+  const __m128i swap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                     7, 6, 5, 4, 3, 2, 1, 0);
+  const __m128i weights = _mm_set1_epi16(0x0110);
+  __m128i valid = _mm_set1_epi8(-1);
+  size_t n = xn & ~(size_t)31;
+  const char *sp;
+  __m128i a, b;
+  size_t i;
+
+  for (i = 0; i < n; i += 32) {
+    sp = rev ? xp + xn - 32 - i : xp + i;
+
+    a = _mm_loadu_si128((const __m128i *)(sp + 0));
+    b = _mm_loadu_si128((const __m128i *)(sp + 16));
+
+    /* (hi << 4) | lo for each pair of characters. */
+    a = _mm_maddubs_epi16(base16_nibbles_ssse3(a, &valid), weights);
+    b = _mm_maddubs_epi16(base16_nibbles_ssse3(b, &valid), weights);
+    a = _mm_packus_epi16(a, b);
+
+    if (rev)
+      a = _mm_shuffle_epi8(a, swap);
+
+    _mm_storeu_si128((__m128i *)(zp + i / 2), a);
+  }
+
+  if (_mm_movemask_epi8(valid) != 0xffff)
+    *z = -1;
+
+  return n;
+}
+#endif /* BASE16_HAVE_SSSE3 */
+
+/*
+ * Base16 (AVX2)
+ */
+
+#if defined(BASE16_HAVE_AVX2)
+__attribute__((target("avx2"))) static size_t
+base16_encode_avx2(char *zp, const uint8_t *xp, size_t xn, int rev) {
+  const __m256i lut = _mm256_setr_epi8(
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+  const __m256i swap = _mm256_setr_epi8(
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i mask = _mm256_set1_epi8(15);
+  size_t n = xn & ~(size_t)31;
+  __m256i x, hi, lo, a, b;
+  size_t i;
+
+  for (i = 0; i < n; i += 32) {
+    if (rev) {
+      x = _mm256_loadu_si256((const __m256i *)(xp + xn - 32 - i));
+      x = _mm256_shuffle_epi8(x, swap);
+      x = _mm256_permute4x64_epi64(x, 0x4e);
+    } else {
+      x = _mm256_loadu_si256((const __m256i *)(xp + i));
+    }
+
+    hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), mask);
+    lo = _mm256_and_si256(x, mask);
+    hi = _mm256_shuffle_epi8(lut, hi);
+    lo = _mm256_shuffle_epi8(lut, lo);
+
+    /* Unpacking works within 128 bit lanes. */
+    a = _mm256_unpacklo_epi8(hi, lo);
+    b = _mm256_unpackhi_epi8(hi, lo);
+
+    _mm256_storeu_si256((__m256i *)(zp + i * 2 + 0),
+                        _mm256_permute2x128_si256(a, b, 0x20));
+
+    _mm256_storeu_si256((__m256i *)(zp + i * 2 + 32),
+                        _mm256_permute2x128_si256(a, b, 0x31));
+  }
+
+  return n;
+}
+
+__attribute__((target("avx2"))) static __m256i
+base16_nibbles_avx2(__m256i x, __m256i *valid) {
+  const __m256i neg = _mm256_set1_epi8(-1);
+  __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8('0'));
+  __m256i l = _mm256_sub_epi8(_mm256_or_si256(x, _mm256_set1_epi8(0x20)),
+                              _mm256_set1_epi8('a'));
+  __m256i vd = _mm256_and_si256(_mm256_cmpgt_epi8(d, neg),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(10), d));
+  __m256i vl = _mm256_and_si256(_mm256_cmpgt_epi8(l, neg),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(6), l));
+
+  l = _mm256_add_epi8(l, _mm256_set1_epi8(10));
+
+  *valid = _mm256_and_si256(*valid, _mm256_or_si256(vd, vl));
+
+  return _mm256_or_si256(_mm256_and_si256(d, vd), _mm256_and_si256(l, vl));
+}
+
+__attribute__((target("avx2"))) static size_t
+base16_decode_avx2(uint8_t *zp, const char *xp, size_t xn, int rev, int *z) {
+  const __m256i swap = _mm256_setr_epi8(
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i weights = _mm256_set1_epi16(0x0110);
+  __m256i valid = _mm256_set1_epi8(-1);
+  size_t n = xn & ~(size_t)63;
+  const char *sp;
+  __m256i a, b;
+  size_t i;
+
+  for (i = 0; i < n; i += 64) {
+    sp = rev ? xp + xn - 64 - i : xp + i;
+
+    a = _mm256_loadu_si256((const __m256i *)(sp + 0));
+    b = _mm256_loadu_si256((const __m256i *)(sp + 32));
+
+    a = _mm256_maddubs_epi16(base16_nibbles_avx2(a, &valid), weights);
+    b = _mm256_maddubs_epi16(base16_nibbles_avx2(b, &valid), weights);
+
+    /* Packing interleaves the 128 bit lanes. */
+    a = _mm256_packus_epi16(a, b);
+    a = _mm256_permute4x64_epi64(a, 0xd8);
+
+    if (rev) {
+      a = _mm256_shuffle_epi8(a, swap);
+      a = _mm256_permute4x64_epi64(a, 0x4e);
+    }
+
+    _mm256_storeu_si256((__m256i *)(zp + i / 2), a);
+  }
+
+  if (_mm256_movemask_epi8(valid) != -1)
+    *z = -1;
+
+  return n;
+}
+#endif /* BASE16_HAVE_AVX2 */
+
+/*
+ * Base16 (NEON)
+ */
+
+#if defined(BASE16_HAVE_NEON)
+static size_t
+base16_encode_neon(char *zp, const uint8_t *xp, size_t xn, int rev) {
+  static const uint8_t chars[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+  };
+  const uint8x16_t lut = vld1q_u8(chars);
+  const uint8x16_t mask = vdupq_n_u8(15);
+  size_t n = xn & ~(size_t)15;
+  uint8x16x2_t y;
+  uint8x16_t x;
+  size_t i;
+
+  for (i = 0; i < n; i += 16) {
+    if (rev) {
+      x = vld1q_u8(xp + xn - 16 - i);
+      x = vrev64q_u8(x);
+      x = vextq_u8(x, x, 8);
+    } else {
+      x = vld1q_u8(xp + i);
+    }
+
+    y.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(x, 4));
+    y.val[1] = vqtbl1q_u8(lut, vandq_u8(x, mask));
+
+    vst2q_u8((uint8_t *)zp + i * 2, y);
+  }
+
+  return n;
+}
+
+static uint8x16_t
+base16_nibbles_neon(uint8x16_t x, uint8x16_t *valid) {
+  uint8x16_t d = vsubq_u8(x, vdupq_n_u8('0'));
+  uint8x16_t l = vsubq_u8(vorrq_u8(x, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+  uint8x16_t vd = vcleq_u8(d, vdupq_n_u8(9));
+  uint8x16_t vl = vcleq_u8(l, vdupq_n_u8(5));
+
+  l = vaddq_u8(l, vdupq_n_u8(10));
+
+  *valid = vandq_u8(*valid, vorrq_u8(vd, vl));
+
+  return vorrq_u8(vandq_u8(d, vd), vandq_u8(l, vl));
+}
+
+static size_t
+base16_decode_neon(uint8_t *zp, const char *xp, size_t xn, int rev, int *z) {
+  uint8x16_t valid = vdupq_n_u8(0xff);
+  size_t n = xn & ~(size_t)31;
+  uint8x16_t hi, lo, x;
+  const char *sp;
+  uint8x16x2_t y;
+  size_t i;
+
+  for (i = 0; i < n; i += 32) {
+    sp = rev ? xp + xn - 32 - i : xp + i;
+
+    /* De-interleaves high and low characters. */
+    y = vld2q_u8((const uint8_t *)sp);
+
+    hi = base16_nibbles_neon(y.val[0], &valid);
+    lo = base16_nibbles_neon(y.val[1], &valid);
+
+    x = vorrq_u8(vshlq_n_u8(hi, 4), lo);
+
+    if (rev) {
+      x = vrev64q_u8(x);
+      x = vextq_u8(x, x, 8);
+    }
+
+    vst1q_u8(zp + i / 2, x);
+  }
+
+  if (vminvq_u8(valid) != 0xff)
+    *z = -1;
+
+  return n;
+}
+#endif /* BASE16_HAVE_NEON */
+
+/*
+ * CPU Detection
+ */
+
+#define BASE16_CPU_SSSE3 1
+#define BASE16_CPU_AVX2 2
+
+static int
+base16_cpu(void) {
+  unsigned int cpu = BTC_CPU_FEATURES();
+  int flags = 0;
+
+  if (cpu & BTC_CPU_SSSE3)
+    flags |= BASE16_CPU_SSSE3;
+
+  if (cpu & BTC_CPU_AVX2)
+    flags |= BASE16_CPU_AVX2;
+
+  return flags;
+}
+
+const char *
+btc_base16_backend(void) {
+  int cpu = base16_cpu();
+
+#if defined(BASE16_HAVE_AVX2)
+  if (cpu & BASE16_CPU_AVX2)
+    return "avx2";
+#endif
+
+#if defined(BASE16_HAVE_SSSE3)
+  if (cpu & BASE16_CPU_SSSE3)
+    return "ssse3";
+#endif
+
+#if defined(BASE16_HAVE_NEON)
+  return "neon";
+#endif
+
+  (void)cpu;
+
+  return "generic";
+}
+
+static size_t
+base16_encode_fast(char *zp, const uint8_t *xp, size_t xn, int rev) {
+  int cpu = base16_cpu();
+
+#if defined(BASE16_HAVE_AVX2)
+  if (cpu & BASE16_CPU_AVX2)
+    return base16_encode_avx2(zp, xp, xn, rev);
+#endif
+
+#if defined(BASE16_HAVE_SSSE3)
+  if (cpu & BASE16_CPU_SSSE3)
+    return base16_encode_ssse3(zp, xp, xn, rev);
+#endif
+
+#if defined(BASE16_HAVE_NEON)
+  return base16_encode_neon(zp, xp, xn, rev);
+#endif
+
+  (void)cpu;
+  (void)zp;
+  (void)xp;
+  (void)xn;
+  (void)rev;
+
+  return 0;
+}
+
+static size_t
+base16_decode_fast(uint8_t *zp, const char *xp, size_t xn, int rev, int *z) {
+  int cpu = base16_cpu();
+
+#if defined(BASE16_HAVE_AVX2)
+  if (cpu & BASE16_CPU_AVX2)
+    return base16_decode_avx2(zp, xp, xn, rev, z);
+#endif
+
+#if defined(BASE16_HAVE_SSSE3)
+  if (cpu & BASE16_CPU_SSSE3)
+    return base16_decode_ssse3(zp, xp, xn, rev, z);
+#endif
+
+#if defined(BASE16_HAVE_NEON)
+  return base16_decode_neon(zp, xp, xn, rev, z);
+#endif
+
+  (void)cpu;
+  (void)zp;
+  (void)xp;
+  (void)xn;
+  (void)rev;
+  (void)z;
+
+  return 0;
+}
+
 /*
  * Base16
  */
 
 void
 btc_base16_encode(char *zp, const uint8_t *xp, size_t xn) {
+  size_t n = base16_encode_fast(zp, xp, xn, 0);
+
+  zp += n * 2;
+  xp += n;
+  xn -= n;
+
   while (xn--) {
     int ch = *xp++;
 
@@ -73,10 +487,16 @@ btc_base16_encode(char *zp, const uint8_t *xp, size_t xn) {
 int
 btc_base16_decode(uint8_t *zp, const char *xp, size_t xn) {
   int z = 0;
+  size_t n;
 
   if (xn & 1)
     return 0;
 
+  n = base16_decode_fast(zp, xp, xn, 0, &z);
+
+  zp += n / 2;
+  xp += n;
+  xn -= n;
   xn >>= 1;
 
   while (xn--) {
@@ -112,6 +532,10 @@ btc_base16_test(const char *xp) {
 
 void
 btc_base16le_encode(char *zp, const uint8_t *xp, size_t xn) {
+  size_t n = base16_encode_fast(zp, xp, xn, 1);
+
+  zp += n * 2;
+  xn -= n;
   xp += xn;
 
   while (xn--) {
@@ -127,10 +551,15 @@ btc_base16le_encode(char *zp, const uint8_t *xp, size_t xn) {
 int
 btc_base16le_decode(uint8_t *zp, const char *xp, size_t xn) {
   int z = 0;
+  size_t n;
 
   if (xn & 1)
     return 0;
 
+  n = base16_decode_fast(zp, xp, xn, 1, &z);
+
+  zp += n / 2;
+  xn -= n;
   xp += xn;
   xn >>= 1;
 
@@ -12,6 +12,7 @@
 #include <string.h>
 #include <mako/encoding.h>
 #include <mako/util.h>
+#include "bio.h"
 #include "internal.h"
 
 /*
@@ -56,120 +57,181 @@ static const signed char base58_table[256] = {
   -1, -1, -1, -1, -1, -1, -1, -1
 };
 
+/* We convert between bases in limbs rather than one
+ * digit at a time. Base58 digits are grouped five to
+ * a limb (58^5 < 2^30) and bytes four to a limb, so
+ * that a limb times the other base always fits into
+ * 64 bits. This cuts the inner loop of the quadratic
+ * conversion by a factor of ~20.
+ */
+
+#define B58_POW5 UINT32_C(656356768) /* 58^5 */
+
+static const uint32_t base58_pow[6] = {
+  1, 58, 3364, 195112, 11316496, 656356768
+};
+
 void
 btc_base58_encode(char *zp, const uint8_t *xp, size_t xn) {
-  uint8_t b58[(512 * 138) / 100 + 1]; /* 707 */
-  int i, j, k, size, carry;
-  int zeroes = 0;
-  int length = 0;
+  uint32_t limbs[((512 * 138) / 100 + 1 + 4) / 5]; /* 142 */
+  size_t i, j, n, pos;
+  size_t zeroes = 0;
+  size_t length = 0;
+  uint64_t carry;
+  uint32_t top;
 
   if (xn > 512)
     abort(); /* LCOV_EXCL_LINE */
 
-  for (i = 0; i < (int)xn; i++) {
+  for (i = 0; i < xn; i++) {
     if (xp[i] != 0)
       break;
 
     zeroes += 1;
   }
 
-  size = ((xn - zeroes) * 138) / 100 + 1;
+  /* Absorb 32 bits at a time, leading bytes first. */
+  n = (xn - i) & 3;
 
-  memset(b58, 0, size);
+  if (n == 0)
+    n = 4;
 
-  for (; i < (int)xn; i++) {
-    carry = xp[i];
+  while (i < xn) {
+    carry = 0;
 
-    for (j = 0, k = size - 1; j < size; j++, k--) {
-      if (carry == 0 && j >= length)
-        break;
+    for (j = 0; j < n; j++)
+      carry = (carry << 8) | xp[i++];
 
-      carry += (int)b58[k] << 8;
-      b58[k] = carry % 58;
-      carry /= 58;
+    for (j = 0; j < length; j++) {
+      carry += (uint64_t)limbs[j] << (n * 8);
+      limbs[j] = carry % B58_POW5;
+      carry /= B58_POW5;
     }
 
-    ASSERT(carry == 0);
+    while (carry != 0) {
+      limbs[length++] = carry % B58_POW5;
+      carry /= B58_POW5;
+    }
 
-    length = j;
+    n = 4;
   }
 
-  i = size - length;
-
-  while (i < size && b58[i] == 0)
-    i += 1;
-
-  /* Assumes sizeof(zp) >= zeroes + (size - i) + 1. */
+  /* Assumes sizeof(zp) >= zeroes + digits + 1. */
   for (j = 0; j < zeroes; j++)
     zp[j] = '1';
 
-  while (i < size)
-    zp[j++] = base58_charset[b58[i++]];
+  if (length == 0) {
+    zp[zeroes] = '\0';
+    return;
+  }
+
+  top = limbs[length - 1];
+  pos = zeroes + (length - 1) * 5;
+
+  for (n = 1; n < 5 && top >= base58_pow[n]; n++)
+    pos += 1;
+
+  /* Digits are written from the end; no reversal. */
+  zp[++pos] = '\0';
+
+  for (j = 0; j < length - 1; j++) {
+    uint32_t limb = limbs[j];
+
+    for (n = 0; n < 5; n++) {
+      zp[--pos] = base58_charset[limb % 58];
+      limb /= 58;
+    }
+  }
 
-  zp[j] = '\0';
+  while (top != 0) {
+    zp[--pos] = base58_charset[top % 58];
+    top /= 58;
+  }
 
-  btc_memzero(b58, size);
+  btc_memzero(limbs, length * sizeof(uint32_t));
 }
 
 int
 btc_base58_decode(uint8_t *zp, size_t *zn, const char *xp, size_t xn) {
-  uint8_t b256[(1024 * 733) / 1000 + 1]; /* 751 */
-  int i, j, k, size, val, carry;
-  int zeroes = 0;
-  int length = 0;
+  uint32_t limbs[((1024 * 733) / 1000 + 1 + 3) / 4]; /* 188 */
+  size_t i, j, n, pos;
+  size_t zeroes = 0;
+  size_t length = 0;
+  uint64_t carry;
+  uint32_t top;
+  int val;
 
   if (xn > 1024)
     return 0;
 
-  for (i = 0; i < (int)xn; i++) {
+  for (i = 0; i < xn; i++) {
     if (xp[i] != '1')
       break;
 
     zeroes += 1;
   }
 
-  size = (xn * 733) / 1000 + 1;
+  /* Absorb five digits at a time, leading digits first. */
+  n = (xn - i) % 5;
 
-  memset(b256, 0, size);
+  if (n == 0)
+    n = 5;
 
-  for (; i < (int)xn; i++) {
-    val = base58_table[xp[i] & 0xff];
+  while (i < xn) {
+    carry = 0;
 
-    if (val == -1) {
-      btc_memzero(b256, size);
-      return 0;
-    }
+    for (j = 0; j < n; j++) {
+      val = base58_table[xp[i++] & 0xff];
 
-    carry = val;
+      if (val == -1) {
+        btc_memzero(limbs, length * sizeof(uint32_t));
+        return 0;
+      }
 
-    for (j = 0, k = size - 1; j < size; j++, k--) {
-      if (carry == 0 && j >= length)
-        break;
+      carry = carry * 58 + val;
+    }
 
-      carry += (int)b256[k] * 58;
-      b256[k] = carry;
-      carry >>= 8;
+    for (j = 0; j < length; j++) {
+      carry += (uint64_t)limbs[j] * base58_pow[n];
+      limbs[j] = (uint32_t)carry;
+      carry >>= 32;
     }
 
-    ASSERT(carry == 0);
+    while (carry != 0) {
+      limbs[length++] = (uint32_t)carry;
+      carry >>= 32;
+    }
 
-    length = j;
+    n = 5;
   }
 
-  /* See: https://github.com/bitcoin/bitcoin/commit/2bcf1fc4 */
-  i = size - length;
-
-  /* Assumes sizeof(zp) >= zeroes + (size - i). */
+  /* Assumes sizeof(zp) >= zeroes + bytes. */
   for (j = 0; j < zeroes; j++)
     zp[j] = 0;
 
-  while (i < size)
-    zp[j++] = b256[i++];
+  pos = zeroes;
+
+  if (length > 0) {
+    top = limbs[length - 1];
+
+    for (n = 4; n > 0; n--) {
+      if ((top >> ((n - 1) * 8)) != 0)
+        break;
+    }
+
+    while (n--)
+      zp[pos++] = top >> (n * 8);
+
+    for (j = length - 1; j-- > 0;) {
+      btc_write32be(zp + pos, limbs[j]);
+      pos += 4;
+    }
+  }
 
   if (zn != NULL)
-    *zn = j;
+    *zn = pos;
 
-  btc_memzero(b256, size);
+  btc_memzero(limbs, length * sizeof(uint32_t));
 
   return 1;
 }
@@ -229,6 +229,66 @@ btc_cmpct_fill_mempool(btc_cmpct_t *blk, btc_hashmapiter_t *iter, int witness) {
   return 0;
 }
 
+int
+btc_cmpct_fill_wtxids(btc_cmpct_t *blk,
+                      const uint8_t *hashes,
+                      const btc_mpentry_t *const *entries,
+                      size_t count) {
+  /* Same as above, but over a contiguous array of
+     witness hashes (see btc_mempool_wtxids), which
+     lets us compute short ids in batches. */
+  size_t total = blk->ptx.length + blk->ids.length;
+  uint64_t ids[256];
+  btc_longset_t *set;
+  size_t i, j, n;
+  int index;
+
+  if (blk->count == total)
+    return 1;
+
+  CHECK(blk->avail.length == total);
+
+  set = btc_longset_create();
+
+  for (i = 0; i < count; i += n) {
+    n = count - i;
+
+    if (n > lengthof(ids))
+      n = lengthof(ids);
+
+    btc_siphash_batch(ids, hashes + i * 32, n, blk->sipkey);
+
+    for (j = 0; j < n; j++) {
+      index = btc_longtab_get(blk->id_map, ids[j] & UINT64_C(0xffffffffffff));
+
+      if (index == -1)
+        continue;
+
+      CHECK((size_t)index < blk->avail.length);
+
+      if (!btc_longset_put(set, index)) {
+        /* Siphash collision, just request it. */
+        btc_tx_destroy((btc_tx_t *)blk->avail.items[index]);
+        blk->avail.items[index] = NULL;
+        blk->count -= 1;
+        continue;
+      }
+
+      blk->avail.items[index] = btc_tx_ref(entries[i + j]->tx);
+      blk->count += 1;
+
+      if (blk->count == total) {
+        btc_longset_destroy(set);
+        return 1;
+      }
+    }
+  }
+
+  btc_longset_destroy(set);
+
+  return 0;
+}
+
 int
 btc_cmpct_fill_missing(btc_cmpct_t *blk, const btc_blocktxn_t *msg) {
   size_t total = blk->ptx.length + blk->ids.length;
@@ -264,6 +324,7 @@ btc_cmpct_finalize(btc_block_t *z, btc_cmpct_t *x) {
 
   btc_txvec_reset(&z->txs);
   btc_txvec_resize(&z->txs, x->avail.length);
+  btc_block_uncache(z);
 
   for (i = 0; i < x->avail.length; i++) {
     tx = (btc_tx_t *)x->avail.items[i];
@@ -0,0 +1,263 @@
+/*!
+ * bip158.c - compact block filters for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://github.com/bitcoin/bips/blob/master/bip-0158.mediawiki
+ *   https://github.com/bitcoin/bitcoin/blob/master/src/blockfilter.cpp
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <mako/bip158.h>
+#include <mako/block.h>
+#include <mako/buffer.h>
+#include <mako/coins.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/siphash.h>
+#include <mako/header.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+
+#include "impl.h"
+#include "internal.h"
+
+/*
+ * Bit Stream
+ */
+
+typedef struct bitwriter_s {
+  uint8_t *data;
+  size_t pos;
+} bitwriter_t;
+
+static void
+bitwriter_write(bitwriter_t *w, uint64_t x, int bits) {
+  while (bits--) {
+    if ((x >> bits) & 1)
+      w->data[w->pos >> 3] |= 0x80 >> (w->pos & 7);
+
+    w->pos++;
+  }
+}
+
+static void
+bitwriter_golomb(bitwriter_t *w, uint64_t x) {
+  uint64_t q = x >> BTC_GCS_P;
+
+  while (q--)
+    bitwriter_write(w, 1, 1);
+
+  bitwriter_write(w, 0, 1);
+  bitwriter_write(w, x, BTC_GCS_P);
+}
+
+typedef struct bitreader_s {
+  const uint8_t *data;
+  size_t pos;
+  size_t len;
+} bitreader_t;
+
+static int
+bitreader_read(bitreader_t *r, uint64_t *x, int bits) {
+  uint64_t z = 0;
+
+  if (r->pos + bits > r->len * 8)
+    return 0;
+
+  while (bits--) {
+    z <<= 1;
+    z |= (r->data[r->pos >> 3] >> (7 - (r->pos & 7))) & 1;
+    r->pos++;
+  }
+
+  *x = z;
+
+  return 1;
+}
+
+static int
+bitreader_golomb(bitreader_t *r, uint64_t *x) {
+  uint64_t q = 0;
+  uint64_t bit, rem;
+
+  for (;;) {
+    if (!bitreader_read(r, &bit, 1))
+      return 0;
+
+    if (bit == 0)
+      break;
+
+    q++;
+  }
+
+  if (!bitreader_read(r, &rem, BTC_GCS_P))
+    return 0;
+
+  *x = (q << BTC_GCS_P) | rem;
+
+  return 1;
+}
+
+/*
+ * Helpers
+ */
+
+static int
+script_cmp(const void *ap, const void *bp) {
+  const btc_script_t *a = *((const btc_script_t **)ap);
+  const btc_script_t *b = *((const btc_script_t **)bp);
+  return btc_buffer_compare(a, b);
+}
+
+static int
+uint64_cmp(const void *ap, const void *bp) {
+  uint64_t a = *((const uint64_t *)ap);
+  uint64_t b = *((const uint64_t *)bp);
+  return (a > b) - (a < b);
+}
+
+/*
+ * Golomb-Coded Set
+ */
+
+void
+btc_gcs_build(btc_buffer_t *z,
+              const btc_block_t *block,
+              const btc_undo_t *undo) {
+  const btc_script_t **items;
+  bitwriter_t w;
+  size_t i, j, n, len;
+  uint64_t *values;
+  uint8_t key[32];
+  uint64_t last, f;
+  size_t bits;
+
+  /* Collect every output script and every script
+     being spent, then deduplicate. The order of
+     the undo coins does not matter for a set. */
+  n = undo != NULL ? undo->length : 0;
+
+  for (i = 0; i < block->txs.length; i++)
+    n += block->txs.items[i]->outputs.length;
+
+  items = (const btc_script_t **)btc_malloc((n + 1) * sizeof(*items));
+  len = 0;
+
+  for (i = 0; i < block->txs.length; i++) {
+    const btc_tx_t *tx = block->txs.items[i];
+
+    for (j = 0; j < tx->outputs.length; j++) {
+      const btc_script_t *script = &tx->outputs.items[j]->script;
+
+      if (script->length == 0 || script->data[0] == BTC_OP_RETURN)
+        continue;
+
+      items[len++] = script;
+    }
+  }
+
+  if (undo != NULL) {
+    for (i = 0; i < undo->length; i++) {
+      const btc_script_t *script = &undo->items[i]->output.script;
+
+      if (script->length == 0)
+        continue;
+
+      items[len++] = script;
+    }
+  }
+
+  qsort((void *)items, len, sizeof(*items), script_cmp);
+
+  for (i = 0, n = 0; i < len; i++) {
+    if (n > 0 && btc_buffer_equal(items[n - 1], items[i]))
+      continue;
+
+    items[n++] = items[i];
+  }
+
+  /* Hash into [0, N * M) and sort. */
+  btc_header_hash(key, &block->header);
+
+  values = (uint64_t *)btc_malloc((n + 1) * sizeof(uint64_t));
+  f = (uint64_t)n * BTC_GCS_M;
+
+  for (i = 0; i < n; i++)
+    values[i] = btc_siphash_mod(items[i]->data, items[i]->length, key, f);
+
+  qsort(values, n, sizeof(uint64_t), uint64_cmp);
+
+  /* Each delta costs P + 1 bits plus its quotient,
+     and the quotients sum to at most F >> P. */
+  bits = n * (BTC_GCS_P + 1) + (size_t)(f >> BTC_GCS_P);
+  len = btc_size_size(n) + (bits + 7) / 8;
+
+  btc_buffer_grow(z, len);
+
+  memset(z->data, 0, len);
+
+  w.data = btc_size_write(z->data, n);
+  w.pos = 0;
+
+  for (i = 0, last = 0; i < n; i++) {
+    bitwriter_golomb(&w, values[i] - last);
+    last = values[i];
+  }
+
+  z->length = (w.data - z->data) + (w.pos + 7) / 8;
+
+  btc_free(values);
+  btc_free(items);
+}
+
+int
+btc_gcs_match(const uint8_t *data,
+              size_t length,
+              const uint8_t *block_hash,
+              const uint8_t *item,
+              size_t size) {
+  uint64_t value, delta, target;
+  bitreader_t r;
+  size_t i, n;
+
+  if (!btc_size_read(&n, &data, &length))
+    return 0;
+
+  if (n == 0)
+    return 0;
+
+  target = btc_siphash_mod(item, size, block_hash, (uint64_t)n * BTC_GCS_M);
+
+  r.data = data;
+  r.pos = 0;
+  r.len = length;
+
+  for (i = 0, value = 0; i < n; i++) {
+    if (!bitreader_golomb(&r, &delta))
+      return 0;
+
+    value += delta;
+
+    if (value == target)
+      return 1;
+
+    if (value > target)
+      return 0;
+  }
+
+  return 0;
+}
+
+void
+btc_gcs_header(uint8_t *out, const uint8_t *filter_hash, const uint8_t *prev) {
+  btc_hash256_t ctx;
+
+  btc_hash256_init(&ctx);
+  btc_hash256_update(&ctx, filter_hash, 32);
+  btc_hash256_update(&ctx, prev, 32);
+  btc_hash256_final(&ctx, out);
+}
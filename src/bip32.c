@@ -588,6 +588,87 @@ retry:
   return 1;
 }
 
+int
+btc_hdpub_derive_range(btc_hdnode_t *children,
+                       const btc_hdnode_t *node,
+                       uint32_t start,
+                       size_t count) {
+  /* Derives children[i] = node/(start + i). The HMAC
+     is keyed and fed the parent key only once, and the
+     point additions share one inversion per chunk. */
+  const uint8_t *tweaks[32];
+  btc_hmac512_t base, ctx;
+  uint8_t hash[32][64];
+  btc_hdnode_t parent;
+  uint8_t *outs[32];
+  uint32_t finger;
+  size_t i, j, n;
+  uint8_t tmp[4];
+  int ret = 1;
+
+  if (node->depth == BTC_BIP32_MAX_DEPTH)
+    return 0; /* LCOV_EXCL_LINE */
+
+  if ((start & BTC_BIP32_HARDEN) || count > BTC_BIP32_HARDEN - start)
+    return 0;
+
+  /* The children may overwrite the parent. */
+  parent = *node;
+  finger = btc_hdnode_fingerprint(&parent);
+
+  btc_hmac512_init(&base, parent.chain, 32);
+  btc_hmac512_update(&base, parent.pubkey, 33);
+
+  for (i = 0; i < count && ret; i += n) {
+    n = count - i;
+
+    if (n > 32)
+      n = 32;
+
+    for (j = 0; j < n; j++) {
+      btc_write32be(tmp, start + i + j);
+
+      ctx = base;
+
+      btc_hmac512_update(&ctx, tmp, 4);
+      btc_hmac512_final(&ctx, hash[j]);
+
+      tweaks[j] = hash[j];
+      outs[j] = children[i + j].pubkey;
+    }
+
+    if (!btc_ecdsa_pubkey_tweak_add_batch(outs, parent.pubkey, 33,
+                                          tweaks, n, 1)) {
+      /* An invalid tweak. Redo the chunk one by one. */
+      for (j = 0; j < n && ret; j++)
+        ret = btc_hdpub_derive(&children[i + j], &parent, start + i + j);
+
+      continue;
+    }
+
+    for (j = 0; j < n; j++) {
+      btc_hdnode_t *child = &children[i + j];
+
+      child->type = parent.type;
+      child->depth = parent.depth + 1;
+      child->parent = finger;
+      child->index = start + i + j;
+
+      memcpy(child->chain, hash[j] + 32, 32);
+
+      btc_memzero(child->seckey, 32);
+    }
+  }
+
+  btc_memzero(hash, sizeof(hash));
+  btc_memzero(&parent, sizeof(parent));
+  btc_memzero(&base, sizeof(base));
+  btc_memzero(&ctx, sizeof(ctx));
+  btc_memzero(tmp, sizeof(tmp));
+
+  return ret;
+}
+
 int
 btc_hdpub_path(btc_hdnode_t *child,
                const btc_hdnode_t *node,
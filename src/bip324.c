@@ -0,0 +1,408 @@
+/*!
+ * bip324.c - v2 transport for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://github.com/bitcoin/bips/blob/master/bip-0324.mediawiki
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <mako/bip324.h>
+#include <mako/crypto/ecc.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/mac.h>
+#include <mako/crypto/stream.h>
+#include <mako/util.h>
+
+#include "bio.h"
+#include "internal.h"
+
+/*
+ * Constants
+ */
+
+#define REKEY_INTERVAL 224
+
+static const char *bip324_types[] = {
+  NULL,
+  "addr",
+  "block",
+  "blocktxn",
+  "cmpctblock",
+  "feefilter",
+  "filteradd",
+  "filterclear",
+  "filterload",
+  "getblocks",
+  "getblocktxn",
+  "getdata",
+  "getheaders",
+  "headers",
+  "inv",
+  "mempool",
+  "merkleblock",
+  "notfound",
+  "ping",
+  "pong",
+  "sendcmpct",
+  "tx",
+  "getcfilters",
+  "cfilter",
+  "getcfheaders",
+  "cfheaders",
+  "getcfcheckpt",
+  "cfcheckpt",
+  "addrv2"
+};
+
+/*
+ * Helpers
+ */
+
+static void
+bip324_nonce(uint8_t *nonce, uint32_t counter, uint64_t rekeys) {
+  btc_write32le(nonce + 0, counter);
+  btc_write64le(nonce + 4, rekeys);
+}
+
+static void
+bip324_expand(uint8_t *out, const uint8_t *prk, const char *info) {
+  /* HKDF-Expand for a single block (RFC 5869). */
+  static const uint8_t one[1] = {0x01};
+  btc_hmac256_t hmac;
+
+  btc_hmac256_init(&hmac, prk, 32);
+  btc_hmac256_update(&hmac, info, strlen(info));
+  btc_hmac256_update(&hmac, one, 1);
+  btc_hmac256_final(&hmac, out);
+}
+
+/*
+ * FSChaCha20
+ */
+
+static void
+btc_fschacha20_init(btc_fschacha20_t *ctx, const uint8_t *key) {
+  uint8_t nonce[12];
+
+  bip324_nonce(nonce, 0, 0);
+
+  btc_chacha20_init(&ctx->chacha, key, 32, nonce, 12, 0);
+
+  ctx->chunks = 0;
+  ctx->rekeys = 0;
+}
+
+static void
+btc_fschacha20_crypt(btc_fschacha20_t *ctx,
+                     uint8_t *dst,
+                     const uint8_t *src,
+                     size_t len) {
+  uint8_t nonce[12];
+  uint8_t key[32];
+
+  btc_chacha20_crypt(&ctx->chacha, dst, src, len);
+
+  if (++ctx->chunks == REKEY_INTERVAL) {
+    /* The next key is the continuation of the keystream. */
+    btc_chacha20_keystream(&ctx->chacha, key, 32);
+
+    ctx->chunks = 0;
+    ctx->rekeys++;
+
+    bip324_nonce(nonce, 0, ctx->rekeys);
+
+    btc_chacha20_init(&ctx->chacha, key, 32, nonce, 12, 0);
+
+    btc_memzero(key, sizeof(key));
+  }
+}
+
+/*
+ * FSChaCha20Poly1305
+ */
+
+static void
+btc_fsaead_init(btc_fsaead_t *ctx, const uint8_t *key) {
+  memcpy(ctx->key, key, 32);
+
+  ctx->packets = 0;
+  ctx->rekeys = 0;
+}
+
+static void
+btc_fsaead_start(btc_fsaead_t *ctx, btc_aead_t *aead) {
+  uint8_t nonce[12];
+
+  bip324_nonce(nonce, ctx->packets, ctx->rekeys);
+
+  btc_aead_init(aead, ctx->key, nonce);
+}
+
+static void
+btc_fsaead_next(btc_fsaead_t *ctx) {
+  btc_chacha20_t chacha;
+  uint8_t nonce[12];
+
+  if (++ctx->packets < REKEY_INTERVAL)
+    return;
+
+  bip324_nonce(nonce, UINT32_MAX, ctx->rekeys);
+
+  /* The next key is the AEAD encryption of 32 zero
+     bytes: the payload keystream starts at block one. */
+  btc_chacha20_init(&chacha, ctx->key, 32, nonce, 12, 1);
+  btc_chacha20_keystream(&chacha, ctx->key, 32);
+
+  ctx->packets = 0;
+  ctx->rekeys++;
+
+  btc_memzero(&chacha, sizeof(chacha));
+}
+
+/*
+ * BIP324
+ */
+
+void
+btc_bip324_init(btc_bip324_t *ctx,
+                uint32_t magic,
+                int initiator,
+                const uint8_t *entropy) {
+  /* Entropy is 64 bytes: a key and an encoding. */
+  memset(ctx, 0, sizeof(*ctx));
+
+  ctx->magic = magic;
+  ctx->initiator = initiator;
+
+  btc_ecdsa_privkey_generate(ctx->priv, entropy);
+
+  CHECK(btc_ellswift_create(ctx->ours, ctx->priv, entropy + 32));
+}
+
+int
+btc_bip324_derive(btc_bip324_t *ctx, const uint8_t *theirs) {
+  static const char salt[] = "bitcoin_v2_shared_secret";
+  const uint8_t *ell_a = ctx->initiator ? ctx->ours : theirs;
+  const uint8_t *ell_b = ctx->initiator ? theirs : ctx->ours;
+  uint8_t tag[32], x[32], secret[32], prk[32];
+  uint8_t k1[32], k2[32], k3[32], k4[32];
+  uint8_t terms[32];
+  uint8_t key[24 + 4];
+  btc_hmac256_t hmac;
+  btc_sha256_t hash;
+
+  if (!btc_ellswift_derive(x, theirs, ctx->priv))
+    return 0;
+
+  /* Tagged hash over both encodings and the shared x. */
+  btc_sha256(tag, "bip324_ellswift_xonly_ecdh", 26);
+
+  btc_sha256_init(&hash);
+  btc_sha256_update(&hash, tag, 32);
+  btc_sha256_update(&hash, tag, 32);
+  btc_sha256_update(&hash, ell_a, 64);
+  btc_sha256_update(&hash, ell_b, 64);
+  btc_sha256_update(&hash, x, 32);
+  btc_sha256_final(&hash, secret);
+
+  /* HKDF-Extract, salted with the network magic. */
+  memcpy(key, salt, 24);
+  btc_write32le(key + 24, ctx->magic);
+
+  btc_hmac256_init(&hmac, key, 28);
+  btc_hmac256_update(&hmac, secret, 32);
+  btc_hmac256_final(&hmac, prk);
+
+  bip324_expand(k1, prk, "initiator_L");
+  bip324_expand(k2, prk, "initiator_P");
+  bip324_expand(k3, prk, "responder_L");
+  bip324_expand(k4, prk, "responder_P");
+  bip324_expand(terms, prk, "garbage_terminators");
+  bip324_expand(ctx->session_id, prk, "session_id");
+
+  if (ctx->initiator) {
+    btc_fschacha20_init(&ctx->send_len, k1);
+    btc_fsaead_init(&ctx->send_aead, k2);
+    btc_fschacha20_init(&ctx->recv_len, k3);
+    btc_fsaead_init(&ctx->recv_aead, k4);
+    memcpy(ctx->send_term, terms + 0, 16);
+    memcpy(ctx->recv_term, terms + 16, 16);
+  } else {
+    btc_fschacha20_init(&ctx->send_len, k3);
+    btc_fsaead_init(&ctx->send_aead, k4);
+    btc_fschacha20_init(&ctx->recv_len, k1);
+    btc_fsaead_init(&ctx->recv_aead, k2);
+    memcpy(ctx->send_term, terms + 16, 16);
+    memcpy(ctx->recv_term, terms + 0, 16);
+  }
+
+  btc_memzero(ctx->priv, 32);
+  btc_memzero(x, sizeof(x));
+  btc_memzero(secret, sizeof(secret));
+  btc_memzero(prk, sizeof(prk));
+  btc_memzero(k1, sizeof(k1));
+  btc_memzero(k2, sizeof(k2));
+  btc_memzero(k3, sizeof(k3));
+  btc_memzero(k4, sizeof(k4));
+
+  return 1;
+}
+
+size_t
+btc_bip324_seal(btc_bip324_t *ctx,
+                uint8_t *packet,
+                size_t len,
+                const uint8_t *aad,
+                size_t aad_len,
+                int ignore) {
+  /* The contents are already in place at packet + 4:
+   *
+   *   [length (3)] [header (1)] [contents (len)] [tag (16)]
+   *
+   * Everything after the length is encrypted where it
+   * lies, so a serialized block is never copied.
+   */
+  uint8_t *body = packet + BTC_BIP324_LENGTH_SIZE;
+  size_t size = BTC_BIP324_HEADER_SIZE + len;
+  btc_aead_t aead;
+
+  CHECK(len < (1 << 24));
+
+  packet[0] = (len >> 0) & 0xff;
+  packet[1] = (len >> 8) & 0xff;
+  packet[2] = (len >> 16) & 0xff;
+
+  btc_fschacha20_crypt(&ctx->send_len, packet, packet, 3);
+
+  body[0] = ignore ? BTC_BIP324_IGNORE : 0;
+
+  btc_fsaead_start(&ctx->send_aead, &aead);
+  btc_aead_aad(&aead, aad, aad_len);
+  btc_aead_encrypt(&aead, body, body, size);
+  btc_aead_final(&aead, body + size);
+  btc_fsaead_next(&ctx->send_aead);
+
+  return BTC_BIP324_EXPANSION + len;
+}
+
+size_t
+btc_bip324_length(btc_bip324_t *ctx, const uint8_t *raw) {
+  uint8_t tmp[3];
+
+  btc_fschacha20_crypt(&ctx->recv_len, tmp, raw, 3);
+
+  return (size_t)tmp[0] | ((size_t)tmp[1] << 8) | ((size_t)tmp[2] << 16);
+}
+
+int
+btc_bip324_open(btc_bip324_t *ctx,
+                uint8_t *dst,
+                const uint8_t *src,
+                size_t len,
+                const uint8_t *aad,
+                size_t aad_len) {
+  /* Decrypts header and contents (1 + len bytes) into
+     dst, which may be src. The tag follows in src. */
+  size_t size = BTC_BIP324_HEADER_SIZE + len;
+  uint8_t tag[16];
+  btc_aead_t aead;
+  int ret;
+
+  btc_fsaead_start(&ctx->recv_aead, &aead);
+  btc_aead_aad(&aead, aad, aad_len);
+  btc_aead_decrypt(&aead, dst, src, size);
+  btc_aead_final(&aead, tag);
+  btc_fsaead_next(&ctx->recv_aead);
+
+  ret = btc_aead_verify(tag, src + size);
+
+  if (!ret)
+    btc_memzero(dst, size);
+
+  return ret;
+}
+
+size_t
+btc_bip324_type_size(const char *cmd) {
+  size_t i;
+
+  for (i = 1; i < lengthof(bip324_types); i++) {
+    if (strcmp(bip324_types[i], cmd) == 0)
+      return 1;
+  }
+
+  return 1 + 12;
+}
+
+uint8_t *
+btc_bip324_type_write(uint8_t *zp, const char *cmd) {
+  size_t i, len;
+
+  for (i = 1; i < lengthof(bip324_types); i++) {
+    if (strcmp(bip324_types[i], cmd) == 0) {
+      *zp++ = i;
+      return zp;
+    }
+  }
+
+  len = strlen(cmd);
+
+  CHECK(len <= 12);
+
+  *zp++ = 0;
+
+  memcpy(zp, cmd, len);
+  memset(zp + len, 0, 12 - len);
+
+  return zp + 12;
+}
+
+int
+btc_bip324_type_read(char *cmd, const uint8_t **xp, size_t *xn) {
+  size_t i, id;
+
+  if (*xn < 1)
+    return 0;
+
+  id = **xp;
+
+  *xp += 1;
+  *xn -= 1;
+
+  if (id != 0) {
+    if (id >= lengthof(bip324_types))
+      return 0;
+
+    strcpy(cmd, bip324_types[id]);
+
+    return 1;
+  }
+
+  if (*xn < 12)
+    return 0;
+
+  /* Padded with zeroes, and nothing but zeroes. */
+  for (i = 0; i < 12 && (*xp)[i] != 0; i++) {
+    if ((*xp)[i] < 0x20 || (*xp)[i] > 0x7e)
+      return 0;
+
+    cmd[i] = (*xp)[i];
+  }
+
+  cmd[i] = '\0';
+
+  for (; i < 12; i++) {
+    if ((*xp)[i] != 0)
+      return 0;
+  }
+
+  *xp += 12;
+  *xn -= 12;
+
+  return 1;
+}
@@ -13,6 +13,7 @@
 #include <mako/buffer.h>
 #include <mako/consensus.h>
 #include <mako/crypto/hash.h>
+#include <mako/crypto/merkle.h>
 #include <mako/header.h>
 #include <mako/map.h>
 #include <mako/tx.h>
@@ -261,69 +262,131 @@ btc_merkleblock_verify(btc_merkleblock_t *block) {
   return 1;
 }
 
-static void
-tree_hash(uint8_t *root,
-          const btc_merkleblock_t *tree,
-          int32_t height,
-          uint32_t pos,
-          const btc_vector_t *leaves) {
-  if (height == 0) {
-    btc_hash_copy(root, leaves->items[pos]);
-  } else {
-    uint8_t left[32], right[32];
+/*
+ * Merkle Tree
+ */
 
-    tree_hash(left, tree, height - 1, pos * 2 + 0, leaves);
+/* Every level of a block's merkle tree, stored
+ * leaves first. Inner nodes are the same for any
+ * filter, so a block served to many SPV peers
+ * is hashed once and each merkleblock only copies
+ * the nodes on the paths to its matches.
+ */
 
-    if (pos * 2 + 1 < tree_width(tree, height - 1))
-      tree_hash(right, tree, height - 1, pos * 2 + 1, leaves);
-    else
-      btc_hash_copy(right, left);
+static uint32_t
+level_width(uint32_t total, int32_t height) {
+  return (total + (1 << height) - 1) >> height;
+}
 
-    btc_hash256_root(root, left, right);
+btc_merkletree_t *
+btc_merkletree_create(const btc_block_t *block) {
+  btc_merkletree_t *tree = btc_malloc(sizeof(btc_merkletree_t));
+  uint32_t total = block->txs.length;
+  size_t i, size = 0;
+  int32_t height = 0;
+  uint8_t *level;
+
+  CHECK(total > 0);
+
+  for (;;) {
+    tree->offsets[height] = size;
+
+    size += level_width(total, height);
+
+    if (level_width(total, height) == 1)
+      break;
+
+    height += 1;
   }
+
+  tree->nodes = (uint8_t *)btc_malloc(size * 32);
+  tree->total = total;
+  tree->height = height;
+
+  for (i = 0; i < total; i++)
+    btc_hash_copy(tree->nodes + i * 32, block->txs.items[i]->hash);
+
+  /* Pairs are hashed with the multi-way kernel. */
+  for (height = 1; height <= tree->height; height++) {
+    level = tree->nodes + tree->offsets[height - 1] * 32;
+
+    btc_merkle_level(tree->nodes + tree->offsets[height] * 32,
+                     level, level_width(total, height - 1));
+  }
+
+  return tree;
+}
+
+void
+btc_merkletree_destroy(btc_merkletree_t *tree) {
+  btc_free(tree->nodes);
+  btc_free(tree);
 }
 
+const uint8_t *
+btc_merkletree_node(const btc_merkletree_t *tree,
+                    int32_t height,
+                    uint32_t pos) {
+  CHECK(height <= tree->height);
+  CHECK(pos < level_width(tree->total, height));
+
+  return tree->nodes + (tree->offsets[height] + pos) * 32;
+}
+
+const uint8_t *
+btc_merkletree_root(const btc_merkletree_t *tree) {
+  return btc_merkletree_node(tree, tree->height, 0);
+}
+
+/*
+ * Merkle Block (Construction)
+ */
+
 static void
 tree_build(btc_merkleblock_t *tree,
            int32_t height,
            uint32_t pos,
-           const btc_vector_t *leaves,
-           const btc_array_t *matches,
+           const btc_merkletree_t *nodes,
+           const uint32_t *counts,
            btc_array_t *bits) {
-  int parent = 0;
-  uint32_t p;
+  uint32_t start = pos << height;
+  uint32_t end = (pos + 1) << height;
+  int parent;
 
-  for (p = pos << height; p < ((pos + 1) << height) && p < tree->total; p++)
-    parent |= matches->items[p];
+  if (end > tree->total)
+    end = tree->total;
 
-  btc_array_push(bits, !!parent);
+  /* Any matches below this node? */
+  parent = counts[end] != counts[start];
+
+  btc_array_push(bits, parent);
 
   if (height == 0 || !parent) {
     uint8_t *root = (uint8_t *)btc_malloc(32);
 
-    tree_hash(root, tree, height, pos, leaves);
+    btc_hash_copy(root, btc_merkletree_node(nodes, height, pos));
 
     btc_vector_push(&tree->hashes, root);
   } else {
-    tree_build(tree, height - 1, pos * 2 + 0, leaves, matches, bits);
+    tree_build(tree, height - 1, pos * 2 + 0, nodes, counts, bits);
 
     if (pos * 2 + 1 < tree_width(tree, height - 1))
-      tree_build(tree, height - 1, pos * 2 + 1, leaves, matches, bits);
+      tree_build(tree, height - 1, pos * 2 + 1, nodes, counts, bits);
   }
 }
 
 static void
 btc_merkleblock_set_matches(btc_merkleblock_t *tree,
                             const btc_block_t *block,
+                            const btc_merkletree_t *nodes,
                             const btc_array_t *matches) {
-  btc_vector_t leaves;
+  uint32_t *counts;
   btc_array_t bits;
-  int32_t height = 0;
   size_t i, p;
 
   CHECK(block->txs.length > 0);
+  CHECK(nodes->total == block->txs.length);
 
-  btc_vector_init(&leaves);
   btc_array_init(&bits);
 
   btc_merkleblock_reset(tree);
@@ -332,15 +395,14 @@ btc_merkleblock_set_matches(btc_merkleblock_t *tree,
 
   tree->total = block->txs.length;
 
-  btc_vector_resize(&leaves, block->txs.length);
+  /* Prefix sums answer "does this subtree match" in O(1). */
+  counts = (uint32_t *)btc_malloc((tree->total + 1) * sizeof(uint32_t));
+  counts[0] = 0;
 
-  for (i = 0; i < block->txs.length; i++)
-    leaves.items[i] = block->txs.items[i]->hash;
+  for (i = 0; i < tree->total; i++)
+    counts[i + 1] = counts[i] + (matches->items[i] != 0);
 
-  while (tree_width(tree, height) > 1)
-    height += 1;
-
-  tree_build(tree, height, 0, &leaves, matches, &bits);
+  tree_build(tree, nodes->height, 0, nodes, counts, &bits);
 
   btc_buffer_resize(&tree->flags, (bits.length + 7) / 8);
 
@@ -349,14 +411,15 @@ btc_merkleblock_set_matches(btc_merkleblock_t *tree,
   for (p = 0; p < bits.length; p++)
     tree->flags.data[p >> 3] |= bits.items[p] << (p & 7);
 
-  btc_vector_clear(&leaves);
+  btc_free(counts);
   btc_array_clear(&bits);
 }
 
 btc_vector_t *
-btc_merkleblock_set_block(btc_merkleblock_t *tree,
-                          const btc_block_t *block,
-                          btc_bloom_t *filter) {
+btc_merkleblock_set_tree(btc_merkleblock_t *tree,
+                         const btc_block_t *block,
+                         const btc_merkletree_t *nodes,
+                         btc_bloom_t *filter) {
   btc_vector_t *txs = btc_vector_create();
   btc_array_t matches;
   size_t i;
@@ -374,18 +437,33 @@ btc_merkleblock_set_block(btc_merkleblock_t *tree,
     matches.items[i] = match;
   }
 
-  btc_merkleblock_set_matches(tree, block, &matches);
+  btc_merkleblock_set_matches(tree, block, nodes, &matches);
 
   btc_array_clear(&matches);
 
   return txs;
 }
 
+btc_vector_t *
+btc_merkleblock_set_block(btc_merkleblock_t *tree,
+                          const btc_block_t *block,
+                          btc_bloom_t *filter) {
+  btc_merkletree_t *nodes = btc_merkletree_create(block);
+  btc_vector_t *txs;
+
+  txs = btc_merkleblock_set_tree(tree, block, nodes, filter);
+
+  btc_merkletree_destroy(nodes);
+
+  return txs;
+}
+
 void
 btc_merkleblock_set_hashes(btc_merkleblock_t *tree,
                            const btc_block_t *block,
                            const btc_vector_t *hashes) {
   btc_hashset_t *filter = btc_hashset_create();
+  btc_merkletree_t *nodes;
   btc_array_t matches;
   size_t i;
 
@@ -402,8 +480,11 @@ btc_merkleblock_set_hashes(btc_merkleblock_t *tree,
     matches.items[i] = btc_hashset_has(filter, tx->hash);
   }
 
-  btc_merkleblock_set_matches(tree, block, &matches);
+  nodes = btc_merkletree_create(block);
+
+  btc_merkleblock_set_matches(tree, block, nodes, &matches);
 
+  btc_merkletree_destroy(nodes);
   btc_hashset_destroy(filter);
   btc_array_clear(&matches);
 }
@@ -29,18 +29,44 @@ btc_block_init(btc_block_t *z) {
   btc_header_init(&z->header);
   btc_txvec_init(&z->txs);
   z->_refs = 0;
+  z->_raw = NULL;
+  z->_raw_size = 0;
+  z->_base_size = 0;
 }
 
 void
 btc_block_clear(btc_block_t *z) {
   btc_header_clear(&z->header);
   btc_txvec_clear(&z->txs);
+  btc_block_uncache(z);
 }
 
 void
 btc_block_copy(btc_block_t *z, const btc_block_t *x) {
   btc_header_copy(&z->header, &x->header);
   btc_txvec_copy(&z->txs, &x->txs);
+  btc_block_uncache(z);
+
+  if (x->_raw != NULL) {
+    z->_raw = (uint8_t *)btc_malloc(x->_raw_size);
+    z->_raw_size = x->_raw_size;
+    z->_base_size = x->_base_size;
+
+    memcpy(z->_raw, x->_raw, x->_raw_size);
+  }
+}
+
+void
+btc_block_uncache(btc_block_t *z) {
+  /* Must be called if the transactions of
+     a deserialized block are modified. */
+  if (z->_raw != NULL) {
+    btc_free(z->_raw);
+    z->_raw = NULL;
+  }
+
+  z->_raw_size = 0;
+  z->_base_size = 0;
 }
 
 int
@@ -166,8 +192,21 @@ btc_block_get_commitment_hash(const btc_block_t *blk) {
 
 int
 btc_block_check_body(btc_verify_error_t *err, const btc_block_t *blk) {
+  return btc_block_check_body_ex(err, blk, NULL, 0, 0);
+}
+
+int
+btc_block_check_body_ex(btc_verify_error_t *err,
+                        const btc_block_t *blk,
+                        const uint8_t *root,
+                        int mutated,
+                        size_t sane) {
+  /* The caller may have computed the merkle root
+     and checked the first `sane` transactions
+     already (see chain.c). The order of checks,
+     and therefore the reported error, is the same. */
   const btc_tx_t *tx;
-  uint8_t root[32];
+  uint8_t tmp[32];
   int sigops = 0;
   size_t i;
 
@@ -182,8 +221,13 @@ btc_block_check_body(btc_verify_error_t *err, const btc_block_t *blk) {
   if (blk->txs.length == 0 || !btc_tx_is_coinbase(blk->txs.items[0]))
     THROW("bad-cb-missing", 100);
 
+  if (root == NULL) {
+    mutated = !btc_block_merkle_root(tmp, blk);
+    root = tmp;
+  }
+
   /* If the merkle is mutated, we have duplicate txs. */
-  if (!btc_block_merkle_root(root, blk))
+  if (mutated)
     THROW("bad-txns-duplicate", 100);
 
   /* Check merkle root. */
@@ -201,7 +245,7 @@ btc_block_check_body(btc_verify_error_t *err, const btc_block_t *blk) {
       THROW("bad-cb-multiple", 100);
 
     /* Sanity checks. */
-    if (!btc_tx_check_sanity(err, tx))
+    if (i >= sane && !btc_tx_check_sanity(err, tx))
       return 0;
 
     /* Count legacy sigops (do not count scripthash or witness). */
@@ -244,11 +288,17 @@ btc_block_claimed(const btc_block_t *blk) {
 
 size_t
 btc_block_base_size(const btc_block_t *blk) {
+  if (blk->_raw != NULL)
+    return btc_header_size(&blk->header) + blk->_base_size;
+
   return btc_header_size(&blk->header) + btc_txvec_base_size(&blk->txs);
 }
 
 size_t
 btc_block_witness_size(const btc_block_t *blk) {
+  if (blk->_raw != NULL)
+    return blk->_raw_size - blk->_base_size;
+
   return btc_txvec_witness_size(&blk->txs);
 }
 
@@ -270,27 +320,131 @@ btc_block_virtual_size(const btc_block_t *blk) {
   return (weight + BTC_WITNESS_SCALE_FACTOR - 1) / BTC_WITNESS_SCALE_FACTOR;
 }
 
+static uint8_t *
+btc_block_strip(uint8_t *zp, const btc_block_t *x) {
+  /* The stripped encoding of each transaction is
+     a subsequence of its witness encoding: copy
+     around the marker and the witness data. */
+  const uint8_t *xp = x->_raw;
+  size_t i, size, base;
+
+  zp = btc_size_write(zp, x->txs.length);
+  xp += btc_size_size(x->txs.length);
+
+  for (i = 0; i < x->txs.length; i++) {
+    const btc_tx_t *tx = x->txs.items[i];
+
+    size = btc_tx_size(tx);
+    base = btc_tx_base_size(tx);
+
+    if (size == base) {
+      zp = btc_raw_write(zp, xp, size);
+    } else {
+      zp = btc_raw_write(zp, xp, 4);
+      zp = btc_raw_write(zp, xp + 6, base - 8);
+      zp = btc_raw_write(zp, xp + size - 4, 4);
+    }
+
+    xp += size;
+  }
+
+  return zp;
+}
+
 uint8_t *
 btc_block_base_write(uint8_t *zp, const btc_block_t *x) {
   zp = btc_header_write(zp, &x->header);
-  zp = btc_txvec_base_write(zp, &x->txs);
+
+  if (x->_raw == NULL)
+    zp = btc_txvec_base_write(zp, &x->txs);
+  else if (x->_base_size == x->_raw_size)
+    zp = btc_raw_write(zp, x->_raw, x->_raw_size);
+  else
+    zp = btc_block_strip(zp, x);
+
   return zp;
 }
 
 uint8_t *
 btc_block_write(uint8_t *zp, const btc_block_t *x) {
   zp = btc_header_write(zp, &x->header);
-  zp = btc_txvec_write(zp, &x->txs);
+
+  if (x->_raw != NULL)
+    zp = btc_raw_write(zp, x->_raw, x->_raw_size);
+  else
+    zp = btc_txvec_write(zp, &x->txs);
+
   return zp;
 }
 
 int
 btc_block_read(btc_block_t *z, const uint8_t **xp, size_t *xn) {
+  const uint8_t *sp;
+  size_t i, count;
+  size_t base = 0;
+  btc_tx_t *tx;
+
+  btc_block_uncache(z);
+
   if (!btc_header_read(&z->header, xp, xn))
     return 0;
 
-  if (!btc_txvec_read(&z->txs, xp, xn))
+  btc_txvec_reset(&z->txs);
+
+  sp = *xp;
+
+  if (!btc_size_read(&count, xp, xn))
     return 0;
 
+  /* One allocation per transaction (see tx.c). */
+  for (i = 0; i < count; i++) {
+    tx = btc_tx_create();
+
+    if (!btc_tx_read_slab(tx, xp, xn)) {
+      btc_tx_destroy(tx);
+      return 0;
+    }
+
+    btc_txvec_push(&z->txs, tx);
+
+    base += btc_tx_base_size(tx);
+  }
+
+  /* Keep the wire bytes for re-encoding (one copy
+     here saves a serialization per consumer). */
+  z->_raw_size = *xp - sp;
+  z->_raw = (uint8_t *)btc_malloc(z->_raw_size);
+  z->_base_size = btc_size_size(count) + base;
+
+  memcpy(z->_raw, sp, z->_raw_size);
+
+  return 1;
+}
+
+int
+btc_block_scan(const uint8_t *xp,
+               size_t xn,
+               btc_rawin_f *on_input,
+               btc_rawout_f *on_output,
+               void *arg) {
+  btc_rawtx_t tx;
+  size_t i, count;
+
+  if (xn < 80)
+    return 0;
+
+  xp += 80;
+  xn -= 80;
+
+  if (!btc_size_read(&count, &xp, &xn))
+    return 0;
+
+  for (i = 0; i < count; i++) {
+    tx.index = i;
+
+    if (!btc_tx_scan(&tx, &xp, &xn, on_input, on_output, arg))
+      return 0;
+  }
+
   return 1;
 }
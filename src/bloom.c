@@ -27,6 +27,11 @@ static const double BTC_LN2SQUARED =
 static const double BTC_LN2 =
   0.6931471805599453094172321214581765680755001343602552;
 
+/* Hashes are computed a group of seeds at a time
+   (see btc_murmur3_tweaks) so that a miss can
+   still return early. */
+#define BTC_BLOOM_LANES 8
+
 /*
  * Bloom Filter
  */
@@ -108,40 +113,54 @@ btc_bloom_set(btc_bloom_t *bloom,
   btc_bloom_reset(bloom);
 }
 
-static size_t
-btc_bloom_hash(const btc_bloom_t *bloom,
-               const uint8_t *val,
-               size_t len,
-               uint32_t n) {
-  return btc_murmur3_tweak(val, len, n, bloom->tweak) % (bloom->size * 8);
-}
-
 void
 btc_bloom_add(btc_bloom_t *bloom, const uint8_t *val, size_t len) {
-  uint32_t i;
+  uint32_t hashes[BTC_BLOOM_LANES];
+  size_t bits = bloom->size * 8;
+  uint32_t i, j, count;
 
   if (bloom->size == 0)
     return;
 
-  for (i = 0; i < bloom->n; i++) {
-    size_t bit = btc_bloom_hash(bloom, val, len, i);
+  for (i = 0; i < bloom->n; i += count) {
+    count = bloom->n - i;
+
+    if (count > BTC_BLOOM_LANES)
+      count = BTC_BLOOM_LANES;
+
+    btc_murmur3_tweaks(hashes, val, len, i, count, bloom->tweak);
 
-    bloom->data[bit >> 3] |= (1 << (bit & 7));
+    for (j = 0; j < count; j++) {
+      size_t bit = hashes[j] % bits;
+
+      bloom->data[bit >> 3] |= (1 << (bit & 7));
+    }
   }
 }
 
 int
 btc_bloom_has(const btc_bloom_t *bloom, const uint8_t *val, size_t len) {
-  uint32_t i;
+  uint32_t hashes[BTC_BLOOM_LANES];
+  size_t bits = bloom->size * 8;
+  uint32_t i, j, count;
 
   if (bloom->size == 0)
     return 0;
 
-  for (i = 0; i < bloom->n; i++) {
-    size_t bit = btc_bloom_hash(bloom, val, len, i);
+  for (i = 0; i < bloom->n; i += count) {
+    count = bloom->n - i;
+
+    if (count > BTC_BLOOM_LANES)
+      count = BTC_BLOOM_LANES;
+
+    btc_murmur3_tweaks(hashes, val, len, i, count, bloom->tweak);
+
+    for (j = 0; j < count; j++) {
+      size_t bit = hashes[j] % bits;
 
-    if ((bloom->data[bit >> 3] & (1 << (bit & 7))) == 0)
-      return 0;
+      if ((bloom->data[bit >> 3] & (1 << (bit & 7))) == 0)
+        return 0;
+    }
   }
 
   return 1;
@@ -291,20 +310,23 @@ btc_filter_set(btc_filter_t *filter, uint32_t items, double rate) {
   btc_filter_reset(filter);
 }
 
-static uint32_t
-btc_filter_hash(const btc_filter_t *filter,
-                const uint8_t *val,
-                size_t len,
-                uint32_t n) {
-  return btc_murmur3_tweak(val, len, n, filter->tweak);
+static size_t
+btc_filter_range(uint32_t hash, size_t length) {
+  /* Maps the hash onto [0, length) with a multiply
+     instead of a division. This uses the high bits,
+     so it does not matter that the low six bits
+     already picked the bit within the word. Unlike
+     a BIP37 filter, nothing depends on the layout. */
+  return (size_t)(((uint64_t)hash * (uint64_t)length) >> 32);
 }
 
 void
 btc_filter_add(btc_filter_t *filter, const uint8_t *val, size_t len) {
+  uint32_t hashes[BTC_BLOOM_LANES];
   uint64_t m1, m2, p1, p2, m;
+  int i, j, bit, count;
   uint32_t hash;
   size_t p, pos;
-  int i, bit;
 
   if (filter->length == 0)
     return;
@@ -332,37 +354,56 @@ btc_filter_add(btc_filter_t *filter, const uint8_t *val, size_t len) {
 
   filter->entries += 1;
 
-  for (i = 0; i < filter->n; i++) {
-    hash = btc_filter_hash(filter, val, len, i);
-    bit = hash & 0x3f;
-    pos = (hash >> 6) % filter->length;
+  for (i = 0; i < filter->n; i += count) {
+    count = filter->n - i;
+
+    if (count > BTC_BLOOM_LANES)
+      count = BTC_BLOOM_LANES;
+
+    btc_murmur3_tweaks(hashes, val, len, i, count, filter->tweak);
+
+    for (j = 0; j < count; j++) {
+      hash = hashes[j];
+      bit = hash & 0x3f;
+      pos = btc_filter_range(hash, filter->length);
 
-    filter->data[pos & ~1] &= ~(UINT64_C(1) << bit);
-    filter->data[pos & ~1] |= ((uint64_t)(filter->generation & 1)) << bit;
+      filter->data[pos & ~1] &= ~(UINT64_C(1) << bit);
+      filter->data[pos & ~1] |= ((uint64_t)(filter->generation & 1)) << bit;
 
-    filter->data[pos | 1] &= ~(UINT64_C(1) << bit);
-    filter->data[pos | 1] |= ((uint64_t)(filter->generation >> 1)) << bit;
+      filter->data[pos | 1] &= ~(UINT64_C(1) << bit);
+      filter->data[pos | 1] |= ((uint64_t)(filter->generation >> 1)) << bit;
+    }
   }
 }
 
 int
 btc_filter_has(const btc_filter_t *filter, const uint8_t *val, size_t len) {
+  uint32_t hashes[BTC_BLOOM_LANES];
+  int i, j, bit, count;
   uint32_t hash;
   uint64_t bits;
   size_t pos;
-  int i, bit;
 
   if (filter->length == 0)
     return 0;
 
-  for (i = 0; i < filter->n; i++) {
-    hash = btc_filter_hash(filter, val, len, i);
-    bit = hash & 0x3f;
-    pos = (hash >> 6) % filter->length;
-    bits = filter->data[pos & ~1] | filter->data[pos | 1];
+  for (i = 0; i < filter->n; i += count) {
+    count = filter->n - i;
+
+    if (count > BTC_BLOOM_LANES)
+      count = BTC_BLOOM_LANES;
+
+    btc_murmur3_tweaks(hashes, val, len, i, count, filter->tweak);
 
-    if (((bits >> bit) & 1) == 0)
-      return 0;
+    for (j = 0; j < count; j++) {
+      hash = hashes[j];
+      bit = hash & 0x3f;
+      pos = btc_filter_range(hash, filter->length);
+      bits = filter->data[pos & ~1] | filter->data[pos | 1];
+
+      if (((bits >> bit) & 1) == 0)
+        return 0;
+    }
   }
 
   return 1;
@@ -29,7 +29,7 @@ btc_buffer_init(btc_buffer_t *z) {
 
 void
 btc_buffer_clear(btc_buffer_t *z) {
-  if (z->alloc > 0)
+  if (z->alloc > 0 && z->data != z->small)
     btc_free(z->data);
 
   z->data = NULL;
@@ -45,8 +45,25 @@ btc_buffer_reset(btc_buffer_t *z) {
 uint8_t *
 btc_buffer_grow(btc_buffer_t *z, size_t zn) {
   if (zn > z->alloc) {
-    z->data = (uint8_t *)btc_realloc(z->data, zn);
-    z->alloc = zn;
+    if (z->alloc > 0 && z->data != z->small) {
+      z->data = (uint8_t *)btc_realloc(z->data, zn);
+      z->alloc = zn;
+    } else {
+      /* Inline, borrowed or empty: nothing to realloc. */
+      uint8_t *zp = z->small;
+      size_t alloc = BTC_BUFFER_INLINE;
+
+      if (zn > BTC_BUFFER_INLINE) {
+        zp = (uint8_t *)btc_malloc(zn);
+        alloc = zn;
+      }
+
+      if (z->length > 0 && z->data != zp)
+        memmove(zp, z->data, z->length < alloc ? z->length : alloc);
+
+      z->data = zp;
+      z->alloc = alloc;
+    }
   }
 
   return z->data;
@@ -93,6 +110,15 @@ btc_buffer_rwset(btc_buffer_t *z, uint8_t *zp, size_t zn) {
   z->length = 0;
 }
 
+size_t
+btc_buffer_usage(const btc_buffer_t *x) {
+  /* Heap memory only; inline and borrowed data count nothing. */
+  if (x->alloc == 0 || x->data == x->small)
+    return 0;
+
+  return btc_malloc_usage(x->alloc);
+}
+
 int
 btc_buffer_equal(const btc_buffer_t *x, const btc_buffer_t *y) {
   if (x->length != y->length)
@@ -59,21 +59,69 @@ btc_client_close(btc_client_t *client) {
   http_client_close(client->http);
 }
 
-json_value *
-btc_client_call(btc_client_t *client, const char *method, json_value *params) {
+void
+btc_client_set_timeout(btc_client_t *client, int64_t msec) {
+  http_client_set_timeout(client->http, msec);
+}
+
+void
+btc_client_set_idle(btc_client_t *client, int64_t msec) {
+  /* Calls share one connection until it has
+     been idle for `msec` milliseconds. */
+  http_client_set_idle(client->http, msec);
+}
+
+static json_value *
+btc_client_response(const char *method, json_value *obj) {
   json_value *error, *code, *message, *result;
-  json_value *obj = json_object_new(3);
+
+  if (obj == NULL || obj->type != json_object)
+    goto fail;
+
+  error = json_object_get(obj, "error");
+
+  if (error != NULL && error->type != json_null) {
+    if (error->type != json_object)
+      goto fail;
+
+    message = json_object_get(error, "message");
+
+    if (message == NULL || message->type != json_string)
+      goto fail;
+
+    code = json_object_get(error, "code");
+
+    if (code == NULL || code->type != json_integer)
+      goto fail;
+
+    if (strcmp(method, "help") == 0 && code->u.integer == -1) {
+      fprintf(stderr, "Usage: %s\n", message->u.string.ptr);
+    } else {
+      fprintf(stderr, "RPC Error: %s (code=%d).\n",
+                      message->u.string.ptr,
+                      (int)code->u.integer);
+    }
+
+    return NULL;
+  }
+
+  result = json_object_pluck(obj, "result");
+
+  if (result == NULL)
+    result = json_null_new();
+
+  return result;
+fail:
+  fprintf(stderr, "Could not parse JSON.\n");
+  return NULL;
+}
+
+static json_value *
+btc_client_request(btc_client_t *client, json_value *obj) {
   http_options_t options;
   http_msg_t *msg;
   char *body;
 
-  if (params == NULL)
-    params = json_array_new(0);
-
-  json_object_push(obj, "method", json_string_new(method));
-  json_object_push(obj, "params", params);
-  json_object_push(obj, "id", json_integer_new(0));
-
   body = json_encode(obj);
 
   json_builder_free(obj);
@@ -107,49 +155,93 @@ btc_client_call(btc_client_t *client, const char *method, json_value *params) {
 
   http_msg_destroy(msg);
 
-  if (obj == NULL || obj->type != json_object)
-    goto fail;
+  if (obj == NULL)
+    fprintf(stderr, "Could not parse JSON.\n");
 
-  error = json_object_get(obj, "error");
+  return obj;
+}
 
-  if (error != NULL && error->type != json_null) {
-    if (error->type != json_object)
-      goto fail;
+static json_value *
+btc_client_message(const char *method, json_value *params, size_t id) {
+  json_value *obj = json_object_new(3);
 
-    message = json_object_get(error, "message");
+  if (params == NULL)
+    params = json_array_new(0);
 
-    if (message == NULL || message->type != json_string)
-      goto fail;
+  json_object_push(obj, "method", json_string_new(method));
+  json_object_push(obj, "params", params);
+  json_object_push(obj, "id", json_integer_new(id));
 
-    code = json_object_get(error, "code");
+  return obj;
+}
 
-    if (code == NULL || code->type != json_integer)
-      goto fail;
+json_value *
+btc_client_call(btc_client_t *client, const char *method, json_value *params) {
+  json_value *obj, *result;
 
-    if (strcmp(method, "help") == 0 && code->u.integer == -1) {
-      fprintf(stderr, "Usage: %s\n", message->u.string.ptr);
-    } else {
-      fprintf(stderr, "RPC Error: %s (code=%d).\n",
-                      message->u.string.ptr,
-                      (int)code->u.integer);
-    }
-
-    json_builder_free(obj);
+  obj = btc_client_request(client, btc_client_message(method, params, 0));
 
+  if (obj == NULL)
     return NULL;
-  }
 
-  result = json_object_pluck(obj, "result");
+  result = btc_client_response(method, obj);
 
   json_builder_free(obj);
 
-  if (result == NULL)
-    result = json_null_new();
-
   return result;
-fail:
-  fprintf(stderr, "Could not parse JSON.\n");
-  if (obj != NULL)
+}
+
+int
+btc_client_batch(btc_client_t *client,
+                 const char **methods,
+                 json_value **params,
+                 json_value **results,
+                 size_t length) {
+  /* All calls go out as a single JSON-RPC batch on
+     the (kept-alive) connection. The server answers
+     in order, but we match on the id regardless. */
+  json_value *obj = json_array_new(length);
+  json_value *item, *id;
+  size_t i, j;
+
+  for (i = 0; i < length; i++) {
+    json_array_push(obj, btc_client_message(methods[i], params[i], i));
+    results[i] = NULL;
+  }
+
+  obj = btc_client_request(client, obj);
+
+  if (obj == NULL)
+    return 0;
+
+  if (obj->type != json_array) {
+    /* A malformed batch is answered with a single error. */
+    btc_client_response("batch", obj);
     json_builder_free(obj);
-  return NULL;
+    return 0;
+  }
+
+  for (j = 0; j < obj->u.array.length; j++) {
+    item = obj->u.array.values[j];
+
+    if (item->type != json_object)
+      continue;
+
+    id = json_object_get(item, "id");
+
+    if (id == NULL || id->type != json_integer)
+      continue;
+
+    if (id->u.integer < 0 || (size_t)id->u.integer >= length)
+      continue;
+
+    i = id->u.integer;
+
+    if (results[i] == NULL)
+      results[i] = btc_client_response(methods[i], item);
+  }
+
+  json_builder_free(obj);
+
+  return 1;
 }
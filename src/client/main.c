@@ -36,20 +36,40 @@ static const struct {
   const char *method;
   json_type schema[8];
 } rpc_methods[] = {
+  { "dumptxoutset", { json_string } },
+  { "estimatesmartfee", { json_integer, json_string } },
   { "generate", { json_integer } },
   { "generatetoaddress", { json_integer, json_string } },
+  { "getaddresshistory", { json_string, json_integer, json_integer } },
+  { "getaddressutxos", { json_string } },
   { "getbestblockhash", { json_none } },
   { "getblock", { json_null, json_integer } },
   { "getblockchaininfo", { json_none } },
   { "getblockcount", { json_none } },
   { "getblockhash", { json_integer } },
   { "getblockheader", { json_null, json_boolean } },
+  { "getblockstats", { json_null, json_array } },
+  { "getblockstatsrange", { json_integer, json_integer, json_array } },
+  { "getblocktemplate", { json_object } },
+  { "getcpuinfo", { json_none } },
+  { "getdbstats", { json_none } },
   { "getdifficulty", { json_none } },
   { "getgenerate", { json_none } },
   { "getinfo", { json_none } },
+  { "getmemoryinfo", { json_none } },
+  { "getnettotals", { json_none } },
+  { "getpeerinfo", { json_none } },
+  { "getperfstats", { json_none } },
+  { "getrawtransaction", { json_string, json_boolean, json_string } },
+  { "gettxoutsetinfo", { json_string } },
   { "help", { json_string } },
+  { "scantxoutset", { json_string, json_array } },
   { "sendtoaddress", { json_string, json_amount } },
-  { "setgenerate", { json_boolean, json_integer } }
+  { "setgenerate", { json_boolean, json_integer } },
+  { "starttrace", { json_integer } },
+  { "stoptrace", { json_string } },
+  { "submitblock", { json_string, json_string } },
+  { "submitpackage", { json_array } }
 };
 
 static const json_type *
@@ -75,71 +95,29 @@ find_schema(const char *method) {
 }
 
 /*
- * Config
- */
-
-static int
-get_config(btc_conf_t *args, int argc, char **argv) {
-  char prefix[BTC_PATH_MAX];
-
-  if (!btc_sys_datadir(prefix, sizeof(prefix), "mako")) {
-    fprintf(stderr, "Could not find suitable datadir.\n");
-    return 0;
-  }
-
-  btc_conf_init(args, argc, argv, prefix, 1);
-
-  return 1;
-}
-
-/*
- * Main
+ * Params
  */
 
-int
-main(int argc, char **argv) {
-  btc_client_t *client = NULL;
-  json_value *params = NULL;
-  const json_type *schema;
-  json_value *result;
-  btc_conf_t args;
-  int ret = EXIT_FAILURE;
+static json_value *
+get_params(const char *method, const char **args, size_t length) {
+  const json_type *schema = find_schema(method);
+  json_value *params;
   size_t i;
 
-  if (!get_config(&args, argc, argv))
-    return EXIT_FAILURE;
-
-  if (args.help) {
-    puts("Usage: mako [options] <command> [params]");
-    return EXIT_SUCCESS;
-  }
-
-  if (args.version) {
-    puts("0.0.0");
-    return EXIT_SUCCESS;
-  }
-
-  if (args.method == NULL) {
-    fprintf(stderr, "Must specify a command.\n");
-    return EXIT_FAILURE;
-  }
-
-  schema = find_schema(args.method);
-
   if (schema == NULL) {
-    fprintf(stderr, "RPC method '%s' not found.\n", args.method);
-    return EXIT_FAILURE;
+    fprintf(stderr, "RPC method '%s' not found.\n", method);
+    return NULL;
   }
 
-  params = json_array_new(args.length);
+  params = json_array_new(length);
 
-  for (i = 0; i < args.length; i++) {
-    const char *param = args.params[i];
+  for (i = 0; i < length; i++) {
+    const char *param = args[i];
     json_type type = schema[i];
     json_value *obj;
 
     if (type == json_none) {
-      fprintf(stderr, "Too many arguments for %s.\n", args.method);
+      fprintf(stderr, "Too many arguments for %s.\n", method);
       goto fail;
     }
 
@@ -198,6 +176,259 @@ main(int argc, char **argv) {
     goto fail;
   }
 
+  return params;
+fail:
+  json_builder_free(params);
+  return NULL;
+}
+
+static void
+print_result(json_value *result) {
+  if (result->type == json_string)
+    puts(result->u.string.ptr);
+  else
+    json_print_ex(result, puts, json_options);
+}
+
+/*
+ * Batch
+ */
+
+typedef struct batch_s {
+  char *lines[1000];
+  const char *methods[1000];
+  json_value *params[1000];
+  json_value *results[1000];
+  size_t length;
+} batch_t;
+
+static char *
+read_line(FILE *stream) {
+  size_t size = 256;
+  char *line = btc_malloc(size);
+  size_t len = 0;
+  int ch;
+
+  while ((ch = getc(stream)) != EOF) {
+    if (ch == '\n')
+      break;
+
+    if (len + 1 == size) {
+      size *= 2;
+      line = btc_realloc(line, size);
+    }
+
+    line[len++] = ch;
+  }
+
+  if (ch == EOF && len == 0) {
+    btc_free(line);
+    return NULL;
+  }
+
+  if (len > 0 && line[len - 1] == '\r')
+    len--;
+
+  line[len] = '\0';
+
+  return line;
+}
+
+static size_t
+split_line(char **args, size_t max, char *line) {
+  /* Whitespace separates arguments, except inside
+     quotes and brackets, so JSON params can contain
+     spaces without further escaping. */
+  size_t length = 0;
+  int depth = 0;
+  int quote = 0;
+  char *ch;
+
+  for (ch = line; *ch != '\0'; ch++) {
+    if (!quote && depth == 0 && (*ch == ' ' || *ch == '\t')) {
+      *ch = '\0';
+      continue;
+    }
+
+    if (ch == line || ch[-1] == '\0') {
+      if (length == max)
+        return max + 1;
+
+      args[length++] = ch;
+    }
+
+    if (quote) {
+      if (*ch == '\\' && ch[1] != '\0')
+        ch++;
+      else if (*ch == '"')
+        quote = 0;
+      continue;
+    }
+
+    switch (*ch) {
+      case '"':
+        quote = 1;
+        break;
+      case '[':
+      case '{':
+        depth++;
+        break;
+      case ']':
+      case '}':
+        depth -= (depth > 0);
+        break;
+    }
+  }
+
+  return length;
+}
+
+static int
+flush_batch(btc_client_t *client, batch_t *batch) {
+  size_t i;
+  int ret;
+
+  ret = btc_client_batch(client,
+                         batch->methods,
+                         batch->params,
+                         batch->results,
+                         batch->length);
+
+  for (i = 0; i < batch->length; i++) {
+    json_value *result = batch->results[i];
+
+    if (result != NULL) {
+      print_result(result);
+      json_builder_free(result);
+    } else {
+      ret = 0;
+    }
+
+    btc_free(batch->lines[i]);
+  }
+
+  batch->length = 0;
+
+  fflush(stdout);
+
+  return ret;
+}
+
+static int
+run_batch(btc_client_t *client, int size) {
+  /* One command per line. Up to `size` commands are
+     sent per request over a single connection, and
+     results are printed as each response arrives. */
+  batch_t *batch = btc_malloc(sizeof(batch_t));
+  char *args[1 + 8];
+  json_value *params;
+  size_t length;
+  int ret = 1;
+  char *line;
+
+  batch->length = 0;
+
+  while ((line = read_line(stdin)) != NULL) {
+    length = split_line(args, lengthof(args), line);
+
+    if (length == 0 || args[0][0] == '#') {
+      btc_free(line);
+      continue;
+    }
+
+    if (length > lengthof(args)) {
+      fprintf(stderr, "Too many parameters.\n");
+      btc_free(line);
+      ret = 0;
+      continue;
+    }
+
+    params = get_params(args[0], (const char **)args + 1, length - 1);
+
+    if (params == NULL) {
+      btc_free(line);
+      ret = 0;
+      continue;
+    }
+
+    batch->lines[batch->length] = line;
+    batch->methods[batch->length] = args[0];
+    batch->params[batch->length] = params;
+    batch->length++;
+
+    if (batch->length == (size_t)size)
+      ret &= flush_batch(client, batch);
+  }
+
+  if (batch->length > 0)
+    ret &= flush_batch(client, batch);
+
+  btc_free(batch);
+
+  return ret;
+}
+
+/*
+ * Config
+ */
+
+static int
+get_config(btc_conf_t *args, int argc, char **argv) {
+  char prefix[BTC_PATH_MAX];
+
+  if (!btc_sys_datadir(prefix, sizeof(prefix), "mako")) {
+    fprintf(stderr, "Could not find suitable datadir.\n");
+    return 0;
+  }
+
+  btc_conf_init(args, argc, argv, prefix, 1);
+
+  return 1;
+}
+
+/*
+ * Main
+ */
+
+int
+main(int argc, char **argv) {
+  btc_client_t *client = NULL;
+  json_value *params = NULL;
+  json_value *result;
+  btc_conf_t args;
+  int ret = EXIT_FAILURE;
+
+  if (!get_config(&args, argc, argv))
+    return EXIT_FAILURE;
+
+  if (args.help) {
+    puts("Usage: mako [options] <command> [params]");
+    puts("       mako [options] -stdin < commands");
+    return EXIT_SUCCESS;
+  }
+
+  if (args.version) {
+    puts("0.0.0");
+    return EXIT_SUCCESS;
+  }
+
+  if (args.rpc_stdin) {
+    if (args.method != NULL) {
+      fprintf(stderr, "Cannot specify a command with -stdin.\n");
+      return EXIT_FAILURE;
+    }
+  } else {
+    if (args.method == NULL) {
+      fprintf(stderr, "Must specify a command.\n");
+      return EXIT_FAILURE;
+    }
+
+    params = get_params(args.method, args.params, args.length);
+
+    if (params == NULL)
+      return EXIT_FAILURE;
+  }
+
   btc_net_startup();
 
   client = btc_client_create();
@@ -208,6 +439,15 @@ main(int argc, char **argv) {
     goto fail;
   }
 
+  if (args.rpc_stdin) {
+    if (run_batch(client, args.rpc_batch))
+      ret = EXIT_SUCCESS;
+
+    btc_client_close(client);
+
+    goto fail;
+  }
+
   result = btc_client_call(client, args.method, params);
   params = NULL;
 
@@ -216,10 +456,7 @@ main(int argc, char **argv) {
   if (result == NULL)
     goto fail;
 
-  if (result->type == json_string)
-    puts(result->u.string.ptr);
-  else
-    json_print_ex(result, puts, json_options);
+  print_result(result);
 
   json_builder_free(result);
 
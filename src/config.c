@@ -364,6 +364,56 @@ btc_match_range(int *z, const char *xp, const char *yp, int min, int max) {
   return 1;
 }
 
+static int
+btc_match_cpus(int *z,
+               size_t *zn,
+               size_t max,
+               const char *xp,
+               const char *yp) {
+  /* Matches `option=0-3,8,10-11`. */
+  const char *val;
+  long lo, hi;
+  char *end;
+
+  if (!btc_match(&val, xp, yp))
+    return 0;
+
+  *zn = 0;
+
+  for (;;) {
+    if (*val < '0' || *val > '9')
+      return btc_die("Invalid option: `%s`", xp);
+
+    lo = strtol(val, &end, 10);
+    hi = lo;
+    val = end;
+
+    if (*val == '-') {
+      val++;
+
+      if (*val < '0' || *val > '9')
+        return btc_die("Invalid option: `%s`", xp);
+
+      hi = strtol(val, &end, 10);
+      val = end;
+    }
+
+    if (hi < lo || hi > 0xffff || (size_t)(hi - lo) >= max - *zn)
+      return btc_die("Invalid option: `%s`", xp);
+
+    while (lo <= hi)
+      z[(*zn)++] = (int)lo++;
+
+    if (*val == '\0')
+      break;
+
+    if (*val++ != ',')
+      return btc_die("Invalid option: `%s`", xp);
+  }
+
+  return 1;
+}
+
 static int
 btc_match_port(int *z, const char *xp, const char *yp) {
   if (!btc_match_int(z, xp, yp))
@@ -398,6 +448,42 @@ btc_match_network(const btc_network_t **z, const char *xp, const char *yp) {
   return 1;
 }
 
+static int
+btc_match_assume(uint8_t *hash, int *height, const char *xp, const char *yp) {
+  /* Matches `option=[height:]hash`. */
+  const char *val, *sep;
+  char tmp[16];
+  size_t len;
+
+  if (!btc_match(&val, xp, yp))
+    return 0;
+
+  *height = -1;
+
+  sep = strchr(val, ':');
+
+  if (sep != NULL) {
+    len = sep - val;
+
+    if (len == 0 || len >= sizeof(tmp))
+      return btc_die("Invalid option: `%s`", xp);
+
+    memcpy(tmp, val, len);
+
+    tmp[len] = '\0';
+
+    if (!btc_parse_int(height, tmp) || *height < 0)
+      return btc_die("Invalid option: `%s`", xp);
+
+    val = sep + 1;
+  }
+
+  if (!btc_hash_import(hash, val))
+    return btc_die("Invalid option: `%s`", xp);
+
+  return 1;
+}
+
 static int
 btc_match_netaddr(btc_netaddr_t *z, const char *xp, const char *yp) {
   const char *val;
@@ -411,6 +497,25 @@ btc_match_netaddr(btc_netaddr_t *z, const char *xp, const char *yp) {
   return 1;
 }
 
+static int
+btc_match_netaddrs(btc_netaddr_t *z,
+                   size_t *zn,
+                   size_t max,
+                   const char *xp,
+                   const char *yp) {
+  btc_netaddr_t addr;
+
+  if (!btc_match_netaddr(&addr, xp, yp))
+    return 0;
+
+  if (*zn == max)
+    return btc_die("Too many options: `%s`", xp);
+
+  z[(*zn)++] = addr;
+
+  return 1;
+}
+
 static int
 btc_match_net(enum btc_ipnet *z, const char *xp, const char *yp) {
   const char *val;
@@ -430,6 +535,56 @@ btc_match_net(enum btc_ipnet *z, const char *xp, const char *yp) {
   return 1;
 }
 
+static int
+btc_match_profile(int *z, const char *xp, const char *yp) {
+  /* Ordered as in node/chaindb.h. */
+  static const char *profiles[] = {
+    "small",
+    "default",
+    "large"
+  };
+  const char *val;
+  int i;
+
+  if (!btc_match(&val, xp, yp))
+    return 0;
+
+  for (i = 0; i < (int)lengthof(profiles); i++) {
+    if (strcmp(val, profiles[i]) == 0) {
+      *z = i;
+      return 1;
+    }
+  }
+
+  return btc_die("Invalid option: `%s`", xp);
+}
+
+static int
+btc_match_level(int *z, const char *xp, const char *yp) {
+  /* Ordered as in node/logger.h. */
+  static const char *levels[] = {
+    "error",
+    "warning",
+    "info",
+    "debug",
+    "spam"
+  };
+  const char *val;
+  int i;
+
+  if (!btc_match(&val, xp, yp))
+    return 0;
+
+  for (i = 0; i < (int)lengthof(levels); i++) {
+    if (strcmp(val, levels[i]) == 0) {
+      *z = i;
+      return 1;
+    }
+  }
+
+  return btc_die("Invalid option: `%s`", xp);
+}
+
 /*
  * Config Helpers
  */
@@ -441,12 +596,41 @@ conf_init(btc_conf_t *conf) {
   conf->network = btc_mainnet;
   conf->prefix[0] = '\0';
   conf->daemon = 0;
+  conf->log_level = 2;
+  conf->debug[0] = '\0';
   conf->network_active = 1;
   conf->disable_wallet = 0;
   conf->checkpoints = 1;
+  conf->assume_valid = 1;
+  conf->assume_height = -1;
   conf->prune = 0;
   conf->workers = 0;
+  conf->loop_cpu = -1;
+  conf->worker_cpus_len = 0;
+  conf->miner_cpus_len = 0;
+  conf->db_cache = 450;
+  conf->db_mmap = 1;
+  conf->db_worker = 0;
+  conf->db_hugepages = 0;
+  conf->db_shared = 0;
+  conf->db_profile = 1;
+  conf->db_autoflush = 0;
+  conf->db_checkpoint = 0;
+  conf->db_automerge = 0;
+  conf->db_blockcache = 0;
+  conf->db_buffer = 0;
+  conf->db_map_coins = -1;
+  conf->persist_mempool = 1;
+  conf->snapshot[0] = '\0';
+  conf->headers_file[0] = '\0';
+  conf->capture_file[0] = '\0';
+  conf->reindex = 0;
+  conf->replay[0] = '\0';
+  conf->replay_scripts = 1;
+  conf->readonly = 0;
   conf->listen = 1;
+  conf->net_threads = 0;
+  conf->busy_poll = 0;
   conf->port = 0;
   btc_netaddr_set(&conf->bind, "::", 0);
   btc_netaddr_set(&conf->external, "0.0.0.0", 0);
@@ -456,6 +640,8 @@ conf_init(btc_conf_t *conf) {
   conf->max_connections = 0;
   conf->max_inbound = 128;
   conf->max_outbound = 8;
+  conf->max_upload = 0;
+  conf->block_buffer = 256;
   conf->ban_time = 24 * 60 * 60;
   conf->discover = 1;
   conf->upnp = 0;
@@ -464,12 +650,29 @@ conf_init(btc_conf_t *conf) {
   conf->bip37 = 0;
   conf->bip152 = 1;
   conf->bip157 = 0;
+  conf->bip330 = 0;
+  conf->filter_index = 0;
+  conf->txindex = 0;
+  conf->coinstats_index = 0;
+  conf->coin_groups = 0;
+  conf->addr_index = 0;
   conf->only_net = BTC_IPNET_NONE;
+  conf->v2transport = 1;
+  conf->udp_port = 0;
+  conf->udp_peers_len = 0;
   conf->rpc_port = 0;
   btc_netaddr_set(&conf->rpc_bind, "127.0.0.1", 0);
+  conf->rpc_threads = 0;
+  conf->rest = 0;
+  conf->metrics = 0;
+  btc_netaddr_init(&conf->notify_bind);
+  btc_netaddr_init(&conf->stratum_bind);
+  conf->stratum_diff = 1;
   btc_str_assign(conf->rpc_connect, "127.0.0.1");
   btc_str_assign(conf->rpc_user, "bitcoinrpc");
   btc_str_assign(conf->rpc_pass, "");
+  conf->rpc_stdin = 0;
+  conf->rpc_batch = 64;
   conf->version = 0;
   conf->help = 0;
   conf->method = NULL;
@@ -536,6 +739,12 @@ conf_read_file(btc_conf_t *conf, const char *file) {
     if (btc_match_bool(&conf->daemon, zp, "daemon="))
       continue;
 
+    if (btc_match_level(&conf->log_level, zp, "loglevel="))
+      continue;
+
+    if (btc_match_str(conf->debug, zp, "debug="))
+      continue;
+
     if (btc_match_bool(&conf->network_active, zp, "networkactive="))
       continue;
 
@@ -545,15 +754,103 @@ conf_read_file(btc_conf_t *conf, const char *file) {
     if (btc_match_bool(&conf->checkpoints, zp, "checkpoints="))
       continue;
 
-    if (btc_match_bool(&conf->prune, zp, "prune="))
+    if (btc_match_bool(&conf->assume_valid, zp, "assumevalid="))
+      continue;
+
+    if (btc_match_assume(conf->assume_hash, &conf->assume_height,
+                         zp, "assumevalid=")) {
+      conf->assume_valid = 1;
+      continue;
+    }
+
+    if (btc_match_uint(&conf->prune, zp, "prune="))
       continue;
 
     if (btc_match_range(&conf->workers, zp, "par=", -6, 15))
       continue;
 
+    if (btc_match_range(&conf->loop_cpu, zp, "loopcpu=", -1, INT_MAX))
+      continue;
+
+    if (btc_match_cpus(conf->worker_cpus, &conf->worker_cpus_len,
+                       lengthof(conf->worker_cpus), zp, "workercpus=")) {
+      continue;
+    }
+
+    if (btc_match_cpus(conf->miner_cpus, &conf->miner_cpus_len,
+                       lengthof(conf->miner_cpus), zp, "minercpus=")) {
+      continue;
+    }
+
+    if (btc_match_range(&conf->db_cache, zp, "dbcache=", 4, 16384))
+      continue;
+
+    if (btc_match_path(conf->snapshot, zp, "loadsnapshot="))
+      continue;
+
+    if (btc_match_path(conf->headers_file, zp, "headersfile="))
+      continue;
+
+    if (btc_match_path(conf->capture_file, zp, "capture="))
+      continue;
+
+    if (btc_match_bool(&conf->reindex, zp, "reindex="))
+      continue;
+
+    if (btc_match_path(conf->replay, zp, "replay="))
+      continue;
+
+    if (btc_match_bool(&conf->replay_scripts, zp, "replayscripts="))
+      continue;
+
+    if (btc_match_bool(&conf->readonly, zp, "readonly="))
+      continue;
+
+    if (btc_match_bool(&conf->db_mmap, zp, "dbmmap="))
+      continue;
+
+    if (btc_match_bool(&conf->db_worker, zp, "dbworker="))
+      continue;
+
+    if (btc_match_bool(&conf->db_hugepages, zp, "dbhugepages="))
+      continue;
+
+    if (btc_match_bool(&conf->db_shared, zp, "dbshared="))
+      continue;
+
+    if (btc_match_profile(&conf->db_profile, zp, "dbprofile="))
+      continue;
+
+    if (btc_match_range(&conf->db_autoflush, zp, "dbautoflush=", 1, 1024))
+      continue;
+
+    if (btc_match_range(&conf->db_checkpoint, zp, "dbcheckpoint=", 1, 4096))
+      continue;
+
+    if (btc_match_range(&conf->db_automerge, zp, "dbautomerge=", 2, 16))
+      continue;
+
+    if (btc_match_range(&conf->db_blockcache, zp, "dbblockcache=", 1, 16384))
+      continue;
+
+    if (btc_match_range(&conf->db_buffer, zp, "dbbuffer=", 1, 4096))
+      continue;
+
+    if (btc_match_bool(&conf->db_map_coins, zp, "dbmapcoins="))
+      continue;
+
+    if (btc_match_bool(&conf->persist_mempool, zp, "persistmempool="))
+      continue;
+
     if (btc_match_bool(&conf->listen, zp, "listen="))
       continue;
 
+    if (btc_match_range(&conf->net_threads, zp, "netthreads=", 0, 16))
+      continue;
+
+    if (btc_match_range(&conf->busy_poll, zp, "busypoll=", 0, 1000000))
+      continue;
+
     if (btc_match_port(&conf->port, zp, "port="))
       continue;
 
@@ -585,6 +882,12 @@ conf_read_file(btc_conf_t *conf, const char *file) {
     if (btc_match_uint(&conf->max_outbound, zp, "maxoutbound="))
       continue;
 
+    if (btc_match_uint(&conf->max_upload, zp, "maxuploadtarget="))
+      continue;
+
+    if (btc_match_range(&conf->block_buffer, zp, "blockbuffer=", 8, 65536))
+      continue;
+
     if (btc_match_uint(&conf->ban_time, zp, "bantime="))
       continue;
 
@@ -614,15 +917,64 @@ conf_read_file(btc_conf_t *conf, const char *file) {
     if (btc_match_bool(&conf->bip157, zp, "peerblockfilters="))
       continue;
 
+    if (btc_match_bool(&conf->bip330, zp, "txreconciliation="))
+      continue;
+
+    if (btc_match_bool(&conf->filter_index, zp, "blockfilterindex="))
+      continue;
+
+    if (btc_match_bool(&conf->txindex, zp, "txindex="))
+      continue;
+
+    if (btc_match_bool(&conf->coinstats_index, zp, "coinstatsindex="))
+      continue;
+
+    if (btc_match_bool(&conf->coin_groups, zp, "coingroups="))
+      continue;
+
+    if (btc_match_bool(&conf->addr_index, zp, "addrindex="))
+      continue;
+
     if (btc_match_net(&conf->only_net, zp, "onlynet="))
       continue;
 
+    if (btc_match_bool(&conf->v2transport, zp, "v2transport="))
+      continue;
+
+    if (btc_match_port(&conf->udp_port, zp, "udpport="))
+      continue;
+
+    if (btc_match_netaddrs(conf->udp_peers, &conf->udp_peers_len,
+                           lengthof(conf->udp_peers), zp, "udppeer=")) {
+      continue;
+    }
+
     if (btc_match_port(&conf->rpc_port, zp, "rpcport="))
       continue;
 
     if (btc_match_netaddr(&conf->rpc_bind, zp, "rpcbind="))
       continue;
 
+    if (btc_match_range(&conf->rpc_threads, zp, "rpcthreads=", 0, 16))
+      continue;
+
+    if (btc_match_bool(&conf->rest, zp, "rest="))
+      continue;
+
+    if (btc_match_bool(&conf->metrics, zp, "metrics="))
+      continue;
+
+    if (btc_match_netaddr(&conf->notify_bind, zp, "notifybind="))
+      continue;
+
+    if (btc_match_netaddr(&conf->stratum_bind, zp, "stratumbind="))
+      continue;
+
+    if (btc_match_range(&conf->stratum_diff, zp, "stratumdiff=",
+                        1, INT_MAX)) {
+      continue;
+    }
+
     if (btc_match_str(conf->rpc_connect, zp, "rpcconnect="))
       continue;
 
@@ -632,6 +984,9 @@ conf_read_file(btc_conf_t *conf, const char *file) {
     if (btc_match_str(conf->rpc_pass, zp, "rpcpassword="))
       continue;
 
+    if (btc_match_range(&conf->rpc_batch, zp, "rpcbatch=", 1, 1000))
+      continue;
+
     btc_free(zp);
 
     fclose(stream);
@@ -666,6 +1021,12 @@ conf_parse_args(btc_conf_t *conf, int argc, char **argv, int allow_params) {
     if (btc_match_argbool(&conf->daemon, arg, "-daemon="))
       continue;
 
+    if (btc_match_level(&conf->log_level, arg, "-loglevel="))
+      continue;
+
+    if (btc_match_str(conf->debug, arg, "-debug="))
+      continue;
+
     if (btc_match_argbool(&conf->network_active, arg, "-networkactive="))
       continue;
 
@@ -675,15 +1036,108 @@ conf_parse_args(btc_conf_t *conf, int argc, char **argv, int allow_params) {
     if (btc_match_argbool(&conf->checkpoints, arg, "-checkpoints="))
       continue;
 
+    if (btc_match_bool(&conf->assume_valid, arg, "-assumevalid="))
+      continue;
+
+    if (btc_match_assume(conf->assume_hash, &conf->assume_height,
+                         arg, "-assumevalid=")) {
+      conf->assume_valid = 1;
+      continue;
+    }
+
     if (btc_match_argbool(&conf->prune, arg, "-prune="))
       continue;
 
+    if (btc_match_uint(&conf->prune, arg, "-prune="))
+      continue;
+
     if (btc_match_range(&conf->workers, arg, "-par=", -6, 15))
       continue;
 
+    if (btc_match_range(&conf->loop_cpu, arg, "-loopcpu=", -1, INT_MAX))
+      continue;
+
+    if (btc_match_cpus(conf->worker_cpus, &conf->worker_cpus_len,
+                       lengthof(conf->worker_cpus), arg, "-workercpus=")) {
+      continue;
+    }
+
+    if (btc_match_cpus(conf->miner_cpus, &conf->miner_cpus_len,
+                       lengthof(conf->miner_cpus), arg, "-minercpus=")) {
+      continue;
+    }
+
+    if (btc_match_range(&conf->db_cache, arg, "-dbcache=", 4, 16384))
+      continue;
+
+    if (btc_match_path(conf->snapshot, arg, "-loadsnapshot="))
+      continue;
+
+    if (btc_match_path(conf->headers_file, arg, "-headersfile="))
+      continue;
+
+    if (btc_match_path(conf->capture_file, arg, "-capture="))
+      continue;
+
+    if (btc_match_argbool(&conf->reindex, arg, "-reindex="))
+      continue;
+
+    if (btc_match_path(conf->replay, arg, "-replay="))
+      continue;
+
+    if (btc_match_argbool(&conf->replay_scripts, arg, "-replayscripts="))
+      continue;
+
+    if (btc_match_argbool(&conf->readonly, arg, "-readonly="))
+      continue;
+
+    if (btc_match_argbool(&conf->db_mmap, arg, "-dbmmap="))
+      continue;
+
+    if (btc_match_argbool(&conf->db_worker, arg, "-dbworker="))
+      continue;
+
+    if (btc_match_argbool(&conf->db_hugepages, arg, "-dbhugepages="))
+      continue;
+
+    if (btc_match_argbool(&conf->db_shared, arg, "-dbshared="))
+      continue;
+
+    if (btc_match_profile(&conf->db_profile, arg, "-dbprofile="))
+      continue;
+
+    if (btc_match_range(&conf->db_autoflush, arg, "-dbautoflush=", 1, 1024))
+      continue;
+
+    if (btc_match_range(&conf->db_checkpoint, arg, "-dbcheckpoint=", 1, 4096))
+      continue;
+
+    if (btc_match_range(&conf->db_automerge, arg, "-dbautomerge=", 2, 16))
+      continue;
+
+    if (btc_match_range(&conf->db_blockcache, arg,
+                        "-dbblockcache=", 1, 16384)) {
+      continue;
+    }
+
+    if (btc_match_range(&conf->db_buffer, arg, "-dbbuffer=", 1, 4096))
+      continue;
+
+    if (btc_match_argbool(&conf->db_map_coins, arg, "-dbmapcoins="))
+      continue;
+
+    if (btc_match_argbool(&conf->persist_mempool, arg, "-persistmempool="))
+      continue;
+
     if (btc_match_argbool(&conf->listen, arg, "-listen="))
       continue;
 
+    if (btc_match_range(&conf->net_threads, arg, "-netthreads=", 0, 16))
+      continue;
+
+    if (btc_match_range(&conf->busy_poll, arg, "-busypoll=", 0, 1000000))
+      continue;
+
     if (btc_match_port(&conf->port, arg, "-port="))
       continue;
 
@@ -715,6 +1169,14 @@ conf_parse_args(btc_conf_t *conf, int argc, char **argv, int allow_params) {
     if (btc_match_uint(&conf->max_outbound, arg, "-maxoutbound="))
       continue;
 
+    if (btc_match_uint(&conf->max_upload, arg, "-maxuploadtarget="))
+      continue;
+
+    if (btc_match_range(&conf->block_buffer, arg, "-blockbuffer=",
+                        8, 65536)) {
+      continue;
+    }
+
     if (btc_match_uint(&conf->ban_time, arg, "-bantime="))
       continue;
 
@@ -744,15 +1206,64 @@ conf_parse_args(btc_conf_t *conf, int argc, char **argv, int allow_params) {
     if (btc_match_argbool(&conf->bip157, arg, "-peerblockfilters="))
       continue;
 
+    if (btc_match_argbool(&conf->bip330, arg, "-txreconciliation="))
+      continue;
+
+    if (btc_match_argbool(&conf->filter_index, arg, "-blockfilterindex="))
+      continue;
+
+    if (btc_match_argbool(&conf->txindex, arg, "-txindex="))
+      continue;
+
+    if (btc_match_argbool(&conf->coinstats_index, arg, "-coinstatsindex="))
+      continue;
+
+    if (btc_match_argbool(&conf->coin_groups, arg, "-coingroups="))
+      continue;
+
+    if (btc_match_argbool(&conf->addr_index, arg, "-addrindex="))
+      continue;
+
     if (btc_match_net(&conf->only_net, arg, "-onlynet="))
       continue;
 
+    if (btc_match_argbool(&conf->v2transport, arg, "-v2transport="))
+      continue;
+
+    if (btc_match_port(&conf->udp_port, arg, "-udpport="))
+      continue;
+
+    if (btc_match_netaddrs(conf->udp_peers, &conf->udp_peers_len,
+                           lengthof(conf->udp_peers), arg, "-udppeer=")) {
+      continue;
+    }
+
     if (btc_match_port(&conf->rpc_port, arg, "-rpcport="))
       continue;
 
     if (btc_match_netaddr(&conf->rpc_bind, arg, "-rpcbind="))
       continue;
 
+    if (btc_match_range(&conf->rpc_threads, arg, "-rpcthreads=", 0, 16))
+      continue;
+
+    if (btc_match_argbool(&conf->rest, arg, "-rest="))
+      continue;
+
+    if (btc_match_argbool(&conf->metrics, arg, "-metrics="))
+      continue;
+
+    if (btc_match_netaddr(&conf->notify_bind, arg, "-notifybind="))
+      continue;
+
+    if (btc_match_netaddr(&conf->stratum_bind, arg, "-stratumbind="))
+      continue;
+
+    if (btc_match_range(&conf->stratum_diff, arg, "-stratumdiff=",
+                        1, INT_MAX)) {
+      continue;
+    }
+
     if (btc_match_str(conf->rpc_connect, arg, "-rpcconnect="))
       continue;
 
@@ -762,6 +1273,14 @@ conf_parse_args(btc_conf_t *conf, int argc, char **argv, int allow_params) {
     if (btc_match_str(conf->rpc_pass, arg, "-rpcpassword="))
       continue;
 
+    if (btc_match_range(&conf->rpc_batch, arg, "-rpcbatch=", 1, 1000))
+      continue;
+
+    if (strcmp(arg, "-stdin") == 0) {
+      conf->rpc_stdin = 1;
+      continue;
+    }
+
     if (strcmp(arg, "-testnet") == 0) {
       conf->network = btc_testnet;
       continue;
@@ -805,6 +1324,7 @@ conf_finalize(btc_conf_t *conf, const char *prefix) {
   const btc_network_t *network = conf->network;
   size_t size = sizeof(conf->prefix);
   char *path = conf->prefix;
+  size_t i;
 
   if (!*conf->prefix)
     btc_str_set(conf->prefix, prefix);
@@ -831,6 +1351,11 @@ conf_finalize(btc_conf_t *conf, const char *prefix) {
   if (conf->proxy.port == 0)
     conf->proxy.port = conf->onion ? 9050 : 1080;
 
+  for (i = 0; i < conf->udp_peers_len; i++) {
+    if (conf->udp_peers[i].port == 0)
+      conf->udp_peers[i].port = conf->udp_port;
+  }
+
   if (conf->rpc_port == 0)
     conf->rpc_port = network->rpc_port;
 
@@ -0,0 +1,187 @@
+/*!
+ * cpu.c - cpu features for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mako/cpu.h>
+#include "internal.h"
+
+/*
+ * CPU Features
+ *
+ * Probed once, on first use. Every primitive with
+ * a hardware backend asks here rather than running
+ * cpuid itself, so one binary picks the best code
+ * on each host and a backend can be switched off
+ * everywhere at once (btc_cpu_disable).
+ *
+ * The backends themselves are compiled per function
+ * (__attribute__((target(...)))) and the rest of the
+ * tree stays C90. On ARM the crypto extensions are a
+ * compile-time choice (-march=...); NEON is part of
+ * the aarch64 baseline.
+ */
+
+#if defined(BTC_HAVE_ASM) && (defined(BTC_GNUC) || defined(__clang__))
+#  if defined(__x86_64__) || defined(__i386__)
+#    define BTC_CPU_HAVE_CPUID
+#    include <cpuid.h>
+#  endif
+#endif
+
+static const char *cpu_names[] = {
+  "ssse3",
+  "sse4.1",
+  "avx2",
+  "sha",
+  "bmi2",
+  "adx",
+  "neon",
+  "sha2"
+};
+
+#if defined(BTC_CPU_HAVE_CPUID)
+static uint64_t
+cpu_xgetbv(void) {
+  uint32_t lo, hi;
+
+  /* xgetbv (%ecx = 0) */
+  __asm__ __volatile__ (
+    ".byte 0x0f, 0x01, 0xd0\n"
+    : "=a" (lo), "=d" (hi)
+    : "c" (0)
+  );
+
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static unsigned int
+cpu_probe(void) {
+  unsigned int eax, ebx, ecx, edx, ecx1;
+  unsigned int flags = 0;
+
+  if (__get_cpuid_max(0, NULL) < 1)
+    return 0;
+
+  __cpuid_count(1, 0, eax, ebx, ecx, edx);
+
+  ecx1 = ecx;
+
+  if (ecx1 & (1 << 9))
+    flags |= BTC_CPU_SSSE3;
+
+  if (ecx1 & (1 << 19))
+    flags |= BTC_CPU_SSE41;
+
+  if (__get_cpuid_max(0, NULL) < 7)
+    return flags;
+
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+  /* AVX2 also requires OS support for the ymm registers. */
+  if ((ebx & (1 << 5)) && (ecx1 & (1 << 27)) && (ecx1 & (1 << 28))) {
+    if ((cpu_xgetbv() & 6) == 6)
+      flags |= BTC_CPU_AVX2;
+  }
+
+  if (ebx & (1 << 8))
+    flags |= BTC_CPU_BMI2;
+
+  if (ebx & (1 << 19))
+    flags |= BTC_CPU_ADX;
+
+  if (ebx & (1 << 29))
+    flags |= BTC_CPU_SHANI;
+
+  return flags;
+}
+#else /* !BTC_CPU_HAVE_CPUID */
+static unsigned int
+cpu_probe(void) {
+  unsigned int flags = 0;
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+  flags |= BTC_CPU_NEON;
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) \
+                          || defined(__ARM_FEATURE_SHA2))
+  flags |= BTC_CPU_SHA2;
+#endif
+
+  return flags;
+}
+#endif /* !BTC_CPU_HAVE_CPUID */
+
+/* Races here are benign: every thread computes the same value. */
+static volatile int cpu_flags = -1;
+static volatile unsigned int cpu_mask = 0;
+
+volatile int btc_cpu_enabled = -1;
+
+unsigned int
+btc_cpu_detected(void) {
+  if (cpu_flags < 0)
+    cpu_flags = cpu_probe();
+
+  return cpu_flags;
+}
+
+unsigned int
+btc_cpu_features(void) {
+  unsigned int flags = btc_cpu_detected() & ~cpu_mask;
+
+  btc_cpu_enabled = flags;
+
+  return flags;
+}
+
+void
+btc_cpu_disable(unsigned int features) {
+  /* Only safe before (or between) uses. */
+  cpu_mask = features;
+  btc_cpu_features();
+}
+
+const char *
+btc_cpu_feature_name(size_t index) {
+  if (index >= lengthof(cpu_names))
+    return NULL;
+
+  return cpu_names[index];
+}
+
+/*
+ * Backends
+ */
+
+static const struct {
+  const char *name;
+  const char *(*backend)(void);
+} cpu_backends[] = {
+  { "sha256", btc_sha256_backend },
+  { "sha256_many", btc_sha256_many_backend },
+  { "sha512_pbkdf2", btc_sha512_pbkdf2_backend },
+  { "ripemd160_many", btc_ripemd160_many_backend },
+  { "mpn_mul", btc_mpn_mul_backend },
+  { "base16", btc_base16_backend }
+};
+
+const char *
+btc_cpu_backend_name(size_t index) {
+  if (index >= lengthof(cpu_backends))
+    return NULL;
+
+  return cpu_backends[index].name;
+}
+
+const char *
+btc_cpu_backend(size_t index) {
+  if (index >= lengthof(cpu_backends))
+    return NULL;
+
+  return cpu_backends[index].backend();
+}
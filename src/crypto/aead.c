@@ -0,0 +1,114 @@
+/*!
+ * aead.c - chacha20-poly1305 for mako
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://tools.ietf.org/html/rfc8439#section-2.8
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <mako/crypto/mac.h>
+#include <mako/crypto/stream.h>
+#include <mako/util.h>
+#include "../bio.h"
+#include "../internal.h"
+
+/*
+ * ChaCha20-Poly1305
+ */
+
+void
+btc_aead_init(btc_aead_t *ctx, const uint8_t *key, const uint8_t *nonce) {
+  uint8_t polykey[32];
+
+  /* Block zero keys the MAC; the payload starts at block one. */
+  btc_chacha20_init(&ctx->chacha, key, 32, nonce, 12, 0);
+  btc_chacha20_keystream(&ctx->chacha, polykey, 32);
+
+  btc_poly1305_init(&ctx->poly, polykey);
+
+  /* Skip the rest of block zero. */
+  ctx->chacha.pos = 0;
+  ctx->chacha.state[12] = 1;
+
+  ctx->adlen = 0;
+  ctx->ctlen = 0;
+
+  btc_memzero(polykey, sizeof(polykey));
+}
+
+void
+btc_aead_aad(btc_aead_t *ctx, const uint8_t *aad, size_t len) {
+  CHECK(ctx->ctlen == 0);
+
+  if (len > 0)
+    btc_poly1305_update(&ctx->poly, aad, len);
+
+  ctx->adlen += len;
+}
+
+static void
+btc_aead_start(btc_aead_t *ctx) {
+  if (ctx->ctlen == 0)
+    btc_poly1305_pad(&ctx->poly);
+}
+
+void
+btc_aead_encrypt(btc_aead_t *ctx,
+                 uint8_t *dst,
+                 const uint8_t *src,
+                 size_t len) {
+  btc_aead_start(ctx);
+
+  btc_chacha20_crypt(&ctx->chacha, dst, src, len);
+  btc_poly1305_update(&ctx->poly, dst, len);
+
+  ctx->ctlen += len;
+}
+
+void
+btc_aead_decrypt(btc_aead_t *ctx,
+                 uint8_t *dst,
+                 const uint8_t *src,
+                 size_t len) {
+  btc_aead_start(ctx);
+
+  btc_poly1305_update(&ctx->poly, src, len);
+  btc_chacha20_crypt(&ctx->chacha, dst, src, len);
+
+  ctx->ctlen += len;
+}
+
+void
+btc_aead_auth(btc_aead_t *ctx, const uint8_t *data, size_t len) {
+  /* MAC the ciphertext without decrypting it. */
+  btc_aead_start(ctx);
+
+  btc_poly1305_update(&ctx->poly, data, len);
+
+  ctx->ctlen += len;
+}
+
+void
+btc_aead_final(btc_aead_t *ctx, uint8_t *tag) {
+  uint8_t lens[16];
+
+  btc_aead_start(ctx);
+
+  btc_write64le(lens + 0, ctx->adlen);
+  btc_write64le(lens + 8, ctx->ctlen);
+
+  btc_poly1305_pad(&ctx->poly);
+  btc_poly1305_update(&ctx->poly, lens, 16);
+  btc_poly1305_final(&ctx->poly, tag);
+
+  btc_memzero(&ctx->chacha, sizeof(ctx->chacha));
+}
+
+int
+btc_aead_verify(const uint8_t *mac1, const uint8_t *mac2) {
+  return btc_memequal(mac1, mac2, 16);
+}
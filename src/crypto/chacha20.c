@@ -104,6 +104,59 @@ chacha20_block(btc_chacha20_t *ctx, uint32_t *stream) {
   ctx->state[13] += (ctx->state[12] < 1);
 }
 
+static void
+chacha20_qround4(uint32_t x[16][4], int a, int b, int c, int d) {
+  int j;
+
+  for (j = 0; j < 4; j++) {
+    x[a][j] += x[b][j]; x[d][j] = ROTL32(x[d][j] ^ x[a][j], 16);
+    x[c][j] += x[d][j]; x[b][j] = ROTL32(x[b][j] ^ x[c][j], 12);
+    x[a][j] += x[b][j]; x[d][j] = ROTL32(x[d][j] ^ x[a][j], 8);
+    x[c][j] += x[d][j]; x[b][j] = ROTL32(x[b][j] ^ x[c][j], 7);
+  }
+}
+
+static void
+chacha20_block4(btc_chacha20_t *ctx, uint8_t *dst) {
+  /* Four blocks side by side: every step of a
+     quarter round applies to the same word of
+     each block, which vectorizes cleanly. */
+  uint32_t s[16][4];
+  uint32_t x[16][4];
+  int i, j;
+
+  for (i = 0; i < 16; i++) {
+    for (j = 0; j < 4; j++)
+      s[i][j] = ctx->state[i];
+  }
+
+  for (j = 1; j < 4; j++) {
+    s[12][j] = ctx->state[12] + j;
+    s[13][j] = ctx->state[13] + (s[12][j] < ctx->state[12]);
+  }
+
+  memcpy(x, s, sizeof(x));
+
+  for (i = 0; i < 10; i++) {
+    chacha20_qround4(x, 0, 4,  8, 12);
+    chacha20_qround4(x, 1, 5,  9, 13);
+    chacha20_qround4(x, 2, 6, 10, 14);
+    chacha20_qround4(x, 3, 7, 11, 15);
+    chacha20_qround4(x, 0, 5, 10, 15);
+    chacha20_qround4(x, 1, 6, 11, 12);
+    chacha20_qround4(x, 2, 7,  8, 13);
+    chacha20_qround4(x, 3, 4,  9, 14);
+  }
+
+  for (j = 0; j < 4; j++) {
+    for (i = 0; i < 16; i++)
+      btc_write32le(dst + j * 64 + i * 4, x[i][j] + s[i][j]);
+  }
+
+  ctx->state[12] += 4;
+  ctx->state[13] += (ctx->state[12] < 4);
+}
+
 void
 btc_chacha20_crypt(btc_chacha20_t *ctx,
                    uint8_t *dst,
@@ -123,6 +176,18 @@ btc_chacha20_crypt(btc_chacha20_t *ctx,
       pos = 0;
     }
 
+    while (len >= 256) {
+      uint8_t tmp[256];
+
+      chacha20_block4(ctx, tmp);
+
+      btc_memxor3(dst, src, tmp, 256);
+
+      dst += 256;
+      src += 256;
+      len -= 256;
+    }
+
     while (len >= 64) {
       chacha20_block(ctx, ctx->stream);
 
@@ -145,3 +210,47 @@ btc_chacha20_crypt(btc_chacha20_t *ctx,
 
   ctx->pos = pos;
 }
+
+void
+btc_chacha20_keystream(btc_chacha20_t *ctx, uint8_t *dst, size_t len) {
+  uint8_t *bytes = (uint8_t *)ctx->stream;
+  size_t pos = ctx->pos;
+  size_t want = 64 - pos;
+
+  if (len >= want) {
+    if (pos > 0) {
+      memcpy(dst, bytes + pos, want);
+
+      dst += want;
+      len -= want;
+      pos = 0;
+    }
+
+    while (len >= 256) {
+      chacha20_block4(ctx, dst);
+
+      dst += 256;
+      len -= 256;
+    }
+
+    while (len >= 64) {
+      chacha20_block(ctx, ctx->stream);
+
+      memcpy(dst, bytes, 64);
+
+      dst += 64;
+      len -= 64;
+    }
+  }
+
+  if (len > 0) {
+    if (pos == 0)
+      chacha20_block(ctx, ctx->stream);
+
+    memcpy(dst, bytes + pos, len);
+
+    pos += len;
+  }
+
+  ctx->pos = pos;
+}
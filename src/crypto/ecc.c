@@ -56,6 +56,15 @@
  *     Pieter Wuille, Jonas Nick, Tim Ruffing
  *     https://github.com/bitcoin/bips/blob/master/bip-0340.mediawiki
  *
+ *   [SWIFT] SwiftEC: Shallue-van de Woestijne Indifferentiable
+ *           Function To Elliptic Curves
+ *     J. Chavez-Saab, F. Rodriguez-Henriquez, M. Tibouchi
+ *     https://eprint.iacr.org/2022/759.pdf
+ *
+ *   [BIP324] Version 2 P2P Encrypted Transport Protocol
+ *     Dhruv Mehta, Tim Ruffing, Jonas Schnelli, Pieter Wuille
+ *     https://github.com/bitcoin/bips/blob/master/bip-0324.mediawiki
+ *
  *   [JCEN12] Efficient Software Implementation of Public-Key Cryptography
  *            on Sensor Networks Using the MSP430X Microcontroller
  *     C. P. L. Gouvea, L. B. Oliveira, J. Lopez
@@ -94,7 +103,11 @@
 #if defined(BTC_HAVE_INT128)
 typedef uint64_t fe_word_t;
 #  define FIELD_WORD_BITS 64
-#  define FIELD_WORDS 6
+#  if defined(BTC_FIELD_5X52)
+#    define FIELD_WORDS 5
+#  else
+#    define FIELD_WORDS 6
+#  endif
 #else
 typedef uint32_t fe_word_t;
 #  define FIELD_WORD_BITS 32
@@ -115,6 +128,11 @@ BTC_BARRIER(fe_word_t, fe_word)
 #define FIXED_STEPS ((256 + FIXED_WIDTH - 1) / FIXED_WIDTH) /* 64 */
 #define FIXED_LENGTH (FIXED_STEPS * FIXED_SIZE) /* 1024 */
 
+#define PRECOMP_WIDTH 6
+#define PRECOMP_SIZE (1 << (PRECOMP_WIDTH - 1)) /* 32 */
+#define PRECOMP_STEPS ((256 + PRECOMP_WIDTH - 1) / PRECOMP_WIDTH) /* 43 */
+#define PRECOMP_LENGTH (PRECOMP_STEPS * PRECOMP_SIZE) /* 1376 */
+
 #define WND_WIDTH 4
 #define WND_SIZE (1 << WND_WIDTH) /* 16 */
 #define WND_STEPS ((ENDO_BITS + WND_WIDTH - 1) / WND_WIDTH) /* 64 */
@@ -127,6 +145,8 @@ BTC_BARRIER(fe_word_t, fe_word)
 
 #define JSF_SIZE 4
 
+#define ECDSA_BATCH 8
+
 #define ECC_MIN(x, y) ((x) < (y) ? (x) : (y))
 #define ECC_MAX(x, y) ((x) > (y) ? (x) : (y))
 
@@ -163,11 +183,19 @@ typedef struct wei_scratch_s {
   sc_t *coeffs;
 } wei_scratch_t;
 
+typedef struct wei_precomp_s {
+  wge_t *wnd;
+  sc_t blind;
+  wge_t unblind;
+} wei_precomp_t;
+
 /*
  * SECP256K1
  */
 
-#if FIELD_WORD_BITS == 64
+#if FIELD_WORDS == 5
+#  include "fields/secp256k1_5x52.h"
+#elif FIELD_WORD_BITS == 64
 #  include "fields/secp256k1_64.h"
 #else
 #  include "fields/secp256k1_32.h"
@@ -1728,6 +1756,59 @@ wge_set_jge_var(wge_t *r, const jge_t *p) {
   r->inf = 0;
 }
 
+static void
+wge_set_jge_all_var(wge_t *out, const jge_t *in, size_t len, fe_t *zs) {
+  /* Montgomery's trick: 1I + (3(n-1))M + n(3M + 1S). */
+  fe_t acc, a, aa;
+  size_t i;
+
+  fe_set(acc, field_one);
+
+  /* Running products of the non-trivial Z coordinates. */
+  for (i = 0; i < len; i++) {
+    if (!in[i].inf && !in[i].aff)
+      fe_mul(acc, acc, in[i].z);
+
+    fe_set(zs[i], acc);
+  }
+
+  ASSERT(fe_invert_var(acc, acc));
+
+  for (i = len; i-- > 0;) {
+    if (in[i].inf) {
+      wge_zero(&out[i]);
+      continue;
+    }
+
+    if (in[i].aff) {
+      fe_set(out[i].x, in[i].x);
+      fe_set(out[i].y, in[i].y);
+      out[i].inf = 0;
+      continue;
+    }
+
+    /* A = 1 / Z(i) */
+    if (i > 0)
+      fe_mul(a, acc, zs[i - 1]);
+    else
+      fe_set(a, acc);
+
+    fe_mul(acc, acc, in[i].z);
+
+    /* AA = A^2 */
+    fe_sqr(aa, a);
+
+    /* X3 = X1 * AA */
+    fe_mul(out[i].x, in[i].x, aa);
+
+    /* Y3 = Y1 * AA * A */
+    fe_mul(out[i].y, in[i].y, aa);
+    fe_mul(out[i].y, out[i].y, a);
+
+    out[i].inf = 0;
+  }
+}
+
 static void
 wge_endo_beta(wge_t *r, const wge_t *p) {
   fe_mul(r->x, p->x, curve_beta);
@@ -2689,6 +2770,37 @@ jge_endo_beta(jge_t *r, const jge_t *p) {
   r->aff = p->aff;
 }
 
+static void
+jge_naf_points_var(jge_t *out, const wge_t *p) {
+  /* Odd multiples of P. */
+  jge_t dbl;
+  int i;
+
+  jge_set_wge(&out[0], p);
+  jge_dbl_var(&dbl, &out[0]);
+
+  for (i = 1; i < NAF_SIZE; i++)
+    jge_add_var(&out[i], &out[i - 1], &dbl);
+}
+
+static void
+wge_naf_points_var(wge_t *out1, wge_t *out2, const wge_t *p) {
+  /* Odd multiples of P and of beta * P, affinized
+     with a single inversion so that the main loop
+     can use mixed additions. */
+  jge_t points[NAF_SIZE];
+  fe_t zs[NAF_SIZE];
+  int i;
+
+  jge_naf_points_var(points, p);
+
+  wge_set_jge_all_var(out1, points, NAF_SIZE, zs);
+
+  /* One multiplication per point. */
+  for (i = 0; i < NAF_SIZE; i++)
+    wge_endo_beta(&out2[i], &out1[i]);
+}
+
 /*
  * Short Weierstrass Curve
  */
@@ -2835,6 +2947,72 @@ wei_mul_g(wge_t *r, const sc_t k) {
   wge_set_jge(r, &j);
 }
 
+static void
+wei_jmul_g_precomp(jge_t *r, const wei_precomp_t *pre, const sc_t k) {
+  /* Fixed-base method with signed windows.
+   *
+   * Like wei_jmul_g, but with the larger table from
+   * btc_precomp_create: each window is recoded to a
+   * digit in [-32,31] so that 32 entries cover 6 bits,
+   * leaving 43 additions for a 256 bit scalar.
+   *
+   * The scalar is blinded as (k + b) * G - b * G
+   * to decorrelate the selected digits from `k`.
+   */
+  const wge_t *wnds = pre->wnd;
+  mp_limb_t b, c, d, s;
+  mp_bits_t i, j;
+  sc_t e;
+  wge_t t;
+
+  sc_add(e, k, pre->blind);
+
+  /* Multiply in constant time. */
+  jge_zero(r);
+
+  c = 0;
+
+  for (i = 0; i < PRECOMP_STEPS; i++) {
+    b = sc_get_bits(e, i * PRECOMP_WIDTH, PRECOMP_WIDTH) + c;
+
+    /* Borrow from the next window if b >= 32. */
+    c = (b + PRECOMP_SIZE) >> PRECOMP_WIDTH;
+    d = b - (c << PRECOMP_WIDTH);
+    s = d >> (MP_LIMB_BITS - 1);
+    d = (d ^ -s) + s;
+
+    wge_zero(&t);
+
+    for (j = 0; j < PRECOMP_SIZE; j++)
+      wge_select(&t, &t, &wnds[i * PRECOMP_SIZE + j], (mp_limb_t)j + 1 == d);
+
+    fe_neg_cond(t.y, t.y, s);
+
+    jge_mixed_add(r, r, &t);
+  }
+
+  jge_mixed_add(r, r, &pre->unblind);
+
+  sc_cleanse(e);
+
+  cleanse(&b, sizeof(b));
+  cleanse(&c, sizeof(c));
+  cleanse(&d, sizeof(d));
+  cleanse(&s, sizeof(s));
+}
+
+static void
+wei_mul_g_precomp(wge_t *r, const wei_precomp_t *pre, const sc_t k) {
+  jge_t j;
+
+  if (pre != NULL)
+    wei_jmul_g_precomp(&j, pre, k);
+  else
+    wei_jmul_g(&j, k);
+
+  wge_set_jge(r, &j);
+}
+
 static void
 wei_jmul(jge_t *r, const wge_t *p, const sc_t k) {
   /* Windowed method for point multiplication
@@ -2922,21 +3100,26 @@ wei_mul(wge_t *r, const wge_t *p, const sc_t k) {
 }
 
 static void
-wei_jmul_double_var(jge_t *r,
-                    const sc_t k1,
-                    const wge_t *p2,
-                    const sc_t k2) {
+wei_jmul_double_wnd_var(jge_t *r,
+                        const sc_t k1,
+                        const wge_t *wnd3,
+                        const wge_t *wnd4,
+                        const sc_t k2) {
   /* Point multiplication with efficiently computable endomorphisms.
    *
    * [GECC] Algorithm 3.77, Page 129, Section 3.5.
    * [GLV] Page 193, Section 3 (Using Efficient Endomorphisms).
+   *
+   * The odd multiples of the second point (and of its
+   * endomorphism) are provided by the caller in affine
+   * form, allowing them to be normalized in bulk.
    */
   const wge_t *wnd1 = curve_wnd_naf;
   const wge_t *wnd2 = curve_wnd_endo;
   int naf1[ENDO_BITS + 1]; /* 1048 bytes */
   int naf2[ENDO_BITS + 1]; /* 1048 bytes */
   int naf3[ENDO_BITS + 1]; /* 1048 bytes */
-  jge_t wnd3[JSF_SIZE]; /* 608 bytes */
+  int naf4[ENDO_BITS + 1]; /* 1048 bytes */
   sc_t c1, c2, c3, c4; /* 288 bytes */
   mp_bits_t i, max, max1, max2;
 
@@ -2944,21 +3127,21 @@ wei_jmul_double_var(jge_t *r,
   wei_endo_split(c1, c2, k1);
   wei_endo_split(c3, c4, k2);
 
-  /* Compute NAFs. */
+  /* Compute NAFs. Both halves of the second scalar get
+     their own wNAF: at width 5 that is ~43 additions
+     against ~65 for the joint sparse form. */
   max1 = sc_naf_var(naf1, naf2, c1, c2, NAF_WIDTH_PRE);
-  max2 = sc_jsf_var(naf3, c3, c4);
+  max2 = sc_naf_var(naf3, naf4, c3, c4, NAF_WIDTH);
   max = ECC_MAX(max1, max2);
 
-  /* Create comb for JSF. */
-  jge_jsf_points_var(wnd3, p2);
-
-  /* Multiply and add. */
+  /* Multiply and add (interleaved). */
   jge_zero(r);
 
   for (i = max - 1; i >= 0; i--) {
     int z1 = naf1[i];
     int z2 = naf2[i];
     int z3 = naf3[i];
+    int z4 = naf4[i];
 
     if (i != max - 1)
       jge_dbl_var(r, r);
@@ -2974,12 +3157,31 @@ wei_jmul_double_var(jge_t *r,
       jge_mixed_sub_var(r, r, &wnd2[(-z2 - 1) >> 1]);
 
     if (z3 > 0)
-      jge_add_var(r, r, &wnd3[(z3 - 1) >> 1]);
+      jge_mixed_add_var(r, r, &wnd3[(z3 - 1) >> 1]);
     else if (z3 < 0)
-      jge_sub_var(r, r, &wnd3[(-z3 - 1) >> 1]);
+      jge_mixed_sub_var(r, r, &wnd3[(-z3 - 1) >> 1]);
+
+    if (z4 > 0)
+      jge_mixed_add_var(r, r, &wnd4[(z4 - 1) >> 1]);
+    else if (z4 < 0)
+      jge_mixed_sub_var(r, r, &wnd4[(-z4 - 1) >> 1]);
   }
 }
 
+static void
+wei_jmul_double_var(jge_t *r,
+                    const sc_t k1,
+                    const wge_t *p2,
+                    const sc_t k2) {
+  wge_t wnd3[NAF_SIZE]; /* 832 bytes */
+  wge_t wnd4[NAF_SIZE]; /* 832 bytes */
+
+  /* Precompute odd multiples. */
+  wge_naf_points_var(wnd3, wnd4, p2);
+
+  wei_jmul_double_wnd_var(r, k1, wnd3, wnd4, k2);
+}
+
 static void
 wei_mul_double_var(wge_t *r,
                    const sc_t k1,
@@ -3386,6 +3588,241 @@ wei_point_to_hash(unsigned char *bytes,
   wge_cleanse(&p2);
 }
 
+static void
+wei_xswiftec(fe_t x, const fe_t u0, const fe_t t0) {
+  /* ElligatorSwift forward map (x only).
+   *
+   * [SWIFT] Page 11, Section 4.2.
+   * [BIP324] "ElligatorSwift encoding of curve X coordinates".
+   *
+   * Map:
+   *
+   *   g(x) = x^3 + b
+   *   c = sqrt(-3)
+   *   u = 1, if u = 0
+   *   t = 1, if t = 0
+   *   t = 2 * t, if g(u) = -t^2
+   *   X = (g(u) - t^2) / (2 * t)
+   *   Y = (X + t) / (c * u)
+   *   x1 = u + 4 * Y^2
+   *   x2 = (-X / Y - u) / 2
+   *   x3 = (X / Y - u) / 2
+   *   x = first of x1, x2, x3 for which g(x) is square
+   *
+   * Either one or all three of g(x1), g(x2), g(x3)
+   * are square, so the choice of c does not matter.
+   */
+  fe_t u, t, gu, t2, X, Y, z, x1, x2, x3, y2;
+
+  fe_select(u, u0, field_one, fe_is_zero(u0));
+  fe_select(t, t0, field_one, fe_is_zero(t0));
+
+  wei_solve_y2(gu, u);
+
+  fe_sqr(t2, t);
+  fe_add(z, gu, t2);
+
+  if (fe_is_zero(z)) {
+    fe_add(t, t, t);
+    fe_sqr(t2, t);
+  }
+
+  /* X = (g(u) - t^2) / (2 * t) */
+  fe_sub(X, gu, t2);
+  fe_add(z, t, t);
+  fe_invert(z, z);
+  fe_mul(X, X, z);
+
+  /* Y = (X + t) / (c * u) */
+  fe_add(Y, X, t);
+  fe_mul(z, curve_c, u);
+  fe_invert(z, z);
+  fe_mul(Y, Y, z);
+
+  /* x1 = u + 4 * Y^2 */
+  fe_sqr(x1, Y);
+  fe_mul4(x1, x1);
+  fe_add(x1, x1, u);
+
+  /* x3 = (X / Y - u) / 2, x2 = -x3 - u */
+  fe_invert(z, Y);
+  fe_mul(x3, X, z);
+  fe_sub(x3, x3, u);
+  fe_mul(x3, x3, curve_i2);
+
+  fe_add(x2, x3, u);
+  fe_neg(x2, x2);
+
+  fe_set(x, x3);
+
+  wei_solve_y2(y2, x2);
+  fe_select(x, x, x2, fe_is_square(y2));
+
+  wei_solve_y2(y2, x1);
+  fe_select(x, x, x1, fe_is_square(y2));
+}
+
+static int
+wei_xswiftec_inv(fe_t t, const fe_t x, const fe_t u, unsigned int hint) {
+  /* ElligatorSwift inverse map.
+   *
+   * [SWIFT] Page 14, Section 5.
+   * [BIP324] "ElligatorSwift encoding of curve X coordinates".
+   *
+   * There are up to eight preimages per (x, u). Bit
+   * 1 of the hint picks which of x1 or x2/x3 we land
+   * on, bits 0 and 2 pick among the roots.
+   *
+   * Map:
+   *
+   *   g(x) = x^3 + b
+   *   c = sqrt(-3)
+   *
+   *   if hint & 2 = 0:
+   *     fail, if g(-x - u) is square
+   *     v = x
+   *     s = -g(u) / (u^2 + u * v + v^2)
+   *   else:
+   *     s = x - u
+   *     fail, if s = 0
+   *     r = sqrt(-s * (4 * g(u) + 3 * s * u^2))
+   *     fail, if r does not exist
+   *     fail, if hint & 1 and r = 0
+   *     v = (r / s - u) / 2
+   *
+   *   v = -u - v, if hint & 1
+   *   w = sqrt(s)
+   *   w = -w, if hint & 4
+   *   t = w * (u * (c - 1) / 2 - v)
+   */
+  fe_t gu, s, v, w, r, z;
+
+  wei_solve_y2(gu, u);
+
+  if ((hint & 2) == 0) {
+    fe_add(z, x, u);
+    fe_neg(z, z);
+
+    wei_solve_y2(z, z);
+
+    if (fe_is_square(z))
+      return 0;
+
+    fe_set(v, x);
+
+    fe_sqr(z, u);
+    fe_mul(w, u, v);
+    fe_add(z, z, w);
+    fe_sqr(w, v);
+    fe_add(z, z, w);
+
+    if (fe_is_zero(z))
+      return 0;
+
+    fe_invert(z, z);
+    fe_mul(s, gu, z);
+    fe_neg(s, s);
+  } else {
+    fe_sub(s, x, u);
+
+    if (fe_is_zero(s))
+      return 0;
+
+    fe_sqr(z, u);
+    fe_mul(z, z, s);
+    fe_mul3(z, z);
+    fe_mul4(w, gu);
+    fe_add(z, z, w);
+    fe_mul(z, z, s);
+    fe_neg(z, z);
+
+    if (!fe_sqrt(r, z))
+      return 0;
+
+    if ((hint & 1) && fe_is_zero(r))
+      return 0;
+
+    fe_invert(z, s);
+    fe_mul(v, r, z);
+    fe_sub(v, v, u);
+    fe_mul(v, v, curve_i2);
+  }
+
+  if (hint & 1) {
+    fe_add(v, v, u);
+    fe_neg(v, v);
+  }
+
+  if (!fe_sqrt(w, s))
+    return 0;
+
+  if (hint & 4)
+    fe_neg(w, w);
+
+  fe_sub(z, curve_c, field_one);
+  fe_mul(z, z, curve_i2);
+  fe_mul(z, z, u);
+  fe_sub(z, z, v);
+  fe_mul(t, w, z);
+
+  return 1;
+}
+
+static void
+wei_point_to_swift(unsigned char *bytes,
+                   const wge_t *p,
+                   const unsigned char *entropy) {
+  /* Pick u at random until some preimage t exists. */
+  unsigned char *u1 = bytes;
+  unsigned char *t1 = bytes + 32;
+  unsigned int hint = 0;
+  btc_drbg_t rng;
+  fe_t u, t, x;
+
+  btc_drbg_init(&rng, entropy, 32);
+
+  for (;;) {
+    btc_drbg_generate(&rng, u1, 32);
+    btc_drbg_generate(&rng, &hint, sizeof(hint));
+
+    /* Anything above p reduces. */
+    fe_import(u, u1);
+
+    if (!wei_xswiftec_inv(t, p->x, u, hint))
+      continue;
+
+    /* The forward map has a couple of special
+       cases the inverse doesn't account for. */
+    wei_xswiftec(x, u, t);
+
+    if (fe_equal(x, p->x))
+      break;
+  }
+
+  /* The parity of t carries the parity of y. */
+  fe_set_odd(t, t, fe_is_odd(p->y));
+
+  fe_export(u1, u);
+  fe_export(t1, t);
+
+  cleanse(&rng, sizeof(rng));
+  cleanse(&hint, sizeof(hint));
+
+  fe_cleanse(u);
+  fe_cleanse(t);
+}
+
+static void
+wei_point_from_swift(fe_t x, const unsigned char *bytes) {
+  fe_t u, t;
+
+  /* Either half may be any 256 bit string. */
+  fe_import(u, bytes);
+  fe_import(t, bytes + 32);
+
+  wei_xswiftec(x, u, t);
+}
+
 /*
  * Scratch API
  */
@@ -3424,6 +3861,67 @@ btc_scratch_destroy(wei_scratch_t *scratch) {
   free(scratch);
 }
 
+/*
+ * Precomputation API
+ */
+
+wei_precomp_t *
+btc_precomp_create(const unsigned char *entropy) {
+  wei_precomp_t *pre = (wei_precomp_t *)checked_malloc(sizeof(wei_precomp_t));
+  jge_t *points = (jge_t *)checked_malloc(PRECOMP_LENGTH * sizeof(jge_t));
+  fe_t *zs = (fe_t *)checked_malloc(PRECOMP_LENGTH * sizeof(fe_t));
+  jge_t *row;
+  jge_t b;
+  int i, j;
+
+  /* Row i holds j * 2^(6 * i) * G for j in [1,32]. */
+  jge_set_wge(&b, &curve_g);
+
+  for (i = 0; i < PRECOMP_STEPS; i++) {
+    row = &points[i * PRECOMP_SIZE];
+
+    jge_set(&row[0], &b);
+
+    for (j = 1; j < PRECOMP_SIZE; j++)
+      jge_add_var(&row[j], &row[j - 1], &b);
+
+    jge_dbl_var(&b, &row[PRECOMP_SIZE - 1]);
+  }
+
+  pre->wnd = (wge_t *)checked_malloc(PRECOMP_LENGTH * sizeof(wge_t));
+
+  wge_set_jge_all_var(pre->wnd, points, PRECOMP_LENGTH, zs);
+
+  free(points);
+  free(zs);
+
+  btc_precomp_randomize(pre, entropy);
+
+  return pre;
+}
+
+void
+btc_precomp_destroy(wei_precomp_t *pre) {
+  sc_cleanse(pre->blind);
+  wge_cleanse(&pre->unblind);
+  free(pre->wnd);
+  free(pre);
+}
+
+void
+btc_precomp_randomize(wei_precomp_t *pre, const unsigned char *entropy) {
+  btc_drbg_t rng;
+
+  btc_drbg_init(&rng, entropy, 32);
+
+  sc_random(pre->blind, &rng);
+
+  wei_mul_g(&pre->unblind, pre->blind);
+  wge_neg(&pre->unblind, &pre->unblind);
+
+  cleanse(&rng, sizeof(rng));
+}
+
 /*
  * ECDSA
  */
@@ -3648,6 +4146,50 @@ btc_ecdsa_pubkey_tweak_add(unsigned char *out,
   return ret;
 }
 
+int
+btc_ecdsa_pubkey_tweak_add_batch(unsigned char *const *outs,
+                                 const unsigned char *pub,
+                                 size_t pub_len,
+                                 const unsigned char *const *tweaks,
+                                 size_t len,
+                                 int compact) {
+  /* Share one inversion across each chunk of results. */
+  jge_t T[32];
+  wge_t R[32];
+  fe_t zs[32];
+  size_t i, j, n;
+  int ret = 1;
+  wge_t A;
+  sc_t t;
+
+  if (!wge_import(&A, pub, pub_len))
+    return 0;
+
+  for (i = 0; i < len; i += n) {
+    n = len - i;
+
+    if (n > 32)
+      n = 32;
+
+    for (j = 0; j < n; j++) {
+      ret &= sc_import(t, tweaks[i + j]);
+
+      wei_jmul_g(&T[j], t);
+
+      jge_mixed_add(&T[j], &T[j], &A);
+    }
+
+    wge_set_jge_all_var(R, T, n, zs);
+
+    for (j = 0; j < n; j++)
+      ret &= wge_export(outs[i + j], &R[j], compact);
+  }
+
+  sc_cleanse(t);
+
+  return ret;
+}
+
 int
 btc_ecdsa_pubkey_tweak_mul(unsigned char *out,
                            const unsigned char *pub,
@@ -3905,22 +4447,14 @@ btc_ecdsa_is_low_s(const unsigned char *sig) {
   return ret;
 }
 
-int
-btc_ecdsa_sign(unsigned char *sig,
-               unsigned int *param,
-               const unsigned char *msg,
-               size_t msg_len,
-               const unsigned char *priv) {
-  return btc_ecdsa_sign_internal(sig, param, msg, msg_len, priv, NULL);
-}
-
-int
-btc_ecdsa_sign_internal(unsigned char *sig,
-                        unsigned int *param,
-                        const unsigned char *msg,
-                        size_t msg_len,
-                        const unsigned char *priv,
-                        btc_redefine_f *redefine) {
+static int
+ecdsa_sign(unsigned char *sig,
+           unsigned int *param,
+           const unsigned char *msg,
+           size_t msg_len,
+           const unsigned char *priv,
+           btc_redefine_f *redefine,
+           const wei_precomp_t *pre) {
   /* ECDSA Signing.
    *
    * [SEC1] Page 44, Section 4.1.3.
@@ -3988,7 +4522,7 @@ btc_ecdsa_sign_internal(unsigned char *sig,
 
     ok = ecdsa_reduce(k, bytes, 32);
 
-    wei_mul_g(&R, k);
+    wei_mul_g_precomp(&R, pre, k);
 
     sign = fe_is_odd(R.y);
     high = sc_set_fe(r, R.x) ^ 1;
@@ -4029,6 +4563,35 @@ btc_ecdsa_sign_internal(unsigned char *sig,
   return ret;
 }
 
+int
+btc_ecdsa_sign(unsigned char *sig,
+               unsigned int *param,
+               const unsigned char *msg,
+               size_t msg_len,
+               const unsigned char *priv) {
+  return btc_ecdsa_sign_internal(sig, param, msg, msg_len, priv, NULL);
+}
+
+int
+btc_ecdsa_sign_precomp(unsigned char *sig,
+                       unsigned int *param,
+                       const unsigned char *msg,
+                       size_t msg_len,
+                       const unsigned char *priv,
+                       const wei_precomp_t *pre) {
+  return ecdsa_sign(sig, param, msg, msg_len, priv, NULL, pre);
+}
+
+int
+btc_ecdsa_sign_internal(unsigned char *sig,
+                        unsigned int *param,
+                        const unsigned char *msg,
+                        size_t msg_len,
+                        const unsigned char *priv,
+                        btc_redefine_f *redefine) {
+  return ecdsa_sign(sig, param, msg, msg_len, priv, redefine, NULL);
+}
+
 int
 btc_ecdsa_verify(const unsigned char *msg,
                  size_t msg_len,
@@ -4096,6 +4659,102 @@ btc_ecdsa_verify(const unsigned char *msg,
   return jge_equal_r_var(&R, r);
 }
 
+int
+btc_ecdsa_verify_batch(const unsigned char *const *msgs,
+                       const size_t *msg_lens,
+                       const unsigned char *const *sigs,
+                       const unsigned char *const *pubs,
+                       const size_t *pub_lens,
+                       size_t len) {
+  /* ECDSA Batch Verification.
+   *
+   * There is no batch equation for ECDSA (only x(R) is
+   * known), but the inversions can still be shared across
+   * a chunk of signatures with Montgomery's trick.
+   *
+   * Computation:
+   *
+   *   t = s1 * s2 * ... * sk mod n
+   *   1 / si = (s1 * ... * s(i-1)) * (s(i+1) * ... * sk) / t mod n
+   *   u1i = mi / si mod n
+   *   u2i = ri / si mod n
+   *   Ri = G * u1i + Ai * u2i
+   *   ri == x(Ri) mod n
+   *
+   * The odd multiples of every `Ai` are likewise
+   * normalized with a single field inversion.
+   */
+  jge_t points[ECDSA_BATCH * NAF_SIZE]; /* 9728 bytes */
+  wge_t wnd1[ECDSA_BATCH * NAF_SIZE]; /* 6656 bytes */
+  wge_t wnd2[ECDSA_BATCH * NAF_SIZE]; /* 6656 bytes */
+  fe_t zs[ECDSA_BATCH * NAF_SIZE]; /* 3072 bytes */
+  sc_t ms[ECDSA_BATCH], rs[ECDSA_BATCH]; /* 1152 bytes */
+  sc_t ss[ECDSA_BATCH], acc[ECDSA_BATCH]; /* 1152 bytes */
+  sc_t t, s, u1, u2;
+  size_t i, j, k;
+  wge_t A;
+  jge_t R;
+
+  for (i = 0; i < len; i += k) {
+    k = ECC_MIN(len - i, ECDSA_BATCH);
+
+    for (j = 0; j < k; j++) {
+      const unsigned char *sig = sigs[i + j];
+
+      if (!sc_import(rs[j], sig))
+        return 0;
+
+      if (!sc_import(ss[j], sig + 32))
+        return 0;
+
+      if (sc_is_zero(rs[j]) || sc_is_zero(ss[j]))
+        return 0;
+
+      if (sc_is_high_var(ss[j]))
+        return 0;
+
+      if (!wge_import(&A, pubs[i + j], pub_lens[i + j]))
+        return 0;
+
+      ecdsa_reduce(ms[j], msgs[i + j], msg_lens[i + j]);
+
+      jge_naf_points_var(&points[j * NAF_SIZE], &A);
+
+      if (j == 0)
+        sc_set(acc[j], ss[j]);
+      else
+        sc_mul(acc[j], acc[j - 1], ss[j]);
+    }
+
+    ASSERT(sc_invert_var(t, acc[k - 1]));
+
+    wge_set_jge_all_var(wnd1, points, k * NAF_SIZE, zs);
+
+    for (j = 0; j < k * NAF_SIZE; j++)
+      wge_endo_beta(&wnd2[j], &wnd1[j]);
+
+    for (j = k; j-- > 0;) {
+      if (j > 0) {
+        sc_mul(s, t, acc[j - 1]);
+        sc_mul(t, t, ss[j]);
+      } else {
+        sc_set(s, t);
+      }
+
+      sc_mul(u1, ms[j], s);
+      sc_mul(u2, rs[j], s);
+
+      wei_jmul_double_wnd_var(&R, u1, &wnd1[j * NAF_SIZE],
+                                      &wnd2[j * NAF_SIZE], u2);
+
+      if (!jge_equal_r_var(&R, rs[j]))
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
 int
 btc_ecdsa_recover(unsigned char *pub,
                   const unsigned char *msg,
@@ -4875,3 +5534,86 @@ btc_bip340_derive(unsigned char *secret,
 
   return ret;
 }
+
+/*
+ * ElligatorSwift
+ */
+
+int
+btc_ellswift_create(unsigned char *out,
+                    const unsigned char *priv,
+                    const unsigned char *entropy) {
+  int ret = 1;
+  wge_t A;
+  sc_t a;
+
+  ret &= sc_import(a, priv);
+  ret &= sc_is_zero(a) ^ 1;
+
+  wei_mul_g(&A, a);
+
+  if (ret)
+    wei_point_to_swift(out, &A, entropy);
+  else
+    memset(out, 0, 64);
+
+  sc_cleanse(a);
+
+  wge_cleanse(&A);
+
+  return ret;
+}
+
+int
+btc_ellswift_derive(unsigned char *secret,
+                    const unsigned char *pub,
+                    const unsigned char *priv) {
+  int ret = 1;
+  wge_t A, P;
+  sc_t a;
+  fe_t x;
+
+  ret &= sc_import(a, priv);
+  ret &= sc_is_zero(a) ^ 1;
+
+  wei_point_from_swift(x, pub);
+
+  /* Only x is shared: either y will do. */
+  ret &= wge_set_x(&A, x, -1);
+
+  wei_mul(&P, &A, a);
+
+  ret &= wge_export_x(secret, &P);
+
+  sc_cleanse(a);
+
+  wge_cleanse(&A);
+  wge_cleanse(&P);
+
+  return ret;
+}
+
+int
+btc_ellswift_invert(unsigned char *out,
+                    const unsigned char *x,
+                    const unsigned char *u,
+                    unsigned int hint) {
+  /* Raw inverse map: out is the t for which
+     (u, t) decodes to x. No parity fixup. */
+  int ret = 1;
+  fe_t xe, ue, t;
+
+  ret &= fe_import(xe, x);
+  ret &= fe_import(ue, u);
+  ret &= fe_is_zero(ue) ^ 1;
+  ret &= wei_xswiftec_inv(t, xe, ue, hint);
+
+  if (ret)
+    fe_export(out, t);
+  else
+    memset(out, 0, 32);
+
+  fe_cleanse(t);
+
+  return ret;
+}
@@ -0,0 +1,400 @@
+/*!
+ * secp256k1_5x52.h - secp256k1 field (5x52) for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Parts of this software are based on bitcoin-core/secp256k1:
+ *   Copyright (c) 2013, Pieter Wuille (MIT License).
+ *   https://github.com/bitcoin-core/secp256k1
+ *
+ * A specialization of the field for 64-bit machines with
+ * a 128-bit multiply. Elements are five 52-bit limbs (the
+ * top limb holding 48 bits), which reduces a multiplication
+ * to 25 partial products (against 36 for the generic 6x43
+ * fiat-crypto representation) and lets the reduction by
+ * 2^256 = 0x1000003d1 (mod p) be folded into the column sums.
+ *
+ * Unlike the fiat-crypto backends, this code is hand-written
+ * and not formally verified. It is only used when mako is
+ * built with BTC_FIELD_5X52 (-DMAKO_FIELD_5X52=ON).
+ *
+ * The interface mirrors the fiat-crypto backends so that the
+ * field wrappers need not care which one is in use:
+ *
+ *   - "tight" elements have magnitude 1 (each limb is at most
+ *     2 * (2^52 - 1), the top limb at most 2 * (2^48 - 1)).
+ *   - "loose" elements have magnitude 3 at most: the output
+ *     of add, sub and opp on tight inputs.
+ *   - carry, carry_mul, carry_square and carry_scmul accept
+ *     loose inputs and produce tight outputs.
+ *   - to_bytes accepts tight inputs and fully reduces.
+ *
+ * The multiplication is correct for magnitudes up to 8.
+ */
+
+#include <stdint.h>
+
+typedef unsigned char fiat_secp256k1_uint1;
+typedef btc_uint128_t fiat_secp256k1_uint128;
+
+#define FE52_M UINT64_C(0xfffffffffffff)
+#define FE52_R UINT64_C(0x1000003d10)
+
+/* 4 * p, limb-wise. */
+#define FE52_P4_0 UINT64_C(0x3ffffbfffff0bc)
+#define FE52_P4_1 UINT64_C(0x3ffffffffffffc)
+#define FE52_P4_4 UINT64_C(0x03fffffffffffc)
+
+static void
+fiat_secp256k1_carry(uint64_t out1[5], const uint64_t arg1[5]) {
+  uint64_t t0 = arg1[0];
+  uint64_t t1 = arg1[1];
+  uint64_t t2 = arg1[2];
+  uint64_t t3 = arg1[3];
+  uint64_t t4 = arg1[4];
+  uint64_t x = t4 >> 48;
+
+  /* Reduce the top limb first so that
+     there is at most a single carry. */
+  t4 &= UINT64_C(0x0ffffffffffff);
+
+  t0 += x * UINT64_C(0x1000003d1);
+  t1 += (t0 >> 52); t0 &= FE52_M;
+  t2 += (t1 >> 52); t1 &= FE52_M;
+  t3 += (t2 >> 52); t2 &= FE52_M;
+  t4 += (t3 >> 52); t3 &= FE52_M;
+
+  out1[0] = t0;
+  out1[1] = t1;
+  out1[2] = t2;
+  out1[3] = t3;
+  out1[4] = t4;
+}
+
+static void
+fiat_secp256k1_add(uint64_t out1[5],
+                   const uint64_t arg1[5],
+                   const uint64_t arg2[5]) {
+  out1[0] = arg1[0] + arg2[0];
+  out1[1] = arg1[1] + arg2[1];
+  out1[2] = arg1[2] + arg2[2];
+  out1[3] = arg1[3] + arg2[3];
+  out1[4] = arg1[4] + arg2[4];
+}
+
+static void
+fiat_secp256k1_sub(uint64_t out1[5],
+                   const uint64_t arg1[5],
+                   const uint64_t arg2[5]) {
+  /* x + 4 * p - y */
+  out1[0] = (arg1[0] + FE52_P4_0) - arg2[0];
+  out1[1] = (arg1[1] + FE52_P4_1) - arg2[1];
+  out1[2] = (arg1[2] + FE52_P4_1) - arg2[2];
+  out1[3] = (arg1[3] + FE52_P4_1) - arg2[3];
+  out1[4] = (arg1[4] + FE52_P4_4) - arg2[4];
+}
+
+static void
+fiat_secp256k1_opp(uint64_t out1[5], const uint64_t arg1[5]) {
+  /* 4 * p - x */
+  out1[0] = FE52_P4_0 - arg1[0];
+  out1[1] = FE52_P4_1 - arg1[1];
+  out1[2] = FE52_P4_1 - arg1[2];
+  out1[3] = FE52_P4_1 - arg1[3];
+  out1[4] = FE52_P4_4 - arg1[4];
+}
+
+static void
+fiat_secp256k1_carry_mul(uint64_t out1[5],
+                         const uint64_t arg1[5],
+                         const uint64_t arg2[5]) {
+  /* [... a b c] is shorthand for ... + a<<104 + b<<52 + c<<0 mod p.
+   *
+   * For 0 <= x <= 4, px is shorthand for sum(a[i]*b[x-i], i=0..x).
+   * For 4 <= x <= 8, px is shorthand for sum(a[i]*b[x-i], i=(x-4)..4).
+   *
+   * Note that [x 0 0 0 0 0] = [x*R].
+   */
+  uint64_t a0 = arg1[0], a1 = arg1[1], a2 = arg1[2], a3 = arg1[3], a4 = arg1[4];
+  uint64_t b0 = arg2[0], b1 = arg2[1], b2 = arg2[2], b3 = arg2[3], b4 = arg2[4];
+  fiat_secp256k1_uint128 c, d;
+  uint64_t t3, t4, tx, u0;
+
+  d  = (fiat_secp256k1_uint128)a0 * b3
+     + (fiat_secp256k1_uint128)a1 * b2
+     + (fiat_secp256k1_uint128)a2 * b1
+     + (fiat_secp256k1_uint128)a3 * b0;
+  /* [d 0 0 0] = [p3 0 0 0] */
+  c  = (fiat_secp256k1_uint128)a4 * b4;
+  /* [c 0 0 0 0 d 0 0 0] = [p8 0 0 0 0 p3 0 0 0] */
+  d += (c & FE52_M) * FE52_R; c >>= 52;
+  /* [c 0 0 0 0 0 d 0 0 0] = [p8 0 0 0 0 p3 0 0 0] */
+  t3 = (uint64_t)d & FE52_M; d >>= 52;
+  /* [c 0 0 0 0 d t3 0 0 0] = [p8 0 0 0 0 p3 0 0 0] */
+
+  d += (fiat_secp256k1_uint128)a0 * b4
+     + (fiat_secp256k1_uint128)a1 * b3
+     + (fiat_secp256k1_uint128)a2 * b2
+     + (fiat_secp256k1_uint128)a3 * b1
+     + (fiat_secp256k1_uint128)a4 * b0;
+  /* [c 0 0 0 0 d t3 0 0 0] = [p8 0 0 0 p4 p3 0 0 0] */
+  d += c * FE52_R;
+  /* [d t3 0 0 0] = [p8 0 0 0 p4 p3 0 0 0] */
+  t4 = (uint64_t)d & FE52_M; d >>= 52;
+  /* [d t4 t3 0 0 0] = [p8 0 0 0 p4 p3 0 0 0] */
+  tx = (t4 >> 48); t4 &= (FE52_M >> 4);
+  /* [d t4+(tx<<48) t3 0 0 0] = [p8 0 0 0 p4 p3 0 0 0] */
+
+  c  = (fiat_secp256k1_uint128)a0 * b0;
+  /* [d t4+(tx<<48) t3 0 0 c] = [p8 0 0 0 p4 p3 0 0 p0] */
+  d += (fiat_secp256k1_uint128)a1 * b4
+     + (fiat_secp256k1_uint128)a2 * b3
+     + (fiat_secp256k1_uint128)a3 * b2
+     + (fiat_secp256k1_uint128)a4 * b1;
+  /* [d t4+(tx<<48) t3 0 0 c] = [p8 0 0 p5 p4 p3 0 0 p0] */
+  u0 = (uint64_t)d & FE52_M; d >>= 52;
+  /* [d u0 t4+(tx<<48) t3 0 0 c] = [p8 0 0 p5 p4 p3 0 0 p0] */
+  u0 = (u0 << 4) | tx;
+  /* [d 0 t4+(u0<<48) t3 0 0 c] = [p8 0 0 p5 p4 p3 0 0 p0] */
+  c += (fiat_secp256k1_uint128)u0 * (FE52_R >> 4);
+  /* [d 0 t4 t3 0 0 c] = [p8 0 0 p5 p4 p3 0 0 p0] */
+  out1[0] = (uint64_t)c & FE52_M; c >>= 52;
+  /* [d 0 t4 t3 0 c r0] = [p8 0 0 p5 p4 p3 0 0 p0] */
+
+  c += (fiat_secp256k1_uint128)a0 * b1
+     + (fiat_secp256k1_uint128)a1 * b0;
+  /* [d 0 t4 t3 0 c r0] = [p8 0 0 p5 p4 p3 0 p1 p0] */
+  d += (fiat_secp256k1_uint128)a2 * b4
+     + (fiat_secp256k1_uint128)a3 * b3
+     + (fiat_secp256k1_uint128)a4 * b2;
+  /* [d 0 t4 t3 0 c r0] = [p8 0 p6 p5 p4 p3 0 p1 p0] */
+  c += (d & FE52_M) * FE52_R; d >>= 52;
+  /* [d 0 0 t4 t3 0 c r0] = [p8 0 p6 p5 p4 p3 0 p1 p0] */
+  out1[1] = (uint64_t)c & FE52_M; c >>= 52;
+  /* [d 0 0 t4 t3 c r1 r0] = [p8 0 p6 p5 p4 p3 0 p1 p0] */
+
+  c += (fiat_secp256k1_uint128)a0 * b2
+     + (fiat_secp256k1_uint128)a1 * b1
+     + (fiat_secp256k1_uint128)a2 * b0;
+  /* [d 0 0 t4 t3 c r1 r0] = [p8 0 p6 p5 p4 p3 p2 p1 p0] */
+  d += (fiat_secp256k1_uint128)a3 * b4
+     + (fiat_secp256k1_uint128)a4 * b3;
+  /* [d 0 0 t4 t3 c r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  c += (d & FE52_M) * FE52_R; d >>= 52;
+  /* [d 0 0 0 t4 t3 c r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  out1[2] = (uint64_t)c & FE52_M; c >>= 52;
+  /* [d 0 0 0 t4 t3+c r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+
+  c += d * FE52_R + t3;
+  /* [t4 c r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  out1[3] = (uint64_t)c & FE52_M; c >>= 52;
+  /* [t4+c r3 r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  c += t4;
+  /* [c r3 r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  out1[4] = (uint64_t)c;
+  /* [r4 r3 r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+}
+
+static void
+fiat_secp256k1_carry_square(uint64_t out1[5], const uint64_t arg1[5]) {
+  /* [... a b c] is shorthand for ... + a<<104 + b<<52 + c<<0 mod p.
+   *
+   * px is shorthand for sum(a[i]*a[x-i], i=0..x).
+   *
+   * Note that [x 0 0 0 0 0] = [x*R].
+   */
+  uint64_t a0 = arg1[0], a1 = arg1[1], a2 = arg1[2], a3 = arg1[3], a4 = arg1[4];
+  fiat_secp256k1_uint128 c, d;
+  uint64_t t3, t4, tx, u0;
+
+  d  = (fiat_secp256k1_uint128)(a0 * 2) * a3
+     + (fiat_secp256k1_uint128)(a1 * 2) * a2;
+  /* [d 0 0 0] = [p3 0 0 0] */
+  c  = (fiat_secp256k1_uint128)a4 * a4;
+  /* [c 0 0 0 0 d 0 0 0] = [p8 0 0 0 0 p3 0 0 0] */
+  d += (c & FE52_M) * FE52_R; c >>= 52;
+  /* [c 0 0 0 0 0 d 0 0 0] = [p8 0 0 0 0 p3 0 0 0] */
+  t3 = (uint64_t)d & FE52_M; d >>= 52;
+  /* [c 0 0 0 0 d t3 0 0 0] = [p8 0 0 0 0 p3 0 0 0] */
+
+  a4 *= 2;
+  d += (fiat_secp256k1_uint128)a0 * a4
+     + (fiat_secp256k1_uint128)(a1 * 2) * a3
+     + (fiat_secp256k1_uint128)a2 * a2;
+  /* [c 0 0 0 0 d t3 0 0 0] = [p8 0 0 0 p4 p3 0 0 0] */
+  d += c * FE52_R;
+  /* [d t3 0 0 0] = [p8 0 0 0 p4 p3 0 0 0] */
+  t4 = (uint64_t)d & FE52_M; d >>= 52;
+  /* [d t4 t3 0 0 0] = [p8 0 0 0 p4 p3 0 0 0] */
+  tx = (t4 >> 48); t4 &= (FE52_M >> 4);
+  /* [d t4+(tx<<48) t3 0 0 0] = [p8 0 0 0 p4 p3 0 0 0] */
+
+  c  = (fiat_secp256k1_uint128)a0 * a0;
+  /* [d t4+(tx<<48) t3 0 0 c] = [p8 0 0 0 p4 p3 0 0 p0] */
+  d += (fiat_secp256k1_uint128)a1 * a4
+     + (fiat_secp256k1_uint128)(a2 * 2) * a3;
+  /* [d t4+(tx<<48) t3 0 0 c] = [p8 0 0 p5 p4 p3 0 0 p0] */
+  u0 = (uint64_t)d & FE52_M; d >>= 52;
+  /* [d u0 t4+(tx<<48) t3 0 0 c] = [p8 0 0 p5 p4 p3 0 0 p0] */
+  u0 = (u0 << 4) | tx;
+  /* [d 0 t4+(u0<<48) t3 0 0 c] = [p8 0 0 p5 p4 p3 0 0 p0] */
+  c += (fiat_secp256k1_uint128)u0 * (FE52_R >> 4);
+  /* [d 0 t4 t3 0 0 c] = [p8 0 0 p5 p4 p3 0 0 p0] */
+  out1[0] = (uint64_t)c & FE52_M; c >>= 52;
+  /* [d 0 t4 t3 0 c r0] = [p8 0 0 p5 p4 p3 0 0 p0] */
+
+  a0 *= 2;
+  c += (fiat_secp256k1_uint128)a0 * a1;
+  /* [d 0 t4 t3 0 c r0] = [p8 0 0 p5 p4 p3 0 p1 p0] */
+  d += (fiat_secp256k1_uint128)a2 * a4
+     + (fiat_secp256k1_uint128)a3 * a3;
+  /* [d 0 t4 t3 0 c r0] = [p8 0 p6 p5 p4 p3 0 p1 p0] */
+  c += (d & FE52_M) * FE52_R; d >>= 52;
+  /* [d 0 0 t4 t3 0 c r0] = [p8 0 p6 p5 p4 p3 0 p1 p0] */
+  out1[1] = (uint64_t)c & FE52_M; c >>= 52;
+  /* [d 0 0 t4 t3 c r1 r0] = [p8 0 p6 p5 p4 p3 0 p1 p0] */
+
+  c += (fiat_secp256k1_uint128)a0 * a2
+     + (fiat_secp256k1_uint128)a1 * a1;
+  /* [d 0 0 t4 t3 c r1 r0] = [p8 0 p6 p5 p4 p3 p2 p1 p0] */
+  d += (fiat_secp256k1_uint128)a3 * a4;
+  /* [d 0 0 t4 t3 c r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  c += (d & FE52_M) * FE52_R; d >>= 52;
+  /* [d 0 0 0 t4 t3 c r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  out1[2] = (uint64_t)c & FE52_M; c >>= 52;
+  /* [d 0 0 0 t4 t3+c r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+
+  c += d * FE52_R + t3;
+  /* [t4 c r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  out1[3] = (uint64_t)c & FE52_M; c >>= 52;
+  /* [t4+c r3 r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  c += t4;
+  /* [c r3 r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+  out1[4] = (uint64_t)c;
+  /* [r4 r3 r2 r1 r0] = [p8 p7 p6 p5 p4 p3 p2 p1 p0] */
+}
+
+static void
+fiat_secp256k1_carry_scmul_3(uint64_t out1[5], const uint64_t arg1[5]) {
+  uint64_t t[5];
+
+  t[0] = arg1[0] * 3;
+  t[1] = arg1[1] * 3;
+  t[2] = arg1[2] * 3;
+  t[3] = arg1[3] * 3;
+  t[4] = arg1[4] * 3;
+
+  fiat_secp256k1_carry(out1, t);
+}
+
+static void
+fiat_secp256k1_carry_scmul_4(uint64_t out1[5], const uint64_t arg1[5]) {
+  uint64_t t[5];
+
+  t[0] = arg1[0] << 2;
+  t[1] = arg1[1] << 2;
+  t[2] = arg1[2] << 2;
+  t[3] = arg1[3] << 2;
+  t[4] = arg1[4] << 2;
+
+  fiat_secp256k1_carry(out1, t);
+}
+
+static void
+fiat_secp256k1_carry_scmul_8(uint64_t out1[5], const uint64_t arg1[5]) {
+  uint64_t t[5];
+
+  t[0] = arg1[0] << 3;
+  t[1] = arg1[1] << 3;
+  t[2] = arg1[2] << 3;
+  t[3] = arg1[3] << 3;
+  t[4] = arg1[4] << 3;
+
+  fiat_secp256k1_carry(out1, t);
+}
+
+static void
+fiat_secp256k1_selectznz(uint64_t out1[5],
+                         fiat_secp256k1_uint1 arg1,
+                         const uint64_t arg2[5],
+                         const uint64_t arg3[5]) {
+  /* out1 = arg1 ? arg3 : arg2 */
+  uint64_t mask = -(uint64_t)fe_word_barrier(arg1);
+  int i;
+
+  for (i = 0; i < 5; i++)
+    out1[i] = (arg2[i] & ~mask) | (arg3[i] & mask);
+}
+
+static void
+fiat_secp256k1_to_bytes(uint8_t out1[32], const uint64_t arg1[5]) {
+  uint64_t t0 = arg1[0];
+  uint64_t t1 = arg1[1];
+  uint64_t t2 = arg1[2];
+  uint64_t t3 = arg1[3];
+  uint64_t t4 = arg1[4];
+  uint64_t m, x;
+  int i;
+
+  /* Weak reduction. */
+  x = t4 >> 48;
+  t4 &= UINT64_C(0x0ffffffffffff);
+
+  t0 += x * UINT64_C(0x1000003d1);
+  t1 += (t0 >> 52); t0 &= FE52_M;
+  t2 += (t1 >> 52); t1 &= FE52_M; m = t1;
+  t3 += (t2 >> 52); t2 &= FE52_M; m &= t2;
+  t4 += (t3 >> 52); t3 &= FE52_M; m &= t3;
+
+  /* At most one final reduction: either
+     the value overflowed 2^256 or is >= p. */
+  x = (t4 >> 48) | ((t4 == UINT64_C(0x0ffffffffffff))
+                  & (m == FE52_M)
+                  & (t0 >= UINT64_C(0xffffefffffc2f)));
+
+  t0 += x * UINT64_C(0x1000003d1);
+  t1 += (t0 >> 52); t0 &= FE52_M;
+  t2 += (t1 >> 52); t1 &= FE52_M;
+  t3 += (t2 >> 52); t2 &= FE52_M;
+  t4 += (t3 >> 52); t3 &= FE52_M;
+
+  t4 &= UINT64_C(0x0ffffffffffff);
+
+  /* Pack (little endian). */
+  t0 |= t1 << 52;
+  t1 = (t1 >> 12) | (t2 << 40);
+  t2 = (t2 >> 24) | (t3 << 28);
+  t3 = (t3 >> 36) | (t4 << 16);
+
+  for (i = 0; i < 8; i++) {
+    out1[i +  0] = (uint8_t)(t0 >> (i * 8));
+    out1[i +  8] = (uint8_t)(t1 >> (i * 8));
+    out1[i + 16] = (uint8_t)(t2 >> (i * 8));
+    out1[i + 24] = (uint8_t)(t3 >> (i * 8));
+  }
+}
+
+static void
+fiat_secp256k1_from_bytes(uint64_t out1[5], const uint8_t arg1[32]) {
+  uint64_t w[4];
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    w[i] = 0;
+
+    for (j = 7; j >= 0; j--)
+      w[i] = (w[i] << 8) | arg1[i * 8 + j];
+  }
+
+  out1[0] = w[0] & FE52_M;
+  out1[1] = ((w[0] >> 52) | (w[1] << 12)) & FE52_M;
+  out1[2] = ((w[1] >> 40) | (w[2] << 24)) & FE52_M;
+  out1[3] = ((w[2] >> 28) | (w[3] << 36)) & FE52_M;
+  out1[4] = w[3] >> 16;
+}
+
+#undef FE52_M
+#undef FE52_R
+#undef FE52_P4_0
+#undef FE52_P4_1
+#undef FE52_P4_4
@@ -37,3 +37,24 @@ btc_hash160(uint8_t *out, const void *data, size_t size) {
   btc_hash160_update(&ctx, data, size);
   btc_hash160_final(&ctx, out);
 }
+
+void
+btc_hash160_many(uint8_t *out, const uint8_t *in, size_t len, size_t count) {
+  /* Hashes `count` contiguous inputs of `len` bytes
+     (33/65 byte keys, scripts) lane by lane. */
+  uint8_t tmp[64 * 32];
+  size_t n;
+
+  while (count > 0) {
+    n = count < 64 ? count : 64;
+
+    btc_sha256_many(tmp, in, len, n);
+    btc_ripemd160_many(out, tmp, 32, n);
+
+    out += n * 20;
+    in += n * len;
+    count -= n;
+  }
+
+  btc_memzero(tmp, sizeof(tmp));
+}
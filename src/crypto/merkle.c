@@ -86,39 +86,46 @@
  */
 
 int
-btc_merkle_root(uint8_t *root, uint8_t *nodes, size_t size) {
-  uint8_t *left, *right, *last;
+btc_merkle_level(uint8_t *out, const uint8_t *nodes, size_t size) {
+  size_t half = size / 2;
   int malleated = 0;
-  size_t i;
 
-  if (size == 0) {
-    memset(root, 0, 32);
-    return 1;
+  /* Mutation check (see above). */
+  if (size > 1 && (size & 1) == 0) {
+    if (memcmp(&nodes[(size - 2) * 32], &nodes[(size - 1) * 32], 32) == 0)
+      malleated = 1;
   }
 
-  last = &nodes[0 * 32];
+  /* Adjacent pairs are contiguous 64 byte inputs. When hashing
+     in place, each output lands in a slot that has been consumed. */
+  btc_sha256d64(out, nodes, half);
 
-  while (size > 1) {
-    for (i = 0; i < size; i += 2) {
-      left = &nodes[(i + 0) * 32];
-      right = left;
+  if (size & 1) {
+    const uint8_t *last = &nodes[(size - 1) * 32];
 
-      if (i + 1 < size) {
-        right = &nodes[(i + 1) * 32];
+    btc_hash256_root(&out[half * 32], last, last);
+  }
 
-        if (i + 2 == size && memcmp(left, right, 32) == 0)
-          malleated = 1;
-      }
+  return malleated == 0;
+}
 
-      last = &nodes[(i / 2) * 32];
+int
+btc_merkle_root(uint8_t *root, uint8_t *nodes, size_t size) {
+  int malleated = 0;
+
+  if (size == 0) {
+    memset(root, 0, 32);
+    return 1;
+  }
 
-      btc_hash256_root(last, left, right);
-    }
+  while (size > 1) {
+    if (!btc_merkle_level(nodes, nodes, size))
+      malleated = 1;
 
     size = (size + 1) / 2;
   }
 
-  memcpy(root, last, 32);
+  memcpy(root, nodes, 32);
 
   return malleated == 0;
 }
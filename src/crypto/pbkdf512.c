@@ -33,11 +33,9 @@ btc_pbkdf512_derive(uint8_t *out,
                     uint32_t iter,
                     size_t len) {
   btc_hmac512_t pmac, smac, hmac;
-  size_t i, k, blocks;
-  uint8_t block[64];
-  uint8_t mac[64];
+  uint8_t block[4 * 64];
   uint8_t ctr[4];
-  uint32_t j;
+  size_t i, j, n, blocks;
 
   if (len + 63 < len)
     btc_abort(); /* LCOV_EXCL_LINE */
@@ -62,37 +60,38 @@ btc_pbkdf512_derive(uint8_t *out,
 
   btc_hmac512_update(&smac, salt, salt_len);
 
-  for (i = 0; i < blocks; i++) {
-    btc_write32be(ctr, i + 1);
+  /* Output blocks are independent: compute U1 for
+     up to four of them, then run the remaining
+     iterations side by side from the key's HMAC
+     midstates. */
+  for (i = 0; i < blocks; i += n) {
+    n = blocks - i;
 
-    hmac = smac;
-    btc_hmac512_update(&hmac, ctr, 4);
-    btc_hmac512_final(&hmac, block);
+    if (n > 4)
+      n = 4;
 
-    memcpy(mac, block, 64);
+    for (j = 0; j < n; j++) {
+      btc_write32be(ctr, i + j + 1);
 
-    for (j = 1; j < iter; j++) {
-      hmac = pmac;
-      btc_hmac512_update(&hmac, mac, 64);
-      btc_hmac512_final(&hmac, mac);
-
-      for (k = 0; k < 64; k++)
-        block[k] ^= mac[k];
+      hmac = smac;
+      btc_hmac512_update(&hmac, ctr, 4);
+      btc_hmac512_final(&hmac, block + j * 64);
     }
 
-    if (len < 64) {
+    btc_sha512_pbkdf2(block, &pmac, n, iter);
+
+    if (len < n * 64) {
       memcpy(out, block, len);
       break;
     }
 
-    memcpy(out, block, 64);
+    memcpy(out, block, n * 64);
 
-    out += 64;
-    len -= 64;
+    out += n * 64;
+    len -= n * 64;
   }
 
   btc_memzero(block, sizeof(block));
-  btc_memzero(mac, sizeof(mac));
   btc_memzero(&pmac, sizeof(pmac));
   btc_memzero(&smac, sizeof(smac));
   btc_memzero(&hmac, sizeof(hmac));
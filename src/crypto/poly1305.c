@@ -0,0 +1,424 @@
+/*!
+ * poly1305.c - poly1305 for mako
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://en.wikipedia.org/wiki/Poly1305
+ *   https://cr.yp.to/mac.html
+ *   https://tools.ietf.org/html/rfc8439#section-2.5
+ *   https://github.com/floodyberry/poly1305-donna
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <mako/crypto/mac.h>
+#include <mako/util.h>
+#include "../bio.h"
+#include "../internal.h"
+
+/*
+ * Poly1305
+ */
+
+#if defined(BTC_HAVE_INT128)
+
+/* Three 44-bit limbs: each block costs nine
+   64x64->128 multiplications. */
+
+#define M44 UINT64_C(0xfffffffffff)
+#define M42 UINT64_C(0x3ffffffffff)
+
+void
+btc_poly1305_init(btc_poly1305_t *ctx, const uint8_t *key) {
+  uint64_t t0 = btc_read64le(key + 0);
+  uint64_t t1 = btc_read64le(key + 8);
+
+  /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+  ctx->r[0] = t0 & UINT64_C(0xffc0fffffff);
+  ctx->r[1] = ((t0 >> 44) | (t1 << 20)) & UINT64_C(0xfffffc0ffff);
+  ctx->r[2] = (t1 >> 24) & UINT64_C(0x00ffffffc0f);
+
+  ctx->h[0] = 0;
+  ctx->h[1] = 0;
+  ctx->h[2] = 0;
+
+  ctx->pad[0] = btc_read64le(key + 16);
+  ctx->pad[1] = btc_read64le(key + 24);
+
+  ctx->pos = 0;
+}
+
+static void
+poly1305_blocks(btc_poly1305_t *ctx,
+                const uint8_t *data,
+                size_t len,
+                uint64_t hibit) {
+  uint64_t r0 = ctx->r[0];
+  uint64_t r1 = ctx->r[1];
+  uint64_t r2 = ctx->r[2];
+  uint64_t h0 = ctx->h[0];
+  uint64_t h1 = ctx->h[1];
+  uint64_t h2 = ctx->h[2];
+  uint64_t s1 = r1 * (5 << 2);
+  uint64_t s2 = r2 * (5 << 2);
+  btc_uint128_t d0, d1, d2;
+  uint64_t t0, t1, c;
+
+  while (len >= 16) {
+    t0 = btc_read64le(data + 0);
+    t1 = btc_read64le(data + 8);
+
+    h0 += t0 & M44;
+    h1 += ((t0 >> 44) | (t1 << 20)) & M44;
+    h2 += ((t1 >> 24) & M42) | hibit;
+
+    d0 = (btc_uint128_t)h0 * r0
+       + (btc_uint128_t)h1 * s2
+       + (btc_uint128_t)h2 * s1;
+
+    d1 = (btc_uint128_t)h0 * r1
+       + (btc_uint128_t)h1 * r0
+       + (btc_uint128_t)h2 * s2;
+
+    d2 = (btc_uint128_t)h0 * r2
+       + (btc_uint128_t)h1 * r1
+       + (btc_uint128_t)h2 * r0;
+
+    c = (uint64_t)(d0 >> 44);
+    h0 = (uint64_t)d0 & M44;
+    d1 += c;
+    c = (uint64_t)(d1 >> 44);
+    h1 = (uint64_t)d1 & M44;
+    d2 += c;
+    c = (uint64_t)(d2 >> 42);
+    h2 = (uint64_t)d2 & M42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= M44;
+    h1 += c;
+
+    data += 16;
+    len -= 16;
+  }
+
+  ctx->h[0] = h0;
+  ctx->h[1] = h1;
+  ctx->h[2] = h2;
+}
+
+static void
+poly1305_finish(btc_poly1305_t *ctx, uint8_t *mac) {
+  uint64_t h0 = ctx->h[0];
+  uint64_t h1 = ctx->h[1];
+  uint64_t h2 = ctx->h[2];
+  uint64_t g0, g1, g2, c;
+  uint64_t t0, t1;
+
+  /* Fully carry h. */
+  c = h1 >> 44;
+  h1 &= M44;
+  h2 += c;
+  c = h2 >> 42;
+  h2 &= M42;
+  h0 += c * 5;
+  c = h0 >> 44;
+  h0 &= M44;
+  h1 += c;
+  c = h1 >> 44;
+  h1 &= M44;
+  h2 += c;
+  c = h2 >> 42;
+  h2 &= M42;
+  h0 += c * 5;
+  c = h0 >> 44;
+  h0 &= M44;
+  h1 += c;
+
+  /* g = h + -p */
+  g0 = h0 + 5;
+  c = g0 >> 44;
+  g0 &= M44;
+  g1 = h1 + c;
+  c = g1 >> 44;
+  g1 &= M44;
+  g2 = h2 + c - (UINT64_C(1) << 42);
+
+  /* h = g if h >= p */
+  c = (g2 >> 63) - 1;
+  g0 &= c;
+  g1 &= c;
+  g2 &= c;
+  c = ~c;
+  h0 = (h0 & c) | g0;
+  h1 = (h1 & c) | g1;
+  h2 = (h2 & c) | g2;
+
+  /* h = (h + pad) mod 2^128 */
+  t0 = ctx->pad[0];
+  t1 = ctx->pad[1];
+
+  h0 += t0 & M44;
+  c = h0 >> 44;
+  h0 &= M44;
+  h1 += (((t0 >> 44) | (t1 << 20)) & M44) + c;
+  c = h1 >> 44;
+  h1 &= M44;
+  h2 += ((t1 >> 24) & M42) + c;
+  h2 &= M42;
+
+  btc_write64le(mac + 0, h0 | (h1 << 44));
+  btc_write64le(mac + 8, (h1 >> 20) | (h2 << 24));
+}
+
+#define POLY1305_HIBIT (UINT64_C(1) << 40)
+
+#else /* !BTC_HAVE_INT128 */
+
+/* Five 26-bit limbs. */
+
+#define M26 0x3ffffff
+
+void
+btc_poly1305_init(btc_poly1305_t *ctx, const uint8_t *key) {
+  /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+  ctx->r[0] = (btc_read32le(key + 0) >> 0) & 0x3ffffff;
+  ctx->r[1] = (btc_read32le(key + 3) >> 2) & 0x3ffff03;
+  ctx->r[2] = (btc_read32le(key + 6) >> 4) & 0x3ffc0ff;
+  ctx->r[3] = (btc_read32le(key + 9) >> 6) & 0x3f03fff;
+  ctx->r[4] = (btc_read32le(key + 12) >> 8) & 0x00fffff;
+
+  ctx->h[0] = 0;
+  ctx->h[1] = 0;
+  ctx->h[2] = 0;
+  ctx->h[3] = 0;
+  ctx->h[4] = 0;
+
+  ctx->pad[0] = btc_read32le(key + 16);
+  ctx->pad[1] = btc_read32le(key + 20);
+  ctx->pad[2] = btc_read32le(key + 24);
+  ctx->pad[3] = btc_read32le(key + 28);
+
+  ctx->pos = 0;
+}
+
+static void
+poly1305_blocks(btc_poly1305_t *ctx,
+                const uint8_t *data,
+                size_t len,
+                uint32_t hibit) {
+  uint32_t r0 = ctx->r[0];
+  uint32_t r1 = ctx->r[1];
+  uint32_t r2 = ctx->r[2];
+  uint32_t r3 = ctx->r[3];
+  uint32_t r4 = ctx->r[4];
+  uint32_t h0 = ctx->h[0];
+  uint32_t h1 = ctx->h[1];
+  uint32_t h2 = ctx->h[2];
+  uint32_t h3 = ctx->h[3];
+  uint32_t h4 = ctx->h[4];
+  uint32_t s1 = r1 * 5;
+  uint32_t s2 = r2 * 5;
+  uint32_t s3 = r3 * 5;
+  uint32_t s4 = r4 * 5;
+  uint64_t d0, d1, d2, d3, d4;
+  uint32_t c;
+
+  while (len >= 16) {
+    h0 += (btc_read32le(data + 0) >> 0) & M26;
+    h1 += (btc_read32le(data + 3) >> 2) & M26;
+    h2 += (btc_read32le(data + 6) >> 4) & M26;
+    h3 += (btc_read32le(data + 9) >> 6) & M26;
+    h4 += (btc_read32le(data + 12) >> 8) | hibit;
+
+    d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3
+       + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+
+    d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4
+       + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+
+    d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0
+       + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+
+    d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1
+       + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+
+    d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2
+       + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+    c = (uint32_t)(d0 >> 26);
+    h0 = (uint32_t)d0 & M26;
+    d1 += c;
+    c = (uint32_t)(d1 >> 26);
+    h1 = (uint32_t)d1 & M26;
+    d2 += c;
+    c = (uint32_t)(d2 >> 26);
+    h2 = (uint32_t)d2 & M26;
+    d3 += c;
+    c = (uint32_t)(d3 >> 26);
+    h3 = (uint32_t)d3 & M26;
+    d4 += c;
+    c = (uint32_t)(d4 >> 26);
+    h4 = (uint32_t)d4 & M26;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= M26;
+    h1 += c;
+
+    data += 16;
+    len -= 16;
+  }
+
+  ctx->h[0] = h0;
+  ctx->h[1] = h1;
+  ctx->h[2] = h2;
+  ctx->h[3] = h3;
+  ctx->h[4] = h4;
+}
+
+static void
+poly1305_finish(btc_poly1305_t *ctx, uint8_t *mac) {
+  uint32_t h0 = ctx->h[0];
+  uint32_t h1 = ctx->h[1];
+  uint32_t h2 = ctx->h[2];
+  uint32_t h3 = ctx->h[3];
+  uint32_t h4 = ctx->h[4];
+  uint32_t g0, g1, g2, g3, g4, c;
+  uint64_t f;
+
+  /* Fully carry h. */
+  c = h1 >> 26;
+  h1 &= M26;
+  h2 += c;
+  c = h2 >> 26;
+  h2 &= M26;
+  h3 += c;
+  c = h3 >> 26;
+  h3 &= M26;
+  h4 += c;
+  c = h4 >> 26;
+  h4 &= M26;
+  h0 += c * 5;
+  c = h0 >> 26;
+  h0 &= M26;
+  h1 += c;
+
+  /* g = h + -p */
+  g0 = h0 + 5;
+  c = g0 >> 26;
+  g0 &= M26;
+  g1 = h1 + c;
+  c = g1 >> 26;
+  g1 &= M26;
+  g2 = h2 + c;
+  c = g2 >> 26;
+  g2 &= M26;
+  g3 = h3 + c;
+  c = g3 >> 26;
+  g3 &= M26;
+  g4 = h4 + c - (UINT32_C(1) << 26);
+
+  /* h = g if h >= p */
+  c = (g4 >> 31) - 1;
+  g0 &= c;
+  g1 &= c;
+  g2 &= c;
+  g3 &= c;
+  g4 &= c;
+  c = ~c;
+  h0 = (h0 & c) | g0;
+  h1 = (h1 & c) | g1;
+  h2 = (h2 & c) | g2;
+  h3 = (h3 & c) | g3;
+  h4 = (h4 & c) | g4;
+
+  /* h = h % 2^128 */
+  h0 = (h0 >> 0) | (h1 << 26);
+  h1 = (h1 >> 6) | (h2 << 20);
+  h2 = (h2 >> 12) | (h3 << 14);
+  h3 = (h3 >> 18) | (h4 << 8);
+
+  /* mac = (h + pad) % 2^128 */
+  f = (uint64_t)h0 + ctx->pad[0];
+  h0 = (uint32_t)f;
+  f = (uint64_t)h1 + ctx->pad[1] + (f >> 32);
+  h1 = (uint32_t)f;
+  f = (uint64_t)h2 + ctx->pad[2] + (f >> 32);
+  h2 = (uint32_t)f;
+  f = (uint64_t)h3 + ctx->pad[3] + (f >> 32);
+  h3 = (uint32_t)f;
+
+  btc_write32le(mac + 0, h0);
+  btc_write32le(mac + 4, h1);
+  btc_write32le(mac + 8, h2);
+  btc_write32le(mac + 12, h3);
+}
+
+#define POLY1305_HIBIT (UINT32_C(1) << 24)
+
+#endif /* !BTC_HAVE_INT128 */
+
+void
+btc_poly1305_update(btc_poly1305_t *ctx, const uint8_t *data, size_t len) {
+  size_t want;
+
+  if (ctx->pos > 0) {
+    want = 16 - ctx->pos;
+
+    if (want > len)
+      want = len;
+
+    memcpy(ctx->block + ctx->pos, data, want);
+
+    ctx->pos += want;
+    data += want;
+    len -= want;
+
+    if (ctx->pos < 16)
+      return;
+
+    poly1305_blocks(ctx, ctx->block, 16, POLY1305_HIBIT);
+
+    ctx->pos = 0;
+  }
+
+  if (len >= 16) {
+    want = len & ~(size_t)15;
+
+    poly1305_blocks(ctx, data, want, POLY1305_HIBIT);
+
+    data += want;
+    len -= want;
+  }
+
+  if (len > 0) {
+    memcpy(ctx->block, data, len);
+    ctx->pos = len;
+  }
+}
+
+void
+btc_poly1305_pad(btc_poly1305_t *ctx) {
+  /* Zero-fill up to a block boundary (RFC 8439). */
+  static const uint8_t zero[16] = {0};
+
+  if (ctx->pos > 0)
+    btc_poly1305_update(ctx, zero, 16 - ctx->pos);
+}
+
+void
+btc_poly1305_final(btc_poly1305_t *ctx, uint8_t *mac) {
+  if (ctx->pos > 0) {
+    ctx->block[ctx->pos++] = 1;
+
+    while (ctx->pos < 16)
+      ctx->block[ctx->pos++] = 0;
+
+    poly1305_blocks(ctx, ctx->block, 16, 0);
+  }
+
+  poly1305_finish(ctx, mac);
+
+  btc_memzero(ctx, sizeof(*ctx));
+}
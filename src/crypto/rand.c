@@ -20,7 +20,16 @@
  * We expose a global fork-aware and thread-safe
  * RNG. We use thread local storage for the global
  * context. This avoids us having to link to
- * pthread and deal with other OS compat issues.
+ * pthread and deal with other OS compat issues,
+ * and keeps locks off of the hot path entirely.
+ * Where pthread is available anyway, forks are
+ * detected with an atfork handler rather than a
+ * getpid(2) call on every request.
+ *
+ * Keys are replaced by their own keystream before
+ * any output is produced ("fast key erasure"[3]).
+ * Small requests are served from a 1kb buffer of
+ * keystream which is zeroed as it is consumed.
  *
  * The RNG below is not used anywhere internally,
  * and as such, mako can build without it (in
@@ -29,6 +38,7 @@
  * [1] https://github.com/jedisct1/libsodium/blob/master/src/libsodium
  *     /randombytes/internal/randombytes_internal_random.c
  * [2] https://github.com/bitcoin/bitcoin/blob/master/src/random.cpp
+ * [3] https://blog.cr.yp.to/20170723-random.html
  */
 
 #include <stddef.h>
@@ -47,10 +57,10 @@
 typedef struct rng_s {
   uint32_t key[8];
   uint64_t nonce;
-  uint32_t pool[128];
+  uint8_t pool[1024];
   size_t pos;
   int started;
-  long pid;
+  long epoch;
 } rng_t;
 
 static int
@@ -60,73 +70,64 @@ rng_init(rng_t *rng) {
 }
 
 static void
-rng_crypt(const rng_t *rng, void *data, size_t size) {
+rng_generate(rng_t *rng, void *dst, size_t size) {
   btc_chacha20_t ctx;
 
   btc_chacha20_init(&ctx, (const uint8_t *)rng->key, 32,
                           (const uint8_t *)&rng->nonce, 8,
                           0);
 
-  btc_chacha20_crypt(&ctx, (uint8_t *)data,
-                           (const uint8_t *)data,
-                           size);
+  /* Fast key erasure: the first 32 bytes of
+     keystream replace the key before anything
+     is handed out. */
+  btc_chacha20_keystream(&ctx, (uint8_t *)rng->key, 32);
+  btc_chacha20_keystream(&ctx, (uint8_t *)dst, size);
+
+  rng->nonce++;
 
   btc_memzero(&ctx, sizeof(ctx));
 }
 
 static void
-rng_read(const rng_t *rng, void *dst, size_t size) {
-  if (size > 0)
-    memset(dst, 0, size);
-
-  rng_crypt(rng, dst, size);
+rng_refill(rng_t *rng) {
+  /* The pool is read from the end and zeroed
+     as it goes. Rekeying happens on refill. */
+  rng_generate(rng, rng->pool, sizeof(rng->pool));
+  rng->pos = sizeof(rng->pool);
 }
 
 static void
-rng_generate(rng_t *rng, void *dst, size_t size) {
-  /* Read the keystream. */
-  rng_read(rng, dst, size);
+rng_read(rng_t *rng, void *dst, size_t size) {
+  if (rng->pos < size)
+    rng_refill(rng);
 
-  /* Mix in some user entropy. */
-  rng->key[0] ^= (uint32_t)size;
+  rng->pos -= size;
 
-  /* Re-key immediately. */
-  rng->nonce++;
+  memcpy(dst, rng->pool + rng->pos, size);
+  memset(rng->pool + rng->pos, 0, size);
+}
 
-  /* At this point, the CTR-DRBG simply reads the
-     keystream again in order to rekey. We mimic
-     libsodium instead by XOR'ing the partially
-     modified key with its own keystream. In truth,
-     there's probably not really a difference in
-     terms of security, as the outputs in both
-     scenarios are dependent on the key. */
-  rng_crypt(rng, rng->key, 32);
+static void
+rng_bytes(rng_t *rng, void *dst, size_t size) {
+  /* Small requests (keys, nonces, tweaks) are
+     served from the pool. */
+  if (size <= 64)
+    rng_read(rng, dst, size);
+  else
+    rng_generate(rng, dst, size);
 }
 
 static uint32_t
 rng_random(rng_t *rng) {
   uint32_t x;
-  size_t i;
-
-  if (rng->pos == 0) {
-    /* Read the keystream. */
-    rng_read(rng, rng->pool, 512);
-
-    /* Re-key every 512 bytes. */
-    for (i = 0; i < 8; i++)
-      rng->key[i] ^= rng->pool[120 + i];
-
-    for (i = 0; i < 8; i++)
-      rng->pool[120 + i] = 0;
-
-    rng->nonce++;
-    rng->pos = 120;
-  }
-
-  x = rng->pool[--rng->pos];
-
-  rng->pool[rng->pos] = 0;
+  rng_read(rng, &x, sizeof(x));
+  return x;
+}
 
+static uint64_t
+rng_nonce(rng_t *rng) {
+  uint64_t x;
+  rng_read(rng, &x, sizeof(x));
   return x;
 }
 
@@ -232,6 +233,59 @@ rng_global_unlock(void) {
 
 #endif /* !__MINGW32__ */
 
+/*
+ * Fork Detection
+ */
+
+#if defined(BTC_TLS) && defined(BTC_HAVE_PTHREAD)
+/* With per-thread state, checking getpid(2) on
+ * every call is the most expensive part of the
+ * RNG. Instead, count forks with an atfork handler
+ * and compare against the count the state was
+ * seeded under.
+ */
+
+#include <pthread.h>
+
+static pthread_once_t rng_once = PTHREAD_ONCE_INIT;
+static volatile long rng_forks = 0;
+
+static void
+rng_atfork_child(void) {
+  rng_forks++;
+}
+
+static void
+rng_atfork_setup(void) {
+  if (pthread_atfork(NULL, NULL, rng_atfork_child) != 0)
+    btc_abort(); /* LCOV_EXCL_LINE */
+}
+
+static long
+rng_epoch(void) {
+  return rng_forks;
+}
+
+static void
+rng_epoch_init(void) {
+  if (pthread_once(&rng_once, rng_atfork_setup) != 0)
+    btc_abort(); /* LCOV_EXCL_LINE */
+}
+
+#else /* !BTC_TLS || !BTC_HAVE_PTHREAD */
+
+static long
+rng_epoch(void) {
+  return btc_getpid();
+}
+
+static void
+rng_epoch_init(void) {
+  return;
+}
+
+#endif /* !BTC_TLS || !BTC_HAVE_PTHREAD */
+
 /*
  * Global Context
  */
@@ -244,9 +298,9 @@ static rng_t rng_state;
 
 static void
 rng_global_init(void) {
-  long pid = btc_getpid();
+  if (!rng_state.started || rng_state.epoch != rng_epoch()) {
+    rng_epoch_init();
 
-  if (!rng_state.started || rng_state.pid != pid) {
     /* LCOV_EXCL_START */
     if (!rng_init(&rng_state)) {
       btc_abort();
@@ -255,7 +309,7 @@ rng_global_init(void) {
     /* LCOV_EXCL_STOP */
 
     rng_state.started = 1;
-    rng_state.pid = pid;
+    rng_state.epoch = rng_epoch();
   }
 }
 
@@ -272,7 +326,7 @@ void
 btc_getrandom(void *dst, size_t size) {
   rng_global_lock();
   rng_global_init();
-  rng_generate(&rng_state, dst, size);
+  rng_bytes(&rng_state, dst, size);
   rng_global_unlock();
 }
 
@@ -306,15 +360,14 @@ btc_uniform(uint32_t max) {
 
 uint64_t
 btc_nonce(void) {
-  uint32_t hi, lo;
+  uint64_t num;
 
   rng_global_lock();
   rng_global_init();
 
-  hi = rng_random(&rng_state);
-  lo = rng_random(&rng_state);
+  num = rng_nonce(&rng_state);
 
   rng_global_unlock();
 
-  return ((uint64_t)hi << 32) | lo;
+  return num;
 }
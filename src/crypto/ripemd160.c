@@ -14,8 +14,23 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <mako/cpu.h>
 #include <mako/crypto/hash.h>
 #include "../bio.h"
+#include "../internal.h"
+
+/*
+ * Backends
+ */
+
+#if defined(BTC_HAVE_ASM) && (BTC_GNUC_PREREQ(4, 9) || defined(__clang__))
+#  if defined(__x86_64__)
+#    define RIPEMD160_HAVE_AVX2
+#  endif
+#  if defined(__x86_64__) || defined(__aarch64__)
+#    define RIPEMD160_HAVE_VEC4
+#  endif
+#endif
 
 /*
  * RIPEMD160
@@ -343,3 +358,222 @@ btc_ripemd160(uint8_t *out, const void *data, size_t size) {
   btc_ripemd160_update(&ctx, data, size);
   btc_ripemd160_final(&ctx, out);
 }
+
+/*
+ * RIPEMD160 (Multi-way)
+ */
+
+#if defined(RIPEMD160_HAVE_VEC4)
+
+static const uint8_t ripemd160_r[2][80] = {
+  {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+     7,  4, 13,  1, 10,  6, 15,  3, 12,  0,  9,  5,  2, 14, 11,  8,
+     3, 10, 14,  4,  9, 15,  8,  1,  2,  7,  0,  6, 13, 11,  5, 12,
+     1,  9, 11, 10,  0,  8, 12,  4, 13,  3,  7, 15, 14,  5,  6,  2,
+     4,  0,  5,  9,  7, 12,  2, 10, 14,  1,  3,  8, 11,  6, 15, 13
+  },
+  {
+     5, 14,  7,  0,  9,  2, 11,  4, 13,  6, 15,  8,  1, 10,  3, 12,
+     6, 11,  3,  7,  0, 13,  5, 10, 14, 15,  8, 12,  4,  9,  1,  2,
+    15,  5,  1,  3,  7, 14,  6,  9, 11,  8, 12,  2, 10,  0,  4, 13,
+     8,  6,  4,  1,  3, 11, 15,  0,  5, 12,  2, 13,  9,  7, 10, 14,
+    12, 15, 10,  4,  1,  5,  8,  7,  6,  2, 13, 14,  0,  3,  9, 11
+  }
+};
+
+static const uint8_t ripemd160_s[2][80] = {
+  {
+    11, 14, 15, 12,  5,  8,  7,  9, 11, 13, 14, 15,  6,  7,  9,  8,
+     7,  6,  8, 13, 11,  9,  7, 15,  7, 12, 15,  9, 11,  7, 13, 12,
+    11, 13,  6,  7, 14,  9, 13, 15, 14,  8, 13,  6,  5, 12,  7,  5,
+    11, 12, 14, 15, 14, 15,  9,  8,  9, 14,  5,  6,  8,  6,  5, 12,
+     9, 15,  5, 11,  6,  8, 13, 12,  5, 12, 13, 14, 11,  8,  5,  6
+  },
+  {
+     8,  9,  9, 11, 13, 15, 15,  5,  7,  7,  8, 11, 14, 14, 12,  6,
+     9, 13, 15,  7, 12,  8,  9, 11,  7,  7, 12,  7,  6, 15, 13, 11,
+     9,  7, 15, 11,  8,  6,  6, 14, 12, 13,  5, 14, 13, 13,  7,  5,
+    15,  5,  8, 11, 14, 14,  6, 14,  6,  9, 12,  9, 12,  5, 15,  8,
+     8,  5, 12,  9, 12,  5, 14,  6,  8, 13,  6,  5, 15, 13, 11, 11
+  }
+};
+
+static const uint32_t ripemd160_k[2][5] = {
+  { 0x00000000, 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xa953fd4e },
+  { 0x50a28be6, 0x5c4dd124, 0x6d703ef3, 0x7a6d76e9, 0x00000000 }
+};
+
+static const uint32_t ripemd160_iv[5] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+/* The rounds are table driven rather than unrolled: the
+ * vector shift takes its count from a register either
+ * way, and the loop keeps both line definitions short.
+ */
+#define VROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define RIPEMD160_MULTI_DEFINE(name, vec, lanes, attr)                  \
+attr static void                                                        \
+name##_line(vec *S, const vec *W, int line) {                           \
+  const uint8_t *r = ripemd160_r[line];                                 \
+  const uint8_t *s = ripemd160_s[line];                                 \
+  vec a = S[0], b = S[1], c = S[2], d = S[3], e = S[4];                 \
+  vec f, t;                                                             \
+  int i, round;                                                         \
+                                                                        \
+  for (i = 0; i < 80; i++) {                                            \
+    /* The right line runs the functions backwards. */                  \
+    round = line ? 4 - (i >> 4) : (i >> 4);                             \
+                                                                        \
+    switch (round) {                                                    \
+      case 0:                                                           \
+        f = b ^ c ^ d;                                                  \
+        break;                                                          \
+      case 1:                                                           \
+        f = (b & c) | (~b & d);                                         \
+        break;                                                          \
+      case 2:                                                           \
+        f = (b | ~c) ^ d;                                               \
+        break;                                                          \
+      case 3:                                                           \
+        f = (b & d) | (c & ~d);                                         \
+        break;                                                          \
+      default:                                                          \
+        f = b ^ (c | ~d);                                               \
+        break;                                                          \
+    }                                                                   \
+                                                                        \
+    t = a + f + W[r[i]] + ripemd160_k[line][i >> 4];                    \
+    t = VROTL(t, s[i]) + e;                                             \
+                                                                        \
+    a = e;                                                              \
+    e = d;                                                              \
+    d = VROTL(c, 10);                                                   \
+    c = b;                                                              \
+    b = t;                                                              \
+  }                                                                     \
+                                                                        \
+  S[0] = a; S[1] = b; S[2] = c; S[3] = d; S[4] = e;                     \
+}                                                                       \
+                                                                        \
+attr static void                                                        \
+name(uint8_t *out, const uint8_t *in, size_t len) {                     \
+  size_t full = len & ~(size_t)63;                                      \
+  size_t end = ((len + 9 + 63) & ~(size_t)63) - full;                   \
+  uint8_t tail[lanes][128];                                             \
+  uint32_t tmp[lanes];                                                  \
+  vec S[5], L[5], R[5], W[16];                                          \
+  const uint8_t *xp;                                                    \
+  size_t pos;                                                           \
+  int i, j;                                                             \
+                                                                        \
+  for (j = 0; j < lanes; j++) {                                         \
+    memset(tail[j], 0, end);                                            \
+    memcpy(tail[j], in + j * len + full, len - full);                   \
+                                                                        \
+    tail[j][len - full] = 0x80;                                         \
+                                                                        \
+    btc_write64le(tail[j] + end - 8, (uint64_t)len << 3);               \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 5; i++) {                                             \
+    memset(&S[i], 0, sizeof(vec));                                      \
+    S[i] += ripemd160_iv[i];                                            \
+  }                                                                     \
+                                                                        \
+  for (pos = 0; pos < full + end; pos += 64) {                          \
+    for (i = 0; i < 16; i++) {                                          \
+      for (j = 0; j < lanes; j++) {                                     \
+        if (pos < full)                                                 \
+          xp = in + j * len + pos;                                      \
+        else                                                            \
+          xp = tail[j] + pos - full;                                    \
+                                                                        \
+        tmp[j] = btc_read32le(xp + i * 4);                              \
+      }                                                                 \
+                                                                        \
+      memcpy(&W[i], tmp, sizeof(vec));                                  \
+    }                                                                   \
+                                                                        \
+    for (i = 0; i < 5; i++) {                                           \
+      L[i] = S[i];                                                      \
+      R[i] = S[i];                                                      \
+    }                                                                   \
+                                                                        \
+    name##_line(L, W, 0);                                               \
+    name##_line(R, W, 1);                                               \
+                                                                        \
+    R[3] += S[1] + L[2];                                                \
+    S[1] = S[2] + L[3] + R[4];                                          \
+    S[2] = S[3] + L[4] + R[0];                                          \
+    S[3] = S[4] + L[0] + R[1];                                          \
+    S[4] = S[0] + L[1] + R[2];                                          \
+    S[0] = R[3];                                                        \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 5; i++) {                                             \
+    memcpy(tmp, &S[i], sizeof(vec));                                    \
+                                                                        \
+    for (j = 0; j < lanes; j++)                                         \
+      btc_write32le(out + j * 20 + i * 4, tmp[j]);                      \
+  }                                                                     \
+}
+
+typedef uint32_t ripemd160_vec4_t __attribute__((vector_size(16)));
+RIPEMD160_MULTI_DEFINE(ripemd160_vec4, ripemd160_vec4_t, 4, BTC_UNUSED)
+
+#if defined(RIPEMD160_HAVE_AVX2)
+typedef uint32_t ripemd160_vec8_t __attribute__((vector_size(32)));
+RIPEMD160_MULTI_DEFINE(ripemd160_avx2, ripemd160_vec8_t, 8,
+                       __attribute__((target("avx2"))))
+#endif
+
+#undef VROTL
+
+#endif /* RIPEMD160_HAVE_VEC4 */
+
+const char *
+btc_ripemd160_many_backend(void) {
+#if defined(RIPEMD160_HAVE_AVX2)
+  if (BTC_CPU_FEATURES() & BTC_CPU_AVX2)
+    return "avx2";
+#endif
+
+#if defined(RIPEMD160_HAVE_VEC4)
+  return "vec4";
+#else
+  return "generic";
+#endif
+}
+
+void
+btc_ripemd160_many(uint8_t *out, const uint8_t *in, size_t len, size_t count) {
+#if defined(RIPEMD160_HAVE_AVX2)
+  if (BTC_CPU_FEATURES() & BTC_CPU_AVX2) {
+    while (count >= 8) {
+      ripemd160_avx2(out, in, len);
+      out += 8 * 20;
+      in += 8 * len;
+      count -= 8;
+    }
+  }
+#endif
+
+#if defined(RIPEMD160_HAVE_VEC4)
+  while (count >= 4) {
+    ripemd160_vec4(out, in, len);
+    out += 4 * 20;
+    in += 4 * len;
+    count -= 4;
+  }
+#endif
+
+  while (count > 0) {
+    btc_ripemd160(out, in, len);
+    out += 20;
+    in += len;
+    count -= 1;
+  }
+}
@@ -9,13 +9,67 @@
  *
  * Unrolled loops generated with:
  *   https://gist.github.com/chjj/338a5ee212eefdff4431e4da65a2d4f7
+ *
+ * Hardware backends:
+ *   https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sha-extensions.html
+ *   https://github.com/noloader/SHA-Intrinsics
+ *   https://github.com/bitcoin/bitcoin/tree/master/src/crypto
  */
 
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <mako/cpu.h>
 #include <mako/crypto/hash.h>
 #include "../bio.h"
+#include "../internal.h"
+
+/*
+ * Backends
+ */
+
+#if defined(BTC_HAVE_ASM) && (BTC_GNUC_PREREQ(4, 9) || defined(__clang__))
+#  if defined(__x86_64__) || defined(__i386__)
+#    define SHA256_HAVE_SHANI
+#    define SHA256_HAVE_AVX2
+#    include <immintrin.h>
+#  endif
+#  if defined(__x86_64__) || defined(__aarch64__)
+#    define SHA256_HAVE_VEC4
+#  endif
+#endif
+
+/* No portable runtime detection on ARM; the compiler must be
+   told that the crypto extensions are present (-march=...). */
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) \
+                          || defined(__ARM_FEATURE_SHA2))
+#  define SHA256_HAVE_ARMV8
+#  include <arm_neon.h>
+#endif
+
+static const uint32_t sha256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_iv[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
 
 /*
  * SHA256
@@ -35,15 +89,15 @@ btc_sha256_init(btc_sha256_t *ctx) {
 }
 
 static void
-sha256_transform(btc_sha256_t *ctx, const uint8_t *chunk) {
-  uint32_t A = ctx->state[0];
-  uint32_t B = ctx->state[1];
-  uint32_t C = ctx->state[2];
-  uint32_t D = ctx->state[3];
-  uint32_t E = ctx->state[4];
-  uint32_t F = ctx->state[5];
-  uint32_t G = ctx->state[6];
-  uint32_t H = ctx->state[7];
+sha256_transform_generic(uint32_t *state, const uint8_t *chunk) {
+  uint32_t A = state[0];
+  uint32_t B = state[1];
+  uint32_t C = state[2];
+  uint32_t D = state[3];
+  uint32_t E = state[4];
+  uint32_t F = state[5];
+  uint32_t G = state[6];
+  uint32_t H = state[7];
   uint32_t W[16];
   uint32_t w;
 
@@ -180,14 +234,495 @@ sha256_transform(btc_sha256_t *ctx, const uint8_t *chunk) {
 #undef WORD
 #undef R
 
-  ctx->state[0] += A;
-  ctx->state[1] += B;
-  ctx->state[2] += C;
-  ctx->state[3] += D;
-  ctx->state[4] += E;
-  ctx->state[5] += F;
-  ctx->state[6] += G;
-  ctx->state[7] += H;
+  state[0] += A;
+  state[1] += B;
+  state[2] += C;
+  state[3] += D;
+  state[4] += E;
+  state[5] += F;
+  state[6] += G;
+  state[7] += H;
+}
+
+/*
+ * SHA256 (x86 SHA Extensions)
+ */
+
+#if defined(SHA256_HAVE_SHANI)
+__attribute__((target("sse4.1,sha"))) static void
+sha256_transform_shani(uint32_t *state, const uint8_t *chunks, size_t blocks) {
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                      0x0405060700010203ULL);
+  __m128i state0, state1, abef, cdgh, msg, tmp;
+  __m128i W[4];
+  int i;
+
+  tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+  state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+
+  tmp = _mm_shuffle_epi32(tmp, 0xb1); /* CDAB */
+  state1 = _mm_shuffle_epi32(state1, 0x1b); /* EFGH */
+  state0 = _mm_alignr_epi8(tmp, state1, 8); /* ABEF */
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0); /* CDGH */
+
+  while (blocks--) {
+    abef = state0;
+    cdgh = state1;
+
+    for (i = 0; i < 16; i++) {
+      if (i < 4) {
+        msg = _mm_loadu_si128((const __m128i *)(chunks + i * 16));
+        W[i] = _mm_shuffle_epi8(msg, mask);
+      } else {
+        msg = _mm_alignr_epi8(W[(i - 1) & 3], W[(i - 2) & 3], 4);
+        msg = _mm_add_epi32(_mm_sha256msg1_epu32(W[i & 3],
+                                                 W[(i - 3) & 3]), msg);
+        W[i & 3] = _mm_sha256msg2_epu32(msg, W[(i - 1) & 3]);
+      }
+
+      msg = _mm_add_epi32(W[i & 3],
+        _mm_loadu_si128((const __m128i *)&sha256_K[i * 4]));
+
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      msg = _mm_shuffle_epi32(msg, 0x0e);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+
+    chunks += 64;
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b); /* FEBA */
+  state1 = _mm_shuffle_epi32(state1, 0xb1); /* DCHG */
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0); /* DCBA */
+  state1 = _mm_alignr_epi8(state1, tmp, 8); /* HGFE */
+
+  _mm_storeu_si128((__m128i *)&state[0], state0);
+  _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif /* SHA256_HAVE_SHANI */
+
+/*
+ * SHA256 (ARMv8 Crypto Extensions)
+ */
+
+#if defined(SHA256_HAVE_ARMV8)
+static void
+sha256_transform_armv8(uint32_t *state, const uint8_t *chunks, size_t blocks) {
+  uint32x4_t state0, state1, abcd, efgh, msg, tmp;
+  uint32x4_t W[4];
+  int i;
+
+  state0 = vld1q_u32(&state[0]);
+  state1 = vld1q_u32(&state[4]);
+
+  while (blocks--) {
+    abcd = state0;
+    efgh = state1;
+
+    for (i = 0; i < 4; i++)
+      W[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(chunks + i * 16)));
+
+    for (i = 0; i < 16; i++) {
+      msg = vaddq_u32(W[i & 3], vld1q_u32(&sha256_K[i * 4]));
+
+      if (i < 12)
+        W[i & 3] = vsha256su0q_u32(W[i & 3], W[(i + 1) & 3]);
+
+      tmp = state0;
+      state0 = vsha256hq_u32(state0, state1, msg);
+      state1 = vsha256h2q_u32(state1, tmp, msg);
+
+      if (i < 12)
+        W[i & 3] = vsha256su1q_u32(W[i & 3], W[(i + 2) & 3], W[(i + 3) & 3]);
+    }
+
+    state0 = vaddq_u32(state0, abcd);
+    state1 = vaddq_u32(state1, efgh);
+
+    chunks += 64;
+  }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+#endif /* SHA256_HAVE_ARMV8 */
+
+/*
+ * SHA256 (Multi-way)
+ */
+
+/* Hashes N independent 64 byte inputs at once (one per
+ * vector lane). This is the exact shape of a merkle tree
+ * level, and the double hash allows us to use constant
+ * message schedules for the padding blocks.
+ *
+ * The lanes are written with GNU vector extensions so
+ * that a single definition serves both SSE2/NEON (4-way)
+ * and AVX2 (8-way).
+ */
+#define SHA256_ROUNDS_DEFINE(name, vec, attr)                           \
+attr static void                                                        \
+name(vec *S, vec *W, int start, int end) {                              \
+  vec a = S[0], b = S[1], c = S[2], d = S[3];                           \
+  vec e = S[4], f = S[5], g = S[6], h = S[7];                           \
+  vec t1, t2, x, y;                                                     \
+  int i;                                                                \
+                                                                        \
+  for (i = start; i < end; i++) {                                       \
+    if (i >= 16) {                                                      \
+      x = W[(i - 15) & 15];                                             \
+      y = W[(i - 2) & 15];                                              \
+      W[i & 15] += VROTR(y, 17) ^ VROTR(y, 19) ^ (y >> 10);             \
+      W[i & 15] += VROTR(x, 7) ^ VROTR(x, 18) ^ (x >> 3);               \
+      W[i & 15] += W[(i - 7) & 15];                                     \
+    }                                                                   \
+                                                                        \
+    t1 = h + (VROTR(e, 6) ^ VROTR(e, 11) ^ VROTR(e, 25))                \
+           + ((e & (f ^ g)) ^ g) + sha256_K[i] + W[i & 15];             \
+    t2 = (VROTR(a, 2) ^ VROTR(a, 13) ^ VROTR(a, 22))                    \
+       + ((a & (b | c)) | (b & c));                                     \
+                                                                        \
+    h = g;                                                              \
+    g = f;                                                              \
+    f = e;                                                              \
+    e = d + t1;                                                         \
+    d = c;                                                              \
+    c = b;                                                              \
+    b = a;                                                              \
+    a = t1 + t2;                                                        \
+  }                                                                     \
+                                                                        \
+  S[0] = a; S[1] = b; S[2] = c; S[3] = d;                               \
+  S[4] = e; S[5] = f; S[6] = g; S[7] = h;                               \
+}
+
+#define SHA256_MULTI_DEFINE(name, vec, lanes, attr)                     \
+SHA256_ROUNDS_DEFINE(name##_rounds, vec, attr)                          \
+                                                                        \
+attr static void                                                        \
+name##_transform(vec *S, vec *W) {                                      \
+  vec T[8];                                                             \
+  int i;                                                                \
+                                                                        \
+  for (i = 0; i < 8; i++)                                               \
+    T[i] = S[i];                                                        \
+                                                                        \
+  name##_rounds(T, W, 0, 64);                                           \
+                                                                        \
+  for (i = 0; i < 8; i++)                                               \
+    S[i] += T[i];                                                       \
+}                                                                       \
+                                                                        \
+attr static void                                                        \
+name(uint8_t *out, const uint8_t *in) {                                 \
+  uint32_t tmp[lanes];                                                  \
+  vec S[8], W[16];                                                      \
+  int i, j;                                                             \
+                                                                        \
+  for (i = 0; i < 16; i++) {                                            \
+    for (j = 0; j < lanes; j++)                                         \
+      tmp[j] = btc_read32be(in + j * 64 + i * 4);                       \
+                                                                        \
+    memcpy(&W[i], tmp, sizeof(vec));                                    \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 8; i++)                                               \
+    S[i] = (W[0] ^ W[0]) + sha256_iv[i];                                \
+                                                                        \
+  name##_transform(S, W);                                               \
+                                                                        \
+  /* Padding for a 64 byte message. */                                  \
+  for (i = 0; i < 16; i++)                                              \
+    W[i] = (S[0] ^ S[0]) + (i == 0 ? 0x80000000 : i == 15 ? 512 : 0);   \
+                                                                        \
+  name##_transform(S, W);                                               \
+                                                                        \
+  /* Second hash over the 32 byte digest. */                            \
+  for (i = 0; i < 8; i++) {                                             \
+    W[i] = S[i];                                                        \
+    W[i + 8] = (S[0] ^ S[0]) + (i == 0 ? 0x80000000 : i == 7 ? 256 : 0);\
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 8; i++)                                               \
+    S[i] = (W[0] ^ W[0]) + sha256_iv[i];                                \
+                                                                        \
+  name##_transform(S, W);                                               \
+                                                                        \
+  for (i = 0; i < 8; i++) {                                             \
+    memcpy(tmp, &S[i], sizeof(vec));                                    \
+                                                                        \
+    for (j = 0; j < lanes; j++)                                         \
+      btc_write32be(out + j * 32 + i * 4, tmp[j]);                      \
+  }                                                                     \
+}
+
+#define VROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#if defined(SHA256_HAVE_VEC4)
+typedef uint32_t sha256_vec4_t __attribute__((vector_size(16)));
+SHA256_MULTI_DEFINE(sha256d64_vec4, sha256_vec4_t, 4, BTC_UNUSED)
+#endif
+
+#if defined(SHA256_HAVE_AVX2)
+typedef uint32_t sha256_vec8_t __attribute__((vector_size(32)));
+SHA256_MULTI_DEFINE(sha256d64_avx2, sha256_vec8_t, 8,
+                    __attribute__((target("avx2"))))
+#endif
+
+/*
+ * SHA256d80 (Multi-way)
+ */
+
+/* Scans N consecutive nonces of an 80 byte header at
+ * once. Everything up to the nonce is fixed, so the
+ * first 64 bytes are absorbed once (the midstate) and
+ * the first three rounds of the second block, which
+ * only see the tail of the merkle root, the time and
+ * the bits, are precomputed as well.
+ *
+ * The target check only looks at the last state word
+ * of the final hash (the most significant 32 bits of
+ * the little-endian hash). That word is settled after
+ * round 60, so the last three rounds are skipped.
+ */
+typedef struct sha256_scan_s {
+  uint32_t mid[8];
+  uint32_t pre[8];
+  uint32_t W[16];
+  uint32_t hi;
+} sha256_scan_t;
+
+#define SHA256_SCAN_DEFINE(name, vec, lanes, attr)                      \
+SHA256_ROUNDS_DEFINE(name##_rounds, vec, attr)                          \
+                                                                        \
+attr static int                                                         \
+name(const sha256_scan_t *sc, uint32_t nonce) {                         \
+  uint32_t tmp[lanes];                                                  \
+  vec S[8], W[16], zero;                                                \
+  int i, j;                                                             \
+                                                                        \
+  memset(&zero, 0, sizeof(zero));                                       \
+                                                                        \
+  for (i = 0; i < 16; i++)                                              \
+    W[i] = zero + sc->W[i];                                             \
+                                                                        \
+  for (j = 0; j < lanes; j++)                                           \
+    tmp[j] = btc_bswap32(nonce + j);                                    \
+                                                                        \
+  memcpy(&W[3], tmp, sizeof(vec));                                      \
+                                                                        \
+  for (i = 0; i < 8; i++)                                               \
+    S[i] = zero + sc->pre[i];                                           \
+                                                                        \
+  name##_rounds(S, W, 3, 64);                                           \
+                                                                        \
+  /* Second hash over the 32 byte digest. */                            \
+  for (i = 0; i < 8; i++) {                                             \
+    W[i] = S[i] + sc->mid[i];                                           \
+    W[i + 8] = zero + (i == 0 ? 0x80000000 : i == 7 ? 256 : 0);         \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 8; i++)                                               \
+    S[i] = zero + sha256_iv[i];                                         \
+                                                                        \
+  name##_rounds(S, W, 0, 61);                                           \
+                                                                        \
+  /* `e` after round 60 is `h` after round 63. */                       \
+  S[4] += sha256_iv[7];                                                 \
+                                                                        \
+  memcpy(tmp, &S[4], sizeof(vec));                                      \
+                                                                        \
+  for (j = 0; j < lanes; j++) {                                         \
+    if (btc_bswap32(tmp[j]) <= sc->hi)                                  \
+      return j;                                                         \
+  }                                                                     \
+                                                                        \
+  return -1;                                                            \
+}
+
+SHA256_SCAN_DEFINE(sha256d80_generic, uint32_t, 1, BTC_UNUSED)
+
+#if defined(SHA256_HAVE_VEC4)
+SHA256_SCAN_DEFINE(sha256d80_vec4, sha256_vec4_t, 4, BTC_UNUSED)
+#endif
+
+#if defined(SHA256_HAVE_AVX2)
+SHA256_SCAN_DEFINE(sha256d80_avx2, sha256_vec8_t, 8,
+                   __attribute__((target("avx2"))))
+#endif
+
+/*
+ * SHA256 Many (Multi-way)
+ */
+
+/* Hashes N independent messages of the same length
+ * at once (public keys, scripts). Every lane has the
+ * same block count, so only the tail blocks, which
+ * hold the padding, need to be assembled by hand.
+ */
+#define SHA256_MANY_DEFINE(name, vec, lanes, transform, attr)           \
+attr static void                                                        \
+name(uint8_t *out, const uint8_t *in, size_t len) {                     \
+  size_t full = len & ~(size_t)63;                                      \
+  size_t end = ((len + 9 + 63) & ~(size_t)63) - full;                   \
+  uint8_t tail[lanes][128];                                             \
+  uint32_t tmp[lanes];                                                  \
+  const uint8_t *xp;                                                    \
+  vec S[8], W[16];                                                      \
+  size_t pos;                                                           \
+  int i, j;                                                             \
+                                                                        \
+  for (j = 0; j < lanes; j++) {                                         \
+    memset(tail[j], 0, end);                                            \
+    memcpy(tail[j], in + j * len + full, len - full);                   \
+                                                                        \
+    tail[j][len - full] = 0x80;                                         \
+                                                                        \
+    btc_write64be(tail[j] + end - 8, (uint64_t)len << 3);               \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 8; i++) {                                             \
+    memset(&S[i], 0, sizeof(vec));                                      \
+    S[i] += sha256_iv[i];                                               \
+  }                                                                     \
+                                                                        \
+  for (pos = 0; pos < full + end; pos += 64) {                          \
+    for (i = 0; i < 16; i++) {                                          \
+      for (j = 0; j < lanes; j++) {                                     \
+        if (pos < full)                                                 \
+          xp = in + j * len + pos;                                      \
+        else                                                            \
+          xp = tail[j] + pos - full;                                    \
+                                                                        \
+        tmp[j] = btc_read32be(xp + i * 4);                              \
+      }                                                                 \
+                                                                        \
+      memcpy(&W[i], tmp, sizeof(vec));                                  \
+    }                                                                   \
+                                                                        \
+    transform(S, W);                                                    \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 8; i++) {                                             \
+    memcpy(tmp, &S[i], sizeof(vec));                                    \
+                                                                        \
+    for (j = 0; j < lanes; j++)                                         \
+      btc_write32be(out + j * 32 + i * 4, tmp[j]);                      \
+  }                                                                     \
+}
+
+#if defined(SHA256_HAVE_VEC4)
+SHA256_MANY_DEFINE(sha256_many_vec4, sha256_vec4_t, 4,
+                   sha256d64_vec4_transform, BTC_UNUSED)
+#endif
+
+#if defined(SHA256_HAVE_AVX2)
+SHA256_MANY_DEFINE(sha256_many_avx2, sha256_vec8_t, 8,
+                   sha256d64_avx2_transform,
+                   __attribute__((target("avx2"))))
+#endif
+
+#undef VROTR
+
+/*
+ * CPU Detection
+ */
+
+#define SHA256_CPU_SHANI 1
+#define SHA256_CPU_AVX2 2
+#define SHA256_CPU_ARMV8 4
+
+static int
+sha256_cpu(void) {
+  unsigned int cpu = BTC_CPU_FEATURES();
+  int flags = 0;
+
+  /* SSSE3 + SSE4.1 are required for SHA-NI. */
+  if ((cpu & BTC_CPU_SHANI) && (cpu & BTC_CPU_SSSE3)
+                            && (cpu & BTC_CPU_SSE41)) {
+    flags |= SHA256_CPU_SHANI;
+  }
+
+  if (cpu & BTC_CPU_AVX2)
+    flags |= SHA256_CPU_AVX2;
+
+#if defined(SHA256_HAVE_ARMV8)
+  if (cpu & BTC_CPU_SHA2)
+    flags |= SHA256_CPU_ARMV8;
+#endif
+
+  return flags;
+}
+
+const char *
+btc_sha256_backend(void) {
+  int cpu = sha256_cpu();
+
+#if defined(SHA256_HAVE_SHANI)
+  if (cpu & SHA256_CPU_SHANI)
+    return "shani";
+#endif
+
+#if defined(SHA256_HAVE_ARMV8)
+  if (cpu & SHA256_CPU_ARMV8)
+    return "armv8";
+#endif
+
+  (void)cpu;
+
+  return "generic";
+}
+
+const char *
+btc_sha256_many_backend(void) {
+  int cpu = sha256_cpu();
+
+#if defined(SHA256_HAVE_AVX2)
+  if (cpu & SHA256_CPU_AVX2)
+    return "avx2";
+#endif
+
+  if (cpu & (SHA256_CPU_SHANI | SHA256_CPU_ARMV8))
+    return btc_sha256_backend();
+
+#if defined(SHA256_HAVE_VEC4)
+  return "vec4";
+#else
+  return "generic";
+#endif
+}
+
+/*
+ * Dispatch
+ */
+
+static void
+sha256_transform(uint32_t *state, const uint8_t *chunks, size_t blocks) {
+  int cpu = sha256_cpu();
+
+#if defined(SHA256_HAVE_SHANI)
+  if (cpu & SHA256_CPU_SHANI) {
+    sha256_transform_shani(state, chunks, blocks);
+    return;
+  }
+#endif
+
+#if defined(SHA256_HAVE_ARMV8)
+  if (cpu & SHA256_CPU_ARMV8) {
+    sha256_transform_armv8(state, chunks, blocks);
+    return;
+  }
+#endif
+
+  (void)cpu;
+
+  while (blocks--) {
+    sha256_transform_generic(state, chunks);
+    chunks += 64;
+  }
 }
 
 void
@@ -206,13 +741,16 @@ btc_sha256_update(btc_sha256_t *ctx, const void *data, size_t len) {
       len -= want;
       pos = 0;
 
-      sha256_transform(ctx, ctx->block);
+      sha256_transform(ctx->state, ctx->block, 1);
     }
 
-    while (len >= 64) {
-      sha256_transform(ctx, raw);
-      raw += 64;
-      len -= 64;
+    if (len >= 64) {
+      size_t blocks = len >> 6;
+
+      sha256_transform(ctx->state, raw, blocks);
+
+      raw += blocks << 6;
+      len &= 63;
     }
   }
 
@@ -231,7 +769,7 @@ btc_sha256_final(btc_sha256_t *ctx, uint8_t *out) {
     while (pos < 64)
       ctx->block[pos++] = 0x00;
 
-    sha256_transform(ctx, ctx->block);
+    sha256_transform(ctx->state, ctx->block, 1);
 
     pos = 0;
   }
@@ -241,7 +779,7 @@ btc_sha256_final(btc_sha256_t *ctx, uint8_t *out) {
 
   btc_write64be(ctx->block + 56, ctx->size << 3);
 
-  sha256_transform(ctx, ctx->block);
+  sha256_transform(ctx->state, ctx->block, 1);
 
   for (i = 0; i < 8; i++)
     btc_write32be(out + i * 4, ctx->state[i]);
@@ -254,3 +792,260 @@ btc_sha256(uint8_t *out, const void *data, size_t size) {
   btc_sha256_update(&ctx, data, size);
   btc_sha256_final(&ctx, out);
 }
+
+/*
+ * SHA256d64
+ */
+
+static void
+sha256d64_single(uint8_t *out, const uint8_t *in) {
+  /* Avoid the context machinery entirely: both padding
+     blocks are constant for a 64 byte input. */
+  uint8_t block[64];
+  uint32_t state[8];
+  int i;
+
+  memcpy(state, sha256_iv, sizeof(state));
+
+  sha256_transform(state, in, 1);
+
+  memset(block, 0, 64);
+
+  block[0] = 0x80;
+  block[62] = 0x02; /* 512 bits */
+
+  sha256_transform(state, block, 1);
+
+  for (i = 0; i < 8; i++)
+    btc_write32be(block + i * 4, state[i]);
+
+  memset(block + 32, 0, 32);
+
+  block[32] = 0x80;
+  block[62] = 0x01; /* 256 bits */
+
+  memcpy(state, sha256_iv, sizeof(state));
+
+  sha256_transform(state, block, 1);
+
+  for (i = 0; i < 8; i++)
+    btc_write32be(out + i * 4, state[i]);
+}
+
+void
+btc_sha256d64(uint8_t *out, const uint8_t *in, size_t blocks) {
+  int cpu = sha256_cpu();
+
+#if defined(SHA256_HAVE_AVX2)
+  if (cpu & SHA256_CPU_AVX2) {
+    while (blocks >= 8) {
+      sha256d64_avx2(out, in);
+      out += 8 * 32;
+      in += 8 * 64;
+      blocks -= 8;
+    }
+  }
+#endif
+
+  /* A single SHA-NI/ARMv8 lane beats 4-way SSE2/NEON. */
+  if (cpu & (SHA256_CPU_SHANI | SHA256_CPU_ARMV8))
+    goto single;
+
+#if defined(SHA256_HAVE_VEC4)
+  while (blocks >= 4) {
+    sha256d64_vec4(out, in);
+    out += 4 * 32;
+    in += 4 * 64;
+    blocks -= 4;
+  }
+#endif
+
+single:
+  while (blocks > 0) {
+    sha256d64_single(out, in);
+    out += 32;
+    in += 64;
+    blocks -= 1;
+  }
+}
+
+/*
+ * SHA256 Many
+ */
+
+void
+btc_sha256_many(uint8_t *out, const uint8_t *in, size_t len, size_t count) {
+  int cpu = sha256_cpu();
+
+#if defined(SHA256_HAVE_AVX2)
+  if (cpu & SHA256_CPU_AVX2) {
+    while (count >= 8) {
+      sha256_many_avx2(out, in, len);
+      out += 8 * 32;
+      in += 8 * len;
+      count -= 8;
+    }
+  }
+#endif
+
+  /* A single SHA-NI/ARMv8 lane beats 4-way SSE2/NEON. */
+  if (cpu & (SHA256_CPU_SHANI | SHA256_CPU_ARMV8))
+    goto single;
+
+#if defined(SHA256_HAVE_VEC4)
+  while (count >= 4) {
+    sha256_many_vec4(out, in, len);
+    out += 4 * 32;
+    in += 4 * len;
+    count -= 4;
+  }
+#endif
+
+single:
+  while (count > 0) {
+    btc_sha256(out, in, len);
+    out += 32;
+    in += len;
+    count -= 1;
+  }
+}
+
+/*
+ * SHA256d80
+ */
+
+static void
+sha256d80_prepare(sha256_scan_t *sc, const btc_sha256_t *ctx, uint32_t hi) {
+  int i;
+
+  memcpy(sc->mid, ctx->state, sizeof(sc->mid));
+  memset(sc->W, 0, sizeof(sc->W));
+
+  for (i = 0; i < 3; i++)
+    sc->W[i] = btc_read32be(ctx->block + i * 4);
+
+  /* Padding for an 80 byte message. */
+  sc->W[4] = 0x80000000;
+  sc->W[15] = 640;
+
+  memcpy(sc->pre, sc->mid, sizeof(sc->pre));
+
+  sha256d80_generic_rounds(sc->pre, sc->W, 0, 3);
+
+  sc->hi = hi;
+}
+
+static void
+sha256d80_single(uint8_t *out, const btc_sha256_t *ctx, uint32_t nonce) {
+  uint8_t block[64];
+  uint32_t state[8];
+  int i;
+
+  memcpy(state, ctx->state, sizeof(state));
+  memset(block, 0, 64);
+  memcpy(block, ctx->block, 12);
+
+  btc_write32le(block + 12, nonce);
+
+  block[16] = 0x80;
+  block[62] = 0x02; /* 640 bits */
+  block[63] = 0x80;
+
+  sha256_transform(state, block, 1);
+
+  for (i = 0; i < 8; i++)
+    btc_write32be(block + i * 4, state[i]);
+
+  memset(block + 32, 0, 32);
+
+  block[32] = 0x80;
+  block[62] = 0x01; /* 256 bits */
+
+  memcpy(state, sha256_iv, sizeof(state));
+
+  sha256_transform(state, block, 1);
+
+  for (i = 0; i < 8; i++)
+    btc_write32be(out + i * 4, state[i]);
+}
+
+int
+btc_sha256d80_scan(uint8_t *out,
+                   uint32_t *nonce,
+                   uint32_t count,
+                   const btc_sha256_t *ctx,
+                   uint32_t hi) {
+  int cpu = sha256_cpu();
+  uint32_t n = *nonce;
+  sha256_scan_t sc;
+  int j;
+
+  CHECK(ctx->size == 76);
+
+  sha256d80_prepare(&sc, ctx, hi);
+
+#if defined(SHA256_HAVE_AVX2)
+  if (cpu & SHA256_CPU_AVX2) {
+    while (count >= 8) {
+      j = sha256d80_avx2(&sc, n);
+
+      if (j >= 0) {
+        n += j;
+        goto found;
+      }
+
+      n += 8;
+      count -= 8;
+    }
+  }
+#endif
+
+  /* A single SHA-NI/ARMv8 lane beats 4-way SSE2/NEON. */
+  if (cpu & (SHA256_CPU_SHANI | SHA256_CPU_ARMV8)) {
+    while (count > 0) {
+      sha256d80_single(out, ctx, n);
+
+      if (btc_read32le(out + 28) <= hi) {
+        *nonce = n;
+        return 1;
+      }
+
+      n += 1;
+      count -= 1;
+    }
+
+    *nonce = n;
+
+    return 0;
+  }
+
+#if defined(SHA256_HAVE_VEC4)
+  while (count >= 4) {
+    j = sha256d80_vec4(&sc, n);
+
+    if (j >= 0) {
+      n += j;
+      goto found;
+    }
+
+    n += 4;
+    count -= 4;
+  }
+#endif
+
+  while (count > 0) {
+    if (sha256d80_generic(&sc, n) >= 0)
+      goto found;
+
+    n += 1;
+    count -= 1;
+  }
+
+  *nonce = n;
+
+  return 0;
+found:
+  sha256d80_single(out, ctx, n);
+  *nonce = n;
+  return 1;
+}
@@ -14,8 +14,21 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <mako/cpu.h>
 #include <mako/crypto/hash.h>
+#include <mako/util.h>
 #include "../bio.h"
+#include "../internal.h"
+
+/*
+ * Backends
+ */
+
+#if defined(BTC_HAVE_ASM) && (BTC_GNUC_PREREQ(4, 9) || defined(__clang__))
+#  if defined(__x86_64__) || defined(__i386__)
+#    define SHA512_HAVE_AVX2
+#  endif
+#endif
 
 /*
  * SHA512
@@ -279,3 +292,268 @@ btc_sha512(uint8_t *out, const void *data, size_t size) {
   btc_sha512_update(&ctx, data, size);
   btc_sha512_final(&ctx, out);
 }
+
+/*
+ * SHA512 PBKDF2 (Multi-way)
+ */
+
+#if defined(SHA512_HAVE_AVX2)
+static const uint64_t sha512_K[80] = {
+  UINT64_C(0x428a2f98d728ae22), UINT64_C(0x7137449123ef65cd),
+  UINT64_C(0xb5c0fbcfec4d3b2f), UINT64_C(0xe9b5dba58189dbbc),
+  UINT64_C(0x3956c25bf348b538), UINT64_C(0x59f111f1b605d019),
+  UINT64_C(0x923f82a4af194f9b), UINT64_C(0xab1c5ed5da6d8118),
+  UINT64_C(0xd807aa98a3030242), UINT64_C(0x12835b0145706fbe),
+  UINT64_C(0x243185be4ee4b28c), UINT64_C(0x550c7dc3d5ffb4e2),
+  UINT64_C(0x72be5d74f27b896f), UINT64_C(0x80deb1fe3b1696b1),
+  UINT64_C(0x9bdc06a725c71235), UINT64_C(0xc19bf174cf692694),
+  UINT64_C(0xe49b69c19ef14ad2), UINT64_C(0xefbe4786384f25e3),
+  UINT64_C(0x0fc19dc68b8cd5b5), UINT64_C(0x240ca1cc77ac9c65),
+  UINT64_C(0x2de92c6f592b0275), UINT64_C(0x4a7484aa6ea6e483),
+  UINT64_C(0x5cb0a9dcbd41fbd4), UINT64_C(0x76f988da831153b5),
+  UINT64_C(0x983e5152ee66dfab), UINT64_C(0xa831c66d2db43210),
+  UINT64_C(0xb00327c898fb213f), UINT64_C(0xbf597fc7beef0ee4),
+  UINT64_C(0xc6e00bf33da88fc2), UINT64_C(0xd5a79147930aa725),
+  UINT64_C(0x06ca6351e003826f), UINT64_C(0x142929670a0e6e70),
+  UINT64_C(0x27b70a8546d22ffc), UINT64_C(0x2e1b21385c26c926),
+  UINT64_C(0x4d2c6dfc5ac42aed), UINT64_C(0x53380d139d95b3df),
+  UINT64_C(0x650a73548baf63de), UINT64_C(0x766a0abb3c77b2a8),
+  UINT64_C(0x81c2c92e47edaee6), UINT64_C(0x92722c851482353b),
+  UINT64_C(0xa2bfe8a14cf10364), UINT64_C(0xa81a664bbc423001),
+  UINT64_C(0xc24b8b70d0f89791), UINT64_C(0xc76c51a30654be30),
+  UINT64_C(0xd192e819d6ef5218), UINT64_C(0xd69906245565a910),
+  UINT64_C(0xf40e35855771202a), UINT64_C(0x106aa07032bbd1b8),
+  UINT64_C(0x19a4c116b8d2d0c8), UINT64_C(0x1e376c085141ab53),
+  UINT64_C(0x2748774cdf8eeb99), UINT64_C(0x34b0bcb5e19b48a8),
+  UINT64_C(0x391c0cb3c5c95a63), UINT64_C(0x4ed8aa4ae3418acb),
+  UINT64_C(0x5b9cca4f7763e373), UINT64_C(0x682e6ff3d6b2b8a3),
+  UINT64_C(0x748f82ee5defb2fc), UINT64_C(0x78a5636f43172f60),
+  UINT64_C(0x84c87814a1f0ab72), UINT64_C(0x8cc702081a6439ec),
+  UINT64_C(0x90befffa23631e28), UINT64_C(0xa4506cebde82bde9),
+  UINT64_C(0xbef9a3f7b2c67915), UINT64_C(0xc67178f2e372532b),
+  UINT64_C(0xca273eceea26619c), UINT64_C(0xd186b8c721c0c207),
+  UINT64_C(0xeada7dd6cde0eb1e), UINT64_C(0xf57d4f7fee6ed178),
+  UINT64_C(0x06f067aa72176fba), UINT64_C(0x0a637dc5a2c898a6),
+  UINT64_C(0x113f9804bef90dae), UINT64_C(0x1b710b35131c471b),
+  UINT64_C(0x28db77f523047d84), UINT64_C(0x32caab7b40c72493),
+  UINT64_C(0x3c9ebe0a15c9bebc), UINT64_C(0x431d67c49c100d4c),
+  UINT64_C(0x4cc5d4becb3e42b6), UINT64_C(0x597f299cfc657e2a),
+  UINT64_C(0x5fcb6fab3ad6faec), UINT64_C(0x6c44198c4a475817)
+};
+
+/* Runs the PBKDF2 rounds for N independent blocks at
+ * once (one per vector lane). Each HMAC in the chain
+ * hashes exactly one 64 byte digest starting from a
+ * precomputed midstate, so the message is a single
+ * block whose second half is constant padding and
+ * the digests never have to leave word form.
+ */
+#define SHA512_PBKDF2_DEFINE(name, vec, lanes, attr)                    \
+attr static void                                                        \
+name##_compress(vec *S, const vec *M) {                                 \
+  vec a = S[0], b = S[1], c = S[2], d = S[3];                           \
+  vec e = S[4], f = S[5], g = S[6], h = S[7];                           \
+  vec t1, t2, x, y, W[16];                                              \
+  int i;                                                                \
+                                                                        \
+  /* Padding for a 64 byte message after a 128 byte key block. */      \
+  for (i = 0; i < 16; i++) {                                            \
+    if (i < 8)                                                          \
+      W[i] = M[i];                                                      \
+    else                                                                \
+      W[i] = (a ^ a) + (i == 8 ? UINT64_C(0x8000000000000000)           \
+                                : i == 15 ? 1536 : 0);                  \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 80; i++) {                                            \
+    if (i >= 16) {                                                      \
+      x = W[(i - 15) & 15];                                             \
+      y = W[(i - 2) & 15];                                              \
+      W[i & 15] += VROTR(y, 19) ^ VROTR(y, 61) ^ (y >> 6);              \
+      W[i & 15] += VROTR(x, 1) ^ VROTR(x, 8) ^ (x >> 7);                \
+      W[i & 15] += W[(i - 7) & 15];                                     \
+    }                                                                   \
+                                                                        \
+    t1 = h + (VROTR(e, 14) ^ VROTR(e, 18) ^ VROTR(e, 41))               \
+           + ((e & (f ^ g)) ^ g) + sha512_K[i] + W[i & 15];             \
+    t2 = (VROTR(a, 28) ^ VROTR(a, 34) ^ VROTR(a, 39))                   \
+       + ((a & (b | c)) | (b & c));                                     \
+                                                                        \
+    h = g;                                                              \
+    g = f;                                                              \
+    f = e;                                                              \
+    e = d + t1;                                                         \
+    d = c;                                                              \
+    c = b;                                                              \
+    b = a;                                                              \
+    a = t1 + t2;                                                        \
+  }                                                                     \
+                                                                        \
+  S[0] += a; S[1] += b; S[2] += c; S[3] += d;                           \
+  S[4] += e; S[5] += f; S[6] += g; S[7] += h;                           \
+}                                                                       \
+                                                                        \
+attr static void                                                        \
+name(uint8_t *blocks,                                                   \
+     const uint64_t *inner,                                             \
+     const uint64_t *outer,                                             \
+     uint32_t iter) {                                                   \
+  uint64_t tmp[lanes];                                                  \
+  vec T[8], U[8], S[8];                                                 \
+  uint32_t r;                                                           \
+  int i, j;                                                             \
+                                                                        \
+  for (i = 0; i < 8; i++) {                                             \
+    for (j = 0; j < lanes; j++)                                         \
+      tmp[j] = btc_read64be(blocks + j * 64 + i * 8);                   \
+                                                                        \
+    memcpy(&U[i], tmp, sizeof(vec));                                    \
+                                                                        \
+    T[i] = U[i];                                                        \
+  }                                                                     \
+                                                                        \
+  for (r = 1; r < iter; r++) {                                          \
+    for (i = 0; i < 8; i++)                                             \
+      S[i] = (T[0] ^ T[0]) + inner[i];                                  \
+                                                                        \
+    name##_compress(S, U);                                              \
+                                                                        \
+    for (i = 0; i < 8; i++)                                             \
+      U[i] = (T[0] ^ T[0]) + outer[i];                                  \
+                                                                        \
+    name##_compress(U, S);                                              \
+                                                                        \
+    for (i = 0; i < 8; i++)                                             \
+      T[i] ^= U[i];                                                     \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < 8; i++) {                                             \
+    memcpy(tmp, &T[i], sizeof(vec));                                    \
+                                                                        \
+    for (j = 0; j < lanes; j++)                                         \
+      btc_write64be(blocks + j * 64 + i * 8, tmp[j]);                   \
+  }                                                                     \
+                                                                        \
+  btc_memzero(tmp, sizeof(tmp));                                        \
+  btc_memzero(T, sizeof(T));                                            \
+  btc_memzero(U, sizeof(U));                                            \
+  btc_memzero(S, sizeof(S));                                            \
+}
+
+#define VROTR(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+typedef uint64_t sha512_vec2_t __attribute__((vector_size(16)));
+typedef uint64_t sha512_vec4_t __attribute__((vector_size(32)));
+SHA512_PBKDF2_DEFINE(sha512_pbkdf2_vec2, sha512_vec2_t, 2,
+                     __attribute__((target("avx2"))))
+SHA512_PBKDF2_DEFINE(sha512_pbkdf2_avx2, sha512_vec4_t, 4,
+                     __attribute__((target("avx2"))))
+
+#undef VROTR
+
+#endif /* SHA512_HAVE_AVX2 */
+
+static void
+sha512_pbkdf2_generic(uint8_t *block,
+                      const uint64_t *inner,
+                      const uint64_t *outer,
+                      uint32_t iter) {
+  /* A single lane is best served by the unrolled
+     transform. The padding half of the message
+     is written once and never changes. */
+  btc_sha512_t ctx;
+  uint8_t msg[128];
+  uint64_t T[8];
+  uint32_t r;
+  int i;
+
+  for (i = 0; i < 8; i++)
+    T[i] = btc_read64be(block + i * 8);
+
+  memcpy(msg, block, 64);
+  memset(msg + 64, 0, 64);
+
+  msg[64] = 0x80;
+  msg[126] = 0x06; /* 1536 bits */
+
+  for (r = 1; r < iter; r++) {
+    memcpy(ctx.state, inner, sizeof(ctx.state));
+
+    sha512_transform(&ctx, msg);
+
+    for (i = 0; i < 8; i++)
+      btc_write64be(msg + i * 8, ctx.state[i]);
+
+    memcpy(ctx.state, outer, sizeof(ctx.state));
+
+    sha512_transform(&ctx, msg);
+
+    for (i = 0; i < 8; i++) {
+      btc_write64be(msg + i * 8, ctx.state[i]);
+      T[i] ^= ctx.state[i];
+    }
+  }
+
+  for (i = 0; i < 8; i++)
+    btc_write64be(block + i * 8, T[i]);
+
+  btc_memzero(&ctx, sizeof(ctx));
+  btc_memzero(msg, sizeof(msg));
+  btc_memzero(T, sizeof(T));
+}
+
+/*
+ * CPU Detection
+ */
+
+#if defined(SHA512_HAVE_AVX2)
+static int
+sha512_has_avx2(void) {
+  return (BTC_CPU_FEATURES() & BTC_CPU_AVX2) != 0;
+}
+#endif
+
+const char *
+btc_sha512_pbkdf2_backend(void) {
+#if defined(SHA512_HAVE_AVX2)
+  if (sha512_has_avx2())
+    return "avx2";
+#endif
+
+  return "generic";
+}
+
+/*
+ * SHA512 PBKDF2
+ */
+
+void
+btc_sha512_pbkdf2(uint8_t *blocks,
+                  const btc_hmac512_t *hmac,
+                  size_t count,
+                  uint32_t iter) {
+  const uint64_t *inner = hmac->inner.state;
+  const uint64_t *outer = hmac->outer.state;
+
+#if defined(SHA512_HAVE_AVX2)
+  if (sha512_has_avx2()) {
+    while (count >= 4) {
+      sha512_pbkdf2_avx2(blocks, inner, outer, iter);
+      blocks += 4 * 64;
+      count -= 4;
+    }
+
+    while (count >= 2) {
+      sha512_pbkdf2_vec2(blocks, inner, outer, iter);
+      blocks += 2 * 64;
+      count -= 2;
+    }
+  }
+#endif
+
+  while (count > 0) {
+    sha512_pbkdf2_generic(blocks, inner, outer, iter);
+    blocks += 64;
+    count -= 1;
+  }
+}
@@ -0,0 +1,294 @@
+/*!
+ * fec.c - erasure coding for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://en.wikipedia.org/wiki/Reed%E2%80%93Solomon_error_correction
+ *   https://en.wikipedia.org/wiki/Cauchy_matrix
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <mako/fec.h>
+#include "internal.h"
+
+/*
+ * Reed-Solomon
+ *
+ * A systematic erasure code over GF(2^8): shards
+ * [0, k) carry the data unchanged and each parity
+ * shard i is the row k + i of a Cauchy matrix
+ * applied to them,
+ *
+ *   p[i] = sum(d[j] / ((k + i) ^ j), j = 0..k-1)
+ *
+ * Every square submatrix of a Cauchy matrix is
+ * invertible, so any k of the k + m shards are
+ * enough to recover the data.
+ */
+
+/*
+ * GF(2^8) (x^8 + x^4 + x^3 + x^2 + 1)
+ */
+
+static const uint8_t gf_exp[510] = {
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d, 0x3a, 0x74, 0xe8,
+  0xcd, 0x87, 0x13, 0x26, 0x4c, 0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9,
+  0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x9d, 0x27, 0x4e, 0x9c,
+  0x25, 0x4a, 0x94, 0x35, 0x6a, 0xd4, 0xb5, 0x77, 0xee, 0xc1, 0x9f, 0x23,
+  0x46, 0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0, 0x5d, 0xba, 0x69, 0xd2,
+  0xb9, 0x6f, 0xde, 0xa1, 0x5f, 0xbe, 0x61, 0xc2, 0x99, 0x2f, 0x5e, 0xbc,
+  0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0, 0xfd, 0xe7, 0xd3, 0xbb,
+  0x6b, 0xd6, 0xb1, 0x7f, 0xfe, 0xe1, 0xdf, 0xa3, 0x5b, 0xb6, 0x71, 0xe2,
+  0xd9, 0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0d, 0x1a, 0x34, 0x68,
+  0xd0, 0xbd, 0x67, 0xce, 0x81, 0x1f, 0x3e, 0x7c, 0xf8, 0xed, 0xc7, 0x93,
+  0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc, 0x85, 0x17, 0x2e, 0x5c,
+  0xb8, 0x6d, 0xda, 0xa9, 0x4f, 0x9e, 0x21, 0x42, 0x84, 0x15, 0x2a, 0x54,
+  0xa8, 0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa, 0x49, 0x92, 0x39, 0x72,
+  0xe4, 0xd5, 0xb7, 0x73, 0xe6, 0xd1, 0xbf, 0x63, 0xc6, 0x91, 0x3f, 0x7e,
+  0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff, 0xe3, 0xdb, 0xab, 0x4b,
+  0x96, 0x31, 0x62, 0xc4, 0x95, 0x37, 0x6e, 0xdc, 0xa5, 0x57, 0xae, 0x41,
+  0x82, 0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e, 0x1c, 0x38, 0x70, 0xe0,
+  0xdd, 0xa7, 0x53, 0xa6, 0x51, 0xa2, 0x59, 0xb2, 0x79, 0xf2, 0xf9, 0xef,
+  0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09, 0x12, 0x24, 0x48, 0x90,
+  0x3d, 0x7a, 0xf4, 0xf5, 0xf7, 0xf3, 0xfb, 0xeb, 0xcb, 0x8b, 0x0b, 0x16,
+  0x2c, 0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83, 0x1b, 0x36, 0x6c, 0xd8,
+  0xad, 0x47, 0x8e, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d,
+  0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26, 0x4c, 0x98, 0x2d, 0x5a, 0xb4,
+  0x75, 0xea, 0xc9, 0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x9d,
+  0x27, 0x4e, 0x9c, 0x25, 0x4a, 0x94, 0x35, 0x6a, 0xd4, 0xb5, 0x77, 0xee,
+  0xc1, 0x9f, 0x23, 0x46, 0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0, 0x5d,
+  0xba, 0x69, 0xd2, 0xb9, 0x6f, 0xde, 0xa1, 0x5f, 0xbe, 0x61, 0xc2, 0x99,
+  0x2f, 0x5e, 0xbc, 0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0, 0xfd,
+  0xe7, 0xd3, 0xbb, 0x6b, 0xd6, 0xb1, 0x7f, 0xfe, 0xe1, 0xdf, 0xa3, 0x5b,
+  0xb6, 0x71, 0xe2, 0xd9, 0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0d,
+  0x1a, 0x34, 0x68, 0xd0, 0xbd, 0x67, 0xce, 0x81, 0x1f, 0x3e, 0x7c, 0xf8,
+  0xed, 0xc7, 0x93, 0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc, 0x85,
+  0x17, 0x2e, 0x5c, 0xb8, 0x6d, 0xda, 0xa9, 0x4f, 0x9e, 0x21, 0x42, 0x84,
+  0x15, 0x2a, 0x54, 0xa8, 0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa, 0x49,
+  0x92, 0x39, 0x72, 0xe4, 0xd5, 0xb7, 0x73, 0xe6, 0xd1, 0xbf, 0x63, 0xc6,
+  0x91, 0x3f, 0x7e, 0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff, 0xe3,
+  0xdb, 0xab, 0x4b, 0x96, 0x31, 0x62, 0xc4, 0x95, 0x37, 0x6e, 0xdc, 0xa5,
+  0x57, 0xae, 0x41, 0x82, 0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e, 0x1c,
+  0x38, 0x70, 0xe0, 0xdd, 0xa7, 0x53, 0xa6, 0x51, 0xa2, 0x59, 0xb2, 0x79,
+  0xf2, 0xf9, 0xef, 0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09, 0x12,
+  0x24, 0x48, 0x90, 0x3d, 0x7a, 0xf4, 0xf5, 0xf7, 0xf3, 0xfb, 0xeb, 0xcb,
+  0x8b, 0x0b, 0x16, 0x2c, 0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83, 0x1b,
+  0x36, 0x6c, 0xd8, 0xad, 0x47, 0x8e
+};
+
+static const uint8_t gf_log[256] = {
+  0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1a, 0xc6, 0x03, 0xdf, 0x33, 0xee,
+  0x1b, 0x68, 0xc7, 0x4b, 0x04, 0x64, 0xe0, 0x0e, 0x34, 0x8d, 0xef, 0x81,
+  0x1c, 0xc1, 0x69, 0xf8, 0xc8, 0x08, 0x4c, 0x71, 0x05, 0x8a, 0x65, 0x2f,
+  0xe1, 0x24, 0x0f, 0x21, 0x35, 0x93, 0x8e, 0xda, 0xf0, 0x12, 0x82, 0x45,
+  0x1d, 0xb5, 0xc2, 0x7d, 0x6a, 0x27, 0xf9, 0xb9, 0xc9, 0x9a, 0x09, 0x78,
+  0x4d, 0xe4, 0x72, 0xa6, 0x06, 0xbf, 0x8b, 0x62, 0x66, 0xdd, 0x30, 0xfd,
+  0xe2, 0x98, 0x25, 0xb3, 0x10, 0x91, 0x22, 0x88, 0x36, 0xd0, 0x94, 0xce,
+  0x8f, 0x96, 0xdb, 0xbd, 0xf1, 0xd2, 0x13, 0x5c, 0x83, 0x38, 0x46, 0x40,
+  0x1e, 0x42, 0xb6, 0xa3, 0xc3, 0x48, 0x7e, 0x6e, 0x6b, 0x3a, 0x28, 0x54,
+  0xfa, 0x85, 0xba, 0x3d, 0xca, 0x5e, 0x9b, 0x9f, 0x0a, 0x15, 0x79, 0x2b,
+  0x4e, 0xd4, 0xe5, 0xac, 0x73, 0xf3, 0xa7, 0x57, 0x07, 0x70, 0xc0, 0xf7,
+  0x8c, 0x80, 0x63, 0x0d, 0x67, 0x4a, 0xde, 0xed, 0x31, 0xc5, 0xfe, 0x18,
+  0xe3, 0xa5, 0x99, 0x77, 0x26, 0xb8, 0xb4, 0x7c, 0x11, 0x44, 0x92, 0xd9,
+  0x23, 0x20, 0x89, 0x2e, 0x37, 0x3f, 0xd1, 0x5b, 0x95, 0xbc, 0xcf, 0xcd,
+  0x90, 0x87, 0x97, 0xb2, 0xdc, 0xfc, 0xbe, 0x61, 0xf2, 0x56, 0xd3, 0xab,
+  0x14, 0x2a, 0x5d, 0x9e, 0x84, 0x3c, 0x39, 0x53, 0x47, 0x6d, 0x41, 0xa2,
+  0x1f, 0x2d, 0x43, 0xd8, 0xb7, 0x7b, 0xa4, 0x76, 0xc4, 0x17, 0x49, 0xec,
+  0x7f, 0x0c, 0x6f, 0xf6, 0x6c, 0xa1, 0x3b, 0x52, 0x29, 0x9d, 0x55, 0xaa,
+  0xfb, 0x60, 0x86, 0xb1, 0xbb, 0xcc, 0x3e, 0x5a, 0xcb, 0x59, 0x5f, 0xb0,
+  0x9c, 0xa9, 0xa0, 0x51, 0x0b, 0xf5, 0x16, 0xeb, 0x7a, 0x75, 0x2c, 0xd7,
+  0x4f, 0xae, 0xd5, 0xe9, 0xe6, 0xe7, 0xad, 0xe8, 0x74, 0xd6, 0xf4, 0xea,
+  0xa8, 0x50, 0x58, 0xaf
+};
+
+static uint8_t
+gf_mul(uint8_t x, uint8_t y) {
+  if (x == 0 || y == 0)
+    return 0;
+
+  return gf_exp[gf_log[x] + gf_log[y]];
+}
+
+static uint8_t
+gf_inv(uint8_t x) {
+  CHECK(x != 0);
+  return gf_exp[255 - gf_log[x]];
+}
+
+static void
+gf_mul_add(uint8_t *zp, const uint8_t *xp, uint8_t c, size_t size) {
+  /* zp += xp * c */
+  uint8_t row[256];
+  size_t i;
+
+  if (c == 0)
+    return;
+
+  for (i = 0; i < 256; i++)
+    row[i] = gf_mul((uint8_t)i, c);
+
+  for (i = 0; i < size; i++)
+    zp[i] ^= row[xp[i]];
+}
+
+static uint8_t
+gf_cauchy(size_t row, size_t col) {
+  return gf_inv((uint8_t)(row ^ col));
+}
+
+static int
+gf_invert(uint8_t *mat, size_t n) {
+  /* Gauss-Jordan elimination in place. */
+  uint8_t *tmp = (uint8_t *)btc_malloc(n * n);
+  size_t i, j, r;
+
+  memset(tmp, 0, n * n);
+
+  for (i = 0; i < n; i++)
+    tmp[i * n + i] = 1;
+
+  for (i = 0; i < n; i++) {
+    uint8_t c;
+
+    for (r = i; r < n; r++) {
+      if (mat[r * n + i] != 0)
+        break;
+    }
+
+    if (r == n) {
+      btc_free(tmp);
+      return 0;
+    }
+
+    if (r != i) {
+      for (j = 0; j < n; j++) {
+        uint8_t t;
+
+        t = mat[i * n + j];
+        mat[i * n + j] = mat[r * n + j];
+        mat[r * n + j] = t;
+
+        t = tmp[i * n + j];
+        tmp[i * n + j] = tmp[r * n + j];
+        tmp[r * n + j] = t;
+      }
+    }
+
+    c = gf_inv(mat[i * n + i]);
+
+    for (j = 0; j < n; j++) {
+      mat[i * n + j] = gf_mul(mat[i * n + j], c);
+      tmp[i * n + j] = gf_mul(tmp[i * n + j], c);
+    }
+
+    for (r = 0; r < n; r++) {
+      if (r == i || mat[r * n + i] == 0)
+        continue;
+
+      c = mat[r * n + i];
+
+      for (j = 0; j < n; j++) {
+        mat[r * n + j] ^= gf_mul(mat[i * n + j], c);
+        tmp[r * n + j] ^= gf_mul(tmp[i * n + j], c);
+      }
+    }
+  }
+
+  memcpy(mat, tmp, n * n);
+
+  btc_free(tmp);
+
+  return 1;
+}
+
+/*
+ * FEC
+ */
+
+void
+btc_fec_encode(uint8_t *const *shards, size_t k, size_t m, size_t size) {
+  size_t i, j;
+
+  CHECK(k > 0 && k + m <= BTC_FEC_MAX_SHARDS);
+
+  for (i = 0; i < m; i++) {
+    uint8_t *parity = shards[k + i];
+
+    memset(parity, 0, size);
+
+    for (j = 0; j < k; j++)
+      gf_mul_add(parity, shards[j], gf_cauchy(k + i, j), size);
+  }
+}
+
+int
+btc_fec_decode(uint8_t *const *shards,
+               const uint8_t *present,
+               size_t k,
+               size_t m,
+               size_t size) {
+  size_t lost[BTC_FEC_MAX_SHARDS];
+  size_t rows[BTC_FEC_MAX_SHARDS];
+  size_t i, j, n, e = 0;
+  uint8_t *mat, *tmp;
+
+  CHECK(k > 0 && k + m <= BTC_FEC_MAX_SHARDS);
+
+  for (i = 0; i < k; i++) {
+    if (!present[i])
+      lost[e++] = i;
+  }
+
+  if (e == 0)
+    return 1;
+
+  for (i = 0, n = 0; i < m && n < e; i++) {
+    if (present[k + i])
+      rows[n++] = k + i;
+  }
+
+  if (n < e)
+    return 0;
+
+  /* Move the known data to the right-hand side:
+     tmp[r] = p[r] - sum(C[r][j] * d[j], j known). */
+  tmp = (uint8_t *)btc_malloc(e * size);
+
+  for (n = 0; n < e; n++) {
+    uint8_t *zp = tmp + n * size;
+
+    memcpy(zp, shards[rows[n]], size);
+
+    for (j = 0; j < k; j++) {
+      if (present[j])
+        gf_mul_add(zp, shards[j], gf_cauchy(rows[n], j), size);
+    }
+  }
+
+  /* What's left is C[rows][lost] * d[lost]. */
+  mat = (uint8_t *)btc_malloc(e * e);
+
+  for (n = 0; n < e; n++) {
+    for (j = 0; j < e; j++)
+      mat[n * e + j] = gf_cauchy(rows[n], lost[j]);
+  }
+
+  CHECK(gf_invert(mat, e));
+
+  for (j = 0; j < e; j++) {
+    uint8_t *zp = shards[lost[j]];
+
+    memset(zp, 0, size);
+
+    for (n = 0; n < e; n++)
+      gf_mul_add(zp, tmp + n * size, mat[j * e + n], size);
+  }
+
+  btc_free(mat);
+  btc_free(tmp);
+
+  return 1;
+}
@@ -10,6 +10,7 @@
 #include <mako/crypto/hash.h>
 #include <mako/header.h>
 #include <mako/util.h>
+#include "bio.h"
 #include "impl.h"
 #include "internal.h"
 
@@ -125,10 +126,11 @@ btc_header_verify(const btc_header_t *hdr) {
 
 int
 btc_header_mine(btc_header_t *hdr, uint32_t limit) {
-  btc_hash256_t pre, ctx;
-  uint32_t attempt = 0;
   uint8_t target[32];
   uint8_t hash[32];
+  btc_hash256_t pre;
+  uint32_t start, count, hi;
+  uint64_t left;
 
   CHECK(btc_compact_export(target, hdr->bits));
 
@@ -142,20 +144,31 @@ btc_header_mine(btc_header_t *hdr, uint32_t limit) {
   btc_time_update(&pre, hdr->time);
   btc_uint32_update(&pre, hdr->bits);
 
-  do {
-    ctx = pre;
+  /* The scanner filters on the high word only. */
+  hi = btc_read32le(target + 28);
 
-    btc_uint32_update(&ctx, hdr->nonce);
-    btc_hash256_final(&ctx, hash);
+  /* Stop when the nonce wraps around. */
+  left = ((uint64_t)1 << 32) - hdr->nonce;
+
+  if (limit != 0 && limit < left)
+    left = limit;
+
+  while (left > 0) {
+    start = hdr->nonce;
+    count = left > 0xffffffff ? 0xffffffff : (uint32_t)left;
+
+    if (!btc_sha256d80_scan(hash, &hdr->nonce, count, &pre, hi)) {
+      left -= count;
+      continue;
+    }
 
     if (btc_hash_compare(hash, target) <= 0)
       return 1;
 
-    hdr->nonce++;
+    left -= (uint32_t)(hdr->nonce - start) + 1;
 
-    if (++attempt == limit)
-      return 0;
-  } while (hdr->nonce != 0);
+    hdr->nonce++;
+  }
 
   return 0;
 }
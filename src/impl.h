@@ -384,6 +384,18 @@ STATIC_ASSERT(sizeof(void *) >= 4);
   }                                            \
 } while (0)
 
+BTC_UNUSED static void
+btc_tagged_init(btc_hash256_t *ctx, const char *tag) {
+  /* BIP340 tagged hash: sha256(sha256(tag) || sha256(tag) || ...). */
+  uint8_t hash[32];
+
+  btc_sha256(hash, tag, strlen(tag));
+
+  btc_sha256_init(ctx);
+  btc_sha256_update(ctx, hash, 32);
+  btc_sha256_update(ctx, hash, 32);
+}
+
 /*
  * Encoding
  */
@@ -983,7 +995,7 @@ BTC_UNUSED static uint8_t *
 btc_nullstr_write(uint8_t *zp, size_t zn, const char *xp) {
   size_t xn = strlen(xp);
 
-  CHECK(xn + 1 <= zn);
+  CHECK(xn <= zn);
 
   memcpy(zp, xp, xn);
 
@@ -995,6 +1007,8 @@ btc_nullstr_write(uint8_t *zp, size_t zn, const char *xp) {
 
 BTC_UNUSED static int
 btc_nullstr_read(char *zp, size_t zn, const uint8_t **xp, size_t *xn) {
+  /* The string may fill the whole field (e.g.
+     "getcfcheckpt"), so `zp` holds zn + 1 bytes. */
   size_t i;
 
   if (*xn < zn)
@@ -1010,9 +1024,6 @@ btc_nullstr_read(char *zp, size_t zn, const uint8_t **xp, size_t *xn) {
       return 0;
   }
 
-  if (i == zn)
-    return 0;
-
   for (; i < zn; i++) {
     int ch = (*xp)[i];
 
@@ -1022,6 +1033,8 @@ btc_nullstr_read(char *zp, size_t zn, const uint8_t **xp, size_t *xn) {
 
   memcpy(zp, *xp, zn);
 
+  zp[zn] = '\0';
+
   *xp += zn;
   *xn -= zn;
 
@@ -8,7 +8,9 @@
 #ifdef BTC_DEBUG
 #  include <stdio.h>
 #endif
+#include <stdint.h>
 #include <stdlib.h>
+#include <mako/util.h>
 #include "internal.h"
 
 /*
@@ -35,6 +37,224 @@ btc_abort(void) {
   abort(); /* LCOV_EXCL_LINE */
 }
 
+#ifdef BTC_MEMSTATS
+
+/*
+ * Memory Accounting
+ */
+
+/* Blocks are tracked in a side table keyed by their
+ * address rather than with a header, as plenty of
+ * callers hand our allocations to free() (and vice
+ * versa). A block freed behind our back is settled
+ * when its address is next handed out; a foreign
+ * pointer passed to btc_free is simply not found.
+ */
+
+#if !defined(__GNUC__)
+#  error "BTC_MEMSTATS requires GCC-style atomics."
+#endif
+
+#define MEM_BUCKETS (1 << 20)
+#define MEM_LOCKS (1 << 12)
+
+typedef struct mem_node_s {
+  void *ptr;
+  size_t size;
+  int tag;
+  struct mem_node_s *next;
+} mem_node_t;
+
+#ifdef BTC_TLS
+static BTC_TLS int mem_tag = BTC_MEMTAG_OTHER;
+#else
+static int mem_tag = BTC_MEMTAG_OTHER;
+#endif
+
+static mem_node_t *mem_table[MEM_BUCKETS];
+static volatile int mem_locks[MEM_LOCKS];
+static volatile int64_t mem_bytes[BTC_MEMTAG_MAX];
+static volatile int64_t mem_count[BTC_MEMTAG_MAX];
+
+static uint32_t
+mem_hash(void *ptr) {
+  uint64_t x = (uint64_t)(size_t)ptr;
+
+  x ^= x >> 33;
+  x *= UINT64_C(0xff51afd7ed558ccd);
+  x ^= x >> 33;
+
+  return (uint32_t)x;
+}
+
+static void
+mem_lock(uint32_t hash) {
+  volatile int *lock = &mem_locks[hash & (MEM_LOCKS - 1)];
+
+  while (__sync_lock_test_and_set(lock, 1)) {
+    while (*lock)
+      ;
+  }
+}
+
+static void
+mem_unlock(uint32_t hash) {
+  __sync_lock_release(&mem_locks[hash & (MEM_LOCKS - 1)]);
+}
+
+static void
+mem_add(int tag, int64_t bytes, int64_t count) {
+  __sync_fetch_and_add(&mem_bytes[tag], bytes);
+  __sync_fetch_and_add(&mem_count[tag], count);
+}
+
+static void
+mem_track(void *ptr, size_t size, int tag) {
+  uint32_t hash = mem_hash(ptr);
+  mem_node_t **bucket = &mem_table[hash & (MEM_BUCKETS - 1)];
+  mem_node_t *node;
+
+  mem_lock(hash);
+
+  for (node = *bucket; node != NULL; node = node->next) {
+    if (node->ptr == ptr)
+      break;
+  }
+
+  if (node != NULL) {
+    /* The last block here went to free() directly. */
+    mem_add(node->tag, -(int64_t)node->size, -1);
+  } else {
+    node = malloc(sizeof(mem_node_t));
+
+    if (node == NULL)
+      abort(); /* LCOV_EXCL_LINE */
+
+    node->ptr = ptr;
+    node->next = *bucket;
+
+    *bucket = node;
+  }
+
+  node->size = size;
+  node->tag = tag;
+
+  mem_unlock(hash);
+
+  mem_add(tag, size, 1);
+}
+
+static int
+mem_untrack(void *ptr) {
+  uint32_t hash = mem_hash(ptr);
+  mem_node_t **link = &mem_table[hash & (MEM_BUCKETS - 1)];
+  mem_node_t *node;
+  int tag = -1;
+
+  mem_lock(hash);
+
+  while ((node = *link) != NULL) {
+    if (node->ptr == ptr) {
+      *link = node->next;
+      break;
+    }
+    link = &node->next;
+  }
+
+  mem_unlock(hash);
+
+  if (node != NULL) {
+    tag = node->tag;
+    mem_add(tag, -(int64_t)node->size, -1);
+    free(node);
+  }
+
+  return tag;
+}
+
+int
+btc_memtag_swap(int tag) {
+  int old = mem_tag;
+
+  if (tag < 0 || tag >= BTC_MEMTAG_MAX)
+    abort(); /* LCOV_EXCL_LINE */
+
+  mem_tag = tag;
+
+  return old;
+}
+
+int
+btc_memstats(btc_memstat_t *stats) {
+  int i;
+
+  for (i = 0; i < BTC_MEMTAG_MAX; i++) {
+    stats[i].bytes = mem_bytes[i];
+    stats[i].count = mem_count[i];
+  }
+
+  return 1;
+}
+
+BTC_MALLOC void *
+btc_malloc(size_t size) {
+  void *ptr = malloc(size);
+
+  if (ptr == NULL)
+    abort(); /* LCOV_EXCL_LINE */
+
+  mem_track(ptr, size, mem_tag);
+
+  return ptr;
+}
+
+BTC_MALLOC void *
+btc_realloc(void *ptr, size_t size) {
+  int tag = -1;
+
+  /* A block keeps the tag it was first charged to. */
+  if (ptr != NULL)
+    tag = mem_untrack(ptr);
+
+  if (tag < 0)
+    tag = mem_tag;
+
+  ptr = realloc(ptr, size);
+
+  if (ptr == NULL)
+    abort(); /* LCOV_EXCL_LINE */
+
+  mem_track(ptr, size, tag);
+
+  return ptr;
+}
+
+void
+btc_free(void *ptr) {
+  if (ptr == NULL) {
+    abort(); /* LCOV_EXCL_LINE */
+    return;
+  }
+
+  mem_untrack(ptr);
+
+  free(ptr);
+}
+
+#else /* !BTC_MEMSTATS */
+
+int
+btc_memtag_swap(int tag) {
+  (void)tag;
+  return BTC_MEMTAG_OTHER;
+}
+
+int
+btc_memstats(btc_memstat_t *stats) {
+  (void)stats;
+  return 0;
+}
+
 BTC_MALLOC void *
 btc_malloc(size_t size) {
   void *ptr = malloc(size);
@@ -64,3 +284,26 @@ btc_free(void *ptr) {
 
   free(ptr);
 }
+
+#endif /* !BTC_MEMSTATS */
+
+const char *
+btc_memtag_name(int tag) {
+  switch (tag) {
+    case BTC_MEMTAG_OTHER:
+      return "other";
+    case BTC_MEMTAG_CHAIN:
+      return "chain";
+    case BTC_MEMTAG_COINS:
+      return "coins";
+    case BTC_MEMTAG_MEMPOOL:
+      return "mempool";
+    case BTC_MEMTAG_ORPHANS:
+      return "orphans";
+    case BTC_MEMTAG_NET:
+      return "net";
+    case BTC_MEMTAG_RPC:
+      return "rpc";
+  }
+  return "unknown";
+}
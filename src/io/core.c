@@ -85,6 +85,9 @@ btc_fs_alloc_file(unsigned char **dst, size_t *len, const char *name) {
   if (!btc_fs_read(fd, xp, xn))
     goto fail;
 
+  /* Read once: keep it from crowding the page cache. */
+  btc_fs_fadvise(fd, 0, 0, BTC_ADVISE_DONTNEED);
+
   *dst = xp;
   *len = xn;
 
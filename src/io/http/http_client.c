@@ -33,6 +33,12 @@ struct http_client {
   int last_was_value;
   size_t total_buffered;
   int done;
+  int complete;
+  int began;
+  int64_t timeout;
+  int64_t idle;
+  int64_t last;
+  int requests;
 };
 
 /*
@@ -114,6 +120,16 @@ http_client_strerror(http_client_t *client) {
   return btc_loop_strerror(client->loop);
 }
 
+void
+http_client_set_timeout(http_client_t *client, int64_t msec) {
+  client->timeout = msec;
+}
+
+void
+http_client_set_idle(http_client_t *client, int64_t msec) {
+  client->idle = msec;
+}
+
 static void
 on_connect(btc_socket_t *socket) {
   http_client_t *client = btc_socket_get_data(socket);
@@ -123,6 +139,11 @@ on_connect(btc_socket_t *socket) {
 static void
 on_close(btc_socket_t *socket) {
   http_client_t *client = btc_socket_get_data(socket);
+
+  /* May be a connection we already dropped. */
+  if (socket != client->socket)
+    return;
+
   client->socket = NULL;
   client->connected = 0;
   client->done = 1;
@@ -136,8 +157,12 @@ on_error(btc_socket_t *socket) {
 static int
 on_data(btc_socket_t *socket, const void *data, size_t size) {
   http_client_t *client = btc_socket_get_data(socket);
+  size_t nparsed;
 
-  size_t nparsed = http_parser_execute(&client->parser,
+  if (socket != client->socket)
+    return 1;
+
+  nparsed = http_parser_execute(&client->parser,
                                        &client->settings,
                                        data,
                                        size);
@@ -216,6 +241,9 @@ http_client_connect(http_client_t *client, const btc_sockaddr_t *addr) {
   btc_socket_on_data(socket, on_data);
 
   client->socket = socket;
+  client->connected = 0;
+  client->requests = 0;
+  client->last = btc_time_msec();
 
   btc_socket_complete(socket);
 
@@ -255,17 +283,23 @@ http_client_reopen(http_client_t *client) {
   return http_client_connect(client, &client->addr);
 }
 
-void
-http_client_close(http_client_t *client) {
+static void
+http_client_drop(http_client_t *client) {
   if (client->socket != NULL)
     btc_socket_close(client->socket);
 
+  client->socket = NULL;
+  client->connected = 0;
+}
+
+void
+http_client_close(http_client_t *client) {
+  http_client_drop(client);
+
   client->hostname[0] = '\0';
   client->port = 0;
 
   btc_sockaddr_init(&client->addr);
-
-  client->connected = 0;
 }
 
 static void
@@ -277,6 +311,7 @@ http_client_reset(http_client_t *client) {
   client->last_was_value = 0;
   client->total_buffered = 0;
   client->done = 0;
+  client->complete = 0;
 }
 
 static int
@@ -293,6 +328,7 @@ on_message_begin(struct http_parser *parser) {
   http_client_reset(client);
 
   client->msg = http_msg_create();
+  client->began = 1;
 
   return 0;
 }
@@ -389,6 +425,11 @@ on_message_complete(struct http_parser *parser) {
   http_client_t *client = parser->data;
 
   client->done = 1;
+  client->complete = 1;
+
+  /* The server won't take another request. */
+  if (!http_should_keep_alive(parser))
+    http_client_drop(client);
 
   return 0;
 }
@@ -422,6 +463,12 @@ http_client_init(http_client_t *client) {
   client->last_was_value = 0;
   client->total_buffered = 0;
   client->done = 0;
+  client->complete = 0;
+  client->began = 0;
+  client->timeout = HTTP_CLIENT_TIMEOUT;
+  client->idle = HTTP_CLIENT_IDLE;
+  client->last = 0;
+  client->requests = 0;
 }
 
 static int
@@ -543,15 +590,14 @@ http_client_write_head(http_client_t *client, const http_options_t *opt) {
   return http_client_write(client, head, zp - head);
 }
 
-http_msg_t *
-http_client_request(http_client_t *client, const http_options_t *options) {
+static http_msg_t *
+http_client_send(http_client_t *client,
+                 const http_options_t *options,
+                 int *closed) {
   http_msg_t *msg = NULL;
   int64_t start;
 
-  if (client->socket == NULL) {
-    if (!http_client_reopen(client))
-      return NULL;
-  }
+  *closed = 0;
 
   if (!http_client_write_head(client, options))
     return NULL;
@@ -563,15 +609,27 @@ http_client_request(http_client_t *client, const http_options_t *options) {
 
   http_client_reset(client);
 
+  client->began = 0;
+
   start = btc_time_msec();
 
   while (!client->done) {
-    if (btc_time_msec() > start + 10 * 1000)
+    if (btc_time_msec() > start + client->timeout) {
+      /* A late response must not be read as
+         the answer to the next request. */
+      http_client_drop(client);
       goto fail;
+    }
 
     btc_loop_poll(client->loop, 1000);
   }
 
+  /* Closed before (or while) responding. */
+  if (!client->complete) {
+    *closed = !client->began && client->socket == NULL;
+    goto fail;
+  }
+
   msg = client->msg;
 
   client->msg = NULL;
@@ -581,6 +639,45 @@ fail:
   return msg;
 }
 
+http_msg_t *
+http_client_request(http_client_t *client, const http_options_t *options) {
+  int64_t now = btc_time_msec();
+  http_msg_t *msg;
+  int closed;
+  int reused;
+
+  /* Servers tend to drop idle keep-alive
+     connections. Don't bother with them. */
+  if (client->socket != NULL && now > client->last + client->idle)
+    http_client_drop(client);
+
+  if (client->socket == NULL) {
+    if (!http_client_reopen(client))
+      return NULL;
+  }
+
+  reused = client->requests > 0;
+
+  msg = http_client_send(client, options, &closed);
+
+  /* The server may have closed the connection
+     just as we reused it. Retry once on a fresh
+     one if nothing at all came back. */
+  if (msg == NULL && closed && reused) {
+    if (!http_client_reopen(client))
+      return NULL;
+
+    msg = http_client_send(client, options, &closed);
+  }
+
+  if (msg != NULL && client->socket != NULL) {
+    client->requests += 1;
+    client->last = btc_time_msec();
+  }
+
+  return msg;
+}
+
 http_msg_t *
 http_get(const char *hostname, int port, const char *path, int family) {
   http_client_t *client = http_client_create();
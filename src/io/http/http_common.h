@@ -16,6 +16,10 @@
  */
 
 #define HTTP_MAX_BUFFER (20 << 20)
+#define HTTP_STREAM_BUFFER (1 << 20)
+#define HTTP_MAX_QUEUE 16
+#define HTTP_CLIENT_TIMEOUT (10 * 1000)
+#define HTTP_CLIENT_IDLE (30 * 1000)
 #define HTTP_MAX_FIELD_SIZE (1 << 10)
 #define HTTP_MAX_HEADERS 100
 
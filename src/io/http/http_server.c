@@ -27,6 +27,9 @@ typedef struct http_conn_s {
   struct http_parser parser;
   struct http_parser_settings settings;
   http_req_t *req;
+  http_res_t *res;
+  http_req_t *queue[HTTP_MAX_QUEUE];
+  int queued;
   int last_was_value;
   size_t total_buffered;
 } http_conn_t;
@@ -86,10 +89,16 @@ static void
 http_res_init(http_res_t *res, btc_socket_t *socket) {
   res->socket = socket;
   http_head_init(&res->headers);
+  res->stream = NULL;
+  res->free_cb = NULL;
+  res->arg = NULL;
 }
 
 static void
 http_res_clear(http_res_t *res) {
+  if (res->free_cb != NULL)
+    res->free_cb(res->arg);
+
   http_head_clear(&res->headers);
 }
 
@@ -107,9 +116,7 @@ http_res_destroy(http_res_t *res) {
 }
 
 static int
-http_res_write(http_res_t *res, void *data, size_t size) {
-  int rc = btc_socket_write(res->socket, data, size);
-
+http_res_check(http_res_t *res, int rc) {
   if (rc == -1) {
     btc_socket_close(res->socket);
     return 0;
@@ -125,6 +132,11 @@ http_res_write(http_res_t *res, void *data, size_t size) {
   return 1;
 }
 
+static int
+http_res_write(http_res_t *res, void *data, size_t size) {
+  return http_res_check(res, btc_socket_write(res->socket, data, size));
+}
+
 static int
 http_res_put(http_res_t *res, const char *str, size_t len) {
   void *data;
@@ -211,7 +223,12 @@ http_res_write_head(http_res_t *res,
     zp += sprintf(zp, "Date: %s\r\n", date);
 
   zp += sprintf(zp, "Content-Type: %s\r\n", type);
-  zp += sprintf(zp, "Content-Length: %lu\r\n", length);
+
+  if (length == (unsigned long)-1)
+    zp += sprintf(zp, "Transfer-Encoding: chunked\r\n");
+  else
+    zp += sprintf(zp, "Content-Length: %lu\r\n", length);
+
   zp += sprintf(zp, "Connection: keep-alive\r\n");
 
   for (i = 0; i < res->headers.length; i++) {
@@ -247,6 +264,26 @@ http_res_send_data(http_res_t *res,
   http_res_write(res, body, length);
 }
 
+void
+http_res_send_shared(http_res_t *res,
+                     unsigned int status,
+                     const char *type,
+                     const void *body,
+                     size_t length,
+                     http_stream_free_cb *free_cb,
+                     void *arg) {
+  /* The body is sent without a copy. `free_cb(arg)`
+     runs once the socket is done with it (`free(arg)`
+     if `free_cb` is NULL). */
+  int rc;
+
+  http_res_write_head(res, status, type, length);
+
+  rc = btc_socket_write_shared(res->socket, body, length, free_cb, arg);
+
+  http_res_check(res, rc);
+}
+
 void
 http_res_error(http_res_t *res, unsigned int status) {
   char body[33];
@@ -256,6 +293,63 @@ http_res_error(http_res_t *res, unsigned int status) {
   http_res_send(res, status, "text/plain", body);
 }
 
+void
+http_res_stream(http_res_t *res,
+                unsigned int status,
+                const char *type,
+                http_stream_cb *stream,
+                http_stream_free_cb *free_cb,
+                void *arg) {
+  /* The body is pulled from `stream` as the socket
+     drains. It returns zero once it has written its
+     last chunk (-1 on failure), after which `free_cb`
+     is called. */
+  http_res_write_head(res, status, type, (unsigned long)-1);
+
+  res->stream = stream;
+  res->free_cb = free_cb;
+  res->arg = arg;
+}
+
+int
+http_res_chunk(http_res_t *res, const void *data, size_t length) {
+  char *chunk, *zp;
+
+  if (length == 0)
+    return 1;
+
+  chunk = http_malloc(16 + 2 + length + 2);
+  zp = chunk;
+
+  zp += sprintf(zp, "%lx\r\n", (unsigned long)length);
+
+  memcpy(zp, data, length);
+  zp += length;
+
+  *zp++ = '\r';
+  *zp++ = '\n';
+
+  /* Buffering is bounded by the pump, not HTTP_MAX_BUFFER. */
+  if (btc_socket_write(res->socket, chunk, zp - chunk) == -1) {
+    btc_socket_close(res->socket);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void
+http_res_finish(http_res_t *res) {
+  http_res_put(res, "0\r\n\r\n", 5);
+
+  if (res->free_cb != NULL)
+    res->free_cb(res->arg);
+
+  res->stream = NULL;
+  res->free_cb = NULL;
+  res->arg = NULL;
+}
+
 /*
  * Connection
  */
@@ -263,10 +357,19 @@ http_res_error(http_res_t *res, unsigned int status) {
 static void
 http_conn_init(http_conn_t *conn, http_server_t *server);
 
+static void
+http_conn_unstream(http_conn_t *conn);
+
 static void
 http_conn_clear(http_conn_t *conn) {
   if (conn->req != NULL)
     http_req_destroy(conn->req);
+
+  if (conn->res != NULL)
+    http_conn_unstream(conn);
+
+  while (conn->queued > 0)
+    http_req_destroy(conn->queue[--conn->queued]);
 }
 
 static http_conn_t *
@@ -296,6 +399,74 @@ http_conn_abort(http_conn_t *conn) {
   return 1;
 }
 
+static void
+http_conn_next(http_conn_t *conn);
+
+static void
+http_conn_pump(http_conn_t *conn) {
+  http_res_t *res = conn->res;
+  size_t buffered;
+  int rc;
+
+  /* Keep roughly HTTP_STREAM_BUFFER bytes queued on the
+     socket; the rest of the body is produced on demand. */
+  while ((buffered = btc_socket_buffered(conn->socket)) < HTTP_STREAM_BUFFER) {
+    rc = res->stream(res, res->arg);
+
+    if (rc <= 0) {
+      if (rc == 0)
+        http_res_finish(res);
+
+      http_conn_unstream(conn);
+
+      if (rc == 0)
+        http_conn_next(conn);
+
+      break;
+    }
+
+    /* Nothing ready yet (produced elsewhere). */
+    if (btc_socket_buffered(conn->socket) == buffered)
+      break;
+  }
+}
+
+static void
+on_stream_tick(void *data) {
+  http_conn_pump(data);
+}
+
+static void
+on_drain(btc_socket_t *socket) {
+  http_conn_t *conn = btc_socket_get_data(socket);
+
+  if (conn->res != NULL)
+    http_conn_pump(conn);
+}
+
+static void
+http_conn_stream(http_conn_t *conn, http_res_t *res) {
+  btc_loop_t *loop = conn->server->loop;
+
+  conn->res = res;
+
+  /* A fully flushed socket never drains, so
+     the loop tick also refills the buffer. */
+  btc_loop_on_tick(loop, on_stream_tick, conn);
+  btc_socket_on_drain(conn->socket, on_drain);
+
+  http_conn_pump(conn);
+}
+
+static void
+http_conn_unstream(http_conn_t *conn) {
+  btc_loop_off_tick(conn->server->loop, on_stream_tick, conn);
+
+  http_res_destroy(conn->res);
+
+  conn->res = NULL;
+}
+
 static void
 on_close(btc_socket_t *socket) {
   http_conn_t *conn = btc_socket_get_data(socket);
@@ -441,30 +612,70 @@ on_body(struct http_parser *parser, const char *at, size_t length) {
   return 0;
 }
 
+static int
+http_conn_dispatch(http_conn_t *conn, http_req_t *req) {
+  http_server_t *server = conn->server;
+  http_res_t *res = http_res_create(conn->socket);
+
+  if (server->on_request != NULL) {
+    if (!server->on_request(server, req, res)) {
+      http_req_destroy(req);
+      http_res_destroy(res);
+      btc_socket_close(conn->socket);
+      return 0;
+    }
+  }
+
+  http_req_destroy(req);
+
+  if (res->stream != NULL)
+    http_conn_stream(conn, res);
+  else
+    http_res_destroy(res);
+
+  return 1;
+}
+
+static void
+http_conn_next(http_conn_t *conn) {
+  http_req_t *req;
+
+  while (conn->res == NULL && conn->queued > 0) {
+    req = conn->queue[0];
+
+    conn->queued--;
+
+    memmove(conn->queue, conn->queue + 1, conn->queued * sizeof(req));
+
+    if (!http_conn_dispatch(conn, req))
+      break;
+  }
+}
+
 static int
 on_message_complete(struct http_parser *parser) {
   http_conn_t *conn = parser->data;
-  http_server_t *server = conn->server;
   http_req_t *req = conn->req;
-  http_res_t *res = http_res_create(conn->socket);
 
   conn->req = NULL;
   conn->last_was_value = 0;
   conn->total_buffered = 0;
 
-  if (server->on_request != NULL) {
-    if (!server->on_request(server, req, res)) {
+  /* Requests pipelined behind a streamed response
+     wait their turn. Too many closes the connection. */
+  if (conn->res != NULL) {
+    if (conn->queued == HTTP_MAX_QUEUE) {
       http_req_destroy(req);
-      http_res_destroy(res);
       btc_socket_close(conn->socket);
       return 1;
     }
-  }
 
-  http_req_destroy(req);
-  http_res_destroy(res);
+    conn->queue[conn->queued++] = req;
 
-  return 0;
+    return 0;
+  }
+
+  return !http_conn_dispatch(conn, req);
 }
 
 static void
@@ -489,6 +700,8 @@ http_conn_init(http_conn_t *conn, http_server_t *server) {
   conn->settings.on_chunk_complete = NULL;
 
   conn->req = NULL;
+  conn->res = NULL;
+  conn->queued = 0;
   conn->last_was_value = 0;
   conn->total_buffered = 0;
 }
@@ -28,6 +28,7 @@
 #    include <sys/select.h>
 #  endif
 #  include <sys/socket.h>
+#  include <sys/uio.h>
 #  include <netinet/in.h>
 #  include <netinet/tcp.h>
 #  include <arpa/inet.h>
@@ -62,6 +63,8 @@ typedef signed __int64 btc_msec_t;
 #  define BTC_EAFNOSUPPORT WSAEAFNOSUPPORT
 #  define BTC_ENOBUFS WSAENOBUFS
 #  define BTC_EISCONN WSAEISCONN
+#  define BTC_ECONNREFUSED WSAECONNREFUSED
+#  define BTC_ECONNABORTED WSAECONNABORTED
 #  define btc_closesocket closesocket
 #  define btc_retry_connect(x) ((x) == WSAEWOULDBLOCK || (x) == WSAEALREADY)
 #else
@@ -87,6 +90,8 @@ typedef long long btc_msec_t;
 #  define BTC_EAFNOSUPPORT EAFNOSUPPORT
 #  define BTC_ENOBUFS ENOBUFS
 #  define BTC_EISCONN EISCONN
+#  define BTC_ECONNREFUSED ECONNREFUSED
+#  define BTC_ECONNABORTED ECONNABORTED
 #  define btc_closesocket close
 #  define btc_retry_connect(x) ((x) == EAGAIN      \
                              || (x) == EWOULDBLOCK \
@@ -100,9 +105,13 @@ typedef long long btc_msec_t;
 
 #if !defined(BTC_USE_SELECT) \
  && !defined(BTC_USE_POLL)   \
- && !defined(BTC_USE_EPOLL)
+ && !defined(BTC_USE_EPOLL)  \
+ && !defined(BTC_USE_KQUEUE)
 #  if defined(__linux__)
 #    define BTC_USE_EPOLL
+#  elif defined(__APPLE__) || defined(__FreeBSD__) \
+     || defined(__OpenBSD__) || defined(__DragonFly__)
+#    define BTC_USE_KQUEUE
 #  elif defined(_WIN32) || defined(_AIX)
 #    define BTC_USE_SELECT
 #  else
@@ -112,6 +121,9 @@ typedef long long btc_msec_t;
 
 #if defined(BTC_USE_EPOLL)
 #  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#elif defined(BTC_USE_KQUEUE)
+#  include <sys/event.h>
 #elif defined(BTC_USE_POLL)
 #  include <poll.h>
 #else
@@ -120,10 +132,20 @@ typedef long long btc_msec_t;
 
 #if (defined(BTC_USE_SELECT) \
    + defined(BTC_USE_POLL)   \
-   + defined(BTC_USE_EPOLL)) != 1
+   + defined(BTC_USE_EPOLL)  \
+   + defined(BTC_USE_KQUEUE)) != 1
 #  error "more than one backend selected"
 #endif
 
+#if defined(__linux__)
+#  include <sys/sendfile.h>
+#  define BTC_SENDFILE_LINUX
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+#  define BTC_SENDFILE_BSD
+#elif defined(__APPLE__)
+#  define BTC_SENDFILE_APPLE
+#endif
+
 /*
  * Macros
  */
@@ -131,6 +153,17 @@ typedef long long btc_msec_t;
 #define CHECK(x) do { if (!(x)) abort(); } while (0)
 #define lengthof(x) (sizeof(x) / sizeof((x)[0]))
 
+/* Milliseconds between tick callbacks when idle. */
+#define BTC_LOOP_TICK 25
+
+/* Timer wheel: four levels of 64 one-millisecond
+   slots reach about 4.6 hours before clamping. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN ((int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
 #define btc_list_init(q) do { \
   (q)->head = NULL;           \
   (q)->tail = NULL;           \
@@ -196,6 +229,15 @@ typedef long long btc_msec_t;
  * Constants
  */
 
+/* Chunks per vectored write (UIO_MAXIOV on linux and
+   the BSDs, otherwise the lowest POSIX allows). */
+#if defined(_WIN32) || defined(__linux__) || defined(__APPLE__) \
+ || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#  define MAX_IOVS 1024
+#else
+#  define MAX_IOVS 16
+#endif
+
 enum btc_socket_state {
   BTC_SOCKET_DISCONNECTED,
   BTC_SOCKET_CONNECTING,
@@ -211,11 +253,19 @@ enum btc_socket_state {
 typedef struct chunk_s {
   struct sockaddr *addr;
   void *ptr;
+  btc_socket_free_cb *free_cb;
   unsigned char *raw;
+  int file;
+  int64_t offset;
   size_t len;
   struct chunk_s *next;
 } chunk_t;
 
+typedef struct socks_s {
+  unsigned char data[272];
+  size_t length;
+} socks_t;
+
 struct btc_socket_s {
   struct btc_loop_s *loop;
   struct sockaddr_storage storage;
@@ -229,6 +279,10 @@ struct btc_socket_s {
   chunk_t *tail;
   size_t total;
   int draining;
+  int writable;
+  int pending;
+  struct btc_socket_s *pending_next;
+  socks_t *socks;
   btc_socket_socket_cb *on_socket;
   btc_socket_connect_cb *on_connect;
   btc_socket_close_cb *on_close;
@@ -241,6 +295,16 @@ struct btc_socket_s {
   struct btc_socket_s *next;
 };
 
+struct btc_timer_s {
+  struct btc_loop_s *loop;
+  btc_timer_cb *handler;
+  void *data;
+  int64_t expires;
+  struct btc_timer_s **slot;
+  struct btc_timer_s *prev;
+  struct btc_timer_s *next;
+};
+
 typedef struct btc_tick_s {
   btc_loop_tick_cb *handler;
   void *data;
@@ -256,6 +320,13 @@ struct btc_loop_s {
   btc_socket_t *head;
   btc_socket_t *tail;
   size_t length;
+#elif defined(BTC_USE_KQUEUE)
+  int fd;
+  struct kevent *events;
+  int max;
+  btc_socket_t *head;
+  btc_socket_t *tail;
+  size_t length;
 #elif defined(BTC_USE_POLL)
   struct pollfd *pfds;
   btc_socket_t **sockets;
@@ -263,7 +334,7 @@ struct btc_loop_s {
   size_t length;
   size_t index;
 #else
-  fd_set fds;
+  fd_set fds, ofds;
   fd_set rfds, wfds;
 #if defined(_WIN32)
   fd_set efds;
@@ -278,6 +349,12 @@ struct btc_loop_s {
 #ifdef _WIN32
   char errmsg[256];
 #endif
+  btc_sockfd_t waker[2];
+  btc_socket_t *pending;
+  int64_t busy;
+  int64_t spin;
+  int64_t active;
+  int64_t ticked;
   struct btc_closed_queue {
     btc_socket_t *head;
     btc_socket_t *tail;
@@ -288,6 +365,11 @@ struct btc_loop_s {
     btc_tick_t *tail;
     size_t length;
   } ticks;
+  struct btc_wheel {
+    btc_timer_t *slots[WHEEL_LEVELS][WHEEL_SIZE];
+    int64_t now; /* next millisecond to run */
+    size_t length;
+  } wheel;
   int error;
   int running;
 };
@@ -554,6 +636,227 @@ safe_epoll_create(void) {
 }
 #endif
 
+/*
+ * Kqueue Helpers
+ */
+
+#ifdef BTC_USE_KQUEUE
+static int
+safe_kqueue_create(void) {
+  int fd = kqueue();
+
+  if (fd != -1)
+    set_cloexec(fd);
+
+  return fd;
+}
+
+static int
+safe_kevent(int kq, int fd, int filter, int flags, void *data) {
+  struct kevent change;
+  int rc;
+
+  EV_SET(&change, fd, filter, flags, 0, 0, data);
+
+  do {
+    rc = kevent(kq, &change, 1, NULL, 0, NULL);
+  } while (rc == -1 && errno == EINTR);
+
+  return rc;
+}
+#endif
+
+/*
+ * Waker
+ */
+
+static void
+waker_open(btc_sockfd_t *fds) {
+#if defined(BTC_USE_EPOLL)
+#if defined(EFD_CLOEXEC) && defined(EFD_NONBLOCK)
+  fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#else
+  fds[0] = -1;
+#endif
+
+  if (fds[0] == -1) {
+    fds[0] = eventfd(0, 0);
+
+    CHECK(fds[0] != -1);
+
+    set_nonblocking(fds[0]);
+    set_cloexec(fds[0]);
+  }
+
+  fds[1] = fds[0];
+#elif defined(_WIN32)
+  /* Only sockets can be selected on. */
+  struct sockaddr_in sin;
+  btc_socklen_t len = sizeof(sin);
+
+  memset(&sin, 0, sizeof(sin));
+
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin.sin_port = 0;
+
+  fds[0] = socket(AF_INET, SOCK_DGRAM, 0);
+
+  CHECK(fds[0] != BTC_INVALID_SOCKET);
+  CHECK(bind(fds[0], (struct sockaddr *)&sin, len) == 0);
+  CHECK(getsockname(fds[0], (struct sockaddr *)&sin, &len) == 0);
+  CHECK(connect(fds[0], (struct sockaddr *)&sin, len) == 0);
+  CHECK(set_nonblocking(fds[0]) != BTC_SOCKET_ERROR);
+
+  fds[1] = fds[0];
+#else
+  CHECK(pipe(fds) == 0);
+
+  set_nonblocking(fds[0]);
+  set_nonblocking(fds[1]);
+  set_cloexec(fds[0]);
+  set_cloexec(fds[1]);
+#endif
+}
+
+static void
+waker_close(btc_sockfd_t *fds) {
+  btc_closesocket(fds[0]);
+
+  if (fds[1] != fds[0])
+    btc_closesocket(fds[1]);
+}
+
+static void
+waker_signal(btc_sockfd_t *fds) {
+  /* A full pipe or a saturated counter is
+     already readable, so failure is fine. */
+#if defined(BTC_USE_EPOLL)
+  uint64_t val = 1;
+  ssize_t ret;
+
+  do {
+    ret = write(fds[1], &val, sizeof(val));
+  } while (ret == -1 && errno == EINTR);
+#elif defined(_WIN32)
+  char val = 1;
+
+  send(fds[1], &val, 1, 0);
+#else
+  unsigned char val = 1;
+  ssize_t ret;
+
+  do {
+    ret = write(fds[1], &val, sizeof(val));
+  } while (ret == -1 && errno == EINTR);
+#endif
+}
+
+static void
+waker_drain(btc_sockfd_t *fds) {
+#if defined(_WIN32)
+  char buf[64];
+  int ret;
+
+  do {
+    ret = recv(fds[0], buf, sizeof(buf), 0);
+  } while (ret > 0);
+#else
+  unsigned char buf[64];
+  ssize_t ret;
+
+  do {
+    ret = read(fds[0], buf, sizeof(buf));
+  } while (ret > 0 || (ret == -1 && errno == EINTR));
+#endif
+}
+
+/*
+ * Chunk
+ */
+
+static void
+chunk_release(void *ptr, btc_socket_free_cb *free_cb) {
+  if (free_cb != NULL)
+    free_cb(ptr);
+  else if (ptr != NULL)
+    free(ptr);
+}
+
+static void
+chunk_destroy(chunk_t *chunk) {
+  if (chunk->addr != NULL)
+    free(chunk->addr);
+
+  chunk_release(chunk->ptr, chunk->free_cb);
+
+  free(chunk);
+}
+
+static int
+chunk_sendfile(btc_sockfd_t fd, const chunk_t *chunk, size_t *sent) {
+  /* Returns zero or an error code. */
+#if defined(BTC_SENDFILE_LINUX)
+  off_t pos = chunk->offset;
+  ssize_t len = sendfile(fd, chunk->file, &pos, chunk->len);
+
+  if (len < 0)
+    return btc_errno;
+
+  /* The file ended early. */
+  if (len == 0)
+    return BTC_EINVAL;
+
+  *sent = len;
+
+  return 0;
+#elif defined(BTC_SENDFILE_BSD) || defined(BTC_SENDFILE_APPLE)
+  int rc, error;
+#if defined(BTC_SENDFILE_BSD)
+  off_t len = 0;
+
+  rc = sendfile(chunk->file, fd, chunk->offset, chunk->len, NULL, &len, 0);
+#else
+  off_t len = chunk->len;
+
+  rc = sendfile(chunk->file, fd, chunk->offset, &len, NULL, 0);
+#endif
+
+  error = btc_errno;
+
+  /* A partial write fails with EAGAIN; count it. */
+  if (rc != 0 && len == 0)
+    return error;
+
+  if (len == 0)
+    return BTC_EINVAL;
+
+  *sent = len;
+
+  return 0;
+#else
+  /* No sendfile(2): bounce through a small buffer. */
+  unsigned char buf[16384];
+  size_t len = chunk->len;
+  int rc;
+
+  if (len > sizeof(buf))
+    len = sizeof(buf);
+
+  if (!btc_fs_pread(chunk->file, buf, len, chunk->offset))
+    return BTC_EINVAL;
+
+  rc = send(fd, (char *)buf, (int)len, BTC_NOSIGNAL);
+
+  if (rc == BTC_SOCKET_ERROR)
+    return btc_errno;
+
+  *sent = rc;
+
+  return 0;
+#endif
+}
+
 /*
  * Socket
  */
@@ -578,14 +881,12 @@ btc_socket_destroy(btc_socket_t *socket) {
 
   for (chunk = socket->head; chunk != NULL; chunk = next) {
     next = chunk->next;
-
-    if (chunk->addr != NULL)
-      free(chunk->addr);
-
-    free(chunk->ptr);
-    free(chunk);
+    chunk_destroy(chunk);
   }
 
+  if (socket->socks != NULL)
+    free(socket->socks);
+
   free(socket);
 }
 
@@ -638,7 +939,9 @@ void
 btc_socket_complete(btc_socket_t *socket) {
   /* This function essentialy means, "I'm ready for on_connect to be called." */
   /* Necessary in cases where the socket connects immediately. */
-  if (socket->state == BTC_SOCKET_CONNECTED && socket->on_connect != NULL) {
+  if (socket->state == BTC_SOCKET_CONNECTED
+      && socket->socks == NULL
+      && socket->on_connect != NULL) {
     socket->on_connect(socket);
     socket->on_connect = NULL;
   }
@@ -869,57 +1172,121 @@ btc_socket_talk(btc_socket_t *socket, int family) {
   return 1;
 }
 
+static void
+btc_loop_watch(btc_loop_t *loop, btc_socket_t *socket, int writable);
+
+static void
+btc_loop_defer(btc_loop_t *loop, btc_socket_t *socket);
+
+static void
+btc_loop_undefer(btc_loop_t *loop, btc_socket_t *socket);
+
 static int
-btc_socket_flush_write(btc_socket_t *socket) {
+btc_socket__flush(btc_socket_t *socket) {
+#if defined(_WIN32)
+  WSABUF iov[MAX_IOVS];
+  DWORD sent;
+#else
+  struct iovec iov[MAX_IOVS];
+  struct msghdr msg;
+  ssize_t sent;
+#endif
   chunk_t *chunk, *next;
-  int len;
+  size_t size;
+  int count, error;
 
-  for (chunk = socket->head; chunk != NULL; chunk = next) {
-    next = chunk->next;
+  /* Everything queued so far goes out in as
+     few calls as the socket buffer allows. */
+  while (socket->head != NULL) {
+    count = 0;
 
-    CHECK(chunk->len <= INT_MAX);
+    for (chunk = socket->head; chunk != NULL; chunk = chunk->next) {
+      if (count == MAX_IOVS || chunk->file != -1)
+        break;
 
-    while (chunk->len > 0) {
-      len = send(socket->fd, (void *)chunk->raw, chunk->len, BTC_NOSIGNAL);
+      CHECK(chunk->len <= INT_MAX);
 
-      if (len == BTC_SOCKET_ERROR) {
-        int error = btc_errno;
+#if defined(_WIN32)
+      iov[count].buf = (char *)chunk->raw;
+      iov[count].len = (ULONG)chunk->len;
+#else
+      iov[count].iov_base = (void *)chunk->raw;
+      iov[count].iov_len = chunk->len;
+#endif
 
-        if (error == BTC_EINTR)
-          continue;
+      count++;
+    }
 
-        if (error == BTC_EAGAIN)
-          break;
+    size = 0;
 
-        if (error == BTC_EWOULDBLOCK)
-          break;
+    if (count == 0) {
+      /* File ranges go out on their own. */
+      error = chunk_sendfile(socket->fd, socket->head, &size);
+    } else {
+#if defined(_WIN32)
+      if (WSASend(socket->fd, iov, count, &sent, 0, NULL, NULL) != 0)
+        error = btc_errno;
+      else
+        error = 0;
+#else
+      memset(&msg, 0, sizeof(msg));
 
-        socket->loop->error = error;
+      msg.msg_iov = iov;
+      msg.msg_iovlen = count;
 
-        return -1;
-      }
+      sent = sendmsg(socket->fd, &msg, BTC_NOSIGNAL);
+      error = (sent < 0) ? btc_errno : 0;
+#endif
 
-      if (len == 0)
-        break;
+      if (error == 0)
+        size = sent;
+    }
 
-      if ((size_t)len > chunk->len)
-        abort(); /* LCOV_EXCL_LINE */
+    if (error != 0) {
+      if (error == BTC_EINTR)
+        continue;
+
+      if (error == BTC_EAGAIN)
+        return 0;
 
-      chunk->raw += len;
-      chunk->len -= len;
+      if (error == BTC_EWOULDBLOCK)
+        return 0;
+
+      socket->loop->error = error;
 
-      socket->total -= len;
+      return -1;
     }
 
-    if (chunk->len != 0) {
-      socket->draining = 1;
+    if (size == 0)
       return 0;
-    }
 
-    free(chunk->ptr);
-    free(chunk);
+    if (size > socket->total)
+      abort(); /* LCOV_EXCL_LINE */
+
+    socket->total -= size;
 
-    socket->head = next;
+    /* Release what was written and keep
+       our place in a partially written one. */
+    for (chunk = socket->head; chunk != NULL; chunk = next) {
+      next = chunk->next;
+
+      if (size < chunk->len) {
+        if (chunk->file != -1)
+          chunk->offset += size;
+        else
+          chunk->raw += size;
+
+        chunk->len -= size;
+
+        break;
+      }
+
+      size -= chunk->len;
+
+      chunk_destroy(chunk);
+
+      socket->head = next;
+    }
   }
 
   CHECK(socket->total == 0);
@@ -928,6 +1295,25 @@ btc_socket_flush_write(btc_socket_t *socket) {
   socket->tail = NULL;
   socket->total = 0;
 
+  return 1;
+}
+
+static int
+btc_socket_flush_write(btc_socket_t *socket) {
+  int rc = btc_socket__flush(socket);
+
+  if (rc == -1)
+    return -1;
+
+  if (rc == 0) {
+    /* Wait for the socket to become writable. */
+    socket->draining = 1;
+    btc_loop_watch(socket->loop, socket, 1);
+    return 0;
+  }
+
+  btc_loop_watch(socket->loop, socket, 0);
+
   if (socket->draining) {
     socket->draining = 0;
     if (socket->on_drain != NULL)
@@ -937,94 +1323,304 @@ btc_socket_flush_write(btc_socket_t *socket) {
   return 1;
 }
 
-int
-btc_socket_write(btc_socket_t *socket, void *data, size_t len) {
-  unsigned char *raw = (unsigned char *)data;
-  chunk_t *chunk;
+/*
+ * SOCKS5 (RFC 1928)
+ *
+ * The greeting only offers "no authentication", so
+ * there is nothing to negotiate: the method selection
+ * and the CONNECT request go out in a single write and
+ * both replies come back in a single read. That saves
+ * a round trip through the proxy, which for Tor is a
+ * round trip through the circuit.
+ */
 
-  if (socket->state != BTC_SOCKET_CONNECTING
-      && socket->state != BTC_SOCKET_CONNECTED) {
-    socket->loop->error = BTC_EPIPE;
+static size_t
+socks_request(unsigned char *zp, const char *host, int port) {
+  size_t len = strlen(host);
 
-    if (data != NULL)
-      free(data);
+  zp[0] = 0x05; /* version */
+  zp[1] = 0x01; /* method count */
+  zp[2] = 0x00; /* no authentication */
+  zp[3] = 0x05; /* version */
+  zp[4] = 0x01; /* connect */
+  zp[5] = 0x00; /* reserved */
+  zp[6] = 0x03; /* domain name */
+  zp[7] = len;
 
-    return -1;
-  }
+  memcpy(zp + 8, host, len);
 
-  if (len == 0) {
-    if (data != NULL)
-      free(data);
+  zp[8 + len] = (port >> 8) & 0xff;
+  zp[9 + len] = (port >> 0) & 0xff;
 
-    return !socket->draining;
-  }
+  return 10 + len;
+}
 
-  if (len > INT_MAX) {
-    socket->loop->error = BTC_EMSGSIZE;
-    free(data);
-    return -1;
+static size_t
+socks_reply_size(const socks_t *socks) {
+  const unsigned char *rp = socks->data;
+
+  /* Method selection (2) + reply header (4) + address + port (2). */
+  if (socks->length < 7)
+    return 7;
+
+  switch (rp[5]) {
+    case 0x01:
+      return 2 + 4 + 4 + 2;
+    case 0x03:
+      return 2 + 4 + 1 + rp[6] + 2;
+    case 0x04:
+      return 2 + 4 + 16 + 2;
   }
 
-  chunk = (chunk_t *)safe_malloc(sizeof(chunk_t));
+  return 0;
+}
 
-  chunk->addr = NULL;
-  chunk->ptr = raw;
-  chunk->raw = raw;
-  chunk->len = len;
-  chunk->next = NULL;
+static int
+socks_reply_error(const socks_t *socks) {
+  const unsigned char *rp = socks->data;
+  size_t len = socks->length;
 
-  if (socket->head == NULL)
-    socket->head = chunk;
+  if (len >= 1 && rp[0] != 0x05)
+    return BTC_ECONNABORTED;
 
-  if (socket->tail != NULL)
-    socket->tail->next = chunk;
+  if (len >= 2 && rp[1] != 0x00)
+    return BTC_ECONNABORTED;
 
-  socket->tail = chunk;
-  socket->total += len;
+  if (len >= 3 && rp[2] != 0x05)
+    return BTC_ECONNABORTED;
 
-  if (socket->state == BTC_SOCKET_CONNECTING) {
-    socket->draining = 1;
-    return 0;
-  }
+  if (len >= 4 && rp[3] != 0x00)
+    return BTC_ECONNREFUSED;
+
+  if (len >= 6 && socks_reply_size(socks) == 0)
+    return BTC_ECONNABORTED;
 
-  return btc_socket_flush_write(socket);
+  return 0;
 }
 
 static int
-btc_socket_flush_send(btc_socket_t *socket) {
-  chunk_t *chunk, *next;
-  btc_socklen_t addrlen;
+btc_socket_socks_send(btc_socket_t *socket) {
+  socks_t *socks = socket->socks;
   int len;
 
-  for (chunk = socket->head; chunk != NULL; chunk = next) {
-    next = chunk->next;
+  do {
+    len = send(socket->fd,
+               (const void *)socks->data,
+               socks->length,
+               BTC_NOSIGNAL);
+  } while (len == BTC_SOCKET_ERROR && btc_errno == BTC_EINTR);
 
-    CHECK(chunk->len <= INT_MAX);
+  if (len == BTC_SOCKET_ERROR) {
+    socket->loop->error = btc_errno;
+    return 0;
+  }
 
-    addrlen = sa_addrlen(chunk->addr);
+  /* A fresh socket always has room for a few hundred bytes. */
+  if ((size_t)len != socks->length) {
+    socket->loop->error = BTC_ECONNABORTED;
+    return 0;
+  }
 
-    for (;;) {
-      len = sendto(socket->fd,
-                   (void *)chunk->raw,
-                   chunk->len,
-                   BTC_NOSIGNAL,
-                   chunk->addr,
-                   addrlen);
+  /* The buffer now collects the replies. */
+  socks->length = 0;
 
-      if (len == BTC_SOCKET_ERROR) {
-        int error = btc_errno;
+  return 1;
+}
 
-        if (error == BTC_EINTR)
-          continue;
+static int
+btc_socket_handshake(btc_socket_t *socket,
+                     const unsigned char *data,
+                     size_t len) {
+  socks_t *socks = socket->socks;
+  size_t need, take;
+  int error;
 
-        if (error == BTC_EAGAIN)
-          return 0;
+  if (len == 0) {
+    socket->loop->error = BTC_ECONNABORTED;
+    goto fail;
+  }
 
-        if (error == BTC_EWOULDBLOCK)
-          return 0;
+  for (;;) {
+    need = socks_reply_size(socks);
+    error = socks_reply_error(socks);
+
+    if (error != 0) {
+      socket->loop->error = error;
+      goto fail;
+    }
+
+    if (socks->length == need)
+      break;
+
+    if (len == 0)
+      return 1;
+
+    take = need - socks->length;
+
+    if (take > len)
+      take = len;
+
+    memcpy(socks->data + socks->length, data, take);
+
+    socks->length += take;
+    data += take;
+    len -= take;
+  }
+
+  free(socks);
+
+  socket->socks = NULL;
+
+  if (socket->on_connect != NULL) {
+    socket->on_connect(socket);
+    socket->on_connect = NULL;
+  }
+
+  if (socket->state != BTC_SOCKET_CONNECTED)
+    return 0;
+
+  if (socket->head != NULL) {
+    if (btc_socket_flush_write(socket) == -1) {
+      socket->on_error(socket);
+      return 0;
+    }
+  }
+
+  if (len > 0)
+    return socket->on_data(socket, data, len);
+
+  return 1;
+fail:
+  socket->on_error(socket);
+  btc_socket_close(socket);
+  return 0;
+}
+
+static int
+btc_socket__write(btc_socket_t *socket,
+                  const void *data,
+                  int file,
+                  int64_t offset,
+                  size_t len,
+                  void *ptr,
+                  btc_socket_free_cb *free_cb) {
+  chunk_t *chunk;
+
+  if (socket->state != BTC_SOCKET_CONNECTING
+      && socket->state != BTC_SOCKET_CONNECTED) {
+    socket->loop->error = BTC_EPIPE;
+    chunk_release(ptr, free_cb);
+    return -1;
+  }
+
+  if (len == 0) {
+    chunk_release(ptr, free_cb);
+    return !socket->draining;
+  }
+
+  if (len > INT_MAX) {
+    socket->loop->error = BTC_EMSGSIZE;
+    chunk_release(ptr, free_cb);
+    return -1;
+  }
+
+  chunk = (chunk_t *)safe_malloc(sizeof(chunk_t));
+
+  chunk->addr = NULL;
+  chunk->ptr = ptr;
+  chunk->free_cb = free_cb;
+  chunk->raw = (unsigned char *)data;
+  chunk->file = file;
+  chunk->offset = offset;
+  chunk->len = len;
+  chunk->next = NULL;
+
+  if (socket->head == NULL)
+    socket->head = chunk;
+
+  if (socket->tail != NULL)
+    socket->tail->next = chunk;
+
+  socket->tail = chunk;
+  socket->total += len;
+
+  if (socket->state == BTC_SOCKET_CONNECTING) {
+    socket->draining = 1;
+    return 0;
+  }
+
+  /* Sent at the end of the loop iteration, or once
+     the socket is writable again if it's backed up. */
+  if (!socket->draining)
+    btc_loop_defer(socket->loop, socket);
+
+  return !socket->draining;
+}
+
+int
+btc_socket_write(btc_socket_t *socket, void *data, size_t len) {
+  return btc_socket__write(socket, data, -1, 0, len, data, NULL);
+}
+
+int
+btc_socket_write_static(btc_socket_t *socket, const void *data, size_t len) {
+  /* Caller guarantees `data` outlives the write. */
+  return btc_socket__write(socket, data, -1, 0, len, NULL, NULL);
+}
+
+int
+btc_socket_write_shared(btc_socket_t *socket,
+                        const void *data,
+                        size_t len,
+                        btc_socket_free_cb *free_cb,
+                        void *arg) {
+  /* `free_cb(arg)` runs once the socket is done with `data`. */
+  return btc_socket__write(socket, data, -1, 0, len, arg, free_cb);
+}
+
+int
+btc_socket_write_file(btc_socket_t *socket,
+                      int fd,
+                      int64_t pos,
+                      size_t len,
+                      btc_socket_free_cb *free_cb,
+                      void *arg) {
+  /* `fd` must stay open until `free_cb(arg)` runs. */
+  return btc_socket__write(socket, NULL, fd, pos, len, arg, free_cb);
+}
+
+static int
+btc_socket_flush_send(btc_socket_t *socket) {
+  chunk_t *chunk, *next;
+  btc_socklen_t addrlen;
+  int len;
+
+  for (chunk = socket->head; chunk != NULL; chunk = next) {
+    next = chunk->next;
+
+    CHECK(chunk->len <= INT_MAX);
 
-        if (error == BTC_ENOBUFS)
+    addrlen = sa_addrlen(chunk->addr);
+
+    for (;;) {
+      len = sendto(socket->fd,
+                   (void *)chunk->raw,
+                   chunk->len,
+                   BTC_NOSIGNAL,
+                   chunk->addr,
+                   addrlen);
+
+      if (len == BTC_SOCKET_ERROR) {
+        int error = btc_errno;
+
+        if (error == BTC_EINTR)
+          continue;
+
+        if (error == BTC_EAGAIN || error == BTC_EWOULDBLOCK
+                                || error == BTC_ENOBUFS) {
+          btc_loop_watch(socket->loop, socket, 1);
           return 0;
+        }
       }
 
       break;
@@ -1032,9 +1628,7 @@ btc_socket_flush_send(btc_socket_t *socket) {
 
     socket->total -= chunk->len;
 
-    free(chunk->addr);
-    free(chunk->ptr);
-    free(chunk);
+    chunk_destroy(chunk);
 
     socket->head = next;
   }
@@ -1045,6 +1639,8 @@ btc_socket_flush_send(btc_socket_t *socket) {
   socket->tail = NULL;
   socket->total = 0;
 
+  btc_loop_watch(socket->loop, socket, 0);
+
   return 1;
 }
 
@@ -1082,7 +1678,10 @@ btc_socket_send(btc_socket_t *socket,
 
   chunk->addr = (struct sockaddr *)safe_malloc(sizeof(struct sockaddr_storage));
   chunk->ptr = raw;
+  chunk->free_cb = NULL;
   chunk->raw = raw;
+  chunk->file = -1;
+  chunk->offset = 0;
   chunk->len = len;
   chunk->next = NULL;
 
@@ -1110,14 +1709,18 @@ btc_socket_close(btc_socket_t *socket) {
   if (socket->state == BTC_SOCKET_DISCONNECTED)
     return;
 
-  for (chunk = socket->head; chunk != NULL; chunk = next) {
-    next = chunk->next;
+  btc_loop_undefer(socket->loop, socket);
 
-    if (chunk->addr != NULL)
-      free(chunk->addr);
+  /* Give deferred writes one last chance. */
+  if (socket->state == BTC_SOCKET_CONNECTED
+      && socket->socks == NULL
+      && socket->head != NULL) {
+    btc_socket__flush(socket);
+  }
 
-    free(chunk->ptr);
-    free(chunk);
+  for (chunk = socket->head; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    chunk_destroy(chunk);
   }
 
   btc_loop_unregister(socket->loop, socket);
@@ -1136,6 +1739,183 @@ btc_socket_close(btc_socket_t *socket) {
   btc_queue_push(&socket->loop->closed, socket);
 }
 
+/*
+ * Timer Wheel
+ */
+
+static void
+wheel_link(struct btc_wheel *wheel, btc_timer_t *timer) {
+  int64_t when = timer->expires;
+  int64_t delta = when - wheel->now;
+  btc_timer_t **slot;
+  int level = 0;
+
+  if (delta < 0) {
+    /* Overdue: run on the next millisecond. */
+    when = wheel->now;
+  } else {
+    /* Too far out: park it at the edge and
+       let the cascade put it back later. */
+    if (delta >= WHEEL_SPAN) {
+      when = wheel->now + WHEEL_SPAN - 1;
+      delta = WHEEL_SPAN - 1;
+    }
+
+    while (delta >= ((int64_t)1 << (WHEEL_BITS * (level + 1))))
+      level++;
+  }
+
+  slot = &wheel->slots[level][(when >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+  timer->slot = slot;
+  timer->prev = NULL;
+  timer->next = *slot;
+
+  if (*slot != NULL)
+    (*slot)->prev = timer;
+
+  *slot = timer;
+}
+
+static void
+wheel_unlink(btc_timer_t *timer) {
+  if (timer->prev != NULL)
+    timer->prev->next = timer->next;
+  else
+    *timer->slot = timer->next;
+
+  if (timer->next != NULL)
+    timer->next->prev = timer->prev;
+
+  timer->slot = NULL;
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+static void
+wheel_cascade(struct btc_wheel *wheel, btc_timer_t **slot) {
+  btc_timer_t *timer = *slot;
+  btc_timer_t *next;
+
+  *slot = NULL;
+
+  for (; timer != NULL; timer = next) {
+    next = timer->next;
+    wheel_link(wheel, timer);
+  }
+}
+
+static void
+wheel_run(struct btc_wheel *wheel, int64_t now) {
+  btc_timer_t *pending, *timer;
+  int level, index;
+
+  if (wheel->length == 0) {
+    if (wheel->now <= now)
+      wheel->now = now + 1;
+    return;
+  }
+
+  while (wheel->now <= now) {
+    index = wheel->now & WHEEL_MASK;
+
+    /* Refill the bottom level from above. */
+    for (level = 1; index == 0 && level < WHEEL_LEVELS; level++) {
+      index = (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+      wheel_cascade(wheel, &wheel->slots[level][index]);
+    }
+
+    index = wheel->now & WHEEL_MASK;
+
+    /* Detach the slot first. Handlers may stop any
+       timer or re-arm their own; a re-armed timer
+       lands on a later millisecond. */
+    pending = wheel->slots[0][index];
+    wheel->slots[0][index] = NULL;
+    wheel->now++;
+
+    for (timer = pending; timer != NULL; timer = timer->next)
+      timer->slot = &pending;
+
+    while (pending != NULL) {
+      timer = pending;
+
+      wheel_unlink(timer);
+
+      if (timer->expires >= wheel->now) {
+        wheel_link(wheel, timer);
+        continue;
+      }
+
+      wheel->length--;
+
+      timer->handler(timer->data);
+    }
+  }
+}
+
+/*
+ * Timer
+ */
+
+btc_timer_t *
+btc_timer_create(btc_loop_t *loop, btc_timer_cb *handler, void *data) {
+  btc_timer_t *timer = (btc_timer_t *)safe_malloc(sizeof(btc_timer_t));
+
+  memset(timer, 0, sizeof(*timer));
+
+  timer->loop = loop;
+  timer->handler = handler;
+  timer->data = data;
+
+  return timer;
+}
+
+void
+btc_timer_destroy(btc_timer_t *timer) {
+  btc_timer_stop(timer);
+  free(timer);
+}
+
+void
+btc_timer_start(btc_timer_t *timer, int64_t msec) {
+  btc_timer_at(timer, btc_time_msec() + (msec > 0 ? msec : 0));
+}
+
+void
+btc_timer_at(btc_timer_t *timer, int64_t time) {
+  struct btc_wheel *wheel = &timer->loop->wheel;
+
+  if (timer->slot != NULL)
+    wheel_unlink(timer);
+  else
+    wheel->length++;
+
+  timer->expires = time;
+
+  wheel_link(wheel, timer);
+}
+
+void
+btc_timer_stop(btc_timer_t *timer) {
+  if (timer->slot == NULL)
+    return;
+
+  wheel_unlink(timer);
+
+  timer->loop->wheel.length--;
+}
+
+int
+btc_timer_active(btc_timer_t *timer) {
+  return timer->slot != NULL;
+}
+
+int64_t
+btc_timer_expires(btc_timer_t *timer) {
+  return timer->slot != NULL ? timer->expires : -1;
+}
+
 /*
  * Loop
  */
@@ -1147,6 +1927,11 @@ btc_loop_grow(btc_loop_t *loop, size_t n) {
     loop->events = safe_realloc(loop->events, n, loop->max, struct epoll_event);
     loop->max = n;
   }
+#elif defined(BTC_USE_KQUEUE)
+  if (n > (size_t)loop->max) {
+    loop->events = safe_realloc(loop->events, n, loop->max, struct kevent);
+    loop->max = n;
+  }
 #elif defined(BTC_USE_POLL)
   if (n > loop->alloc) {
     loop->pfds = safe_realloc(loop->pfds, n, loop->alloc, struct pollfd);
@@ -1169,14 +1954,50 @@ btc_loop_create(void) {
   loop->fd = safe_epoll_create();
 
   CHECK(loop->fd != -1);
+
+  waker_open(loop->waker);
+
+  {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+
+    /* A null pointer marks the waker. */
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    CHECK(epoll_ctl(loop->fd, EPOLL_CTL_ADD, loop->waker[0], &ev) == 0);
+  }
+#elif defined(BTC_USE_KQUEUE)
+  loop->fd = safe_kqueue_create();
+
+  CHECK(loop->fd != -1);
+
+  waker_open(loop->waker);
+
+  /* A null pointer marks the waker. */
+  CHECK(safe_kevent(loop->fd, loop->waker[0], EVFILT_READ, EV_ADD, NULL) == 0);
 #elif defined(BTC_USE_POLL)
-  /* nothing */
+  waker_open(loop->waker);
 #else
   FD_ZERO(&loop->fds);
+  FD_ZERO(&loop->ofds);
+
+  waker_open(loop->waker);
+
+  FD_SET(loop->waker[0], &loop->fds);
+
+#if !defined(_WIN32)
+  CHECK(loop->waker[0] < FD_SETSIZE);
+
+  loop->nfds = loop->waker[0] + 1;
+#endif
 #endif
 
   btc_loop_grow(loop, 64);
 
+  loop->wheel.now = btc_time_msec();
+
   return loop;
 }
 
@@ -1186,7 +2007,7 @@ btc_loop_destroy(btc_loop_t *loop) {
 
   CHECK(loop->running == 0);
 
-#if defined(BTC_USE_EPOLL)
+#if defined(BTC_USE_EPOLL) || defined(BTC_USE_KQUEUE)
   CHECK(loop->fd != -1);
   close(loop->fd);
   free(loop->events);
@@ -1195,6 +2016,8 @@ btc_loop_destroy(btc_loop_t *loop) {
   free(loop->sockets);
 #endif
 
+  waker_close(loop->waker);
+
   for (tick = loop->ticks.head; tick != NULL; tick = next) {
     next = tick->next;
     free(tick);
@@ -1228,6 +2051,21 @@ btc_loop_off_tick(btc_loop_t *loop, btc_loop_tick_cb *handler, void *data) {
   }
 }
 
+int64_t
+btc_loop_busy(btc_loop_t *loop) {
+  return loop->busy;
+}
+
+void
+btc_loop_wakeup(btc_loop_t *loop) {
+  waker_signal(loop->waker);
+}
+
+void
+btc_loop_set_spin(btc_loop_t *loop, int64_t usec) {
+  loop->spin = usec > 0 ? usec * 1000 : 0;
+}
+
 const char *
 btc_loop_strerror(btc_loop_t *loop) {
 #if defined(_WIN32)
@@ -1266,9 +2104,12 @@ btc_loop_register(btc_loop_t *loop, btc_socket_t *socket) {
 
   CHECK(socket->fd != -1);
 
+  /* Only ask for writability when we're waiting on it. */
+  socket->writable = (socket->state == BTC_SOCKET_CONNECTING);
+
   memset(&ev, 0, sizeof(ev));
 
-  ev.events = EPOLLIN | EPOLLOUT;
+  ev.events = EPOLLIN | (socket->writable ? EPOLLOUT : 0);
   ev.data.fd = socket->fd;
   ev.data.ptr = socket;
 
@@ -1277,6 +2118,28 @@ btc_loop_register(btc_loop_t *loop, btc_socket_t *socket) {
 
   btc_list_push(loop, socket, btc_socket_t);
 
+  return 1;
+#elif defined(BTC_USE_KQUEUE)
+  CHECK(socket->fd != -1);
+
+  /* Only ask for writability when we're waiting on it. */
+  socket->writable = (socket->state == BTC_SOCKET_CONNECTING);
+
+  if (safe_kevent(loop->fd, socket->fd, EVFILT_READ, EV_ADD, socket) != 0) {
+    loop->error = errno;
+    return 0;
+  }
+
+  if (socket->writable) {
+    if (safe_kevent(loop->fd, socket->fd, EVFILT_WRITE, EV_ADD, socket) != 0) {
+      loop->error = errno;
+      safe_kevent(loop->fd, socket->fd, EVFILT_READ, EV_DELETE, NULL);
+      return 0;
+    }
+  }
+
+  btc_list_push(loop, socket, btc_socket_t);
+
   return 1;
 #elif defined(BTC_USE_POLL)
   struct pollfd *pfd;
@@ -1284,9 +2147,11 @@ btc_loop_register(btc_loop_t *loop, btc_socket_t *socket) {
   if (loop->length == loop->alloc)
     btc_loop_grow(loop, (loop->length * 3) / 2);
 
+  socket->writable = (socket->state == BTC_SOCKET_CONNECTING);
+
   pfd = &loop->pfds[loop->length];
   pfd->fd = socket->fd;
-  pfd->events = POLLIN | POLLOUT;
+  pfd->events = POLLIN | (socket->writable ? POLLOUT : 0);
   pfd->revents = 0;
 
   socket->index = loop->length;
@@ -1297,7 +2162,7 @@ btc_loop_register(btc_loop_t *loop, btc_socket_t *socket) {
   return 1;
 #else
 #if defined(_WIN32)
-  if (loop->length >= FD_SETSIZE) {
+  if (loop->length + 1 >= FD_SETSIZE) {
     loop->error = BTC_EMFILE;
     return 0;
   }
@@ -1311,8 +2176,13 @@ btc_loop_register(btc_loop_t *loop, btc_socket_t *socket) {
     loop->nfds = socket->fd + 1;
 #endif
 
+  socket->writable = (socket->state == BTC_SOCKET_CONNECTING);
+
   FD_SET(socket->fd, &loop->fds);
 
+  if (socket->writable)
+    FD_SET(socket->fd, &loop->ofds);
+
   btc_list_push(loop, socket, btc_socket_t);
 
   return 1;
@@ -1331,6 +2201,15 @@ btc_loop_unregister(btc_loop_t *loop, btc_socket_t *socket) {
       abort(); /* LCOV_EXCL_LINE */
   }
 
+  btc_list_remove(loop, socket, btc_socket_t);
+#elif defined(BTC_USE_KQUEUE)
+  /* The filters go away with the descriptor,
+     but it may outlive us if it was shared. */
+  safe_kevent(loop->fd, socket->fd, EVFILT_READ, EV_DELETE, NULL);
+
+  if (socket->writable)
+    safe_kevent(loop->fd, socket->fd, EVFILT_WRITE, EV_DELETE, NULL);
+
   btc_list_remove(loop, socket, btc_socket_t);
 #elif defined(BTC_USE_POLL)
   loop->pfds[socket->index] = loop->pfds[loop->length - 1];
@@ -1342,11 +2221,76 @@ btc_loop_unregister(btc_loop_t *loop, btc_socket_t *socket) {
     loop->index--;
 #else
   FD_CLR(socket->fd, &loop->fds);
+  FD_CLR(socket->fd, &loop->ofds);
 
   btc_list_remove(loop, socket, btc_socket_t);
 #endif
 }
 
+static void
+btc_loop_watch(btc_loop_t *loop, btc_socket_t *socket, int writable) {
+#if defined(BTC_USE_EPOLL)
+  struct epoll_event ev;
+#endif
+
+  if (socket->writable == writable)
+    return;
+
+#if defined(BTC_USE_EPOLL)
+  memset(&ev, 0, sizeof(ev));
+
+  ev.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+  ev.data.fd = socket->fd;
+  ev.data.ptr = socket;
+
+  if (epoll_ctl(loop->fd, EPOLL_CTL_MOD, socket->fd, &ev) != 0)
+    abort(); /* LCOV_EXCL_LINE */
+#elif defined(BTC_USE_KQUEUE)
+  if (safe_kevent(loop->fd, socket->fd, EVFILT_WRITE,
+                  writable ? EV_ADD : EV_DELETE, socket) != 0) {
+    abort(); /* LCOV_EXCL_LINE */
+  }
+#elif defined(BTC_USE_POLL)
+  loop->pfds[socket->index].events = POLLIN | (writable ? POLLOUT : 0);
+#else
+  if (writable)
+    FD_SET(socket->fd, &loop->ofds);
+  else
+    FD_CLR(socket->fd, &loop->ofds);
+#endif
+
+  socket->writable = writable;
+}
+
+static void
+btc_loop_defer(btc_loop_t *loop, btc_socket_t *socket) {
+  if (socket->pending)
+    return;
+
+  socket->pending = 1;
+  socket->pending_next = loop->pending;
+
+  loop->pending = socket;
+}
+
+static void
+btc_loop_undefer(btc_loop_t *loop, btc_socket_t *socket) {
+  btc_socket_t **link;
+
+  if (!socket->pending)
+    return;
+
+  for (link = &loop->pending; *link != NULL; link = &(*link)->pending_next) {
+    if (*link == socket) {
+      *link = socket->pending_next;
+      break;
+    }
+  }
+
+  socket->pending = 0;
+  socket->pending_next = NULL;
+}
+
 btc_socket_t *
 btc_loop_listen(btc_loop_t *loop, const btc_sockaddr_t *addr) {
   btc_socket_t *socket = btc_socket_create(loop);
@@ -1383,6 +2327,46 @@ fail:
   return NULL;
 }
 
+btc_socket_t *
+btc_loop_proxy(btc_loop_t *loop,
+               const btc_sockaddr_t *proxy,
+               const char *host,
+               int port) {
+  size_t len = strlen(host);
+  btc_socket_t *socket;
+
+  if (len == 0 || len > 255 || port < 0 || port > 0xffff) {
+    loop->error = BTC_EINVAL;
+    return NULL;
+  }
+
+  socket = btc_socket_create(loop);
+  socket->socks = (socks_t *)safe_malloc(sizeof(socks_t));
+  socket->socks->length = socks_request(socket->socks->data, host, port);
+
+  if (!btc_socket_connect(socket, proxy))
+    goto fail;
+
+  if (!btc_loop_register(loop, socket)) {
+    btc_closesocket(socket->fd);
+    goto fail;
+  }
+
+  /* A local proxy may accept us immediately. */
+  if (socket->state == BTC_SOCKET_CONNECTED) {
+    if (!btc_socket_socks_send(socket)) {
+      btc_loop_unregister(loop, socket);
+      btc_closesocket(socket->fd);
+      goto fail;
+    }
+  }
+
+  return socket;
+fail:
+  btc_socket_destroy(socket);
+  return NULL;
+}
+
 btc_socket_t *
 btc_loop_bind(btc_loop_t *loop, const btc_sockaddr_t *addr) {
   btc_socket_t *socket = btc_socket_create(loop);
@@ -1429,7 +2413,7 @@ handle_read(btc_loop_t *loop, btc_socket_t *socket) {
         goto fail;
 
       if (!btc_loop_register(loop, child)) {
-        btc_closesocket(socket->fd);
+        btc_closesocket(child->fd);
         goto fail;
       }
 
@@ -1473,10 +2457,17 @@ fail:
         if ((size_t)len > size)
           abort(); /* LCOV_EXCL_LINE */
 
-        if (!socket->on_data(socket, buf, len))
-          break;
+        if (socket->socks != NULL) {
+          if (!btc_socket_handshake(socket, buf, len))
+            break;
+        } else {
+          if (!socket->on_data(socket, buf, len))
+            break;
+        }
 
-        if (len == 0)
+        /* A short read means the buffer is empty; don't
+           spend another call finding that out. */
+        if ((size_t)len < size)
           break;
       }
 
@@ -1535,8 +2526,6 @@ fail:
 
 static void
 handle_write(btc_loop_t *loop, btc_socket_t *socket) {
-  (void)loop;
-
   switch (socket->state) {
     case BTC_SOCKET_CONNECTING: {
       btc_socklen_t addrlen = sa_addrlen(socket->addr);
@@ -1557,6 +2546,19 @@ handle_write(btc_loop_t *loop, btc_socket_t *socket) {
 
       socket->state = BTC_SOCKET_CONNECTED;
 
+      if (socket->socks != NULL) {
+        /* Writes stay queued until the proxy has
+           connected us; see btc_socket_handshake. */
+        btc_loop_watch(loop, socket, 0);
+
+        if (!btc_socket_socks_send(socket)) {
+          socket->on_error(socket);
+          btc_socket_close(socket);
+        }
+
+        break;
+      }
+
       if (socket->on_connect != NULL) {
         socket->on_connect(socket);
         socket->on_connect = NULL;
@@ -1566,6 +2568,9 @@ handle_write(btc_loop_t *loop, btc_socket_t *socket) {
     }
 
     case BTC_SOCKET_CONNECTED: {
+      if (socket->socks != NULL)
+        break;
+
       if (btc_socket_flush_write(socket) == -1)
         socket->on_error(socket);
       break;
@@ -1578,10 +2583,41 @@ handle_write(btc_loop_t *loop, btc_socket_t *socket) {
   }
 }
 
+static void
+handle_pending(btc_loop_t *loop) {
+  btc_socket_t *socket;
+
+  /* One batched write per socket per iteration. */
+  while (loop->pending != NULL) {
+    socket = loop->pending;
+
+    loop->pending = socket->pending_next;
+
+    socket->pending = 0;
+    socket->pending_next = NULL;
+
+    if (socket->state != BTC_SOCKET_CONNECTED)
+      continue;
+
+    if (socket->socks != NULL)
+      continue;
+
+    if (btc_socket_flush_write(socket) == -1)
+      socket->on_error(socket);
+  }
+}
+
+static void
+handle_timers(btc_loop_t *loop) {
+  wheel_run(&loop->wheel, btc_time_msec());
+}
+
 static void
 handle_ticks(btc_loop_t *loop) {
   btc_tick_t *tick, *next;
 
+  loop->ticked = btc_time_nsec();
+
   for (tick = loop->ticks.head; tick != NULL; tick = next) {
     next = tick->next;
 
@@ -1596,21 +2632,41 @@ handle_closed(btc_loop_t *loop) {
   for (socket = loop->closed.head; socket != NULL; socket = next) {
     next = socket->next;
 
-    socket->on_close(socket);
+    /* Refused children never got handlers. */
+    if (socket->on_close != NULL)
+      socket->on_close(socket);
+
     btc_socket_destroy(socket);
   }
 
   btc_list_init(&loop->closed);
 }
 
+static int
+btc_loop_timeout(btc_loop_t *loop) {
+  int64_t now = btc_time_nsec();
+  int64_t left;
+
+  /* Busy-poll for a while after the last event. */
+  if (loop->spin > 0 && now - loop->active < loop->spin)
+    return 0;
+
+  /* Otherwise sleep until the next tick is due. Other
+     threads cut this short with btc_loop_wakeup. */
+  left = loop->ticked + BTC_LOOP_TICK * 1000000 - now;
+
+  if (left <= 0)
+    return 0;
+
+  return (int)((left + 999999) / 1000000);
+}
+
 void
 btc_loop_start(btc_loop_t *loop) {
   loop->running = 1;
 
-  while (loop->running) {
-    btc_loop_poll(loop, 25);
-    btc_time_sleep(1);
-  }
+  while (loop->running)
+    btc_loop_poll(loop, btc_loop_timeout(loop));
 
   btc_loop_close(loop);
 }
@@ -1625,8 +2681,11 @@ btc_loop_poll(btc_loop_t *loop, int timeout) {
 #if defined(BTC_USE_EPOLL)
   struct epoll_event *event;
   btc_socket_t *socket;
+  int64_t start;
   int i, count;
 
+  handle_pending(loop);
+
 retry:
   count = epoll_wait(loop->fd, loop->events, loop->max, timeout);
 
@@ -1637,10 +2696,20 @@ retry:
     abort(); /* LCOV_EXCL_LINE */
   }
 
+  start = btc_time_nsec();
+
+  if (count > 0)
+    loop->active = start;
+
   for (i = 0; i < count; i++) {
     event = &loop->events[i];
     socket = event->data.ptr;
 
+    if (socket == NULL) {
+      waker_drain(loop->waker);
+      continue;
+    }
+
     if (event->events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
       handle_write(loop, socket);
 
@@ -1651,15 +2720,86 @@ retry:
   if (count == loop->max)
     btc_loop_grow(loop, (count * 3) / 2);
 
+  handle_timers(loop);
   handle_ticks(loop);
+  handle_pending(loop);
+  handle_closed(loop);
+#elif defined(BTC_USE_KQUEUE)
+  struct timespec *to, ts;
+  struct kevent *event;
+  btc_socket_t *socket;
+  int64_t start;
+  int i, count;
+
+  handle_pending(loop);
+
+  if (timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    to = &ts;
+  } else {
+    to = NULL;
+  }
+
+retry:
+  count = kevent(loop->fd, NULL, 0, loop->events, loop->max, to);
+
+  if (count == -1) {
+    if (errno == EINTR)
+      goto retry;
+
+    abort(); /* LCOV_EXCL_LINE */
+  }
+
+  start = btc_time_nsec();
+
+  if (count > 0)
+    loop->active = start;
+
+  /* Reads and writes arrive as separate events. A
+     socket closed by the first stays allocated until
+     handle_closed, and its state turns the second away. */
+  for (i = 0; i < count; i++) {
+    event = &loop->events[i];
+    socket = (btc_socket_t *)event->udata;
+
+    if (socket == NULL) {
+      waker_drain(loop->waker);
+      continue;
+    }
+
+    if (event->filter == EVFILT_WRITE)
+      handle_write(loop, socket);
+    else if (event->filter == EVFILT_READ)
+      handle_read(loop, socket);
+  }
+
+  if (count == loop->max)
+    btc_loop_grow(loop, (count * 3) / 2);
+
+  handle_timers(loop);
+  handle_ticks(loop);
+  handle_pending(loop);
   handle_closed(loop);
 #elif defined(BTC_USE_POLL)
   btc_socket_t *socket;
   struct pollfd *pfd;
+  int64_t start;
   int count;
 
+  handle_pending(loop);
+
+  /* The waker sits just past the sockets. */
+  if (loop->length == loop->alloc)
+    btc_loop_grow(loop, (loop->length * 3) / 2);
+
+  pfd = &loop->pfds[loop->length];
+  pfd->fd = loop->waker[0];
+  pfd->events = POLLIN;
+  pfd->revents = 0;
+
 retry:
-  count = poll(loop->pfds, loop->length, timeout);
+  count = poll(loop->pfds, loop->length + 1, timeout);
 
   if (count == -1) {
     if (errno == EINTR)
@@ -1668,6 +2808,17 @@ retry:
     abort(); /* LCOV_EXCL_LINE */
   }
 
+  start = btc_time_nsec();
+
+  if (count > 0)
+    loop->active = start;
+
+  if (pfd->revents != 0) {
+    waker_drain(loop->waker);
+    pfd->revents = 0;
+    count--;
+  }
+
   if (count != 0) {
     for (loop->index = 0; loop->index < loop->length; loop->index++) {
       socket = loop->sockets[loop->index];
@@ -1688,18 +2839,23 @@ retry:
     }
   }
 
+  handle_timers(loop);
   handle_ticks(loop);
+  handle_pending(loop);
   handle_closed(loop);
 #else /* BTC_USE_SELECT */
   btc_socket_t *socket, *next;
   struct timeval *to;
   struct timeval tv;
   btc_sockfd_t fd;
+  int64_t start;
   int count;
 
+  handle_pending(loop);
+
 retry:
   memcpy(&loop->rfds, &loop->fds, sizeof(loop->fds));
-  memcpy(&loop->wfds, &loop->fds, sizeof(loop->fds));
+  memcpy(&loop->wfds, &loop->ofds, sizeof(loop->ofds));
 #ifdef _WIN32
   memcpy(&loop->efds, &loop->fds, sizeof(loop->fds));
 #endif
@@ -1740,6 +2896,16 @@ retry:
 #endif
   }
 
+  start = btc_time_nsec();
+
+  if (count > 0)
+    loop->active = start;
+
+  if (count > 0 && FD_ISSET(loop->waker[0], &loop->rfds)) {
+    waker_drain(loop->waker);
+    count--;
+  }
+
   if (count != 0) {
     for (socket = loop->head; socket != NULL; socket = next) {
       next = socket->next;
@@ -1758,9 +2924,13 @@ retry:
     }
   }
 
+  handle_timers(loop);
   handle_ticks(loop);
+  handle_pending(loop);
   handle_closed(loop);
 #endif /* BTC_USE_SELECT */
+
+  loop->busy = btc_time_nsec() - start;
 }
 
 void
@@ -1779,7 +2949,7 @@ btc_loop_close(btc_loop_t *loop) {
   handle_closed(loop);
 
 #if defined(BTC_USE_SELECT) && !defined(_WIN32)
-  loop->nfds = 0;
+  loop->nfds = loop->waker[0] + 1;
 #endif
 #endif /* !BTC_USE_POLL */
 }
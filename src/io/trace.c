@@ -0,0 +1,276 @@
+/*!
+ * trace.c - trace events for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <io/trace.h>
+
+#ifdef BTC_TRACE
+
+/*
+ * Constants
+ */
+
+#define TRACE_NAME 24
+#define TRACE_DEFAULT (1 << 16)
+#define TRACE_MAX (1 << 24)
+
+/*
+ * Types
+ */
+
+typedef struct trace_event_s {
+  int64_t time;
+  const char *cat;
+  char name[TRACE_NAME];
+  uint32_t tid;
+  int phase;
+} trace_event_t;
+
+/*
+ * Globals
+ */
+
+/* Checked without the lock by every trace point:
+ * a stale read costs at most one event, which is
+ * re-checked against the ring under the lock. The
+ * lock itself lives as long as the process.
+ */
+
+volatile int btc_trace_enabled = 0;
+
+static btc_mutex_t *trace_lock = NULL;
+static trace_event_t *trace_ring = NULL;
+static size_t trace_size = 0;
+static uint64_t trace_head = 0;
+static int64_t trace_epoch = 0;
+static uint32_t trace_tids = 0;
+
+#ifdef BTC_TLS
+static BTC_TLS uint32_t trace_tid = 0;
+#endif
+
+/*
+ * Helpers
+ */
+
+static uint32_t
+trace_thread(void) {
+#ifdef BTC_TLS
+  if (trace_tid == 0)
+    trace_tid = ++trace_tids;
+
+  return trace_tid;
+#else
+  return 1;
+#endif
+}
+
+static void
+trace_name(char *zp, const char *xp) {
+  /* Peer commands come off the wire: keep
+     the output valid JSON whatever they hold. */
+  size_t i;
+
+  for (i = 0; i < TRACE_NAME - 1 && xp[i] != '\0'; i++) {
+    int ch = xp[i];
+
+    if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z')
+        || (ch >= 'a' && ch <= 'z') || ch == '_') {
+      zp[i] = ch;
+    } else {
+      zp[i] = '?';
+    }
+  }
+
+  zp[i] = '\0';
+}
+
+static int
+trace_write(const char *file,
+            const trace_event_t *ring,
+            size_t size,
+            uint64_t head) {
+  uint64_t start = head > size ? head - size : 0;
+  FILE *stream = fopen(file, "w");
+  uint64_t i;
+  int ok;
+
+  if (stream == NULL)
+    return 0;
+
+  fputs("{\"traceEvents\":[\n", stream);
+
+  for (i = start; i < head; i++) {
+    const trace_event_t *ev = &ring[i % size];
+
+    fprintf(stream, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+                    "\"ts\":%ld,\"pid\":1,\"tid\":%lu}",
+                    i == start ? "" : ",\n",
+                    ev->name,
+                    ev->cat,
+                    ev->phase,
+                    (long)ev->time,
+                    (unsigned long)ev->tid);
+  }
+
+  fputs("\n],\"displayTimeUnit\":\"ms\"}\n", stream);
+
+  ok = !ferror(stream);
+
+  if (fclose(stream) != 0)
+    ok = 0;
+
+  return ok;
+}
+
+/*
+ * Trace
+ */
+
+int
+btc_trace_start(size_t events) {
+  trace_event_t *ring;
+
+  if (events == 0)
+    events = TRACE_DEFAULT;
+
+  if (events > TRACE_MAX)
+    events = TRACE_MAX;
+
+  /* Only ever started from the event loop. */
+  if (trace_lock == NULL)
+    trace_lock = btc_mutex_create();
+
+  ring = (trace_event_t *)malloc(events * sizeof(trace_event_t));
+
+  if (ring == NULL)
+    return 0;
+
+  btc_mutex_lock(trace_lock);
+
+  if (trace_ring != NULL) {
+    btc_mutex_unlock(trace_lock);
+    free(ring);
+    return 0;
+  }
+
+  trace_ring = ring;
+  trace_size = events;
+  trace_head = 0;
+  trace_epoch = btc_time_usec();
+
+  btc_trace_enabled = 1;
+
+  btc_mutex_unlock(trace_lock);
+
+  return 1;
+}
+
+int
+btc_trace_stop(const char *file, size_t *events) {
+  trace_event_t *ring;
+  uint64_t head;
+  size_t size;
+  int ok = 1;
+
+  if (events != NULL)
+    *events = 0;
+
+  if (trace_lock == NULL)
+    return 0;
+
+  btc_mutex_lock(trace_lock);
+
+  ring = trace_ring;
+  size = trace_size;
+  head = trace_head;
+
+  btc_trace_enabled = 0;
+
+  trace_ring = NULL;
+
+  btc_mutex_unlock(trace_lock);
+
+  if (ring == NULL)
+    return 0;
+
+  /* The ring keeps the newest events. */
+  if (events != NULL)
+    *events = head < size ? (size_t)head : size;
+
+  if (file != NULL)
+    ok = trace_write(file, ring, size, head);
+
+  free(ring);
+
+  return ok;
+}
+
+int
+btc_trace_active(void) {
+  return btc_trace_enabled;
+}
+
+void
+btc_trace_event(int phase, const char *cat, const char *name) {
+  int64_t now = btc_time_usec();
+  trace_event_t *ev;
+
+  btc_mutex_lock(trace_lock);
+
+  if (trace_ring != NULL) {
+    ev = &trace_ring[trace_head++ % trace_size];
+
+    ev->time = now - trace_epoch;
+    ev->cat = cat;
+    ev->tid = trace_thread();
+    ev->phase = phase;
+
+    trace_name(ev->name, name);
+  }
+
+  btc_mutex_unlock(trace_lock);
+}
+
+#else /* !BTC_TRACE */
+
+int
+btc_trace_start(size_t events) {
+  (void)events;
+  return 0;
+}
+
+int
+btc_trace_stop(const char *file, size_t *events) {
+  (void)file;
+
+  if (events != NULL)
+    *events = 0;
+
+  return 0;
+}
+
+int
+btc_trace_active(void) {
+  return 0;
+}
+
+void
+btc_trace_event(int phase, const char *cat, const char *name) {
+  (void)phase;
+  (void)cat;
+  (void)name;
+}
+
+#endif /* !BTC_TRACE */
@@ -5,9 +5,11 @@
  */
 
 #undef HAVE_FCNTL
+#undef HAVE_MMAP
 
 #if !defined(__EMSCRIPTEN__) && !defined(__wasi__)
 #  define HAVE_FCNTL
+#  define HAVE_MMAP
 #endif
 
 #include <errno.h>
@@ -24,6 +26,9 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #ifdef __APPLE__
 #include <pthread.h>
 #endif
@@ -424,6 +429,13 @@ btc_fs_open(const char *name, int flags, uint32_t mode) {
     fd = btc_fs__open(name, flags, mode);
   } while (fd == -1 && errno == EINTR);
 
+  if (fd != -1) {
+    if (flags & BTC_O_SEQUENTIAL)
+      btc_fs_fadvise(fd, 0, 0, BTC_ADVISE_SEQUENTIAL);
+    else if (flags & BTC_O_RANDOM)
+      btc_fs_fadvise(fd, 0, 0, BTC_ADVISE_RANDOM);
+  }
+
   return fd;
 }
 
@@ -901,11 +913,121 @@ btc_fs_flock(int fd, int operation) {
 #endif
 }
 
+int
+btc_fs_fallocate(int fd, int64_t pos, int64_t len) {
+  /* Reserves space without changing the file size,
+     so readers never see the preallocated tail. */
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+  int r;
+
+  do {
+    r = fallocate(fd, FALLOC_FL_KEEP_SIZE, pos, len);
+  } while (r == -1 && errno == EINTR);
+
+  return r == 0;
+#elif defined(__APPLE__) && defined(F_PREALLOCATE)
+  fstore_t store;
+  struct stat st;
+
+  if (fstat(fd, &st) != 0)
+    return 0;
+
+  if (pos + len <= (int64_t)st.st_size)
+    return 1;
+
+  memset(&store, 0, sizeof(store));
+
+  store.fst_flags = F_ALLOCATECONTIG;
+  store.fst_posmode = F_PEOFPOSMODE;
+  store.fst_offset = 0;
+  store.fst_length = pos + len - st.st_size;
+
+  if (fcntl(fd, F_PREALLOCATE, &store) == 0)
+    return 1;
+
+  store.fst_flags = F_ALLOCATEALL;
+
+  return fcntl(fd, F_PREALLOCATE, &store) == 0;
+#else
+  (void)fd;
+  (void)pos;
+  (void)len;
+  return 0;
+#endif
+}
+
+int
+btc_fs_fadvise(int fd, int64_t pos, int64_t len, int advice) {
+#if defined(POSIX_FADV_NORMAL) && !defined(__APPLE__)
+  int type;
+
+  switch (advice) {
+    case BTC_ADVISE_NORMAL:
+      type = POSIX_FADV_NORMAL;
+      break;
+    case BTC_ADVISE_SEQUENTIAL:
+      type = POSIX_FADV_SEQUENTIAL;
+      break;
+    case BTC_ADVISE_RANDOM:
+      type = POSIX_FADV_RANDOM;
+      break;
+    case BTC_ADVISE_WILLNEED:
+      type = POSIX_FADV_WILLNEED;
+      break;
+    case BTC_ADVISE_DONTNEED:
+      type = POSIX_FADV_DONTNEED;
+      break;
+    default:
+      return 0;
+  }
+
+  return posix_fadvise(fd, pos, len, type) == 0;
+#else
+  (void)fd;
+  (void)pos;
+  (void)len;
+  (void)advice;
+  return 0;
+#endif
+}
+
 int
 btc_fs_close(int fd) {
   return close(fd) == 0;
 }
 
+void *
+btc_fs_mmap(int fd, size_t size) {
+#ifdef HAVE_MMAP
+  void *ptr;
+
+  if (size == 0)
+    return NULL;
+
+  ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+  if (ptr == MAP_FAILED)
+    return NULL;
+
+  return ptr;
+#else
+  (void)fd;
+  (void)size;
+  return NULL;
+#endif
+}
+
+int
+btc_fs_munmap(void *ptr, size_t size) {
+#ifdef HAVE_MMAP
+  return munmap(ptr, size) == 0;
+#else
+  (void)ptr;
+  (void)size;
+  return 0;
+#endif
+}
+
 /*
  * Path
  */
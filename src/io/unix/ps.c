@@ -4,6 +4,7 @@
  * https://github.com/chjj/mako
  */
 
+#include <errno.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,6 +26,8 @@
 static void (*global_handler)(void *) = NULL;
 static void *global_arg = NULL;
 static int global_bound = 0;
+static void (*usr1_handler)(void *) = NULL;
+static void *usr1_arg = NULL;
 
 /*
  * Process
@@ -146,6 +149,61 @@ btc_ps_fdlimit(int minfd) {
   return lim.rlim_cur;
 }
 
+size_t
+btc_ps_rss(void) {
+#if defined(__linux__)
+  /* Resident pages are the second field. */
+  char buf[128];
+  size_t pages = 0;
+  long page;
+  char *p;
+  int fd, n;
+
+  fd = open("/proc/self/statm", O_RDONLY);
+
+  if (fd == -1)
+    return 0;
+
+  do {
+    n = read(fd, buf, sizeof(buf) - 1);
+  } while (n < 0 && errno == EINTR);
+
+  close(fd);
+
+  if (n <= 0)
+    return 0;
+
+  buf[n] = '\0';
+
+  p = strchr(buf, ' ');
+
+  if (p == NULL)
+    return 0;
+
+  for (p++; *p >= '0' && *p <= '9'; p++)
+    pages = pages * 10 + (*p - '0');
+
+  page = sysconf(_SC_PAGESIZE);
+
+  if (page <= 0)
+    return 0;
+
+  return pages * (size_t)page;
+#else
+  /* Only the peak is portable. */
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+#if defined(__APPLE__)
+  return usage.ru_maxrss;
+#else
+  return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
 static void
 btc_signal(int signum, void (*handler)(int)) {
   struct sigaction sa;
@@ -181,3 +239,20 @@ btc_ps_onterm(void (*handler)(void *), void *arg) {
     btc_signal(SIGINT, real_handler);
   }
 }
+
+static void
+usr1_real_handler(int signum) {
+  (void)signum;
+
+  /* Unlike SIGTERM, this may fire any number of times. */
+  if (usr1_handler != NULL)
+    usr1_handler(usr1_arg);
+}
+
+void
+btc_ps_onusr1(void (*handler)(void *), void *arg) {
+  usr1_handler = handler;
+  usr1_arg = arg;
+
+  btc_signal(SIGUSR1, usr1_real_handler);
+}
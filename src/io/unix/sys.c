@@ -5,11 +5,15 @@
  */
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pwd.h>
 #include <unistd.h>
+#if !defined(__EMSCRIPTEN__) && !defined(__wasi__)
+#  include <sys/mman.h>
+#endif
 #include <io/core.h>
 
 /*
@@ -153,3 +157,65 @@ btc_sys_datadir(char *buf, size_t size, const char *name) {
 
   return 1;
 }
+
+/*
+ * Huge Pages
+ */
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+void *
+btc_sys_hugealloc(size_t *size) {
+#if defined(MADV_HUGEPAGE)
+  size_t len = (*size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  unsigned char *ptr;
+  size_t off;
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_2MB)
+  /* Explicit pages, if the administrator reserved any. */
+  ptr = mmap(NULL, len, prot, flags | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+
+  if (ptr != MAP_FAILED) {
+    *size = len;
+    return ptr;
+  }
+#endif
+
+  /* Otherwise, an aligned region the kernel may back
+     transparently (or not, depending on its policy). */
+  ptr = mmap(NULL, len + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+
+  if (ptr == MAP_FAILED)
+    return NULL;
+
+  off = -(uintptr_t)ptr & (HUGE_PAGE_SIZE - 1);
+
+  if (off > 0)
+    munmap(ptr, off);
+
+  munmap(ptr + off + len, HUGE_PAGE_SIZE - off);
+
+  ptr += off;
+
+  madvise(ptr, len, MADV_HUGEPAGE);
+
+  *size = len;
+
+  return ptr;
+#else
+  (void)size;
+  return NULL;
+#endif
+}
+
+void
+btc_sys_hugefree(void *ptr, size_t size) {
+#if defined(MADV_HUGEPAGE)
+  munmap(ptr, size);
+#else
+  (void)ptr;
+  (void)size;
+#endif
+}
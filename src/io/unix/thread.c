@@ -259,6 +259,15 @@ btc_thread_free(btc_thread_t *thread) {
   free(thread);
 }
 
+/* Threads inherit their creator's affinity on Linux. Once
+   a thread pins itself, the mask it had beforehand is kept
+   here and handed to any thread it creates instead. */
+#if defined(__linux__) && !defined(__ANDROID__) && defined(CPU_SETSIZE)
+#  define HAVE_AFFINITY
+static cpu_set_t thread_affinity;
+static int thread_pinned = 0;
+#endif
+
 /* Set a sane stack size for thread (from libuv). */
 #if defined(__APPLE__) || defined(__linux__)
 static size_t
@@ -316,11 +325,30 @@ btc_thread_create(btc_thread_t *thread, void (*start)(void *), void *arg) {
   }
 #endif
 
+#ifdef HAVE_AFFINITY
+  if (thread_pinned) {
+    if (attr == NULL) {
+      attr = &tmp;
+
+      if (pthread_attr_init(attr) != 0)
+        abort(); /* LCOV_EXCL_LINE */
+    }
+
+    if (pthread_attr_setaffinity_np(attr, sizeof(thread_affinity),
+                                          &thread_affinity) != 0) {
+      abort(); /* LCOV_EXCL_LINE */
+    }
+  }
+#endif
+
   args->start = start;
   args->arg = arg;
 
   if (pthread_create(&thread->handle, attr, btc_thread_run, args) != 0)
     abort(); /* LCOV_EXCL_LINE */
+
+  if (attr != NULL)
+    pthread_attr_destroy(attr);
 }
 
 void
@@ -335,6 +363,38 @@ btc_thread_join(btc_thread_t *thread) {
     abort(); /* LCOV_EXCL_LINE */
 }
 
+int
+btc_thread_pin(btc_thread_t *thread, int cpu) {
+  /* Pins `thread` (or the caller, if NULL) to a single
+     CPU. Memory it touches first is then placed on that
+     CPU's NUMA node by the default kernel policy. */
+#ifdef HAVE_AFFINITY
+  pthread_t handle = thread != NULL ? thread->handle : pthread_self();
+  cpu_set_t set;
+
+  if (cpu < 0 || cpu >= CPU_SETSIZE)
+    return 0;
+
+  if (!thread_pinned) {
+    if (pthread_getaffinity_np(pthread_self(), sizeof(thread_affinity),
+                                               &thread_affinity) != 0) {
+      return 0;
+    }
+
+    thread_pinned = 1;
+  }
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#else
+  (void)thread;
+  (void)cpu;
+  return 0;
+#endif
+}
+
 /*
  * Once
  */
@@ -371,3 +431,95 @@ btc_tls_set(btc_tls_t *key, void *value) {
   if (pthread_setspecific(*key, value) != 0)
     abort(); /* LCOV_EXCL_LINE */
 }
+
+/*
+ * Atomic
+ */
+
+#if defined(__ATOMIC_SEQ_CST)
+
+long
+btc_atomic_load(const volatile long *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+void
+btc_atomic_store(volatile long *ptr, long val) {
+  __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+void
+btc_atomic_fence(void) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#elif defined(__GNUC__)
+
+long
+btc_atomic_load(const volatile long *ptr) {
+  long val;
+
+  __sync_synchronize();
+
+  val = *ptr;
+
+  __sync_synchronize();
+
+  return val;
+}
+
+void
+btc_atomic_store(volatile long *ptr, long val) {
+  __sync_synchronize();
+
+  *ptr = val;
+
+  __sync_synchronize();
+}
+
+void
+btc_atomic_fence(void) {
+  __sync_synchronize();
+}
+
+#else /* !__GNUC__ */
+
+/* A mutex orders memory just as well, if slowly. */
+static pthread_mutex_t atomic_lock = PTHREAD_MUTEX_INITIALIZER;
+
+long
+btc_atomic_load(const volatile long *ptr) {
+  long val;
+
+  if (pthread_mutex_lock(&atomic_lock) != 0)
+    abort(); /* LCOV_EXCL_LINE */
+
+  val = *ptr;
+
+  if (pthread_mutex_unlock(&atomic_lock) != 0)
+    abort(); /* LCOV_EXCL_LINE */
+
+  return val;
+}
+
+void
+btc_atomic_store(volatile long *ptr, long val) {
+  if (pthread_mutex_lock(&atomic_lock) != 0)
+    abort(); /* LCOV_EXCL_LINE */
+
+  *ptr = val;
+
+  if (pthread_mutex_unlock(&atomic_lock) != 0)
+    abort(); /* LCOV_EXCL_LINE */
+}
+
+void
+btc_atomic_fence(void) {
+  if (pthread_mutex_lock(&atomic_lock) != 0)
+    abort(); /* LCOV_EXCL_LINE */
+
+  if (pthread_mutex_unlock(&atomic_lock) != 0)
+    abort(); /* LCOV_EXCL_LINE */
+}
+
+#endif /* !__GNUC__ */
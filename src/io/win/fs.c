@@ -732,11 +732,73 @@ btc_fs_flock(int fd, int operation) {
   return 0;
 }
 
+int
+btc_fs_fallocate(int fd, int64_t pos, int64_t len) {
+  /* Unlike SetFileValidData, raising the allocation
+     size needs no privileges and leaves the end of
+     file (and the contents past it) alone. */
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600 /* Vista (2007) */
+  HANDLE handle = (HANDLE)_get_osfhandle(fd);
+  FILE_ALLOCATION_INFO info;
+
+  if (handle == INVALID_HANDLE_VALUE)
+    return 0;
+
+  info.AllocationSize.QuadPart = pos + len;
+
+  return SetFileInformationByHandle(handle, FileAllocationInfo,
+                                    &info, sizeof(info)) != 0;
+#else
+  (void)fd;
+  (void)pos;
+  (void)len;
+  return 0;
+#endif
+}
+
+int
+btc_fs_fadvise(int fd, int64_t pos, int64_t len, int advice) {
+  /* Windows takes its hints at open time. */
+  (void)fd;
+  (void)pos;
+  (void)len;
+  (void)advice;
+  return 0;
+}
+
 int
 btc_fs_close(int fd) {
   return _close(fd) == 0;
 }
 
+void *
+btc_fs_mmap(int fd, size_t size) {
+  HANDLE handle = (HANDLE)_get_osfhandle(fd);
+  HANDLE mapping;
+  void *ptr;
+
+  if (handle == INVALID_HANDLE_VALUE || size == 0)
+    return NULL;
+
+  mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+
+  if (mapping == NULL)
+    return NULL;
+
+  ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+
+  /* The view holds a reference to the mapping. */
+  CloseHandle(mapping);
+
+  return ptr;
+}
+
+int
+btc_fs_munmap(void *ptr, size_t size) {
+  (void)size;
+  return UnmapViewOfFile(ptr) != 0;
+}
+
 /*
  * Path
  */
@@ -6,8 +6,13 @@
 
 #include <stdlib.h>
 #include <windows.h>
+#include <psapi.h>
 #include <io/core.h>
 
+#ifndef __MINGW32__
+#  pragma comment(lib, "psapi.lib")
+#endif
+
 /*
  * Globals
  */
@@ -42,6 +47,16 @@ btc_ps_fdlimit(int minfd) {
   return minfd < 2048 ? 2048 : minfd;
 }
 
+size_t
+btc_ps_rss(void) {
+  PROCESS_MEMORY_COUNTERS pmc;
+
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return 0;
+
+  return pmc.WorkingSetSize;
+}
+
 static BOOL WINAPI
 real_handler(DWORD type) {
   /* Note: this runs on a separate thread. */
@@ -69,3 +84,10 @@ btc_ps_onterm(void (*handler)(void *), void *arg) {
     SetConsoleCtrlHandler(real_handler, TRUE);
   }
 }
+
+void
+btc_ps_onusr1(void (*handler)(void *), void *arg) {
+  /* No SIGUSR1 on windows. */
+  (void)handler;
+  (void)arg;
+}
@@ -69,3 +69,76 @@ btc_sys_datadir(char *buf, size_t size, const char *name) {
 
   return 1;
 }
+
+/*
+ * Huge Pages
+ */
+
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600
+static int
+enable_lock_privilege(void) {
+  /* Large pages need SeLockMemoryPrivilege, which
+     an administrator must grant to the account. */
+  static int state = -1;
+  TOKEN_PRIVILEGES tp;
+  HANDLE token;
+
+  if (state >= 0)
+    return state;
+
+  state = 0;
+
+  if (!OpenProcessToken(GetCurrentProcess(),
+                        TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY,
+                        &token)) {
+    return 0;
+  }
+
+  tp.PrivilegeCount = 1;
+  tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+  if (LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege",
+                            &tp.Privileges[0].Luid)) {
+    if (AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL))
+      state = (GetLastError() == ERROR_SUCCESS);
+  }
+
+  CloseHandle(token);
+
+  return state;
+}
+#endif
+
+void *
+btc_sys_hugealloc(size_t *size) {
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600
+  size_t page = GetLargePageMinimum();
+  size_t len;
+  void *ptr;
+
+  if (page == 0 || !enable_lock_privilege())
+    return NULL;
+
+  len = ((*size + page - 1) / page) * page;
+
+  ptr = VirtualAlloc(NULL, len,
+                     MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                     PAGE_READWRITE);
+
+  if (ptr == NULL)
+    return NULL;
+
+  *size = len;
+
+  return ptr;
+#else
+  (void)size;
+  return NULL;
+#endif
+}
+
+void
+btc_sys_hugefree(void *ptr, size_t size) {
+  (void)size;
+  VirtualFree(ptr, 0, MEM_RELEASE);
+}
@@ -418,6 +418,17 @@ btc_thread_join(btc_thread_t *thread) {
     abort(); /* LCOV_EXCL_LINE */
 }
 
+int
+btc_thread_pin(btc_thread_t *thread, int cpu) {
+  /* Only the first 64 CPUs (the caller's processor group). */
+  HANDLE handle = thread != NULL ? thread->handle : GetCurrentThread();
+
+  if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8))
+    return 0;
+
+  return SetThreadAffinityMask(handle, (DWORD_PTR)1 << cpu) != 0;
+}
+
 /*
  * Once
  */
@@ -488,3 +499,22 @@ btc_tls_set(btc_tls_t *key, void *value) {
   if (TlsSetValue(key->index, value) == FALSE)
     abort(); /* LCOV_EXCL_LINE */
 }
+
+/*
+ * Atomic
+ */
+
+long
+btc_atomic_load(const volatile long *ptr) {
+  return InterlockedCompareExchange((volatile LONG *)ptr, 0, 0);
+}
+
+void
+btc_atomic_store(volatile long *ptr, long val) {
+  InterlockedExchange((volatile LONG *)ptr, val);
+}
+
+void
+btc_atomic_fence(void) {
+  MemoryBarrier();
+}
@@ -5,13 +5,28 @@
  *
  * Resources:
  *   https://nachtimwald.com/2019/04/12/thread-pool-in-c/
+ *   https://www.dre.vanderbilt.edu/~schmidt/PDF/work-stealing-dequeue.pdf
  */
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <io/core.h>
+#include <io/loop.h>
+#include <io/trace.h>
 #include <io/workers.h>
 
+/*
+ * Constants
+ */
+
+/* Steal sweeps before a worker parks. */
+#define WORKERS_SPIN 64
+
+/* Initial deque capacity (power of two). */
+#define DEQUE_SIZE 64
+
 /*
  * Helpers
  */
@@ -36,22 +51,27 @@ btc_work_create(btc_work_f *func, void *arg) {
 
   work->func = func;
   work->arg = arg;
+  work->owned = 1;
+  work->priority = BTC_WORK_NORMAL;
+  work->group = NULL;
   work->next = NULL;
 
   return work;
 }
 
-static btc_work_t *
-btc_work_destroy(btc_work_t *work) {
-  btc_work_t *next = work->next;
-  free(work);
-  return next;
-}
-
-static btc_work_t *
+static void
 btc_work_execute(btc_work_t *work) {
+  int owned = work->owned;
+
+  BTC_TRACE_BEGIN("workers", "task");
+
   work->func(work->arg);
-  return btc_work_destroy(work);
+
+  BTC_TRACE_END("workers", "task");
+
+  /* Intrusive items belong to the caller. */
+  if (owned)
+    free(work);
 }
 
 /*
@@ -69,16 +89,18 @@ void
 btc_workq_clear(btc_workq_t *queue) {
   btc_work_t *work, *next;
 
-  for (work = queue->head; work != NULL; work = next)
-    next = btc_work_destroy(work);
+  for (work = queue->head; work != NULL; work = next) {
+    next = work->next;
+
+    if (work->owned)
+      free(work);
+  }
 
   btc_workq_init(queue);
 }
 
-void
-btc_workq_push(btc_workq_t *queue, btc_work_f *func, void *arg) {
-  btc_work_t *work = btc_work_create(func, arg);
-
+static void
+btc_workq_link(btc_workq_t *queue, btc_work_t *work) {
   if (queue->head == NULL)
     queue->head = work;
 
@@ -89,62 +111,218 @@ btc_workq_push(btc_workq_t *queue, btc_work_f *func, void *arg) {
   queue->length++;
 }
 
-static btc_work_t *
-btc_workq_shift(btc_workq_t *queue) {
-  btc_work_t *work = queue->head;
+void
+btc_workq_push(btc_workq_t *queue, btc_work_f *func, void *arg) {
+  btc_workq_link(queue, btc_work_create(func, arg));
+}
 
-  if (work == NULL)
-    abort(); /* LCOV_EXCL_LINE */
+void
+btc_workq_append(btc_workq_t *queue,
+                 btc_work_t *work,
+                 btc_work_f *func,
+                 void *arg) {
+  work->func = func;
+  work->arg = arg;
+  work->owned = 0;
+  work->priority = BTC_WORK_NORMAL;
+  work->group = NULL;
+  work->next = NULL;
 
-  queue->head = work->next;
+  btc_workq_link(queue, work);
+}
 
-  if (queue->head == NULL)
-    queue->tail = NULL;
+/*
+ * Deque
+ */
 
-  queue->length--;
+/* One per thread. The owner takes from the top,
+ * thieves take from the bottom. Each deque has its
+ * own lock, so submitters and workers only contend
+ * when they land on the same thread's queue.
+ *
+ * Every priority class gets a lane of its own.
+ * Lane lengths may be read without the lock as a
+ * hint; anything taken is re-checked under it.
+ */
 
-  work->next = NULL;
+typedef struct btc_lane_s {
+  btc_work_t **items;
+  size_t mask;
+  volatile size_t top;
+  volatile size_t bottom;
+} btc_lane_t;
 
-  return work;
+typedef struct btc_deque_s {
+  btc_mutex_t *mutex;
+  btc_lane_t lanes[BTC_WORK_PRIORITIES];
+  struct btc_workers_s *pool;
+  btc_thread_t *thread;
+  int index;
+} btc_deque_t;
+
+static void
+btc_deque_init(btc_deque_t *dq, struct btc_workers_s *pool, int index) {
+  int i;
+
+  dq->mutex = btc_mutex_create();
+
+  for (i = 0; i < BTC_WORK_PRIORITIES; i++) {
+    btc_lane_t *lane = &dq->lanes[i];
+
+    lane->items = safe_malloc(DEQUE_SIZE * sizeof(btc_work_t *));
+    lane->mask = DEQUE_SIZE - 1;
+    lane->top = 0;
+    lane->bottom = 0;
+  }
+
+  dq->pool = pool;
+  dq->thread = btc_thread_alloc();
+  dq->index = index;
 }
 
 static void
-btc_workq_concat(btc_workq_t *z, btc_workq_t *x) {
-  if (z->head == NULL) {
-    z->head = x->head;
-    z->tail = x->tail;
-  } else {
-    z->tail->next = x->head;
-    z->tail = x->head;
+btc_deque_clear(btc_deque_t *dq) {
+  btc_work_t *work;
+  btc_lane_t *lane;
+  int i;
+
+  btc_mutex_lock(dq->mutex);
+
+  for (i = 0; i < BTC_WORK_PRIORITIES; i++) {
+    lane = &dq->lanes[i];
+
+    while (lane->top != lane->bottom) {
+      work = lane->items[lane->top++ & lane->mask];
+
+      if (work->owned)
+        free(work);
+    }
   }
 
-  z->length += x->length;
+  btc_mutex_unlock(dq->mutex);
+}
+
+static void
+btc_deque_destroy(btc_deque_t *dq) {
+  int i;
+
+  btc_mutex_destroy(dq->mutex);
+  btc_thread_free(dq->thread);
 
-  btc_workq_init(x);
+  for (i = 0; i < BTC_WORK_PRIORITIES; i++)
+    free(dq->lanes[i].items);
 }
 
 static void
-btc_workq_slice(btc_workq_t *z, btc_workq_t *x, int length) {
+btc_lane_grow(btc_lane_t *lane) {
+  size_t size = (lane->mask + 1) * 2;
+  btc_work_t **items = safe_malloc(size * sizeof(btc_work_t *));
+  size_t i, length = lane->bottom - lane->top;
+
+  for (i = 0; i < length; i++)
+    items[i] = lane->items[(lane->top + i) & lane->mask];
+
+  free(lane->items);
+
+  lane->items = items;
+  lane->mask = size - 1;
+  lane->top = 0;
+  lane->bottom = length;
+}
+
+static size_t
+btc_lane_length(const btc_lane_t *lane) {
+  return lane->bottom - lane->top;
+}
+
+static void
+btc_deque_push(btc_deque_t *dq, btc_work_t *work) {
+  /* Called with the lock held. */
+  btc_lane_t *lane = &dq->lanes[work->priority];
+
+  if (lane->bottom - lane->top > lane->mask)
+    btc_lane_grow(lane);
+
+  lane->items[lane->bottom++ & lane->mask] = work;
+}
+
+static btc_work_t *
+btc_deque_pop(btc_deque_t *dq, int priority) {
+  btc_lane_t *lane = &dq->lanes[priority];
+  btc_work_t *work = NULL;
+
+  if (btc_lane_length(lane) == 0)
+    return NULL;
+
+  btc_mutex_lock(dq->mutex);
+
+  if (lane->top != lane->bottom) {
+    work = lane->items[lane->top++ & lane->mask];
+    work->next = NULL;
+  }
+
+  btc_mutex_unlock(dq->mutex);
+
+  return work;
+}
+
+static btc_work_t *
+btc_deque_steal(btc_deque_t *dq, int priority, int max) {
+  btc_lane_t *lane = &dq->lanes[priority];
+  btc_work_t *head = NULL;
   btc_work_t *work;
+  size_t length;
 
-  if (length <= 0)
-    abort(); /* LCOV_EXCL_LINE */
+  if (btc_lane_length(lane) == 0)
+    return NULL;
 
-  length--;
+  btc_mutex_lock(dq->mutex);
 
-  work = btc_workq_shift(x);
+  /* Take half, capped at the batch size. */
+  length = (lane->bottom - lane->top + 1) / 2;
 
-  z->head = work;
-  z->tail = work;
-  z->length = 1;
+  if (length > (size_t)max)
+    length = max;
 
   while (length--) {
-    work = btc_workq_shift(x);
+    work = lane->items[--lane->bottom & lane->mask];
+    work->next = head;
+    head = work;
+  }
+
+  btc_mutex_unlock(dq->mutex);
+
+  return head;
+}
 
-    z->tail->next = work;
-    z->tail = work;
-    z->length++;
+static int
+btc_deque_empty(btc_deque_t *dq) {
+  int ret = 1;
+  int i;
+
+  btc_mutex_lock(dq->mutex);
+
+  for (i = 0; i < BTC_WORK_PRIORITIES; i++) {
+    if (dq->lanes[i].top != dq->lanes[i].bottom) {
+      ret = 0;
+      break;
+    }
   }
+
+  btc_mutex_unlock(dq->mutex);
+
+  return ret;
+}
+
+static size_t
+btc_deque_length(btc_deque_t *dq, int priority) {
+  size_t length;
+
+  btc_mutex_lock(dq->mutex);
+  length = btc_lane_length(&dq->lanes[priority]);
+  btc_mutex_unlock(dq->mutex);
+
+  return length;
 }
 
 /*
@@ -155,12 +333,14 @@ struct btc_workers_s {
   btc_mutex_t *mutex;
   btc_cond_t *master;
   btc_cond_t *worker;
-  btc_workq_t queue;
+  btc_deque_t *deques;
   int threads;
+  int running;
   int max_batch;
   int idle;
   int left;
   int stop;
+  btc_loop_t *loop;
 };
 
 static void
@@ -169,7 +349,6 @@ worker_thread(void *arg);
 btc_workers_t *
 btc_workers_create(int threads, int max_batch) {
   btc_workers_t *pool = safe_malloc(sizeof(btc_workers_t));
-  btc_thread_t *thread = btc_thread_alloc();
   int i;
 
   if (threads < 2)
@@ -181,78 +360,148 @@ btc_workers_create(int threads, int max_batch) {
   pool->mutex = btc_mutex_create();
   pool->master = btc_cond_create();
   pool->worker = btc_cond_create();
-
-  btc_workq_init(&pool->queue);
-
+  pool->deques = safe_malloc(threads * sizeof(btc_deque_t));
   pool->threads = threads;
+  pool->running = threads;
   pool->max_batch = max_batch;
   pool->idle = 0;
   pool->left = 0;
   pool->stop = 0;
+  pool->loop = NULL;
 
-  for (i = 0; i < threads; i++) {
-    btc_thread_create(thread, worker_thread, pool);
-    btc_thread_detach(thread);
-  }
+  for (i = 0; i < threads; i++)
+    btc_deque_init(&pool->deques[i], pool, i);
 
-  btc_thread_free(thread);
+  /* Handles are kept around for pinning. */
+  for (i = 0; i < threads; i++)
+    btc_thread_create(pool->deques[i].thread, worker_thread, &pool->deques[i]);
 
   return pool;
 }
 
 void
 btc_workers_destroy(btc_workers_t *pool) {
-  btc_mutex_lock(pool->mutex);
+  int i;
+
+  for (i = 0; i < pool->threads; i++)
+    btc_deque_clear(&pool->deques[i]);
 
-  btc_workq_clear(&pool->queue);
+  btc_mutex_lock(pool->mutex);
 
   pool->stop = 1;
 
   btc_cond_broadcast(pool->worker);
-  btc_mutex_unlock(pool->mutex);
-
-  btc_mutex_lock(pool->mutex);
 
-  while (pool->threads > 0)
+  while (pool->running > 0)
     btc_cond_wait(pool->master, pool->mutex);
 
   btc_mutex_unlock(pool->mutex);
 
+  for (i = 0; i < pool->threads; i++) {
+    btc_thread_join(pool->deques[i].thread);
+    btc_deque_destroy(&pool->deques[i]);
+  }
+
   btc_mutex_destroy(pool->mutex);
   btc_cond_destroy(pool->worker);
   btc_cond_destroy(pool->master);
 
+  free(pool->deques);
   free(pool);
 }
 
-void
-btc_workers_add(btc_workers_t *pool, btc_work_f *func, void *arg) {
+static void
+btc_workers_reserve(btc_workers_t *pool, int length) {
+  /* Counted before the items become visible
+     so that a fast worker cannot publish its
+     completion ahead of the submission. */
+  btc_mutex_lock(pool->mutex);
+  pool->left += length;
+  btc_mutex_unlock(pool->mutex);
+}
+
+static void
+btc_workers_wake(btc_workers_t *pool, int length) {
   btc_mutex_lock(pool->mutex);
-  btc_workq_push(&pool->queue, func, arg);
-  pool->left++;
-  btc_cond_signal(pool->worker);
+
+  if (pool->idle > 0) {
+    if (length == 1)
+      btc_cond_signal(pool->worker);
+    else
+      btc_cond_broadcast(pool->worker);
+  }
+
   btc_mutex_unlock(pool->mutex);
 }
 
+static void
+btc_workers_submit(btc_workers_t *pool, btc_work_t *work) {
+  /* Shard by address; no shared cursor to race on. */
+  btc_deque_t *dq = &pool->deques[((uintptr_t)work >> 4) % pool->threads];
+
+  btc_workers_reserve(pool, 1);
+
+  btc_mutex_lock(dq->mutex);
+  btc_deque_push(dq, work);
+  btc_mutex_unlock(dq->mutex);
+
+  btc_workers_wake(pool, 1);
+}
+
+int
+btc_workers_pin(btc_workers_t *pool, const int *cpus, size_t length) {
+  /* Threads are dealt out over the set round-robin. */
+  int ret = 1;
+  int i;
+
+  if (length == 0)
+    return 0;
+
+  for (i = 0; i < pool->threads; i++)
+    ret &= btc_thread_pin(pool->deques[i].thread, cpus[i % length]);
+
+  return ret;
+}
+
+void
+btc_workers_add(btc_workers_t *pool, btc_work_f *func, void *arg) {
+  btc_workers_submit(pool, btc_work_create(func, arg));
+}
+
 void
 btc_workers_batch(btc_workers_t *pool, btc_workq_t *batch) {
   int length = batch->length;
+  btc_work_t *work = batch->head;
+  btc_work_t *next;
+  btc_deque_t *dq;
+  int i, j, size;
 
   if (length == 0)
     return;
 
-  btc_mutex_lock(pool->mutex);
+  btc_workers_reserve(pool, length);
 
-  btc_workq_concat(&pool->queue, batch);
+  /* Deal contiguous runs out to every thread. */
+  size = (length + pool->threads - 1) / pool->threads;
 
-  pool->left += length;
+  for (i = 0; i < pool->threads && work != NULL; i++) {
+    dq = &pool->deques[i];
 
-  if (length == 1)
-    btc_cond_signal(pool->worker);
-  else
-    btc_cond_broadcast(pool->worker);
+    btc_mutex_lock(dq->mutex);
 
-  btc_mutex_unlock(pool->mutex);
+    for (j = 0; j < size && work != NULL; j++) {
+      next = work->next;
+      work->next = NULL;
+      btc_deque_push(dq, work);
+      work = next;
+    }
+
+    btc_mutex_unlock(dq->mutex);
+  }
+
+  btc_workq_init(batch);
+
+  btc_workers_wake(pool, length);
 }
 
 void
@@ -265,40 +514,202 @@ btc_workers_wait(btc_workers_t *pool) {
   btc_mutex_unlock(pool->mutex);
 }
 
-static int
-btc_workers_slice(btc_workers_t *pool, btc_workq_t *jobs) {
-  /* Same logic as bitcoin core v0.10.0. */
-  int length = pool->queue.length / (pool->threads + pool->idle + 1);
+void
+btc_workers_notify(btc_workers_t *pool, btc_loop_t *loop) {
+  btc_mutex_lock(pool->mutex);
+  pool->loop = loop;
+  btc_mutex_unlock(pool->mutex);
+}
+
+int
+btc_workers_backlog(btc_workers_t *pool) {
+  /* Queued or running. */
+  int left;
+
+  btc_mutex_lock(pool->mutex);
+
+  left = pool->left;
+
+  btc_mutex_unlock(pool->mutex);
 
-  if (length > pool->max_batch)
-    length = pool->max_batch;
+  return left;
+}
 
-  if (length < 1)
-    length = 1;
+size_t
+btc_workers_queued(btc_workers_t *pool, int priority) {
+  /* Queued but not yet taken, for one class. */
+  size_t length = 0;
+  int i;
+
+  if (priority < 0 || priority >= BTC_WORK_PRIORITIES)
+    abort(); /* LCOV_EXCL_LINE */
 
-  btc_workq_slice(jobs, &pool->queue, length);
+  for (i = 0; i < pool->threads; i++)
+    length += btc_deque_length(&pool->deques[i], priority);
 
   return length;
 }
 
+static btc_work_t *
+btc_workers_next(btc_workers_t *pool, btc_deque_t *self) {
+  /* A higher class is taken from anywhere before a lower
+     one is taken from our own deque. Below the top class
+     we steal one item at a time so that a long run of
+     background work cannot hold up what comes in later. */
+  int start = self != NULL ? self->index + 1 : 0;
+  btc_work_t *work;
+  int i, max, priority;
+
+  for (priority = 0; priority < BTC_WORK_PRIORITIES; priority++) {
+    if (self != NULL) {
+      work = btc_deque_pop(self, priority);
+
+      if (work != NULL)
+        return work;
+    }
+
+    max = priority == BTC_WORK_HIGH ? pool->max_batch : 1;
+
+    for (i = 0; i < pool->threads; i++) {
+      btc_deque_t *dq = &pool->deques[(start + i) % pool->threads];
+
+      work = btc_deque_steal(dq, priority, max);
+
+      if (work != NULL)
+        return work;
+    }
+  }
+
+  return NULL;
+}
+
+static int
+btc_workers_pending(btc_workers_t *pool) {
+  /* Called with the pool lock held. */
+  int i;
+
+  for (i = 0; i < pool->threads; i++) {
+    if (!btc_deque_empty(&pool->deques[i]))
+      return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Tally
+ */
+
+/* Completions are counted locally and published
+ * when the group changes or the thread runs dry,
+ * rather than taking a lock per item.
+ */
+
+typedef struct btc_tally_s {
+  btc_taskgroup_t *group;
+  int group_done;
+  int done;
+} btc_tally_t;
+
 static void
-worker_thread(void *arg) {
-  btc_workers_t *pool = arg;
-  btc_work_t *work, *next;
-  btc_workq_t jobs;
-  int length = 0;
+btc_taskgroup_complete(btc_taskgroup_t *group, int count);
 
-  for (;;) {
+static void
+btc_tally_init(btc_tally_t *tally) {
+  tally->group = NULL;
+  tally->group_done = 0;
+  tally->done = 0;
+}
+
+static void
+btc_tally_flush_group(btc_tally_t *tally) {
+  if (tally->group_done > 0)
+    btc_taskgroup_complete(tally->group, tally->group_done);
+
+  tally->group = NULL;
+  tally->group_done = 0;
+}
+
+static void
+btc_tally_flush(btc_tally_t *tally, btc_workers_t *pool) {
+  btc_loop_t *loop;
+
+  btc_tally_flush_group(tally);
+
+  if (tally->done > 0) {
     btc_mutex_lock(pool->mutex);
 
-    if (length > 0) {
-      pool->left -= length;
+    pool->left -= tally->done;
+
+    if (pool->left == 0)
+      btc_cond_broadcast(pool->master);
 
-      if (!pool->stop && pool->left == 0)
-        btc_cond_signal(pool->master);
+    loop = pool->loop;
+
+    btc_mutex_unlock(pool->mutex);
+
+    /* Results are picked up on the next tick. */
+    if (loop != NULL)
+      btc_loop_wakeup(loop);
+
+    tally->done = 0;
+  }
+}
+
+static void
+btc_tally_run(btc_tally_t *tally, btc_work_t *work) {
+  btc_taskgroup_t *group;
+  btc_work_t *next;
+
+  for (; work != NULL; work = next) {
+    /* The item may be gone once it has run. */
+    group = work->group;
+    next = work->next;
+
+    if (group != tally->group)
+      btc_tally_flush_group(tally);
+
+    btc_work_execute(work);
+
+    tally->group = group;
+    tally->group_done += (group != NULL);
+    tally->done++;
+  }
+}
+
+/*
+ * Worker Thread
+ */
+
+static void
+worker_thread(void *arg) {
+  btc_deque_t *self = arg;
+  btc_workers_t *pool = self->pool;
+  btc_tally_t tally;
+  btc_work_t *work;
+  int spins = 0;
+
+  btc_tally_init(&tally);
+
+  for (;;) {
+    work = btc_workers_next(pool, self);
+
+    if (work != NULL) {
+      btc_tally_run(&tally, work);
+      spins = 0;
+      continue;
     }
 
-    while (!pool->stop && pool->queue.length == 0) {
+    btc_tally_flush(&tally, pool);
+
+    if (spins++ < WORKERS_SPIN)
+      continue;
+
+    spins = 0;
+
+    btc_mutex_lock(pool->mutex);
+
+    while (!pool->stop && !btc_workers_pending(pool)) {
       pool->idle++;
       btc_cond_wait(pool->worker, pool->mutex);
       pool->idle--;
@@ -307,25 +718,219 @@ worker_thread(void *arg) {
     if (pool->stop)
       break;
 
-    if (pool->max_batch > 1) {
-      length = btc_workers_slice(pool, &jobs);
+    btc_mutex_unlock(pool->mutex);
+  }
+
+  if (--pool->running == 0)
+    btc_cond_signal(pool->master);
 
-      btc_mutex_unlock(pool->mutex);
+  btc_mutex_unlock(pool->mutex);
+}
+
+/*
+ * Task Group
+ */
 
-      for (work = jobs.head; work != NULL; work = next)
-        next = btc_work_execute(work);
-    } else {
-      work = btc_workq_shift(&pool->queue);
-      length = 1;
+struct btc_taskgroup_s {
+  btc_workers_t *pool;
+  btc_mutex_t *mutex;
+  btc_cond_t *cond;
+  int priority;
+  int left;
+};
 
-      btc_mutex_unlock(pool->mutex);
+btc_taskgroup_t *
+btc_taskgroup_create(btc_workers_t *pool) {
+  btc_taskgroup_t *group = safe_malloc(sizeof(btc_taskgroup_t));
 
-      btc_work_execute(work);
-    }
+  group->pool = pool;
+  group->mutex = btc_mutex_create();
+  group->cond = btc_cond_create();
+  group->priority = BTC_WORK_NORMAL;
+  group->left = 0;
+
+  return group;
+}
+
+void
+btc_taskgroup_destroy(btc_taskgroup_t *group) {
+  btc_mutex_destroy(group->mutex);
+  btc_cond_destroy(group->cond);
+  free(group);
+}
+
+void
+btc_taskgroup_set_priority(btc_taskgroup_t *group, int priority) {
+  if (priority < 0 || priority >= BTC_WORK_PRIORITIES)
+    abort(); /* LCOV_EXCL_LINE */
+  group->priority = priority;
+}
+
+static void
+btc_taskgroup_reserve(btc_taskgroup_t *group, int length) {
+  btc_mutex_lock(group->mutex);
+  group->left += length;
+  btc_mutex_unlock(group->mutex);
+}
+
+static void
+btc_taskgroup_complete(btc_taskgroup_t *group, int count) {
+  btc_mutex_lock(group->mutex);
+
+  group->left -= count;
+
+  if (group->left == 0)
+    btc_cond_broadcast(group->cond);
+
+  btc_mutex_unlock(group->mutex);
+}
+
+void
+btc_taskgroup_add(btc_taskgroup_t *group, btc_work_f *func, void *arg) {
+  btc_work_t *work = btc_work_create(func, arg);
+
+  work->priority = group->priority;
+  work->group = group;
+
+  btc_taskgroup_reserve(group, 1);
+  btc_workers_submit(group->pool, work);
+}
+
+void
+btc_taskgroup_batch(btc_taskgroup_t *group, btc_workq_t *batch) {
+  btc_work_t *work;
+
+  if (batch->length == 0)
+    return;
+
+  for (work = batch->head; work != NULL; work = work->next) {
+    work->priority = group->priority;
+    work->group = group;
   }
 
-  if (--pool->threads == 0)
-    btc_cond_signal(pool->master);
+  btc_taskgroup_reserve(group, batch->length);
+  btc_workers_batch(group->pool, batch);
+}
 
-  btc_mutex_unlock(pool->mutex);
+void
+btc_taskgroup_wait(btc_taskgroup_t *group) {
+  btc_workers_t *pool = group->pool;
+  btc_tally_t tally;
+  btc_work_t *work;
+  int left;
+
+  btc_tally_init(&tally);
+
+  /* Help out instead of sleeping. Whatever is
+     stolen runs here, whichever group owns it. */
+  for (;;) {
+    btc_mutex_lock(group->mutex);
+    left = group->left;
+    btc_mutex_unlock(group->mutex);
+
+    if (left == 0)
+      break;
+
+    work = btc_workers_next(pool, NULL);
+
+    if (work == NULL)
+      break;
+
+    btc_tally_run(&tally, work);
+  }
+
+  btc_tally_flush(&tally, pool);
+
+  /* Nothing left to take: the rest is running. */
+  btc_mutex_lock(group->mutex);
+
+  while (group->left > 0)
+    btc_cond_wait(group->cond, group->mutex);
+
+  btc_mutex_unlock(group->mutex);
+}
+
+/*
+ * Parallel For
+ */
+
+typedef struct btc_range_s {
+  btc_work_t work;
+  btc_range_f *func;
+  void *arg;
+  size_t start;
+  size_t end;
+} btc_range_t;
+
+static void
+btc_range_work(void *arg) {
+  btc_range_t *range = arg;
+  range->func(range->start, range->end, range->arg);
+}
+
+void
+btc_parallel_for(btc_workers_t *pool,
+                 size_t length,
+                 size_t grain,
+                 btc_range_f *func,
+                 void *arg) {
+  btc_parallel_for_ex(pool, BTC_WORK_NORMAL, length, grain, func, arg);
+}
+
+void
+btc_parallel_for_ex(btc_workers_t *pool,
+                    int priority,
+                    size_t length,
+                    size_t grain,
+                    btc_range_f *func,
+                    void *arg) {
+  btc_taskgroup_t *group;
+  btc_range_t *ranges;
+  btc_workq_t batch;
+  size_t i, count;
+
+  if (length == 0)
+    return;
+
+  /* A few chunks per thread so that
+     stealing can even out the tail. */
+  if (grain == 0)
+    grain = length / ((size_t)pool->threads * 4);
+
+  if (grain == 0)
+    grain = 1;
+
+  count = (length + grain - 1) / grain;
+
+  if (count == 1) {
+    func(0, length, arg);
+    return;
+  }
+
+  ranges = safe_malloc(count * sizeof(btc_range_t));
+  group = btc_taskgroup_create(pool);
+
+  btc_taskgroup_set_priority(group, priority);
+
+  btc_workq_init(&batch);
+
+  for (i = 0; i < count; i++) {
+    btc_range_t *range = &ranges[i];
+
+    range->func = func;
+    range->arg = arg;
+    range->start = i * grain;
+    range->end = range->start + grain;
+
+    if (range->end > length)
+      range->end = length;
+
+    btc_workq_append(&batch, &range->work, btc_range_work, range);
+  }
+
+  btc_taskgroup_batch(group, &batch);
+  btc_taskgroup_wait(group);
+  btc_taskgroup_destroy(group);
+
+  free(ranges);
 }
@@ -177,33 +177,38 @@ json_stack_new(const btc_stack_t *stack) {
   return obj;
 }
 
-static json_value *
-json_script_type_new(const btc_script_t *script) {
+static const char *
+json_script_type(const btc_script_t *script) {
   if (btc_script_is_p2pk(script))
-    return json_string_new("pubkey");
+    return "pubkey";
 
   if (btc_script_is_p2pkh(script))
-    return json_string_new("pubkeyhash");
+    return "pubkeyhash";
 
   if (btc_script_is_p2sh(script))
-    return json_string_new("scripthash");
+    return "scripthash";
 
   if (btc_script_is_multisig(script))
-    return json_string_new("multisig");
+    return "multisig";
 
   if (btc_script_is_nulldata(script))
-    return json_string_new("nulldata");
+    return "nulldata";
 
   if (btc_script_is_p2wpkh(script))
-    return json_string_new("witness_v0_keyhash");
+    return "witness_v0_keyhash";
 
   if (btc_script_is_p2wsh(script))
-    return json_string_new("witness_v0_scripthash");
+    return "witness_v0_scripthash";
 
   if (btc_script_is_program(script))
-    return json_string_new("witness_unknown");
+    return "witness_unknown";
 
-  return json_string_new("nonstandard");
+  return "nonstandard";
+}
+
+static json_value *
+json_script_type_new(const btc_script_t *script) {
+  return json_string_new(json_script_type(script));
 }
 
 static json_value *
@@ -579,3 +584,505 @@ json_block_raw(const btc_block_t *block) {
 
   return json_string_new_nocopy(size * 2, str);
 }
+
+/*
+ * JSON Writer
+ */
+
+void
+json_writer_init(json_writer *w, json_writer_sink *sink, void *arg) {
+  w->data = NULL;
+  w->alloc = 0;
+  w->length = 0;
+  w->sink = sink;
+  w->arg = arg;
+  w->depth = 0;
+  w->count[0] = 0;
+  w->keyed = 0;
+}
+
+void
+json_writer_clear(json_writer *w) {
+  if (w->alloc > 0)
+    btc_free(w->data);
+
+  w->data = NULL;
+  w->alloc = 0;
+  w->length = 0;
+}
+
+void
+json_writer_flush(json_writer *w) {
+  if (w->sink != NULL && w->length > 0) {
+    w->sink(w->arg, w->data, w->length);
+    w->length = 0;
+  }
+}
+
+static char *
+json_writer_reserve(json_writer *w, size_t size) {
+  /* With a sink attached, output goes out in
+     JSON_WRITER_CHUNK sized pieces. Otherwise
+     the whole document accumulates in memory. */
+  if (w->sink != NULL && w->length + size > JSON_WRITER_CHUNK)
+    json_writer_flush(w);
+
+  if (w->length + size > w->alloc) {
+    size_t alloc = w->alloc;
+
+    if (alloc < JSON_WRITER_CHUNK)
+      alloc = JSON_WRITER_CHUNK;
+
+    while (alloc < w->length + size)
+      alloc *= 2;
+
+    w->data = (char *)btc_realloc(w->data, alloc);
+    w->alloc = alloc;
+  }
+
+  return w->data + w->length;
+}
+
+static void
+json_writer_put(json_writer *w, const char *xp, size_t xn) {
+  memcpy(json_writer_reserve(w, xn), xp, xn);
+  w->length += xn;
+}
+
+static void
+json_writer_separate(json_writer *w) {
+  if (w->keyed) {
+    w->keyed = 0;
+    return;
+  }
+
+  /* Only whether the container is empty matters. */
+  if (w->count[w->depth])
+    json_writer_put(w, ",", 1);
+  else
+    w->count[w->depth] = 1;
+}
+
+static void
+json_writer_open(json_writer *w, int ch) {
+  char c = ch;
+
+  json_writer_separate(w);
+  json_writer_put(w, &c, 1);
+
+  CHECK(w->depth + 1 < JSON_WRITER_DEPTH);
+
+  w->count[++w->depth] = 0;
+}
+
+static void
+json_writer_close(json_writer *w, int ch) {
+  char c = ch;
+
+  CHECK(w->depth > 0 && !w->keyed);
+
+  json_writer_put(w, &c, 1);
+
+  w->depth--;
+}
+
+void
+json_writer_object_begin(json_writer *w) {
+  json_writer_open(w, '{');
+}
+
+void
+json_writer_object_end(json_writer *w) {
+  json_writer_close(w, '}');
+}
+
+void
+json_writer_array_begin(json_writer *w) {
+  json_writer_open(w, '[');
+}
+
+void
+json_writer_array_end(json_writer *w) {
+  json_writer_close(w, ']');
+}
+
+void
+json_writer_key(json_writer *w, const char *name) {
+  json_writer_string(w, name);
+  json_writer_put(w, ":", 1);
+  w->keyed = 1;
+}
+
+void
+json_writer_value(json_writer *w, json_value *value) {
+  /* Same encoding as json_encode (packed). The
+     measurement is an upper bound for doubles. */
+  size_t size = json_measure(value);
+  char *zp;
+
+  json_writer_separate(w);
+
+  zp = json_writer_reserve(w, size);
+
+  json_serialize(zp, value);
+
+  w->length += strlen(zp);
+}
+
+static void
+json_writer_scalar(json_writer *w, json_value *value, json_type type) {
+  value->parent = NULL;
+  value->type = type;
+
+  json_writer_value(w, value);
+}
+
+void
+json_writer_string(json_writer *w, const char *str) {
+  json_value value;
+
+  memset(&value, 0, sizeof(value));
+
+  value.u.string.length = strlen(str);
+  value.u.string.ptr = (json_char *)str;
+
+  json_writer_scalar(w, &value, json_string);
+}
+
+void
+json_writer_integer(json_writer *w, int64_t x) {
+  json_value value;
+
+  memset(&value, 0, sizeof(value));
+
+  value.u.integer = x;
+
+  json_writer_scalar(w, &value, json_integer);
+}
+
+void
+json_writer_amount(json_writer *w, int64_t x) {
+  json_value value;
+
+  memset(&value, 0, sizeof(value));
+
+  value.u.integer = x;
+
+  json_writer_scalar(w, &value, json_amount);
+}
+
+void
+json_writer_double(json_writer *w, double x) {
+  json_value value;
+
+  memset(&value, 0, sizeof(value));
+
+  value.u.dbl = x;
+
+  json_writer_scalar(w, &value, json_double);
+}
+
+void
+json_writer_boolean(json_writer *w, int x) {
+  json_value value;
+
+  memset(&value, 0, sizeof(value));
+
+  value.u.boolean = x;
+
+  json_writer_scalar(w, &value, json_boolean);
+}
+
+void
+json_writer_null(json_writer *w) {
+  json_writer_separate(w);
+  json_writer_put(w, "null", 4);
+}
+
+static void
+json_writer_hex(json_writer *w, const uint8_t *data, size_t size) {
+  char *zp;
+
+  json_writer_separate(w);
+
+  zp = json_writer_reserve(w, size * 2 + 3);
+
+  *zp++ = '"';
+
+  btc_base16_encode(zp, data, size);
+
+  zp[size * 2] = '"';
+
+  w->length += size * 2 + 2;
+}
+
+void
+json_writer_hash(json_writer *w, const uint8_t *hash) {
+  char str[64 + 1];
+
+  if (hash == NULL) {
+    json_writer_null(w);
+    return;
+  }
+
+  btc_hash_export(str, hash);
+
+  json_writer_separate(w);
+  json_writer_put(w, "\"", 1);
+  json_writer_put(w, str, 64);
+  json_writer_put(w, "\"", 1);
+}
+
+void
+json_writer_buffer(json_writer *w, const btc_buffer_t *item) {
+  json_writer_hex(w, item->data, item->length);
+}
+
+/*
+ * JSON Streams
+ */
+
+static void
+json_stack_write(json_writer *w, const btc_stack_t *stack) {
+  size_t i;
+
+  json_writer_array_begin(w);
+
+  for (i = 0; i < stack->length; i++)
+    json_writer_buffer(w, stack->items[i]);
+
+  json_writer_array_end(w);
+}
+
+static void
+json_script_asm_write(json_writer *w, const btc_script_t *script) {
+  char *str = btc_script_asm(script);
+
+  json_writer_string(w, str);
+
+  btc_free(str);
+}
+
+static void
+json_scriptsig_write(json_writer *w, const btc_script_t *script) {
+  json_writer_object_begin(w);
+  json_writer_key(w, "asm");
+  json_script_asm_write(w, script);
+  json_writer_key(w, "hex");
+  json_writer_buffer(w, script);
+  json_writer_object_end(w);
+}
+
+static void
+json_script_write(json_writer *w,
+                  const btc_script_t *script,
+                  const btc_network_t *network) {
+  char str[BTC_ADDRESS_MAXLEN + 1];
+  btc_address_t addr;
+
+  json_writer_object_begin(w);
+  json_writer_key(w, "asm");
+  json_script_asm_write(w, script);
+  json_writer_key(w, "hex");
+  json_writer_buffer(w, script);
+
+  if (btc_address_set_script(&addr, script)) {
+    btc_address_get_str(str, &addr, network);
+
+    json_writer_key(w, "address");
+    json_writer_string(w, str);
+  }
+
+  json_writer_key(w, "type");
+  json_writer_string(w, json_script_type(script));
+  json_writer_object_end(w);
+}
+
+static void
+json_coin_write(json_writer *w,
+                const btc_coin_t *coin,
+                const btc_network_t *network) {
+  json_writer_object_begin(w);
+  json_writer_key(w, "generated");
+  json_writer_boolean(w, coin->coinbase);
+  json_writer_key(w, "height");
+  json_writer_integer(w, coin->height);
+  json_writer_key(w, "value");
+  json_writer_amount(w, coin->output.value);
+  json_writer_key(w, "scriptPubKey");
+  json_script_write(w, &coin->output.script, network);
+  json_writer_object_end(w);
+}
+
+static void
+json_input_write(json_writer *w,
+                 const btc_input_t *input,
+                 const btc_view_t *view,
+                 const btc_network_t *network) {
+  const btc_coin_t *coin = NULL;
+
+  if (view != NULL)
+    coin = btc_view_get(view, &input->prevout);
+
+  json_writer_object_begin(w);
+
+  if (btc_outpoint_is_null(&input->prevout)) {
+    json_writer_key(w, "coinbase");
+    json_writer_buffer(w, &input->script);
+  } else {
+    json_writer_key(w, "txid");
+    json_writer_hash(w, input->prevout.hash);
+    json_writer_key(w, "vout");
+    json_writer_integer(w, input->prevout.index);
+    json_writer_key(w, "scriptSig");
+    json_scriptsig_write(w, &input->script);
+  }
+
+  if (input->witness.length > 0) {
+    json_writer_key(w, "txinwitness");
+    json_stack_write(w, &input->witness);
+  }
+
+  if (coin != NULL) {
+    json_writer_key(w, "prevout");
+    json_coin_write(w, coin, network);
+  }
+
+  json_writer_key(w, "sequence");
+  json_writer_integer(w, input->sequence);
+
+  json_writer_object_end(w);
+}
+
+static void
+json_output_write(json_writer *w,
+                  const btc_output_t *output,
+                  size_t index,
+                  const btc_network_t *network) {
+  json_writer_object_begin(w);
+  json_writer_key(w, "value");
+  json_writer_amount(w, output->value);
+  json_writer_key(w, "scriptPubKey");
+  json_script_write(w, &output->script, network);
+  json_writer_key(w, "n");
+  json_writer_integer(w, index);
+  json_writer_object_end(w);
+}
+
+void
+json_tx_write(json_writer *w,
+              const btc_tx_t *tx,
+              const btc_view_t *view,
+              const btc_network_t *network) {
+  size_t base = btc_tx_base_size(tx);
+  size_t wit = btc_tx_witness_size(tx);
+  size_t size = base + wit;
+  size_t weight = (base * BTC_WITNESS_SCALE_FACTOR) + wit;
+  size_t vsize = weight;
+  size_t i;
+
+  vsize += (BTC_WITNESS_SCALE_FACTOR - 1);
+  vsize /= BTC_WITNESS_SCALE_FACTOR;
+
+  json_writer_object_begin(w);
+  json_writer_key(w, "txid");
+  json_writer_hash(w, tx->hash);
+  json_writer_key(w, "hash");
+  json_writer_hash(w, tx->whash);
+  json_writer_key(w, "version");
+  json_writer_integer(w, tx->version);
+  json_writer_key(w, "size");
+  json_writer_integer(w, size);
+  json_writer_key(w, "vsize");
+  json_writer_integer(w, vsize);
+  json_writer_key(w, "weight");
+  json_writer_integer(w, weight);
+  json_writer_key(w, "locktime");
+  json_writer_integer(w, tx->locktime);
+
+  if (view != NULL) {
+    int64_t fee = btc_tx_fee(tx, view);
+
+    if (fee != -1) {
+      json_writer_key(w, "fee");
+      json_writer_amount(w, fee);
+    }
+  }
+
+  json_writer_key(w, "vin");
+  json_writer_array_begin(w);
+
+  for (i = 0; i < tx->inputs.length; i++)
+    json_input_write(w, tx->inputs.items[i], view, network);
+
+  json_writer_array_end(w);
+
+  json_writer_key(w, "vout");
+  json_writer_array_begin(w);
+
+  for (i = 0; i < tx->outputs.length; i++)
+    json_output_write(w, tx->outputs.items[i], i, network);
+
+  json_writer_array_end(w);
+
+  json_writer_object_end(w);
+}
+
+void
+json_block_write_begin(json_writer *w,
+                       const btc_block_t *block,
+                       const btc_entry_t *entry,
+                       int confirmations,
+                       const uint8_t *next) {
+  const btc_header_t *hdr = &entry->header;
+  size_t base = btc_block_base_size(block);
+  size_t wit = btc_block_witness_size(block);
+  size_t size = base + wit;
+  size_t weight = (base * BTC_WITNESS_SCALE_FACTOR) + wit;
+
+  /* Same layout as json_block_new_ex. The
+     caller writes the `tx` array elements. */
+  json_writer_object_begin(w);
+  json_writer_key(w, "hash");
+  json_writer_hash(w, entry->hash);
+  json_writer_key(w, "height");
+  json_writer_integer(w, entry->height);
+  json_writer_key(w, "version");
+  json_writer_integer(w, hdr->version);
+  json_writer_key(w, "previousblockhash");
+  json_writer_hash(w, hdr->prev_block);
+  json_writer_key(w, "merkleroot");
+  json_writer_hash(w, hdr->merkle_root);
+  json_writer_key(w, "time");
+  json_writer_integer(w, hdr->time);
+  json_writer_key(w, "bits");
+  json_writer_integer(w, hdr->bits);
+  json_writer_key(w, "nonce");
+  json_writer_integer(w, hdr->nonce);
+  json_writer_key(w, "chainwork");
+  json_writer_hash(w, entry->chainwork);
+  json_writer_key(w, "mediantime");
+  json_writer_integer(w, btc_entry_median_time(entry));
+  json_writer_key(w, "difficulty");
+  json_writer_double(w, btc_difficulty(hdr->bits));
+  json_writer_key(w, "confirmations");
+  json_writer_integer(w, confirmations);
+  json_writer_key(w, "nextblockhash");
+  json_writer_hash(w, next);
+  json_writer_key(w, "strippedsize");
+  json_writer_integer(w, base);
+  json_writer_key(w, "size");
+  json_writer_integer(w, size);
+  json_writer_key(w, "weight");
+  json_writer_integer(w, weight);
+  json_writer_key(w, "nTx");
+  json_writer_integer(w, block->txs.length);
+  json_writer_key(w, "tx");
+  json_writer_array_begin(w);
+}
+
+void
+json_block_write_end(json_writer *w) {
+  json_writer_array_end(w);
+  json_writer_object_end(w);
+}
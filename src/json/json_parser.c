@@ -89,6 +89,8 @@ typedef struct
    const json_char * ptr;
    unsigned int cur_line, cur_col;
 
+   int insitu;
+
 } json_state;
 
 static void * default_alloc (size_t size, int zero, void * user_data)
@@ -168,6 +170,22 @@ static int new_value (json_state * state,
 
          case json_string:
 
+            /* In place, a string with no escapes is the run of input
+             * up to its closing quote. The first pass stored its
+             * decoded length, which is shorter whenever it has any.
+             */
+            if (state->insitu)
+            {
+               json_char * raw = (json_char *) state->ptr + 1;
+               unsigned int length = value->u.string.length;
+
+               if (raw [length] == '"' && !memchr (raw, '\\', length))
+               {
+                  value->u.string.ptr = raw;
+                  break;
+               }
+            }
+
             if (! (value->u.string.ptr = (json_char *) json_alloc
                (state, (value->u.string.length + 1) * sizeof (json_char), 0)) )
             {
@@ -237,10 +255,11 @@ static const long
    flag_block_comment    = 1 << 14,
    flag_num_got_decimal  = 1 << 15;
 
-json_value * json_parse_ex (json_settings * settings,
-                            const json_char * json,
-                            size_t length,
-                            char * error_buf)
+static json_value * parse (json_settings * settings,
+                           const json_char * json,
+                           size_t length,
+                           char * error_buf,
+                           int insitu)
 {
    char error [json_error_max];
    const json_char * end;
@@ -265,6 +284,8 @@ json_value * json_parse_ex (json_settings * settings,
 
    memcpy (&state.settings, settings, sizeof (json_settings));
 
+   state.insitu = insitu;
+
    if (!state.settings.mem_alloc)
       state.settings.mem_alloc = default_alloc;
 
@@ -603,6 +624,15 @@ json_value * json_parse_ex (json_settings * settings,
                         if (!new_value (&state, &top, &root, &alloc, json_string))
                            goto e_alloc_failure;
 
+                        if (!state.first_pass && top->u.string.ptr == state.ptr + 1)
+                        {
+                           state.ptr += top->u.string.length + 1;
+                           *(json_char *) state.ptr = 0;
+
+                           flags |= flag_next;
+                           break;
+                        }
+
                         flags |= flag_string;
 
                         string = top->u.string.ptr;
@@ -998,6 +1028,14 @@ e_failed:
    return 0;
 }
 
+json_value * json_parse_ex (json_settings * settings,
+                            const json_char * json,
+                            size_t length,
+                            char * error_buf)
+{
+   return parse (settings, json, length, error_buf, 0);
+}
+
 json_value * json_parse (const json_char * json, size_t length)
 {
    json_settings settings = { 0 };
@@ -1060,3 +1098,94 @@ void json_value_free (json_value * value)
    settings.mem_free = default_free;
    json_value_free_ex (&settings, value);
 }
+
+typedef struct _json_chunk
+{
+   struct _json_chunk * next;
+   size_t size, used;
+   double align;  /* keeps what follows aligned for values */
+
+} json_chunk;
+
+static void * arena_alloc (size_t size, int zero, void * user_data)
+{
+   json_arena * arena = (json_arena *) user_data;
+   json_chunk * chunk = (json_chunk *) arena->head;
+   void * ptr;
+
+   size = (size + 7) & ~(size_t) 7;
+
+   if (!chunk || chunk->size - chunk->used < size)
+   {
+      size_t avail = arena->size;
+
+      /* Later chunks double, so that a
+       * misestimate costs few mallocs.
+       */
+      if (avail < size)
+         avail = size;
+
+      if (! (chunk = (json_chunk *) malloc (sizeof (json_chunk) + avail)) )
+         return 0;
+
+      chunk->next = (json_chunk *) arena->head;
+      chunk->size = avail;
+      chunk->used = 0;
+
+      arena->head = chunk;
+      arena->size *= 2;
+   }
+
+   ptr = (char *) (chunk + 1) + chunk->used;
+   chunk->used += size;
+
+   if (zero)
+      memset (ptr, 0, size);
+
+   return ptr;
+}
+
+static void arena_free (void * ptr, void * user_data)
+{
+   (void)ptr;
+   (void)user_data;
+}
+
+json_value * json_parse_insitu (json_settings * settings,
+                                json_arena * arena,
+                                json_char * json,
+                                size_t length,
+                                char * error_buf)
+{
+   json_settings local;
+
+   memcpy (&local, settings, sizeof (json_settings));
+
+   local.mem_alloc = arena_alloc;
+   local.mem_free = arena_free;
+   local.user_data = arena;
+
+   /* Most of a request is a few long strings,
+    * which stay in the input; the values fit
+    * in about as much again.
+    */
+   arena->head = 0;
+   arena->size = (length + 1024) & ~(size_t) 7;
+
+   return parse (&local, json, length, error_buf, 1);
+}
+
+void json_arena_free (json_arena * arena)
+{
+   json_chunk * chunk = (json_chunk *) arena->head;
+
+   while (chunk)
+   {
+      json_chunk * next = chunk->next;
+      free (chunk);
+      chunk = next;
+   }
+
+   arena->head = 0;
+   arena->size = 0;
+}
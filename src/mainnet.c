@@ -554,6 +554,15 @@ static const btc_network_t mainnet = {
     /* .length = */ lengthof(mainnet_checkpoints)
   },
   /* .last_checkpoint = */ 710000,
+  /* .assume_valid = */ {
+    724466,
+    {
+      0x91, 0x70, 0x5a, 0x1f, 0x8f, 0xea, 0x67, 0xa0,
+      0x12, 0x6b, 0xdf, 0x68, 0x4e, 0x94, 0x65, 0xca,
+      0x55, 0x97, 0x25, 0x4a, 0x31, 0x2d, 0x05, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    }
+  },
   /* .halving_interval = */ 210000,
   /* .genesis = */ {
     /* .hash = */ {
@@ -658,6 +667,15 @@ static const btc_network_t mainnet = {
         0x74, 0x3b, 0xcb, 0xd9, 0x18, 0x80, 0x1c, 0x00,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
       }
+    },
+    /* .taproot = */ {
+      709632,
+      {
+        0x44, 0x82, 0x4d, 0xa9, 0xc0, 0x4e, 0xb5, 0x4b,
+        0xb4, 0x29, 0x86, 0x31, 0x49, 0xf9, 0xc1, 0xc2,
+        0x4d, 0x19, 0x86, 0xa9, 0xbc, 0x87, 0x06, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+      }
     }
   },
   /* .activation_threshold = */ 1916, /* 95% of 2016 */
@@ -670,7 +688,8 @@ static const btc_network_t mainnet = {
     /* .data = */ NULL,
     /* .alloc = */ 0,
     /* .length = */ 0,
-    /* ._refs = */ 0
+    /* ._refs = */ 0,
+    /* .small = */ {0}
   },
   /* .key = */ {
     /* .privkey = */ 0x80,
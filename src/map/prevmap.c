@@ -0,0 +1,324 @@
+/*!
+ * prevmap.c - prevout map for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/map.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include "map.h"
+
+/*
+ * Types
+ */
+
+/* A swiss table (see swiss.h) whose slots hold
+ * the 36 byte outpoint itself. Lookups compare
+ * keys without chasing a pointer, and the table
+ * owns its keys.
+ *
+ * The starting group depends on the txid and on
+ * index / 16 only: the outputs of a tx (the usual
+ * walk when removing its spenders) land in the
+ * same or neighbouring groups instead of across
+ * the whole table. The index is folded into the
+ * 7 bits kept in the control byte.
+ */
+
+typedef struct btc_prevslot_s {
+  btc_outpoint_t key;
+  void *val;
+} btc_prevslot_t;
+
+struct btc_prevmap_s {
+  uint32_t n_buckets, size, growth;
+  uint8_t *ctrl;
+  btc_prevslot_t *slots;
+};
+
+/*
+ * Helpers
+ */
+
+static uint32_t
+prevmap_hash(const btc_outpoint_t *key) {
+  return btc_hash_key(key->hash, 0);
+}
+
+static uint32_t
+prevmap_start(const btc_prevmap_t *map, const btc_outpoint_t *key,
+              uint32_t hash) {
+  uint32_t mask = (map->n_buckets / SW_GROUP) - 1;
+  return ((hash >> 7) + (key->index >> 4)) & mask;
+}
+
+static int
+prevmap_tag(const btc_outpoint_t *key, uint32_t hash) {
+  return (hash ^ (key->index * 0x9e3779b1)) >> 25;
+}
+
+static uint32_t
+prevmap_find(const btc_prevmap_t *map, const btc_outpoint_t *key) {
+  uint32_t hash, mask, step, g;
+  int h2;
+
+  if (map->n_buckets == 0)
+    return 0;
+
+  hash = prevmap_hash(key);
+  mask = (map->n_buckets / SW_GROUP) - 1;
+  step = 0;
+  g = prevmap_start(map, key, hash);
+  h2 = prevmap_tag(key, hash);
+
+  for (;;) {
+    const uint8_t *ctrl = &map->ctrl[g * SW_GROUP];
+    sw_mask_t match = sw_match(ctrl, h2);
+
+    while (match != 0) {
+      uint32_t i = g * SW_GROUP + sw_lowest(match);
+      const btc_outpoint_t *slot = &map->slots[i].key;
+
+      if (slot->index == key->index && btc_hash_equal(slot->hash, key->hash))
+        return i;
+
+      match &= match - 1;
+    }
+
+    if (sw_match_empty(ctrl) != 0)
+      return map->n_buckets;
+
+    g = (g + ++step) & mask;
+  }
+}
+
+static uint32_t
+prevmap_slot(const btc_prevmap_t *map, const btc_outpoint_t *key,
+             uint32_t hash) {
+  uint32_t mask = (map->n_buckets / SW_GROUP) - 1;
+  uint32_t g = prevmap_start(map, key, hash);
+  uint32_t step = 0;
+
+  for (;;) {
+    sw_mask_t match = sw_match_free(&map->ctrl[g * SW_GROUP]);
+
+    if (match != 0)
+      return g * SW_GROUP + sw_lowest(match);
+
+    g = (g + ++step) & mask;
+  }
+}
+
+static int
+prevmap_rehash(btc_prevmap_t *map, uint32_t n_buckets) {
+  uint32_t n = SW_GROUP;
+  btc_prevmap_t t;
+  uint32_t i;
+
+  if (n_buckets > ((uint32_t)1 << 31))
+    return 0;
+
+  while (n < n_buckets)
+    n <<= 1;
+
+  if (map->size >= sw_capacity(n))
+    return 1;
+
+  t.n_buckets = n;
+  t.size = map->size;
+  t.growth = sw_capacity(n) - map->size;
+  t.ctrl = (uint8_t *)malloc(n);
+  t.slots = (btc_prevslot_t *)malloc(n * sizeof(btc_prevslot_t));
+
+  if (t.ctrl == NULL || t.slots == NULL) {
+    free(t.ctrl);
+    free(t.slots);
+    return 0;
+  }
+
+  memset(t.ctrl, SW_EMPTY, n);
+
+  for (i = 0; i < map->n_buckets; i++) {
+    const btc_prevslot_t *slot = &map->slots[i];
+    uint32_t hash, j;
+
+    if (map->ctrl[i] & 0x80)
+      continue;
+
+    hash = prevmap_hash(&slot->key);
+    j = prevmap_slot(&t, &slot->key, hash);
+
+    t.ctrl[j] = (uint8_t)prevmap_tag(&slot->key, hash);
+    t.slots[j] = *slot;
+  }
+
+  free(map->ctrl);
+  free(map->slots);
+
+  *map = t;
+
+  return 1;
+}
+
+static void
+prevmap_erase(btc_prevmap_t *map, uint32_t i) {
+  const uint8_t *group = &map->ctrl[i & ~(uint32_t)(SW_GROUP - 1)];
+
+  if (sw_match_empty(group) != 0) {
+    map->ctrl[i] = SW_EMPTY;
+    map->growth++;
+  } else {
+    map->ctrl[i] = SW_DELETED;
+  }
+
+  map->size--;
+}
+
+/*
+ * Prevout Map
+ */
+
+btc_prevmap_t *
+btc_prevmap_create(void) {
+  btc_prevmap_t *map = (btc_prevmap_t *)calloc(1, sizeof(btc_prevmap_t));
+
+  if (map == NULL)
+    abort(); /* LCOV_EXCL_LINE */
+
+  return map;
+}
+
+void
+btc_prevmap_destroy(btc_prevmap_t *map) {
+  free(map->ctrl);
+  free(map->slots);
+  free(map);
+}
+
+void
+btc_prevmap_reset(btc_prevmap_t *map) {
+  if (map->ctrl != NULL) {
+    memset(map->ctrl, SW_EMPTY, map->n_buckets);
+    map->size = 0;
+    map->growth = sw_capacity(map->n_buckets);
+  }
+}
+
+void
+btc_prevmap_resize(btc_prevmap_t *map, size_t size) {
+  if (size > ((uint32_t)1 << 31))
+    size = ((uint32_t)1 << 31);
+
+  if (!prevmap_rehash(map, size))
+    abort(); /* LCOV_EXCL_LINE */
+}
+
+size_t
+btc_prevmap_size(const btc_prevmap_t *map) {
+  return map->size;
+}
+
+size_t
+btc_prevmap_buckets(const btc_prevmap_t *map) {
+  return map->n_buckets;
+}
+
+int
+btc_prevmap_has(const btc_prevmap_t *map, const btc_outpoint_t *key) {
+  return prevmap_find(map, key) != map->n_buckets;
+}
+
+void *
+btc_prevmap_get(const btc_prevmap_t *map, const btc_outpoint_t *key) {
+  uint32_t i = prevmap_find(map, key);
+
+  if (i == map->n_buckets)
+    return NULL;
+
+  return map->slots[i].val;
+}
+
+int
+btc_prevmap_put(btc_prevmap_t *map, const btc_outpoint_t *key, void *val) {
+  uint32_t hash, i;
+
+  if (prevmap_find(map, key) != map->n_buckets)
+    return 0;
+
+  if (map->growth == 0) {
+    /* Grow, unless it is mostly tombstones. */
+    uint32_t n = map->n_buckets;
+
+    if (map->size >= sw_capacity(n) / 2)
+      n *= 2;
+
+    if (!prevmap_rehash(map, n))
+      abort(); /* LCOV_EXCL_LINE */
+  }
+
+  hash = prevmap_hash(key);
+  i = prevmap_slot(map, key, hash);
+
+  if (map->ctrl[i] == SW_EMPTY)
+    map->growth--;
+
+  map->ctrl[i] = (uint8_t)prevmap_tag(key, hash);
+  map->slots[i].key = *key;
+  map->slots[i].val = val;
+  map->size++;
+
+  return 1;
+}
+
+int
+btc_prevmap_del(btc_prevmap_t *map, const btc_outpoint_t *key) {
+  uint32_t i = prevmap_find(map, key);
+
+  if (i == map->n_buckets)
+    return 0;
+
+  prevmap_erase(map, i);
+
+  return 1;
+}
+
+void *
+btc_prevmap_rem(btc_prevmap_t *map, const btc_outpoint_t *key) {
+  uint32_t i = prevmap_find(map, key);
+
+  if (i == map->n_buckets)
+    return NULL;
+
+  prevmap_erase(map, i);
+
+  return map->slots[i].val;
+}
+
+void
+btc_prevmap_iterate(btc_prevmapiter_t *iter, const btc_prevmap_t *map) {
+  iter->map = map;
+  iter->it = 0;
+  iter->key = NULL;
+  iter->val = NULL;
+}
+
+int
+btc_prevmap_next(btc_prevmapiter_t *iter) {
+  const btc_prevmap_t *map = iter->map;
+
+  for (; iter->it != map->n_buckets; iter->it++) {
+    if (!(map->ctrl[iter->it] & 0x80)) {
+      iter->key = &map->slots[iter->it].key;
+      iter->val = map->slots[iter->it].val;
+      iter->it++;
+      return 1;
+    }
+  }
+
+  return 0;
+}
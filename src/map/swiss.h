@@ -0,0 +1,407 @@
+/*!
+ * swiss.h - group-probed hash table for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://abseil.io/about/design/swisstables
+ */
+
+#ifndef BTC_SWISS_H
+#define BTC_SWISS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Every slot has a control byte: the top bit marks
+ * it as empty (0x80) or deleted (0xfe), otherwise
+ * the low 7 bits hold 7 bits of the key's hash. A
+ * lookup compares a whole group of 16 control bytes
+ * against those bits at once and only touches the
+ * keys that match, so a probe costs one cache line
+ * of control bytes instead of a walk over the keys.
+ *
+ * Groups are aligned and probed triangularly. This
+ * is simpler than abseil's unaligned windows: a slot
+ * can be marked empty again on deletion whenever its
+ * group still has an empty slot, since no probe ever
+ * continued past such a group.
+ *
+ * The functions mirror khash (init, destroy, clear,
+ * resize, get, put, del) so that map.h can generate
+ * either table from the same code.
+ */
+
+#ifndef sw_inline
+#  define sw_inline
+#endif
+
+#ifndef sw_unused
+#  define sw_unused
+#endif
+
+/*
+ * Backend
+ */
+
+#if !defined(BTC_SWISS_PORTABLE)
+#  if defined(__SSE2__) || defined(_M_X64) \
+   || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define SW_HAVE_SSE2
+#    include <emmintrin.h>
+#  elif defined(__aarch64__) && defined(__ARM_NEON)
+#    define SW_HAVE_NEON
+#    include <arm_neon.h>
+#  endif
+#endif
+
+/*
+ * Constants
+ */
+
+#define SW_GROUP 16
+#define SW_EMPTY 0x80
+#define SW_DELETED 0xfe
+
+/* 7/8 of the slots (counting tombstones). */
+#define sw_capacity(n) ((n) - ((n) >> 3))
+
+/*
+ * Group Matching
+ */
+
+/* A match is a bitmask with one set bit per
+ * matching slot. NEON has no movemask: there
+ * we narrow to a nibble per slot instead.
+ */
+
+typedef uint64_t sw_mask_t;
+
+#if defined(SW_HAVE_NEON)
+#  define SW_MASK_SHIFT 2
+#else
+#  define SW_MASK_SHIFT 0
+#endif
+
+#if defined(SW_HAVE_SSE2)
+
+static sw_inline sw_unused sw_mask_t
+sw_match(const uint8_t *ctrl, int h2) {
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  __m128i match = _mm_set1_epi8((char)h2);
+  return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, match));
+}
+
+static sw_inline sw_unused sw_mask_t
+sw_match_empty(const uint8_t *ctrl) {
+  return sw_match(ctrl, SW_EMPTY);
+}
+
+static sw_inline sw_unused sw_mask_t
+sw_match_free(const uint8_t *ctrl) {
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return (unsigned int)_mm_movemask_epi8(group);
+}
+
+#elif defined(SW_HAVE_NEON)
+
+static sw_inline sw_unused sw_mask_t
+sw_movemask(uint8x16_t eq) {
+  uint8x8_t nib = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+  uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nib), 0);
+  return mask & UINT64_C(0x8888888888888888);
+}
+
+static sw_inline sw_unused sw_mask_t
+sw_match(const uint8_t *ctrl, int h2) {
+  uint8x16_t group = vld1q_u8(ctrl);
+  return sw_movemask(vceqq_u8(group, vdupq_n_u8((uint8_t)h2)));
+}
+
+static sw_inline sw_unused sw_mask_t
+sw_match_empty(const uint8_t *ctrl) {
+  return sw_match(ctrl, SW_EMPTY);
+}
+
+static sw_inline sw_unused sw_mask_t
+sw_match_free(const uint8_t *ctrl) {
+  int8x16_t group = vreinterpretq_s8_u8(vld1q_u8(ctrl));
+  return sw_movemask(vcltzq_s8(group));
+}
+
+#else /* !SW_HAVE_NEON */
+
+static sw_inline sw_unused sw_mask_t
+sw_match(const uint8_t *ctrl, int h2) {
+  sw_mask_t mask = 0;
+  int i;
+
+  for (i = 0; i < SW_GROUP; i++)
+    mask |= (sw_mask_t)(ctrl[i] == h2) << i;
+
+  return mask;
+}
+
+static sw_inline sw_unused sw_mask_t
+sw_match_empty(const uint8_t *ctrl) {
+  return sw_match(ctrl, SW_EMPTY);
+}
+
+static sw_inline sw_unused sw_mask_t
+sw_match_free(const uint8_t *ctrl) {
+  sw_mask_t mask = 0;
+  int i;
+
+  for (i = 0; i < SW_GROUP; i++)
+    mask |= (sw_mask_t)(ctrl[i] >> 7) << i;
+
+  return mask;
+}
+
+#endif /* !SW_HAVE_NEON */
+
+static sw_inline sw_unused unsigned int
+sw_lowest(sw_mask_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned int)__builtin_ctzll(mask) >> SW_MASK_SHIFT;
+#else
+  unsigned int i = 0;
+
+  while ((mask & 1) == 0) {
+    mask >>= 1;
+    i++;
+  }
+
+  return i >> SW_MASK_SHIFT;
+#endif
+}
+
+/*
+ * Table
+ */
+
+#define SWISS_TYPE(name, key_t, val_t)                                       \
+typedef struct kh_##name##_s {                                               \
+  uint32_t n_buckets, size, growth;                                          \
+  uint8_t *ctrl;                                                             \
+  key_t *keys;                                                               \
+  val_t *vals;                                                               \
+} kh_##name##_t;
+
+#define SWISS_IMPL(name, scope, key_t, val_t, is_map, hash_func, hash_equal) \
+scope kh_##name##_t *                                                        \
+sw_init_##name(void) {                                                       \
+  return (kh_##name##_t *)calloc(1, sizeof(kh_##name##_t));                  \
+}                                                                            \
+                                                                             \
+scope void                                                                   \
+sw_destroy_##name(kh_##name##_t *h) {                                        \
+  if (h != NULL) {                                                           \
+    free(h->ctrl);                                                           \
+    free((void *)h->keys);                                                   \
+    free((void *)h->vals);                                                   \
+    free(h);                                                                 \
+  }                                                                          \
+}                                                                            \
+                                                                             \
+scope void                                                                   \
+sw_clear_##name(kh_##name##_t *h) {                                          \
+  if (h != NULL && h->ctrl != NULL) {                                        \
+    memset(h->ctrl, SW_EMPTY, h->n_buckets);                                 \
+    h->size = 0;                                                             \
+    h->growth = sw_capacity(h->n_buckets);                                   \
+  }                                                                          \
+}                                                                            \
+                                                                             \
+scope uint32_t                                                               \
+sw_find_##name(const kh_##name##_t *h, key_t key, uint32_t hash) {           \
+  uint32_t mask = (h->n_buckets / SW_GROUP) - 1;                             \
+  uint32_t g = (hash >> 7) & mask;                                           \
+  uint32_t step = 0;                                                         \
+  int h2 = hash & 0x7f;                                                      \
+                                                                             \
+  for (;;) {                                                                 \
+    const uint8_t *ctrl = &h->ctrl[g * SW_GROUP];                            \
+    sw_mask_t match = sw_match(ctrl, h2);                                    \
+                                                                             \
+    while (match != 0) {                                                     \
+      uint32_t i = g * SW_GROUP + sw_lowest(match);                          \
+                                                                             \
+      if (hash_equal(h->keys[i], key))                                       \
+        return i;                                                            \
+                                                                             \
+      match &= match - 1;                                                    \
+    }                                                                        \
+                                                                             \
+    if (sw_match_empty(ctrl) != 0)                                           \
+      return h->n_buckets;                                                   \
+                                                                             \
+    g = (g + ++step) & mask;                                                 \
+  }                                                                          \
+}                                                                            \
+                                                                             \
+scope uint32_t                                                               \
+sw_slot_##name(const kh_##name##_t *h, uint32_t hash) {                      \
+  uint32_t mask = (h->n_buckets / SW_GROUP) - 1;                             \
+  uint32_t g = (hash >> 7) & mask;                                           \
+  uint32_t step = 0;                                                         \
+                                                                             \
+  for (;;) {                                                                 \
+    sw_mask_t match = sw_match_free(&h->ctrl[g * SW_GROUP]);                 \
+                                                                             \
+    if (match != 0)                                                          \
+      return g * SW_GROUP + sw_lowest(match);                                \
+                                                                             \
+    g = (g + ++step) & mask;                                                 \
+  }                                                                          \
+}                                                                            \
+                                                                             \
+scope uint32_t                                                               \
+sw_get_##name(const kh_##name##_t *h, key_t key) {                           \
+  if (h->n_buckets == 0)                                                     \
+    return 0;                                                                \
+                                                                             \
+  return sw_find_##name(h, key, hash_func(key));                             \
+}                                                                            \
+                                                                             \
+scope int                                                                    \
+sw_resize_##name(kh_##name##_t *h, uint32_t new_n_buckets) {                 \
+  uint32_t n = SW_GROUP;                                                     \
+  kh_##name##_t t;                                                           \
+  uint32_t i;                                                                \
+                                                                             \
+  if (new_n_buckets > ((uint32_t)1 << 31))                                   \
+    return -1;                                                               \
+                                                                             \
+  while (n < new_n_buckets)                                                  \
+    n <<= 1;                                                                 \
+                                                                             \
+  new_n_buckets = n;                                                         \
+                                                                             \
+  if (h->size >= sw_capacity(new_n_buckets))                                 \
+    return 0;                                                                \
+                                                                             \
+  t.n_buckets = new_n_buckets;                                               \
+  t.size = h->size;                                                          \
+  t.growth = sw_capacity(new_n_buckets) - h->size;                           \
+  t.ctrl = (uint8_t *)malloc(new_n_buckets);                                 \
+  t.keys = (key_t *)malloc(new_n_buckets * sizeof(key_t));                   \
+  t.vals = NULL;                                                             \
+                                                                             \
+  if (is_map)                                                                \
+    t.vals = (val_t *)malloc(new_n_buckets * sizeof(val_t));                 \
+                                                                             \
+  if (t.ctrl == NULL || t.keys == NULL || (is_map && t.vals == NULL)) {      \
+    free(t.ctrl);                                                            \
+    free((void *)t.keys);                                                    \
+    free((void *)t.vals);                                                    \
+    return -1;                                                               \
+  }                                                                          \
+                                                                             \
+  memset(t.ctrl, SW_EMPTY, new_n_buckets);                                   \
+                                                                             \
+  for (i = 0; i < h->n_buckets; i++) {                                       \
+    uint32_t hash, j;                                                        \
+                                                                             \
+    if (h->ctrl[i] & 0x80)                                                   \
+      continue;                                                              \
+                                                                             \
+    hash = hash_func(h->keys[i]);                                            \
+    j = sw_slot_##name(&t, hash);                                            \
+                                                                             \
+    t.ctrl[j] = (uint8_t)(hash & 0x7f);                                      \
+    t.keys[j] = h->keys[i];                                                  \
+                                                                             \
+    if (is_map)                                                              \
+      t.vals[j] = h->vals[i];                                                \
+  }                                                                          \
+                                                                             \
+  free(h->ctrl);                                                             \
+  free((void *)h->keys);                                                     \
+  free((void *)h->vals);                                                     \
+                                                                             \
+  *h = t;                                                                    \
+                                                                             \
+  return 0;                                                                  \
+}                                                                            \
+                                                                             \
+scope uint32_t                                                               \
+sw_put_##name(kh_##name##_t *h, key_t key, int *ret) {                       \
+  uint32_t hash = hash_func(key);                                            \
+  uint32_t i;                                                                \
+                                                                             \
+  if (h->n_buckets > 0) {                                                    \
+    i = sw_find_##name(h, key, hash);                                        \
+                                                                             \
+    if (i != h->n_buckets) {                                                 \
+      *ret = 0;                                                              \
+      return i;                                                              \
+    }                                                                        \
+  }                                                                          \
+                                                                             \
+  if (h->growth == 0) {                                                      \
+    /* Grow, unless it is mostly tombstones. */                              \
+    uint32_t n = h->n_buckets;                                               \
+                                                                             \
+    if (h->size >= sw_capacity(n) / 2)                                       \
+      n *= 2;                                                                \
+                                                                             \
+    if (sw_resize_##name(h, n) < 0) {                                        \
+      *ret = -1;                                                             \
+      return h->n_buckets;                                                   \
+    }                                                                        \
+  }                                                                          \
+                                                                             \
+  i = sw_slot_##name(h, hash);                                               \
+                                                                             \
+  if (h->ctrl[i] == SW_EMPTY) {                                              \
+    h->growth--;                                                             \
+    *ret = 1;                                                                \
+  } else {                                                                   \
+    *ret = 2;                                                                \
+  }                                                                          \
+                                                                             \
+  h->ctrl[i] = (uint8_t)(hash & 0x7f);                                       \
+  h->keys[i] = key;                                                          \
+  h->size++;                                                                 \
+                                                                             \
+  return i;                                                                  \
+}                                                                            \
+                                                                             \
+scope void                                                                   \
+sw_del_##name(kh_##name##_t *h, uint32_t x) {                                \
+  if (x != h->n_buckets && !(h->ctrl[x] & 0x80)) {                           \
+    const uint8_t *group = &h->ctrl[x & ~(uint32_t)(SW_GROUP - 1)];          \
+                                                                             \
+    if (sw_match_empty(group) != 0) {                                        \
+      h->ctrl[x] = SW_EMPTY;                                                 \
+      h->growth++;                                                           \
+    } else {                                                                 \
+      h->ctrl[x] = SW_DELETED;                                               \
+    }                                                                        \
+                                                                             \
+    h->size--;                                                               \
+  }                                                                          \
+}
+
+#define SWISS_INIT(name, key_t, val_t, is_map, hash_func, hash_equal) \
+  SWISS_TYPE(name, key_t, val_t)                                      \
+  SWISS_IMPL(name, static sw_inline sw_unused,                        \
+             key_t, val_t, is_map, hash_func, hash_equal)
+
+/*
+ * Accessors
+ */
+
+#define sw_exist(h, x) (((h)->ctrl[x] & 0x80) == 0)
+#define sw_key(h, x) ((h)->keys[x])
+#define sw_val(h, x) ((h)->vals[x])
+#define sw_value(h, x) ((h)->vals[x])
+#define sw_begin(h) ((uint32_t)0)
+#define sw_end(h) ((h)->n_buckets)
+#define sw_size(h) ((h)->size)
+#define sw_n_buckets(h) ((h)->n_buckets)
+
+#endif /* BTC_SWISS_H */
@@ -0,0 +1,502 @@
+/*!
+ * minisketch.c - set sketches for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://github.com/sipa/minisketch
+ *   https://github.com/bitcoin/bips/blob/master/bip-0330.mediawiki
+ *   https://en.wikipedia.org/wiki/Berlekamp%E2%80%93Massey_algorithm
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <mako/minisketch.h>
+#include "bio.h"
+#include "impl.h"
+#include "internal.h"
+
+/*
+ * PinSketch
+ *
+ * A sketch of capacity c over a set of non-zero
+ * 32 bit elements is the list of odd power sums
+ *
+ *   s[i] = sum(x^(2i + 1)), i = 0..c-1
+ *
+ * in GF(2^32). Sketches add by xor, so the sum of
+ * two sketches is the sketch of the symmetric
+ * difference of their sets. Up to c differences
+ * are recovered by finding the polynomial whose
+ * roots are the inverses of the elements (with
+ * Berlekamp-Massey; the even power sums follow
+ * from s[2i] = s[i]^2) and then its roots.
+ */
+
+/*
+ * GF(2^32) (x^32 + x^7 + x^3 + x^2 + 1)
+ */
+
+static uint32_t
+gf_reduce(uint64_t r) {
+  uint64_t h = r >> 32;
+
+  /* x^32 = x^7 + x^3 + x^2 + 1 */
+  r = (r & 0xffffffff) ^ h ^ (h << 2) ^ (h << 3) ^ (h << 7);
+  h = r >> 32;
+  r = r ^ h ^ (h << 2) ^ (h << 3) ^ (h << 7);
+
+  return (uint32_t)r;
+}
+
+static uint32_t
+gf_mul(uint32_t x, uint32_t y) {
+  uint64_t a = x;
+  uint64_t r = 0;
+
+  while (y != 0) {
+    if (y & 1)
+      r ^= a;
+
+    a <<= 1;
+    y >>= 1;
+  }
+
+  return gf_reduce(r);
+}
+
+static uint32_t
+gf_sqr(uint32_t x) {
+  /* Squaring spreads the bits out. */
+  uint64_t r = 0;
+  int i;
+
+  for (i = 0; i < 32; i++) {
+    if ((x >> i) & 1)
+      r |= (uint64_t)1 << (2 * i);
+  }
+
+  return gf_reduce(r);
+}
+
+static uint32_t
+gf_inv(uint32_t x) {
+  /* x^(2^32 - 2) */
+  uint32_t r = x;
+  int i;
+
+  CHECK(x != 0);
+
+  for (i = 0; i < 30; i++)
+    r = gf_mul(gf_sqr(r), x);
+
+  return gf_sqr(r);
+}
+
+/*
+ * Polynomials (coefficients low to high)
+ */
+
+static size_t
+poly_degree(const uint32_t *a, size_t len) {
+  /* Returns len for the zero polynomial. */
+  while (len > 0 && a[len - 1] == 0)
+    len--;
+
+  return len == 0 ? (size_t)-1 : len - 1;
+}
+
+static void
+poly_monic(uint32_t *a, size_t d) {
+  uint32_t c = gf_inv(a[d]);
+  size_t i;
+
+  for (i = 0; i <= d; i++)
+    a[i] = gf_mul(a[i], c);
+}
+
+static size_t
+poly_mod(uint32_t *a, size_t da, const uint32_t *f, size_t df) {
+  /* a mod f for monic f; returns the degree bound. */
+  size_t i, j;
+
+  if (da == (size_t)-1 || da < df)
+    return da;
+
+  for (i = da; i >= df; i--) {
+    uint32_t c = a[i];
+
+    if (c != 0) {
+      for (j = 0; j < df; j++)
+        a[i - df + j] ^= gf_mul(c, f[j]);
+
+      a[i] = 0;
+    }
+
+    if (i == df)
+      break;
+  }
+
+  return poly_degree(a, df);
+}
+
+static void
+poly_divexact(uint32_t *q, uint32_t *a, size_t da,
+              const uint32_t *f, size_t df) {
+  size_t i, j;
+
+  for (i = da; i >= df; i--) {
+    uint32_t c = a[i];
+
+    q[i - df] = c;
+
+    if (c != 0) {
+      for (j = 0; j < df; j++)
+        a[i - df + j] ^= gf_mul(c, f[j]);
+
+      a[i] = 0;
+    }
+
+    if (i == df)
+      break;
+  }
+}
+
+static void
+poly_sqrmod(uint32_t *a, uint32_t *tmp, const uint32_t *f, size_t d) {
+  /* a = a^2 mod f, where deg(a) < d = deg(f). */
+  size_t i;
+
+  memset(tmp, 0, (2 * d - 1) * sizeof(uint32_t));
+
+  for (i = 0; i < d; i++)
+    tmp[2 * i] = gf_sqr(a[i]);
+
+  poly_mod(tmp, 2 * d - 2, f, d);
+
+  memcpy(a, tmp, d * sizeof(uint32_t));
+}
+
+static size_t
+poly_gcd(uint32_t *a, size_t da, uint32_t *b, size_t db, size_t len) {
+  /* Euclid. The (monic) result is left in a. */
+  size_t i;
+
+  while (db != (size_t)-1) {
+    size_t dt;
+
+    poly_monic(b, db);
+
+    da = poly_mod(a, da, b, db);
+
+    for (i = 0; i < len; i++) {
+      uint32_t t = a[i];
+      a[i] = b[i];
+      b[i] = t;
+    }
+
+    dt = da;
+    da = db;
+    db = dt;
+  }
+
+  return da;
+}
+
+static int
+poly_roots(uint32_t *out, size_t *len,
+           const uint32_t *f, size_t d,
+           uint32_t *seed) {
+  uint32_t *t, *g, *h, *q, *tmp;
+  int attempt, ret = 0;
+  size_t i;
+
+  if (d == 0)
+    return 1;
+
+  if (d == 1) {
+    /* x + c has the root c. */
+    if (f[0] == 0)
+      return 0;
+
+    out[(*len)++] = f[0];
+
+    return 1;
+  }
+
+  t = (uint32_t *)btc_malloc(d * sizeof(uint32_t));
+  g = (uint32_t *)btc_malloc((d + 1) * sizeof(uint32_t));
+  h = (uint32_t *)btc_malloc((d + 1) * sizeof(uint32_t));
+  q = (uint32_t *)btc_malloc((d + 1) * sizeof(uint32_t));
+  tmp = (uint32_t *)btc_malloc((2 * d - 1) * sizeof(uint32_t));
+
+  for (attempt = 0; attempt < 64; attempt++) {
+    uint32_t beta;
+    size_t dg;
+
+    /* Tr(beta * x) = sum((beta * x)^(2^i)), i = 0..31.
+       It takes the values 0 and 1 only at our roots,
+       so gcd(f, Tr) is a random subset of them. */
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+
+    beta = *seed;
+
+    memset(t, 0, d * sizeof(uint32_t));
+    memset(h, 0, (d + 1) * sizeof(uint32_t));
+
+    t[1] = beta;
+    h[1] = beta;
+
+    for (i = 1; i < 32; i++) {
+      size_t j;
+
+      poly_sqrmod(t, tmp, f, d);
+
+      for (j = 0; j < d; j++)
+        h[j] ^= t[j];
+    }
+
+    memcpy(g, f, (d + 1) * sizeof(uint32_t));
+
+    dg = poly_gcd(g, d, h, poly_degree(h, d), d + 1);
+
+    if (dg == 0 || dg >= d)
+      continue;
+
+    memcpy(h, f, (d + 1) * sizeof(uint32_t));
+    memset(q, 0, (d + 1) * sizeof(uint32_t));
+
+    poly_divexact(q, h, d, g, dg);
+
+    ret = poly_roots(out, len, g, dg, seed)
+       && poly_roots(out, len, q, d - dg, seed);
+
+    break;
+  }
+
+  btc_free(t);
+  btc_free(g);
+  btc_free(h);
+  btc_free(q);
+  btc_free(tmp);
+
+  return ret;
+}
+
+static int
+poly_splits(const uint32_t *f, size_t d) {
+  /* f divides x^(2^32) - x if and only if it is
+     a product of distinct linear factors. */
+  uint32_t *a = (uint32_t *)btc_malloc(d * sizeof(uint32_t));
+  uint32_t *tmp = (uint32_t *)btc_malloc((2 * d - 1) * sizeof(uint32_t));
+  int i, ret = 1;
+  size_t j;
+
+  memset(a, 0, d * sizeof(uint32_t));
+
+  a[1] = 1;
+
+  for (i = 0; i < 32; i++)
+    poly_sqrmod(a, tmp, f, d);
+
+  for (j = 0; j < d; j++) {
+    if (a[j] != (j == 1))
+      ret = 0;
+  }
+
+  btc_free(a);
+  btc_free(tmp);
+
+  return ret;
+}
+
+/*
+ * Minisketch
+ */
+
+void
+btc_minisketch_init(btc_minisketch_t *z, size_t capacity) {
+  CHECK(capacity <= BTC_MINISKETCH_MAX);
+
+  z->items = NULL;
+  z->capacity = capacity;
+
+  if (capacity > 0) {
+    z->items = (uint32_t *)btc_malloc(capacity * sizeof(uint32_t));
+
+    memset(z->items, 0, capacity * sizeof(uint32_t));
+  }
+}
+
+void
+btc_minisketch_clear(btc_minisketch_t *z) {
+  if (z->items != NULL)
+    btc_free(z->items);
+
+  z->items = NULL;
+  z->capacity = 0;
+}
+
+void
+btc_minisketch_add(btc_minisketch_t *z, uint32_t element) {
+  uint32_t sqr = gf_sqr(element);
+  uint32_t pow = element;
+  size_t i;
+
+  CHECK(element != 0);
+
+  for (i = 0; i < z->capacity; i++) {
+    z->items[i] ^= pow;
+    pow = gf_mul(pow, sqr);
+  }
+}
+
+void
+btc_minisketch_merge(btc_minisketch_t *z, const btc_minisketch_t *x) {
+  size_t i;
+
+  CHECK(z->capacity == x->capacity);
+
+  for (i = 0; i < z->capacity; i++)
+    z->items[i] ^= x->items[i];
+}
+
+size_t
+btc_minisketch_size(const btc_minisketch_t *x) {
+  return x->capacity * 4;
+}
+
+uint8_t *
+btc_minisketch_write(uint8_t *zp, const btc_minisketch_t *x) {
+  size_t i;
+
+  for (i = 0; i < x->capacity; i++)
+    zp = btc_uint32_write(zp, x->items[i]);
+
+  return zp;
+}
+
+int
+btc_minisketch_import(btc_minisketch_t *z, const uint8_t *xp, size_t xn) {
+  size_t i;
+
+  if ((xn & 3) != 0 || xn / 4 > BTC_MINISKETCH_MAX)
+    return 0;
+
+  btc_minisketch_clear(z);
+  btc_minisketch_init(z, xn / 4);
+
+  for (i = 0; i < z->capacity; i++)
+    z->items[i] = btc_read32le(xp + i * 4);
+
+  return 1;
+}
+
+int
+btc_minisketch_decode(uint32_t *out, size_t *len, const btc_minisketch_t *x) {
+  size_t n = 2 * x->capacity;
+  uint32_t *s, *c, *b, *t, *r;
+  uint32_t seed = 0x9e3779b9;
+  size_t i, j, k, l = 0, m = 1;
+  uint32_t bd = 1;
+  int ret = 0;
+
+  *len = 0;
+
+  if (x->capacity == 0)
+    return 1;
+
+  s = (uint32_t *)btc_malloc(n * sizeof(uint32_t));
+  c = (uint32_t *)btc_malloc((n + 1) * sizeof(uint32_t));
+  b = (uint32_t *)btc_malloc((n + 1) * sizeof(uint32_t));
+  t = (uint32_t *)btc_malloc((n + 1) * sizeof(uint32_t));
+  r = (uint32_t *)btc_malloc((n + 1) * sizeof(uint32_t));
+
+  /* s[j] is the power sum of x^(j + 1). */
+  for (j = 0; j < n; j++) {
+    if ((j & 1) == 0)
+      s[j] = x->items[j / 2];
+    else
+      s[j] = gf_sqr(s[j / 2]);
+  }
+
+  /* Berlekamp-Massey. */
+  memset(c, 0, (n + 1) * sizeof(uint32_t));
+  memset(b, 0, (n + 1) * sizeof(uint32_t));
+
+  c[0] = 1;
+  b[0] = 1;
+
+  for (k = 0; k < n; k++) {
+    uint32_t d = s[k];
+    uint32_t coef;
+
+    for (i = 1; i <= l; i++)
+      d ^= gf_mul(c[i], s[k - i]);
+
+    if (d == 0) {
+      m++;
+      continue;
+    }
+
+    coef = gf_mul(d, gf_inv(bd));
+
+    if (2 * l <= k) {
+      memcpy(t, c, (n + 1) * sizeof(uint32_t));
+
+      for (i = 0; i + m <= n; i++)
+        c[i + m] ^= gf_mul(coef, b[i]);
+
+      l = k + 1 - l;
+
+      memcpy(b, t, (n + 1) * sizeof(uint32_t));
+
+      bd = d;
+      m = 1;
+    } else {
+      for (i = 0; i + m <= n; i++)
+        c[i + m] ^= gf_mul(coef, b[i]);
+
+      m++;
+    }
+  }
+
+  if (l == 0) {
+    ret = 1;
+    goto done;
+  }
+
+  /* A zero root or too many differences. */
+  if (l > x->capacity || c[l] == 0)
+    goto done;
+
+  for (i = l + 1; i <= n; i++) {
+    if (c[i] != 0)
+      goto done;
+  }
+
+  /* Reversing c gives the polynomial whose roots
+     are the elements themselves (already monic). */
+  for (i = 0; i <= l; i++)
+    r[i] = c[l - i];
+
+  if (l > 1 && !poly_splits(r, l))
+    goto done;
+
+  if (!poly_roots(out, len, r, l, &seed) || *len != l) {
+    *len = 0;
+    goto done;
+  }
+
+  ret = 1;
+done:
+  btc_free(s);
+  btc_free(c);
+  btc_free(b);
+  btc_free(t);
+  btc_free(r);
+  return ret;
+}
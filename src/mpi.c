@@ -45,6 +45,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include <mako/cpu.h>
 #include <mako/mpi.h>
 
 #include "internal.h"
@@ -57,6 +58,15 @@
 #undef MP_USE_DIV_3BY2_ASM
 #undef MP_USE_DIV_3BY2
 
+/* Karatsuba crossovers in limbs (see mako_bench mpn_*). */
+#ifndef MP_MUL_KARATSUBA_THRESHOLD
+#  define MP_MUL_KARATSUBA_THRESHOLD 28
+#endif
+
+#ifndef MP_SQR_KARATSUBA_THRESHOLD
+#  define MP_SQR_KARATSUBA_THRESHOLD 64
+#endif
+
 /*
  * Wide Type
  */
@@ -152,6 +162,11 @@ BTC_BARRIER(mp_limb_t, mp_limb)
 #  define MP_FAST_ASM_X64
 #endif
 
+#if defined(MP_HAVE_ASM_X64) && defined(BTC_GNUC)
+/* MULX/ADCX/ADOX (Broadwell and later), detected at runtime. */
+#  define MP_HAVE_ADX
+#endif
+
 #if defined(MP_HAVE_WIDE) && defined(__clang__)
 /* Clang 5.0 and above produce efficient
    carry code with wider types and shifts. */
@@ -1648,6 +1663,90 @@ mpn_sec_sub(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn,
  * Multiplication
  */
 
+#if defined(MP_HAVE_ADX)
+static int
+mp_cpu_adx(void) {
+  /* BMI2 (mulx) and ADX (adcx/adox). */
+  unsigned int cpu = BTC_CPU_FEATURES();
+
+  return (cpu & BTC_CPU_BMI2) && (cpu & BTC_CPU_ADX);
+}
+
+static mp_limb_t
+mpn_addmul_1_adx(mp_limb_t *zp, const mp_limb_t *xp,
+                                mp_size_t xn,
+                                mp_limb_t y) {
+  /* Two independent carry chains: CF carries the high
+     half of the previous product, OF the limb of z. */
+  mp_limb_t c = 0;
+  mp_size_t n;
+
+  switch (xn & 3) {
+    case 3:
+      mp_addmul_1(*zp, c, *xp, y); zp++; xp++;
+    case 2:
+      mp_addmul_1(*zp, c, *xp, y); zp++; xp++;
+    case 1:
+      mp_addmul_1(*zp, c, *xp, y); zp++; xp++;
+  }
+
+  n = xn >> 2;
+
+  __asm__ __volatile__ (
+    "xorl %%r9d, %%r9d\n"
+    "movq %q[c], %%r8\n"
+    "1:\n"
+    "jrcxz 2f\n"
+    "mulxq 0(%q[x]), %%r9, %%r10\n"
+    "adcxq %%r8, %%r9\n"
+    "adoxq 0(%q[z]), %%r9\n"
+    "movq %%r9, 0(%q[z])\n"
+    "mulxq 8(%q[x]), %%r9, %%r8\n"
+    "adcxq %%r10, %%r9\n"
+    "adoxq 8(%q[z]), %%r9\n"
+    "movq %%r9, 8(%q[z])\n"
+    "mulxq 16(%q[x]), %%r9, %%r10\n"
+    "adcxq %%r8, %%r9\n"
+    "adoxq 16(%q[z]), %%r9\n"
+    "movq %%r9, 16(%q[z])\n"
+    "mulxq 24(%q[x]), %%r9, %%r8\n"
+    "adcxq %%r10, %%r9\n"
+    "adoxq 24(%q[z]), %%r9\n"
+    "movq %%r9, 24(%q[z])\n"
+    "leaq 32(%q[x]), %q[x]\n"
+    "leaq 32(%q[z]), %q[z]\n"
+    "leaq -1(%%rcx), %%rcx\n"
+    "jmp 1b\n"
+    "2:\n"
+    "movl $0, %%r9d\n"
+    "adcxq %%r9, %%r8\n"
+    "adoxq %%r9, %%r8\n"
+    "movq %%r8, %q[c]\n"
+    : [c] "+r" (c), [z] "+r" (zp), [x] "+r" (xp), "+c" (n)
+    : "d" (y)
+    : "cc", "memory", "r8", "r9", "r10"
+  );
+
+  return c;
+}
+#endif /* MP_HAVE_ADX */
+
+const char *
+btc_mpn_mul_backend(void) {
+#if defined(MP_HAVE_ADX)
+  if (mp_cpu_adx())
+    return "adx";
+#endif
+
+#if defined(MP_HAVE_ASM_X64) || defined(MP_MSVC_ASM_X64)
+  return "x64";
+#elif defined(MP_HAVE_ASM_X86) || defined(MP_MSVC_ASM_X86)
+  return "x86";
+#else
+  return "generic";
+#endif
+}
+
 mp_limb_t
 mpn_mul_1(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn, mp_limb_t y) {
   mp_limb_t c = 0;
@@ -1681,6 +1780,11 @@ mp_limb_t
 mpn_addmul_1(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn, mp_limb_t y) {
   mp_limb_t c = 0;
 
+#if defined(MP_HAVE_ADX)
+  if (xn >= 8 && mp_cpu_adx())
+    return mpn_addmul_1_adx(zp, xp, xn, y);
+#endif
+
   switch (xn & 3) {
     case 3:
       mp_addmul_1(*zp, c, *xp, y); zp++; xp++;
@@ -1735,38 +1839,24 @@ mpn_submul_1(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn, mp_limb_t y) {
   return c;
 }
 
-void
-mpn_mul_n(mp_limb_t *zp, const mp_limb_t *xp,
-                         const mp_limb_t *yp,
-                         mp_size_t n) {
-  mpn_mul(zp, xp, n, yp, n);
-}
-
-void
-mpn_mul(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn,
-                       const mp_limb_t *yp, mp_size_t yn) {
+static void
+mpn_mul_basecase(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn,
+                                 const mp_limb_t *yp, mp_size_t yn) {
   mp_size_t i;
 
-  if (UNLIKELY(yn == 0)) {
-    mpn_zero(zp, xn);
-    return;
-  }
-
   zp[xn] = mpn_mul_1(zp, xp, xn, yp[0]);
 
   for (i = 1; i < yn; i++)
     zp[xn + i] = mpn_addmul_1(zp + i, xp, xn, yp[i]);
 }
 
-void
-mpn_sqr(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn, mp_limb_t *scratch) {
+static void
+mpn_sqr_basecase(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn,
+                                mp_limb_t *scratch) {
   /* `2 * xn` limbs are required for scratch. */
   mp_limb_t *tp = scratch;
   mp_size_t i;
 
-  if (UNLIKELY(xn == 0))
-    return;
-
   mp_sqr(zp[1], zp[0], xp[0]);
 
   if (xn == 1)
@@ -1789,6 +1879,206 @@ mpn_sqr(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn, mp_limb_t *scratch) {
   ASSERT(mpn_add_n(zp, zp, tp, 2 * xn) == 0);
 }
 
+/*
+ * Karatsuba Multiplication
+ */
+
+static mp_size_t
+mpn_kara_itch(mp_size_t n, mp_size_t threshold) {
+  /* Scratch for one level is `4 * l + 1` limbs (the
+     difference product and the middle term), plus
+     whatever the half-size products below it need. */
+  mp_size_t tn = 2 * n;
+  mp_size_t l;
+
+  while (n >= threshold) {
+    l = (n + 1) / 2;
+    tn += 4 * l + 1;
+    n = l;
+  }
+
+  return tn;
+}
+
+static int
+mpn_sub_abs(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn,
+                           const mp_limb_t *yp, mp_size_t yn) {
+  /* z = |x - y| (xn >= yn), returns 1 if x < y. */
+  mp_size_t i;
+
+  for (i = xn - 1; i >= yn; i--) {
+    if (xp[i] != 0)
+      break;
+  }
+
+  if (i < yn && mpn_cmp(xp, yp, yn) < 0) {
+    mpn_sub_n(zp, yp, xp, yn);
+    mpn_zero(zp + yn, xn - yn);
+    return 1;
+  }
+
+  ASSERT(mpn_sub(zp, xp, xn, yp, yn) == 0);
+
+  return 0;
+}
+
+static void
+mpn_kara_mul_n(mp_limb_t *zp, const mp_limb_t *xp,
+                              const mp_limb_t *yp,
+                              mp_size_t n,
+                              mp_limb_t *scratch) {
+  /**
+   * Karatsuba multiplication [ARITH] Algorithm 1.3.
+   *
+   * With x = x1 * B^l + x0 and y = y1 * B^l + y0:
+   *
+   *   x * y = x1 * y1 * B^(2 * l)
+   *         + (x0 * y0 + x1 * y1 - (x0 - x1) * (y0 - y1)) * B^l
+   *         + x0 * y0
+   *
+   * The low and high products go straight into z; the
+   * differences are staged in z before they are written.
+   */
+  mp_size_t l = (n + 1) / 2;
+  mp_size_t h = n - l;
+  mp_limb_t *dp = scratch;
+  mp_limb_t *mp = scratch + 2 * l;
+  mp_limb_t *tp = scratch + 4 * l + 1;
+  int sign;
+
+  if (n < MP_MUL_KARATSUBA_THRESHOLD) {
+    mpn_mul_basecase(zp, xp, n, yp, n);
+    return;
+  }
+
+  sign = mpn_sub_abs(zp, xp, l, xp + l, h);
+  sign ^= mpn_sub_abs(zp + l, yp, l, yp + l, h);
+
+  mpn_kara_mul_n(dp, zp, zp + l, l, tp);
+  mpn_kara_mul_n(zp, xp, yp, l, tp);
+  mpn_kara_mul_n(zp + 2 * l, xp + l, yp + l, h, tp);
+
+  mp[2 * l] = mpn_add(mp, zp, 2 * l, zp + 2 * l, 2 * h);
+
+  if (sign)
+    ASSERT(mpn_add(mp, mp, 2 * l + 1, dp, 2 * l) == 0);
+  else
+    ASSERT(mpn_sub(mp, mp, 2 * l + 1, dp, 2 * l) == 0);
+
+  ASSERT(mpn_add(zp + l, zp + l, 2 * n - l, mp, 2 * l + 1) == 0);
+}
+
+static void
+mpn_kara_sqr(mp_limb_t *zp, const mp_limb_t *xp,
+                            mp_size_t n,
+                            mp_limb_t *scratch) {
+  /* As above, but the difference term is a square. */
+  mp_size_t l = (n + 1) / 2;
+  mp_size_t h = n - l;
+  mp_limb_t *dp = scratch;
+  mp_limb_t *mp = scratch + 2 * l;
+  mp_limb_t *tp = scratch + 4 * l + 1;
+
+  if (n < MP_SQR_KARATSUBA_THRESHOLD) {
+    mpn_sqr_basecase(zp, xp, n, scratch);
+    return;
+  }
+
+  mpn_sub_abs(zp, xp, l, xp + l, h);
+
+  mpn_kara_sqr(dp, zp, l, tp);
+  mpn_kara_sqr(zp, xp, l, tp);
+  mpn_kara_sqr(zp + 2 * l, xp + l, h, tp);
+
+  mp[2 * l] = mpn_add(mp, zp, 2 * l, zp + 2 * l, 2 * h);
+
+  ASSERT(mpn_sub(mp, mp, 2 * l + 1, dp, 2 * l) == 0);
+  ASSERT(mpn_add(zp + l, zp + l, 2 * n - l, mp, 2 * l + 1) == 0);
+}
+
+void
+mpn_mul_n(mp_limb_t *zp, const mp_limb_t *xp,
+                         const mp_limb_t *yp,
+                         mp_size_t n) {
+  mpn_mul(zp, xp, n, yp, n);
+}
+
+void
+mpn_mul(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn,
+                       const mp_limb_t *yp, mp_size_t yn) {
+  mp_limb_t *tp, *pp;
+  mp_size_t tn;
+
+  if (xn < yn) {
+    const mp_limb_t *sp = xp;
+    mp_size_t sn = xn;
+
+    xp = yp;
+    xn = yn;
+    yp = sp;
+    yn = sn;
+  }
+
+  if (UNLIKELY(yn == 0)) {
+    mpn_zero(zp, xn);
+    return;
+  }
+
+  if (yn < MP_MUL_KARATSUBA_THRESHOLD) {
+    mpn_mul_basecase(zp, xp, xn, yp, yn);
+    return;
+  }
+
+  /* Balanced products of `yn` limbs, one slice of x at a time. */
+  tn = 2 * yn + mpn_kara_itch(yn, MP_MUL_KARATSUBA_THRESHOLD);
+  tp = mp_alloc_vla(tn);
+  pp = tp + 2 * yn;
+
+  mpn_kara_mul_n(zp, xp, yp, yn, pp);
+
+  xp += yn;
+  xn -= yn;
+
+  while (xn > 0) {
+    zp += yn;
+
+    if (xn >= yn) {
+      mpn_kara_mul_n(tp, xp, yp, yn, pp);
+      ASSERT(mpn_add(zp, tp, 2 * yn, zp, yn) == 0);
+    } else {
+      mpn_mul(tp, yp, yn, xp, xn);
+      ASSERT(mpn_add(zp, tp, yn + xn, zp, yn) == 0);
+    }
+
+    xp += yn;
+    xn -= MP_MIN(xn, yn);
+  }
+
+  mp_free_vla(tp, tn);
+}
+
+void
+mpn_sqr(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn, mp_limb_t *scratch) {
+  /* `2 * xn` limbs are required for scratch. */
+  mp_limb_t *tp;
+  mp_size_t tn;
+
+  if (UNLIKELY(xn == 0))
+    return;
+
+  if (xn < MP_SQR_KARATSUBA_THRESHOLD) {
+    mpn_sqr_basecase(zp, xp, xn, scratch);
+    return;
+  }
+
+  tn = mpn_kara_itch(xn, MP_SQR_KARATSUBA_THRESHOLD);
+  tp = mp_alloc_vla(tn);
+
+  mpn_kara_sqr(zp, xp, xn, tp);
+
+  mp_free_vla(tp, tn);
+}
+
 /*
  * Multiply + Shift
  */
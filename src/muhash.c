@@ -0,0 +1,167 @@
+/*!
+ * muhash.c - muhash3072 for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://cseweb.ucsd.edu/~mihir/papers/inchash.pdf
+ *   https://github.com/bitcoin/bitcoin/blob/master/src/crypto/muhash.cpp
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/stream.h>
+#include <mako/mpi.h>
+#include <mako/muhash.h>
+#include "internal.h"
+
+/*
+ * MuHash3072
+ *
+ * A set is hashed to the product of its elements
+ * in the multiplicative group mod p = 2^3072 - 1103717,
+ * where an element is the expansion of SHA256(data)
+ * with ChaCha20. Insertion and removal commute, so the
+ * digest of a set is independent of the order it was
+ * built in. Removals accumulate in a separate
+ * denominator to put off the inversion until the
+ * digest is actually needed.
+ */
+
+#define MUHASH_LIMBS (3072 / MP_LIMB_BITS)
+#define MUHASH_PRIME_DIFF 1103717
+
+/*
+ * Helpers
+ */
+
+static void
+num_normalize(mp_limb_t *zp) {
+  /* z >= p if and only if z + (2^3072 - p) overflows. */
+  mp_limb_t tp[MUHASH_LIMBS];
+
+  if (mpn_add_1(tp, zp, MUHASH_LIMBS, MUHASH_PRIME_DIFF))
+    mpn_copyi(zp, tp, MUHASH_LIMBS);
+}
+
+static void
+num_mul(mp_limb_t *zp, const mp_limb_t *xp, const mp_limb_t *yp) {
+  /* hi * 2^3072 + lo == lo + hi * (2^3072 - p) (mod p) */
+  mp_limb_t tp[MUHASH_LIMBS * 2];
+  mp_limb_t *hp = tp + MUHASH_LIMBS;
+  mp_limb_t cp[2];
+  mp_limb_t c;
+
+  mpn_mul_n(tp, xp, yp, MUHASH_LIMBS);
+
+  c = mpn_mul_1(hp, hp, MUHASH_LIMBS, MUHASH_PRIME_DIFF);
+  c += mpn_add_n(zp, tp, hp, MUHASH_LIMBS);
+
+  while (c != 0) {
+    cp[1] = mpn_mul_1(cp, &c, 1, MUHASH_PRIME_DIFF);
+    c = mpn_add(zp, zp, MUHASH_LIMBS, cp, 2);
+  }
+
+  num_normalize(zp);
+}
+
+static void
+num_import(mp_limb_t *zp, const uint8_t *xp) {
+  mpn_import(zp, MUHASH_LIMBS, xp, BTC_MUHASH_SIZE, -1);
+}
+
+static void
+num_export(uint8_t *zp, const mp_limb_t *xp) {
+  mpn_export(zp, BTC_MUHASH_SIZE, xp, MUHASH_LIMBS, -1);
+}
+
+static void
+num_element(mp_limb_t *zp, const void *data, size_t len) {
+  static const uint8_t nonce[8] = {0};
+  uint8_t raw[BTC_MUHASH_SIZE];
+  btc_chacha20_t ctx;
+  uint8_t key[32];
+
+  btc_sha256(key, data, len);
+
+  btc_chacha20_init(&ctx, key, 32, nonce, 8, 0);
+  btc_chacha20_keystream(&ctx, raw, sizeof(raw));
+
+  num_import(zp, raw);
+  num_normalize(zp);
+}
+
+static void
+num_update(uint8_t *zp, const void *data, size_t len) {
+  mp_limb_t xp[MUHASH_LIMBS];
+  mp_limb_t yp[MUHASH_LIMBS];
+
+  num_import(xp, zp);
+  num_element(yp, data, len);
+  num_mul(xp, xp, yp);
+  num_export(zp, xp);
+}
+
+/*
+ * MuHash3072
+ */
+
+void
+btc_muhash_init(btc_muhash_t *ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+
+  ctx->num[0] = 1;
+  ctx->den[0] = 1;
+}
+
+void
+btc_muhash_insert(btc_muhash_t *ctx, const void *data, size_t len) {
+  num_update(ctx->num, data, len);
+}
+
+void
+btc_muhash_remove(btc_muhash_t *ctx, const void *data, size_t len) {
+  num_update(ctx->den, data, len);
+}
+
+void
+btc_muhash_combine(btc_muhash_t *z, const btc_muhash_t *x) {
+  mp_limb_t zp[MUHASH_LIMBS];
+  mp_limb_t xp[MUHASH_LIMBS];
+
+  num_import(zp, z->num);
+  num_import(xp, x->num);
+  num_mul(zp, zp, xp);
+  num_export(z->num, zp);
+
+  num_import(zp, z->den);
+  num_import(xp, x->den);
+  num_mul(zp, zp, xp);
+  num_export(z->den, zp);
+}
+
+void
+btc_muhash_final(const btc_muhash_t *ctx, uint8_t *out) {
+  mp_limb_t scratch[MPN_INVERT_ITCH(MUHASH_LIMBS)];
+  mp_limb_t pp[MUHASH_LIMBS];
+  mp_limb_t np[MUHASH_LIMBS];
+  mp_limb_t dp[MUHASH_LIMBS];
+  mp_limb_t ip[MUHASH_LIMBS];
+  uint8_t raw[BTC_MUHASH_SIZE];
+
+  mpn_set_1(pp, MUHASH_LIMBS, 0);
+  mpn_sub_1(pp, pp, MUHASH_LIMBS, MUHASH_PRIME_DIFF);
+
+  num_import(np, ctx->num);
+  num_import(dp, ctx->den);
+
+  /* Elements are never zero mod p (p is prime). */
+  CHECK(mpn_invert_n(ip, dp, pp, MUHASH_LIMBS, scratch));
+
+  num_mul(np, np, ip);
+  num_export(raw, np);
+
+  btc_sha256(out, raw, sizeof(raw));
+}
@@ -10,8 +10,24 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <mako/util.h>
 #include "bio.h"
+#include "internal.h"
+
+/*
+ * Backends
+ */
+
+#if defined(BTC_HAVE_ASM) && (BTC_GNUC_PREREQ(4, 9) || defined(__clang__))
+#  if defined(__x86_64__) || defined(__aarch64__)
+#    define MURMUR3_HAVE_VEC4
+#  endif
+#endif
+
+#define MURMUR3_C1 UINT32_C(0xcc9e2d51)
+#define MURMUR3_C2 UINT32_C(0x1b873593)
+#define MURMUR3_TWEAK UINT32_C(0xfba4c795)
 
 /*
  * Murmur3
@@ -20,8 +36,8 @@
 uint32_t
 btc_murmur3_sum(const uint8_t *data, size_t len, uint32_t seed) {
   uint32_t h1 = seed;
-  uint32_t c1 = UINT32_C(0xcc9e2d51);
-  uint32_t c2 = UINT32_C(0x1b873593);
+  uint32_t c1 = MURMUR3_C1;
+  uint32_t c2 = MURMUR3_C2;
   uint32_t k1 = 0;
   size_t left = len;
 
@@ -67,6 +83,157 @@ btc_murmur3_sum(const uint8_t *data, size_t len, uint32_t seed) {
 
 uint32_t
 btc_murmur3_tweak(const uint8_t *data, size_t len, uint32_t n, uint32_t tweak) {
-  uint32_t seed = (n * UINT32_C(0xfba4c795)) + tweak;
+  uint32_t seed = (n * MURMUR3_TWEAK) + tweak;
   return btc_murmur3_sum(data, len, seed);
 }
+
+/*
+ * Murmur3 (Multi-lane)
+ */
+
+/* A bloom filter hashes every element once per hash
+ * function, under seeds which differ by a constant.
+ * The message words are mixed the same way whatever
+ * the seed, so each word is mixed once and folded
+ * into all of the lanes at the same time.
+ */
+
+static uint32_t
+murmur3_mix(uint32_t k1) {
+  k1 *= MURMUR3_C1;
+  k1 = ROTL32(k1, 15);
+  k1 *= MURMUR3_C2;
+  return k1;
+}
+
+static uint32_t
+murmur3_tail(const uint8_t *data, size_t left) {
+  uint32_t k1 = 0;
+
+  switch (left) {
+    case 3:
+      k1 ^= (uint32_t)data[2] << 16;
+    case 2:
+      k1 ^= (uint32_t)data[1] << 8;
+    case 1:
+      k1 ^= (uint32_t)data[0] << 0;
+  }
+
+  return murmur3_mix(k1);
+}
+
+static void
+murmur3_lanes(uint32_t *out,
+              const uint8_t *data,
+              size_t len,
+              uint32_t seed,
+              size_t lanes) {
+  uint32_t h[8];
+  size_t left = len;
+  uint32_t k1;
+  size_t j;
+
+  for (j = 0; j < lanes; j++)
+    h[j] = seed + (uint32_t)j * MURMUR3_TWEAK;
+
+  while (left >= 4) {
+    k1 = murmur3_mix(btc_read32le(data));
+
+    for (j = 0; j < lanes; j++) {
+      h[j] ^= k1;
+      h[j] = ROTL32(h[j], 13);
+      h[j] = h[j] * 5 + UINT32_C(0xe6546b64);
+    }
+
+    data += 4;
+    left -= 4;
+  }
+
+  if (left > 0) {
+    k1 = murmur3_tail(data, left);
+
+    for (j = 0; j < lanes; j++)
+      h[j] ^= k1;
+  }
+
+  for (j = 0; j < lanes; j++) {
+    h[j] ^= len;
+    h[j] ^= h[j] >> 16;
+    h[j] *= UINT32_C(0x85ebca6b);
+    h[j] ^= h[j] >> 13;
+    h[j] *= UINT32_C(0xc2b2ae35);
+    h[j] ^= h[j] >> 16;
+
+    out[j] = h[j];
+  }
+}
+
+#if defined(MURMUR3_HAVE_VEC4)
+typedef uint32_t murmur3_vec4_t __attribute__((vector_size(16)));
+
+static void
+murmur3_vec4(uint32_t *out, const uint8_t *data, size_t len, uint32_t seed) {
+  murmur3_vec4_t h;
+  size_t left = len;
+  uint32_t tmp[4];
+  uint32_t k1;
+  int j;
+
+  for (j = 0; j < 4; j++)
+    tmp[j] = seed + (uint32_t)j * MURMUR3_TWEAK;
+
+  memcpy(&h, tmp, sizeof(h));
+
+  while (left >= 4) {
+    k1 = murmur3_mix(btc_read32le(data));
+
+    h ^= k1;
+    h = (h << 13) | (h >> 19);
+    h = h * 5 + UINT32_C(0xe6546b64);
+
+    data += 4;
+    left -= 4;
+  }
+
+  if (left > 0)
+    h ^= murmur3_tail(data, left);
+
+  h ^= (uint32_t)len;
+  h ^= h >> 16;
+  h *= UINT32_C(0x85ebca6b);
+  h ^= h >> 13;
+  h *= UINT32_C(0xc2b2ae35);
+  h ^= h >> 16;
+
+  memcpy(out, &h, sizeof(h));
+}
+#endif
+
+void
+btc_murmur3_tweaks(uint32_t *out,
+                   const uint8_t *data,
+                   size_t len,
+                   uint32_t n,
+                   size_t count,
+                   uint32_t tweak) {
+  uint32_t seed = (n * MURMUR3_TWEAK) + tweak;
+
+#if defined(MURMUR3_HAVE_VEC4)
+  while (count >= 4) {
+    murmur3_vec4(out, data, len, seed);
+    seed += 4 * MURMUR3_TWEAK;
+    out += 4;
+    count -= 4;
+  }
+#endif
+
+  while (count > 0) {
+    size_t lanes = count < 8 ? count : 8;
+
+    murmur3_lanes(out, data, len, seed, lanes);
+
+    seed += (uint32_t)lanes * MURMUR3_TWEAK;
+    out += lanes;
+    count -= lanes;
+  }
+}
@@ -841,6 +841,44 @@ btc_netaddr_get_str(char *zp, const btc_netaddr_t *x) {
   return c;
 }
 
+size_t
+btc_netaddr_get_host(char *zp, const btc_netaddr_t *x) {
+  /* Hostname without the port, as a proxy wants it. */
+  static const char *charset = "abcdefghijklmnopqrstuvwxyz234567";
+  char tmp[BTC_ADDRSTRLEN + 1];
+  size_t i, len;
+
+  if (btc_netaddr_is_onion(x)) {
+    const uint8_t *xp = x->raw + 6;
+
+    /* 80 bits of onion service id, 5 bits at a time. */
+    for (i = 0; i < 16; i++) {
+      size_t bit = i * 5;
+      unsigned int w = (xp[bit / 8] << 8);
+
+      if (bit / 8 + 1 < 10)
+        w |= xp[bit / 8 + 1];
+
+      zp[i] = charset[(w >> (11 - bit % 8)) & 31];
+    }
+
+    memcpy(zp + 16, ".onion", 7);
+
+    return 22;
+  }
+
+  if (btc_netaddr_is_mapped(x))
+    CHECK(inet_ntop4(x->raw + 12, tmp, sizeof(tmp) - 6) == 0);
+  else
+    CHECK(inet_ntop6(x->raw, tmp, sizeof(tmp) - 8) == 0);
+
+  len = strlen(tmp);
+
+  memcpy(zp, tmp, len + 1);
+
+  return len;
+}
+
 /**
  * Portable inet_{pton,ntop}.
  *
@@ -11,6 +11,7 @@
 #include <mako/bip152.h>
 #include <mako/block.h>
 #include <mako/bloom.h>
+#include <mako/buffer.h>
 #include <mako/header.h>
 #include <mako/netaddr.h>
 #include <mako/netmsg.h>
@@ -30,6 +31,9 @@ static const char *btc_cmds[] = {
   "addr",
   "block",
   "blocktxn",
+  "cfcheckpt",
+  "cfheaders",
+  "cfilter",
   "cmpctblock",
   "feefilter",
   "filteradd",
@@ -38,6 +42,9 @@ static const char *btc_cmds[] = {
   "getaddr",
   "getblocks",
   "getblocktxn",
+  "getcfcheckpt",
+  "getcfheaders",
+  "getcfilters",
   "getdata",
   "getheaders",
   "headers",
@@ -47,12 +54,17 @@ static const char *btc_cmds[] = {
   "notfound",
   "ping",
   "pong",
+  "reconcildiff",
   "reject",
+  "reqrecon",
   "sendcmpct",
   "sendheaders",
+  "sendtxrcncl",
+  "sketch",
   "tx",
   "verack",
   "version",
+  "wtxidrelay",
   /* Internal */
   "blocktxn", /* base */
   "block", /* base */
@@ -412,6 +424,7 @@ btc_zinv_init(btc_zinv_t *z) {
   z->items = NULL;
   z->alloc = 0;
   z->length = 0;
+  z->raw = NULL;
 }
 
 void
@@ -422,12 +435,19 @@ btc_zinv_clear(btc_zinv_t *z) {
   z->items = NULL;
   z->alloc = 0;
   z->length = 0;
+  z->raw = NULL;
 }
 
 void
 btc_zinv_copy(btc_zinv_t *z, const btc_zinv_t *x) {
   size_t i;
 
+  if (x->raw != NULL) {
+    z->length = x->length;
+    z->raw = x->raw;
+    return;
+  }
+
   btc_zinv_grow(z, x->length);
 
   for (i = 0; i < x->length; i++) {
@@ -436,11 +456,13 @@ btc_zinv_copy(btc_zinv_t *z, const btc_zinv_t *x) {
   }
 
   z->length = x->length;
+  z->raw = NULL;
 }
 
 void
 btc_zinv_reset(btc_zinv_t *z) {
   z->length = 0;
+  z->raw = NULL;
 }
 
 void
@@ -456,6 +478,8 @@ void
 btc_zinv_push(btc_zinv_t *z, uint32_t type, const uint8_t *hash) {
   btc_zinvitem_t *item;
 
+  CHECK(z->raw == NULL);
+
   if (z->length == z->alloc)
     btc_zinv_grow(z, (z->alloc * 3) / 2 + (z->alloc <= 1));
 
@@ -466,12 +490,27 @@ btc_zinv_push(btc_zinv_t *z, uint32_t type, const uint8_t *hash) {
 
 btc_invitem_t *
 btc_zinv_get(const btc_zinv_t *z, size_t index) {
-  btc_zinvitem_t *item = &z->items[index];
   btc_invitem_t *ret = btc_invitem_create();
-  btc_invitem_set(ret, item->type, item->hash);
+  btc_zinvitem_t item;
+
+  btc_zinv_item(&item, z, index);
+  btc_invitem_set(ret, item.type, item.hash);
+
   return ret;
 }
 
+void
+btc_zinv_item(btc_zinvitem_t *item, const btc_zinv_t *z, size_t index) {
+  if (z->raw != NULL) {
+    const uint8_t *xp = z->raw + index * 36;
+
+    item->type = btc_read32le(xp);
+    item->hash = xp + 4;
+  } else {
+    *item = z->items[index];
+  }
+}
+
 static size_t
 btc_zinv_size(const btc_zinv_t *x) {
   return btc_size_size(x->length) + x->length * 36;
@@ -484,6 +523,9 @@ btc_zinv_write(uint8_t *zp, const btc_zinv_t *x) {
 
   zp = btc_size_write(zp, x->length);
 
+  if (x->raw != NULL)
+    return btc_raw_write(zp, x->raw, x->length * 36);
+
   for (i = 0; i < x->length; i++) {
     item = &x->items[i];
 
@@ -496,31 +538,23 @@ btc_zinv_write(uint8_t *zp, const btc_zinv_t *x) {
 
 static int
 btc_zinv_read(btc_zinv_t *z, const uint8_t **xp, size_t *xn) {
-  btc_zinvitem_t *item;
-  size_t i, length;
+  size_t length;
 
   if (!btc_size_read(&length, xp, xn))
     return 0;
 
-  if (*xn < length * 36)
+  if (length > *xn / 36)
     return 0;
 
-  btc_zinv_grow(z, length);
-
-  /* The parser is currently holding all of `*xp`
-     in memory until btc_parser_parse returns.
-     Zero copy here makes us crazy fast. */
-  for (i = 0; i < length; i++) {
-    item = &z->items[i];
-
-    item->type = btc_read32le(*xp);
-    item->hash = *xp + 4;
-
-    *xp += 36;
-    *xn -= 36;
-  }
-
+  /* The parser holds all of `*xp` in memory until
+     the message has been handled: keep a view of
+     the items rather than copying (or even listing)
+     them. See btc_zinv_item. */
   z->length = length;
+  z->raw = *xp;
+
+  *xp += length * 36;
+  *xn -= length * 36;
 
   return 1;
 }
@@ -909,6 +943,551 @@ btc_sendcmpct_read(btc_sendcmpct_t *z, const uint8_t **xp, size_t *xn) {
   return 1;
 }
 
+/*
+ * GetCFilters
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_getcfilters, SCOPE_EXTERN)
+
+void
+btc_getcfilters_init(btc_getcfilters_t *msg) {
+  msg->filter_type = 0;
+  msg->start_height = 0;
+  btc_hash_init(msg->stop_hash);
+}
+
+void
+btc_getcfilters_clear(btc_getcfilters_t *msg) {
+  (void)msg;
+}
+
+void
+btc_getcfilters_copy(btc_getcfilters_t *z, const btc_getcfilters_t *x) {
+  *z = *x;
+}
+
+size_t
+btc_getcfilters_size(const btc_getcfilters_t *x) {
+  (void)x;
+  return 37;
+}
+
+uint8_t *
+btc_getcfilters_write(uint8_t *zp, const btc_getcfilters_t *x) {
+  zp = btc_uint8_write(zp, x->filter_type);
+  zp = btc_uint32_write(zp, x->start_height);
+  zp = btc_raw_write(zp, x->stop_hash, 32);
+  return zp;
+}
+
+int
+btc_getcfilters_read(btc_getcfilters_t *z, const uint8_t **xp, size_t *xn) {
+  if (!btc_uint8_read(&z->filter_type, xp, xn))
+    return 0;
+
+  if (!btc_uint32_read(&z->start_height, xp, xn))
+    return 0;
+
+  if (!btc_raw_read(z->stop_hash, 32, xp, xn))
+    return 0;
+
+  return 1;
+}
+
+/*
+ * CFilter
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_cfilter, SCOPE_EXTERN)
+
+void
+btc_cfilter_init(btc_cfilter_t *msg) {
+  msg->filter_type = 0;
+  btc_hash_init(msg->block_hash);
+  btc_buffer_init(&msg->filter);
+}
+
+void
+btc_cfilter_clear(btc_cfilter_t *msg) {
+  btc_buffer_clear(&msg->filter);
+}
+
+void
+btc_cfilter_copy(btc_cfilter_t *z, const btc_cfilter_t *x) {
+  z->filter_type = x->filter_type;
+  btc_hash_copy(z->block_hash, x->block_hash);
+  btc_buffer_copy(&z->filter, &x->filter);
+}
+
+size_t
+btc_cfilter_size(const btc_cfilter_t *x) {
+  return 33 + btc_buffer_size(&x->filter);
+}
+
+uint8_t *
+btc_cfilter_write(uint8_t *zp, const btc_cfilter_t *x) {
+  zp = btc_uint8_write(zp, x->filter_type);
+  zp = btc_raw_write(zp, x->block_hash, 32);
+  zp = btc_buffer_write(zp, &x->filter);
+  return zp;
+}
+
+int
+btc_cfilter_read(btc_cfilter_t *z, const uint8_t **xp, size_t *xn) {
+  if (!btc_uint8_read(&z->filter_type, xp, xn))
+    return 0;
+
+  if (!btc_raw_read(z->block_hash, 32, xp, xn))
+    return 0;
+
+  if (!btc_buffer_read(&z->filter, xp, xn))
+    return 0;
+
+  return 1;
+}
+
+/*
+ * CFHeaders
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_cfheaders, SCOPE_EXTERN)
+
+void
+btc_cfheaders_init(btc_cfheaders_t *msg) {
+  msg->filter_type = 0;
+  btc_hash_init(msg->stop_hash);
+  btc_hash_init(msg->prev_header);
+  msg->hashes = NULL;
+  msg->length = 0;
+}
+
+void
+btc_cfheaders_clear(btc_cfheaders_t *msg) {
+  if (msg->hashes != NULL)
+    btc_free(msg->hashes);
+
+  msg->hashes = NULL;
+  msg->length = 0;
+}
+
+void
+btc_cfheaders_copy(btc_cfheaders_t *z, const btc_cfheaders_t *x) {
+  z->filter_type = x->filter_type;
+  btc_hash_copy(z->stop_hash, x->stop_hash);
+  btc_hash_copy(z->prev_header, x->prev_header);
+  btc_cfheaders_resize(z, x->length);
+
+  if (x->length > 0)
+    memcpy(z->hashes, x->hashes, x->length * 32);
+}
+
+void
+btc_cfheaders_resize(btc_cfheaders_t *z, size_t length) {
+  if (length > 0)
+    z->hashes = (uint8_t *)btc_realloc(z->hashes, length * 32);
+
+  z->length = length;
+}
+
+size_t
+btc_cfheaders_size(const btc_cfheaders_t *x) {
+  return 65 + btc_size_size(x->length) + x->length * 32;
+}
+
+uint8_t *
+btc_cfheaders_write(uint8_t *zp, const btc_cfheaders_t *x) {
+  zp = btc_uint8_write(zp, x->filter_type);
+  zp = btc_raw_write(zp, x->stop_hash, 32);
+  zp = btc_raw_write(zp, x->prev_header, 32);
+  zp = btc_size_write(zp, x->length);
+  zp = btc_raw_write(zp, x->hashes, x->length * 32);
+  return zp;
+}
+
+int
+btc_cfheaders_read(btc_cfheaders_t *z, const uint8_t **xp, size_t *xn) {
+  size_t length;
+
+  if (!btc_uint8_read(&z->filter_type, xp, xn))
+    return 0;
+
+  if (!btc_raw_read(z->stop_hash, 32, xp, xn))
+    return 0;
+
+  if (!btc_raw_read(z->prev_header, 32, xp, xn))
+    return 0;
+
+  if (!btc_size_read(&length, xp, xn))
+    return 0;
+
+  if (length > BTC_NET_MAX_CFHEADERS)
+    return 0;
+
+  if (*xn < length * 32)
+    return 0;
+
+  btc_cfheaders_resize(z, length);
+
+  return btc_raw_read(z->hashes, length * 32, xp, xn);
+}
+
+/*
+ * GetCFCheckpt
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_getcfcheckpt, SCOPE_EXTERN)
+
+void
+btc_getcfcheckpt_init(btc_getcfcheckpt_t *msg) {
+  msg->filter_type = 0;
+  btc_hash_init(msg->stop_hash);
+}
+
+void
+btc_getcfcheckpt_clear(btc_getcfcheckpt_t *msg) {
+  (void)msg;
+}
+
+void
+btc_getcfcheckpt_copy(btc_getcfcheckpt_t *z, const btc_getcfcheckpt_t *x) {
+  *z = *x;
+}
+
+size_t
+btc_getcfcheckpt_size(const btc_getcfcheckpt_t *x) {
+  (void)x;
+  return 33;
+}
+
+uint8_t *
+btc_getcfcheckpt_write(uint8_t *zp, const btc_getcfcheckpt_t *x) {
+  zp = btc_uint8_write(zp, x->filter_type);
+  zp = btc_raw_write(zp, x->stop_hash, 32);
+  return zp;
+}
+
+int
+btc_getcfcheckpt_read(btc_getcfcheckpt_t *z, const uint8_t **xp, size_t *xn) {
+  if (!btc_uint8_read(&z->filter_type, xp, xn))
+    return 0;
+
+  if (!btc_raw_read(z->stop_hash, 32, xp, xn))
+    return 0;
+
+  return 1;
+}
+
+/*
+ * CFCheckpt
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_cfcheckpt, SCOPE_EXTERN)
+
+void
+btc_cfcheckpt_init(btc_cfcheckpt_t *msg) {
+  msg->filter_type = 0;
+  btc_hash_init(msg->stop_hash);
+  msg->headers = NULL;
+  msg->length = 0;
+}
+
+void
+btc_cfcheckpt_clear(btc_cfcheckpt_t *msg) {
+  if (msg->headers != NULL)
+    btc_free(msg->headers);
+
+  msg->headers = NULL;
+  msg->length = 0;
+}
+
+void
+btc_cfcheckpt_copy(btc_cfcheckpt_t *z, const btc_cfcheckpt_t *x) {
+  z->filter_type = x->filter_type;
+  btc_hash_copy(z->stop_hash, x->stop_hash);
+  btc_cfcheckpt_resize(z, x->length);
+
+  if (x->length > 0)
+    memcpy(z->headers, x->headers, x->length * 32);
+}
+
+void
+btc_cfcheckpt_resize(btc_cfcheckpt_t *z, size_t length) {
+  if (length > 0)
+    z->headers = (uint8_t *)btc_realloc(z->headers, length * 32);
+
+  z->length = length;
+}
+
+size_t
+btc_cfcheckpt_size(const btc_cfcheckpt_t *x) {
+  return 33 + btc_size_size(x->length) + x->length * 32;
+}
+
+uint8_t *
+btc_cfcheckpt_write(uint8_t *zp, const btc_cfcheckpt_t *x) {
+  zp = btc_uint8_write(zp, x->filter_type);
+  zp = btc_raw_write(zp, x->stop_hash, 32);
+  zp = btc_size_write(zp, x->length);
+  zp = btc_raw_write(zp, x->headers, x->length * 32);
+  return zp;
+}
+
+int
+btc_cfcheckpt_read(btc_cfcheckpt_t *z, const uint8_t **xp, size_t *xn) {
+  size_t length;
+
+  if (!btc_uint8_read(&z->filter_type, xp, xn))
+    return 0;
+
+  if (!btc_raw_read(z->stop_hash, 32, xp, xn))
+    return 0;
+
+  if (!btc_size_read(&length, xp, xn))
+    return 0;
+
+  if (*xn < length * 32)
+    return 0;
+
+  btc_cfcheckpt_resize(z, length);
+
+  return btc_raw_read(z->headers, length * 32, xp, xn);
+}
+
+/*
+ * SendTxRcncl
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_sendtxrcncl, SCOPE_EXTERN)
+
+void
+btc_sendtxrcncl_init(btc_sendtxrcncl_t *msg) {
+  msg->version = 1;
+  msg->salt = 0;
+}
+
+void
+btc_sendtxrcncl_clear(btc_sendtxrcncl_t *msg) {
+  (void)msg;
+}
+
+void
+btc_sendtxrcncl_copy(btc_sendtxrcncl_t *z, const btc_sendtxrcncl_t *x) {
+  *z = *x;
+}
+
+size_t
+btc_sendtxrcncl_size(const btc_sendtxrcncl_t *x) {
+  (void)x;
+  return 12;
+}
+
+uint8_t *
+btc_sendtxrcncl_write(uint8_t *zp, const btc_sendtxrcncl_t *x) {
+  zp = btc_uint32_write(zp, x->version);
+  zp = btc_uint64_write(zp, x->salt);
+  return zp;
+}
+
+int
+btc_sendtxrcncl_read(btc_sendtxrcncl_t *z, const uint8_t **xp, size_t *xn) {
+  if (!btc_uint32_read(&z->version, xp, xn))
+    return 0;
+
+  if (!btc_uint64_read(&z->salt, xp, xn))
+    return 0;
+
+  return 1;
+}
+
+/*
+ * ReqRecon
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_reqrecon, SCOPE_EXTERN)
+
+void
+btc_reqrecon_init(btc_reqrecon_t *msg) {
+  msg->set_size = 0;
+  msg->q = 0;
+}
+
+void
+btc_reqrecon_clear(btc_reqrecon_t *msg) {
+  (void)msg;
+}
+
+void
+btc_reqrecon_copy(btc_reqrecon_t *z, const btc_reqrecon_t *x) {
+  *z = *x;
+}
+
+size_t
+btc_reqrecon_size(const btc_reqrecon_t *x) {
+  (void)x;
+  return 4;
+}
+
+uint8_t *
+btc_reqrecon_write(uint8_t *zp, const btc_reqrecon_t *x) {
+  zp = btc_uint16_write(zp, x->set_size);
+  zp = btc_uint16_write(zp, x->q);
+  return zp;
+}
+
+int
+btc_reqrecon_read(btc_reqrecon_t *z, const uint8_t **xp, size_t *xn) {
+  if (!btc_uint16_read(&z->set_size, xp, xn))
+    return 0;
+
+  if (!btc_uint16_read(&z->q, xp, xn))
+    return 0;
+
+  return 1;
+}
+
+/*
+ * Sketch
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_sketch, SCOPE_EXTERN)
+
+void
+btc_sketch_init(btc_sketch_t *msg) {
+  msg->data = NULL;
+  msg->length = 0;
+}
+
+void
+btc_sketch_clear(btc_sketch_t *msg) {
+  if (msg->data != NULL)
+    btc_free(msg->data);
+
+  msg->data = NULL;
+  msg->length = 0;
+}
+
+void
+btc_sketch_copy(btc_sketch_t *z, const btc_sketch_t *x) {
+  if (x->length > 0) {
+    z->data = (uint8_t *)btc_realloc(z->data, x->length);
+
+    memcpy(z->data, x->data, x->length);
+  }
+
+  z->length = x->length;
+}
+
+size_t
+btc_sketch_size(const btc_sketch_t *x) {
+  return btc_size_size(x->length) + x->length;
+}
+
+uint8_t *
+btc_sketch_write(uint8_t *zp, const btc_sketch_t *x) {
+  zp = btc_size_write(zp, x->length);
+  zp = btc_raw_write(zp, x->data, x->length);
+  return zp;
+}
+
+int
+btc_sketch_read(btc_sketch_t *z, const uint8_t **xp, size_t *xn) {
+  size_t length;
+
+  if (!btc_size_read(&length, xp, xn))
+    return 0;
+
+  if (*xn < length)
+    return 0;
+
+  if (length > 0)
+    z->data = (uint8_t *)btc_realloc(z->data, length);
+
+  z->length = length;
+
+  return btc_raw_read(z->data, length, xp, xn);
+}
+
+/*
+ * ReconcilDiff
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_reconcildiff, SCOPE_EXTERN)
+
+void
+btc_reconcildiff_init(btc_reconcildiff_t *msg) {
+  msg->success = 0;
+  msg->ids = NULL;
+  msg->length = 0;
+}
+
+void
+btc_reconcildiff_clear(btc_reconcildiff_t *msg) {
+  if (msg->ids != NULL)
+    btc_free(msg->ids);
+
+  msg->ids = NULL;
+  msg->length = 0;
+}
+
+void
+btc_reconcildiff_copy(btc_reconcildiff_t *z, const btc_reconcildiff_t *x) {
+  z->success = x->success;
+
+  btc_reconcildiff_resize(z, x->length);
+
+  if (x->length > 0)
+    memcpy(z->ids, x->ids, x->length * sizeof(uint32_t));
+}
+
+void
+btc_reconcildiff_resize(btc_reconcildiff_t *z, size_t length) {
+  if (length > 0)
+    z->ids = (uint32_t *)btc_realloc(z->ids, length * sizeof(uint32_t));
+
+  z->length = length;
+}
+
+size_t
+btc_reconcildiff_size(const btc_reconcildiff_t *x) {
+  return 1 + btc_size_size(x->length) + x->length * 4;
+}
+
+uint8_t *
+btc_reconcildiff_write(uint8_t *zp, const btc_reconcildiff_t *x) {
+  size_t i;
+
+  zp = btc_uint8_write(zp, x->success);
+  zp = btc_size_write(zp, x->length);
+
+  for (i = 0; i < x->length; i++)
+    zp = btc_uint32_write(zp, x->ids[i]);
+
+  return zp;
+}
+
+int
+btc_reconcildiff_read(btc_reconcildiff_t *z, const uint8_t **xp, size_t *xn) {
+  size_t i, length;
+
+  if (!btc_uint8_read(&z->success, xp, xn))
+    return 0;
+
+  if (!btc_size_read(&length, xp, xn))
+    return 0;
+
+  if (*xn < length * 4)
+    return 0;
+
+  btc_reconcildiff_resize(z, length);
+
+  for (i = 0; i < length; i++) {
+    if (!btc_uint32_read(&z->ids[i], xp, xn))
+      return 0;
+  }
+
+  return 1;
+}
+
 /*
  * Unknown
  */
@@ -985,11 +1564,28 @@ btc_msg_clear(btc_msg_t *msg) {
   if (msg->body == NULL)
     return;
 
+  if (msg->body == (void *)&msg->local) {
+    switch (msg->type) {
+      case BTC_MSG_INV:
+      case BTC_MSG_GETDATA:
+      case BTC_MSG_NOTFOUND:
+        btc_zinv_clear(&msg->local.zinv);
+        break;
+      default:
+        break;
+    }
+
+    msg->body = NULL;
+
+    return;
+  }
+
   switch (msg->type) {
     case BTC_MSG_VERSION:
       btc_version_destroy((btc_version_t *)msg->body);
       break;
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       break;
     case BTC_MSG_PING:
       btc_ping_destroy((btc_ping_t *)msg->body);
@@ -1062,6 +1658,34 @@ btc_msg_clear(btc_msg_t *msg) {
     case BTC_MSG_BLOCKTXN_BASE:
       btc_blocktxn_destroy((btc_blocktxn_t *)msg->body);
       break;
+    case BTC_MSG_GETCFILTERS:
+    case BTC_MSG_GETCFHEADERS:
+      btc_getcfilters_destroy((btc_getcfilters_t *)msg->body);
+      break;
+    case BTC_MSG_CFILTER:
+      btc_cfilter_destroy((btc_cfilter_t *)msg->body);
+      break;
+    case BTC_MSG_CFHEADERS:
+      btc_cfheaders_destroy((btc_cfheaders_t *)msg->body);
+      break;
+    case BTC_MSG_GETCFCHECKPT:
+      btc_getcfcheckpt_destroy((btc_getcfcheckpt_t *)msg->body);
+      break;
+    case BTC_MSG_CFCHECKPT:
+      btc_cfcheckpt_destroy((btc_cfcheckpt_t *)msg->body);
+      break;
+    case BTC_MSG_SENDTXRCNCL:
+      btc_sendtxrcncl_destroy((btc_sendtxrcncl_t *)msg->body);
+      break;
+    case BTC_MSG_REQRECON:
+      btc_reqrecon_destroy((btc_reqrecon_t *)msg->body);
+      break;
+    case BTC_MSG_SKETCH:
+      btc_sketch_destroy((btc_sketch_t *)msg->body);
+      break;
+    case BTC_MSG_RECONCILDIFF:
+      btc_reconcildiff_destroy((btc_reconcildiff_t *)msg->body);
+      break;
     case BTC_MSG_UNKNOWN:
       btc_unknown_destroy((btc_unknown_t *)msg->body);
       break;
@@ -1075,6 +1699,9 @@ btc_msg_clear(btc_msg_t *msg) {
 void
 btc_msg_copy(btc_msg_t *z, const btc_msg_t *x) {
   *z = *x;
+
+  if (x->body == (const void *)&x->local)
+    z->body = &z->local;
 }
 
 void
@@ -1102,13 +1729,16 @@ btc_msg_alloc(btc_msg_t *msg) {
       msg->body = btc_version_create();
       break;
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       msg->body = NULL;
       break;
     case BTC_MSG_PING:
-      msg->body = btc_ping_create();
+      btc_ping_init(&msg->local.ping);
+      msg->body = &msg->local.ping;
       break;
     case BTC_MSG_PONG:
-      msg->body = btc_pong_create();
+      btc_pong_init(&msg->local.ping);
+      msg->body = &msg->local.ping;
       break;
     case BTC_MSG_GETADDR:
       msg->body = NULL;
@@ -1119,7 +1749,8 @@ btc_msg_alloc(btc_msg_t *msg) {
     case BTC_MSG_INV:
     case BTC_MSG_GETDATA:
     case BTC_MSG_NOTFOUND:
-      msg->body = btc_zinv_create();
+      btc_zinv_init(&msg->local.zinv);
+      msg->body = &msg->local.zinv;
       break;
     case BTC_MSG_INV_FULL:
     case BTC_MSG_GETDATA_FULL:
@@ -1163,10 +1794,12 @@ btc_msg_alloc(btc_msg_t *msg) {
       msg->body = btc_merkleblock_create();
       break;
     case BTC_MSG_FEEFILTER:
-      msg->body = btc_feefilter_create();
+      btc_feefilter_init(&msg->local.feefilter);
+      msg->body = &msg->local.feefilter;
       break;
     case BTC_MSG_SENDCMPCT:
-      msg->body = btc_sendcmpct_create();
+      btc_sendcmpct_init(&msg->local.sendcmpct);
+      msg->body = &msg->local.sendcmpct;
       break;
     case BTC_MSG_CMPCTBLOCK:
     case BTC_MSG_CMPCTBLOCK_BASE:
@@ -1179,6 +1812,36 @@ btc_msg_alloc(btc_msg_t *msg) {
     case BTC_MSG_BLOCKTXN_BASE:
       msg->body = btc_blocktxn_create();
       break;
+    case BTC_MSG_GETCFILTERS:
+    case BTC_MSG_GETCFHEADERS:
+      msg->body = btc_getcfilters_create();
+      break;
+    case BTC_MSG_CFILTER:
+      msg->body = btc_cfilter_create();
+      break;
+    case BTC_MSG_CFHEADERS:
+      msg->body = btc_cfheaders_create();
+      break;
+    case BTC_MSG_GETCFCHECKPT:
+      msg->body = btc_getcfcheckpt_create();
+      break;
+    case BTC_MSG_CFCHECKPT:
+      msg->body = btc_cfcheckpt_create();
+      break;
+    case BTC_MSG_SENDTXRCNCL:
+      btc_sendtxrcncl_init(&msg->local.sendtxrcncl);
+      msg->body = &msg->local.sendtxrcncl;
+      break;
+    case BTC_MSG_REQRECON:
+      btc_reqrecon_init(&msg->local.reqrecon);
+      msg->body = &msg->local.reqrecon;
+      break;
+    case BTC_MSG_SKETCH:
+      msg->body = btc_sketch_create();
+      break;
+    case BTC_MSG_RECONCILDIFF:
+      msg->body = btc_reconcildiff_create();
+      break;
     case BTC_MSG_UNKNOWN:
       msg->body = btc_unknown_create();
       break;
@@ -1194,6 +1857,7 @@ btc_msg_size(const btc_msg_t *x) {
     case BTC_MSG_VERSION:
       return btc_version_size((const btc_version_t *)x->body);
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       return 0;
     case BTC_MSG_PING:
       return btc_ping_size((const btc_ping_t *)x->body);
@@ -1252,6 +1916,25 @@ btc_msg_size(const btc_msg_t *x) {
       return btc_blocktxn_size((const btc_blocktxn_t *)x->body);
     case BTC_MSG_BLOCKTXN_BASE:
       return btc_blocktxn_base_size((const btc_blocktxn_t *)x->body);
+    case BTC_MSG_GETCFILTERS:
+    case BTC_MSG_GETCFHEADERS:
+      return btc_getcfilters_size((const btc_getcfilters_t *)x->body);
+    case BTC_MSG_CFILTER:
+      return btc_cfilter_size((const btc_cfilter_t *)x->body);
+    case BTC_MSG_CFHEADERS:
+      return btc_cfheaders_size((const btc_cfheaders_t *)x->body);
+    case BTC_MSG_GETCFCHECKPT:
+      return btc_getcfcheckpt_size((const btc_getcfcheckpt_t *)x->body);
+    case BTC_MSG_CFCHECKPT:
+      return btc_cfcheckpt_size((const btc_cfcheckpt_t *)x->body);
+    case BTC_MSG_SENDTXRCNCL:
+      return btc_sendtxrcncl_size((const btc_sendtxrcncl_t *)x->body);
+    case BTC_MSG_REQRECON:
+      return btc_reqrecon_size((const btc_reqrecon_t *)x->body);
+    case BTC_MSG_SKETCH:
+      return btc_sketch_size((const btc_sketch_t *)x->body);
+    case BTC_MSG_RECONCILDIFF:
+      return btc_reconcildiff_size((const btc_reconcildiff_t *)x->body);
     case BTC_MSG_UNKNOWN:
       return btc_unknown_size((const btc_unknown_t *)x->body);
     default:
@@ -1265,6 +1948,7 @@ btc_msg_write(uint8_t *zp, const btc_msg_t *x) {
     case BTC_MSG_VERSION:
       return btc_version_write(zp, (const btc_version_t *)x->body);
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       return zp;
     case BTC_MSG_PING:
       return btc_ping_write(zp, (const btc_ping_t *)x->body);
@@ -1323,6 +2007,25 @@ btc_msg_write(uint8_t *zp, const btc_msg_t *x) {
       return btc_blocktxn_write(zp, (const btc_blocktxn_t *)x->body);
     case BTC_MSG_BLOCKTXN_BASE:
       return btc_blocktxn_base_write(zp, (const btc_blocktxn_t *)x->body);
+    case BTC_MSG_GETCFILTERS:
+    case BTC_MSG_GETCFHEADERS:
+      return btc_getcfilters_write(zp, (const btc_getcfilters_t *)x->body);
+    case BTC_MSG_CFILTER:
+      return btc_cfilter_write(zp, (const btc_cfilter_t *)x->body);
+    case BTC_MSG_CFHEADERS:
+      return btc_cfheaders_write(zp, (const btc_cfheaders_t *)x->body);
+    case BTC_MSG_GETCFCHECKPT:
+      return btc_getcfcheckpt_write(zp, (const btc_getcfcheckpt_t *)x->body);
+    case BTC_MSG_CFCHECKPT:
+      return btc_cfcheckpt_write(zp, (const btc_cfcheckpt_t *)x->body);
+    case BTC_MSG_SENDTXRCNCL:
+      return btc_sendtxrcncl_write(zp, (const btc_sendtxrcncl_t *)x->body);
+    case BTC_MSG_REQRECON:
+      return btc_reqrecon_write(zp, (const btc_reqrecon_t *)x->body);
+    case BTC_MSG_SKETCH:
+      return btc_sketch_write(zp, (const btc_sketch_t *)x->body);
+    case BTC_MSG_RECONCILDIFF:
+      return btc_reconcildiff_write(zp, (const btc_reconcildiff_t *)x->body);
     case BTC_MSG_UNKNOWN:
       return btc_unknown_write(zp, (const btc_unknown_t *)x->body);
     default:
@@ -1336,6 +2039,7 @@ btc_msg_read(btc_msg_t *z, const uint8_t **xp, size_t *xn) {
     case BTC_MSG_VERSION:
       return btc_version_read((btc_version_t *)z->body, xp, xn);
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       return 1;
     case BTC_MSG_PING:
       return btc_ping_read((btc_ping_t *)z->body, xp, xn);
@@ -1390,6 +2094,25 @@ btc_msg_read(btc_msg_t *z, const uint8_t **xp, size_t *xn) {
     case BTC_MSG_BLOCKTXN:
     case BTC_MSG_BLOCKTXN_BASE:
       return btc_blocktxn_read((btc_blocktxn_t *)z->body, xp, xn);
+    case BTC_MSG_GETCFILTERS:
+    case BTC_MSG_GETCFHEADERS:
+      return btc_getcfilters_read((btc_getcfilters_t *)z->body, xp, xn);
+    case BTC_MSG_CFILTER:
+      return btc_cfilter_read((btc_cfilter_t *)z->body, xp, xn);
+    case BTC_MSG_CFHEADERS:
+      return btc_cfheaders_read((btc_cfheaders_t *)z->body, xp, xn);
+    case BTC_MSG_GETCFCHECKPT:
+      return btc_getcfcheckpt_read((btc_getcfcheckpt_t *)z->body, xp, xn);
+    case BTC_MSG_CFCHECKPT:
+      return btc_cfcheckpt_read((btc_cfcheckpt_t *)z->body, xp, xn);
+    case BTC_MSG_SENDTXRCNCL:
+      return btc_sendtxrcncl_read((btc_sendtxrcncl_t *)z->body, xp, xn);
+    case BTC_MSG_REQRECON:
+      return btc_reqrecon_read((btc_reqrecon_t *)z->body, xp, xn);
+    case BTC_MSG_SKETCH:
+      return btc_sketch_read((btc_sketch_t *)z->body, xp, xn);
+    case BTC_MSG_RECONCILDIFF:
+      return btc_reconcildiff_read((btc_reconcildiff_t *)z->body, xp, xn);
     case BTC_MSG_UNKNOWN:
       return btc_unknown_read((btc_unknown_t *)z->body, xp, xn);
     default:
@@ -0,0 +1,723 @@
+/*!
+ * addrindex.c - address index for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <lsm.h>
+
+#include <io/core.h>
+
+#include <node/addrindex.h>
+#include <node/chain.h>
+#include <node/indexer.h>
+#include <node/logger.h>
+
+#include <mako/block.h>
+#include <mako/coins.h>
+#include <mako/crypto/hash.h>
+#include <mako/entry.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+
+#include "../bio.h"
+#include "../impl.h"
+#include "../internal.h"
+
+/*
+ * Storage
+ *
+ * The index lives in its own database next to the
+ * chain and is keyed by the SHA256 of the script
+ * (what Electrum calls a "scripthash"):
+ *
+ *   'h' [scripthash] [height] [index] -> [txid]
+ *   'u' [scripthash] [txid] [vout] -> [height] [value]
+ *   'R' -> [block hash] [height]
+ *
+ * Heights and indices are big endian, so a range
+ * scan returns a script's history in chain order.
+ *
+ * Writes are queued in memory and committed a batch
+ * at a time, sorted, together with the tip they bring
+ * the index up to. Whatever a crash loses is rebuilt
+ * from the stored blocks and undo coins on startup.
+ *
+ * Catching up and rewinding are left to the indexer,
+ * which calls back into us with its lock held.
+ */
+
+#define HIST_PREFIX 'h'
+#define HIST_KEYLEN 41
+#define COIN_PREFIX 'u'
+#define COIN_KEYLEN 69
+
+static const uint8_t state_key[1] = {'R'};
+
+/* Queued writes before a batch is committed. */
+#define BTC_ADDR_BATCH 100000
+
+/* Seconds before a partial batch is committed. */
+#define BTC_ADDR_INTERVAL 10
+
+/*
+ * Types
+ */
+
+typedef struct btc_addrop_s {
+  uint8_t key[COIN_KEYLEN];
+  uint8_t val[32];
+  uint8_t key_len;
+  uint8_t val_len;
+  uint8_t remove;
+  uint32_t seq;
+} btc_addrop_t;
+
+struct btc_addrindex_s {
+  btc_chain_t *chain;
+  btc_logger_t *logger;
+  btc_indexer_t *indexer;
+  lsm_db *lsm;
+  const btc_entry_t *tip;
+  const btc_entry_t *flushed;
+  btc_addrop_t *ops;
+  size_t alloc;
+  size_t length;
+  int64_t last_flush;
+};
+
+/*
+ * Keys
+ */
+
+static void
+hist_key(btc_addrop_t *op, const uint8_t *hash, int32_t height, size_t index) {
+  op->key[0] = HIST_PREFIX;
+  memcpy(op->key + 1, hash, 32);
+  btc_write32be(op->key + 33, height);
+  btc_write32be(op->key + 37, index);
+  op->key_len = HIST_KEYLEN;
+}
+
+static void
+coin_key(btc_addrop_t *op, const uint8_t *hash, const btc_outpoint_t *prevout) {
+  op->key[0] = COIN_PREFIX;
+  memcpy(op->key + 1, hash, 32);
+  memcpy(op->key + 33, prevout->hash, 32);
+  btc_write32be(op->key + 65, prevout->index);
+  op->key_len = COIN_KEYLEN;
+}
+
+static int
+op_cmp(const void *xp, const void *yp) {
+  const btc_addrop_t *x = (const btc_addrop_t *)xp;
+  const btc_addrop_t *y = (const btc_addrop_t *)yp;
+  size_t len = x->key_len < y->key_len ? x->key_len : y->key_len;
+  int cmp = memcmp(x->key, y->key, len);
+
+  if (cmp != 0)
+    return cmp;
+
+  if (x->key_len != y->key_len)
+    return (int)x->key_len - (int)y->key_len;
+
+  /* Later writes to the same key win. */
+  return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/*
+ * Address Index
+ */
+
+static int
+on_connect(const btc_entry_t *entry,
+           const btc_block_t *block,
+           const btc_undo_t *undo,
+           void *arg);
+
+static int
+on_disconnect(const btc_entry_t *entry,
+              const btc_block_t *block,
+              const btc_undo_t *undo,
+              void *arg);
+
+btc_addrindex_t *
+btc_addrindex_create(btc_chain_t *chain) {
+  btc_addrindex_t *db = btc_malloc(sizeof(btc_addrindex_t));
+
+  memset(db, 0, sizeof(*db));
+
+  db->chain = chain;
+  db->logger = NULL;
+  db->indexer = btc_indexer_create(chain, "addrindex");
+  db->lsm = NULL;
+  db->ops = NULL;
+
+  btc_indexer_set_context(db->indexer, db);
+  btc_indexer_on_connect(db->indexer, on_connect);
+  btc_indexer_on_disconnect(db->indexer, on_disconnect);
+
+  return db;
+}
+
+void
+btc_addrindex_destroy(btc_addrindex_t *db) {
+  btc_indexer_destroy(db->indexer);
+
+  if (db->ops != NULL)
+    btc_free(db->ops);
+
+  btc_free(db);
+}
+
+void
+btc_addrindex_set_logger(btc_addrindex_t *db, btc_logger_t *logger) {
+  btc_indexer_set_logger(db->indexer, logger);
+  db->logger = logger;
+}
+
+static void
+btc_addrindex_log(btc_addrindex_t *db, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_write(db->logger, "addrindex", fmt, ap);
+  va_end(ap);
+}
+
+static btc_addrop_t *
+btc_addrindex_push(btc_addrindex_t *db) {
+  btc_addrop_t *op;
+
+  if (db->length == db->alloc) {
+    db->alloc = db->alloc == 0 ? 1024 : db->alloc * 2;
+    db->ops = btc_realloc(db->ops, db->alloc * sizeof(btc_addrop_t));
+  }
+
+  op = &db->ops[db->length];
+  op->seq = db->length++;
+  op->val_len = 0;
+  op->remove = 0;
+
+  return op;
+}
+
+static void
+btc_addrindex_put_tx(btc_addrindex_t *db,
+                     const btc_script_t *script,
+                     const btc_entry_t *entry,
+                     size_t index,
+                     const btc_tx_t *tx,
+                     int remove) {
+  btc_addrop_t *op = btc_addrindex_push(db);
+  uint8_t hash[32];
+
+  btc_addrindex_hash(hash, script);
+
+  hist_key(op, hash, entry->height, index);
+
+  memcpy(op->val, tx->hash, 32);
+
+  op->val_len = 32;
+  op->remove = remove;
+}
+
+static void
+btc_addrindex_put_coin(btc_addrindex_t *db,
+                       const btc_outpoint_t *prevout,
+                       const btc_output_t *output,
+                       int32_t height,
+                       int remove) {
+  btc_addrop_t *op = btc_addrindex_push(db);
+  uint8_t hash[32];
+
+  btc_addrindex_hash(hash, &output->script);
+
+  coin_key(op, hash, prevout);
+
+  btc_write32le(op->val + 0, height);
+  btc_write64le(op->val + 4, output->value);
+
+  op->val_len = 12;
+  op->remove = remove;
+}
+
+static void
+btc_addrindex_apply(btc_addrindex_t *db,
+                    const btc_entry_t *entry,
+                    const btc_block_t *block,
+                    const btc_undo_t *undo,
+                    int remove) {
+  /* Undo coins are stored in input order, which
+     lets us walk them without building a view. */
+  const btc_output_t *output;
+  const btc_input_t *input;
+  const btc_coin_t *coin;
+  btc_outpoint_t prevout;
+  const btc_tx_t *tx;
+  size_t i, j, k = 0;
+
+  for (i = 0; i < block->txs.length; i++) {
+    tx = block->txs.items[i];
+
+    if (i > 0) {
+      for (j = 0; j < tx->inputs.length; j++) {
+        input = tx->inputs.items[j];
+
+        CHECK(k < undo->length);
+
+        coin = undo->items[k++];
+
+        btc_addrindex_put_tx(db, &coin->output.script, entry, i, tx, remove);
+        btc_addrindex_put_coin(db, &input->prevout, &coin->output,
+                                   coin->height, !remove);
+      }
+    }
+
+    for (j = 0; j < tx->outputs.length; j++) {
+      output = tx->outputs.items[j];
+
+      if (btc_script_is_unspendable(&output->script))
+        continue;
+
+      btc_outpoint_set(&prevout, tx->hash, j);
+
+      btc_addrindex_put_tx(db, &output->script, entry, i, tx, remove);
+      btc_addrindex_put_coin(db, &prevout, output, entry->height, remove);
+    }
+  }
+
+  CHECK(k == undo->length);
+
+  db->tip = remove ? entry->prev : entry;
+}
+
+static int
+btc_addrindex_flush(btc_addrindex_t *db) {
+  uint8_t state[36];
+  btc_addrop_t *op;
+  size_t i;
+  int rc;
+
+  if (db->length == 0 && db->flushed == db->tip)
+    return 1;
+
+  qsort(db->ops, db->length, sizeof(btc_addrop_t), op_cmp);
+
+  rc = lsm_begin(db->lsm, 1);
+
+  if (rc != LSM_OK)
+    return 0;
+
+  for (i = 0; i < db->length; i++) {
+    op = &db->ops[i];
+
+    /* Superseded by a later write. */
+    if (i + 1 < db->length && op->key_len == op[1].key_len
+        && memcmp(op->key, op[1].key, op->key_len) == 0) {
+      continue;
+    }
+
+    if (op->remove)
+      rc = lsm_delete(db->lsm, op->key, op->key_len);
+    else
+      rc = lsm_insert(db->lsm, op->key, op->key_len, op->val, op->val_len);
+
+    if (rc != LSM_OK)
+      goto fail;
+  }
+
+  memcpy(state, db->tip->hash, 32);
+  btc_write32le(state + 32, db->tip->height);
+
+  rc = lsm_insert(db->lsm, state_key, 1, state, sizeof(state));
+
+  if (rc != LSM_OK)
+    goto fail;
+
+  rc = lsm_commit(db->lsm, 0);
+
+  if (rc != LSM_OK)
+    goto fail;
+
+  db->length = 0;
+  db->flushed = db->tip;
+  db->last_flush = btc_now();
+
+  return 1;
+fail:
+  CHECK(lsm_rollback(db->lsm, 0) == 0);
+  db->length = 0;
+  return 0;
+}
+
+static int
+btc_addrindex_maybe_flush(btc_addrindex_t *db) {
+  if (db->length >= BTC_ADDR_BATCH)
+    return btc_addrindex_flush(db);
+
+  if (btc_now() >= db->last_flush + BTC_ADDR_INTERVAL)
+    return btc_addrindex_flush(db);
+
+  return 1;
+}
+
+static int
+on_connect(const btc_entry_t *entry,
+           const btc_block_t *block,
+           const btc_undo_t *undo,
+           void *arg) {
+  btc_addrindex_t *db = (btc_addrindex_t *)arg;
+
+  btc_addrindex_apply(db, entry, block, undo, 0);
+
+  return btc_addrindex_maybe_flush(db);
+}
+
+static int
+on_disconnect(const btc_entry_t *entry,
+              const btc_block_t *block,
+              const btc_undo_t *undo,
+              void *arg) {
+  btc_addrindex_t *db = (btc_addrindex_t *)arg;
+
+  btc_addrindex_apply(db, entry, block, undo, 1);
+
+  return btc_addrindex_maybe_flush(db);
+}
+
+static int
+btc_addrindex_wipe(btc_addrindex_t *db) {
+  /* Deleted a batch at a time: a cursor
+     cannot be held across a write. */
+  const void *kp;
+  lsm_cursor *cur;
+  size_t count;
+  int kn;
+
+  do {
+    count = 0;
+
+    CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+    CHECK(lsm_csr_first(cur) == 0);
+
+    while (lsm_csr_valid(cur) && count < 1024) {
+      btc_addrop_t *op = btc_addrindex_push(db);
+
+      CHECK(lsm_csr_key(cur, &kp, &kn) == 0);
+      CHECK(kn >= 1 && kn <= COIN_KEYLEN);
+
+      memcpy(op->key, kp, kn);
+
+      op->key_len = kn;
+      op->remove = 1;
+
+      count++;
+
+      CHECK(lsm_csr_next(cur) == 0);
+    }
+
+    CHECK(lsm_csr_close(cur) == 0);
+
+    if (count == 0)
+      break;
+
+    if (!btc_addrindex_flush(db))
+      return 0;
+  } while (count == 1024);
+
+  return 1;
+}
+
+static int
+btc_addrindex_load(btc_addrindex_t *db) {
+  const btc_entry_t *entry = NULL;
+  lsm_cursor *cur;
+  const void *vp;
+  int vn;
+
+  db->tip = btc_chain_by_height(db->chain, 0);
+  db->flushed = NULL;
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, state_key, 1, LSM_SEEK_EQ) == 0);
+
+  if (lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+
+    if (vn == 36)
+      entry = btc_chain_by_hash(db->chain, vp);
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  if (entry == NULL) {
+    btc_addrindex_log(db, "Building address index.");
+
+    /* Start over from whatever is on disk. */
+    if (!btc_addrindex_wipe(db))
+      return 0;
+
+    return btc_addrindex_flush(db);
+  }
+
+  /* If the chain reorged past our last batch,
+     the indexer rewinds the stale blocks. */
+  db->tip = entry;
+  db->flushed = entry;
+
+  return 1;
+}
+
+int
+btc_addrindex_open(btc_addrindex_t *db, const char *prefix, unsigned int flags) {
+  char path[BTC_PATH_MAX];
+  int rc, op;
+
+  if (!(flags & BTC_ADDR_INDEX))
+    return 1;
+
+  btc_addrindex_log(db, "Opening address index.");
+
+  /* Pruned nodes may be missing the blocks and
+     undo coins needed to index older history. */
+  if (flags & BTC_CHAIN_PRUNE) {
+    btc_addrindex_log(db, "Address index is incompatible with pruning.");
+    return 0;
+  }
+
+  if (!btc_path_join(path, sizeof(path), prefix, "addrs.dat", 0))
+    return 0;
+
+  rc = lsm_new(lsm_default_env(), &db->lsm);
+
+  if (rc != LSM_OK)
+    return 0;
+
+  op = 0;
+  rc = lsm_config(db->lsm, LSM_CONFIG_MMAP, &op);
+
+  if (rc == LSM_OK) {
+    op = 0;
+    rc = lsm_config(db->lsm, LSM_CONFIG_MULTIPLE_PROCESSES, &op);
+  }
+
+  if (rc == LSM_OK)
+    rc = lsm_open(db->lsm, path);
+
+  if (rc != LSM_OK) {
+    btc_addrindex_log(db, "Could not open %s.", path);
+    goto fail;
+  }
+
+  db->last_flush = btc_now();
+
+  if (!btc_addrindex_load(db)) {
+    btc_addrindex_log(db, "Could not read %s.", path);
+    goto fail;
+  }
+
+  btc_addrindex_log(db, "Loaded addresses to height %d.", db->tip->height);
+
+  if (!btc_indexer_start(db->indexer, db->tip)) {
+    btc_addrindex_log(db, "Could not start address index.");
+    goto fail;
+  }
+
+  return 1;
+fail:
+  CHECK(lsm_close(db->lsm) == 0);
+  db->lsm = NULL;
+  db->length = 0;
+  return 0;
+}
+
+void
+btc_addrindex_close(btc_addrindex_t *db) {
+  if (db->lsm == NULL)
+    return;
+
+  btc_addrindex_log(db, "Closing address index.");
+
+  btc_indexer_stop(db->indexer);
+
+  if (!btc_addrindex_flush(db))
+    btc_addrindex_log(db, "Could not write address index.");
+
+  CHECK(lsm_close(db->lsm) == 0);
+
+  db->lsm = NULL;
+  db->tip = NULL;
+  db->flushed = NULL;
+  db->length = 0;
+}
+
+void
+btc_addrindex_connect(btc_addrindex_t *db,
+                      const btc_entry_t *entry,
+                      const btc_block_t *block,
+                      const btc_view_t *view) {
+  btc_indexer_connect(db->indexer, entry, block, view);
+}
+
+void
+btc_addrindex_disconnect(btc_addrindex_t *db,
+                         const btc_entry_t *entry,
+                         const btc_block_t *block) {
+  btc_indexer_disconnect(db->indexer, entry, block);
+}
+
+int
+btc_addrindex_enabled(btc_addrindex_t *db) {
+  return db->lsm != NULL;
+}
+
+int32_t
+btc_addrindex_height(btc_addrindex_t *db) {
+  if (db->lsm == NULL)
+    return -1;
+
+  return btc_indexer_height(db->indexer);
+}
+
+int
+btc_addrindex_syncing(btc_addrindex_t *db) {
+  if (db->lsm == NULL)
+    return 0;
+
+  return btc_indexer_syncing(db->indexer);
+}
+
+void
+btc_addrindex_hash(uint8_t *hash, const btc_script_t *script) {
+  btc_sha256(hash, script->data, script->length);
+}
+
+size_t
+btc_addrindex_history(btc_addrindex_t *db,
+                      btc_addrtx_t **items,
+                      const uint8_t *hash,
+                      int32_t start,
+                      size_t limit) {
+  uint8_t key[HIST_KEYLEN];
+  btc_addrtx_t *item;
+  const uint8_t *kp;
+  size_t count = 0;
+  lsm_cursor *cur;
+  const void *vp;
+  int kn, vn;
+
+  *items = NULL;
+
+  if (db->lsm == NULL || limit == 0)
+    return 0;
+
+  btc_indexer_lock(db->indexer);
+
+  /* Queries see everything indexed so far. */
+  if (!btc_addrindex_flush(db)) {
+    btc_indexer_unlock(db->indexer);
+    return 0;
+  }
+
+  key[0] = HIST_PREFIX;
+  memcpy(key + 1, hash, 32);
+  btc_write32be(key + 33, start < 0 ? 0 : start);
+  btc_write32be(key + 37, 0);
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_GE) == 0);
+
+  while (count < limit && lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_key(cur, (const void **)&kp, &kn) == 0);
+
+    if (kn != HIST_KEYLEN || memcmp(kp, key, 33) != 0)
+      break;
+
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+    CHECK(vn == 32);
+
+    if ((count & (count - 1)) == 0)
+      *items = btc_realloc(*items, (count ? count * 2 : 1) * sizeof(*item));
+
+    item = &(*items)[count++];
+
+    memcpy(item->hash, vp, 32);
+
+    item->height = (int32_t)btc_read32be(kp + 33);
+    item->index = btc_read32be(kp + 37);
+
+    CHECK(lsm_csr_next(cur) == 0);
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  btc_indexer_unlock(db->indexer);
+
+  return count;
+}
+
+size_t
+btc_addrindex_unspents(btc_addrindex_t *db,
+                       btc_addrcoin_t **items,
+                       const uint8_t *hash,
+                       size_t limit) {
+  uint8_t key[33];
+  btc_addrcoin_t *item;
+  const uint8_t *kp;
+  const uint8_t *vp;
+  size_t count = 0;
+  lsm_cursor *cur;
+  int kn, vn;
+
+  *items = NULL;
+
+  if (db->lsm == NULL || limit == 0)
+    return 0;
+
+  btc_indexer_lock(db->indexer);
+
+  if (!btc_addrindex_flush(db)) {
+    btc_indexer_unlock(db->indexer);
+    return 0;
+  }
+
+  key[0] = COIN_PREFIX;
+  memcpy(key + 1, hash, 32);
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_GE) == 0);
+
+  while (count < limit && lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_key(cur, (const void **)&kp, &kn) == 0);
+
+    if (kn != COIN_KEYLEN || memcmp(kp, key, 33) != 0)
+      break;
+
+    CHECK(lsm_csr_value(cur, (const void **)&vp, &vn) == 0);
+    CHECK(vn == 12);
+
+    if ((count & (count - 1)) == 0)
+      *items = btc_realloc(*items, (count ? count * 2 : 1) * sizeof(*item));
+
+    item = &(*items)[count++];
+
+    btc_outpoint_set(&item->prevout, kp + 33, btc_read32be(kp + 65));
+
+    item->height = (int32_t)btc_read32le(vp + 0);
+    item->value = (int64_t)btc_read64le(vp + 4);
+
+    CHECK(lsm_csr_next(cur) == 0);
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  btc_indexer_unlock(db->indexer);
+
+  return count;
+}
@@ -8,6 +8,7 @@
 
 #include <math.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -20,7 +21,6 @@
 
 #include <mako/crypto/hash.h>
 #include <mako/crypto/rand.h>
-#include <mako/list.h>
 #include <mako/map.h>
 #include <mako/net.h>
 #include <mako/netaddr.h>
@@ -97,8 +97,7 @@ btc_addrent_init(btc_addrent_t *entry) {
   entry->last_success = 0;
   entry->last_attempt = 0;
   entry->rand_pos = 0;
-  entry->prev = NULL;
-  entry->next = NULL;
+  entry->bucket_pos = 0;
 }
 
 static void
@@ -117,8 +116,7 @@ btc_addrent_copy(btc_addrent_t *z, const btc_addrent_t *x) {
   z->last_success = x->last_success;
   z->last_attempt = x->last_attempt;
   z->rand_pos = x->rand_pos;
-  z->prev = x->prev;
-  z->next = x->next;
+  z->bucket_pos = x->bucket_pos;
 }
 
 static double
@@ -204,34 +202,11 @@ btc_addrent_read(btc_addrent_t *z, const uint8_t **xp, size_t *xn) {
     return 0;
 
   z->rand_pos = 0;
-  z->prev = NULL;
-  z->next = NULL;
+  z->bucket_pos = 0;
 
   return 1;
 }
 
-/*
- * Used Bucket
- */
-
-typedef struct btc_bucket_s {
-  btc_addrent_t *head;
-  btc_addrent_t *tail;
-  size_t length;
-} btc_bucket_t;
-
-static btc_bucket_t *
-btc_bucket_create(void) {
-  btc_bucket_t *z;
-  btc_list_create(z, btc_bucket_t);
-  return z;
-}
-
-static void
-btc_bucket_destroy(btc_bucket_t *z) {
-  btc_list_destroy(z);
-}
-
 /*
  * Local Address
  */
@@ -299,6 +274,95 @@ btc_randvec_swap(btc_vector_t *rnd, size_t i, size_t j) {
   return y;
 }
 
+/*
+ * DNS Seed
+ */
+
+typedef struct btc_seed_s {
+  const char *name;
+  btc_mutex_t *lock;
+  btc_thread_t *thread;
+  btc_sockaddr_t *res;
+  int ok;
+  int done;
+} btc_seed_t;
+
+static void
+btc_seed_resolve(void *arg) {
+  btc_seed_t *seed = (btc_seed_t *)arg;
+  btc_sockaddr_t *res;
+  int ok;
+
+  ok = btc_getaddrinfo(&res, seed->name);
+
+  btc_mutex_lock(seed->lock);
+
+  seed->res = res;
+  seed->ok = ok;
+  seed->done = 1;
+
+  btc_mutex_unlock(seed->lock);
+}
+
+/*
+ * Batch
+ */
+
+typedef struct btc_addrbatch_s {
+  uint8_t src[6];
+  uint64_t have;
+  uint32_t buckets[FRESH_SPREAD];
+} btc_addrbatch_t;
+
+/*
+ * Snapshot Writer
+ */
+
+typedef struct btc_dump_s {
+  char path[BTC_PATH_MAX];
+  char tmp[BTC_PATH_MAX + 5];
+  btc_mutex_t *lock;
+  btc_thread_t *thread;
+  uint8_t *data;
+  size_t length;
+  int ok;
+  int done;
+} btc_dump_t;
+
+static int
+btc_dump_commit(const btc_dump_t *dump) {
+  int flags = BTC_O_WRONLY | BTC_O_CREAT | BTC_O_TRUNC;
+  int fd = btc_fs_open(dump->tmp, flags, 0644);
+  int ok;
+
+  if (fd == -1)
+    return 0;
+
+  ok = btc_fs_write(fd, dump->data, dump->length) && btc_fs_fsync(fd);
+
+  btc_fs_close(fd);
+
+  if (!ok || !btc_fs_rename(dump->tmp, dump->path)) {
+    btc_fs_unlink(dump->tmp);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void
+btc_dump_write(void *arg) {
+  btc_dump_t *dump = (btc_dump_t *)arg;
+  int ok = btc_dump_commit(dump);
+
+  btc_mutex_lock(dump->lock);
+
+  dump->ok = ok;
+  dump->done = 1;
+
+  btc_mutex_unlock(dump->lock);
+}
+
 /*
  * Address Manager
  */
@@ -315,19 +379,25 @@ struct btc_addrman_s {
   uint8_t key[32];
   btc_netmap_t *map;
   btc_vector_t rnd;
-  btc_netmap_t **fresh;
+  btc_addrent_t **fresh;
+  uint16_t *fresh_len;
   size_t total_fresh;
-  btc_bucket_t **used;
+  btc_addrent_t **used;
+  uint16_t *used_len;
   size_t total_used;
   btc_netmap_t *local;
   btc_netmap_t *banned;
+  btc_mutex_t *seed_lock;
+  btc_seed_t *seeds;
+  size_t seeds_len;
+  size_t seeds_left;
+  btc_dump_t dump;
   int needs_flush;
 };
 
 btc_addrman_t *
 btc_addrman_create(const btc_network_t *network) {
   btc_addrman_t *man = btc_malloc(sizeof(btc_addrman_t));
-  int i;
 
   memset(man, 0, sizeof(*man));
 
@@ -344,19 +414,26 @@ btc_addrman_create(const btc_network_t *network) {
   btc_getrandom(man->key, 32);
   man->map = btc_netmap_create();
   btc_vector_init(&man->rnd);
-  man->fresh = btc_malloc(FRESH_COUNT * sizeof(btc_netmap_t *));
+  man->fresh = btc_malloc(FRESH_COUNT * FRESH_SIZE * sizeof(btc_addrent_t *));
+  man->fresh_len = btc_malloc(FRESH_COUNT * sizeof(uint16_t));
   man->total_fresh = 0;
-  man->used = btc_malloc(USED_COUNT * sizeof(btc_bucket_t *));
+  man->used = btc_malloc(USED_COUNT * USED_SIZE * sizeof(btc_addrent_t *));
+  man->used_len = btc_malloc(USED_COUNT * sizeof(uint16_t));
   man->total_used = 0;
   man->local = btc_netmap_create();
   man->banned = btc_netmap_create();
+  man->seed_lock = btc_mutex_create();
+  man->seeds = NULL;
+  man->seeds_len = 0;
+  man->seeds_left = 0;
+  man->dump.lock = btc_mutex_create();
+  man->dump.thread = NULL;
   man->needs_flush = 0;
 
-  for (i = 0; i < FRESH_COUNT; i++)
-    man->fresh[i] = btc_netmap_create();
-
-  for (i = 0; i < USED_COUNT; i++)
-    man->used[i] = btc_bucket_create();
+  memset(man->fresh, 0, FRESH_COUNT * FRESH_SIZE * sizeof(btc_addrent_t *));
+  memset(man->fresh_len, 0, FRESH_COUNT * sizeof(uint16_t));
+  memset(man->used, 0, USED_COUNT * USED_SIZE * sizeof(btc_addrent_t *));
+  memset(man->used_len, 0, USED_COUNT * sizeof(uint16_t));
 
   return man;
 }
@@ -364,19 +441,12 @@ btc_addrman_create(const btc_network_t *network) {
 void
 btc_addrman_destroy(btc_addrman_t *man) {
   btc_netmapiter_t iter;
-  size_t i;
 
   btc_netmap_iterate(&iter, man->map);
 
   while (btc_netmap_next(&iter))
     btc_addrent_destroy(iter.val);
 
-  for (i = 0; i < FRESH_COUNT; i++)
-    btc_netmap_destroy(man->fresh[i]);
-
-  for (i = 0; i < USED_COUNT; i++)
-    btc_bucket_destroy(man->used[i]);
-
   btc_netmap_iterate(&iter, man->local);
 
   while (btc_netmap_next(&iter))
@@ -390,9 +460,13 @@ btc_addrman_destroy(btc_addrman_t *man) {
   btc_netmap_destroy(man->map);
   btc_vector_clear(&man->rnd);
   btc_free(man->fresh);
+  btc_free(man->fresh_len);
   btc_free(man->used);
+  btc_free(man->used_len);
   btc_netmap_destroy(man->local);
   btc_netmap_destroy(man->banned);
+  btc_mutex_destroy(man->seed_lock);
+  btc_mutex_destroy(man->dump.lock);
   btc_free(man);
 }
 
@@ -444,12 +518,16 @@ btc_addrman_read_file(btc_addrman_t *man, const char *file) {
 
 static int
 btc_addrman_resolve(btc_addrman_t *man) {
+  /* Literal seeds go in right away. DNS seeds are
+     looked up concurrently, one thread apiece, and
+     picked up by `btc_addrman_poll` as they land. */
   const btc_network_t *network = man->network;
   int64_t now = btc_now();
-  btc_sockaddr_t *res, *it;
   btc_netaddr_t addr;
   size_t i;
 
+  CHECK(man->seeds == NULL);
+
   for (i = 0; i < network->seeds.length; i++) {
     const char *seed = network->seeds.items[i];
 
@@ -461,42 +539,174 @@ btc_addrman_resolve(btc_addrman_t *man) {
         addr.port = network->port;
 
       btc_addrman_add(man, &addr, NULL);
+    }
+  }
+
+  /* Temporary. */
+  if (btc_netmap_size(man->map) >= 10)
+    return 1;
+
+  if (network->seeds.length == 0)
+    return btc_addrman_total(man) > 0;
 
+  man->seeds = btc_malloc(network->seeds.length * sizeof(btc_seed_t));
+
+  for (i = 0; i < network->seeds.length; i++) {
+    const char *name = network->seeds.items[i];
+    btc_seed_t *seed;
+
+    if (btc_netaddr_set_str(&addr, name))
       continue;
+
+    btc_addrman_log(man, "Resolving %s...", name);
+
+    seed = &man->seeds[man->seeds_len++];
+    seed->name = name;
+    seed->lock = man->seed_lock;
+    seed->thread = btc_thread_alloc();
+    seed->res = NULL;
+    seed->ok = 0;
+    seed->done = 0;
+
+    btc_thread_create(seed->thread, btc_seed_resolve, seed);
+  }
+
+  man->seeds_left = man->seeds_len;
+
+  return btc_addrman_total(man) > 0 || man->seeds_left > 0;
+}
+
+static size_t
+btc_addrman_finish(btc_addrman_t *man, btc_seed_t *seed) {
+  size_t added = 0;
+  btc_sockaddr_t *it;
+  btc_netaddr_t addr;
+  int64_t now;
+  int total;
+
+  btc_thread_join(seed->thread);
+  btc_thread_free(seed->thread);
+
+  seed->thread = NULL;
+
+  if (!seed->ok) {
+    btc_addrman_log(man, "Could not resolve %s", seed->name);
+    return 0;
+  }
+
+  now = btc_now();
+  total = 0;
+
+  for (it = seed->res; it != NULL; it = it->next) {
+    btc_netaddr_set_sockaddr(&addr, it);
+
+    addr.time = now;
+    addr.services = BTC_NET_DEFAULT_SERVICES;
+    addr.port = man->network->port;
+
+    added += btc_addrman_add(man, &addr, NULL);
+
+    total += 1;
+  }
+
+  btc_addrman_log(man, "Resolved %d seeds from %s", total, seed->name);
+
+  btc_freeaddrinfo(seed->res);
+
+  seed->res = NULL;
+
+  return added;
+}
+
+static void
+btc_addrman_clear_seeds(btc_addrman_t *man) {
+  size_t i;
+
+  for (i = 0; i < man->seeds_len; i++) {
+    btc_seed_t *seed = &man->seeds[i];
+
+    if (seed->thread != NULL) {
+      btc_thread_join(seed->thread);
+      btc_thread_free(seed->thread);
     }
 
-    /* Temporary. */
-    if (btc_netmap_size(man->map) >= 10)
-      continue;
+    if (seed->res != NULL)
+      btc_freeaddrinfo(seed->res);
+  }
 
-    btc_addrman_log(man, "Resolving %s...", seed);
+  if (man->seeds != NULL)
+    btc_free(man->seeds);
 
-    if (btc_getaddrinfo(&res, seed)) {
-      int total = 0;
+  man->seeds = NULL;
+  man->seeds_len = 0;
+  man->seeds_left = 0;
+}
 
-      for (it = res; it != NULL; it = it->next) {
-        btc_netaddr_set_sockaddr(&addr, it);
+static void
+btc_addrman_reap(btc_addrman_t *man, int wait) {
+  btc_dump_t *dump = &man->dump;
+  int done;
 
-        addr.time = now;
-        addr.services = BTC_NET_DEFAULT_SERVICES;
-        addr.port = network->port;
+  if (dump->thread == NULL)
+    return;
 
-        btc_addrman_add(man, &addr, NULL);
+  btc_mutex_lock(dump->lock);
 
-        total += 1;
-      }
+  done = dump->done;
 
-      btc_addrman_log(man, "Resolved %d seeds from %s", total, seed);
+  btc_mutex_unlock(dump->lock);
 
-      btc_freeaddrinfo(res);
-    } else {
-      btc_addrman_log(man, "Could not resolve %s", seed);
+  if (!done && !wait)
+    return;
+
+  btc_thread_join(dump->thread);
+  btc_thread_free(dump->thread);
+  btc_free(dump->data);
+
+  dump->thread = NULL;
+  dump->data = NULL;
+
+  if (!dump->ok) {
+    btc_addrman_log(man, "Could not write %s.", man->file);
+    man->needs_flush = 1;
+  }
+}
+
+size_t
+btc_addrman_poll(btc_addrman_t *man) {
+  size_t added = 0;
+  size_t i;
+
+  btc_addrman_reap(man, 0);
+
+  if (man->seeds_left == 0)
+    return 0;
+
+  for (i = 0; i < man->seeds_len; i++) {
+    btc_seed_t *seed = &man->seeds[i];
+    int done;
+
+    if (seed->thread == NULL)
+      continue;
+
+    btc_mutex_lock(man->seed_lock);
+
+    done = seed->done;
+
+    btc_mutex_unlock(man->seed_lock);
+
+    if (done) {
+      added += btc_addrman_finish(man, seed);
+      man->seeds_left -= 1;
     }
   }
 
-  btc_addrman_log(man, "Resolved %zu seeds.", btc_addrman_total(man));
+  if (man->seeds_left == 0) {
+    btc_addrman_log(man, "Resolved %zu seeds.", btc_addrman_total(man));
+    btc_addrman_clear_seeds(man);
+  }
 
-  return btc_addrman_total(man) > 0;
+  return added;
 }
 
 int
@@ -518,33 +728,57 @@ btc_addrman_open(btc_addrman_t *man, const char *file, unsigned int flags) {
   return btc_addrman_resolve(man);
 }
 
-void
-btc_addrman_close(btc_addrman_t *man) {
-  btc_addrman_reset(man);
-}
+static void
+btc_addrman_snapshot(btc_addrman_t *man) {
+  /* Serializing is a walk over memory we already
+     own; the disk is the slow part, and that is
+     left to a thread working from the copy. */
+  btc_dump_t *dump = &man->dump;
 
-static int
-btc_addrman_write_file(btc_addrman_t *man, const char *file) {
-  size_t zn = btc_addrman_size(man);
-  uint8_t *zp = btc_malloc(zn);
-  int ret;
+  CHECK(dump->thread == NULL);
 
-  CHECK(btc_addrman_export(zp, man) == zn);
+  strcpy(dump->path, man->file);
+  sprintf(dump->tmp, "%s.tmp", man->file);
 
-  ret = btc_fs_write_file(file, 0644, zp, zn);
+  dump->length = btc_addrman_size(man);
+  dump->data = btc_malloc(dump->length);
+  dump->ok = 0;
+  dump->done = 0;
 
-  btc_free(zp);
+  CHECK(btc_addrman_export(dump->data, man) == dump->length);
 
-  return ret;
+  dump->thread = btc_thread_alloc();
+
+  btc_thread_create(dump->thread, btc_dump_write, dump);
+
+  man->needs_flush = 0;
+}
+
+void
+btc_addrman_close(btc_addrman_t *man) {
+  btc_addrman_clear_seeds(man);
+  btc_addrman_reap(man, 1);
+
+  if (man->needs_flush && *man->file) {
+    btc_addrman_snapshot(man);
+    btc_addrman_reap(man, 1);
+  }
+
+  btc_addrman_reset(man);
 }
 
 void
 btc_addrman_flush(btc_addrman_t *man) {
+  btc_addrman_reap(man, 0);
+
+  /* Still writing the last one. */
+  if (man->dump.thread != NULL)
+    return;
+
   if (man->needs_flush && *man->file) {
     btc_addrman_log(man, "Flushing %zu addresses to disk.",
                          btc_addrman_total(man));
-    btc_addrman_write_file(man, man->file);
-    man->needs_flush = 0;
+    btc_addrman_snapshot(man);
   }
 }
 
@@ -561,7 +795,6 @@ btc_addrman_is_full(btc_addrman_t *man) {
 void
 btc_addrman_reset(btc_addrman_t *man) {
   btc_netmapiter_t iter;
-  size_t i;
 
   btc_netmap_iterate(&iter, man->map);
 
@@ -571,11 +804,10 @@ btc_addrman_reset(btc_addrman_t *man) {
   btc_netmap_reset(man->map);
   btc_vector_reset(&man->rnd);
 
-  for (i = 0; i < FRESH_COUNT; i++)
-    btc_netmap_reset(man->fresh[i]);
-
-  for (i = 0; i < USED_COUNT; i++)
-    btc_list_reset((btc_bucket_t *)man->used[i]);
+  memset(man->fresh, 0, FRESH_COUNT * FRESH_SIZE * sizeof(btc_addrent_t *));
+  memset(man->fresh_len, 0, FRESH_COUNT * sizeof(uint16_t));
+  memset(man->used, 0, USED_COUNT * USED_SIZE * sizeof(btc_addrent_t *));
+  memset(man->used_len, 0, USED_COUNT * sizeof(uint16_t));
 
   man->total_fresh = 0;
   man->total_used = 0;
@@ -636,13 +868,25 @@ btc_addrman_clear_banned(btc_addrman_t *man) {
   btc_netmap_reset(man->banned);
 }
 
+static btc_addrent_t *
+bucket_pick(btc_addrent_t **bucket, size_t size) {
+  /* Scan forward from a random slot. The bucket
+     must not be empty. Size is a power of two. */
+  size_t i = btc_uniform(size);
+
+  while (bucket[i] == NULL)
+    i = (i + 1) & (size - 1);
+
+  return bucket[i];
+}
+
 const btc_addrent_t *
 btc_addrman_get(btc_addrman_t *man) {
   btc_addrent_t *entry = NULL;
   double factor, num;
   int used = -1;
-  size_t index;
   int64_t now;
+  size_t i;
 
   if (man->total_fresh > 0)
     used = 0;
@@ -660,37 +904,19 @@ btc_addrman_get(btc_addrman_t *man) {
 
   for (;;) {
     if (used) {
-      size_t i = btc_uniform(USED_COUNT);
-      btc_bucket_t *bucket = man->used[i];
+      i = btc_uniform(USED_COUNT);
 
-      if (bucket->length == 0)
+      if (man->used_len[i] == 0)
         continue;
 
-      index = btc_uniform(bucket->length);
-      entry = bucket->head;
-
-      while (index--)
-        entry = entry->next;
+      entry = bucket_pick(&man->used[i * USED_SIZE], USED_SIZE);
     } else {
-      size_t i = btc_uniform(FRESH_COUNT);
-      btc_netmap_t *bucket = man->fresh[i];
-      btc_netmapiter_t iter;
+      i = btc_uniform(FRESH_COUNT);
 
-      if (btc_netmap_size(bucket) == 0)
+      if (man->fresh_len[i] == 0)
         continue;
 
-      index = btc_uniform(btc_netmap_size(bucket));
-
-      btc_netmap_iterate(&iter, bucket);
-
-      while (btc_netmap_next(&iter)) {
-        entry = iter.val;
-
-        if (index == 0)
-          break;
-
-        index -= 1;
-      }
+      entry = bucket_pick(&man->fresh[i * FRESH_SIZE], FRESH_SIZE);
     }
 
     num = btc_uniform(1U << 30);
@@ -704,37 +930,65 @@ btc_addrman_get(btc_addrman_t *man) {
   return entry;
 }
 
-static btc_netmap_t *
-fresh_bucket(btc_addrman_t *man, const btc_addrent_t *entry) {
-  uint32_t hash32, hash, index;
-  uint8_t hash1[32];
-  uint8_t hash2[32];
+static uint32_t
+bucket_pos(btc_addrman_t *man, const btc_netaddr_t *addr) {
+  /* The slot an address occupies in whichever bucket
+     holds it. The first four bytes of this hash pick
+     the used bucket, so we take the next four. */
   btc_hash256_t ctx;
-  uint8_t tmp[6];
+  uint8_t hash[32];
 
   btc_hash256_init(&ctx);
   btc_hash256_update(&ctx, man->key, 32);
-  btc_hash256_update(&ctx, btc_netaddr_groupkey(tmp, &entry->addr), 6);
-  btc_hash256_update(&ctx, btc_netaddr_groupkey(tmp, &entry->src), 6);
-  btc_hash256_final(&ctx, hash1);
+  btc_hash256_update(&ctx, addr->raw, 16);
+  btc_uint16_update(&ctx, addr->port);
+  btc_hash256_final(&ctx, hash);
 
-  hash32 = btc_read32le(hash1) % FRESH_SPREAD;
+  return btc_read32le(hash + 4);
+}
+
+static uint32_t
+fresh_spread(btc_addrman_t *man, const uint8_t *group, const uint8_t *src) {
+  btc_hash256_t ctx;
+  uint8_t hash[32];
 
   btc_hash256_init(&ctx);
   btc_hash256_update(&ctx, man->key, 32);
-  btc_hash256_update(&ctx, btc_netaddr_groupkey(tmp, &entry->src), 6);
-  btc_uint32_update(&ctx, hash32);
-  btc_hash256_final(&ctx, hash2);
+  btc_hash256_update(&ctx, group, 6);
+  btc_hash256_update(&ctx, src, 6);
+  btc_hash256_final(&ctx, hash);
 
-  hash = btc_read32le(hash2);
-  index = hash % FRESH_COUNT;
+  return btc_read32le(hash) % FRESH_SPREAD;
+}
+
+static uint32_t
+fresh_index(btc_addrman_t *man, const uint8_t *src, uint32_t spread) {
+  btc_hash256_t ctx;
+  uint8_t hash[32];
 
-  return man->fresh[index];
+  btc_hash256_init(&ctx);
+  btc_hash256_update(&ctx, man->key, 32);
+  btc_hash256_update(&ctx, src, 6);
+  btc_uint32_update(&ctx, spread);
+  btc_hash256_final(&ctx, hash);
+
+  return btc_read32le(hash) % FRESH_COUNT;
 }
 
-static btc_bucket_t *
+static uint32_t
+fresh_bucket(btc_addrman_t *man, const btc_addrent_t *entry) {
+  uint8_t group[6];
+  uint8_t src[6];
+
+  btc_netaddr_groupkey(group, &entry->addr);
+  btc_netaddr_groupkey(src, &entry->src);
+
+  return fresh_index(man, src, fresh_spread(man, group, src));
+}
+
+static uint32_t
 used_bucket(btc_addrman_t *man, const btc_addrent_t *entry) {
-  uint32_t hash32, hash, index;
+  uint32_t hash32, hash;
   uint8_t hash1[32];
   uint8_t hash2[32];
   btc_hash256_t ctx;
@@ -755,78 +1009,137 @@ used_bucket(btc_addrman_t *man, const btc_addrent_t *entry) {
   btc_hash256_final(&ctx, hash2);
 
   hash = btc_read32le(hash2);
-  index = hash % USED_COUNT;
 
-  return man->used[index];
+  return hash % USED_COUNT;
 }
 
-static void
-evict_fresh(btc_addrman_t *man, btc_netmap_t *bucket) {
-  int64_t now = btc_timedata_now(man->timedata);
-  btc_addrent_t *old = NULL;
-  btc_netmapiter_t iter;
-  btc_addrent_t *entry;
+static uint32_t
+batch_bucket(btc_addrman_t *man,
+             btc_addrbatch_t *batch,
+             const btc_addrent_t *entry) {
+  /* Everything one peer sends shares a source group,
+     so the second hash only ever takes FRESH_SPREAD
+     distinct inputs. Work each one out at most once. */
+  uint32_t spread;
+  uint8_t group[6];
+  uint8_t src[6];
 
-  btc_netmap_iterate(&iter, bucket);
+  btc_netaddr_groupkey(src, &entry->src);
 
-  while (btc_netmap_next(&iter)) {
-    entry = iter.val;
+  if (memcmp(src, batch->src, 6) != 0)
+    return fresh_bucket(man, entry);
 
-    if (btc_addrent_is_stale(entry, now)) {
-      btc_netmap_del(bucket, &entry->addr);
+  btc_netaddr_groupkey(group, &entry->addr);
 
-      if (--entry->ref_count == 0) {
-        btc_netmap_del(man->map, &entry->addr);
-        btc_randvec_pop(&man->rnd, entry);
-        btc_addrent_destroy(entry);
-        man->total_fresh -= 1;
-      }
+  spread = fresh_spread(man, group, src);
 
-      continue;
-    }
+  if (!(batch->have & ((uint64_t)1 << spread))) {
+    batch->buckets[spread] = fresh_index(man, src, spread);
+    batch->have |= (uint64_t)1 << spread;
+  }
 
-    if (old == NULL) {
-      old = entry;
-      continue;
-    }
+  return batch->buckets[spread];
+}
 
-    if (entry->addr.time < old->addr.time)
-      old = entry;
-  }
+static btc_addrent_t **
+fresh_slot(btc_addrman_t *man, uint32_t bucket, const btc_addrent_t *entry) {
+  return &man->fresh[bucket * FRESH_SIZE + entry->bucket_pos % FRESH_SIZE];
+}
 
-  if (old == NULL)
-    return;
+static btc_addrent_t **
+used_slot(btc_addrman_t *man, uint32_t bucket, const btc_addrent_t *entry) {
+  return &man->used[bucket * USED_SIZE + entry->bucket_pos % USED_SIZE];
+}
 
-  btc_netmap_del(bucket, &old->addr);
+static void
+fresh_link(btc_addrman_t *man, uint32_t bucket, btc_addrent_t *entry) {
+  btc_addrent_t **slot = fresh_slot(man, bucket, entry);
+
+  CHECK(*slot == NULL);
+
+  *slot = entry;
+
+  man->fresh_len[bucket] += 1;
+
+  if (entry->ref_count++ == 0)
+    man->total_fresh += 1;
+}
+
+static void
+fresh_unlink(btc_addrman_t *man, uint32_t bucket, btc_addrent_t *entry) {
+  btc_addrent_t **slot = fresh_slot(man, bucket, entry);
+
+  CHECK(*slot == entry);
+  CHECK(entry->ref_count > 0);
+
+  *slot = NULL;
+
+  man->fresh_len[bucket] -= 1;
 
-  if (--old->ref_count == 0) {
-    btc_netmap_del(man->map, &old->addr);
-    btc_randvec_pop(&man->rnd, old);
-    btc_addrent_destroy(old);
+  if (--entry->ref_count == 0)
     man->total_fresh -= 1;
-  }
 }
 
-static btc_addrent_t *
-evict_used(btc_bucket_t *bucket) {
-  btc_addrent_t *old = bucket->head;
-  btc_addrent_t *entry;
+static void
+fresh_clear(btc_addrman_t *man, btc_addrent_t *entry) {
+  uint32_t i;
 
-  for (entry = bucket->head; entry != NULL; entry = entry->next) {
-    if (entry->addr.time < old->addr.time)
-      old = entry;
+  for (i = 0; i < FRESH_COUNT && entry->ref_count > 0; i++) {
+    if (*fresh_slot(man, i, entry) == entry)
+      fresh_unlink(man, i, entry);
   }
 
-  return old;
+  CHECK(entry->ref_count == 0);
 }
 
-int
-btc_addrman_add(btc_addrman_t *man,
-                const btc_netaddr_t *addr,
-                const btc_netaddr_t *src) {
-  int64_t now = btc_timedata_now(man->timedata);
-  btc_addrent_t *entry;
-  btc_netmap_t *bucket;
+static void
+evict_fresh(btc_addrman_t *man, uint32_t bucket, btc_addrent_t *entry) {
+  /* Drop one reference, and the entry along with it
+     if that was the last one. */
+  fresh_unlink(man, bucket, entry);
+
+  if (entry->ref_count == 0) {
+    btc_netmap_del(man->map, &entry->addr);
+    btc_randvec_pop(&man->rnd, entry);
+    btc_addrent_destroy(entry);
+  }
+}
+
+static void
+evict_used(btc_addrman_t *man, uint32_t bucket, btc_addrent_t *entry) {
+  /* Demote back to fresh, taking over whatever
+     holds its slot there. */
+  btc_addrent_t **slot = used_slot(man, bucket, entry);
+  btc_addrent_t *other;
+  uint32_t index;
+
+  CHECK(*slot == entry);
+  CHECK(entry->ref_count == 0);
+
+  *slot = NULL;
+
+  man->used_len[bucket] -= 1;
+  man->total_used -= 1;
+
+  entry->used = 0;
+
+  index = fresh_bucket(man, entry);
+  other = *fresh_slot(man, index, entry);
+
+  if (other != NULL)
+    evict_fresh(man, index, other);
+
+  fresh_link(man, index, entry);
+}
+
+static int
+btc_addrman_insert(btc_addrman_t *man,
+                   const btc_netaddr_t *addr,
+                   const btc_netaddr_t *src,
+                   int64_t now,
+                   btc_addrbatch_t *batch) {
+  btc_addrent_t *entry, *other;
+  uint32_t bucket;
   int32_t i;
 
   CHECK(addr->port != 0);
@@ -892,19 +1205,36 @@ btc_addrman_add(btc_addrman_t *man,
     btc_netaddr_copy(&entry->addr, addr);
     btc_netaddr_copy(&entry->src, src);
 
-    man->total_fresh += 1;
+    entry->bucket_pos = bucket_pos(man, addr);
   }
 
-  bucket = fresh_bucket(man, entry);
+  if (batch != NULL)
+    bucket = batch_bucket(man, batch, entry);
+  else
+    bucket = fresh_bucket(man, entry);
+
+  other = *fresh_slot(man, bucket, entry);
 
-  if (btc_netmap_has(bucket, &entry->addr))
+  if (other == entry)
     return 0;
 
-  if (btc_netmap_size(bucket) >= FRESH_SIZE)
-    evict_fresh(man, bucket);
+  if (other != NULL) {
+    /* Only overwrite an entry which is stale, or
+       which is also held elsewhere when ours isn't. */
+    int evict = btc_addrent_is_stale(other, now)
+             || (other->ref_count > 1 && entry->ref_count == 0);
+
+    if (!evict) {
+      if (entry->ref_count == 0)
+        btc_addrent_destroy(entry);
+
+      return 0;
+    }
+
+    evict_fresh(man, bucket, other);
+  }
 
-  btc_netmap_put(bucket, &entry->addr, entry);
-  entry->ref_count += 1;
+  fresh_link(man, bucket, entry);
 
   if (btc_netmap_put(man->map, &entry->addr, entry))
     btc_randvec_push(&man->rnd, entry);
@@ -914,48 +1244,60 @@ btc_addrman_add(btc_addrman_t *man,
   return 1;
 }
 
+int
+btc_addrman_add(btc_addrman_t *man,
+                const btc_netaddr_t *addr,
+                const btc_netaddr_t *src) {
+  int64_t now = btc_timedata_now(man->timedata);
+  return btc_addrman_insert(man, addr, src, now, NULL);
+}
+
+size_t
+btc_addrman_add_many(btc_addrman_t *man,
+                     const btc_vector_t *addrs,
+                     const btc_netaddr_t *src) {
+  int64_t now = btc_timedata_now(man->timedata);
+  btc_addrbatch_t batch;
+  size_t i, added = 0;
+
+  if (src == NULL)
+    src = &man->addr;
+
+  btc_netaddr_groupkey(batch.src, src);
+
+  batch.have = 0;
+
+  for (i = 0; i < addrs->length; i++)
+    added += btc_addrman_insert(man, addrs->items[i], src, now, &batch);
+
+  return added;
+}
+
 int
 btc_addrman_remove(btc_addrman_t *man, const btc_netaddr_t *addr) {
   btc_addrent_t *entry = btc_netmap_get(man->map, addr);
-  size_t i;
+  uint32_t i;
 
   if (entry == NULL)
     return 0;
 
   if (entry->used) {
-    btc_addrent_t *head = entry;
-    btc_bucket_t *bucket;
-
     CHECK(entry->ref_count == 0);
 
-    while (head->prev != NULL)
-      head = head->prev;
-
     for (i = 0; i < USED_COUNT; i++) {
-      bucket = man->used[i];
+      btc_addrent_t **slot = used_slot(man, i, entry);
 
-      if (bucket->head == head) {
-        btc_list_remove(bucket, entry, btc_addrent_t);
+      if (*slot == entry) {
+        *slot = NULL;
+        man->used_len[i] -= 1;
         man->total_used -= 1;
-        head = NULL;
         break;
       }
     }
 
-    CHECK(head == NULL);
+    CHECK(i < USED_COUNT);
   } else {
-    btc_netmap_t *bucket;
-
-    for (i = 0; i < FRESH_COUNT; i++) {
-      bucket = man->fresh[i];
-
-      if (btc_netmap_del(bucket, &entry->addr))
-        entry->ref_count -= 1;
-    }
-
-    man->total_fresh -= 1;
-
-    CHECK(entry->ref_count == 0);
+    fresh_clear(man, entry);
   }
 
   CHECK(btc_netmap_del(man->map, &entry->addr));
@@ -997,12 +1339,9 @@ btc_addrman_mark_ack(btc_addrman_t *man,
                      const btc_netaddr_t *addr,
                      uint64_t services) {
   btc_addrent_t *entry = btc_netmap_get(man->map, addr);
-  btc_addrent_t *evicted;
-  btc_netmap_t *old = NULL;
-  btc_netmap_t *fresh;
-  btc_bucket_t *bucket;
+  btc_addrent_t *other;
+  uint32_t bucket;
   int64_t now;
-  size_t i;
 
   if (entry == NULL)
     return;
@@ -1021,48 +1360,21 @@ btc_addrman_mark_ack(btc_addrman_t *man,
   CHECK(entry->ref_count > 0);
 
   /* Remove from fresh. */
-  for (i = 0; i < FRESH_COUNT; i++) {
-    fresh = man->fresh[i];
+  fresh_clear(man, entry);
 
-    if (btc_netmap_del(fresh, &entry->addr)) {
-      entry->ref_count -= 1;
-      old = fresh;
-    }
-  }
-
-  CHECK(old != NULL);
-  CHECK(entry->ref_count == 0);
-
-  man->total_fresh -= 1;
-
-  /* Find room in used bucket. */
+  /* Make room in the used bucket. */
   bucket = used_bucket(man, entry);
+  other = *used_slot(man, bucket, entry);
 
-  if (bucket->length < USED_SIZE) {
-    entry->used = 1;
-    btc_list_push(bucket, entry, btc_addrent_t);
-    man->total_used += 1;
-    return;
-  }
-
-  /* No room. Evict. */
-  evicted = evict_used(bucket);
-  fresh = fresh_bucket(man, evicted);
-
-  /* Move to entry's old bucket if no room. */
-  if (btc_netmap_size(fresh) >= FRESH_SIZE)
-    fresh = old;
+  if (other != NULL)
+    evict_used(man, bucket, other);
 
-  /* Swap to evicted's used bucket. */
   entry->used = 1;
-  btc_list_replace(bucket, evicted, entry, btc_addrent_t);
 
-  /* Move evicted to fresh bucket. */
-  evicted->used = 0;
-  btc_netmap_put(fresh, &evicted->addr, evicted);
-  CHECK(evicted->ref_count == 0);
-  evicted->ref_count += 1;
-  man->total_fresh += 1;
+  *used_slot(man, bucket, entry) = entry;
+
+  man->used_len[bucket] += 1;
+  man->total_used += 1;
 }
 
 int
@@ -1211,17 +1523,13 @@ btc_addrman_size(const btc_addrman_t *man) {
   size += man->rnd.length * BTC_ADDRENT_SIZE;
 
   for (i = 0; i < FRESH_COUNT; i++) {
-    const btc_netmap_t *bucket = man->fresh[i];
-
-    size += btc_size_size(btc_netmap_size(bucket));
-    size += btc_netmap_size(bucket) * 4;
+    size += btc_size_size(man->fresh_len[i]);
+    size += man->fresh_len[i] * 4;
   }
 
   for (i = 0; i < USED_COUNT; i++) {
-    const btc_bucket_t *bucket = man->used[i];
-
-    size += btc_size_size(bucket->length);
-    size += bucket->length * 4;
+    size += btc_size_size(man->used_len[i]);
+    size += man->used_len[i] * 4;
   }
 
   return size;
@@ -1229,6 +1537,7 @@ btc_addrman_size(const btc_addrman_t *man) {
 
 static uint8_t *
 btc_addrman_write(uint8_t *zp, const btc_addrman_t *man) {
+  const btc_addrent_t *entry;
   size_t i;
 
   zp = btc_uint32_write(zp, SER_VERSION);
@@ -1240,28 +1549,23 @@ btc_addrman_write(uint8_t *zp, const btc_addrman_t *man) {
   for (i = 0; i < man->rnd.length; i++)
     zp = btc_addrent_write(zp, man->rnd.items[i]);
 
-  for (i = 0; i < FRESH_COUNT; i++) {
-    const btc_netmap_t *bucket = man->fresh[i];
-    btc_netmapiter_t iter;
-
-    btc_netmap_iterate(&iter, bucket);
+  for (i = 0; i < FRESH_COUNT * FRESH_SIZE; i++) {
+    if (i % FRESH_SIZE == 0)
+      zp = btc_size_write(zp, man->fresh_len[i / FRESH_SIZE]);
 
-    zp = btc_size_write(zp, btc_netmap_size(bucket));
-
-    while (btc_netmap_next(&iter)) {
-      const btc_addrent_t *entry = iter.val;
+    entry = man->fresh[i];
 
+    if (entry != NULL)
       zp = btc_uint32_write(zp, entry->rand_pos);
-    }
   }
 
-  for (i = 0; i < USED_COUNT; i++) {
-    const btc_bucket_t *bucket = man->used[i];
-    const btc_addrent_t *entry;
+  for (i = 0; i < USED_COUNT * USED_SIZE; i++) {
+    if (i % USED_SIZE == 0)
+      zp = btc_size_write(zp, man->used_len[i / USED_SIZE]);
 
-    zp = btc_size_write(zp, bucket->length);
+    entry = man->used[i];
 
-    for (entry = bucket->head; entry != NULL; entry = entry->next)
+    if (entry != NULL)
       zp = btc_uint32_write(zp, entry->rand_pos);
   }
 
@@ -1306,15 +1610,21 @@ btc_addrman_read(btc_addrman_t *man, const uint8_t **xp, size_t *xn) {
       goto fail;
     }
 
+    entry->bucket_pos = bucket_pos(man, &entry->addr);
+
     btc_randvec_push(&man->rnd, entry);
   }
 
+  /* Files written before buckets had fixed slots
+     may place two entries in the same one. We keep
+     the first and let the other go below. */
   for (i = 0; i < FRESH_COUNT; i++) {
-    btc_netmap_t *bucket = man->fresh[i];
-
     if (!btc_size_read(&length, xp, xn))
       goto fail;
 
+    if (length > FRESH_SIZE)
+      goto fail; /* Bucket size mismatch. */
+
     for (j = 0; j < length; j++) {
       btc_addrent_t *entry;
       uint32_t pos;
@@ -1327,25 +1637,20 @@ btc_addrman_read(btc_addrman_t *man, const uint8_t **xp, size_t *xn) {
 
       entry = man->rnd.items[pos];
 
-      if (entry->ref_count == 0)
-        man->total_fresh++;
-
-      entry->ref_count++;
-
-      btc_netmap_put(bucket, &entry->addr, entry);
+      if (*fresh_slot(man, i, entry) == NULL)
+        fresh_link(man, i, entry);
     }
-
-    if (btc_netmap_size(bucket) > FRESH_SIZE)
-      goto fail; /* Bucket size mismatch. */
   }
 
   for (i = 0; i < USED_COUNT; i++) {
-    btc_bucket_t *bucket = man->used[i];
-
     if (!btc_size_read(&length, xp, xn))
       goto fail;
 
+    if (length > USED_SIZE)
+      goto fail; /* Bucket size mismatch. */
+
     for (j = 0; j < length; j++) {
+      btc_addrent_t **slot;
       btc_addrent_t *entry;
       uint32_t pos;
 
@@ -1360,25 +1665,32 @@ btc_addrman_read(btc_addrman_t *man, const uint8_t **xp, size_t *xn) {
       if (entry->ref_count != 0 || entry->used)
         goto fail;
 
-      man->total_used++;
+      slot = used_slot(man, i, entry);
+
+      if (*slot != NULL)
+        continue;
+
+      *slot = entry;
 
       entry->used = 1;
 
-      btc_list_push(bucket, entry, btc_addrent_t);
+      man->used_len[i] += 1;
+      man->total_used += 1;
     }
-
-    if (bucket->length > USED_SIZE)
-      goto fail; /* Bucket size mismatch. */
   }
 
   if (*xn != 0)
     goto fail;
 
-  for (i = 0; i < man->rnd.length; i++) {
-    btc_addrent_t *entry = man->rnd.items[i];
+  /* Drop anything which lost its slot. */
+  for (i = man->rnd.length; i > 0; i--) {
+    btc_addrent_t *entry = man->rnd.items[i - 1];
 
-    if (!entry->used && entry->ref_count == 0)
-      goto fail;
+    if (!entry->used && entry->ref_count == 0) {
+      btc_netmap_del(man->map, &entry->addr);
+      btc_randvec_pop(&man->rnd, entry);
+      btc_addrent_destroy(entry);
+    }
   }
 
   return 1;
@@ -11,17 +11,22 @@
 #include <string.h>
 
 #include <io/core.h>
+#include <io/trace.h>
 #include <io/workers.h>
 
 #include <node/chain.h>
 #include <node/chaindb.h>
 #include <node/logger.h>
+#include <node/perf.h>
 #include <node/timedata.h>
 
 #include <mako/block.h>
 #include <mako/coins.h>
 #include <mako/consensus.h>
 #include <mako/crypto/hash.h>
+#include <mako/crypto/merkle.h>
+#include <mako/crypto/rand.h>
+#include <mako/encoding.h>
 #include <mako/entry.h>
 #include <mako/header.h>
 #include <mako/list.h>
@@ -33,6 +38,7 @@
 #include <mako/util.h>
 #include <mako/vector.h>
 
+#include "../bio.h"
 #include "../impl.h"
 #include "../internal.h"
 
@@ -54,12 +60,20 @@ btc_deployment_state_init(btc_deployment_state_t *state) {
  * Orphan Block
  */
 
+/* Orphans are spilled to a temporary store under
+   the prefix. Only their headers stay in memory. */
+#define BTC_ORPHAN_DIR "orphans"
+#define BTC_ORPHAN_BYTES (256 << 20)
+
 typedef struct btc_orphan_s {
   uint8_t hash[32];
-  btc_block_t *block;
+  btc_header_t header;
+  size_t size;
   unsigned int flags;
   unsigned int id;
   int64_t time;
+  struct btc_orphan_s *prev;
+  struct btc_orphan_s *next;
 } btc_orphan_t;
 
 DEFINE_OBJECT(btc_orphan, SCOPE_STATIC)
@@ -71,10 +85,7 @@ btc_orphan_init(btc_orphan_t *orphan) {
 
 static void
 btc_orphan_clear(btc_orphan_t *orphan) {
-  if (orphan->block != NULL)
-    btc_block_destroy(orphan->block);
-
-  orphan->block = NULL;
+  (void)orphan;
 }
 
 static void
@@ -86,34 +97,105 @@ btc_orphan_copy(btc_orphan_t *z, const btc_orphan_t *x) {
  * TX Checker
  */
 
+/* Inputs per work item. Large transactions are split
+   up so that a single tx cannot serialize a block. */
+#define BTC_CHECKER_CHUNK 8
+
 typedef struct btc_txwork_s {
   const btc_tx_t *tx;
   const btc_view_t *view;
+  btc_tx_cache_t *cache;
+  size_t start;
+  size_t end;
   unsigned int flags;
-  int result;
+  struct btc_checker_s *checker;
+  btc_work_t work;
   struct btc_txwork_s *next;
 } btc_txwork_t;
 
 typedef struct btc_checker_s {
-  btc_workers_t *pool;
+  btc_taskgroup_t *group;
   btc_txwork_t *head;
   btc_txwork_t *tail;
   btc_workq_t batch;
+  btc_mutex_t *lock;
+  int failed;
   size_t length;
 } btc_checker_t;
 
 static void
 btc_checker_init(btc_checker_t *checker, btc_workers_t *pool) {
-  checker->pool = pool;
+  checker->group = btc_taskgroup_create(pool);
+  checker->lock = btc_mutex_create();
+
+  btc_taskgroup_set_priority(checker->group, BTC_WORK_HIGH);
+
+  checker->failed = 0;
   btc_queue_init(checker);
   btc_workq_init(&checker->batch);
 }
 
+static int
+btc_checker_failed(btc_checker_t *checker) {
+  int ret;
+
+  btc_mutex_lock(checker->lock);
+  ret = checker->failed;
+  btc_mutex_unlock(checker->lock);
+
+  return ret;
+}
+
+static void
+btc_checker_fail(btc_checker_t *checker) {
+  btc_mutex_lock(checker->lock);
+  checker->failed = 1;
+  btc_mutex_unlock(checker->lock);
+}
+
 static void
 btc_checker_work(void *arg) {
   btc_txwork_t *work = arg;
+  const btc_tx_t *tx = work->tx;
+  btc_tx_cache_t *cache = work->cache;
+  const btc_input_t *input;
+  const btc_coin_t *coin;
+  int ret = 0;
+  size_t i;
+
+  /* Another input already failed. */
+  if (btc_checker_failed(work->checker))
+    return;
+
+  /* Schnorr signatures are batched per chunk. */
+  if (cache != NULL && cache->has_taproot)
+    cache->batch = btc_sigbatch_create();
+
+  for (i = work->start; i < work->end; i++) {
+    input = tx->inputs.items[i];
+    coin = btc_view_get(work->view, &input->prevout);
+
+    if (coin == NULL)
+      goto done;
+
+    if (!btc_tx_verify_input(tx, i, &coin->output, work->flags, cache))
+      goto done;
+  }
+
+  if (cache != NULL && cache->batch != NULL) {
+    if (!btc_sigbatch_verify(cache->batch))
+      goto done;
+  }
 
-  work->result = btc_tx_verify(work->tx, work->view, work->flags);
+  ret = 1;
+done:
+  if (cache != NULL && cache->batch != NULL) {
+    btc_sigbatch_destroy(cache->batch);
+    cache->batch = NULL;
+  }
+
+  if (!ret)
+    btc_checker_fail(work->checker);
 }
 
 static void
@@ -121,37 +203,241 @@ btc_checker_push(btc_checker_t *checker,
                  const btc_tx_t *tx,
                  const btc_view_t *view,
                  unsigned int flags) {
-  btc_txwork_t *work = btc_malloc(sizeof(btc_txwork_t));
+  const btc_tx_cache_t *shared = btc_tx_precompute(tx, view);
+  btc_txwork_t *work;
+  size_t i;
 
-  work->tx = tx;
-  work->view = view;
-  work->flags = flags;
-  work->result = 0;
-  work->next = NULL;
+  for (i = 0; i < tx->inputs.length; i += BTC_CHECKER_CHUNK) {
+    work = btc_malloc(sizeof(btc_txwork_t));
+
+    work->tx = tx;
+    work->view = view;
+    work->cache = NULL;
+    work->start = i;
+    work->end = i + BTC_CHECKER_CHUNK;
+    work->flags = flags;
+    work->checker = checker;
+    work->next = NULL;
+
+    if (work->end > tx->inputs.length)
+      work->end = tx->inputs.length;
+
+    /* Each chunk gets its own copy of the
+       cache so that it can hold a batch. */
+    if (shared != NULL) {
+      work->cache = btc_malloc(sizeof(btc_tx_cache_t));
+      *work->cache = *shared;
+    }
 
-  btc_queue_push(checker, work);
-  btc_workq_push(&checker->batch, btc_checker_work, work);
+    btc_queue_push(checker, work);
+    btc_workq_append(&checker->batch, &work->work, btc_checker_work, work);
+  }
 }
 
 static int
 btc_checker_verify(btc_checker_t *checker) {
   btc_txwork_t *work, *next;
-  int ret = 1;
+  int ret;
 
-  btc_workers_batch(checker->pool, &checker->batch);
-  btc_workers_wait(checker->pool);
+  btc_taskgroup_batch(checker->group, &checker->batch);
+  btc_taskgroup_wait(checker->group);
 
   for (work = checker->head; work != NULL; work = next) {
     next = work->next;
-    ret &= work->result;
+
+    if (work->cache != NULL)
+      btc_free(work->cache);
+
     btc_free(work);
   }
 
+  ret = !checker->failed;
+
+  btc_mutex_destroy(checker->lock);
+  btc_taskgroup_destroy(checker->group);
   btc_queue_init(checker);
 
   return ret;
 }
 
+/*
+ * Body Checks
+ */
+
+/* Blocks smaller than this are checked inline. */
+#define BTC_BODY_PARALLEL 256
+
+/* Merkle levels wider than this are hashed on the pool. */
+#define BTC_MERKLE_PARALLEL 512
+
+typedef struct btc_merklejob_s {
+  uint8_t *out;
+  const uint8_t *in;
+} btc_merklejob_t;
+
+static void
+btc_merklejob_work(size_t start, size_t end, void *arg) {
+  btc_merklejob_t *job = arg;
+
+  btc_sha256d64(job->out + start * 32, job->in + start * 64, end - start);
+}
+
+static int
+btc_merkle_root_parallel(uint8_t *root,
+                         uint8_t *nodes,
+                         size_t size,
+                         btc_workers_t *pool) {
+  uint8_t *tmp = btc_malloc(((size + 1) / 2) * 32);
+  uint8_t *buf = nodes;
+  btc_merklejob_t job;
+  int malleated = 0;
+  size_t half, tail;
+
+  while (size > BTC_MERKLE_PARALLEL) {
+    half = size / 2;
+    tail = 2 + (size & 1);
+
+    job.out = tmp;
+    job.in = nodes;
+
+    /* All pairs but the last go wide. The tail goes
+       through btc_merkle_level for identical mutation
+       and odd-node handling. */
+    btc_parallel_for_ex(pool, BTC_WORK_HIGH, half - 1, 0,
+                        btc_merklejob_work, &job);
+
+    if (!btc_merkle_level(&tmp[(half - 1) * 32],
+                          &nodes[(size - tail) * 32],
+                          tail)) {
+      malleated = 1;
+    }
+
+    tmp = nodes;
+    nodes = job.out;
+    size = (size + 1) / 2;
+  }
+
+  if (!btc_merkle_root(root, nodes, size))
+    malleated = 1;
+
+  btc_free(nodes == buf ? tmp : nodes);
+
+  return malleated == 0;
+}
+
+static int
+btc_block_root_parallel(uint8_t *root,
+                        const btc_block_t *block,
+                        int witness,
+                        btc_workers_t *pool) {
+  size_t length = block->txs.length;
+  uint8_t *hashes = (uint8_t *)btc_malloc(length * 32);
+  size_t i;
+  int ret;
+
+  for (i = 0; i < length; i++) {
+    const btc_tx_t *tx = block->txs.items[i];
+
+    if (witness && i == 0)
+      btc_hash_init(&hashes[0]);
+    else
+      btc_hash_copy(&hashes[i * 32], witness ? tx->whash : tx->hash);
+  }
+
+  ret = btc_merkle_root_parallel(root, hashes, length, pool);
+
+  btc_free(hashes);
+
+  return ret;
+}
+
+typedef struct btc_sanejob_s {
+  const btc_block_t *block;
+  btc_mutex_t *lock;
+  size_t bad;
+} btc_sanejob_t;
+
+static void
+btc_sanejob_work(size_t start, size_t end, void *arg) {
+  btc_sanejob_t *job = arg;
+  size_t i;
+
+  for (i = start; i < end; i++) {
+    if (!btc_tx_check_sanity(NULL, job->block->txs.items[i]))
+      break;
+  }
+
+  if (i == end)
+    return;
+
+  btc_mutex_lock(job->lock);
+
+  if (i < job->bad)
+    job->bad = i;
+
+  btc_mutex_unlock(job->lock);
+}
+
+static int
+btc_body_check(btc_verify_error_t *err,
+               const btc_block_t *block,
+               btc_workers_t *pool) {
+  size_t length = block->txs.length;
+  btc_sanejob_t job;
+  uint8_t root[32];
+  int mutated;
+
+  if (pool == NULL || length < BTC_BODY_PARALLEL)
+    return btc_block_check_body(err, block);
+
+  /* Find the first insane tx on the pool, then
+     let btc_block_check_body_ex replay the cheap
+     checks in order so the error is unchanged. */
+  job.block = block;
+  job.lock = btc_mutex_create();
+  job.bad = length;
+
+  btc_parallel_for_ex(pool, BTC_WORK_HIGH, length, 0,
+                      btc_sanejob_work, &job);
+
+  btc_mutex_destroy(job.lock);
+
+  mutated = !btc_block_root_parallel(root, block, 0, pool);
+
+  return btc_block_check_body_ex(err, block, root, mutated, job.bad);
+}
+
+static int
+btc_body_merkle_root(uint8_t *root,
+                     const btc_block_t *block,
+                     btc_workers_t *pool) {
+  if (pool == NULL || block->txs.length < BTC_BODY_PARALLEL)
+    return btc_block_merkle_root(root, block);
+
+  return btc_block_root_parallel(root, block, 0, pool);
+}
+
+static int
+btc_body_commitment_hash(uint8_t *hash,
+                         const btc_block_t *block,
+                         btc_workers_t *pool) {
+  const uint8_t *nonce = btc_block_witness_nonce(block);
+  uint8_t root[32];
+
+  if (pool == NULL || block->txs.length < BTC_BODY_PARALLEL)
+    return btc_block_create_commitment_hash(hash, block);
+
+  if (nonce == NULL)
+    return 0;
+
+  if (!btc_block_root_parallel(root, block, 1, pool))
+    return 0;
+
+  btc_hash256_root(hash, root, nonce);
+
+  return 1;
+}
+
 /*
  * State Cache
  */
@@ -189,6 +475,16 @@ btc_statecache_clear(btc_statecache_t *cache) {
   }
 }
 
+static void
+btc_statecache_reset(btc_statecache_t *cache) {
+  int i;
+
+  for (i = 0; i < 32; i++) {
+    if (cache->bits[i] != NULL)
+      btc_hashtab_reset(cache->bits[i]);
+  }
+}
+
 static void
 btc_statecache_set(btc_statecache_t *cache,
                    int bit,
@@ -210,6 +506,182 @@ btc_statecache_get(btc_statecache_t *cache, int bit, const btc_entry_t *entry) {
   return btc_hashtab_get(map, entry->hash);
 }
 
+/*
+ * Script Cache
+ */
+
+/* Number of transactions remembered (~3mb of keys). */
+#define BTC_SCRIPTCACHE_SIZE 100000
+
+typedef struct btc_scriptcache_s {
+  btc_hashtab_t *map; /* salted wtxid -> verified flags */
+  uint8_t (*keys)[32];
+  size_t head;
+  size_t length;
+  uint8_t salt[32];
+  btc_mutex_t *lock;
+} btc_scriptcache_t;
+
+static void
+btc_scriptcache_init(btc_scriptcache_t *cache) {
+  cache->map = btc_hashtab_create();
+  cache->keys = btc_malloc(BTC_SCRIPTCACHE_SIZE * 32);
+  cache->head = 0;
+  cache->length = 0;
+  cache->lock = btc_mutex_create();
+
+  btc_getrandom(cache->salt, 32);
+}
+
+static void
+btc_scriptcache_clear(btc_scriptcache_t *cache) {
+  btc_hashtab_destroy(cache->map);
+  btc_mutex_destroy(cache->lock);
+  btc_free(cache->keys);
+}
+
+static void
+btc_scriptcache_key(uint8_t *key,
+                    const btc_scriptcache_t *cache,
+                    const uint8_t *whash) {
+  /* Salted so that peers cannot grind keys
+     into the same hash table bucket. */
+  btc_sha256_t ctx;
+
+  btc_sha256_init(&ctx);
+  btc_sha256_update(&ctx, cache->salt, 32);
+  btc_sha256_update(&ctx, whash, 32);
+  btc_sha256_final(&ctx, key);
+}
+
+static int
+btc_scriptcache_has(btc_scriptcache_t *cache,
+                    const uint8_t *whash,
+                    unsigned int flags) {
+  uint8_t key[32];
+  int64_t val;
+
+  btc_scriptcache_key(key, cache, whash);
+
+  btc_mutex_lock(cache->lock);
+
+  val = btc_hashtab_get(cache->map, key);
+
+  btc_mutex_unlock(cache->lock);
+
+  /* Every verification flag is a soft fork. Anything
+     valid under a superset of flags is valid here. */
+  if (val == -1)
+    return 0;
+
+  return ((unsigned int)val & flags) == flags;
+}
+
+static void
+btc_scriptcache_add(btc_scriptcache_t *cache,
+                    const uint8_t *whash,
+                    unsigned int flags) {
+  uint8_t key[32];
+  uint8_t *slot;
+  int64_t val;
+
+  btc_scriptcache_key(key, cache, whash);
+
+  btc_mutex_lock(cache->lock);
+
+  val = btc_hashtab_get(cache->map, key);
+
+  if (val != -1) {
+    /* An entry holds the exact flags of a single
+       verification. Separate passes under different
+       flags prove nothing about their union, so a set
+       is only replaced, never merged. */
+    if (((unsigned int)val & flags) != flags) {
+      slot = btc_hashtab_del(cache->map, key);
+      btc_hashtab_put(cache->map, slot, flags);
+    }
+  } else {
+    slot = cache->keys[cache->head];
+
+    /* Evict the oldest entry. */
+    if (cache->length == BTC_SCRIPTCACHE_SIZE)
+      btc_hashtab_del(cache->map, slot);
+    else
+      cache->length++;
+
+    memcpy(slot, key, 32);
+
+    btc_hashtab_put(cache->map, slot, flags);
+
+    cache->head = (cache->head + 1) % BTC_SCRIPTCACHE_SIZE;
+  }
+
+  btc_mutex_unlock(cache->lock);
+}
+
+/*
+ * Assumed-Valid Headers
+ */
+
+/* A hash-linked run of headers from a block in our
+   chain up to the assumed-valid block. Only blocks
+   found in it (once it is complete and carries the
+   minimum chainwork) have their scripts skipped. */
+typedef struct btc_assume_s {
+  uint8_t *hashes;
+  int32_t base;
+  int32_t length;
+  int32_t alloc;
+  uint8_t work[32];
+  int done;
+} btc_assume_t;
+
+static void
+btc_assume_init(btc_assume_t *z) {
+  memset(z, 0, sizeof(*z));
+  z->base = -1;
+}
+
+static void
+btc_assume_clear(btc_assume_t *z) {
+  if (z->hashes != NULL)
+    btc_free(z->hashes);
+
+  btc_assume_init(z);
+}
+
+static const uint8_t *
+btc_assume_get(const btc_assume_t *z, int32_t height) {
+  if (z->length == 0 || height < z->base)
+    return NULL;
+
+  if (height - z->base >= z->length)
+    return NULL;
+
+  return z->hashes + (size_t)(height - z->base) * 32;
+}
+
+static void
+btc_assume_push(btc_assume_t *z, const uint8_t *hash, uint32_t bits) {
+  btc_entry_t prev, next;
+
+  if (z->length == z->alloc) {
+    z->alloc = z->alloc == 0 ? 2048 : z->alloc * 2;
+    z->hashes = (uint8_t *)btc_realloc(z->hashes, (size_t)z->alloc * 32);
+  }
+
+  memcpy(z->hashes + (size_t)z->length * 32, hash, 32);
+
+  z->length++;
+
+  /* Only the bits and the previous work are read. */
+  memcpy(prev.chainwork, z->work, 32);
+
+  next.header.bits = bits;
+
+  btc_entry_get_chainwork(z->work, &next, &prev);
+}
+
 /*
  * Chain
  */
@@ -219,18 +691,38 @@ struct btc_chain_s {
   btc_logger_t *logger;
   btc_chaindb_t *db;
   const btc_timedata_t *timedata;
+  btc_perf_t *perf;
   btc_workers_t *workers;
   btc_hashset_t *invalid;
   btc_hashmap_t *orphan_map;
   btc_hashmap_t *orphan_prev;
+  struct btc_orphans_s {
+    btc_orphan_t *head;
+    btc_orphan_t *tail;
+    size_t length;
+  } orphans;
+  size_t orphan_size;
+  char orphan_dir[BTC_PATH_MAX];
   btc_statecache_t cache;
+  btc_scriptcache_t scripts;
   btc_entry_t *tip;
   int32_t height;
   btc_deployment_state_t state;
+  volatile long seq;
+  btc_chaintip_t published;
   btc_verify_error_t error;
   int synced;
   unsigned int flags;
   int threads;
+  int *cpus;
+  size_t cpus_len;
+  int assume_valid;
+  uint8_t assume_hash[32];
+  int32_t assume_height;
+  btc_assume_t assume;
+  int32_t assumed;
+  int skip_scripts;
+  char snapshot[BTC_PATH_MAX];
   btc_chain_block_cb *on_block;
   btc_chain_connect_cb *on_connect;
   btc_chain_connect_cb *on_disconnect;
@@ -253,14 +745,19 @@ btc_chain_create(const btc_network_t *network) {
   chain->orphan_map = btc_hashmap_create();
   chain->orphan_prev = btc_hashmap_create();
   btc_statecache_init(&chain->cache, network);
+  btc_scriptcache_init(&chain->scripts);
   chain->tip = NULL;
   chain->height = -1;
+  chain->assumed = -1;
+
+  btc_assume_init(&chain->assume);
 
   btc_deployment_state_init(&chain->state);
 
   chain->flags = BTC_CHAIN_DEFAULT_FLAGS;
 
   btc_chain_set_threads(chain, 0);
+  btc_chain_set_assume_valid(chain, network->assume_valid.hash, -1);
 
   return chain;
 }
@@ -280,13 +777,18 @@ btc_chain_destroy(btc_chain_t *chain) {
   while (btc_hashmap_next(&mapiter))
     btc_orphan_destroy(mapiter.val);
 
+  btc_assume_clear(&chain->assume);
   btc_hashset_destroy(chain->invalid);
   btc_hashmap_destroy(chain->orphan_map);
   btc_hashmap_destroy(chain->orphan_prev);
   btc_statecache_clear(&chain->cache);
+  btc_scriptcache_clear(&chain->scripts);
 
   btc_chaindb_destroy(chain->db);
 
+  if (chain->cpus != NULL)
+    btc_free(chain->cpus);
+
   btc_free(chain);
 }
 
@@ -300,6 +802,11 @@ btc_chain_set_timedata(btc_chain_t *chain, const btc_timedata_t *td) {
   chain->timedata = td;
 }
 
+void
+btc_chain_set_perf(btc_chain_t *chain, btc_perf_t *perf) {
+  chain->perf = perf;
+}
+
 void
 btc_chain_set_threads(btc_chain_t *chain, int threads) {
   if (threads <= 0) {
@@ -319,6 +826,75 @@ btc_chain_set_threads(btc_chain_t *chain, int threads) {
   chain->threads = threads;
 }
 
+void
+btc_chain_set_cpus(btc_chain_t *chain, const int *cpus, size_t length) {
+  if (chain->cpus != NULL)
+    btc_free(chain->cpus);
+
+  chain->cpus = NULL;
+  chain->cpus_len = 0;
+
+  if (length > 0) {
+    chain->cpus = btc_malloc(length * sizeof(int));
+    chain->cpus_len = length;
+
+    memcpy(chain->cpus, cpus, length * sizeof(int));
+  }
+}
+
+void
+btc_chain_set_cache(btc_chain_t *chain, size_t size) {
+  btc_chaindb_set_cache(chain->db, size);
+}
+
+void
+btc_chain_set_prune(btc_chain_t *chain, int64_t size) {
+  btc_chaindb_set_prune(chain->db, size);
+}
+
+void
+btc_chain_set_tune(btc_chain_t *chain, const btc_dbtune_t *tune) {
+  btc_chaindb_set_tune(chain->db, tune);
+}
+
+void
+btc_chain_set_assume_valid(btc_chain_t *chain,
+                           const uint8_t *hash,
+                           int32_t height) {
+  const btc_checkpoint_t *chk = &chain->network->assume_valid;
+
+  btc_assume_clear(&chain->assume);
+
+  if (hash == NULL || btc_hash_is_null(hash)) {
+    chain->assume_valid = 0;
+    return;
+  }
+
+  chain->assume_valid = 1;
+  chain->assume_height = height;
+
+  memcpy(chain->assume_hash, hash, 32);
+
+  /* Otherwise the header chain tells us (a known
+     height only bounds how far we look for it). */
+  if (memcmp(hash, chk->hash, 32) == 0)
+    chain->assume_height = chk->height;
+}
+
+void
+btc_chain_set_snapshot(btc_chain_t *chain, const char *path) {
+  size_t len;
+
+  if (path == NULL)
+    path = "";
+
+  len = strlen(path);
+
+  CHECK(len < sizeof(chain->snapshot));
+
+  memcpy(chain->snapshot, path, len + 1);
+}
+
 void
 btc_chain_on_block(btc_chain_t *chain, btc_chain_block_cb *handler) {
   chain->on_block = handler;
@@ -360,6 +936,31 @@ btc_chain_log(btc_chain_t *chain, const char *fmt, ...) {
   va_end(ap);
 }
 
+static void
+btc_chain_debug(btc_chain_t *chain, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_log(chain->logger, BTC_LOG_DEBUG, "chain", fmt, ap);
+  va_end(ap);
+}
+
+static void
+btc_chain_publish(btc_chain_t *chain) {
+  /* Only the chain thread writes, so it may
+     read the sequence without ordering. */
+  long seq = chain->seq;
+
+  btc_atomic_store(&chain->seq, seq + 1);
+  btc_atomic_fence();
+
+  chain->published.entry = chain->tip;
+  chain->published.height = chain->height;
+  chain->published.state = chain->state;
+  chain->published.generation++;
+
+  btc_atomic_store(&chain->seq, seq + 2);
+}
+
 static void
 btc_chain_get_deployment_state(btc_chain_t *chain,
                                btc_deployment_state_t *state) {
@@ -398,122 +999,150 @@ btc_chain_maybe_sync(btc_chain_t *chain) {
 
   btc_chain_log(chain, "Chain is fully synced (height=%d).", chain->height);
 
+  /* Write out the coins accumulated during IBD. */
+  CHECK(btc_chaindb_flush(chain->db));
+
+  /* Back to steady-state database tuning. */
+  btc_chaindb_set_bulk(chain->db, 0);
+
   chain->synced = 1;
 }
 
-int
-btc_chain_open(btc_chain_t *chain, const char *prefix, unsigned int flags) {
-  btc_chain_log(chain, "Chain is loading.");
-
-  chain->flags = flags;
+static int
+btc_chain_orphan_path(btc_chain_t *chain, char *path, const uint8_t *hash) {
+  char name[64 + 4 + 1];
 
-  if (!btc_chaindb_open(chain->db, prefix, flags))
-    return 0;
+  btc_base16_encode(name, hash, 32);
 
-  if (chain->threads > 0)
-    chain->workers = btc_workers_create(chain->threads, 128);
+  memcpy(name + 64, ".blk", 5);
 
-  chain->tip = (btc_entry_t *)btc_chaindb_tail(chain->db);
-  chain->height = chain->tip->height;
-  chain->synced = 0;
-
-  btc_chain_get_deployment_state(chain, &chain->state);
-
-  if (chain->flags & BTC_CHAIN_CHECKPOINTS)
-    btc_chain_log(chain, "Checkpoints are enabled.");
+  return btc_path_join(path, BTC_PATH_MAX, chain->orphan_dir, name, 0);
+}
 
-  btc_chain_log(chain, "Chain Height: %d", chain->height);
+static int
+btc_chain_clean_orphans(btc_chain_t *chain) {
+  /* Anything left over is from an unclean shutdown. */
+  char path[BTC_PATH_MAX];
+  btc_dirent_t **list;
+  size_t i, count;
+  int ret = 1;
 
-  btc_chain_maybe_sync(chain);
+  if (!btc_fs_exists(chain->orphan_dir))
+    return 1;
 
-  return 1;
-}
+  if (!btc_fs_scandir(chain->orphan_dir, &list, &count))
+    return 0;
 
-void
-btc_chain_close(btc_chain_t *chain) {
-  btc_chain_log(chain, "Closing chain.");
+  for (i = 0; i < count; i++) {
+    if (btc_path_join(path, sizeof(path), chain->orphan_dir,
+                                          list[i]->d_name, 0)) {
+      ret &= btc_fs_unlink(path);
+    } else {
+      ret = 0;
+    }
 
-  if (chain->workers != NULL) {
-    btc_workers_destroy(chain->workers);
-    chain->workers = NULL;
+    free(list[i]);
   }
 
-  btc_chaindb_close(chain->db);
+  free(list);
+
+  return ret & btc_fs_rmdir(chain->orphan_dir);
 }
 
 static void
 btc_chain_add_orphan(btc_chain_t *chain, btc_orphan_t *orphan) {
-  btc_header_t *hdr = &orphan->block->header;
+  btc_header_t *hdr = &orphan->header;
 
   CHECK(btc_hashmap_put(chain->orphan_map, orphan->hash, orphan));
   CHECK(btc_hashmap_put(chain->orphan_prev, hdr->prev_block, orphan));
+
+  btc_list_push(&chain->orphans, orphan, btc_orphan_t);
+
+  chain->orphan_size += orphan->size;
 }
 
 static void
-btc_chain_remove_orphan(btc_chain_t *chain, const btc_orphan_t *orphan) {
-  const btc_header_t *hdr = &orphan->block->header;
+btc_chain_remove_orphan(btc_chain_t *chain, btc_orphan_t *orphan) {
+  const btc_header_t *hdr = &orphan->header;
 
   CHECK(btc_hashmap_del(chain->orphan_map, orphan->hash));
   CHECK(btc_hashmap_del(chain->orphan_prev, hdr->prev_block));
-}
 
-int
-btc_chain_has_orphan(btc_chain_t *chain, const uint8_t *hash) {
-  return btc_hashmap_has(chain->orphan_map, hash);
+  btc_list_remove(&chain->orphans, orphan, btc_orphan_t);
+
+  chain->orphan_size -= orphan->size;
 }
 
 static void
-btc_chain_limit_orphans(btc_chain_t *chain) {
-  btc_hashmapiter_t iter;
-  btc_orphan_t *oldest = NULL;
-  btc_orphan_t *orphan;
-  btc_vector_t orphans;
-  size_t i;
+btc_chain_unlink_orphan(btc_chain_t *chain, btc_orphan_t *orphan) {
+  char path[BTC_PATH_MAX];
 
-  if (btc_hashmap_size(chain->orphan_map) <= 20)
-    return;
+  if (btc_chain_orphan_path(chain, path, orphan->hash))
+    btc_fs_unlink(path);
 
-  btc_vector_init(&orphans);
+  btc_orphan_destroy(orphan);
+}
 
-  btc_hashmap_iterate(&iter, chain->orphan_map);
+static btc_block_t *
+btc_chain_read_orphan(btc_chain_t *chain, btc_orphan_t *orphan) {
+  char path[BTC_PATH_MAX];
+  btc_block_t *block;
+  uint8_t *data;
+  size_t len;
 
-  while (btc_hashmap_next(&iter)) {
-    orphan = iter.val;
+  if (!btc_chain_orphan_path(chain, path, orphan->hash))
+    return NULL;
 
-    if (oldest == NULL || orphan->time < oldest->time)
-      oldest = orphan;
+  if (!btc_fs_alloc_file(&data, &len, path))
+    return NULL;
 
-    btc_vector_push(&orphans, orphan);
-  }
+  block = btc_block_decode(data, len);
 
-  for (i = 0; i < orphans.length; i++) {
-    orphan = (btc_orphan_t *)orphans.items[i];
+  free(data);
 
-    if (orphan == oldest)
-      continue;
+  return block;
+}
+
+int
+btc_chain_has_orphan(btc_chain_t *chain, const uint8_t *hash) {
+  return btc_hashmap_has(chain->orphan_map, hash);
+}
+
+static void
+btc_chain_limit_orphans(btc_chain_t *chain, size_t size) {
+  btc_orphan_t *orphan;
+
+  /* Oldest first. */
+  while (chain->orphans.head != NULL) {
+    if (chain->orphan_size + size <= BTC_ORPHAN_BYTES)
+      break;
+
+    orphan = chain->orphans.head;
+
+    btc_chain_debug(chain, "Evicting orphan block: %H.", orphan->hash);
 
     btc_chain_remove_orphan(chain, orphan);
-    btc_orphan_destroy(orphan);
+    btc_chain_unlink_orphan(chain, orphan);
   }
-
-  btc_vector_clear(&orphans);
 }
 
 static void
 btc_chain_purge_orphans(btc_chain_t *chain) {
-  size_t count = btc_hashmap_size(chain->orphan_map);
-  btc_hashmapiter_t iter;
+  size_t count = chain->orphans.length;
+  btc_orphan_t *orphan;
 
   if (count == 0)
     return;
 
-  btc_hashmap_iterate(&iter, chain->orphan_map);
+  while (chain->orphans.head != NULL) {
+    orphan = chain->orphans.head;
 
-  while (btc_hashmap_next(&iter))
-    btc_orphan_destroy(iter.val);
+    btc_chain_remove_orphan(chain, orphan);
+    btc_chain_unlink_orphan(chain, orphan);
+  }
 
-  btc_hashmap_reset(chain->orphan_map);
-  btc_hashmap_reset(chain->orphan_prev);
+  CHECK(btc_hashmap_size(chain->orphan_map) == 0);
+  CHECK(chain->orphan_size == 0);
 
   btc_chain_log(chain, "Purged %zu orphans.", count);
 }
@@ -537,34 +1166,54 @@ btc_chain_store_orphan(btc_chain_t *chain,
                        unsigned int id) {
   const btc_header_t *hdr = &block->header;
   int32_t height = btc_block_coinbase_height(block);
+  char path[BTC_PATH_MAX];
   btc_orphan_t *orphan;
+  uint8_t *data;
+  size_t len;
+  int ok;
 
   orphan = btc_hashmap_get(chain->orphan_prev, hdr->prev_block);
 
   /* The orphan chain forked. */
   if (orphan != NULL) {
-    btc_chain_log(chain,
+    btc_chain_debug(chain,
       "Removing forked orphan block: %H (%d).",
       orphan->hash, height);
 
     btc_chain_remove_orphan(chain, orphan);
-    btc_orphan_destroy(orphan);
+    btc_chain_unlink_orphan(chain, orphan);
 
     return;
   }
 
   orphan = btc_orphan_create();
-  orphan->block = btc_block_refconst(block);
+  orphan->header = *hdr;
   orphan->flags = flags;
   orphan->id = id;
   orphan->time = btc_now();
 
   btc_header_hash(orphan->hash, hdr);
 
-  btc_chain_limit_orphans(chain);
+  btc_block_encode(&data, &len, block);
+
+  orphan->size = len;
+
+  btc_chain_limit_orphans(chain, len);
+
+  ok = btc_chain_orphan_path(chain, path, orphan->hash)
+    && btc_fs_write_file(path, 0644, data, len);
+
+  btc_free(data);
+
+  if (!ok) {
+    btc_chain_log(chain, "Could not store orphan block: %H.", orphan->hash);
+    btc_orphan_destroy(orphan);
+    return;
+  }
+
   btc_chain_add_orphan(chain, orphan);
 
-  btc_chain_log(chain,
+  btc_chain_debug(chain,
     "Storing orphan block: %H (%d).",
     orphan->hash, height);
 }
@@ -574,6 +1223,195 @@ btc_chain_has_next_orphan(btc_chain_t *chain, const uint8_t *hash) {
   return btc_hashmap_has(chain->orphan_prev, hash);
 }
 
+static void
+btc_chain_load_assumed(btc_chain_t *chain) {
+  const btc_entry_t *entry;
+
+  if (!chain->assume_valid)
+    return;
+
+  entry = btc_chaindb_by_hash(chain->db, chain->assume_hash);
+
+  /* Connected already: nothing left to skip. */
+  if (entry != NULL && btc_chaindb_is_main(chain->db, entry)) {
+    chain->assume_valid = 0;
+    return;
+  }
+
+  if (chain->assume_height < 0)
+    return;
+
+  if (chain->tip->height < chain->assume_height)
+    return;
+
+  /* Past it already, on another chain. */
+  btc_chain_log(chain, "Assumed-valid block %H is not in the chain.",
+                       chain->assume_hash);
+
+  chain->assume_valid = 0;
+}
+
+static void
+btc_chain_drop_assumed(btc_chain_t *chain, const char *reason) {
+  btc_chain_log(chain, "Not skipping scripts for %H: %s.",
+                       chain->assume_hash, reason);
+
+  btc_assume_clear(&chain->assume);
+
+  chain->assume_valid = 0;
+}
+
+int
+btc_chain_open(btc_chain_t *chain, const char *prefix, unsigned int flags) {
+  btc_utxostats_t stats;
+  int tag, ok;
+
+  btc_chain_log(chain, "Chain is loading.");
+
+  chain->flags = flags;
+
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_CHAIN);
+
+  ok = btc_chaindb_open(chain->db, prefix, flags);
+
+  BTC_MEMTAG_POP(tag);
+
+  if (!ok)
+    return 0;
+
+  /* Orphans and snapshots belong to the primary. */
+  if (flags & BTC_CHAIN_READONLY)
+    goto done;
+
+  /* Orphans go wherever the database put itself. */
+  if (flags & BTC_CHAIN_MEMORY)
+    prefix = btc_chaindb_prefix(chain->db);
+
+  if (!btc_path_join(chain->orphan_dir, sizeof(chain->orphan_dir),
+                     prefix, BTC_ORPHAN_DIR, 0)) {
+    btc_chaindb_close(chain->db);
+    return 0;
+  }
+
+  if (!btc_chain_clean_orphans(chain)
+      || !btc_fs_mkdir(chain->orphan_dir, 0755)) {
+    btc_chain_log(chain, "Could not create orphan store: %s.",
+                         chain->orphan_dir);
+    btc_chaindb_close(chain->db);
+    return 0;
+  }
+
+  if (chain->snapshot[0] != '\0') {
+    if (btc_chaindb_height(chain->db) == 0) {
+      btc_chain_log(chain, "Loading snapshot from %s.", chain->snapshot);
+
+      if (!btc_chaindb_read_snapshot(chain->db, chain->snapshot)) {
+        btc_chain_log(chain, "Could not load snapshot.");
+        btc_chaindb_close(chain->db);
+        return 0;
+      }
+
+      /* To be checked against the source's gettxoutsetinfo. */
+      if (btc_chaindb_utxo_stats(chain->db, &stats)) {
+        btc_chain_log(chain, "Snapshot commitment: %H (height=%d).",
+                             stats.muhash, stats.height);
+      }
+    } else {
+      btc_chain_log(chain, "Ignoring snapshot (height=%d).",
+                           btc_chaindb_height(chain->db));
+    }
+  }
+
+done:
+  if (chain->threads > 0) {
+    chain->workers = btc_workers_create(chain->threads, 128);
+
+    if (chain->cpus_len > 0
+        && !btc_workers_pin(chain->workers, chain->cpus, chain->cpus_len)) {
+      btc_chain_log(chain, "Could not pin script workers.");
+    }
+  }
+
+  chain->tip = (btc_entry_t *)btc_chaindb_tail(chain->db);
+  chain->height = chain->tip->height;
+  chain->synced = 0;
+
+  btc_chain_get_deployment_state(chain, &chain->state);
+  btc_chain_publish(chain);
+
+  /* Tuned for bulk loading until we are synced. */
+  btc_chaindb_set_bulk(chain->db, 1);
+
+  if (chain->flags & BTC_CHAIN_CHECKPOINTS)
+    btc_chain_log(chain, "Checkpoints are enabled.");
+
+  btc_chain_load_assumed(chain);
+
+  if (chain->assume_valid) {
+    btc_chain_log(chain, "Assuming valid: %H (height=%d).",
+                         chain->assume_hash, chain->assume_height);
+  }
+
+  btc_chain_log(chain, "Chain Height: %d", chain->height);
+
+  if (chain->flags & BTC_CHAIN_READONLY)
+    btc_chain_log(chain, "Following the primary as a read-only replica.");
+
+  btc_chain_maybe_sync(chain);
+
+  return 1;
+}
+
+int
+btc_chain_refresh(btc_chain_t *chain) {
+  /* Replicas pick up the primary's tip. Nothing is
+     connected here, so no callbacks are invoked. */
+  if (!btc_chaindb_refresh(chain->db))
+    return 0;
+
+  chain->tip = (btc_entry_t *)btc_chaindb_tail(chain->db);
+  chain->height = chain->tip->height;
+
+  btc_chain_get_deployment_state(chain, &chain->state);
+  btc_chain_publish(chain);
+
+  btc_chain_log(chain, "Replica tip: %H (height=%d).",
+                       chain->tip->hash, chain->height);
+
+  btc_chain_maybe_sync(chain);
+
+  return 1;
+}
+
+void
+btc_chain_close(btc_chain_t *chain) {
+  btc_chain_log(chain, "Closing chain.");
+
+  if (chain->workers != NULL) {
+    btc_workers_destroy(chain->workers);
+    chain->workers = NULL;
+  }
+
+  /* Keys point into entries owned by the database. */
+  btc_statecache_reset(&chain->cache);
+
+  btc_chain_purge_orphans(chain);
+  btc_chain_clean_orphans(chain);
+
+  btc_chaindb_close(chain->db);
+}
+
+int
+btc_chain_write_snapshot(btc_chain_t *chain,
+                         const char *path,
+                         uint8_t *checksum,
+                         uint64_t *count) {
+  btc_chain_log(chain, "Writing snapshot to %s (height=%d).",
+                       path, chain->height);
+
+  return btc_chaindb_write_snapshot(chain->db, path, checksum, count);
+}
+
 static void
 btc_chain_set_invalid(btc_chain_t *chain, const uint8_t *hash) {
   uint8_t *key = btc_hash_clone(hash);
@@ -660,6 +1498,47 @@ btc_chain_is_historical(btc_chain_t *chain, const btc_entry_t *prev) {
   return 0;
 }
 
+static int
+btc_chain_is_assumed(btc_chain_t *chain,
+                     const btc_header_t *hdr,
+                     const btc_entry_t *prev) {
+  int64_t now = btc_timedata_now(chain->timedata);
+  int32_t height = prev->height + 1;
+  const uint8_t *expect;
+  uint8_t hash[32];
+
+  if (!chain->assume_valid || !chain->assume.done)
+    return 0;
+
+  if (height > chain->assume_height)
+    return 0;
+
+  /* Recent blocks are always fully verified. */
+  if (hdr->time > now - 14 * 24 * 60 * 60)
+    return 0;
+
+  /* Being in the header chain at this height is
+     what makes the block an ancestor of it. */
+  expect = btc_assume_get(&chain->assume, height);
+
+  if (expect == NULL)
+    return 0;
+
+  btc_header_hash(hash, hdr);
+
+  if (memcmp(hash, expect, 32) != 0)
+    return 0;
+
+  if (height == chain->assume_height) {
+    btc_chain_log(chain, "Reached assumed-valid block %H (height=%d).",
+                         hash, height);
+  }
+
+  chain->assumed = height;
+
+  return 1;
+}
+
 static const btc_entry_t *
 btc_chain_get_ancestor(btc_chain_t *chain,
                        const btc_entry_t *entry,
@@ -672,10 +1551,7 @@ btc_chain_get_ancestor(btc_chain_t *chain,
   if (btc_chaindb_is_main(chain->db, entry))
     return btc_chaindb_by_height(chain->db, height);
 
-  while (entry->height != height)
-    entry = entry->prev;
-
-  return entry;
+  return btc_entry_get_ancestor(entry, height);
 }
 
 static uint32_t
@@ -806,16 +1682,25 @@ btc_chain_get_state(btc_chain_t *chain,
   while (entry != NULL) {
     cached = btc_statecache_get(&chain->cache, bit, entry);
 
+    if (cached == -1) {
+      /* Fall back to states saved by a previous run. */
+      cached = btc_chaindb_get_state(chain->db, deployment, entry);
+
+      if (cached != -1)
+        btc_statecache_set(&chain->cache, bit, entry, cached);
+    }
+
     if (cached != -1) {
       state = cached;
       break;
     }
 
-    time = btc_entry_median_time(entry);
+    time = btc_chain_median_time(chain, entry);
 
     if (time < deployment->start_time) {
       state = BTC_STATE_DEFINED;
       btc_statecache_set(&chain->cache, bit, entry, state);
+      btc_chaindb_put_state(chain->db, deployment, entry, state);
       break;
     }
 
@@ -831,7 +1716,7 @@ btc_chain_get_state(btc_chain_t *chain,
 
     switch (state) {
       case BTC_STATE_DEFINED: {
-        time = btc_entry_median_time(entry);
+        time = btc_chain_median_time(chain, entry);
 
         if (time >= deployment->timeout) {
           state = BTC_STATE_FAILED;
@@ -847,7 +1732,7 @@ btc_chain_get_state(btc_chain_t *chain,
       }
 
       case BTC_STATE_STARTED: {
-        time = btc_entry_median_time(entry);
+        time = btc_chain_median_time(chain, entry);
 
         if (time >= deployment->timeout) {
           state = BTC_STATE_FAILED;
@@ -891,6 +1776,7 @@ btc_chain_get_state(btc_chain_t *chain,
     }
 
     btc_statecache_set(&chain->cache, bit, entry, state);
+    btc_chaindb_put_state(chain->db, deployment, entry, state);
   }
 
   btc_vector_clear(&compute);
@@ -970,6 +1856,17 @@ btc_chain_get_deployments(btc_chain_t *chain,
     state->flags |= BTC_SCRIPT_VERIFY_WITNESS;
     state->flags |= BTC_SCRIPT_VERIFY_NULLDUMMY;
   }
+
+  /* Taproot (bip341 & bip342) is now usable. */
+  deploy = btc_network_deployment(network, "taproot");
+
+  if (deploy != NULL)
+    active = btc_chain_is_active(chain, prev, deploy);
+  else
+    active = (height >= network->softforks.taproot.height);
+
+  if (active)
+    state->flags |= BTC_SCRIPT_VERIFY_TAPROOT;
 }
 
 static int
@@ -1035,7 +1932,7 @@ btc_chain_verify(btc_chain_t *chain,
   if (btc_chain_is_historical(chain, prev)) {
     /* Check merkle root. */
     if (flags & BTC_BLOCK_VERIFY_BODY) {
-      int rc = btc_block_merkle_root(root, block);
+      int rc = btc_body_merkle_root(root, block, chain->workers);
 
       if (rc == 0 || !btc_hash_equal(hdr->merkle_root, root)) {
         return btc_chain_throw(chain, hdr,
@@ -1062,7 +1959,7 @@ btc_chain_verify(btc_chain_t *chain,
   if (flags & BTC_BLOCK_VERIFY_BODY) {
     btc_verify_error_t err;
 
-    if (!btc_block_check_body(&err, block))
+    if (!btc_body_check(&err, block, chain->workers))
       return btc_chain_throw(chain, hdr, "invalid", err.reason, err.score, 1);
   }
 
@@ -1073,7 +1970,7 @@ btc_chain_verify(btc_chain_t *chain,
     return btc_chain_throw(chain, hdr, "invalid", "bad-diffbits", 100, 0);
 
   /* Ensure the timestamp is correct. */
-  mtp = btc_entry_median_time(prev);
+  mtp = btc_chain_median_time(chain, prev);
 
   if (hdr->time <= mtp)
     return btc_chain_throw(chain, hdr, "invalid", "time-too-old", 0, 0);
@@ -1146,7 +2043,7 @@ btc_chain_verify(btc_chain_t *chain,
                                1);
       }
 
-      CHECK(btc_block_create_commitment_hash(root, block));
+      CHECK(btc_body_commitment_hash(root, block, chain->workers));
 
       if (!btc_hash_equal(commit_hash, root)) {
         return btc_chain_throw(chain, hdr,
@@ -1260,7 +2157,7 @@ btc_chain_verify_final(btc_chain_t *chain,
     return btc_tx_is_final(tx, height, -1);
 
   if (flags & BTC_LOCKTIME_MEDIAN_TIME_PAST) {
-    int64_t ts = btc_entry_median_time(prev);
+    int64_t ts = btc_chain_median_time(chain, prev);
     return btc_tx_is_final(tx, height, ts);
   }
 
@@ -1322,7 +2219,7 @@ btc_chain_verify_locks(btc_chain_t *chain,
 
     masked <<= BTC_SEQUENCE_GRANULARITY;
 
-    time = btc_entry_median_time(entry) + ((int64_t)masked - 1);
+    time = btc_chain_median_time(chain, entry) + ((int64_t)masked - 1);
 
     if (time > min_time)
       min_time = time;
@@ -1331,12 +2228,51 @@ btc_chain_verify_locks(btc_chain_t *chain,
   if (min_height >= prev->height + 1)
     return 0;
 
-  if (min_time >= btc_entry_median_time(prev))
+  if (min_time >= btc_chain_median_time(chain, prev))
+    return 0;
+
+  return 1;
+}
+
+int
+btc_chain_verify_scripts(btc_chain_t *chain,
+                         const btc_tx_t *tx,
+                         const btc_view_t *view,
+                         unsigned int flags) {
+  if (btc_scriptcache_has(&chain->scripts, tx->whash, flags))
+    return 1;
+
+  btc_tx_precompute(tx, view);
+
+  if (!btc_tx_verify(tx, view, flags))
     return 0;
 
+  btc_scriptcache_add(&chain->scripts, tx->whash, flags);
+
   return 1;
 }
 
+int
+btc_chain_has_scripts(btc_chain_t *chain,
+                      const btc_tx_t *tx,
+                      unsigned int flags) {
+  return btc_scriptcache_has(&chain->scripts, tx->whash, flags);
+}
+
+void
+btc_chain_cache_scripts(btc_chain_t *chain,
+                        const btc_tx_t *tx,
+                        unsigned int flags) {
+  btc_scriptcache_add(&chain->scripts, tx->whash, flags);
+}
+
+void
+btc_chain_cache_witness(btc_chain_t *chain,
+                        const uint8_t *whash,
+                        unsigned int flags) {
+  btc_scriptcache_add(&chain->scripts, whash, flags);
+}
+
 static btc_view_t *
 btc_chain_verify_inputs(btc_chain_t *chain,
                         const btc_block_t *block,
@@ -1346,11 +2282,15 @@ btc_chain_verify_inputs(btc_chain_t *chain,
   int32_t interval = chain->network->halving_interval;
   btc_view_t *view = btc_view_create();
   int32_t height = prev->height + 1;
+  int64_t start = btc_time_nsec();
   btc_verify_error_t err;
   int64_t reward = 0;
   int sigops = 0;
   size_t i;
 
+  /* Load every coin the block spends up front. */
+  btc_chaindb_prefetch(chain->db, view, block);
+
   /* Check all transactions. */
   for (i = 0; i < block->txs.length; i++) {
     const btc_tx_t *tx = block->txs.items[i];
@@ -1431,6 +2371,18 @@ btc_chain_verify_inputs(btc_chain_t *chain,
     goto fail;
   }
 
+  btc_perf_record(chain->perf, BTC_PERF_BLOCK_COINS, btc_time_nsec() - start);
+
+  /* Scripts below the assumed-valid block are trusted. */
+  if (btc_chain_is_assumed(chain, hdr, prev))
+    return view;
+
+  /* Replaying trusted block files without scripts. */
+  if (chain->skip_scripts)
+    return view;
+
+  start = btc_time_nsec();
+
   if (chain->workers != NULL) {
     btc_checker_t checker;
 
@@ -1440,6 +2392,9 @@ btc_chain_verify_inputs(btc_chain_t *chain,
     for (i = 1; i < block->txs.length; i++) {
       const btc_tx_t *tx = block->txs.items[i];
 
+      if (btc_scriptcache_has(&chain->scripts, tx->whash, state->flags))
+        continue;
+
       btc_checker_push(&checker, tx, view, state->flags);
     }
 
@@ -1452,21 +2407,42 @@ btc_chain_verify_inputs(btc_chain_t *chain,
       goto fail;
     }
   } else {
+    btc_sigbatch_t *batch = NULL;
+    int ret = 1;
+
+    /* Schnorr signatures are batched per block. */
+    if (state->flags & BTC_SCRIPT_VERIFY_TAPROOT)
+      batch = btc_sigbatch_create();
+
     /* Verify all transactions. */
-    for (i = 1; i < block->txs.length; i++) {
+    for (i = 1; i < block->txs.length && ret; i++) {
       const btc_tx_t *tx = block->txs.items[i];
 
-      if (!btc_tx_verify(tx, view, state->flags)) {
-        btc_chain_throw(chain, hdr,
-                        "invalid",
-                        "mandatory-script-verify-flag-failed",
-                        100,
-                        0);
-        goto fail;
-      }
+      if (btc_scriptcache_has(&chain->scripts, tx->whash, state->flags))
+        continue;
+
+      ret = btc_tx_verify_batch(tx, view, state->flags, batch);
+    }
+
+    if (batch != NULL) {
+      if (ret)
+        ret = btc_sigbatch_verify(batch);
+
+      btc_sigbatch_destroy(batch);
+    }
+
+    if (!ret) {
+      btc_chain_throw(chain, hdr,
+                      "invalid",
+                      "mandatory-script-verify-flag-failed",
+                      100,
+                      0);
+      goto fail;
     }
   }
 
+  btc_perf_record(chain->perf, BTC_PERF_BLOCK_SCRIPTS, btc_time_nsec() - start);
+
   return view;
 fail:
   btc_view_destroy(view);
@@ -1479,24 +2455,36 @@ btc_chain_verify_context(btc_chain_t *chain,
                          const btc_block_t *block,
                          const btc_entry_t *prev,
                          unsigned int flags) {
+  int64_t start = btc_time_nsec();
+  btc_view_t *view;
+  int tag;
+
   /* Initial non-contextual verification. */
   if (!btc_chain_verify(chain, state, block, prev, flags))
     return NULL;
 
-  /* Skip everything if we're using checkpoints. */
-  if (btc_chain_is_historical(chain, prev))
-    return btc_chain_update_inputs(chain, block, prev);
+  btc_perf_record(chain->perf, BTC_PERF_BLOCK_SANITY, btc_time_nsec() - start);
 
   /* BIP30 - Verify there are no duplicate txids.
      Note that BIP34 made it impossible to create
      duplicate txids. */
-  if (!state->bip34) {
+  if (!btc_chain_is_historical(chain, prev) && !state->bip34) {
     if (!btc_chain_verify_duplicates(chain, block, prev))
       return NULL;
   }
 
-  /* Verify scripts, spend and add coins. */
-  return btc_chain_verify_inputs(chain, block, prev, state);
+  /* The view's coins outlive it in the coin cache. */
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_COINS);
+
+  /* Skip everything if we're using checkpoints. */
+  if (btc_chain_is_historical(chain, prev))
+    view = btc_chain_update_inputs(chain, block, prev);
+  else /* Verify scripts, spend and add coins. */
+    view = btc_chain_verify_inputs(chain, block, prev, state);
+
+  BTC_MEMTAG_POP(tag);
+
+  return view;
 }
 
 static int
@@ -1615,6 +2603,8 @@ btc_chain_unreorganize(btc_chain_t *chain,
   for (entry = last; entry != fork; entry = entry->prev)
     btc_vector_push(&connect, entry);
 
+  CHECK(btc_chaindb_begin_reorg(chain->db));
+
   /* Disconnect blocks and transactions. */
   for (i = 0; i < disconnect.length; i++) {
     entry = (btc_entry_t *)disconnect.items[i];
@@ -1629,6 +2619,8 @@ btc_chain_unreorganize(btc_chain_t *chain,
     CHECK(btc_chain_reconnect(chain, entry));
   }
 
+  CHECK(btc_chaindb_end_reorg(chain->db));
+
   btc_chain_log(chain,
     "Chain un-reorganization: old=%H(%d) new=%H(%d)",
     tip->hash,
@@ -1646,19 +2638,26 @@ btc_chain_unreorganize(btc_chain_t *chain,
 
 static const btc_entry_t *
 find_fork(const btc_entry_t *fork, const btc_entry_t *longer) {
+  if (fork->height > longer->height)
+    fork = btc_entry_get_ancestor(fork, longer->height);
+  else
+    longer = btc_entry_get_ancestor(longer, fork->height);
+
+  CHECK(fork != NULL && longer != NULL);
+
+  /* Both sides are at the same height and so share skip
+     heights. Differing skips mean the fork lies below. */
   while (fork != longer) {
-    while (longer->height > fork->height) {
+    if (fork->skip != NULL && longer->skip != NULL
+                           && fork->skip != longer->skip) {
+      fork = fork->skip;
+      longer = longer->skip;
+    } else {
+      fork = fork->prev;
       longer = longer->prev;
-
-      CHECK(longer != NULL);
     }
 
-    if (fork == longer)
-      return fork;
-
-    fork = fork->prev;
-
-    CHECK(fork != NULL);
+    CHECK(fork != NULL && longer != NULL);
   }
 
   return fork;
@@ -1685,6 +2684,11 @@ btc_chain_reorganize(btc_chain_t *chain, btc_entry_t *competitor) {
   for (entry = competitor; entry != fork; entry = entry->prev)
     btc_vector_push(&connect, entry);
 
+  /* Rather than committing every step, the whole
+     reorg is applied in memory and the net change
+     to the coins is written out once at the end. */
+  CHECK(btc_chaindb_begin_reorg(chain->db));
+
   /* Disconnect blocks and transactions. */
   for (i = 0; i < disconnect.length; i++) {
     entry = (btc_entry_t *)disconnect.items[i];
@@ -1709,14 +2713,20 @@ btc_chain_reorganize(btc_chain_t *chain, btc_entry_t *competitor) {
         }
       }
 
+      CHECK(btc_chaindb_end_reorg(chain->db));
+
       if (btc_hash_compare(chain->tip->chainwork, tip->chainwork) < 0)
         btc_chain_unreorganize(chain, fork, tip);
+      else if (chain->on_reorganize != NULL)
+        chain->on_reorganize(tip, chain->tip, chain->arg);
 
       fork = NULL;
       goto done;
     }
   }
 
+  CHECK(btc_chaindb_end_reorg(chain->db));
+
   btc_chain_log(chain,
     "Chain reorganization: old=%H(%d) new=%H(%d)",
     tip->hash,
@@ -1790,6 +2800,7 @@ btc_chain_set_best_chain(btc_chain_t *chain,
   btc_entry_t *tip = chain->tip;
   btc_deployment_state_t state;
   btc_view_t *view;
+  int64_t start;
 
   /* A higher fork has arrived. Time to reorganize the chain. */
   if (!btc_hash_equal(entry->header.prev_block, tip->hash)) {
@@ -1827,18 +2838,28 @@ btc_chain_set_best_chain(btc_chain_t *chain,
     if (fork != NULL) {
       if (btc_hash_compare(chain->tip->chainwork, tip->chainwork) < 0)
         btc_chain_unreorganize(chain, fork, tip);
+
+      /* We may have stayed on the competing chain. */
+      btc_chain_publish(chain);
     }
 
     return 0;
   }
 
   /* Save block and connect inputs. */
+  start = btc_time_nsec();
+
   CHECK(btc_chaindb_save(chain->db, entry, block, view));
 
+  btc_perf_record(chain->perf, BTC_PERF_BLOCK_SAVE, btc_time_nsec() - start);
+
   chain->tip = entry;
   chain->height = entry->height;
   chain->state = state;
 
+  /* Intermediate tips of a reorg are never published. */
+  btc_chain_publish(chain);
+
   if (chain->on_block != NULL)
     chain->on_block(block, entry, chain->arg);
 
@@ -1857,12 +2878,14 @@ btc_chain_connect(btc_chain_t *chain,
                   unsigned int flags) {
   const btc_network_t *network = chain->network;
   const btc_header_t *hdr = &block->header;
-  btc_entry_t *entry = btc_entry_create();
-  int64_t now = btc_time_usec();
+  btc_entry_t *entry = btc_chaindb_create_entry(chain->db);
+  int64_t start = btc_time_nsec();
 
   /* Sanity check. */
   CHECK(btc_hash_equal(hdr->prev_block, prev->hash));
 
+  BTC_TRACE_BEGIN("chain", "connect_block");
+
   /* Create a new chain entry. */
   btc_entry_set_block(entry, block, prev);
 
@@ -1872,13 +2895,15 @@ btc_chain_connect(btc_chain_t *chain,
   if (btc_hash_compare(entry->chainwork, chain->tip->chainwork) <= 0) {
     /* Save block to an alternate chain. */
     if (!btc_chain_save_alternate(chain, entry, block, flags)) {
-      btc_entry_destroy(entry);
+      btc_chaindb_destroy_entry(chain->db, entry);
+      BTC_TRACE_END("chain", "connect_block");
       return NULL;
     }
   } else {
     /* Attempt to add block to the chain index. */
     if (!btc_chain_set_best_chain(chain, entry, block, flags)) {
-      btc_entry_destroy(entry);
+      btc_chaindb_destroy_entry(chain->db, entry);
+      BTC_TRACE_END("chain", "connect_block");
       return NULL;
     }
   }
@@ -1886,22 +2911,47 @@ btc_chain_connect(btc_chain_t *chain,
   if (entry->height % 20 == 0 || entry->height >= network->block.slow_height) {
     btc_chain_log(chain, "Block %H (%d) added to chain (txs=%zu time=%.2f).",
                          entry->hash, entry->height, block->txs.length,
-                         (double)(btc_time_usec() - now) / 1000.0);
+                         (double)(btc_time_nsec() - start) / 1000000.0);
+  }
+
+  if (entry->height % 1000 == 0) {
+    btc_dbstats_t stats;
+
+    btc_chaindb_stats(chain->db, &stats);
+
+    btc_chain_log(chain, "Database: levels=%d segments=%d"
+                         " tree=%d/%dkb checkpoint=%dkb.",
+                         stats.levels, stats.segments,
+                         stats.tree_old, stats.tree_new,
+                         stats.checkpoint);
   }
 
   btc_chain_maybe_sync(chain);
 
+  btc_perf_record(chain->perf, BTC_PERF_BLOCK_CONNECT, btc_time_nsec() - start);
+
+  BTC_TRACE_END("chain", "connect_block");
+
   return entry;
 }
 
 static void
 btc_chain_handle_orphans(btc_chain_t *chain, const btc_entry_t *entry) {
   btc_orphan_t *orphan = btc_chain_resolve_orphan(chain, entry->hash);
+  btc_block_t *block;
 
   while (orphan != NULL) {
-    entry = btc_chain_connect(chain, entry, orphan->block, orphan->flags);
+    block = btc_chain_read_orphan(chain, orphan);
 
-    btc_orphan_destroy(orphan);
+    if (block == NULL) {
+      btc_chain_log(chain, "Could not read orphan block: %H.", orphan->hash);
+      btc_chain_unlink_orphan(chain, orphan);
+      break;
+    }
+
+    entry = btc_chain_connect(chain, entry, block, orphan->flags);
+
+    btc_block_destroy(block);
 
     if (entry == NULL) {
       btc_chain_log(chain,
@@ -1911,9 +2961,13 @@ btc_chain_handle_orphans(btc_chain_t *chain, const btc_entry_t *entry) {
       if (chain->on_badorphan != NULL)
         chain->on_badorphan(&chain->error, orphan->id, chain->arg);
 
+      btc_chain_unlink_orphan(chain, orphan);
+
       break;
     }
 
+    btc_chain_unlink_orphan(chain, orphan);
+
     btc_chain_log(chain,
       "Orphan block was resolved: %H (%d).",
       entry->hash, entry->height);
@@ -1922,11 +2976,11 @@ btc_chain_handle_orphans(btc_chain_t *chain, const btc_entry_t *entry) {
   }
 }
 
-int
-btc_chain_add(btc_chain_t *chain,
-              const btc_block_t *block,
-              unsigned int flags,
-              unsigned int id) {
+static int
+btc_chain__add(btc_chain_t *chain,
+               const btc_block_t *block,
+               unsigned int flags,
+               unsigned int id) {
   const btc_network_t *network = chain->network;
   const btc_header_t *hdr = &block->header;
   const btc_entry_t *prev, *entry;
@@ -1943,7 +2997,7 @@ btc_chain_add(btc_chain_t *chain,
   /* If the block is already known to be
      an orphan, ignore it. */
   if (btc_chain_has_orphan(chain, hash)) {
-    btc_chain_log(chain, "Already have orphan block: %H.", hash);
+    btc_chain_debug(chain, "Already have orphan block: %H.", hash);
     return btc_chain_throw(chain, hdr, "duplicate", "duplicate", 0, 0);
   }
 
@@ -1961,7 +3015,7 @@ btc_chain_add(btc_chain_t *chain,
 
   /* Do we already have this block? */
   if (btc_chaindb_by_hash(chain->db, hash) != NULL) {
-    btc_chain_log(chain, "Already have block: %H.", hash);
+    btc_chain_debug(chain, "Already have block: %H.", hash);
     return btc_chain_throw(chain, hdr, "duplicate", "duplicate", 0, 0);
   }
 
@@ -1988,6 +3042,151 @@ btc_chain_add(btc_chain_t *chain,
   return 1;
 }
 
+int
+btc_chain_add(btc_chain_t *chain,
+              const btc_block_t *block,
+              unsigned int flags,
+              unsigned int id) {
+  int tag, ret;
+
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_CHAIN);
+
+  ret = btc_chain__add(chain, block, flags, id);
+
+  BTC_MEMTAG_POP(tag);
+
+  return ret;
+}
+
+/*
+ * Replay
+ */
+
+static void
+btc_chain_replay_data(btc_chain_t *chain,
+                      const uint8_t *xp,
+                      size_t xn,
+                      btc_replay_t *stats) {
+  uint32_t magic = chain->network->magic;
+  btc_block_t *block;
+  size_t i, hdr, size;
+
+  /* Both our own records (a 24 byte message header)
+     and bitcoind's (magic and length) are accepted.
+     Anything else, e.g. zeroed preallocation, is
+     skipped a byte at a time until the next magic. */
+  while (xn >= 8) {
+    if (btc_read32le(xp) != magic) {
+      xp += 1;
+      xn -= 1;
+      continue;
+    }
+
+    if (xn >= 24 && btc_read32le(xp + 4) == 0x636f6c62) {
+      hdr = 24;
+      size = btc_read32le(xp + 16);
+    } else {
+      hdr = 8;
+      size = btc_read32le(xp + 4);
+    }
+
+    if (size > xn - hdr)
+      break;
+
+    block = btc_block_decode(xp + hdr, size);
+
+    xp += hdr + size;
+    xn -= hdr + size;
+
+    if (block == NULL) {
+      stats->skipped++;
+      continue;
+    }
+
+    if (btc_chain_add(chain, block, BTC_BLOCK_DEFAULT_FLAGS, 0)) {
+      stats->blocks++;
+      stats->txs += block->txs.length;
+
+      for (i = 1; i < block->txs.length; i++)
+        stats->inputs += block->txs.items[i]->inputs.length;
+    } else {
+      stats->skipped++;
+    }
+
+    btc_block_destroy(block);
+  }
+}
+
+int
+btc_chain_replay(btc_chain_t *chain,
+                 const char *dir,
+                 int scripts,
+                 btc_replay_t *stats) {
+  int64_t start = btc_time_nsec();
+  char path[BTC_PATH_MAX];
+  char name[32];
+  uint8_t *data;
+  size_t len;
+  int id;
+
+  memset(stats, 0, sizeof(*stats));
+
+  chain->skip_scripts = !scripts;
+
+  for (id = 0; id < 100000; id++) {
+    sprintf(name, "blk%.5d.dat", id);
+
+    if (!btc_path_join(path, sizeof(path), dir, name, 0))
+      break;
+
+    if (!btc_fs_exists(path))
+      break;
+
+    btc_chain_log(chain, "Replaying %s.", path);
+
+    if (!btc_fs_alloc_file(&data, &len, path))
+      continue;
+
+    btc_chain_replay_data(chain, data, len, stats);
+
+    stats->files += 1;
+    stats->bytes += len;
+
+    free(data);
+  }
+
+  chain->skip_scripts = 0;
+
+  stats->elapsed = btc_time_nsec() - start;
+
+  return stats->files > 0;
+}
+
+int
+btc_chain_reindex(btc_chain_t *chain, btc_replay_t *stats) {
+  char path[BTC_PATH_MAX];
+
+  memset(stats, 0, sizeof(*stats));
+
+  if (!btc_chaindb_reindex_path(chain->db, path, sizeof(path)))
+    return 0;
+
+  if (!btc_fs_exists(path))
+    return 0;
+
+  btc_chain_log(chain, "Reindexing from %s.", path);
+
+  btc_chain_replay(chain, path, 1, stats);
+
+  /* Flush before the originals go away. */
+  if (!btc_chaindb_flush(chain->db))
+    return 0;
+
+  btc_chaindb_reindex_done(chain->db);
+
+  return 1;
+}
+
 const btc_entry_t *
 btc_chain_tip(btc_chain_t *chain) {
   return chain->tip;
@@ -1998,6 +3197,11 @@ btc_chain_height(btc_chain_t *chain) {
   return chain->height;
 }
 
+btc_workers_t *
+btc_chain_workers(btc_chain_t *chain) {
+  return chain->workers;
+}
+
 const btc_deployment_state_t *
 btc_chain_state(btc_chain_t *chain) {
   return &chain->state;
@@ -2010,12 +3214,35 @@ btc_chain_error(btc_chain_t *chain) {
 
 double
 btc_chain_progress(btc_chain_t *chain) {
+  const btc_entry_t *tip = chain->tip;
   int64_t now = btc_timedata_now(chain->timedata);
   int64_t start = chain->network->genesis.header.time;
-  int64_t current = chain->tip->header.time - start;
+  int64_t current = tip->header.time - start;
   int64_t end = (now - start) - 40 * 60;
+  const btc_entry_t *base;
+  double rate, remaining;
   double progress;
 
+  /* Count transactions rather than seconds: the
+     transaction rate over the last 4096 blocks is
+     extrapolated to estimate what remains. */
+  base = btc_entry_get_ancestor(tip, tip->height > 4096
+                                   ? tip->height - 4096
+                                   : 0);
+
+  if (tip->chain_tx > base->chain_tx
+      && tip->header.time > base->header.time) {
+    rate = (double)(tip->chain_tx - base->chain_tx)
+         / (double)(tip->header.time - base->header.time);
+
+    remaining = rate * (double)(now - tip->header.time);
+
+    if (remaining < 0.0)
+      remaining = 0.0;
+
+    return (double)tip->chain_tx / ((double)tip->chain_tx + remaining);
+  }
+
   if (end < 1)
     end = 1;
 
@@ -2027,6 +3254,36 @@ btc_chain_progress(btc_chain_t *chain) {
   return progress;
 }
 
+void
+btc_chain_sync_stats(btc_chain_t *chain, btc_hist_t *hist) {
+  btc_chaindb_sync_stats(chain->db, hist);
+}
+
+void
+btc_chain_counters(btc_chain_t *chain, btc_dbstats_t *stats) {
+  btc_chaindb_counters(chain->db, stats);
+}
+
+void
+btc_chain_stats(btc_chain_t *chain, btc_dbstats_t *stats) {
+  btc_chaindb_stats(chain->db, stats);
+}
+
+int
+btc_chain_utxo_stats(btc_chain_t *chain, btc_utxostats_t *stats) {
+  return btc_chaindb_utxo_stats(chain->db, stats);
+}
+
+char *
+btc_chain_structure(btc_chain_t *chain) {
+  return btc_chaindb_structure(chain->db);
+}
+
+const btc_dbtune_t *
+btc_chain_tune(btc_chain_t *chain) {
+  return btc_chaindb_tune(chain->db);
+}
+
 int
 btc_chain_synced(btc_chain_t *chain) {
   return chain->synced;
@@ -2037,6 +3294,109 @@ btc_chain_pruned(btc_chain_t *chain) {
   return (chain->flags & BTC_CHAIN_PRUNE) != 0;
 }
 
+int32_t
+btc_chain_assumed(btc_chain_t *chain) {
+  return chain->assumed;
+}
+
+int
+btc_chain_assume_locator(btc_chain_t *chain, uint8_t *start, uint8_t *stop) {
+  const btc_assume_t *assume = &chain->assume;
+
+  if (!chain->assume_valid || assume->done)
+    return 0;
+
+  if (chain->assume_height >= 0 && chain->height >= chain->assume_height)
+    return 0;
+
+  if (assume->length > 0)
+    memcpy(start, btc_assume_get(assume, assume->base + assume->length - 1), 32);
+  else
+    memcpy(start, chain->tip->hash, 32);
+
+  memcpy(stop, chain->assume_hash, 32);
+
+  return 1;
+}
+
+int
+btc_chain_add_assumed(btc_chain_t *chain,
+                      btc_header_t **items,
+                      const uint8_t *hashes,
+                      size_t length) {
+  /* Headers toward the assumed-valid block. Their
+     proof of work has been checked against their
+     own targets by the caller. */
+  btc_assume_t *assume = &chain->assume;
+  uint8_t start[32], stop[32];
+  size_t i;
+
+  if (!btc_chain_assume_locator(chain, start, stop))
+    return 1;
+
+  for (i = 0; i < length; i++) {
+    const btc_header_t *hdr = items[i];
+    const uint8_t *hash = hashes + i * 32;
+    int32_t height;
+
+    if (assume->length == 0) {
+      const btc_entry_t *entry = btc_chaindb_by_hash(chain->db,
+                                                     hdr->prev_block);
+
+      if (entry == NULL || !btc_chaindb_is_main(chain->db, entry))
+        return 0;
+
+      assume->base = entry->height;
+
+      btc_assume_push(assume, entry->hash, entry->header.bits);
+
+      /* The anchor carries the work of the whole chain below it. */
+      memcpy(assume->work, entry->chainwork, 32);
+    } else if (memcmp(hdr->prev_block, start, 32) != 0) {
+      return 0;
+    }
+
+    btc_assume_push(assume, hash, hdr->bits);
+
+    memcpy(start, hash, 32);
+
+    height = assume->base + assume->length - 1;
+
+    if (memcmp(hash, chain->assume_hash, 32) == 0) {
+      if (chain->assume_height >= 0 && height != chain->assume_height) {
+        btc_chain_drop_assumed(chain, "found at the wrong height");
+        return 1;
+      }
+
+      /* A cheap fork of our own making proves nothing. */
+      if (btc_hash_compare(assume->work, chain->network->pow.chainwork) < 0) {
+        btc_chain_drop_assumed(chain, "not enough chainwork");
+        return 1;
+      }
+
+      btc_chain_log(chain, "Found assumed-valid block %H in the"
+                           " header chain (height=%d).", hash, height);
+
+      chain->assume_height = height;
+
+      assume->done = 1;
+
+      return 1;
+    }
+
+    if (chain->assume_height >= 0 && height >= chain->assume_height) {
+      btc_chain_drop_assumed(chain, "not in the header chain");
+      return 1;
+    }
+  }
+
+  /* A short batch means the peer has no more. */
+  if (length < 2000)
+    btc_chain_drop_assumed(chain, "not in the header chain");
+
+  return 1;
+}
+
 int
 btc_chain_has_hash(btc_chain_t *chain, const uint8_t *hash) {
   return btc_chaindb_by_hash(chain->db, hash) != NULL;
@@ -2057,6 +3417,11 @@ btc_chain_is_main(btc_chain_t *chain, const btc_entry_t *entry) {
   return btc_chaindb_is_main(chain->db, entry);
 }
 
+int64_t
+btc_chain_median_time(btc_chain_t *chain, const btc_entry_t *entry) {
+  return btc_chaindb_median_time(chain->db, entry);
+}
+
 int
 btc_chain_has_coins(btc_chain_t *chain, const btc_tx_t *tx) {
   return btc_chaindb_has_coins(chain->db, tx);
@@ -2074,6 +3439,16 @@ btc_chain_get_block(btc_chain_t *chain, const btc_entry_t *entry) {
   return btc_chaindb_get_block(chain->db, entry);
 }
 
+btc_undo_t *
+btc_chain_get_undo(btc_chain_t *chain, const btc_entry_t *entry) {
+  return btc_chaindb_get_undo(chain->db, entry);
+}
+
+int
+btc_chain_has_undo(btc_chain_t *chain, const btc_entry_t *entry) {
+  return btc_chaindb_has_undo(chain->db, entry);
+}
+
 int
 btc_chain_get_raw_block(btc_chain_t *chain,
                         uint8_t **data,
@@ -2082,6 +3457,105 @@ btc_chain_get_raw_block(btc_chain_t *chain,
   return btc_chaindb_get_raw_block(chain->db, data, length, entry);
 }
 
+const uint8_t *
+btc_chain_map_raw_block(btc_chain_t *chain,
+                        size_t *length,
+                        const btc_entry_t *entry) {
+  return btc_chaindb_map_raw_block(chain->db, length, entry);
+}
+
+int
+btc_chain_get_raw_undo(btc_chain_t *chain,
+                       uint8_t **data,
+                       size_t *length,
+                       const btc_entry_t *entry) {
+  return btc_chaindb_get_raw_undo(chain->db, data, length, entry);
+}
+
+const uint8_t *
+btc_chain_map_raw_undo(btc_chain_t *chain,
+                       size_t *length,
+                       const btc_entry_t *entry) {
+  return btc_chaindb_map_raw_undo(chain->db, length, entry);
+}
+
+btc_undo_t *
+btc_chain_decode_undo(const uint8_t *data,
+                      size_t length,
+                      const btc_entry_t *entry) {
+  return btc_chaindb_decode_undo(data, length, entry->height);
+}
+
+btc_blockfile_t *
+btc_chain_open_raw_block(btc_chain_t *chain,
+                         int64_t *pos,
+                         size_t *length,
+                         const btc_entry_t *entry) {
+  return btc_chaindb_open_raw_block(chain->db, pos, length, entry);
+}
+
+int
+btc_chain_get_raw_tx(btc_chain_t *chain,
+                     uint8_t **data,
+                     size_t *length,
+                     const btc_entry_t **entry,
+                     const uint8_t *hash) {
+  return btc_chaindb_get_raw_tx(chain->db, data, length, entry, hash);
+}
+
+btc_tx_t *
+btc_chain_get_tx(btc_chain_t *chain,
+                 const btc_entry_t **entry,
+                 const uint8_t *hash) {
+  return btc_chaindb_get_tx(chain->db, entry, hash);
+}
+
+void
+btc_chain_snapshot(btc_chain_t *chain, btc_chaintip_t *tip) {
+  /* Safe from any thread. A copy racing with a publish
+     is detected by the sequence and simply retried; the
+     chain never waits on us. Entries are immutable once
+     published and live as long as the chain. */
+  long seq;
+
+  for (;;) {
+    seq = btc_atomic_load(&chain->seq);
+
+    if (seq & 1)
+      continue;
+
+    *tip = chain->published;
+
+    btc_atomic_fence();
+
+    if (btc_atomic_load(&chain->seq) == seq)
+      break;
+  }
+}
+
+const btc_entry_t *
+btc_chaintip_by_height(const btc_chaintip_t *tip, int32_t height) {
+  if (tip->entry == NULL || height < 0 || height > tip->height)
+    return NULL;
+
+  return btc_entry_get_ancestor(tip->entry, height);
+}
+
+int
+btc_chaintip_is_main(const btc_chaintip_t *tip, const btc_entry_t *entry) {
+  return btc_chaintip_by_height(tip, entry->height) == entry;
+}
+
+btc_chainreader_t *
+btc_chain_reader(btc_chain_t *chain) {
+  return btc_chainreader_create(chain->db);
+}
+
+btc_coinscan_t *
+btc_chain_coinscan(btc_chain_t *chain) {
+  return btc_coinscan_create(chain->db);
+}
+
 const uint8_t *
 btc_chain_get_orphan_root(btc_chain_t *chain, const uint8_t *hash) {
   const uint8_t *root = NULL;
@@ -2094,7 +3568,7 @@ btc_chain_get_orphan_root(btc_chain_t *chain, const uint8_t *hash) {
       break;
 
     root = hash;
-    hash = orphan->block->header.prev_block;
+    hash = orphan->header.prev_block;
   }
 
   return root;
@@ -12,36 +12,47 @@
 #include <lsm.h>
 
 #include <io/core.h>
+#include <io/trace.h>
 #include <mako/block.h>
 #include <mako/coins.h>
 #include <mako/consensus.h>
 #include <mako/crypto/hash.h>
+#include <mako/crypto/rand.h>
+#include <mako/crypto/siphash.h>
+#include <mako/encoding.h>
 #include <mako/entry.h>
+#include <mako/header.h>
 #include <mako/list.h>
 #include <mako/map.h>
+#include <mako/muhash.h>
 #include <mako/network.h>
+#include <mako/array.h>
+#include <mako/script.h>
 #include <mako/tx.h>
 #include <mako/util.h>
 #include <mako/vector.h>
 #include <node/chaindb.h>
+#include <node/perf.h>
 
 #include "../bio.h"
 #include "../impl.h"
 #include "../internal.h"
+#include "../slab.h"
 
 /*
  * Options
  */
 
-#undef USE_WORKER
-#undef USE_CKPTR
-
-#if defined(USE_CKPTR) && !defined(USE_WORKER)
-#  error "invalid options"
+/* LevelDB (lsm2) and LMDB (lsm3) implement the LSM
+   API without its merge and checkpoint machinery. */
+#if !defined(LSM_LEVELDB) && !defined(LSM_LMDB)
+#  define USE_NATIVE
 #endif
 
-#if defined(USE_WORKER) && defined(LSM_LEVELDB)
-#  error "invalid options"
+/* The background merge worker and checkpointer
+   (BTC_CHAIN_WORKER) need the native LSM backend. */
+#ifdef USE_NATIVE
+#  define USE_WORKER
 #endif
 
 /*
@@ -51,6 +62,14 @@
 #define WRITE_FLAGS (BTC_O_RDWR | BTC_O_CREAT | BTC_O_APPEND)
 #define READ_FLAGS (BTC_O_RDONLY | BTC_O_RANDOM)
 #define MAX_FILE_SIZE (128 << 20)
+#define BLOCK_CHUNK_SIZE (16 << 20)
+#define UNDO_CHUNK_SIZE (1 << 20)
+#define MAX_HANDLES 8
+#define DEFAULT_CACHE_SIZE ((size_t)450 << 20)
+#define FLUSH_INTERVAL (60 * 60)
+#define SAVE_BATCH 64
+#define WRITER_LIMIT ((size_t)64 << 20)
+#define UNDO_DELTA 0x6f646e75 /* "undo" */
 
 /*
  * LSM Helpers
@@ -91,7 +110,11 @@ lsm_csr_le(lsm_cursor *cur, const void *kp, int kn) {
 }
 
 static int
-lsm_connect(lsm_db **lsm, const char *path) {
+lsm_connect(lsm_db **lsm,
+            const char *path,
+            const btc_dbtune_t *tune,
+            int worker,
+            int readonly) {
   lsm_db *db = NULL;
   int rc, op;
 
@@ -101,58 +124,90 @@ lsm_connect(lsm_db **lsm, const char *path) {
     return rc;
 
 #ifdef LSM_LEVELDB
-  op = 64 * 1024; /* default = 8mb */
+  op = tune->cache_size; /* default = 8mb */
   rc = lsm_config(db, LSM_CONFIG_CACHE_SIZE, &op);
 
   if (rc != LSM_OK)
     goto done;
 
-  op = 32 * 1024; /* default = 4mb */
+  op = tune->buffer_size; /* default = 4mb */
   rc = lsm_config(db, LSM_CONFIG_BUFFER_SIZE, &op);
 
   if (rc != LSM_OK)
     goto done;
-#endif
 
-#ifdef USE_WORKER
-  op = 4 * 1024; /* default = 1mb */
+  (void)worker;
+#elif defined(USE_WORKER)
+  /* A worker merges in the background: flush and
+     checkpoint in larger steps, with fewer segments
+     allowed to pile up per level. */
+  op = tune->autoflush; /* default = 1mb */
+
+  if (worker)
+    op *= 4;
+
   rc = lsm_config(db, LSM_CONFIG_AUTOFLUSH, &op);
 
   if (rc != LSM_OK)
     goto done;
 
-  op = 8 * 1024; /* default = 2mb */
+  op = tune->autocheckpoint; /* default = 2mb */
+
+  if (worker)
+    op *= 4;
+
   rc = lsm_config(db, LSM_CONFIG_AUTOCHECKPOINT, &op);
 
   if (rc != LSM_OK)
     goto done;
 
-  op = 2; /* default = 4 */
+  op = tune->automerge; /* default = 4 */
+
+  if (worker && (op /= 2) < 2)
+    op = 2;
+
   rc = lsm_config(db, LSM_CONFIG_AUTOMERGE, &op);
 
   if (rc != LSM_OK)
     goto done;
+
+  if (worker) {
+    op = 0; /* default = 1 */
+    rc = lsm_config(db, LSM_CONFIG_AUTOWORK, &op);
+
+    if (rc != LSM_OK)
+      goto done;
+  }
+#else
+  (void)worker;
 #endif
 
-  op = 0; /* default = 1 */
+  op = tune->mmap; /* default = 1 */
   rc = lsm_config(db, LSM_CONFIG_MMAP, &op);
 
   if (rc != LSM_OK)
     goto done;
 
-  op = 0; /* default = 1 */
+  /* Replicas coordinate with the primary through shared
+     memory and file locks. Otherwise we are the only
+     process and can do without either. */
+  op = tune->shared || readonly; /* default = 1 */
   rc = lsm_config(db, LSM_CONFIG_MULTIPLE_PROCESSES, &op);
 
   if (rc != LSM_OK)
     goto done;
 
-#ifdef USE_WORKER
-  op = 0; /* default = 1 */
-  rc = lsm_config(db, LSM_CONFIG_AUTOWORK, &op);
+  op = readonly; /* default = 0 */
+  rc = lsm_config(db, LSM_CONFIG_READONLY, &op);
+
+  if (rc != LSM_OK)
+    goto done;
+
+  op = tune->safety; /* default = 1 */
+  rc = lsm_config(db, LSM_CONFIG_SAFETY, &op);
 
   if (rc != LSM_OK)
     goto done;
-#endif
 
   rc = lsm_open(db, path);
 
@@ -168,16 +223,68 @@ done:
   return rc;
 }
 
+static int
+lsm_tune(lsm_db *db, const btc_dbtune_t *tune, int bulk, int worker) {
+#ifdef USE_NATIVE
+  int rc, op;
+
+  /* During the initial sync, buffer far more in memory, merge
+     larger runs and only checkpoint when the coins are flushed.
+     With a worker, merging and checkpointing are its business. */
+  if (bulk)
+    op = tune->bulk_flush;
+  else
+    op = worker ? 4 * tune->autoflush : tune->autoflush;
+
+  rc = lsm_config(db, LSM_CONFIG_AUTOFLUSH, &op);
+
+  if (rc != LSM_OK || worker)
+    return rc;
+
+  op = bulk ? 0 : tune->autocheckpoint;
+  rc = lsm_config(db, LSM_CONFIG_AUTOCHECKPOINT, &op);
+
+  if (rc != LSM_OK)
+    return rc;
+
+  op = bulk ? 2 * tune->automerge : tune->automerge;
+  rc = lsm_config(db, LSM_CONFIG_AUTOMERGE, &op);
+
+  if (rc != LSM_OK)
+    return rc;
+
+  if (!bulk)
+    return lsm_checkpoint(db, NULL);
+
+  return LSM_OK;
+#else
+  (void)db;
+  (void)tune;
+  (void)bulk;
+  (void)worker;
+  return LSM_OK;
+#endif
+}
+
 /*
  * LSM Worker
  */
 
 #ifdef USE_WORKER
+/* Merging and checkpointing run on connections
+ * of their own. Writers never sleep-poll: they
+ * kick a thread and wait on its `done` condition
+ * until it completes a pass, then re-check. Every
+ * wait also ends once the thread is stopping.
+ */
+
 typedef struct lsm_worker_s {
   lsm_db *conn;
   btc_thread_t *thread;
   btc_cond_t *cond;
+  btc_cond_t *done;
   btc_mutex_t *lock;
+  unsigned int passes;
   int autockpt;
   int work;
   int stop;
@@ -189,7 +296,9 @@ lsm_worker_init(lsm_worker *w) {
   w->conn = NULL;
   w->thread = btc_thread_alloc();
   w->cond = btc_cond_create();
+  w->done = btc_cond_create();
   w->lock = btc_mutex_create();
+  w->passes = 0;
   w->autockpt = -1;
   w->work = 0;
   w->stop = 0;
@@ -200,15 +309,22 @@ static void
 lsm_worker_clear(lsm_worker *w) {
   btc_thread_free(w->thread);
   btc_cond_destroy(w->cond);
+  btc_cond_destroy(w->done);
   btc_mutex_destroy(w->lock);
 }
 
 static int
-lsm_worker_start(lsm_worker *w, const char *path, void (*start)(void *)) {
-  int rc = lsm_connect(&w->conn, path);
+lsm_worker_start(lsm_worker *w,
+                 const char *path,
+                 const btc_dbtune_t *tune,
+                 void (*start)(void *)) {
+  int rc = lsm_connect(&w->conn, path, tune, 1, 0);
 
   if (rc == LSM_OK) {
     w->autockpt = -1;
+    w->passes = 0;
+    w->work = 0;
+    w->stop = 0;
 
     CHECK(lsm_config(w->conn, LSM_CONFIG_AUTOCHECKPOINT, &w->autockpt) == 0);
 
@@ -225,11 +341,14 @@ lsm_worker_stop(lsm_worker *w) {
   w->stop = 1;
 
   btc_cond_signal(w->cond);
+  btc_cond_broadcast(w->done);
   btc_mutex_unlock(w->lock);
 
   btc_thread_join(w->thread);
 
   CHECK(lsm_close(w->conn) == 0);
+
+  w->conn = NULL;
 }
 
 static void
@@ -242,6 +361,47 @@ lsm_worker_signal(lsm_worker *w) {
   btc_mutex_unlock(w->lock);
 }
 
+static unsigned int
+lsm_worker_passes(lsm_worker *w) {
+  unsigned int passes;
+
+  btc_mutex_lock(w->lock);
+
+  passes = w->passes;
+
+  btc_mutex_unlock(w->lock);
+
+  return passes;
+}
+
+static void
+lsm_worker_await(lsm_worker *w, unsigned int passes) {
+  /* Kick the thread and wait for a pass to finish. */
+  btc_mutex_lock(w->lock);
+
+  w->work = 1;
+
+  btc_cond_signal(w->cond);
+
+  while (!w->stop && w->passes == passes)
+    btc_cond_wait(w->done, w->lock);
+
+  btc_mutex_unlock(w->lock);
+}
+
+static void
+lsm_worker_idle(lsm_worker *w) {
+  /* Called with the lock held after each pass. */
+  w->passes++;
+
+  btc_cond_broadcast(w->done);
+
+  if (!w->stop && !w->work)
+    btc_cond_wait(w->cond, w->lock);
+
+  w->work = 0;
+}
+
 static void
 lsm_worker_ckpt(void *arg) {
   lsm_worker *w = (lsm_worker *)arg;
@@ -255,18 +415,18 @@ lsm_worker_ckpt(void *arg) {
     kb = 0;
     rc = lsm_info(w->conn, LSM_INFO_CHECKPOINT_SIZE, &kb);
 
-    if (rc == LSM_OK && kb >= (w->autockpt / 4))
+    if (rc == LSM_OK && kb >= (w->autockpt / 4)) {
+      BTC_TRACE_BEGIN("lsm", "checkpoint");
       rc = lsm_checkpoint(w->conn, 0);
+      BTC_TRACE_END("lsm", "checkpoint");
+    }
 
     if (rc != LSM_OK && rc != LSM_BUSY)
       btc_abort(); /* LCOV_EXCL_LINE */
 
     btc_mutex_lock(w->lock);
 
-    if (!w->stop && !w->work)
-      btc_cond_wait(w->cond, w->lock);
-
-    w->work = 0;
+    lsm_worker_idle(w);
   }
 
   btc_mutex_unlock(w->lock);
@@ -274,18 +434,23 @@ lsm_worker_ckpt(void *arg) {
 
 static int
 lsm_worker_barrier(lsm_worker *w, lsm_db *db) {
+  /* Keep uncheckpointed data bounded. */
+  unsigned int passes;
   int kb, rc;
 
   for (;;) {
+    passes = lsm_worker_passes(w);
+
     kb = 0;
     rc = lsm_info(db, LSM_INFO_CHECKPOINT_SIZE, &kb);
 
     if (rc != LSM_OK || kb < w->autockpt)
       break;
 
-    lsm_worker_signal(w);
+    lsm_worker_await(w, passes);
 
-    btc_time_sleep(5);
+    if (w->stop)
+      break;
   }
 
   return rc;
@@ -294,38 +459,36 @@ lsm_worker_barrier(lsm_worker *w, lsm_db *db) {
 static void
 lsm_worker_work(void *arg) {
   lsm_worker *w = (lsm_worker *)arg;
-  int ckpt = (w->ckptr != NULL);
   int nwrite, rc;
   int val = 0;
 
   btc_mutex_lock(w->lock);
 
-  if (ckpt)
-    CHECK(lsm_config(w->conn, LSM_CONFIG_AUTOCHECKPOINT, &val) == 0);
+  /* The checkpointer does all checkpointing. */
+  CHECK(lsm_config(w->conn, LSM_CONFIG_AUTOCHECKPOINT, &val) == 0);
 
   while (!w->stop) {
     btc_mutex_unlock(w->lock);
 
     do {
-      if (ckpt)
-        lsm_worker_barrier(w->ckptr, w->conn);
+      lsm_worker_barrier(w->ckptr, w->conn);
 
       nwrite = 0;
+
+      BTC_TRACE_BEGIN("lsm", "merge");
       rc = lsm_work(w->conn, 0, 256, &nwrite);
+      BTC_TRACE_END("lsm", "merge");
 
       if (rc != LSM_OK && rc != LSM_BUSY)
         btc_abort(); /* LCOV_EXCL_LINE */
 
-      if (ckpt && nwrite > 0)
+      if (nwrite > 0)
         lsm_worker_signal(w->ckptr);
     } while (nwrite > 0);
 
     btc_mutex_lock(w->lock);
 
-    if (!w->stop && !w->work)
-      btc_cond_wait(w->cond, w->lock);
-
-    w->work = 0;
+    lsm_worker_idle(w);
   }
 
   btc_mutex_unlock(w->lock);
@@ -333,6 +496,10 @@ lsm_worker_work(void *arg) {
 
 static int
 lsm_worker_wait(lsm_worker *w, lsm_db *db) {
+  /* Back-pressure: hold writers while an old
+     in-memory tree is waiting to be flushed
+     and the live one has reached half size. */
+  unsigned int passes;
   int rc, old, new;
   int limit = -1;
 
@@ -342,6 +509,8 @@ lsm_worker_wait(lsm_worker *w, lsm_db *db) {
     return rc;
 
   for (;;) {
+    passes = lsm_worker_passes(w);
+
     rc = lsm_info(db, LSM_INFO_TREE_SIZE, &old, &new);
 
     if (rc != LSM_OK)
@@ -350,9 +519,7 @@ lsm_worker_wait(lsm_worker *w, lsm_db *db) {
     if (old == 0 || new < (limit / 2))
       break;
 
-    lsm_worker_signal(w);
-
-    btc_time_sleep(5);
+    lsm_worker_await(w, passes);
   }
 
   return rc;
@@ -375,6 +542,10 @@ lsm_worker_hook(lsm_db *db, void *arg) {
 static const uint8_t meta_key[1] = {'R'};
 static const uint8_t blockfile_key[1] = {'B'};
 static const uint8_t undofile_key[1] = {'U'};
+static const uint8_t state_key[1] = {'S'};
+static const uint8_t txindex_key[1] = {'T'};
+static const uint8_t coinstats_key[1] = {'M'};
+static const uint8_t layout_key[1] = {'L'};
 
 #define ENTRY_PREFIX 'e'
 #define ENTRY_KEYLEN 33
@@ -404,7 +575,7 @@ entry_key(uint8_t *key, const uint8_t *hash) {
 #define TIP_PREFIX 'p'
 #define TIP_KEYLEN 33
 
-BTC_UNUSED static const uint8_t tip_min[TIP_KEYLEN] = {
+static const uint8_t tip_min[TIP_KEYLEN] = {
   TIP_PREFIX,
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -412,7 +583,7 @@ BTC_UNUSED static const uint8_t tip_min[TIP_KEYLEN] = {
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
-BTC_UNUSED static const uint8_t tip_max[TIP_KEYLEN] = {
+static const uint8_t tip_max[TIP_KEYLEN] = {
   TIP_PREFIX,
   0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
   0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
@@ -445,7 +616,7 @@ file_key(uint8_t *key, uint8_t type, uint32_t id) {
 #define COIN_PREFIX 'c'
 #define COIN_KEYLEN 37
 
-BTC_UNUSED static const uint8_t coin_min[COIN_KEYLEN] = {
+static const uint8_t coin_min[COIN_KEYLEN] = {
   COIN_PREFIX,
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -454,7 +625,7 @@ BTC_UNUSED static const uint8_t coin_min[COIN_KEYLEN] = {
   0x00, 0x00, 0x00, 0x00
 };
 
-BTC_UNUSED static const uint8_t coin_max[COIN_KEYLEN] = {
+static const uint8_t coin_max[COIN_KEYLEN] = {
   COIN_PREFIX,
   0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
   0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
@@ -470,6 +641,196 @@ coin_key(uint8_t *key, const uint8_t *hash, uint32_t index) {
   btc_write32be(key + 33, index);
 }
 
+#define GROUP_PREFIX 'g'
+#define GROUP_KEYLEN 9
+
+static const uint8_t group_min[GROUP_KEYLEN] =
+  {GROUP_PREFIX, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+static const uint8_t group_max[GROUP_KEYLEN] =
+  {GROUP_PREFIX, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+#define TX_PREFIX 't'
+#define TX_KEYLEN 33
+
+static const uint8_t tx_min[TX_KEYLEN] = {
+  TX_PREFIX,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const uint8_t tx_max[TX_KEYLEN] = {
+  TX_PREFIX,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static void
+tx_key(uint8_t *key, const uint8_t *hash) {
+  key[0] = TX_PREFIX;
+  memcpy(key + 1, hash, 32);
+}
+
+#define DEPLOY_PREFIX 'v'
+#define DEPLOY_KEYLEN 34
+#define DEPLOY_VALLEN 25
+
+static void
+deploy_key(uint8_t *key, int bit, const uint8_t *hash) {
+  key[0] = DEPLOY_PREFIX;
+  key[1] = (uint8_t)bit;
+  memcpy(key + 2, hash, 32);
+}
+
+static void
+deploy_value(uint8_t *val, const btc_deployment_t *deploy, int state) {
+  /* The parameters are kept alongside the state
+     so that a changed deployment is recomputed. */
+  val[0] = (uint8_t)state;
+  btc_write64le(val + 1, deploy->start_time);
+  btc_write64le(val + 9, deploy->timeout);
+  btc_write32le(val + 17, deploy->threshold);
+  btc_write32le(val + 21, deploy->window);
+}
+
+/*
+ * Transaction Location
+ */
+
+#define BTC_TXLOC_SIZE 20
+
+typedef struct btc_txloc_s {
+  uint8_t hash[32];
+  int32_t height;
+  int32_t file;
+  int32_t pos;
+  uint32_t offset;
+  uint32_t length;
+} btc_txloc_t;
+
+static void
+btc_txloc_export(uint8_t *zp, const btc_txloc_t *x) {
+  btc_write32le(zp +  0, x->height);
+  btc_write32le(zp +  4, x->file);
+  btc_write32le(zp +  8, x->pos);
+  btc_write32le(zp + 12, x->offset);
+  btc_write32le(zp + 16, x->length);
+}
+
+static int
+btc_txloc_import(btc_txloc_t *z, const uint8_t *xp, size_t xn) {
+  if (xn != BTC_TXLOC_SIZE)
+    return 0;
+
+  z->height = (int32_t)btc_read32le(xp +  0);
+  z->file = (int32_t)btc_read32le(xp +  4);
+  z->pos = (int32_t)btc_read32le(xp +  8);
+  z->offset = btc_read32le(xp + 12);
+  z->length = btc_read32le(xp + 16);
+
+  return 1;
+}
+
+static int
+txloc_cmp(const void *xp, const void *yp) {
+  const btc_txloc_t *x = *((const btc_txloc_t **)xp);
+  const btc_txloc_t *y = *((const btc_txloc_t **)yp);
+
+  return memcmp(x->hash, y->hash, 32);
+}
+
+/*
+ * Coin Statistics
+ */
+
+/* A running commitment to the coin set (its MuHash3072)
+ * along with the number of coins and their total value.
+ * Coins are serialized as in Bitcoin Core's coinstats
+ * index so that the digests can be compared:
+ *
+ *   hash[32] index[4] (height << 1 | coinbase)[4] output
+ */
+
+#define BTC_COINSTATS_SIZE (BTC_MUHASH_SIZE * 2 + 16)
+
+typedef struct btc_coinstats_s {
+  btc_muhash_t muhash;
+  uint64_t count;
+  int64_t amount;
+} btc_coinstats_t;
+
+static void
+btc_coinstats_init(btc_coinstats_t *z) {
+  btc_muhash_init(&z->muhash);
+
+  z->count = 0;
+  z->amount = 0;
+}
+
+static void
+btc_coinstats_export(uint8_t *zp, const btc_coinstats_t *x) {
+  memcpy(zp, x->muhash.num, BTC_MUHASH_SIZE);
+  memcpy(zp + BTC_MUHASH_SIZE, x->muhash.den, BTC_MUHASH_SIZE);
+
+  btc_write64le(zp + BTC_MUHASH_SIZE * 2 + 0, x->count);
+  btc_write64le(zp + BTC_MUHASH_SIZE * 2 + 8, x->amount);
+}
+
+static int
+btc_coinstats_import(btc_coinstats_t *z, const uint8_t *xp, size_t xn) {
+  if (xn != BTC_COINSTATS_SIZE)
+    return 0;
+
+  memcpy(z->muhash.num, xp, BTC_MUHASH_SIZE);
+  memcpy(z->muhash.den, xp + BTC_MUHASH_SIZE, BTC_MUHASH_SIZE);
+
+  z->count = btc_read64le(xp + BTC_MUHASH_SIZE * 2 + 0);
+  z->amount = (int64_t)btc_read64le(xp + BTC_MUHASH_SIZE * 2 + 8);
+
+  return 1;
+}
+
+static void
+btc_coinstats_update(btc_coinstats_t *z,
+                     const uint8_t *hash,
+                     uint32_t index,
+                     int32_t height,
+                     int coinbase,
+                     const btc_output_t *output,
+                     int sign) {
+  size_t len = 40 + btc_output_size(output);
+  uint8_t tmp[256];
+  uint8_t *buf = tmp;
+  uint8_t *zp;
+
+  if (len > sizeof(tmp))
+    buf = (uint8_t *)btc_malloc(len);
+
+  zp = btc_raw_write(buf, hash, 32);
+  zp = btc_uint32_write(zp, index);
+  zp = btc_uint32_write(zp, ((uint32_t)height << 1) | (coinbase != 0));
+  zp = btc_output_write(zp, output);
+
+  if (sign > 0) {
+    btc_muhash_insert(&z->muhash, buf, len);
+
+    z->count += 1;
+    z->amount += output->value;
+  } else {
+    btc_muhash_remove(&z->muhash, buf, len);
+
+    z->count -= 1;
+    z->amount -= output->value;
+  }
+
+  if (buf != tmp)
+    btc_free(buf);
+}
+
 /*
  * Chain File
  */
@@ -478,6 +839,8 @@ coin_key(uint8_t *key, const uint8_t *hash, uint32_t index) {
 
 typedef struct btc_chainfile_s {
   int fd;
+  const uint8_t *map;
+  size_t map_size;
   uint8_t type;
   int32_t id;
   int32_t pos;
@@ -486,6 +849,7 @@ typedef struct btc_chainfile_s {
   int64_t max_time;
   int32_t min_height;
   int32_t max_height;
+  int64_t reserved;
   struct btc_chainfile_s *prev;
   struct btc_chainfile_s *next;
 } btc_chainfile_t;
@@ -495,6 +859,8 @@ DEFINE_SERIALIZABLE_OBJECT(btc_chainfile, SCOPE_STATIC)
 static void
 btc_chainfile_init(btc_chainfile_t *z) {
   z->fd = -1;
+  z->map = NULL;
+  z->map_size = 0;
   z->type = 0;
   z->id = 0;
   z->pos = 0;
@@ -503,6 +869,7 @@ btc_chainfile_init(btc_chainfile_t *z) {
   z->max_time = -1;
   z->min_height = -1;
   z->max_height = -1;
+  z->reserved = 0;
   z->prev = NULL;
   z->next = NULL;
 }
@@ -515,6 +882,8 @@ btc_chainfile_clear(btc_chainfile_t *z) {
 static void
 btc_chainfile_copy(btc_chainfile_t *z, const btc_chainfile_t *x) {
   z->fd = -1;
+  z->map = NULL;
+  z->map_size = 0;
   z->type = x->type;
   z->id = x->id;
   z->pos = x->pos;
@@ -523,6 +892,7 @@ btc_chainfile_copy(btc_chainfile_t *z, const btc_chainfile_t *x) {
   z->max_time = x->max_time;
   z->min_height = x->min_height;
   z->max_height = x->max_height;
+  z->reserved = 0;
   z->prev = NULL;
   z->next = NULL;
 }
@@ -575,6 +945,15 @@ btc_chainfile_read(btc_chainfile_t *z, const uint8_t **xp, size_t *xn) {
   return 1;
 }
 
+static void
+btc_chainfile_unmap(btc_chainfile_t *z) {
+  if (z->map != NULL)
+    btc_fs_munmap((void *)z->map, z->map_size);
+
+  z->map = NULL;
+  z->map_size = 0;
+}
+
 static void
 btc_chainfile_update(btc_chainfile_t *z, const btc_entry_t *entry) {
   z->items += 1;
@@ -593,526 +972,5841 @@ btc_chainfile_update(btc_chainfile_t *z, const btc_entry_t *entry) {
 }
 
 /*
- * Chain Database
+ * Flat Index
  */
 
-struct btc_chaindb_s {
-  const btc_network_t *network;
-  char prefix[BTC_PATH_MAX - 26];
-  unsigned int flags;
-  lsm_db *lsm;
-#ifdef USE_WORKER
-  lsm_worker worker;
-#endif
-#ifdef USE_CKPTR
-  lsm_worker ckptr;
-#endif
-  btc_hashmap_t *hashes;
-  btc_vector_t heights;
-  btc_entry_t *head;
-  btc_entry_t *tail;
-  struct btc_chainfiles_s {
-    btc_chainfile_t *head;
-    btc_chainfile_t *tail;
-    size_t length;
-  } files;
-  btc_chainfile_t block;
-  btc_chainfile_t undo;
-  uint8_t *slab;
-};
+/* The main chain is mirrored to a flat file of fixed-size
+ * records, one per height, so that startup does not have
+ * to scan, decode and rehash every entry in the database.
+ * The file is only a cache: records are validated against
+ * the database tip on load and rebuilt if they disagree.
+ */
 
-static void
-btc_chaindb_path(btc_chaindb_t *db, char *path, int type, int id) {
-  const char *tag = (type == 0 ? "blk" : "rev");
+#define INDEX_RECORD_SIZE (32 + BTC_ENTRY_SIZE)
+#define INDEX_BATCH_SIZE 4096
 
-#if defined(_WIN32)
-  sprintf(path, "%s\\blocks\\%s%.5d.dat", db->prefix, tag, id);
-#else
-  sprintf(path, "%s/blocks/%s%.5d.dat", db->prefix, tag, id);
-#endif
+static uint8_t *
+index_record_write(uint8_t *zp, const btc_entry_t *x) {
+  zp = btc_raw_write(zp, x->hash, 32);
+  zp = btc_entry_write(zp, x);
+  return zp;
 }
 
-static void
-btc_chaindb_init(btc_chaindb_t *db, const btc_network_t *network) {
-  memset(db, 0, sizeof(*db));
-
-  db->network = network;
-  db->prefix[0] = '/';
-  db->hashes = btc_hashmap_create();
-  db->flags = BTC_CHAIN_DEFAULT_FLAGS;
+static int
+index_record_read(btc_entry_t *z, const uint8_t *xp) {
+  size_t xn = INDEX_RECORD_SIZE;
 
-#ifdef USE_WORKER
-  lsm_worker_init(&db->worker);
-#endif
+  /* Unlike btc_entry_read, trust the stored hash. */
+  if (!btc_raw_read(z->hash, 32, &xp, &xn))
+    return 0;
 
-#ifdef USE_CKPTR
-  lsm_worker_init(&db->ckptr);
+  if (!btc_header_read(&z->header, &xp, &xn))
+    return 0;
 
-  db->worker.ckptr = &db->ckptr;
-#endif
+  if (!btc_int32_read(&z->height, &xp, &xn))
+    return 0;
 
-  btc_vector_init(&db->heights);
+  if (!btc_raw_read(z->chainwork, 32, &xp, &xn))
+    return 0;
 
-  db->slab = (uint8_t *)btc_malloc(24 + BTC_MAX_RAW_BLOCK_SIZE);
-}
+  if (!btc_int32_read(&z->block_file, &xp, &xn))
+    return 0;
 
-static void
-btc_chaindb_clear(btc_chaindb_t *db) {
-  btc_hashmap_destroy(db->hashes);
-  btc_vector_clear(&db->heights);
-#ifdef USE_WORKER
-  lsm_worker_clear(&db->worker);
-#endif
-#ifdef USE_CKPTR
-  lsm_worker_clear(&db->ckptr);
-#endif
-  btc_free(db->slab);
-  memset(db, 0, sizeof(*db));
-}
+  if (!btc_int32_read(&z->block_pos, &xp, &xn))
+    return 0;
 
-btc_chaindb_t *
-btc_chaindb_create(const btc_network_t *network) {
-  btc_chaindb_t *db = (btc_chaindb_t *)btc_malloc(sizeof(btc_chaindb_t));
-  btc_chaindb_init(db, network);
-  return db;
-}
+  if (!btc_int32_read(&z->undo_file, &xp, &xn))
+    return 0;
 
-void
-btc_chaindb_destroy(btc_chaindb_t *db) {
-  btc_chaindb_clear(db);
-  btc_free(db);
-}
+  if (!btc_int32_read(&z->undo_pos, &xp, &xn))
+    return 0;
 
-static int
-btc_chaindb_load_prefix(btc_chaindb_t *db, const char *prefix) {
-  char path[BTC_PATH_MAX];
+  if (!btc_int64_read(&z->median_time, &xp, &xn))
+    return 0;
 
-  if (!btc_path_resolve(db->prefix, sizeof(db->prefix), prefix, 0))
+  if (!btc_uint32_read(&z->tx_count, &xp, &xn))
     return 0;
 
-  if (!btc_fs_mkdirp(db->prefix, 0755))
+  if (!btc_uint64_read(&z->chain_tx, &xp, &xn))
     return 0;
 
-  if (!btc_path_join(path, sizeof(path), db->prefix, "blocks", 0))
-    return 0;
-
-  if (!btc_fs_exists(path) && !btc_fs_mkdir(path, 0755))
-    return 0;
+  z->prev = NULL;
+  z->next = NULL;
 
   return 1;
 }
 
-static int
-btc_chaindb_load_database(btc_chaindb_t *db) {
-  char path[BTC_PATH_MAX];
-  int rc;
+/*
+ * Coin Cache
+ */
 
-  if (!btc_path_join(path, sizeof(path), db->prefix, "chain.dat", 0)) {
-    fprintf(stderr, "lsm_open: path too long\n");
-    return 0;
-  }
+#define CACHE_DIRTY 1 /* Differs from the database. */
+#define CACHE_FRESH 2 /* Does not exist in the database. */
 
-  rc = lsm_connect(&db->lsm, path);
+typedef struct btc_cached_s {
+  btc_outpoint_t key;
+  btc_coin_t *coin; /* NULL if spent. */
+  unsigned int flags;
+} btc_cached_t;
+
+typedef struct btc_coincache_s {
+  btc_outmap_t *map;
+  btc_slab_t entries;
+  size_t usage;
+  size_t limit;
+  size_t dirty;
+  uint64_t hits;
+  uint64_t misses;
+} btc_coincache_t;
 
-  if (rc != 0) {
-    fprintf(stderr, "lsm_connect: %s\n", lsm_strerror(rc));
-    return 0;
-  }
+static size_t
+btc_cached_usage(const btc_coin_t *coin) {
+  /* Entry, bucket (key+value+flags) and coin. */
+  size_t size = sizeof(btc_cached_t) + 2 * sizeof(void *) + 1;
 
-#ifdef USE_CKPTR
-  rc = lsm_worker_start(&db->ckptr, path, lsm_worker_ckpt);
+  if (coin != NULL)
+    size += sizeof(btc_coin_t) + btc_script_usage(&coin->output.script);
 
-  if (rc != 0)
-    goto fail;
-#endif
+  return size;
+}
 
-#ifdef USE_WORKER
-  rc = lsm_worker_start(&db->worker, path, lsm_worker_work);
+static void
+btc_coincache_init(btc_coincache_t *cache) {
+  cache->map = btc_outmap_create();
+  cache->usage = 0;
+  cache->limit = DEFAULT_CACHE_SIZE;
+  cache->dirty = 0;
+  cache->hits = 0;
+  cache->misses = 0;
+
+  btc_slab_init(&cache->entries, sizeof(btc_cached_t), 4096);
+}
 
-  if (rc != 0)
-    goto fail;
+static void
+btc_coincache_reset(btc_coincache_t *cache) {
+  btc_outmapiter_t iter;
+  btc_cached_t *entry;
 
-  lsm_config_work_hook(db->lsm, lsm_worker_hook, &db->worker);
-#endif
+  btc_outmap_iterate(&iter, cache->map);
 
-  return 1;
-#ifdef USE_WORKER
-fail:
-  fprintf(stderr, "lsm_worker_start: %s\n", lsm_strerror(rc));
+  while (btc_outmap_next(&iter)) {
+    entry = iter.val;
 
-  CHECK(lsm_close(db->lsm) == 0);
+    if (entry->coin != NULL)
+      btc_coin_destroy(entry->coin);
+  }
 
-  db->lsm = NULL;
+  btc_outmap_reset(cache->map);
+  btc_slab_clear(&cache->entries);
 
-  return 0;
-#endif
+  cache->usage = 0;
+  cache->dirty = 0;
 }
 
 static void
-btc_chaindb_unload_database(btc_chaindb_t *db) {
-#ifdef USE_WORKER
-  lsm_worker_stop(&db->worker);
-#endif
-
-#ifdef USE_CKPTR
-  lsm_worker_stop(&db->ckptr);
-#endif
-
-  CHECK(lsm_close(db->lsm) == 0);
+btc_coincache_clear(btc_coincache_t *cache) {
+  btc_coincache_reset(cache);
+  btc_outmap_destroy(cache->map);
+}
 
-  db->lsm = NULL;
+static btc_cached_t *
+btc_coincache_get(const btc_coincache_t *cache, const btc_outpoint_t *key) {
+  return btc_outmap_get(cache->map, key);
 }
 
-static int
-btc_chaindb_load_files(btc_chaindb_t *db) {
-  char path[BTC_PATH_MAX];
-  btc_chainfile_t *file;
-  lsm_cursor *cur;
-  const void *vp;
-  int vn;
+static void
+btc_coincache_put(btc_coincache_t *cache,
+                  const btc_outpoint_t *key,
+                  btc_coin_t *coin,
+                  unsigned int flags) {
+  btc_cached_t *entry = btc_slab_alloc(&cache->entries);
 
-  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  entry->key = *key;
+  entry->coin = coin;
+  entry->flags = flags;
 
-  /* Read best block file. */
-  CHECK(lsm_csr_seek(cur, blockfile_key, 1, LSM_SEEK_EQ) == 0);
+  CHECK(btc_outmap_put(cache->map, &entry->key, entry));
 
-  if (lsm_csr_valid(cur)) {
-    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
-    CHECK(btc_chainfile_import(&db->block, vp, vn));
-    CHECK(db->block.type == 0);
-  } else {
-    btc_chainfile_init(&db->block);
-    db->block.type = 0;
-  }
+  cache->usage += btc_cached_usage(coin);
 
-  /* Read best undo file. */
-  CHECK(lsm_csr_seek(cur, undofile_key, 1, LSM_SEEK_EQ) == 0);
+  if (flags & CACHE_DIRTY)
+    cache->dirty++;
+}
 
-  if (lsm_csr_valid(cur)) {
-    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
-    CHECK(btc_chainfile_import(&db->undo, vp, vn));
-    CHECK(db->undo.type == 1);
-  } else {
-    btc_chainfile_init(&db->undo);
-    db->undo.type = 1;
-  }
+static void
+btc_coincache_update(btc_coincache_t *cache,
+                     btc_cached_t *entry,
+                     btc_coin_t *coin) {
+  cache->usage -= btc_cached_usage(entry->coin);
+  cache->usage += btc_cached_usage(coin);
 
-  /* Read file index and build vector. */
-  CHECK(lsm_csr_seek(cur, file_min, sizeof(file_min), LSM_SEEK_GE) == 0);
+  if (entry->coin != NULL)
+    btc_coin_destroy(entry->coin);
 
-  while (lsm_csr_le(cur, file_max, sizeof(file_max))) {
-    file = btc_chainfile_create();
+  if (!(entry->flags & CACHE_DIRTY))
+    cache->dirty++;
 
-    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+  entry->coin = coin;
+  entry->flags |= CACHE_DIRTY;
+}
 
-    CHECK(btc_chainfile_import(file, vp, vn));
+static void
+btc_coincache_remove(btc_coincache_t *cache, btc_cached_t *entry) {
+  CHECK(btc_outmap_del(cache->map, &entry->key) == &entry->key);
 
-    btc_list_push(&db->files, file, btc_chainfile_t);
+  cache->usage -= btc_cached_usage(entry->coin);
 
-    CHECK(lsm_csr_next(cur) == 0);
-  }
+  if (entry->flags & CACHE_DIRTY)
+    cache->dirty--;
 
-  CHECK(lsm_csr_close(cur) == 0);
+  if (entry->coin != NULL)
+    btc_coin_destroy(entry->coin);
 
-  /* Open block file for writing. */
-  btc_chaindb_path(db, path, 0, db->block.id);
+  btc_slab_free(&cache->entries, entry);
+}
 
-  db->block.fd = btc_fs_open(path, WRITE_FLAGS, 0644);
+static void
+btc_coincache_commit(btc_coincache_t *cache, const btc_view_t *view) {
+  const btc_coin_t *coin;
+  btc_viewiter_t iter;
+  btc_cached_t *entry;
+  btc_outpoint_t key;
+  int tag;
 
-  CHECK(db->block.fd != -1);
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_COINS);
 
-  /* Open undo file for writing. */
-  btc_chaindb_path(db, path, 1, db->undo.id);
+  btc_view_iterate(&iter, view);
 
-  db->undo.fd = btc_fs_open(path, WRITE_FLAGS, 0644);
+  while (btc_view_next(&coin, &iter)) {
+    btc_outpoint_set(&key, iter.hash, iter.index);
 
-  CHECK(db->undo.fd != -1);
+    entry = btc_coincache_get(cache, &key);
 
-  return 1;
-}
+    if (coin->spent) {
+      if (entry == NULL) {
+        btc_coincache_put(cache, &key, NULL, CACHE_DIRTY);
+        continue;
+      }
 
-static void
-btc_chaindb_unload_files(btc_chaindb_t *db) {
-  btc_chainfile_t *file, *next;
+      /* Created and spent between flushes. The
+         database never needs to know about it. */
+      if (entry->flags & CACHE_FRESH) {
+        btc_coincache_remove(cache, entry);
+        continue;
+      }
 
-  btc_fs_fsync(db->block.fd);
-  btc_fs_fsync(db->undo.fd);
+      btc_coincache_update(cache, entry, NULL);
+    } else {
+      if (entry == NULL) {
+        unsigned int flags = CACHE_DIRTY;
 
-  btc_fs_close(db->block.fd);
-  btc_fs_close(db->undo.fd);
+        /* Pre-BIP34 coinbases may overwrite
+           an unspent coin with the same txid. */
+        if (!coin->coinbase)
+          flags |= CACHE_FRESH;
 
-  for (file = db->files.head; file != NULL; file = next) {
-    next = file->next;
-    btc_chainfile_destroy(file);
+        btc_coincache_put(cache, &key, btc_coin_refconst(coin), flags);
+        continue;
+      }
+
+      btc_coincache_update(cache, entry, btc_coin_refconst(coin));
+    }
   }
 
-  btc_list_reset(&db->files);
+  BTC_MEMTAG_POP(tag);
 }
 
-static int
-btc_chaindb_init_index(btc_chaindb_t *db) {
-  btc_view_t *view = btc_view_create();
-  btc_entry_t *entry = btc_entry_create();
-  btc_block_t block;
+static void
+btc_coincache_sweep(btc_coincache_t *cache) {
+  /* Called after a successful flush. Spent
+     entries are dropped while unspent ones
+     are kept around as clean read cache. */
+  btc_outmapiter_t iter;
+  btc_cached_t *entry;
+  btc_vector_t spent;
+  size_t i;
 
-  btc_block_init(&block);
-  btc_block_import(&block, db->network->genesis.data,
-                           db->network->genesis.length);
+  btc_vector_init(&spent);
 
-  btc_entry_set_block(entry, &block, NULL);
+  btc_outmap_iterate(&iter, cache->map);
 
-  CHECK(btc_chaindb_save(db, entry, &block, view));
+  while (btc_outmap_next(&iter)) {
+    entry = iter.val;
 
-  btc_block_clear(&block);
-  btc_view_destroy(view);
+    if (entry->coin == NULL)
+      btc_vector_push(&spent, entry);
+    else
+      entry->flags = 0;
+  }
 
-  return 1;
-}
+  for (i = 0; i < spent.length; i++)
+    btc_coincache_remove(cache, (btc_cached_t *)spent.items[i]);
 
-static int
-btc_chaindb_load_index(btc_chaindb_t *db) {
-  btc_entry_t *entry, *tip;
-  btc_entry_t *gen = NULL;
-  btc_hashmapiter_t iter;
-  uint8_t tip_hash[32];
-  lsm_cursor *cur;
-  const void *vp;
-  int vn;
+  btc_vector_clear(&spent);
 
-  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  cache->dirty = 0;
+}
 
-  /* Read tip hash. */
-  {
-    CHECK(lsm_csr_seek(cur, meta_key, 1, LSM_SEEK_EQ) == 0);
+/*
+ * Block Writer
+ */
 
-    if (!lsm_csr_valid(cur)) {
-      CHECK(lsm_csr_close(cur) == 0);
-      return btc_chaindb_init_index(db);
-    }
+/* Block and undo data are appended to disk on a
+ * background thread so that connecting the next
+ * block does not wait on the previous one's write
+ * or fsync. Everything queued since the last pass
+ * is written as one batch: contiguous appends to
+ * the same file are coalesced into a single write
+ * and each file is synced at most once per batch.
+ *
+ * File positions are still assigned synchronously.
+ * Anything which reads or syncs the active files
+ * must drain the queue first.
+ *
+ * Pruned files are unlinked by the same thread. An
+ * item with no descriptor carries a path instead.
+ */
 
-    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
-    CHECK(vn == 32);
+#define WRITER_CHUNK ((size_t)4 << 20)
+#define WRITER_MAX_FDS 4
 
-    memcpy(tip_hash, vp, 32);
-  }
+typedef struct btc_blockwrite_s {
+  int fd;
+  uint8_t *data;
+  size_t length;
+  int sync;
+  struct btc_blockwrite_s *next;
+} btc_blockwrite_t;
 
-  /* Read block index and create hash->entry map. */
-  CHECK(lsm_csr_seek(cur, entry_min, sizeof(entry_min), LSM_SEEK_GE) == 0);
+typedef struct btc_blockwriter_s {
+  btc_thread_t *thread;
+  btc_cond_t *work;
+  btc_cond_t *done;
+  btc_mutex_t *lock;
+  btc_blockwrite_t *head;
+  btc_blockwrite_t *tail;
+  size_t length;
+  size_t pending;
+  size_t bytes;
+  btc_hist_t syncs;
+  int stop;
+} btc_blockwriter_t;
 
-  while (lsm_csr_le(cur, entry_max, sizeof(entry_max))) {
-    entry = btc_entry_create();
+static void
+btc_blockwriter_init(btc_blockwriter_t *w) {
+  w->thread = btc_thread_alloc();
+  w->work = btc_cond_create();
+  w->done = btc_cond_create();
+  w->lock = btc_mutex_create();
+  w->head = NULL;
+  w->tail = NULL;
+  w->length = 0;
+  w->pending = 0;
+  w->bytes = 0;
+  w->stop = 0;
 
-    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+  btc_hist_init(&w->syncs);
+}
 
-    CHECK(btc_entry_import(entry, vp, vn));
-    CHECK(btc_hashmap_put(db->hashes, entry->hash, entry));
+static void
+btc_blockwriter_clear(btc_blockwriter_t *w) {
+  CHECK(w->head == NULL);
 
-    CHECK(lsm_csr_next(cur) == 0);
+  btc_thread_free(w->thread);
+  btc_cond_destroy(w->work);
+  btc_cond_destroy(w->done);
+  btc_mutex_destroy(w->lock);
+}
+
+static void
+write_or_abort(int fd, const uint8_t *data, size_t length) {
+  /* Entries already point at this data. */
+  if (!btc_fs_write(fd, data, length)) {
+    fprintf(stderr, "btc_blockwriter: write failed\n");
+    btc_abort(); /* LCOV_EXCL_LINE */
   }
+}
 
-  CHECK(lsm_csr_close(cur) == 0);
+static void
+timed_sync(int fd, int64_t *ns) {
+  int64_t start = btc_time_nsec();
 
-  /* Create `prev` links and retrieve genesis block. */
-  btc_hashmap_iterate(&iter, db->hashes);
+  btc_fs_fdatasync(fd);
 
-  while (btc_hashmap_next(&iter)) {
-    entry = iter.val;
+  if (*ns < 0)
+    *ns = 0;
 
-    if (entry->height == 0) {
-      gen = entry;
+  *ns += btc_time_nsec() - start;
+}
+
+static size_t
+btc_blockwriter_flush(btc_blockwrite_t *batch, uint8_t *chunk, int64_t *ns) {
+  int fds[WRITER_MAX_FDS];
+  btc_blockwrite_t *item, *next, *it;
+  size_t nfds = 0;
+  size_t total = 0;
+  size_t i, size;
+
+  *ns = -1;
+
+  for (item = batch; item != NULL; item = next) {
+    if (item->fd == -1) {
+      btc_fs_unlink((const char *)item->data);
+      next = item->next;
       continue;
     }
 
-    entry->prev = btc_hashmap_get(db->hashes, entry->header.prev_block);
-
-    CHECK(entry->prev != NULL);
-  }
+    /* Gather a run of appends to the same file. */
+    size = item->length;
+    next = item->next;
 
-  CHECK(gen != NULL);
+    while (next != NULL && next->fd == item->fd
+                        && size + next->length <= WRITER_CHUNK) {
+      size += next->length;
+      next = next->next;
+    }
 
-  /* Retrieve tip. */
-  tip = btc_hashmap_get(db->hashes, tip_hash);
+    if (item->next == next) {
+      write_or_abort(item->fd, item->data, item->length);
+    } else {
+      size = 0;
 
-  CHECK(tip != NULL);
+      for (it = item; it != next; it = it->next) {
+        memcpy(chunk + size, it->data, it->length);
+        size += it->length;
+      }
 
-  /* Create height->entry vector. */
-  btc_vector_grow(&db->heights, (btc_hashmap_size(db->hashes) * 3) / 2);
-  btc_vector_resize(&db->heights, tip->height + 1);
+      write_or_abort(item->fd, chunk, size);
+    }
 
-  /* Populate height vector and create `next` links. */
-  entry = tip;
+    for (it = item; it != next; it = it->next) {
+      if (!it->sync)
+        continue;
 
-  do {
-    CHECK((size_t)entry->height < db->heights.length);
+      for (i = 0; i < nfds; i++) {
+        if (fds[i] == it->fd)
+          break;
+      }
 
-    db->heights.items[entry->height] = entry;
+      if (i == nfds) {
+        if (nfds == WRITER_MAX_FDS)
+          timed_sync(fds[--nfds], ns);
 
-    if (entry->prev != NULL)
-      entry->prev->next = entry;
+        fds[nfds++] = it->fd;
+      }
+    }
+  }
 
-    entry = entry->prev;
-  } while (entry != NULL);
+  /* One sync per file for the whole batch. */
+  for (i = 0; i < nfds; i++)
+    timed_sync(fds[i], ns);
 
-  db->head = gen;
-  db->tail = tip;
+  for (item = batch; item != NULL; item = next) {
+    next = item->next;
+    total += item->length;
+    btc_free(item->data);
+    btc_free(item);
+  }
 
-  return 1;
+  return total;
 }
 
 static void
-btc_chaindb_unload_index(btc_chaindb_t *db) {
-  btc_hashmapiter_t iter;
+btc_blockwriter_loop(void *arg) {
+  btc_blockwriter_t *w = (btc_blockwriter_t *)arg;
+  uint8_t *chunk = (uint8_t *)btc_malloc(WRITER_CHUNK);
+  btc_blockwrite_t *batch;
+  size_t count, bytes;
+  int64_t ns;
 
-  btc_hashmap_iterate(&iter, db->hashes);
+  btc_mutex_lock(w->lock);
 
-  while (btc_hashmap_next(&iter))
-    btc_entry_destroy(iter.val);
+  for (;;) {
+    if (w->head == NULL) {
+      if (w->stop)
+        break;
 
-  btc_hashmap_reset(db->hashes);
-  btc_vector_clear(&db->heights);
+      btc_cond_wait(w->work, w->lock);
 
-  db->head = NULL;
-  db->tail = NULL;
-}
+      continue;
+    }
 
-int
-btc_chaindb_open(btc_chaindb_t *db,
-                 const char *prefix,
-                 unsigned int flags) {
-  db->flags = flags;
+    /* Take everything queued so far. */
+    batch = w->head;
+    count = w->length;
 
-  if (!btc_chaindb_load_prefix(db, prefix))
-    return 0;
+    btc_queue_init(w);
 
-  if (!btc_chaindb_load_database(db))
-    return 0;
+    btc_mutex_unlock(w->lock);
 
-  if (!btc_chaindb_load_files(db))
-    return 0;
+    bytes = btc_blockwriter_flush(batch, chunk, &ns);
 
-  if (!btc_chaindb_load_index(db))
-    return 0;
+    btc_mutex_lock(w->lock);
+
+    w->pending -= count;
+    w->bytes -= bytes;
+
+    if (ns >= 0)
+      btc_hist_record(&w->syncs, ns);
+
+    btc_cond_broadcast(w->done);
+  }
+
+  btc_mutex_unlock(w->lock);
+
+  btc_free(chunk);
+}
+
+static void
+btc_blockwriter_start(btc_blockwriter_t *w) {
+  w->stop = 0;
+
+  btc_thread_create(w->thread, btc_blockwriter_loop, w);
+}
+
+static void
+btc_blockwriter_stop(btc_blockwriter_t *w) {
+  btc_mutex_lock(w->lock);
+
+  w->stop = 1;
+
+  btc_cond_signal(w->work);
+  btc_mutex_unlock(w->lock);
+
+  btc_thread_join(w->thread);
+}
+
+static void
+btc_blockwriter_push(btc_blockwriter_t *w, int fd, uint8_t *data, size_t length,
+                                                         int sync) {
+  btc_blockwrite_t *item = btc_malloc(sizeof(btc_blockwrite_t));
+
+  item->fd = fd;
+  item->data = data;
+  item->length = length;
+  item->sync = sync;
+  item->next = NULL;
+
+  btc_mutex_lock(w->lock);
+
+  /* Bound memory if the disk falls behind. */
+  while (w->pending > 0 && w->bytes + length > WRITER_LIMIT)
+    btc_cond_wait(w->done, w->lock);
+
+  btc_queue_push(w, item);
+
+  w->pending += 1;
+  w->bytes += length;
+
+  btc_cond_signal(w->work);
+  btc_mutex_unlock(w->lock);
+}
+
+static void
+btc_blockwriter_unlink(btc_blockwriter_t *w, const char *path) {
+  size_t size = strlen(path) + 1;
+  uint8_t *data = btc_malloc(size);
+
+  memcpy(data, path, size);
+
+  btc_blockwriter_push(w, -1, data, 0, 0);
+}
+
+static void
+btc_blockwriter_drain(btc_blockwriter_t *w) {
+  btc_mutex_lock(w->lock);
+
+  while (w->pending > 0)
+    btc_cond_wait(w->done, w->lock);
+
+  btc_mutex_unlock(w->lock);
+}
+
+/*
+ * Block File Handle
+ */
+
+/* A read descriptor for a block file, shared by the
+   sockets sending from it. The chaindb caches a few
+   and holds a reference to each; queued writes hold
+   their own, so a descriptor outlives its cache slot
+   (and the chaindb itself) until the last send. */
+struct btc_blockfile_s {
+  int fd;
+  int32_t id;
+  int refs;
+};
+
+static btc_blockfile_t *
+btc_blockfile_create(int fd, int32_t id) {
+  btc_blockfile_t *file = btc_malloc(sizeof(btc_blockfile_t));
+
+  file->fd = fd;
+  file->id = id;
+  file->refs = 1;
+
+  return file;
+}
+
+int
+btc_blockfile_fd(const btc_blockfile_t *file) {
+  return file->fd;
+}
+
+void
+btc_blockfile_unref(btc_blockfile_t *file) {
+  CHECK(file->refs > 0);
+
+  if (--file->refs == 0) {
+    btc_fs_close(file->fd);
+    btc_free(file);
+  }
+}
+
+/*
+ * Tuning
+ */
+
+void
+btc_dbtune_init(btc_dbtune_t *tune, enum btc_dbprofile profile) {
+  switch (profile) {
+    case BTC_DBPROFILE_SMALL: {
+      tune->cache_size = 8 * 1024;
+      tune->buffer_size = 4 * 1024;
+      tune->autoflush = 1024;
+      tune->bulk_flush = 16 * 1024;
+      tune->autocheckpoint = 1024;
+      tune->automerge = 4;
+      tune->mmap = 0;
+      tune->shared = 0;
+      tune->safety = 1;
+      break;
+    }
+
+    case BTC_DBPROFILE_LARGE: {
+      tune->cache_size = 512 * 1024;
+      tune->buffer_size = 128 * 1024;
+      tune->autoflush = 4 * 1024;
+      tune->bulk_flush = 256 * 1024;
+      tune->autocheckpoint = 8 * 1024;
+      tune->automerge = 4;
+      /* Only map the whole file with the address space to do it. */
+      tune->mmap = sizeof(void *) >= 8;
+      tune->shared = 0;
+      tune->safety = 1;
+      break;
+    }
+
+    default: {
+      tune->cache_size = 64 * 1024;
+      tune->buffer_size = 32 * 1024;
+      tune->autoflush = 1024;
+      tune->bulk_flush = 64 * 1024;
+      tune->autocheckpoint = 2048;
+      tune->automerge = 4;
+      tune->mmap = 0;
+      tune->shared = 0;
+      tune->safety = 1;
+      break;
+    }
+  }
+}
+
+/*
+ * Chain Database
+ */
+
+struct btc_chaindb_s {
+  const btc_network_t *network;
+  char prefix[BTC_PATH_MAX - 26];
+  unsigned int flags;
+  lsm_db *lsm;
+#ifdef USE_WORKER
+  lsm_worker worker;
+  lsm_worker ckptr;
+#endif
+  btc_hashmap_t *hashes;
+  btc_vector_t heights;
+  btc_entry_t *head;
+  btc_entry_t *tail;
+  btc_slab_t entries;
+  int index_fd;
+  struct btc_chainfiles_s {
+    btc_chainfile_t *head;
+    btc_chainfile_t *tail;
+    size_t length;
+  } files;
+  btc_chainfile_t block;
+  btc_chainfile_t undo;
+  btc_blockwriter_t writer;
+  btc_blockfile_t *handles[MAX_HANDLES];
+  size_t handle_index;
+  btc_coincache_t cache;
+  btc_coinstats_t stats;
+  btc_hashmap_t *txlocs;
+  btc_rwlock_t *state;
+  int readers;
+  int64_t last_flush;
+  int32_t flushed;
+  int64_t prune_target;
+  int prune_flush;
+  btc_dbtune_t tune;
+  int bulk;
+  int batch;
+  int nested;
+  int reorg;
+  int grouped;
+  uint8_t salt[16];
+  uint8_t *slab;
+};
+
+static void
+btc_chaindb_path(btc_chaindb_t *db, char *path, int type, int id) {
+  const char *tag = (type == 0 ? "blk" : "rev");
+
+#if defined(_WIN32)
+  sprintf(path, "%s\\blocks\\%s%.5d.dat", db->prefix, tag, id);
+#else
+  sprintf(path, "%s/blocks/%s%.5d.dat", db->prefix, tag, id);
+#endif
+}
+
+static void
+btc_chaindb_init(btc_chaindb_t *db, const btc_network_t *network) {
+  memset(db, 0, sizeof(*db));
+
+  db->network = network;
+  db->prefix[0] = '/';
+  db->hashes = btc_hashmap_create();
+  db->txlocs = btc_hashmap_create();
+  db->flags = BTC_CHAIN_DEFAULT_FLAGS;
+  db->index_fd = -1;
+
+  btc_dbtune_init(&db->tune, BTC_DBPROFILE_DEFAULT);
+
+  btc_slab_init(&db->entries, sizeof(btc_entry_t), 4096);
+
+#ifdef USE_WORKER
+  lsm_worker_init(&db->worker);
+  lsm_worker_init(&db->ckptr);
+
+  db->worker.ckptr = &db->ckptr;
+#endif
+
+  btc_vector_init(&db->heights);
+  btc_blockwriter_init(&db->writer);
+  btc_coincache_init(&db->cache);
+  btc_coinstats_init(&db->stats);
+
+  db->state = btc_rwlock_create();
+  db->slab = (uint8_t *)btc_malloc(24 + BTC_MAX_RAW_BLOCK_SIZE);
+}
+
+static void
+btc_chaindb_reset_txlocs(btc_chaindb_t *db) {
+  btc_hashmapiter_t iter;
+
+  btc_hashmap_iterate(&iter, db->txlocs);
+
+  while (btc_hashmap_next(&iter))
+    btc_free(iter.val);
+
+  btc_hashmap_reset(db->txlocs);
+}
+
+static void
+btc_chaindb_clear(btc_chaindb_t *db) {
+  btc_chaindb_reset_txlocs(db);
+  btc_hashmap_destroy(db->hashes);
+  btc_hashmap_destroy(db->txlocs);
+  btc_vector_clear(&db->heights);
+  btc_blockwriter_clear(&db->writer);
+  btc_coincache_clear(&db->cache);
+  btc_rwlock_destroy(db->state);
+#ifdef USE_WORKER
+  lsm_worker_clear(&db->worker);
+  lsm_worker_clear(&db->ckptr);
+#endif
+  btc_free(db->slab);
+  memset(db, 0, sizeof(*db));
+}
+
+btc_chaindb_t *
+btc_chaindb_create(const btc_network_t *network) {
+  btc_chaindb_t *db = (btc_chaindb_t *)btc_malloc(sizeof(btc_chaindb_t));
+  btc_chaindb_init(db, network);
+  return db;
+}
+
+void
+btc_chaindb_destroy(btc_chaindb_t *db) {
+  btc_chaindb_clear(db);
+  btc_free(db);
+}
+
+btc_entry_t *
+btc_chaindb_create_entry(btc_chaindb_t *db) {
+  btc_entry_t *entry = btc_slab_alloc(&db->entries);
+  btc_entry_init(entry);
+  return entry;
+}
+
+void
+btc_chaindb_destroy_entry(btc_chaindb_t *db, btc_entry_t *entry) {
+  btc_entry_clear(entry);
+  btc_slab_free(&db->entries, entry);
+}
+
+static int
+btc_chaindb_load_scratch(btc_chaindb_t *db, const char *prefix) {
+  /* An in-memory database gets a directory of its own on
+     a memory-backed filesystem, or under the prefix where
+     there is none. It is removed again on close. */
+  char base[BTC_PATH_MAX];
+  char name[5 + 16 + 1];
+  uint8_t nonce[8];
+
+#if defined(__linux__)
+  if (btc_fs_exists("/dev/shm"))
+    prefix = "/dev/shm";
+#endif
+
+  if (!btc_path_resolve(base, sizeof(base), prefix, 0))
+    return 0;
+
+  if (!btc_fs_mkdirp(base, 0755))
+    return 0;
+
+  btc_getrandom(nonce, sizeof(nonce));
+
+  memcpy(name, "mako-", 5);
+  btc_base16_encode(name + 5, nonce, sizeof(nonce));
+
+  if (!btc_path_join(db->prefix, sizeof(db->prefix), base, name, 0))
+    return 0;
+
+  return btc_fs_mkdir(db->prefix, 0700);
+}
+
+static int
+btc_chaindb_load_prefix(btc_chaindb_t *db, const char *prefix) {
+  char path[BTC_PATH_MAX];
+
+  if (db->flags & BTC_CHAIN_MEMORY) {
+    if (!btc_chaindb_load_scratch(db, prefix))
+      return 0;
+  } else {
+    if (!btc_path_resolve(db->prefix, sizeof(db->prefix), prefix, 0))
+      return 0;
+
+    if (!btc_fs_mkdirp(db->prefix, 0755))
+      return 0;
+  }
+
+  if (!btc_path_join(path, sizeof(path), db->prefix, "blocks", 0))
+    return 0;
+
+  if (!btc_fs_exists(path) && !btc_fs_mkdir(path, 0755))
+    return 0;
+
+  return 1;
+}
+
+static int
+btc_chaindb_remove_dir(const char *dir) {
+  char path[BTC_PATH_MAX];
+  btc_dirent_t **list;
+  size_t i, count;
+  int ret = 1;
+
+  if (!btc_fs_scandir(dir, &list, &count))
+    return 0;
+
+  for (i = 0; i < count; i++) {
+    if (btc_path_join(path, sizeof(path), dir, list[i]->d_name, 0))
+      ret &= btc_fs_unlink(path);
+    else
+      ret = 0;
+
+    free(list[i]);
+  }
+
+  free(list);
+
+  return ret & btc_fs_rmdir(dir);
+}
+
+static void
+btc_chaindb_remove_scratch(btc_chaindb_t *db) {
+  char path[BTC_PATH_MAX];
+
+  if (btc_path_join(path, sizeof(path), db->prefix, "blocks", 0))
+    btc_chaindb_remove_dir(path);
+
+  btc_chaindb_remove_dir(db->prefix);
+}
+
+static int
+btc_chaindb_wipe(btc_chaindb_t *db) {
+  char blocks[BTC_PATH_MAX];
+  char backup[BTC_PATH_MAX];
+  char path[BTC_PATH_MAX];
+  int rc;
+
+  if (!btc_path_join(blocks, sizeof(blocks), db->prefix, "blocks", 0))
+    return 0;
+
+  if (!btc_chaindb_reindex_path(db, backup, sizeof(backup)))
+    return 0;
+
+  /* Block files are set aside to be replayed once
+     the node is up. If a previous reindex never
+     finished, its backup is still the full set,
+     and whatever it had rebuilt is thrown away. */
+  if (btc_fs_exists(backup)) {
+    if (!btc_chaindb_remove_dir(blocks))
+      return 0;
+  } else {
+    if (!btc_fs_rename(blocks, backup))
+      return 0;
+  }
+
+  if (!btc_fs_mkdir(blocks, 0755))
+    return 0;
+
+  /* Each backend lays out its own files. */
+  if (!btc_path_join(path, sizeof(path), db->prefix, "chain.dat", 0))
+    return 0;
+
+  rc = lsm_destroy(path);
+
+  if (rc != 0) {
+    fprintf(stderr, "lsm_destroy: %s\n", lsm_strerror(rc));
+    return 0;
+  }
+
+  if (!btc_path_join(path, sizeof(path), db->prefix, "index.dat", 0))
+    return 0;
+
+  if (btc_fs_exists(path) && !btc_fs_unlink(path))
+    return 0;
+
+  /* Coins may linger from an earlier open. */
+  btc_coincache_reset(&db->cache);
+  btc_chaindb_reset_txlocs(db);
+
+  return 1;
+}
+
+static int
+btc_chaindb_load_database(btc_chaindb_t *db) {
+  char path[BTC_PATH_MAX];
+  int rc;
+
+  if (!btc_path_join(path, sizeof(path), db->prefix, "chain.dat", 0)) {
+    fprintf(stderr, "lsm_open: path too long\n");
+    return 0;
+  }
+
+  rc = lsm_connect(&db->lsm, path, &db->tune,
+                   (db->flags & BTC_CHAIN_WORKER) != 0,
+                   (db->flags & BTC_CHAIN_READONLY) != 0);
+
+  if (rc != 0) {
+    fprintf(stderr, "lsm_connect: %s\n", lsm_strerror(rc));
+    return 0;
+  }
+
+  /* Grouped saves roll back a single block with a
+     nested transaction. Not every backend has them
+     (the leveldb wrapper does not). */
+  db->nested = 0;
+
+  if (!(db->flags & BTC_CHAIN_READONLY)) {
+    db->nested = (lsm_begin(db->lsm, 2) == 0);
+
+    CHECK(lsm_rollback(db->lsm, 0) == 0);
+  }
+
+#ifdef USE_WORKER
+  if (db->flags & BTC_CHAIN_WORKER) {
+    rc = lsm_worker_start(&db->ckptr, path, &db->tune, lsm_worker_ckpt);
+
+    if (rc != 0)
+      goto fail;
+
+    rc = lsm_worker_start(&db->worker, path, &db->tune, lsm_worker_work);
+
+    if (rc != 0) {
+      lsm_worker_stop(&db->ckptr);
+      goto fail;
+    }
+
+    lsm_config_work_hook(db->lsm, lsm_worker_hook, &db->worker);
+  }
+#endif
+
+  return 1;
+#ifdef USE_WORKER
+fail:
+  fprintf(stderr, "lsm_worker_start: %s\n", lsm_strerror(rc));
+
+  CHECK(lsm_close(db->lsm) == 0);
+
+  db->lsm = NULL;
+
+  return 0;
+#endif
+}
+
+static void
+btc_chaindb_unload_database(btc_chaindb_t *db) {
+#ifdef USE_WORKER
+  if (db->flags & BTC_CHAIN_WORKER) {
+    /* The worker may still be waiting on the
+       checkpointer, so it has to go first. */
+    lsm_config_work_hook(db->lsm, NULL, NULL);
+    lsm_worker_stop(&db->worker);
+    lsm_worker_stop(&db->ckptr);
+  }
+#endif
+
+  CHECK(lsm_close(db->lsm) == 0);
+
+  db->lsm = NULL;
+  db->bulk = 0;
+  db->batch = 0;
+}
+
+static int
+btc_chaindb_backoff(btc_chaindb_t *db) {
+#ifdef USE_WORKER
+  if (db->flags & BTC_CHAIN_WORKER)
+    return lsm_worker_wait(&db->worker, db->lsm) == 0;
+#else
+  (void)db;
+#endif
+  return 1;
+}
+
+static int
+btc_chaindb_commit_batch(btc_chaindb_t *db) {
+  /* Close out blocks saved since the last commit. */
+  if (db->batch == 0)
+    return 1;
+
+  db->batch = 0;
+
+  return lsm_commit(db->lsm, 0) == 0;
+}
+
+static void
+btc_chaindb_sync_files(btc_chaindb_t *db) {
+  /* Nothing in memory survives a crash anyway. */
+  if (db->flags & BTC_CHAIN_MEMORY)
+    return;
+
+  btc_fs_fsync(db->block.fd);
+  btc_fs_fsync(db->undo.fd);
+}
+
+static void
+btc_chainfile_trim(btc_chainfile_t *file) {
+  /* Anything past the recorded position belongs to
+     blocks whose transaction never committed. Files
+     are opened for appending, so it has to go before
+     new data lands behind it at the wrong offset. */
+  btc_stat_t st;
+
+  if (btc_fs_fstat(file->fd, &st) && st.st_size > file->pos)
+    CHECK(btc_fs_ftruncate(file->fd, file->pos));
+}
+
+static int
+btc_chaindb_load_files(btc_chaindb_t *db) {
+  char path[BTC_PATH_MAX];
+  btc_chainfile_t *file;
+  lsm_cursor *cur;
+  const void *vp;
+  int vn;
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+
+  /* Read best block file. */
+  CHECK(lsm_csr_seek(cur, blockfile_key, 1, LSM_SEEK_EQ) == 0);
+
+  if (lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+    CHECK(btc_chainfile_import(&db->block, vp, vn));
+    CHECK(db->block.type == 0);
+  } else {
+    btc_chainfile_init(&db->block);
+    db->block.type = 0;
+  }
+
+  /* Read best undo file. */
+  CHECK(lsm_csr_seek(cur, undofile_key, 1, LSM_SEEK_EQ) == 0);
+
+  if (lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+    CHECK(btc_chainfile_import(&db->undo, vp, vn));
+    CHECK(db->undo.type == 1);
+  } else {
+    btc_chainfile_init(&db->undo);
+    db->undo.type = 1;
+  }
+
+  /* Read file index and build vector. */
+  CHECK(lsm_csr_seek(cur, file_min, sizeof(file_min), LSM_SEEK_GE) == 0);
+
+  while (lsm_csr_le(cur, file_max, sizeof(file_max))) {
+    file = btc_chainfile_create();
+
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+
+    CHECK(btc_chainfile_import(file, vp, vn));
+
+    btc_list_push(&db->files, file, btc_chainfile_t);
+
+    CHECK(lsm_csr_next(cur) == 0);
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  /* Replicas open every file by name, the one the
+     primary is appending to included, so reads never
+     go through a descriptor of ours. */
+  if (db->flags & BTC_CHAIN_READONLY) {
+    db->block.id = -1;
+    db->undo.id = -1;
+    return 1;
+  }
+
+  /* Open block file for writing. */
+  btc_chaindb_path(db, path, 0, db->block.id);
+
+  db->block.fd = btc_fs_open(path, WRITE_FLAGS, 0644);
+
+  CHECK(db->block.fd != -1);
+
+  /* Open undo file for writing. */
+  btc_chaindb_path(db, path, 1, db->undo.id);
+
+  db->undo.fd = btc_fs_open(path, WRITE_FLAGS, 0644);
+
+  CHECK(db->undo.fd != -1);
+
+  btc_chainfile_trim(&db->block);
+  btc_chainfile_trim(&db->undo);
+
+  btc_blockwriter_start(&db->writer);
+
+  return 1;
+}
+
+static void
+btc_chaindb_drop_handles(btc_chaindb_t *db, int32_t id) {
+  size_t i;
+
+  for (i = 0; i < lengthof(db->handles); i++) {
+    btc_blockfile_t *file = db->handles[i];
+
+    if (file != NULL && (id == -1 || file->id == id)) {
+      btc_blockfile_unref(file);
+      db->handles[i] = NULL;
+    }
+  }
+}
+
+static void
+btc_chaindb_unload_files(btc_chaindb_t *db) {
+  btc_chainfile_t *file, *next;
+
+  if (!(db->flags & BTC_CHAIN_READONLY)) {
+    btc_blockwriter_stop(&db->writer);
+    btc_chaindb_sync_files(db);
+
+    btc_fs_close(db->block.fd);
+    btc_fs_close(db->undo.fd);
+  }
+
+  btc_chaindb_drop_handles(db, -1);
+
+  for (file = db->files.head; file != NULL; file = next) {
+    next = file->next;
+    btc_chainfile_unmap(file);
+    btc_chainfile_destroy(file);
+  }
+
+  btc_list_reset(&db->files);
+}
+
+static int
+btc_chaindb_init_index(btc_chaindb_t *db) {
+  btc_view_t *view = btc_view_create();
+  btc_entry_t *entry = btc_chaindb_create_entry(db);
+  btc_block_t block;
+
+  btc_block_init(&block);
+  btc_block_import(&block, db->network->genesis.data,
+                           db->network->genesis.length);
+
+  btc_entry_set_block(entry, &block, NULL);
+
+  CHECK(btc_chaindb_save(db, entry, &block, view));
+
+  btc_block_clear(&block);
+  btc_view_destroy(view);
+
+  return 1;
+}
+
+static btc_entry_t *
+read_entry(btc_chaindb_t *db, lsm_cursor *cur, const uint8_t *hash) {
+  uint8_t key[ENTRY_KEYLEN];
+  btc_entry_t *entry;
+  const void *vp;
+  int vn;
+
+  entry_key(key, hash);
+
+  CHECK(lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_EQ) == 0);
+
+  if (!lsm_csr_valid(cur))
+    return NULL;
+
+  CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+
+  entry = btc_chaindb_create_entry(db);
+
+  CHECK(btc_entry_import(entry, vp, vn));
+
+  return entry;
+}
+
+static void
+btc_chaindb_write_index(btc_chaindb_t *db, const btc_entry_t *entry) {
+  uint8_t raw[INDEX_RECORD_SIZE];
+  int64_t pos = (int64_t)entry->height * INDEX_RECORD_SIZE;
+
+  index_record_write(raw, entry);
+
+  /* Failure is tolerable: a stale record
+     is detected and rebuilt on next load. */
+  if (!btc_fs_pwrite(db->index_fd, raw, sizeof(raw), pos))
+    fprintf(stderr, "btc_chaindb_write_index: write failed\n");
+}
+
+static void
+btc_chaindb_rebuild_index(btc_chaindb_t *db) {
+  size_t total = db->heights.length;
+  uint8_t *buf = db->slab;
+  int64_t pos = 0;
+  size_t i, j, n;
+
+  for (i = 0; i < total; i += n) {
+    n = total - i;
+
+    if (n > INDEX_BATCH_SIZE)
+      n = INDEX_BATCH_SIZE;
+
+    for (j = 0; j < n; j++)
+      index_record_write(buf + j * INDEX_RECORD_SIZE, db->heights.items[i + j]);
+
+    if (!btc_fs_pwrite(db->index_fd, buf, n * INDEX_RECORD_SIZE, pos))
+      goto fail;
+
+    pos += n * INDEX_RECORD_SIZE;
+  }
+
+  if (!btc_fs_ftruncate(db->index_fd, pos))
+    goto fail;
+
+  return;
+fail:
+  fprintf(stderr, "btc_chaindb_rebuild_index: write failed\n");
+}
+
+static int
+btc_chaindb_load_flat(btc_chaindb_t *db, lsm_cursor *cur,
+                                         const uint8_t *tip_hash) {
+  btc_entry_t *entry, *prev;
+  uint8_t *buf = db->slab;
+  size_t i, j, n, total;
+  btc_stat_t st;
+  int64_t pos;
+
+  /* The database tip tells us how many records we need. */
+  entry = read_entry(db, cur, tip_hash);
+
+  CHECK(entry != NULL);
+
+  total = (size_t)entry->height + 1;
+
+  btc_chaindb_destroy_entry(db, entry);
+
+  if (!btc_fs_fstat(db->index_fd, &st))
+    return 0;
+
+  if (st.st_size < (int64_t)(total * INDEX_RECORD_SIZE))
+    return 0;
+
+  btc_vector_grow(&db->heights, (total * 3) / 2);
+  btc_vector_resize(&db->heights, total);
+
+  prev = NULL;
+  pos = 0;
+
+  for (i = 0; i < total; i += n) {
+    n = total - i;
+
+    if (n > INDEX_BATCH_SIZE)
+      n = INDEX_BATCH_SIZE;
+
+    if (!btc_fs_pread(db->index_fd, buf, n * INDEX_RECORD_SIZE, pos))
+      goto fail;
+
+    pos += n * INDEX_RECORD_SIZE;
+
+    for (j = 0; j < n; j++) {
+      entry = btc_slab_alloc(&db->entries);
+
+      CHECK(index_record_read(entry, buf + j * INDEX_RECORD_SIZE));
+
+      db->heights.items[i + j] = entry;
+
+      /* Every record must link to the one below it. */
+      if ((size_t)entry->height != i + j)
+        goto fail;
+
+      if (prev != NULL) {
+        if (memcmp(entry->header.prev_block, prev->hash, 32) != 0)
+          goto fail;
+
+        entry->prev = prev;
+        prev->next = entry;
+      }
+
+      prev = entry;
+    }
+  }
+
+  if (memcmp(prev->hash, tip_hash, 32) != 0)
+    goto fail;
+
+  btc_hashmap_resize(db->hashes, (total * 4) / 3 + 1);
+
+  for (i = 0; i < total; i++) {
+    entry = db->heights.items[i];
+
+    CHECK(btc_hashmap_put(db->hashes, entry->hash, entry));
+  }
+
+  db->head = db->heights.items[0];
+  db->tail = prev;
+
+  return 1;
+fail:
+  /* Nothing else has been allocated yet. */
+  btc_vector_reset(&db->heights);
+  btc_slab_clear(&db->entries);
+  return 0;
+}
+
+static void
+btc_chaindb_load_branch(btc_chaindb_t *db,
+                        lsm_cursor *cur,
+                        const uint8_t *tip_hash) {
+  /* Walk back from a tip until we reach a known entry. */
+  btc_entry_t *entry, *child = NULL;
+  uint8_t hash[32];
+
+  memcpy(hash, tip_hash, 32);
+
+  while (!btc_hashmap_has(db->hashes, hash)) {
+    entry = read_entry(db, cur, hash);
+
+    CHECK(entry != NULL);
+    CHECK(entry->height > 0);
+    CHECK(btc_hashmap_put(db->hashes, entry->hash, entry));
+
+    if (child != NULL)
+      child->prev = entry;
+
+    child = entry;
+
+    memcpy(hash, entry->header.prev_block, 32);
+  }
+
+  if (child != NULL)
+    child->prev = btc_hashmap_get(db->hashes, hash);
+}
+
+static void
+btc_chaindb_load_side(btc_chaindb_t *db, lsm_cursor *cur) {
+  lsm_cursor *tips;
+  const void *kp;
+  int kn;
+
+  CHECK(lsm_csr_open(db->lsm, &tips) == 0);
+
+  /* Anything outside of the main chain is an
+     ancestor of some stored tip. */
+  CHECK(lsm_csr_seek(tips, tip_min, sizeof(tip_min), LSM_SEEK_GE) == 0);
+
+  while (lsm_csr_le(tips, tip_max, sizeof(tip_max))) {
+    CHECK(lsm_csr_key(tips, &kp, &kn) == 0);
+    CHECK(kn == TIP_KEYLEN);
+
+    btc_chaindb_load_branch(db, cur, (const uint8_t *)kp + 1);
+
+    CHECK(lsm_csr_next(tips) == 0);
+  }
+
+  CHECK(lsm_csr_close(tips) == 0);
+}
+
+static void
+btc_chaindb_scan_index(btc_chaindb_t *db, lsm_cursor *cur,
+                                          const uint8_t *tip_hash) {
+  btc_entry_t *entry, *tip;
+  btc_entry_t *gen = NULL;
+  btc_hashmapiter_t iter;
+  const void *vp;
+  int vn;
+
+  /* Read block index and create hash->entry map. */
+  CHECK(lsm_csr_seek(cur, entry_min, sizeof(entry_min), LSM_SEEK_GE) == 0);
+
+  while (lsm_csr_le(cur, entry_max, sizeof(entry_max))) {
+    entry = btc_chaindb_create_entry(db);
+
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+
+    CHECK(btc_entry_import(entry, vp, vn));
+    CHECK(btc_hashmap_put(db->hashes, entry->hash, entry));
+
+    CHECK(lsm_csr_next(cur) == 0);
+  }
+
+  /* Create `prev` links and retrieve genesis block. */
+  btc_hashmap_iterate(&iter, db->hashes);
+
+  while (btc_hashmap_next(&iter)) {
+    entry = iter.val;
+
+    if (entry->height == 0) {
+      gen = entry;
+      continue;
+    }
+
+    entry->prev = btc_hashmap_get(db->hashes, entry->header.prev_block);
+
+    CHECK(entry->prev != NULL);
+  }
+
+  CHECK(gen != NULL);
+
+  /* Retrieve tip. */
+  tip = btc_hashmap_get(db->hashes, tip_hash);
+
+  CHECK(tip != NULL);
+
+  /* Create height->entry vector. */
+  btc_vector_grow(&db->heights, (btc_hashmap_size(db->hashes) * 3) / 2);
+  btc_vector_resize(&db->heights, tip->height + 1);
+
+  /* Populate height vector and create `next` links. */
+  entry = tip;
+
+  do {
+    CHECK((size_t)entry->height < db->heights.length);
+
+    db->heights.items[entry->height] = entry;
+
+    if (entry->prev != NULL)
+      entry->prev->next = entry;
+
+    entry = entry->prev;
+  } while (entry != NULL);
+
+  db->head = gen;
+  db->tail = tip;
+}
+
+static void
+btc_chaindb_load_skips(btc_chaindb_t *db) {
+  btc_hashmapiter_t iter;
+  size_t i;
+
+  /* Main chain first, in height order, so
+     each entry can lean on the skips below. */
+  for (i = 0; i < db->heights.length; i++)
+    btc_entry_build_skip(db->heights.items[i]);
+
+  btc_hashmap_iterate(&iter, db->hashes);
+
+  while (btc_hashmap_next(&iter)) {
+    btc_entry_t *entry = iter.val;
+
+    if (!btc_chaindb_is_main(db, entry))
+      btc_entry_build_skip(entry);
+  }
+}
+
+static int
+btc_chaindb_read_tip(btc_chaindb_t *db, lsm_cursor *cur, uint8_t *hash) {
+  const void *vp;
+  int vn;
+
+  /* A replica stops at the block the coins on disk
+     correspond to: anything past it may still be
+     sitting in the primary's coin cache. */
+  if (db->flags & BTC_CHAIN_READONLY) {
+    CHECK(lsm_csr_seek(cur, state_key, 1, LSM_SEEK_EQ) == 0);
+
+    if (lsm_csr_valid(cur)) {
+      CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+      CHECK(vn == 32);
+
+      memcpy(hash, vp, 32);
+
+      return 1;
+    }
+  }
+
+  CHECK(lsm_csr_seek(cur, meta_key, 1, LSM_SEEK_EQ) == 0);
+
+  if (!lsm_csr_valid(cur))
+    return 0;
+
+  CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+  CHECK(vn == 32);
+
+  memcpy(hash, vp, 32);
+
+  return 1;
+}
+
+static int
+btc_chaindb_load_index(btc_chaindb_t *db) {
+  int readonly = (db->flags & BTC_CHAIN_READONLY) != 0;
+  char path[BTC_PATH_MAX];
+  uint8_t tip_hash[32];
+  lsm_cursor *cur;
+
+  /* Open flat index. */
+  if (!btc_path_join(path, sizeof(path), db->prefix, "index.dat", 0))
+    return 0;
+
+  if (readonly)
+    db->index_fd = btc_fs_open(path, BTC_O_RDONLY, 0);
+  else
+    db->index_fd = btc_fs_open(path, BTC_O_RDWR | BTC_O_CREAT, 0644);
+
+  if (db->index_fd == -1)
+    return 0;
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+
+  /* Read tip hash. */
+  if (!btc_chaindb_read_tip(db, cur, tip_hash)) {
+    CHECK(lsm_csr_close(cur) == 0);
+
+    if (readonly) {
+      fprintf(stderr, "Database has no chain to follow.\n");
+      return 0;
+    }
+
+    return btc_chaindb_init_index(db);
+  }
+
+  /* Materialize the main chain from the flat index
+     if it agrees with the database, otherwise fall
+     back to a full scan and rewrite the index. */
+  if (btc_chaindb_load_flat(db, cur, tip_hash)) {
+    btc_chaindb_load_side(db, cur);
+  } else {
+    btc_chaindb_scan_index(db, cur, tip_hash);
+
+    if (!readonly)
+      btc_chaindb_rebuild_index(db);
+  }
+
+  btc_chaindb_load_skips(db);
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  return 1;
+}
+
+static void
+btc_chaindb_unload_index(btc_chaindb_t *db) {
+  btc_hashmap_reset(db->hashes);
+  btc_vector_clear(&db->heights);
+  btc_slab_clear(&db->entries);
+
+  btc_fs_close(db->index_fd);
+
+  db->index_fd = -1;
+  db->head = NULL;
+  db->tail = NULL;
+}
+
+static int
+btc_chaindb_load_layout(btc_chaindb_t *db);
+
+static int
+btc_chaindb_load_coins(btc_chaindb_t *db);
+
+static int
+btc_chaindb_load_stats(btc_chaindb_t *db);
+
+static int
+btc_chaindb_load_txindex(btc_chaindb_t *db);
+
+void
+btc_chaindb_set_cache(btc_chaindb_t *db, size_t size) {
+  db->cache.limit = size;
+}
+
+void
+btc_chaindb_set_prune(btc_chaindb_t *db, int64_t size) {
+  db->prune_target = size;
+}
+
+void
+btc_chaindb_set_bulk(btc_chaindb_t *db, int bulk) {
+  if (db->bulk == bulk)
+    return;
+
+  /* Tuning is the primary's business. */
+  if (db->flags & BTC_CHAIN_READONLY) {
+    db->bulk = bulk;
+    return;
+  }
+
+  CHECK(btc_chaindb_commit_batch(db));
+  CHECK(lsm_tune(db->lsm, &db->tune, bulk,
+                 (db->flags & BTC_CHAIN_WORKER) != 0) == 0);
+
+  db->bulk = bulk;
+}
+
+void
+btc_chaindb_set_tune(btc_chaindb_t *db, const btc_dbtune_t *tune) {
+  /* Read when the database is opened. */
+  CHECK(db->lsm == NULL);
+
+  db->tune = *tune;
+}
+
+const btc_dbtune_t *
+btc_chaindb_tune(btc_chaindb_t *db) {
+  return &db->tune;
+}
+
+const char *
+btc_chaindb_prefix(btc_chaindb_t *db) {
+  return db->prefix;
+}
+
+void
+btc_chaindb_counters(btc_chaindb_t *db, btc_dbstats_t *stats) {
+  /* Everything but the level walk. Cheap
+     enough to poll and never allocates. */
+  memset(stats, 0, sizeof(*stats));
+
+  lsm_info(db->lsm, LSM_INFO_TREE_SIZE, &stats->tree_old, &stats->tree_new);
+  lsm_info(db->lsm, LSM_INFO_CHECKPOINT_SIZE, &stats->checkpoint);
+  lsm_info(db->lsm, LSM_INFO_NREAD, &stats->pages_read);
+  lsm_info(db->lsm, LSM_INFO_NWRITE, &stats->pages_written);
+
+  stats->cache_usage = db->cache.usage;
+  stats->cache_limit = db->cache.limit;
+  stats->cache_hits = db->cache.hits;
+  stats->cache_misses = db->cache.misses;
+}
+
+void
+btc_chaindb_stats(btc_chaindb_t *db, btc_dbstats_t *stats) {
+  /* Merge debt: every level holds one or more
+     segments which have yet to be merged down. */
+  char *str = NULL;
+  int depth = 0;
+  char *p;
+
+  btc_chaindb_counters(db, stats);
+
+  if (lsm_info(db->lsm, LSM_INFO_DB_STRUCTURE, &str) != LSM_OK)
+    return;
+
+  for (p = str; p != NULL && *p != '\0'; p++) {
+    if (*p == '{') {
+      depth++;
+
+      if (depth == 1)
+        stats->levels++;
+      else if (depth == 2)
+        stats->segments++;
+    } else if (*p == '}') {
+      depth--;
+    }
+  }
+
+  lsm_free(lsm_get_env(db->lsm), str);
+}
+
+char *
+btc_chaindb_structure(btc_chaindb_t *db) {
+  char *str = NULL;
+  char *out;
+
+  if (lsm_info(db->lsm, LSM_INFO_DB_STRUCTURE, &str) != LSM_OK)
+    return NULL;
+
+  if (str == NULL)
+    return NULL;
+
+  out = btc_strdup(str);
+
+  lsm_free(lsm_get_env(db->lsm), str);
+
+  return out;
+}
+
+void
+btc_chaindb_sync_stats(btc_chaindb_t *db, btc_hist_t *hist) {
+  btc_blockwriter_t *w = &db->writer;
+
+  btc_mutex_lock(w->lock);
+
+  *hist = w->syncs;
+
+  btc_mutex_unlock(w->lock);
+}
+
+int
+btc_chaindb_open(btc_chaindb_t *db,
+                 const char *prefix,
+                 unsigned int flags) {
+  db->flags = flags;
+  db->last_flush = btc_now();
+
+  /* Mapping every block file needs a 64-bit address space, and
+     pruning would unmap files which may still be referenced. */
+  if (sizeof(void *) < 8 || (flags & BTC_CHAIN_PRUNE))
+    db->flags &= ~BTC_CHAIN_MMAP;
+
+#ifndef USE_WORKER
+  /* The background threads need the native backend. */
+  db->flags &= ~BTC_CHAIN_WORKER;
+#endif
+
+  /* A replica never writes, and the primary may be
+     appending to any file we would map. */
+  if (flags & BTC_CHAIN_READONLY) {
+    db->flags &= ~(BTC_CHAIN_MMAP | BTC_CHAIN_WORKER | BTC_CHAIN_REINDEX);
+    db->flags &= ~BTC_CHAIN_COINSTATS;
+  }
+
+  /* An in-memory database starts out empty and
+     has no reason to sync anything to disk. */
+  if (flags & BTC_CHAIN_MEMORY) {
+    db->flags &= ~BTC_CHAIN_REINDEX;
+    db->tune.safety = 0;
+  }
+
+  /* Index entries and cached coins are hit at random;
+     backing their slabs with huge pages saves on TLB
+     misses. Either falls back to the heap if the
+     system won't hand any out. */
+  if (flags & BTC_CHAIN_HUGEPAGES) {
+    btc_slab_backing(&db->entries, btc_sys_hugealloc, btc_sys_hugefree);
+    btc_slab_backing(&db->cache.entries, btc_sys_hugealloc, btc_sys_hugefree);
+  } else {
+    btc_slab_backing(&db->entries, NULL, NULL);
+    btc_slab_backing(&db->cache.entries, NULL, NULL);
+  }
+
+  if (!btc_chaindb_load_prefix(db, prefix))
+    return 0;
+
+  if ((flags & BTC_CHAIN_REINDEX) && !btc_chaindb_wipe(db))
+    return 0;
+
+  if (!btc_chaindb_load_database(db))
+    return 0;
+
+  if (!btc_chaindb_load_files(db))
+    return 0;
+
+  if (!btc_chaindb_load_layout(db))
+    return 0;
+
+  if (!btc_chaindb_load_index(db))
+    return 0;
+
+  if (!btc_chaindb_load_coins(db))
+    return 0;
+
+  if (!btc_chaindb_load_stats(db))
+    return 0;
+
+  if (!btc_chaindb_load_txindex(db))
+    return 0;
+
+  return 1;
+}
+
+void
+btc_chaindb_close(btc_chaindb_t *db) {
+  CHECK(db->readers == 0);
+  CHECK(btc_chaindb_flush(db));
+
+  btc_coincache_reset(&db->cache);
+  btc_chaindb_unload_index(db);
+  btc_chaindb_unload_files(db);
+  btc_chaindb_unload_database(db);
+
+  if (db->flags & BTC_CHAIN_MEMORY)
+    btc_chaindb_remove_scratch(db);
+}
+
+int
+btc_chaindb_reindex_path(btc_chaindb_t *db, char *path, size_t size) {
+  return btc_path_join(path, size, db->prefix, "blocks.reindex", 0);
+}
+
+void
+btc_chaindb_reindex_done(btc_chaindb_t *db) {
+  char path[BTC_PATH_MAX];
+
+  if (btc_chaindb_reindex_path(db, path, sizeof(path)))
+    btc_chaindb_remove_dir(path);
+}
+
+static int
+prevout_cmp(const void *xp, const void *yp) {
+  const btc_outpoint_t *x = (const btc_outpoint_t *)xp;
+  const btc_outpoint_t *y = (const btc_outpoint_t *)yp;
+  int cmp = memcmp(x->hash, y->hash, 32);
+
+  if (cmp != 0)
+    return cmp;
+
+  if (x->index != y->index)
+    return x->index < y->index ? -1 : 1;
+
+  return 0;
+}
+
+/*
+ * Coin Groups
+ */
+
+/* A database created with BTC_CHAIN_COINGROUPS keeps
+ * every unspent output of a tx in a single record,
+ * keyed by a salted 8 byte tag of the txid in place
+ * of the full txid and index. A tx then pays for its
+ * txid once, and spending several outputs of one
+ * parent costs one lookup. Tags may collide, so a
+ * record is a list of txs, sorted by txid:
+ *
+ *   [txid] [size] ([index] [size] [coin])...
+ *
+ * The salt is chosen when the database is created
+ * and keeps anyone from grinding txids into one
+ * oversized record.
+ */
+
+typedef struct btc_groupiter_s {
+  const uint8_t *xp;
+  size_t xn;
+  const uint8_t *rp;
+  size_t rn;
+  const uint8_t *hash;
+  uint32_t index;
+  const uint8_t *cp;
+  size_t cn;
+} btc_groupiter_t;
+
+typedef struct btc_grouped_s {
+  uint64_t tag;
+  btc_cached_t *entry;
+} btc_grouped_t;
+
+static uint64_t
+group_tag(const btc_chaindb_t *db, const uint8_t *hash) {
+  return btc_siphash_sum(hash, 32, db->salt);
+}
+
+static void
+group_key(uint8_t *key, uint64_t tag) {
+  key[0] = GROUP_PREFIX;
+  btc_write64be(key + 1, tag);
+}
+
+static int
+group_record(const uint8_t **hp,
+             const uint8_t **rp,
+             size_t *rn,
+             const uint8_t **xp,
+             size_t *xn) {
+  if (*xn == 0)
+    return 0;
+
+  CHECK(*xn >= 32);
+
+  *hp = *xp;
+  *xp += 32;
+  *xn -= 32;
+
+  CHECK(btc_size_read(rn, xp, xn));
+  CHECK(*rn <= *xn);
+
+  *rp = *xp;
+  *xp += *rn;
+  *xn -= *rn;
+
+  return 1;
+}
+
+static int
+group_entry(uint32_t *index,
+            const uint8_t **cp,
+            size_t *cn,
+            const uint8_t **xp,
+            size_t *xn) {
+  size_t idx;
+
+  if (*xn == 0)
+    return 0;
+
+  CHECK(btc_size_read(&idx, xp, xn));
+  CHECK(btc_size_read(cn, xp, xn));
+  CHECK(idx <= UINT32_MAX && *cn <= *xn);
+
+  *index = idx;
+  *cp = *xp;
+  *xp += *cn;
+  *xn -= *cn;
+
+  return 1;
+}
+
+static void
+btc_groupiter_init(btc_groupiter_t *it, const void *vp, int vn) {
+  it->xp = (const uint8_t *)vp;
+  it->xn = vn;
+  it->rp = NULL;
+  it->rn = 0;
+}
+
+static int
+btc_groupiter_next(btc_groupiter_t *it) {
+  while (it->rn == 0) {
+    if (!group_record(&it->hash, &it->rp, &it->rn, &it->xp, &it->xn))
+      return 0;
+  }
+
+  return group_entry(&it->index, &it->cp, &it->cn, &it->rp, &it->rn);
+}
+
+static btc_coin_t *
+group_coin(const void *vp, int vn, const btc_outpoint_t *prevout) {
+  btc_groupiter_t it;
+  btc_coin_t *coin;
+
+  btc_groupiter_init(&it, vp, vn);
+
+  while (btc_groupiter_next(&it)) {
+    if (it.index != prevout->index)
+      continue;
+
+    if (memcmp(it.hash, prevout->hash, 32) != 0)
+      continue;
+
+    coin = btc_coin_create();
+
+    CHECK(btc_coin_import(coin, it.cp, it.cn));
+
+    return coin;
+  }
+
+  return NULL;
+}
+
+static uint8_t *
+group_reserve(btc_buffer_t *z, size_t zn) {
+  if (z->length + zn > z->alloc)
+    btc_buffer_grow(z, (z->length + zn) * 2);
+
+  return z->data + z->length;
+}
+
+static void
+group_append(btc_buffer_t *z, uint32_t index, const uint8_t *cp, size_t cn) {
+  uint8_t *zp = group_reserve(z, 18 + cn);
+
+  zp = btc_size_write(zp, index);
+  zp = btc_size_write(zp, cn);
+  zp = btc_raw_write(zp, cp, cn);
+
+  z->length = zp - z->data;
+}
+
+static void
+group_append_coin(btc_buffer_t *z, uint32_t index, const btc_coin_t *coin) {
+  size_t cn = btc_coin_size(coin);
+  uint8_t *zp = group_reserve(z, 18 + cn);
+
+  zp = btc_size_write(zp, index);
+  zp = btc_size_write(zp, cn);
+  zp = btc_coin_write(zp, coin);
+
+  z->length = zp - z->data;
+}
+
+static void
+group_merge_tx(btc_buffer_t *z,
+               btc_buffer_t *tmp,
+               const uint8_t *hash,
+               const uint8_t *xp,
+               size_t xn,
+               const btc_grouped_t *items,
+               size_t len) {
+  /* Entries are sorted by index, as are the updates. */
+  const uint8_t *cp = NULL;
+  uint32_t index = 0;
+  size_t cn = 0;
+  int have = group_entry(&index, &cp, &cn, &xp, &xn);
+  size_t i = 0;
+  uint8_t *zp;
+
+  tmp->length = 0;
+
+  while (have || i < len) {
+    const btc_cached_t *entry = i < len ? items[i].entry : NULL;
+
+    if (entry != NULL && (!have || entry->key.index <= index)) {
+      if (have && entry->key.index == index)
+        have = group_entry(&index, &cp, &cn, &xp, &xn);
+
+      if (entry->coin != NULL)
+        group_append_coin(tmp, entry->key.index, entry->coin);
+
+      i++;
+    } else {
+      group_append(tmp, index, cp, cn);
+
+      have = group_entry(&index, &cp, &cn, &xp, &xn);
+    }
+  }
+
+  /* Fully spent txs leave the record. */
+  if (tmp->length == 0)
+    return;
+
+  zp = group_reserve(z, 32 + 9 + tmp->length);
+  zp = btc_raw_write(zp, hash, 32);
+  zp = btc_size_write(zp, tmp->length);
+  zp = btc_raw_write(zp, tmp->data, tmp->length);
+
+  z->length = zp - z->data;
+}
+
+static void
+group_merge(btc_buffer_t *z,
+            btc_buffer_t *tmp,
+            const uint8_t *xp,
+            size_t xn,
+            const btc_grouped_t *items,
+            size_t len) {
+  /* Apply updates sorted by (txid, index) to a record. */
+  const uint8_t *hp = NULL;
+  const uint8_t *rp = NULL;
+  size_t rn = 0;
+  int have = group_record(&hp, &rp, &rn, &xp, &xn);
+  size_t i = 0;
+  size_t j;
+  int cmp;
+
+  z->length = 0;
+
+  while (have || i < len) {
+    const uint8_t *hash = i < len ? items[i].entry->key.hash : NULL;
+    uint8_t *zp;
+
+    if (!have)
+      cmp = 1;
+    else if (hash == NULL)
+      cmp = -1;
+    else
+      cmp = memcmp(hp, hash, 32);
+
+    if (cmp < 0) {
+      zp = group_reserve(z, 32 + 9 + rn);
+      zp = btc_raw_write(zp, hp, 32);
+      zp = btc_size_write(zp, rn);
+      zp = btc_raw_write(zp, rp, rn);
+
+      z->length = zp - z->data;
+
+      have = group_record(&hp, &rp, &rn, &xp, &xn);
+
+      continue;
+    }
+
+    for (j = i + 1; j < len; j++) {
+      if (memcmp(items[j].entry->key.hash, hash, 32) != 0)
+        break;
+    }
+
+    if (cmp == 0) {
+      group_merge_tx(z, tmp, hash, rp, rn, items + i, j - i);
+      have = group_record(&hp, &rp, &rn, &xp, &xn);
+    } else {
+      group_merge_tx(z, tmp, hash, NULL, 0, items + i, j - i);
+    }
+
+    i = j;
+  }
+}
+
+static int
+grouped_cmp(const void *xp, const void *yp) {
+  const btc_grouped_t *x = (const btc_grouped_t *)xp;
+  const btc_grouped_t *y = (const btc_grouped_t *)yp;
+
+  if (x->tag != y->tag)
+    return x->tag < y->tag ? -1 : 1;
+
+  return prevout_cmp(&x->entry->key, &y->entry->key);
+}
+
+static void
+read_group_raw(btc_chaindb_t *db, const uint8_t *key, btc_buffer_t *z) {
+  /* Copied out: the cursor cannot be held across a write. */
+  lsm_cursor *cur;
+  const void *vp;
+  int vn;
+
+  z->length = 0;
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, key, GROUP_KEYLEN, LSM_SEEK_EQ) == 0);
+
+  if (lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+
+    if (vn > 0)
+      btc_buffer_set(z, vp, vn);
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+}
+
+static int
+write_groups(btc_chaindb_t *db, btc_cached_t **entries, size_t count) {
+  btc_grouped_t *items;
+  btc_buffer_t old, val, tmp;
+  uint8_t key[GROUP_KEYLEN];
+  size_t i, j;
+  int rc = 0;
+
+  if (count == 0)
+    return 1;
+
+  items = (btc_grouped_t *)btc_malloc(count * sizeof(btc_grouped_t));
+
+  for (i = 0; i < count; i++) {
+    items[i].tag = group_tag(db, entries[i]->key.hash);
+    items[i].entry = entries[i];
+  }
+
+  /* Every update to a record is applied at once. */
+  qsort(items, count, sizeof(btc_grouped_t), grouped_cmp);
+
+  btc_buffer_init(&old);
+  btc_buffer_init(&val);
+  btc_buffer_init(&tmp);
+
+  for (i = 0; i < count && rc == 0; i = j) {
+    for (j = i + 1; j < count; j++) {
+      if (items[j].tag != items[i].tag)
+        break;
+    }
+
+    group_key(key, items[i].tag);
+
+    read_group_raw(db, key, &old);
+
+    group_merge(&val, &tmp, old.data, old.length, items + i, j - i);
+
+    if (val.length > 0)
+      rc = lsm_insert(db->lsm, key, sizeof(key), val.data, val.length);
+    else if (old.length > 0)
+      rc = lsm_delete(db->lsm, key, sizeof(key));
+
+    if (rc != 0)
+      fprintf(stderr, "lsm_insert: %s\n", lsm_strerror(rc));
+  }
+
+  btc_buffer_clear(&old);
+  btc_buffer_clear(&val);
+  btc_buffer_clear(&tmp);
+  btc_free(items);
+
+  return rc == 0;
+}
+
+static btc_coin_t *
+read_group(btc_chaindb_t *db,
+           lsm_cursor *cur,
+           int *ready,
+           const btc_outpoint_t *prevout) {
+  uint8_t key[GROUP_KEYLEN];
+  const void *vp;
+  int cmp = -1;
+  int rc, vn;
+
+  group_key(key, group_tag(db, prevout->hash));
+
+  /* Siblings of the last coin read share its record. */
+  if (*ready && lsm_csr_valid(cur))
+    CHECK(lsm_csr_cmp(cur, key, sizeof(key), &cmp) == 0);
+
+  if (cmp != 0) {
+    rc = lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_EQ);
+
+    if (rc != 0) {
+      fprintf(stderr, "lsm_csr_seek: %s\n", lsm_strerror(rc));
+      *ready = 0;
+      return NULL;
+    }
+
+    *ready = 1;
+
+    if (!lsm_csr_valid(cur))
+      return NULL;
+  }
+
+  CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+
+  return group_coin(vp, vn, prevout);
+}
+
+static int
+btc_chaindb_load_layout(btc_chaindb_t *db) {
+  /* The layout is fixed when the database is created. */
+  uint8_t raw[17];
+  lsm_cursor *cur;
+  const void *vp;
+  int fresh, vn;
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, layout_key, 1, LSM_SEEK_EQ) == 0);
+
+  if (lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+    CHECK(vn == 17 && *((const uint8_t *)vp) == 1);
+
+    memcpy(db->salt, (const uint8_t *)vp + 1, 16);
+
+    db->grouped = 1;
+
+    CHECK(lsm_csr_close(cur) == 0);
+
+    return 1;
+  }
+
+  CHECK(lsm_csr_seek(cur, meta_key, 1, LSM_SEEK_EQ) == 0);
+
+  fresh = !lsm_csr_valid(cur);
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  if (!(db->flags & BTC_CHAIN_COINGROUPS))
+    return 1;
+
+  /* Replicas take whatever layout the primary chose. */
+  if (db->flags & BTC_CHAIN_READONLY)
+    return 1;
+
+  if (!fresh) {
+    fprintf(stderr, "Coin groups apply to new databases only"
+                    " (reindex to convert).\n");
+    return 1;
+  }
+
+  raw[0] = 1;
+
+  btc_getrandom(raw + 1, 16);
+
+  if (lsm_begin(db->lsm, 1) != 0)
+    return 0;
+
+  if (lsm_insert(db->lsm, layout_key, 1, raw, sizeof(raw)) != 0
+      || lsm_commit(db->lsm, 0) != 0) {
+    CHECK(lsm_rollback(db->lsm, 0) == 0);
+    return 0;
+  }
+
+  memcpy(db->salt, raw + 1, 16);
+
+  db->grouped = 1;
+
+  return 1;
+}
+
+/*
+ * Coin Iterator
+ */
+
+/* Walks every coin on disk in key order, whatever
+   the layout. Ranges start at a two byte prefix. */
+typedef struct btc_coiniter_s {
+  lsm_cursor *cur;
+  int grouped;
+  int ready;
+  btc_groupiter_t group;
+  const uint8_t *kp;
+  const uint8_t *hash;
+  uint32_t index;
+  const uint8_t *cp;
+  size_t cn;
+} btc_coiniter_t;
+
+static void
+btc_coiniter_init(btc_coiniter_t *it,
+                  btc_chaindb_t *db,
+                  lsm_cursor *cur,
+                  uint32_t start) {
+  size_t len = db->grouped ? GROUP_KEYLEN : COIN_KEYLEN;
+  uint8_t min[COIN_KEYLEN];
+
+  memcpy(min, db->grouped ? group_min : coin_min, len);
+
+  min[1] = (start >> 8) & 0xff;
+  min[2] = (start >> 0) & 0xff;
+
+  it->cur = cur;
+  it->grouped = db->grouped;
+  it->ready = 0;
+  it->kp = NULL;
+
+  btc_groupiter_init(&it->group, NULL, 0);
+
+  CHECK(lsm_csr_seek(cur, min, len, LSM_SEEK_GE) == 0);
+}
+
+static int
+btc_coiniter_next(btc_coiniter_t *it) {
+  const uint8_t *max = it->grouped ? group_max : coin_max;
+  int len = it->grouped ? GROUP_KEYLEN : COIN_KEYLEN;
+  const void *kp, *vp;
+  int kn, vn;
+
+  for (;;) {
+    if (btc_groupiter_next(&it->group)) {
+      it->hash = it->group.hash;
+      it->index = it->group.index;
+      it->cp = it->group.cp;
+      it->cn = it->group.cn;
+      return 1;
+    }
+
+    if (it->ready)
+      CHECK(lsm_csr_next(it->cur) == 0);
+
+    it->ready = 1;
+
+    if (!lsm_csr_le(it->cur, max, len))
+      return 0;
+
+    CHECK(lsm_csr_key(it->cur, &kp, &kn) == 0);
+    CHECK(lsm_csr_value(it->cur, &vp, &vn) == 0);
+    CHECK(kn == len);
+
+    it->kp = (const uint8_t *)kp;
+
+    if (it->grouped) {
+      btc_groupiter_init(&it->group, vp, vn);
+      continue;
+    }
+
+    it->hash = it->kp + 1;
+    it->index = btc_read32be(it->kp + 33);
+    it->cp = (const uint8_t *)vp;
+    it->cn = vn;
+
+    return 1;
+  }
+}
+
+static btc_coin_t *
+read_db(btc_chaindb_t *db, lsm_cursor *cur, const btc_outpoint_t *prevout) {
+  uint8_t key[COIN_KEYLEN];
+  btc_coin_t *coin;
+  const void *vp;
+  int rc, vn;
+
+  if (db->grouped) {
+    int ready = 0;
+    return read_group(db, cur, &ready, prevout);
+  }
+
+  coin_key(key, prevout->hash, prevout->index);
+
+  rc = lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_EQ);
+
+  if (rc != 0) {
+    fprintf(stderr, "lsm_csr_seek: %s\n", lsm_strerror(rc));
+    return NULL;
+  }
+
+  if (!lsm_csr_valid(cur))
+    return NULL;
+
+  coin = btc_coin_create();
+
+  CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+  CHECK(btc_coin_import(coin, vp, vn));
+
+  return coin;
+}
+
+/* Keys past the last one read but under the same
+   txid (the usual case for several inputs spending
+   one tx) are reached by stepping the cursor rather
+   than seeking down every level of the tree again. */
+#define COIN_MAX_STEPS 8
+
+static btc_coin_t *
+read_next(btc_chaindb_t *db,
+          lsm_cursor *cur,
+          int *ready,
+          const btc_outpoint_t *prevout) {
+  uint8_t key[COIN_KEYLEN];
+  const void *kp, *vp;
+  int rc, kn, vn;
+  int steps = 0;
+  int cmp = -1;
+  btc_coin_t *coin;
+
+  if (db->grouped)
+    return read_group(db, cur, ready, prevout);
+
+  coin_key(key, prevout->hash, prevout->index);
+
+  /* Keys arrive in order, and the cursor sits on the
+     first key at or after the previous one. Anything
+     it has already passed is not in the database. */
+  while (*ready) {
+    if (!lsm_csr_valid(cur)) {
+      cmp = 1;
+      break;
+    }
+
+    CHECK(lsm_csr_cmp(cur, key, sizeof(key), &cmp) == 0);
+
+    if (cmp >= 0)
+      break;
+
+    CHECK(lsm_csr_key(cur, &kp, &kn) == 0);
+
+    if (kn < 33 || memcmp(kp, key, 33) != 0)
+      break;
+
+    if (steps++ == COIN_MAX_STEPS)
+      break;
+
+    CHECK(lsm_csr_next(cur) == 0);
+  }
+
+  if (cmp < 0) {
+    rc = lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_GE);
+
+    if (rc != 0) {
+      fprintf(stderr, "lsm_csr_seek: %s\n", lsm_strerror(rc));
+      *ready = 0;
+      return NULL;
+    }
+
+    *ready = 1;
+
+    if (!lsm_csr_valid(cur))
+      return NULL;
+
+    CHECK(lsm_csr_cmp(cur, key, sizeof(key), &cmp) == 0);
+  }
+
+  if (cmp != 0)
+    return NULL;
+
+  coin = btc_coin_create();
+
+  CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+  CHECK(btc_coin_import(coin, vp, vn));
+
+  return coin;
+}
+
+static void
+read_batch(btc_chaindb_t *db,
+           lsm_cursor *cur,
+           btc_view_t *view,
+           btc_outpoint_t *prevouts,
+           size_t len,
+           int shared) {
+  /* Shared readers never touch the cache: it belongs to the chain. */
+  btc_coincache_t *cache = &db->cache;
+  const btc_outpoint_t *prevout;
+  btc_cached_t *entry;
+  btc_coin_t *coin;
+  int ready = 0;
+  size_t i;
+  int tag;
+
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_COINS);
+
+  /* Visit keys in database order so the cursor only moves forward. */
+  qsort(prevouts, len, sizeof(btc_outpoint_t), prevout_cmp);
+
+  for (i = 0; i < len; i++) {
+    prevout = &prevouts[i];
+
+    if (i > 0 && prevout_cmp(&prevouts[i - 1], prevout) == 0)
+      continue;
+
+    if (btc_view_has(view, prevout))
+      continue;
+
+    entry = btc_coincache_get(cache, prevout);
+
+    if (entry != NULL) {
+      if (!shared)
+        cache->hits++;
+
+      /* The view mutates its coins; hand out a copy. */
+      if (entry->coin != NULL)
+        btc_view_put(view, prevout, btc_coin_clone(entry->coin));
+
+      continue;
+    }
+
+    if (!shared)
+      cache->misses++;
+
+    /* Missing coins are left for the caller to report. */
+    coin = read_next(db, cur, &ready, prevout);
+
+    if (coin == NULL)
+      continue;
+
+    if (!shared && cache->usage < cache->limit)
+      btc_coincache_put(cache, prevout, btc_coin_clone(coin), 0);
+
+    btc_view_put(view, prevout, coin);
+  }
+
+  BTC_MEMTAG_POP(tag);
+}
+
+static void
+read_inputs(btc_chaindb_t *db,
+            lsm_cursor *cur,
+            btc_view_t *view,
+            const btc_tx_t *tx,
+            int shared) {
+  btc_outpoint_t *prevouts;
+  size_t i;
+
+  if (tx->inputs.length == 0)
+    return;
+
+  prevouts = (btc_outpoint_t *)btc_malloc(tx->inputs.length
+                                          * sizeof(btc_outpoint_t));
+
+  for (i = 0; i < tx->inputs.length; i++)
+    prevouts[i] = tx->inputs.items[i]->prevout;
+
+  read_batch(db, cur, view, prevouts, tx->inputs.length, shared);
+
+  btc_free(prevouts);
+}
+
+static btc_coin_t *
+read_none(const btc_outpoint_t *prevout, void *arg1, void *arg2) {
+  /* Whatever the batch did not find does not exist. */
+  (void)prevout;
+  (void)arg1;
+  (void)arg2;
+  return NULL;
+}
+
+int
+btc_chaindb_spend(btc_chaindb_t *db,
+                  btc_view_t *view,
+                  const btc_tx_t *tx) {
+  lsm_cursor *cur;
+  int rc;
+
+  rc = lsm_csr_open(db->lsm, &cur);
+
+  if (rc != 0) {
+    fprintf(stderr, "lsm_csr_open: %s\n", lsm_strerror(rc));
+    return 0;
+  }
+
+  btc_rwlock_wrlock(db->state);
+
+  read_inputs(db, cur, view, tx, 0);
+
+  rc = btc_view_spend(view, tx, read_none, NULL, NULL);
+
+  btc_rwlock_wrunlock(db->state);
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  return rc;
+}
+
+int
+btc_chaindb_fill(btc_chaindb_t *db,
+                 btc_view_t *view,
+                 const btc_tx_t *tx) {
+  lsm_cursor *cur;
+  int rc;
+
+  rc = lsm_csr_open(db->lsm, &cur);
+
+  if (rc != 0) {
+    fprintf(stderr, "lsm_csr_open: %s\n", lsm_strerror(rc));
+    return 0;
+  }
+
+  btc_rwlock_wrlock(db->state);
+
+  read_inputs(db, cur, view, tx, 0);
+
+  rc = btc_view_fill(view, tx, read_none, NULL, NULL);
+
+  btc_rwlock_wrunlock(db->state);
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  return rc;
+}
+
+void
+btc_chaindb_prefetch(btc_chaindb_t *db,
+                     btc_view_t *view,
+                     const btc_block_t *block) {
+  btc_outpoint_t *prevouts;
+  const btc_input_t *input;
+  btc_hashset_t *txids;
+  const btc_tx_t *tx;
+  size_t i, j, len;
+  lsm_cursor *cur;
+  size_t total = 0;
+
+  if (block->txs.length <= 1)
+    return;
+
+  for (i = 1; i < block->txs.length; i++)
+    total += block->txs.items[i]->inputs.length;
+
+  /* Outputs created within the block are not in the database. */
+  txids = btc_hashset_create();
+
+  for (i = 0; i < block->txs.length; i++)
+    btc_hashset_put(txids, block->txs.items[i]->hash);
+
+  prevouts = (btc_outpoint_t *)btc_malloc(total * sizeof(btc_outpoint_t));
+  len = 0;
+
+  for (i = 1; i < block->txs.length; i++) {
+    tx = block->txs.items[i];
+
+    for (j = 0; j < tx->inputs.length; j++) {
+      input = tx->inputs.items[j];
+
+      if (btc_hashset_has(txids, input->prevout.hash))
+        continue;
+
+      prevouts[len++] = input->prevout;
+    }
+  }
+
+  btc_hashset_destroy(txids);
+
+  if (lsm_csr_open(db->lsm, &cur) != 0)
+    goto done;
+
+  btc_rwlock_wrlock(db->state);
+
+  read_batch(db, cur, view, prevouts, len, 0);
+
+  btc_rwlock_wrunlock(db->state);
+
+  CHECK(lsm_csr_close(cur) == 0);
+done:
+  btc_free(prevouts);
+}
+
+static int
+cached_cmp(const void *xp, const void *yp) {
+  const btc_cached_t *x = *((const btc_cached_t **)xp);
+  const btc_cached_t *y = *((const btc_cached_t **)yp);
+
+  return prevout_cmp(&x->key, &y->key);
+}
+
+static void
+btc_chaindb_index_txs(btc_chaindb_t *db,
+                      const btc_entry_t *entry,
+                      const btc_block_t *block) {
+  /* Locations are queued alongside the dirty coins
+     and reach the database with them, so connecting
+     a block costs no more than a few hash inserts. */
+  uint32_t offset = 80 + btc_size_size(block->txs.length);
+  btc_txloc_t *loc;
+  size_t i;
+
+  if (!(db->flags & BTC_CHAIN_TXINDEX))
+    return;
+
+  CHECK(entry->block_pos != -1);
+
+  for (i = 0; i < block->txs.length; i++) {
+    const btc_tx_t *tx = block->txs.items[i];
+
+    loc = btc_hashmap_get(db->txlocs, tx->hash);
+
+    if (loc == NULL) {
+      loc = (btc_txloc_t *)btc_malloc(sizeof(btc_txloc_t));
+
+      memcpy(loc->hash, tx->hash, 32);
+
+      CHECK(btc_hashmap_put(db->txlocs, loc->hash, loc));
+    }
+
+    loc->height = entry->height;
+    loc->file = entry->block_file;
+    loc->pos = entry->block_pos;
+    loc->offset = offset;
+    loc->length = btc_tx_size(tx);
+
+    offset += loc->length;
+  }
+}
+
+static int
+btc_chaindb_unindex_txs(btc_chaindb_t *db, const btc_block_t *block) {
+  uint8_t key[TX_KEYLEN];
+  btc_txloc_t *loc;
+  size_t i;
+
+  if (!(db->flags & BTC_CHAIN_TXINDEX))
+    return 1;
+
+  for (i = 0; i < block->txs.length; i++) {
+    const btc_tx_t *tx = block->txs.items[i];
+
+    loc = btc_hashmap_rem(db->txlocs, tx->hash);
+
+    if (loc != NULL)
+      btc_free(loc);
+
+    tx_key(key, tx->hash);
+
+    if (lsm_delete(db->lsm, key, sizeof(key)) != 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+static int
+btc_chaindb_write_txlocs(btc_chaindb_t *db) {
+  size_t count = btc_hashmap_size(db->txlocs);
+  uint8_t val[BTC_TXLOC_SIZE];
+  uint8_t key[TX_KEYLEN];
+  btc_hashmapiter_t iter;
+  btc_txloc_t **items;
+  size_t i = 0;
+  int rc = 0;
+
+  if (count == 0)
+    return 1;
+
+  items = btc_malloc(count * sizeof(btc_txloc_t *));
+
+  btc_hashmap_iterate(&iter, db->txlocs);
+
+  while (btc_hashmap_next(&iter))
+    items[i++] = iter.val;
+
+  /* Random txids, so sort them like the coins. */
+  qsort(items, count, sizeof(btc_txloc_t *), txloc_cmp);
+
+  for (i = 0; i < count; i++) {
+    tx_key(key, items[i]->hash);
+
+    btc_txloc_export(val, items[i]);
+
+    rc = lsm_insert(db->lsm, key, sizeof(key), val, sizeof(val));
+
+    if (rc != 0) {
+      fprintf(stderr, "lsm_insert: %s\n", lsm_strerror(rc));
+      break;
+    }
+  }
+
+  btc_free(items);
+
+  return rc == 0;
+}
+
+static size_t
+btc_chaindb_usage(btc_chaindb_t *db) {
+  size_t count = btc_hashmap_size(db->txlocs);
+  return db->cache.usage + count * (sizeof(btc_txloc_t) + 16);
+}
+
+static int
+btc_chaindb_dirty(btc_chaindb_t *db) {
+  return db->cache.dirty > 0 || btc_hashmap_size(db->txlocs) > 0;
+}
+
+static int
+write_coins(btc_chaindb_t *db, btc_cached_t **items, size_t count) {
+  uint8_t key[COIN_KEYLEN];
+  uint8_t *val = db->slab;
+  btc_cached_t *entry;
+  size_t i, len;
+  int rc = 0;
+
+  /* Insert in key order: the in-memory tree
+     then sees appends rather than random
+     inserts, and flushes to sorted runs. */
+  qsort(items, count, sizeof(btc_cached_t *), cached_cmp);
+
+  for (i = 0; i < count; i++) {
+    entry = items[i];
+
+    coin_key(key, entry->key.hash, entry->key.index);
+
+    if (entry->coin == NULL) {
+      rc = lsm_delete(db->lsm, key, sizeof(key));
+    } else {
+      len = btc_coin_export(val, entry->coin);
+      rc = lsm_insert(db->lsm, key, sizeof(key), val, len);
+    }
+
+    if (rc != 0) {
+      fprintf(stderr, "lsm_insert: %s\n", lsm_strerror(rc));
+      break;
+    }
+  }
+
+  return rc == 0;
+}
+
+static int
+btc_chaindb_write_cache(btc_chaindb_t *db, const uint8_t *hash) {
+  btc_outmapiter_t iter;
+  btc_cached_t **items;
+  btc_cached_t *entry;
+  size_t count = 0;
+  int ok;
+
+  items = btc_malloc((db->cache.dirty + 1) * sizeof(btc_cached_t *));
+
+  btc_outmap_iterate(&iter, db->cache.map);
+
+  while (btc_outmap_next(&iter)) {
+    entry = iter.val;
+
+    if (!(entry->flags & CACHE_DIRTY))
+      continue;
+
+    CHECK(count < db->cache.dirty);
+
+    items[count++] = entry;
+  }
+
+  if (db->grouped)
+    ok = write_groups(db, items, count);
+  else
+    ok = write_coins(db, items, count);
+
+  btc_free(items);
+
+  if (!ok)
+    return 0;
+
+  if (!btc_chaindb_write_txlocs(db))
+    return 0;
+
+  /* Record which tip the coins now correspond to. */
+  if (lsm_insert(db->lsm, state_key, 1, hash, 32) != 0)
+    return 0;
+
+  return 1;
+}
+
+static void
+btc_chaindb_sweep_cache(btc_chaindb_t *db, int erase) {
+  if (erase)
+    btc_coincache_reset(&db->cache);
+  else
+    btc_coincache_sweep(&db->cache);
+
+  btc_chaindb_reset_txlocs(db);
+
+  db->last_flush = btc_now();
+  db->prune_flush = 0;
+}
+
+static int
+btc_chaindb__flush_cache(btc_chaindb_t *db, const uint8_t *hash, int erase) {
+  const btc_entry_t *entry;
+
+  /* Block and undo data must hit the disk before
+     the coin state does, otherwise we would be
+     unable to replay the blocks after a crash. */
+  btc_blockwriter_drain(&db->writer);
+  btc_chaindb_sync_files(db);
+
+  if (!btc_chaindb_commit_batch(db))
+    return 0;
+
+  if (!btc_chaindb_backoff(db))
+    return 0;
+
+  if (lsm_begin(db->lsm, 1) != 0)
+    return 0;
+
+  if (!btc_chaindb_write_cache(db, hash))
+    goto fail;
+
+  if (lsm_commit(db->lsm, 0) != 0)
+    goto fail;
+
+  entry = btc_hashmap_get(db->hashes, hash);
+
+  CHECK(entry != NULL);
+
+  db->flushed = entry->height;
+
+  /* Automatic checkpoints are off while syncing
+     (unless the checkpointer thread is running). */
+  if (db->bulk && !(db->flags & BTC_CHAIN_WORKER)) {
+    if (lsm_checkpoint(db->lsm, NULL) != 0)
+      return 0;
+  }
+
+  btc_chaindb_sweep_cache(db, erase);
+
+  return 1;
+fail:
+  CHECK(lsm_rollback(db->lsm, 0) == 0);
+  return 0;
+}
+
+static int
+btc_chaindb_flush_cache(btc_chaindb_t *db, const uint8_t *hash, int erase) {
+  int ret;
+
+  BTC_TRACE_BEGIN("lsm", "flush_coins");
+
+  ret = btc_chaindb__flush_cache(db, hash, erase);
+
+  BTC_TRACE_END("lsm", "flush_coins");
+
+  return ret;
+}
+
+static int
+btc_chaindb_maybe_flush(btc_chaindb_t *db) {
+  if (btc_chaindb_usage(db) > db->cache.limit)
+    return btc_chaindb_flush_cache(db, db->tail->hash, 1);
+
+  /* A size target cannot prune past the last flush. */
+  if (db->prune_flush)
+    return btc_chaindb_flush_cache(db, db->tail->hash, 0);
+
+  if (btc_chaindb_dirty(db) && btc_now() >= db->last_flush + FLUSH_INTERVAL)
+    return btc_chaindb_flush_cache(db, db->tail->hash, 0);
+
+  /* Replicas serve coins from disk and follow the
+     flushed state, so keep it at the tip once synced. */
+  if (db->tune.shared && !db->bulk && btc_chaindb_dirty(db))
+    return btc_chaindb_flush_cache(db, db->tail->hash, 0);
+
+  return 1;
+}
+
+static btc_chainfile_t *
+btc_chaindb_find(btc_chaindb_t *db, int type, int id) {
+  btc_chainfile_t *file;
+
+  for (file = db->files.head; file != NULL; file = file->next) {
+    if (file->type == type && file->id == id)
+      return file;
+  }
+
+  return NULL;
+}
+
+static btc_chainfile_t *
+btc_chaindb_map(btc_chaindb_t *db, int type, int id) {
+  /* Finalized files are never written to again,
+     so they can be mapped read-only and shared. */
+  char path[BTC_PATH_MAX];
+  btc_chainfile_t *file;
+  btc_stat_t st;
+  int fd;
+
+  if (!(db->flags & BTC_CHAIN_MMAP))
+    return NULL;
+
+  file = btc_chaindb_find(db, type, id);
+
+  if (file == NULL)
+    return NULL;
+
+  if (file->map != NULL)
+    return file;
+
+  btc_chaindb_path(db, path, type, id);
+
+  fd = btc_fs_open(path, READ_FLAGS, 0);
+
+  if (fd == -1)
+    return NULL;
+
+  if (btc_fs_fstat(fd, &st) && st.st_size > 0) {
+    file->map = btc_fs_mmap(fd, st.st_size);
+    file->map_size = st.st_size;
+
+    if (file->map == NULL)
+      file->map_size = 0;
+  }
+
+  btc_fs_close(fd);
+
+  return file->map != NULL ? file : NULL;
+}
+
+static const uint8_t *
+btc_chaindb_peek(btc_chaindb_t *db,
+                 size_t *len,
+                 const btc_chainfile_t *file,
+                 int id,
+                 int pos) {
+  const btc_chainfile_t *map;
+  size_t size;
+
+  if (id == file->id)
+    return NULL;
+
+  map = btc_chaindb_map(db, file->type, id);
+
+  if (map == NULL)
+    return NULL;
+
+  if (pos < 0 || (size_t)pos + 24 > map->map_size)
+    return NULL;
+
+  size = 24 + btc_read32le(map->map + pos + 16);
+
+  if (size > map->map_size - pos)
+    return NULL;
+
+  *len = size;
+
+  return map->map + pos;
+}
+
+static int
+btc_chaindb_read(btc_chaindb_t *db,
+                 uint8_t **raw,
+                 size_t *len,
+                 const btc_chainfile_t *file,
+                 int id,
+                 int pos) {
+  char path[BTC_PATH_MAX];
+  const uint8_t *map;
+  uint8_t *data = NULL;
+  uint8_t tmp[4];
+  size_t size;
+  int ret = 0;
+  int fd;
+
+  map = btc_chaindb_peek(db, &size, file, id, pos);
+
+  if (map != NULL) {
+    data = (uint8_t *)malloc(size);
+
+    if (data == NULL)
+      return 0;
+
+    memcpy(data, map, size);
+
+    *raw = data;
+    *len = size;
+
+    return 1;
+  }
+
+  if (id == file->id) {
+    /* The tail of the active file may still be queued. */
+    btc_blockwriter_drain(&db->writer);
+
+    fd = file->fd;
+  } else {
+    /* A pruned file lingers until the writer unlinks it. */
+    if (btc_chaindb_find(db, file->type, id) == NULL)
+      return 0;
+
+    btc_chaindb_path(db, path, file->type, id);
+
+    fd = btc_fs_open(path, READ_FLAGS, 0);
+
+    if (fd == -1)
+      return 0;
+  }
+
+  if (!btc_fs_pread(fd, tmp, 4, pos + 16))
+    goto fail;
+
+  size = 24 + btc_read32le(tmp);
+  data = (uint8_t *)malloc(size);
+
+  if (data == NULL)
+    goto fail;
+
+  if (!btc_fs_pread(fd, data, size, pos))
+    goto fail;
+
+  *raw = data;
+  *len = size;
+
+  data = NULL;
+  ret = 1;
+fail:
+  if (data != NULL)
+    free(data);
+
+  if (fd != file->fd)
+    btc_fs_close(fd);
+
+  return ret;
+}
+
+static btc_block_t *
+btc_chaindb_read_block(btc_chaindb_t *db, const btc_entry_t *entry) {
+  const uint8_t *map;
+  btc_block_t *block;
+  uint8_t *buf;
+  size_t len;
+
+  if (entry->block_pos == -1)
+    return NULL;
+
+  map = btc_chaindb_peek(db, &len, &db->block, entry->block_file,
+                                               entry->block_pos);
+
+  if (map != NULL)
+    return btc_block_decode(map + 24, len - 24);
+
+  if (!btc_chaindb_read(db, &buf, &len, &db->block, entry->block_file,
+                                                    entry->block_pos)) {
+    return NULL;
+  }
+
+  block = btc_block_decode(buf + 24, len - 24);
+
+  free(buf);
+
+  return block;
+}
+
+static btc_undo_t *
+undo_decode(const uint8_t *xp, size_t xn, int32_t height) {
+  btc_undo_t *undo;
+  int ret;
+
+  if (xn < 24)
+    return NULL;
+
+  undo = btc_undo_create();
+
+  /* Older records store absolute coin heights. */
+  if (btc_read32le(xp + 4) == UNDO_DELTA) {
+    xp += 24;
+    xn -= 24;
+    ret = btc_undo_decompress(undo, &xp, &xn, height);
+  } else {
+    xp += 24;
+    xn -= 24;
+    ret = btc_undo_read(undo, &xp, &xn);
+  }
+
+  if (!ret) {
+    btc_undo_destroy(undo);
+    return NULL;
+  }
+
+  return undo;
+}
+
+static btc_undo_t *
+btc_chaindb_read_undo(btc_chaindb_t *db, const btc_entry_t *entry) {
+  const uint8_t *map;
+  btc_undo_t *undo;
+  uint8_t *buf;
+  size_t len;
+
+  if (entry->undo_pos == -1)
+    return btc_undo_create();
+
+  map = btc_chaindb_peek(db, &len, &db->undo, entry->undo_file,
+                                              entry->undo_pos);
+
+  if (map != NULL)
+    return undo_decode(map, len, entry->height);
+
+  if (!btc_chaindb_read(db, &buf, &len, &db->undo, entry->undo_file,
+                                                   entry->undo_pos)) {
+    return NULL;
+  }
+
+  undo = undo_decode(buf, len, entry->height);
+
+  free(buf);
+
+  return undo;
+}
+
+static int
+should_sync(const btc_chaindb_t *db, const btc_entry_t *entry) {
+  if (db->flags & BTC_CHAIN_MEMORY)
+    return 0;
+
+  if (entry->header.time >= btc_now() - 24 * 60 * 60)
+    return 1;
+
+  if ((entry->height % 20000) == 0)
+    return 1;
+
+  return 0;
+}
+
+static void
+btc_chaindb_reserve(btc_chainfile_t *file, size_t len) {
+  /* Files grow a chunk at a time instead of one
+     append at a time, which keeps them from being
+     scattered over the disk. Best effort only. */
+  int64_t chunk = file->type == 0 ? BLOCK_CHUNK_SIZE : UNDO_CHUNK_SIZE;
+  int64_t end = (int64_t)file->pos + len;
+  int64_t start = file->reserved;
+
+  if (end <= file->reserved)
+    return;
+
+  if (start < file->pos)
+    start = file->pos;
+
+  file->reserved = ((end + chunk - 1) / chunk) * chunk;
+
+  if (file->reserved > MAX_FILE_SIZE)
+    file->reserved = end > MAX_FILE_SIZE ? end : MAX_FILE_SIZE;
+
+  btc_fs_fallocate(file->fd, start, file->reserved - start);
+}
+
+static int
+btc_chaindb_alloc(btc_chaindb_t *db, btc_chainfile_t *file, size_t len) {
+  uint8_t raw[BTC_CHAINFILE_SIZE];
+  uint8_t key[FILE_KEYLEN];
+  char path[BTC_PATH_MAX];
+  int fd;
+
+  if (file->pos + len <= MAX_FILE_SIZE) {
+    btc_chaindb_reserve(file, len);
+    return 1;
+  }
+
+  file_key(key, file->type, file->id);
+
+  btc_chainfile_export(raw, file);
+
+  if (lsm_insert(db->lsm, key, sizeof(key), raw, sizeof(raw)) != 0)
+    return 0;
+
+  btc_chaindb_path(db, path, file->type, file->id + 1);
+
+  fd = btc_fs_open(path, WRITE_FLAGS, 0644);
+
+  if (fd == -1)
+    return 0;
+
+  btc_blockwriter_drain(&db->writer);
+
+  /* Hand back whatever was reserved past the end. */
+  if (file->reserved > file->pos)
+    btc_fs_ftruncate(file->fd, file->pos);
+
+  if (!(db->flags & BTC_CHAIN_MEMORY))
+    btc_fs_fsync(file->fd);
+
+  /* While syncing, a finished file is unlikely to be
+     read again soon. Its (now clean) pages are better
+     spent on the coin database. */
+  if (db->bulk)
+    btc_fs_fadvise(file->fd, 0, 0, BTC_ADVISE_DONTNEED);
+
+  btc_fs_close(file->fd);
+
+  btc_list_push(&db->files, btc_chainfile_clone(file),
+                            btc_chainfile_t);
+
+  file->fd = fd;
+  file->id++;
+  file->pos = 0;
+  file->items = 0;
+  file->min_time = -1;
+  file->max_time = -1;
+  file->min_height = -1;
+  file->max_height = -1;
+  file->reserved = 0;
+
+  btc_chaindb_reserve(file, len);
+
+  return 1;
+}
+
+static int
+btc_chaindb_write_block(btc_chaindb_t *db,
+                        btc_entry_t *entry,
+                        const btc_block_t *block) {
+  uint8_t raw[BTC_CHAINFILE_SIZE];
+  uint8_t hash[32];
+  uint8_t *buf;
+  size_t len;
+
+  buf = (uint8_t *)btc_malloc(24 + btc_block_size(block));
+  len = btc_block_export(buf + 24, block);
+
+  btc_hash256(hash, buf + 24, len);
+
+  /* Store in network format. */
+  btc_uint32_write(buf +  0, db->network->magic);
+  btc_uint32_write(buf +  4, 0x636f6c62);
+  btc_uint32_write(buf +  8, 0x0000006b);
+  btc_uint32_write(buf + 12, 0x00000000);
+  btc_uint32_write(buf + 16, len);
+
+  btc_raw_write(buf + 20, hash, 4);
+
+  len += 24;
+
+  if (!btc_chaindb_alloc(db, &db->block, len)) {
+    btc_free(buf);
+    return 0;
+  }
+
+  /* The writer takes ownership of the buffer. */
+  btc_blockwriter_push(&db->writer, db->block.fd, buf, len,
+                       should_sync(db, entry));
+
+  entry->block_file = db->block.id;
+  entry->block_pos = db->block.pos;
+
+  db->block.pos += len;
+
+  btc_chainfile_update(&db->block, entry);
+
+  btc_chainfile_export(raw, &db->block);
+
+  if (lsm_insert(db->lsm, blockfile_key, 1, raw, sizeof(raw)) != 0)
+    return 0;
+
+  return 1;
+}
+
+static int
+btc_chaindb_write_undo(btc_chaindb_t *db,
+                       btc_entry_t *entry,
+                       const btc_undo_t *undo) {
+  size_t len = btc_undo_deflate(undo, entry->height);
+  uint8_t raw[BTC_CHAINFILE_SIZE];
+  uint8_t hash[32];
+  uint8_t *buf;
+
+  buf = (uint8_t *)btc_malloc(24 + len);
+
+  btc_undo_compress(buf + 24, undo, entry->height);
+
+  btc_hash256(hash, buf + 24, len);
+
+  btc_uint32_write(buf +  0, db->network->magic);
+  btc_uint32_write(buf +  4, UNDO_DELTA);
+  btc_uint32_write(buf +  8, 0x00000000);
+  btc_uint32_write(buf + 12, 0x00000000);
+  btc_uint32_write(buf + 16, len);
+
+  btc_raw_write(buf + 20, hash, 4);
+
+  len += 24;
+
+  if (!btc_chaindb_alloc(db, &db->undo, len)) {
+    btc_free(buf);
+    return 0;
+  }
+
+  /* The writer takes ownership of the buffer. */
+  btc_blockwriter_push(&db->writer, db->undo.fd, buf, len,
+                       should_sync(db, entry));
+
+  entry->undo_file = db->undo.id;
+  entry->undo_pos = db->undo.pos;
+
+  db->undo.pos += len;
+
+  btc_chainfile_update(&db->undo, entry);
+
+  btc_chainfile_export(raw, &db->undo);
+
+  if (lsm_insert(db->lsm, undofile_key, 1, raw, sizeof(raw)) != 0)
+    return 0;
+
+  return 1;
+}
+
+static int
+btc_chaindb_prune_files(btc_chaindb_t *db, const btc_entry_t *entry) {
+  btc_chainfile_t *file, *next;
+  uint8_t key[FILE_KEYLEN];
+  char path[BTC_PATH_MAX];
+  int64_t total = 0;
+  int32_t target, limit;
+  int held = 0;
+
+  if (!(db->flags & BTC_CHAIN_PRUNE))
+    return 1;
+
+  if (entry->height < db->network->block.keep_blocks)
+    return 1;
+
+  /* Whatever else happens, the last 288 blocks stay
+     on disk: enough to reorg and to serve as a limited
+     node. With a size target, older files are only
+     removed (oldest first) until we're back under it. */
+  limit = entry->height - db->network->block.keep_blocks;
+
+  if (limit <= db->network->block.prune_after_height)
+    return 1;
+
+  /* Blocks past the last coin flush are replayed on
+     the next open (see btc_chaindb_load_coins) and
+     must outlive a crash. This holds for the size
+     target too: it never reaches past the flush. */
+  target = limit;
+
+  if (target > db->flushed + 1)
+    target = db->flushed + 1;
+
+  if (db->prune_target > 0) {
+    total = (int64_t)db->block.pos + db->undo.pos;
+
+    for (file = db->files.head; file != NULL; file = file->next)
+      total += file->pos;
+
+    if (total <= db->prune_target)
+      return 1;
+  }
+
+  for (file = db->files.head; file != NULL; file = next) {
+    next = file->next;
+
+    if (file->max_height >= target) {
+      held |= (file->max_height < limit);
+      continue;
+    }
+
+    if (db->prune_target > 0) {
+      if (total <= db->prune_target)
+        break;
+
+      total -= file->pos;
+    }
+
+    file_key(key, file->type, file->id);
+
+    if (lsm_delete(db->lsm, key, sizeof(key)) != 0)
+      return 0;
+
+    btc_chaindb_path(db, path, file->type, file->id);
+
+    btc_chainfile_unmap(file);
+
+    if (file->type == 0)
+      btc_chaindb_drop_handles(db, file->id);
+
+    /* Unlinking a large file can stall; let the writer do it. */
+    btc_blockwriter_unlink(&db->writer, path);
+
+    btc_list_remove(&db->files, file, btc_chainfile_t);
+
+    btc_chainfile_destroy(file);
+  }
+
+  /* Still over the target only because the coins lag
+     behind: flush them once this block is saved. */
+  if (db->prune_target > 0 && total > db->prune_target && held)
+    db->prune_flush = 1;
+
+  return 1;
+}
+
+static int
+needs_undo(btc_chaindb_t *db, const btc_entry_t *entry) {
+  /* A pruned node can never reorg past the last
+     checkpoint, so skip writing undo coins during
+     that part of the initial sync. The filter index
+     refuses to run pruned; getblockstats and rescans
+     report the missing undo coins. */
+  if ((db->flags & BTC_CHAIN_PRUNE) && (db->flags & BTC_CHAIN_CHECKPOINTS))
+    return entry->height >= db->network->last_checkpoint;
+
+  return 1;
+}
+
+static void
+btc_chaindb_update_stats(btc_chaindb_t *db,
+                         const btc_entry_t *entry,
+                         const btc_block_t *block,
+                         const btc_undo_t *undo,
+                         int sign) {
+  /* The delta comes from the block and its undo
+     coins rather than the view, which cannot tell
+     a coin created and spent within the block from
+     one which existed before it. Pairs like that
+     cancel out here instead. */
+  const btc_checkpoint_t *chk;
+  const btc_output_t *output;
+  const btc_input_t *input;
+  const btc_coin_t *coin;
+  const btc_tx_t *tx;
+  size_t i, j, k = 0;
+  int bip30;
+
+  if (!(db->flags & BTC_CHAIN_COINSTATS))
+    return;
+
+  chk = btc_network_bip30(db->network, entry->height);
+  bip30 = (chk != NULL && btc_hash_equal(entry->hash, chk->hash));
+
+  for (i = 0; i < block->txs.length; i++) {
+    tx = block->txs.items[i];
+
+    if (i > 0) {
+      for (j = 0; j < tx->inputs.length; j++) {
+        input = tx->inputs.items[j];
+        coin = undo->items[k++];
+
+        btc_coinstats_update(&db->stats, input->prevout.hash,
+                                         input->prevout.index,
+                                         coin->height,
+                                         coin->coinbase,
+                                         &coin->output,
+                                         -sign);
+      }
+    }
+
+    /* The duplicate coinbases overwrote coins we
+       already counted. Like Core, leave them out. */
+    if (i == 0 && bip30)
+      continue;
+
+    for (j = 0; j < tx->outputs.length; j++) {
+      output = tx->outputs.items[j];
+
+      if (btc_script_is_unspendable(&output->script))
+        continue;
+
+      btc_coinstats_update(&db->stats, tx->hash, j,
+                                       entry->height,
+                                       i == 0,
+                                       output,
+                                       sign);
+    }
+  }
+
+  CHECK(k == undo->length);
+}
+
+static int
+btc_chaindb_write_stats(btc_chaindb_t *db) {
+  uint8_t raw[BTC_COINSTATS_SIZE];
+
+  if (!(db->flags & BTC_CHAIN_COINSTATS))
+    return 1;
+
+  btc_coinstats_export(raw, &db->stats);
+
+  return lsm_insert(db->lsm, coinstats_key, 1, raw, sizeof(raw)) == 0;
+}
+
+static int
+btc_chaindb_connect_block(btc_chaindb_t *db,
+                          btc_entry_t *entry,
+                          const btc_block_t *block,
+                          const btc_view_t *view) {
+  const btc_undo_t *undo;
+
+  /* Genesis block's coinbase is unspendable. */
+  if (entry->height == 0)
+    return 1;
+
+  undo = btc_view_undo(view);
+
+  /* Commit new coin state (to the cache). */
+  btc_coincache_commit(&db->cache, view);
+
+  /* Account for created and spent coins. */
+  btc_chaindb_update_stats(db, entry, block, undo, 1);
+
+  /* Queue transaction locations. */
+  btc_chaindb_index_txs(db, entry, block);
+
+  /* Write undo coins (if there are any). */
+  if (undo->length != 0 && entry->undo_pos == -1 && needs_undo(db, entry)) {
+    if (!btc_chaindb_write_undo(db, entry, undo))
+      return 0;
+  }
+
+  /* Prune height-288 if pruning is enabled. */
+  return btc_chaindb_prune_files(db, entry);
+}
+
+static btc_view_t *
+btc_chaindb_disconnect_block(btc_chaindb_t *db,
+                             const btc_entry_t *entry,
+                             const btc_block_t *block) {
+  btc_undo_t *undo = btc_chaindb_read_undo(db, entry);
+  const btc_input_t *input;
+  const btc_tx_t *tx;
+  btc_coin_t *coin;
+  btc_view_t *view;
+  size_t i, j;
+
+  if (undo == NULL)
+    return NULL;
+
+  /* Revert created and spent coins. */
+  btc_chaindb_update_stats(db, entry, block, undo, -1);
+
+  view = btc_view_create();
+
+  /* Disconnect all transactions. */
+  for (i = block->txs.length - 1; i != (size_t)-1; i--) {
+    tx = block->txs.items[i];
+
+    if (i > 0) {
+      for (j = tx->inputs.length - 1; j != (size_t)-1; j--) {
+        input = tx->inputs.items[j];
+        coin = btc_undo_pop(undo);
+
+        btc_view_put(view, &input->prevout, coin);
+      }
+    }
+
+    /* Remove any created coins. */
+    btc_view_add(view, tx, entry->height, 1);
+  }
+
+  /* Undo coins should be empty. */
+  CHECK(undo->length == 0);
+
+  btc_undo_destroy(undo);
+
+  /* Forget transaction locations. */
+  if (!btc_chaindb_unindex_txs(db, block)) {
+    btc_view_destroy(view);
+    return NULL;
+  }
+
+  /* Commit new coin state (to the cache). */
+  btc_coincache_commit(&db->cache, view);
+
+  return view;
+}
+
+static int
+btc_chaindb_save_block(btc_chaindb_t *db,
+                       btc_entry_t *entry,
+                       const btc_block_t *block,
+                       const btc_view_t *view) {
+  /* Write actual block data. */
+  if (entry->block_pos == -1) {
+    if (!btc_chaindb_write_block(db, entry, block))
+      return 0;
+  }
+
+  if (view == NULL)
+    return 1;
+
+  return btc_chaindb_connect_block(db, entry, block, view);
+}
+
+static int
+btc_chaindb__save(btc_chaindb_t *db,
+                  btc_entry_t *entry,
+                  const btc_block_t *block,
+                  const btc_view_t *view) {
+  uint8_t raw[BTC_ENTRY_SIZE];
+  uint8_t key[ENTRY_KEYLEN];
+
+  /* Sanity checks. */
+  CHECK(entry->prev != NULL || entry->height == 0);
+  CHECK(entry->next == NULL);
+
+  /* Wait for worker (once per batch). */
+  if (db->batch == 0) {
+    if (!btc_chaindb_backoff(db))
+      return 0;
+
+    if (lsm_begin(db->lsm, 1) != 0)
+      return 0;
+  }
+
+  /* Each block is a sub-transaction of the batch. */
+  if (db->nested && lsm_begin(db->lsm, 2) != 0)
+    goto fail;
+
+  /* Connect block and save data. */
+  if (!btc_chaindb_save_block(db, entry, block, view))
+    goto fail;
+
+  /* Write entry data. */
+  entry_key(key, entry->hash);
+
+  btc_entry_export(raw, entry);
+
+  if (lsm_insert(db->lsm, key, sizeof(key), raw, sizeof(raw)) != 0)
+    goto fail;
+
+  /* Clear old tip. */
+  if (entry->height != 0) {
+    tip_key(key, entry->header.prev_block);
+
+    if (lsm_delete(db->lsm, key, sizeof(key)) != 0)
+      goto fail;
+  }
+
+  /* Write new tip. */
+  tip_key(key, entry->hash);
+
+  if (lsm_insert(db->lsm, key, sizeof(key), raw, 1) != 0)
+    goto fail;
+
+  /* Write state (main chain only). */
+  if (view != NULL) {
+    /* Commit new chain state. */
+    if (lsm_insert(db->lsm, meta_key, 1, entry->hash, 32) != 0)
+      goto fail;
+
+    if (!btc_chaindb_write_stats(db))
+      goto fail;
+  }
+
+  /* While syncing, blocks are committed in groups:
+     a crash loses at most one batch, which is simply
+     downloaded again, and its block data is trimmed
+     from the files on the next open. Otherwise every
+     block commits on its own. */
+  if (db->bulk && db->nested && db->batch + 1 < SAVE_BATCH) {
+    if (lsm_commit(db->lsm, 1) != 0)
+      goto fail;
+
+    db->batch++;
+  } else {
+    if (lsm_commit(db->lsm, 0) != 0)
+      goto fail;
+
+    db->batch = 0;
+  }
+
+  /* Update hashes. */
+  CHECK(btc_hashmap_put(db->hashes, entry->hash, entry));
+
+  /* Main-chain-only stuff. */
+  if (view != NULL) {
+    /* Mirror to flat index. */
+    btc_chaindb_write_index(db, entry);
+
+    /* Set next pointer. */
+    if (entry->prev != NULL)
+      entry->prev->next = entry;
+
+    /* Update heights. */
+    CHECK(db->heights.length == (size_t)entry->height);
+    btc_vector_push(&db->heights, entry);
+
+    /* Update tip. */
+    if (entry->height == 0)
+      db->head = entry;
+
+    db->tail = entry;
+
+    /* Write back coins if necessary. */
+    if (!btc_chaindb_maybe_flush(db))
+      return 0;
+  }
+
+  return 1;
+fail:
+  if (db->batch > 0) {
+    /* Drop this block, keep the rest of the batch. */
+    CHECK(lsm_rollback(db->lsm, 2) == 0);
+    CHECK(lsm_commit(db->lsm, 1) == 0);
+  } else {
+    CHECK(lsm_rollback(db->lsm, 0) == 0);
+  }
+  return 0;
+}
+
+int
+btc_chaindb_save(btc_chaindb_t *db,
+                 btc_entry_t *entry,
+                 const btc_block_t *block,
+                 const btc_view_t *view) {
+  int ret;
+
+  btc_rwlock_wrlock(db->state);
+
+  ret = btc_chaindb__save(db, entry, block, view);
+
+  btc_rwlock_wrunlock(db->state);
+
+  return ret;
+}
+
+static int
+btc_chaindb__reconnect(btc_chaindb_t *db,
+                       btc_entry_t *entry,
+                       const btc_block_t *block,
+                       const btc_view_t *view) {
+  uint8_t raw[BTC_ENTRY_SIZE];
+  uint8_t key[ENTRY_KEYLEN];
+
+  if (db->reorg) {
+    /* Part of a batched reorg: everything goes
+       into the transaction opened by begin_reorg. */
+    if (!btc_chaindb_connect_block(db, entry, block, view))
+      return 0;
+
+    entry_key(key, entry->hash);
+
+    btc_entry_export(raw, entry);
+
+    if (lsm_insert(db->lsm, key, sizeof(key), raw, sizeof(raw)) != 0)
+      return 0;
+
+    goto done;
+  }
+
+  if (!btc_chaindb_commit_batch(db))
+    return 0;
+
+  /* Wait for worker. */
+  if (!btc_chaindb_backoff(db))
+    return 0;
+
+  /* Begin transaction. */
+  if (lsm_begin(db->lsm, 1) != 0)
+    return 0;
+
+  /* Connect inputs. */
+  if (!btc_chaindb_connect_block(db, entry, block, view))
+    goto fail;
+
+  /* Re-write entry data (we may have updated the undo pos). */
+  entry_key(key, entry->hash);
+
+  btc_entry_export(raw, entry);
+
+  if (lsm_insert(db->lsm, key, sizeof(key), raw, sizeof(raw)) != 0)
+    goto fail;
+
+  /* Commit new chain state. */
+  if (lsm_insert(db->lsm, meta_key, 1, entry->hash, 32) != 0)
+    goto fail;
+
+  if (!btc_chaindb_write_stats(db))
+    goto fail;
+
+  /* Commit transaction. */
+  if (lsm_commit(db->lsm, 0) != 0)
+    goto fail;
+
+done:
+  /* Mirror to flat index. */
+  btc_chaindb_write_index(db, entry);
+
+  /* Set next pointer. */
+  CHECK(entry->prev != NULL);
+  CHECK(entry->next == NULL);
+  entry->prev->next = entry;
+
+  /* Update heights. */
+  CHECK(db->heights.length == (size_t)entry->height);
+  btc_vector_push(&db->heights, entry);
+
+  /* Update tip. */
+  db->tail = entry;
+
+  /* Write back coins if necessary. */
+  if (!db->reorg && !btc_chaindb_maybe_flush(db))
+    return 0;
+
+  return 1;
+fail:
+  CHECK(lsm_rollback(db->lsm, 0) == 0);
+  return 0;
+}
+
+int
+btc_chaindb_reconnect(btc_chaindb_t *db,
+                      btc_entry_t *entry,
+                      const btc_block_t *block,
+                      const btc_view_t *view) {
+  int ret;
+
+  btc_rwlock_wrlock(db->state);
+
+  ret = btc_chaindb__reconnect(db, entry, block, view);
+
+  btc_rwlock_wrunlock(db->state);
+
+  return ret;
+}
+
+static btc_view_t *
+btc_chaindb__disconnect(btc_chaindb_t *db,
+                        btc_entry_t *entry,
+                        const btc_block_t *block) {
+  btc_view_t *view;
+
+  if (db->reorg) {
+    /* Coins are reverted in the cache only. The
+       disk keeps the old tip until end_reorg. */
+    view = btc_chaindb_disconnect_block(db, entry, block);
+
+    if (view == NULL)
+      return NULL;
+
+    goto done;
+  }
+
+  if (!btc_chaindb_commit_batch(db))
+    return NULL;
+
+  /* Wait for worker. */
+  if (!btc_chaindb_backoff(db))
+    return NULL;
+
+  /* The on-disk coins must match the tip before
+     we rewind, otherwise a crash would leave us
+     with a coin state we cannot replay from. */
+  if (btc_chaindb_dirty(db)) {
+    if (!btc_chaindb_flush_cache(db, entry->hash, 0))
+      return NULL;
+  }
+
+  /* Begin transaction. */
+  if (lsm_begin(db->lsm, 1) != 0)
+    return NULL;
+
+  /* Disconnect inputs. */
+  view = btc_chaindb_disconnect_block(db, entry, block);
+
+  if (view == NULL)
+    goto fail;
+
+  /* Revert chain state to previous tip. */
+  if (lsm_insert(db->lsm, meta_key, 1, entry->header.prev_block, 32) != 0)
+    goto fail;
+
+  if (!btc_chaindb_write_stats(db))
+    goto fail;
+
+  /* Write reverted coins through. */
+  if (!btc_chaindb_write_cache(db, entry->header.prev_block))
+    goto fail;
+
+  /* Commit transaction. */
+  if (lsm_commit(db->lsm, 0) != 0)
+    goto fail;
+
+  btc_chaindb_sweep_cache(db, 0);
+
+done:
+  /* Set next pointer. */
+  CHECK(entry->prev != NULL);
+  CHECK(entry->next == NULL);
+  entry->prev->next = NULL;
+
+  /* Update heights. */
+  CHECK((btc_entry_t *)btc_vector_pop(&db->heights) == entry);
+
+  /* Revert tip. */
+  db->tail = entry->prev;
+
+  return view;
+fail:
+  if (view != NULL)
+    btc_view_destroy(view);
+
+  CHECK(lsm_rollback(db->lsm, 0) == 0);
+
+  return NULL;
+}
+
+btc_view_t *
+btc_chaindb_disconnect(btc_chaindb_t *db,
+                       btc_entry_t *entry,
+                       const btc_block_t *block) {
+  btc_view_t *ret;
+
+  btc_rwlock_wrlock(db->state);
+
+  ret = btc_chaindb__disconnect(db, entry, block);
+
+  btc_rwlock_wrunlock(db->state);
+
+  return ret;
+}
+
+static int
+btc_chaindb__begin_reorg(btc_chaindb_t *db) {
+  CHECK(!db->reorg);
+
+  if (!btc_chaindb_commit_batch(db))
+    return 0;
+
+  /* Wait for worker. */
+  if (!btc_chaindb_backoff(db))
+    return 0;
+
+  /* One transaction for the whole reorg. Blocks
+     are rolled back and applied in the coin cache;
+     nothing is visible on disk until end_reorg. */
+  if (lsm_begin(db->lsm, 1) != 0)
+    return 0;
+
+  db->reorg = 1;
+
+  return 1;
+}
+
+int
+btc_chaindb_begin_reorg(btc_chaindb_t *db) {
+  int ret;
+
+  btc_rwlock_wrlock(db->state);
+
+  ret = btc_chaindb__begin_reorg(db);
+
+  btc_rwlock_wrunlock(db->state);
+
+  return ret;
+}
+
+static int
+btc_chaindb__end_reorg(btc_chaindb_t *db) {
+  CHECK(db->reorg);
+
+  db->reorg = 0;
+
+  /* Undo data for the new branch must be on
+     disk before the coins which depend on it. */
+  btc_blockwriter_drain(&db->writer);
+  btc_chaindb_sync_files(db);
+
+  /* Chain state, stats and the net coin delta
+     move to the new tip in a single commit. */
+  if (lsm_insert(db->lsm, meta_key, 1, db->tail->hash, 32) != 0)
+    goto fail;
+
+  if (!btc_chaindb_write_stats(db))
+    goto fail;
+
+  if (!btc_chaindb_write_cache(db, db->tail->hash))
+    goto fail;
+
+  if (lsm_commit(db->lsm, 0) != 0)
+    goto fail;
+
+  btc_chaindb_sweep_cache(db, 0);
+
+  return 1;
+fail:
+  CHECK(lsm_rollback(db->lsm, 0) == 0);
+  return 0;
+}
+
+int
+btc_chaindb_end_reorg(btc_chaindb_t *db) {
+  int ret;
+
+  btc_rwlock_wrlock(db->state);
+
+  ret = btc_chaindb__end_reorg(db);
+
+  btc_rwlock_wrunlock(db->state);
+
+  return ret;
+}
+
+static int
+btc_chaindb_load_coins(btc_chaindb_t *db) {
+  /* Replay any blocks connected after the last
+     coin flush (i.e. we crashed or were killed). */
+  const btc_entry_t *tip = db->tail;
+  const btc_entry_t *entry;
+  btc_block_t *block;
+  btc_view_t *view;
+  uint8_t hash[32];
+  lsm_cursor *cur;
+  int32_t height;
+  const void *vp;
+  size_t i;
+  int vn;
+
+  /* Anything behind the tip is replayed and flushed below. */
+  db->flushed = tip->height;
+
+  /* A replica's tip is the coin state already. */
+  if (db->flags & BTC_CHAIN_READONLY)
+    return 1;
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, state_key, 1, LSM_SEEK_EQ) == 0);
+
+  /* Coins predating the cache were written through. */
+  if (!lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_close(cur) == 0);
+    return 1;
+  }
+
+  CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+  CHECK(vn == 32);
+
+  memcpy(hash, vp, 32);
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  if (btc_hash_equal(hash, tip->hash))
+    return 1;
+
+  entry = btc_hashmap_get(db->hashes, hash);
+
+  if (entry == NULL || !btc_chaindb_is_main(db, entry)) {
+    fprintf(stderr, "Coin state is not on the main chain.\n");
+    return 0;
+  }
+
+  for (height = entry->height + 1; height <= tip->height; height++) {
+    entry = (const btc_entry_t *)db->heights.items[height];
+    block = btc_chaindb_read_block(db, entry);
+
+    if (block == NULL) {
+      fprintf(stderr, "Block data not found for replay (height=%d).\n",
+                      (int)height);
+      return 0;
+    }
+
+    view = btc_view_create();
+
+    for (i = 0; i < block->txs.length; i++) {
+      const btc_tx_t *tx = block->txs.items[i];
+
+      if (i > 0)
+        CHECK(btc_chaindb_spend(db, view, tx));
+
+      btc_view_add(view, tx, height, 0);
+    }
+
+    btc_coincache_commit(&db->cache, view);
+
+    btc_chaindb_index_txs(db, entry, block);
+
+    btc_view_destroy(view);
+    btc_block_destroy(block);
+
+    if (btc_chaindb_usage(db) > db->cache.limit) {
+      if (!btc_chaindb_flush_cache(db, entry->hash, 1))
+        return 0;
+    }
+  }
+
+  return btc_chaindb_flush_cache(db, tip->hash, 0);
+}
+
+static int
+btc_chaindb_clear_txindex(btc_chaindb_t *db) {
+  /* Deleted a batch at a time: the cursor
+     cannot be held across a write. */
+  uint8_t *keys = btc_malloc(1024 * TX_KEYLEN);
+  lsm_cursor *cur;
+  const void *kp;
+  size_t i, count;
+  int ret = 0;
+  int kn;
+
+  do {
+    count = 0;
+
+    CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+    CHECK(lsm_csr_seek(cur, tx_min, sizeof(tx_min), LSM_SEEK_GE) == 0);
+
+    while (count < 1024 && lsm_csr_le(cur, tx_max, sizeof(tx_max))) {
+      CHECK(lsm_csr_key(cur, &kp, &kn) == 0);
+      CHECK(kn == TX_KEYLEN);
+
+      memcpy(keys + count * TX_KEYLEN, kp, TX_KEYLEN);
+
+      count++;
+
+      CHECK(lsm_csr_next(cur) == 0);
+    }
+
+    CHECK(lsm_csr_close(cur) == 0);
+
+    if (count == 0)
+      break;
+
+    if (lsm_begin(db->lsm, 1) != 0)
+      goto fail;
+
+    for (i = 0; i < count; i++) {
+      if (lsm_delete(db->lsm, keys + i * TX_KEYLEN, TX_KEYLEN) != 0) {
+        CHECK(lsm_rollback(db->lsm, 0) == 0);
+        goto fail;
+      }
+    }
+
+    if (lsm_commit(db->lsm, 0) != 0) {
+      CHECK(lsm_rollback(db->lsm, 0) == 0);
+      goto fail;
+    }
+  } while (count == 1024);
+
+  ret = 1;
+fail:
+  btc_free(keys);
+  return ret;
+}
+
+static int
+btc_chaindb_load_txindex(btc_chaindb_t *db) {
+  const btc_entry_t *entry;
+  btc_block_t *block;
+  lsm_cursor *cur;
+  int32_t height;
+  int exists;
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, txindex_key, 1, LSM_SEEK_EQ) == 0);
+
+  exists = lsm_csr_valid(cur);
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  /* Replicas use the index if the primary keeps one. */
+  if (db->flags & BTC_CHAIN_READONLY) {
+    if (exists)
+      db->flags |= BTC_CHAIN_TXINDEX;
+    else
+      db->flags &= ~BTC_CHAIN_TXINDEX;
+
+    return 1;
+  }
+
+  if (!(db->flags & BTC_CHAIN_TXINDEX)) {
+    /* The index goes stale from here on. Forget
+       it so that re-enabling it forces a rebuild. */
+    if (exists) {
+      if (lsm_begin(db->lsm, 1) != 0)
+        return 0;
+
+      if (lsm_delete(db->lsm, txindex_key, 1) != 0
+          || lsm_commit(db->lsm, 0) != 0) {
+        CHECK(lsm_rollback(db->lsm, 0) == 0);
+        return 0;
+      }
+    }
+
+    return 1;
+  }
+
+  if (db->flags & BTC_CHAIN_PRUNE) {
+    fprintf(stderr, "Transaction index is incompatible with pruning.\n");
+    return 0;
+  }
+
+  if (exists)
+    return 1;
+
+  /* Leftovers from an earlier run may point
+     at blocks which have since been reorged. */
+  if (!btc_chaindb_clear_txindex(db))
+    return 0;
+
+  for (height = 1; height <= db->tail->height; height++) {
+    entry = (const btc_entry_t *)db->heights.items[height];
+
+    /* Blocks below a snapshot were never stored. */
+    if (entry->block_pos == -1)
+      continue;
+
+    block = btc_chaindb_read_block(db, entry);
+
+    if (block == NULL) {
+      fprintf(stderr, "Block data not found for txindex (height=%d).\n",
+                      (int)height);
+      return 0;
+    }
+
+    btc_chaindb_index_txs(db, entry, block);
+    btc_block_destroy(block);
+
+    if (btc_chaindb_usage(db) > db->cache.limit) {
+      if (!btc_chaindb_flush_cache(db, db->tail->hash, 0))
+        return 0;
+    }
+  }
+
+  if (btc_chaindb_dirty(db)) {
+    if (!btc_chaindb_flush_cache(db, db->tail->hash, 0))
+      return 0;
+  }
+
+  if (lsm_begin(db->lsm, 1) != 0)
+    return 0;
+
+  if (lsm_insert(db->lsm, txindex_key, 1, db->tail->hash, 32) != 0
+      || lsm_commit(db->lsm, 0) != 0) {
+    CHECK(lsm_rollback(db->lsm, 0) == 0);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void
+btc_chaindb_scan_stats(btc_chaindb_t *db, btc_coinstats_t *stats) {
+  /* The coins on disk must correspond to the tip. */
+  btc_coiniter_t it;
+  lsm_cursor *cur;
+  btc_coin_t coin;
+
+  btc_coin_init(&coin);
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+
+  btc_coiniter_init(&it, db, cur, 0);
+
+  while (btc_coiniter_next(&it)) {
+    CHECK(btc_coin_import(&coin, it.cp, it.cn));
+
+    btc_coinstats_update(stats, it.hash, it.index,
+                                         coin.height,
+                                         coin.coinbase,
+                                         &coin.output,
+                                         1);
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  btc_coin_clear(&coin);
+}
+
+static int
+btc_chaindb_load_stats(btc_chaindb_t *db) {
+  lsm_cursor *cur;
+  const void *vp;
+  int exists;
+  int vn;
+
+  btc_coinstats_init(&db->stats);
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, coinstats_key, 1, LSM_SEEK_EQ) == 0);
+
+  exists = lsm_csr_valid(cur);
+
+  if (exists && (db->flags & BTC_CHAIN_COINSTATS)) {
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+    CHECK(btc_coinstats_import(&db->stats, vp, vn));
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  /* The stored stats go with the primary's tip, not
+     with the flushed coins a replica follows. */
+  if (db->flags & BTC_CHAIN_READONLY)
+    return 1;
+
+  if (!(db->flags & BTC_CHAIN_COINSTATS)) {
+    /* Same as the txindex: a stale record
+       must not survive to be picked up again. */
+    if (exists) {
+      if (lsm_begin(db->lsm, 1) != 0)
+        return 0;
+
+      if (lsm_delete(db->lsm, coinstats_key, 1) != 0
+          || lsm_commit(db->lsm, 0) != 0) {
+        CHECK(lsm_rollback(db->lsm, 0) == 0);
+        return 0;
+      }
+    }
+
+    return 1;
+  }
+
+  if (exists)
+    return 1;
+
+  /* Built once from the coin set (which was just
+     flushed), and kept up to date from here on. */
+  btc_chaindb_scan_stats(db, &db->stats);
+
+  if (lsm_begin(db->lsm, 1) != 0)
+    return 0;
+
+  if (!btc_chaindb_write_stats(db) || lsm_commit(db->lsm, 0) != 0) {
+    CHECK(lsm_rollback(db->lsm, 0) == 0);
+    return 0;
+  }
+
+  return 1;
+}
+
+int
+btc_chaindb_utxo_stats(btc_chaindb_t *db, btc_utxostats_t *stats) {
+  if (!(db->flags & BTC_CHAIN_COINSTATS))
+    return 0;
+
+  btc_rwlock_rdlock(db->state);
+
+  memcpy(stats->hash, db->tail->hash, 32);
+
+  stats->height = db->tail->height;
+  stats->count = db->stats.count;
+  stats->amount = db->stats.amount;
+
+  btc_muhash_final(&db->stats.muhash, stats->muhash);
+
+  btc_rwlock_rdunlock(db->state);
+
+  return 1;
+}
+
+int
+btc_chaindb_flush(btc_chaindb_t *db) {
+  int ret = 1;
+
+  btc_rwlock_wrlock(db->state);
+
+  if (btc_chaindb_dirty(db))
+    ret = btc_chaindb_flush_cache(db, db->tail->hash, 0);
+  else
+    ret = btc_chaindb_commit_batch(db);
+
+  btc_rwlock_wrunlock(db->state);
+
+  return ret;
+}
+
+/*
+ * Replicas
+ */
+
+static int
+btc_chaindb_follow_flat(btc_chaindb_t *db, lsm_cursor *cur,
+                                           const uint8_t *tip_hash) {
+  /* The usual case: the primary extended our main
+     chain, and has mirrored the new entries to the
+     flat index. Read them from there in one go. */
+  btc_entry_t *entry, *prev, *next;
+  btc_entry_t *base = db->tail;
+  uint8_t *buf = db->slab;
+  size_t i, j, n, total;
+  int32_t height;
+  btc_stat_t st;
+  int64_t pos;
+
+  entry = read_entry(db, cur, tip_hash);
+
+  if (entry == NULL)
+    return 0;
+
+  height = entry->height;
+
+  btc_chaindb_destroy_entry(db, entry);
+
+  if (height <= base->height)
+    return 0;
+
+  total = (size_t)(height - base->height);
+  pos = (int64_t)(base->height + 1) * INDEX_RECORD_SIZE;
+
+  if (!btc_fs_fstat(db->index_fd, &st))
+    return 0;
+
+  if (st.st_size < pos + (int64_t)(total * INDEX_RECORD_SIZE))
+    return 0;
+
+  prev = base;
+
+  for (i = 0; i < total; i += n) {
+    n = total - i;
+
+    if (n > INDEX_BATCH_SIZE)
+      n = INDEX_BATCH_SIZE;
+
+    if (!btc_fs_pread(db->index_fd, buf, n * INDEX_RECORD_SIZE, pos))
+      goto fail;
+
+    pos += n * INDEX_RECORD_SIZE;
+
+    for (j = 0; j < n; j++) {
+      entry = btc_chaindb_create_entry(db);
+
+      if (!index_record_read(entry, buf + j * INDEX_RECORD_SIZE)) {
+        btc_chaindb_destroy_entry(db, entry);
+        goto fail;
+      }
+
+      entry->prev = prev;
+      prev = entry;
+
+      /* A record may be stale or half written. */
+      if (entry->height != entry->prev->height + 1)
+        goto fail;
+
+      if (memcmp(entry->header.prev_block, entry->prev->hash, 32) != 0)
+        goto fail;
+    }
+  }
+
+  if (memcmp(prev->hash, tip_hash, 32) != 0)
+    goto fail;
+
+  for (entry = prev; entry != base; entry = entry->prev)
+    CHECK(btc_hashmap_put(db->hashes, entry->hash, entry));
+
+  return 1;
+fail:
+  for (entry = prev; entry != base; entry = next) {
+    next = entry->prev;
+    btc_chaindb_destroy_entry(db, entry);
+  }
+
+  return 0;
+}
+
+int
+btc_chaindb_refresh(btc_chaindb_t *db) {
+  /* Move a replica to whatever the primary has most
+     recently committed. Entries are never freed, so
+     anything handed out before remains valid; those
+     which were reorged out simply become side ones. */
+  btc_entry_t *entry, *tip, *fork;
+  uint8_t hash[32];
+  lsm_cursor *cur;
+  size_t i, length;
+  int rc;
+
+  CHECK(db->flags & BTC_CHAIN_READONLY);
+
+  rc = lsm_csr_open(db->lsm, &cur);
+
+  if (rc != 0) {
+    fprintf(stderr, "lsm_csr_open: %s\n", lsm_strerror(rc));
+    return 0;
+  }
+
+  if (!btc_chaindb_read_tip(db, cur, hash)
+      || btc_hash_equal(hash, db->tail->hash)) {
+    CHECK(lsm_csr_close(cur) == 0);
+    return 0;
+  }
+
+  btc_rwlock_wrlock(db->state);
+
+  if (!btc_hashmap_has(db->hashes, hash)) {
+    if (!btc_chaindb_follow_flat(db, cur, hash))
+      btc_chaindb_load_branch(db, cur, hash);
+  }
+
+  tip = btc_hashmap_get(db->hashes, hash);
+
+  CHECK(tip != NULL);
+
+  /* Rewind to the fork and move onto the new branch. */
+  fork = tip;
+
+  while (!btc_chaindb_is_main(db, fork))
+    fork = fork->prev;
+
+  for (i = fork->height; i < db->heights.length; i++) {
+    entry = db->heights.items[i];
+    entry->next = NULL;
+  }
+
+  length = (size_t)tip->height + 1;
+
+  if (length > db->heights.alloc)
+    btc_vector_grow(&db->heights, (length * 3) / 2);
+
+  btc_vector_resize(&db->heights, length);
+
+  for (entry = tip; entry != fork; entry = entry->prev) {
+    db->heights.items[entry->height] = entry;
+    entry->prev->next = entry;
+  }
+
+  /* Skips lean on the ones below, so oldest first. */
+  for (i = fork->height + 1; i < length; i++)
+    btc_entry_build_skip(db->heights.items[i]);
+
+  db->tail = tip;
+
+  /* Cached coins may have been spent since. */
+  btc_coincache_reset(&db->cache);
+
+  btc_rwlock_wrunlock(db->state);
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  return 1;
+}
+
+/*
+ * Snapshots
+ */
+
+/* A snapshot is the main chain index followed by
+ * the coin set as of its tip, in database order:
+ *
+ *   magic[4] version[4] hash[32] height[4]
+ *   record[INDEX_RECORD_SIZE] * (height + 1)
+ *   (hash[32] index[4] size[varint] coin[size]) * count
+ *   count[8] checksum[32]
+ *
+ * Block positions are cleared so that any two nodes
+ * produce identical files for the same tip. The
+ * checksum is the hash256 of everything before it.
+ */
+
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HEADER_SIZE 44
+#define SNAPSHOT_TRAILER_SIZE 40
+#define SNAPSHOT_COIN_SIZE (32 + 4 + 9)
+#define SNAPSHOT_BATCH_SIZE 4096
+#define SNAPSHOT_BUFFER_SIZE (24 + BTC_MAX_RAW_BLOCK_SIZE)
+
+typedef struct btc_snapfile_s {
+  int fd;
+  uint8_t *buf;
+  size_t size;
+  size_t pos;
+  size_t len;
+  int64_t left;
+  btc_hash256_t hash;
+} btc_snapfile_t;
+
+static void
+btc_snapfile_init(btc_snapfile_t *f, int fd, uint8_t *buf,
+                                             size_t size,
+                                             int64_t left) {
+  f->fd = fd;
+  f->buf = buf;
+  f->size = size;
+  f->pos = 0;
+  f->len = 0;
+  f->left = left;
+
+  btc_hash256_init(&f->hash);
+}
+
+static int
+btc_snapfile_flush(btc_snapfile_t *f) {
+  btc_hash256_update(&f->hash, f->buf, f->pos);
+
+  if (!btc_fs_write(f->fd, f->buf, f->pos))
+    return 0;
+
+  f->pos = 0;
+
+  return 1;
+}
+
+static int
+btc_snapfile_write(btc_snapfile_t *f, const void *data, size_t len) {
+  if (f->pos + len > f->size) {
+    if (!btc_snapfile_flush(f))
+      return 0;
+
+    if (len > f->size) {
+      btc_hash256_update(&f->hash, data, len);
+      return btc_fs_write(f->fd, data, len);
+    }
+  }
+
+  memcpy(f->buf + f->pos, data, len);
+
+  f->pos += len;
+
+  return 1;
+}
+
+static int
+btc_snapfile_fill(btc_snapfile_t *f, size_t need) {
+  /* Ensure `need` bytes are buffered past `pos`. */
+  size_t want;
+
+  if (f->len - f->pos >= need)
+    return 1;
+
+  if (f->pos > 0) {
+    memmove(f->buf, f->buf + f->pos, f->len - f->pos);
+
+    f->len -= f->pos;
+    f->pos = 0;
+  }
+
+  want = f->size - f->len;
+
+  if ((int64_t)want > f->left)
+    want = f->left;
+
+  if (want > 0) {
+    if (!btc_fs_read(f->fd, f->buf + f->len, want))
+      return 0;
+
+    btc_hash256_update(&f->hash, f->buf + f->len, want);
+
+    f->len += want;
+    f->left -= want;
+  }
+
+  return f->len - f->pos >= need;
+}
+
+static size_t
+btc_snapfile_avail(const btc_snapfile_t *f) {
+  return (f->len - f->pos) + (size_t)f->left;
+}
+
+int
+btc_chaindb_write_snapshot(btc_chaindb_t *db,
+                           const char *path,
+                           uint8_t *checksum,
+                           uint64_t *count) {
+  const btc_entry_t *tip = db->tail;
+  uint8_t raw[INDEX_RECORD_SIZE];
+  char tmp[BTC_PATH_MAX];
+  btc_snapfile_t f;
+  btc_entry_t entry;
+  btc_coiniter_t it;
+  lsm_cursor *cur;
+  uint64_t total = 0;
+  uint8_t *zp;
+  int32_t i;
+  int fd;
+
+  if (strlen(path) + 5 > sizeof(tmp))
+    return 0;
+
+  sprintf(tmp, "%s.tmp", path);
+
+  /* The coins on disk must correspond to the tip. */
+  if (!btc_chaindb_flush(db))
+    return 0;
+
+  fd = btc_fs_open(tmp, BTC_O_WRONLY | BTC_O_CREAT | BTC_O_TRUNC, 0644);
+
+  if (fd == -1)
+    return 0;
+
+  btc_snapfile_init(&f, fd, db->slab, SNAPSHOT_BUFFER_SIZE, 0);
+
+  zp = raw;
+  zp = btc_uint32_write(zp, db->network->magic);
+  zp = btc_uint32_write(zp, SNAPSHOT_VERSION);
+  zp = btc_raw_write(zp, tip->hash, 32);
+  zp = btc_int32_write(zp, tip->height);
+
+  if (!btc_snapfile_write(&f, raw, zp - raw))
+    goto fail;
+
+  for (i = 0; i <= tip->height; i++) {
+    entry = *((const btc_entry_t *)db->heights.items[i]);
+    entry.block_file = -1;
+    entry.block_pos = -1;
+    entry.undo_file = -1;
+    entry.undo_pos = -1;
+
+    index_record_write(raw, &entry);
+
+    if (!btc_snapfile_write(&f, raw, sizeof(raw)))
+      goto fail;
+  }
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+
+  btc_coiniter_init(&it, db, cur, 0);
+
+  while (btc_coiniter_next(&it)) {
+    zp = raw;
+    zp = btc_raw_write(zp, it.hash, 32);
+    zp = btc_uint32_write(zp, it.index);
+    zp = btc_size_write(zp, it.cn);
+
+    if (!btc_snapfile_write(&f, raw, zp - raw)
+        || !btc_snapfile_write(&f, it.cp, it.cn)) {
+      CHECK(lsm_csr_close(cur) == 0);
+      goto fail;
+    }
+
+    total++;
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  btc_uint64_write(raw, total);
+
+  if (!btc_snapfile_write(&f, raw, 8))
+    goto fail;
+
+  if (!btc_snapfile_flush(&f))
+    goto fail;
+
+  btc_hash256_final(&f.hash, checksum);
+
+  if (!btc_fs_write(fd, checksum, 32))
+    goto fail;
+
+  if (!btc_fs_fsync(fd))
+    goto fail;
+
+  btc_fs_close(fd);
+
+  if (!btc_fs_rename(tmp, path)) {
+    btc_fs_unlink(tmp);
+    return 0;
+  }
+
+  *count = total;
+
+  return 1;
+fail:
+  btc_fs_close(fd);
+  btc_fs_unlink(tmp);
+  return 0;
+}
+
+static int64_t
+snapshot_median_time(const int64_t *times, int32_t height) {
+  int64_t tvec[BTC_MEDIAN_TIMESPAN];
+  int len = 0;
+  int i, j;
+
+  /* `times` is a ring of the last 11 timestamps. */
+  for (i = 0; i < BTC_MEDIAN_TIMESPAN && i <= height; i++) {
+    int64_t time = times[(height - i) % BTC_MEDIAN_TIMESPAN];
+
+    for (j = len++; j > 0 && tvec[j - 1] > time; j--)
+      tvec[j] = tvec[j - 1];
+
+    tvec[j] = time;
+  }
+
+  return tvec[len >> 1];
+}
+
+static int
+btc_chaindb_apply_snapshot(btc_chaindb_t *db, btc_snapfile_t *f, int apply) {
+  /* Parse a snapshot, writing it to the
+     database on the second (apply) pass. */
+  const btc_network_t *network = db->network;
+  int64_t times[BTC_MEDIAN_TIMESPAN];
+  btc_entry_t prev, entry, rec;
+  uint8_t raw[BTC_ENTRY_SIZE];
+  uint8_t key[COIN_KEYLEN];
+  uint8_t ekey[ENTRY_KEYLEN];
+  uint32_t magic, version;
+  uint64_t count, total;
+  btc_coinstats_t stats;
+  uint8_t tip_hash[32];
+  uint8_t hash[32];
+  int32_t tip_height;
+  size_t batch = 0;
+  const uint8_t *xp;
+  btc_coin_t coin;
+  size_t xn, len;
+  uint32_t index;
+  int32_t height;
+
+  btc_coin_init(&coin);
+  btc_coinstats_init(&stats);
+
+  if (!btc_snapfile_fill(f, SNAPSHOT_HEADER_SIZE))
+    goto fail;
+
+  xp = f->buf + f->pos;
+  xn = SNAPSHOT_HEADER_SIZE;
+
+  CHECK(btc_uint32_read(&magic, &xp, &xn));
+  CHECK(btc_uint32_read(&version, &xp, &xn));
+  CHECK(btc_raw_read(tip_hash, 32, &xp, &xn));
+  CHECK(btc_int32_read(&tip_height, &xp, &xn));
+
+  f->pos += SNAPSHOT_HEADER_SIZE;
+
+  if (magic != network->magic || version != SNAPSHOT_VERSION)
+    goto fail;
+
+  if (tip_height <= 0)
+    goto fail;
+
+  if (apply) {
+    CHECK(lsm_begin(db->lsm, 1) == 0);
+
+    /* Until the final commit the coins on disk
+       match no block, so the database won't open. */
+    btc_hash_init(hash);
+
+    CHECK(lsm_insert(db->lsm, state_key, 1, hash, 32) == 0);
+  }
+
+  /* Rebuild every entry from its header. The
+     records only have to agree with the result. */
+  btc_entry_init(&prev);
+
+  for (height = 0; height <= tip_height; height++) {
+    if (!btc_snapfile_fill(f, INDEX_RECORD_SIZE))
+      goto fail;
+
+    CHECK(index_record_read(&rec, f->buf + f->pos));
+
+    f->pos += INDEX_RECORD_SIZE;
+
+    btc_entry_set_header(&entry, &rec.header, height > 0 ? &prev : NULL);
+
+    entry.prev = NULL;
+    entry.skip = NULL;
+
+    /* Our copy of `prev` is unlinked, so the
+       median time comes from a ring instead. */
+    times[height % BTC_MEDIAN_TIMESPAN] = entry.header.time;
+
+    entry.median_time = snapshot_median_time(times, height);
+
+    /* Transaction counts can't be checked without
+       the blocks, but they must at least add up. */
+    entry.tx_count = rec.tx_count;
+    entry.chain_tx += rec.tx_count;
+
+    if (rec.height != height || !btc_hash_equal(rec.hash, entry.hash))
+      goto fail;
+
+    if (!btc_hash_equal(rec.chainwork, entry.chainwork))
+      goto fail;
+
+    if (rec.median_time != entry.median_time)
+      goto fail;
+
+    if (rec.tx_count == 0 || rec.chain_tx != entry.chain_tx)
+      goto fail;
+
+    if (height == 0) {
+      if (!btc_hash_equal(entry.hash, network->genesis.hash))
+        goto fail;
+    } else {
+      if (!btc_hash_equal(entry.header.prev_block, prev.hash))
+        goto fail;
+
+      if (!btc_header_verify(&entry.header))
+        goto fail;
+    }
+
+    if (apply && height > 0) {
+      entry_key(ekey, entry.hash);
+
+      btc_entry_export(raw, &entry);
+
+      CHECK(lsm_insert(db->lsm, ekey, sizeof(ekey), raw, sizeof(raw)) == 0);
+
+      if (++batch == SNAPSHOT_BATCH_SIZE) {
+        CHECK(lsm_commit(db->lsm, 0) == 0);
+        CHECK(lsm_begin(db->lsm, 1) == 0);
+        batch = 0;
+      }
+    }
+
+    prev = entry;
+  }
+
+  if (!btc_hash_equal(prev.hash, tip_hash))
+    goto fail;
+
+  /* Coins run up to the trailing count. */
+  total = 0;
+
+  while (btc_snapfile_avail(f) > 8) {
+    len = btc_snapfile_avail(f) - 8;
+
+    if (len > SNAPSHOT_COIN_SIZE)
+      len = SNAPSHOT_COIN_SIZE;
+
+    if (!btc_snapfile_fill(f, len))
+      goto fail;
+
+    xp = f->buf + f->pos;
+    xn = len;
+
+    if (!btc_raw_read(hash, 32, &xp, &xn))
+      goto fail;
+
+    if (!btc_uint32_read(&index, &xp, &xn))
+      goto fail;
+
+    if (!btc_size_read(&len, &xp, &xn))
+      goto fail;
+
+    if (len > f->size - SNAPSHOT_COIN_SIZE)
+      goto fail;
+
+    f->pos = xp - f->buf;
+
+    if (!btc_snapfile_fill(f, len))
+      goto fail;
+
+    if (!btc_coin_import(&coin, f->buf + f->pos, len))
+      goto fail;
+
+    if (apply && (db->flags & BTC_CHAIN_COINSTATS)) {
+      btc_coinstats_update(&stats, hash, index, coin.height,
+                                                coin.coinbase,
+                                                &coin.output,
+                                                1);
+    }
+
+    if (apply) {
+      if (db->grouped) {
+        btc_cached_t item;
+        btc_cached_t *items = &item;
+
+        btc_outpoint_set(&item.key, hash, index);
+
+        item.coin = &coin;
+        item.flags = CACHE_DIRTY;
+
+        CHECK(write_groups(db, &items, 1));
+      } else {
+        coin_key(key, hash, index);
+
+        CHECK(lsm_insert(db->lsm, key, sizeof(key),
+                         f->buf + f->pos, len) == 0);
+      }
+
+      if (++batch == SNAPSHOT_BATCH_SIZE) {
+        CHECK(lsm_commit(db->lsm, 0) == 0);
+        CHECK(lsm_begin(db->lsm, 1) == 0);
+        batch = 0;
+      }
+    }
+
+    f->pos += len;
+
+    total++;
+  }
+
+  if (!btc_snapfile_fill(f, 8))
+    goto fail;
+
+  xp = f->buf + f->pos;
+  xn = 8;
+
+  CHECK(btc_uint64_read(&count, &xp, &xn));
+
+  f->pos += 8;
+
+  if (count != total)
+    goto fail;
+
+  if (apply) {
+    /* Point the database at the new tip. */
+    tip_key(ekey, network->genesis.hash);
+
+    CHECK(lsm_delete(db->lsm, ekey, sizeof(ekey)) == 0);
+
+    tip_key(ekey, tip_hash);
+
+    CHECK(lsm_insert(db->lsm, ekey, sizeof(ekey), raw, 1) == 0);
+    CHECK(lsm_insert(db->lsm, meta_key, 1, tip_hash, 32) == 0);
+    CHECK(lsm_insert(db->lsm, state_key, 1, tip_hash, 32) == 0);
+
+    db->stats = stats;
+
+    CHECK(btc_chaindb_write_stats(db));
+    CHECK(lsm_commit(db->lsm, 0) == 0);
+  }
+
+  btc_coin_clear(&coin);
 
   return 1;
+fail:
+  /* The first pass vetted the whole file, so a
+     failure here leaves a torn database behind. */
+  if (apply)
+    btc_abort(); /* LCOV_EXCL_LINE */
+
+  btc_coin_clear(&coin);
+
+  return 0;
+}
+
+int
+btc_chaindb_read_snapshot(btc_chaindb_t *db, const char *path) {
+  uint8_t checksum[32];
+  uint8_t expect[32];
+  btc_snapfile_t f;
+  btc_stat_t st;
+  int64_t size;
+  int fd;
+
+  CHECK(db->readers == 0);
+
+  if (db->tail->height != 0)
+    return 0;
+
+  if (!btc_chaindb_flush(db))
+    return 0;
+
+  fd = btc_fs_open(path, BTC_O_RDONLY | BTC_O_SEQUENTIAL, 0);
+
+  if (fd == -1)
+    return 0;
+
+  if (!btc_fs_fstat(fd, &st))
+    goto fail;
+
+  if (st.st_size < SNAPSHOT_HEADER_SIZE + SNAPSHOT_TRAILER_SIZE)
+    goto fail;
+
+  size = st.st_size - 32;
+
+  if (!btc_fs_pread(fd, expect, 32, size))
+    goto fail;
+
+  /* Vet the whole file before touching the database. */
+  btc_snapfile_init(&f, fd, db->slab, SNAPSHOT_BUFFER_SIZE, size);
+
+  if (!btc_chaindb_apply_snapshot(db, &f, 0))
+    goto fail;
+
+  btc_hash256_final(&f.hash, checksum);
+
+  if (!btc_hash_equal(checksum, expect))
+    goto fail;
+
+  btc_fs_close(fd);
+
+  fd = btc_fs_open(path, BTC_O_RDONLY | BTC_O_SEQUENTIAL, 0);
+
+  if (fd == -1)
+    return 0;
+
+  btc_snapfile_init(&f, fd, db->slab, SNAPSHOT_BUFFER_SIZE, size);
+
+  CHECK(btc_chaindb_apply_snapshot(db, &f, 1));
+
+  btc_fs_close(fd);
+
+  /* Reload the index from the new tip. */
+  btc_coincache_reset(&db->cache);
+  btc_chaindb_unload_index(db);
+
+  return btc_chaindb_load_index(db);
+fail:
+  btc_fs_close(fd);
+  return 0;
+}
+
+const btc_entry_t *
+btc_chaindb_head(btc_chaindb_t *db) {
+  return db->head;
+}
+
+const btc_entry_t *
+btc_chaindb_tail(btc_chaindb_t *db) {
+  return db->tail;
+}
+
+int32_t
+btc_chaindb_height(btc_chaindb_t *db) {
+  return db->tail->height;
+}
+
+const btc_entry_t *
+btc_chaindb_by_hash(btc_chaindb_t *db, const uint8_t *hash) {
+  return btc_hashmap_get(db->hashes, hash);
+}
+
+const btc_entry_t *
+btc_chaindb_by_height(btc_chaindb_t *db, int32_t height) {
+  if ((size_t)height >= db->heights.length)
+    return NULL;
+
+  return (btc_entry_t *)db->heights.items[height];
+}
+
+int
+btc_chaindb_is_main(btc_chaindb_t *db, const btc_entry_t *entry) {
+  if ((size_t)entry->height >= db->heights.length)
+    return 0;
+
+  return (btc_entry_t *)db->heights.items[entry->height] == entry;
+}
+
+int64_t
+btc_chaindb_median_time(btc_chaindb_t *db, const btc_entry_t *entry) {
+  (void)db;
+  return entry->median_time;
+}
+
+int
+btc_chaindb_get_state(btc_chaindb_t *db,
+                      const btc_deployment_t *deploy,
+                      const btc_entry_t *entry) {
+  uint8_t key[DEPLOY_KEYLEN];
+  uint8_t val[DEPLOY_VALLEN];
+  lsm_cursor *cur;
+  const void *vp;
+  int state = -1;
+  int vn;
+
+  deploy_key(key, deploy->bit, entry->hash);
+  deploy_value(val, deploy, 0);
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_EQ) == 0);
+
+  if (lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+
+    if (vn == DEPLOY_VALLEN && memcmp(val + 1, (uint8_t *)vp + 1, 24) == 0)
+      state = *((const uint8_t *)vp);
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  return state;
+}
+
+void
+btc_chaindb_put_state(btc_chaindb_t *db,
+                      const btc_deployment_t *deploy,
+                      const btc_entry_t *entry,
+                      int state) {
+  uint8_t key[DEPLOY_KEYLEN];
+  uint8_t val[DEPLOY_VALLEN];
+
+  deploy_key(key, deploy->bit, entry->hash);
+  deploy_value(val, deploy, state);
+
+  /* An open batch commits this along with the blocks. */
+  if (db->batch > 0) {
+    lsm_insert(db->lsm, key, sizeof(key), val, sizeof(val));
+    return;
+  }
+
+  /* Best effort: the state can always be recomputed. */
+  if (lsm_begin(db->lsm, 1) != 0)
+    return;
+
+  if (lsm_insert(db->lsm, key, sizeof(key), val, sizeof(val)) != 0
+      || lsm_commit(db->lsm, 0) != 0) {
+    CHECK(lsm_rollback(db->lsm, 0) == 0);
+  }
+}
+
+int
+btc_chaindb_has_coins(btc_chaindb_t *db, const btc_tx_t *tx) {
+  btc_outpoint_t prevout;
+  btc_cached_t *entry;
+  btc_coin_t *coin;
+  lsm_cursor *cur;
+  int ready = 0;
+  int ret = 0;
+  size_t i;
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+
+  for (i = 0; i < tx->outputs.length && !ret; i++) {
+    btc_outpoint_set(&prevout, tx->hash, i);
+
+    entry = btc_coincache_get(&db->cache, &prevout);
+
+    if (entry != NULL) {
+      ret = (entry->coin != NULL);
+      continue;
+    }
+
+    coin = read_next(db, cur, &ready, &prevout);
+
+    if (coin != NULL) {
+      btc_coin_destroy(coin);
+      ret = 1;
+    }
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  return ret;
+}
+
+btc_block_t *
+btc_chaindb_get_block(btc_chaindb_t *db, const btc_entry_t *entry) {
+  return btc_chaindb_read_block(db, entry);
 }
 
-void
-btc_chaindb_close(btc_chaindb_t *db) {
-  btc_chaindb_unload_index(db);
-  btc_chaindb_unload_files(db);
-  btc_chaindb_unload_database(db);
+btc_undo_t *
+btc_chaindb_get_undo(btc_chaindb_t *db, const btc_entry_t *entry) {
+  return btc_chaindb_read_undo(db, entry);
 }
 
-static btc_coin_t *
-read_coin(const btc_outpoint_t *prevout, void *arg1, void *arg2) {
-  btc_chaindb_t *db = (btc_chaindb_t *)arg1;
-  lsm_cursor *cur = (lsm_cursor *)arg2;
-  uint8_t key[COIN_KEYLEN];
-  btc_coin_t *coin;
-  const void *vp;
-  int rc, vn;
+int
+btc_chaindb_has_undo(btc_chaindb_t *db, const btc_entry_t *entry) {
+  /* A block without an undo record either spends
+     nothing or had its undo coins skipped. */
+  return entry->undo_pos != -1 || needs_undo(db, entry);
+}
 
-  (void)db;
+int
+btc_chaindb_get_raw_block(btc_chaindb_t *db,
+                          uint8_t **data,
+                          size_t *length,
+                          const btc_entry_t *entry) {
+  if (entry->block_pos == -1)
+    return 0;
 
-  coin_key(key, prevout->hash, prevout->index);
+  return btc_chaindb_read(db, data, length, &db->block, entry->block_file,
+                                                        entry->block_pos);
 
-  rc = lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_EQ);
+}
 
-  if (rc != 0) {
-    fprintf(stderr, "lsm_csr_seek: %s\n", lsm_strerror(rc));
+const uint8_t *
+btc_chaindb_map_raw_block(btc_chaindb_t *db,
+                          size_t *length,
+                          const btc_entry_t *entry) {
+  if (entry->block_pos == -1)
     return NULL;
+
+  return btc_chaindb_peek(db, length, &db->block, entry->block_file,
+                                                  entry->block_pos);
+}
+
+int
+btc_chaindb_get_raw_undo(btc_chaindb_t *db,
+                         uint8_t **data,
+                         size_t *length,
+                         const btc_entry_t *entry) {
+  if (entry->undo_pos == -1)
+    return 0;
+
+  return btc_chaindb_read(db, data, length, &db->undo, entry->undo_file,
+                                                       entry->undo_pos);
+}
+
+const uint8_t *
+btc_chaindb_map_raw_undo(btc_chaindb_t *db,
+                         size_t *length,
+                         const btc_entry_t *entry) {
+  if (entry->undo_pos == -1)
+    return NULL;
+
+  return btc_chaindb_peek(db, length, &db->undo, entry->undo_file,
+                                                 entry->undo_pos);
+}
+
+btc_undo_t *
+btc_chaindb_decode_undo(const uint8_t *data, size_t length, int32_t height) {
+  /* Touches nothing but the record: safe from any thread. */
+  return undo_decode(data, length, height);
+}
+
+btc_blockfile_t *
+btc_chaindb_open_raw_block(btc_chaindb_t *db,
+                           int64_t *pos,
+                           size_t *length,
+                           const btc_entry_t *entry) {
+  char path[BTC_PATH_MAX];
+  btc_blockfile_t *file = NULL;
+  uint8_t tmp[4];
+  size_t i;
+  int fd;
+
+  if (entry->block_pos == -1)
+    return NULL;
+
+  /* The tail of the active file may still be queued. */
+  if (entry->block_file == db->block.id)
+    btc_blockwriter_drain(&db->writer);
+
+  for (i = 0; i < lengthof(db->handles); i++) {
+    if (db->handles[i] != NULL && db->handles[i]->id == entry->block_file) {
+      file = db->handles[i];
+      break;
+    }
   }
 
-  if (!lsm_csr_valid(cur))
+  if (file == NULL) {
+    btc_chaindb_path(db, path, 0, entry->block_file);
+
+    fd = btc_fs_open(path, READ_FLAGS, 0);
+
+    if (fd == -1)
+      return NULL;
+
+    file = btc_blockfile_create(fd, entry->block_file);
+
+    /* Evict round-robin. */
+    i = db->handle_index++ % lengthof(db->handles);
+
+    if (db->handles[i] != NULL)
+      btc_blockfile_unref(db->handles[i]);
+
+    db->handles[i] = file;
+  }
+
+  if (!btc_fs_pread(file->fd, tmp, 4, entry->block_pos + 16))
     return NULL;
 
-  coin = btc_coin_create();
+  *pos = entry->block_pos;
+  *length = 24 + btc_read32le(tmp);
 
-  CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
-  CHECK(btc_coin_import(coin, vp, vn));
+  file->refs++;
 
-  return coin;
+  return file;
 }
 
-int
-btc_chaindb_spend(btc_chaindb_t *db,
-                  btc_view_t *view,
-                  const btc_tx_t *tx) {
+static int
+btc_chaindb_read_txloc(btc_chaindb_t *db,
+                       btc_txloc_t *loc,
+                       const uint8_t *hash) {
+  const btc_txloc_t *pending = btc_hashmap_get(db->txlocs, hash);
+  uint8_t key[TX_KEYLEN];
   lsm_cursor *cur;
+  const void *vp;
+  int ret = 0;
+  int vn;
+
+  if (pending != NULL) {
+    *loc = *pending;
+    return 1;
+  }
+
+  tx_key(key, hash);
+
+  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
+  CHECK(lsm_csr_seek(cur, key, sizeof(key), LSM_SEEK_EQ) == 0);
+
+  if (lsm_csr_valid(cur)) {
+    CHECK(lsm_csr_value(cur, &vp, &vn) == 0);
+
+    ret = btc_txloc_import(loc, vp, vn);
+  }
+
+  CHECK(lsm_csr_close(cur) == 0);
+
+  return ret;
+}
+
+int
+btc_chaindb_get_raw_tx(btc_chaindb_t *db,
+                       uint8_t **data,
+                       size_t *length,
+                       const btc_entry_t **entry,
+                       const uint8_t *hash) {
+  const btc_entry_t *block;
+  char path[BTC_PATH_MAX];
+  const uint8_t *map;
+  uint8_t *raw = NULL;
+  btc_txloc_t loc;
+  size_t size;
+  int fd;
+
+  if (!(db->flags & BTC_CHAIN_TXINDEX))
+    return 0;
+
+  if (!btc_chaindb_read_txloc(db, &loc, hash))
+    return 0;
+
+  if (loc.height < 0 || (size_t)loc.height >= db->heights.length)
+    return 0;
+
+  block = (const btc_entry_t *)db->heights.items[loc.height];
+
+  if (block->block_file != loc.file || block->block_pos != loc.pos)
+    return 0;
+
+  if (loc.length == 0 || loc.length > BTC_MAX_RAW_BLOCK_SIZE)
+    return 0;
+
+  /* Only the transaction itself is read. */
+  map = btc_chaindb_peek(db, &size, &db->block, loc.file, loc.pos);
+
+  if (map != NULL) {
+    if ((size_t)loc.offset + loc.length > size - 24)
+      return 0;
+
+    raw = (uint8_t *)malloc(loc.length);
+
+    if (raw == NULL)
+      return 0;
+
+    memcpy(raw, map + 24 + loc.offset, loc.length);
+  } else {
+    if (loc.file == db->block.id) {
+      /* The tail of the active file may still be queued. */
+      btc_blockwriter_drain(&db->writer);
+
+      fd = db->block.fd;
+    } else {
+      btc_chaindb_path(db, path, db->block.type, loc.file);
+
+      fd = btc_fs_open(path, READ_FLAGS, 0);
+
+      if (fd == -1)
+        return 0;
+    }
+
+    raw = (uint8_t *)malloc(loc.length);
+
+    if (raw != NULL) {
+      int64_t pos = (int64_t)loc.pos + 24 + loc.offset;
+
+      if (!btc_fs_pread(fd, raw, loc.length, pos)) {
+        free(raw);
+        raw = NULL;
+      }
+    }
+
+    if (fd != db->block.fd)
+      btc_fs_close(fd);
+
+    if (raw == NULL)
+      return 0;
+  }
+
+  *data = raw;
+  *length = loc.length;
+
+  if (entry != NULL)
+    *entry = block;
+
+  return 1;
+}
+
+btc_tx_t *
+btc_chaindb_get_tx(btc_chaindb_t *db,
+                   const btc_entry_t **entry,
+                   const uint8_t *hash) {
+  btc_tx_t *tx;
+  uint8_t *raw;
+  size_t len;
+
+  if (!btc_chaindb_get_raw_tx(db, &raw, &len, entry, hash))
+    return NULL;
+
+  tx = btc_tx_decode(raw, len);
+
+  free(raw);
+
+  /* A mismatch means the location is stale. */
+  if (tx != NULL && !btc_hash_equal(tx->hash, hash)) {
+    btc_tx_destroy(tx);
+    return NULL;
+  }
+
+  return tx;
+}
+
+/*
+ * Chain Reader
+ */
+
+/* A reader serves coin lookups (and index and block
+ * reads) on a thread other than the one driving the
+ * chain. Each reader has its own LSM connection
+ * (under LevelDB and LMDB it shares the thread-safe
+ * handle). Lookups run under
+ * the shared side of the state lock, which the chain
+ * holds exclusively while it touches the coin cache
+ * or the on-disk coins, so a lookup always sees the
+ * coins as of one committed tip. One reader must not
+ * be used by two threads at once.
+ */
+
+struct btc_chainreader_s {
+  btc_chaindb_t *db;
+  lsm_db *lsm;
+  uint8_t tip[32];
+  int32_t height;
+};
+
+btc_chainreader_t *
+btc_chainreader_create(btc_chaindb_t *db) {
+  btc_chainreader_t *reader;
+#ifdef USE_NATIVE
+  char path[BTC_PATH_MAX];
   int rc;
+#endif
 
-  rc = lsm_csr_open(db->lsm, &cur);
+  reader = (btc_chainreader_t *)btc_malloc(sizeof(btc_chainreader_t));
+  reader->db = db;
+  reader->lsm = db->lsm;
+  reader->height = -1;
+
+  memset(reader->tip, 0, 32);
+
+#ifdef USE_NATIVE
+  if (!btc_path_join(path, sizeof(path), db->prefix, "chain.dat", 0))
+    goto fail;
+
+  rc = lsm_connect(&reader->lsm, path, &db->tune, 0,
+                   (db->flags & BTC_CHAIN_READONLY) != 0);
 
   if (rc != 0) {
-    fprintf(stderr, "lsm_csr_open: %s\n", lsm_strerror(rc));
-    return 0;
+    fprintf(stderr, "lsm_connect: %s\n", lsm_strerror(rc));
+    goto fail;
   }
+#endif
 
-  rc = btc_view_spend(view, tx, read_coin, db, cur);
+  btc_rwlock_wrlock(db->state);
 
-  CHECK(lsm_csr_close(cur) == 0);
+  db->readers++;
 
-  return rc;
+  btc_rwlock_wrunlock(db->state);
+
+  return reader;
+#ifdef USE_NATIVE
+fail:
+  btc_free(reader);
+  return NULL;
+#endif
 }
 
-int
-btc_chaindb_fill(btc_chaindb_t *db,
-                 btc_view_t *view,
-                 const btc_tx_t *tx) {
+void
+btc_chainreader_destroy(btc_chainreader_t *reader) {
+  btc_chaindb_t *db = reader->db;
+
+#ifdef USE_NATIVE
+  CHECK(lsm_close(reader->lsm) == 0);
+#endif
+
+  btc_rwlock_wrlock(db->state);
+
+  CHECK(db->readers > 0);
+
+  db->readers--;
+
+  btc_rwlock_wrunlock(db->state);
+
+  btc_free(reader);
+}
+
+static btc_coin_t *
+read_shared(const btc_outpoint_t *prevout, void *arg1, void *arg2) {
+  btc_chainreader_t *reader = (btc_chainreader_t *)arg1;
+  lsm_cursor *cur = (lsm_cursor *)arg2;
+  btc_cached_t *entry;
+
+  /* Never populate the cache: it belongs to the chain. */
+  entry = btc_coincache_get(&reader->db->cache, prevout);
+
+  if (entry != NULL) {
+    if (entry->coin == NULL)
+      return NULL;
+
+    return btc_coin_clone(entry->coin);
+  }
+
+  return read_db(reader->db, cur, prevout);
+}
+
+static lsm_cursor *
+btc_chainreader_begin(btc_chainreader_t *reader) {
+  btc_chaindb_t *db = reader->db;
   lsm_cursor *cur;
   int rc;
 
-  rc = lsm_csr_open(db->lsm, &cur);
+  btc_rwlock_rdlock(db->state);
+
+  /* Opened under the lock so that the cursor
+     sees the last flush of the coin cache. */
+  rc = lsm_csr_open(reader->lsm, &cur);
 
   if (rc != 0) {
     fprintf(stderr, "lsm_csr_open: %s\n", lsm_strerror(rc));
-    return 0;
+    btc_rwlock_rdunlock(db->state);
+    return NULL;
   }
 
-  rc = btc_view_fill(view, tx, read_coin, db, cur);
+  memcpy(reader->tip, db->tail->hash, 32);
+
+  reader->height = db->tail->height;
+
+  return cur;
+}
 
+static void
+btc_chainreader_end(btc_chainreader_t *reader, lsm_cursor *cur) {
   CHECK(lsm_csr_close(cur) == 0);
 
-  return rc;
+  btc_rwlock_rdunlock(reader->db->state);
+}
+
+int
+btc_chainreader_fill(btc_chainreader_t *reader,
+                     btc_view_t *view,
+                     const btc_tx_t *tx) {
+  lsm_cursor *cur = btc_chainreader_begin(reader);
+  int rc;
+
+  if (cur == NULL)
+    return 0;
+
+  read_inputs(reader->db, cur, view, tx, 1);
+
+  rc = btc_view_fill(view, tx, read_none, NULL, NULL);
+
+  btc_chainreader_end(reader, cur);
+
+  return rc;
+}
+
+btc_coin_t *
+btc_chainreader_get(btc_chainreader_t *reader, const btc_outpoint_t *prevout) {
+  lsm_cursor *cur = btc_chainreader_begin(reader);
+  btc_coin_t *coin;
+
+  if (cur == NULL)
+    return NULL;
+
+  coin = read_shared(prevout, reader, cur);
+
+  btc_chainreader_end(reader, cur);
+
+  return coin;
+}
+
+const uint8_t *
+btc_chainreader_tip(const btc_chainreader_t *reader, int32_t *height) {
+  if (height != NULL)
+    *height = reader->height;
+
+  return reader->tip;
+}
+
+const btc_entry_t *
+btc_chainreader_by_height(btc_chainreader_t *reader, int32_t height) {
+  const btc_entry_t *entry;
+
+  btc_rwlock_rdlock(reader->db->state);
+
+  entry = btc_chaindb_by_height(reader->db, height);
+
+  btc_rwlock_rdunlock(reader->db->state);
+
+  return entry;
+}
+
+const btc_entry_t *
+btc_chainreader_by_hash(btc_chainreader_t *reader, const uint8_t *hash) {
+  const btc_entry_t *entry;
+
+  btc_rwlock_rdlock(reader->db->state);
+
+  entry = btc_chaindb_by_hash(reader->db, hash);
+
+  btc_rwlock_rdunlock(reader->db->state);
+
+  return entry;
+}
+
+int32_t
+btc_chainreader_depth(btc_chainreader_t *reader,
+                      const btc_entry_t *entry,
+                      const uint8_t **next) {
+  const btc_entry_t *tip;
+  int32_t depth = -1;
+
+  btc_rwlock_rdlock(reader->db->state);
+
+  tip = reader->db->tail;
+
+  *next = NULL;
+
+  if (entry == tip) {
+    depth = 1;
+  } else if (entry->next != NULL) {
+    *next = entry->next->hash;
+    depth = tip->height - entry->height + 1;
+  }
+
+  btc_rwlock_rdunlock(reader->db->state);
+
+  return depth;
 }
 
-static int
-btc_chaindb_save_view(btc_chaindb_t *db, const btc_view_t *view) {
-  uint8_t key[COIN_KEYLEN];
-  uint8_t *val = db->slab;
-  const btc_coin_t *coin;
-  btc_viewiter_t iter;
-  size_t len;
-  int rc;
-
-  btc_view_iterate(&iter, view);
+int
+btc_chainreader_is_main(btc_chainreader_t *reader, const btc_entry_t *entry) {
+  int ret;
 
-  while (btc_view_next(&coin, &iter)) {
-    coin_key(key, iter.hash, iter.index);
+  btc_rwlock_rdlock(reader->db->state);
 
-    if (coin->spent) {
-      rc = lsm_delete(db->lsm, key, sizeof(key));
-    } else {
-      len = btc_coin_export(val, coin);
-      rc = lsm_insert(db->lsm, key, sizeof(key), val, len);
-    }
+  ret = btc_chaindb_is_main(reader->db, entry);
 
-    if (rc != 0) {
-      fprintf(stderr, "lsm_insert: %s\n", lsm_strerror(rc));
-      return 0;
-    }
-  }
+  btc_rwlock_rdunlock(reader->db->state);
 
-  return 1;
+  return ret;
 }
 
 static int
-btc_chaindb_read(btc_chaindb_t *db,
-                 uint8_t **raw,
-                 size_t *len,
-                 const btc_chainfile_t *file,
-                 int id,
-                 int pos) {
+btc_chainreader_record(btc_chainreader_t *reader,
+                       uint8_t **raw,
+                       size_t *len,
+                       int type,
+                       int id,
+                       int pos,
+                       int active) {
+  /* The mappings and the descriptors of the active
+     files belong to the chain thread. We open our own. */
   char path[BTC_PATH_MAX];
   uint8_t *data = NULL;
   uint8_t tmp[4];
@@ -1120,16 +6814,15 @@ btc_chaindb_read(btc_chaindb_t *db,
   int ret = 0;
   int fd;
 
-  if (id == file->id) {
-    fd = file->fd;
-  } else {
-    btc_chaindb_path(db, path, file->type, id);
+  if (id == active)
+    btc_blockwriter_drain(&reader->db->writer);
 
-    fd = btc_fs_open(path, READ_FLAGS, 0);
+  btc_chaindb_path(reader->db, path, type, id);
 
-    if (fd == -1)
-      return 0;
-  }
+  fd = btc_fs_open(path, READ_FLAGS, 0);
+
+  if (fd == -1)
+    return 0;
 
   if (!btc_fs_pread(fd, tmp, 4, pos + 16))
     goto fail;
@@ -1152,611 +6845,538 @@ fail:
   if (data != NULL)
     free(data);
 
-  if (fd != file->fd)
-    btc_fs_close(fd);
+  btc_fs_close(fd);
 
   return ret;
 }
 
-static btc_block_t *
-btc_chaindb_read_block(btc_chaindb_t *db, const btc_entry_t *entry) {
-  btc_block_t *block;
+int
+btc_chainreader_read(btc_chainreader_t *reader,
+                     btc_block_t **block,
+                     btc_undo_t **undo,
+                     const btc_entry_t *entry) {
+  btc_chaindb_t *db = reader->db;
+  int32_t block_file, block_pos;
+  int32_t undo_file, undo_pos;
+  int32_t block_id, undo_id;
   uint8_t *buf;
   size_t len;
 
-  if (entry->block_pos == -1)
-    return NULL;
-
-  if (!btc_chaindb_read(db, &buf, &len, &db->block, entry->block_file,
-                                                    entry->block_pos)) {
-    return NULL;
-  }
-
-  block = btc_block_decode(buf + 24, len - 24);
-
-  free(buf);
+  /* Positions may be rewritten by a reconnect. */
+  btc_rwlock_rdlock(db->state);
 
-  return block;
-}
+  block_file = entry->block_file;
+  block_pos = entry->block_pos;
+  undo_file = entry->undo_file;
+  undo_pos = entry->undo_pos;
+  block_id = db->block.id;
+  undo_id = db->undo.id;
 
-static btc_undo_t *
-btc_chaindb_read_undo(btc_chaindb_t *db, const btc_entry_t *entry) {
-  btc_undo_t *undo;
-  uint8_t *buf;
-  size_t len;
+  btc_rwlock_rdunlock(db->state);
 
-  if (entry->undo_pos == -1)
-    return btc_undo_create();
+  if (block_pos == -1)
+    return 0;
 
-  if (!btc_chaindb_read(db, &buf, &len, &db->undo, entry->undo_file,
-                                                   entry->undo_pos)) {
-    return NULL;
+  if (!btc_chainreader_record(reader, &buf, &len, 0, block_file,
+                                                  block_pos, block_id)) {
+    return 0;
   }
 
-  undo = btc_undo_decode(buf + 24, len - 24);
+  *block = btc_block_decode(buf + 24, len - 24);
 
   free(buf);
 
-  return undo;
-}
-
-static int
-should_sync(const btc_entry_t *entry) {
-  if (entry->header.time >= btc_now() - 24 * 60 * 60)
-    return 1;
+  if (*block == NULL)
+    return 0;
 
-  if ((entry->height % 20000) == 0)
+  /* Undo data is optional. */
+  if (undo == NULL)
     return 1;
 
-  return 0;
-}
-
-static int
-btc_chaindb_alloc(btc_chaindb_t *db, btc_chainfile_t *file, size_t len) {
-  uint8_t raw[BTC_CHAINFILE_SIZE];
-  uint8_t key[FILE_KEYLEN];
-  char path[BTC_PATH_MAX];
-  int fd;
-
-  if (file->pos + len <= MAX_FILE_SIZE)
+  if (undo_pos == -1) {
+    *undo = btc_undo_create();
     return 1;
+  }
 
-  file_key(key, file->type, file->id);
-
-  btc_chainfile_export(raw, file);
-
-  if (lsm_insert(db->lsm, key, sizeof(key), raw, sizeof(raw)) != 0)
+  if (!btc_chainreader_record(reader, &buf, &len, 1, undo_file,
+                                                  undo_pos, undo_id)) {
+    btc_block_destroy(*block);
     return 0;
+  }
 
-  btc_chaindb_path(db, path, file->type, file->id + 1);
+  *undo = undo_decode(buf, len, entry->height);
 
-  fd = btc_fs_open(path, WRITE_FLAGS, 0644);
+  free(buf);
 
-  if (fd == -1)
+  if (*undo == NULL) {
+    btc_block_destroy(*block);
     return 0;
-
-  btc_fs_fsync(file->fd);
-  btc_fs_close(file->fd);
-
-  btc_list_push(&db->files, btc_chainfile_clone(file),
-                            btc_chainfile_t);
-
-  file->fd = fd;
-  file->id++;
-  file->pos = 0;
-  file->items = 0;
-  file->min_time = -1;
-  file->max_time = -1;
-  file->min_height = -1;
-  file->max_height = -1;
+  }
 
   return 1;
 }
 
-static int
-btc_chaindb_write_block(btc_chaindb_t *db,
-                        btc_entry_t *entry,
-                        const btc_block_t *block) {
-  uint8_t raw[BTC_CHAINFILE_SIZE];
-  uint8_t hash[32];
-  size_t len;
-
-  len = btc_block_export(db->slab + 24, block);
-
-  btc_hash256(hash, db->slab + 24, len);
-
-  /* Store in network format. */
-  btc_uint32_write(db->slab +  0, db->network->magic);
-  btc_uint32_write(db->slab +  4, 0x636f6c62);
-  btc_uint32_write(db->slab +  8, 0x0000006b);
-  btc_uint32_write(db->slab + 12, 0x00000000);
-  btc_uint32_write(db->slab + 16, len);
-
-  btc_raw_write(db->slab + 20, hash, 4);
-
-  len += 24;
-
-  if (!btc_chaindb_alloc(db, &db->block, len))
-    return 0;
+/*
+ * Coin Scan
+ */
 
-  if (!btc_fs_write(db->block.fd, db->slab, len))
-    return 0;
+/* A coin scan walks the whole coin keyspace looking
+ * for outputs to a set of scripts. The keyspace is cut
+ * into ranges by the first two bytes of the txid and
+ * each range is walked by its own thread on its own
+ * cursor (and, natively, its own connection). All of
+ * the cursors are opened together under the state
+ * lock after a flush, so they share one view of the
+ * coins as of the tip, regardless of what the chain
+ * does while they run. Scripts are matched by a
+ * salted siphash first and compared in full only on
+ * a hit.
+ */
 
-  if (should_sync(entry))
-    btc_fs_fsync(db->block.fd);
+#define SCAN_PREFIXES 65536
+#define SCAN_INTERVAL 4096
+#define SCAN_MAX_RANGES 64
 
-  entry->block_file = db->block.id;
-  entry->block_pos = db->block.pos;
+typedef struct btc_coinrange_s {
+  btc_coinscan_t *scan;
+  btc_thread_t *thread;
+  lsm_db *lsm;
+  lsm_cursor *cur;
+  uint32_t start;
+  uint32_t end;
+  uint32_t pos;
+  uint64_t count;
+  btc_vector_t items;
+} btc_coinrange_t;
+
+struct btc_coinscan_s {
+  btc_chaindb_t *db;
+  btc_longmap_t *scripts;
+  uint8_t salt[16];
+  btc_coinrange_t *ranges;
+  int length;
+  btc_mutex_t *lock;
+  int running;
+  int finished;
+  int aborted;
+  uint8_t tip[32];
+  int32_t height;
+  uint64_t count;
+  btc_vector_t items;
+};
 
-  db->block.pos += len;
+btc_coinscan_t *
+btc_coinscan_create(btc_chaindb_t *db) {
+  btc_coinscan_t *scan = (btc_coinscan_t *)btc_malloc(sizeof(btc_coinscan_t));
 
-  btc_chainfile_update(&db->block, entry);
+  memset(scan, 0, sizeof(*scan));
 
-  btc_chainfile_export(raw, &db->block);
+  scan->db = db;
+  scan->scripts = btc_longmap_create();
+  scan->lock = btc_mutex_create();
+  scan->height = -1;
 
-  if (lsm_insert(db->lsm, blockfile_key, 1, raw, sizeof(raw)) != 0)
-    return 0;
+  btc_getrandom(scan->salt, 16);
+  btc_vector_init(&scan->items);
 
-  return 1;
+  return scan;
 }
 
-static int
-btc_chaindb_write_undo(btc_chaindb_t *db,
-                       btc_entry_t *entry,
-                       const btc_undo_t *undo) {
-  size_t len = btc_undo_size(undo);
-  uint8_t raw[BTC_CHAINFILE_SIZE];
-  uint8_t *buf = db->slab;
-  uint8_t hash[32];
-  int ret = 0;
-
-  if (len > BTC_MAX_RAW_BLOCK_SIZE)
-    buf = (uint8_t *)btc_malloc(24 + len);
+static void
+btc_scanitem_destroy(btc_scanitem_t *item) {
+  btc_coin_destroy(item->coin);
+  btc_free(item);
+}
 
-  len = btc_undo_export(buf + 24, undo);
+static void
+btc_coinscan_free(btc_coinscan_t *scan);
 
-  btc_hash256(hash, buf + 24, len);
+void
+btc_coinscan_destroy(btc_coinscan_t *scan) {
+  btc_longmapiter_t it;
+  size_t i;
 
-  btc_uint32_write(buf +  0, db->network->magic);
-  btc_uint32_write(buf +  4, 0x00000000);
-  btc_uint32_write(buf +  8, 0x00000000);
-  btc_uint32_write(buf + 12, 0x00000000);
-  btc_uint32_write(buf + 16, len);
+  if (scan->running) {
+    btc_coinscan_abort(scan);
+    btc_coinscan_wait(scan);
+  }
 
-  btc_raw_write(buf + 20, hash, 4);
+  btc_coinscan_free(scan);
 
-  len += 24;
+  btc_longmap_iterate(&it, scan->scripts);
 
-  if (!btc_chaindb_alloc(db, &db->undo, len))
-    goto fail;
+  while (btc_longmap_next(&it))
+    btc_script_destroy(it.val);
 
-  if (!btc_fs_write(db->undo.fd, buf, len))
-    goto fail;
+  for (i = 0; i < scan->items.length; i++)
+    btc_scanitem_destroy(scan->items.items[i]);
 
-  if (should_sync(entry))
-    btc_fs_fsync(db->undo.fd);
+  btc_longmap_destroy(scan->scripts);
+  btc_mutex_destroy(scan->lock);
+  btc_vector_clear(&scan->items);
+  btc_free(scan);
+}
 
-  entry->undo_file = db->undo.id;
-  entry->undo_pos = db->undo.pos;
+static uint64_t
+btc_coinscan_hash(const btc_coinscan_t *scan, const btc_script_t *script) {
+  return btc_siphash_sum(script->data, script->length, scan->salt);
+}
 
-  db->undo.pos += len;
+void
+btc_coinscan_add(btc_coinscan_t *scan, const btc_script_t *script) {
+  uint64_t id = btc_coinscan_hash(scan, script);
 
-  btc_chainfile_update(&db->undo, entry);
+  CHECK(scan->ranges == NULL);
 
-  btc_chainfile_export(raw, &db->undo);
+  if (!btc_longmap_has(scan->scripts, id))
+    btc_longmap_put(scan->scripts, id, btc_script_clone(script));
+}
 
-  if (lsm_insert(db->lsm, undofile_key, 1, raw, sizeof(raw)) != 0)
-    goto fail;
+static const btc_script_t *
+btc_coinscan_match(const btc_coinscan_t *scan, const btc_script_t *script) {
+  uint64_t id = btc_coinscan_hash(scan, script);
+  btc_script_t *item = btc_longmap_get(scan->scripts, id);
 
-  ret = 1;
-fail:
-  if (buf != db->slab)
-    btc_free(buf);
+  if (item == NULL || !btc_script_equal(item, script))
+    return NULL;
 
-  return ret;
+  return item;
 }
 
 static int
-btc_chaindb_prune_files(btc_chaindb_t *db, const btc_entry_t *entry) {
-  btc_chainfile_t *file, *next;
-  uint8_t key[FILE_KEYLEN];
-  char path[BTC_PATH_MAX];
-  int32_t target;
-
-  if (!(db->flags & BTC_CHAIN_PRUNE))
-    return 1;
-
-  if (entry->height < db->network->block.keep_blocks)
-    return 1;
-
-  target = entry->height - db->network->block.keep_blocks;
-
-  if (target <= db->network->block.prune_after_height)
-    return 1;
-
-  for (file = db->files.head; file != NULL; file = file->next) {
-    if (file->max_height >= target)
-      continue;
-
-    file_key(key, file->type, file->id);
+btc_coinrange_report(btc_coinrange_t *range, const uint8_t *kp) {
+  btc_coinscan_t *scan = range->scan;
+  int aborted;
 
-    if (lsm_delete(db->lsm, key, sizeof(key)) != 0)
-      return 0;
-  }
-
-  for (file = db->files.head; file != NULL; file = next) {
-    next = file->next;
-
-    if (file->max_height >= target)
-      continue;
+  btc_mutex_lock(scan->lock);
 
-    btc_chaindb_path(db, path, file->type, file->id);
+  if (kp != NULL)
+    range->pos = ((uint32_t)kp[1] << 8) | kp[2];
+  else
+    range->pos = range->end;
 
-    btc_fs_unlink(path);
+  scan->count += range->count;
+  range->count = 0;
 
-    btc_list_remove(&db->files, file, btc_chainfile_t);
+  aborted = scan->aborted;
 
-    btc_chainfile_destroy(file);
-  }
+  btc_mutex_unlock(scan->lock);
 
-  return 1;
+  return !aborted;
 }
 
 static int
-btc_chaindb_connect_block(btc_chaindb_t *db,
-                          btc_entry_t *entry,
-                          const btc_block_t *block,
-                          const btc_view_t *view) {
-  const btc_undo_t *undo;
-
-  (void)block;
-
-  /* Genesis block's coinbase is unspendable. */
-  if (entry->height == 0)
-    return 1;
-
-  /* Commit new coin state. */
-  if (!btc_chaindb_save_view(db, view))
-    return 0;
+scanitem_cmp(const void *xp, const void *yp) {
+  const btc_scanitem_t *x = *((const btc_scanitem_t **)xp);
+  const btc_scanitem_t *y = *((const btc_scanitem_t **)yp);
 
-  /* Write undo coins (if there are any). */
-  undo = btc_view_undo(view);
+  return prevout_cmp(&x->prevout, &y->prevout);
+}
 
-  if (undo->length != 0 && entry->undo_pos == -1) {
-    if (!btc_chaindb_write_undo(db, entry, undo))
-      return 0;
-  }
+static void
+btc_coinrange_loop(void *arg) {
+  btc_coinrange_t *range = (btc_coinrange_t *)arg;
+  btc_coinscan_t *scan = range->scan;
+  lsm_cursor *cur = range->cur;
+  btc_scanitem_t *item;
+  uint64_t total = 0;
+  btc_coiniter_t it;
+  btc_coin_t coin;
 
-  /* Prune height-288 if pruning is enabled. */
-  return btc_chaindb_prune_files(db, entry);
-}
+  btc_coin_init(&coin);
 
-static btc_view_t *
-btc_chaindb_disconnect_block(btc_chaindb_t *db,
-                             const btc_entry_t *entry,
-                             const btc_block_t *block) {
-  btc_undo_t *undo = btc_chaindb_read_undo(db, entry);
-  const btc_input_t *input;
-  const btc_tx_t *tx;
-  btc_coin_t *coin;
-  btc_view_t *view;
-  size_t i, j;
+  btc_coiniter_init(&it, scan->db, cur, range->start);
 
-  if (undo == NULL)
-    return NULL;
+  while (btc_coiniter_next(&it)) {
+    if ((((uint32_t)it.kp[1] << 8) | it.kp[2]) >= range->end)
+      break;
 
-  view = btc_view_create();
+    CHECK(btc_coin_import(&coin, it.cp, it.cn));
 
-  /* Disconnect all transactions. */
-  for (i = block->txs.length - 1; i != (size_t)-1; i--) {
-    tx = block->txs.items[i];
+    if (btc_coinscan_match(scan, &coin.output.script) != NULL) {
+      item = (btc_scanitem_t *)btc_malloc(sizeof(btc_scanitem_t));
 
-    if (i > 0) {
-      for (j = tx->inputs.length - 1; j != (size_t)-1; j--) {
-        input = tx->inputs.items[j];
-        coin = btc_undo_pop(undo);
+      btc_outpoint_set(&item->prevout, it.hash, it.index);
 
-        btc_view_put(view, &input->prevout, coin);
-      }
+      item->coin = btc_coin_clone(&coin);
+
+      btc_vector_push(&range->items, item);
     }
 
-    /* Remove any created coins. */
-    btc_view_add(view, tx, entry->height, 1);
+    range->count++;
+
+    if (++total % SCAN_INTERVAL == 0) {
+      if (!btc_coinrange_report(range, it.kp))
+        break;
+    }
   }
 
-  /* Undo coins should be empty. */
-  CHECK(undo->length == 0);
+  btc_coinrange_report(range, NULL);
 
-  btc_undo_destroy(undo);
+  btc_coin_clear(&coin);
 
-  /* Commit new coin state. */
-  if (!btc_chaindb_save_view(db, view)) {
-    btc_view_destroy(view);
-    return NULL;
-  }
+  btc_mutex_lock(scan->lock);
 
-  return view;
+  scan->finished++;
+
+  btc_mutex_unlock(scan->lock);
 }
 
-static int
-btc_chaindb_save_block(btc_chaindb_t *db,
-                       btc_entry_t *entry,
-                       const btc_block_t *block,
-                       const btc_view_t *view) {
-  /* Write actual block data. */
-  if (entry->block_pos == -1) {
-    if (!btc_chaindb_write_block(db, entry, block))
-      return 0;
+static void
+btc_coinscan_close(btc_coinscan_t *scan) {
+  btc_coinrange_t *range;
+  int i;
+
+  for (i = 0; i < scan->length; i++) {
+    range = &scan->ranges[i];
+
+    if (range->cur != NULL)
+      CHECK(lsm_csr_close(range->cur) == 0);
+
+#ifdef USE_NATIVE
+    if (range->lsm != NULL)
+      CHECK(lsm_close(range->lsm) == 0);
+#endif
+
+    range->cur = NULL;
+    range->lsm = NULL;
   }
+}
 
-  if (view == NULL)
-    return 1;
+static void
+btc_coinscan_free(btc_coinscan_t *scan) {
+  btc_coinrange_t *range;
+  size_t j;
+  int i;
 
-  return btc_chaindb_connect_block(db, entry, block, view);
+  if (scan->ranges == NULL)
+    return;
+
+  btc_coinscan_close(scan);
+
+  for (i = 0; i < scan->length; i++) {
+    range = &scan->ranges[i];
+
+    for (j = 0; j < range->items.length; j++)
+      btc_scanitem_destroy(range->items.items[j]);
+
+    btc_vector_clear(&range->items);
+  }
+
+  btc_free(scan->ranges);
+
+  scan->ranges = NULL;
+  scan->length = 0;
 }
 
 int
-btc_chaindb_save(btc_chaindb_t *db,
-                 btc_entry_t *entry,
-                 const btc_block_t *block,
-                 const btc_view_t *view) {
-  uint8_t raw[BTC_ENTRY_SIZE];
-  uint8_t key[ENTRY_KEYLEN];
+btc_coinscan_start(btc_coinscan_t *scan, int ranges) {
+  btc_chaindb_t *db = scan->db;
+  btc_coinrange_t *range;
+#ifdef USE_NATIVE
+  char path[BTC_PATH_MAX];
+#endif
+  int i, rc;
 
-  /* Sanity checks. */
-  CHECK(entry->prev != NULL || entry->height == 0);
-  CHECK(entry->next == NULL);
+  CHECK(scan->ranges == NULL);
 
-#ifdef USE_WORKER
-  /* Wait for worker. */
-  if (lsm_worker_wait(&db->worker, db->lsm) != 0)
-    return 0;
-#endif
+  if (ranges < 1)
+    ranges = 1;
 
-  /* Begin transaction. */
-  if (lsm_begin(db->lsm, 1) != 0)
-    return 0;
+  if (ranges > SCAN_MAX_RANGES)
+    ranges = SCAN_MAX_RANGES;
 
-  /* Connect block and save data. */
-  if (!btc_chaindb_save_block(db, entry, block, view))
-    goto fail;
+  scan->ranges = (btc_coinrange_t *)btc_malloc(ranges * sizeof(*range));
+  scan->length = ranges;
 
-  /* Write entry data. */
-  entry_key(key, entry->hash);
+  memset(scan->ranges, 0, ranges * sizeof(*range));
 
-  btc_entry_export(raw, entry);
+  for (i = 0; i < ranges; i++) {
+    range = &scan->ranges[i];
+    range->scan = scan;
+    range->start = ((uint32_t)i * SCAN_PREFIXES) / ranges;
+    range->end = ((uint32_t)(i + 1) * SCAN_PREFIXES) / ranges;
+    range->pos = range->start;
+    range->lsm = db->lsm;
 
-  if (lsm_insert(db->lsm, key, sizeof(key), raw, sizeof(raw)) != 0)
-    goto fail;
+    btc_vector_init(&range->items);
 
-  /* Clear old tip. */
-  if (entry->height != 0) {
-    tip_key(key, entry->header.prev_block);
+#ifdef USE_NATIVE
+    range->lsm = NULL;
 
-    if (lsm_delete(db->lsm, key, sizeof(key)) != 0)
+    if (!btc_path_join(path, sizeof(path), db->prefix, "chain.dat", 0))
       goto fail;
-  }
 
-  /* Write new tip. */
-  tip_key(key, entry->hash);
+    rc = lsm_connect(&range->lsm, path, &db->tune, 0,
+                     (db->flags & BTC_CHAIN_READONLY) != 0);
 
-  if (lsm_insert(db->lsm, key, sizeof(key), raw, 1) != 0)
+    if (rc != 0) {
+      fprintf(stderr, "lsm_connect: %s\n", lsm_strerror(rc));
+      range->lsm = NULL;
+      goto fail;
+    }
+#endif
+  }
+
+  /* Every unflushed coin must be on disk. */
+  if (!btc_chaindb_flush(db))
     goto fail;
 
-  /* Write state (main chain only). */
-  if (view != NULL) {
-    /* Commit new chain state. */
-    if (lsm_insert(db->lsm, meta_key, 1, entry->hash, 32) != 0)
+  btc_rwlock_wrlock(db->state);
+
+  for (i = 0; i < ranges; i++) {
+    range = &scan->ranges[i];
+    rc = lsm_csr_open(range->lsm, &range->cur);
+
+    if (rc != 0) {
+      fprintf(stderr, "lsm_csr_open: %s\n", lsm_strerror(rc));
+      range->cur = NULL;
+      btc_rwlock_wrunlock(db->state);
       goto fail;
+    }
   }
 
-  /* Commit transaction. */
-  if (lsm_commit(db->lsm, 0) != 0)
-    goto fail;
+  memcpy(scan->tip, db->tail->hash, 32);
 
-  /* Update hashes. */
-  CHECK(btc_hashmap_put(db->hashes, entry->hash, entry));
+  scan->height = db->tail->height;
 
-  /* Main-chain-only stuff. */
-  if (view != NULL) {
-    /* Set next pointer. */
-    if (entry->prev != NULL)
-      entry->prev->next = entry;
+  db->readers++;
 
-    /* Update heights. */
-    CHECK(db->heights.length == (size_t)entry->height);
-    btc_vector_push(&db->heights, entry);
+  btc_rwlock_wrunlock(db->state);
 
-    /* Update tip. */
-    if (entry->height == 0)
-      db->head = entry;
+  for (i = 0; i < ranges; i++) {
+    range = &scan->ranges[i];
+    range->thread = btc_thread_alloc();
 
-    db->tail = entry;
+    btc_thread_create(range->thread, btc_coinrange_loop, range);
   }
 
+  scan->running = 1;
+
   return 1;
 fail:
-  CHECK(lsm_rollback(db->lsm, 0) == 0);
+  btc_coinscan_free(scan);
   return 0;
 }
 
-int
-btc_chaindb_reconnect(btc_chaindb_t *db,
-                      btc_entry_t *entry,
-                      const btc_block_t *block,
-                      const btc_view_t *view) {
-  uint8_t raw[BTC_ENTRY_SIZE];
-  uint8_t key[ENTRY_KEYLEN];
-
-#ifdef USE_WORKER
-  /* Wait for worker. */
-  if (lsm_worker_wait(&db->worker, db->lsm) != 0)
-    return 0;
-#endif
-
-  /* Begin transaction. */
-  if (lsm_begin(db->lsm, 1) != 0)
-    return 0;
+void
+btc_coinscan_abort(btc_coinscan_t *scan) {
+  btc_mutex_lock(scan->lock);
 
-  /* Connect inputs. */
-  if (!btc_chaindb_connect_block(db, entry, block, view))
-    goto fail;
+  scan->aborted = 1;
 
-  /* Re-write entry data (we may have updated the undo pos). */
-  entry_key(key, entry->hash);
+  btc_mutex_unlock(scan->lock);
+}
 
-  btc_entry_export(raw, entry);
+int
+btc_coinscan_done(btc_coinscan_t *scan) {
+  int ret;
 
-  if (lsm_insert(db->lsm, key, sizeof(key), raw, sizeof(raw)) != 0)
-    goto fail;
+  btc_mutex_lock(scan->lock);
 
-  /* Commit new chain state. */
-  if (lsm_insert(db->lsm, meta_key, 1, entry->hash, 32) != 0)
-    goto fail;
+  ret = (scan->finished == scan->length);
 
-  /* Commit transaction. */
-  if (lsm_commit(db->lsm, 0) != 0)
-    goto fail;
+  btc_mutex_unlock(scan->lock);
 
-  /* Set next pointer. */
-  CHECK(entry->prev != NULL);
-  CHECK(entry->next == NULL);
-  entry->prev->next = entry;
+  return ret;
+}
 
-  /* Update heights. */
-  CHECK(db->heights.length == (size_t)entry->height);
-  btc_vector_push(&db->heights, entry);
+int
+btc_coinscan_wait(btc_coinscan_t *scan) {
+  btc_chaindb_t *db = scan->db;
+  btc_coinrange_t *range;
+  size_t j;
+  int i;
 
-  /* Update tip. */
-  db->tail = entry;
+  if (!scan->running)
+    return scan->ranges != NULL && !scan->aborted;
 
-  return 1;
-fail:
-  CHECK(lsm_rollback(db->lsm, 0) == 0);
-  return 0;
-}
+  for (i = 0; i < scan->length; i++) {
+    range = &scan->ranges[i];
 
-btc_view_t *
-btc_chaindb_disconnect(btc_chaindb_t *db,
-                       btc_entry_t *entry,
-                       const btc_block_t *block) {
-  btc_view_t *view;
+    btc_thread_join(range->thread);
+    btc_thread_free(range->thread);
 
-#ifdef USE_WORKER
-  /* Wait for worker. */
-  if (lsm_worker_wait(&db->worker, db->lsm) != 0)
-    return NULL;
-#endif
+    range->thread = NULL;
+  }
 
-  /* Begin transaction. */
-  if (lsm_begin(db->lsm, 1) != 0)
-    return NULL;
+  btc_coinscan_close(scan);
 
-  /* Disconnect inputs. */
-  view = btc_chaindb_disconnect_block(db, entry, block);
+  btc_rwlock_wrlock(db->state);
 
-  if (view == NULL)
-    goto fail;
+  CHECK(db->readers > 0);
 
-  /* Revert chain state to previous tip. */
-  if (lsm_insert(db->lsm, meta_key, 1, entry->header.prev_block, 32) != 0)
-    goto fail;
+  db->readers--;
 
-  /* Commit transaction. */
-  if (lsm_commit(db->lsm, 0) != 0)
-    goto fail;
+  btc_rwlock_wrunlock(db->state);
 
-  /* Set next pointer. */
-  CHECK(entry->prev != NULL);
-  CHECK(entry->next == NULL);
-  entry->prev->next = NULL;
+  /* Ranges are disjoint and in key order. */
+  for (i = 0; i < scan->length; i++) {
+    range = &scan->ranges[i];
 
-  /* Update heights. */
-  CHECK((btc_entry_t *)btc_vector_pop(&db->heights) == entry);
+    for (j = 0; j < range->items.length; j++)
+      btc_vector_push(&scan->items, range->items.items[j]);
 
-  /* Revert tip. */
-  db->tail = entry->prev;
+    btc_vector_clear(&range->items);
+  }
 
-  return view;
-fail:
-  if (view != NULL)
-    btc_view_destroy(view);
+  /* Groups are keyed by tag, not txid. */
+  if (db->grouped && scan->items.length > 1) {
+    qsort(scan->items.items, scan->items.length,
+          sizeof(btc_scanitem_t *), scanitem_cmp);
+  }
 
-  CHECK(lsm_rollback(db->lsm, 0) == 0);
+  scan->running = 0;
 
-  return NULL;
+  return !scan->aborted;
 }
 
-const btc_entry_t *
-btc_chaindb_head(btc_chaindb_t *db) {
-  return db->head;
-}
+double
+btc_coinscan_progress(btc_coinscan_t *scan) {
+  uint32_t total = 0;
+  int i;
 
-const btc_entry_t *
-btc_chaindb_tail(btc_chaindb_t *db) {
-  return db->tail;
-}
+  if (scan->ranges == NULL)
+    return 0.0;
 
-int32_t
-btc_chaindb_height(btc_chaindb_t *db) {
-  return db->tail->height;
-}
+  btc_mutex_lock(scan->lock);
 
-const btc_entry_t *
-btc_chaindb_by_hash(btc_chaindb_t *db, const uint8_t *hash) {
-  return btc_hashmap_get(db->hashes, hash);
-}
+  for (i = 0; i < scan->length; i++)
+    total += scan->ranges[i].pos - scan->ranges[i].start;
 
-const btc_entry_t *
-btc_chaindb_by_height(btc_chaindb_t *db, int32_t height) {
-  if ((size_t)height >= db->heights.length)
-    return NULL;
+  btc_mutex_unlock(scan->lock);
 
-  return (btc_entry_t *)db->heights.items[height];
+  return (double)total / SCAN_PREFIXES;
 }
 
-int
-btc_chaindb_is_main(btc_chaindb_t *db, const btc_entry_t *entry) {
-  if ((size_t)entry->height >= db->heights.length)
-    return 0;
+const uint8_t *
+btc_coinscan_tip(const btc_coinscan_t *scan, int32_t *height) {
+  if (height != NULL)
+    *height = scan->height;
 
-  return (btc_entry_t *)db->heights.items[entry->height] == entry;
+  return scan->tip;
 }
 
-int
-btc_chaindb_has_coins(btc_chaindb_t *db, const btc_tx_t *tx) {
-  uint8_t min[COIN_KEYLEN];
-  uint8_t max[COIN_KEYLEN];
-  lsm_cursor *cur;
-  int ret;
-
-  coin_key(min, tx->hash, 0);
-  coin_key(max, tx->hash, UINT32_MAX);
+uint64_t
+btc_coinscan_count(btc_coinscan_t *scan) {
+  uint64_t count;
 
-  CHECK(lsm_csr_open(db->lsm, &cur) == 0);
-  CHECK(lsm_csr_seek(cur, min, sizeof(min), LSM_SEEK_GE) == 0);
+  btc_mutex_lock(scan->lock);
 
-  ret = lsm_csr_le(cur, max, sizeof(max));
+  count = scan->count;
 
-  CHECK(lsm_csr_close(cur) == 0);
+  btc_mutex_unlock(scan->lock);
 
-  return ret;
+  return count;
 }
 
-btc_block_t *
-btc_chaindb_get_block(btc_chaindb_t *db, const btc_entry_t *entry) {
-  return btc_chaindb_read_block(db, entry);
+size_t
+btc_coinscan_length(const btc_coinscan_t *scan) {
+  return scan->items.length;
 }
 
-int
-btc_chaindb_get_raw_block(btc_chaindb_t *db,
-                          uint8_t **data,
-                          size_t *length,
-                          const btc_entry_t *entry) {
-  if (entry->block_pos == -1)
-    return 0;
-
-  return btc_chaindb_read(db, data, length, &db->block, entry->block_file,
-                                                        entry->block_pos);
-
+const btc_scanitem_t *
+btc_coinscan_item(const btc_coinscan_t *scan, size_t index) {
+  CHECK(index < scan->items.length);
+  return scan->items.items[index];
 }
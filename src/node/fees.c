@@ -0,0 +1,355 @@
+/*!
+ * fees.c - fee estimation for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <node/fees.h>
+
+#include <mako/block.h>
+#include <mako/map.h>
+#include <mako/policy.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+
+#include "../internal.h"
+
+/*
+ * Constants
+ */
+
+/* Feerate buckets, in sat/kvB, spaced geometrically. */
+#define MIN_BUCKET_RATE 1000.0
+#define MAX_BUCKET_RATE 10000000.0
+#define BUCKET_SPACING 1.05
+#define MAX_BUCKETS 200
+
+/* Per-block decay of every running average
+   (a half-life of roughly 350 blocks). */
+#define DECAY 0.998
+
+/* Confirmation ratio a feerate range must hit. */
+#define SUCCESS_PCT 0.85
+
+/* Decayed txs a range needs before we trust it. */
+#define SUFFICIENT_TXS (0.1 / (1.0 - DECAY))
+
+/*
+ * Tracked Transaction
+ */
+
+typedef struct btc_feetx_s {
+  uint8_t hash[32];
+  int32_t height;
+  int64_t rate;
+  int bucket;
+} btc_feetx_t;
+
+/*
+ * Fee Estimator
+ */
+
+struct btc_fees_s {
+  int32_t height; /* best seen height */
+  int length;
+  double bounds[MAX_BUCKETS]; /* upper feerate of each bucket */
+  double txs[MAX_BUCKETS]; /* confirmed txs */
+  double rates[MAX_BUCKETS]; /* sum of their feerates */
+  /* Txs confirmed within N+1 blocks. */
+  double confirmed[BTC_FEES_MAX_TARGET][MAX_BUCKETS];
+  /* Unconfirmed txs by entry height. */
+  int unconfirmed[BTC_FEES_MAX_TARGET][MAX_BUCKETS];
+  /* Unconfirmed for too long to have a slot. */
+  int stuck[MAX_BUCKETS];
+  btc_hashmap_t *map;
+};
+
+btc_fees_t *
+btc_fees_create(void) {
+  btc_fees_t *fees = (btc_fees_t *)btc_malloc(sizeof(btc_fees_t));
+  double rate;
+
+  memset(fees, 0, sizeof(*fees));
+
+  for (rate = MIN_BUCKET_RATE; rate < MAX_BUCKET_RATE; rate *= BUCKET_SPACING)
+    fees->bounds[fees->length++] = rate;
+
+  /* Everything above the top bucket. */
+  fees->bounds[fees->length++] = 1e99;
+
+  CHECK(fees->length <= MAX_BUCKETS);
+
+  fees->height = -1;
+  fees->map = btc_hashmap_create();
+
+  return fees;
+}
+
+void
+btc_fees_destroy(btc_fees_t *fees) {
+  btc_fees_reset(fees);
+  btc_hashmap_destroy(fees->map);
+  btc_free(fees);
+}
+
+void
+btc_fees_reset(btc_fees_t *fees) {
+  btc_hashmapiter_t iter;
+
+  btc_hashmap_iterate(&iter, fees->map);
+
+  while (btc_hashmap_next(&iter))
+    btc_free(iter.val);
+
+  btc_hashmap_reset(fees->map);
+
+  fees->height = -1;
+
+  memset(fees->txs, 0, sizeof(fees->txs));
+  memset(fees->rates, 0, sizeof(fees->rates));
+  memset(fees->confirmed, 0, sizeof(fees->confirmed));
+  memset(fees->unconfirmed, 0, sizeof(fees->unconfirmed));
+  memset(fees->stuck, 0, sizeof(fees->stuck));
+}
+
+static int
+btc_fees_bucket(const btc_fees_t *fees, int64_t rate) {
+  int lo = 0;
+  int hi = fees->length - 1;
+
+  /* First bucket whose bound covers the rate. */
+  while (lo < hi) {
+    int mid = (lo + hi) >> 1;
+
+    if (fees->bounds[mid] < (double)rate)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+void
+btc_fees_add_tx(btc_fees_t *fees,
+                const uint8_t *hash,
+                int32_t height,
+                int64_t rate) {
+  btc_feetx_t *tx;
+
+  /* Only txs seen arriving on top of our best block. */
+  if (height != fees->height)
+    return;
+
+  if (btc_hashmap_has(fees->map, hash))
+    return;
+
+  tx = (btc_feetx_t *)btc_malloc(sizeof(btc_feetx_t));
+
+  btc_hash_copy(tx->hash, hash);
+
+  tx->height = height;
+  tx->rate = rate;
+  tx->bucket = btc_fees_bucket(fees, rate);
+
+  fees->unconfirmed[height % BTC_FEES_MAX_TARGET][tx->bucket]++;
+
+  CHECK(btc_hashmap_put(fees->map, tx->hash, tx));
+}
+
+static void
+btc_fees_untrack(btc_fees_t *fees, const btc_feetx_t *tx) {
+  int32_t age = fees->height - tx->height;
+
+  if (age >= BTC_FEES_MAX_TARGET)
+    fees->stuck[tx->bucket]--;
+  else
+    fees->unconfirmed[tx->height % BTC_FEES_MAX_TARGET][tx->bucket]--;
+}
+
+int
+btc_fees_remove_tx(btc_fees_t *fees, const uint8_t *hash) {
+  btc_feetx_t *tx = btc_hashmap_get(fees->map, hash);
+
+  if (tx == NULL)
+    return 0;
+
+  btc_fees_untrack(fees, tx);
+
+  btc_hashmap_del(fees->map, hash);
+  btc_free(tx);
+
+  return 1;
+}
+
+static void
+btc_fees_confirm(btc_fees_t *fees, const btc_feetx_t *tx, int32_t height) {
+  int32_t blocks = height - tx->height;
+  int i;
+
+  if (blocks <= 0)
+    return;
+
+  /* Counts towards every target it would have met. */
+  for (i = blocks - 1; i < BTC_FEES_MAX_TARGET; i++)
+    fees->confirmed[i][tx->bucket] += 1;
+
+  fees->txs[tx->bucket] += 1;
+  fees->rates[tx->bucket] += (double)tx->rate;
+}
+
+void
+btc_fees_add_block(btc_fees_t *fees,
+                   int32_t height,
+                   const btc_block_t *block) {
+  int slot = height % BTC_FEES_MAX_TARGET;
+  btc_feetx_t *tx;
+  size_t i;
+  int b, t;
+
+  /* Reorgs and replays tell us nothing new. */
+  if (height <= fees->height)
+    return;
+
+  /* The oldest slot ages out into the stuck counts. */
+  for (b = 0; b < fees->length; b++) {
+    fees->stuck[b] += fees->unconfirmed[slot][b];
+    fees->unconfirmed[slot][b] = 0;
+  }
+
+  fees->height = height;
+
+  for (b = 0; b < fees->length; b++) {
+    fees->txs[b] *= DECAY;
+    fees->rates[b] *= DECAY;
+
+    for (t = 0; t < BTC_FEES_MAX_TARGET; t++)
+      fees->confirmed[t][b] *= DECAY;
+  }
+
+  for (i = 1; i < block->txs.length; i++) {
+    const uint8_t *hash = block->txs.items[i]->hash;
+
+    tx = btc_hashmap_get(fees->map, hash);
+
+    if (tx == NULL)
+      continue;
+
+    btc_fees_untrack(fees, tx);
+    btc_fees_confirm(fees, tx, height);
+
+    btc_hashmap_del(fees->map, hash);
+    btc_free(tx);
+  }
+}
+
+static double
+btc_fees_pending(const btc_fees_t *fees, int target, int bucket) {
+  double total = fees->stuck[bucket];
+  int32_t age;
+
+  /* Still unconfirmed after `target` blocks counts as a miss. */
+  for (age = target; age < BTC_FEES_MAX_TARGET; age++) {
+    int32_t height = fees->height - age;
+
+    if (height < 0)
+      break;
+
+    total += fees->unconfirmed[height % BTC_FEES_MAX_TARGET][bucket];
+  }
+
+  return total;
+}
+
+int64_t
+btc_fees_estimate(const btc_fees_t *fees, int target) {
+  double confirmed = 0, total = 0, pending = 0;
+  int start = fees->length - 1;
+  int best_lo = -1, best_hi = -1;
+  double half, count;
+  int b;
+
+  if (target < 1 || target > BTC_FEES_MAX_TARGET)
+    return -1;
+
+  /* Walk down from the highest feerates, grouping
+     buckets until a range has enough data, and keep
+     going for as long as each range succeeds. */
+  for (b = fees->length - 1; b >= 0; b--) {
+    confirmed += fees->confirmed[target - 1][b];
+    total += fees->txs[b];
+    pending += btc_fees_pending(fees, target, b);
+
+    if (total < SUFFICIENT_TXS)
+      continue;
+
+    if (confirmed / (total + pending) < SUCCESS_PCT)
+      break;
+
+    best_lo = b;
+    best_hi = start;
+
+    confirmed = 0;
+    total = 0;
+    pending = 0;
+    start = b - 1;
+  }
+
+  if (best_lo < 0)
+    return -1;
+
+  /* Median feerate of the cheapest passing range. */
+  half = 0;
+
+  for (b = best_lo; b <= best_hi; b++)
+    half += fees->txs[b];
+
+  half /= 2;
+  count = 0;
+
+  for (b = best_lo; b <= best_hi; b++) {
+    count += fees->txs[b];
+
+    if (count >= half && fees->txs[b] > 0)
+      break;
+  }
+
+  if (b > best_hi)
+    b = best_hi;
+
+  if (fees->txs[b] <= 0)
+    return -1;
+
+  return (int64_t)(fees->rates[b] / fees->txs[b] + 0.5);
+}
+
+int64_t
+btc_fees_estimate_smart(const btc_fees_t *fees, int target, int *blocks) {
+  int64_t rate = -1;
+
+  if (target < 1)
+    target = 1;
+
+  if (target > BTC_FEES_MAX_TARGET)
+    target = BTC_FEES_MAX_TARGET;
+
+  /* Fall back to longer targets until we have an answer. */
+  for (; target <= BTC_FEES_MAX_TARGET; target++) {
+    rate = btc_fees_estimate(fees, target);
+
+    if (rate >= 0)
+      break;
+  }
+
+  if (blocks != NULL)
+    *blocks = target > BTC_FEES_MAX_TARGET ? BTC_FEES_MAX_TARGET : target;
+
+  if (rate >= 0 && rate < BTC_MIN_RELAY)
+    rate = BTC_MIN_RELAY;
+
+  return rate;
+}
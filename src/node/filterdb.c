@@ -0,0 +1,467 @@
+/*!
+ * filterdb.c - block filter index for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <io/core.h>
+
+#include <node/chain.h>
+#include <node/filterdb.h>
+#include <node/indexer.h>
+#include <node/logger.h>
+
+#include <mako/bip158.h>
+#include <mako/block.h>
+#include <mako/buffer.h>
+#include <mako/coins.h>
+#include <mako/crypto/hash.h>
+#include <mako/entry.h>
+#include <mako/util.h>
+
+#include "../bio.h"
+#include "../impl.h"
+#include "../internal.h"
+
+/*
+ * Storage
+ *
+ * Basic filters (BIP158) are appended to a flat
+ * file, one record per main chain block:
+ *
+ *   [block hash] [filter hash] [filter header]
+ *   [u32 length] [filter]
+ *
+ * The file is only ever appended to or truncated,
+ * so a record's height is its position in the file.
+ * On open, records are replayed until one fails to
+ * link up with the main chain or with the previous
+ * filter header, and everything after it is thrown
+ * away and rebuilt from the stored blocks.
+ */
+
+#define BTC_FILTER_RECORD 100
+
+/*
+ * Types
+ */
+
+typedef struct btc_filterpos_s {
+  int64_t pos;
+  uint8_t header[32];
+} btc_filterpos_t;
+
+struct btc_filterdb_s {
+  btc_chain_t *chain;
+  btc_logger_t *logger;
+  btc_indexer_t *indexer;
+  char path[BTC_PATH_MAX];
+  int fd;
+  int64_t pos;
+  btc_filterpos_t *items;
+  size_t alloc;
+  size_t length;
+};
+
+/*
+ * Filter Index
+ */
+
+static int
+on_connect(const btc_entry_t *entry,
+           const btc_block_t *block,
+           const btc_undo_t *undo,
+           void *arg);
+
+static int
+on_disconnect(const btc_entry_t *entry,
+              const btc_block_t *block,
+              const btc_undo_t *undo,
+              void *arg);
+
+btc_filterdb_t *
+btc_filterdb_create(btc_chain_t *chain) {
+  btc_filterdb_t *db = btc_malloc(sizeof(btc_filterdb_t));
+
+  memset(db, 0, sizeof(*db));
+
+  db->chain = chain;
+  db->logger = NULL;
+  db->indexer = btc_indexer_create(chain, "filterdb");
+  db->fd = -1;
+  db->items = NULL;
+
+  btc_indexer_set_context(db->indexer, db);
+  btc_indexer_on_connect(db->indexer, on_connect);
+  btc_indexer_on_disconnect(db->indexer, on_disconnect);
+
+  return db;
+}
+
+void
+btc_filterdb_destroy(btc_filterdb_t *db) {
+  btc_indexer_destroy(db->indexer);
+
+  if (db->items != NULL)
+    btc_free(db->items);
+
+  btc_free(db);
+}
+
+void
+btc_filterdb_set_logger(btc_filterdb_t *db, btc_logger_t *logger) {
+  btc_indexer_set_logger(db->indexer, logger);
+  db->logger = logger;
+}
+
+static void
+btc_filterdb_log(btc_filterdb_t *db, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_write(db->logger, "filterdb", fmt, ap);
+  va_end(ap);
+}
+
+static void
+btc_filterdb_push(btc_filterdb_t *db, int64_t pos, const uint8_t *header) {
+  btc_filterpos_t *item;
+
+  if (db->length == db->alloc) {
+    db->alloc = db->alloc == 0 ? 1024 : db->alloc * 2;
+    db->items = btc_realloc(db->items, db->alloc * sizeof(btc_filterpos_t));
+  }
+
+  item = &db->items[db->length++];
+  item->pos = pos;
+
+  memcpy(item->header, header, 32);
+}
+
+static int
+btc_filterdb_append(btc_filterdb_t *db,
+                    const btc_entry_t *entry,
+                    const btc_block_t *block,
+                    const btc_undo_t *undo) {
+  static const uint8_t zero[32] = {0};
+  const uint8_t *prev = zero;
+  uint8_t raw[BTC_FILTER_RECORD];
+  uint8_t header[32];
+  uint8_t hash[32];
+  btc_buffer_t filter;
+  uint8_t *zp = raw;
+  int ret = 0;
+
+  CHECK((size_t)entry->height == db->length);
+
+  if (db->length > 0)
+    prev = db->items[db->length - 1].header;
+
+  btc_buffer_init(&filter);
+  btc_gcs_build(&filter, block, undo);
+
+  btc_hash256(hash, filter.data, filter.length);
+  btc_gcs_header(header, hash, prev);
+
+  zp = btc_raw_write(zp, entry->hash, 32);
+  zp = btc_raw_write(zp, hash, 32);
+  zp = btc_raw_write(zp, header, 32);
+  zp = btc_uint32_write(zp, filter.length);
+
+  if (!btc_fs_pwrite(db->fd, raw, sizeof(raw), db->pos))
+    goto fail;
+
+  if (!btc_fs_pwrite(db->fd, filter.data, filter.length,
+                     db->pos + BTC_FILTER_RECORD)) {
+    goto fail;
+  }
+
+  btc_filterdb_push(db, db->pos, header);
+
+  db->pos += BTC_FILTER_RECORD + filter.length;
+
+  ret = 1;
+fail:
+  btc_buffer_clear(&filter);
+  return ret;
+}
+
+static int
+btc_filterdb_truncate(btc_filterdb_t *db, size_t length) {
+  if (length >= db->length)
+    return 1;
+
+  db->pos = db->items[length].pos;
+  db->length = length;
+
+  return btc_fs_ftruncate(db->fd, db->pos);
+}
+
+static int
+on_connect(const btc_entry_t *entry,
+           const btc_block_t *block,
+           const btc_undo_t *undo,
+           void *arg) {
+  return btc_filterdb_append((btc_filterdb_t *)arg, entry, block, undo);
+}
+
+static int
+on_disconnect(const btc_entry_t *entry,
+              const btc_block_t *block,
+              const btc_undo_t *undo,
+              void *arg) {
+  (void)block;
+  (void)undo;
+  return btc_filterdb_truncate((btc_filterdb_t *)arg, entry->height);
+}
+
+static int
+btc_filterdb_load(btc_filterdb_t *db) {
+  static const uint8_t zero[32] = {0};
+  const uint8_t *prev = zero;
+  uint8_t raw[BTC_FILTER_RECORD];
+  const btc_entry_t *entry;
+  uint8_t header[32];
+  btc_stat_t st;
+  int64_t pos = 0;
+  uint32_t len;
+
+  if (!btc_fs_fstat(db->fd, &st))
+    return 0;
+
+  /* Only the record headers are read here. */
+  while (pos + BTC_FILTER_RECORD <= (int64_t)st.st_size) {
+    if (!btc_fs_pread(db->fd, raw, sizeof(raw), pos))
+      return 0;
+
+    len = btc_read32le(raw + 96);
+
+    if (pos + BTC_FILTER_RECORD + len > (int64_t)st.st_size)
+      break;
+
+    entry = btc_chain_by_height(db->chain, db->length);
+
+    if (entry == NULL || memcmp(raw, entry->hash, 32) != 0)
+      break;
+
+    btc_gcs_header(header, raw + 32, prev);
+
+    if (memcmp(header, raw + 64, 32) != 0)
+      break;
+
+    btc_filterdb_push(db, pos, header);
+
+    prev = db->items[db->length - 1].header;
+    pos += BTC_FILTER_RECORD + len;
+  }
+
+  db->pos = pos;
+
+  /* The last write may have been torn. */
+  if (db->length > 0) {
+    btc_filterpos_t *item = &db->items[db->length - 1];
+    btc_buffer_t filter;
+    uint8_t hash[32];
+    int ok;
+
+    btc_buffer_init(&filter);
+
+    ok = btc_fs_pread(db->fd, raw, sizeof(raw), item->pos);
+
+    if (ok) {
+      len = btc_read32le(raw + 96);
+
+      btc_buffer_resize(&filter, len);
+
+      ok = btc_fs_pread(db->fd, filter.data, len,
+                        item->pos + BTC_FILTER_RECORD);
+    }
+
+    if (ok) {
+      btc_hash256(hash, filter.data, filter.length);
+      ok = (memcmp(hash, raw + 32, 32) == 0);
+    }
+
+    btc_buffer_clear(&filter);
+
+    if (!ok) {
+      db->pos = item->pos;
+      db->length--;
+    }
+  }
+
+  return btc_fs_ftruncate(db->fd, db->pos);
+}
+
+int
+btc_filterdb_open(btc_filterdb_t *db, const char *prefix, unsigned int flags) {
+  const btc_entry_t *tip = NULL;
+
+  if (!(flags & BTC_FILTER_INDEX))
+    return 1;
+
+  btc_filterdb_log(db, "Opening filter index.");
+
+  /* Pruned nodes may be missing the blocks and
+     undo coins needed to build older filters. */
+  if (flags & BTC_CHAIN_PRUNE) {
+    btc_filterdb_log(db, "Filter index is incompatible with pruning.");
+    return 0;
+  }
+
+  if (!btc_path_join(db->path, sizeof(db->path), prefix, "filters.dat", 0))
+    return 0;
+
+  db->fd = btc_fs_open(db->path, BTC_O_RDWR | BTC_O_CREAT, 0644);
+
+  if (db->fd == -1) {
+    btc_filterdb_log(db, "Could not open %s.", db->path);
+    return 0;
+  }
+
+  if (!btc_filterdb_load(db)) {
+    btc_filterdb_log(db, "Could not read %s.", db->path);
+    btc_fs_close(db->fd);
+    db->fd = -1;
+    db->length = 0;
+    return 0;
+  }
+
+  btc_filterdb_log(db, "Loaded filters to height %d.",
+                       (int32_t)db->length - 1);
+
+  if (db->length > 0)
+    tip = btc_chain_by_height(db->chain, db->length - 1);
+
+  if (!btc_indexer_start(db->indexer, tip)) {
+    btc_filterdb_log(db, "Could not start filter index.");
+    btc_fs_close(db->fd);
+    db->fd = -1;
+    db->length = 0;
+    return 0;
+  }
+
+  return 1;
+}
+
+void
+btc_filterdb_close(btc_filterdb_t *db) {
+  if (db->fd == -1)
+    return;
+
+  btc_filterdb_log(db, "Closing filter index.");
+
+  btc_indexer_stop(db->indexer);
+
+  btc_fs_fsync(db->fd);
+  btc_fs_close(db->fd);
+
+  db->fd = -1;
+  db->length = 0;
+  db->pos = 0;
+}
+
+void
+btc_filterdb_connect(btc_filterdb_t *db,
+                     const btc_entry_t *entry,
+                     const btc_block_t *block,
+                     const btc_view_t *view) {
+  btc_indexer_connect(db->indexer, entry, block, view);
+}
+
+void
+btc_filterdb_disconnect(btc_filterdb_t *db,
+                        const btc_entry_t *entry,
+                        const btc_block_t *block) {
+  btc_indexer_disconnect(db->indexer, entry, block);
+}
+
+int
+btc_filterdb_enabled(btc_filterdb_t *db) {
+  return db->fd != -1;
+}
+
+int32_t
+btc_filterdb_height(btc_filterdb_t *db) {
+  if (db->fd == -1)
+    return -1;
+
+  return btc_indexer_height(db->indexer);
+}
+
+static int
+btc_filterdb_lookup(btc_filterdb_t *db,
+                    btc_filterpos_t *item,
+                    const btc_entry_t *entry) {
+  int ret = 0;
+
+  if (!btc_chain_is_main(db->chain, entry))
+    return 0;
+
+  /* Records above the fork point may be stale. */
+  if (entry->height > btc_filterdb_height(db))
+    return 0;
+
+  btc_indexer_lock(db->indexer);
+
+  if ((size_t)entry->height < db->length) {
+    *item = db->items[entry->height];
+    ret = 1;
+  }
+
+  btc_indexer_unlock(db->indexer);
+
+  return ret;
+}
+
+int
+btc_filterdb_get_filter(btc_filterdb_t *db,
+                        btc_buffer_t *filter,
+                        const btc_entry_t *entry) {
+  btc_filterpos_t item;
+  uint8_t raw[4];
+  uint32_t len;
+
+  if (!btc_filterdb_lookup(db, &item, entry))
+    return 0;
+
+  if (!btc_fs_pread(db->fd, raw, 4, item.pos + 96))
+    return 0;
+
+  len = btc_read32le(raw);
+
+  btc_buffer_resize(filter, len);
+
+  return btc_fs_pread(db->fd, filter->data, len,
+                      item.pos + BTC_FILTER_RECORD);
+}
+
+int
+btc_filterdb_get_hash(btc_filterdb_t *db,
+                      uint8_t *hash,
+                      const btc_entry_t *entry) {
+  btc_filterpos_t item;
+
+  if (!btc_filterdb_lookup(db, &item, entry))
+    return 0;
+
+  return btc_fs_pread(db->fd, hash, 32, item.pos + 32);
+}
+
+int
+btc_filterdb_get_header(btc_filterdb_t *db,
+                        uint8_t *header,
+                        const btc_entry_t *entry) {
+  btc_filterpos_t item;
+
+  if (!btc_filterdb_lookup(db, &item, entry))
+    return 0;
+
+  memcpy(header, item.header, 32);
+
+  return 1;
+}
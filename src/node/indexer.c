@@ -0,0 +1,384 @@
+/*!
+ * indexer.c - background index builder for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <io/core.h>
+
+#include <node/chain.h>
+#include <node/chaindb.h>
+#include <node/indexer.h>
+#include <node/logger.h>
+
+#include <mako/block.h>
+#include <mako/coins.h>
+#include <mako/entry.h>
+
+#include "../internal.h"
+
+/*
+ * Indexer
+ *
+ * Drives an index from its own best block up to
+ * the chain tip. Catching up happens on a thread
+ * of its own, which reads blocks and undo coins
+ * through a chain reader so that `btc_chain_add`
+ * never waits on it. Once the index reaches the
+ * tip, the thread exits and the chain's connect
+ * and disconnect events keep it current.
+ *
+ * Both sides apply blocks under the indexer lock
+ * and only ever extend the current tip, so neither
+ * can apply a block twice: whichever is second
+ * sees that the tip has moved and backs off. If
+ * the tip ends up off the main chain (a reorg ran
+ * while the thread was behind, or we crashed
+ * mid-reorg), the thread rewinds it block by block
+ * before going forward again.
+ *
+ * Callbacks run with the lock held. The lock must
+ * also be held when the index is read from another
+ * thread.
+ */
+
+struct btc_indexer_s {
+  btc_chain_t *chain;
+  btc_logger_t *logger;
+  const char *name;
+  btc_indexer_cb *on_connect;
+  btc_indexer_cb *on_disconnect;
+  void *arg;
+  btc_chainreader_t *reader;
+  btc_thread_t *thread;
+  btc_mutex_t *lock;
+  const btc_entry_t *tip;
+  int open;
+  int running;
+  int syncing;
+  int stop;
+};
+
+btc_indexer_t *
+btc_indexer_create(btc_chain_t *chain, const char *name) {
+  btc_indexer_t *idx = btc_malloc(sizeof(btc_indexer_t));
+
+  memset(idx, 0, sizeof(*idx));
+
+  idx->chain = chain;
+  idx->logger = NULL;
+  idx->name = name;
+  idx->arg = NULL;
+  idx->reader = NULL;
+  idx->thread = btc_thread_alloc();
+  idx->lock = btc_mutex_create();
+  idx->tip = NULL;
+
+  return idx;
+}
+
+void
+btc_indexer_destroy(btc_indexer_t *idx) {
+  CHECK(!idx->open);
+
+  btc_thread_free(idx->thread);
+  btc_mutex_destroy(idx->lock);
+  btc_free(idx);
+}
+
+void
+btc_indexer_set_logger(btc_indexer_t *idx, btc_logger_t *logger) {
+  idx->logger = logger;
+}
+
+void
+btc_indexer_on_connect(btc_indexer_t *idx, btc_indexer_cb *handler) {
+  idx->on_connect = handler;
+}
+
+void
+btc_indexer_on_disconnect(btc_indexer_t *idx, btc_indexer_cb *handler) {
+  idx->on_disconnect = handler;
+}
+
+void
+btc_indexer_set_context(btc_indexer_t *idx, void *arg) {
+  idx->arg = arg;
+}
+
+static void
+btc_indexer_log(btc_indexer_t *idx, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_write(idx->logger, idx->name, fmt, ap);
+  va_end(ap);
+}
+
+static int
+btc_indexer_step(btc_indexer_t *idx, const btc_entry_t *tip) {
+  /* Returns 1 to keep going, 0 once caught up and -1 on error. */
+  btc_chainreader_t *reader = idx->reader;
+  const btc_entry_t *entry;
+  btc_block_t *block;
+  btc_undo_t *undo;
+  int rewind = 0;
+  int ret = 1;
+
+  if (tip != NULL && !btc_chainreader_is_main(reader, tip)) {
+    entry = tip;
+    rewind = 1;
+  } else {
+    entry = btc_chainreader_by_height(reader, tip ? tip->height + 1 : 0);
+  }
+
+  if (entry == NULL) {
+    /* The hooks take over from here, unless
+       they moved the tip in the meantime. */
+    btc_mutex_lock(idx->lock);
+
+    if (idx->tip == tip) {
+      idx->syncing = 0;
+      ret = 0;
+    }
+
+    btc_mutex_unlock(idx->lock);
+
+    if (ret == 0 && tip != NULL)
+      btc_indexer_log(idx, "Index synced at height %d.", tip->height);
+
+    return ret;
+  }
+
+  if (!btc_chainreader_read(reader, &block, &undo, entry)) {
+    btc_indexer_log(idx, "Could not read block %H (%d).",
+                         entry->hash, entry->height);
+    return -1;
+  }
+
+  btc_mutex_lock(idx->lock);
+
+  if (rewind) {
+    if (idx->tip == entry) {
+      btc_indexer_log(idx, "Rewinding block %H (%d).",
+                           entry->hash, entry->height);
+
+      if (idx->on_disconnect(entry, block, undo, idx->arg))
+        idx->tip = entry->prev;
+      else
+        ret = -1;
+    }
+  } else {
+    if (entry->prev == idx->tip) {
+      if (idx->on_connect(entry, block, undo, idx->arg))
+        idx->tip = entry;
+      else
+        ret = -1;
+    }
+  }
+
+  btc_mutex_unlock(idx->lock);
+
+  if (ret < 0) {
+    btc_indexer_log(idx, "Could not index block %H (%d).",
+                         entry->hash, entry->height);
+  } else if (!rewind && (entry->height % 10000) == 0) {
+    btc_indexer_log(idx, "Indexed to height %d.", entry->height);
+  }
+
+  btc_undo_destroy(undo);
+  btc_block_destroy(block);
+
+  return ret;
+}
+
+static void
+btc_indexer_loop(void *arg) {
+  btc_indexer_t *idx = (btc_indexer_t *)arg;
+  const btc_entry_t *tip;
+  int rc;
+
+  for (;;) {
+    btc_mutex_lock(idx->lock);
+
+    if (idx->stop) {
+      btc_mutex_unlock(idx->lock);
+      break;
+    }
+
+    tip = idx->tip;
+
+    btc_mutex_unlock(idx->lock);
+
+    rc = btc_indexer_step(idx, tip);
+
+    if (rc <= 0)
+      break;
+  }
+
+  btc_mutex_lock(idx->lock);
+
+  idx->syncing = 0;
+
+  btc_mutex_unlock(idx->lock);
+}
+
+int
+btc_indexer_start(btc_indexer_t *idx, const btc_entry_t *tip) {
+  CHECK(!idx->open);
+  CHECK(idx->on_connect != NULL);
+  CHECK(idx->on_disconnect != NULL);
+
+  idx->tip = tip;
+  idx->open = 1;
+  idx->stop = 0;
+
+  if (tip != NULL && tip == btc_chain_tip(idx->chain))
+    return 1;
+
+  idx->reader = btc_chain_reader(idx->chain);
+
+  if (idx->reader == NULL) {
+    idx->open = 0;
+    return 0;
+  }
+
+  idx->running = 1;
+  idx->syncing = 1;
+
+  btc_thread_create(idx->thread, btc_indexer_loop, idx);
+
+  return 1;
+}
+
+void
+btc_indexer_stop(btc_indexer_t *idx) {
+  if (!idx->open)
+    return;
+
+  if (idx->running) {
+    btc_mutex_lock(idx->lock);
+
+    idx->stop = 1;
+
+    btc_mutex_unlock(idx->lock);
+
+    btc_thread_join(idx->thread);
+
+    idx->running = 0;
+  }
+
+  if (idx->reader != NULL) {
+    btc_chainreader_destroy(idx->reader);
+    idx->reader = NULL;
+  }
+
+  idx->tip = NULL;
+  idx->open = 0;
+  idx->syncing = 0;
+}
+
+void
+btc_indexer_connect(btc_indexer_t *idx,
+                    const btc_entry_t *entry,
+                    const btc_block_t *block,
+                    const btc_view_t *view) {
+  if (!idx->open)
+    return;
+
+  btc_mutex_lock(idx->lock);
+
+  /* Still catching up; the thread will get to it. */
+  if (entry->prev == idx->tip) {
+    if (idx->on_connect(entry, block, btc_view_undo(view), idx->arg)) {
+      idx->tip = entry;
+    } else {
+      btc_indexer_log(idx, "Could not index block %H (%d).",
+                           entry->hash, entry->height);
+    }
+  }
+
+  btc_mutex_unlock(idx->lock);
+}
+
+void
+btc_indexer_disconnect(btc_indexer_t *idx,
+                       const btc_entry_t *entry,
+                       const btc_block_t *block) {
+  btc_undo_t *undo;
+
+  if (!idx->open)
+    return;
+
+  btc_mutex_lock(idx->lock);
+
+  /* Not indexed yet. */
+  if (entry != idx->tip) {
+    btc_mutex_unlock(idx->lock);
+    return;
+  }
+
+  undo = btc_chain_get_undo(idx->chain, entry);
+
+  if (undo != NULL && idx->on_disconnect(entry, block, undo, idx->arg)) {
+    idx->tip = entry->prev;
+  } else {
+    btc_indexer_log(idx, "Could not unindex block %H (%d).",
+                         entry->hash, entry->height);
+  }
+
+  if (undo != NULL)
+    btc_undo_destroy(undo);
+
+  btc_mutex_unlock(idx->lock);
+}
+
+void
+btc_indexer_lock(btc_indexer_t *idx) {
+  btc_mutex_lock(idx->lock);
+}
+
+void
+btc_indexer_unlock(btc_indexer_t *idx) {
+  btc_mutex_unlock(idx->lock);
+}
+
+const btc_entry_t *
+btc_indexer_tip(btc_indexer_t *idx) {
+  return idx->tip;
+}
+
+int32_t
+btc_indexer_height(btc_indexer_t *idx) {
+  /* Only what is still on the main chain counts:
+     a stale tip may be rewound at any moment. */
+  const btc_entry_t *entry;
+
+  btc_mutex_lock(idx->lock);
+
+  entry = idx->tip;
+
+  while (entry != NULL && !btc_chain_is_main(idx->chain, entry))
+    entry = entry->prev;
+
+  btc_mutex_unlock(idx->lock);
+
+  return entry != NULL ? entry->height : -1;
+}
+
+int
+btc_indexer_syncing(btc_indexer_t *idx) {
+  int ret;
+
+  btc_mutex_lock(idx->lock);
+
+  ret = idx->syncing;
+
+  btc_mutex_unlock(idx->lock);
+
+  return ret;
+}
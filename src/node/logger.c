@@ -5,12 +5,23 @@
  */
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
 #include <node/logger.h>
 #include <mako/printf.h>
 #include "../internal.h"
 
+/*
+ * Constants
+ */
+
+#define LOGGER_RING (1 << 20)
+#define LOGGER_RATE (1 << 20)
+#define LOGGER_SUBSYSTEMS 16
+
 /*
  * Types
  */
@@ -18,6 +29,20 @@
 struct btc_logger_s {
   FILE *stream;
   int silent;
+  int level;
+  int debug_all;
+  char debug[LOGGER_SUBSYSTEMS][16];
+  size_t debug_len;
+  btc_mutex_t *lock;
+  btc_cond_t *cond;
+  btc_thread_t *thread;
+  char *ring;
+  uint64_t head;
+  uint64_t tail;
+  int64_t window;
+  size_t budget;
+  uint64_t dropped;
+  int running;
 };
 
 /*
@@ -28,14 +53,24 @@ btc_logger_t *
 btc_logger_create(void) {
   btc_logger_t *logger = (btc_logger_t *)btc_malloc(sizeof(btc_logger_t));
 
+  memset(logger, 0, sizeof(*logger));
+
   logger->stream = NULL;
   logger->silent = 0;
+  logger->level = BTC_LOG_INFO;
+  logger->lock = btc_mutex_create();
+  logger->cond = btc_cond_create();
+  logger->thread = NULL;
+  logger->ring = NULL;
+  logger->running = 0;
 
   return logger;
 }
 
 void
 btc_logger_destroy(btc_logger_t *logger) {
+  btc_mutex_destroy(logger->lock);
+  btc_cond_destroy(logger->cond);
   btc_free(logger);
 }
 
@@ -44,6 +79,217 @@ btc_logger_set_silent(btc_logger_t *logger, int silent) {
   logger->silent = silent;
 }
 
+void
+btc_logger_set_level(btc_logger_t *logger, enum btc_log_level level) {
+  logger->level = level;
+}
+
+void
+btc_logger_set_debug(btc_logger_t *logger, const char *names) {
+  /* A comma-separated list of subsystems (the
+     `[prefix]` of each line) to log at debug
+     level regardless of the global level. */
+  logger->debug_all = 0;
+  logger->debug_len = 0;
+
+  while (*names) {
+    const char *end = strchr(names, ',');
+    size_t len;
+
+    if (end == NULL)
+      end = names + strlen(names);
+
+    len = end - names;
+
+    if (len == 1 && names[0] == '1') {
+      logger->debug_all = 1;
+    } else if (len == 3 && memcmp(names, "all", 3) == 0) {
+      logger->debug_all = 1;
+    } else if (len > 0 && len < 16 && logger->debug_len < LOGGER_SUBSYSTEMS) {
+      memcpy(logger->debug[logger->debug_len], names, len);
+      logger->debug[logger->debug_len++][len] = '\0';
+    }
+
+    names = *end ? end + 1 : end;
+  }
+}
+
+int
+btc_logger_enabled(const btc_logger_t *logger,
+                   enum btc_log_level level,
+                   const char *pre) {
+  size_t i;
+
+  if (logger == NULL)
+    return level <= BTC_LOG_INFO;
+
+  if (logger->silent && logger->stream == NULL)
+    return 0;
+
+  if ((int)level <= logger->level)
+    return 1;
+
+  if (level != BTC_LOG_DEBUG || pre == NULL)
+    return 0;
+
+  if (logger->debug_all)
+    return 1;
+
+  for (i = 0; i < logger->debug_len; i++) {
+    if (strcmp(logger->debug[i], pre) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Flusher
+ */
+
+/* Once the log file is open, lines are formatted
+ * on the calling thread and copied into a ring
+ * buffer; a background thread does the actual
+ * writes. Callers never block on I/O: if the ring
+ * is full or a subsystem floods past the per-second
+ * byte budget, the line is dropped and counted,
+ * and the flusher reports the count. Errors and
+ * warnings skip the budget but not the ring.
+ */
+
+static void
+logger_output(btc_logger_t *logger, const char *data, size_t len) {
+  if (len == 0)
+    return;
+
+  if (!logger->silent)
+    fwrite(data, 1, len, stdout);
+
+  if (logger->stream != NULL)
+    fwrite(data, 1, len, logger->stream);
+}
+
+static void
+logger_flusher(void *arg) {
+  btc_logger_t *logger = (btc_logger_t *)arg;
+  uint64_t head, tail, dropped;
+  size_t start, len, rem;
+  char tmp[64];
+  int running;
+
+  btc_mutex_lock(logger->lock);
+
+  for (;;) {
+    while (logger->head == logger->tail
+           && logger->dropped == 0
+           && logger->running) {
+      btc_cond_wait(logger->cond, logger->lock);
+    }
+
+    head = logger->head;
+    tail = logger->tail;
+    dropped = logger->dropped;
+    running = logger->running;
+
+    logger->dropped = 0;
+
+    btc_mutex_unlock(logger->lock);
+
+    /* Producers only ever write past `head`, and
+       won't reuse [tail, head) until we advance
+       `tail` below, so this runs unlocked. */
+    start = tail % LOGGER_RING;
+    len = head - tail;
+    rem = LOGGER_RING - start;
+
+    if (len > rem) {
+      logger_output(logger, logger->ring + start, rem);
+      logger_output(logger, logger->ring, len - rem);
+    } else {
+      logger_output(logger, logger->ring + start, len);
+    }
+
+    if (dropped > 0) {
+      len = btc_snprintf(tmp, sizeof(tmp),
+                         "[logger] Dropped %llu messages.\n",
+                         (unsigned long long)dropped);
+
+      logger_output(logger, tmp, len);
+    }
+
+    if (logger->stream != NULL)
+      fflush(logger->stream);
+
+    btc_mutex_lock(logger->lock);
+
+    logger->tail = head;
+
+    if (!running && logger->head == logger->tail)
+      break;
+  }
+
+  btc_mutex_unlock(logger->lock);
+}
+
+static void
+logger_push(btc_logger_t *logger,
+            enum btc_log_level level,
+            const char *data,
+            size_t len) {
+  size_t start, rem;
+  int64_t now;
+  int wake;
+
+  btc_mutex_lock(logger->lock);
+
+  if (level > BTC_LOG_WARNING) {
+    now = btc_time_msec() / 1000;
+
+    if (now != logger->window) {
+      logger->window = now;
+      logger->budget = LOGGER_RATE;
+    }
+
+    if (len > logger->budget) {
+      logger->dropped++;
+      btc_mutex_unlock(logger->lock);
+      return;
+    }
+
+    logger->budget -= len;
+  }
+
+  if (len > LOGGER_RING - (size_t)(logger->head - logger->tail)) {
+    logger->dropped++;
+    btc_mutex_unlock(logger->lock);
+    return;
+  }
+
+  start = logger->head % LOGGER_RING;
+  rem = LOGGER_RING - start;
+
+  if (len > rem) {
+    memcpy(logger->ring + start, data, rem);
+    memcpy(logger->ring, data + rem, len - rem);
+  } else {
+    memcpy(logger->ring + start, data, len);
+  }
+
+  /* The flusher only sleeps on an empty ring. */
+  wake = (logger->head == logger->tail);
+
+  logger->head += len;
+
+  btc_mutex_unlock(logger->lock);
+
+  if (wake)
+    btc_cond_signal(logger->cond);
+}
+
+/*
+ * Logger
+ */
+
 int
 btc_logger_open(btc_logger_t *logger, const char *file) {
   FILE *stream = fopen(file, "a");
@@ -52,55 +298,94 @@ btc_logger_open(btc_logger_t *logger, const char *file) {
     return 0;
 
   logger->stream = stream;
+  logger->ring = (char *)btc_malloc(LOGGER_RING);
+  logger->head = 0;
+  logger->tail = 0;
+  logger->window = 0;
+  logger->budget = 0;
+  logger->dropped = 0;
+  logger->running = 1;
+  logger->thread = btc_thread_alloc();
+
+  btc_thread_create(logger->thread, logger_flusher, logger);
 
   return 1;
 }
 
 void
 btc_logger_close(btc_logger_t *logger) {
+  btc_mutex_lock(logger->lock);
+  logger->running = 0;
+  btc_mutex_unlock(logger->lock);
+
+  btc_cond_signal(logger->cond);
+
+  btc_thread_join(logger->thread);
+  btc_thread_free(logger->thread);
+
   fclose(logger->stream);
+
+  btc_free(logger->ring);
+
   logger->stream = NULL;
+  logger->thread = NULL;
+  logger->ring = NULL;
 }
 
 void
-btc_logger_write(btc_logger_t *logger,
-                 const char *pre,
-                 const char *fmt,
-                 va_list ap) {
+btc_logger_log(btc_logger_t *logger,
+               enum btc_log_level level,
+               const char *pre,
+               const char *fmt,
+               va_list ap) {
   char tmp[1024];
-  int len = 0;
+  int rem = sizeof(tmp) - 1;
+  char *ptr = tmp;
+  int len;
 
-  if (logger == NULL || logger->silent == 0 || logger->stream != NULL) {
-    int rem = sizeof(tmp) - 1;
-    char *ptr = tmp;
+  if (!btc_logger_enabled(logger, level, pre))
+    return;
 
-    if (pre != NULL) {
-      len = btc_snprintf(tmp, rem, "[%s] ", pre);
+  if (pre != NULL) {
+    len = btc_snprintf(tmp, rem, "[%s] ", pre);
 
-      CHECK(len >= 0 && len < rem);
+    CHECK(len >= 0 && len < rem);
 
-      ptr += len;
-      rem -= len;
-    }
+    ptr += len;
+    rem -= len;
+  }
 
-    len = btc_vsnprintf(ptr, rem, fmt, ap);
+  len = btc_vsnprintf(ptr, rem, fmt, ap);
 
-    CHECK(len >= 0);
+  CHECK(len >= 0);
 
-    if (len >= rem)
-      len = rem - 1;
+  if (len >= rem)
+    len = rem - 1;
 
-    ptr += len;
+  ptr += len;
 
-    *ptr++ = '\n';
-    *ptr++ = '\0';
+  *ptr++ = '\n';
+  *ptr++ = '\0';
 
-    len = (ptr - tmp) - 1;
-  }
+  len = (ptr - tmp) - 1;
 
-  if (logger == NULL || logger->silent == 0)
+  if (logger == NULL) {
     fwrite(tmp, 1, len, stdout);
+    return;
+  }
 
-  if (logger != NULL && logger->stream != NULL)
-    fwrite(tmp, 1, len, logger->stream);
+  if (logger->thread != NULL) {
+    logger_push(logger, level, tmp, len);
+    return;
+  }
+
+  logger_output(logger, tmp, len);
+}
+
+void
+btc_logger_write(btc_logger_t *logger,
+                 const char *pre,
+                 const char *fmt,
+                 va_list ap) {
+  btc_logger_log(logger, BTC_LOG_INFO, pre, fmt, ap);
 }
@@ -10,14 +10,22 @@
 #include <string.h>
 
 #include <io/core.h>
+#include <io/loop.h>
 
 #include <node/chain.h>
+#include <node/chaindb.h>
+#include <node/logger.h>
+#include <node/mempool.h>
+#include <node/miner.h>
 #include <node/node.h>
+#include <node/notify.h>
 #include <node/pool.h>
 #include <node/rpc.h>
+#include <node/stratum.h>
 
 #include <mako/config.h>
 #include <mako/netaddr.h>
+#include <mako/util.h>
 
 /*
  * Config
@@ -43,10 +51,67 @@ get_config(btc_conf_t *args, int argc, char **argv) {
   return 1;
 }
 
+static void
+set_tune(btc_node_t *node, const btc_conf_t *conf) {
+  /* Overrides are in MB. */
+  btc_dbtune_t tune;
+
+  btc_dbtune_init(&tune, (enum btc_dbprofile)conf->db_profile);
+
+  if (conf->db_autoflush > 0)
+    tune.autoflush = conf->db_autoflush << 10;
+
+  if (conf->db_checkpoint > 0)
+    tune.autocheckpoint = conf->db_checkpoint << 10;
+
+  if (conf->db_automerge > 0)
+    tune.automerge = conf->db_automerge;
+
+  if (conf->db_blockcache > 0)
+    tune.cache_size = conf->db_blockcache << 10;
+
+  if (conf->db_buffer > 0)
+    tune.buffer_size = conf->db_buffer << 10;
+
+  if (conf->db_map_coins >= 0)
+    tune.mmap = conf->db_map_coins;
+
+  tune.shared = conf->db_shared;
+
+  btc_chain_set_tune(node->chain, &tune);
+}
+
 static void
 set_config(btc_node_t *node, const btc_conf_t *conf) {
+  size_t i;
+
+  btc_logger_set_level(node->logger, (enum btc_log_level)conf->log_level);
+  btc_logger_set_debug(node->logger, conf->debug);
+
   btc_chain_set_threads(node->chain, conf->workers);
+  btc_chain_set_cpus(node->chain, conf->worker_cpus, conf->worker_cpus_len);
+  btc_chain_set_cache(node->chain, (size_t)conf->db_cache << 20);
+  btc_chain_set_snapshot(node->chain, conf->snapshot);
+
+  set_tune(node, conf);
+
+  btc_mempool_set_threads(node->mempool, conf->workers);
+  btc_mempool_set_cpus(node->mempool, conf->worker_cpus,
+                                      conf->worker_cpus_len);
+  btc_miner_set_cpus(node->miner, conf->miner_cpus, conf->miner_cpus_len);
 
+  /* A size in MB. `prune=1` prunes by height alone. */
+  if (conf->prune > 1)
+    btc_chain_set_prune(node->chain, (int64_t)conf->prune << 20);
+
+  if (!conf->assume_valid)
+    btc_chain_set_assume_valid(node->chain, NULL, -1);
+  else if (!btc_hash_is_null(conf->assume_hash))
+    btc_chain_set_assume_valid(node->chain, conf->assume_hash,
+                               conf->assume_height);
+
+  btc_pool_set_threads(node->pool, conf->net_threads);
+  btc_loop_set_spin(node->loop, conf->busy_poll);
   btc_pool_set_port(node->pool, conf->port);
   btc_pool_set_bind(node->pool, &conf->bind);
   btc_pool_set_external(node->pool, &conf->external);
@@ -54,11 +119,26 @@ set_config(btc_node_t *node, const btc_conf_t *conf) {
   btc_pool_set_proxy(node->pool, &conf->proxy);
   btc_pool_set_maxinbound(node->pool, conf->max_inbound);
   btc_pool_set_maxoutbound(node->pool, conf->max_outbound);
+  btc_pool_set_uploadtarget(node->pool, (uint64_t)conf->max_upload << 20);
+  btc_pool_set_blockbuffer(node->pool, (size_t)conf->block_buffer << 20);
   btc_pool_set_bantime(node->pool, conf->ban_time);
   btc_pool_set_onlynet(node->pool, conf->only_net);
+  btc_pool_set_v2(node->pool, conf->v2transport);
+  btc_pool_set_relay(node->pool, conf->udp_port);
+  btc_pool_set_headers(node->pool, conf->headers_file);
+  btc_pool_set_capture(node->pool, conf->capture_file);
+
+  for (i = 0; i < conf->udp_peers_len; i++)
+    btc_pool_add_relay(node->pool, &conf->udp_peers[i]);
 
   btc_rpc_set_bind(node->rpc, &conf->rpc_bind);
+  btc_rpc_set_threads(node->rpc, conf->rpc_threads);
   btc_rpc_set_credentials(node->rpc, conf->rpc_user, conf->rpc_pass);
+
+  btc_notify_set_bind(node->notify, &conf->notify_bind);
+
+  btc_stratum_set_bind(node->stratum, &conf->stratum_bind);
+  btc_stratum_set_difficulty(node->stratum, conf->stratum_diff);
 }
 
 static unsigned int
@@ -71,6 +151,33 @@ get_node_flags(const btc_conf_t *conf) {
   if (conf->prune)
     flags |= BTC_CHAIN_PRUNE;
 
+  if (conf->db_mmap)
+    flags |= BTC_CHAIN_MMAP;
+
+  if (conf->db_worker)
+    flags |= BTC_CHAIN_WORKER;
+
+  if (conf->db_hugepages)
+    flags |= BTC_CHAIN_HUGEPAGES;
+
+  if (conf->txindex)
+    flags |= BTC_CHAIN_TXINDEX;
+
+  if (conf->coinstats_index)
+    flags |= BTC_CHAIN_COINSTATS;
+
+  if (conf->coin_groups)
+    flags |= BTC_CHAIN_COINGROUPS;
+
+  if (conf->reindex)
+    flags |= BTC_CHAIN_REINDEX;
+
+  if (conf->readonly)
+    flags |= BTC_CHAIN_READONLY;
+
+  if (conf->persist_mempool)
+    flags |= BTC_MEMPOOL_PERSISTENT;
+
   if (conf->listen)
     flags |= BTC_POOL_LISTEN;
 
@@ -107,6 +214,28 @@ get_node_flags(const btc_conf_t *conf) {
   if (conf->bip157)
     flags |= BTC_POOL_BIP157;
 
+  if (conf->bip330)
+    flags |= BTC_POOL_BIP330;
+
+  /* Serving filters requires the index. */
+  if (conf->filter_index || conf->bip157)
+    flags |= BTC_FILTER_INDEX;
+
+  if (conf->addr_index)
+    flags |= BTC_ADDR_INDEX;
+
+  if (conf->rest)
+    flags |= BTC_RPC_REST;
+
+  if (conf->metrics)
+    flags |= BTC_RPC_METRICS;
+
+  if (!btc_netaddr_is_null(&conf->notify_bind))
+    flags |= BTC_NOTIFY_LISTEN;
+
+  if (!btc_netaddr_is_null(&conf->stratum_bind))
+    flags |= BTC_STRATUM_LISTEN;
+
   return flags;
 }
 
@@ -119,6 +248,11 @@ on_sigterm(void *arg) {
   btc_node_stop((btc_node_t *)arg);
 }
 
+static void
+on_sigusr1(void *arg) {
+  btc_node_toggle_trace((btc_node_t *)arg);
+}
+
 /*
  * Main
  */
@@ -141,6 +275,11 @@ main(int argc, char **argv) {
     return EXIT_SUCCESS;
   }
 
+  if (args.readonly && args.replay[0] != '\0') {
+    fprintf(stderr, "A read-only replica cannot replay blocks.\n");
+    return EXIT_FAILURE;
+  }
+
   if (args.daemon) {
     if (!btc_ps_daemon()) {
       fprintf(stderr, "Could not daemonize process.\n");
@@ -156,13 +295,30 @@ main(int argc, char **argv) {
 
   set_config(node, &args);
 
+  /* Threads created from here on are not confined with it. */
+  if (args.loop_cpu >= 0 && !btc_thread_pin(NULL, args.loop_cpu))
+    fprintf(stderr, "Could not pin event loop to CPU %d.\n", args.loop_cpu);
+
   if (!btc_node_open(node, args.prefix, get_node_flags(&args))) {
     btc_node_destroy(node);
     btc_net_cleanup();
     return EXIT_FAILURE;
   }
 
+  /* Benchmark mode: validate the given block files
+     and exit without ever touching the network. */
+  if (args.replay[0] != '\0') {
+    int ok = btc_node_replay(node, args.replay, args.replay_scripts);
+
+    btc_node_close(node);
+    btc_node_destroy(node);
+    btc_net_cleanup();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   btc_ps_onterm(on_sigterm, node);
+  btc_ps_onusr1(on_sigusr1, node);
 
   btc_node_start(node);
 
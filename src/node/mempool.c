@@ -4,16 +4,22 @@
  * https://github.com/chjj/mako
  */
 
+#include <math.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
 #include <io/core.h>
+#include <io/trace.h>
+#include <io/workers.h>
 
 #include <node/chain.h>
+#include <node/fees.h>
 #include <node/logger.h>
 #include <node/mempool.h>
+#include <node/perf.h>
 #include <node/timedata.h>
 
 #include <mako/block.h>
@@ -25,6 +31,7 @@
 #include <mako/entry.h>
 #include <mako/header.h>
 #include <mako/heap.h>
+#include <mako/list.h>
 #include <mako/map.h>
 #include <mako/network.h>
 #include <mako/policy.h>
@@ -43,10 +50,19 @@
 typedef struct btc_orphan_s {
   const uint8_t *hash;
   btc_tx_t *tx;
-  int missing;
+  int missing; /* unresolved prevouts */
   unsigned int id;
+  size_t index; /* position in mp->orphan_list */
+  struct btc_orphan_s *prev; /* peer's orphans, oldest first */
+  struct btc_orphan_s *next;
 } btc_orphan_t;
 
+typedef struct btc_orphans_s {
+  btc_orphan_t *head;
+  btc_orphan_t *tail;
+  size_t length;
+} btc_orphans_t;
+
 DEFINE_OBJECT(btc_orphan, SCOPE_STATIC)
 
 static void
@@ -67,6 +83,98 @@ btc_orphan_copy(btc_orphan_t *z, const btc_orphan_t *x) {
   *z = *x;
 }
 
+/*
+ * Admission Job
+ */
+
+enum btc_mpjob_state {
+  BTC_MPJOB_PENDING, /* scripts are being verified */
+  BTC_MPJOB_READY, /* scripts verified, awaiting commit */
+  BTC_MPJOB_DEFERRED, /* depends on an earlier job */
+  BTC_MPJOB_DONE /* result already known */
+};
+
+typedef struct btc_mpjob_s {
+  btc_tx_t *tx;
+  unsigned int id;
+  btc_mempool_done_cb *done;
+  void *arg;
+  struct btc_mpentry_s *entry;
+  btc_view_t *view;
+  const btc_entry_t *tip;
+  const btc_entry_t *trusted; /* tip the scripts were checked at */
+  int64_t time;
+  btc_verify_error_t error;
+  btc_mutex_t *lock;
+  /* Protected by lock. */
+  enum btc_mpjob_state state;
+  int result;
+  int64_t cost; /* validation time (ns) */
+  struct btc_mpjob_s *next;
+} btc_mpjob_t;
+
+struct btc_mpjobs_s {
+  btc_mpjob_t *head;
+  btc_mpjob_t *tail;
+  size_t length;
+};
+
+/*
+ * Peer Account
+ */
+
+typedef struct btc_mppeer_s {
+  unsigned int id;
+  struct btc_mpjobs_s jobs; /* not yet scheduled */
+  int64_t cost; /* decayed validation time (ns) */
+  int64_t time; /* last decay (ms) */
+  struct btc_mppeer_s *prev;
+  struct btc_mppeer_s *next;
+} btc_mppeer_t;
+
+/*
+ * Cluster
+ */
+
+typedef struct btc_mpcluster_s {
+  btc_mpentry_t **items; /* linearization, best chunk first */
+  size_t length;
+  size_t alloc;
+} btc_mpcluster_t;
+
+static btc_mpcluster_t *
+btc_mpcluster_create(void) {
+  btc_mpcluster_t *cluster = btc_malloc(sizeof(btc_mpcluster_t));
+
+  cluster->items = NULL;
+  cluster->length = 0;
+  cluster->alloc = 0;
+
+  return cluster;
+}
+
+static void
+btc_mpcluster_destroy(btc_mpcluster_t *cluster) {
+  if (cluster->alloc > 0)
+    btc_free(cluster->items);
+
+  btc_free(cluster);
+}
+
+static void
+btc_mpcluster_push(btc_mpcluster_t *z, btc_mpentry_t *entry) {
+  if (z->length == z->alloc) {
+    z->alloc = z->alloc == 0 ? 4 : z->alloc * 2;
+    z->items = (btc_mpentry_t **)btc_realloc(z->items,
+                                             z->alloc * sizeof(void *));
+  }
+
+  entry->_cluster = z;
+  entry->_pos = z->length;
+
+  z->items[z->length++] = entry;
+}
+
 /**
  * Mempool Entry
  */
@@ -86,8 +194,14 @@ btc_mpentry_init(btc_mpentry_t *entry) {
   entry->time = 0;
   entry->coinbase = 0;
   entry->locks = 0;
-  entry->desc_fee = 0;
-  entry->desc_size = 0;
+  entry->chunk_fee = 0;
+  entry->chunk_size = 0;
+  entry->_index = 0;
+  entry->_heap[0] = 0;
+  entry->_heap[1] = 0;
+  entry->_cluster = NULL;
+  entry->_pos = 0;
+  entry->_chunk = 0;
 }
 
 static void
@@ -111,8 +225,8 @@ btc_mpentry_copy(btc_mpentry_t *z, const btc_mpentry_t *x) {
   z->time = x->time;
   z->coinbase = x->coinbase;
   z->locks = x->locks;
-  z->desc_fee = x->desc_fee;
-  z->desc_size = x->desc_size;
+  z->chunk_fee = x->chunk_fee;
+  z->chunk_size = x->chunk_size;
 }
 
 static void
@@ -152,8 +266,8 @@ btc_mpentry_set(btc_mpentry_t *entry,
   entry->time = btc_now();
   entry->coinbase = coinbase;
   entry->locks = locks;
-  entry->desc_fee = fee;
-  entry->desc_size = size;
+  entry->chunk_fee = fee;
+  entry->chunk_size = size;
 }
 
 static size_t
@@ -161,6 +275,29 @@ btc_mpentry_size(const btc_mpentry_t *x) {
   return btc_tx_size(x->tx) + 30;
 }
 
+static size_t
+btc_mpentry_usage(const btc_mpentry_t *x) {
+  size_t usage = btc_malloc_usage(sizeof(btc_mpentry_t));
+
+  usage += btc_tx_usage(x->tx);
+
+  /* Map slot, wtxid table slot and heap slots. */
+  usage += 2 * sizeof(void *);
+  usage += 32 + sizeof(void *);
+  usage += 2 * sizeof(void *);
+
+  /* Cluster slot, charged as if the entry were alone. */
+  usage += btc_malloc_usage(sizeof(btc_mpcluster_t)) + sizeof(void *);
+
+  /* One spents slot per input. */
+  usage += x->tx->inputs.length * 2 * sizeof(void *);
+
+  /* Sighash midstates and decoded input scripts. */
+  usage += btc_tx_cache_usage(x->tx);
+
+  return usage;
+}
+
 static uint8_t *
 btc_mpentry_write(uint8_t *zp, const btc_mpentry_t *x) {
   zp = btc_tx_write(zp, x->tx);
@@ -208,29 +345,277 @@ btc_mpentry_read(btc_mpentry_t *z, const uint8_t **xp, size_t *xn) {
   return 1;
 }
 
+/*
+ * Entry Heap
+ */
+
+typedef struct btc_mpheap_s {
+  btc_mpentry_t **items;
+  size_t length;
+  size_t alloc;
+  btc_heapcmp_f *cmp;
+  int slot;
+} btc_mpheap_t;
+
+static int64_t
+cmp_rate(const void *ap, const void *bp) {
+  const btc_mpentry_t *a = ap;
+  const btc_mpentry_t *b = bp;
+  int64_t x = a->chunk_fee * b->chunk_size;
+  int64_t y = b->chunk_fee * a->chunk_size;
+
+  /* Lowest chunk feerate first. */
+  if (x == y) {
+    x = a->time;
+    y = b->time;
+  }
+
+  return x - y;
+}
+
+static int64_t
+cmp_time(const void *ap, const void *bp) {
+  const btc_mpentry_t *a = ap;
+  const btc_mpentry_t *b = bp;
+
+  return a->time - b->time;
+}
+
+static int64_t
+cmp_chunk(const void *ap, const void *bp) {
+  const btc_mpentry_t *a = ap;
+  const btc_mpentry_t *b = bp;
+  int64_t x = a->chunk_fee * b->chunk_size;
+  int64_t y = b->chunk_fee * a->chunk_size;
+
+  /* Highest chunk feerate first. */
+  if (x == y) {
+    x = b->time;
+    y = a->time;
+  }
+
+  return y - x;
+}
+
+static void
+btc_mpheap_init(btc_mpheap_t *z, btc_heapcmp_f *cmp, int slot) {
+  z->items = NULL;
+  z->length = 0;
+  z->alloc = 0;
+  z->cmp = cmp;
+  z->slot = slot;
+}
+
+static void
+btc_mpheap_clear(btc_mpheap_t *z) {
+  if (z->alloc > 0)
+    btc_free(z->items);
+
+  z->items = NULL;
+  z->length = 0;
+  z->alloc = 0;
+}
+
+static void
+btc_mpheap_swap(btc_mpheap_t *z, size_t i, size_t j) {
+  btc_mpentry_t *x = z->items[i];
+  btc_mpentry_t *y = z->items[j];
+
+  z->items[i] = y;
+  z->items[j] = x;
+
+  y->_heap[z->slot] = i;
+  x->_heap[z->slot] = j;
+}
+
+static int
+btc_mpheap_less(const btc_mpheap_t *z, size_t i, size_t j) {
+  return z->cmp(z->items[i], z->items[j]) < 0;
+}
+
+static int
+btc_mpheap_down(btc_mpheap_t *z, size_t i, size_t n) {
+  size_t i0 = i;
+  size_t l, j;
+
+  for (;;) {
+    l = 2 * i + 1;
+
+    if (l >= n)
+      break;
+
+    j = l;
+
+    if (l + 1 < n && btc_mpheap_less(z, l + 1, l))
+      j = l + 1;
+
+    if (!btc_mpheap_less(z, j, i))
+      break;
+
+    btc_mpheap_swap(z, i, j);
+    i = j;
+  }
+
+  return i > i0;
+}
+
+static void
+btc_mpheap_up(btc_mpheap_t *z, size_t i) {
+  size_t j;
+
+  while (i > 0) {
+    j = (i - 1) / 2;
+
+    if (!btc_mpheap_less(z, i, j))
+      break;
+
+    btc_mpheap_swap(z, j, i);
+    i = j;
+  }
+}
+
+static btc_mpentry_t *
+btc_mpheap_peek(const btc_mpheap_t *z) {
+  if (z->length == 0)
+    return NULL;
+
+  return z->items[0];
+}
+
+static void
+btc_mpheap_insert(btc_mpheap_t *z, btc_mpentry_t *entry) {
+  if (z->length == z->alloc) {
+    z->alloc = z->alloc == 0 ? 64 : z->alloc * 2;
+    z->items = (btc_mpentry_t **)btc_realloc(z->items,
+                                             z->alloc * sizeof(void *));
+  }
+
+  z->items[z->length] = entry;
+
+  entry->_heap[z->slot] = z->length++;
+
+  btc_mpheap_up(z, z->length - 1);
+}
+
+static void
+btc_mpheap_remove(btc_mpheap_t *z, const btc_mpentry_t *entry) {
+  size_t i = entry->_heap[z->slot];
+  size_t n;
+
+  CHECK(i < z->length && z->items[i] == entry);
+
+  n = --z->length;
+
+  if (i != n) {
+    btc_mpheap_swap(z, i, n);
+
+    if (!btc_mpheap_down(z, i, n))
+      btc_mpheap_up(z, i);
+  }
+}
+
+static void
+btc_mpheap_fix(btc_mpheap_t *z, const btc_mpentry_t *entry) {
+  size_t i = entry->_heap[z->slot];
+
+  CHECK(i < z->length && z->items[i] == entry);
+
+  if (!btc_mpheap_down(z, i, z->length))
+    btc_mpheap_up(z, i);
+}
+
 /*
  * Mempool
  */
 
+#define BTC_MEMPOOL_FILE_VERSION 2
+#define BTC_MEMPOOL_HEADER_SIZE 48
+#define BTC_MEMPOOL_BUFFER_SIZE (1 << 20)
+#define BTC_MEMPOOL_LOAD_BATCH 500
+#define BTC_MEMPOOL_REORG_DEPTH 6
+#define BTC_MEMPOOL_JOB_WINDOW 64
+#define BTC_MEMPOOL_TIME_SLICE (25 * 1000000) /* 25ms */
+#define BTC_MEMPOOL_PEER_HALFLIFE 60000 /* 1 minute */
+
+typedef struct btc_mpblock_s {
+  uint8_t hash[32];
+  btc_hashset_t *txs; /* confirmed txs whose scripts we checked */
+} btc_mpblock_t;
+
+typedef struct btc_mpdetach_s {
+  btc_tx_t *tx;
+  int32_t height;
+  uint32_t index;
+  int trusted;
+} btc_mpdetach_t;
+
 struct btc_mempool_s {
   const btc_network_t *network;
   btc_logger_t *logger;
   const btc_timedata_t *timedata;
+  btc_perf_t *perf;
   btc_chain_t *chain;
-  size_t size;
+  size_t usage;
   btc_hashmap_t *map;
-  btc_hashmap_t *waiting;
+  btc_hashmap_t *wmap; /* entries by wtxid */
+  struct btc_mpwtxids_s {
+    uint8_t *hashes;
+    const btc_mpentry_t **entries;
+    size_t length;
+    size_t alloc;
+  } wtxids;
+  btc_mpheap_t by_rate; /* worst chunk first */
+  btc_mpheap_t by_time;
+  btc_prevmap_t *waiting;
   btc_hashmap_t *orphans;
-  btc_outmap_t *spents;
+  btc_hashmap_t *worphans; /* orphans by wtxid */
+  btc_vector_t orphan_list;
+  btc_intmap_t *orphan_peers;
+  btc_prevmap_t *spents;
+  btc_hashset_t *fragile; /* entries a reorg could invalidate */
+  btc_mpblock_t blocks[BTC_MEMPOOL_REORG_DEPTH];
+  btc_hashmap_t *detached; /* txs of disconnected blocks */
+  btc_fees_t *fees;
   btc_filter_t rejects;
+  btc_hashmap_t *lowfee; /* fee-only rejects a child may pay for */
+  int64_t min_rate; /* rolling minimum feerate */
+  int64_t min_time;
+  int min_decay; /* a block came in since it was raised */
   btc_verify_error_t error;
   unsigned int flags;
   char file[BTC_PATH_MAX];
   btc_mempool_tx_cb *on_tx;
   btc_mempool_badorphan_cb *on_badorphan;
   void *arg;
+  int threads;
+  int *cpus;
+  size_t cpus_len;
+  int in_package;
+  btc_workers_t *workers;
+  struct btc_loop_s *loop;
+  btc_mutex_t *lock;
+  struct btc_mpjobs_s jobs;
+  btc_intmap_t *peers; /* validation accounts */
+  struct btc_mppeers_s {
+    btc_mppeer_t *head;
+    btc_mppeer_t *tail;
+    size_t length;
+  } backlog; /* accounts with unscheduled jobs */
+  btc_hashset_t *pending; /* hashes of queued txs */
+  btc_prevmap_t *claims; /* outpoints spent by queued txs */
+  struct btc_mpload_s {
+    uint8_t *data;
+    const uint8_t *xp;
+    size_t xn;
+    size_t left;
+    size_t total;
+    uint8_t tip[32];
+  } load;
 };
 
+static void
+btc_mempool_clear_peers(btc_mempool_t *mp);
+
 btc_mempool_t *
 btc_mempool_create(const btc_network_t *network, btc_chain_t *chain) {
   btc_mempool_t *mp = (btc_mempool_t *)btc_malloc(sizeof(btc_mempool_t));
@@ -240,44 +625,138 @@ btc_mempool_create(const btc_network_t *network, btc_chain_t *chain) {
   mp->network = network;
   mp->chain = chain;
   mp->map = btc_hashmap_create();
-  mp->waiting = btc_hashmap_create(); /* orphan prevout hashes */
+  mp->wmap = btc_hashmap_create();
+  mp->waiting = btc_prevmap_create(); /* missing orphan prevouts */
   mp->orphans = btc_hashmap_create();
-  mp->spents = btc_outmap_create(); /* mempool entry's outpoints */
+  mp->worphans = btc_hashmap_create();
+  mp->orphan_peers = btc_intmap_create();
+  mp->spents = btc_prevmap_create(); /* mempool entry's outpoints */
+  mp->fees = btc_fees_create();
+  mp->fragile = btc_hashset_create();
+  mp->detached = btc_hashmap_create();
   mp->flags = BTC_MEMPOOL_DEFAULT_FLAGS;
+  mp->pending = btc_hashset_create();
+  mp->claims = btc_prevmap_create();
+  mp->lowfee = btc_hashmap_create();
+  mp->peers = btc_intmap_create();
+
+  btc_list_init(&mp->backlog);
+
+  btc_mempool_set_threads(mp, 0);
   mp->file[0] = '\0';
 
+  btc_mpheap_init(&mp->by_rate, cmp_rate, 0);
+  btc_mpheap_init(&mp->by_time, cmp_time, 1);
+
+  btc_vector_init(&mp->orphan_list);
+
   btc_filter_init(&mp->rejects);
   btc_filter_set(&mp->rejects, 120000, 0.000001);
 
   return mp;
 }
 
+static void
+btc_mpblock_clear(btc_mpblock_t *blk) {
+  btc_hashsetiter_t iter;
+
+  if (blk->txs == NULL)
+    return;
+
+  btc_hashset_iterate(&iter, blk->txs);
+
+  while (btc_hashset_next(&iter))
+    btc_free(iter.key);
+
+  btc_hashset_destroy(blk->txs);
+
+  blk->txs = NULL;
+}
+
+static void
+btc_mpdetach_destroy(btc_mpdetach_t *item) {
+  btc_tx_destroy(item->tx);
+  btc_free(item);
+}
+
 void
 btc_mempool_destroy(btc_mempool_t *mp) {
   btc_hashmapiter_t iter;
+  btc_prevmapiter_t oiter;
+  btc_intmapiter_t piter;
+  int i;
 
   btc_hashmap_iterate(&iter, mp->map);
 
-  while (btc_hashmap_next(&iter))
-    btc_mpentry_destroy(iter.val);
+  while (btc_hashmap_next(&iter)) {
+    btc_mpentry_t *entry = iter.val;
 
-  btc_hashmap_iterate(&iter, mp->waiting);
+    if (entry->_pos == 0)
+      btc_mpcluster_destroy(entry->_cluster);
 
-  while (btc_hashmap_next(&iter)) {
-    btc_free(iter.key);
-    btc_hashset_destroy(iter.val);
+    btc_mpentry_destroy(entry);
   }
 
+  btc_prevmap_iterate(&oiter, mp->waiting);
+
+  while (btc_prevmap_next(&oiter))
+    btc_vector_destroy(oiter.val);
+
   btc_hashmap_iterate(&iter, mp->orphans);
 
   while (btc_hashmap_next(&iter))
     btc_orphan_destroy(iter.val);
 
+  btc_intmap_iterate(&piter, mp->orphan_peers);
+
+  while (btc_intmap_next(&piter))
+    btc_free(piter.val);
+
+  btc_hashmap_iterate(&iter, mp->lowfee);
+
+  while (btc_hashmap_next(&iter))
+    btc_tx_destroy(iter.val);
+
+  btc_hashmap_iterate(&iter, mp->detached);
+
+  while (btc_hashmap_next(&iter))
+    btc_mpdetach_destroy(iter.val);
+
+  if (mp->wtxids.alloc > 0) {
+    btc_free(mp->wtxids.hashes);
+    btc_free(mp->wtxids.entries);
+  }
+
+  btc_mpheap_clear(&mp->by_rate);
+  btc_mpheap_clear(&mp->by_time);
+
   btc_hashmap_destroy(mp->map);
-  btc_hashmap_destroy(mp->waiting);
+  btc_hashmap_destroy(mp->wmap);
+  btc_prevmap_destroy(mp->waiting);
   btc_hashmap_destroy(mp->orphans);
-  btc_outmap_destroy(mp->spents);
+  btc_hashmap_destroy(mp->worphans);
+  btc_vector_clear(&mp->orphan_list);
+  btc_intmap_destroy(mp->orphan_peers);
+  btc_prevmap_destroy(mp->spents);
+  btc_fees_destroy(mp->fees);
+  btc_hashset_destroy(mp->fragile);
+
+  for (i = 0; i < BTC_MEMPOOL_REORG_DEPTH; i++)
+    btc_mpblock_clear(&mp->blocks[i]);
+  btc_hashmap_destroy(mp->detached);
+  btc_hashset_destroy(mp->pending);
+  btc_prevmap_destroy(mp->claims);
   btc_filter_clear(&mp->rejects);
+  btc_hashmap_destroy(mp->lowfee);
+
+  btc_mempool_clear_peers(mp);
+  btc_intmap_destroy(mp->peers);
+
+  if (mp->load.data != NULL)
+    btc_free(mp->load.data);
+
+  if (mp->cpus != NULL)
+    btc_free(mp->cpus);
 
   btc_free(mp);
 }
@@ -292,6 +771,52 @@ btc_mempool_set_timedata(btc_mempool_t *mp, const btc_timedata_t *td) {
   mp->timedata = td;
 }
 
+void
+btc_mempool_set_perf(btc_mempool_t *mp, btc_perf_t *perf) {
+  mp->perf = perf;
+}
+
+void
+btc_mempool_set_loop(btc_mempool_t *mp, struct btc_loop_s *loop) {
+  /* Woken when verification jobs finish. */
+  mp->loop = loop;
+}
+
+void
+btc_mempool_set_threads(btc_mempool_t *mp, int threads) {
+  if (threads <= 0) {
+    int num = btc_sys_numcpu();
+
+    if (num < 1)
+      num = 1;
+
+    threads += num;
+  }
+
+  if (threads <= 1)
+    threads = 0;
+  else if (threads > 16)
+    threads = 16;
+
+  mp->threads = threads;
+}
+
+void
+btc_mempool_set_cpus(btc_mempool_t *mp, const int *cpus, size_t length) {
+  if (mp->cpus != NULL)
+    btc_free(mp->cpus);
+
+  mp->cpus = NULL;
+  mp->cpus_len = 0;
+
+  if (length > 0) {
+    mp->cpus = btc_malloc(length * sizeof(int));
+    mp->cpus_len = length;
+
+    memcpy(mp->cpus, cpus, length * sizeof(int));
+  }
+}
+
 void
 btc_mempool_on_tx(btc_mempool_t *mp, btc_mempool_tx_cb *handler) {
   mp->on_tx = handler;
@@ -316,6 +841,20 @@ btc_mempool_log(btc_mempool_t *mp, const char *fmt, ...) {
   va_end(ap);
 }
 
+static void
+btc_mempool_debug(btc_mempool_t *mp, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_log(mp->logger, BTC_LOG_DEBUG, "mempool", fmt, ap);
+  va_end(ap);
+}
+
+static int
+btc_mempool_read_file(btc_mempool_t *mp, const char *path);
+
+static int
+btc_mempool_write_file(btc_mempool_t *mp, const char *path);
+
 int
 btc_mempool_open(btc_mempool_t *mp, const char *prefix, unsigned int flags) {
   mp->flags = flags;
@@ -327,12 +866,65 @@ btc_mempool_open(btc_mempool_t *mp, const char *prefix, unsigned int flags) {
 
   btc_mempool_log(mp, "Opening mempool.");
 
+  if (mp->threads > 0) {
+    mp->workers = btc_workers_create(mp->threads, 1);
+    mp->lock = btc_mutex_create();
+
+    if (mp->cpus_len > 0
+        && !btc_workers_pin(mp->workers, mp->cpus, mp->cpus_len)) {
+      btc_mempool_log(mp, "Could not pin verification workers.");
+    }
+
+    if (mp->loop != NULL)
+      btc_workers_notify(mp->workers, mp->loop);
+  }
+
+  /* Entries are fed back in by btc_mempool_drain. */
+  if ((flags & BTC_MEMPOOL_PERSISTENT) && *mp->file) {
+    if (btc_fs_exists(mp->file) && !btc_mempool_read_file(mp, mp->file))
+      btc_mempool_log(mp, "Could not read %s.", mp->file);
+  }
+
   return 1;
 }
 
 void
 btc_mempool_close(btc_mempool_t *mp) {
+  btc_mpjob_t *job;
+
   btc_mempool_log(mp, "Closing mempool.");
+
+  /* Nobody is listening for results anymore. */
+  for (job = mp->jobs.head; job != NULL; job = job->next)
+    job->done = NULL;
+
+  /* Nor has anything vouched for the backlog. */
+  btc_mempool_clear_peers(mp);
+
+  /* Settle queued and unread txs so they make it into the dump. */
+  while (mp->jobs.head != NULL || mp->load.data != NULL) {
+    if (mp->workers != NULL)
+      btc_workers_wait(mp->workers);
+
+    btc_mempool_drain(mp);
+  }
+
+  if ((mp->flags & BTC_MEMPOOL_PERSISTENT) && *mp->file) {
+    btc_mempool_log(mp, "Writing %zu txs to %s.",
+                    btc_hashmap_size(mp->map), mp->file);
+
+    if (!btc_mempool_write_file(mp, mp->file))
+      btc_mempool_log(mp, "Could not write %s.", mp->file);
+  }
+
+  if (mp->workers == NULL)
+    return;
+
+  btc_workers_destroy(mp->workers);
+  btc_mutex_destroy(mp->lock);
+
+  mp->workers = NULL;
+  mp->lock = NULL;
 }
 
 static int
@@ -370,11 +962,35 @@ btc_mempool_throw(btc_mempool_t *mp,
  * Orphan Handling
  */
 
+static void
+btc_mempool_unlink_orphan(btc_mempool_t *mp, btc_orphan_t *orphan) {
+  btc_orphans_t *queue = btc_intmap_get(mp->orphan_peers, orphan->id);
+  btc_orphan_t *last = btc_vector_pop(&mp->orphan_list);
+
+  /* Swap the last orphan into our slot. */
+  if (last != orphan) {
+    mp->orphan_list.items[orphan->index] = last;
+    last->index = orphan->index;
+  }
+
+  CHECK(queue != NULL);
+
+  btc_list_remove(queue, orphan, btc_orphan_t);
+
+  if (queue->length == 0) {
+    btc_intmap_del(mp->orphan_peers, orphan->id);
+    btc_free(queue);
+  }
+
+  btc_hashmap_del(mp->orphans, orphan->hash);
+  btc_hashmap_del(mp->worphans, orphan->tx->whash);
+}
+
 static int
 btc_mempool_remove_orphan(btc_mempool_t *mp, const uint8_t *hash) {
   btc_orphan_t *orphan = btc_hashmap_get(mp->orphans, hash);
   const btc_tx_t *tx;
-  size_t i;
+  size_t i, j;
 
   if (orphan == NULL)
     return 0;
@@ -384,54 +1000,53 @@ btc_mempool_remove_orphan(btc_mempool_t *mp, const uint8_t *hash) {
   for (i = 0; i < tx->inputs.length; i++) {
     const btc_input_t *input = tx->inputs.items[i];
     const btc_outpoint_t *prevout = &input->prevout;
-    btc_hashset_t *set = btc_hashmap_get(mp->waiting, prevout->hash);
+    btc_vector_t *list = btc_prevmap_get(mp->waiting, prevout);
 
-    if (set == NULL)
+    if (list == NULL)
       continue;
 
-    btc_hashset_del(set, hash);
+    for (j = 0; j < list->length; j++) {
+      if (list->items[j] == orphan) {
+        list->items[j] = list->items[list->length - 1];
+        btc_vector_pop(list);
+        break;
+      }
+    }
 
-    if (btc_hashset_size(set) == 0) {
-      btc_free(btc_hashmap_del(mp->waiting, prevout->hash));
-      btc_hashset_destroy(set);
+    if (list->length == 0) {
+      btc_prevmap_del(mp->waiting, prevout);
+      btc_vector_destroy(list);
     }
   }
 
-  btc_hashmap_del(mp->orphans, hash);
+  btc_mempool_unlink_orphan(mp, orphan);
   btc_orphan_destroy(orphan);
 
   return 1;
 }
 
-static int
-btc_mempool_limit_orphans(btc_mempool_t *mp) {
-  const uint8_t *hash = NULL;
-  btc_hashmapiter_t iter;
-  size_t index;
+static void
+btc_mempool_limit_orphans(btc_mempool_t *mp, unsigned int id) {
+  const btc_orphans_t *queue = btc_intmap_get(mp->orphan_peers, id);
+  const btc_orphan_t *orphan;
+  uint8_t hash[32];
 
-  if (btc_hashmap_size(mp->orphans) < BTC_MEMPOOL_MAX_ORPHANS)
-    return 0;
+  if (queue != NULL && queue->length >= BTC_MEMPOOL_MAX_PEER_ORPHANS) {
+    /* The peer is over budget: drop its oldest. */
+    orphan = queue->head;
+  } else if (mp->orphan_list.length >= BTC_MEMPOOL_MAX_ORPHANS) {
+    size_t index = btc_uniform(mp->orphan_list.length);
 
-  index = btc_uniform(btc_hashmap_size(mp->orphans));
+    orphan = mp->orphan_list.items[index];
+  } else {
+    return;
+  }
 
-  btc_hashmap_iterate(&iter, mp->orphans);
+  btc_hash_copy(hash, orphan->hash);
 
-  while (btc_hashmap_next(&iter)) {
-    hash = iter.key;
-
-    if (index == 0)
-      break;
-
-    index--;
-  }
-
-  CHECK(hash != NULL);
-
-  btc_mempool_log(mp, "Removing orphan %H from mempool.", hash);
+  btc_mempool_debug(mp, "Removing orphan %H from mempool.", hash);
 
   btc_mempool_remove_orphan(mp, hash);
-
-  return 1;
 }
 
 static int
@@ -462,8 +1077,8 @@ btc_mempool_check_orphan(btc_mempool_t *mp,
       continue;
 
     if (btc_mempool_has_reject(mp, prevout->hash)) {
-      btc_mempool_log(mp, "Not storing orphan %H (rejected parents).",
-                          tx->hash);
+      btc_mempool_debug(mp, "Not storing orphan %H (rejected parents).",
+                        tx->hash);
       return btc_mempool_fail(mp, tx,
                               "duplicate",
                               "duplicate",
@@ -472,8 +1087,8 @@ btc_mempool_check_orphan(btc_mempool_t *mp,
     }
 
     if (btc_mempool_has(mp, prevout->hash)) {
-      btc_mempool_log(mp, "Not storing orphan %H (non-existent output).",
-                          tx->hash);
+      btc_mempool_debug(mp, "Not storing orphan %H (non-existent output).",
+                        tx->hash);
       return btc_mempool_throw(mp, tx,
                                "invalid",
                                "bad-txns-inputs-missingorspent",
@@ -484,7 +1099,7 @@ btc_mempool_check_orphan(btc_mempool_t *mp,
 
   /* Weight limit for orphans. */
   if (btc_tx_weight(tx) > BTC_MAX_TX_WEIGHT) {
-    btc_mempool_log(mp, "Ignoring large orphan %H.", tx->hash);
+    btc_mempool_debug(mp, "Ignoring large orphan %H.", tx->hash);
     return btc_mempool_throw(mp, tx,
                              "invalid",
                              "tx-size",
@@ -500,81 +1115,222 @@ btc_mempool_add_orphan(btc_mempool_t *mp,
                        const btc_tx_t *tx,
                        const btc_view_t *view,
                        unsigned int id) {
-  btc_orphan_t *orphan = btc_orphan_create();
-  btc_hashset_t *hashes = btc_hashset_create();
-  btc_hashsetiter_t iter;
+  btc_orphans_t *queue;
+  btc_orphan_t *orphan;
   size_t i;
+  int tag;
 
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_ORPHANS);
+
+  orphan = btc_orphan_create();
   orphan->tx = btc_tx_refconst(tx);
   orphan->hash = orphan->tx->hash;
   orphan->missing = 0;
   orphan->id = id;
 
-  btc_mempool_limit_orphans(mp);
+  btc_mempool_limit_orphans(mp, id);
 
   for (i = 0; i < orphan->tx->inputs.length; i++) {
     const btc_input_t *input = orphan->tx->inputs.items[i];
+    const btc_outpoint_t *prevout = &input->prevout;
+    btc_vector_t *list;
 
-    if (!btc_view_has(view, &input->prevout))
-      btc_hashset_put(hashes, input->prevout.hash);
-  }
-
-  btc_hashset_iterate(&iter, hashes);
+    if (btc_view_has(view, prevout))
+      continue;
 
-  while (btc_hashset_next(&iter)) {
-    const uint8_t *prev = iter.key;
+    list = btc_prevmap_get(mp->waiting, prevout);
 
-    if (!btc_hashmap_has(mp->waiting, prev))
-      btc_hashmap_put(mp->waiting, btc_hash_clone(prev), btc_hashset_create());
+    if (list == NULL) {
+      list = btc_vector_create();
+      btc_prevmap_put(mp->waiting, prevout, list);
+    }
 
-    btc_hashset_put(btc_hashmap_get(mp->waiting, prev), orphan->hash);
+    btc_vector_push(list, orphan);
 
     orphan->missing++;
   }
 
-  btc_hashset_destroy(hashes);
+  queue = btc_intmap_get(mp->orphan_peers, id);
+
+  if (queue == NULL) {
+    queue = (btc_orphans_t *)btc_malloc(sizeof(btc_orphans_t));
+
+    btc_list_init(queue);
+
+    btc_intmap_put(mp->orphan_peers, id, queue);
+  }
+
+  btc_list_push(queue, orphan, btc_orphan_t);
+
+  orphan->index = mp->orphan_list.length;
+
+  btc_vector_push(&mp->orphan_list, orphan);
 
   CHECK(btc_hashmap_put(mp->orphans, orphan->hash, orphan));
+  CHECK(btc_hashmap_put(mp->worphans, orphan->tx->whash, orphan));
 
-  btc_mempool_log(mp, "Added orphan %H to mempool.", tx->hash);
+  BTC_MEMTAG_POP(tag);
+
+  btc_mempool_debug(mp, "Added orphan %H to mempool.", tx->hash);
 }
 
-static btc_vector_t *
-btc_mempool_resolve_orphans(btc_mempool_t *mp, const uint8_t *parent) {
-  btc_hashset_t *set = btc_hashmap_get(mp->waiting, parent);
-  btc_vector_t *resolved;
-  btc_hashsetiter_t iter;
+static void
+btc_mempool_remove_lowfee(btc_mempool_t *mp, const uint8_t *hash) {
+  btc_tx_t *tx = btc_hashmap_get(mp->lowfee, hash);
 
-  if (set == NULL)
-    return NULL;
+  if (tx == NULL)
+    return;
 
-  CHECK(btc_hashset_size(set) > 0);
+  btc_hashmap_del(mp->lowfee, hash);
+  btc_tx_destroy(tx);
+}
+
+static void
+btc_mempool_add_lowfee(btc_mempool_t *mp, const btc_tx_t *tx) {
+  btc_hashmapiter_t iter;
+  btc_tx_t *ref;
+
+  if (btc_hashmap_has(mp->lowfee, tx->hash))
+    return;
+
+  if (btc_hashmap_size(mp->lowfee) >= BTC_MEMPOOL_MAX_LOWFEE) {
+    btc_hashmap_iterate(&iter, mp->lowfee);
+
+    CHECK(btc_hashmap_next(&iter));
+
+    btc_mempool_remove_lowfee(mp, iter.key);
+  }
+
+  ref = btc_tx_refconst(tx);
+
+  CHECK(btc_hashmap_put(mp->lowfee, ref->hash, ref));
+}
+
+static int
+btc_mempool_bump_parents(btc_mempool_t *mp,
+                         const btc_tx_t *tx,
+                         const btc_view_t *view,
+                         unsigned int id) {
+  btc_txvec_t txs;
+  size_t i, j;
+  int ret;
 
-  resolved = btc_vector_create();
+  btc_txvec_init(&txs);
 
-  btc_hashset_iterate(&iter, set);
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+    const btc_outpoint_t *prevout = &input->prevout;
+    const btc_tx_t *parent;
+
+    if (btc_view_has(view, prevout))
+      continue;
 
-  while (btc_hashset_next(&iter)) {
-    const uint8_t *hash = iter.key;
-    btc_orphan_t *orphan = btc_hashmap_get(mp->orphans, hash);
+    parent = btc_hashmap_get(mp->lowfee, prevout->hash);
 
-    CHECK(orphan != NULL);
+    if (parent == NULL) {
+      btc_txvec_clear(&txs);
+      return 0;
+    }
 
-    if (--orphan->missing == 0) {
-      btc_hashmap_del(mp->orphans, hash);
-      btc_vector_push(resolved, orphan);
+    for (j = 0; j < txs.length; j++) {
+      if (txs.items[j] == parent)
+        break;
     }
+
+    if (j == txs.length)
+      btc_txvec_push(&txs, btc_tx_refconst(parent));
   }
 
-  btc_free(btc_hashmap_del(mp->waiting, parent));
+  btc_txvec_push(&txs, btc_tx_refconst(tx));
 
-  btc_hashset_destroy(set);
+  ret = btc_mempool_add_package(mp, &txs, id);
+
+  btc_txvec_clear(&txs);
+
+  return ret;
+}
+
+static void
+btc_mempool_bump_orphan(btc_mempool_t *mp, const btc_tx_t *parent) {
+  btc_outpoint_t prevout;
+  btc_vector_t *list;
+  btc_txvec_t txs;
+  size_t i, j;
+
+  btc_txvec_init(&txs);
+
+  /* Nothing is touched until a package succeeds. */
+  for (i = 0; i < parent->outputs.length; i++) {
+    btc_outpoint_set(&prevout, parent->hash, i);
+
+    list = btc_prevmap_get(mp->waiting, &prevout);
+
+    if (list == NULL)
+      continue;
+
+    for (j = 0; j < list->length; j++) {
+      const btc_orphan_t *orphan = list->items[j];
+      int ret;
+
+      btc_txvec_push(&txs, btc_tx_refconst(parent));
+      btc_txvec_push(&txs, btc_tx_refconst(orphan->tx));
+
+      ret = btc_mempool_add_package(mp, &txs, orphan->id);
+
+      btc_txvec_reset(&txs);
+
+      if (ret) {
+        btc_txvec_clear(&txs);
+        return;
+      }
+    }
+  }
+
+  btc_txvec_clear(&txs);
+}
+
+static btc_vector_t *
+btc_mempool_resolve_orphans(btc_mempool_t *mp, const btc_tx_t *tx) {
+  btc_vector_t *resolved = NULL;
+  btc_outpoint_t prevout;
+  btc_vector_t *list;
+  size_t i, j;
+
+  if (btc_prevmap_size(mp->waiting) == 0)
+    return NULL;
+
+  for (i = 0; i < tx->outputs.length; i++) {
+    btc_outpoint_set(&prevout, tx->hash, i);
+
+    list = btc_prevmap_get(mp->waiting, &prevout);
+
+    if (list == NULL)
+      continue;
+
+    CHECK(list->length > 0);
+
+    for (j = 0; j < list->length; j++) {
+      btc_orphan_t *orphan = list->items[j];
+
+      if (--orphan->missing == 0) {
+        btc_mempool_unlink_orphan(mp, orphan);
+
+        if (resolved == NULL)
+          resolved = btc_vector_create();
+
+        btc_vector_push(resolved, orphan);
+      }
+    }
+
+    btc_prevmap_del(mp->waiting, &prevout);
+    btc_vector_destroy(list);
+  }
 
   return resolved;
 }
 
 static void
-btc_mempool_handle_orphans(btc_mempool_t *mp, const uint8_t *parent) {
+btc_mempool_handle_orphans(btc_mempool_t *mp, const btc_tx_t *parent) {
   btc_vector_t *resolved = btc_mempool_resolve_orphans(mp, parent);
   uint8_t hash[32];
   size_t i;
@@ -587,7 +1343,9 @@ btc_mempool_handle_orphans(btc_mempool_t *mp, const uint8_t *parent) {
 
     btc_hash_copy(hash, orphan->hash);
 
-    if (!btc_mempool_add(mp, orphan->tx, orphan->id)) {
+    /* A child may have paid for it. */
+    if (!btc_mempool_add(mp, orphan->tx, orphan->id)
+        && !btc_hashmap_has(mp->map, hash)) {
       btc_mempool_log(mp, "Could not resolve orphan %H.", hash);
       btc_orphan_destroy(orphan);
       continue;
@@ -605,7 +1363,7 @@ btc_mempool_handle_orphans(btc_mempool_t *mp, const uint8_t *parent) {
       continue;
     }
 
-    btc_mempool_log(mp, "Resolved orphan %H in mempool.", hash);
+    btc_mempool_debug(mp, "Resolved orphan %H in mempool.", hash);
   }
 
   btc_vector_destroy(resolved);
@@ -646,35 +1404,12 @@ btc_mempool_view(btc_mempool_t *mp, const btc_tx_t *tx) {
  * Entry Handling
  */
 
-static void
-add_fee(btc_mpentry_t *parent, const btc_mpentry_t *child) {
-  parent->desc_fee += child->delta_fee;
-  parent->desc_size += child->size;
-}
-
-static void
-remove_fee(btc_mpentry_t *parent, const btc_mpentry_t *child) {
-  parent->desc_fee -= child->desc_fee;
-  parent->desc_size -= child->desc_size;
-}
-
-BTC_UNUSED static void
-preprioritise(btc_mpentry_t *parent, const btc_mpentry_t *child) {
-  parent->desc_fee -= child->delta_fee;
-}
-
-BTC_UNUSED static void
-postprioritise(btc_mpentry_t *parent, const btc_mpentry_t *child) {
-  parent->desc_fee += child->delta_fee;
-}
+#define BIT(i) ((uint64_t)1 << (i))
 
 static size_t
 traverse_ancestors(btc_mempool_t *mp,
                    const btc_mpentry_t *entry,
-                   btc_hashset_t *set,
-                   const btc_mpentry_t *child,
-                   void (*map)(btc_mpentry_t *,
-                               const btc_mpentry_t *)) {
+                   btc_hashset_t *set) {
   const btc_tx_t *tx = entry->tx;
   size_t i;
 
@@ -691,13 +1426,10 @@ traverse_ancestors(btc_mempool_t *mp,
 
     btc_hashset_put(set, parent->hash);
 
-    if (map != NULL)
-      map(parent, child);
-
     if (btc_hashset_size(set) > BTC_MEMPOOL_MAX_ANCESTORS)
       break;
 
-    traverse_ancestors(mp, parent, set, child, map);
+    traverse_ancestors(mp, parent, set);
 
     if (btc_hashset_size(set) > BTC_MEMPOOL_MAX_ANCESTORS)
       break;
@@ -707,583 +1439,2321 @@ traverse_ancestors(btc_mempool_t *mp,
 }
 
 static size_t
-btc_mempool_update_ancestors(btc_mempool_t *mp,
-                             const btc_mpentry_t *entry,
-                             void (*map)(btc_mpentry_t *,
-                                         const btc_mpentry_t *)) {
+btc_mempool_count_ancestors(btc_mempool_t *mp,
+                            const btc_mpentry_t *entry) {
   btc_hashset_t *set = btc_hashset_create();
-  size_t count = traverse_ancestors(mp, entry, set, entry, map);
+  size_t count = traverse_ancestors(mp, entry, set);
 
   btc_hashset_destroy(set);
 
   return count;
 }
 
-static size_t
-btc_mempool_count_ancestors(btc_mempool_t *mp,
-                            const btc_mpentry_t *entry) {
-  return btc_mempool_update_ancestors(mp, entry, NULL);
-}
+static void
+btc_mempool_neighbors(btc_mempool_t *mp,
+                      btc_vector_t *out,
+                      const btc_mpentry_t *entry) {
+  const btc_tx_t *tx = entry->tx;
+  btc_mpentry_t *item;
+  btc_outpoint_t prevout;
+  size_t i, j;
 
-static int
-btc_mempool_exists(btc_mempool_t *mp, const uint8_t *hash) {
-  if (btc_hashmap_has(mp->orphans, hash))
-    return 1;
+  btc_vector_reset(out);
 
-  return btc_hashmap_has(mp->map, hash);
-}
+  for (i = 0; i < tx->inputs.length + tx->outputs.length; i++) {
+    if (i < tx->inputs.length) {
+      item = btc_hashmap_get(mp->map, tx->inputs.items[i]->prevout.hash);
+    } else {
+      /* Re-added block txs may already have spenders. */
+      btc_outpoint_set(&prevout, entry->hash, i - tx->inputs.length);
 
-static int
-btc_mempool_is_double_spend(btc_mempool_t *mp, const btc_tx_t *tx) {
-  size_t i;
+      item = btc_prevmap_get(mp->spents, &prevout);
+    }
 
-  for (i = 0; i < tx->inputs.length; i++) {
-    const btc_input_t *input = tx->inputs.items[i];
+    if (item == NULL || item == entry)
+      continue;
 
-    if (btc_outmap_has(mp->spents, &input->prevout))
-      return 1;
-  }
+    for (j = 0; j < out->length; j++) {
+      if (out->items[j] == item->_cluster)
+        break;
+    }
 
-  return 0;
+    if (j == out->length)
+      btc_vector_push(out, item->_cluster);
+  }
 }
 
-static void
-btc_mempool_track_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
-  const btc_tx_t *tx = entry->tx;
+static size_t
+btc_mempool_joined_size(btc_mempool_t *mp, const btc_mpentry_t *entry) {
+  size_t total = 1;
+  btc_vector_t list;
   size_t i;
 
-  CHECK(!btc_tx_is_coinbase(tx));
-  CHECK(btc_hashmap_put(mp->map, entry->hash, entry));
-
-  for (i = 0; i < tx->inputs.length; i++) {
-    const btc_input_t *input = tx->inputs.items[i];
-
-    btc_outmap_put(mp->spents, &input->prevout, entry);
-  }
+  btc_vector_init(&list);
 
-  mp->size += entry->size;
-}
+  btc_mempool_neighbors(mp, &list, entry);
 
-static void
-btc_mempool_add_entry(btc_mempool_t *mp,
-                      btc_mpentry_t *entry,
-                      const btc_view_t *view) {
-  btc_mempool_track_entry(mp, entry);
-  btc_mempool_update_ancestors(mp, entry, add_fee);
+  for (i = 0; i < list.length; i++) {
+    const btc_mpcluster_t *cluster = list.items[i];
 
-  if (mp->on_tx != NULL)
-    mp->on_tx(entry, view, mp->arg);
+    total += cluster->length;
+  }
 
-  btc_mempool_log(mp, "Added %H to mempool (txs=%zu).",
-                      entry->hash, btc_hashmap_size(mp->map));
+  btc_vector_clear(&list);
 
-  btc_mempool_handle_orphans(mp, entry->hash);
+  return total;
 }
 
-static void
-btc_mempool_untrack_entry(btc_mempool_t *mp,
-                          const btc_mpentry_t *entry) {
+static uint64_t
+btc_mempool_parents(btc_mempool_t *mp, const btc_mpentry_t *entry) {
   const btc_tx_t *tx = entry->tx;
+  const btc_mpentry_t *parent;
+  uint64_t mask = 0;
   size_t i;
 
-  CHECK(!btc_tx_is_coinbase(tx));
-  CHECK(btc_hashmap_del(mp->map, entry->hash));
-
   for (i = 0; i < tx->inputs.length; i++) {
-    const btc_input_t *input = tx->inputs.items[i];
+    parent = btc_hashmap_get(mp->map, tx->inputs.items[i]->prevout.hash);
 
-    CHECK(btc_outmap_del(mp->spents, &input->prevout));
+    if (parent != NULL && parent->_cluster == entry->_cluster)
+      mask |= BIT(parent->_pos);
   }
 
-  mp->size -= entry->size;
-}
-
-static void
-btc_mempool_remove_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
-  btc_mempool_untrack_entry(mp, entry);
-  btc_mpentry_destroy(entry);
+  return mask;
 }
 
 static void
-btc_mempool_remove_spenders(btc_mempool_t *mp,
-                            const btc_mpentry_t *entry) {
-  btc_mpentry_t *spender;
-  btc_outpoint_t prevout;
-  size_t i;
+btc_mempool_chunk(btc_mempool_t *mp, btc_mpcluster_t *cluster) {
+  size_t ends[BTC_MEMPOOL_MAX_CLUSTER];
+  int64_t fees[BTC_MEMPOOL_MAX_CLUSTER];
+  int64_t sizes[BTC_MEMPOOL_MAX_CLUSTER];
+  size_t i, j, n = 0;
+
+  CHECK(cluster->length <= BTC_MEMPOOL_MAX_CLUSTER);
+
+  /* A tx joins the chunk before it for as long as
+     it pays at least as well. Chunk feerates are
+     strictly decreasing as a result. */
+  for (i = 0; i < cluster->length; i++) {
+    const btc_mpentry_t *entry = cluster->items[i];
+
+    fees[n] = entry->delta_fee;
+    sizes[n] = entry->size;
+    ends[n] = i + 1;
+    n++;
+
+    while (n > 1 && fees[n - 1] * sizes[n - 2] >= fees[n - 2] * sizes[n - 1]) {
+      fees[n - 2] += fees[n - 1];
+      sizes[n - 2] += sizes[n - 1];
+      ends[n - 2] = ends[n - 1];
+      n--;
+    }
+  }
 
-  for (i = 0; i < entry->tx->outputs.length; i++) {
-    btc_outpoint_set(&prevout, entry->hash, i);
+  for (i = 0, j = 0; i < cluster->length; i++) {
+    btc_mpentry_t *entry = cluster->items[i];
 
-    spender = btc_outmap_get(mp->spents, &prevout);
+    if (i == ends[j])
+      j++;
 
-    if (spender == NULL)
-      continue;
+    entry->_cluster = cluster;
+    entry->_pos = i;
+    entry->_chunk = ends[j];
+    entry->chunk_fee = fees[j];
+    entry->chunk_size = sizes[j];
 
-    btc_mempool_remove_spenders(mp, spender);
-    btc_mempool_remove_entry(mp, spender);
+    btc_mpheap_fix(&mp->by_rate, entry);
   }
 }
 
 static void
-btc_mempool_evict_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
-  btc_mempool_remove_spenders(mp, entry);
-  btc_mempool_update_ancestors(mp, entry, remove_fee);
-  btc_mempool_remove_entry(mp, entry);
-}
+btc_mempool_linearize(btc_mempool_t *mp, btc_mpcluster_t *cluster) {
+  btc_mpentry_t *order[BTC_MEMPOOL_MAX_CLUSTER];
+  uint64_t parents[BTC_MEMPOOL_MAX_CLUSTER];
+  uint64_t anc[BTC_MEMPOOL_MAX_CLUSTER];
+  int64_t fee[BTC_MEMPOOL_MAX_CLUSTER];
+  int64_t size[BTC_MEMPOOL_MAX_CLUSTER];
+  size_t topo[BTC_MEMPOOL_MAX_CLUSTER];
+  btc_mpentry_t **items = cluster->items;
+  size_t n = cluster->length;
+  uint64_t done, left, set;
+  size_t i, j, k, t, best;
+
+  CHECK(n <= BTC_MEMPOOL_MAX_CLUSTER);
+
+  for (i = 0; i < n; i++)
+    items[i]->_pos = i;
+
+  for (i = 0; i < n; i++)
+    parents[i] = btc_mempool_parents(mp, items[i]);
+
+  /* Sort topologically, collecting ancestor sets. */
+  done = 0;
+  k = 0;
+
+  while (k < n) {
+    for (i = 0; i < n; i++) {
+      if ((done & BIT(i)) || (parents[i] & ~done))
+        continue;
 
-static void
-btc_mempool_remove_double_spends(btc_mempool_t *mp, const btc_tx_t *tx) {
-  size_t i;
+      anc[i] = BIT(i);
 
-  for (i = 0; i < tx->inputs.length; i++) {
-    const btc_input_t *input = tx->inputs.items[i];
-    btc_mpentry_t *spent = btc_outmap_get(mp->spents, &input->prevout);
+      for (j = 0; j < n; j++) {
+        if (parents[i] & BIT(j))
+          anc[i] |= anc[j];
+      }
 
-    if (spent == NULL)
-      continue;
+      done |= BIT(i);
+      topo[k++] = i;
+    }
+  }
 
-    btc_mempool_log(mp, "Removing double spender from mempool: %H.",
-                        spent->hash);
+  for (i = 0; i < n; i++) {
+    fee[i] = 0;
+    size[i] = 0;
 
-    btc_mempool_evict_entry(mp, spent);
+    for (j = 0; j < n; j++) {
+      if (anc[i] & BIT(j)) {
+        fee[i] += items[j]->delta_fee;
+        size[i] += items[j]->size;
+      }
+    }
   }
-}
 
-static int
-btc_mempool_has_dependencies(btc_mempool_t *mp, const btc_tx_t *tx) {
-  size_t i;
+  /* Repeatedly take the ancestor set with the best
+     feerate out of what is left. The sums are kept
+     up to date, so this is quadratic overall. */
+  left = done;
+  k = 0;
 
-  for (i = 0; i < tx->inputs.length; i++) {
-    const btc_input_t *input = tx->inputs.items[i];
+  while (left != 0) {
+    best = n;
 
-    if (btc_hashmap_has(mp->map, input->prevout.hash))
-      return 1;
-  }
+    for (i = 0; i < n; i++) {
+      if (!(left & BIT(i)))
+        continue;
 
-  return 0;
-}
+      if (best == n
+          || fee[i] * size[best] > fee[best] * size[i]
+          || (fee[i] * size[best] == fee[best] * size[i]
+              && size[i] < size[best])) {
+        best = i;
+      }
+    }
 
-static int
-use_desc(const btc_mpentry_t *a) {
-  int64_t x = a->delta_fee * a->desc_size;
-  int64_t y = a->desc_fee * a->size;
-  return y > x;
-}
+    set = anc[best] & left;
+    left &= ~set;
 
-static int64_t
-cmp_rate(const void *ap, const void *bp) {
-  const btc_mpentry_t *a = ap;
-  const btc_mpentry_t *b = bp;
+    for (j = 0; j < n; j++) {
+      t = topo[j];
 
-  int64_t xf = a->delta_fee;
-  int64_t xs = a->size;
-  int64_t yf = b->delta_fee;
-  int64_t ys = b->size;
-  int64_t x, y;
+      if (!(set & BIT(t)))
+        continue;
 
-  if (use_desc(a)) {
-    xf = a->desc_fee;
-    xs = a->desc_size;
-  }
+      order[k++] = items[t];
 
-  if (use_desc(b)) {
-    yf = b->desc_fee;
-    ys = b->desc_size;
+      for (i = 0; i < n; i++) {
+        if ((left & BIT(i)) && (anc[i] & BIT(t))) {
+          fee[i] -= items[t]->delta_fee;
+          size[i] -= items[t]->size;
+        }
+      }
+    }
   }
 
-  x = xf * ys;
-  y = xs * yf;
-
-  if (x == y) {
-    x = a->time;
-    y = b->time;
-  }
+  memcpy(items, order, n * sizeof(btc_mpentry_t *));
 
-  return x - y;
+  btc_mempool_chunk(mp, cluster);
 }
 
-static int
-btc_mempool_limit_size(btc_mempool_t *mp, const uint8_t *added) {
-  btc_hashmapiter_t iter;
-  btc_vector_t queue;
-  int64_t now;
+static void
+btc_mempool_join(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  btc_mpcluster_t *target = NULL;
+  btc_vector_t list;
+  size_t i, j;
 
-  if (mp->size <= BTC_MEMPOOL_MAX_SIZE)
-    return 0;
+  btc_vector_init(&list);
 
-  now = btc_now();
+  btc_mempool_neighbors(mp, &list, entry);
 
-  btc_vector_init(&queue);
+  /* Union by size: the largest cluster absorbs the rest. */
+  for (i = 0; i < list.length; i++) {
+    btc_mpcluster_t *cluster = list.items[i];
 
-  btc_hashmap_iterate(&iter, mp->map);
+    if (target == NULL || cluster->length > target->length)
+      target = cluster;
+  }
 
-  while (btc_hashmap_next(&iter)) {
-    btc_mpentry_t *entry = iter.val;
+  if (target == NULL)
+    target = btc_mpcluster_create();
 
-    if (btc_mempool_has_dependencies(mp, entry->tx))
-      continue;
+  for (i = 0; i < list.length; i++) {
+    btc_mpcluster_t *cluster = list.items[i];
 
-    if (now < entry->time + BTC_MEMPOOL_EXPIRY_TIME) {
-      btc_heap_insert(&queue, entry, cmp_rate);
+    if (cluster == target)
       continue;
-    }
-
-    btc_mempool_log(mp, "Removing package %H from mempool (too old).",
-                        entry->hash);
 
-    btc_mempool_evict_entry(mp, entry);
-  }
+    for (j = 0; j < cluster->length; j++)
+      btc_mpcluster_push(target, cluster->items[j]);
 
-  if (mp->size <= BTC_MEMPOOL_THRESHOLD) {
-    btc_vector_clear(&queue);
-    return !btc_hashmap_has(mp->map, added);
+    btc_mpcluster_destroy(cluster);
   }
 
-  while (queue.length > 0) {
-    btc_mpentry_t *entry = btc_heap_shift(&queue, cmp_rate);
+  btc_mpcluster_push(target, entry);
 
-    btc_mempool_log(mp, "Removing package %H from mempool (low fee).",
-                        entry->hash);
+  btc_vector_clear(&list);
 
-    btc_mempool_evict_entry(mp, entry);
+  btc_mempool_linearize(mp, target);
+}
 
-    if (mp->size <= BTC_MEMPOOL_THRESHOLD)
-      break;
+static size_t
+uf_find(size_t *up, size_t i) {
+  while (up[i] != i) {
+    up[i] = up[up[i]];
+    i = up[i];
   }
+  return i;
+}
 
-  btc_vector_clear(&queue);
+static void
+btc_mempool_split(btc_mempool_t *mp, btc_mpcluster_t *cluster) {
+  btc_mpcluster_t *parts[BTC_MEMPOOL_MAX_CLUSTER];
+  btc_mpentry_t *items[BTC_MEMPOOL_MAX_CLUSTER];
+  size_t up[BTC_MEMPOOL_MAX_CLUSTER];
+  size_t n = cluster->length;
+  size_t i, j, x, y;
+  uint64_t mask;
+  int split = 0;
+
+  for (i = 0; i < n; i++)
+    up[i] = i;
+
+  for (i = 0; i < n; i++) {
+    mask = btc_mempool_parents(mp, cluster->items[i]);
+
+    for (j = 0; j < n; j++) {
+      if (!(mask & BIT(j)))
+        continue;
 
-  return !btc_hashmap_has(mp->map, added);
-}
+      x = uf_find(up, i);
+      y = uf_find(up, j);
 
-/*
- * TX Handling
- */
+      /* The lowest position is the root. */
+      if (x < y)
+        up[y] = x;
+      else
+        up[x] = y;
+    }
+  }
 
-static int
-btc_mempool_verify_inputs(btc_mempool_t *mp,
-                          const btc_mpentry_t *entry,
-                          const btc_view_t *view,
-                          unsigned int flags) {
-  const btc_tx_t *tx = entry->tx;
+  for (i = 0; i < n; i++) {
+    parts[i] = NULL;
 
-  if (btc_tx_verify(tx, view, flags))
+    if (uf_find(up, i) != 0)
+      split = 1;
+  }
+
+  if (!split) {
+    btc_mempool_chunk(mp, cluster);
+    return;
+  }
+
+  /* Each component keeps its relative order,
+     which is still a valid linearization. */
+  memcpy(items, cluster->items, n * sizeof(btc_mpentry_t *));
+
+  cluster->length = 0;
+
+  for (i = 0; i < n; i++) {
+    x = uf_find(up, i);
+
+    if (parts[x] == NULL)
+      parts[x] = x == 0 ? cluster : btc_mpcluster_create();
+
+    btc_mpcluster_push(parts[x], items[i]);
+  }
+
+  for (i = 0; i < n; i++) {
+    if (parts[i] != NULL)
+      btc_mempool_chunk(mp, parts[i]);
+  }
+}
+
+static void
+btc_mempool_leave(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  btc_mpcluster_t *cluster = entry->_cluster;
+  size_t i;
+
+  for (i = entry->_pos + 1; i < cluster->length; i++) {
+    cluster->items[i - 1] = cluster->items[i];
+    cluster->items[i - 1]->_pos = i - 1;
+  }
+
+  cluster->length--;
+
+  entry->_cluster = NULL;
+
+  if (cluster->length == 0)
+    btc_mpcluster_destroy(cluster);
+  else
+    btc_mempool_split(mp, cluster);
+}
+
+static int
+btc_mempool_exists(btc_mempool_t *mp, const uint8_t *hash) {
+  if (btc_hashmap_has(mp->orphans, hash))
     return 1;
 
-  if (flags & BTC_SCRIPT_ONLY_STANDARD_VERIFY_FLAGS) {
-    flags &= ~BTC_SCRIPT_ONLY_STANDARD_VERIFY_FLAGS;
+  return btc_hashmap_has(mp->map, hash);
+}
 
-    if (btc_tx_verify(tx, view, flags)) {
-      return btc_mempool_throw(mp, tx,
-                               "invalid",
-                               "non-mandatory-script-verify-flag",
-                               0,
-                               0);
-    }
+static int
+btc_mempool_is_double_spend(btc_mempool_t *mp, const btc_tx_t *tx) {
+  size_t i;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    if (btc_prevmap_has(mp->spents, &input->prevout))
+      return 1;
   }
 
-  return btc_mempool_throw(mp, tx,
-                           "invalid",
-                           "mandatory-script-verify-flag-failed",
-                           100,
-                           0);
+  return 0;
 }
 
 static int
-btc_mempool_verify(btc_mempool_t *mp,
-                   const btc_mpentry_t *entry,
-                   const btc_view_t *view) {
-  unsigned int lock_flags = BTC_STANDARD_LOCKTIME_FLAGS;
-  const btc_deployment_state_t *state = btc_chain_state(mp->chain);
-  const btc_entry_t *tip = btc_chain_tip(mp->chain);
-  int32_t height = tip->height + 1;
+btc_mempool_check_replacement(btc_mempool_t *mp,
+                              const btc_mpentry_t *entry) {
+  int64_t minfee = btc_get_min_fee(entry->size, mp->network->min_relay);
+  btc_hashset_t *parents = btc_hashset_create();
+  btc_hashset_t *seen = btc_hashset_create();
   const btc_tx_t *tx = entry->tx;
-  btc_verify_error_t err;
-  unsigned int flags;
-  int64_t minfee;
+  const char *reason = NULL;
+  btc_mpentry_t *spender;
+  btc_outpoint_t prevout;
+  btc_vector_t stack;
+  int64_t fee = 0;
+  size_t i, j;
 
-  /* Verify sequence locks. */
-  if (!btc_chain_verify_locks(mp->chain, tip, tx, view, lock_flags)) {
-    return btc_mempool_throw(mp, tx,
-                             "nonstandard",
-                             "non-BIP68-final",
-                             0,
-                             0);
+  btc_vector_init(&stack);
+
+  /* Direct conflicts must opt in and pay less per byte
+     than the chunk they would be mined in. */
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    spender = btc_prevmap_get(mp->spents, &input->prevout);
+
+    if (spender == NULL)
+      continue;
+
+    if (!btc_hashset_put(seen, spender->hash))
+      continue;
+
+    if (!btc_tx_is_rbf(spender->tx)) {
+      reason = "txn-mempool-conflict";
+      goto done;
+    }
+
+    if (entry->fee * spender->chunk_size
+        <= spender->chunk_fee * entry->size) {
+      reason = "insufficient-replacement-fee";
+      goto done;
+    }
+
+    for (j = 0; j < spender->tx->inputs.length; j++) {
+      const uint8_t *hash = spender->tx->inputs.items[j]->prevout.hash;
+
+      if (btc_hashmap_has(mp->map, hash))
+        btc_hashset_put(parents, (uint8_t *)hash);
+    }
+
+    btc_vector_push(&stack, spender);
   }
 
-  /* Check input and witness standardness. */
-  if (mp->network->require_standard) {
-    if (!btc_tx_has_standard_inputs(tx, view)) {
-      return btc_mempool_throw(mp, tx,
-                               "nonstandard",
-                               "bad-txns-nonstandard-inputs",
-                               0,
-                               0);
+  /* Walk their descendants, but only so far. The
+     visited set is capped, so an adversarial chain
+     costs us no more than the cap. */
+  while (stack.length > 0) {
+    const btc_mpentry_t *item = btc_vector_pop(&stack);
+
+    fee += item->fee;
+
+    if (btc_hashset_size(seen) > BTC_MEMPOOL_MAX_REPLACEMENTS) {
+      reason = "too-many-replacements";
+      goto done;
     }
 
-    if (state->flags & BTC_SCRIPT_VERIFY_WITNESS) {
-      if (!btc_tx_has_standard_witness(tx, view)) {
-        return btc_mempool_throw(mp, tx,
-                                 "nonstandard",
-                                 "bad-witness-nonstandard",
-                                 0,
-                                 1);
-      }
+    for (i = 0; i < item->tx->outputs.length; i++) {
+      btc_outpoint_set(&prevout, item->hash, i);
+
+      spender = btc_prevmap_get(mp->spents, &prevout);
+
+      if (spender != NULL && btc_hashset_put(seen, spender->hash))
+        btc_vector_push(&stack, spender);
     }
   }
 
-  /* Annoying process known as sigops counting. */
-  if (entry->sigops > BTC_MAX_TX_SIGOPS_COST) {
-    return btc_mempool_throw(mp, tx,
-                             "nonstandard",
-                             "bad-txns-too-many-sigops",
-                             0,
-                             0);
+  for (i = 0; i < tx->inputs.length; i++) {
+    const uint8_t *hash = tx->inputs.items[i]->prevout.hash;
+
+    if (btc_hashset_has(seen, hash)) {
+      reason = "bad-txns-spends-conflicting-tx";
+      goto done;
+    }
+
+    /* No unconfirmed inputs the originals didn't have. */
+    if (btc_hashmap_has(mp->map, hash) && !btc_hashset_has(parents, hash)) {
+      reason = "replacement-adds-unconfirmed";
+      goto done;
+    }
   }
 
-  /* Make sure this guy gave a decent fee. */
-  minfee = btc_get_min_fee(entry->size, mp->network->min_relay);
+  /* Pay for everything evicted, plus our own relay. */
+  if (entry->fee < fee + minfee)
+    reason = "insufficient-replacement-fee";
+
+done:
+  btc_vector_clear(&stack);
+  btc_hashset_destroy(parents);
+  btc_hashset_destroy(seen);
 
-  if (entry->fee < minfee) {
+  if (reason != NULL) {
     return btc_mempool_throw(mp, tx,
                              "insufficientfee",
-                             "insufficient fee",
+                             reason,
                              0,
                              0);
   }
 
-  /* Important safety feature. */
-  if (entry->fee > minfee * 10000) {
-    return btc_mempool_throw(mp, tx,
-                             "highfee",
-                             "absurdly-high-fee",
-                             0,
-                             0);
+  return 1;
+}
+
+static void
+btc_mempool_push_wtxid(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  struct btc_mpwtxids_s *z = &mp->wtxids;
+
+  if (z->length == z->alloc) {
+    z->alloc = z->alloc == 0 ? 64 : z->alloc * 2;
+    z->hashes = (uint8_t *)btc_realloc(z->hashes, z->alloc * 32);
+    z->entries = (const btc_mpentry_t **)btc_realloc(z->entries,
+                                                     z->alloc * sizeof(void *));
   }
 
-  /* Check ancestor depth. */
-  if (btc_mempool_count_ancestors(mp, entry) + 1 > BTC_MEMPOOL_MAX_ANCESTORS) {
-    return btc_mempool_throw(mp, tx,
-                             "nonstandard",
-                             "too-long-mempool-chain",
-                             0,
-                             0);
+  memcpy(z->hashes + z->length * 32, entry->whash, 32);
+
+  z->entries[z->length] = entry;
+
+  entry->_index = z->length++;
+}
+
+static void
+btc_mempool_remove_wtxid(btc_mempool_t *mp, const btc_mpentry_t *entry) {
+  struct btc_mpwtxids_s *z = &mp->wtxids;
+  size_t i = entry->_index;
+  btc_mpentry_t *last;
+
+  CHECK(i < z->length && z->entries[i] == entry);
+
+  last = (btc_mpentry_t *)z->entries[--z->length];
+
+  if (last != entry) {
+    memcpy(z->hashes + i * 32, z->hashes + z->length * 32, 32);
+
+    z->entries[i] = last;
+
+    last->_index = i;
   }
+}
 
-  /* Contextual sanity checks. */
-  if (btc_tx_check_inputs(&err, tx, view, height) == -1) {
-    return btc_mempool_throw(mp, tx,
-                             "invalid",
-                             err.reason,
-                             err.score,
-                             0);
+static int
+is_fragile(const btc_mpentry_t *entry) {
+  const btc_tx_t *tx = entry->tx;
+  size_t i;
+
+  /* Coinbase maturity and relative locks
+     depend on the heights of our coins. */
+  if (entry->coinbase || entry->locks)
+    return 1;
+
+  if (tx->locktime == 0)
+    return 0;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    if (tx->inputs.items[i]->sequence != 0xffffffff)
+      return 1;
+  }
+
+  return 0;
+}
+
+static void
+btc_mempool_track_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  const btc_tx_t *tx = entry->tx;
+  size_t i;
+
+  CHECK(!btc_tx_is_coinbase(tx));
+  CHECK(btc_hashmap_put(mp->map, entry->hash, entry));
+  CHECK(btc_hashmap_put(mp->wmap, entry->whash, entry));
+
+  btc_mempool_push_wtxid(mp, entry);
+
+  btc_mpheap_insert(&mp->by_rate, entry);
+  btc_mpheap_insert(&mp->by_time, entry);
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    btc_prevmap_put(mp->spents, &input->prevout, entry);
+  }
+
+  btc_mempool_join(mp, entry);
+
+  if (is_fragile(entry))
+    btc_hashset_put(mp->fragile, entry->hash);
+
+  mp->usage += btc_mpentry_usage(entry);
+}
+
+static void
+btc_mempool_publish_entry(btc_mempool_t *mp,
+                          const btc_mpentry_t *entry,
+                          const btc_view_t *view) {
+  btc_mempool_remove_lowfee(mp, entry->hash);
+
+  if (mp->on_tx != NULL)
+    mp->on_tx(entry, view, mp->arg);
+
+  btc_mempool_debug(mp, "Added %H to mempool (txs=%zu).",
+                    entry->hash, btc_hashmap_size(mp->map));
+
+  /* Track time-to-confirm once we're caught up. */
+  if (btc_chain_synced(mp->chain)) {
+    btc_fees_add_tx(mp->fees, entry->hash, entry->height,
+                    btc_get_rate(entry->size, entry->fee));
   }
+}
+
+static void
+btc_mempool_add_entry(btc_mempool_t *mp,
+                      btc_mpentry_t *entry,
+                      const btc_view_t *view) {
+  btc_mempool_track_entry(mp, entry);
+  btc_mempool_publish_entry(mp, entry, view);
+  btc_mempool_handle_orphans(mp, entry->tx);
+}
+
+static void
+btc_mempool_untrack_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  const btc_tx_t *tx = entry->tx;
+  size_t i;
+
+  CHECK(!btc_tx_is_coinbase(tx));
+  CHECK(btc_hashmap_del(mp->map, entry->hash));
+  CHECK(btc_hashmap_del(mp->wmap, entry->whash));
+
+  btc_mempool_remove_wtxid(mp, entry);
+
+  btc_mpheap_remove(&mp->by_rate, entry);
+  btc_mpheap_remove(&mp->by_time, entry);
+
+  btc_mempool_leave(mp, entry);
+
+  btc_fees_remove_tx(mp->fees, entry->hash);
+
+  btc_hashset_del(mp->fragile, entry->hash);
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    CHECK(btc_prevmap_del(mp->spents, &input->prevout));
+  }
+
+  mp->usage -= btc_mpentry_usage(entry);
+}
+
+static void
+btc_mempool_remove_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  btc_mempool_untrack_entry(mp, entry);
+  btc_mpentry_destroy(entry);
+}
+
+static void
+btc_mempool_remove_spenders(btc_mempool_t *mp,
+                            const btc_mpentry_t *entry) {
+  btc_mpentry_t *spender;
+  btc_outpoint_t prevout;
+  size_t i;
+
+  for (i = 0; i < entry->tx->outputs.length; i++) {
+    btc_outpoint_set(&prevout, entry->hash, i);
+
+    spender = btc_prevmap_get(mp->spents, &prevout);
+
+    if (spender == NULL)
+      continue;
+
+    btc_mempool_remove_spenders(mp, spender);
+    btc_mempool_remove_entry(mp, spender);
+  }
+}
+
+static void
+btc_mempool_evict_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  btc_mempool_remove_spenders(mp, entry);
+  btc_mempool_remove_entry(mp, entry);
+}
+
+static void
+btc_mempool_remove_double_spends(btc_mempool_t *mp, const btc_tx_t *tx) {
+  size_t i;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+    btc_mpentry_t *spent = btc_prevmap_get(mp->spents, &input->prevout);
+
+    if (spent == NULL)
+      continue;
+
+    btc_mempool_debug(mp, "Removing double spender from mempool: %H.",
+                      spent->hash);
+
+    btc_mempool_evict_entry(mp, spent);
+  }
+}
+
+static void
+btc_mempool_evict_chunk(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  btc_mpentry_t *items[BTC_MEMPOOL_MAX_CLUSTER];
+  btc_mpcluster_t *cluster = entry->_cluster;
+  size_t start = entry->_pos;
+  size_t end = entry->_chunk;
+  size_t i;
+
+  /* The worst chunk is always last in its cluster, so
+     nothing outside of it depends on it. Children come
+     after their parents and are removed first. */
+  CHECK(end == cluster->length);
+
+  while (start > 0 && cluster->items[start - 1]->_chunk == end)
+    start--;
+
+  for (i = start; i < end; i++)
+    items[i - start] = cluster->items[i];
+
+  for (i = end - start; i-- > 0;)
+    btc_mempool_remove_entry(mp, items[i]);
+}
+
+static void
+btc_mempool_bump_rate(btc_mempool_t *mp, int64_t rate) {
+  if (rate <= mp->min_rate)
+    return;
+
+  btc_mempool_debug(mp, "Raising mempool min fee to %v/kvB.", rate);
+
+  mp->min_rate = rate;
+  mp->min_time = btc_now();
+  mp->min_decay = 0;
+}
+
+static int
+btc_mempool_limit_size(btc_mempool_t *mp, const uint8_t *added) {
+  btc_mpentry_t *entry;
+  int64_t rate = 0;
+  int64_t now;
+
+  if (mp->usage <= BTC_MEMPOOL_MAX_SIZE)
+    return 0;
+
+  now = btc_now();
+
+  while ((entry = btc_mpheap_peek(&mp->by_time)) != NULL) {
+    if (now < entry->time + BTC_MEMPOOL_EXPIRY_TIME)
+      break;
+
+    btc_mempool_debug(mp, "Removing package %H from mempool (too old).",
+                      entry->hash);
+
+    btc_mempool_evict_entry(mp, entry);
+  }
+
+  while (mp->usage > BTC_MEMPOOL_THRESHOLD) {
+    entry = btc_mpheap_peek(&mp->by_rate);
+
+    CHECK(entry != NULL);
+
+    btc_mempool_debug(mp, "Removing chunk %H from mempool (low fee).",
+                      entry->hash);
+
+    /* Anything paying no more than this would just
+       be evicted again. Demand a relay fee on top. */
+    if (btc_get_rate(entry->chunk_size, entry->chunk_fee) > rate)
+      rate = btc_get_rate(entry->chunk_size, entry->chunk_fee);
+
+    btc_mempool_evict_chunk(mp, entry);
+  }
+
+  if (rate > 0)
+    btc_mempool_bump_rate(mp, rate + mp->network->min_relay);
+
+  return !btc_hashmap_has(mp->map, added);
+}
+
+/*
+ * TX Handling
+ */
+
+enum btc_mpscript {
+  BTC_MPSCRIPT_OK = 0,
+  BTC_MPSCRIPT_NONMANDATORY = 1,
+  BTC_MPSCRIPT_MANDATORY = 2,
+  BTC_MPSCRIPT_MALLEATED = 4
+};
+
+static int
+btc_mempool_check_scripts(const btc_tx_t *tx, const btc_view_t *view) {
+  /* Touches nothing but the tx and view: safe to run on a worker. */
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+  int code = BTC_MPSCRIPT_MANDATORY;
+  btc_sigbatch_t *batch;
+  int ret;
+
+  /* Standard flags include NULLFAIL, letting the ECDSA
+     checks be deferred and verified in one batch. The
+     slower paths below only run for invalid txs. */
+  batch = btc_sigbatch_create();
+
+  ret = btc_tx_verify_batch(tx, view, flags, batch)
+     && btc_sigbatch_verify(batch);
+
+  btc_sigbatch_destroy(batch);
+
+  if (ret)
+    return BTC_MPSCRIPT_OK;
+
+  if (flags & BTC_SCRIPT_ONLY_STANDARD_VERIFY_FLAGS) {
+    if (btc_tx_verify(tx, view, flags & ~BTC_SCRIPT_ONLY_STANDARD_VERIFY_FLAGS))
+      code = BTC_MPSCRIPT_NONMANDATORY;
+  }
+
+  if (btc_tx_has_witness(tx))
+    return code;
+
+  /* Try without segwit and cleanstack. */
+  flags &= ~BTC_SCRIPT_VERIFY_WITNESS;
+  flags &= ~BTC_SCRIPT_VERIFY_CLEANSTACK;
+
+  /* If it failed, the first verification
+     was the only result we needed. */
+  if (!btc_tx_verify(tx, view, flags))
+    return code;
+
+  /* If it succeeded, segwit may be causing the
+     failure. Try with segwit but without cleanstack. */
+  flags |= BTC_SCRIPT_VERIFY_WITNESS;
+
+  /* Cleanstack was causing the failure. */
+  if (btc_tx_verify(tx, view, flags))
+    return code;
+
+  return code | BTC_MPSCRIPT_MALLEATED;
+}
+
+static int
+btc_mempool_verify_scripts(btc_mempool_t *mp,
+                           const btc_tx_t *tx,
+                           const btc_view_t *view,
+                           int code) {
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+
+  if (code == BTC_MPSCRIPT_OK) {
+    /* Cache the result for block validation. */
+    btc_chain_cache_scripts(mp->chain, tx, flags);
+
+    /* Paranoid checks. */
+    if (mp->flags & BTC_MEMPOOL_PARANOID)
+      CHECK(btc_tx_verify(tx, view, BTC_SCRIPT_MANDATORY_VERIFY_FLAGS));
+
+    return 1;
+  }
+
+  if (code & BTC_MPSCRIPT_NONMANDATORY) {
+    btc_mempool_throw(mp, tx,
+                      "invalid",
+                      "non-mandatory-script-verify-flag",
+                      0,
+                      0);
+  } else {
+    btc_mempool_throw(mp, tx,
+                      "invalid",
+                      "mandatory-script-verify-flag-failed",
+                      100,
+                      0);
+  }
+
+  /* Do not insert into reject cache. */
+  if (code & BTC_MPSCRIPT_MALLEATED)
+    mp->error.malleated = 1;
+
+  return 0;
+}
+
+static int
+btc_mempool_run_scripts(btc_mempool_t *mp,
+                        const btc_tx_t *tx,
+                        const btc_view_t *view) {
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+
+  if (btc_chain_has_scripts(mp->chain, tx, flags))
+    return BTC_MPSCRIPT_OK;
+
+  return btc_mempool_check_scripts(tx, view);
+}
+
+static int
+btc_mempool_verify_context(btc_mempool_t *mp,
+                           const btc_mpentry_t *entry,
+                           const btc_view_t *view) {
+  unsigned int lock_flags = BTC_STANDARD_LOCKTIME_FLAGS;
+  const btc_deployment_state_t *state = btc_chain_state(mp->chain);
+  const btc_entry_t *tip = btc_chain_tip(mp->chain);
+  int32_t height = tip->height + 1;
+  const btc_tx_t *tx = entry->tx;
+  btc_verify_error_t err;
+  int64_t minfee, rate;
+
+  /* Make sure this guy gave a decent fee. Package
+     members are checked against the package rate. */
+  minfee = btc_get_min_fee(entry->size, mp->network->min_relay);
+
+  if (entry->fee < minfee && !mp->in_package) {
+    return btc_mempool_throw(mp, tx,
+                             "insufficientfee",
+                             "insufficient fee",
+                             0,
+                             0);
+  }
+
+  /* While we're full, anything paying less than what
+     we last evicted would only be evicted again. This
+     runs before any script does. */
+  rate = btc_mempool_min_rate(mp);
+
+  if (entry->fee < btc_get_min_fee(entry->size, rate) && !mp->in_package) {
+    return btc_mempool_throw(mp, tx,
+                             "insufficientfee",
+                             "mempool min fee not met",
+                             0,
+                             0);
+  }
+
+  /* Important safety feature. */
+  if (entry->fee > minfee * 10000) {
+    return btc_mempool_throw(mp, tx,
+                             "highfee",
+                             "absurdly-high-fee",
+                             0,
+                             0);
+  }
+
+  /* Verify sequence locks. */
+  if (!btc_chain_verify_locks(mp->chain, tip, tx, view, lock_flags)) {
+    return btc_mempool_throw(mp, tx,
+                             "nonstandard",
+                             "non-BIP68-final",
+                             0,
+                             0);
+  }
+
+  /* Check input and witness standardness. */
+  if (mp->network->require_standard) {
+    if (!btc_tx_has_standard_inputs(tx, view)) {
+      return btc_mempool_throw(mp, tx,
+                               "nonstandard",
+                               "bad-txns-nonstandard-inputs",
+                               0,
+                               0);
+    }
+
+    if (state->flags & BTC_SCRIPT_VERIFY_WITNESS) {
+      if (!btc_tx_has_standard_witness(tx, view)) {
+        return btc_mempool_throw(mp, tx,
+                                 "nonstandard",
+                                 "bad-witness-nonstandard",
+                                 0,
+                                 1);
+      }
+    }
+  }
+
+  /* Annoying process known as sigops counting. */
+  if (entry->sigops > BTC_MAX_TX_SIGOPS_COST) {
+    return btc_mempool_throw(mp, tx,
+                             "nonstandard",
+                             "bad-txns-too-many-sigops",
+                             0,
+                             0);
+  }
+
+  /* Check ancestor depth. */
+  if (btc_mempool_count_ancestors(mp, entry) + 1 > BTC_MEMPOOL_MAX_ANCESTORS) {
+    return btc_mempool_throw(mp, tx,
+                             "nonstandard",
+                             "too-long-mempool-chain",
+                             0,
+                             0);
+  }
+
+  /* Check cluster size. */
+  if (btc_mempool_joined_size(mp, entry) > BTC_MEMPOOL_MAX_CLUSTER) {
+    return btc_mempool_throw(mp, tx,
+                             "nonstandard",
+                             "too-large-cluster",
+                             0,
+                             0);
+  }
+
+  /* Contextual sanity checks. */
+  if (btc_tx_check_inputs(&err, tx, view, height) == -1) {
+    return btc_mempool_throw(mp, tx,
+                             "invalid",
+                             err.reason,
+                             err.score,
+                             0);
+  }
+
+  return 1;
+}
+
+static int
+btc_mempool_prepare(btc_mempool_t *mp,
+                    const btc_tx_t *tx,
+                    unsigned int id,
+                    btc_mpentry_t **result,
+                    btc_view_t **coins) {
+  const btc_deployment_state_t *state = btc_chain_state(mp->chain);
+  unsigned int lock_flags = BTC_STANDARD_LOCKTIME_FLAGS;
+  const btc_entry_t *tip = btc_chain_tip(mp->chain);
+  int32_t height = tip->height;
+  btc_verify_error_t err;
+  btc_mpentry_t *entry;
+  int replaces = 0;
+  btc_view_t *view;
+
+  /* Basic sanity checks. */
+  if (!btc_tx_check_sanity(&err, tx)) {
+    return btc_mempool_throw(mp, tx,
+                             "invalid",
+                             err.reason,
+                             err.score,
+                             0);
+  }
+
+  /* Coinbases are an insta-ban. */
+  if (btc_tx_is_coinbase(tx)) {
+    return btc_mempool_throw(mp, tx,
+                             "invalid",
+                             "coinbase",
+                             100,
+                             0);
+  }
+
+  /* Do not allow CSV until it's activated. */
+  if (mp->network->require_standard) {
+    if (!(state->flags & BTC_SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)) {
+      if (tx->version >= 2) {
+        return btc_mempool_throw(mp, tx,
+                                 "nonstandard",
+                                 "premature-version2-tx",
+                                 0,
+                                 0);
+      }
+    }
+  }
+
+  /* Do not allow segwit until it's activated. */
+  if (!(state->flags & BTC_SCRIPT_VERIFY_WITNESS)) {
+    if (btc_tx_has_witness(tx)) {
+      return btc_mempool_throw(mp, tx,
+                               "nonstandard",
+                               "no-witness-yet",
+                               0,
+                               1);
+    }
+  }
+
+  /* Non-contextual standardness checks. */
+  if (mp->network->require_standard) {
+    if (!btc_tx_check_standard(&err, tx)) {
+      return btc_mempool_throw(mp, tx,
+                               "invalid",
+                               err.reason,
+                               err.score,
+                               0);
+    }
+  }
+
+  /* Verify transaction finality. */
+  if (!btc_chain_verify_final(mp->chain, tip, tx, lock_flags)) {
+    return btc_mempool_throw(mp, tx,
+                             "nonstandard",
+                             "non-final",
+                             0,
+                             0);
+  }
+
+  /* We can maybe ignore this. Package members
+     may be sitting in the orphan pool. */
+  if (!mp->in_package && btc_mempool_exists(mp, tx->hash)) {
+    return btc_mempool_throw(mp, tx,
+                             "alreadyknown",
+                             "txn-already-in-mempool",
+                             0,
+                             0);
+  }
+
+  /* We can test whether this is an
+     non-fully-spent transaction on
+     the chain. */
+  if (btc_chain_has_coins(mp->chain, tx)) {
+    return btc_mempool_throw(mp, tx,
+                             "alreadyknown",
+                             "txn-already-known",
+                             0,
+                             0);
+  }
+
+  /* Quick and dirty test to verify we're
+     not double-spending an output in the
+     mempool. Replacements are evaluated
+     once we know the fee. */
+  if (btc_mempool_is_double_spend(mp, tx)) {
+    if (mp->in_package) {
+      return btc_mempool_throw(mp, tx,
+                               "duplicate",
+                               "bad-txns-inputs-spent",
+                               0,
+                               0);
+    }
+
+    replaces = 1;
+  }
+
+  /* Get coin viewpoint as it pertains to the mempool. */
+  view = btc_mempool_view(mp, tx);
+
+  /* Maybe store as an orphan. */
+  if (!btc_tx_has_coins(tx, view)) {
+    /* Packages must be complete. */
+    if (mp->in_package) {
+      btc_view_destroy(view);
+      return btc_mempool_fail(mp, tx,
+                              "invalid",
+                              "missing-inputs",
+                              0,
+                              0);
+    }
+
+    /* The parents may have been too cheap alone. */
+    if (btc_mempool_bump_parents(mp, tx, view, id)) {
+      btc_view_destroy(view);
+
+      *result = NULL;
+      *coins = NULL;
+
+      return 1;
+    }
+
+    /* Preliminary orphan checks. */
+    if (!btc_mempool_check_orphan(mp, tx, view)) {
+      btc_view_destroy(view);
+      return 0;
+    }
+
+    btc_mempool_add_orphan(mp, tx, view, id);
+    btc_view_destroy(view);
+
+    *result = NULL;
+    *coins = NULL;
+
+    return 1;
+  }
+
+  /* Computed here, before any worker sees the tx,
+     and shared with block validation later on. */
+  btc_tx_precompute(tx, view);
+
+  /* Create a new mempool entry at current chain height. */
+  entry = btc_mpentry_create();
+
+  btc_mpentry_set(entry, tx, view, height);
+
+  /* Contextual verification (minus scripts). */
+  if (!btc_mempool_verify_context(mp, entry, view)) {
+    btc_view_destroy(view);
+    btc_mpentry_destroy(entry);
+    return 0;
+  }
+
+  /* BIP125 replacement rules. */
+  if (replaces && !btc_mempool_check_replacement(mp, entry)) {
+    btc_view_destroy(view);
+    btc_mpentry_destroy(entry);
+    return 0;
+  }
+
+  *result = entry;
+  *coins = view;
+
+  return 1;
+}
+
+static int
+btc_mempool_finish(btc_mempool_t *mp,
+                   btc_mpentry_t *entry,
+                   btc_view_t *view,
+                   int code) {
+  const btc_tx_t *tx = entry->tx;
+
+  /* Script verification. */
+  if (!btc_mempool_verify_scripts(mp, tx, view, code)) {
+    btc_view_destroy(view);
+    btc_mpentry_destroy(entry);
+    return 0;
+  }
+
+  /* Evict whatever we replace. */
+  btc_mempool_remove_double_spends(mp, tx);
+
+  /* Add and index the entry. */
+  btc_mempool_add_entry(mp, entry, view);
+  btc_view_destroy(view);
+
+  /* Trim size if we're too big. */
+  if (btc_mempool_limit_size(mp, tx->hash)) {
+    return btc_mempool_throw(mp, tx,
+                             "insufficientfee",
+                             "mempool full",
+                             0,
+                             0);
+  }
+
+  return 1;
+}
+
+static int
+btc_mempool__insert(btc_mempool_t *mp,
+                    const btc_tx_t *tx,
+                    unsigned int id,
+                    int64_t time,
+                    int trusted) {
+  int64_t start = btc_time_nsec();
+  int64_t mark, now;
+  btc_mpentry_t *entry;
+  btc_view_t *view;
+  int code, ret;
+
+  BTC_TRACE_BEGIN("mempool", "accept_tx");
+
+  if (!btc_mempool_prepare(mp, tx, id, &entry, &view)) {
+    BTC_TRACE_END("mempool", "accept_tx");
+    return 0;
+  }
+
+  if (entry == NULL) {
+    BTC_TRACE_END("mempool", "accept_tx");
+    return 1;
+  }
+
+  mark = btc_time_nsec();
+
+  btc_perf_record(mp->perf, BTC_PERF_TX_CHECK, mark - start);
+
+  /* Restored entries keep their original age. */
+  if (time != 0)
+    entry->time = time;
+
+  if (trusted)
+    code = BTC_MPSCRIPT_OK;
+  else
+    code = btc_mempool_run_scripts(mp, tx, view);
+
+  now = btc_time_nsec();
+
+  btc_perf_record(mp->perf, BTC_PERF_TX_SCRIPTS, now - mark);
+
+  ret = btc_mempool_finish(mp, entry, view, code);
+
+  mark = now;
+  now = btc_time_nsec();
+
+  btc_perf_record(mp->perf, BTC_PERF_TX_ADD, now - mark);
+  btc_perf_record(mp->perf, BTC_PERF_TX_ACCEPT, now - start);
+
+  BTC_TRACE_END("mempool", "accept_tx");
+
+  return ret;
+}
+
+static int
+btc_mempool_insert(btc_mempool_t *mp,
+                   const btc_tx_t *tx,
+                   unsigned int id,
+                   int64_t time,
+                   int trusted) {
+  int tag, ret;
+
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_MEMPOOL);
+
+  ret = btc_mempool__insert(mp, tx, id, time, trusted);
+
+  BTC_MEMTAG_POP(tag);
+
+  return ret;
+}
+
+static void
+btc_mempool_reject(btc_mempool_t *mp, const btc_tx_t *tx) {
+  const btc_verify_error_t *err = &mp->error;
+
+  /* Keep it around in case a child pays for it. */
+  if (strcmp(err->reason, "insufficient fee") == 0
+      || strcmp(err->reason, "mempool min fee not met") == 0) {
+    btc_mempool_add_lowfee(mp, tx);
+    btc_mempool_bump_orphan(mp, tx);
+    return;
+  }
+
+  /* A wtxid commits to the witness, so a bad witness can only
+     ever condemn itself. Without one, we have to be sure the
+     failure wasn't caused by a stripped witness before the
+     txid (which equals the wtxid) goes in. */
+  if (btc_tx_has_witness(tx) || !err->malleated)
+    btc_filter_add(&mp->rejects, tx->whash, 32);
+}
+
+int
+btc_mempool_add(btc_mempool_t *mp, const btc_tx_t *tx, unsigned int id) {
+  if (!btc_mempool_insert(mp, tx, id, 0, 0)) {
+    btc_mempool_reject(mp, tx);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Admission Queue
+ */
+
+static btc_mpjob_t *
+btc_mpjob_create(const btc_tx_t *tx,
+                 unsigned int id,
+                 btc_mempool_done_cb *done,
+                 void *arg) {
+  btc_mpjob_t *job = (btc_mpjob_t *)btc_malloc(sizeof(btc_mpjob_t));
+
+  memset(job, 0, sizeof(*job));
+
+  job->tx = btc_tx_refconst(tx);
+  job->id = id;
+  job->done = done;
+  job->arg = arg;
+  job->state = BTC_MPJOB_DONE;
+
+  return job;
+}
+
+static void
+btc_mpjob_destroy(btc_mpjob_t *job) {
+  if (job->entry != NULL)
+    btc_mpentry_destroy(job->entry);
+
+  if (job->view != NULL)
+    btc_view_destroy(job->view);
+
+  btc_tx_destroy(job->tx);
+  btc_free(job);
+}
+
+static void
+btc_mpjob_work(void *arg) {
+  btc_mpjob_t *job = (btc_mpjob_t *)arg;
+  int64_t start = btc_time_nsec();
+  int code = btc_mempool_check_scripts(job->tx, job->view);
+  int64_t cost = btc_time_nsec() - start;
+
+  btc_mutex_lock(job->lock);
+
+  job->result = code;
+  job->state = BTC_MPJOB_READY;
+  job->cost += cost;
+
+  btc_mutex_unlock(job->lock);
+}
+
+static int
+btc_mempool_is_queued(btc_mempool_t *mp, const btc_tx_t *tx) {
+  size_t i;
+
+  if (btc_hashset_has(mp->pending, tx->hash))
+    return 1;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    if (btc_hashset_has(mp->pending, input->prevout.hash))
+      return 1;
+
+    if (btc_prevmap_has(mp->claims, &input->prevout))
+      return 1;
+  }
+
+  return 0;
+}
+
+static void
+btc_mempool_enqueue(btc_mempool_t *mp, btc_mpjob_t *job) {
+  const btc_tx_t *tx = job->tx;
+  size_t i;
+
+  if (job->state != BTC_MPJOB_DONE) {
+    btc_hashset_put(mp->pending, tx->hash);
+
+    for (i = 0; i < tx->inputs.length; i++) {
+      const btc_input_t *input = tx->inputs.items[i];
+
+      if (!btc_prevmap_has(mp->claims, &input->prevout))
+        btc_prevmap_put(mp->claims, &input->prevout, job);
+    }
+  }
+
+  btc_queue_push(&mp->jobs, job);
+}
+
+static void
+btc_mempool_unqueue(btc_mempool_t *mp, btc_mpjob_t *job) {
+  const btc_tx_t *tx = job->tx;
+  size_t i;
+
+  if (job->state == BTC_MPJOB_DONE)
+    return;
+
+  btc_hashset_del(mp->pending, tx->hash);
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    if (btc_prevmap_get(mp->claims, &input->prevout) == job)
+      btc_prevmap_del(mp->claims, &input->prevout);
+  }
+}
+
+static int
+btc_mempool_is_stale(btc_mempool_t *mp, const btc_mpjob_t *job) {
+  const btc_tx_t *tx = job->tx;
+  size_t i;
+
+  /* Coins from the chain may have moved. */
+  if (job->tip != btc_chain_tip(mp->chain))
+    return 1;
+
+  if (btc_mempool_exists(mp, tx->hash))
+    return 1;
+
+  if (btc_mempool_is_double_spend(mp, tx))
+    return 1;
+
+  /* Parents may have been evicted in the meantime. */
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+    const btc_coin_t *coin = btc_view_get(job->view, &input->prevout);
+
+    if (coin->height == -1 && !btc_hashmap_has(mp->map, input->prevout.hash))
+      return 1;
+  }
+
+  /* Or their clusters grew past the limit. */
+  if (btc_mempool_joined_size(mp, job->entry) > BTC_MEMPOOL_MAX_CLUSTER)
+    return 1;
+
+  return 0;
+}
+
+static int
+btc_mempool_commit(btc_mempool_t *mp, btc_mpjob_t *job) {
+  btc_mpentry_t *entry = job->entry;
+  btc_view_t *view = job->view;
+  int stale = btc_mempool_is_stale(mp, job);
+
+  job->entry = NULL;
+  job->view = NULL;
+
+  /* Something changed underneath us: start over. */
+  if (stale) {
+    btc_view_destroy(view);
+    btc_mpentry_destroy(entry);
+    return btc_mempool_insert(mp, job->tx, job->id, job->time, 0);
+  }
+
+  return btc_mempool_finish(mp, entry, view, job->result);
+}
+
+static void
+btc_mempool_schedule(btc_mempool_t *mp, btc_mpjob_t *job) {
+  const btc_entry_t *tip = btc_chain_tip(mp->chain);
+  int64_t start = btc_time_nsec();
+  const btc_tx_t *tx = job->tx;
+  btc_mpentry_t *entry;
+  btc_view_t *view;
+
+  job->lock = mp->lock;
+
+  if (mp->workers == NULL) {
+    /* No workers: admit synchronously. */
+    job->result = btc_mempool_insert(mp, tx, job->id, job->time,
+                                     job->trusted == tip);
+
+    if (!job->result)
+      btc_mempool_reject(mp, tx);
+
+    job->error = mp->error;
+  } else if (btc_mempool_is_queued(mp, tx)) {
+    /* Spends or conflicts with an earlier job. */
+    job->state = BTC_MPJOB_DEFERRED;
+  } else if (!btc_mempool_prepare(mp, tx, job->id, &entry, &view)) {
+    btc_mempool_reject(mp, tx);
+
+    job->result = 0;
+    job->error = mp->error;
+  } else if (entry == NULL) {
+    /* Stored as an orphan. */
+    job->result = 1;
+  } else {
+    if (job->time != 0)
+      entry->time = job->time;
+
+    job->entry = entry;
+    job->view = view;
+    job->tip = tip;
+
+    if (job->trusted == tip
+        || btc_chain_has_scripts(mp->chain, tx,
+                                 BTC_SCRIPT_STANDARD_VERIFY_FLAGS)) {
+      job->result = BTC_MPSCRIPT_OK;
+      job->state = BTC_MPJOB_READY;
+    } else {
+      job->state = BTC_MPJOB_PENDING;
+    }
+  }
+
+  job->cost = btc_time_nsec() - start;
+
+  btc_mempool_enqueue(mp, job);
+
+  if (job->state == BTC_MPJOB_PENDING)
+    btc_workers_add(mp->workers, btc_mpjob_work, job);
+}
+
+static void
+btc_mempool_load(btc_mempool_t *mp) {
+  const btc_entry_t *tip = btc_chain_tip(mp->chain);
+  struct btc_mpload_s *load = &mp->load;
+  size_t batch = BTC_MEMPOOL_LOAD_BATCH;
+  int64_t now = btc_now();
+  btc_mpentry_t *entry;
+  btc_mpjob_t *job;
+
+  /* Scripts were checked against the tip we dumped at. */
+  if (tip != NULL && !btc_hash_equal(tip->hash, load->tip))
+    tip = NULL;
+
+  while (load->left > 0 && batch > 0) {
+    if (mp->jobs.length >= BTC_MEMPOOL_LOAD_BATCH)
+      return;
+
+    entry = btc_mpentry_create();
+
+    if (!btc_mpentry_read(entry, &load->xp, &load->xn)) {
+      btc_mempool_log(mp, "Corrupt mempool file (%zu txs unread).",
+                      load->left);
+      btc_mpentry_destroy(entry);
+      load->left = 0;
+      break;
+    }
+
+    load->left--;
+    batch--;
+
+    if (now < entry->time + BTC_MEMPOOL_EXPIRY_TIME) {
+      job = btc_mpjob_create(entry->tx, 0, NULL, NULL);
+      job->time = entry->time;
+      job->trusted = tip;
+
+      btc_mempool_schedule(mp, job);
+
+      load->total++;
+    }
+
+    btc_mpentry_destroy(entry);
+  }
+
+  if (load->left == 0) {
+    btc_mempool_log(mp, "Queued %zu txs from disk (txs=%zu).",
+                    load->total, btc_hashmap_size(mp->map));
+
+    btc_free(load->data);
+
+    load->data = NULL;
+  }
+}
+
+/*
+ * Fair Scheduling
+ */
+
+static btc_mppeer_t *
+btc_mppeer_create(unsigned int id) {
+  btc_mppeer_t *peer = (btc_mppeer_t *)btc_malloc(sizeof(btc_mppeer_t));
+
+  memset(peer, 0, sizeof(*peer));
+
+  peer->id = id;
+  peer->time = btc_time_msec();
+
+  return peer;
+}
+
+static void
+btc_mppeer_destroy(btc_mppeer_t *peer) {
+  btc_mpjob_t *job, *next;
+
+  for (job = peer->jobs.head; job != NULL; job = next) {
+    next = job->next;
+    btc_mpjob_destroy(job);
+  }
+
+  btc_free(peer);
+}
+
+static int64_t
+btc_mppeer_cost(btc_mppeer_t *peer, int64_t now) {
+  double elapsed = (double)(now - peer->time);
+
+  if (elapsed > 0) {
+    peer->cost = (int64_t)((double)peer->cost
+               * pow(0.5, elapsed / BTC_MEMPOOL_PEER_HALFLIFE));
+    peer->time = now;
+  }
+
+  return peer->cost;
+}
+
+static void
+btc_mempool_clear_peers(btc_mempool_t *mp) {
+  btc_intmapiter_t iter;
+
+  btc_intmap_iterate(&iter, mp->peers);
+
+  while (btc_intmap_next(&iter))
+    btc_mppeer_destroy(iter.val);
+
+  btc_intmap_reset(mp->peers);
+  btc_list_reset(&mp->backlog);
+}
+
+static void
+btc_mempool_charge(btc_mempool_t *mp, unsigned int id, int64_t cost) {
+  btc_mppeer_t *peer = btc_intmap_get(mp->peers, id);
+
+  if (peer != NULL) {
+    btc_mppeer_cost(peer, btc_time_msec());
+    peer->cost += cost;
+  }
+}
+
+static btc_mppeer_t *
+btc_mempool_next_peer(btc_mempool_t *mp) {
+  int64_t now = btc_time_msec();
+  btc_mppeer_t *best = NULL;
+  btc_mppeer_t *peer;
+
+  /* Whoever has cost us the least goes first. Peers
+     rotate to the back once served, so ties (and an
+     idle node) degrade to plain round-robin. */
+  for (peer = mp->backlog.head; peer != NULL; peer = peer->next) {
+    if (best == NULL || btc_mppeer_cost(peer, now) < best->cost)
+      best = peer;
+  }
+
+  return best;
+}
+
+static void
+btc_mempool_pump(btc_mempool_t *mp) {
+  int64_t start = btc_time_nsec();
+  btc_mppeer_t *peer;
+  btc_mpjob_t *job;
+
+  while (mp->backlog.head != NULL) {
+    if (mp->workers != NULL) {
+      /* Enough to keep the workers busy and no more:
+         whatever waits here can still be reordered. */
+      if (mp->jobs.length >= BTC_MEMPOOL_JOB_WINDOW)
+        break;
+    } else {
+      /* Scripts run on the loop thread. */
+      if (btc_time_nsec() - start >= BTC_MEMPOOL_TIME_SLICE)
+        break;
+    }
+
+    peer = btc_mempool_next_peer(mp);
+    job = peer->jobs.head;
+
+    btc_queue_shift(&peer->jobs);
+    btc_list_remove(&mp->backlog, peer, btc_mppeer_t);
+
+    if (peer->jobs.length > 0)
+      btc_list_push(&mp->backlog, peer, btc_mppeer_t);
+
+    job->next = NULL;
+
+    btc_mempool_schedule(mp, job);
+  }
+}
+
+void
+btc_mempool_submit(btc_mempool_t *mp,
+                   const btc_tx_t *tx,
+                   unsigned int id,
+                   btc_mempool_done_cb *done,
+                   void *arg) {
+  btc_mppeer_t *peer = btc_intmap_get(mp->peers, id);
+
+  if (peer == NULL) {
+    peer = btc_mppeer_create(id);
+    btc_intmap_put(mp->peers, id, peer);
+  }
+
+  if (peer->jobs.length == 0)
+    btc_list_push(&mp->backlog, peer, btc_mppeer_t);
+
+  btc_queue_push(&peer->jobs, btc_mpjob_create(tx, id, done, arg));
+
+  btc_mempool_drain(mp);
+}
+
+int64_t
+btc_mempool_cost(btc_mempool_t *mp, unsigned int id) {
+  btc_mppeer_t *peer = btc_intmap_get(mp->peers, id);
+
+  if (peer == NULL)
+    return 0;
+
+  return btc_mppeer_cost(peer, btc_time_msec());
+}
+
+void
+btc_mempool_forget(btc_mempool_t *mp, unsigned int id) {
+  btc_mppeer_t *peer = btc_intmap_get(mp->peers, id);
+
+  if (peer == NULL)
+    return;
+
+  if (peer->jobs.length > 0)
+    btc_list_remove(&mp->backlog, peer, btc_mppeer_t);
+
+  btc_intmap_del(mp->peers, id);
+  btc_mppeer_destroy(peer);
+}
+
+void
+btc_mempool_drain(btc_mempool_t *mp) {
+  enum btc_mpjob_state state;
+  btc_mpjob_t *job;
+  int64_t start;
+  int result;
+
+  if (mp->load.data != NULL)
+    btc_mempool_load(mp);
+
+  btc_mempool_pump(mp);
+
+  while (mp->jobs.head != NULL) {
+    job = mp->jobs.head;
+
+    if (job->lock != NULL)
+      btc_mutex_lock(job->lock);
+
+    state = job->state;
+
+    if (job->lock != NULL)
+      btc_mutex_unlock(job->lock);
+
+    if (state == BTC_MPJOB_PENDING)
+      break;
+
+    /* Results are committed in arrival order. */
+    btc_queue_shift(&mp->jobs);
+    btc_mempool_unqueue(mp, job);
+
+    start = btc_time_nsec();
+
+    switch (state) {
+      case BTC_MPJOB_READY:
+        result = btc_mempool_commit(mp, job);
+        break;
+      case BTC_MPJOB_DEFERRED:
+        result = btc_mempool_insert(mp, job->tx, job->id, job->time,
+                                    job->trusted == btc_chain_tip(mp->chain));
+        break;
+      default:
+        mp->error = job->error;
+        result = job->result;
+        break;
+    }
+
+    if (!result && state != BTC_MPJOB_DONE)
+      btc_mempool_reject(mp, job->tx);
+
+    btc_mempool_charge(mp, job->id, job->cost + btc_time_nsec() - start);
+
+    if (job->done != NULL)
+      job->done(job->tx, result, job->id, job->arg);
+
+    btc_mpjob_destroy(job);
+  }
+
+  /* Refill the window we just freed up. */
+  if (mp->workers != NULL)
+    btc_mempool_pump(mp);
+}
+
+/*
+ * Package Handling
+ */
+
+static int
+btc_mempool_check_package(btc_mempool_t *mp, const btc_txvec_t *txs) {
+  const btc_tx_t *child = txs->items[txs->length - 1];
+  btc_hashset_t *hashes = btc_hashset_create();
+  btc_hashset_t *seen = btc_hashset_create();
+  btc_prevmap_t *spent = btc_prevmap_create();
+  const char *reason = NULL;
+  size_t weight = 0;
+  size_t i, j;
+
+  if (txs->length > BTC_MEMPOOL_MAX_PACKAGE) {
+    reason = "package-too-many-transactions";
+    goto done;
+  }
+
+  for (i = 0; i < txs->length; i++) {
+    const btc_tx_t *tx = txs->items[i];
+
+    weight += btc_tx_weight(tx);
+
+    if (!btc_hashset_put(hashes, tx->hash)) {
+      reason = "package-contains-duplicates";
+      goto done;
+    }
+  }
+
+  if (weight > BTC_MEMPOOL_MAX_PACKAGE_WEIGHT) {
+    reason = "package-too-large";
+    goto done;
+  }
+
+  for (i = 0; i < txs->length; i++) {
+    btc_tx_t *tx = txs->items[i];
+
+    for (j = 0; j < tx->inputs.length; j++) {
+      const btc_input_t *input = tx->inputs.items[j];
+      const btc_outpoint_t *prevout = &input->prevout;
+
+      /* Parents must come before their children. */
+      if (btc_hashset_has(hashes, prevout->hash)
+          && !btc_hashset_has(seen, prevout->hash)) {
+        reason = "package-not-sorted";
+        goto done;
+      }
+
+      if (!btc_prevmap_put(spent, prevout, tx)) {
+        reason = "conflict-in-package";
+        goto done;
+      }
+    }
+
+    btc_hashset_put(seen, tx->hash);
+  }
+
+  /* Only child-with-parents packages for now. */
+  btc_hashset_reset(seen);
+
+  for (i = 0; i < child->inputs.length; i++)
+    btc_hashset_put(seen, child->inputs.items[i]->prevout.hash);
+
+  for (i = 0; i < txs->length - 1; i++) {
+    if (!btc_hashset_has(seen, txs->items[i]->hash)) {
+      reason = "package-not-child-with-parents";
+      goto done;
+    }
+  }
+
+done:
+  btc_hashset_destroy(hashes);
+  btc_hashset_destroy(seen);
+  btc_prevmap_destroy(spent);
+
+  if (reason != NULL) {
+    return btc_mempool_throw(mp, child,
+                             "invalid",
+                             reason,
+                             0,
+                             0);
+  }
+
+  return 1;
+}
+
+static void
+btc_mempool_package_scripts(btc_mempool_t *mp,
+                            btc_mpentry_t **entries,
+                            btc_view_t **views,
+                            int *codes,
+                            size_t count) {
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+  btc_taskgroup_t *group;
+  btc_mpjob_t **jobs;
+  size_t i;
+
+  if (mp->workers == NULL || count == 1) {
+    for (i = 0; i < count; i++)
+      codes[i] = btc_mempool_run_scripts(mp, entries[i]->tx, views[i]);
+
+    return;
+  }
+
+  jobs = (btc_mpjob_t **)btc_malloc(count * sizeof(btc_mpjob_t *));
+  group = btc_taskgroup_create(mp->workers);
+
+  for (i = 0; i < count; i++) {
+    const btc_tx_t *tx = entries[i]->tx;
+
+    if (btc_chain_has_scripts(mp->chain, tx, flags)) {
+      codes[i] = BTC_MPSCRIPT_OK;
+      jobs[i] = NULL;
+      continue;
+    }
+
+    jobs[i] = btc_mpjob_create(tx, 0, NULL, NULL);
+    jobs[i]->lock = mp->lock;
+    jobs[i]->view = views[i];
+    jobs[i]->state = BTC_MPJOB_PENDING;
+
+    btc_taskgroup_add(group, btc_mpjob_work, jobs[i]);
+  }
+
+  btc_taskgroup_wait(group);
+  btc_taskgroup_destroy(group);
+
+  for (i = 0; i < count; i++) {
+    if (jobs[i] == NULL)
+      continue;
+
+    btc_mutex_lock(mp->lock);
+    codes[i] = jobs[i]->result;
+    btc_mutex_unlock(mp->lock);
+
+    /* The view is borrowed. */
+    jobs[i]->view = NULL;
+
+    btc_mpjob_destroy(jobs[i]);
+  }
+
+  btc_free(jobs);
+}
+
+int
+btc_mempool_add_package(btc_mempool_t *mp,
+                        const btc_txvec_t *txs,
+                        unsigned int id) {
+  size_t length = txs->length;
+  const btc_tx_t *child;
+  btc_mpentry_t **entries;
+  btc_view_t **views;
+  size_t i, count = 0;
+  int64_t fee = 0;
+  size_t size = 0;
+  int ret = 0;
+  int *codes;
+
+  CHECK(length > 0);
+
+  child = txs->items[length - 1];
+
+  if (!btc_mempool_check_package(mp, txs))
+    return 0;
+
+  entries = (btc_mpentry_t **)btc_malloc(length * sizeof(btc_mpentry_t *));
+  views = (btc_view_t **)btc_malloc(length * sizeof(btc_view_t *));
+  codes = (int *)btc_malloc(length * sizeof(int));
+
+  /* Stage each member so that its children see its
+     outputs. Nothing is announced until all pass. */
+  mp->in_package = 1;
+
+  for (i = 0; i < length; i++) {
+    const btc_tx_t *tx = txs->items[i];
+
+    if (btc_hashmap_has(mp->map, tx->hash))
+      continue;
+
+    if (!btc_mempool_prepare(mp, tx, id, &entries[count], &views[count]))
+      break;
+
+    CHECK(entries[count] != NULL);
+
+    btc_mempool_track_entry(mp, entries[count]);
+
+    fee += entries[count]->fee;
+    size += entries[count]->size;
+
+    count++;
+  }
+
+  mp->in_package = 0;
+
+  if (i < length)
+    goto fail;
+
+  if (count == 0) {
+    ret = 1;
+    goto done;
+  }
+
+  /* The package as a whole must pay the relay fee,
+     or the rolling minimum while we're full. */
+  if (fee < btc_get_min_fee(size, btc_mempool_min_rate(mp))) {
+    btc_mempool_throw(mp, child,
+                      "insufficientfee",
+                      "package-fee-too-low",
+                      0,
+                      0);
+    goto fail;
+  }
+
+  btc_mempool_package_scripts(mp, entries, views, codes, count);
+
+  for (i = 0; i < count; i++) {
+    if (!btc_mempool_verify_scripts(mp, entries[i]->tx, views[i], codes[i]))
+      goto fail;
+  }
+
+  for (i = 0; i < count; i++) {
+    btc_mempool_remove_orphan(mp, entries[i]->hash);
+    btc_mempool_publish_entry(mp, entries[i], views[i]);
+    btc_view_destroy(views[i]);
+  }
+
+  btc_mempool_debug(mp, "Added package %H to mempool (size=%zu).",
+                    child->hash, count);
+
+  /* Entries may be evicted from here on. */
+  for (i = 0; i < length; i++) {
+    const btc_tx_t *tx = txs->items[i];
+
+    if (btc_hashmap_has(mp->map, tx->hash))
+      btc_mempool_handle_orphans(mp, tx);
+  }
+
+  /* Trim size if we're too big. */
+  if (btc_mempool_limit_size(mp, child->hash)) {
+    btc_mempool_throw(mp, child,
+                      "insufficientfee",
+                      "mempool full",
+                      0,
+                      0);
+    goto done;
+  }
+
+  ret = 1;
+  goto done;
+fail:
+  while (count--) {
+    btc_mempool_evict_entry(mp, entries[count]);
+    btc_view_destroy(views[count]);
+  }
+done:
+  btc_free(entries);
+  btc_free(views);
+  btc_free(codes);
+  return ret;
+}
+
+/*
+ * Persistence
+ */
+
+typedef struct btc_mpfile_s {
+  int fd;
+  uint8_t *data;
+  size_t length;
+  size_t alloc;
+  btc_hash256_t hash;
+} btc_mpfile_t;
+
+static void
+btc_mpfile_init(btc_mpfile_t *f, int fd) {
+  f->fd = fd;
+  f->data = (uint8_t *)btc_malloc(BTC_MEMPOOL_BUFFER_SIZE);
+  f->length = 0;
+  f->alloc = BTC_MEMPOOL_BUFFER_SIZE;
+
+  btc_hash256_init(&f->hash);
+}
+
+static void
+btc_mpfile_clear(btc_mpfile_t *f) {
+  btc_free(f->data);
+}
+
+static int
+btc_mpfile_flush(btc_mpfile_t *f) {
+  if (f->length == 0)
+    return 1;
+
+  btc_hash256_update(&f->hash, f->data, f->length);
+
+  if (!btc_fs_write(f->fd, f->data, f->length))
+    return 0;
+
+  f->length = 0;
+
+  return 1;
+}
+
+static uint8_t *
+btc_mpfile_reserve(btc_mpfile_t *f, size_t size) {
+  if (f->length + size > f->alloc) {
+    if (!btc_mpfile_flush(f))
+      return NULL;
+
+    if (size > f->alloc) {
+      f->data = (uint8_t *)btc_realloc(f->data, size);
+      f->alloc = size;
+    }
+  }
+
+  return f->data + f->length;
+}
+
+static int
+btc_mempool_write_file(btc_mempool_t *mp, const char *path) {
+  const btc_entry_t *tip = btc_chain_tip(mp->chain);
+  size_t count = btc_hashmap_size(mp->map);
+  const btc_mpentry_t **entries;
+  char tmp[BTC_PATH_MAX + 5];
+  btc_hashmapiter_t iter;
+  uint8_t checksum[32];
+  btc_mpfile_t f;
+  size_t i, j, size;
+  uint8_t *zp;
+  int fd;
+
+  if (strlen(path) + 5 > sizeof(tmp))
+    return 0;
+
+  sprintf(tmp, "%s.tmp", path);
+
+  /* Parents must be read back before their children.
+     Linearizations already put them in that order. */
+  entries = (const btc_mpentry_t **)btc_malloc((count + 1) * sizeof(void *));
+
+  btc_hashmap_iterate(&iter, mp->map);
+
+  for (i = 0; btc_hashmap_next(&iter);) {
+    const btc_mpentry_t *entry = iter.val;
+    const btc_mpcluster_t *cluster = entry->_cluster;
+
+    if (entry->_pos != 0)
+      continue;
+
+    for (j = 0; j < cluster->length; j++)
+      entries[i++] = cluster->items[j];
+  }
+
+  CHECK(i == count);
+
+  fd = btc_fs_open(tmp, BTC_O_WRONLY | BTC_O_CREAT | BTC_O_TRUNC, 0644);
+
+  if (fd == -1) {
+    btc_free((void *)entries);
+    return 0;
+  }
+
+  btc_mpfile_init(&f, fd);
+
+  zp = btc_mpfile_reserve(&f, BTC_MEMPOOL_HEADER_SIZE);
+  zp = btc_uint32_write(zp, mp->network->magic);
+  zp = btc_uint32_write(zp, BTC_MEMPOOL_FILE_VERSION);
+  zp = btc_raw_write(zp, tip->hash, 32);
+  zp = btc_uint64_write(zp, count);
+
+  f.length += BTC_MEMPOOL_HEADER_SIZE;
+
+  /* Every entry passed the standard flags. Their
+     wtxids come first so that the script cache can
+     be warmed without decoding the whole file. */
+  zp = btc_mpfile_reserve(&f, 4);
+  zp = btc_uint32_write(zp, BTC_SCRIPT_STANDARD_VERIFY_FLAGS);
+
+  f.length += 4;
+
+  for (i = 0; i < count; i++) {
+    zp = btc_mpfile_reserve(&f, 32);
+
+    if (zp == NULL)
+      goto fail;
+
+    btc_raw_write(zp, entries[i]->tx->whash, 32);
+
+    f.length += 32;
+  }
+
+  for (i = 0; i < count; i++) {
+    size = btc_mpentry_size(entries[i]);
+    zp = btc_mpfile_reserve(&f, size);
 
-  /* Script verification. */
-  flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+    if (zp == NULL)
+      goto fail;
 
-  if (!btc_mempool_verify_inputs(mp, entry, view, flags)) {
-    if (btc_tx_has_witness(tx))
-      return 0;
+    btc_mpentry_write(zp, entries[i]);
 
-    /* Try without segwit and cleanstack. */
-    flags &= ~BTC_SCRIPT_VERIFY_WITNESS;
-    flags &= ~BTC_SCRIPT_VERIFY_CLEANSTACK;
+    f.length += size;
+  }
 
-    /* If it failed, the first verification
-       was the only result we needed. */
-    if (!btc_tx_verify(tx, view, flags))
-      return 0;
+  if (!btc_mpfile_flush(&f))
+    goto fail;
 
-    /* If it succeeded, segwit may be causing the
-       failure. Try with segwit but without cleanstack. */
-    flags |= BTC_SCRIPT_VERIFY_WITNESS;
+  btc_hash256_final(&f.hash, checksum);
 
-    /* Cleanstack was causing the failure. */
-    if (btc_tx_verify(tx, view, flags))
-      return 0;
+  if (!btc_fs_write(fd, checksum, 32))
+    goto fail;
 
-    /* Do not insert into reject cache. */
-    mp->error.malleated = 1;
+  if (!btc_fs_fsync(fd))
+    goto fail;
 
+  btc_fs_close(fd);
+  btc_mpfile_clear(&f);
+  btc_free((void *)entries);
+
+  if (!btc_fs_rename(tmp, path)) {
+    btc_fs_unlink(tmp);
     return 0;
   }
 
-  /* Paranoid checks. */
-  if (mp->flags & BTC_MEMPOOL_PARANOID)
-    CHECK(btc_tx_verify(tx, view, BTC_SCRIPT_MANDATORY_VERIFY_FLAGS));
-
   return 1;
+fail:
+  btc_fs_close(fd);
+  btc_fs_unlink(tmp);
+  btc_mpfile_clear(&f);
+  btc_free((void *)entries);
+  return 0;
 }
 
 static int
-btc_mempool_insert(btc_mempool_t *mp, const btc_tx_t *tx, unsigned int id) {
-  const btc_deployment_state_t *state = btc_chain_state(mp->chain);
-  unsigned int lock_flags = BTC_STANDARD_LOCKTIME_FLAGS;
+btc_mempool_read_file(btc_mempool_t *mp, const char *path) {
   const btc_entry_t *tip = btc_chain_tip(mp->chain);
-  int32_t height = tip->height;
-  btc_verify_error_t err;
-  btc_mpentry_t *entry;
-  btc_view_t *view;
+  struct btc_mpload_s *load = &mp->load;
+  uint32_t magic, version, flags;
+  const uint8_t *wtxids, *xp;
+  size_t i, xn, warmed = 0;
+  uint8_t checksum[32];
+  btc_hash256_t hash;
+  uint64_t count;
+  uint8_t *data;
+
+  if (!btc_fs_alloc_file(&data, &xn, path))
+    return 0;
 
-  /* Basic sanity checks. */
-  if (!btc_tx_check_sanity(&err, tx)) {
-    return btc_mempool_throw(mp, tx,
-                             "invalid",
-                             err.reason,
-                             err.score,
-                             0);
-  }
+  if (xn < BTC_MEMPOOL_HEADER_SIZE + 32)
+    goto fail;
 
-  /* Coinbases are an insta-ban. */
-  if (btc_tx_is_coinbase(tx)) {
-    return btc_mempool_throw(mp, tx,
-                             "invalid",
-                             "coinbase",
-                             100,
-                             0);
-  }
+  xn -= 32;
 
-  /* Do not allow CSV until it's activated. */
-  if (mp->network->require_standard) {
-    if (!(state->flags & BTC_SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)) {
-      if (tx->version >= 2) {
-        return btc_mempool_throw(mp, tx,
-                                 "nonstandard",
-                                 "premature-version2-tx",
-                                 0,
-                                 0);
-      }
-    }
-  }
+  btc_hash256_init(&hash);
+  btc_hash256_update(&hash, data, xn);
+  btc_hash256_final(&hash, checksum);
 
-  /* Do not allow segwit until it's activated. */
-  if (!(state->flags & BTC_SCRIPT_VERIFY_WITNESS)) {
-    if (btc_tx_has_witness(tx)) {
-      return btc_mempool_throw(mp, tx,
-                               "nonstandard",
-                               "no-witness-yet",
-                               0,
-                               1);
-    }
-  }
+  if (!btc_hash_equal(checksum, data + xn))
+    goto fail;
 
-  /* Non-contextual standardness checks. */
-  if (mp->network->require_standard) {
-    if (!btc_tx_check_standard(&err, tx)) {
-      return btc_mempool_throw(mp, tx,
-                               "invalid",
-                               err.reason,
-                               err.score,
-                               0);
-    }
-  }
+  xp = data;
 
-  /* Verify transaction finality. */
-  if (!btc_chain_verify_final(mp->chain, tip, tx, lock_flags)) {
-    return btc_mempool_throw(mp, tx,
-                             "nonstandard",
-                             "non-final",
-                             0,
-                             0);
-  }
+  if (!btc_uint32_read(&magic, &xp, &xn))
+    goto fail;
 
-  /* We can maybe ignore this. */
-  if (btc_mempool_exists(mp, tx->hash)) {
-    return btc_mempool_throw(mp, tx,
-                             "alreadyknown",
-                             "txn-already-in-mempool",
-                             0,
-                             0);
-  }
+  if (!btc_uint32_read(&version, &xp, &xn))
+    goto fail;
 
-  /* We can test whether this is an
-     non-fully-spent transaction on
-     the chain. */
-  if (btc_chain_has_coins(mp->chain, tx)) {
-    return btc_mempool_throw(mp, tx,
-                             "alreadyknown",
-                             "txn-already-known",
-                             0,
-                             0);
-  }
+  if (magic != mp->network->magic)
+    goto fail;
 
-  /* Quick and dirty test to verify we're
-     not double-spending an output in the
-     mempool. */
-  if (btc_mempool_is_double_spend(mp, tx)) {
-    if (btc_tx_is_rbf(tx)) {
-      return btc_mempool_fail(mp, tx,
-                              "duplicate",
-                              "replace-by-fee",
-                              0,
-                              0);
-    }
+  if (version < 1 || version > BTC_MEMPOOL_FILE_VERSION)
+    goto fail;
 
-    return btc_mempool_throw(mp, tx,
-                             "duplicate",
-                             "bad-txns-inputs-spent",
-                             0,
-                             0);
-  }
+  if (!btc_raw_read(load->tip, 32, &xp, &xn))
+    goto fail;
 
-  /* Get coin viewpoint as it pertains to the mempool. */
-  view = btc_mempool_view(mp, tx);
+  if (!btc_uint64_read(&count, &xp, &xn))
+    goto fail;
 
-  /* Maybe store as an orphan. */
-  if (!btc_tx_has_coins(tx, view)) {
-    /* Preliminary orphan checks. */
-    if (!btc_mempool_check_orphan(mp, tx, view)) {
-      btc_view_destroy(view);
-      return 0;
-    }
+  if (count > xn)
+    goto fail;
 
-    btc_mempool_add_orphan(mp, tx, view, id);
-    btc_view_destroy(view);
+  if (version >= 2) {
+    if (!btc_uint32_read(&flags, &xp, &xn))
+      goto fail;
 
-    return 1;
-  }
+    if (count > xn / 32)
+      goto fail;
 
-  /* Create a new mempool entry at current chain height. */
-  entry = btc_mpentry_create();
+    wtxids = xp;
 
-  btc_mpentry_set(entry, tx, view, height);
+    xp += count * 32;
+    xn -= count * 32;
 
-  /* Contextual verification. */
-  if (!btc_mempool_verify(mp, entry, view)) {
-    btc_view_destroy(view);
-    btc_mpentry_destroy(entry);
-    return 0;
-  }
+    if (count > xn)
+      goto fail;
 
-  /* Add and index the entry. */
-  btc_mempool_add_entry(mp, entry, view);
-  btc_view_destroy(view);
+    /* Valid at the tip we dumped at (as with the
+       entries themselves). Warming the cache now
+       lets blocks which arrive during the reload
+       skip the scripts we have already checked.
+       With no chain loaded there is nothing to
+       compare against, so the cache stays cold. */
+    if (tip != NULL && btc_hash_equal(tip->hash, load->tip)) {
+      for (i = 0; i < count; i++)
+        btc_chain_cache_witness(mp->chain, wtxids + i * 32, flags);
 
-  /* Trim size if we're too big. */
-  if (btc_mempool_limit_size(mp, tx->hash)) {
-    return btc_mempool_throw(mp, tx,
-                             "insufficientfee",
-                             "mempool full",
-                             0,
-                             0);
+      warmed = count;
+    }
   }
 
-  return 1;
-}
-
-int
-btc_mempool_add(btc_mempool_t *mp, const btc_tx_t *tx, unsigned int id) {
-  if (!btc_mempool_insert(mp, tx, id)) {
-    const btc_verify_error_t *err = &mp->error;
-
-    if (!btc_tx_has_witness(tx) && !err->malleated)
-      btc_filter_add(&mp->rejects, tx->hash, 32);
+  load->data = data;
+  load->xp = xp;
+  load->xn = xn;
+  load->left = count;
+  load->total = 0;
 
-    return 0;
-  }
+  btc_mempool_log(mp, "Restoring %zu txs from %s (cached=%zu).",
+                  load->left, path, warmed);
 
   return 1;
+fail:
+  btc_free(data);
+  return 0;
 }
 
 /*
@@ -1294,14 +3764,35 @@ void
 btc_mempool_add_block(btc_mempool_t *mp,
                       const btc_entry_t *entry,
                       const btc_block_t *block) {
+  btc_mpblock_t *blk = &mp->blocks[entry->height % BTC_MEMPOOL_REORG_DEPTH];
   int total = 0;
   size_t i;
 
+  /* Must see confirmations before they're untracked. */
+  btc_fees_add_block(mp->fees, entry->height, block);
+
+  btc_mpblock_clear(blk);
+
+  /* Mined again on the new branch. */
+  if (btc_hashmap_size(mp->detached) > 0) {
+    for (i = 0; i < block->txs.length; i++) {
+      const btc_tx_t *tx = block->txs.items[i];
+      btc_mpdetach_t *item = btc_hashmap_rem(mp->detached, tx->hash);
+
+      if (item != NULL)
+        btc_mpdetach_destroy(item);
+    }
+  }
+
   if (btc_hashmap_size(mp->map) == 0)
     return;
 
   CHECK(block->txs.length > 0);
 
+  btc_hash_copy(blk->hash, entry->hash);
+
+  blk->txs = btc_hashset_create();
+
   for (i = block->txs.length - 1; i != 0; i--) {
     const btc_tx_t *tx = block->txs.items[i];
     btc_mpentry_t *ent;
@@ -1310,16 +3801,25 @@ btc_mempool_add_block(btc_mempool_t *mp,
 
     if (ent == NULL) {
       btc_mempool_remove_orphan(mp, tx->hash);
+      btc_mempool_remove_lowfee(mp, tx->hash);
       btc_mempool_remove_double_spends(mp, tx);
-      btc_mempool_handle_orphans(mp, tx->hash);
+      btc_mempool_handle_orphans(mp, tx);
       continue;
     }
 
+    /* Remember it passed our script checks
+       in case the block is disconnected. */
+    btc_hashset_put(blk->txs, btc_hash_clone(ent->hash));
+
+    /* Spenders left behind are rechunked without it. */
     btc_mempool_remove_entry(mp, ent);
 
     total += 1;
   }
 
+  /* The rolling minimum fee may start to decay. */
+  mp->min_decay = 1;
+
   /* We need to reset the rejects filter periodically. */
   /* There may be a locktime in a TX that is now valid. */
   btc_filter_reset(&mp->rejects);
@@ -1334,44 +3834,138 @@ void
 btc_mempool_remove_block(btc_mempool_t *mp,
                          const btc_entry_t *entry,
                          const btc_block_t *block) {
-  int total = 0;
+  btc_mpblock_t *blk = &mp->blocks[entry->height % BTC_MEMPOOL_REORG_DEPTH];
+  const btc_hashset_t *checked = NULL;
+  btc_mpdetach_t *item;
   size_t i;
 
+  if (blk->txs != NULL && btc_hash_equal(blk->hash, entry->hash))
+    checked = blk->txs;
+
   if (btc_hashmap_size(mp->map) == 0)
-    return;
+    goto done;
 
+  /* Nothing is inserted until the reorg is over:
+     validating against each intermediate tip is
+     wasted work, and txs mined again on the new
+     branch need not be validated at all. */
   for (i = 1; i < block->txs.length; i++) {
     const btc_tx_t *tx = block->txs.items[i];
 
     if (btc_hashmap_has(mp->map, tx->hash))
       continue;
 
-    total += btc_mempool_insert(mp, tx, -1);
+    if (btc_hashmap_has(mp->detached, tx->hash))
+      continue;
+
+    item = (btc_mpdetach_t *)btc_malloc(sizeof(btc_mpdetach_t));
+    item->tx = btc_tx_refconst(tx);
+    item->height = entry->height;
+    item->index = i;
+
+    /* Txs we verified before they were mined
+       only need their contextual checks. */
+    item->trusted = checked != NULL && btc_hashset_has(checked, tx->hash);
+
+    CHECK(btc_hashmap_put(mp->detached, item->tx->hash, item));
   }
 
+done:
+  btc_mpblock_clear(blk);
+}
+
+static int
+detach_cmp(const void *xp, const void *yp) {
+  const btc_mpdetach_t *x = *((const btc_mpdetach_t **)xp);
+  const btc_mpdetach_t *y = *((const btc_mpdetach_t **)yp);
+
+  if (x->height != y->height)
+    return x->height < y->height ? -1 : 1;
+
+  if (x->index != y->index)
+    return x->index < y->index ? -1 : 1;
+
+  return 0;
+}
+
+static void
+btc_mempool_reinsert(btc_mempool_t *mp) {
+  size_t count = btc_hashmap_size(mp->detached);
+  btc_hashmapiter_t iter;
+  btc_mpdetach_t **items;
+  int total = 0;
+  size_t i = 0;
+
+  if (count == 0)
+    return;
+
+  items = (btc_mpdetach_t **)btc_malloc(count * sizeof(btc_mpdetach_t *));
+
+  btc_hashmap_iterate(&iter, mp->detached);
+
+  while (btc_hashmap_next(&iter))
+    items[i++] = iter.val;
+
+  btc_hashmap_reset(mp->detached);
+
+  /* Parents before children: block order. */
+  qsort(items, count, sizeof(btc_mpdetach_t *), detach_cmp);
+
   btc_filter_reset(&mp->rejects);
 
-  if (total > 0) {
-    btc_mempool_log(mp, "Added %d txs back into the mempool for block %d.",
-                        total, entry->height);
+  for (i = 0; i < count; i++) {
+    btc_mpdetach_t *item = items[i];
+
+    if (!btc_hashmap_has(mp->map, item->tx->hash))
+      total += btc_mempool_insert(mp, item->tx, -1, 0, item->trusted);
+
+    btc_mpdetach_destroy(item);
   }
+
+  btc_free(items);
+
+  if (total > 0)
+    btc_mempool_log(mp, "Added %d txs back into the mempool.", total);
 }
 
 void
 btc_mempool_handle_reorg(btc_mempool_t *mp) {
   unsigned int flags = BTC_STANDARD_LOCKTIME_FLAGS;
   const btc_entry_t *tip = btc_chain_tip(mp->chain);
-  int64_t mtp = btc_entry_median_time(tip);
+  int64_t mtp = btc_chain_median_time(mp->chain, tip);
   int32_t height = tip->height + 1;
-  btc_hashmapiter_t iter;
+  size_t count;
+  btc_hashsetiter_t iter;
+  uint8_t *hashes;
+  size_t i, j;
 
-  btc_hashmap_iterate(&iter, mp->map);
+  /* One batch for every block the reorg undid. */
+  btc_mempool_reinsert(mp);
 
-  while (btc_hashmap_next(&iter)) {
-    btc_mpentry_t *entry = iter.val;
-    btc_tx_t *tx = entry->tx;
+  count = btc_hashset_size(mp->fragile);
+
+  if (count == 0)
+    return;
+
+  /* Evictions take descendants with them,
+     so work from a copy of the hashes. */
+  hashes = (uint8_t *)btc_malloc(count * 32);
+
+  btc_hashset_iterate(&iter, mp->fragile);
+
+  for (i = 0; btc_hashset_next(&iter); i++)
+    btc_hash_copy(hashes + i * 32, iter.key);
+
+  for (i = 0; i < count; i++) {
+    btc_mpentry_t *entry = btc_hashmap_get(mp->map, hashes + i * 32);
+    btc_tx_t *tx;
     btc_view_t *view;
 
+    if (entry == NULL)
+      continue;
+
+    tx = entry->tx;
+
     if (!btc_tx_is_final(tx, height, mtp)) {
       btc_mempool_evict_entry(mp, entry);
       continue;
@@ -1390,10 +3984,9 @@ btc_mempool_handle_reorg(btc_mempool_t *mp) {
 
     if (entry->coinbase) {
       int invalid = 0;
-      size_t i;
 
-      for (i = 0; i < tx->inputs.length; i++) {
-        const btc_input_t *input = tx->inputs.items[i];
+      for (j = 0; j < tx->inputs.length; j++) {
+        const btc_input_t *input = tx->inputs.items[j];
         const btc_coin_t *coin = btc_view_get(view, &input->prevout);
 
         if (coin == NULL || !coin->coinbase)
@@ -1414,6 +4007,8 @@ btc_mempool_handle_reorg(btc_mempool_t *mp) {
 
     btc_view_destroy(view);
   }
+
+  btc_free(hashes);
 }
 
 /*
@@ -1425,11 +4020,58 @@ btc_mempool_error(btc_mempool_t *mp) {
   return &mp->error;
 }
 
+const btc_fees_t *
+btc_mempool_fees(btc_mempool_t *mp) {
+  return mp->fees;
+}
+
 size_t
 btc_mempool_size(btc_mempool_t *mp) {
   return btc_hashmap_size(mp->map);
 }
 
+size_t
+btc_mempool_usage(btc_mempool_t *mp) {
+  return mp->usage;
+}
+
+int64_t
+btc_mempool_min_rate(btc_mempool_t *mp) {
+  int64_t relay = mp->network->min_relay;
+  int64_t halflife = BTC_MEMPOOL_FEE_HALFLIFE;
+  int64_t now;
+
+  if (mp->min_rate == 0)
+    return relay;
+
+  now = btc_now();
+
+  /* Decay once a block has made some room, and
+     the faster the emptier the mempool is. */
+  if (mp->min_decay && now > mp->min_time + 10) {
+    if (mp->usage < BTC_MEMPOOL_MAX_SIZE / 4)
+      halflife /= 4;
+    else if (mp->usage < BTC_MEMPOOL_MAX_SIZE / 2)
+      halflife /= 2;
+
+    mp->min_rate = (int64_t)((double)mp->min_rate
+                 / pow(2.0, (double)(now - mp->min_time) / halflife));
+    mp->min_time = now;
+
+    if (mp->min_rate < relay / 2) {
+      mp->min_rate = 0;
+      return relay;
+    }
+  }
+
+  return mp->min_rate > relay ? mp->min_rate : relay;
+}
+
+btc_workers_t *
+btc_mempool_workers(btc_mempool_t *mp) {
+  return mp->workers;
+}
+
 int
 btc_mempool_has(btc_mempool_t *mp, const uint8_t *hash) {
   return btc_hashmap_has(mp->map, hash);
@@ -1440,16 +4082,49 @@ btc_mempool_get(btc_mempool_t *mp, const uint8_t *hash) {
   return btc_hashmap_get(mp->map, hash);
 }
 
+int
+btc_mempool_has_wtx(btc_mempool_t *mp, const uint8_t *whash) {
+  return btc_hashmap_has(mp->wmap, whash);
+}
+
+const btc_mpentry_t *
+btc_mempool_get_wtx(btc_mempool_t *mp, const uint8_t *whash) {
+  return btc_hashmap_get(mp->wmap, whash);
+}
+
+size_t
+btc_mempool_cluster(btc_mempool_t *mp, const uint8_t *hash) {
+  const btc_mpentry_t *entry = btc_hashmap_get(mp->map, hash);
+
+  if (entry == NULL)
+    return 0;
+
+  return entry->_cluster->length;
+}
+
 int
 btc_mempool_has_orphan(btc_mempool_t *mp, const uint8_t *hash) {
   return btc_hashmap_has(mp->orphans, hash);
 }
 
+int
+btc_mempool_has_orphan_wtx(btc_mempool_t *mp, const uint8_t *whash) {
+  return btc_hashmap_has(mp->worphans, whash);
+}
+
 int
 btc_mempool_has_reject(btc_mempool_t *mp, const uint8_t *hash) {
+  if (btc_hashmap_has(mp->lowfee, hash))
+    return 1;
+
   return btc_filter_has(&mp->rejects, hash, 32);
 }
 
+int
+btc_mempool_has_spent(btc_mempool_t *mp, const btc_outpoint_t *prevout) {
+  return btc_prevmap_has(mp->spents, prevout);
+}
+
 btc_vector_t *
 btc_mempool_missing(btc_mempool_t *mp, const btc_tx_t *tx) {
   btc_vector_t *missing = btc_vector_create();
@@ -1458,7 +4133,7 @@ btc_mempool_missing(btc_mempool_t *mp, const btc_tx_t *tx) {
   for (i = 0; i < tx->inputs.length; i++) {
     const btc_input_t *input = tx->inputs.items[i];
 
-    if (!btc_hashmap_has(mp->waiting, input->prevout.hash))
+    if (!btc_prevmap_has(mp->waiting, &input->prevout))
       continue;
 
     if (btc_hashmap_has(mp->orphans, input->prevout.hash))
@@ -1470,6 +4145,15 @@ btc_mempool_missing(btc_mempool_t *mp, const btc_tx_t *tx) {
   return missing;
 }
 
+size_t
+btc_mempool_wtxids(const uint8_t **hashes,
+                   const btc_mpentry_t *const **entries,
+                   btc_mempool_t *mp) {
+  *hashes = mp->wtxids.hashes;
+  *entries = mp->wtxids.entries;
+  return mp->wtxids.length;
+}
+
 void
 btc_mempool_iterate(btc_mpiter_t *iter, btc_mempool_t *mp) {
   btc_hashmap_iterate(iter, mp->map);
@@ -1483,3 +4167,43 @@ btc_mempool_next(const btc_mpentry_t **entry, btc_mpiter_t *iter) {
   }
   return 0;
 }
+
+void
+btc_mempool_queue(btc_vector_t *queue, btc_mempool_t *mp) {
+  const struct btc_mpwtxids_s *z = &mp->wtxids;
+  size_t i;
+
+  btc_vector_reset(queue);
+
+  /* One cursor per cluster, at its best chunk. */
+  for (i = 0; i < z->length; i++) {
+    if (z->entries[i]->_pos == 0)
+      btc_vector_push(queue, z->entries[i]);
+  }
+
+  btc_heap_init(queue, cmp_chunk);
+}
+
+size_t
+btc_mempool_dequeue(const btc_mpentry_t *const **chunk, btc_vector_t *queue) {
+  const btc_mpentry_t *head;
+  const btc_mpcluster_t *cluster;
+  size_t start, end;
+
+  if (queue->length == 0)
+    return 0;
+
+  head = btc_heap_shift(queue, cmp_chunk);
+  cluster = head->_cluster;
+  start = head->_pos;
+  end = head->_chunk;
+
+  /* Chunk feerates decrease along a cluster, so its
+     next chunk can never jump ahead of this one. */
+  if (end < cluster->length)
+    btc_heap_insert(queue, cluster->items[end], cmp_chunk);
+
+  *chunk = (const btc_mpentry_t *const *)&cluster->items[start];
+
+  return end - start;
+}
@@ -51,27 +51,41 @@
 static const uint8_t zero_nonce[32] = {0};
 static const uint8_t default_flags[] = "mined by mako";
 
+/* How long a shared template is extended before
+   being reassembled from the mempool. */
+#define BTC_MINER_REBUILD (60 * 1000)
+
+/* Nonces a CPU miner thread scans between
+   checks for a new job. */
+#define BTC_CPUMINER_CHUNK (1 << 16)
+
 /*
  * Types
  */
 
 struct btc_cpuminer_s;
 
+typedef struct btc_cpujob_s {
+  btc_tmpl_t *tmpl;
+  int64_t offset;
+  /* Protected by cpu.lock. */
+  int refs;
+} btc_cpujob_t;
+
 typedef struct btc_cputhread_s {
   struct btc_cpuminer_s *cpu;
   uint32_t nonce1;
-  uint32_t nonce2;
+  int pin;
   /* Protected by cpu.lock. */
+  btc_cpujob_t *found;
+  uint32_t nonce2;
   int64_t time;
   uint32_t nonce;
-  uint8_t root[32];
-  int result;
 } btc_cputhread_t;
 
 typedef struct btc_cpuminer_s {
   btc_miner_t *miner;
   int mining;
-  int64_t last_check;
   btc_mutex_t *lock;
   btc_cond_t *master;
   btc_cond_t *worker;
@@ -80,9 +94,13 @@ typedef struct btc_cpuminer_s {
   uint8_t last_tip[32];
   int64_t last_job;
   /* Protected by cpu.lock. */
-  btc_tmpl_t *job;
+  btc_cpujob_t *job;
   int active;
-  int stop;
+  /* Written with cpu.lock held, but also read
+     without it as a hint to go take the lock. */
+  volatile uint32_t epoch;
+  volatile int found;
+  volatile int stop;
 } btc_cpuminer_t;
 
 struct btc_miner_s {
@@ -96,6 +114,14 @@ struct btc_miner_s {
   btc_buffer_t cbflags;
   btc_vector_t addrs;
   btc_cpuminer_t cpu;
+  /* Shared template (loop only). */
+  btc_tmpl_t *tmpl;
+  btc_hashset_t *tmpl_txs;
+  btc_outset_t *tmpl_spent;
+  int64_t tmpl_built;
+  int tmpl_stale;
+  int tmpl_dirty;
+  unsigned int updates;
 };
 
 /*
@@ -126,7 +152,7 @@ btc_blockentry_copy(btc_blockentry_t *z, const btc_blockentry_t *x) {
 
 static void
 btc_blockentry_set_tx(btc_blockentry_t *z, const btc_tx_t *x) {
-  z->tx = btc_tx_clone(x);
+  z->tx = btc_tx_refconst(x);
   z->hash = z->tx->hash;
   z->whash = z->tx->whash;
   z->fee = 0;
@@ -134,7 +160,6 @@ btc_blockentry_set_tx(btc_blockentry_t *z, const btc_tx_t *x) {
   z->weight = btc_tx_weight(x);
   z->sigops = 0;
   z->desc_rate = 0;
-  z->dep_count = 0;
 }
 
 static void
@@ -144,7 +169,7 @@ btc_blockentry_set_view(btc_blockentry_t *z,
   int sigops = btc_tx_sigops_cost(x, view, BTC_SCRIPT_STANDARD_VERIFY_FLAGS);
   size_t size = btc_tx_sigops_size(x, sigops);
 
-  z->tx = btc_tx_clone(x);
+  z->tx = btc_tx_refconst(x);
   z->hash = z->tx->hash;
   z->whash = z->tx->whash;
   z->fee = btc_tx_fee(x, view);
@@ -152,7 +177,6 @@ btc_blockentry_set_view(btc_blockentry_t *z,
   z->weight = btc_tx_weight(x);
   z->sigops = sigops;
   z->desc_rate = z->rate;
-  z->dep_count = 0;
 }
 
 static void
@@ -164,8 +188,7 @@ btc_blockentry_set_mpentry(btc_blockentry_t *z, const btc_mpentry_t *x) {
   z->rate = btc_get_rate(x->size, x->delta_fee);
   z->weight = btc_tx_weight(x->tx);
   z->sigops = x->sigops;
-  z->desc_rate = btc_get_rate(x->desc_size, x->desc_fee);
-  z->dep_count = 0;
+  z->desc_rate = btc_get_rate(x->chunk_size, x->chunk_fee);
 }
 
 /*
@@ -347,6 +370,39 @@ btc_tmpl_compute(uint8_t *root, const btc_tmpl_t *bt, const uint8_t *hash) {
   btc_free(hashes);
 }
 
+uint8_t *
+btc_tmpl_branch(size_t *length, const btc_tmpl_t *bt) {
+  size_t size = bt->txs.length + 1;
+  uint8_t *nodes = (uint8_t *)btc_malloc(size * 32);
+  uint8_t *branch;
+  size_t i, n;
+
+  *length = 0;
+
+  for (n = size; n > 1; n = (n + 1) / 2)
+    *length += 1;
+
+  branch = (uint8_t *)btc_malloc(*length * 32 + 1);
+
+  /* The coinbase slot never feeds into its siblings. */
+  btc_hash_init(&nodes[0 * 32]);
+
+  for (i = 1; i < size; i++) {
+    const btc_blockentry_t *entry = bt->txs.items[i - 1];
+
+    btc_hash_copy(&nodes[i * 32], entry->hash);
+  }
+
+  for (i = 0, n = size; n > 1; i++, n = (n + 1) / 2) {
+    btc_hash_copy(&branch[i * 32], &nodes[1 * 32]);
+    btc_merkle_level(nodes, nodes, n);
+  }
+
+  btc_free(nodes);
+
+  return branch;
+}
+
 void
 btc_tmpl_root(uint8_t *root,
               const btc_tmpl_t *bt,
@@ -565,6 +621,40 @@ fail:
  * CPU Miner
  */
 
+/* Jobs are handed to the threads by epoch: the loop
+ * publishes a new job under the lock and bumps the
+ * epoch, while the threads only glance at the epoch
+ * between chunks and take the lock when it changes.
+ *
+ * Every thread owns its extranonce1 (its index) and
+ * rolls the time and extranonce2 itself, so threads
+ * never share nonce space or wait on each other.
+ *
+ * Found blocks are handed back with a reference to
+ * the job they were mined on, so a block is never
+ * lost to a job refresh that raced with it.
+ */
+
+static btc_cpujob_t *
+btc_cpujob_create(btc_tmpl_t *bt, int64_t offset) {
+  btc_cpujob_t *job = btc_malloc(sizeof(btc_cpujob_t));
+
+  job->tmpl = bt;
+  job->offset = offset;
+  job->refs = 1;
+
+  return job;
+}
+
+static void
+btc_cpujob_release(btc_cpujob_t *job) {
+  /* Must be called with lock held. */
+  if (job != NULL && --job->refs == 0) {
+    btc_tmpl_destroy(job->tmpl);
+    btc_free(job);
+  }
+}
+
 static void
 btc_cpuminer_init(btc_cpuminer_t *cpu, btc_miner_t *miner, int length) {
   btc_cputhread_t *thread;
@@ -575,7 +665,6 @@ btc_cpuminer_init(btc_cpuminer_t *cpu, btc_miner_t *miner, int length) {
 
   cpu->miner = miner;
   cpu->mining = 0;
-  cpu->last_check = 0;
   cpu->lock = btc_mutex_create();
   cpu->master = btc_cond_create();
   cpu->worker = btc_cond_create();
@@ -585,6 +674,8 @@ btc_cpuminer_init(btc_cpuminer_t *cpu, btc_miner_t *miner, int length) {
   cpu->last_job = 0;
   cpu->job = NULL;
   cpu->active = 0;
+  cpu->epoch = 0;
+  cpu->found = 0;
   cpu->stop = 0;
 
   for (i = 0; i < length; i++) {
@@ -593,7 +684,9 @@ btc_cpuminer_init(btc_cpuminer_t *cpu, btc_miner_t *miner, int length) {
     memset(thread, 0, sizeof(*thread));
 
     thread->cpu = cpu;
-    thread->result = -1;
+    thread->nonce1 = i;
+    thread->pin = -1;
+    thread->found = NULL;
   }
 }
 
@@ -606,57 +699,50 @@ btc_cpuminer_clear(btc_cpuminer_t *cpu) {
 }
 
 static void
-btc_cpuminer_start_job(btc_cpuminer_t *cpu) {
-  /* Must be called with lock held. */
-  btc_cputhread_t *thread;
-  int i;
+btc_cpuminer_publish(btc_cpuminer_t *cpu, btc_tmpl_t *bt) {
+  btc_miner_t *miner = cpu->miner;
+  btc_cpujob_t *job = NULL;
 
-  if (cpu->job != NULL)
-    btc_tmpl_destroy(cpu->job);
+  if (bt != NULL) {
+    int64_t offset = btc_timedata_now(miner->timedata) - btc_now();
 
-  cpu->job = btc_miner_template(cpu->miner);
+    job = btc_cpujob_create(bt, offset);
 
-  btc_hash_copy(cpu->last_tip, cpu->job->prev_block);
+    btc_hash_copy(cpu->last_tip, bt->prev_block);
 
-  cpu->last_job = btc_time_msec();
+    cpu->last_job = btc_time_msec();
+  }
 
-  for (i = 0; i < cpu->length; i++) {
-    thread = &cpu->threads[i];
+  btc_mutex_lock(cpu->lock);
 
-    thread->nonce1 = UINT32_C(1) << (31 - i);
-    thread->nonce2 = 0;
-    thread->time = cpu->job->time;
-    thread->nonce = 0;
+  btc_cpujob_release(cpu->job);
 
-    btc_tmpl_root(thread->root, cpu->job, thread->nonce1, 0);
+  cpu->job = job;
+  cpu->epoch++;
 
-    thread->result = -1;
-  }
+  btc_cond_broadcast(cpu->worker);
+  btc_mutex_unlock(cpu->lock);
 }
 
 static void
-btc_cpuminer_stop_job(btc_cpuminer_t *cpu) {
+btc_cpuminer_reset(btc_cpuminer_t *cpu) {
   /* Must be called with lock held. */
   btc_cputhread_t *thread;
   int i;
 
-  if (cpu->job != NULL)
-    btc_tmpl_destroy(cpu->job);
-
-  cpu->job = NULL;
-
   for (i = 0; i < cpu->length; i++) {
     thread = &cpu->threads[i];
 
-    thread->nonce1 = 0;
-    thread->nonce2 = 0;
-    thread->time = 0;
-    thread->nonce = 0;
+    btc_cpujob_release(thread->found);
 
-    btc_hash_init(thread->root);
-
-    thread->result = -1;
+    thread->found = NULL;
   }
+
+  btc_cpujob_release(cpu->job);
+
+  cpu->job = NULL;
+  cpu->epoch++;
+  cpu->found = 0;
 }
 
 static void
@@ -665,11 +751,14 @@ on_tick(void *arg);
 static void
 mining_thread(void *arg);
 
+static void
+btc_miner_log(btc_miner_t *miner, const char *fmt, ...);
+
 static void
 btc_cpuminer_start(btc_cpuminer_t *cpu, int active) {
   btc_thread_t *thread = btc_thread_alloc();
   btc_miner_t *miner = cpu->miner;
-  int i;
+  int i, pin;
 
   if (active < 1)
     active = 1;
@@ -684,13 +773,23 @@ btc_cpuminer_start(btc_cpuminer_t *cpu, int active) {
 
   btc_loop_on_tick(miner->loop, on_tick, cpu);
 
+  btc_mutex_lock(cpu->lock);
+
   for (i = 0; i < active; i++) {
     btc_thread_create(thread, mining_thread, &cpu->threads[i]);
+
+    pin = cpu->threads[i].pin;
+
+    if (pin >= 0 && !btc_thread_pin(thread, pin))
+      btc_miner_log(miner, "Could not pin miner thread to CPU %d.", pin);
+
     btc_thread_detach(thread);
   }
 
   cpu->active = active;
 
+  btc_mutex_unlock(cpu->lock);
+
   btc_thread_free(thread);
 }
 
@@ -704,21 +803,22 @@ btc_cpuminer_stop(btc_cpuminer_t *cpu) {
 
   cpu->stop = 1;
 
-  btc_cpuminer_stop_job(cpu);
-  btc_hash_init(cpu->last_tip);
-
-  btc_cond_signal(cpu->worker);
-  btc_mutex_unlock(cpu->lock);
+  btc_cpuminer_reset(cpu);
 
-  btc_mutex_lock(cpu->lock);
+  btc_cond_broadcast(cpu->worker);
 
   while (cpu->active > 0)
     btc_cond_wait(cpu->master, cpu->lock);
 
+  /* Threads may have handed back blocks on their way out. */
+  btc_cpuminer_reset(cpu);
+
   cpu->stop = 0;
 
   btc_mutex_unlock(cpu->lock);
 
+  btc_hash_init(cpu->last_tip);
+
   cpu->mining = 0;
 
   btc_loop_off_tick(miner->loop, on_tick, cpu);
@@ -737,163 +837,156 @@ btc_cpuminer_setgenerate(btc_cpuminer_t *cpu, int value, int active) {
     btc_cpuminer_stop(cpu);
 }
 
-static void
-on_tick(void *arg) {
-  btc_cpuminer_t *cpu = arg;
-  btc_miner_t *miner = cpu->miner;
-  int64_t now = btc_time_msec();
+static btc_block_t *
+btc_cpuminer_collect(btc_cpuminer_t *cpu, const btc_entry_t *tip) {
+  btc_block_t *block = NULL;
   btc_cputhread_t *thread;
-  const btc_entry_t *tip;
   btc_blockproof_t proof;
-  btc_block_t *block;
+  const btc_tmpl_t *bt;
   int i;
 
-  CHECK(cpu->mining == 1);
-
-  if (now < cpu->last_check + 25)
-    return;
-
-  cpu->last_check = now;
-
   btc_mutex_lock(cpu->lock);
 
-  /* Get tip for below checks. */
-  tip = btc_chain_tip(miner->chain);
-
-  /* Do we have a job? */
-  if (cpu->job == NULL) {
-    /* Is this a new tip? */
-    if (!btc_hash_equal(cpu->last_tip, tip->hash)) {
-      /* Start a new job. */
-      btc_cpuminer_start_job(cpu);
-      btc_cond_broadcast(cpu->worker);
-    }
-    goto done;
-  }
+  cpu->found = 0;
 
   for (i = 0; i < cpu->length; i++) {
     thread = &cpu->threads[i];
 
-    /* Did we find a block? */
-    if (thread->result == 1) {
+    if (thread->found == NULL)
+      continue;
+
+    bt = thread->found->tmpl;
+
+    /* Blocks for an old tip are discarded. */
+    if (block == NULL && btc_hash_equal(bt->prev_block, tip->hash)) {
       CHECK(btc_tmpl_prove(&proof,
-                           cpu->job,
+                           bt,
                            thread->nonce1,
                            thread->nonce2,
                            thread->time,
                            thread->nonce));
 
-      block = btc_tmpl_commit(cpu->job, &proof);
+      block = btc_tmpl_commit(bt, &proof);
+    }
 
-      if (!btc_hash_equal(cpu->job->prev_block, tip->hash)) {
-        /* Job is stale. Start new job immediately. */
-        btc_cpuminer_start_job(cpu);
-        btc_cond_broadcast(cpu->worker);
-      } else {
-        /* Wait for new job. */
-        btc_cpuminer_stop_job(cpu);
-      }
+    btc_cpujob_release(thread->found);
+
+    thread->found = NULL;
+  }
+
+  btc_mutex_unlock(cpu->lock);
+
+  return block;
+}
+
+static void
+on_tick(void *arg) {
+  btc_cpuminer_t *cpu = arg;
+  btc_miner_t *miner = cpu->miner;
+  const btc_entry_t *tip = btc_chain_tip(miner->chain);
+  btc_block_t *block;
+
+  CHECK(cpu->mining == 1);
 
-      btc_mutex_unlock(cpu->lock);
+  /* Did we find a block? */
+  if (cpu->found) {
+    block = btc_cpuminer_collect(cpu, tip);
 
+    if (block != NULL) {
       CHECK(btc_chain_add(miner->chain, block, BTC_BLOCK_DEFAULT_FLAGS, 0));
 
       btc_block_destroy(block);
 
-      return;
+      tip = btc_chain_tip(miner->chain);
     }
   }
 
-  /* Is our job stale? */
-  if (!btc_hash_equal(cpu->job->prev_block, tip->hash)) {
-    btc_cpuminer_start_job(cpu);
-    btc_cond_broadcast(cpu->worker);
-    goto done;
+  /* Is this a new tip? */
+  if (!btc_hash_equal(cpu->last_tip, tip->hash)) {
+    btc_cpuminer_publish(cpu, btc_miner_template(miner));
+    return;
   }
 
   /* Do we need to check the mempool again? */
-  if (now >= cpu->last_job + 60 * 1000) {
-    btc_cpuminer_start_job(cpu);
-    btc_cond_broadcast(cpu->worker);
-    goto done;
-  }
+  if (btc_time_msec() >= cpu->last_job + 60 * 1000)
+    btc_cpuminer_publish(cpu, btc_miner_template(miner));
+}
 
-  now = btc_timedata_now(miner->timedata);
+static void
+mining_thread(void *arg) {
+  btc_cputhread_t *thread = arg;
+  btc_cpuminer_t *cpu = thread->cpu;
+  btc_cpujob_t *job = NULL;
+  uint32_t nonce2 = 0;
+  uint8_t root[32];
+  uint32_t epoch;
+  btc_header_t hdr;
+  int64_t now;
 
-  for (i = 0; i < cpu->length; i++) {
-    thread = &cpu->threads[i];
+  btc_mutex_lock(cpu->lock);
 
-    /* Are we still working? */
-    if (thread->result == -1)
-      continue;
+  epoch = cpu->epoch - 1;
 
-    /* Update timestamp if possible. */
-    if (now > thread->time) {
-      thread->nonce = 0;
-      thread->time = now;
-      thread->result = -1;
-      continue;
-    }
+  for (;;) {
+    /* Lock held. */
+    while (!cpu->stop && (cpu->job == NULL || cpu->epoch == epoch))
+      btc_cond_wait(cpu->worker, cpu->lock);
 
-    /* Increment extra nonce. */
-    if (thread->nonce >= (UINT32_C(1) << 31)) {
-      thread->nonce1 += (++thread->nonce2 == 0);
-      thread->nonce = 0;
+    if (cpu->stop)
+      break;
 
-      btc_tmpl_root(thread->root,
-                    cpu->job,
-                    thread->nonce1,
-                    thread->nonce2);
+    job = cpu->job;
+    job->refs++;
+    epoch = cpu->epoch;
 
-      thread->result = -1;
+    btc_mutex_unlock(cpu->lock);
 
-      continue;
-    }
+    nonce2 = 0;
 
-    thread->result = -1;
-  }
+    btc_tmpl_root(root, job->tmpl, thread->nonce1, nonce2);
+    btc_tmpl_header(&hdr, job->tmpl, root, job->tmpl->time, 0);
 
-  btc_cond_broadcast(cpu->worker);
+    /* Lock-free until the epoch moves or we find a block. */
+    while (cpu->epoch == epoch && !cpu->stop) {
+      if (btc_header_mine(&hdr, BTC_CPUMINER_CHUNK)) {
+        btc_mutex_lock(cpu->lock);
 
-done:
-  btc_mutex_unlock(cpu->lock);
-}
+        if (thread->found == NULL) {
+          thread->found = job;
+          thread->nonce2 = nonce2;
+          thread->time = hdr.time;
+          thread->nonce = hdr.nonce;
 
-static void
-mining_thread(void *arg) {
-  btc_cputhread_t *thread = arg;
-  btc_cpuminer_t *cpu = thread->cpu;
-  btc_header_t hdr;
-  int result = -1;
+          cpu->found = 1;
 
-  for (;;) {
-    btc_mutex_lock(cpu->lock);
+          job = NULL;
+        }
 
-    CHECK(thread->result == -1);
+        btc_mutex_unlock(cpu->lock);
 
-    if (result != -1) {
-      thread->result = result;
-      thread->nonce = hdr.nonce;
-    }
+        btc_loop_wakeup(cpu->miner->loop);
 
-    while (!cpu->stop) {
-      if (cpu->job != NULL && thread->result == -1)
         break;
+      }
 
-      btc_cond_wait(cpu->worker, cpu->lock);
-    }
+      /* Nonce space exhausted. */
+      if (hdr.nonce == 0) {
+        now = btc_now() + job->offset;
 
-    if (cpu->stop)
-      break;
+        if (now > (int64_t)hdr.time) {
+          hdr.time = now;
+        } else {
+          btc_tmpl_root(root, job->tmpl, thread->nonce1, ++nonce2);
+          btc_hash_copy(hdr.merkle_root, root);
+        }
+      }
+    }
 
-    btc_tmpl_header(&hdr, cpu->job,
-                          thread->root,
-                          thread->time,
-                          thread->nonce);
+    btc_mutex_lock(cpu->lock);
 
-    btc_mutex_unlock(cpu->lock);
+    btc_cpujob_release(job);
 
-    result = btc_header_mine(&hdr, 1 << 24);
+    job = NULL;
   }
 
   if (--cpu->active == 0)
@@ -927,6 +1020,9 @@ btc_miner_create(const btc_network_t *network,
   btc_vector_init(&miner->addrs);
   btc_cpuminer_init(&miner->cpu, miner, btc_sys_numcpu());
 
+  miner->tmpl_txs = btc_hashset_create();
+  miner->tmpl_spent = btc_outset_create();
+
   btc_buffer_set(&miner->cbflags, default_flags, sizeof(default_flags) - 1);
 
   return miner;
@@ -939,6 +1035,11 @@ btc_miner_destroy(btc_miner_t *miner) {
   for (i = 0; i < miner->addrs.length; i++)
     btc_address_destroy(miner->addrs.items[i]);
 
+  if (miner->tmpl != NULL)
+    btc_tmpl_destroy(miner->tmpl);
+
+  btc_hashset_destroy(miner->tmpl_txs);
+  btc_outset_destroy(miner->tmpl_spent);
   btc_vector_clear(&miner->addrs);
   btc_buffer_clear(&miner->cbflags);
   btc_cpuminer_clear(&miner->cpu);
@@ -956,6 +1057,15 @@ btc_miner_set_timedata(btc_miner_t *miner, const btc_timedata_t *td) {
   miner->timedata = td;
 }
 
+void
+btc_miner_set_cpus(btc_miner_t *miner, const int *cpus, size_t length) {
+  btc_cpuminer_t *cpu = &miner->cpu;
+  int i;
+
+  for (i = 0; i < cpu->length; i++)
+    cpu->threads[i].pin = length > 0 ? cpus[i % length] : -1;
+}
+
 static void
 btc_miner_log(btc_miner_t *miner, const char *fmt, ...) {
   va_list ap;
@@ -1021,107 +1131,112 @@ btc_miner_update_time(btc_miner_t *miner, btc_tmpl_t *bt) {
   bt->time = now;
 }
 
-static int64_t
-cmp_rate(const void *ap, const void *bp) {
-  const btc_blockentry_t *a = ap;
-  const btc_blockentry_t *b = bp;
+static int
+btc_miner_has_parents(btc_miner_t *miner,
+                      const btc_mpentry_t *const *chunk,
+                      size_t index,
+                      btc_hashset_t *included) {
+  const btc_tx_t *tx = chunk[index]->tx;
+  const btc_mpentry_t *parent;
+  size_t i, j;
 
-  int64_t x = a->rate;
-  int64_t y = b->rate;
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
 
-  if (a->desc_rate > a->rate)
-    x = a->desc_rate;
+    parent = btc_mempool_get(miner->mempool, input->prevout.hash);
 
-  if (b->desc_rate > b->rate)
-    y = b->desc_rate;
+    if (parent == NULL)
+      continue;
+
+    if (btc_hashset_has(included, parent->hash))
+      continue;
 
-  return y - x;
+    for (j = 0; j < index; j++) {
+      if (chunk[j] == parent)
+        break;
+    }
+
+    if (j == index)
+      return 0;
+  }
+
+  return 1;
 }
 
 static void
 btc_miner_assemble(btc_miner_t *miner, btc_tmpl_t *bt) {
-  btc_hashmap_t *depmap = btc_hashmap_create();
+  btc_hashset_t *included = btc_hashset_create();
   int64_t locktime = btc_tmpl_locktime(bt);
-  const btc_mpentry_t *entry;
+  const btc_mpentry_t *const *chunk;
+  size_t i, length, weight;
   btc_vector_t queue;
-  btc_mpiter_t iter;
-  size_t i;
+  int sigops, ok;
 
   btc_vector_init(&queue);
 
-  btc_mempool_iterate(&iter, miner->mempool);
-
-  while (btc_mempool_next(&entry, &iter)) {
-    btc_blockentry_t *item = btc_blockentry_create();
+  /* Walk the mempool chunk by chunk, merging the
+     cluster linearizations by chunk feerate. */
+  btc_mempool_queue(&queue, miner->mempool);
 
-    btc_blockentry_set_mpentry(item, entry);
+  while ((length = btc_mempool_dequeue(&chunk, &queue)) > 0) {
+    weight = 0;
+    sigops = 0;
+    ok = 1;
 
-    for (i = 0; i < item->tx->inputs.length; i++) {
-      const btc_input_t *input = item->tx->inputs.items[i];
-      const uint8_t *hash = input->prevout.hash;
+    /* A chunk is taken whole or not at all. Once
+       one is skipped, the rest of its cluster is
+       skipped too for want of parents. */
+    for (i = 0; i < length; i++) {
+      const btc_mpentry_t *item = chunk[i];
 
-      if (!btc_mempool_has(miner->mempool, hash))
-        continue;
+      if (!btc_miner_has_parents(miner, chunk, i, included)) {
+        ok = 0;
+        break;
+      }
 
-      item->dep_count += 1;
+      if (!btc_tx_is_final(item->tx, bt->height, locktime)) {
+        ok = 0;
+        break;
+      }
 
-      if (!btc_hashmap_has(depmap, hash))
-        btc_hashmap_put(depmap, hash, btc_vector_create());
+      if (!(bt->flags & BTC_SCRIPT_VERIFY_WITNESS)) {
+        if (btc_tx_has_witness(item->tx)) {
+          ok = 0;
+          break;
+        }
+      }
 
-      btc_vector_push(btc_hashmap_get(depmap, hash), item);
+      weight += btc_tx_weight(item->tx);
+      sigops += item->sigops;
     }
 
-    if (item->dep_count > 0)
-      continue;
-
-    btc_heap_insert(&queue, item, cmp_rate);
-  }
-
-  while (queue.length > 0) {
-    const btc_blockentry_t *item = btc_heap_shift(&queue, cmp_rate);
-    btc_vector_t *deps;
-
-    if (!btc_tx_is_final(item->tx, bt->height, locktime))
+    if (!ok)
       continue;
 
-    if (!(bt->flags & BTC_SCRIPT_VERIFY_WITNESS)) {
-      if (btc_tx_has_witness(item->tx))
-        continue;
-    }
-
-    if (bt->weight + item->weight > BTC_MAX_POLICY_BLOCK_WEIGHT)
+    if (bt->weight + weight > BTC_MAX_POLICY_BLOCK_WEIGHT)
       continue;
 
-    if (bt->sigops + item->sigops > BTC_MAX_BLOCK_SIGOPS_COST)
+    if (bt->sigops + sigops > BTC_MAX_BLOCK_SIGOPS_COST)
       continue;
 
-    bt->weight += item->weight;
-    bt->sigops += item->sigops;
-    bt->fees += item->fee;
-
-    btc_vector_push(&bt->txs, item);
-
-    deps = btc_hashmap_get(depmap, item->hash);
+    for (i = 0; i < length; i++) {
+      const btc_mpentry_t *item = chunk[i];
+      btc_blockentry_t *child = btc_blockentry_create();
 
-    if (deps == NULL)
-      continue;
+      btc_blockentry_set_mpentry(child, item);
 
-    for (i = 0; i < deps->length; i++) {
-      btc_blockentry_t *child = deps->items[i];
+      bt->weight += child->weight;
+      bt->sigops += child->sigops;
+      bt->fees += child->fee;
 
-      if (--child->dep_count == 0)
-        btc_heap_insert(&queue, child, cmp_rate);
+      btc_vector_push(&bt->txs, child);
+      btc_hashset_put(included, item->hash);
     }
   }
 
   btc_tmpl_refresh(bt);
 
-  btc_hashmap_iterate(&iter, depmap);
-
-  while (btc_hashmap_next(&iter))
-    btc_vector_destroy(iter.val);
-
-  btc_hashmap_destroy(depmap);
+  btc_hashset_destroy(included);
   btc_vector_clear(&queue);
 }
 
@@ -1129,7 +1244,7 @@ btc_tmpl_t *
 btc_miner_template(btc_miner_t *miner) {
   const btc_entry_t *tip = btc_chain_tip(miner->chain);
   uint32_t version = btc_chain_compute_version(miner->chain, tip);
-  int64_t mtp = btc_entry_median_time(tip);
+  int64_t mtp = btc_chain_median_time(miner->chain, tip);
   int64_t time = btc_timedata_now(miner->timedata);
   btc_tmpl_t *bt = btc_tmpl_create();
   btc_deployment_state_t state;
@@ -1169,6 +1284,118 @@ btc_miner_template(btc_miner_t *miner) {
   return bt;
 }
 
+static void
+btc_miner_index(btc_miner_t *miner, const btc_tx_t *tx) {
+  size_t i;
+
+  btc_hashset_put(miner->tmpl_txs, tx->hash);
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    btc_outset_put(miner->tmpl_spent, &input->prevout);
+  }
+}
+
+static void
+btc_miner_rebuild(btc_miner_t *miner) {
+  btc_tmpl_t *bt = btc_miner_template(miner);
+  size_t i;
+
+  /* The sets point into the old template. */
+  btc_hashset_reset(miner->tmpl_txs);
+  btc_outset_reset(miner->tmpl_spent);
+
+  if (miner->tmpl != NULL)
+    btc_tmpl_destroy(miner->tmpl);
+
+  for (i = 0; i < bt->txs.length; i++) {
+    const btc_blockentry_t *item = bt->txs.items[i];
+
+    btc_miner_index(miner, item->tx);
+  }
+
+  miner->tmpl = bt;
+  miner->tmpl_built = btc_time_msec();
+  miner->tmpl_stale = 0;
+  miner->tmpl_dirty = 0;
+  miner->updates++;
+}
+
+const btc_tmpl_t *
+btc_miner_get_template(btc_miner_t *miner) {
+  const btc_entry_t *tip = btc_chain_tip(miner->chain);
+  btc_tmpl_t *bt = miner->tmpl;
+
+  if (bt == NULL || !btc_hash_equal(bt->prev_block, tip->hash)) {
+    btc_miner_rebuild(miner);
+  } else if (miner->tmpl_stale) {
+    /* Transactions were added (or skipped) since the
+       template was assembled. A full pass may find a
+       better selection. */
+    if (btc_time_msec() >= miner->tmpl_built + BTC_MINER_REBUILD)
+      btc_miner_rebuild(miner);
+  }
+
+  bt = miner->tmpl;
+
+  if (miner->tmpl_dirty) {
+    btc_tmpl_refresh(bt);
+    miner->tmpl_dirty = 0;
+  }
+
+  btc_miner_update_time(miner, bt);
+
+  return bt;
+}
+
+unsigned int
+btc_miner_updates(btc_miner_t *miner) {
+  return miner->updates;
+}
+
+void
+btc_miner_add_tx(btc_miner_t *miner,
+                 const btc_tx_t *tx,
+                 const btc_view_t *view) {
+  const btc_entry_t *tip = btc_chain_tip(miner->chain);
+  btc_tmpl_t *bt = miner->tmpl;
+  const btc_blockentry_t *item;
+  size_t i;
+
+  /* Nothing to extend; the next request rebuilds. */
+  if (bt == NULL || !btc_hash_equal(bt->prev_block, tip->hash))
+    return;
+
+  miner->tmpl_stale = 1;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+    const uint8_t *hash = input->prevout.hash;
+
+    /* A replacement for something we already include. */
+    if (btc_outset_has(miner->tmpl_spent, &input->prevout))
+      return;
+
+    /* Unconfirmed parents must come first. */
+    if (btc_mempool_has(miner->mempool, hash)) {
+      if (!btc_hashset_has(miner->tmpl_txs, hash))
+        return;
+    }
+  }
+
+  if (!btc_tmpl_add(bt, tx, view))
+    return;
+
+  /* Index our own copy. */
+  item = bt->txs.items[bt->txs.length - 1];
+
+  btc_miner_index(miner, item->tx);
+
+  miner->tmpl_dirty = 1;
+  miner->updates++;
+}
+
 int
 btc_miner_getgenerate(btc_miner_t *miner) {
   return miner->cpu.mining;
@@ -11,15 +11,22 @@
 
 #include <io/core.h>
 #include <io/loop.h>
+#include <io/trace.h>
 
 #include <node/addrman.h>
 #include <node/chain.h>
+#include <node/chaindb.h>
+#include <node/addrindex.h>
+#include <node/filterdb.h>
 #include <node/logger.h>
 #include <node/mempool.h>
 #include <node/miner.h>
 #include <node/node.h>
+#include <node/notify.h>
+#include <node/perf.h>
 #include <node/pool.h>
 #include <node/rpc.h>
+#include <node/stratum.h>
 #include <node/timedata.h>
 
 #include <mako/block.h>
@@ -39,6 +46,13 @@
 
 #include "../internal.h"
 
+/*
+ * Constants
+ */
+
+/* Milliseconds between a replica's looks at the primary. */
+#define REFRESH_INTERVAL 500
+
 /*
  * Callbacks
  */
@@ -63,6 +77,9 @@ on_reorganize(const btc_entry_t *old, const btc_entry_t *new_, void *arg);
 static void
 on_tx(const btc_mpentry_t *entry, const btc_view_t *view, void *arg);
 
+static void
+on_tick(void *arg);
+
 /*
  * Node
  */
@@ -77,27 +94,44 @@ btc_node_create(const btc_network_t *network) {
   node->loop = btc_loop_create();
   node->logger = btc_logger_create();
   node->timedata = btc_timedata_create();
+  node->perf = btc_perf_create();
   node->chain = btc_chain_create(network);
   node->mempool = btc_mempool_create(network, node->chain);
   node->miner = btc_miner_create(network, node->loop, node->chain, node->mempool);
   node->pool = btc_pool_create(network, node->loop, node->chain, node->mempool);
   node->rpc = btc_rpc_create(node);
+  node->notify = btc_notify_create(node->loop);
+  node->stratum = btc_stratum_create(network, node->loop,
+                                     node->chain, node->miner);
+  node->filterdb = btc_filterdb_create(node->chain);
+  node->addrindex = btc_addrindex_create(node->chain);
 
   btc_chain_set_logger(node->chain, node->logger);
   btc_mempool_set_logger(node->mempool, node->logger);
   btc_miner_set_logger(node->miner, node->logger);
   btc_pool_set_logger(node->pool, node->logger);
+  btc_notify_set_logger(node->notify, node->logger);
+  btc_stratum_set_logger(node->stratum, node->logger);
+  btc_filterdb_set_logger(node->filterdb, node->logger);
+  btc_addrindex_set_logger(node->addrindex, node->logger);
 
   btc_chain_set_timedata(node->chain, node->timedata);
   btc_mempool_set_timedata(node->mempool, node->timedata);
   btc_miner_set_timedata(node->miner, node->timedata);
   btc_pool_set_timedata(node->pool, node->timedata);
 
+  btc_chain_set_perf(node->chain, node->perf);
+  btc_mempool_set_perf(node->mempool, node->perf);
+  btc_mempool_set_loop(node->mempool, node->loop);
+  btc_pool_set_perf(node->pool, node->perf);
+
   btc_chain_set_context(node->chain, node);
   btc_chain_on_connect(node->chain, on_connect);
   btc_chain_on_disconnect(node->chain, on_disconnect);
   btc_chain_on_reorganize(node->chain, on_reorganize);
 
+  btc_pool_set_filterdb(node->pool, node->filterdb);
+
   btc_mempool_set_context(node->mempool, node);
   btc_mempool_on_tx(node->mempool, on_tx);
 
@@ -109,11 +143,20 @@ btc_node_destroy(btc_node_t *node) {
   btc_loop_destroy(node->loop);
   btc_logger_destroy(node->logger);
   btc_timedata_destroy(node->timedata);
+  btc_perf_destroy(node->perf);
   btc_chain_destroy(node->chain);
   btc_mempool_destroy(node->mempool);
   btc_miner_destroy(node->miner);
   btc_pool_destroy(node->pool);
   btc_rpc_destroy(node->rpc);
+  btc_notify_destroy(node->notify);
+  btc_stratum_destroy(node->stratum);
+  btc_filterdb_destroy(node->filterdb);
+  btc_addrindex_destroy(node->addrindex);
+
+  if (node->trace_file != NULL)
+    btc_free(node->trace_file);
+
   btc_free(node);
 }
 
@@ -125,10 +168,109 @@ btc_node_log(btc_node_t *node, const char *fmt, ...) {
   va_end(ap);
 }
 
+int
+btc_node_replay(btc_node_t *node, const char *dir, int scripts) {
+  btc_dbstats_t db0, db1;
+  btc_hist_t sync0, sync1;
+  btc_replay_t stats;
+  double secs, mb;
+  int ret;
+
+  /* Without a directory, finish a reindex (if any). */
+  btc_chain_counters(node->chain, &db0);
+  btc_chain_sync_stats(node->chain, &sync0);
+
+  if (dir != NULL)
+    ret = btc_chain_replay(node->chain, dir, scripts, &stats);
+  else
+    ret = btc_chain_reindex(node->chain, &stats);
+
+  if (!ret)
+    return 0;
+
+  btc_chain_counters(node->chain, &db1);
+  btc_chain_sync_stats(node->chain, &sync1);
+
+  secs = (double)stats.elapsed / 1000000000.0;
+  mb = (double)stats.bytes / (1 << 20);
+
+  if (secs <= 0.0)
+    secs = 1e-9;
+
+  btc_node_log(node, "Replayed %lld blocks (skipped=%lld, height=%d)"
+                     " from %lld files in %.2fs.",
+                     (long long)stats.blocks,
+                     (long long)stats.skipped,
+                     btc_chain_height(node->chain),
+                     (long long)stats.files,
+                     secs);
+
+  btc_node_log(node, "Replay: %.1f blocks/s, %.1f tx/s, %.1f inputs/s%s.",
+                     (double)stats.blocks / secs,
+                     (double)stats.txs / secs,
+                     (double)stats.inputs / secs,
+                     scripts ? "" : " (no scripts)");
+
+  btc_node_log(node, "Replay I/O: read=%.1fMB (%.1fMB/s)"
+                     " pages_read=%d pages_written=%d syncs=%llu.",
+                     mb, mb / secs,
+                     db1.pages_read - db0.pages_read,
+                     db1.pages_written - db0.pages_written,
+                     (unsigned long long)(sync1.count - sync0.count));
+
+  return 1;
+}
+
+typedef struct btc_loader_s {
+  btc_chain_t *chain;
+  btc_loop_t *loop;
+  const char *prefix;
+  unsigned int flags;
+  volatile long done;
+  int result;
+} btc_loader_t;
+
+static void
+btc_loader_start(void *arg) {
+  btc_loader_t *loader = arg;
+
+  loader->result = btc_chain_open(loader->chain,
+                                  loader->prefix,
+                                  loader->flags);
+
+  btc_atomic_store(&loader->done, 1);
+  btc_loop_wakeup(loader->loop);
+}
+
+static int
+btc_node_open_replica(btc_node_t *node,
+                      const char *prefix,
+                      unsigned int flags) {
+  /* Just the chain and the RPC server: a replica has
+     no peers, and validates and writes nothing. */
+  if (!btc_chain_open(node->chain, prefix, flags))
+    return 0;
+
+  if (!btc_rpc_open(node->rpc, flags)) {
+    btc_chain_close(node->chain);
+    return 0;
+  }
+
+  node->readonly = 1;
+  node->refreshed = btc_time_msec();
+
+  btc_loop_on_tick(node->loop, on_tick, node);
+
+  return 1;
+}
+
 int
 btc_node_open(btc_node_t *node, const char *prefix, unsigned int flags) {
   char path[BTC_PATH_MAX];
   char file[BTC_PATH_MAX];
+  btc_thread_t *thread;
+  btc_loader_t loader;
+  int ok;
 
   if (!btc_path_resolve(path, sizeof(path), prefix, 0))
     return 0;
@@ -136,36 +278,122 @@ btc_node_open(btc_node_t *node, const char *prefix, unsigned int flags) {
   if (!btc_fs_mkdirp(path, 0755))
     return 0;
 
-  if (!btc_path_join(file, sizeof(file), path, "debug.log", 0))
+  if (!btc_path_join(file, sizeof(file), path,
+                     (flags & BTC_CHAIN_READONLY) ? "replica.log"
+                                                  : "debug.log", 0)) {
     return 0;
+  }
 
   if (!btc_logger_open(node->logger, file))
     return 0;
 
+  if (node->trace_file == NULL) {
+    if (!btc_path_join(file, sizeof(file), path, "trace.json", 0))
+      goto fail1;
+
+    node->trace_file = btc_strdup(file);
+  }
+
   btc_node_log(node, "Opening node.");
 
-  if (!btc_chain_open(node->chain, path, flags))
+  if (flags & BTC_CHAIN_READONLY) {
+    if (!btc_node_open_replica(node, path, flags))
+      goto fail1;
+
+    return 1;
+  }
+
+  /* Loading the block index dominates startup. It
+     runs on its own thread while we bring up the
+     pieces which do not depend on it: the RPC server
+     (answering with a warmup error for now) and the
+     address manager. Everything which reads chain
+     state opens after the loader has been joined. */
+  loader.chain = node->chain;
+  loader.loop = node->loop;
+  loader.prefix = path;
+  loader.flags = flags;
+  loader.done = 0;
+  loader.result = 0;
+
+  thread = btc_thread_alloc();
+
+  btc_thread_create(thread, btc_loader_start, &loader);
+
+  btc_rpc_set_warmup(node->rpc, "Loading block index...");
+
+  ok = btc_rpc_open(node->rpc, flags);
+
+  if (ok && !btc_pool_load(node->pool, path, flags)) {
+    btc_rpc_close(node->rpc);
+    ok = 0;
+  }
+
+  /* Serve warmup errors until the chain is ready. */
+  while (!btc_atomic_load(&loader.done))
+    btc_loop_poll(node->loop, 100);
+
+  btc_thread_join(thread);
+  btc_thread_free(thread);
+
+  if (!loader.result) {
+    if (ok) {
+      btc_pool_unload(node->pool);
+      btc_rpc_close(node->rpc);
+    }
     goto fail1;
+  }
 
-  if (!btc_mempool_open(node->mempool, path, flags))
+  if (!ok)
     goto fail2;
 
-  if (!btc_miner_open(node->miner, flags))
+  /* Restoring the mempool checks entries against
+     the tip and the coins, so it needs the chain. */
+  if (!btc_mempool_open(node->mempool, path, flags))
     goto fail3;
 
-  if (!btc_pool_open(node->pool, path, flags))
+  if (!btc_filterdb_open(node->filterdb, path, flags))
     goto fail4;
 
-  if (!btc_rpc_open(node->rpc, flags))
+  if (!btc_addrindex_open(node->addrindex, path, flags))
     goto fail5;
 
+  if (!btc_miner_open(node->miner, flags))
+    goto fail6;
+
+  if (!btc_pool_open(node->pool, path, flags))
+    goto fail7;
+
+  if (!btc_notify_open(node->notify, flags))
+    goto fail8;
+
+  if (!btc_stratum_open(node->stratum, flags))
+    goto fail9;
+
+  btc_rpc_set_warmup(node->rpc, NULL);
+
+  btc_loop_on_tick(node->loop, on_tick, node);
+
+  /* Everything is open, so blocks replayed from a
+     reindex reach the indexers and mempool as usual. */
+  btc_node_replay(node, NULL, 1);
+
   return 1;
-fail5:
+fail9:
+  btc_notify_close(node->notify);
+fail8:
   btc_pool_close(node->pool);
-fail4:
+fail7:
   btc_miner_close(node->miner);
-fail3:
+fail6:
+  btc_addrindex_close(node->addrindex);
+fail5:
+  btc_filterdb_close(node->filterdb);
+fail4:
   btc_mempool_close(node->mempool);
+fail3:
+  btc_pool_unload(node->pool);
+  btc_rpc_close(node->rpc);
 fail2:
   btc_chain_close(node->chain);
 fail1:
@@ -177,11 +405,27 @@ void
 btc_node_close(btc_node_t *node) {
   btc_node_log(node, "Closing node.");
 
-  btc_rpc_close(node->rpc);
-  btc_pool_close(node->pool);
-  btc_miner_close(node->miner);
-  btc_mempool_close(node->mempool);
+  btc_loop_off_tick(node->loop, on_tick, node);
+
+  if (node->readonly) {
+    btc_rpc_close(node->rpc);
+  } else {
+    btc_stratum_close(node->stratum);
+    btc_notify_close(node->notify);
+    btc_rpc_close(node->rpc);
+    btc_pool_close(node->pool);
+    btc_miner_close(node->miner);
+    btc_mempool_close(node->mempool);
+    btc_addrindex_close(node->addrindex);
+    btc_filterdb_close(node->filterdb);
+  }
+
   btc_chain_close(node->chain);
+
+  /* Don't lose a trace left running. */
+  if (btc_trace_active())
+    btc_node_stop_trace(node, NULL, NULL);
+
   btc_logger_close(node->logger);
 }
 
@@ -195,6 +439,45 @@ btc_node_stop(btc_node_t *node) {
   btc_loop_stop(node->loop);
 }
 
+int
+btc_node_start_trace(btc_node_t *node, size_t events) {
+  if (!btc_trace_start(events))
+    return 0;
+
+  btc_node_log(node, "Tracing started.");
+
+  return 1;
+}
+
+int
+btc_node_stop_trace(btc_node_t *node, const char *file, size_t *events) {
+  size_t count;
+
+  if (file == NULL)
+    file = node->trace_file;
+
+  if (!btc_trace_active() || file == NULL)
+    return 0;
+
+  if (!btc_trace_stop(file, &count)) {
+    btc_node_log(node, "Could not write trace to %s.", file);
+    return 0;
+  }
+
+  btc_node_log(node, "Wrote %zu trace events to %s.", count, file);
+
+  if (events != NULL)
+    *events = count;
+
+  return 1;
+}
+
+void
+btc_node_toggle_trace(btc_node_t *node) {
+  /* Safe from a signal handler: the next tick acts on it. */
+  node->trace_toggle = 1;
+}
+
 /*
  * Event Handling
  */
@@ -206,9 +489,10 @@ on_connect(const btc_entry_t *entry,
            void *arg) {
   btc_node_t *node = (btc_node_t *)arg;
 
-  (void)view;
-
+  btc_filterdb_connect(node->filterdb, entry, block, view);
+  btc_addrindex_connect(node->addrindex, entry, block, view);
   btc_mempool_add_block(node->mempool, entry, block);
+  btc_notify_block(node->notify, entry, block);
 }
 
 static void
@@ -220,6 +504,8 @@ on_disconnect(const btc_entry_t *entry,
 
   (void)view;
 
+  btc_filterdb_disconnect(node->filterdb, entry, block);
+  btc_addrindex_disconnect(node->addrindex, entry, block);
   btc_mempool_remove_block(node->mempool, entry, block);
 }
 
@@ -237,7 +523,32 @@ static void
 on_tx(const btc_mpentry_t *entry, const btc_view_t *view, void *arg) {
   btc_node_t *node = (btc_node_t *)arg;
 
-  (void)node;
-  (void)entry;
-  (void)view;
+  btc_miner_add_tx(node->miner, entry->tx, view);
+  btc_notify_tx(node->notify, entry->tx);
+}
+
+static void
+on_tick(void *arg) {
+  btc_node_t *node = (btc_node_t *)arg;
+
+  /* Ticks run mid-iteration: this is the last full one. */
+  btc_perf_record(node->perf, BTC_PERF_LOOP_POLL, btc_loop_busy(node->loop));
+
+  if (node->readonly) {
+    int64_t now = btc_time_msec();
+
+    if (now >= node->refreshed + REFRESH_INTERVAL) {
+      btc_chain_refresh(node->chain);
+      node->refreshed = now;
+    }
+  }
+
+  if (node->trace_toggle) {
+    node->trace_toggle = 0;
+
+    if (btc_trace_active())
+      btc_node_stop_trace(node, NULL, NULL);
+    else
+      btc_node_start_trace(node, 0);
+  }
 }
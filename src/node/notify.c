@@ -0,0 +1,448 @@
+/*!
+ * notify.c - notifications for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <io/core.h>
+#include <io/loop.h>
+
+#include <node/logger.h>
+#include <node/notify.h>
+
+#include <mako/block.h>
+#include <mako/entry.h>
+#include <mako/list.h>
+#include <mako/netaddr.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+
+#include "../bio.h"
+#include "../impl.h"
+#include "../internal.h"
+
+/*
+ * Protocol
+ *
+ * Subscribers connect over TCP and send
+ * subscription frames:
+ *
+ *   [u8 length] [topic]
+ *
+ * An empty topic subscribes to everything.
+ * Published messages look like:
+ *
+ *   [u32 length] [u8 topic length] [topic] [body] [u32 sequence]
+ *
+ * Where `length` covers everything after it.
+ * Integers are little-endian and hashes are in
+ * display (reversed) order, as with ZMQ.
+ *
+ * Sequence numbers count the messages sent on
+ * each topic. A subscriber that falls too far
+ * behind has messages dropped, which shows up
+ * as a gap in the sequence.
+ */
+
+/*
+ * Constants
+ */
+
+enum btc_topic {
+  BTC_TOPIC_HASHBLOCK,
+  BTC_TOPIC_HASHTX,
+  BTC_TOPIC_RAWBLOCK,
+  BTC_TOPIC_RAWTX,
+  BTC_TOPIC_MAX
+};
+
+static const char *btc_topics[BTC_TOPIC_MAX] = {
+  "hashblock",
+  "hashtx",
+  "rawblock",
+  "rawtx"
+};
+
+#define BTC_NOTIFY_ALL ((1 << BTC_TOPIC_MAX) - 1)
+
+/* Output queued for one subscriber before
+   we start dropping its messages. */
+#define BTC_NOTIFY_MAX_BUFFER (32 << 20)
+
+/*
+ * Types
+ */
+
+typedef struct btc_subscriber_s {
+  btc_notify_t *notify;
+  btc_socket_t *socket;
+  unsigned int mask;
+  uint8_t buf[256];
+  size_t len;
+  struct btc_subscriber_s *prev;
+  struct btc_subscriber_s *next;
+} btc_subscriber_t;
+
+typedef struct btc_subscribers_s {
+  btc_subscriber_t *head;
+  btc_subscriber_t *tail;
+  size_t length;
+} btc_subscribers_t;
+
+struct btc_notify_s {
+  btc_loop_t *loop;
+  btc_logger_t *logger;
+  btc_socket_t *server;
+  btc_subscribers_t subs;
+  btc_sockaddr_t bind;
+  uint32_t seq[BTC_TOPIC_MAX];
+};
+
+/*
+ * Message
+ */
+
+typedef struct btc_notifymsg_s {
+  int refs;
+  size_t length;
+  uint8_t *data;
+} btc_notifymsg_t;
+
+static btc_notifymsg_t *
+btc_notifymsg_create(enum btc_topic topic,
+                     const uint8_t *body,
+                     size_t length,
+                     uint32_t seq) {
+  const char *name = btc_topics[topic];
+  size_t size = 1 + strlen(name) + length + 4;
+  btc_notifymsg_t *msg;
+  uint8_t *zp;
+
+  msg = btc_malloc(sizeof(btc_notifymsg_t) + 4 + size);
+  msg->refs = 0;
+  msg->length = 4 + size;
+  msg->data = (uint8_t *)(msg + 1);
+
+  zp = msg->data;
+  zp = btc_uint32_write(zp, size);
+  zp = btc_uint8_write(zp, strlen(name));
+  zp = btc_raw_write(zp, (const uint8_t *)name, strlen(name));
+  zp = btc_raw_write(zp, body, length);
+  zp = btc_uint32_write(zp, seq);
+
+  return msg;
+}
+
+static void
+btc_notifymsg_release(void *arg) {
+  /* Only touched from the loop thread. */
+  btc_notifymsg_t *msg = arg;
+
+  if (--msg->refs == 0)
+    btc_free(msg);
+}
+
+/*
+ * Subscriber
+ */
+
+static btc_subscriber_t *
+btc_subscriber_create(btc_notify_t *notify, btc_socket_t *socket) {
+  btc_subscriber_t *sub = btc_malloc(sizeof(btc_subscriber_t));
+
+  sub->notify = notify;
+  sub->socket = socket;
+  sub->mask = 0;
+  sub->len = 0;
+  sub->prev = NULL;
+  sub->next = NULL;
+
+  return sub;
+}
+
+static void
+btc_subscriber_destroy(btc_subscriber_t *sub) {
+  btc_free(sub);
+}
+
+static void
+btc_subscriber_subscribe(btc_subscriber_t *sub,
+                         const uint8_t *topic,
+                         size_t length) {
+  int i;
+
+  if (length == 0) {
+    sub->mask = BTC_NOTIFY_ALL;
+    return;
+  }
+
+  /* Unknown topics are ignored. */
+  for (i = 0; i < BTC_TOPIC_MAX; i++) {
+    const char *name = btc_topics[i];
+
+    if (strlen(name) == length && memcmp(name, topic, length) == 0)
+      sub->mask |= 1 << i;
+  }
+}
+
+static int
+on_sub_data(btc_socket_t *socket, const void *data, size_t size) {
+  btc_subscriber_t *sub = btc_socket_get_data(socket);
+  const uint8_t *xp = data;
+  size_t n;
+
+  while (size > 0) {
+    n = sizeof(sub->buf) - sub->len;
+
+    if (n > size)
+      n = size;
+
+    memcpy(sub->buf + sub->len, xp, n);
+
+    sub->len += n;
+    xp += n;
+    size -= n;
+
+    /* Frames are at most 256 bytes, so
+       the buffer always makes progress. */
+    while (sub->len > 0 && sub->len >= 1 + (size_t)sub->buf[0]) {
+      n = 1 + sub->buf[0];
+
+      btc_subscriber_subscribe(sub, sub->buf + 1, n - 1);
+
+      memmove(sub->buf, sub->buf + n, sub->len - n);
+
+      sub->len -= n;
+    }
+  }
+
+  return 1;
+}
+
+static void
+on_sub_close(btc_socket_t *socket) {
+  btc_subscriber_t *sub = btc_socket_get_data(socket);
+  btc_notify_t *notify = sub->notify;
+
+  btc_list_remove(&notify->subs, sub, btc_subscriber_t);
+
+  btc_subscriber_destroy(sub);
+}
+
+static void
+on_sub_error(btc_socket_t *socket) {
+  btc_socket_close(socket);
+}
+
+/*
+ * Notify
+ */
+
+btc_notify_t *
+btc_notify_create(btc_loop_t *loop) {
+  btc_notify_t *notify = btc_malloc(sizeof(btc_notify_t));
+
+  memset(notify, 0, sizeof(*notify));
+
+  notify->loop = loop;
+  notify->logger = NULL;
+  notify->server = NULL;
+
+  btc_list_init(&notify->subs);
+  btc_sockaddr_init(&notify->bind);
+
+  return notify;
+}
+
+void
+btc_notify_destroy(btc_notify_t *notify) {
+  btc_free(notify);
+}
+
+void
+btc_notify_set_logger(btc_notify_t *notify, btc_logger_t *logger) {
+  notify->logger = logger;
+}
+
+void
+btc_notify_set_bind(btc_notify_t *notify, const btc_netaddr_t *addr) {
+  btc_netaddr_get_sockaddr(&notify->bind, addr);
+}
+
+static void
+btc_notify_log(btc_notify_t *notify, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_write(notify->logger, "notify", fmt, ap);
+  va_end(ap);
+}
+
+static void
+on_socket(btc_socket_t *server, btc_socket_t *socket) {
+  btc_notify_t *notify = btc_socket_get_data(server);
+  btc_subscriber_t *sub = btc_subscriber_create(notify, socket);
+
+  btc_socket_set_nodelay(socket, 1);
+  btc_socket_set_data(socket, sub);
+  btc_socket_on_data(socket, on_sub_data);
+  btc_socket_on_close(socket, on_sub_close);
+  btc_socket_on_error(socket, on_sub_error);
+
+  btc_list_push(&notify->subs, sub, btc_subscriber_t);
+}
+
+static void
+on_server_close(btc_socket_t *socket) {
+  btc_notify_t *notify = btc_socket_get_data(socket);
+  notify->server = NULL;
+}
+
+int
+btc_notify_open(btc_notify_t *notify, unsigned int flags) {
+  if (!(flags & BTC_NOTIFY_LISTEN))
+    return 1;
+
+  btc_notify_log(notify, "Opening notifier.");
+
+  if (notify->bind.port == 0) {
+    btc_notify_log(notify, "No port given for notifications.");
+    return 0;
+  }
+
+  notify->server = btc_loop_listen(notify->loop, &notify->bind);
+
+  if (notify->server == NULL) {
+    const char *msg = btc_loop_strerror(notify->loop);
+
+    btc_notify_log(notify, "Could not listen on %S: %s.", &notify->bind, msg);
+
+    return 0;
+  }
+
+  btc_socket_set_data(notify->server, notify);
+  btc_socket_on_socket(notify->server, on_socket);
+  btc_socket_on_close(notify->server, on_server_close);
+
+  btc_notify_log(notify, "Notifications on %S.", &notify->bind);
+
+  return 1;
+}
+
+void
+btc_notify_close(btc_notify_t *notify) {
+  btc_subscriber_t *sub;
+
+  if (notify->server != NULL)
+    btc_notify_log(notify, "Closing notifier.");
+
+  if (notify->server != NULL)
+    btc_socket_close(notify->server);
+
+  for (sub = notify->subs.head; sub != NULL; sub = sub->next)
+    btc_socket_close(sub->socket);
+}
+
+static int
+btc_notify_wants(btc_notify_t *notify, enum btc_topic topic) {
+  btc_subscriber_t *sub;
+
+  for (sub = notify->subs.head; sub != NULL; sub = sub->next) {
+    if (sub->mask & (1 << topic))
+      return 1;
+  }
+
+  return 0;
+}
+
+static void
+btc_notify_reverse(uint8_t *zp, const uint8_t *xp) {
+  int i;
+
+  for (i = 0; i < 32; i++)
+    zp[i] = xp[31 - i];
+}
+
+static void
+btc_notify_publish(btc_notify_t *notify,
+                   enum btc_topic topic,
+                   const uint8_t *body,
+                   size_t length) {
+  btc_subscriber_t *sub;
+  btc_notifymsg_t *msg;
+
+  msg = btc_notifymsg_create(topic, body, length, notify->seq[topic]++);
+
+  /* Hold a reference while we hand it out. */
+  msg->refs++;
+
+  for (sub = notify->subs.head; sub != NULL; sub = sub->next) {
+    if (!(sub->mask & (1 << topic)))
+      continue;
+
+    /* Never block the loop on a slow reader. */
+    if (btc_socket_buffered(sub->socket) > BTC_NOTIFY_MAX_BUFFER)
+      continue;
+
+    msg->refs++;
+
+    btc_socket_write_shared(sub->socket, msg->data, msg->length,
+                            btc_notifymsg_release, msg);
+  }
+
+  btc_notifymsg_release(msg);
+}
+
+void
+btc_notify_tx(btc_notify_t *notify, const btc_tx_t *tx) {
+  uint8_t hash[32];
+
+  if (notify->subs.length == 0)
+    return;
+
+  if (btc_notify_wants(notify, BTC_TOPIC_HASHTX)) {
+    btc_notify_reverse(hash, tx->hash);
+    btc_notify_publish(notify, BTC_TOPIC_HASHTX, hash, 32);
+  }
+
+  if (btc_notify_wants(notify, BTC_TOPIC_RAWTX)) {
+    uint8_t *raw = btc_malloc(btc_tx_size(tx));
+    size_t len = btc_tx_write(raw, tx) - raw;
+
+    btc_notify_publish(notify, BTC_TOPIC_RAWTX, raw, len);
+
+    btc_free(raw);
+  }
+}
+
+void
+btc_notify_block(btc_notify_t *notify,
+                 const btc_entry_t *entry,
+                 const btc_block_t *block) {
+  uint8_t hash[32];
+  size_t i;
+
+  if (notify->subs.length == 0)
+    return;
+
+  for (i = 0; i < block->txs.length; i++)
+    btc_notify_tx(notify, block->txs.items[i]);
+
+  if (btc_notify_wants(notify, BTC_TOPIC_HASHBLOCK)) {
+    btc_notify_reverse(hash, entry->hash);
+    btc_notify_publish(notify, BTC_TOPIC_HASHBLOCK, hash, 32);
+  }
+
+  if (btc_notify_wants(notify, BTC_TOPIC_RAWBLOCK)) {
+    uint8_t *raw = btc_malloc(btc_block_size(block));
+    size_t len = btc_block_write(raw, block) - raw;
+
+    btc_notify_publish(notify, BTC_TOPIC_RAWBLOCK, raw, len);
+
+    btc_free(raw);
+  }
+}
@@ -0,0 +1,217 @@
+/*!
+ * perf.c - latency histograms for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <node/perf.h>
+#include <mako/util.h>
+#include "../impl.h"
+#include "../internal.h"
+
+/*
+ * Histogram
+ */
+
+/* Values below 8 get a bucket each. Past that,
+ * every power of two is split into 8 linear
+ * sub-buckets, so a bucket's width is at most
+ * 1/8th of its lower bound. This is the layout
+ * HdrHistogram uses with one significant digit
+ * in base 2, minus the auto-resizing.
+ */
+
+static size_t
+hist_index(uint64_t value) {
+  size_t index;
+  int bits = 3;
+
+  if (value < 8)
+    return value;
+
+  while (bits < 63 && (value >> (bits + 1)) != 0)
+    bits++;
+
+  index = (bits - 2) * 8 + ((value >> (bits - 3)) & 7);
+
+  if (index >= BTC_HIST_BUCKETS)
+    index = BTC_HIST_BUCKETS - 1;
+
+  return index;
+}
+
+static uint64_t
+hist_upper(size_t index) {
+  int shift;
+
+  if (index < 8)
+    return index;
+
+  shift = (int)(index / 8) - 1;
+
+  return ((uint64_t)(8 + index % 8) << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+void
+btc_hist_init(btc_hist_t *hist) {
+  memset(hist, 0, sizeof(*hist));
+}
+
+void
+btc_hist_record(btc_hist_t *hist, int64_t value) {
+  uint64_t val = value < 0 ? 0 : value;
+  uint32_t *bucket = &hist->buckets[hist_index(val)];
+
+  /* Saturate rather than wrap on a long-lived node. */
+  if (*bucket == UINT32_MAX)
+    return;
+
+  *bucket += 1;
+
+  hist->count += 1;
+  hist->total += val;
+
+  if (val > hist->max)
+    hist->max = val;
+}
+
+void
+btc_hist_merge(btc_hist_t *z, const btc_hist_t *x) {
+  size_t i;
+
+  for (i = 0; i < BTC_HIST_BUCKETS; i++) {
+    uint32_t count = x->buckets[i];
+
+    if (z->buckets[i] > UINT32_MAX - count)
+      count = UINT32_MAX - z->buckets[i];
+
+    z->buckets[i] += count;
+    z->count += count;
+  }
+
+  z->total += x->total;
+
+  if (x->max > z->max)
+    z->max = x->max;
+}
+
+uint64_t
+btc_hist_percentile(const btc_hist_t *hist, double rank) {
+  uint64_t target, seen = 0;
+  size_t i;
+
+  if (hist->count == 0)
+    return 0;
+
+  if (rank < 0.0)
+    rank = 0.0;
+
+  if (rank > 1.0)
+    rank = 1.0;
+
+  target = (uint64_t)(rank * (double)hist->count + 0.5);
+
+  if (target == 0)
+    target = 1;
+
+  for (i = 0; i < BTC_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+
+    if (seen >= target)
+      break;
+  }
+
+  /* The last bucket also holds everything past it. */
+  if (i >= BTC_HIST_BUCKETS - 1 || hist_upper(i) > hist->max)
+    return hist->max;
+
+  return hist_upper(i);
+}
+
+uint64_t
+btc_hist_mean(const btc_hist_t *hist) {
+  if (hist->count == 0)
+    return 0;
+
+  return hist->total / hist->count;
+}
+
+uint64_t
+btc_hist_below(const btc_hist_t *hist, uint64_t value) {
+  /* Exact when `value` starts a bucket (e.g.
+     any power of two below the last bucket). */
+  size_t end = hist_index(value);
+  uint64_t count = 0;
+  size_t i;
+
+  for (i = 0; i < end; i++)
+    count += hist->buckets[i];
+
+  return count;
+}
+
+/*
+ * Perf
+ */
+
+/* Every stage is recorded from the event loop
+ * thread (work done elsewhere hands its timing
+ * back with the result), so none of this needs
+ * a lock.
+ */
+
+DEFINE_OBJECT(btc_perf, SCOPE_EXTERN)
+
+void
+btc_perf_init(btc_perf_t *perf) {
+  memset(perf, 0, sizeof(*perf));
+}
+
+void
+btc_perf_clear(btc_perf_t *perf) {
+  btc_perf_init(perf);
+}
+
+void
+btc_perf_copy(btc_perf_t *z, const btc_perf_t *x) {
+  *z = *x;
+}
+
+void
+btc_perf_record(btc_perf_t *perf, enum btc_perf_stage stage, int64_t value) {
+  if (perf != NULL)
+    btc_hist_record(&perf->stages[stage], value);
+}
+
+const char *
+btc_perf_name(enum btc_perf_stage stage) {
+  switch (stage) {
+    case BTC_PERF_BLOCK_DECODE:
+      return "block_decode";
+    case BTC_PERF_BLOCK_SANITY:
+      return "block_sanity";
+    case BTC_PERF_BLOCK_COINS:
+      return "block_coins";
+    case BTC_PERF_BLOCK_SCRIPTS:
+      return "block_scripts";
+    case BTC_PERF_BLOCK_SAVE:
+      return "block_save";
+    case BTC_PERF_BLOCK_CONNECT:
+      return "block_connect";
+    case BTC_PERF_TX_CHECK:
+      return "tx_check";
+    case BTC_PERF_TX_SCRIPTS:
+      return "tx_scripts";
+    case BTC_PERF_TX_ADD:
+      return "tx_add";
+    case BTC_PERF_TX_ACCEPT:
+      return "tx_accept";
+    case BTC_PERF_LOOP_POLL:
+      return "loop_poll";
+    default:
+      return "unknown";
+  }
+}
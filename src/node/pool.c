@@ -4,33 +4,45 @@
  * https://github.com/chjj/mako
  */
 
+#include <math.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
 #include <io/core.h>
 #include <io/loop.h>
+#include <io/trace.h>
+#include <io/workers.h>
 
 #include <node/addrman.h>
 #include <node/chain.h>
+#include <node/chaindb.h>
+#include <node/filterdb.h>
 #include <node/logger.h>
 #include <node/mempool.h>
+#include <node/perf.h>
 #include <node/pool.h>
 #include <node/timedata.h>
 
+#include <mako/bip324.h>
 #include <mako/bip37.h>
 #include <mako/bip152.h>
+#include <mako/bip158.h>
 #include <mako/block.h>
 #include <mako/bloom.h>
 #include <mako/coins.h>
 #include <mako/consensus.h>
 #include <mako/crypto/hash.h>
 #include <mako/crypto/rand.h>
+#include <mako/crypto/siphash.h>
 #include <mako/entry.h>
+#include <mako/fec.h>
 #include <mako/header.h>
 #include <mako/list.h>
 #include <mako/map.h>
+#include <mako/minisketch.h>
 #include <mako/net.h>
 #include <mako/netaddr.h>
 #include <mako/netmsg.h>
@@ -49,6 +61,61 @@
  * Constants
  */
 
+#define PARSER_RETAIN (64 << 10)
+#define PARSER_DEFER (16 << 10)
+#define BLOCK_CACHE_SIZE 3
+#define HEADER_RECORD_SIZE 81
+#define MAX_CMPCT_HB 3
+#define MAX_HEADER_RANGES 8
+#define HEADER_JOB_SIZE 128
+#define BLOCK_WINDOW 1024
+#define BLOCK_BUFFER_TIME 5000
+#define MIN_BLOCK_INFLIGHT 2
+#define MAX_BLOCK_INFLIGHT 32
+#define BLOCK_BUFFER_SIZE (256 << 20)
+#define BLOCK_BUFFER_RESERVE 16
+#define MIN_STALL_TIMEOUT 2000
+#define MAX_STALL_TIMEOUT 64000
+#define INV_OUTBOUND_INTERVAL 2000
+#define INV_INBOUND_INTERVAL 5000
+#define FEEFILTER_INTERVAL (10 * 60000)
+#define FEEFILTER_MAX_DELAY (5 * 60000)
+#define ADDR_TOKEN_RATE 0.1 /* per second */
+#define ADDR_TOKEN_MAX 1000
+#define EVICT_PROTECT_GROUP 4
+#define EVICT_PROTECT_PING 8
+#define EVICT_PROTECT_TX 4
+#define EVICT_PROTECT_BLOCK_RELAY 8
+#define EVICT_PROTECT_BLOCK 4
+#define CONNECT_TIMEOUT 5000
+#define PROXY_TIMEOUT 20000
+#define PING_INTERVAL 30000
+#define STALL_RECHECK 5000
+#define OUTBOUND_RACE 4
+#define OUTBOUND_RACE_PROXY 12
+#define BLOCK_RELAY_PEERS 2
+#define ROTATE_INTERVAL 60000
+#define ROTATE_MIN_PEERS 4
+#define ROTATE_FACTOR 8
+#define UPLOAD_TIMEFRAME (24 * 60 * 60)
+#define HISTORICAL_AGE (7 * 24 * 60 * 60)
+#define RELAY_HEADER_SIZE 43
+#define RELAY_SHARD_SIZE 1152
+#define RELAY_MAX_PEERS 8
+#define RELAY_SLOTS 8
+#define TX_MAX_INFLIGHT 100
+#define TX_INBOUND_DELAY 2000
+#define TX_OVERLOAD_DELAY 2000
+#define TX_REQUEST_TIMEOUT 60000
+#define TX_CHECK_INTERVAL 100
+#define TX_CPU_BUDGET (INT64_C(30) * 1000000000) /* 30s */
+#define RECON_VERSION 1
+#define RECON_INTERVAL 8000
+#define RECON_FLOOD_RATIO 10
+#define RECON_MAX_SET 3000
+#define RECON_Q 8191 /* 0.25 * 32767 */
+#define V2_HANDSHAKE_SIZE (64 + 4095 + 16) /* key, garbage, terminator */
+
 enum btc_peer_state {
   BTC_PEER_CONNECTING,
   BTC_PEER_WAIT_VERSION,
@@ -57,12 +124,39 @@ enum btc_peer_state {
   BTC_PEER_DEAD
 };
 
+enum btc_v2_state {
+  BTC_V2_NONE,
+  BTC_V2_KEY,
+  BTC_V2_GARBAGE,
+  BTC_V2_READY
+};
+
 /*
  * Types
  */
 
 typedef void btc_parser_on_msg_cb(btc_msg_t *msg, void *arg);
-typedef void btc_parser_on_error_cb(void *arg);
+typedef void btc_parser_on_error_cb(void *arg, int fatal);
+
+enum btc_frame_state {
+  BTC_FRAME_PENDING,
+  BTC_FRAME_OK,
+  BTC_FRAME_BAD
+};
+
+typedef struct btc_frame_s {
+  btc_mutex_t *lock;
+  char cmd[12 + 1];
+  uint8_t *data;
+  size_t length;
+  uint32_t checksum;
+  int authenticated;
+  btc_msg_t msg;
+  enum btc_frame_state state;
+  int64_t elapsed;
+  int orphan;
+  struct btc_frame_s *next;
+} btc_frame_t;
 
 typedef struct btc_parser_s {
   uint32_t magic;
@@ -72,9 +166,25 @@ typedef struct btc_parser_s {
   size_t waiting;
   int closed;
   /* Header */
-  char cmd[12];
+  char cmd[12 + 1];
   int has_header;
   uint32_t checksum;
+  /* Transport */
+  btc_bip324_t *cipher;
+  uint8_t *garbage;
+  size_t garbage_len;
+  int greeted;
+  /* Accounting */
+  btc_netstat_t *stats;
+  btc_perf_t *perf;
+  /* Decoding */
+  btc_workers_t *workers;
+  btc_mutex_t *lock;
+  struct btc_frames_s {
+    btc_frame_t *head;
+    btc_frame_t *tail;
+    size_t length;
+  } frames;
   /* Callback */
   btc_parser_on_msg_cb *on_msg;
   btc_parser_on_error_cb *on_error;
@@ -96,17 +206,30 @@ typedef struct btc_peer_s {
   btc_parser_t parser;
   btc_sendqueue_t sending;
   enum btc_peer_state state;
+  btc_bip324_t *cipher;
+  enum btc_v2_state v2;
+  uint8_t *handshake;
+  size_t handshake_len;
+  uint8_t *garbage;
+  size_t garbage_len;
+  int v1_retry;
   unsigned int id;
   int outbound;
   int loader;
+  int block_relay;
   btc_netaddr_t addr;
   btc_netaddr_t local;
   uint64_t nonce;
   int64_t time;
   int64_t last_send;
   int64_t last_recv;
+  uint64_t bytes_sent;
+  uint64_t bytes_recv;
+  btc_netstat_t sent[BTC_NETSTAT_TYPES];
+  btc_netstat_t recv[BTC_NETSTAT_TYPES];
   int ban_score;
   btc_inv_t inv_queue;
+  uint64_t inv_seq;
   uint32_t version;
   uint64_t services;
   int32_t height;
@@ -115,28 +238,53 @@ typedef struct btc_peer_s {
   int prefer_headers;
   uint8_t hash_continue[32];
   int64_t fee_rate;
+  int64_t fee_sent;
+  int64_t fee_timer;
   int compact_mode;
   int compact_witness;
+  int64_t compact_hb;
+  int wtxid_relay;
+  size_t tx_announced;
+  int recon;
+  int recon_wait;
+  uint64_t recon_salt;
+  uint8_t recon_key[16];
+  int64_t recon_time;
+  btc_longmap_t *recon_set;
+  btc_longmap_t *recon_snap;
   int syncing;
   int sent_addr;
   int getting_addr;
   int sent_getaddr;
+  double addr_tokens;
+  int64_t addr_time;
+  uint64_t group; /* keyed netgroup hash */
+  int64_t last_tx;
+  int64_t last_block;
+  uint64_t addr_processed;
+  uint64_t addr_dropped;
   uint64_t challenge;
   int64_t last_pong;
   int64_t last_ping;
   int64_t min_ping;
   int64_t block_time;
+  int64_t block_mark;
+  int64_t block_interval;
+  int64_t block_rate;
+  int block_limit;
   int64_t gb_time;
   int64_t gh_time;
-  int64_t ping_timer;
-  int64_t inv_timer;
-  int64_t stall_timer;
+  btc_timer_t *connect_timer;
+  btc_timer_t *ping_timer;
+  btc_timer_t *inv_timer;
+  btc_timer_t *stall_timer;
   btc_filter_t addr_filter;
   btc_filter_t inv_filter;
   btc_bloom_t *spv_filter;
   btc_hashtab_t *block_map;
   btc_hashtab_t *tx_map;
   btc_hashmap_t *compact_map;
+  struct btc_hdrrange_s *range;
   struct btc_peer_s *prev;
   struct btc_peer_s *next;
 } btc_peer_t;
@@ -153,6 +301,7 @@ typedef struct btc_peers_s {
   btc_peer_t *load;
   size_t inbound;
   size_t outbound;
+  size_t block_relay;
   size_t length;
 } btc_peers_t;
 
@@ -162,42 +311,229 @@ typedef struct btc_hdrnode_s {
   struct btc_hdrnode_s *next;
 } btc_hdrnode_t;
 
+typedef struct btc_txqueue_s {
+  uint8_t *hashes;
+  size_t length;
+  size_t alloc;
+  uint64_t base;
+} btc_txqueue_t;
+
+typedef struct btc_txann_s {
+  const btc_mpentry_t *entry;
+  int64_t rate;
+  int depth;
+} btc_txann_t;
+
+typedef struct btc_txcand_s {
+  struct btc_peer_s *peer;
+  uint32_t type;
+  int64_t time;
+} btc_txcand_t;
+
+typedef struct btc_txreq_s {
+  uint8_t hash[32];
+  btc_txcand_t *items;
+  size_t length;
+  size_t alloc;
+  struct btc_peer_s *peer;
+  uint32_t type;
+  int64_t expires;
+} btc_txreq_t;
+
+typedef struct btc_txfetch_s {
+  struct btc_peer_s *peer;
+  uint32_t type;
+  const uint8_t *hash;
+} btc_txfetch_t;
+
+typedef struct btc_pendblock_s {
+  btc_block_t *block;
+  unsigned int flags;
+  unsigned int id;
+} btc_pendblock_t;
+
+typedef struct btc_hdrrange_s {
+  const btc_checkpoint_t *start;
+  const btc_checkpoint_t *stop;
+  btc_hdrnode_t *head;
+  btc_hdrnode_t *tail;
+  btc_peer_t *peer;
+  int complete;
+  struct btc_hdrrange_s *next;
+} btc_hdrrange_t;
+
+typedef struct btc_hdrranges_s {
+  btc_hdrrange_t *head;
+  btc_hdrrange_t *tail;
+  size_t length;
+} btc_hdrranges_t;
+
+typedef struct btc_hdrjob_s {
+  btc_header_t **items;
+  size_t length;
+  uint8_t *hashes;
+  int valid;
+  btc_mutex_t *lock;
+  btc_cond_t *cond;
+  int *pending;
+} btc_hdrjob_t;
+
+enum btc_blockenc {
+  BTC_BLOCKENC_BASE,
+  BTC_BLOCKENC_WITNESS,
+  BTC_BLOCKENC_CMPCT_BASE,
+  BTC_BLOCKENC_CMPCT,
+  BTC_BLOCKENC_MAX
+};
+
+typedef struct btc_rawmsg_s {
+  int refs;
+  uint8_t *data;
+  size_t length;
+} btc_rawmsg_t;
+
+typedef struct btc_cachedblock_s {
+  uint8_t hash[32];
+  int used;
+  int relayed;
+  btc_rawmsg_t *msgs[BTC_BLOCKENC_MAX];
+  btc_merkletree_t *tree;
+} btc_cachedblock_t;
+
+typedef struct btc_blockcache_s {
+  btc_cachedblock_t items[BLOCK_CACHE_SIZE];
+  size_t index;
+} btc_blockcache_t;
+
+typedef struct btc_relayslot_s {
+  uint8_t hash[32];
+  int state;
+  size_t length;
+  size_t k, m;
+  size_t count;
+  uint8_t *data;
+  uint8_t present[BTC_FEC_MAX_SHARDS];
+} btc_relayslot_t;
+
+typedef struct btc_hdrarray_s {
+  uint8_t *data;
+  int32_t length;
+  size_t alloc;
+} btc_hdrarray_t;
+
 struct btc_pool_s {
   const btc_network_t *network;
   btc_loop_t *loop;
   btc_logger_t *logger;
   btc_timedata_t *timedata;
+  btc_perf_t *perf;
   btc_addrman_t *addrman;
   btc_chain_t *chain;
   btc_mempool_t *mempool;
+  btc_filterdb_t *filterdb;
   unsigned int flags;
   uint64_t services;
+  int loaded;
   int port;
   btc_sockaddr_t bind;
   btc_netaddr_t connect;
   btc_sockaddr_t proxy;
   size_t max_inbound;
   size_t max_outbound;
+  uint8_t group_key[16];
   enum btc_ipnet only_net;
+  int v2;
   btc_socket_t *server;
   btc_peers_t peers;
   btc_nonces_t nonces;
   btc_hashset_t *block_map;
-  btc_hashset_t *tx_map;
+  btc_hashmap_t *tx_map;
   btc_hashset_t *compact_map;
+  int64_t tx_timer;
+  btc_txqueue_t tx_queue;
+  btc_blockcache_t block_cache;
+  btc_hdrarray_t header_array;
+  btc_socket_t *relay;
+  int relay_port;
+  btc_netaddr_t relay_peers[RELAY_MAX_PEERS];
+  size_t relay_length;
+  btc_relayslot_t relay_slots[RELAY_SLOTS];
+  size_t relay_index;
   int block_mode;
   int checkpoints;
+  char headers_file[BTC_PATH_MAX];
+  char capture_file[BTC_PATH_MAX];
+  FILE *capture;
   const btc_checkpoint_t *header_tip;
   btc_hdrnode_t *header_head;
   btc_hdrnode_t *header_tail;
-  btc_hdrnode_t *header_next;
+  btc_hdrranges_t header_ranges;
+  btc_hashmap_t *block_pending;
+  size_t block_buffer;
+  size_t block_buffer_max;
+  int64_t block_avg;
+  int window_full;
+  int window_throttled;
+  int64_t stall_timeout;
+  int64_t stall_time;
+  unsigned int stall_id;
+  int32_t stall_height;
+  btc_workers_t *workers;
+  btc_mutex_t *frame_lock;
+  int threads;
   int64_t refill_timer;
+  int64_t window_timer;
+  int64_t inv_timer;
   int64_t flush_timer;
+  int64_t rotate_timer;
   unsigned int id;
   uint64_t required_services;
+  uint64_t bytes_sent;
+  uint64_t bytes_recv;
+  btc_netstat_t sent[BTC_NETSTAT_TYPES]; /* closed peers */
+  btc_netstat_t recv[BTC_NETSTAT_TYPES];
+  uint64_t upload_target;
+  uint64_t cycle_sent;
+  int64_t cycle_start;
   int synced;
 };
 
+static int
+btc_pool_serves_blocks(btc_pool_t *pool, uint64_t services) {
+  if (services & BTC_NET_SERVICE_NETWORK)
+    return 1;
+
+  /* Near the tip, a limited peer has every block we want. */
+  if (services & BTC_NET_SERVICE_NETWORK_LIMITED)
+    return btc_chain_synced(pool->chain);
+
+  return 0;
+}
+
+static int
+btc_pool_has_services(btc_pool_t *pool, uint64_t services) {
+  uint64_t required = pool->required_services & ~BTC_NET_SERVICE_NETWORK;
+
+  if ((services & required) != required)
+    return 0;
+
+  if (pool->required_services & BTC_NET_SERVICE_NETWORK)
+    return btc_pool_serves_blocks(pool, services);
+
+  return 1;
+}
+
+static int
+btc_pool_can_serve(btc_pool_t *pool, const btc_entry_t *entry) {
+  /* A pruned node serves what it promises to keep. */
+  int32_t height = btc_chain_height(pool->chain);
+
+  if (!btc_chain_pruned(pool->chain))
+    return 1;
+
+  return entry->height > height - pool->network->block.keep_blocks;
+}
+
 /*
  * Nonce List
  */
@@ -238,3589 +574,8161 @@ btc_nonces_remove(btc_nonces_t *list, uint64_t nonce) {
 }
 
 /*
- * Parser
+ * Raw Message
  */
 
-static void
-btc_parser_init(btc_parser_t *parser, uint32_t magic) {
-  parser->magic = magic;
-  parser->pending = NULL;
-  parser->alloc = 0;
-  parser->total = 0;
-  parser->waiting = 24;
-  parser->closed = 0;
-  parser->cmd[0] = '\0';
-  parser->has_header = 0;
-  parser->checksum = 0;
-  parser->on_msg = NULL;
-  parser->on_error = NULL;
-  parser->arg = NULL;
+static uint8_t *
+btc_msg_frame(size_t *length, const btc_msg_t *msg, uint32_t magic) {
+  size_t bodylen = btc_msg_size(msg);
+  uint8_t *data = (uint8_t *)btc_malloc(24 + bodylen);
+  uint8_t *body = data + 24;
+  uint8_t *zp = data;
+
+  /* Payload. */
+  btc_msg_export(body, msg);
+
+  /* Magic value. */
+  zp = btc_uint32_write(zp, magic);
+
+  /* Command. */
+  zp = btc_nullstr_write(zp, 12, msg->cmd);
+
+  /* Payload length. */
+  zp = btc_uint32_write(zp, bodylen);
+
+  /* Checksum. */
+  btc_uint32_write(zp, btc_checksum(body, bodylen));
+
+  *length = 24 + bodylen;
+
+  return data;
+}
+
+static btc_rawmsg_t *
+btc_rawmsg_create(uint8_t *data, size_t length) {
+  btc_rawmsg_t *raw = (btc_rawmsg_t *)btc_malloc(sizeof(btc_rawmsg_t));
+
+  raw->refs = 1;
+  raw->data = data;
+  raw->length = length;
+
+  return raw;
 }
 
 static void
-btc_parser_clear(btc_parser_t *parser) {
-  if (parser->alloc > 0)
-    btc_free(parser->pending);
+btc_rawmsg_unref(void *ptr) {
+  btc_rawmsg_t *raw = (btc_rawmsg_t *)ptr;
 
-  parser->pending = NULL;
+  CHECK(raw->refs > 0);
+
+  if (--raw->refs == 0) {
+    btc_free(raw->data);
+    btc_free(raw);
+  }
 }
 
-static uint8_t *
-btc_parser_append(btc_parser_t *parser, const uint8_t *data, size_t length) {
-  if (parser->closed)
-    return parser->pending;
+/*
+ * Block Cache
+ */
+
+/* The wire encodings of the last few blocks we
+ * announced. Every peer we relay a new block to
+ * asks for one of the same handful of messages,
+ * so each is serialized once and the buffer is
+ * shared between the peers' send queues.
+ */
 
-  if (parser->total + length > parser->alloc) {
-    void *ptr = btc_realloc(parser->pending, parser->total + length);
+static void
+btc_cachedblock_reset(btc_cachedblock_t *item) {
+  int i;
 
-    parser->pending = (uint8_t *)ptr;
-    parser->alloc = parser->total + length;
+  for (i = 0; i < BTC_BLOCKENC_MAX; i++) {
+    if (item->msgs[i] != NULL)
+      btc_rawmsg_unref(item->msgs[i]);
+
+    item->msgs[i] = NULL;
   }
 
-  if (length > 0)
-    memcpy(parser->pending + parser->total, data, length);
+  if (item->tree != NULL)
+    btc_merkletree_destroy(item->tree);
 
-  parser->total += length;
+  item->tree = NULL;
+  item->used = 0;
+  item->relayed = 0;
+}
 
-  return parser->pending;
+static void
+btc_blockcache_init(btc_blockcache_t *cache) {
+  memset(cache, 0, sizeof(*cache));
 }
 
-static int
-btc_parser_parse_header(btc_parser_t *parser, const uint8_t **xp, size_t *xn) {
-  uint32_t magic, size;
+static void
+btc_blockcache_clear(btc_blockcache_t *cache) {
+  size_t i;
 
-  if (!btc_uint32_read(&magic, xp, xn))
-    return 0;
+  for (i = 0; i < BLOCK_CACHE_SIZE; i++)
+    btc_cachedblock_reset(&cache->items[i]);
 
-  if (magic != parser->magic)
-    return 0;
+  cache->index = 0;
+}
 
-  if (!btc_nullstr_read(parser->cmd, sizeof(parser->cmd), xp, xn))
-    return 0;
+static btc_cachedblock_t *
+btc_blockcache_get(btc_blockcache_t *cache, const uint8_t *hash) {
+  size_t i;
 
-  if (!btc_uint32_read(&size, xp, xn))
-    return 0;
+  for (i = 0; i < BLOCK_CACHE_SIZE; i++) {
+    btc_cachedblock_t *item = &cache->items[i];
 
-  if (size > BTC_NET_MAX_MESSAGE)
-    return 0;
+    if (item->used && btc_hash_equal(item->hash, hash))
+      return item;
+  }
 
-  if (!btc_uint32_read(&parser->checksum, xp, xn))
-    return 0;
+  return NULL;
+}
 
-  parser->waiting = size;
-  parser->has_header = 1;
+static void
+btc_blockcache_add(btc_blockcache_t *cache, const uint8_t *hash) {
+  btc_cachedblock_t *item;
 
-  return 1;
+  if (btc_blockcache_get(cache, hash) != NULL)
+    return;
+
+  item = &cache->items[cache->index];
+
+  btc_cachedblock_reset(item);
+  btc_hash_copy(item->hash, hash);
+
+  item->used = 1;
+
+  cache->index = (cache->index + 1) % BLOCK_CACHE_SIZE;
 }
 
-static int
-btc_parser_parse(btc_parser_t *parser, const uint8_t *data, size_t length) {
+static btc_rawmsg_t *
+btc_blockcache_encode(btc_blockcache_t *cache,
+                      const uint8_t *hash,
+                      enum btc_blockenc enc,
+                      const btc_block_t *block,
+                      uint32_t magic) {
+  btc_cachedblock_t *item = btc_blockcache_get(cache, hash);
+  size_t length;
+  uint8_t *data;
+  btc_cmpct_t cmpct;
   btc_msg_t msg;
 
-  CHECK(length <= BTC_NET_MAX_MESSAGE);
+  if (item == NULL)
+    return NULL;
 
-  if (!parser->has_header)
-    return btc_parser_parse_header(parser, &data, &length);
+  if (item->msgs[enc] != NULL)
+    return item->msgs[enc];
 
-  parser->waiting = 24;
-  parser->has_header = 0;
+  if (block == NULL)
+    return NULL;
 
-  if (btc_checksum(data, length) != parser->checksum)
-    return 0;
+  switch (enc) {
+    case BTC_BLOCKENC_BASE:
+    case BTC_BLOCKENC_WITNESS: {
+      if (enc == BTC_BLOCKENC_WITNESS)
+        btc_msg_set_type(&msg, BTC_MSG_BLOCK);
+      else
+        btc_msg_set_type(&msg, BTC_MSG_BLOCK_BASE);
 
-  btc_msg_set_cmd(&msg, parser->cmd);
-  btc_msg_alloc(&msg);
+      msg.body = (void *)block;
 
-  if (!btc_msg_import(&msg, data, length)) {
-    btc_msg_clear(&msg);
-    return 0;
-  }
+      data = btc_msg_frame(&length, &msg, magic);
 
-  parser->on_msg(&msg, parser->arg);
+      break;
+    }
 
-  btc_msg_clear(&msg);
+    case BTC_BLOCKENC_CMPCT_BASE:
+    case BTC_BLOCKENC_CMPCT: {
+      int witness = (enc == BTC_BLOCKENC_CMPCT);
 
-  return 1;
-}
+      /* Peers share one set of short ids, as
+         with a block we announce to them all. */
+      btc_cmpct_init(&cmpct);
+      btc_cmpct_set_block(&cmpct, block, witness);
 
-static int
-btc_parser_feed(btc_parser_t *parser, const uint8_t *data, size_t length) {
-  uint8_t *ptr = btc_parser_append(parser, data, length);
-  size_t len = parser->total;
-  int parsed = 0;
-  size_t size;
+      if (witness)
+        btc_msg_set_type(&msg, BTC_MSG_CMPCTBLOCK);
+      else
+        btc_msg_set_type(&msg, BTC_MSG_CMPCTBLOCK_BASE);
 
-  while (!parser->closed && len >= parser->waiting) {
-    size = parser->waiting;
+      msg.body = &cmpct;
 
-    if (parser->has_header)
-      parsed = 1;
+      data = btc_msg_frame(&length, &msg, magic);
 
-    if (!btc_parser_parse(parser, ptr, size)) {
-      if (!parser->closed)
-        parser->on_error(parser->arg);
+      btc_cmpct_clear(&cmpct);
+
+      break;
     }
 
-    ptr += size;
-    len -= size;
+    default: {
+      btc_abort(); /* LCOV_EXCL_LINE */
+      return NULL; /* LCOV_EXCL_LINE */
+    }
   }
 
-  if (len > 0 && ptr != parser->pending)
-    memmove(parser->pending, ptr, len);
+  item->msgs[enc] = btc_rawmsg_create(data, length);
 
-  parser->total = len;
-
-  return parsed;
+  return item->msgs[enc];
 }
 
 /*
- * Events
+ * Header Array
  */
 
-static void
-btc_pool_on_tick(btc_pool_t *pool, int64_t now);
+/* Main chain headers in their wire encoding (the
+ * 80 byte header and a zero tx count) indexed by
+ * height, so a headers response is one slice of
+ * the array. It is filled in as peers ask for it.
+ *
+ * A reorg replaces a suffix of the chain and each
+ * header commits to its parent: if the last header
+ * of a slice is still on the main chain, so is
+ * everything below it.
+ */
 
 static void
-btc_pool_on_socket(btc_pool_t *pool, btc_socket_t *socket);
+btc_hdrarray_init(btc_hdrarray_t *arr) {
+  arr->data = NULL;
+  arr->length = 0;
+  arr->alloc = 0;
+}
 
 static void
-btc_peer_on_tick(btc_peer_t *peer, int64_t now);
+btc_hdrarray_clear(btc_hdrarray_t *arr) {
+  if (arr->alloc > 0)
+    btc_free(arr->data);
 
-static void
-btc_peer_on_connect(btc_peer_t *peer);
+  btc_hdrarray_init(arr);
+}
 
-static void
-btc_peer_on_close(btc_peer_t *peer);
+static int
+btc_hdrarray_match(const btc_hdrarray_t *arr,
+                   btc_chain_t *chain,
+                   int32_t height) {
+  const btc_entry_t *entry = btc_chain_by_height(chain, height);
+  uint8_t raw[80];
 
-static void
-btc_peer_on_error(btc_peer_t *peer, const char *msg);
+  btc_header_write(raw, &entry->header);
 
-static int
-btc_peer_on_data(btc_peer_t *peer, const uint8_t *data, size_t size);
+  return memcmp(arr->data + height * HEADER_RECORD_SIZE, raw, 80) == 0;
+}
 
-static void
-btc_peer_on_drain(btc_peer_t *peer);
+static const uint8_t *
+btc_hdrarray_slice(btc_hdrarray_t *arr,
+                   btc_chain_t *chain,
+                   int32_t start,
+                   int32_t end) {
+  int32_t height = end;
+  size_t size;
 
-static void
-btc_peer_on_msg(btc_peer_t *peer, btc_msg_t *msg);
+  CHECK(start >= 0 && start <= end);
+  CHECK(end <= btc_chain_height(chain));
 
-static void
-btc_peer_on_parse_error(btc_peer_t *peer);
+  if (height >= arr->length)
+    height = arr->length - 1;
 
-static void
-on_server_socket(btc_socket_t *server, btc_socket_t *socket) {
-  btc_socket_set_nodelay(socket, 1);
-  btc_pool_on_socket((btc_pool_t *)btc_socket_get_data(server), socket);
-}
+  /* Drop whatever a reorg replaced. */
+  while (height >= 0 && !btc_hdrarray_match(arr, chain, height))
+    arr->length = height--;
 
-static void
-on_server_close(btc_socket_t *server) {
-  btc_pool_t *pool = (btc_pool_t *)btc_socket_get_data(server);
+  size = ((size_t)end + 1) * HEADER_RECORD_SIZE;
 
-  pool->server = NULL;
-}
+  if (size > arr->alloc) {
+    size_t alloc = arr->alloc == 0 ? (1 << 20) : arr->alloc;
 
-static void
-on_tick(void *arg) {
-  btc_pool_t *pool = (btc_pool_t *)arg;
-  btc_peer_t *peer, *next;
-  int64_t now = btc_time_msec();
+    while (alloc < size)
+      alloc *= 2;
 
-  for (peer = pool->peers.head; peer != NULL; peer = next) {
-    next = peer->next;
-    btc_peer_on_tick(peer, now);
+    arr->data = (uint8_t *)btc_realloc(arr->data, alloc);
+    arr->alloc = alloc;
   }
 
-  btc_pool_on_tick(pool, now);
+  for (height = arr->length; height <= end; height++) {
+    const btc_entry_t *entry = btc_chain_by_height(chain, height);
+    uint8_t *zp = arr->data + height * HEADER_RECORD_SIZE;
+
+    zp = btc_header_write(zp, &entry->header);
+
+    *zp = 0;
+  }
+
+  if (end >= arr->length)
+    arr->length = end + 1;
+
+  return arr->data + start * HEADER_RECORD_SIZE;
 }
 
+/*
+ * Transaction Queue
+ */
+
+/* Accepted transactions are queued here once.
+ * Each peer keeps its own position in the queue
+ * and reads everything past it when its timer
+ * fires.
+ */
+
 static void
-on_connect(btc_socket_t *socket) {
-  btc_socket_set_nodelay(socket, 1);
-  btc_peer_on_connect((btc_peer_t *)btc_socket_get_data(socket));
+btc_txqueue_init(btc_txqueue_t *queue) {
+  queue->hashes = NULL;
+  queue->length = 0;
+  queue->alloc = 0;
+  queue->base = 0;
 }
 
 static void
-on_close(btc_socket_t *socket) {
-  btc_peer_on_close((btc_peer_t *)btc_socket_get_data(socket));
+btc_txqueue_clear(btc_txqueue_t *queue) {
+  if (queue->alloc > 0)
+    btc_free(queue->hashes);
+
+  btc_txqueue_init(queue);
 }
 
 static void
-on_error(btc_socket_t *socket) {
-  btc_peer_on_error((btc_peer_t *)btc_socket_get_data(socket),
-                    btc_socket_strerror(socket));
-}
+btc_txqueue_push(btc_txqueue_t *queue, const uint8_t *hash) {
+  if (queue->length == queue->alloc) {
+    queue->alloc = queue->alloc == 0 ? 256 : queue->alloc * 2;
+    queue->hashes = (uint8_t *)btc_realloc(queue->hashes, queue->alloc * 32);
+  }
 
-static int
-on_data(btc_socket_t *socket, const void *data, size_t size) {
-  return btc_peer_on_data((btc_peer_t *)btc_socket_get_data(socket),
-                          (const uint8_t *)data,
-                          size);
+  memcpy(queue->hashes + queue->length * 32, hash, 32);
+
+  queue->length++;
 }
 
 static void
-on_drain(btc_socket_t *socket) {
-  btc_peer_on_drain((btc_peer_t *)btc_socket_get_data(socket));
+btc_txqueue_shift(btc_txqueue_t *queue, uint64_t seq) {
+  size_t count;
+
+  if (seq <= queue->base)
+    return;
+
+  count = seq - queue->base;
+
+  if (count > queue->length)
+    count = queue->length;
+
+  memmove(queue->hashes, queue->hashes + count * 32,
+          (queue->length - count) * 32);
+
+  queue->length -= count;
+  queue->base += count;
 }
 
-static void
-on_msg(btc_msg_t *msg, void *arg) {
-  btc_peer_on_msg((btc_peer_t *)arg, msg);
+static int
+btc_txann_compare(const void *x, const void *y) {
+  const btc_txann_t *a = (const btc_txann_t *)x;
+  const btc_txann_t *b = (const btc_txann_t *)y;
+
+  /* Parents first, then by fee rate. */
+  if (a->depth != b->depth)
+    return a->depth - b->depth;
+
+  if (a->rate != b->rate)
+    return a->rate < b->rate ? 1 : -1;
+
+  return 0;
 }
 
-static void
-on_parse_error(void *arg) {
-  btc_peer_on_parse_error((btc_peer_t *)arg);
+static int64_t
+btc_poisson_time(int64_t now, int64_t mean) {
+  double x = (double)btc_random() / 4294967296.0;
+
+  return now + (int64_t)(-log(1.0 - x) * (double)mean + 0.5);
 }
 
 /*
- * Peer
+ * Transaction Requests
  */
 
-static btc_peer_t *
-btc_peer_create(btc_pool_t *pool) {
-  btc_peer_t *peer = (btc_peer_t *)btc_malloc(sizeof(btc_peer_t));
+/* Every hash we want lives here exactly once,
+ * along with the peers that announced it and
+ * the earliest time each may be asked for it.
+ * It is only ever in flight with one of them;
+ * the rest are fallbacks should that one time
+ * out, send notfound, or go away. The hash is
+ * a wtxid if it came from a BIP339 inv, and a
+ * txid otherwise (orphan parents are always
+ * fetched by txid).
+ */
 
-  memset(peer, 0, sizeof(*peer));
+static btc_txreq_t *
+btc_txreq_create(const uint8_t *hash) {
+  btc_txreq_t *req = (btc_txreq_t *)btc_malloc(sizeof(btc_txreq_t));
 
-  peer->pool = pool;
-  peer->network = pool->network;
-  peer->logger = pool->logger;
-  peer->loop = pool->loop;
-  peer->socket = NULL;
+  memcpy(req->hash, hash, 32);
 
-  peer->state = BTC_PEER_DEAD;
-  peer->id = pool->id++;
-  peer->version = -1;
-  peer->height = -1;
-  peer->relay = 1;
-  peer->fee_rate = -1;
-  peer->compact_mode = -1;
-  peer->last_pong = -1;
-  peer->last_ping = -1;
-  peer->min_ping = -1;
-  peer->block_time = -1;
-  peer->gb_time = -1;
-  peer->gh_time = -1;
+  req->items = NULL;
+  req->length = 0;
+  req->alloc = 0;
+  req->peer = NULL;
+  req->type = BTC_INV_TX;
+  req->expires = 0;
 
-  btc_parser_init(&peer->parser, peer->network->magic);
+  return req;
+}
 
-  peer->parser.on_msg = on_msg;
-  peer->parser.on_error = on_parse_error;
-  peer->parser.arg = peer;
+static void
+btc_txreq_destroy(btc_txreq_t *req) {
+  if (req->alloc > 0)
+    btc_free(req->items);
 
-  btc_inv_init(&peer->inv_queue);
+  btc_free(req);
+}
 
-  btc_filter_init(&peer->addr_filter);
-  btc_filter_set(&peer->addr_filter, 5000, 0.001);
+static int
+btc_txreq_add(btc_txreq_t *req,
+              btc_peer_t *peer,
+              uint32_t type,
+              int64_t time) {
+  size_t i;
 
-  btc_filter_init(&peer->inv_filter);
-  btc_filter_set(&peer->inv_filter, 50000, 0.000001);
+  for (i = 0; i < req->length; i++) {
+    if (req->items[i].peer == peer)
+      return 0;
+  }
 
-  peer->block_map = btc_hashtab_create();
-  peer->tx_map = btc_hashtab_create();
-  peer->compact_map = btc_hashmap_create();
+  if (req->length == req->alloc) {
+    req->alloc = req->alloc == 0 ? 2 : req->alloc * 2;
+    req->items = (btc_txcand_t *)btc_realloc(req->items,
+                                             req->alloc * sizeof(btc_txcand_t));
+  }
 
-  return peer;
+  req->items[req->length].peer = peer;
+  req->items[req->length].type = type;
+  req->items[req->length].time = time;
+  req->length++;
+
+  return 1;
 }
 
-static void
-btc_peer_clear_data(btc_peer_t *peer);
+static int
+btc_txreq_remove(btc_txreq_t *req, btc_peer_t *peer) {
+  size_t i;
 
-static void
-btc_peer_destroy(btc_peer_t *peer) {
-  btc_hashtabiter_t tabit;
-  btc_hashmapiter_t mapit;
+  for (i = 0; i < req->length; i++) {
+    if (req->items[i].peer == peer) {
+      req->items[i] = req->items[--req->length];
+      return 1;
+    }
+  }
 
-  btc_parser_clear(&peer->parser);
+  return 0;
+}
 
-  btc_peer_clear_data(peer);
+static const btc_txcand_t *
+btc_txreq_select(const btc_txreq_t *req, int64_t now, int64_t *next) {
+  const btc_txcand_t *best = NULL;
+  size_t i;
 
-  /* Free block hashes. */
-  btc_hashtab_iterate(&tabit, peer->block_map);
+  for (i = 0; i < req->length; i++) {
+    const btc_txcand_t *cand = &req->items[i];
 
-  while (btc_hashtab_next(&tabit))
-    btc_free(tabit.key);
+    if (cand->time > now) {
+      if (cand->time < *next)
+        *next = cand->time;
 
-  /* Free TXIDs. */
-  btc_hashtab_iterate(&tabit, peer->tx_map);
+      continue;
+    }
 
-  while (btc_hashtab_next(&tabit))
-    btc_free(tabit.key);
+    if (best == NULL || cand->time < best->time)
+      best = cand;
+  }
 
-  /* Free compact blocks. */
-  btc_hashmap_iterate(&mapit, peer->compact_map);
+  return best;
+}
 
-  while (btc_hashmap_next(&mapit))
-    btc_cmpct_destroy(mapit.val);
+static int
+btc_txfetch_compare(const void *x, const void *y) {
+  const btc_txfetch_t *a = (const btc_txfetch_t *)x;
+  const btc_txfetch_t *b = (const btc_txfetch_t *)y;
 
-  btc_inv_clear(&peer->inv_queue);
+  if (a->peer->id != b->peer->id)
+    return a->peer->id < b->peer->id ? -1 : 1;
 
-  btc_filter_clear(&peer->addr_filter);
-  btc_filter_clear(&peer->inv_filter);
+  return 0;
+}
 
-  if (peer->spv_filter != NULL)
-    btc_bloom_destroy(peer->spv_filter);
+static void
+btc_pool_clear_txs(btc_pool_t *pool) {
+  btc_hashmapiter_t it;
 
-  btc_hashtab_destroy(peer->block_map);
-  btc_hashtab_destroy(peer->tx_map);
-  btc_hashmap_destroy(peer->compact_map);
+  btc_hashmap_iterate(&it, pool->tx_map);
 
-  btc_free(peer);
+  while (btc_hashmap_next(&it))
+    btc_txreq_destroy(it.val);
+
+  btc_hashmap_reset(pool->tx_map);
 }
 
+/*
+ * Parser
+ */
+
 static void
-btc_peer_log(btc_peer_t *peer, const char *fmt, ...) {
-  va_list ap;
-  va_start(ap, fmt);
-  btc_logger_write(peer->logger, "peer", fmt, ap);
-  va_end(ap);
+btc_parser_init(btc_parser_t *parser, uint32_t magic) {
+  parser->magic = magic;
+  parser->pending = NULL;
+  parser->alloc = 0;
+  parser->total = 0;
+  parser->waiting = 24;
+  parser->closed = 0;
+  parser->cmd[0] = '\0';
+  parser->has_header = 0;
+  parser->checksum = 0;
+  parser->cipher = NULL;
+  parser->garbage = NULL;
+  parser->garbage_len = 0;
+  parser->greeted = 0;
+  parser->stats = NULL;
+  parser->perf = NULL;
+  parser->workers = NULL;
+  parser->lock = NULL;
+  btc_queue_init(&parser->frames);
+  parser->on_msg = NULL;
+  parser->on_error = NULL;
+  parser->arg = NULL;
 }
 
-static int
-btc_peer_open(btc_peer_t *peer, const btc_netaddr_t *addr) {
-  btc_socket_t *socket;
-  btc_sockaddr_t sa;
+static void
+btc_frame_destroy(btc_frame_t *frame);
 
-  btc_netaddr_get_sockaddr(&sa, addr);
+static void
+btc_parser_clear(btc_parser_t *parser) {
+  btc_frame_t *frame, *next;
 
-  socket = btc_loop_connect(peer->loop, &sa);
+  for (frame = parser->frames.head; frame != NULL; frame = next) {
+    next = frame->next;
 
-  if (socket == NULL)
-    return 0;
+    /* A worker still holds this one; it frees it when done. */
+    btc_mutex_lock(parser->lock);
 
-  peer->state = BTC_PEER_CONNECTING;
-  peer->socket = socket;
-  peer->addr = *addr;
-  peer->outbound = 1;
-  peer->time = btc_time_msec();
-  peer->nonce = btc_nonces_alloc(&peer->pool->nonces);
+    if (frame->state == BTC_FRAME_PENDING) {
+      frame->orphan = 1;
+      frame = NULL;
+    }
 
-  btc_socket_set_data(socket, peer);
-  btc_socket_on_connect(socket, on_connect);
-  btc_socket_on_close(socket, on_close);
-  btc_socket_on_error(socket, on_error);
-  btc_socket_on_data(socket, on_data);
-  btc_socket_on_drain(socket, on_drain);
+    btc_mutex_unlock(parser->lock);
 
-  return 1;
-}
+    if (frame != NULL)
+      btc_frame_destroy(frame);
+  }
 
-static int
-btc_peer_accept(btc_peer_t *peer, btc_socket_t *socket) {
-  btc_sockaddr_t sa;
+  btc_queue_init(&parser->frames);
 
-  btc_socket_address(&sa, socket);
+  if (parser->alloc > 0)
+    btc_free(parser->pending);
 
-  /* We're shy. Wait for an introduction. */
-  peer->state = BTC_PEER_WAIT_VERSION;
-  peer->socket = socket;
+  if (parser->garbage != NULL)
+    btc_free(parser->garbage);
 
-  btc_netaddr_set_sockaddr(&peer->addr, &sa);
+  parser->pending = NULL;
+  parser->garbage = NULL;
+}
 
-  peer->outbound = 0;
-  peer->time = btc_time_msec();
-  peer->nonce = btc_nonces_alloc(&peer->pool->nonces);
+static void
+btc_parser_set_cipher(btc_parser_t *parser,
+                      btc_bip324_t *cipher,
+                      const uint8_t *garbage,
+                      size_t garbage_len) {
+  /* Everything from here on is framed as v2 packets. The
+     first one also authenticates the garbage before it. */
+  CHECK(parser->total == 0 && !parser->has_header);
 
-  btc_socket_set_data(socket, peer);
-  /* btc_socket_on_connect(socket, on_connect); */
-  btc_socket_on_close(socket, on_close);
-  btc_socket_on_error(socket, on_error);
-  btc_socket_on_data(socket, on_data);
-  btc_socket_on_drain(socket, on_drain);
+  parser->cipher = cipher;
+  parser->waiting = BTC_BIP324_LENGTH_SIZE;
 
-  btc_peer_log(peer, "Connected to %N.", &peer->addr);
+  if (garbage_len > 0) {
+    parser->garbage = (uint8_t *)btc_malloc(garbage_len);
+    parser->garbage_len = garbage_len;
 
-  return 1;
+    memcpy(parser->garbage, garbage, garbage_len);
+  }
 }
 
 static void
-btc_peer_close(btc_peer_t *peer) {
-  btc_socket_close(peer->socket);
-  peer->state = BTC_PEER_DEAD;
-  peer->parser.closed = 1;
+btc_parser_reserve(btc_parser_t *parser, size_t size) {
+  if (size > parser->alloc) {
+    parser->pending = (uint8_t *)btc_realloc(parser->pending, size);
+    parser->alloc = size;
+  }
 }
 
 static void
-btc_pool_ban(btc_pool_t *pool, const btc_netaddr_t *addr);
-
-static int
-btc_peer_increase_ban(btc_peer_t *peer, int score) {
-  peer->ban_score += score;
+btc_parser_release(btc_parser_t *parser) {
+  /* Don't hold on to a block-sized buffer per peer. */
+  if (parser->alloc > PARSER_RETAIN) {
+    btc_free(parser->pending);
 
-  if (peer->ban_score >= 100) {
-    btc_peer_log(peer, "Ban threshold exceeded (%N).", &peer->addr);
-    btc_pool_ban(peer->pool, &peer->addr);
-    return 1;
+    parser->pending = NULL;
+    parser->alloc = 0;
   }
-
-  return 0;
 }
 
 static int
-btc_peer_write(btc_peer_t *peer, uint8_t *data, size_t length) {
-  int rc = btc_socket_write(peer->socket, data, length);
+btc_parser_parse_header(btc_parser_t *parser, const uint8_t **xp, size_t *xn) {
+  uint32_t magic, size;
 
-  if (rc == -1) {
-    const char *msg = btc_socket_strerror(peer->socket);
+  if (!btc_uint32_read(&magic, xp, xn))
+    return 0;
 
-    btc_peer_log(peer, "Write error (%N): %s", &peer->addr, msg);
-    btc_peer_close(peer);
+  if (magic != parser->magic)
+    return 0;
 
+  if (!btc_nullstr_read(parser->cmd, 12, xp, xn))
     return 0;
-  }
 
-  peer->last_send = btc_time_msec();
+  if (!btc_uint32_read(&size, xp, xn))
+    return 0;
 
-  return rc;
-}
+  if (size > BTC_NET_MAX_MESSAGE)
+    return 0;
 
-static int
-btc_peer_send(btc_peer_t *peer, const btc_msg_t *msg) {
-  size_t bodylen = btc_msg_size(msg);
-  size_t length = 24 + bodylen;
-  uint8_t *data = (uint8_t *)btc_malloc(length);
-  uint8_t *body = data + 24;
-  uint8_t *zp = data;
+  if (!btc_uint32_read(&parser->checksum, xp, xn))
+    return 0;
 
-  /* Payload. */
-  btc_msg_export(body, msg);
+  parser->waiting = size;
+  parser->has_header = 1;
 
-  /* Magic value. */
-  zp = btc_uint32_write(zp, peer->network->magic);
+  return 1;
+}
 
-  /* Command. */
-  zp = btc_nullstr_write(zp, 12, msg->cmd);
+static int
+btc_parser_parse_length(btc_parser_t *parser, const uint8_t *data) {
+  size_t size = btc_bip324_length(parser->cipher, data);
 
-  /* Payload length. */
-  zp = btc_uint32_write(zp, bodylen);
+  /* Contents are a message type followed by the payload. */
+  if (size > 1 + 12 + BTC_NET_MAX_MESSAGE)
+    return 0;
 
-  /* Checksum. */
-  btc_uint32_write(zp, btc_checksum(body, bodylen));
+  parser->waiting = BTC_BIP324_HEADER_SIZE + size + BTC_BIP324_TAG_SIZE;
+  parser->has_header = 1;
 
-  return btc_peer_write(peer, data, length);
+  return 1;
 }
 
-static int
-btc_peer_sendmsg(btc_peer_t *peer, enum btc_msgtype type, const void *body) {
-  btc_msg_t msg;
+/* With network threads enabled, large payloads are
+ * checksummed and decoded on the worker pool instead
+ * of the loop thread. Once a peer has a frame out for
+ * decoding, everything after it follows the same path
+ * so that messages are still delivered in order. The
+ * results are picked up by btc_parser_drain.
+ */
 
-  btc_msg_set_type(&msg, type);
+static void
+btc_frame_destroy(btc_frame_t *frame) {
+  if (frame->state == BTC_FRAME_OK)
+    btc_msg_clear(&frame->msg);
 
-  msg.body = (void *)body;
+  if (frame->data != NULL)
+    btc_free(frame->data);
 
-  return btc_peer_send(peer, &msg);
+  btc_free(frame);
 }
 
 static int
-btc_peer_send_version(btc_peer_t *peer) {
-  btc_pool_t *pool = peer->pool;
-  btc_version_t msg;
-
-  btc_version_init(&msg);
+btc_frame_is_view(const btc_frame_t *frame) {
+  switch (frame->msg.type) {
+    case BTC_MSG_INV:
+    case BTC_MSG_GETDATA:
+    case BTC_MSG_NOTFOUND:
+      return 1;
+    default:
+      return 0;
+  }
+}
 
-  msg.version = BTC_NET_PROTOCOL_VERSION;
-  msg.services = pool->services;
-  msg.time = btc_timedata_now(pool->timedata);
-  msg.remote = peer->addr;
+static int
+btc_msg_memtag(const btc_msg_t *msg) {
+  /* Charge decoded objects to whoever ends up holding them. */
+  switch (msg->type) {
+    case BTC_MSG_TX:
+      return BTC_MEMTAG_MEMPOOL;
+    case BTC_MSG_BLOCK:
+    case BTC_MSG_BLOCKTXN:
+    case BTC_MSG_CMPCTBLOCK:
+      return BTC_MEMTAG_CHAIN;
+    default:
+      return BTC_MEMTAG_NET;
+  }
+}
 
-  btc_netaddr_init(&msg.local);
+static void
+btc_frame_decode(void *arg) {
+  btc_frame_t *frame = (btc_frame_t *)arg;
+  enum btc_frame_state state = BTC_FRAME_BAD;
+  int64_t start = btc_time_nsec();
+  int orphan, tag;
 
-  msg.local.services = pool->services;
-  msg.nonce = peer->nonce;
+  if (frame->authenticated
+      || btc_checksum(frame->data, frame->length) == frame->checksum) {
+    btc_msg_set_cmd(&frame->msg, frame->cmd);
 
-  strcpy(msg.agent, BTC_NET_USER_AGENT);
+    BTC_MEMTAG_PUSH(tag, btc_msg_memtag(&frame->msg));
 
-  msg.height = btc_chain_height(pool->chain);
-  msg.relay = ((pool->flags & BTC_POOL_BLOCKSONLY) == 0);
+    btc_msg_alloc(&frame->msg);
 
-  return btc_peer_sendmsg(peer, BTC_MSG_VERSION, &msg);
-}
+    if (btc_msg_import(&frame->msg, frame->data, frame->length))
+      state = BTC_FRAME_OK;
+    else
+      btc_msg_clear(&frame->msg);
 
-static int
-btc_peer_send_verack(btc_peer_t *peer) {
-  return btc_peer_sendmsg(peer, BTC_MSG_VERACK, NULL);
-}
+    BTC_MEMTAG_POP(tag);
+  }
 
-static int
-btc_peer_send_ping(btc_peer_t *peer) {
-  btc_ping_t ping;
+  /* Inv bodies are views over the payload: keep
+     it around until the frame is destroyed. */
+  if (state != BTC_FRAME_OK || !btc_frame_is_view(frame)) {
+    if (frame->data != NULL)
+      btc_free(frame->data);
 
-  if (peer->version <= BTC_NET_PONG_VERSION) {
-    ping.nonce = 0;
-    return btc_peer_sendmsg(peer, BTC_MSG_PING, &ping);
+    frame->data = NULL;
   }
 
-  if (peer->challenge != 0) {
-    btc_peer_log(peer, "Peer has not responded to ping (%N).", &peer->addr);
-    return 1;
-  }
+  btc_mutex_lock(frame->lock);
 
-  peer->last_ping = btc_time_msec();
-  peer->challenge = btc_nonce();
+  frame->state = state;
+  frame->elapsed = btc_time_nsec() - start;
 
-  ping.nonce = peer->challenge;
+  orphan = frame->orphan;
 
-  return btc_peer_sendmsg(peer, BTC_MSG_PING, &ping);
+  btc_mutex_unlock(frame->lock);
+
+  if (orphan)
+    btc_frame_destroy(frame);
 }
 
 static int
-btc_peer_send_pong(btc_peer_t *peer, uint64_t nonce) {
-  btc_pong_t pong;
+btc_parser_defer(btc_parser_t *parser, const uint8_t *data, size_t length) {
+  btc_frame_t *frame = (btc_frame_t *)btc_malloc(sizeof(btc_frame_t));
 
-  pong.nonce = nonce;
+  memcpy(frame->cmd, parser->cmd, sizeof(frame->cmd));
 
-  return btc_peer_sendmsg(peer, BTC_MSG_PONG, &pong);
-}
+  frame->lock = parser->lock;
+  frame->data = NULL;
+  frame->length = length;
+  frame->checksum = parser->checksum;
+  frame->authenticated = (parser->cipher != NULL);
+  frame->state = BTC_FRAME_PENDING;
+  frame->elapsed = 0;
+  frame->orphan = 0;
+  frame->next = NULL;
 
-static int
-btc_peer_send_getaddr(btc_peer_t *peer) {
-  if (peer->sent_getaddr)
-    return 1;
+  if (data == parser->pending) {
+    /* Already sized for the frame: hand it over. */
+    frame->data = parser->pending;
 
-  peer->sent_getaddr = 1;
+    parser->pending = NULL;
+    parser->alloc = 0;
+  } else if (length > 0) {
+    frame->data = (uint8_t *)btc_malloc(length);
 
-  return btc_peer_sendmsg(peer, BTC_MSG_GETADDR, NULL);
-}
+    memcpy(frame->data, data, length);
+  }
 
-static int
-btc_peer_send_addr(btc_peer_t *peer, const btc_addrs_t *addrs) {
-  return btc_peer_sendmsg(peer, BTC_MSG_ADDR, addrs);
+  btc_queue_push(&parser->frames, frame);
+
+  btc_workers_add(parser->workers, btc_frame_decode, frame);
+
+  return 1;
 }
 
-static int
-btc_peer_send_addr_1(btc_peer_t *peer, const btc_netaddr_t *addr) {
-  btc_netaddr_t *items[1];
-  btc_addrs_t addrs;
+static void
+btc_parser_drain(btc_parser_t *parser) {
+  enum btc_frame_state state;
+  btc_frame_t *frame;
 
-  items[0] = (btc_netaddr_t *)addr;
+  while (parser->frames.head != NULL) {
+    frame = parser->frames.head;
 
-  addrs.items = items;
-  addrs.alloc = 0;
-  addrs.length = 1;
+    btc_mutex_lock(parser->lock);
 
-  return btc_peer_send_addr(peer, &addrs);
-}
+    state = frame->state;
 
-static int
-btc_peer_send_getblocks(btc_peer_t *peer,
-                        const btc_vector_t *locator,
-                        const uint8_t *stop) {
-  const uint8_t *tip = NULL;
-  btc_getblocks_t msg;
+    btc_mutex_unlock(parser->lock);
 
-  msg.version = BTC_NET_PROTOCOL_VERSION;
-  msg.locator = *locator;
+    if (state == BTC_FRAME_PENDING)
+      break;
 
-  if (stop != NULL)
-    btc_hash_copy(msg.stop, stop);
-  else
-    btc_hash_init(msg.stop);
+    btc_queue_shift(&parser->frames);
 
-  peer->gb_time = btc_time_msec();
+    if (!parser->closed) {
+      if (state == BTC_FRAME_OK && frame->msg.type == BTC_MSG_BLOCK)
+        btc_perf_record(parser->perf, BTC_PERF_BLOCK_DECODE, frame->elapsed);
 
-  if (locator->length > 0)
-    tip = (const uint8_t *)locator->items[0];
+      if (state == BTC_FRAME_OK)
+        parser->on_msg(&frame->msg, parser->arg);
+      else
+        parser->on_error(parser->arg, 0);
+    }
 
-  btc_peer_log(peer, "Requesting inv message from peer with getblocks (%N).",
-                     &peer->addr);
+    btc_frame_destroy(frame);
+  }
+}
 
-  btc_peer_log(peer, "Sending getblocks (tip=%H, stop=%H).", tip, stop);
+static int
+btc_parser_should_defer(btc_parser_t *parser, size_t length) {
+  if (parser->workers == NULL)
+    return 0;
 
-  return btc_peer_sendmsg(peer, BTC_MSG_GETBLOCKS, &msg);
+  return parser->frames.length > 0 || length >= PARSER_DEFER;
 }
 
 static int
-btc_peer_send_getheaders(btc_peer_t *peer,
-                         const btc_vector_t *locator,
-                         const uint8_t *stop) {
-  const uint8_t *tip = NULL;
-  btc_getblocks_t msg;
+btc_parser_dispatch(btc_parser_t *parser,
+                    const uint8_t *data,
+                    size_t length,
+                    size_t wire) {
+  int64_t start;
+  btc_msg_t msg;
+  int tag, ok;
 
-  msg.version = BTC_NET_PROTOCOL_VERSION;
-  msg.locator = *locator;
+  btc_msg_set_cmd(&msg, parser->cmd);
 
-  if (stop != NULL)
-    btc_hash_copy(msg.stop, stop);
-  else
-    btc_hash_init(msg.stop);
+  if (parser->stats != NULL) {
+    parser->stats[msg.type].bytes += wire;
+    parser->stats[msg.type].msgs += 1;
+  }
 
-  peer->gh_time = btc_time_msec();
+  if (btc_parser_should_defer(parser, length))
+    return btc_parser_defer(parser, data, length);
 
-  if (locator->length > 0)
-    tip = (const uint8_t *)locator->items[0];
+  start = btc_time_nsec();
 
-  btc_peer_log(peer,
-    "Requesting headers message from peer with getheaders (%N).",
-    &peer->addr);
+  /* v2 packets were already authenticated. */
+  if (parser->cipher == NULL) {
+    if (btc_checksum(data, length) != parser->checksum)
+      return 0;
+  }
 
-  btc_peer_log(peer, "Sending getheaders (tip=%H, stop=%H).", tip, stop);
+  BTC_MEMTAG_PUSH(tag, btc_msg_memtag(&msg));
 
-  return btc_peer_sendmsg(peer, BTC_MSG_GETHEADERS, &msg);
-}
+  btc_msg_alloc(&msg);
 
-static int
-btc_peer_send_getheaders_1(btc_peer_t *peer,
-                           const uint8_t *hash,
-                           const uint8_t *stop) {
-  btc_vector_t locator;
-  void *items[1];
+  ok = btc_msg_import(&msg, data, length);
 
-  items[0] = (void *)hash;
+  if (!ok)
+    btc_msg_clear(&msg);
 
-  locator.items = items;
-  locator.alloc = 0;
-  locator.length = 1;
+  BTC_MEMTAG_POP(tag);
 
-  return btc_peer_send_getheaders(peer, &locator, stop);
-}
+  if (!ok)
+    return 0;
 
-BTC_UNUSED static int
-btc_peer_send_mempool(btc_peer_t *peer) {
-  if (!(peer->services & BTC_NET_SERVICE_BLOOM)) {
-    btc_peer_log(peer,
-      "Cannot request mempool for non-bloom peer (%N).",
-      &peer->addr);
-    return 1;
+  if (msg.type == BTC_MSG_BLOCK) {
+    btc_perf_record(parser->perf, BTC_PERF_BLOCK_DECODE,
+                                  btc_time_nsec() - start);
   }
 
-  btc_peer_log(peer,
-    "Requesting inv message from peer with mempool (%N).",
-    &peer->addr);
+  parser->on_msg(&msg, parser->arg);
 
-  return btc_peer_sendmsg(peer, BTC_MSG_MEMPOOL, NULL);
+  btc_msg_clear(&msg);
+
+  return 1;
 }
 
 static int
-btc_peer_send_sendcmpct(btc_peer_t *peer, uint8_t mode) {
-  btc_sendcmpct_t msg;
+btc_parser_open(btc_parser_t *parser, const uint8_t *data, size_t length) {
+  /* Packets are decrypted straight into the framing
+     buffer. Split ones were gathered there already
+     and are opened in place. */
+  size_t len = length - BTC_BIP324_HEADER_SIZE - BTC_BIP324_TAG_SIZE;
+  const uint8_t *body;
+  int ok;
+
+  parser->waiting = BTC_BIP324_LENGTH_SIZE;
+  parser->has_header = 0;
 
-  msg.mode = mode;
+  if (data != parser->pending)
+    btc_parser_reserve(parser, BTC_BIP324_HEADER_SIZE + len);
 
-  if (peer->services & BTC_NET_SERVICE_WITNESS) {
-    if (peer->version >= BTC_NET_COMPACT_WITNESS_VERSION) {
-      btc_peer_log(peer,
-        "Initializing witness compact blocks (%N).",
-        &peer->addr);
+  ok = btc_bip324_open(parser->cipher,
+                       parser->pending,
+                       data,
+                       len,
+                       parser->garbage,
+                       parser->garbage_len);
 
-      msg.version = 2;
+  if (parser->garbage != NULL) {
+    btc_free(parser->garbage);
 
-      return btc_peer_sendmsg(peer, BTC_MSG_SENDCMPCT, &msg);
-    }
+    parser->garbage = NULL;
+    parser->garbage_len = 0;
   }
 
-#if 0
-  if (peer->version >= BTC_NET_COMPACT_VERSION) {
-    btc_peer_log(peer,
-      "Initializing normal compact blocks (%N).",
-      &peer->addr);
+  if (!ok)
+    return 0;
 
-    msg.version = 1;
+  /* Decoys. */
+  if (parser->pending[0] & BTC_BIP324_IGNORE)
+    return 1;
 
-    return btc_peer_sendmsg(peer, BTC_MSG_SENDCMPCT, &msg);
+  /* The version packet is reserved for future use. */
+  if (!parser->greeted) {
+    parser->greeted = 1;
+    return 1;
   }
-#endif
 
-  return 1;
-}
+  body = parser->pending + BTC_BIP324_HEADER_SIZE;
 
-static int
-btc_peer_send_inv(btc_peer_t *peer, const btc_zinv_t *msg) {
-  size_t i;
+  if (!btc_bip324_type_read(parser->cmd, &body, &len))
+    return 0;
 
-  for (i = 0; i < msg->length; i++) {
-    const btc_zinvitem_t *item = &msg->items[i];
+  if (len > BTC_NET_MAX_MESSAGE)
+    return 0;
 
-    btc_filter_add(&peer->inv_filter, item->hash, 32);
+  /* A deferred frame takes the buffer with it. */
+  if (btc_parser_should_defer(parser, len)) {
+    memmove(parser->pending, body, len);
+    body = parser->pending;
   }
 
-  btc_peer_log(peer, "Serving %zu inv items to %N.",
-                     msg->length, &peer->addr);
-
-  return btc_peer_sendmsg(peer, BTC_MSG_INV, msg);
+  return btc_parser_dispatch(parser, body, len,
+                             BTC_BIP324_LENGTH_SIZE + length);
 }
 
 static int
-btc_peer_send_inv_0(btc_peer_t *peer,
-                    enum btc_msgtype cmd,
-                    uint32_t type,
-                    const uint8_t *hash) {
-  btc_zinvitem_t item;
-  btc_zinv_t msg;
+btc_parser_parse(btc_parser_t *parser, const uint8_t *data, size_t length) {
+  if (parser->cipher != NULL) {
+    if (!parser->has_header)
+      return btc_parser_parse_length(parser, data);
 
-  item.type = type;
-  item.hash = hash;
+    return btc_parser_open(parser, data, length);
+  }
 
-  msg.items = &item;
-  msg.alloc = 0;
-  msg.length = 1;
+  CHECK(length <= BTC_NET_MAX_MESSAGE);
 
-  return btc_peer_sendmsg(peer, cmd, &msg);
-}
+  if (!parser->has_header)
+    return btc_parser_parse_header(parser, &data, &length);
 
-static int
-btc_peer_send_inv_1(btc_peer_t *peer, uint32_t type, const uint8_t *hash) {
-  btc_filter_add(&peer->inv_filter, hash, 32);
-  btc_peer_log(peer, "Serving 1 inv items to %N.", &peer->addr);
-  return btc_peer_send_inv_0(peer, BTC_MSG_INV, type, hash);
-}
+  parser->waiting = 24;
+  parser->has_header = 0;
 
-static int
-btc_peer_send_getdata(btc_peer_t *peer, const btc_zinv_t *msg) {
-  return btc_peer_sendmsg(peer, BTC_MSG_GETDATA, msg);
+  return btc_parser_dispatch(parser, data, length, 24 + length);
 }
 
 static int
-btc_peer_send_getdata_1(btc_peer_t *peer, uint32_t type, const uint8_t *hash) {
-  return btc_peer_send_inv_0(peer, BTC_MSG_GETDATA, type, hash);
-}
+btc_parser_feed(btc_parser_t *parser, const uint8_t *data, size_t length) {
+  int parsed = 0, fatal;
+  const uint8_t *ptr;
+  size_t size;
 
-static int
-btc_peer_send_notfound(btc_peer_t *peer, const btc_inv_t *msg) {
-  return btc_peer_sendmsg(peer, BTC_MSG_NOTFOUND_FULL, msg);
-}
+  /* Frames which arrive whole are parsed straight
+     out of the read buffer. Anything split across
+     reads is gathered into a buffer sized for the
+     frame as soon as its header is known. */
+  while (!parser->closed) {
+    size = parser->waiting;
 
-static int
-btc_peer_send_notfound_1(btc_peer_t *peer, uint32_t type, const uint8_t *hash) {
-  return btc_peer_send_inv_0(peer, BTC_MSG_NOTFOUND, type, hash);
-}
+    if (parser->total == 0 && length >= size) {
+      ptr = data;
+      data += size;
+      length -= size;
+    } else {
+      if (length == 0)
+        break;
 
-static int
-btc_peer_send_headers(btc_peer_t *peer, const btc_headers_t *msg) {
-  return btc_peer_sendmsg(peer, BTC_MSG_HEADERS, msg);
-}
+      btc_parser_reserve(parser, size);
 
-static int
-btc_peer_send_headers_1(btc_peer_t *peer, const btc_header_t *hdr) {
-  btc_header_t *items[1];
-  btc_headers_t msg;
+      size -= parser->total;
 
-  items[0] = (btc_header_t *)hdr;
+      if (size > length)
+        size = length;
 
-  msg.items = items;
-  msg.alloc = 0;
-  msg.length = 1;
+      memcpy(parser->pending + parser->total, data, size);
 
-  return btc_peer_sendmsg(peer, BTC_MSG_HEADERS, &msg);
-}
+      parser->total += size;
+      data += size;
+      length -= size;
 
-static int
-btc_peer_send_reject(btc_peer_t *peer, const btc_reject_t *msg) {
-  btc_peer_log(peer, "Rejecting %s %H (%N): code=%s reason=%s.",
-                     msg->message,
-                     msg->hash,
-                     &peer->addr,
-                     btc_reject_get_code(msg),
-                     msg->reason);
+      if (parser->total < parser->waiting)
+        break;
 
-  return btc_peer_sendmsg(peer, BTC_MSG_REJECT, msg);
-}
+      ptr = parser->pending;
+      size = parser->total;
 
-static int
-btc_peer_reject(btc_peer_t *peer,
-                const char *message,
-                const btc_verify_error_t *err) {
-  btc_reject_t reject;
+      parser->total = 0;
+    }
 
-  btc_reject_init(&reject);
-
-  strcpy(reject.message, message);
-  btc_reject_set_code(&reject, err->code);
-  strcpy(reject.reason, err->reason);
-  btc_hash_copy(reject.hash, err->hash);
+    if (parser->has_header)
+      parsed = 1;
 
-  btc_peer_send_reject(peer, &reject);
+    /* A bad header or a bad tag leaves us lost in the stream. */
+    fatal = !parser->has_header || parser->cipher != NULL;
 
-  return btc_peer_increase_ban(peer, err->score);
-}
+    if (!btc_parser_parse(parser, ptr, size)) {
+      if (!parser->closed)
+        parser->on_error(parser->arg, fatal);
+    }
 
-static int
-btc_peer_has_compact_support(btc_peer_t *peer) {
-  if (peer->version < BTC_NET_COMPACT_VERSION)
-    return 0;
+    if (ptr == parser->pending || parser->cipher != NULL)
+      btc_parser_release(parser);
+  }
 
-  if (!(peer->services & BTC_NET_SERVICE_WITNESS))
-    return 0;
+  if (parser->frames.length > 0)
+    btc_parser_drain(parser);
 
-  return peer->version >= BTC_NET_COMPACT_WITNESS_VERSION;
+  return parsed;
 }
 
-static int
-btc_peer_has_compact(btc_peer_t *peer) {
-  if (peer->compact_mode == -1)
-    return 0;
+/*
+ * Events
+ */
 
-  if (!peer->compact_witness)
-    return 0;
+static void
+btc_pool_on_tick(btc_pool_t *pool, int64_t now);
 
-  return 1;
-}
+static void
+btc_pool_on_socket(btc_pool_t *pool, btc_socket_t *socket);
 
-static uint32_t
-btc_peer_block_type(btc_peer_t *peer) {
-  if ((peer->pool->flags & BTC_POOL_BIP152)
-      && btc_peer_has_compact_support(peer)
-      && btc_peer_has_compact(peer)) {
-    return BTC_INV_CMPCT_BLOCK;
-  }
+static void
+btc_pool_on_relay(btc_pool_t *pool,
+                  const uint8_t *data,
+                  size_t size,
+                  const btc_sockaddr_t *addr);
 
-  if (peer->services & BTC_NET_SERVICE_WITNESS)
-    return BTC_INV_WITNESS_BLOCK;
+static void
+btc_pool_reset_relay(btc_pool_t *pool);
 
-  return BTC_INV_BLOCK;
-}
+static void
+btc_peer_on_tick(btc_peer_t *peer);
 
-static uint32_t
-btc_peer_tx_type(btc_peer_t *peer) {
-  if (peer->services & BTC_NET_SERVICE_WITNESS)
-    return BTC_INV_WITNESS_TX;
+static void
+btc_peer_on_connect_timer(void *arg);
 
-  return BTC_INV_TX;
-}
+static void
+btc_peer_on_ping_timer(void *arg);
 
-static int
-btc_peer_get_full_block(btc_peer_t *peer, const uint8_t *hash) {
-  uint32_t type = BTC_INV_BLOCK;
+static void
+btc_peer_on_inv_timer(void *arg);
 
-  if (peer->services & BTC_NET_SERVICE_WITNESS)
-    type = BTC_INV_WITNESS_BLOCK;
+static void
+btc_peer_on_stall_timer(void *arg);
 
-  return btc_peer_send_getdata_1(peer, type, hash);
-}
+static void
+btc_peer_on_connect(btc_peer_t *peer);
+
+static void
+btc_peer_on_close(btc_peer_t *peer);
+
+static void
+btc_peer_on_error(btc_peer_t *peer, const char *msg);
 
 static int
-btc_peer_send_cmpctblock(btc_peer_t *peer, const btc_block_t *block) {
-  enum btc_msgtype type = BTC_MSG_CMPCTBLOCK_BASE;
-  btc_cmpct_t msg;
-  int rc;
+btc_peer_on_data(btc_peer_t *peer, const uint8_t *data, size_t size);
 
-  btc_cmpct_init(&msg);
-  btc_cmpct_set_block(&msg, block, peer->compact_witness);
+static void
+btc_peer_on_drain(btc_peer_t *peer);
 
-  if (peer->compact_witness)
-    type = BTC_MSG_CMPCTBLOCK;
+static void
+btc_peer_on_msg(btc_peer_t *peer, btc_msg_t *msg);
 
-  rc = btc_peer_sendmsg(peer, type, &msg);
+static void
+btc_peer_on_parse_error(btc_peer_t *peer, int fatal);
 
-  btc_cmpct_clear(&msg);
+static void
+btc_pool_handle_tx(btc_pool_t *pool,
+                   const btc_tx_t *tx,
+                   int result,
+                   unsigned int id);
 
-  return rc;
+static void
+on_server_socket(btc_socket_t *server, btc_socket_t *socket) {
+  btc_socket_set_nodelay(socket, 1);
+  btc_pool_on_socket((btc_pool_t *)btc_socket_get_data(server), socket);
 }
 
-static int
-btc_peer_send_getblocktxn(btc_peer_t *peer, const btc_cmpct_t *block) {
-  btc_getblocktxn_t msg;
-  int rc;
+static void
+on_server_close(btc_socket_t *server) {
+  btc_pool_t *pool = (btc_pool_t *)btc_socket_get_data(server);
 
-  btc_getblocktxn_init(&msg);
+  pool->server = NULL;
+}
 
-  btc_getblocktxn_set_cmpct(&msg, block);
+static void
+on_relay_message(btc_socket_t *relay,
+                 const void *data,
+                 size_t size,
+                 const btc_sockaddr_t *addr) {
+  btc_pool_on_relay((btc_pool_t *)btc_socket_get_data(relay),
+                    (const uint8_t *)data, size, addr);
+}
 
-  rc = btc_peer_sendmsg(peer, BTC_MSG_GETBLOCKTXN, &msg);
+static void
+on_relay_error(btc_socket_t *relay) {
+  /* Mostly ICMP errors from a peer that is
+     down. Datagrams are best effort anyway. */
+  (void)relay;
+}
 
-  btc_getblocktxn_clear(&msg);
+static void
+on_relay_close(btc_socket_t *relay) {
+  btc_pool_t *pool = (btc_pool_t *)btc_socket_get_data(relay);
 
-  return rc;
+  pool->relay = NULL;
 }
 
-static int
-btc_peer_send_blocktxn(btc_peer_t *peer,
-                       const btc_block_t *block,
-                       const btc_getblocktxn_t *req) {
-  enum btc_msgtype type = BTC_MSG_BLOCKTXN_BASE;
-  btc_blocktxn_t msg;
-  int rc;
+static void
+on_tx_result(const btc_tx_t *tx, int result, unsigned int id, void *arg) {
+  btc_pool_handle_tx((btc_pool_t *)arg, tx, result, id);
+}
 
-  btc_blocktxn_init(&msg);
+static void
+on_tick(void *arg) {
+  btc_pool_t *pool = (btc_pool_t *)arg;
+  btc_peer_t *peer, *next;
+  int64_t now = btc_time_msec();
 
-  btc_blocktxn_set_block(&msg, block, req);
+  btc_mempool_drain(pool->mempool);
 
-  if (peer->compact_witness)
-    type = BTC_MSG_BLOCKTXN;
+  for (peer = pool->peers.head; peer != NULL; peer = next) {
+    next = peer->next;
+    btc_parser_drain(&peer->parser);
+    btc_peer_on_tick(peer);
+  }
 
-  rc = btc_peer_sendmsg(peer, type, &msg);
+  btc_pool_on_tick(pool, now);
+}
 
-  btc_blocktxn_clear(&msg);
+static void
+on_connect(btc_socket_t *socket) {
+  btc_socket_set_nodelay(socket, 1);
+  btc_peer_on_connect((btc_peer_t *)btc_socket_get_data(socket));
+}
 
-  return rc;
+static void
+on_close(btc_socket_t *socket) {
+  btc_peer_on_close((btc_peer_t *)btc_socket_get_data(socket));
+}
+
+static void
+on_error(btc_socket_t *socket) {
+  btc_peer_on_error((btc_peer_t *)btc_socket_get_data(socket),
+                    btc_socket_strerror(socket));
 }
 
 static int
-btc_peer_flush_inv(btc_peer_t *peer) {
-  btc_inv_t inv;
-  int rc = 1;
-  size_t i;
+on_data(btc_socket_t *socket, const void *data, size_t size) {
+  return btc_peer_on_data((btc_peer_t *)btc_socket_get_data(socket),
+                          (const uint8_t *)data,
+                          size);
+}
 
-  if (peer->inv_queue.length == 0)
-    return 1;
+static void
+on_drain(btc_socket_t *socket) {
+  btc_peer_on_drain((btc_peer_t *)btc_socket_get_data(socket));
+}
 
-  btc_inv_init(&inv);
-  btc_inv_grow(&inv, peer->inv_queue.length);
+static void
+on_msg(btc_msg_t *msg, void *arg) {
+  btc_peer_on_msg((btc_peer_t *)arg, msg);
+}
 
-  for (i = 0; i < peer->inv_queue.length; i++) {
-    btc_invitem_t *item = peer->inv_queue.items[i];
+static void
+on_parse_error(void *arg, int fatal) {
+  btc_peer_on_parse_error((btc_peer_t *)arg, fatal);
+}
 
-    if (btc_filter_has(&peer->inv_filter, item->hash, 32)) {
-      btc_invitem_destroy(item);
-      continue;
-    }
+/*
+ * Capture
+ */
 
-    btc_filter_add(&peer->inv_filter, item->hash, 32);
+static void
+btc_pool_log(btc_pool_t *pool, const char *fmt, ...);
 
-    btc_inv_push(&inv, item);
-  }
+static void
+btc_pool_capture(btc_pool_t *pool,
+                 const btc_peer_t *peer,
+                 enum btc_capture_kind kind,
+                 const uint8_t *data,
+                 size_t length) {
+  /* Buffered by stdio; see BTC_CAPTURE_MAGIC for the layout. */
+  uint8_t hdr[BTC_CAPTURE_HEADER];
+
+  if (pool->capture == NULL)
+    return;
 
-  peer->inv_queue.length = 0;
+  btc_write64le(hdr + 0, btc_time_usec());
+  btc_write32le(hdr + 8, peer->id);
+  btc_write32le(hdr + 13, length);
 
-  if (inv.length > 0) {
-    btc_peer_log(peer, "Serving %zu inv items to %N.",
-                       inv.length, &peer->addr);
+  hdr[12] = kind;
 
-    rc = btc_peer_sendmsg(peer, BTC_MSG_INV_FULL, &inv);
+  if (fwrite(hdr, 1, sizeof(hdr), pool->capture) != sizeof(hdr)
+      || (length > 0 && fwrite(data, 1, length, pool->capture) != length)) {
+    btc_pool_log(pool, "Could not write to %s. Capture stopped.",
+                       pool->capture_file);
+    fclose(pool->capture);
+    pool->capture = NULL;
   }
+}
 
-  btc_inv_clear(&inv);
+static void
+btc_pool_capture_open(btc_pool_t *pool, const btc_peer_t *peer) {
+  uint8_t outbound = peer->outbound;
 
-  return rc;
+  btc_pool_capture(pool, peer, BTC_CAPTURE_OPEN, &outbound, 1);
 }
 
-static int
-btc_peer_announce_block(btc_peer_t *peer,
-                        const btc_block_t *block,
-                        const uint8_t *hash) {
-  /* Don't send if they already have it. */
-  if (btc_filter_has(&peer->inv_filter, hash, 32))
-    return 0;
+/*
+ * Peer
+ */
 
-  /* Send them the block immediately if
-     they're using compact block mode 1. */
-  if (peer->compact_mode == 1) {
-    btc_filter_add(&peer->inv_filter, hash, 32);
-    btc_peer_send_cmpctblock(peer, block);
-    return 1;
-  }
+static btc_peer_t *
+btc_peer_create(btc_pool_t *pool, int block_relay) {
+  btc_peer_t *peer = (btc_peer_t *)btc_malloc(sizeof(btc_peer_t));
 
-  /* Send header for peers that request it. */
-  if (peer->prefer_headers) {
-    btc_filter_add(&peer->inv_filter, hash, 32);
-    btc_peer_send_headers_1(peer, &block->header);
-    return 1;
-  }
+  memset(peer, 0, sizeof(*peer));
 
-  btc_inv_push_item(&peer->inv_queue, BTC_INV_BLOCK, hash);
-  btc_peer_flush_inv(peer);
+  peer->pool = pool;
+  peer->network = pool->network;
+  peer->logger = pool->logger;
+  peer->loop = pool->loop;
+  peer->socket = NULL;
 
-  return 1;
-}
+  peer->state = BTC_PEER_DEAD;
+  peer->id = pool->id++;
+  peer->block_relay = block_relay;
+  peer->version = -1;
+  peer->height = -1;
+  peer->relay = 1;
+  peer->fee_rate = -1;
+  peer->fee_sent = -1;
+  peer->fee_timer = 0;
+  peer->addr_tokens = 1.0;
+  peer->addr_time = btc_time_msec();
+  peer->compact_mode = -1;
+  peer->last_pong = -1;
+  peer->last_ping = -1;
+  peer->min_ping = -1;
+  peer->block_time = -1;
+  peer->block_mark = -1;
+  peer->block_interval = -1;
+  peer->block_rate = -1;
+  peer->block_limit = MIN_BLOCK_INFLIGHT;
+  peer->gb_time = -1;
+  peer->gh_time = -1;
 
-static int
-btc_peer_announce_tx(btc_peer_t *peer, const btc_mpentry_t *entry) {
-  /* Do not send txs to spv clients that have relay unset. */
-  if (!peer->relay)
-    return 0;
+  peer->connect_timer = btc_timer_create(pool->loop,
+                                         btc_peer_on_connect_timer,
+                                         peer);
 
-  /* Don't send if they already have it. */
-  if (btc_filter_has(&peer->inv_filter, entry->hash, 32))
-    return 0;
+  peer->ping_timer = btc_timer_create(pool->loop, btc_peer_on_ping_timer, peer);
+  peer->inv_timer = btc_timer_create(pool->loop, btc_peer_on_inv_timer, peer);
+  peer->stall_timer = btc_timer_create(pool->loop,
+                                       btc_peer_on_stall_timer,
+                                       peer);
 
-  /* Check the peer's bloom filter. */
-  if (peer->spv_filter != NULL) {
-    if (!btc_tx_matches(entry->tx, peer->spv_filter))
-      return 0;
-  }
+  btc_parser_init(&peer->parser, peer->network->magic);
 
-  /* Check the fee filter. */
-  if (peer->fee_rate != -1) {
-    int64_t rate = btc_get_rate(entry->size, entry->fee);
+  peer->parser.stats = peer->recv;
+  peer->parser.perf = pool->perf;
+  peer->parser.workers = pool->workers;
+  peer->parser.lock = pool->frame_lock;
+  peer->parser.on_msg = on_msg;
+  peer->parser.on_error = on_parse_error;
+  peer->parser.arg = peer;
 
-    if (rate < peer->fee_rate)
-      return 0;
-  }
+  btc_inv_init(&peer->inv_queue);
 
-  btc_inv_push_item(&peer->inv_queue, BTC_INV_TX, entry->hash);
+  /* Only announce what comes after us. */
+  peer->inv_seq = pool->tx_queue.base + pool->tx_queue.length;
 
-  if (peer->inv_queue.length >= 500)
-    btc_peer_flush_inv(peer);
+  btc_filter_init(&peer->addr_filter);
+  btc_filter_set(&peer->addr_filter, 5000, 0.001);
 
-  return 1;
-}
+  btc_filter_init(&peer->inv_filter);
+  btc_filter_set(&peer->inv_filter, 50000, 0.000001);
 
-static void
-btc_pool_on_connect(btc_pool_t *pool, btc_peer_t *peer);
+  peer->block_map = btc_hashtab_create();
+  peer->compact_map = btc_hashmap_create();
 
-static void
-btc_peer_on_connect(btc_peer_t *peer) {
-  if (peer->outbound) {
-    /* Say hello. */
-    btc_peer_send_version(peer);
-  } else {
-    /* We're shy. Wait for an introduction. */
+  /* Block-relay-only links never carry txs. */
+  if (!block_relay) {
+    peer->tx_map = btc_hashtab_create();
+    peer->recon_salt = btc_nonce();
+    peer->recon_set = btc_longmap_create();
+    peer->recon_snap = btc_longmap_create();
   }
 
-  peer->state = BTC_PEER_WAIT_VERSION;
-  peer->time = btc_time_msec();
-
-  btc_pool_on_connect(peer->pool, peer);
+  return peer;
 }
 
 static void
-btc_pool_on_close(btc_pool_t *pool, btc_peer_t *peer);
+btc_peer_clear_data(btc_peer_t *peer);
 
 static void
-btc_peer_on_close(btc_peer_t *peer) {
-  btc_pool_on_close(peer->pool, peer);
-}
+btc_recon_reset(btc_longmap_t *map);
 
 static void
-btc_pool_on_complete(btc_pool_t *pool, btc_peer_t *peer);
+btc_peer_init_v2(btc_peer_t *peer) {
+  /* Keys are only generated once we know they're needed. */
+  peer->v2 = BTC_V2_KEY;
+  peer->handshake = (uint8_t *)btc_malloc(V2_HANDSHAKE_SIZE);
+  peer->handshake_len = 0;
+}
 
 static void
-btc_peer_on_version(btc_peer_t *peer, const btc_version_t *msg) {
-  if (peer->state != BTC_PEER_WAIT_VERSION) {
-    btc_peer_log(peer, "Peer sent unsolicited version (%N).", &peer->addr);
-    btc_peer_close(peer);
-    return;
-  }
+btc_peer_keygen_v2(btc_peer_t *peer) {
+  uint8_t entropy[64];
 
-  peer->version = msg->version;
-  peer->services = msg->services;
-  peer->height = msg->height;
-  strcpy(peer->agent, msg->agent);
-  peer->relay = msg->relay;
-  peer->local = msg->remote;
+  btc_getrandom(entropy, sizeof(entropy));
 
-  if (!peer->network->self_connect) {
-    if (btc_nonces_has(&peer->pool->nonces, msg->nonce)) {
-      btc_peer_log(peer, "We connected to ourself. Oops (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
-  }
+  peer->cipher = (btc_bip324_t *)btc_malloc(sizeof(btc_bip324_t));
 
-  if (peer->version < BTC_NET_MIN_VERSION) {
-    btc_peer_log(peer, "Peer does not support required protocol version (%N).",
-                       &peer->addr);
-    btc_peer_close(peer);
-    return;
-  }
+  btc_bip324_init(peer->cipher,
+                  peer->network->magic,
+                  peer->outbound,
+                  entropy);
 
-  if (peer->outbound) {
-    if ((peer->services & BTC_NET_SERVICE_NETWORK) == 0) {
-      btc_peer_log(peer, "Peer does not support network services (%N).",
-                         &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+  peer->garbage = (uint8_t *)btc_malloc(BTC_BIP324_GARBAGE_MAX);
+  peer->garbage_len = btc_uniform(BTC_BIP324_GARBAGE_MAX + 1);
 
-    if (peer->pool->flags & BTC_POOL_CHECKPOINTS) {
-      if (peer->version < BTC_NET_HEADERS_VERSION) {
-        btc_peer_log(peer, "Peer does not support getheaders (%N).",
-                           &peer->addr);
-        btc_peer_close(peer);
-        return;
-      }
-    }
+  btc_getrandom(peer->garbage, peer->garbage_len);
 
-    if ((peer->services & BTC_NET_SERVICE_WITNESS) == 0) {
-      btc_peer_log(peer, "Peer does not support segregated witness (%N).",
-                         &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+  btc_memzero(entropy, sizeof(entropy));
+}
 
-    if (peer->pool->flags & BTC_POOL_BIP152) {
-      if (!btc_peer_has_compact_support(peer)) {
-        btc_peer_log(peer, "Peer does not support compact blocks (%N).",
-                           &peer->addr);
-      }
-    }
+static void
+btc_peer_clear_v2(btc_peer_t *peer) {
+  if (peer->cipher != NULL) {
+    btc_memzero(peer->cipher, sizeof(*peer->cipher));
+    btc_free(peer->cipher);
   }
 
-  if (!peer->outbound)
-    btc_peer_send_version(peer);
+  if (peer->handshake != NULL)
+    btc_free(peer->handshake);
 
-  btc_peer_send_verack(peer);
+  if (peer->garbage != NULL)
+    btc_free(peer->garbage);
 
-  peer->state = BTC_PEER_WAIT_VERACK;
+  peer->cipher = NULL;
+  peer->v2 = BTC_V2_NONE;
+  peer->handshake = NULL;
+  peer->handshake_len = 0;
+  peer->garbage = NULL;
+  peer->garbage_len = 0;
 }
 
 static void
-btc_peer_on_verack(btc_peer_t *peer) {
-  if (peer->state != BTC_PEER_WAIT_VERACK) {
-    btc_peer_log(peer, "Peer sent unsolicited verack (%N).", &peer->addr);
-    btc_peer_close(peer);
-    return;
-  }
+btc_peer_destroy(btc_peer_t *peer) {
+  btc_hashtabiter_t tabit;
+  btc_hashmapiter_t mapit;
 
-  peer->state = BTC_PEER_CONNECTED;
+  btc_parser_clear(&peer->parser);
 
-  btc_peer_log(peer, "Version handshake complete (%N).", &peer->addr);
-  btc_pool_on_complete(peer->pool, peer);
-}
+  btc_peer_clear_v2(peer);
 
-static void
-btc_peer_on_ping(btc_peer_t *peer, const btc_ping_t *msg) {
-  if (msg->nonce == 0)
-    return;
+  btc_peer_clear_data(peer);
 
-  btc_peer_send_pong(peer, msg->nonce);
-}
+  btc_timer_destroy(peer->connect_timer);
+  btc_timer_destroy(peer->ping_timer);
+  btc_timer_destroy(peer->inv_timer);
+  btc_timer_destroy(peer->stall_timer);
 
-static void
-btc_peer_on_pong(btc_peer_t *peer, const btc_pong_t *msg) {
-  int64_t now = btc_time_msec();
+  /* Free block hashes. */
+  btc_hashtab_iterate(&tabit, peer->block_map);
 
-  if (peer->challenge == 0) {
-    btc_peer_log(peer, "Peer sent an unsolicited pong (%N).", &peer->addr);
-    return;
-  }
+  while (btc_hashtab_next(&tabit))
+    btc_free(tabit.key);
 
-  if (msg->nonce != peer->challenge) {
-    if (msg->nonce == 0) {
-      btc_peer_log(peer, "Peer sent a zero nonce (%N).", &peer->addr);
-      peer->challenge = 0;
-      return;
-    }
-    btc_peer_log(peer, "Peer sent the wrong nonce (%N).", &peer->addr);
-    return;
-  }
+  /* Free compact blocks. */
+  btc_hashmap_iterate(&mapit, peer->compact_map);
 
-  if (now >= peer->last_ping) {
-    peer->last_pong = now;
+  while (btc_hashmap_next(&mapit))
+    btc_cmpct_destroy(mapit.val);
 
-    if (peer->min_ping == -1)
-      peer->min_ping = now - peer->last_ping;
+  btc_inv_clear(&peer->inv_queue);
 
-    now -= peer->last_ping;
+  btc_filter_clear(&peer->addr_filter);
+  btc_filter_clear(&peer->inv_filter);
 
-    if (now < peer->min_ping)
-      peer->min_ping = now;
-  } else {
-    btc_peer_log(peer, "Timing mismatch (what?) (%N).", &peer->addr);
-  }
+  if (peer->spv_filter != NULL)
+    btc_bloom_destroy(peer->spv_filter);
 
-  peer->challenge = 0;
-}
+  btc_hashtab_destroy(peer->block_map);
+  btc_hashmap_destroy(peer->compact_map);
 
-static void
-btc_peer_on_sendheaders(btc_peer_t *peer) {
-  if (peer->prefer_headers) {
-    btc_peer_log(peer, "Peer sent a duplicate sendheaders (%N).", &peer->addr);
-    return;
+  if (!peer->block_relay) {
+    btc_hashtab_destroy(peer->tx_map);
+
+    btc_recon_reset(peer->recon_set);
+    btc_recon_reset(peer->recon_snap);
+
+    btc_longmap_destroy(peer->recon_set);
+    btc_longmap_destroy(peer->recon_snap);
   }
 
-  peer->prefer_headers = 1;
+  btc_free(peer);
 }
 
 static void
-btc_peer_on_filterload(btc_peer_t *peer, const btc_bloom_t *filter) {
-  btc_pool_t *pool = peer->pool;
+btc_peer_log(btc_peer_t *peer, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_write(peer->logger, "peer", fmt, ap);
+  va_end(ap);
+}
 
-  if (!(pool->flags & BTC_POOL_BIP37)) {
-    btc_peer_log(peer, "Peer loaded filter without bip37 enabled (%N).",
-                       &peer->addr);
-    btc_peer_close(peer);
-    return;
-  }
+static void
+btc_peer_debug(btc_peer_t *peer, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_log(peer->logger, BTC_LOG_DEBUG, "peer", fmt, ap);
+  va_end(ap);
+}
 
-  if (!btc_bloom_is_within_constraints(filter)) {
-    btc_peer_increase_ban(peer, 100);
-    return;
-  }
+static int
+btc_peer_open(btc_peer_t *peer, const btc_netaddr_t *addr, int v2) {
+  btc_pool_t *pool = peer->pool;
+  int64_t timeout = CONNECT_TIMEOUT;
+  btc_socket_t *socket;
 
-  /* Could avoid a second allocation here. */
-  if (peer->spv_filter == NULL)
-    peer->spv_filter = btc_bloom_clone(filter);
-  else
-    btc_bloom_copy(peer->spv_filter, filter);
+  if (pool->flags & BTC_POOL_PROXY) {
+    char host[BTC_ADDRSTRLEN + 1];
 
-  peer->relay = 1;
-}
+    btc_netaddr_get_host(host, addr);
 
-static void
-btc_peer_on_filteradd(btc_peer_t *peer, const btc_filteradd_t *msg) {
-  btc_pool_t *pool = peer->pool;
+    /* Circuits take a while to build. */
+    socket = btc_loop_proxy(peer->loop, &pool->proxy, host, addr->port);
+    timeout = PROXY_TIMEOUT;
+  } else {
+    btc_sockaddr_t sa;
 
-  if (!(pool->flags & BTC_POOL_BIP37)) {
-    btc_peer_log(peer, "Peer added to filter without bip37 enabled (%N).",
-                       &peer->addr);
-    btc_peer_close(peer);
-    return;
-  }
+    btc_netaddr_get_sockaddr(&sa, addr);
 
-  if (msg->length > BTC_MAX_SCRIPT_PUSH) {
-    btc_peer_increase_ban(peer, 100);
-    return;
+    socket = btc_loop_connect(peer->loop, &sa);
   }
 
-  if (peer->spv_filter != NULL)
-    btc_bloom_add(peer->spv_filter, msg->data, msg->length);
+  if (socket == NULL)
+    return 0;
 
-  peer->relay = 1;
-}
+  peer->state = BTC_PEER_CONNECTING;
+  peer->socket = socket;
+  peer->addr = *addr;
+  peer->outbound = 1;
+  peer->time = btc_time_msec();
+  peer->nonce = btc_nonces_alloc(&peer->pool->nonces);
 
-static void
-btc_peer_on_filterclear(btc_peer_t *peer) {
-  btc_pool_t *pool = peer->pool;
+  if (v2)
+    btc_peer_init_v2(peer);
 
-  if (!(pool->flags & BTC_POOL_BIP37)) {
-    btc_peer_log(peer, "Peer cleared filter without bip37 enabled (%N).",
-                       &peer->addr);
-    btc_peer_close(peer);
-    return;
-  }
+  btc_timer_start(peer->connect_timer, timeout);
 
-  if (peer->spv_filter != NULL)
-    btc_bloom_reset(peer->spv_filter);
+  btc_socket_set_data(socket, peer);
+  btc_socket_on_connect(socket, on_connect);
+  btc_socket_on_close(socket, on_close);
+  btc_socket_on_error(socket, on_error);
+  btc_socket_on_data(socket, on_data);
+  btc_socket_on_drain(socket, on_drain);
 
-  peer->relay = 1;
+  return 1;
 }
 
-static void
-btc_peer_on_feefilter(btc_peer_t *peer, const btc_feefilter_t *msg) {
-  if (msg->rate < 0 || msg->rate > BTC_MAX_MONEY) {
-    btc_peer_increase_ban(peer, 100);
-    return;
-  }
+static int
+btc_peer_accept(btc_peer_t *peer, btc_socket_t *socket) {
+  btc_sockaddr_t sa;
 
-  peer->fee_rate = msg->rate;
-}
-
-static void
-btc_peer_on_sendcmpct(btc_peer_t *peer, const btc_sendcmpct_t *msg) {
-  if (peer->compact_mode != -1) {
-    btc_peer_log(peer, "Peer sent a duplicate sendcmpct (%N).", &peer->addr);
-    return;
-  }
+  btc_socket_address(&sa, socket);
 
-  if (msg->version > 2) {
-    /* Ignore. */
-    btc_peer_log(peer, "Peer requested compact blocks version %llu (%N).",
-                       msg->version, &peer->addr);
-    return;
-  }
+  /* We're shy. Wait for an introduction. */
+  peer->state = BTC_PEER_WAIT_VERSION;
+  peer->socket = socket;
 
-  if (msg->mode > 1) {
-    /* Ignore. */
-    btc_peer_log(peer, "Peer requested compact blocks mode %hhu (%N).",
-                       msg->mode, &peer->addr);
-    return;
-  }
+  btc_netaddr_set_sockaddr(&peer->addr, &sa);
 
-  btc_peer_log(peer,
-    "Peer initialized compact blocks (mode=%hhu, version=%llu) (%N).",
-    msg->mode, msg->version, &peer->addr);
+  peer->outbound = 0;
+  peer->time = btc_time_msec();
+  peer->nonce = btc_nonces_alloc(&peer->pool->nonces);
 
-  peer->compact_mode = msg->mode;
-  peer->compact_witness = (msg->version == 2);
-}
+  /* Either transport may show up. */
+  if (peer->pool->v2)
+    btc_peer_init_v2(peer);
 
-static void
-btc_peer_on_error(btc_peer_t *peer, const char *msg) {
-  btc_peer_log(peer, "Socket error (%N): %s", &peer->addr, msg);
-  btc_peer_close(peer);
-}
+  btc_timer_start(peer->connect_timer, CONNECT_TIMEOUT);
 
-static int
-btc_peer_on_data(btc_peer_t *peer, const uint8_t *data, size_t size) {
-  if (peer->state == BTC_PEER_DEAD)
-    return 0;
+  btc_socket_set_data(socket, peer);
+  /* btc_socket_on_connect(socket, on_connect); */
+  btc_socket_on_close(socket, on_close);
+  btc_socket_on_error(socket, on_error);
+  btc_socket_on_data(socket, on_data);
+  btc_socket_on_drain(socket, on_drain);
 
-  if (size == 0) {
-    btc_peer_log(peer, "Peer sent EOF (%N).", &peer->addr);
-    btc_peer_close(peer);
-    return 0;
-  }
+  btc_peer_log(peer, "Connected to %N.", &peer->addr);
 
-  peer->last_recv = btc_time_msec();
+  btc_pool_capture_open(peer->pool, peer);
 
-  return !btc_parser_feed(&peer->parser, data, size);
+  return 1;
 }
 
-static int
-btc_peer_flush_data(btc_peer_t *peer);
+static void
+btc_peer_close(btc_peer_t *peer) {
+  btc_socket_close(peer->socket);
+  peer->state = BTC_PEER_DEAD;
+  peer->parser.closed = 1;
+
+  btc_timer_stop(peer->connect_timer);
+  btc_timer_stop(peer->ping_timer);
+  btc_timer_stop(peer->inv_timer);
+  btc_timer_stop(peer->stall_timer);
+}
 
 static void
-btc_peer_on_drain(btc_peer_t *peer) {
+btc_peer_stall_at(btc_peer_t *peer, int64_t time) {
+  /* Deadlines only ever pull the check closer; the
+     check itself pushes it out to the next one. */
+  int64_t due = btc_timer_expires(peer->stall_timer);
+
   if (peer->state == BTC_PEER_DEAD)
     return;
 
-  btc_peer_flush_data(peer);
+  if (due == -1 || time < due)
+    btc_timer_at(peer->stall_timer, time);
 }
 
 static void
-btc_pool_on_msg(btc_pool_t *pool, btc_peer_t *peer, btc_msg_t *msg);
+btc_pool_ban(btc_pool_t *pool, const btc_netaddr_t *addr);
 
-static void
-btc_peer_on_msg(btc_peer_t *peer, btc_msg_t *msg) {
-  if (peer->state == BTC_PEER_DEAD)
-    return;
+static int
+btc_peer_increase_ban(btc_peer_t *peer, int score) {
+  peer->ban_score += score;
 
-  switch (msg->type) {
-    case BTC_MSG_VERSION:
-      btc_peer_on_version(peer, (const btc_version_t *)msg->body);
-      break;
-    case BTC_MSG_VERACK:
-      btc_peer_on_verack(peer);
-      break;
-    case BTC_MSG_PING:
-      btc_peer_on_ping(peer, (const btc_ping_t *)msg->body);
-      break;
-    case BTC_MSG_PONG:
-      btc_peer_on_pong(peer, (const btc_pong_t *)msg->body);
-      break;
-    case BTC_MSG_SENDHEADERS:
-      btc_peer_on_sendheaders(peer);
-      break;
-    case BTC_MSG_FILTERLOAD:
-      btc_peer_on_filterload(peer, (const btc_bloom_t *)msg->body);
-      break;
-    case BTC_MSG_FILTERADD:
-      btc_peer_on_filteradd(peer, (const btc_filteradd_t *)msg->body);
-      break;
-    case BTC_MSG_FILTERCLEAR:
-      btc_peer_on_filterclear(peer);
-      break;
-    case BTC_MSG_FEEFILTER:
-      btc_peer_on_feefilter(peer, (const btc_feefilter_t *)msg->body);
-      break;
-    case BTC_MSG_SENDCMPCT:
-      btc_peer_on_sendcmpct(peer, (const btc_sendcmpct_t *)msg->body);
-      break;
-    default:
-      break;
+  if (peer->ban_score >= 100) {
+    btc_peer_log(peer, "Ban threshold exceeded (%N).", &peer->addr);
+    btc_pool_ban(peer->pool, &peer->addr);
+    return 1;
   }
 
-  btc_pool_on_msg(peer->pool, peer, msg);
+  return 0;
 }
 
 static void
-btc_peer_on_parse_error(btc_peer_t *peer) {
-  if (peer->state == BTC_PEER_DEAD)
-    return;
-
-  btc_peer_log(peer, "Parse error (%N).", &peer->addr);
-  btc_peer_increase_ban(peer, 10);
+btc_pool_update_cycle(btc_pool_t *pool, int64_t now) {
+  if (now >= pool->cycle_start + UPLOAD_TIMEFRAME) {
+    pool->cycle_start = now;
+    pool->cycle_sent = 0;
+  }
 }
 
 static int
-btc_peer_flush_data(btc_peer_t *peer) {
-  btc_chain_t *chain = peer->pool->chain;
-  btc_mempool_t *mempool = peer->pool->mempool;
-  btc_invitem_t *item, *next;
-  int blk_count = 0;
-  int tx_count = 0;
-  int cmpct_count = 0;
-  int64_t unknown = -1;
-  uint32_t type;
-  btc_inv_t nf;
-  int send_tip;
-  size_t size;
-  int ret = 1;
+btc_pool_upload_exhausted(btc_pool_t *pool, int historical) {
+  int64_t now = btc_now();
+  uint64_t target = pool->upload_target;
+  uint64_t buffer;
+  int64_t left;
 
-  if (peer->state != BTC_PEER_CONNECTED)
-    return 1;
+  if (target == 0)
+    return 0;
 
-  if (peer->sending.length == 0)
-    return 1;
+  btc_pool_update_cycle(pool, now);
 
-  btc_inv_init(&nf);
+  if (!historical)
+    return pool->cycle_sent >= target;
 
-  for (item = peer->sending.head; item != NULL; item = next) {
-    next = item->next;
-    size = btc_socket_buffered(peer->socket) + nf.length * 36;
-    type = item->type;
+  /* Hold enough back to relay each new block once.
+     A block never serializes to more than its weight. */
+  left = pool->cycle_start + UPLOAD_TIMEFRAME - now;
+  buffer = (uint64_t)(left / 600) * BTC_MAX_BLOCK_WEIGHT;
 
-    if (size >= (10 << 20) || peer->state == BTC_PEER_DEAD) {
-      /* Wait for the peer to read
-         before we pull more data
-         out of the database. */
-      ret = 0;
-      break;
-    }
+  return buffer >= target || pool->cycle_sent >= target - buffer;
+}
 
-    /* Check the hashContinue early. */
-    send_tip = btc_hash_equal(item->hash, peer->hash_continue);
+static void
+btc_peer_account(btc_peer_t *peer, const uint8_t *data, size_t length) {
+  /* Everything we write is a whole message. */
+  btc_pool_t *pool = peer->pool;
+  char cmd[12 + 1];
+  btc_msg_t msg;
 
-    /* Maybe fall back to full block. */
-    if (type == BTC_INV_CMPCT_BLOCK) {
-      const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
+  peer->bytes_sent += length;
+  pool->bytes_sent += length;
 
-      if (entry != NULL && entry->height < btc_chain_height(chain) - 10)
-        type = peer->compact_witness ? BTC_INV_WITNESS_BLOCK : BTC_INV_BLOCK;
-    }
+  btc_pool_update_cycle(pool, btc_now());
 
-    switch (type) {
-      case BTC_INV_BLOCK: {
-        const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
-        btc_block_t *block;
+  pool->cycle_sent += length;
 
-        if (entry == NULL) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+  if (length < 24)
+    return;
 
-        block = btc_chain_get_block(chain, entry);
+  memcpy(cmd, data + 4, 12);
 
-        if (block == NULL) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+  cmd[12] = '\0';
 
-        btc_peer_sendmsg(peer, BTC_MSG_BLOCK_BASE, block);
+  if (pool->capture != NULL) {
+    uint8_t raw[12 + 4];
 
-        btc_block_destroy(block);
-        btc_invitem_destroy(item);
+    memcpy(raw, data + 4, 12);
+    btc_write32le(raw + 12, length);
 
-        blk_count += 1;
+    btc_pool_capture(pool, peer, BTC_CAPTURE_SEND, raw, sizeof(raw));
+  }
 
-        break;
-      }
+  btc_msg_set_cmd(&msg, cmd);
 
-      case BTC_INV_WITNESS_BLOCK: {
-        const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
-        size_t length;
-        uint8_t *data;
+  peer->sent[msg.type].bytes += length;
+  peer->sent[msg.type].msgs += 1;
+}
 
-        if (entry == NULL) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+static void
+btc_peer_free_packet(void *ptr) {
+  btc_free(ptr);
+}
 
-        if (!btc_chain_get_raw_block(chain, &data, &length, entry)) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+static int
+btc_peer_write_packet(btc_peer_t *peer, uint8_t *data, size_t length) {
+  /* Reframe a v1 message as a v2 packet where it lies.
+     The payload stays put and the packet header takes
+     over the tail of the old one. The buffer must have
+     room for the tag at the end. */
+  size_t size, len;
+  uint8_t *packet;
+  char cmd[12 + 1];
+  int rc;
 
-        btc_peer_write(peer, data, length);
+  if (peer->v2 < BTC_V2_GARBAGE) {
+    /* Nothing is sent before the keys are. */
+    btc_free(data);
+    return 0;
+  }
 
-        btc_invitem_destroy(item);
+  memcpy(cmd, data + 4, 12);
 
-        blk_count += 1;
+  cmd[12] = '\0';
 
-        break;
-      }
+  size = btc_bip324_type_size(cmd);
+  len = size + (length - 24);
+  packet = data + 24 - size - 4;
 
-      case BTC_INV_CMPCT_BLOCK: {
-        const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
-        btc_block_t *block;
+  btc_bip324_type_write(packet + 4, cmd);
+  btc_bip324_seal(peer->cipher, packet, len, NULL, 0, 0);
 
-        if (entry == NULL) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+  rc = btc_socket_write_shared(peer->socket,
+                               packet,
+                               BTC_BIP324_EXPANSION + len,
+                               btc_peer_free_packet,
+                               data);
 
-        block = btc_chain_get_block(chain, entry);
+  if (rc == -1) {
+    const char *msg = btc_socket_strerror(peer->socket);
 
-        if (block == NULL) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+    btc_peer_log(peer, "Write error (%N): %s", &peer->addr, msg);
+    btc_peer_close(peer);
 
-        btc_peer_send_cmpctblock(peer, block);
+    return 0;
+  }
 
-        btc_block_destroy(block);
-        btc_invitem_destroy(item);
+  peer->last_send = btc_time_msec();
 
-        blk_count += 1;
-        cmpct_count += 1;
+  return rc;
+}
 
-        break;
-      }
+static int
+btc_peer_write(btc_peer_t *peer, uint8_t *data, size_t length) {
+  int rc;
 
-      case BTC_INV_FILTERED_BLOCK: {
-        const btc_entry_t *entry;
-        btc_merkleblock_t mrkl;
-        btc_block_t *block;
-        btc_vector_t *txs;
-        size_t i;
+  btc_peer_account(peer, data, length);
 
-        if (!(peer->pool->flags & BTC_POOL_BIP37)) {
-          btc_peer_log(peer,
-            "Peer requested a merkleblock without bip37 enabled (%N).",
-            &peer->addr);
-          btc_peer_close(peer);
-          break;
-        }
+  if (peer->cipher != NULL) {
+    data = (uint8_t *)btc_realloc(data, length + BTC_BIP324_TAG_SIZE);
 
-        if (peer->spv_filter == NULL) {
-          btc_invitem_destroy(item);
-          break;
-        }
+    return btc_peer_write_packet(peer, data, length);
+  }
 
-        entry = btc_chain_by_hash(chain, item->hash);
-
-        if (entry == NULL) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+  rc = btc_socket_write(peer->socket, data, length);
 
-        block = btc_chain_get_block(chain, entry);
+  if (rc == -1) {
+    const char *msg = btc_socket_strerror(peer->socket);
 
-        if (block == NULL) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+    btc_peer_log(peer, "Write error (%N): %s", &peer->addr, msg);
+    btc_peer_close(peer);
 
-        btc_merkleblock_init(&mrkl);
+    return 0;
+  }
 
-        txs = btc_merkleblock_set_block(&mrkl, block, peer->spv_filter);
+  peer->last_send = btc_time_msec();
 
-        btc_peer_sendmsg(peer, BTC_MSG_MERKLEBLOCK, &mrkl);
+  return rc;
+}
 
-        for (i = 0; i < txs->length; i++)
-          btc_peer_sendmsg(peer, BTC_MSG_TX_BASE, txs->items[i]);
+static void
+btc_peer_unref_file(void *ptr) {
+  btc_blockfile_unref((btc_blockfile_t *)ptr);
+}
 
-        blk_count += 1;
-        tx_count += txs->length;
+static int
+btc_peer_write_file(btc_peer_t *peer,
+                    btc_blockfile_t *file,
+                    int64_t pos,
+                    size_t length) {
+  /* Block records are stored with their wire header. */
+  static const uint8_t header[24] = {
+    0, 0, 0, 0, 'b', 'l', 'o', 'c', 'k', 0, 0, 0, 0, 0, 0, 0
+  };
+  int rc;
 
-        btc_merkleblock_clear(&mrkl);
-        btc_vector_destroy(txs);
-        btc_block_destroy(block);
-        btc_invitem_destroy(item);
+  btc_peer_account(peer, header, length);
 
-        break;
-      }
+  rc = btc_socket_write_file(peer->socket,
+                             btc_blockfile_fd(file),
+                             pos,
+                             length,
+                             btc_peer_unref_file,
+                             file);
 
-      case BTC_INV_TX:
-      case BTC_INV_WITNESS_TX: {
-        const btc_mpentry_t *entry = btc_mempool_get(mempool, item->hash);
+  if (rc == -1) {
+    const char *msg = btc_socket_strerror(peer->socket);
 
-        if (entry == NULL) {
-          btc_inv_push(&nf, item);
-          break;
-        }
+    btc_peer_log(peer, "Write error (%N): %s", &peer->addr, msg);
+    btc_peer_close(peer);
 
-        if (type == BTC_INV_TX)
-          btc_peer_sendmsg(peer, BTC_MSG_TX_BASE, entry->tx);
-        else
-          btc_peer_sendmsg(peer, BTC_MSG_TX, entry->tx);
+    return 0;
+  }
 
-        btc_invitem_destroy(item);
+  peer->last_send = btc_time_msec();
 
-        tx_count += 1;
+  return rc;
+}
 
-        break;
-      }
+static int
+btc_peer_write_shared(btc_peer_t *peer, btc_rawmsg_t *raw) {
+  int rc;
 
-      default: {
-        btc_inv_push(&nf, item);
-        unknown = type;
-        break;
-      }
-    }
+  btc_peer_account(peer, raw->data, raw->length);
 
-    if (send_tip) {
-      btc_peer_send_inv_1(peer, BTC_INV_BLOCK, btc_chain_tip(chain)->hash);
-      btc_hash_init(peer->hash_continue);
-    }
+  if (peer->cipher != NULL) {
+    /* Every peer encrypts its own copy. */
+    uint8_t *data = (uint8_t *)btc_malloc(raw->length + BTC_BIP324_TAG_SIZE);
 
-    peer->sending.head = next;
-    peer->sending.length--;
+    memcpy(data, raw->data, raw->length);
 
-    if (peer->sending.head == NULL)
-      peer->sending.tail = NULL;
+    return btc_peer_write_packet(peer, data, raw->length);
   }
 
-  if (nf.length > 0)
-    btc_peer_send_notfound(peer, &nf);
+  raw->refs++;
 
-  if (blk_count > 0) {
-    btc_peer_log(peer,
-      "Served %d blocks with getdata (notfound=%zu, cmpct=%d) (%N).",
-      blk_count, nf.length, cmpct_count, &peer->addr);
-  }
+  rc = btc_socket_write_shared(peer->socket,
+                               raw->data,
+                               raw->length,
+                               btc_rawmsg_unref,
+                               raw);
 
-  if (tx_count > 0) {
-    btc_peer_log(peer,
-      "Served %d txs with getdata (notfound=%zu) (%N).",
-      tx_count, nf.length, &peer->addr);
-  }
+  if (rc == -1) {
+    const char *msg = btc_socket_strerror(peer->socket);
 
-  if (unknown != -1) {
-    btc_peer_log(peer,
-      "Peer sent an unknown getdata type: %u (%N).",
-      (uint32_t)unknown, &peer->addr);
+    btc_peer_log(peer, "Write error (%N): %s", &peer->addr, msg);
+    btc_peer_close(peer);
+
+    return 0;
   }
 
-  btc_inv_clear(&nf);
+  peer->last_send = btc_time_msec();
 
-  return ret;
+  return rc;
 }
 
-static void
-btc_peer_send_data(btc_peer_t *peer, btc_invitem_t *item) {
-  if (peer->sending.head == NULL)
-    peer->sending.head = item;
+static int
+btc_peer_send(btc_peer_t *peer, const btc_msg_t *msg) {
+  size_t length;
+  uint8_t *data = btc_msg_frame(&length, msg, peer->network->magic);
 
-  if (peer->sending.tail != NULL)
-    peer->sending.tail->next = item;
+  return btc_peer_write(peer, data, length);
+}
 
-  peer->sending.tail = item;
-  peer->sending.length++;
+static int
+btc_peer_sendmsg(btc_peer_t *peer, enum btc_msgtype type, const void *body) {
+  btc_msg_t msg;
+
+  btc_msg_set_type(&msg, type);
+
+  msg.body = (void *)body;
+
+  return btc_peer_send(peer, &msg);
 }
 
-static void
-btc_peer_clear_data(btc_peer_t *peer) {
-  btc_invitem_t *item, *next;
+static int
+btc_peer_send_handshake(btc_peer_t *peer, int key, int term) {
+  /* Our key and garbage go out as soon as we can. The
+     terminator and version packet follow once we have
+     their key; the responder sends all of it at once. */
+  btc_bip324_t *cipher = peer->cipher;
+  size_t length = 0;
+  uint8_t *data, *zp;
+  int rc;
 
-  for (item = peer->sending.head; item != NULL; item = next) {
-    next = item->next;
-    btc_invitem_destroy(item);
+  if (key)
+    length += BTC_BIP324_KEY_SIZE + peer->garbage_len;
+
+  if (term)
+    length += BTC_BIP324_TERM_SIZE + BTC_BIP324_EXPANSION;
+
+  data = (uint8_t *)btc_malloc(length);
+  zp = data;
+
+  if (key) {
+    memcpy(zp, cipher->ours, BTC_BIP324_KEY_SIZE);
+    zp += BTC_BIP324_KEY_SIZE;
+
+    memcpy(zp, peer->garbage, peer->garbage_len);
+    zp += peer->garbage_len;
   }
 
-  peer->sending.head = NULL;
-  peer->sending.tail = NULL;
-  peer->sending.length = 0;
-}
+  if (term) {
+    memcpy(zp, cipher->send_term, BTC_BIP324_TERM_SIZE);
+    zp += BTC_BIP324_TERM_SIZE;
 
-static void
-btc_peer_maybe_timeout(btc_peer_t *peer, int64_t now) {
-  btc_chain_t *chain = peer->pool->chain;
+    /* The first packet authenticates our garbage. */
+    btc_bip324_seal(cipher, zp, 0, peer->garbage, peer->garbage_len, 0);
 
-  if (!btc_chain_synced(chain)) {
-    if (peer->gb_time != -1 && now > peer->gb_time + 30000) {
-      btc_peer_log(peer, "Peer is stalling (inv) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+    btc_free(peer->garbage);
+
+    peer->garbage = NULL;
+    peer->garbage_len = 0;
   }
 
-  if (peer->gh_time != -1 && now > peer->gh_time + 60000) {
-    btc_peer_log(peer, "Peer is stalling (headers) (%N).", &peer->addr);
+  peer->bytes_sent += length;
+  peer->pool->bytes_sent += length;
+
+  rc = btc_socket_write(peer->socket, data, length);
+
+  if (rc == -1) {
+    const char *msg = btc_socket_strerror(peer->socket);
+
+    btc_peer_log(peer, "Write error (%N): %s", &peer->addr, msg);
     btc_peer_close(peer);
-    return;
-  }
 
-  if (peer->syncing && peer->loader && !btc_chain_synced(chain)) {
-    if (now > peer->block_time + 120000) {
-      btc_peer_log(peer, "Peer is stalling (block) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+    return 0;
   }
 
-  if (btc_chain_synced(chain) || !peer->syncing) {
-    btc_hashtabiter_t tabit;
-    btc_hashmapiter_t mapit;
-
-    btc_hashtab_iterate(&tabit, peer->block_map);
+  peer->last_send = btc_time_msec();
 
-    while (btc_hashtab_next(&tabit)) {
-      if (now > tabit.val + 120000) {
-        btc_peer_log(peer, "Peer is stalling (block) (%N).", &peer->addr);
-        btc_peer_close(peer);
-        return;
-      }
-    }
+  return 1;
+}
 
-    btc_hashtab_iterate(&tabit, peer->tx_map);
+static int
+btc_peer_send_version(btc_peer_t *peer) {
+  btc_pool_t *pool = peer->pool;
+  btc_version_t msg;
 
-    while (btc_hashtab_next(&tabit)) {
-      if (now > tabit.val + 120000) {
-        btc_peer_log(peer, "Peer is stalling (tx) (%N).", &peer->addr);
-        btc_peer_close(peer);
-        return;
-      }
-    }
+  btc_version_init(&msg);
 
-    btc_hashmap_iterate(&mapit, peer->compact_map);
+  msg.version = BTC_NET_PROTOCOL_VERSION;
+  msg.services = pool->services;
+  msg.time = btc_timedata_now(pool->timedata);
+  msg.remote = peer->addr;
 
-    while (btc_hashmap_next(&mapit)) {
-      if (now > ((btc_cmpct_t *)mapit.val)->now + 30000) {
-        btc_peer_log(peer, "Peer is stalling (blocktxn) (%N).", &peer->addr);
-        btc_peer_close(peer);
-        return;
-      }
-    }
-  }
+  btc_netaddr_init(&msg.local);
 
-  if (now > peer->time + 60000) {
-    int mult = (peer->version <= BTC_NET_PONG_VERSION ? 4 : 1);
+  msg.local.services = pool->services;
+  msg.nonce = peer->nonce;
 
-    if (peer->last_recv == 0 || peer->last_send == 0) {
-      btc_peer_log(peer, "Peer is stalling (no message) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+  strcpy(msg.agent, BTC_NET_USER_AGENT);
 
-    if (now > peer->last_send + 20 * 60000) {
-      btc_peer_log(peer, "Peer is stalling (send) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+  msg.height = btc_chain_height(pool->chain);
+  msg.relay = ((pool->flags & BTC_POOL_BLOCKSONLY) == 0 && !peer->block_relay);
 
-    if (now > peer->last_recv + 20 * 60000 * mult) {
-      btc_peer_log(peer, "Peer is stalling (recv) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+  return btc_peer_sendmsg(peer, BTC_MSG_VERSION, &msg);
+}
 
-    if (peer->challenge && now > peer->last_ping + 20 * 60000) {
-      btc_peer_log(peer, "Peer is stalling (ping) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
-  }
+static int
+btc_peer_send_verack(btc_peer_t *peer) {
+  return btc_peer_sendmsg(peer, BTC_MSG_VERACK, NULL);
 }
 
-static void
-btc_peer_on_tick(btc_peer_t *peer, int64_t now) {
-  if (peer->state == BTC_PEER_DEAD)
-    return;
+static int
+btc_peer_send_ping(btc_peer_t *peer) {
+  btc_ping_t ping;
 
-  if (peer->state != BTC_PEER_CONNECTED) {
-    if (now > peer->time + 5000) {
-      btc_peer_log(peer, "Peer stalled (connect) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
-    return;
+  if (peer->version <= BTC_NET_PONG_VERSION) {
+    ping.nonce = 0;
+    return btc_peer_sendmsg(peer, BTC_MSG_PING, &ping);
   }
 
-  if (now >= peer->ping_timer + 30000) {
-    btc_peer_send_ping(peer);
-    peer->ping_timer = now;
+  if (peer->challenge != 0) {
+    btc_peer_log(peer, "Peer has not responded to ping (%N).", &peer->addr);
+    return 1;
   }
 
-  if (now >= peer->inv_timer + 5000) {
-    btc_peer_flush_inv(peer);
-    peer->inv_timer = now;
-  }
+  peer->last_ping = btc_time_msec();
+  peer->challenge = btc_nonce();
 
-  if (now >= peer->stall_timer + 5000) {
-    btc_peer_maybe_timeout(peer, now);
-    peer->stall_timer = now;
-  }
+  btc_peer_stall_at(peer, peer->last_ping + 20 * 60000);
 
-  btc_peer_flush_data(peer);
+  ping.nonce = peer->challenge;
 
-  if (btc_socket_buffered(peer->socket) > (30 << 20)) {
-    btc_peer_log(peer, "Peer stalled (drain) (%N).", &peer->addr);
-    btc_peer_close(peer);
-    return;
-  }
+  return btc_peer_sendmsg(peer, BTC_MSG_PING, &ping);
+}
+
+static int
+btc_peer_send_pong(btc_peer_t *peer, uint64_t nonce) {
+  btc_pong_t pong;
+
+  pong.nonce = nonce;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_PONG, &pong);
+}
+
+static int
+btc_peer_send_getaddr(btc_peer_t *peer) {
+  if (peer->sent_getaddr)
+    return 1;
+
+  peer->sent_getaddr = 1;
+
+  /* Let the answer through. */
+  peer->addr_tokens += 1000;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_GETADDR, NULL);
+}
+
+static int
+btc_peer_send_addr(btc_peer_t *peer, const btc_addrs_t *addrs) {
+  return btc_peer_sendmsg(peer, BTC_MSG_ADDR, addrs);
+}
+
+static int
+btc_peer_send_addr_1(btc_peer_t *peer, const btc_netaddr_t *addr) {
+  btc_netaddr_t *items[1];
+  btc_addrs_t addrs;
+
+  items[0] = (btc_netaddr_t *)addr;
+
+  addrs.items = items;
+  addrs.alloc = 0;
+  addrs.length = 1;
+
+  return btc_peer_send_addr(peer, &addrs);
+}
+
+static int
+btc_peer_send_getblocks(btc_peer_t *peer,
+                        const btc_vector_t *locator,
+                        const uint8_t *stop) {
+  const uint8_t *tip = NULL;
+  btc_getblocks_t msg;
+
+  msg.version = BTC_NET_PROTOCOL_VERSION;
+  msg.locator = *locator;
+
+  if (stop != NULL)
+    btc_hash_copy(msg.stop, stop);
+  else
+    btc_hash_init(msg.stop);
+
+  peer->gb_time = btc_time_msec();
+
+  btc_peer_stall_at(peer, peer->gb_time + 30000);
+
+  if (locator->length > 0)
+    tip = (const uint8_t *)locator->items[0];
+
+  btc_peer_log(peer, "Requesting inv message from peer with getblocks (%N).",
+                     &peer->addr);
+
+  btc_peer_log(peer, "Sending getblocks (tip=%H, stop=%H).", tip, stop);
+
+  return btc_peer_sendmsg(peer, BTC_MSG_GETBLOCKS, &msg);
+}
+
+static int
+btc_peer_send_getheaders(btc_peer_t *peer,
+                         const btc_vector_t *locator,
+                         const uint8_t *stop) {
+  const uint8_t *tip = NULL;
+  btc_getblocks_t msg;
+
+  msg.version = BTC_NET_PROTOCOL_VERSION;
+  msg.locator = *locator;
+
+  if (stop != NULL)
+    btc_hash_copy(msg.stop, stop);
+  else
+    btc_hash_init(msg.stop);
+
+  peer->gh_time = btc_time_msec();
+
+  btc_peer_stall_at(peer, peer->gh_time + 60000);
+
+  if (locator->length > 0)
+    tip = (const uint8_t *)locator->items[0];
+
+  btc_peer_log(peer,
+    "Requesting headers message from peer with getheaders (%N).",
+    &peer->addr);
+
+  btc_peer_log(peer, "Sending getheaders (tip=%H, stop=%H).", tip, stop);
+
+  return btc_peer_sendmsg(peer, BTC_MSG_GETHEADERS, &msg);
+}
+
+static int
+btc_peer_send_getheaders_1(btc_peer_t *peer,
+                           const uint8_t *hash,
+                           const uint8_t *stop) {
+  btc_vector_t locator;
+  void *items[1];
+
+  items[0] = (void *)hash;
+
+  locator.items = items;
+  locator.alloc = 0;
+  locator.length = 1;
+
+  return btc_peer_send_getheaders(peer, &locator, stop);
+}
+
+BTC_UNUSED static int
+btc_peer_send_mempool(btc_peer_t *peer) {
+  if (!(peer->services & BTC_NET_SERVICE_BLOOM)) {
+    btc_peer_log(peer,
+      "Cannot request mempool for non-bloom peer (%N).",
+      &peer->addr);
+    return 1;
+  }
+
+  btc_peer_log(peer,
+    "Requesting inv message from peer with mempool (%N).",
+    &peer->addr);
+
+  return btc_peer_sendmsg(peer, BTC_MSG_MEMPOOL, NULL);
+}
+
+static int
+btc_peer_send_sendcmpct(btc_peer_t *peer, uint8_t mode) {
+  btc_sendcmpct_t msg;
+
+  msg.mode = mode;
+
+  if (peer->services & BTC_NET_SERVICE_WITNESS) {
+    if (peer->version >= BTC_NET_COMPACT_WITNESS_VERSION) {
+      btc_peer_log(peer,
+        "Initializing witness compact blocks (%N).",
+        &peer->addr);
+
+      msg.version = 2;
+
+      return btc_peer_sendmsg(peer, BTC_MSG_SENDCMPCT, &msg);
+    }
+  }
+
+#if 0
+  if (peer->version >= BTC_NET_COMPACT_VERSION) {
+    btc_peer_log(peer,
+      "Initializing normal compact blocks (%N).",
+      &peer->addr);
+
+    msg.version = 1;
+
+    return btc_peer_sendmsg(peer, BTC_MSG_SENDCMPCT, &msg);
+  }
+#endif
+
+  return 1;
+}
+
+static int
+btc_peer_send_wtxidrelay(btc_peer_t *peer) {
+  if (peer->version < BTC_NET_WTXID_VERSION || peer->block_relay)
+    return 1;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_WTXIDRELAY, NULL);
+}
+
+static int
+btc_peer_send_feefilter(btc_peer_t *peer, int64_t rate) {
+  btc_feefilter_t msg;
+
+  msg.rate = rate;
+
+  peer->fee_sent = rate;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_FEEFILTER, &msg);
+}
+
+static int
+btc_peer_send_sendtxrcncl(btc_peer_t *peer) {
+  btc_pool_t *pool = peer->pool;
+  btc_sendtxrcncl_t msg;
+
+  if (!(pool->flags & BTC_POOL_BIP330))
+    return 1;
+
+  if ((pool->flags & BTC_POOL_BLOCKSONLY) || !peer->relay)
+    return 1;
+
+  if (peer->version < BTC_NET_WTXID_VERSION)
+    return 1;
+
+  msg.version = RECON_VERSION;
+  msg.salt = peer->recon_salt;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_SENDTXRCNCL, &msg);
+}
+
+static int
+btc_peer_send_inv(btc_peer_t *peer, const btc_zinv_t *msg) {
+  btc_zinvitem_t item;
+  size_t i;
+
+  for (i = 0; i < msg->length; i++) {
+    btc_zinv_item(&item, msg, i);
+    btc_filter_add(&peer->inv_filter, item.hash, 32);
+  }
+
+  btc_peer_debug(peer, "Serving %zu inv items to %N.",
+                       msg->length, &peer->addr);
+
+  return btc_peer_sendmsg(peer, BTC_MSG_INV, msg);
+}
+
+static int
+btc_peer_send_inv_0(btc_peer_t *peer,
+                    enum btc_msgtype cmd,
+                    uint32_t type,
+                    const uint8_t *hash) {
+  btc_zinvitem_t item;
+  btc_zinv_t msg;
+
+  item.type = type;
+  item.hash = hash;
+
+  msg.items = &item;
+  msg.alloc = 0;
+  msg.length = 1;
+  msg.raw = NULL;
+
+  return btc_peer_sendmsg(peer, cmd, &msg);
+}
+
+static int
+btc_peer_send_inv_1(btc_peer_t *peer, uint32_t type, const uint8_t *hash) {
+  btc_filter_add(&peer->inv_filter, hash, 32);
+  btc_peer_debug(peer, "Serving 1 inv items to %N.", &peer->addr);
+  return btc_peer_send_inv_0(peer, BTC_MSG_INV, type, hash);
+}
+
+static int
+btc_peer_send_getdata(btc_peer_t *peer, const btc_zinv_t *msg) {
+  return btc_peer_sendmsg(peer, BTC_MSG_GETDATA, msg);
+}
+
+static int
+btc_peer_send_getdata_1(btc_peer_t *peer, uint32_t type, const uint8_t *hash) {
+  return btc_peer_send_inv_0(peer, BTC_MSG_GETDATA, type, hash);
+}
+
+static int
+btc_peer_send_notfound(btc_peer_t *peer, const btc_inv_t *msg) {
+  return btc_peer_sendmsg(peer, BTC_MSG_NOTFOUND_FULL, msg);
+}
+
+static int
+btc_peer_send_notfound_1(btc_peer_t *peer, uint32_t type, const uint8_t *hash) {
+  return btc_peer_send_inv_0(peer, BTC_MSG_NOTFOUND, type, hash);
+}
+
+static int
+btc_peer_send_headers_1(btc_peer_t *peer, const btc_header_t *hdr) {
+  btc_header_t *items[1];
+  btc_headers_t msg;
+
+  items[0] = (btc_header_t *)hdr;
+
+  msg.items = items;
+  msg.alloc = 0;
+  msg.length = 1;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_HEADERS, &msg);
+}
+
+static int
+btc_peer_send_reject(btc_peer_t *peer, const btc_reject_t *msg) {
+  btc_peer_log(peer, "Rejecting %s %H (%N): code=%s reason=%s.",
+                     msg->message,
+                     msg->hash,
+                     &peer->addr,
+                     btc_reject_get_code(msg),
+                     msg->reason);
+
+  return btc_peer_sendmsg(peer, BTC_MSG_REJECT, msg);
+}
+
+static int
+btc_peer_reject(btc_peer_t *peer,
+                const char *message,
+                const btc_verify_error_t *err) {
+  btc_reject_t reject;
+
+  btc_reject_init(&reject);
+
+  strcpy(reject.message, message);
+  btc_reject_set_code(&reject, err->code);
+  strcpy(reject.reason, err->reason);
+  btc_hash_copy(reject.hash, err->hash);
+
+  btc_peer_send_reject(peer, &reject);
+
+  return btc_peer_increase_ban(peer, err->score);
+}
+
+static int
+btc_peer_has_compact_support(btc_peer_t *peer) {
+  if (peer->version < BTC_NET_COMPACT_VERSION)
+    return 0;
+
+  if (!(peer->services & BTC_NET_SERVICE_WITNESS))
+    return 0;
+
+  return peer->version >= BTC_NET_COMPACT_WITNESS_VERSION;
+}
+
+static int
+btc_peer_has_compact(btc_peer_t *peer) {
+  if (peer->compact_mode == -1)
+    return 0;
+
+  if (!peer->compact_witness)
+    return 0;
+
+  return 1;
+}
+
+static uint32_t
+btc_peer_block_type(btc_peer_t *peer) {
+  if ((peer->pool->flags & BTC_POOL_BIP152)
+      && btc_peer_has_compact_support(peer)
+      && btc_peer_has_compact(peer)) {
+    return BTC_INV_CMPCT_BLOCK;
+  }
+
+  if (peer->services & BTC_NET_SERVICE_WITNESS)
+    return BTC_INV_WITNESS_BLOCK;
+
+  return BTC_INV_BLOCK;
+}
+
+static uint32_t
+btc_peer_txid_type(btc_peer_t *peer) {
+  if (peer->services & BTC_NET_SERVICE_WITNESS)
+    return BTC_INV_WITNESS_TX;
+
+  return BTC_INV_TX;
+}
+
+static uint32_t
+btc_peer_tx_type(btc_peer_t *peer) {
+  if (peer->wtxid_relay)
+    return BTC_INV_WTX;
+
+  return btc_peer_txid_type(peer);
+}
+
+static const uint8_t *
+btc_peer_tx_hash(btc_peer_t *peer, const btc_mpentry_t *entry) {
+  return peer->wtxid_relay ? entry->whash : entry->hash;
+}
+
+static int
+btc_peer_get_full_block(btc_peer_t *peer, const uint8_t *hash) {
+  uint32_t type = BTC_INV_BLOCK;
+
+  if (peer->services & BTC_NET_SERVICE_WITNESS)
+    type = BTC_INV_WITNESS_BLOCK;
+
+  return btc_peer_send_getdata_1(peer, type, hash);
+}
+
+static int
+btc_peer_send_cmpctblock(btc_peer_t *peer,
+                         const btc_block_t *block,
+                         const uint8_t *hash) {
+  enum btc_blockenc enc = BTC_BLOCKENC_CMPCT_BASE;
+  enum btc_msgtype type = BTC_MSG_CMPCTBLOCK_BASE;
+  btc_rawmsg_t *raw;
+  btc_cmpct_t msg;
+  int rc;
+
+  if (peer->compact_witness)
+    enc = BTC_BLOCKENC_CMPCT;
+
+  raw = btc_blockcache_encode(&peer->pool->block_cache, hash, enc,
+                              block, peer->network->magic);
+
+  if (raw != NULL)
+    return btc_peer_write_shared(peer, raw);
+
+  btc_cmpct_init(&msg);
+  btc_cmpct_set_block(&msg, block, peer->compact_witness);
+
+  if (peer->compact_witness)
+    type = BTC_MSG_CMPCTBLOCK;
+
+  rc = btc_peer_sendmsg(peer, type, &msg);
+
+  btc_cmpct_clear(&msg);
+
+  return rc;
+}
+
+static int
+btc_peer_send_getblocktxn(btc_peer_t *peer, const btc_cmpct_t *block) {
+  btc_getblocktxn_t msg;
+  int rc;
+
+  btc_getblocktxn_init(&msg);
+
+  btc_getblocktxn_set_cmpct(&msg, block);
+
+  rc = btc_peer_sendmsg(peer, BTC_MSG_GETBLOCKTXN, &msg);
+
+  btc_getblocktxn_clear(&msg);
+
+  return rc;
+}
+
+static int
+btc_peer_send_blocktxn(btc_peer_t *peer,
+                       const btc_block_t *block,
+                       const btc_getblocktxn_t *req) {
+  enum btc_msgtype type = BTC_MSG_BLOCKTXN_BASE;
+  btc_blocktxn_t msg;
+  int rc;
+
+  btc_blocktxn_init(&msg);
+
+  btc_blocktxn_set_block(&msg, block, req);
+
+  if (peer->compact_witness)
+    type = BTC_MSG_BLOCKTXN;
+
+  rc = btc_peer_sendmsg(peer, type, &msg);
+
+  btc_blocktxn_clear(&msg);
+
+  return rc;
+}
+
+static int
+btc_peer_flush_inv(btc_peer_t *peer) {
+  btc_inv_t inv;
+  int rc = 1;
+  size_t i;
+
+  if (peer->inv_queue.length == 0)
+    return 1;
+
+  btc_inv_init(&inv);
+  btc_inv_grow(&inv, peer->inv_queue.length);
+
+  for (i = 0; i < peer->inv_queue.length; i++) {
+    btc_invitem_t *item = peer->inv_queue.items[i];
+
+    if (btc_filter_has(&peer->inv_filter, item->hash, 32)) {
+      btc_invitem_destroy(item);
+      continue;
+    }
+
+    btc_filter_add(&peer->inv_filter, item->hash, 32);
+
+    btc_inv_push(&inv, item);
+  }
+
+  peer->inv_queue.length = 0;
+
+  if (inv.length > 0) {
+    btc_peer_debug(peer, "Serving %zu inv items to %N.",
+                         inv.length, &peer->addr);
+
+    rc = btc_peer_sendmsg(peer, BTC_MSG_INV_FULL, &inv);
+  }
+
+  btc_inv_clear(&inv);
+
+  return rc;
+}
+
+static int
+btc_peer_announce_block(btc_peer_t *peer,
+                        const btc_block_t *block,
+                        const uint8_t *hash) {
+  /* Don't send if they already have it. */
+  if (btc_filter_has(&peer->inv_filter, hash, 32))
+    return 0;
+
+  /* Send them the block immediately if
+     they're using compact block mode 1. */
+  if (peer->compact_mode == 1) {
+    btc_filter_add(&peer->inv_filter, hash, 32);
+    btc_peer_send_cmpctblock(peer, block, hash);
+    return 1;
+  }
+
+  /* Send header for peers that request it. */
+  if (peer->prefer_headers) {
+    btc_filter_add(&peer->inv_filter, hash, 32);
+    btc_peer_send_headers_1(peer, &block->header);
+    return 1;
+  }
+
+  btc_inv_push_item(&peer->inv_queue, BTC_INV_BLOCK, hash);
+  btc_peer_flush_inv(peer);
+
+  return 1;
+}
+
+static int
+btc_peer_wants_tx(btc_peer_t *peer, const btc_mpentry_t *entry) {
+  /* Don't send if they already have it. */
+  if (btc_filter_has(&peer->inv_filter, btc_peer_tx_hash(peer, entry), 32))
+    return 0;
+
+  /* Check the peer's bloom filter. */
+  if (peer->spv_filter != NULL) {
+    if (!btc_tx_matches(entry->tx, peer->spv_filter))
+      return 0;
+  }
+
+  /* Check the fee filter. */
+  if (peer->fee_rate != -1) {
+    int64_t rate = btc_get_rate(entry->size, entry->fee);
+
+    if (rate < peer->fee_rate)
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Reconciliation (BIP330)
+ */
+
+/* Most transactions reach a reconciling peer
+ * through a periodic sketch exchange rather
+ * than an inv of their own. The outbound side
+ * asks for a sketch of the inbound side's set,
+ * subtracts its own, and the decoded difference
+ * says who is missing what. Anything that can't
+ * be reconciled is simply flooded.
+ */
+
+static uint32_t
+btc_peer_short_id(btc_peer_t *peer, const uint8_t *hash) {
+  uint64_t h = btc_siphash_sum(hash, 32, peer->recon_key);
+
+  return 1 + (uint32_t)(h % 0xffffffff);
+}
+
+static void
+btc_recon_reset(btc_longmap_t *map) {
+  btc_longmapiter_t it;
+
+  btc_longmap_iterate(&it, map);
+
+  while (btc_longmap_next(&it))
+    btc_free(it.val);
+
+  btc_longmap_reset(map);
+}
+
+static void
+btc_recon_sketch(btc_minisketch_t *z,
+                 const btc_longmap_t *map,
+                 size_t capacity) {
+  btc_longmapiter_t it;
+
+  btc_minisketch_init(z, capacity);
+
+  btc_longmap_iterate(&it, map);
+
+  while (btc_longmap_next(&it))
+    btc_minisketch_add(z, (uint32_t)it.key);
+}
+
+static size_t
+btc_recon_capacity(size_t ours, size_t theirs, uint16_t q) {
+  size_t diff = ours > theirs ? ours - theirs : theirs - ours;
+  size_t min = ours < theirs ? ours : theirs;
+
+  return diff + (min * q) / 32767 + 1;
+}
+
+static int
+btc_peer_recon_add(btc_peer_t *peer, const uint8_t *hash) {
+  uint32_t id = btc_peer_short_id(peer, hash);
+
+  /* A small fraction is still flooded to
+     every link to keep latency down. */
+  if ((id % RECON_FLOOD_RATIO) == 0)
+    return 0;
+
+  if (btc_longmap_size(peer->recon_set) >= RECON_MAX_SET)
+    return 0;
+
+  if (!btc_longmap_has(peer->recon_set, id))
+    btc_longmap_put(peer->recon_set, id, btc_hash_clone(hash));
+
+  return 1;
+}
+
+static void
+btc_peer_recon_snapshot(btc_peer_t *peer) {
+  btc_longmap_t *snap = peer->recon_snap;
+
+  peer->recon_snap = peer->recon_set;
+  peer->recon_set = snap;
+  peer->recon_wait = 1;
+}
+
+static int
+btc_peer_recon_finish(btc_peer_t *peer,
+                      const uint32_t *ids,
+                      size_t length,
+                      int all) {
+  btc_pool_t *pool = peer->pool;
+  btc_longmapiter_t it;
+  const uint8_t *hash;
+  btc_zinv_t inv;
+  size_t i = 0;
+  int rc = 1;
+
+  btc_zinv_init(&inv);
+  btc_longmap_iterate(&it, peer->recon_snap);
+
+  for (;;) {
+    if (all) {
+      if (!btc_longmap_next(&it))
+        break;
+
+      hash = it.val;
+    } else {
+      if (i == length)
+        break;
+
+      hash = btc_longmap_get(peer->recon_snap, ids[i++]);
+
+      if (hash == NULL)
+        continue;
+    }
+
+    if (btc_filter_has(&peer->inv_filter, hash, 32))
+      continue;
+
+    if (!btc_mempool_has_wtx(pool->mempool, hash))
+      continue;
+
+    btc_zinv_push(&inv, BTC_INV_WTX, hash);
+
+    if (inv.length == BTC_NET_MAX_INV) {
+      rc = btc_peer_send_inv(peer, &inv);
+      btc_zinv_reset(&inv);
+    }
+  }
+
+  if (inv.length > 0)
+    rc = btc_peer_send_inv(peer, &inv);
+
+  btc_zinv_clear(&inv);
+
+  btc_recon_reset(peer->recon_snap);
+
+  peer->recon_wait = 0;
+  peer->recon_time = btc_time_msec() + RECON_INTERVAL;
+
+  return rc;
+}
+
+static int
+btc_peer_send_reqrecon(btc_peer_t *peer) {
+  size_t size = btc_longmap_size(peer->recon_set);
+  btc_reqrecon_t msg;
+
+  btc_peer_recon_snapshot(peer);
+
+  msg.set_size = size < 0xffff ? size : 0xffff;
+  msg.q = RECON_Q;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_REQRECON, &msg);
+}
+
+static void
+btc_peer_flush_feefilter(btc_peer_t *peer, int64_t now) {
+  btc_pool_t *pool = peer->pool;
+  int64_t rate, sent;
+
+  if (peer->version < BTC_NET_FEEFILTER_VERSION)
+    return;
+
+  if ((pool->flags & BTC_POOL_BLOCKSONLY) || peer->block_relay)
+    return;
+
+  /* Nothing is worth relaying to us while we sync. */
+  if (btc_chain_synced(pool->chain))
+    rate = btc_mempool_min_rate(pool->mempool);
+  else
+    rate = BTC_MAX_MONEY;
+
+  if (now >= peer->fee_timer) {
+    if (rate != peer->fee_sent)
+      btc_peer_send_feefilter(peer, rate);
+
+    peer->fee_timer = btc_poisson_time(now, FEEFILTER_INTERVAL);
+
+    return;
+  }
+
+  /* Big moves of the mempool min fee go out sooner. */
+  sent = peer->fee_sent;
+
+  if (now + FEEFILTER_MAX_DELAY < peer->fee_timer) {
+    if (rate < sent * 3 / 4 || rate > sent * 4 / 3)
+      peer->fee_timer = now + btc_uniform(FEEFILTER_MAX_DELAY);
+  }
+}
+
+static int
+btc_peer_flush_recon(btc_peer_t *peer, int64_t now) {
+  if (!peer->recon || now < peer->recon_time)
+    return 1;
+
+  if (peer->recon_wait) {
+    /* Peer went quiet on us. */
+    btc_peer_debug(peer, "Reconciliation timed out (%N).", &peer->addr);
+    return btc_peer_recon_finish(peer, NULL, 0, 1);
+  }
+
+  if (!peer->outbound)
+    return 1;
+
+  peer->recon_time = now + RECON_INTERVAL;
+
+  return btc_peer_send_reqrecon(peer);
+}
+
+static int
+btc_peer_flush_txs(btc_peer_t *peer) {
+  btc_pool_t *pool = peer->pool;
+  btc_txqueue_t *queue = &pool->tx_queue;
+  uint64_t end = queue->base + queue->length;
+  uint64_t seq = peer->inv_seq;
+  const btc_mpentry_t *entry;
+  btc_txann_t *items, *item, *parent;
+  const btc_input_t *input;
+  btc_hashmap_t *map;
+  size_t i, j, count;
+  btc_zinv_t inv;
+  int rc = 1;
+
+  peer->inv_seq = end;
+
+  if (peer->block_relay)
+    return 1;
+
+  if (seq < queue->base)
+    seq = queue->base;
+
+  /* Do not send txs to spv clients that have relay unset. */
+  if (seq >= end || !peer->relay)
+    return 1;
+
+  items = (btc_txann_t *)btc_malloc((end - seq) * sizeof(btc_txann_t));
+  map = btc_hashmap_create();
+  count = 0;
+
+  for (; seq < end; seq++) {
+    const uint8_t *hash = queue->hashes + (seq - queue->base) * 32;
+
+    /* Queued twice. */
+    if (btc_hashmap_has(map, hash))
+      continue;
+
+    entry = btc_mempool_get(pool->mempool, hash);
+
+    /* Gone since. */
+    if (entry == NULL)
+      continue;
+
+    if (!btc_peer_wants_tx(peer, entry))
+      continue;
+
+    item = &items[count++];
+    item->entry = entry;
+    item->rate = btc_get_rate(entry->size, entry->delta_fee);
+    item->depth = 0;
+
+    /* The queue is in acceptance order, so any
+       parents in this batch were seen already. */
+    for (i = 0; i < entry->tx->inputs.length; i++) {
+      input = entry->tx->inputs.items[i];
+      parent = btc_hashmap_get(map, input->prevout.hash);
+
+      if (parent != NULL && parent->depth >= item->depth)
+        item->depth = parent->depth + 1;
+    }
+
+    btc_hashmap_put(map, (uint8_t *)entry->hash, item);
+  }
+
+  btc_hashmap_destroy(map);
+
+  qsort(items, count, sizeof(btc_txann_t), btc_txann_compare);
+
+  btc_zinv_init(&inv);
+  btc_zinv_grow(&inv, count < BTC_NET_MAX_INV ? count : BTC_NET_MAX_INV);
+
+  for (j = 0; j < count; j++) {
+    const uint8_t *hash = btc_peer_tx_hash(peer, items[j].entry);
+
+    /* Left for the next sketch. */
+    if (peer->recon && btc_peer_recon_add(peer, hash))
+      continue;
+
+    btc_zinv_push(&inv, peer->wtxid_relay ? BTC_INV_WTX : BTC_INV_TX, hash);
+
+    if (inv.length == BTC_NET_MAX_INV) {
+      rc = btc_peer_send_inv(peer, &inv);
+      btc_zinv_reset(&inv);
+    }
+  }
+
+  if (inv.length > 0)
+    rc = btc_peer_send_inv(peer, &inv);
+
+  btc_zinv_clear(&inv);
+  btc_free(items);
+
+  return rc;
+}
+
+static void
+btc_pool_on_connect(btc_pool_t *pool, btc_peer_t *peer);
+
+static void
+btc_peer_on_connect(btc_peer_t *peer) {
+  if (peer->v2 == BTC_V2_KEY) {
+    /* Hello has to wait until it can be encrypted. */
+    btc_peer_keygen_v2(peer);
+    btc_peer_send_handshake(peer, 1, 0);
+    return;
+  }
+
+  if (peer->outbound) {
+    /* Say hello. */
+    btc_peer_send_version(peer);
+  } else {
+    /* We're shy. Wait for an introduction. */
+  }
+
+  peer->state = BTC_PEER_WAIT_VERSION;
+  peer->time = btc_time_msec();
+
+  btc_timer_start(peer->connect_timer, CONNECT_TIMEOUT);
+
+  btc_pool_capture_open(peer->pool, peer);
+  btc_pool_on_connect(peer->pool, peer);
+}
+
+static void
+btc_pool_on_close(btc_pool_t *pool, btc_peer_t *peer);
+
+static void
+btc_peer_on_close(btc_peer_t *peer) {
+  btc_pool_capture(peer->pool, peer, BTC_CAPTURE_CLOSE, NULL, 0);
+  btc_pool_on_close(peer->pool, peer);
+}
+
+static void
+btc_pool_on_complete(btc_pool_t *pool, btc_peer_t *peer);
+
+static void
+btc_peer_on_version(btc_peer_t *peer, const btc_version_t *msg) {
+  if (peer->state != BTC_PEER_WAIT_VERSION) {
+    btc_peer_log(peer, "Peer sent unsolicited version (%N).", &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  peer->version = msg->version;
+  peer->services = msg->services;
+  peer->height = msg->height;
+  strcpy(peer->agent, msg->agent);
+  peer->relay = msg->relay && !peer->block_relay;
+  peer->local = msg->remote;
+
+  if (!peer->network->self_connect) {
+    if (btc_nonces_has(&peer->pool->nonces, msg->nonce)) {
+      btc_peer_log(peer, "We connected to ourself. Oops (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return;
+    }
+  }
+
+  if (peer->version < BTC_NET_MIN_VERSION) {
+    btc_peer_log(peer, "Peer does not support required protocol version (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  if (peer->outbound) {
+    if (!btc_pool_serves_blocks(peer->pool, peer->services)) {
+      btc_peer_log(peer, "Peer does not support network services (%N).",
+                         &peer->addr);
+      btc_peer_close(peer);
+      return;
+    }
+
+    if (peer->pool->flags & BTC_POOL_CHECKPOINTS) {
+      if (peer->version < BTC_NET_HEADERS_VERSION) {
+        btc_peer_log(peer, "Peer does not support getheaders (%N).",
+                           &peer->addr);
+        btc_peer_close(peer);
+        return;
+      }
+    }
+
+    if ((peer->services & BTC_NET_SERVICE_WITNESS) == 0) {
+      btc_peer_log(peer, "Peer does not support segregated witness (%N).",
+                         &peer->addr);
+      btc_peer_close(peer);
+      return;
+    }
+
+    if (peer->pool->flags & BTC_POOL_BIP152) {
+      if (!btc_peer_has_compact_support(peer)) {
+        btc_peer_log(peer, "Peer does not support compact blocks (%N).",
+                           &peer->addr);
+      }
+    }
+  }
+
+  if (!peer->outbound)
+    btc_peer_send_version(peer);
+
+  btc_peer_send_wtxidrelay(peer);
+  btc_peer_send_sendtxrcncl(peer);
+  btc_peer_send_verack(peer);
+
+  peer->state = BTC_PEER_WAIT_VERACK;
+}
+
+static void
+btc_peer_on_verack(btc_peer_t *peer) {
+  if (peer->state != BTC_PEER_WAIT_VERACK) {
+    btc_peer_log(peer, "Peer sent unsolicited verack (%N).", &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  peer->state = BTC_PEER_CONNECTED;
+
+  btc_timer_stop(peer->connect_timer);
+  btc_timer_start(peer->ping_timer, 0);
+  btc_timer_start(peer->inv_timer, 0);
+  btc_timer_start(peer->stall_timer, 0);
+
+  btc_peer_log(peer, "Version handshake complete (%N).", &peer->addr);
+  btc_pool_on_complete(peer->pool, peer);
+}
+
+static void
+btc_peer_on_ping(btc_peer_t *peer, const btc_ping_t *msg) {
+  if (msg->nonce == 0)
+    return;
+
+  btc_peer_send_pong(peer, msg->nonce);
+}
+
+static void
+btc_peer_on_pong(btc_peer_t *peer, const btc_pong_t *msg) {
+  int64_t now = btc_time_msec();
+
+  if (peer->challenge == 0) {
+    btc_peer_log(peer, "Peer sent an unsolicited pong (%N).", &peer->addr);
+    return;
+  }
+
+  if (msg->nonce != peer->challenge) {
+    if (msg->nonce == 0) {
+      btc_peer_log(peer, "Peer sent a zero nonce (%N).", &peer->addr);
+      peer->challenge = 0;
+      return;
+    }
+    btc_peer_log(peer, "Peer sent the wrong nonce (%N).", &peer->addr);
+    return;
+  }
+
+  if (now >= peer->last_ping) {
+    peer->last_pong = now;
+
+    if (peer->min_ping == -1)
+      peer->min_ping = now - peer->last_ping;
+
+    now -= peer->last_ping;
+
+    if (now < peer->min_ping)
+      peer->min_ping = now;
+  } else {
+    btc_peer_log(peer, "Timing mismatch (what?) (%N).", &peer->addr);
+  }
+
+  peer->challenge = 0;
+}
+
+static void
+btc_peer_on_sendheaders(btc_peer_t *peer) {
+  if (peer->prefer_headers) {
+    btc_peer_log(peer, "Peer sent a duplicate sendheaders (%N).", &peer->addr);
+    return;
+  }
+
+  peer->prefer_headers = 1;
+}
+
+static void
+btc_peer_on_filterload(btc_peer_t *peer, const btc_bloom_t *filter) {
+  btc_pool_t *pool = peer->pool;
+
+  if (!(pool->flags & BTC_POOL_BIP37)) {
+    btc_peer_log(peer, "Peer loaded filter without bip37 enabled (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  if (!btc_bloom_is_within_constraints(filter)) {
+    btc_peer_increase_ban(peer, 100);
+    return;
+  }
+
+  /* No tx relay to filter. */
+  if (peer->block_relay)
+    return;
+
+  /* Could avoid a second allocation here. */
+  if (peer->spv_filter == NULL)
+    peer->spv_filter = btc_bloom_clone(filter);
+  else
+    btc_bloom_copy(peer->spv_filter, filter);
+
+  peer->relay = 1;
+}
+
+static void
+btc_peer_on_filteradd(btc_peer_t *peer, const btc_filteradd_t *msg) {
+  btc_pool_t *pool = peer->pool;
+
+  if (!(pool->flags & BTC_POOL_BIP37)) {
+    btc_peer_log(peer, "Peer added to filter without bip37 enabled (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  if (msg->length > BTC_MAX_SCRIPT_PUSH) {
+    btc_peer_increase_ban(peer, 100);
+    return;
+  }
+
+  /* Nothing to add to. */
+  if (peer->spv_filter == NULL) {
+    btc_peer_increase_ban(peer, 100);
+    return;
+  }
+
+  btc_bloom_add(peer->spv_filter, msg->data, msg->length);
+
+  peer->relay = 1;
+}
+
+static void
+btc_peer_on_filterclear(btc_peer_t *peer) {
+  btc_pool_t *pool = peer->pool;
+
+  if (!(pool->flags & BTC_POOL_BIP37)) {
+    btc_peer_log(peer, "Peer cleared filter without bip37 enabled (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  /* An empty filter would match nothing: drop
+     it so the peer goes back to full relay. */
+  if (peer->spv_filter != NULL) {
+    btc_bloom_destroy(peer->spv_filter);
+    peer->spv_filter = NULL;
+  }
+
+  peer->relay = !peer->block_relay;
+}
+
+static void
+btc_peer_on_feefilter(btc_peer_t *peer, const btc_feefilter_t *msg) {
+  if (msg->rate < 0 || msg->rate > BTC_MAX_MONEY) {
+    btc_peer_increase_ban(peer, 100);
+    return;
+  }
+
+  peer->fee_rate = msg->rate;
+}
+
+static void
+btc_peer_on_sendcmpct(btc_peer_t *peer, const btc_sendcmpct_t *msg) {
+  if (msg->version > 2) {
+    /* Ignore. */
+    btc_peer_log(peer, "Peer requested compact blocks version %llu (%N).",
+                       msg->version, &peer->addr);
+    return;
+  }
+
+  if (msg->mode > 1) {
+    /* Ignore. */
+    btc_peer_log(peer, "Peer requested compact blocks mode %hhu (%N).",
+                       msg->mode, &peer->addr);
+    return;
+  }
+
+  if (peer->compact_mode != -1) {
+    /* Peers move us in and out of high
+       bandwidth mode as they see fit. */
+    if (msg->version != (peer->compact_witness ? 2 : 1)) {
+      btc_peer_log(peer, "Peer sent a duplicate sendcmpct (%N).",
+                         &peer->addr);
+      return;
+    }
+
+    btc_peer_log(peer, "Peer switched compact blocks to mode %hhu (%N).",
+                       msg->mode, &peer->addr);
+
+    peer->compact_mode = msg->mode;
+
+    return;
+  }
+
+  btc_peer_log(peer,
+    "Peer initialized compact blocks (mode=%hhu, version=%llu) (%N).",
+    msg->mode, msg->version, &peer->addr);
+
+  peer->compact_mode = msg->mode;
+  peer->compact_witness = (msg->version == 2);
+}
+
+static void
+btc_peer_on_wtxidrelay(btc_peer_t *peer) {
+  if (peer->state != BTC_PEER_WAIT_VERACK) {
+    btc_peer_log(peer, "Peer sent wtxidrelay outside handshake (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  if (peer->version < BTC_NET_WTXID_VERSION)
+    return;
+
+  peer->wtxid_relay = 1;
+}
+
+static void
+btc_peer_on_sendtxrcncl(btc_peer_t *peer, const btc_sendtxrcncl_t *msg) {
+  btc_pool_t *pool = peer->pool;
+  uint64_t lo = peer->recon_salt;
+  uint64_t hi = msg->salt;
+  uint8_t hash[32];
+  uint8_t raw[16];
+  btc_sha256_t ctx;
+
+  if (peer->state != BTC_PEER_WAIT_VERACK) {
+    btc_peer_log(peer, "Peer sent sendtxrcncl outside handshake (%N).",
+                       &peer->addr);
+    return;
+  }
+
+  if (!(pool->flags & BTC_POOL_BIP330))
+    return;
+
+  if ((pool->flags & BTC_POOL_BLOCKSONLY) || !peer->relay)
+    return;
+
+  if (peer->recon || msg->version < RECON_VERSION)
+    return;
+
+  /* Short ids are computed over wtxids. */
+  if (!peer->wtxid_relay)
+    return;
+
+  if (lo > hi) {
+    lo = msg->salt;
+    hi = peer->recon_salt;
+  }
+
+  btc_write64le(raw + 0, lo);
+  btc_write64le(raw + 8, hi);
+
+  btc_tagged_init(&ctx, "Tx Relay Salting");
+  btc_sha256_update(&ctx, raw, 16);
+  btc_sha256_final(&ctx, hash);
+
+  memcpy(peer->recon_key, hash, 16);
+
+  peer->recon = 1;
+  peer->recon_time = btc_time_msec() + RECON_INTERVAL;
+
+  btc_peer_log(peer, "Peer negotiated tx reconciliation (%N).",
+                     &peer->addr);
+}
+
+static void
+btc_peer_on_reqrecon(btc_peer_t *peer, const btc_reqrecon_t *msg) {
+  btc_minisketch_t sketch;
+  btc_sketch_t body;
+  size_t capacity;
+
+  if (!peer->recon || peer->outbound || peer->recon_wait) {
+    btc_peer_log(peer, "Peer sent unsolicited reqrecon (%N).", &peer->addr);
+    return;
+  }
+
+  btc_peer_recon_snapshot(peer);
+
+  peer->recon_time = btc_time_msec() + RECON_INTERVAL;
+
+  capacity = btc_recon_capacity(btc_longmap_size(peer->recon_snap),
+                                msg->set_size, msg->q);
+
+  btc_sketch_init(&body);
+
+  /* An empty sketch tells the initiator
+     to give up and flood instead. */
+  if (capacity <= BTC_MINISKETCH_MAX) {
+    btc_recon_sketch(&sketch, peer->recon_snap, capacity);
+
+    body.length = btc_minisketch_size(&sketch);
+    body.data = (uint8_t *)btc_malloc(body.length);
+
+    btc_minisketch_write(body.data, &sketch);
+    btc_minisketch_clear(&sketch);
+  }
+
+  btc_peer_sendmsg(peer, BTC_MSG_SKETCH, &body);
+  btc_sketch_clear(&body);
+}
+
+static void
+btc_peer_on_sketch(btc_peer_t *peer, const btc_sketch_t *msg) {
+  btc_minisketch_t theirs, ours;
+  btc_reconcildiff_t diff;
+  uint32_t *ids = NULL;
+  size_t i, len = 0;
+  int ok = 0;
+
+  if (!peer->recon || !peer->outbound || !peer->recon_wait) {
+    btc_peer_log(peer, "Peer sent unsolicited sketch (%N).", &peer->addr);
+    return;
+  }
+
+  btc_minisketch_init(&theirs, 0);
+
+  if (msg->length > 0
+      && btc_minisketch_import(&theirs, msg->data, msg->length)) {
+    btc_recon_sketch(&ours, peer->recon_snap, theirs.capacity);
+    btc_minisketch_merge(&theirs, &ours);
+    btc_minisketch_clear(&ours);
+
+    ids = (uint32_t *)btc_malloc((theirs.capacity + 1) * sizeof(uint32_t));
+    ok = btc_minisketch_decode(ids, &len, &theirs);
+  }
+
+  btc_minisketch_clear(&theirs);
+
+  btc_reconcildiff_init(&diff);
+
+  diff.success = ok;
+
+  if (ok) {
+    /* Ask for whatever isn't ours. */
+    for (i = 0; i < len; i++) {
+      if (!btc_longmap_has(peer->recon_snap, ids[i])) {
+        btc_reconcildiff_resize(&diff, diff.length + 1);
+        diff.ids[diff.length - 1] = ids[i];
+      }
+    }
+  }
+
+  btc_peer_debug(peer, "Reconciled with %N (success=%d, diff=%zu, ask=%zu).",
+                       &peer->addr, ok, len, diff.length);
+
+  btc_peer_sendmsg(peer, BTC_MSG_RECONCILDIFF, &diff);
+  btc_peer_recon_finish(peer, ids, len, !ok);
+
+  btc_reconcildiff_clear(&diff);
+
+  if (ids != NULL)
+    btc_free(ids);
+}
+
+static void
+btc_peer_on_reconcildiff(btc_peer_t *peer, const btc_reconcildiff_t *msg) {
+  if (!peer->recon || peer->outbound || !peer->recon_wait) {
+    btc_peer_log(peer, "Peer sent unsolicited reconcildiff (%N).",
+                       &peer->addr);
+    return;
+  }
+
+  btc_peer_recon_finish(peer, msg->ids, msg->length, !msg->success);
+}
+
+static void
+btc_peer_on_refused(btc_peer_t *peer) {
+  /* A v1-only peer hangs up on our key without a word. */
+  if (peer->outbound && peer->v2 == BTC_V2_KEY) {
+    if (peer->bytes_sent > 0 && peer->bytes_recv == 0)
+      peer->v1_retry = 1;
+  }
+}
+
+static void
+btc_peer_on_error(btc_peer_t *peer, const char *msg) {
+  btc_peer_log(peer, "Socket error (%N): %s", &peer->addr, msg);
+  btc_peer_on_refused(peer);
+  btc_peer_close(peer);
+}
+
+static int
+btc_peer_is_v1(btc_peer_t *peer) {
+  /* A v1 initiator opens with its version message. */
+  uint8_t prefix[16];
+
+  if (peer->outbound || peer->handshake_len < 16)
+    return 0;
+
+  btc_write32le(prefix, peer->network->magic);
+
+  memcpy(prefix + 4, "version\0\0\0\0\0", 12);
+
+  return memcmp(peer->handshake, prefix, 16) == 0;
+}
+
+static int
+btc_peer_on_handshake(btc_peer_t *peer, const uint8_t *data, size_t size) {
+  btc_parser_t *parser = &peer->parser;
+  uint8_t *buf = peer->handshake;
+  size_t i, len;
+
+  if (peer->v2 == BTC_V2_KEY) {
+    len = BTC_BIP324_KEY_SIZE - peer->handshake_len;
+
+    if (len > size)
+      len = size;
+
+    memcpy(buf + peer->handshake_len, data, len);
+
+    peer->handshake_len += len;
+
+    data += len;
+    size -= len;
+
+    if (btc_peer_is_v1(peer)) {
+      uint8_t head[BTC_BIP324_KEY_SIZE];
+      int parsed;
+
+      len = peer->handshake_len;
+
+      memcpy(head, buf, len);
+
+      btc_peer_clear_v2(peer);
+
+      parsed = btc_parser_feed(parser, head, len);
+
+      if (size > 0 && peer->state != BTC_PEER_DEAD)
+        parsed |= btc_parser_feed(parser, data, size);
+
+      return parsed;
+    }
+
+    if (peer->handshake_len < BTC_BIP324_KEY_SIZE)
+      return 0;
+
+    if (peer->cipher == NULL)
+      btc_peer_keygen_v2(peer);
+
+    if (!btc_bip324_derive(peer->cipher, buf)) {
+      btc_peer_log(peer, "Invalid v2 key (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return 0;
+    }
+
+    peer->v2 = BTC_V2_GARBAGE;
+    peer->handshake_len = 0;
+
+    if (!btc_peer_send_handshake(peer, !peer->outbound, 1))
+      return 0;
+
+    /* Now we can say hello. */
+    if (peer->outbound)
+      btc_peer_on_connect(peer);
+
+    if (peer->state == BTC_PEER_DEAD)
+      return 0;
+  }
+
+  /* Their garbage runs up to the terminator. */
+  for (i = 0; i < size; i++) {
+    buf[peer->handshake_len++] = data[i];
+
+    len = peer->handshake_len;
+
+    if (len < BTC_BIP324_TERM_SIZE)
+      continue;
+
+    len -= BTC_BIP324_TERM_SIZE;
+
+    if (memcmp(buf + len, peer->cipher->recv_term, BTC_BIP324_TERM_SIZE)) {
+      if (len < BTC_BIP324_GARBAGE_MAX)
+        continue;
+
+      btc_peer_log(peer, "No garbage terminator (%N).", &peer->addr);
+      btc_peer_close(peer);
+
+      return 0;
+    }
+
+    btc_parser_set_cipher(parser, peer->cipher, buf, len);
+
+    btc_free(peer->handshake);
+
+    peer->v2 = BTC_V2_READY;
+    peer->handshake = NULL;
+    peer->handshake_len = 0;
+
+    data += i + 1;
+    size -= i + 1;
+
+    if (size == 0)
+      return 0;
+
+    return btc_parser_feed(parser, data, size);
+  }
+
+  return 0;
+}
+
+static int
+btc_peer_on_data(btc_peer_t *peer, const uint8_t *data, size_t size) {
+  int tag, ret;
+
+  if (peer->state == BTC_PEER_DEAD)
+    return 0;
+
+  if (size == 0) {
+    btc_peer_log(peer, "Peer sent EOF (%N).", &peer->addr);
+    btc_peer_on_refused(peer);
+    btc_peer_close(peer);
+    return 0;
+  }
+
+  peer->last_recv = btc_time_msec();
+  peer->bytes_recv += size;
+  peer->pool->bytes_recv += size;
+
+  btc_pool_capture(peer->pool, peer, BTC_CAPTURE_RECV, data, size);
+
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_NET);
+
+  if (peer->v2 == BTC_V2_KEY || peer->v2 == BTC_V2_GARBAGE)
+    ret = !btc_peer_on_handshake(peer, data, size);
+  else
+    ret = !btc_parser_feed(&peer->parser, data, size);
+
+  BTC_MEMTAG_POP(tag);
+
+  return ret;
+}
+
+static int
+btc_peer_flush_data(btc_peer_t *peer);
+
+static void
+btc_peer_on_drain(btc_peer_t *peer) {
+  if (peer->state == BTC_PEER_DEAD)
+    return;
+
+  btc_peer_flush_data(peer);
+}
+
+static void
+btc_pool_on_msg(btc_pool_t *pool, btc_peer_t *peer, btc_msg_t *msg);
+
+static void
+btc_peer_on_msg(btc_peer_t *peer, btc_msg_t *msg) {
+  int64_t start;
+
+  if (peer->state == BTC_PEER_DEAD)
+    return;
+
+  BTC_TRACE_BEGIN("net", msg->cmd);
+
+  start = btc_time_nsec();
+
+  switch (msg->type) {
+    case BTC_MSG_VERSION:
+      btc_peer_on_version(peer, (const btc_version_t *)msg->body);
+      break;
+    case BTC_MSG_VERACK:
+      btc_peer_on_verack(peer);
+      break;
+    case BTC_MSG_PING:
+      btc_peer_on_ping(peer, (const btc_ping_t *)msg->body);
+      break;
+    case BTC_MSG_PONG:
+      btc_peer_on_pong(peer, (const btc_pong_t *)msg->body);
+      break;
+    case BTC_MSG_SENDHEADERS:
+      btc_peer_on_sendheaders(peer);
+      break;
+    case BTC_MSG_FILTERLOAD:
+      btc_peer_on_filterload(peer, (const btc_bloom_t *)msg->body);
+      break;
+    case BTC_MSG_FILTERADD:
+      btc_peer_on_filteradd(peer, (const btc_filteradd_t *)msg->body);
+      break;
+    case BTC_MSG_FILTERCLEAR:
+      btc_peer_on_filterclear(peer);
+      break;
+    case BTC_MSG_FEEFILTER:
+      btc_peer_on_feefilter(peer, (const btc_feefilter_t *)msg->body);
+      break;
+    case BTC_MSG_SENDCMPCT:
+      btc_peer_on_sendcmpct(peer, (const btc_sendcmpct_t *)msg->body);
+      break;
+    case BTC_MSG_WTXIDRELAY:
+      btc_peer_on_wtxidrelay(peer);
+      break;
+    case BTC_MSG_SENDTXRCNCL:
+      btc_peer_on_sendtxrcncl(peer, (const btc_sendtxrcncl_t *)msg->body);
+      break;
+    case BTC_MSG_REQRECON:
+      btc_peer_on_reqrecon(peer, (const btc_reqrecon_t *)msg->body);
+      break;
+    case BTC_MSG_SKETCH:
+      btc_peer_on_sketch(peer, (const btc_sketch_t *)msg->body);
+      break;
+    case BTC_MSG_RECONCILDIFF:
+      btc_peer_on_reconcildiff(peer, (const btc_reconcildiff_t *)msg->body);
+      break;
+    default:
+      break;
+  }
+
+  btc_pool_on_msg(peer->pool, peer, msg);
+
+  peer->recv[msg->type].time += btc_time_nsec() - start;
+
+  BTC_TRACE_END("net", msg->cmd);
+}
+
+static void
+btc_peer_on_parse_error(btc_peer_t *peer, int fatal) {
+  if (peer->state == BTC_PEER_DEAD)
+    return;
+
+  /* Nothing after this can be read. Not necessarily
+     malice: it may be a v2 peer trying its luck. */
+  if (fatal) {
+    btc_peer_log(peer, "Bad framing (%N).", &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  btc_peer_log(peer, "Parse error (%N).", &peer->addr);
+  btc_peer_increase_ban(peer, 10);
+}
+
+static int
+btc_peer_flush_data(btc_peer_t *peer) {
+  btc_chain_t *chain = peer->pool->chain;
+  btc_mempool_t *mempool = peer->pool->mempool;
+  btc_blockcache_t *cache = &peer->pool->block_cache;
+  uint32_t magic = peer->network->magic;
+  btc_invitem_t *item, *next;
+  int blk_count = 0;
+  int tx_count = 0;
+  int cmpct_count = 0;
+  int64_t unknown = -1;
+  uint32_t type;
+  btc_inv_t nf;
+  int send_tip;
+  size_t size;
+  int ret = 1;
+
+  if (peer->state != BTC_PEER_CONNECTED)
+    return 1;
+
+  if (peer->sending.length == 0)
+    return 1;
+
+  btc_inv_init(&nf);
+
+  for (item = peer->sending.head; item != NULL; item = next) {
+    next = item->next;
+    size = btc_socket_buffered(peer->socket) + nf.length * 36;
+    type = item->type;
+
+    if (size >= (10 << 20) || peer->state == BTC_PEER_DEAD) {
+      /* Wait for the peer to read
+         before we pull more data
+         out of the database. */
+      ret = 0;
+      break;
+    }
+
+    /* Check the hashContinue early. */
+    send_tip = btc_hash_equal(item->hash, peer->hash_continue);
+
+    /* Maybe fall back to full block. */
+    if (type == BTC_INV_CMPCT_BLOCK) {
+      const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
+
+      if (entry != NULL && entry->height < btc_chain_height(chain) - 10)
+        type = peer->compact_witness ? BTC_INV_WITNESS_BLOCK : BTC_INV_BLOCK;
+    }
+
+    /* Out of upload budget: old blocks are no longer served. */
+    if (type == BTC_INV_BLOCK
+        || type == BTC_INV_WITNESS_BLOCK
+        || type == BTC_INV_FILTERED_BLOCK) {
+      if (btc_pool_upload_exhausted(peer->pool, 1)) {
+        const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
+        int64_t now = btc_timedata_now(peer->pool->timedata);
+
+        if (entry != NULL && entry->header.time < now - HISTORICAL_AGE) {
+          btc_peer_log(peer, "Upload target reached, disconnecting (%N).",
+                             &peer->addr);
+          btc_peer_close(peer);
+          ret = 0;
+          break;
+        }
+      }
+    }
+
+    switch (type) {
+      case BTC_INV_BLOCK: {
+        const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
+        btc_block_t *block;
+        btc_rawmsg_t *raw;
+
+        if (entry == NULL || !btc_pool_can_serve(peer->pool, entry)) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        raw = btc_blockcache_encode(cache, item->hash, BTC_BLOCKENC_BASE,
+                                    NULL, magic);
+
+        if (raw != NULL) {
+          btc_peer_write_shared(peer, raw);
+          btc_invitem_destroy(item);
+          blk_count += 1;
+          break;
+        }
+
+        block = btc_chain_get_block(chain, entry);
+
+        if (block == NULL) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        raw = btc_blockcache_encode(cache, item->hash, BTC_BLOCKENC_BASE,
+                                    block, magic);
+
+        if (raw != NULL)
+          btc_peer_write_shared(peer, raw);
+        else
+          btc_peer_sendmsg(peer, BTC_MSG_BLOCK_BASE, block);
+
+        btc_block_destroy(block);
+        btc_invitem_destroy(item);
+
+        blk_count += 1;
+
+        break;
+      }
+
+      case BTC_INV_WITNESS_BLOCK: {
+        const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
+        btc_cachedblock_t *cached;
+        btc_blockfile_t *file;
+        size_t length;
+        uint8_t *data;
+        int64_t pos;
+
+        if (entry == NULL || !btc_pool_can_serve(peer->pool, entry)) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        /* Recent blocks may already be encoded. */
+        cached = btc_blockcache_get(cache, item->hash);
+
+        if (cached != NULL && cached->msgs[BTC_BLOCKENC_WITNESS] != NULL) {
+          btc_peer_write_shared(peer, cached->msgs[BTC_BLOCKENC_WITNESS]);
+          btc_invitem_destroy(item);
+          blk_count += 1;
+          break;
+        }
+
+        /* Records are stored framed as a block message:
+           hand the file range to the kernel as is. A v2
+           peer needs it encrypted, so it gets read in. */
+        file = NULL;
+
+        if (peer->cipher == NULL)
+          file = btc_chain_open_raw_block(chain, &pos, &length, entry);
+
+        if (file != NULL) {
+          btc_peer_write_file(peer, file, pos, length);
+          btc_invitem_destroy(item);
+          blk_count += 1;
+          break;
+        }
+
+        if (!btc_chain_get_raw_block(chain, &data, &length, entry)) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        btc_peer_write(peer, data, length);
+        btc_invitem_destroy(item);
+
+        blk_count += 1;
+
+        break;
+      }
+
+      case BTC_INV_CMPCT_BLOCK: {
+        const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
+        enum btc_blockenc enc = BTC_BLOCKENC_CMPCT_BASE;
+        btc_block_t *block;
+        btc_rawmsg_t *raw;
+
+        if (entry == NULL || !btc_pool_can_serve(peer->pool, entry)) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        if (peer->compact_witness)
+          enc = BTC_BLOCKENC_CMPCT;
+
+        raw = btc_blockcache_encode(cache, item->hash, enc, NULL, magic);
+
+        if (raw != NULL) {
+          btc_peer_write_shared(peer, raw);
+          btc_invitem_destroy(item);
+          blk_count += 1;
+          cmpct_count += 1;
+          break;
+        }
+
+        block = btc_chain_get_block(chain, entry);
+
+        if (block == NULL) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        btc_peer_send_cmpctblock(peer, block, item->hash);
+
+        btc_block_destroy(block);
+        btc_invitem_destroy(item);
+
+        blk_count += 1;
+        cmpct_count += 1;
+
+        break;
+      }
+
+      case BTC_INV_FILTERED_BLOCK: {
+        btc_cachedblock_t *cached;
+        const btc_entry_t *entry;
+        btc_merkletree_t *tree;
+        btc_merkleblock_t mrkl;
+        btc_block_t *block;
+        btc_vector_t *txs;
+        size_t i;
+
+        if (!(peer->pool->flags & BTC_POOL_BIP37)) {
+          btc_peer_log(peer,
+            "Peer requested a merkleblock without bip37 enabled (%N).",
+            &peer->addr);
+          btc_peer_close(peer);
+          break;
+        }
+
+        if (peer->spv_filter == NULL) {
+          btc_invitem_destroy(item);
+          break;
+        }
+
+        entry = btc_chain_by_hash(chain, item->hash);
+
+        if (entry == NULL || !btc_pool_can_serve(peer->pool, entry)) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        block = btc_chain_get_block(chain, entry);
+
+        if (block == NULL) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        btc_merkleblock_init(&mrkl);
+
+        /* Peers filtering a block we just announced
+           share its inner nodes. */
+        cached = btc_blockcache_get(cache, item->hash);
+
+        if (cached != NULL) {
+          if (cached->tree == NULL)
+            cached->tree = btc_merkletree_create(block);
+
+          tree = cached->tree;
+        } else {
+          tree = btc_merkletree_create(block);
+        }
+
+        txs = btc_merkleblock_set_tree(&mrkl, block, tree, peer->spv_filter);
+
+        if (cached == NULL)
+          btc_merkletree_destroy(tree);
+
+        btc_peer_sendmsg(peer, BTC_MSG_MERKLEBLOCK, &mrkl);
+
+        for (i = 0; i < txs->length; i++)
+          btc_peer_sendmsg(peer, BTC_MSG_TX_BASE, txs->items[i]);
+
+        blk_count += 1;
+        tx_count += txs->length;
+
+        btc_merkleblock_clear(&mrkl);
+        btc_vector_destroy(txs);
+        btc_block_destroy(block);
+        btc_invitem_destroy(item);
+
+        break;
+      }
+
+      case BTC_INV_TX:
+      case BTC_INV_WITNESS_TX:
+      case BTC_INV_WTX: {
+        const btc_mpentry_t *entry;
+
+        if (type == BTC_INV_WTX)
+          entry = btc_mempool_get_wtx(mempool, item->hash);
+        else
+          entry = btc_mempool_get(mempool, item->hash);
+
+        if (entry == NULL) {
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        if (type == BTC_INV_TX)
+          btc_peer_sendmsg(peer, BTC_MSG_TX_BASE, entry->tx);
+        else
+          btc_peer_sendmsg(peer, BTC_MSG_TX, entry->tx);
+
+        btc_invitem_destroy(item);
+
+        tx_count += 1;
+
+        break;
+      }
+
+      default: {
+        btc_inv_push(&nf, item);
+        unknown = type;
+        break;
+      }
+    }
+
+    if (send_tip) {
+      btc_peer_send_inv_1(peer, BTC_INV_BLOCK, btc_chain_tip(chain)->hash);
+      btc_hash_init(peer->hash_continue);
+    }
+
+    peer->sending.head = next;
+    peer->sending.length--;
+
+    if (peer->sending.head == NULL)
+      peer->sending.tail = NULL;
+  }
+
+  if (nf.length > 0)
+    btc_peer_send_notfound(peer, &nf);
+
+  if (blk_count > 0) {
+    btc_peer_debug(peer,
+      "Served %d blocks with getdata (notfound=%zu, cmpct=%d) (%N).",
+      blk_count, nf.length, cmpct_count, &peer->addr);
+  }
+
+  if (tx_count > 0) {
+    btc_peer_debug(peer,
+      "Served %d txs with getdata (notfound=%zu) (%N).",
+      tx_count, nf.length, &peer->addr);
+  }
+
+  if (unknown != -1) {
+    btc_peer_log(peer,
+      "Peer sent an unknown getdata type: %u (%N).",
+      (uint32_t)unknown, &peer->addr);
+  }
+
+  btc_inv_clear(&nf);
+
+  return ret;
+}
+
+static void
+btc_peer_send_data(btc_peer_t *peer, btc_invitem_t *item) {
+  if (peer->sending.head == NULL)
+    peer->sending.head = item;
+
+  if (peer->sending.tail != NULL)
+    peer->sending.tail->next = item;
+
+  peer->sending.tail = item;
+  peer->sending.length++;
+}
+
+static void
+btc_peer_clear_data(btc_peer_t *peer) {
+  btc_invitem_t *item, *next;
+
+  for (item = peer->sending.head; item != NULL; item = next) {
+    next = item->next;
+    btc_invitem_destroy(item);
+  }
+
+  peer->sending.head = NULL;
+  peer->sending.tail = NULL;
+  peer->sending.length = 0;
+}
+
+static int64_t
+btc_stall_next(int64_t next, int64_t due, int64_t now) {
+  /* Passed but not in force: look again later. */
+  if (due <= now)
+    due = now + STALL_RECHECK;
+
+  return (next == -1 || due < next) ? due : next;
+}
+
+static int64_t
+btc_peer_maybe_timeout(btc_peer_t *peer, int64_t now) {
+  /* Returns the next deadline, or -1 if we hung up. */
+  btc_chain_t *chain = peer->pool->chain;
+  int window = peer->pool->checkpoints;
+  int synced = btc_chain_synced(chain);
+  int64_t next = -1;
+  int64_t due;
+
+  if (peer->gb_time != -1 && !synced) {
+    due = peer->gb_time + 30000;
+
+    if (now >= due) {
+      btc_peer_log(peer, "Peer is stalling (inv) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return -1;
+    }
+
+    next = btc_stall_next(next, due, now);
+  }
+
+  if (peer->gh_time != -1) {
+    due = peer->gh_time + 60000;
+
+    if (now >= due) {
+      btc_peer_log(peer, "Peer is stalling (headers) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return -1;
+    }
+
+    next = btc_stall_next(next, due, now);
+  }
+
+  if (peer->syncing && peer->loader && peer->block_time != -1 && !synced) {
+    due = peer->block_time + 120000;
+
+    if (!window && now >= due) {
+      btc_peer_log(peer, "Peer is stalling (block) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return -1;
+    }
+
+    next = btc_stall_next(next, due, now);
+  }
+
+  /* The download window keeps per-peer requests
+     small enough to time each block on its own. */
+  if (synced || !peer->syncing || window) {
+    btc_hashtabiter_t tabit;
+    btc_hashmapiter_t mapit;
+
+    btc_hashtab_iterate(&tabit, peer->block_map);
+
+    while (btc_hashtab_next(&tabit)) {
+      due = tabit.val + 120000;
+
+      if (now >= due) {
+        btc_peer_log(peer, "Peer is stalling (block) (%N).", &peer->addr);
+        btc_peer_close(peer);
+        return -1;
+      }
+
+      next = btc_stall_next(next, due, now);
+    }
+
+    btc_hashmap_iterate(&mapit, peer->compact_map);
+
+    while (btc_hashmap_next(&mapit)) {
+      due = ((btc_cmpct_t *)mapit.val)->now + 30000;
+
+      if (now >= due) {
+        btc_peer_log(peer, "Peer is stalling (blocktxn) (%N).", &peer->addr);
+        btc_peer_close(peer);
+        return -1;
+      }
+
+      next = btc_stall_next(next, due, now);
+    }
+  } else if (btc_hashtab_size(peer->block_map) > 0
+          || btc_hashmap_size(peer->compact_map) > 0) {
+    next = btc_stall_next(next, now, now);
+  }
+
+  if (now >= peer->time + 60000) {
+    int mult = (peer->version <= BTC_NET_PONG_VERSION ? 4 : 1);
+
+    if (peer->last_recv == 0 || peer->last_send == 0) {
+      btc_peer_log(peer, "Peer is stalling (no message) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return -1;
+    }
+
+    if (now >= peer->last_send + 20 * 60000) {
+      btc_peer_log(peer, "Peer is stalling (send) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return -1;
+    }
+
+    if (now >= peer->last_recv + 20 * 60000 * mult) {
+      btc_peer_log(peer, "Peer is stalling (recv) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return -1;
+    }
+
+    if (peer->challenge && now >= peer->last_ping + 20 * 60000) {
+      btc_peer_log(peer, "Peer is stalling (ping) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return -1;
+    }
+
+    next = btc_stall_next(next, peer->last_send + 20 * 60000, now);
+    next = btc_stall_next(next, peer->last_recv + 20 * 60000 * mult, now);
+
+    if (peer->challenge)
+      next = btc_stall_next(next, peer->last_ping + 20 * 60000, now);
+  } else {
+    next = btc_stall_next(next, peer->time + 60000, now);
+  }
+
+  return next;
+}
+
+static void
+btc_peer_on_connect_timer(void *arg) {
+  btc_peer_t *peer = arg;
+
+  if (peer->state == BTC_PEER_DEAD || peer->state == BTC_PEER_CONNECTED)
+    return;
+
+  btc_peer_log(peer, "Peer stalled (connect) (%N).", &peer->addr);
+  btc_peer_close(peer);
+}
+
+static void
+btc_peer_on_ping_timer(void *arg) {
+  btc_peer_t *peer = arg;
+
+  if (peer->state != BTC_PEER_CONNECTED)
+    return;
+
+  btc_peer_send_ping(peer);
+
+  if (peer->state == BTC_PEER_CONNECTED)
+    btc_timer_start(peer->ping_timer, PING_INTERVAL);
+}
+
+static void
+btc_peer_on_inv_timer(void *arg) {
+  btc_peer_t *peer = arg;
+  btc_pool_t *pool = peer->pool;
+  int64_t now = btc_time_msec();
+
+  if (peer->state != BTC_PEER_CONNECTED)
+    return;
+
+  btc_peer_flush_inv(peer);
+  btc_peer_flush_txs(peer);
+  btc_peer_flush_recon(peer, now);
+  btc_peer_flush_feefilter(peer, now);
+
+  if (peer->state != BTC_PEER_CONNECTED)
+    return;
+
+  /* Inbound peers share one timer so that
+     connecting many times over doesn't give
+     a finer view of when a tx arrived. */
+  if (peer->outbound) {
+    btc_timer_at(peer->inv_timer,
+                 btc_poisson_time(now, INV_OUTBOUND_INTERVAL));
+  } else {
+    if (now >= pool->inv_timer)
+      pool->inv_timer = btc_poisson_time(now, INV_INBOUND_INTERVAL);
+
+    btc_timer_at(peer->inv_timer, pool->inv_timer);
+  }
+}
+
+static void
+btc_peer_on_stall_timer(void *arg) {
+  btc_peer_t *peer = arg;
+  int64_t next;
+
+  if (peer->state != BTC_PEER_CONNECTED)
+    return;
+
+  next = btc_peer_maybe_timeout(peer, btc_time_msec());
+
+  if (next != -1)
+    btc_timer_at(peer->stall_timer, next);
+}
+
+static void
+btc_peer_on_tick(btc_peer_t *peer) {
+  if (peer->state != BTC_PEER_CONNECTED)
+    return;
+
+  btc_peer_flush_data(peer);
+
+  if (btc_socket_buffered(peer->socket) > (30 << 20)) {
+    btc_peer_log(peer, "Peer stalled (drain) (%N).", &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+}
+
+/**
+ * Peer List
+ */
+
+static void
+btc_peers_init(btc_peers_t *list) {
+  list->map = btc_netmap_create(); /* addr->peer */
+  list->ids = btc_intmap_create(); /* id->peer */
+  list->head = NULL;
+  list->tail = NULL;
+  list->load = NULL;
+  list->inbound = 0;
+  list->outbound = 0;
+  list->block_relay = 0;
+  list->length = 0;
+}
+
+static void
+btc_peers_clear(btc_peers_t *list) {
+  btc_netmap_destroy(list->map);
+  btc_intmap_destroy(list->ids);
+}
+
+static void
+btc_peers_add(btc_peers_t *list, btc_peer_t *peer) {
+  CHECK(btc_netmap_put(list->map, &peer->addr, peer));
+  CHECK(btc_intmap_put(list->ids, peer->id, peer));
+
+  btc_list_push(list, peer, btc_peer_t);
+
+  if (peer->outbound)
+    list->outbound += 1;
+  else
+    list->inbound += 1;
+
+  if (peer->block_relay)
+    list->block_relay += 1;
+
+  btc_socket_complete(peer->socket);
+}
+
+static void
+btc_peers_remove(btc_peers_t *list, btc_peer_t *peer) {
+  CHECK(btc_netmap_del(list->map, &peer->addr) == &peer->addr);
+  CHECK(btc_intmap_del(list->ids, peer->id) == peer->id);
+
+  btc_list_remove(list, peer, btc_peer_t);
+
+  if (peer == list->load) {
+    CHECK(peer->loader == 1);
+    peer->loader = 0;
+    list->load = NULL;
+  }
+
+  if (peer->outbound)
+    list->outbound -= 1;
+  else
+    list->inbound -= 1;
+
+  if (peer->block_relay)
+    list->block_relay -= 1;
+}
+
+static int
+btc_peers_has(btc_peers_t *list, const btc_netaddr_t *addr) {
+  return btc_netmap_has(list->map, addr);
+}
+
+static btc_peer_t *
+btc_peers_get(btc_peers_t *list, const btc_netaddr_t *addr) {
+  return btc_netmap_get(list->map, addr);
+}
+
+static btc_peer_t *
+btc_peers_find(btc_peers_t *list, uint32_t id) {
+  return btc_intmap_get(list->ids, id);
+}
+
+static void
+btc_peers_close(btc_peers_t *list) {
+  btc_peer_t *peer, *next;
+
+  for (peer = list->head; peer != NULL; peer = next) {
+    next = peer->next;
+    btc_peer_close(peer);
+  }
+}
+
+/*
+ * Header Entry
+ */
+
+static btc_hdrnode_t *
+btc_hdrnode_create(const uint8_t *hash, int32_t height) {
+  btc_hdrnode_t *node = (btc_hdrnode_t *)btc_malloc(sizeof(btc_hdrnode_t));
+
+  btc_hash_copy(node->hash, hash);
+
+  node->height = height;
+  node->next = NULL;
+
+  return node;
+}
+
+static void
+btc_hdrnode_destroy(btc_hdrnode_t *node) {
+  btc_free(node);
+}
+
+/*
+ * Pending Block
+ */
+
+/* Blocks inside the download window can arrive
+ * in any order. The chain only keeps a handful
+ * of orphans, so out-of-order blocks are held
+ * here (keyed by their previous hash) until the
+ * tip reaches them.
+ */
+
+static btc_pendblock_t *
+btc_pendblock_create(const btc_block_t *block,
+                     unsigned int flags,
+                     unsigned int id) {
+  btc_pendblock_t *item =
+    (btc_pendblock_t *)btc_malloc(sizeof(btc_pendblock_t));
+
+  item->block = btc_block_refconst(block);
+  item->flags = flags;
+  item->id = id;
+
+  return item;
+}
+
+static void
+btc_pendblock_destroy(btc_pendblock_t *item) {
+  btc_block_destroy(item->block);
+  btc_free(item);
+}
+
+/*
+ * Header Range
+ */
+
+/* The headers between two checkpoints can be fetched
+ * and checked without anything before them. While the
+ * loader works through the current checkpoint, other
+ * outbound peers fill the ranges after it. Each range
+ * is spliced onto the header chain once the blocks
+ * reach its start.
+ */
+
+static btc_hdrrange_t *
+btc_hdrrange_create(const btc_checkpoint_t *start,
+                    const btc_checkpoint_t *stop) {
+  btc_hdrrange_t *range = (btc_hdrrange_t *)btc_malloc(sizeof(*range));
+
+  range->start = start;
+  range->stop = stop;
+  range->head = NULL;
+  range->tail = NULL;
+  range->peer = NULL;
+  range->complete = 0;
+  range->next = NULL;
+
+  return range;
+}
+
+static void
+btc_hdrrange_release(btc_hdrrange_t *range) {
+  if (range->peer != NULL) {
+    range->peer->range = NULL;
+    range->peer = NULL;
+  }
+}
+
+static void
+btc_hdrrange_reset(btc_hdrrange_t *range) {
+  btc_hdrnode_t *node, *next;
+
+  for (node = range->head; node != NULL; node = next) {
+    next = node->next;
+    btc_hdrnode_destroy(node);
+  }
+
+  range->head = NULL;
+  range->tail = NULL;
+  range->complete = 0;
+}
+
+static void
+btc_hdrrange_destroy(btc_hdrrange_t *range) {
+  btc_hdrrange_release(range);
+  btc_hdrrange_reset(range);
+  btc_free(range);
+}
+
+/*
+ * Pool
+ */
+
+btc_pool_t *
+btc_pool_create(const btc_network_t *network,
+                btc_loop_t *loop,
+                btc_chain_t *chain,
+                btc_mempool_t *mempool) {
+  btc_pool_t *pool = (btc_pool_t *)btc_malloc(sizeof(btc_pool_t));
+
+  memset(pool, 0, sizeof(*pool));
+
+  pool->network = network;
+  pool->loop = loop;
+  pool->logger = NULL;
+  pool->timedata = NULL;
+  pool->addrman = btc_addrman_create(network);
+  pool->chain = chain;
+  pool->mempool = mempool;
+  pool->filterdb = NULL;
+  pool->flags = BTC_POOL_DEFAULT_FLAGS;
+  pool->services = BTC_NET_LOCAL_SERVICES;
+  pool->port = network->port;
+  btc_sockaddr_import(&pool->bind, "::", 0);
+  btc_netaddr_set(&pool->connect, "0.0.0.0", 0);
+  btc_sockaddr_import(&pool->proxy, "0.0.0.0", 0);
+  pool->max_inbound = 128;
+  pool->max_outbound = 8;
+  btc_getrandom(pool->group_key, 16);
+  pool->only_net = BTC_IPNET_NONE;
+  pool->v2 = 0;
+  pool->server = NULL;
+  pool->relay = NULL;
+  pool->relay_port = 0;
+  pool->relay_length = 0;
+  pool->relay_index = 0;
+  btc_peers_init(&pool->peers);
+  btc_nonces_init(&pool->nonces);
+  pool->block_map = btc_hashset_create();
+  pool->tx_map = btc_hashmap_create();
+  pool->tx_timer = 0;
+  pool->compact_map = btc_hashset_create();
+  btc_txqueue_init(&pool->tx_queue);
+  btc_blockcache_init(&pool->block_cache);
+  btc_hdrarray_init(&pool->header_array);
+  pool->block_mode = 0;
+  pool->checkpoints = 0;
+  pool->headers_file[0] = '\0';
+  pool->capture_file[0] = '\0';
+  pool->capture = NULL;
+  pool->header_tip = NULL;
+  pool->header_head = NULL;
+  pool->header_tail = NULL;
+  btc_queue_init(&pool->header_ranges);
+  pool->block_pending = btc_hashmap_create();
+  pool->block_buffer = 0;
+  pool->block_buffer_max = BLOCK_BUFFER_SIZE;
+  pool->block_avg = -1;
+  pool->window_full = 0;
+  pool->window_throttled = 0;
+  pool->stall_timeout = MIN_STALL_TIMEOUT;
+  pool->stall_time = -1;
+  pool->stall_id = 0;
+  pool->stall_height = -1;
+  pool->workers = NULL;
+  pool->frame_lock = btc_mutex_create();
+  pool->threads = 0;
+  pool->refill_timer = 0;
+  pool->window_timer = 0;
+  pool->inv_timer = 0;
+  pool->flush_timer = 0;
+  pool->rotate_timer = 0;
+  pool->id = 0;
+  pool->required_services = BTC_NET_LOCAL_SERVICES;
+  pool->bytes_sent = 0;
+  pool->bytes_recv = 0;
+  pool->upload_target = 0;
+  pool->cycle_sent = 0;
+  pool->cycle_start = 0;
+  pool->synced = 0;
+
+  return pool;
+}
+
+void
+btc_pool_destroy(btc_pool_t *pool) {
+  btc_addrman_destroy(pool->addrman);
+  btc_peers_clear(&pool->peers);
+  btc_nonces_clear(&pool->nonces);
+  btc_hashset_destroy(pool->block_map);
+  btc_pool_clear_txs(pool);
+  btc_hashmap_destroy(pool->tx_map);
+  btc_hashset_destroy(pool->compact_map);
+  btc_txqueue_clear(&pool->tx_queue);
+  btc_hashmap_destroy(pool->block_pending);
+  btc_blockcache_clear(&pool->block_cache);
+  btc_hdrarray_clear(&pool->header_array);
+  btc_pool_reset_relay(pool);
+  btc_mutex_destroy(pool->frame_lock);
+  btc_free(pool);
+}
+
+void
+btc_pool_set_logger(btc_pool_t *pool, btc_logger_t *logger) {
+  pool->logger = logger;
+  btc_addrman_set_logger(pool->addrman, logger);
+}
+
+void
+btc_pool_set_timedata(btc_pool_t *pool, btc_timedata_t *td) {
+  pool->timedata = td;
+  btc_addrman_set_timedata(pool->addrman, td);
+}
+
+void
+btc_pool_set_perf(btc_pool_t *pool, btc_perf_t *perf) {
+  pool->perf = perf;
+}
+
+void
+btc_pool_set_filterdb(btc_pool_t *pool, btc_filterdb_t *filterdb) {
+  pool->filterdb = filterdb;
+}
+
+void
+btc_pool_set_threads(btc_pool_t *pool, int threads) {
+  if (threads < 0)
+    threads = 0;
+
+  if (threads > 16)
+    threads = 16;
+
+  pool->threads = threads;
+}
+
+void
+btc_pool_set_port(btc_pool_t *pool, int port) {
+  CHECK(port > 0 && port <= 0xffff);
+  pool->port = port;
+}
+
+void
+btc_pool_set_bind(btc_pool_t *pool, const btc_netaddr_t *addr) {
+  btc_netaddr_get_sockaddr(&pool->bind, addr);
+
+  if (!btc_netaddr_is_null(addr))
+    btc_addrman_add_local(pool->addrman, addr, BTC_SCORE_BIND);
+}
+
+void
+btc_pool_set_external(btc_pool_t *pool, const btc_netaddr_t *addr) {
+  if (!btc_netaddr_is_null(addr))
+    btc_addrman_add_local(pool->addrman, addr, BTC_SCORE_MANUAL);
+}
+
+void
+btc_pool_set_connect(btc_pool_t *pool, const btc_netaddr_t *addr) {
+  btc_netaddr_copy(&pool->connect, addr);
+}
+
+void
+btc_pool_set_proxy(btc_pool_t *pool, const btc_netaddr_t *addr) {
+  btc_netaddr_get_sockaddr(&pool->proxy, addr);
+  btc_addrman_set_proxy(pool->addrman, addr);
+}
+
+void
+btc_pool_set_maxinbound(btc_pool_t *pool, size_t max_inbound) {
+  pool->max_inbound = max_inbound;
+}
+
+void
+btc_pool_set_maxoutbound(btc_pool_t *pool, size_t max_outbound) {
+  pool->max_outbound = max_outbound;
+}
+
+void
+btc_pool_set_bantime(btc_pool_t *pool, int64_t ban_time) {
+  btc_addrman_set_bantime(pool->addrman, ban_time);
+}
+
+void
+btc_pool_set_uploadtarget(btc_pool_t *pool, uint64_t target) {
+  pool->upload_target = target;
+}
+
+void
+btc_pool_set_blockbuffer(btc_pool_t *pool, size_t size) {
+  pool->block_buffer_max = size;
+}
+
+void
+btc_pool_set_onlynet(btc_pool_t *pool, enum btc_ipnet only_net) {
+  pool->only_net = only_net;
+}
+
+void
+btc_pool_set_v2(btc_pool_t *pool, int enable) {
+  pool->v2 = enable;
+}
+
+void
+btc_pool_set_relay(btc_pool_t *pool, int port) {
+  CHECK(port >= 0 && port <= 0xffff);
+  pool->relay_port = port;
+}
+
+void
+btc_pool_add_relay(btc_pool_t *pool, const btc_netaddr_t *addr) {
+  if (pool->relay_length == RELAY_MAX_PEERS)
+    return;
+
+  btc_netaddr_copy(&pool->relay_peers[pool->relay_length++], addr);
+}
+
+void
+btc_pool_set_headers(btc_pool_t *pool, const char *path) {
+  size_t len;
+
+  if (path == NULL)
+    path = "";
+
+  len = strlen(path);
+
+  CHECK(len < sizeof(pool->headers_file));
+
+  memcpy(pool->headers_file, path, len + 1);
+}
+
+void
+btc_pool_set_capture(btc_pool_t *pool, const char *path) {
+  size_t len;
+
+  if (path == NULL)
+    path = "";
+
+  len = strlen(path);
+
+  CHECK(len < sizeof(pool->capture_file));
+
+  memcpy(pool->capture_file, path, len + 1);
+}
+
+static void
+btc_pool_log(btc_pool_t *pool, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_write(pool->logger, "pool", fmt, ap);
+  va_end(ap);
+}
+
+static void
+btc_pool_debug(btc_pool_t *pool, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_log(pool->logger, BTC_LOG_DEBUG, "pool", fmt, ap);
+  va_end(ap);
+}
+
+static int
+btc_pool_listen(btc_pool_t *pool) {
+  btc_sockaddr_t addr = pool->bind;
+  btc_socket_t *server;
+
+  if (addr.port == 0)
+    addr.port = pool->port;
+
+  server = btc_loop_listen(pool->loop, &addr);
+
+  if (server == NULL) {
+    const char *msg = btc_loop_strerror(pool->loop);
+
+    btc_pool_log(pool, "Could not listen on %S: %s.", &addr, msg);
+
+    return 0;
+  }
+
+  btc_socket_set_data(server, pool);
+  btc_socket_on_socket(server, on_server_socket);
+  btc_socket_on_close(server, on_server_close);
+
+  pool->server = server;
+
+  btc_pool_log(pool, "Listening on %S.", &addr);
+
+  return 1;
+}
+
+static int
+btc_pool_bind_relay(btc_pool_t *pool) {
+  btc_sockaddr_t addr = pool->bind;
+  btc_socket_t *relay;
+
+  addr.port = pool->relay_port;
+
+  relay = btc_loop_bind(pool->loop, &addr);
+
+  if (relay == NULL) {
+    const char *msg = btc_loop_strerror(pool->loop);
+
+    btc_pool_log(pool, "Could not bind relay to %S: %s.", &addr, msg);
+
+    return 0;
+  }
+
+  btc_socket_set_data(relay, pool);
+  btc_socket_on_message(relay, on_relay_message);
+  btc_socket_on_error(relay, on_relay_error);
+  btc_socket_on_close(relay, on_relay_close);
+
+  pool->relay = relay;
+
+  btc_pool_log(pool, "Relaying blocks on %S to %zu peers.",
+                     &addr, pool->relay_length);
+
+  return 1;
+}
+
+static void
+btc_pool_discover_local(btc_pool_t *pool) {
+  btc_sockaddr_t *res, *it;
+  btc_netaddr_t addr;
+
+  btc_pool_log(pool, "Looking up local addresses...");
+
+  if (btc_getifaddrs(&res)) {
+    int total = 0;
+
+    for (it = res; it != NULL; it = it->next) {
+      btc_netaddr_set_sockaddr(&addr, it);
+
+      addr.port = pool->port;
+
+      btc_pool_log(pool, "Local address found: %N.", &addr);
+
+      btc_addrman_add_local(pool->addrman, &addr, BTC_SCORE_IF);
+
+      total += 1;
+    }
+
+    btc_pool_log(pool, "Found %d local addresses.", total);
+
+    btc_freeifaddrs(res);
+  } else {
+    btc_pool_log(pool, "Local addresses not found.");
+  }
+}
+
+static void
+btc_pool_discover_external(btc_pool_t *pool) {
+  btc_sockaddr_t sa;
+  btc_netaddr_t na;
+
+  btc_pool_log(pool, "Looking up IPv4 address...");
+
+  if (btc_net_external(&sa, BTC_AF_INET, pool->port)) {
+    btc_pool_log(pool, "IPv4 address found: %S.", &sa);
+    btc_netaddr_set_sockaddr(&na, &sa);
+    btc_addrman_add_local(pool->addrman, &na, BTC_SCORE_DNS);
+  } else {
+    btc_pool_log(pool, "IPv4 address not found.");
+  }
+
+  btc_pool_log(pool, "Looking up IPv6 address...");
+
+  if (btc_net_external(&sa, BTC_AF_INET6, pool->port)) {
+    btc_pool_log(pool, "IPv6 address found: %S.", &sa);
+    btc_netaddr_set_sockaddr(&na, &sa);
+    btc_addrman_add_local(pool->addrman, &na, BTC_SCORE_DNS);
+  } else {
+    btc_pool_log(pool, "IPv6 address not found.");
+  }
+}
+
+static const btc_checkpoint_t *
+btc_pool_next_tip(btc_pool_t *pool, int32_t height) {
+  const btc_network_t *network = pool->network;
+  const btc_checkpoint_t *chk;
+  size_t i;
+
+  for (i = 0; i < network->checkpoints.length; i++) {
+    chk = &network->checkpoints.items[i];
+
+    if (chk->height > height)
+      return chk;
+  }
+
+  btc_abort(); /* LCOV_EXCL_LINE */
+
+  return NULL; /* LCOV_EXCL_LINE */
+}
+
+static void
+btc_pool_clear_chain(btc_pool_t *pool) {
+  btc_hdrnode_t *node, *next;
+  btc_hashmapiter_t iter;
+
+  for (node = pool->header_head; node != NULL; node = next) {
+    next = node->next;
+    btc_hdrnode_destroy(node);
+  }
+
+  btc_hashmap_iterate(&iter, pool->block_pending);
+
+  while (btc_hashmap_next(&iter))
+    btc_pendblock_destroy(iter.val);
+
+  btc_hashmap_reset(pool->block_pending);
+
+  pool->block_buffer = 0;
+  pool->checkpoints = 0;
+  pool->header_tip = NULL;
+  pool->header_head = NULL;
+  pool->header_tail = NULL;
+  pool->window_full = 0;
+  pool->stall_time = -1;
+}
+
+static void
+btc_pool_clear_ranges(btc_pool_t *pool) {
+  btc_hdrrange_t *range;
+
+  while (pool->header_ranges.head != NULL) {
+    range = pool->header_ranges.head;
+    btc_queue_shift(&pool->header_ranges);
+    btc_hdrrange_destroy(range);
+  }
+}
+
+static void
+btc_pool_fill_ranges(btc_pool_t *pool) {
+  const btc_network_t *network = pool->network;
+  btc_hdrranges_t *ranges = &pool->header_ranges;
+  const btc_checkpoint_t *last;
+  btc_hdrrange_t *range;
+
+  if (!pool->checkpoints)
+    return;
+
+  /* Ranges the header chain has moved past. */
+  while (ranges->head != NULL) {
+    range = ranges->head;
+
+    if (range->start->height >= pool->header_tip->height)
+      break;
+
+    btc_queue_shift(ranges);
+    btc_hdrrange_destroy(range);
+  }
+
+  last = ranges->tail != NULL ? ranges->tail->stop : pool->header_tip;
+
+  while (ranges->length < MAX_HEADER_RANGES) {
+    if (last->height >= network->last_checkpoint)
+      break;
+
+    range = btc_hdrrange_create(last, btc_pool_next_tip(pool, last->height));
+
+    btc_queue_push(ranges, range);
+
+    last = range->stop;
+  }
+}
+
+static void
+btc_pool_request_range(btc_pool_t *pool,
+                       btc_peer_t *peer,
+                       btc_hdrrange_t *range) {
+  const uint8_t *hash = range->start->hash;
+
+  if (range->tail != NULL)
+    hash = range->tail->hash;
+
+  btc_pool_log(pool, "Requesting headers %d-%d (%N).",
+                     range->start->height,
+                     range->stop->height,
+                     &peer->addr);
+
+  range->peer = peer;
+  peer->range = range;
+
+  btc_peer_send_getheaders_1(peer, hash, range->stop->hash);
+}
+
+static void
+btc_pool_assign_ranges(btc_pool_t *pool) {
+  btc_hdrrange_t *range;
+  btc_peer_t *peer;
+
+  if (!pool->checkpoints)
+    return;
+
+  for (range = pool->header_ranges.head; range != NULL; range = range->next) {
+    if (range->complete || range->peer != NULL)
+      continue;
+
+    for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+      if (peer->state != BTC_PEER_CONNECTED)
+        continue;
+
+      if (!peer->outbound || peer->loader || peer->range != NULL)
+        continue;
+
+      if ((peer->services & pool->required_services)
+          != pool->required_services) {
+        continue;
+      }
+
+      if (peer->height < range->stop->height)
+        continue;
+
+      break;
+    }
+
+    if (peer == NULL)
+      break;
+
+    btc_pool_request_range(pool, peer, range);
+  }
+}
+
+static const btc_checkpoint_t *
+btc_pool_load_headers(btc_pool_t *pool, const btc_entry_t *tip) {
+  /* A trusted headers file is a flat run of 80 byte
+     headers starting at genesis. Rather than pulling
+     the checkpointed part of the header chain from the
+     network, link it here in one hashing pass. Each
+     checkpoint along the way must match, and anything
+     past the last one we hit is thrown away. */
+  const btc_network_t *network = pool->network;
+  const btc_checkpoint_t *chk = NULL;
+  const btc_checkpoint_t *next;
+  btc_hdrnode_t *head = NULL;
+  btc_hdrnode_t *tail = NULL;
+  btc_hdrnode_t *node;
+  const uint8_t *xp;
+  uint8_t hash[32];
+  uint8_t *data;
+  int32_t height;
+  int32_t count;
+  size_t len;
+
+  if (!btc_fs_alloc_file(&data, &len, pool->headers_file)) {
+    btc_pool_log(pool, "Could not read headers file %s.",
+                       pool->headers_file);
+    return NULL;
+  }
+
+  if (len % 80 != 0 || len / 80 > INT32_MAX) {
+    btc_pool_log(pool, "Headers file %s is malformed.", pool->headers_file);
+    goto fail;
+  }
+
+  count = len / 80;
+
+  if (tip->height >= count)
+    goto fail;
+
+  xp = data + (size_t)tip->height * 80;
+
+  btc_hash256(hash, xp, 80);
+
+  if (!btc_hash_equal(hash, tip->hash)) {
+    btc_pool_log(pool, "Headers file %s does not match our chain.",
+                       pool->headers_file);
+    goto fail;
+  }
+
+  next = btc_pool_next_tip(pool, tip->height);
+
+  for (height = tip->height + 1; height < count; height++) {
+    xp += 80;
+
+    /* prev_block sits right after the version. */
+    if (!btc_hash_equal(xp + 4, hash))
+      goto bad;
+
+    btc_hash256(hash, xp, 80);
+
+    node = btc_hdrnode_create(hash, height);
+
+    if (tail == NULL)
+      head = node;
+    else
+      tail->next = node;
+
+    tail = node;
+
+    if (height == next->height) {
+      if (!btc_hash_equal(hash, next->hash))
+        goto bad;
+
+      chk = next;
+
+      if (chk->height >= network->last_checkpoint)
+        break;
+
+      next = btc_pool_next_tip(pool, chk->height);
+    }
+  }
+
+  btc_free(data);
+
+  if (chk == NULL) {
+    for (node = head; node != NULL; node = tail) {
+      tail = node->next;
+      btc_hdrnode_destroy(node);
+    }
+    return NULL;
+  }
+
+  /* Trim back to the checkpoint. */
+  node = head;
+
+  while (node->height != chk->height)
+    node = node->next;
+
+  tail = node->next;
+  node->next = NULL;
+
+  while (tail != NULL) {
+    node = tail->next;
+    btc_hdrnode_destroy(tail);
+    tail = node;
+  }
+
+  pool->header_tail->next = head;
+
+  while (pool->header_tail->next != NULL)
+    pool->header_tail = pool->header_tail->next;
+
+  btc_pool_log(pool, "Loaded %d trusted headers from %s.",
+                     chk->height - tip->height, pool->headers_file);
+
+  return chk;
+bad:
+  btc_pool_log(pool, "Headers file %s has a bad chain at height %d.",
+                     pool->headers_file, height);
+
+  for (node = head; node != NULL; node = tail) {
+    tail = node->next;
+    btc_hdrnode_destroy(node);
+  }
+fail:
+  btc_free(data);
+  return NULL;
+}
+
+static void
+btc_pool_reset_chain(btc_pool_t *pool) {
+  const btc_network_t *network = pool->network;
+  const btc_entry_t *tip;
+
+  if (!(pool->flags & BTC_POOL_CHECKPOINTS))
+    return;
+
+  if (network->checkpoints.length == 0)
+    return;
+
+  btc_pool_clear_chain(pool);
+
+  tip = btc_chain_tip(pool->chain);
+
+  if (tip->height < network->last_checkpoint) {
+    pool->checkpoints = 1;
+    pool->header_tip = btc_pool_next_tip(pool, tip->height);
+    pool->header_head = btc_hdrnode_create(tip->hash, tip->height);
+    pool->header_tail = pool->header_head;
+
+    if (pool->headers_file[0] != '\0') {
+      const btc_checkpoint_t *chk = btc_pool_load_headers(pool, tip);
+
+      if (chk != NULL)
+        pool->header_tip = chk;
+    }
+
+    btc_pool_log(pool,
+      "Initialized header chain to height %d (checkpoint=%H).",
+      tip->height, pool->header_tip->hash);
+
+    btc_pool_fill_ranges(pool);
+    btc_pool_assign_ranges(pool);
+  } else {
+    btc_pool_clear_ranges(pool);
+  }
+}
+
+int
+btc_pool_load(btc_pool_t *pool, const char *prefix, unsigned int flags) {
+  char file[BTC_PATH_MAX];
+
+  /* Reads peers.dat (or starts the DNS seed lookups).
+     Nothing here depends on the chain, so the node can
+     do this while the block index is still loading. */
+  if (pool->loaded)
+    return 1;
+
+  if (!btc_path_resolve(file, sizeof(file), prefix, "peers.dat", 0))
+    return 0;
+
+  if (!btc_addrman_open(pool->addrman, file, flags))
+    return 0;
+
+  pool->loaded = 1;
+
+  return 1;
+}
+
+void
+btc_pool_unload(btc_pool_t *pool) {
+  if (pool->loaded) {
+    btc_addrman_close(pool->addrman);
+    pool->loaded = 0;
+  }
+}
+
+static void
+btc_pool_start_capture(btc_pool_t *pool) {
+  uint8_t hdr[8];
+  FILE *stream;
+
+  stream = fopen(pool->capture_file, "wb");
+
+  if (stream == NULL) {
+    btc_pool_log(pool, "Could not open capture file %s.",
+                       pool->capture_file);
+    return;
+  }
+
+  /* Peers come and go faster than we want to write. */
+  setvbuf(stream, NULL, _IOFBF, 1 << 20);
+
+  btc_write32le(hdr + 0, BTC_CAPTURE_MAGIC);
+  btc_write32le(hdr + 4, pool->network->magic);
+
+  if (fwrite(hdr, 1, sizeof(hdr), stream) != sizeof(hdr)) {
+    fclose(stream);
+    return;
+  }
+
+  btc_pool_log(pool, "Capturing traffic to %s.", pool->capture_file);
+
+  pool->capture = stream;
+}
+
+static void
+btc_pool_stop_capture(btc_pool_t *pool) {
+  if (pool->capture != NULL) {
+    fclose(pool->capture);
+    pool->capture = NULL;
+  }
+}
+
+int
+btc_pool_open(btc_pool_t *pool, const char *prefix, unsigned int flags) {
+  pool->flags = flags;
+  pool->services = BTC_NET_LOCAL_SERVICES | BTC_NET_SERVICE_NETWORK_LIMITED;
+
+  /* A pruned node has only the recent blocks (BIP159). */
+  if (btc_chain_pruned(pool->chain))
+    pool->services &= ~BTC_NET_SERVICE_NETWORK;
+
+  if (pool->flags & BTC_POOL_BIP37)
+    pool->services |= BTC_NET_SERVICE_BLOOM;
+
+  if (pool->flags & BTC_POOL_BIP157) {
+    if (pool->filterdb != NULL && btc_filterdb_enabled(pool->filterdb))
+      pool->services |= BTC_NET_SERVICE_COMPACT_FILTERS;
+  }
+
+  if (pool->v2)
+    pool->services |= BTC_NET_SERVICE_P2P_V2;
+
+  btc_pool_log(pool, "Opening pool.");
+
+  if (!btc_pool_load(pool, prefix, flags))
+    return 0;
+
+  if (pool->flags & BTC_POOL_LISTEN) {
+    if (!btc_pool_listen(pool)) {
+      btc_pool_unload(pool);
+      return 0;
+    }
+
+    if (pool->flags & BTC_POOL_DISCOVER) {
+      btc_pool_discover_local(pool);
+      btc_pool_discover_external(pool);
+    }
+  }
+
+  if (pool->relay_port != 0) {
+    if (!btc_pool_bind_relay(pool)) {
+      if (pool->server != NULL)
+        btc_socket_close(pool->server);
+
+      btc_pool_unload(pool);
+
+      return 0;
+    }
+  }
+
+  pool->synced = btc_chain_synced(pool->chain);
+
+  btc_pool_reset_chain(pool);
+
+  if (pool->capture_file[0] != '\0')
+    btc_pool_start_capture(pool);
+
+  if (pool->threads > 0) {
+    pool->workers = btc_workers_create(pool->threads, 1);
+    btc_workers_notify(pool->workers, pool->loop);
+  }
+
+  btc_loop_on_tick(pool->loop, on_tick, pool);
+
+  return 1;
+}
+
+void
+btc_pool_close(btc_pool_t *pool) {
+  btc_pool_log(pool, "Closing pool.");
+
+  btc_loop_off_tick(pool->loop, on_tick, pool);
+
+  if (pool->server != NULL)
+    btc_socket_close(pool->server);
+
+  if (pool->relay != NULL)
+    btc_socket_close(pool->relay);
+
+  btc_peers_close(&pool->peers);
+  btc_pool_clear_chain(pool);
+  btc_pool_clear_ranges(pool);
+  btc_blockcache_clear(&pool->block_cache);
+  btc_hdrarray_clear(&pool->header_array);
+  btc_pool_reset_relay(pool);
+  btc_pool_unload(pool);
+  btc_pool_stop_capture(pool);
+
+  if (pool->workers != NULL) {
+    btc_workers_wait(pool->workers);
+    btc_workers_destroy(pool->workers);
+    pool->workers = NULL;
+  }
+}
+
+size_t
+btc_pool_peerinfo(btc_pool_t *pool, btc_peerinfo_t **out) {
+  btc_peerinfo_t *items = NULL;
+  btc_peer_t *peer;
+  size_t i = 0;
+
+  if (pool->peers.length > 0)
+    items = btc_malloc(pool->peers.length * sizeof(btc_peerinfo_t));
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    btc_peerinfo_t *info = &items[i++];
+
+    info->id = peer->id;
+    info->addr = peer->addr;
+    info->local = peer->local;
+    info->inbound = !peer->outbound;
+    info->block_relay = peer->block_relay;
+    info->connected = (peer->state == BTC_PEER_CONNECTED);
+    info->services = peer->services;
+    info->version = peer->version;
+    info->height = peer->height;
+    info->time = peer->time;
+    info->last_send = peer->last_send;
+    info->last_recv = peer->last_recv;
+    info->min_ping = peer->min_ping;
+    info->addr_processed = peer->addr_processed;
+    info->addr_rate_limited = peer->addr_dropped;
+    info->ban_score = peer->ban_score;
+    info->bytes_sent = peer->bytes_sent;
+    info->bytes_recv = peer->bytes_recv;
+
+    memcpy(info->agent, peer->agent, sizeof(info->agent));
+    memcpy(info->sent, peer->sent, sizeof(info->sent));
+    memcpy(info->recv, peer->recv, sizeof(info->recv));
+  }
+
+  CHECK(i == pool->peers.length);
+
+  *out = items;
+
+  return i;
+}
+
+void
+btc_pool_nettotals(btc_pool_t *pool, btc_nettotals_t *out) {
+  int64_t now = btc_now();
+  btc_peer_t *peer;
+  size_t i;
+
+  btc_pool_update_cycle(pool, now);
+
+  out->bytes_sent = pool->bytes_sent;
+  out->bytes_recv = pool->bytes_recv;
+  out->target = pool->upload_target;
+  out->timeframe = UPLOAD_TIMEFRAME;
+  out->cycle_sent = pool->cycle_sent;
+  out->time_left = pool->cycle_start + UPLOAD_TIMEFRAME - now;
+  out->target_reached = btc_pool_upload_exhausted(pool, 0);
+  out->serve_historical = !btc_pool_upload_exhausted(pool, 1);
+  out->inbound = 0;
+  out->outbound = 0;
+  out->decoding = 0;
+  out->send_queue = 0;
+  out->recv_buffer = 0;
+
+  if (pool->workers != NULL)
+    out->decoding = btc_workers_backlog(pool->workers);
+
+  out->block_buffer = pool->block_buffer;
+  out->block_buffer_max = pool->block_buffer_max;
+  out->blocks_inflight = btc_hashset_size(pool->block_map);
+  out->blocks_held = btc_hashmap_size(pool->block_pending);
+  out->throttled = pool->window_throttled;
+
+  memcpy(out->sent, pool->sent, sizeof(out->sent));
+  memcpy(out->recv, pool->recv, sizeof(out->recv));
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (peer->outbound)
+      out->outbound++;
+    else
+      out->inbound++;
+
+    out->send_queue += btc_socket_buffered(peer->socket);
+    out->recv_buffer += peer->parser.alloc;
+
+    for (i = 0; i < BTC_NETSTAT_TYPES; i++) {
+      out->sent[i].bytes += peer->sent[i].bytes;
+      out->sent[i].msgs += peer->sent[i].msgs;
+      out->recv[i].bytes += peer->recv[i].bytes;
+      out->recv[i].msgs += peer->recv[i].msgs;
+      out->recv[i].time += peer->recv[i].time;
+    }
+  }
+}
+
+static const btc_netaddr_t *
+btc_pool_get_addr(btc_pool_t *pool) {
+  int64_t now = btc_timedata_now(pool->timedata);
+  const btc_addrent_t *entry;
+  const btc_netaddr_t *addr;
+  int i;
+
+  if (pool->flags & BTC_POOL_CONNECT) {
+    if (btc_peers_has(&pool->peers, &pool->connect))
+      return NULL;
+
+    return &pool->connect;
+  }
+
+  for (i = 0; i < 100; i++) {
+    entry = btc_addrman_get(pool->addrman);
+
+    if (entry == NULL)
+      break;
+
+    addr = &entry->addr;
+
+    if (btc_peers_has(&pool->peers, addr))
+      continue;
+
+    if (btc_addrman_has_local(pool->addrman, addr))
+      continue;
+
+    if (btc_addrman_is_banned(pool->addrman, addr))
+      continue;
+
+    if (!btc_netaddr_is_valid(addr))
+      continue;
+
+    if (!btc_pool_has_services(pool, addr->services))
+      continue;
+
+    /* Leave the archival nodes to those still syncing. */
+    if (i < 20 && (addr->services & BTC_NET_SERVICE_NETWORK)) {
+      if (btc_chain_synced(pool->chain))
+        continue;
+    }
+
+    if (!(pool->flags & BTC_POOL_ONION)) {
+      if (btc_netaddr_is_onion(addr))
+        continue;
+    }
+
+    if (i < 30 && now - entry->last_attempt < 600)
+      continue;
+
+    if (i < 50 && addr->port != pool->network->port)
+      continue;
+
+    if (pool->only_net != BTC_IPNET_NONE) {
+      if (btc_netaddr_network(addr) != pool->only_net)
+        continue;
+    }
+
+    return addr;
+  }
+
+  return NULL;
+}
+
+static void
+btc_pool_ban(btc_pool_t *pool, const btc_netaddr_t *addr) {
+  btc_peer_t *peer = btc_peers_get(&pool->peers, addr);
+
+  btc_pool_log(pool, "Banning peer (%N).", addr);
+
+  btc_addrman_ban(pool->addrman, addr);
+  btc_addrman_remove(pool->addrman, addr);
+
+  if (peer != NULL)
+    btc_peer_close(peer);
+}
+
+static int
+btc_pool_use_v2(btc_pool_t *pool, const btc_netaddr_t *addr) {
+  if (!pool->v2)
+    return 0;
+
+  /* Manual peers get a try; we fall back if refused. */
+  if (pool->flags & BTC_POOL_CONNECT)
+    return 1;
+
+  return (addr->services & BTC_NET_SERVICE_P2P_V2) != 0;
+}
+
+static btc_peer_t *
+btc_pool_open_outbound(btc_pool_t *pool,
+                       const btc_netaddr_t *addr,
+                       int block_relay,
+                       int v2) {
+  btc_peer_t *peer = btc_peer_create(pool, block_relay);
+
+  btc_addrman_mark_attempt(pool->addrman, addr);
+
+  btc_pool_log(pool, "Connecting to %N%s.", addr, v2 ? " (v2)" : "");
+
+  if (!btc_peer_open(peer, addr, v2)) {
+    const char *msg = btc_loop_strerror(pool->loop);
+
+    btc_pool_log(pool, "Connection failed: %s (%N).", msg, addr);
+    btc_peer_destroy(peer);
+
+    return NULL;
+  }
+
+  return peer;
+}
+
+static btc_peer_t *
+btc_pool_create_outbound(btc_pool_t *pool,
+                         const btc_netaddr_t *addr,
+                         int block_relay) {
+  int v2 = btc_pool_use_v2(pool, addr);
+
+  return btc_pool_open_outbound(pool, addr, block_relay, v2);
+}
+
+static int
+btc_peer_compare(const btc_peer_t *x, const btc_peer_t *y) {
+  /* Fastest first: peers which delivered blocks by
+     throughput, then the rest by round trip time. */
+  if (x->block_rate != y->block_rate) {
+    if (x->block_rate == -1 || y->block_rate == -1)
+      return x->block_rate == -1 ? 1 : -1;
+
+    return x->block_rate > y->block_rate ? -1 : 1;
+  }
+
+  if (x->min_ping != y->min_ping) {
+    if (x->min_ping == -1 || y->min_ping == -1)
+      return x->min_ping == -1 ? 1 : -1;
+
+    return x->min_ping < y->min_ping ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static int
+peer_cmp(const void *xp, const void *yp) {
+  const btc_peer_t *x = *((const btc_peer_t **)xp);
+  const btc_peer_t *y = *((const btc_peer_t **)yp);
+
+  return btc_peer_compare(x, y);
+}
+
+static size_t
+btc_pool_count_inbound(btc_pool_t *pool) {
+  /* Inbound peers we haven't already let go of. */
+  size_t total = 0;
+  btc_peer_t *peer;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (!peer->outbound && peer->state != BTC_PEER_DEAD)
+      total += 1;
+  }
+
+  return total;
+}
+
+static size_t
+btc_pool_count_outbound(btc_pool_t *pool) {
+  /* Full-relay outbound peers which finished the handshake. */
+  size_t total = 0;
+  btc_peer_t *peer;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (!peer->outbound || peer->block_relay)
+      continue;
+
+    if (peer->state == BTC_PEER_CONNECTED)
+      total += 1;
+  }
+
+  return total;
+}
+
+static void
+btc_pool_drop_pending(btc_pool_t *pool) {
+  /* Cut loose the candidates which lost the race. */
+  btc_peer_t *peer;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (!peer->outbound || peer->loader || peer->block_relay)
+      continue;
+
+    if (peer->state == BTC_PEER_CONNECTED || peer->state == BTC_PEER_DEAD)
+      continue;
+
+    btc_pool_log(pool, "Dropping slower outbound peer (%N).", &peer->addr);
+
+    btc_peer_close(peer);
+  }
+}
+
+static size_t
+btc_pool_full_outbound(btc_pool_t *pool) {
+  /* Outbound peers in any state, minus the block-relay-only ones. */
+  return pool->peers.outbound - pool->peers.block_relay;
+}
+
+static size_t
+btc_pool_race_limit(btc_pool_t *pool) {
+  /* Most dials through Tor go nowhere and the rest take
+     seconds, so run many more of them side by side. */
+  if (pool->flags & BTC_POOL_PROXY)
+    return pool->max_outbound + OUTBOUND_RACE_PROXY;
+
+  return pool->max_outbound + OUTBOUND_RACE;
+}
+
+static int
+btc_pool_add_outbound(btc_pool_t *pool, int block_relay) {
+  const btc_netaddr_t *addr;
+  btc_peer_t *peer;
+
+  if (block_relay) {
+    if (pool->peers.block_relay >= BLOCK_RELAY_PEERS)
+      return 0;
+  } else {
+    if (btc_pool_full_outbound(pool) >= btc_pool_race_limit(pool))
+      return 0;
+  }
+
+  /* Hang back if we don't have a loader peer yet. */
+  if (pool->peers.load == NULL)
+    return 0;
+
+  addr = btc_pool_get_addr(pool);
+
+  if (addr == NULL)
+    return 0;
+
+  peer = btc_pool_create_outbound(pool, addr, block_relay);
+
+  if (peer == NULL)
+    return 0;
+
+  if (block_relay)
+    btc_pool_log(pool, "Adding block-relay-only peer (%N).", &peer->addr);
+
+  btc_peers_add(&pool->peers, peer);
+
+  return 1;
+}
+
+static int
+btc_pool_is_syncable(btc_pool_t *pool, btc_peer_t *peer) {
+  if (peer->state != BTC_PEER_CONNECTED)
+    return 0;
+
+  if (!btc_pool_has_services(pool, peer->services))
+    return 0;
+
+  if (!peer->loader) {
+    if (!btc_chain_synced(pool->chain))
+      return 0;
+  }
+
+  return 1;
+}
+
+static void
+btc_pool_request_assumed(btc_pool_t *pool, btc_peer_t *peer) {
+  /* Headers up to the assumed-valid block, so the
+     chain can tell which blocks lead to it. */
+  uint8_t start[32], stop[32];
+
+  if (!peer->loader)
+    return;
+
+  if (btc_chain_assume_locator(pool->chain, start, stop))
+    btc_peer_send_getheaders_1(peer, start, stop);
+}
+
+static int
+btc_pool_send_locator(btc_pool_t *pool,
+                      btc_peer_t *peer,
+                      const btc_vector_t *locator) {
+  if (!btc_pool_is_syncable(pool, peer))
+    return 0;
+
+  /* Nothing to ask for until the blocks catch up. */
+  if (pool->checkpoints) {
+    if (pool->header_tail->height >= pool->header_tip->height)
+      return 0;
+  }
+
+  /* Ask for the mempool if we're synced. */
+  if (pool->network->request_mempool) {
+    if (peer->loader && btc_chain_synced(pool->chain))
+      btc_peer_send_mempool(peer);
+  }
+
+  peer->syncing = 1;
+  peer->block_time = btc_time_msec();
+
+  btc_peer_stall_at(peer, peer->block_time + 120000);
+
+  /* Pick up where the last loader left off. */
+  if (pool->checkpoints) {
+    btc_peer_send_getheaders_1(peer, pool->header_tail->hash,
+                                     pool->header_tip->hash);
+    return 1;
+  }
+
+  btc_pool_request_assumed(pool, peer);
+  btc_peer_send_getblocks(peer, locator, NULL);
+
+  return 1;
+}
+
+static int
+btc_pool_send_sync(btc_pool_t *pool, btc_peer_t *peer) {
+  btc_vector_t locator;
+
+  if (peer->syncing)
+    return 0;
+
+  if (!btc_pool_is_syncable(pool, peer))
+    return 0;
+
+  btc_vector_init(&locator);
+  btc_chain_get_locator(pool->chain, &locator, NULL);
+  btc_pool_send_locator(pool, peer, &locator);
+  btc_vector_clear(&locator);
+
+  return 1;
+}
+
+static void
+btc_pool_set_loader(btc_pool_t *pool, btc_peer_t *peer) {
+  CHECK(peer->outbound == 1);
+  CHECK(pool->peers.load == NULL);
+  CHECK(peer->loader == 0);
+
+  if (peer->range != NULL)
+    btc_hdrrange_release(peer->range);
+
+  peer->loader = 1;
+  pool->peers.load = peer;
+
+  btc_pool_send_sync(pool, peer);
+}
+
+static int
+btc_pool_add_loader(btc_pool_t *pool) {
+  const btc_netaddr_t *addr;
+  btc_peer_t *best = NULL;
+  btc_peer_t *peer;
+
+  CHECK(pool->peers.load == NULL);
+
+  /* Take the fastest peer we already have. */
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (!peer->outbound || peer->state == BTC_PEER_DEAD)
+      continue;
+
+    if (peer->block_relay)
+      continue;
+
+    if (best == NULL) {
+      best = peer;
+      continue;
+    }
+
+    if ((peer->state == BTC_PEER_CONNECTED)
+        != (best->state == BTC_PEER_CONNECTED)) {
+      if (peer->state == BTC_PEER_CONNECTED)
+        best = peer;
+      continue;
+    }
+
+    if (btc_peer_compare(peer, best) < 0)
+      best = peer;
+  }
+
+  if (best != NULL) {
+    btc_pool_log(pool, "Repurposing peer for loader (%N).", &best->addr);
+
+    btc_pool_set_loader(pool, best);
+
+    return 1;
+  }
+
+  addr = btc_pool_get_addr(pool);
+
+  if (addr == NULL)
+    return 0;
+
+  peer = btc_pool_create_outbound(pool, addr, 0);
+
+  if (peer == NULL)
+    return 0;
+
+  btc_pool_log(pool, "Adding loader peer (%N).", &peer->addr);
+
+  btc_peers_add(&pool->peers, peer);
+
+  btc_pool_set_loader(pool, peer);
+
+  return 1;
+}
+
+static int
+btc_pool_fill_outbound(btc_pool_t *pool) {
+  size_t total = btc_addrman_total(pool->addrman);
+  size_t i, need, limit;
+
+  if (pool->flags & BTC_POOL_NOCONNECT)
+    return 0;
+
+  if (pool->peers.load == NULL) {
+    if (!btc_pool_add_loader(pool))
+      return 0;
+  }
+
+  if (pool->flags & BTC_POOL_CONNECT)
+    return 0;
+
+  /* A couple of links which only relay blocks. They
+     leak nothing about our txs or addrs, which makes
+     them hard to find and eclipse. */
+  while (pool->peers.block_relay < BLOCK_RELAY_PEERS) {
+    if (!btc_pool_add_outbound(pool, 1))
+      break;
+  }
+
+  if (btc_pool_count_outbound(pool) >= pool->max_outbound)
+    return 1;
+
+  /* Race a few more candidates than we need. Whoever
+     finishes the handshake first gets the slots. */
+  limit = btc_pool_race_limit(pool);
+
+  if (btc_pool_full_outbound(pool) >= limit)
+    return 1;
+
+  need = limit - btc_pool_full_outbound(pool);
+
+  if (need > total)
+    need = total;
+
+  if (need == 0)
+    return 0;
+
+  btc_pool_log(pool, "Refilling %zu peers (%zu/%zu).", need,
+               btc_pool_full_outbound(pool), pool->max_outbound);
+
+  for (i = 0; i < need; i++)
+    btc_pool_add_outbound(pool, 0);
+
+  return 1;
 }
 
-/**
- * Peer List
- */
-
 static void
-btc_peers_init(btc_peers_t *list) {
-  list->map = btc_netmap_create(); /* addr->peer */
-  list->ids = btc_intmap_create(); /* id->peer */
-  list->head = NULL;
-  list->tail = NULL;
-  list->load = NULL;
-  list->inbound = 0;
-  list->outbound = 0;
-  list->length = 0;
+btc_pool_rotate_outbound(btc_pool_t *pool) {
+  /* While syncing, drop the slowest outbound peer when it
+     lags far behind the fastest. The refill that follows
+     tries someone new. */
+  btc_peer_t *best = NULL;
+  btc_peer_t *worst = NULL;
+  btc_peer_t *peer;
+  size_t count = 0;
+
+  if (btc_chain_synced(pool->chain))
+    return;
+
+  if (pool->flags & BTC_POOL_CONNECT)
+    return;
+
+  if (btc_pool_count_outbound(pool) < pool->max_outbound)
+    return;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (!peer->outbound || peer->state != BTC_PEER_CONNECTED)
+      continue;
+
+    if (peer->block_rate == -1)
+      continue;
+
+    if (best == NULL || peer->block_rate > best->block_rate)
+      best = peer;
+
+    if (!peer->loader) {
+      if (worst == NULL || peer->block_rate < worst->block_rate)
+        worst = peer;
+    }
+
+    count += 1;
+  }
+
+  if (count < ROTATE_MIN_PEERS || worst == NULL)
+    return;
+
+  if (worst->block_rate * ROTATE_FACTOR >= best->block_rate)
+    return;
+
+  btc_pool_log(pool, "Rotating out slow peer (%N): %T vs %T bytes/s.",
+                     &worst->addr, worst->block_rate, best->block_rate);
+
+  btc_peer_close(worst);
+}
+
+static void
+btc_pool_request_window(btc_pool_t *pool);
+
+static void
+btc_pool_check_window(btc_pool_t *pool, int64_t now);
+
+static void
+btc_pool_check_txs(btc_pool_t *pool, int64_t now);
+
+static void
+btc_pool_trim_txs(btc_pool_t *pool) {
+  btc_txqueue_t *queue = &pool->tx_queue;
+  uint64_t seq = queue->base + queue->length;
+  btc_peer_t *peer;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (peer->inv_seq < seq)
+      seq = peer->inv_seq;
+  }
+
+  btc_txqueue_shift(queue, seq);
+}
+
+static void
+btc_pool_on_tick(btc_pool_t *pool, int64_t now) {
+  /* Seeds just came in: no need to wait. */
+  if (btc_addrman_poll(pool->addrman) > 0)
+    pool->refill_timer = 0;
+
+  if (now >= pool->refill_timer + 3000) {
+    btc_pool_fill_outbound(pool);
+    btc_pool_assign_ranges(pool);
+    btc_pool_trim_txs(pool);
+    pool->refill_timer = now;
+  }
+
+  if (now >= pool->window_timer + 1000) {
+    btc_pool_check_window(pool, now);
+    pool->window_timer = now;
+  }
+
+  if (now >= pool->tx_timer)
+    btc_pool_check_txs(pool, now);
+
+  if (now >= pool->flush_timer + 10 * 60 * 1000) {
+    btc_addrman_flush(pool->addrman);
+    pool->flush_timer = now;
+  }
+
+  if (now >= pool->rotate_timer + ROTATE_INTERVAL) {
+    btc_pool_rotate_outbound(pool);
+    pool->rotate_timer = now;
+  }
+}
+
+/* Inbound eviction, after Bitcoin Core. When every
+ * inbound slot is taken, a newcomer pushes out the
+ * least useful inbound peer, if there is one. Peers
+ * which are hard for an attacker to imitate are set
+ * aside first: a few from distinct netgroups, the
+ * fastest pingers, the last to relay us a new tx or
+ * block, and the older half of what is left. The
+ * most crowded netgroup then gives up its youngest.
+ */
+
+#define EVICT_CMP(x, y) ((x) < (y) ? -1 : ((x) > (y)))
+
+static int64_t
+evict_ping(const btc_peer_t *peer) {
+  return peer->min_ping == -1 ? INT64_MAX : peer->min_ping;
+}
+
+static int
+evict_cmp_group(const void *xp, const void *yp) {
+  const btc_peer_t *x = *((const btc_peer_t **)xp);
+  const btc_peer_t *y = *((const btc_peer_t **)yp);
+
+  return EVICT_CMP(x->group, y->group);
+}
+
+static int
+evict_cmp_ping(const void *xp, const void *yp) {
+  const btc_peer_t *x = *((const btc_peer_t **)xp);
+  const btc_peer_t *y = *((const btc_peer_t **)yp);
+
+  return EVICT_CMP(evict_ping(y), evict_ping(x));
+}
+
+static int
+evict_cmp_tx(const void *xp, const void *yp) {
+  const btc_peer_t *x = *((const btc_peer_t **)xp);
+  const btc_peer_t *y = *((const btc_peer_t **)yp);
+
+  if (x->last_tx != y->last_tx)
+    return EVICT_CMP(x->last_tx, y->last_tx);
+
+  if (x->relay != y->relay)
+    return x->relay - y->relay;
+
+  return EVICT_CMP(y->time, x->time);
+}
+
+static int
+evict_cmp_block_relay(const void *xp, const void *yp) {
+  const btc_peer_t *x = *((const btc_peer_t **)xp);
+  const btc_peer_t *y = *((const btc_peer_t **)yp);
+
+  if (x->relay != y->relay)
+    return y->relay - x->relay;
+
+  if (x->last_block != y->last_block)
+    return EVICT_CMP(x->last_block, y->last_block);
+
+  return EVICT_CMP(y->time, x->time);
+}
+
+static int
+evict_cmp_block(const void *xp, const void *yp) {
+  const btc_peer_t *x = *((const btc_peer_t **)xp);
+  const btc_peer_t *y = *((const btc_peer_t **)yp);
+
+  if (x->last_block != y->last_block)
+    return EVICT_CMP(x->last_block, y->last_block);
+
+  return EVICT_CMP(y->time, x->time);
+}
+
+static int
+evict_cmp_uptime(const void *xp, const void *yp) {
+  const btc_peer_t *x = *((const btc_peer_t **)xp);
+  const btc_peer_t *y = *((const btc_peer_t **)yp);
+
+  return EVICT_CMP(y->time, x->time);
+}
+
+static int
+evict_cmp_crowd(const void *xp, const void *yp) {
+  const btc_peer_t *x = *((const btc_peer_t **)xp);
+  const btc_peer_t *y = *((const btc_peer_t **)yp);
+
+  if (x->group != y->group)
+    return EVICT_CMP(x->group, y->group);
+
+  return EVICT_CMP(x->time, y->time);
+}
+
+static void
+evict_protect(btc_vector_t *cands,
+              int (*cmp)(const void *, const void *),
+              size_t count,
+              int block_relay) {
+  /* Sort the keepers to the back and take them out
+     (optionally only the ones not relaying txs). */
+  size_t start, i, j;
+
+  if (count > cands->length)
+    count = cands->length;
+
+  qsort(cands->items, cands->length, sizeof(void *), cmp);
+
+  start = cands->length - count;
+
+  for (i = start, j = start; i < cands->length; i++) {
+    btc_peer_t *peer = cands->items[i];
+
+    if (!block_relay || peer->relay)
+      cands->items[j++] = peer;
+  }
+
+  cands->length = block_relay ? j : start;
+}
+
+static btc_peer_t *
+btc_pool_select_evict(btc_pool_t *pool) {
+  btc_peer_t *peer, *best = NULL;
+  size_t i, run, best_run = 0;
+  btc_vector_t cands;
+
+  btc_vector_init(&cands);
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (peer->outbound || peer->state == BTC_PEER_DEAD)
+      continue;
+
+    btc_vector_push(&cands, peer);
+  }
+
+  evict_protect(&cands, evict_cmp_group, EVICT_PROTECT_GROUP, 0);
+  evict_protect(&cands, evict_cmp_ping, EVICT_PROTECT_PING, 0);
+  evict_protect(&cands, evict_cmp_tx, EVICT_PROTECT_TX, 0);
+  evict_protect(&cands, evict_cmp_block_relay, EVICT_PROTECT_BLOCK_RELAY, 1);
+  evict_protect(&cands, evict_cmp_block, EVICT_PROTECT_BLOCK, 0);
+  evict_protect(&cands, evict_cmp_uptime, cands.length / 2, 0);
+
+  /* Runs of one netgroup, oldest first. Ties go to
+     the group whose youngest member is the newest. */
+  qsort(cands.items, cands.length, sizeof(void *), evict_cmp_crowd);
+
+  for (i = 0, run = 0; i < cands.length; i++) {
+    peer = cands.items[i];
+
+    run += 1;
+
+    if (i + 1 < cands.length) {
+      const btc_peer_t *next = cands.items[i + 1];
+
+      if (next->group == peer->group)
+        continue;
+    }
+
+    if (run > best_run || (run == best_run && peer->time > best->time)) {
+      best = peer;
+      best_run = run;
+    }
+
+    run = 0;
+  }
+
+  btc_vector_clear(&cands);
+
+  return best;
+}
+
+static void
+btc_pool_on_socket(btc_pool_t *pool, btc_socket_t *socket) {
+  btc_sockaddr_t sa;
+  btc_netaddr_t na;
+  btc_peer_t *peer;
+  uint8_t group[6];
+
+  btc_socket_address(&sa, socket);
+
+  btc_netaddr_set_sockaddr(&na, &sa);
+
+  if (btc_addrman_is_banned(pool->addrman, &na)) {
+    btc_pool_log(pool, "Ignoring banned peer (%S).", &sa);
+    btc_socket_close(socket);
+    return;
+  }
+
+  if (btc_pool_count_inbound(pool) >= pool->max_inbound) {
+    peer = btc_pool_select_evict(pool);
+
+    if (peer == NULL) {
+      btc_pool_log(pool, "Ignoring inbound peer (%S).", &sa);
+      btc_socket_close(socket);
+      return;
+    }
+
+    btc_pool_log(pool, "Evicting inbound peer for %S (%N).",
+                       &sa, &peer->addr);
+
+    btc_peer_close(peer);
+  }
+
+  btc_pool_log(pool, "Accepting inbound peer (%S).", &sa);
+
+  peer = btc_peer_create(pool, 0);
+
+  if (!btc_peer_accept(peer, socket)) {
+    const char *msg = btc_loop_strerror(pool->loop);
+
+    btc_pool_log(pool, "Connection failed: %s (%S).", msg, &sa);
+    btc_peer_destroy(peer);
+
+    return;
+  }
+
+  btc_netaddr_groupkey(group, &peer->addr);
+
+  peer->group = btc_siphash_sum(group, 6, pool->group_key);
+
+  btc_peers_add(&pool->peers, peer);
 }
 
 static void
-btc_peers_clear(btc_peers_t *list) {
-  btc_netmap_destroy(list->map);
-  btc_intmap_destroy(list->ids);
+btc_pool_on_connect(btc_pool_t *pool, btc_peer_t *peer) {
+  btc_pool_log(pool, "Connected to %N.", &peer->addr);
+
+  if (peer->outbound)
+    btc_addrman_mark_success(pool->addrman, &peer->addr);
 }
 
 static void
-btc_peers_add(btc_peers_t *list, btc_peer_t *peer) {
-  CHECK(btc_netmap_put(list->map, &peer->addr, peer));
-  CHECK(btc_intmap_put(list->ids, peer->id, peer));
+btc_pool_on_complete(btc_pool_t *pool, btc_peer_t *peer) {
+  const btc_netaddr_t *addr;
 
-  btc_list_push(list, peer, btc_peer_t);
+  if (peer->outbound && !peer->block_relay) {
+    /* Advertise our address. */
+    if ((pool->flags & BTC_POOL_LISTEN) && btc_chain_synced(pool->chain)) {
+      addr = btc_addrman_get_local(pool->addrman, &peer->addr, pool->services);
 
-  if (peer->outbound)
-    list->outbound += 1;
-  else
-    list->inbound += 1;
+      if (addr != NULL)
+        btc_peer_send_addr_1(peer, addr);
+    }
 
-  btc_socket_complete(peer->socket);
+    /* Find some more peers. */
+    btc_peer_send_getaddr(peer);
+    peer->getting_addr = 1;
+  }
+
+  /* We want compact blocks! */
+  if (pool->flags & BTC_POOL_BIP152)
+    btc_peer_send_sendcmpct(peer, pool->block_mode);
+
+  if (peer->outbound) {
+    /* Start syncing the chain. */
+    btc_pool_send_sync(pool, peer);
+
+    /* Or help fetch headers ahead of the loader. */
+    btc_pool_assign_ranges(pool);
+
+    /* Mark success. */
+    btc_addrman_mark_ack(pool->addrman, &peer->addr, peer->services);
+
+    /* If we don't have an ack'd loader yet, consider it dead. */
+    if (!peer->loader && pool->peers.load != NULL) {
+      if (pool->peers.load->state != BTC_PEER_CONNECTED) {
+        pool->peers.load->loader = 0;
+        pool->peers.load = NULL;
+      }
+    }
+
+    /* If we do not have a loader, use this peer. */
+    if (pool->peers.load == NULL)
+      btc_pool_set_loader(pool, peer);
+
+    /* All slots taken. */
+    if (btc_pool_count_outbound(pool) >= pool->max_outbound)
+      btc_pool_drop_pending(pool);
+  }
 }
 
 static void
-btc_peers_remove(btc_peers_t *list, btc_peer_t *peer) {
-  CHECK(btc_netmap_del(list->map, &peer->addr) == &peer->addr);
-  CHECK(btc_intmap_del(list->ids, peer->id) == peer->id);
+btc_pool_resync(btc_pool_t *pool, int force) {
+  btc_vector_t locator;
+  btc_peer_t *peer;
 
-  btc_list_remove(list, peer, btc_peer_t);
+  btc_vector_init(&locator);
+  btc_chain_get_locator(pool->chain, &locator, NULL);
 
-  if (peer == list->load) {
-    CHECK(peer->loader == 1);
-    peer->loader = 0;
-    list->load = NULL;
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (!peer->outbound)
+      continue;
+
+    if (!force && peer->syncing)
+      continue;
+
+    btc_pool_send_locator(pool, peer, &locator);
   }
 
-  if (peer->outbound)
-    list->outbound -= 1;
-  else
-    list->inbound -= 1;
+  btc_vector_clear(&locator);
 }
 
 static int
-btc_peers_has(btc_peers_t *list, const btc_netaddr_t *addr) {
-  return btc_netmap_has(list->map, addr);
-}
+btc_pool_resolve_block(btc_pool_t *pool,
+                       btc_peer_t *peer,
+                       const uint8_t *hash) {
+  uint8_t *key = btc_hashtab_del(peer->block_map, hash);
 
-static btc_peer_t *
-btc_peers_get(btc_peers_t *list, const btc_netaddr_t *addr) {
-  return btc_netmap_get(list->map, addr);
-}
+  if (key == NULL)
+    return 0;
 
-static btc_peer_t *
-btc_peers_find(btc_peers_t *list, uint32_t id) {
-  return btc_intmap_get(list->ids, id);
+  CHECK(btc_hashset_del(pool->block_map, hash) == key);
+
+  btc_free(key);
+
+  return 1;
 }
 
 static void
-btc_peers_close(btc_peers_t *list) {
-  btc_peer_t *peer, *next;
+btc_pool_forget_tx(btc_pool_t *pool, btc_txreq_t *req) {
+  size_t i;
 
-  for (peer = list->head; peer != NULL; peer = next) {
-    next = peer->next;
-    btc_peer_close(peer);
-  }
+  for (i = 0; i < req->length; i++)
+    req->items[i].peer->tx_announced--;
+
+  if (req->peer != NULL)
+    btc_hashtab_del(req->peer->tx_map, req->hash);
+
+  CHECK(btc_hashmap_del(pool->tx_map, req->hash) == req->hash);
+
+  btc_txreq_destroy(req);
 }
 
-/*
- * Header Entry
- */
+static btc_peer_t *
+btc_pool_assign_tx(btc_pool_t *pool, btc_txreq_t *req, int64_t now) {
+  const btc_txcand_t *cand;
+  btc_peer_t *peer;
 
-static btc_hdrnode_t *
-btc_hdrnode_create(const uint8_t *hash, int32_t height) {
-  btc_hdrnode_t *node = (btc_hdrnode_t *)btc_malloc(sizeof(btc_hdrnode_t));
+  CHECK(req->peer == NULL);
 
-  btc_hash_copy(node->hash, hash);
+  cand = btc_txreq_select(req, now, &pool->tx_timer);
 
-  node->height = height;
-  node->next = NULL;
+  if (cand == NULL)
+    return NULL;
 
-  return node;
-}
+  peer = cand->peer;
 
-static void
-btc_hdrnode_destroy(btc_hdrnode_t *node) {
-  btc_free(node);
+  req->peer = peer;
+  req->type = cand->type;
+  req->expires = now + TX_REQUEST_TIMEOUT;
+
+  btc_hashtab_put(peer->tx_map, req->hash, now);
+
+  if (req->expires < pool->tx_timer)
+    pool->tx_timer = req->expires;
+
+  return peer;
 }
 
-/*
- * Pool
- */
+static void
+btc_pool_fetch_txs(btc_pool_t *pool, btc_txfetch_t *items, size_t count) {
+  btc_zinv_t inv;
+  size_t i, j;
 
-btc_pool_t *
-btc_pool_create(const btc_network_t *network,
-                btc_loop_t *loop,
-                btc_chain_t *chain,
-                btc_mempool_t *mempool) {
-  btc_pool_t *pool = (btc_pool_t *)btc_malloc(sizeof(btc_pool_t));
+  qsort(items, count, sizeof(btc_txfetch_t), btc_txfetch_compare);
 
-  memset(pool, 0, sizeof(*pool));
+  btc_zinv_init(&inv);
 
-  pool->network = network;
-  pool->loop = loop;
-  pool->logger = NULL;
-  pool->timedata = NULL;
-  pool->addrman = btc_addrman_create(network);
-  pool->chain = chain;
-  pool->mempool = mempool;
-  pool->flags = BTC_POOL_DEFAULT_FLAGS;
-  pool->services = BTC_NET_LOCAL_SERVICES;
-  pool->port = network->port;
-  btc_sockaddr_import(&pool->bind, "::", 0);
-  btc_netaddr_set(&pool->connect, "0.0.0.0", 0);
-  btc_sockaddr_import(&pool->proxy, "0.0.0.0", 0);
-  pool->max_inbound = 128;
-  pool->max_outbound = 8;
-  pool->only_net = BTC_IPNET_NONE;
-  pool->server = NULL;
-  btc_peers_init(&pool->peers);
-  btc_nonces_init(&pool->nonces);
-  pool->block_map = btc_hashset_create();
-  pool->tx_map = btc_hashset_create();
-  pool->compact_map = btc_hashset_create();
-  pool->block_mode = 0;
-  pool->checkpoints = 0;
-  pool->header_tip = NULL;
-  pool->header_head = NULL;
-  pool->header_tail = NULL;
-  pool->header_next = NULL;
-  pool->refill_timer = 0;
-  pool->flush_timer = 0;
-  pool->id = 0;
-  pool->required_services = BTC_NET_LOCAL_SERVICES;
-  pool->synced = 0;
+  for (i = 0; i < count; i = j) {
+    btc_peer_t *peer = items[i].peer;
 
-  return pool;
-}
+    btc_zinv_reset(&inv);
 
-void
-btc_pool_destroy(btc_pool_t *pool) {
-  btc_addrman_destroy(pool->addrman);
-  btc_peers_clear(&pool->peers);
-  btc_nonces_clear(&pool->nonces);
-  btc_hashset_destroy(pool->block_map);
-  btc_hashset_destroy(pool->tx_map);
-  btc_hashset_destroy(pool->compact_map);
-  btc_free(pool);
-}
+    for (j = i; j < count && items[j].peer == peer; j++)
+      btc_zinv_push(&inv, items[j].type, items[j].hash);
 
-void
-btc_pool_set_logger(btc_pool_t *pool, btc_logger_t *logger) {
-  pool->logger = logger;
-  btc_addrman_set_logger(pool->addrman, logger);
-}
+    btc_pool_debug(pool,
+      "Requesting %zu/%zu txs from peer with getdata (%N).",
+      inv.length, btc_hashmap_size(pool->tx_map), &peer->addr);
 
-void
-btc_pool_set_timedata(btc_pool_t *pool, btc_timedata_t *td) {
-  pool->timedata = td;
-  btc_addrman_set_timedata(pool->addrman, td);
-}
+    btc_peer_send_getdata(peer, &inv);
+  }
 
-void
-btc_pool_set_port(btc_pool_t *pool, int port) {
-  CHECK(port > 0 && port <= 0xffff);
-  pool->port = port;
+  btc_zinv_clear(&inv);
 }
 
-void
-btc_pool_set_bind(btc_pool_t *pool, const btc_netaddr_t *addr) {
-  btc_netaddr_get_sockaddr(&pool->bind, addr);
+static void
+btc_pool_retry_tx(btc_pool_t *pool,
+                  btc_txreq_t *req,
+                  btc_peer_t *peer,
+                  btc_vector_t *fetch) {
+  /* Drop the peer and hand the request
+     over to the next announcer in line. */
+  if (req->peer == peer) {
+    btc_hashtab_del(peer->tx_map, req->hash);
+    req->peer = NULL;
+  }
 
-  if (!btc_netaddr_is_null(addr))
-    btc_addrman_add_local(pool->addrman, addr, BTC_SCORE_BIND);
-}
+  if (btc_txreq_remove(req, peer))
+    peer->tx_announced--;
 
-void
-btc_pool_set_external(btc_pool_t *pool, const btc_netaddr_t *addr) {
-  if (!btc_netaddr_is_null(addr))
-    btc_addrman_add_local(pool->addrman, addr, BTC_SCORE_MANUAL);
-}
+  if (req->length == 0) {
+    btc_pool_forget_tx(pool, req);
+    return;
+  }
 
-void
-btc_pool_set_connect(btc_pool_t *pool, const btc_netaddr_t *addr) {
-  btc_netaddr_copy(&pool->connect, addr);
+  if (req->peer == NULL)
+    btc_vector_push(fetch, req);
 }
 
-void
-btc_pool_set_proxy(btc_pool_t *pool, const btc_netaddr_t *addr) {
-  btc_netaddr_get_sockaddr(&pool->proxy, addr);
-  btc_addrman_set_proxy(pool->addrman, addr);
-}
+static void
+btc_pool_retry_txs(btc_pool_t *pool, const btc_vector_t *reqs, int64_t now) {
+  btc_txfetch_t *items;
+  btc_txreq_t *req;
+  btc_peer_t *peer;
+  size_t i, count;
 
-void
-btc_pool_set_maxinbound(btc_pool_t *pool, size_t max_inbound) {
-  pool->max_inbound = max_inbound;
-}
+  if (reqs->length == 0)
+    return;
 
-void
-btc_pool_set_maxoutbound(btc_pool_t *pool, size_t max_outbound) {
-  pool->max_outbound = max_outbound;
-}
+  items = (btc_txfetch_t *)btc_malloc(reqs->length * sizeof(btc_txfetch_t));
+  count = 0;
 
-void
-btc_pool_set_bantime(btc_pool_t *pool, int64_t ban_time) {
-  btc_addrman_set_bantime(pool->addrman, ban_time);
-}
+  for (i = 0; i < reqs->length; i++) {
+    req = (btc_txreq_t *)reqs->items[i];
+    peer = btc_pool_assign_tx(pool, req, now);
 
-void
-btc_pool_set_onlynet(btc_pool_t *pool, enum btc_ipnet only_net) {
-  pool->only_net = only_net;
-}
+    if (peer != NULL) {
+      items[count].peer = peer;
+      items[count].type = req->type;
+      items[count].hash = req->hash;
+      count++;
+    }
+  }
 
-static void
-btc_pool_log(btc_pool_t *pool, const char *fmt, ...) {
-  va_list ap;
-  va_start(ap, fmt);
-  btc_logger_write(pool->logger, "pool", fmt, ap);
-  va_end(ap);
+  if (count > 0)
+    btc_pool_fetch_txs(pool, items, count);
+
+  btc_free(items);
 }
 
-static int
-btc_pool_listen(btc_pool_t *pool) {
-  btc_sockaddr_t addr = pool->bind;
-  btc_socket_t *server;
+static void
+btc_pool_check_txs(btc_pool_t *pool, int64_t now) {
+  btc_hashmapiter_t it;
+  btc_vector_t stale;
+  btc_vector_t fetch;
+  btc_txreq_t *req;
+  size_t i;
 
-  if (addr.port == 0)
-    addr.port = pool->port;
+  pool->tx_timer = now + 1000;
 
-  server = btc_loop_listen(pool->loop, &addr);
+  btc_vector_init(&stale);
+  btc_vector_init(&fetch);
 
-  if (server == NULL) {
-    const char *msg = btc_loop_strerror(pool->loop);
+  btc_hashmap_iterate(&it, pool->tx_map);
 
-    btc_pool_log(pool, "Could not listen on %S: %s.", &addr, msg);
+  while (btc_hashmap_next(&it)) {
+    req = it.val;
 
-    return 0;
+    if (req->peer == NULL)
+      btc_vector_push(&fetch, req);
+    else if (now >= req->expires)
+      btc_vector_push(&stale, req);
+    else if (req->expires < pool->tx_timer)
+      pool->tx_timer = req->expires;
   }
 
-  btc_socket_set_data(server, pool);
-  btc_socket_on_socket(server, on_server_socket);
-  btc_socket_on_close(server, on_server_close);
+  for (i = 0; i < stale.length; i++) {
+    req = (btc_txreq_t *)stale.items[i];
 
-  pool->server = server;
+    btc_pool_debug(pool, "Timed out requesting tx %H (%N).",
+                         req->hash, &req->peer->addr);
 
-  btc_pool_log(pool, "Listening on %S.", &addr);
+    btc_pool_retry_tx(pool, req, req->peer, &fetch);
+  }
 
-  return 1;
+  btc_pool_retry_txs(pool, &fetch, now);
+
+  btc_vector_clear(&stale);
+  btc_vector_clear(&fetch);
+
+  if (pool->tx_timer < now + TX_CHECK_INTERVAL)
+    pool->tx_timer = now + TX_CHECK_INTERVAL;
 }
 
-static void
-btc_pool_discover_local(btc_pool_t *pool) {
-  btc_sockaddr_t *res, *it;
-  btc_netaddr_t addr;
+static int
+btc_pool_resolve_tx(btc_pool_t *pool,
+                    btc_peer_t *peer,
+                    const uint8_t *hash) {
+  btc_txreq_t *req = btc_hashmap_get(pool->tx_map, hash);
 
-  btc_pool_log(pool, "Looking up local addresses...");
+  if (req == NULL || req->peer != peer)
+    return 0;
 
-  if (btc_getifaddrs(&res)) {
-    int total = 0;
+  /* Other announcers are no longer needed. */
+  btc_pool_forget_tx(pool, req);
 
-    for (it = res; it != NULL; it = it->next) {
-      btc_netaddr_set_sockaddr(&addr, it);
+  return 1;
+}
 
-      addr.port = pool->port;
+static int
+btc_pool_notfound_tx(btc_pool_t *pool,
+                     btc_peer_t *peer,
+                     const uint8_t *hash) {
+  btc_txreq_t *req = btc_hashmap_get(pool->tx_map, hash);
+  btc_vector_t fetch;
 
-      btc_pool_log(pool, "Local address found: %N.", &addr);
+  if (req == NULL || req->peer != peer)
+    return 0;
 
-      btc_addrman_add_local(pool->addrman, &addr, BTC_SCORE_IF);
+  btc_vector_init(&fetch);
 
-      total += 1;
-    }
+  btc_pool_retry_tx(pool, req, peer, &fetch);
+  btc_pool_retry_txs(pool, &fetch, btc_time_msec());
 
-    btc_pool_log(pool, "Found %d local addresses.", total);
+  btc_vector_clear(&fetch);
 
-    btc_freeifaddrs(res);
-  } else {
-    btc_pool_log(pool, "Local addresses not found.");
+  return 1;
+}
+
+static int
+btc_pool_resolve_item(btc_pool_t *pool,
+                      btc_peer_t *peer,
+                      const btc_zinvitem_t *item) {
+  switch (item->type) {
+    case BTC_INV_TX:
+    case BTC_INV_WITNESS_TX:
+    case BTC_INV_WTX:
+      return btc_pool_notfound_tx(pool, peer, item->hash);
+    case BTC_INV_BLOCK:
+    case BTC_INV_FILTERED_BLOCK:
+    case BTC_INV_CMPCT_BLOCK:
+    case BTC_INV_WITNESS_BLOCK:
+    case BTC_INV_WITNESS_FILTERED_BLOCK:
+      return btc_pool_resolve_block(pool, peer, item->hash);
+    default:
+      return 0;
   }
 }
 
 static void
-btc_pool_discover_external(btc_pool_t *pool) {
-  btc_sockaddr_t sa;
-  btc_netaddr_t na;
+btc_pool_remove_peer(btc_pool_t *pool, btc_peer_t *peer) {
+  btc_hashtabiter_t tabit;
+  btc_hashmapiter_t mapit;
+  size_t i;
 
-  btc_pool_log(pool, "Looking up IPv4 address...");
+  btc_peers_remove(&pool->peers, peer);
 
-  if (btc_net_external(&sa, BTC_AF_INET, pool->port)) {
-    btc_pool_log(pool, "IPv4 address found: %S.", &sa);
-    btc_netaddr_set_sockaddr(&na, &sa);
-    btc_addrman_add_local(pool->addrman, &na, BTC_SCORE_DNS);
-  } else {
-    btc_pool_log(pool, "IPv4 address not found.");
+  /* Drop whatever it sent that we haven't validated. */
+  btc_mempool_forget(pool->mempool, peer->id);
+
+  /* Keep its traffic in the totals. */
+  for (i = 0; i < BTC_NETSTAT_TYPES; i++) {
+    pool->sent[i].bytes += peer->sent[i].bytes;
+    pool->sent[i].msgs += peer->sent[i].msgs;
+    pool->recv[i].bytes += peer->recv[i].bytes;
+    pool->recv[i].msgs += peer->recv[i].msgs;
+    pool->recv[i].time += peer->recv[i].time;
   }
 
-  btc_pool_log(pool, "Looking up IPv6 address...");
+  /* Give up any header range. */
+  if (peer->range != NULL)
+    btc_hdrrange_release(peer->range);
 
-  if (btc_net_external(&sa, BTC_AF_INET6, pool->port)) {
-    btc_pool_log(pool, "IPv6 address found: %S.", &sa);
-    btc_netaddr_set_sockaddr(&na, &sa);
-    btc_addrman_add_local(pool->addrman, &na, BTC_SCORE_DNS);
-  } else {
-    btc_pool_log(pool, "IPv6 address not found.");
-  }
-}
+  /* Remove block hashes. */
+  btc_hashtab_iterate(&tabit, peer->block_map);
 
-static const btc_checkpoint_t *
-btc_pool_next_tip(btc_pool_t *pool, int32_t height) {
-  const btc_network_t *network = pool->network;
-  const btc_checkpoint_t *chk;
-  size_t i;
+  while (btc_hashtab_next(&tabit))
+    CHECK(btc_hashset_del(pool->block_map, tabit.key));
 
-  for (i = 0; i < network->checkpoints.length; i++) {
-    chk = &network->checkpoints.items[i];
+  /* Pass its tx requests on to other announcers. */
+  if (peer->tx_announced > 0) {
+    btc_hashmapiter_t txit;
+    btc_vector_t fetch;
+    btc_vector_t reqs;
 
-    if (chk->height > height)
-      return chk;
-  }
+    btc_vector_init(&reqs);
+    btc_vector_init(&fetch);
 
-  btc_abort(); /* LCOV_EXCL_LINE */
+    btc_hashmap_iterate(&txit, pool->tx_map);
 
-  return NULL; /* LCOV_EXCL_LINE */
-}
+    while (btc_hashmap_next(&txit))
+      btc_vector_push(&reqs, txit.val);
 
-static void
-btc_pool_clear_chain(btc_pool_t *pool) {
-  btc_hdrnode_t *node, *next;
+    for (i = 0; i < reqs.length; i++)
+      btc_pool_retry_tx(pool, reqs.items[i], peer, &fetch);
 
-  for (node = pool->header_head; node != NULL; node = next) {
-    next = node->next;
-    btc_hdrnode_destroy(node);
+    btc_pool_retry_txs(pool, &fetch, btc_time_msec());
+
+    btc_vector_clear(&reqs);
+    btc_vector_clear(&fetch);
   }
 
-  pool->checkpoints = 0;
-  pool->header_tip = NULL;
-  pool->header_head = NULL;
-  pool->header_tail = NULL;
-  pool->header_next = NULL;
+  if (!peer->block_relay)
+    CHECK(btc_hashtab_size(peer->tx_map) == 0);
+
+  /* Remove compact block hashes. */
+  btc_hashmap_iterate(&mapit, peer->compact_map);
+
+  while (btc_hashmap_next(&mapit))
+    CHECK(btc_hashset_del(pool->compact_map, mapit.key));
 }
 
 static void
-btc_pool_reset_chain(btc_pool_t *pool) {
-  const btc_network_t *network = pool->network;
-  const btc_entry_t *tip;
+btc_pool_on_close(btc_pool_t *pool, btc_peer_t *peer) {
+  int loader = peer->loader;
+  size_t size = btc_hashtab_size(peer->block_map);
 
-  if (!(pool->flags & BTC_POOL_CHECKPOINTS))
-    return;
+  btc_pool_remove_peer(pool, peer);
 
-  if (network->checkpoints.length == 0)
-    return;
+  /* The header chain is kept. The next
+     loader resumes from its tail. */
+  if (loader)
+    btc_pool_log(pool, "Removed loader peer (%N).", &peer->addr);
 
-  btc_pool_clear_chain(pool);
+  /* Hand its blocks to someone else. */
+  if (size > 0)
+    btc_pool_request_window(pool);
 
-  tip = btc_chain_tip(pool->chain);
+  btc_nonces_remove(&pool->nonces, peer->nonce);
 
-  if (tip->height < network->last_checkpoint) {
-    pool->checkpoints = 1;
-    pool->header_tip = btc_pool_next_tip(pool, tip->height);
-    pool->header_head = btc_hdrnode_create(tip->hash, tip->height);
-    pool->header_tail = pool->header_head;
+  /* Try a v1-only peer again the old way. */
+  if (peer->v1_retry && pool->loaded) {
+    btc_peer_t *retry;
 
-    btc_pool_log(pool,
-      "Initialized header chain to height %d (checkpoint=%H).",
-      tip->height, pool->header_tip->hash);
+    btc_pool_log(pool, "Retrying with v1 transport (%N).", &peer->addr);
+
+    retry = btc_pool_open_outbound(pool, &peer->addr, peer->block_relay, 0);
+
+    if (retry != NULL)
+      btc_peers_add(&pool->peers, retry);
   }
-}
 
-int
-btc_pool_open(btc_pool_t *pool, const char *prefix, unsigned int flags) {
-  char file[BTC_PATH_MAX];
+  if (btc_chain_synced(pool->chain) && size > 0) {
+    btc_pool_log(pool, "Peer disconnected with requested blocks (%N).",
+                       &peer->addr);
+    btc_pool_log(pool, "Resending sync...");
+    btc_pool_resync(pool, 1);
+  }
 
-  pool->flags = flags;
-  pool->services = BTC_NET_LOCAL_SERVICES;
+  btc_peer_destroy(peer);
+}
 
-  if (pool->flags & BTC_POOL_BIP37)
-    pool->services |= BTC_NET_SERVICE_BLOOM;
+static void
+btc_pool_on_version(btc_pool_t *pool,
+                    btc_peer_t *peer,
+                    const btc_version_t *msg) {
+  btc_pool_log(pool,
+    "Received version (%N): version=%d height=%d services=%#.16llx agent=%s",
+    &peer->addr,
+    msg->version,
+    msg->height,
+    msg->services,
+    msg->agent);
 
-  btc_pool_log(pool, "Opening pool.");
+  if (pool->timedata != NULL) {
+    size_t length = pool->timedata->length;
+    int64_t offset = pool->timedata->offset;
 
-  if (!btc_path_resolve(file, sizeof(file), prefix, "peers.dat", 0))
-    return 0;
+    if (!btc_timedata_add(pool->timedata, msg->time)) {
+      btc_pool_log(pool, "Adjusted time mismatch!");
+      btc_pool_log(pool, "Please make sure your system clock is correct!");
+    }
 
-  if (!btc_addrman_open(pool->addrman, file, flags))
-    return 0;
+    if (pool->timedata->length != length) {
+      int64_t sample = msg->time - btc_now();
 
-  if (pool->flags & BTC_POOL_LISTEN) {
-    if (!btc_pool_listen(pool)) {
-      btc_addrman_close(pool->addrman);
-      return 0;
+      btc_pool_log(pool, "Added time data: total=%zu, sample=%T (%T minutes).",
+                         pool->timedata->length, sample, sample / 60);
     }
 
-    if (pool->flags & BTC_POOL_DISCOVER) {
-      btc_pool_discover_local(pool);
-      btc_pool_discover_external(pool);
+    if (pool->timedata->offset != offset) {
+      btc_pool_log(pool, "Time offset: %T (%T minutes).",
+                         pool->timedata->offset,
+                         pool->timedata->offset / 60);
     }
   }
 
-  pool->synced = btc_chain_synced(pool->chain);
-
-  btc_pool_reset_chain(pool);
-
-  btc_loop_on_tick(pool->loop, on_tick, pool);
+  btc_nonces_remove(&pool->nonces, peer->nonce);
 
-  return 1;
+  if (!peer->outbound && btc_netaddr_is_routable(&msg->remote))
+    btc_addrman_mark_local(pool->addrman, &msg->remote);
 }
 
-void
-btc_pool_close(btc_pool_t *pool) {
-  btc_pool_log(pool, "Closing pool.");
-
-  btc_loop_off_tick(pool->loop, on_tick, pool);
+static void
+btc_pool_on_verack(btc_pool_t *pool, btc_peer_t *peer) {
+  (void)pool;
+  (void)peer;
+}
 
-  if (pool->server != NULL)
-    btc_socket_close(pool->server);
+static void
+btc_pool_on_ping(btc_pool_t *pool,
+                 btc_peer_t *peer,
+                 const btc_ping_t *ping) {
+  (void)pool;
+  (void)peer;
+  (void)ping;
+}
 
-  btc_peers_close(&pool->peers);
-  btc_pool_clear_chain(pool);
-  btc_addrman_close(pool->addrman);
+static void
+btc_pool_on_pong(btc_pool_t *pool,
+                 btc_peer_t *peer,
+                 const btc_pong_t *pong) {
+  (void)pool;
+  (void)peer;
+  (void)pong;
 }
 
-static const btc_netaddr_t *
-btc_pool_get_addr(btc_pool_t *pool) {
-  int64_t now = btc_timedata_now(pool->timedata);
-  const btc_addrent_t *entry;
-  const btc_netaddr_t *addr;
-  int i;
+static void
+btc_pool_on_getaddr(btc_pool_t *pool, btc_peer_t *peer) {
+  btc_vector_t *snapshot;
+  btc_addrs_t addrs;
+  size_t i;
 
-  if (pool->flags & BTC_POOL_CONNECT) {
-    if (btc_peers_has(&pool->peers, &pool->connect))
-      return NULL;
+  if (peer->outbound) {
+    btc_pool_log(pool, "Ignoring getaddr from outbound node (%N).",
+                       &peer->addr);
+    return;
+  }
 
-    return &pool->connect;
+  if (peer->sent_addr) {
+    btc_pool_log(pool, "Ignoring repeated getaddr (%N).",
+                       &peer->addr);
+    return;
   }
 
-  for (i = 0; i < 100; i++) {
-    entry = btc_addrman_get(pool->addrman);
+  peer->sent_addr = 1;
 
-    if (entry == NULL)
-      break;
+  btc_addrs_init(&addrs);
 
-    addr = &entry->addr;
+  snapshot = btc_addrman_getaddr(pool->addrman);
 
-    if (btc_peers_has(&pool->peers, addr))
-      continue;
+  for (i = 0; i < snapshot->length; i++) {
+    const btc_netaddr_t *addr = snapshot->items[i];
 
-    if (btc_addrman_has_local(pool->addrman, addr))
+    if (btc_filter_has_addr(&peer->addr_filter, addr))
       continue;
 
-    if (btc_addrman_is_banned(pool->addrman, addr))
-      continue;
+    btc_filter_add_addr(&peer->addr_filter, addr);
 
-    if (!btc_netaddr_is_valid(addr))
-      continue;
+    btc_addrs_push(&addrs, (btc_netaddr_t *)addr);
 
-    if ((addr->services & pool->required_services) != pool->required_services)
-      continue;
+    if (addrs.length == 1000)
+      break;
+  }
 
-    if (!(pool->flags & BTC_POOL_ONION)) {
-      if (btc_netaddr_is_onion(addr))
-        continue;
-    }
+  btc_pool_debug(pool, "Sending %zu addrs to peer (%N)",
+                       addrs.length, &peer->addr);
 
-    if (i < 30 && now - entry->last_attempt < 600)
-      continue;
+  if (addrs.length > 0) {
+    btc_peer_send_addr(peer, &addrs);
+    addrs.length = 0;
+  }
 
-    if (i < 50 && addr->port != pool->network->port)
-      continue;
+  btc_vector_destroy(snapshot);
+  btc_addrs_clear(&addrs);
+}
 
-    if (pool->only_net != BTC_IPNET_NONE) {
-      if (btc_netaddr_network(addr) != pool->only_net)
-        continue;
-    }
+static void
+btc_pool_on_addr(btc_pool_t *pool,
+                 btc_peer_t *peer,
+                 const btc_addrs_t *addrs) {
+  uint64_t services = pool->required_services & ~BTC_NET_SERVICE_NETWORK;
+  uint64_t network = BTC_NET_SERVICE_NETWORK | BTC_NET_SERVICE_NETWORK_LIMITED;
+  int64_t now = btc_timedata_now(pool->timedata);
+  int64_t since = now - 10 * 60;
+  int64_t mark = btc_time_msec();
+  size_t dropped = 0;
+  btc_vector_t relay;
+  btc_vector_t items;
+  size_t i;
 
-    return addr;
+  if (addrs->length > 1000) {
+    btc_peer_increase_ban(peer, 20);
+    return;
   }
 
-  return NULL;
-}
+  /* Addr traffic would give the link away. */
+  if (peer->block_relay)
+    return;
 
-static void
-btc_pool_ban(btc_pool_t *pool, const btc_netaddr_t *addr) {
-  btc_peer_t *peer = btc_peers_get(&pool->peers, addr);
+  /* Refill the token bucket: one address every ten
+     seconds, plus whatever we asked for with getaddr. */
+  if (peer->addr_tokens < ADDR_TOKEN_MAX) {
+    peer->addr_tokens += (mark - peer->addr_time) * ADDR_TOKEN_RATE / 1000;
 
-  btc_pool_log(pool, "Banning peer (%N).", addr);
+    if (peer->addr_tokens > ADDR_TOKEN_MAX)
+      peer->addr_tokens = ADDR_TOKEN_MAX;
+  }
 
-  btc_addrman_ban(pool->addrman, addr);
-  btc_addrman_remove(pool->addrman, addr);
+  peer->addr_time = mark;
 
-  if (peer != NULL)
-    btc_peer_close(peer);
-}
+  btc_vector_init(&relay);
+  btc_vector_init(&items);
 
-static btc_peer_t *
-btc_pool_create_outbound(btc_pool_t *pool, const btc_netaddr_t *addr) {
-  btc_peer_t *peer = btc_peer_create(pool);
+  for (i = 0; i < addrs->length; i++) {
+    btc_netaddr_t *addr = addrs->items[i];
 
-  btc_addrman_mark_attempt(pool->addrman, addr);
+    if (peer->addr_tokens < 1) {
+      dropped++;
+      continue;
+    }
 
-  btc_pool_log(pool, "Connecting to %N.", addr);
+    peer->addr_tokens -= 1;
+    peer->addr_processed++;
 
-  if (!btc_peer_open(peer, addr)) {
-    const char *msg = btc_loop_strerror(pool->loop);
+    btc_filter_add_addr(&peer->addr_filter, addr);
 
-    btc_pool_log(pool, "Connection failed: %s (%N).", msg, addr);
-    btc_peer_destroy(peer);
+    if (!btc_netaddr_is_routable(addr))
+      continue;
 
-    return NULL;
-  }
+    if ((addr->services & services) != services)
+      continue;
 
-  return peer;
-}
+    /* Limited peers are kept for when we reach the tip. */
+    if ((addr->services & network) == 0)
+      continue;
 
-static int
-btc_pool_add_outbound(btc_pool_t *pool) {
-  const btc_netaddr_t *addr;
-  btc_peer_t *peer;
+    if (addr->port == 0)
+      continue;
 
-  if (pool->peers.outbound >= pool->max_outbound)
-    return 0;
+    if (btc_addrman_is_banned(pool->addrman, addr))
+      continue;
 
-  /* Hang back if we don't have a loader peer yet. */
-  if (pool->peers.load == NULL)
-    return 0;
+    if (addr->time <= 100000000 || addr->time > now + 10 * 60)
+      addr->time = now - 5 * 24 * 60 * 60;
 
-  addr = btc_pool_get_addr(pool);
+    if (!peer->getting_addr && addrs->length < 10) {
+      if (addr->time > since)
+        btc_vector_push(&relay, addr);
+    }
 
-  if (addr == NULL)
-    return 0;
+    btc_vector_push(&items, addr);
+  }
 
-  peer = btc_pool_create_outbound(pool, addr);
+  btc_addrman_add_many(pool->addrman, &items, &peer->addr);
 
-  if (peer == NULL)
-    return 0;
+  if (addrs->length < 1000)
+    peer->getting_addr = 0;
 
-  btc_peers_add(&pool->peers, peer);
+  peer->addr_dropped += dropped;
 
-  return 1;
-}
+  btc_pool_debug(pool,
+    "Received %zu addrs (dropped=%zu, hosts=%zu, peers=%zu) (%N).",
+    addrs->length,
+    dropped,
+    btc_addrman_total(pool->addrman),
+    pool->peers.length,
+    &peer->addr);
 
-static int
-btc_pool_is_syncable(btc_pool_t *pool, btc_peer_t *peer) {
-  if (peer->state != BTC_PEER_CONNECTED)
-    return 0;
+  if (relay.length > 0) {
+    btc_vector_t peers;
+    btc_peer_t *it;
 
-  if ((peer->services & pool->required_services) != pool->required_services)
-    return 0;
+    btc_pool_debug(pool, "Relaying %zu addrs to random peers.", relay.length);
 
-  if (!peer->loader) {
-    if (!btc_chain_synced(pool->chain))
-      return 0;
-  }
+    btc_vector_init(&peers);
 
-  return 1;
-}
+    for (it = pool->peers.head; it != NULL; it = it->next) {
+      if (it->state == BTC_PEER_CONNECTED && !it->block_relay)
+        btc_vector_push(&peers, it);
+    }
 
-static int
-btc_pool_send_locator(btc_pool_t *pool,
-                      btc_peer_t *peer,
-                      const btc_vector_t *locator) {
-  if (!btc_pool_is_syncable(pool, peer))
-    return 0;
+    if (peers.length > 0) {
+      for (i = 0; i < relay.length; i++) {
+        const btc_netaddr_t *addr = relay.items[i];
+        btc_peer_t *peer1 = peers.items[btc_uniform(peers.length)];
+        btc_peer_t *peer2 = peers.items[btc_uniform(peers.length)];
 
-  /* Ask for the mempool if we're synced. */
-  if (pool->network->request_mempool) {
-    if (peer->loader && btc_chain_synced(pool->chain))
-      btc_peer_send_mempool(peer);
-  }
+        if (!btc_filter_has_addr(&peer1->addr_filter, addr)) {
+          btc_filter_add_addr(&peer1->addr_filter, addr);
+          btc_peer_send_addr_1(peer1, addr);
+        }
 
-  peer->syncing = 1;
-  peer->block_time = btc_time_msec();
+        if (!btc_filter_has_addr(&peer2->addr_filter, addr)) {
+          btc_filter_add_addr(&peer2->addr_filter, addr);
+          btc_peer_send_addr_1(peer2, addr);
+        }
+      }
+    }
 
-  if (pool->checkpoints) {
-    btc_peer_send_getheaders(peer, locator, pool->header_tip->hash);
-    return 1;
+    btc_vector_clear(&peers);
   }
 
-  btc_peer_send_getblocks(peer, locator, NULL);
+  btc_vector_clear(&relay);
+  btc_vector_clear(&items);
 
-  return 1;
+  btc_pool_fill_outbound(pool);
 }
 
-static int
-btc_pool_send_sync(btc_pool_t *pool, btc_peer_t *peer) {
+static void
+btc_pool_resolve_orphan(btc_pool_t *pool,
+                        btc_peer_t *peer,
+                        const uint8_t *orphan) {
+  const uint8_t *root = btc_chain_get_orphan_root(pool->chain, orphan);
   btc_vector_t locator;
 
-  if (peer->syncing)
-    return 0;
-
-  if (!btc_pool_is_syncable(pool, peer))
-    return 0;
+  CHECK(root != NULL);
 
   btc_vector_init(&locator);
   btc_chain_get_locator(pool->chain, &locator, NULL);
-  btc_pool_send_locator(pool, peer, &locator);
+  btc_peer_send_getblocks(peer, &locator, root);
   btc_vector_clear(&locator);
+}
 
-  return 1;
+static void
+btc_pool_getblocks(btc_pool_t *pool,
+                   btc_peer_t *peer,
+                   const uint8_t *tip,
+                   const uint8_t *stop) {
+  btc_vector_t locator;
+
+  btc_vector_init(&locator);
+  btc_chain_get_locator(pool->chain, &locator, tip);
+  btc_peer_send_getblocks(peer, &locator, stop);
+  btc_vector_clear(&locator);
 }
 
 static void
-btc_pool_set_loader(btc_pool_t *pool, btc_peer_t *peer) {
-  CHECK(peer->outbound == 1);
-  CHECK(pool->peers.load == NULL);
-  CHECK(peer->loader == 0);
+btc_pool_request_blocks(btc_pool_t *pool,
+                        btc_peer_t *peer,
+                        const btc_vector_t *hashes) {
+  const uint8_t *hash;
+  btc_zinv_t inv;
+  uint8_t *key;
+  int64_t now;
+  size_t i;
 
-  peer->loader = 1;
-  pool->peers.load = peer;
+  if (peer->state != BTC_PEER_CONNECTED) {
+    btc_pool_log(pool, "Peer handshake not complete (getdata) (%N).",
+                       &peer->addr);
+    return;
+  }
 
-  btc_pool_send_sync(pool, peer);
-}
+  now = btc_time_msec();
 
-static int
-btc_pool_add_loader(btc_pool_t *pool) {
-  const btc_netaddr_t *addr;
-  btc_peer_t *peer;
+  /* Start timing deliveries from here. */
+  if (btc_hashtab_size(peer->block_map) == 0)
+    peer->block_mark = now;
 
-  CHECK(pool->peers.load == NULL);
+  btc_zinv_init(&inv);
+  btc_zinv_grow(&inv, hashes->length);
 
-  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
-    if (!peer->outbound)
+  for (i = 0; i < hashes->length; i++) {
+    hash = (const uint8_t *)hashes->items[i];
+
+    if (btc_hashset_has(pool->block_map, hash))
       continue;
 
-    btc_pool_log(pool, "Repurposing peer for loader (%N).", &peer->addr);
+    key = btc_hash_clone(hash);
+
+    btc_hashset_put(pool->block_map, key);
+    btc_hashtab_put(peer->block_map, key, now);
 
-    btc_pool_set_loader(pool, peer);
+    if (btc_chain_synced(pool->chain))
+      now += 100;
 
-    return 1;
+    btc_zinv_push(&inv, btc_peer_block_type(peer), hash);
   }
 
-  addr = btc_pool_get_addr(pool);
+  if (inv.length == 0) {
+    btc_zinv_clear(&inv);
+    return;
+  }
 
-  if (addr == NULL)
-    return 0;
+  if (btc_hashtab_size(peer->block_map) >= BTC_NET_MAX_BLOCK_REQUEST) {
+    btc_zinv_clear(&inv);
+    btc_pool_log(pool, "Peer advertised too many blocks (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
 
-  peer = btc_pool_create_outbound(pool, addr);
+  btc_pool_debug(pool,
+    "Requesting %zu/%zu blocks from peer with getdata (%N).",
+    inv.length, btc_hashset_size(pool->block_map), &peer->addr);
 
-  if (peer == NULL)
-    return 0;
+  btc_peer_stall_at(peer, btc_time_msec() + 120000);
+  btc_peer_send_getdata(peer, &inv);
 
-  btc_pool_log(pool, "Adding loader peer (%N).", &peer->addr);
+  btc_zinv_clear(&inv);
+}
 
-  btc_peers_add(&pool->peers, peer);
+static void
+btc_pool_on_blockinv(btc_pool_t *pool,
+                     btc_peer_t *peer,
+                     const btc_vector_t *hashes) {
+  const uint8_t *hash;
+  btc_vector_t out;
+  size_t i;
 
-  btc_pool_set_loader(pool, peer);
+  CHECK(hashes->length > 0);
 
-  return 1;
-}
+  peer->gb_time = -1;
 
-static int
-btc_pool_fill_outbound(btc_pool_t *pool) {
-  size_t total = btc_addrman_total(pool->addrman);
-  size_t i, need;
+  /* Ignore for now if we're still syncing. */
+  if (!btc_chain_synced(pool->chain) && !peer->loader)
+    return;
 
-  if (pool->flags & BTC_POOL_NOCONNECT)
-    return 0;
+  /* Request headers instead. */
+  if (pool->checkpoints)
+    return;
 
-  if (pool->peers.load == NULL) {
-    if (!btc_pool_add_loader(pool))
-      return 0;
-  }
+  btc_pool_debug(pool, "Received %zu block hashes from peer (%N).",
+                       hashes->length, &peer->addr);
 
-  if (pool->flags & BTC_POOL_CONNECT)
-    return 0;
+  btc_vector_init(&out);
 
-  if (pool->peers.outbound >= pool->max_outbound)
-    return 1;
+  for (i = 0; i < hashes->length; i++) {
+    hash = (const uint8_t *)hashes->items[i];
 
-  need = pool->max_outbound - pool->peers.outbound;
+    /* Ignore invalid (maybe ban?). */
+    if (btc_chain_has_invalid(pool->chain, hash))
+      continue;
 
-  if (need > total)
-    need = total;
+    /* Resolve orphan chain. */
+    if (btc_chain_has_orphan(pool->chain, hash)) {
+      btc_pool_debug(pool, "Received known orphan hash (%N).", &peer->addr);
+      btc_pool_resolve_orphan(pool, peer, hash);
+      continue;
+    }
 
-  if (need == 0)
-    return 0;
+    /* Request the block if we don't have it. */
+    if (!btc_chain_has_hash(pool->chain, hash)) {
+      btc_vector_push(&out, hash);
+      continue;
+    }
 
-  btc_pool_log(pool, "Refilling %zu peers (%zu/%zu).", need,
-               pool->peers.outbound, pool->max_outbound);
+    /* Normally we request the hashContinue.
+       In the odd case where we already have
+       it, we can do one of two things: either
+       force re-downloading of the block to
+       continue the sync, or do a getblocks
+       from the last hash. */
+    if (i == hashes->length - 1) {
+      btc_pool_debug(pool, "Received existing hash (%N).", &peer->addr);
+      btc_pool_getblocks(pool, peer, hash, NULL);
+    }
+  }
 
-  for (i = 0; i < need; i++)
-    btc_pool_add_outbound(pool);
+  btc_pool_request_blocks(pool, peer, &out);
 
-  return 1;
+  btc_vector_clear(&out);
 }
 
 static void
-btc_pool_on_tick(btc_pool_t *pool, int64_t now) {
-  if (now >= pool->refill_timer + 3000) {
-    btc_pool_fill_outbound(pool);
-    pool->refill_timer = now;
+btc_pool_request_txs(btc_pool_t *pool,
+                     btc_peer_t *peer,
+                     const btc_vector_t *hashes,
+                     uint32_t type,
+                     int preferred) {
+  btc_txfetch_t *items;
+  const uint8_t *hash;
+  btc_txreq_t *req;
+  btc_peer_t *target;
+  int64_t now, time;
+  size_t i, count;
+
+  if (peer->state != BTC_PEER_CONNECTED) {
+    btc_pool_log(pool, "Peer handshake not complete (getdata) (%N).",
+                       &peer->addr);
+    return;
   }
 
-  if (now >= pool->flush_timer + 10 * 60 * 1000) {
-    btc_addrman_flush(pool->addrman);
-    pool->flush_timer = now;
+  if (peer->tx_announced + hashes->length > BTC_NET_MAX_TX_REQUEST) {
+    btc_pool_log(pool, "Peer advertised too many txs (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    return;
   }
-}
 
-static void
-btc_pool_on_socket(btc_pool_t *pool, btc_socket_t *socket) {
-  btc_sockaddr_t sa;
-  btc_netaddr_t na;
-  btc_peer_t *peer;
+  now = btc_time_msec();
+  time = now;
 
-  btc_socket_address(&sa, socket);
+  /* Outbound peers get a head start, and a peer
+     already sitting on plenty of our requests
+     waits behind anyone else who has it. */
+  if (!preferred && !peer->outbound)
+    time += TX_INBOUND_DELAY;
 
-  if (pool->peers.length >= pool->max_inbound) {
-    btc_pool_log(pool, "Ignoring inbound peer (%S).", &sa);
-    btc_socket_close(socket);
-    return;
-  }
+  if (btc_hashtab_size(peer->tx_map) >= TX_MAX_INFLIGHT)
+    time += TX_OVERLOAD_DELAY;
 
-  btc_netaddr_set_sockaddr(&na, &sa);
+  items = (btc_txfetch_t *)btc_malloc((hashes->length + 1)
+                                      * sizeof(btc_txfetch_t));
+  count = 0;
 
-  if (btc_addrman_is_banned(pool->addrman, &na)) {
-    btc_pool_log(pool, "Ignoring banned peer (%S).", &sa);
-    btc_socket_close(socket);
-    return;
-  }
+  for (i = 0; i < hashes->length; i++) {
+    hash = (const uint8_t *)hashes->items[i];
+    req = btc_hashmap_get(pool->tx_map, hash);
 
-  btc_pool_log(pool, "Accepting inbound peer (%S).", &sa);
+    if (req == NULL) {
+      req = btc_txreq_create(hash);
+      btc_hashmap_put(pool->tx_map, req->hash, req);
+    }
+
+    if (!btc_txreq_add(req, peer, type, time))
+      continue;
 
-  peer = btc_peer_create(pool);
+    peer->tx_announced++;
 
-  if (!btc_peer_accept(peer, socket)) {
-    const char *msg = btc_loop_strerror(pool->loop);
+    if (req->peer != NULL)
+      continue;
 
-    btc_pool_log(pool, "Connection failed: %s (%S).", msg, &sa);
-    btc_peer_destroy(peer);
+    target = btc_pool_assign_tx(pool, req, now);
 
-    return;
+    if (target != NULL) {
+      items[count].peer = target;
+      items[count].type = req->type;
+      items[count].hash = req->hash;
+      count++;
+    }
   }
 
-  btc_peers_add(&pool->peers, peer);
+  if (count > 0)
+    btc_pool_fetch_txs(pool, items, count);
+
+  btc_free(items);
 }
 
-static void
-btc_pool_on_connect(btc_pool_t *pool, btc_peer_t *peer) {
-  btc_pool_log(pool, "Connected to %N.", &peer->addr);
+static int
+btc_pool_has_tx(btc_pool_t *pool, const uint8_t *hash, int wtx) {
+  if (wtx) {
+    if (btc_mempool_has_wtx(pool->mempool, hash))
+      return 1;
 
-  if (peer->outbound)
-    btc_addrman_mark_success(pool->addrman, &peer->addr);
+    if (btc_mempool_has_orphan_wtx(pool->mempool, hash))
+      return 1;
+  } else {
+    /* Check the mempool. */
+    if (btc_mempool_has(pool->mempool, hash))
+      return 1;
+
+    /* Check for orphans. */
+    if (btc_mempool_has_orphan(pool->mempool, hash))
+      return 1;
+  }
+
+  /* If we recently rejected this item. Ignore. */
+  if (btc_mempool_has_reject(pool->mempool, hash)) {
+    btc_pool_debug(pool, "Saw known reject of %H.", hash);
+    return 1;
+  }
+
+  return 0;
 }
 
 static void
-btc_pool_on_complete(btc_pool_t *pool, btc_peer_t *peer) {
-  const btc_netaddr_t *addr;
+btc_pool_on_txinv(btc_pool_t *pool,
+                  btc_peer_t *peer,
+                  const btc_vector_t *hashes) {
+  uint32_t type = btc_peer_tx_type(peer);
+  int wtx = (type == BTC_INV_WTX);
+  const uint8_t *hash;
+  btc_vector_t out;
+  size_t i;
 
-  if (peer->outbound) {
-    /* Advertise our address. */
-    if ((pool->flags & BTC_POOL_LISTEN) && btc_chain_synced(pool->chain)) {
-      addr = btc_addrman_get_local(pool->addrman, &peer->addr, pool->services);
+  CHECK(hashes->length > 0);
 
-      if (addr != NULL)
-        btc_peer_send_addr_1(peer, addr);
-    }
+  if (!btc_chain_synced(pool->chain))
+    return;
 
-    /* Find some more peers. */
-    btc_peer_send_getaddr(peer);
-    peer->getting_addr = 1;
-  }
+  if (pool->flags & BTC_POOL_BLOCKSONLY)
+    return;
 
-  /* We want compact blocks! */
-  if (pool->flags & BTC_POOL_BIP152)
-    btc_peer_send_sendcmpct(peer, pool->block_mode);
+  /* We told them not to (relay=0). */
+  if (peer->block_relay)
+    return;
 
-  if (peer->outbound) {
-    /* Start syncing the chain. */
-    btc_pool_send_sync(pool, peer);
+  btc_vector_init(&out);
 
-    /* Mark success. */
-    btc_addrman_mark_ack(pool->addrman, &peer->addr, peer->services);
+  for (i = 0; i < hashes->length; i++) {
+    hash = (const uint8_t *)hashes->items[i];
 
-    /* If we don't have an ack'd loader yet, consider it dead. */
-    if (!peer->loader && pool->peers.load != NULL) {
-      if (pool->peers.load->state != BTC_PEER_CONNECTED) {
-        pool->peers.load->loader = 0;
-        pool->peers.load = NULL;
-      }
-    }
+    if (btc_pool_has_tx(pool, hash, wtx))
+      continue;
 
-    /* If we do not have a loader, use this peer. */
-    if (pool->peers.load == NULL)
-      btc_pool_set_loader(pool, peer);
+    btc_vector_push(&out, hash);
   }
+
+  btc_pool_request_txs(pool, peer, &out, type, 0);
+
+  btc_vector_clear(&out);
 }
 
 static void
-btc_pool_resync(btc_pool_t *pool, int force) {
-  btc_vector_t locator;
-  btc_peer_t *peer;
+btc_pool_on_inv(btc_pool_t *pool,
+                btc_peer_t *peer,
+                const btc_zinv_t *inv) {
+  btc_zinvitem_t item;
+  int64_t unknown = -1;
+  btc_vector_t blocks;
+  btc_vector_t txs;
+  size_t i;
 
-  btc_vector_init(&locator);
-  btc_chain_get_locator(pool->chain, &locator, NULL);
+  if (inv->length > BTC_NET_MAX_INV) {
+    btc_peer_increase_ban(peer, 20);
+    return;
+  }
 
-  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
-    if (!peer->outbound)
-      continue;
+  btc_vector_init(&blocks);
+  btc_vector_init(&txs);
 
-    if (!force && peer->syncing)
-      continue;
+  for (i = 0; i < inv->length; i++) {
+    btc_zinv_item(&item, inv, i);
 
-    btc_pool_send_locator(pool, peer, &locator);
-  }
+    switch (item.type) {
+      case BTC_INV_BLOCK:
+        btc_vector_push(&blocks, item.hash);
+        break;
+      case BTC_INV_TX:
+        /* Superseded by wtxids (BIP339). */
+        if (!peer->wtxid_relay)
+          btc_vector_push(&txs, item.hash);
+        break;
+      case BTC_INV_WTX:
+        if (peer->wtxid_relay)
+          btc_vector_push(&txs, item.hash);
+        break;
+      default:
+        unknown = item.type;
+        break;
+    }
 
-  btc_vector_clear(&locator);
-}
+    btc_filter_add(&peer->inv_filter, item.hash, 32);
+  }
 
-static int
-btc_pool_resolve_block(btc_pool_t *pool,
-                       btc_peer_t *peer,
-                       const uint8_t *hash) {
-  uint8_t *key = btc_hashtab_del(peer->block_map, hash);
+  btc_pool_debug(pool,
+    "Received inv message with %zu items: blocks=%zu txs=%zu (%N).",
+    inv->length, blocks.length, txs.length, &peer->addr);
 
-  if (key == NULL)
-    return 0;
+  if (unknown != -1) {
+    btc_pool_log(pool,
+      "Peer sent an unknown inv type: %u (%N).",
+      (uint32_t)unknown, &peer->addr);
+  }
 
-  CHECK(btc_hashset_del(pool->block_map, hash) == key);
+  if (blocks.length > 0)
+    btc_pool_on_blockinv(pool, peer, &blocks);
 
-  btc_free(key);
+  if (txs.length > 0)
+    btc_pool_on_txinv(pool, peer, &txs);
 
-  return 1;
+  btc_vector_clear(&blocks);
+  btc_vector_clear(&txs);
 }
 
-static int
-btc_pool_resolve_tx(btc_pool_t *pool,
+static void
+btc_pool_on_getdata(btc_pool_t *pool,
                     btc_peer_t *peer,
-                    const uint8_t *hash) {
-  uint8_t *key = btc_hashtab_del(peer->tx_map, hash);
-
-  if (key == NULL)
-    return 0;
+                    const btc_zinv_t *msg) {
+  size_t i;
 
-  CHECK(btc_hashset_del(pool->tx_map, hash) == key);
+  if (msg->length > BTC_NET_MAX_INV) {
+    btc_pool_log(pool, "Peer sent inv with >50k items (%n).",
+                       &peer->addr);
+    btc_peer_increase_ban(peer, 20);
+    return;
+  }
 
-  btc_free(key);
+  for (i = 0; i < msg->length; i++)
+    btc_peer_send_data(peer, btc_zinv_get(msg, i));
 
-  return 1;
-}
+  btc_peer_flush_data(peer);
 
-static int
-btc_pool_resolve_item(btc_pool_t *pool,
-                      btc_peer_t *peer,
-                      const btc_zinvitem_t *item) {
-  switch (item->type) {
-    case BTC_INV_TX:
-    case BTC_INV_WITNESS_TX:
-      return btc_pool_resolve_tx(pool, peer, item->hash);
-    case BTC_INV_BLOCK:
-    case BTC_INV_FILTERED_BLOCK:
-    case BTC_INV_CMPCT_BLOCK:
-    case BTC_INV_WITNESS_BLOCK:
-    case BTC_INV_WITNESS_FILTERED_BLOCK:
-      return btc_pool_resolve_block(pool, peer, item->hash);
-    default:
-      return 0;
+  if (peer->sending.length > BTC_NET_MAX_INV) {
+    btc_peer_log(peer, "Peer exceeded getdata queue (%N).", &peer->addr);
+    btc_peer_close(peer);
+    return;
   }
 }
 
 static void
-btc_pool_remove_peer(btc_pool_t *pool, btc_peer_t *peer) {
-  btc_hashtabiter_t tabit;
-  btc_hashmapiter_t mapit;
+btc_pool_on_notfound(btc_pool_t *pool,
+                     btc_peer_t *peer,
+                     const btc_zinv_t *msg) {
+  btc_zinvitem_t item;
+  size_t i;
 
-  btc_peers_remove(&pool->peers, peer);
+  for (i = 0; i < msg->length; i++) {
+    btc_zinv_item(&item, msg, i);
 
-  /* Remove block hashes. */
-  btc_hashtab_iterate(&tabit, peer->block_map);
+    if (!btc_pool_resolve_item(pool, peer, &item)) {
+      btc_pool_log(pool,
+        "Peer sent notfound for unrequested item: %H (%N).",
+        item.hash, &peer->addr);
+      btc_peer_close(peer);
+      return;
+    }
+  }
+}
 
-  while (btc_hashtab_next(&tabit))
-    CHECK(btc_hashset_del(pool->block_map, tabit.key));
+static size_t
+btc_pool_inv_size(btc_pool_t *pool,
+                  const btc_entry_t *start,
+                  const btc_entry_t *stop,
+                  size_t max) {
+  size_t length;
 
-  /* Remove TXIDs. */
-  btc_hashtab_iterate(&tabit, peer->tx_map);
+  if (start == NULL)
+    return 0;
 
-  while (btc_hashtab_next(&tabit))
-    CHECK(btc_hashset_del(pool->tx_map, tabit.key));
+  if (stop == NULL || stop->height < start->height)
+    stop = btc_chain_tip(pool->chain);
 
-  /* Remove compact block hashes. */
-  btc_hashmap_iterate(&mapit, peer->compact_map);
+  length = stop->height - start->height + 1;
 
-  while (btc_hashmap_next(&mapit))
-    CHECK(btc_hashset_del(pool->compact_map, mapit.key));
+  if (length > max)
+    length = max;
+
+  return length;
 }
 
 static void
-btc_pool_on_close(btc_pool_t *pool, btc_peer_t *peer) {
-  int loader = peer->loader;
-  size_t size = btc_hashtab_size(peer->block_map);
-
-  btc_pool_remove_peer(pool, peer);
+btc_pool_on_getblocks(btc_pool_t *pool,
+                      btc_peer_t *peer,
+                      const btc_getblocks_t *msg) {
+  const btc_entry_t *entry, *stop;
+  btc_zinv_t blocks;
 
-  if (loader) {
-    btc_pool_log(pool, "Removed loader peer (%N).", &peer->addr);
-    if (pool->checkpoints)
-      btc_pool_reset_chain(pool);
-  }
+  if (!btc_chain_synced(pool->chain))
+    return;
 
-  btc_nonces_remove(&pool->nonces, peer->nonce);
+  entry = btc_chain_find_locator(pool->chain, &msg->locator);
 
-  if (btc_chain_synced(pool->chain) && size > 0) {
-    btc_pool_log(pool, "Peer disconnected with requested blocks (%N).",
-                       &peer->addr);
-    btc_pool_log(pool, "Resending sync...");
-    btc_pool_resync(pool, 1);
-  }
+  if (entry != NULL)
+    entry = entry->next;
 
-  btc_peer_destroy(peer);
-}
+  stop = btc_chain_by_hash(pool->chain, msg->stop);
 
-static void
-btc_pool_on_version(btc_pool_t *pool,
-                    btc_peer_t *peer,
-                    const btc_version_t *msg) {
-  btc_pool_log(pool,
-    "Received version (%N): version=%d height=%d services=%#.16llx agent=%s",
-    &peer->addr,
-    msg->version,
-    msg->height,
-    msg->services,
-    msg->agent);
+  btc_zinv_init(&blocks);
+  btc_zinv_grow(&blocks, btc_pool_inv_size(pool, entry, stop, 500));
 
-  if (pool->timedata != NULL) {
-    size_t length = pool->timedata->length;
-    int64_t offset = pool->timedata->offset;
+  while (entry != NULL) {
+    if (entry == stop)
+      break;
 
-    if (!btc_timedata_add(pool->timedata, msg->time)) {
-      btc_pool_log(pool, "Adjusted time mismatch!");
-      btc_pool_log(pool, "Please make sure your system clock is correct!");
-    }
+    /* Pruned from here on. */
+    if (!btc_pool_can_serve(pool, entry))
+      break;
 
-    if (pool->timedata->length != length) {
-      int64_t sample = msg->time - btc_now();
+    btc_zinv_push(&blocks, BTC_INV_BLOCK, entry->hash);
 
-      btc_pool_log(pool, "Added time data: total=%zu, sample=%T (%T minutes).",
-                         pool->timedata->length, sample, sample / 60);
+    if (blocks.length == 500) {
+      btc_hash_copy(peer->hash_continue, entry->hash);
+      break;
     }
 
-    if (pool->timedata->offset != offset) {
-      btc_pool_log(pool, "Time offset: %T (%T minutes).",
-                         pool->timedata->offset,
-                         pool->timedata->offset / 60);
-    }
+    entry = entry->next;
   }
 
-  btc_nonces_remove(&pool->nonces, peer->nonce);
+  if (blocks.length > 0)
+    btc_peer_send_inv(peer, &blocks);
 
-  if (!peer->outbound && btc_netaddr_is_routable(&msg->remote))
-    btc_addrman_mark_local(pool->addrman, &msg->remote);
+  btc_zinv_clear(&blocks);
 }
 
 static void
-btc_pool_on_verack(btc_pool_t *pool, btc_peer_t *peer) {
-  (void)pool;
-  (void)peer;
-}
+btc_pool_on_getheaders(btc_pool_t *pool,
+                       btc_peer_t *peer,
+                       const btc_getblocks_t *msg) {
+  const btc_entry_t *entry, *stop;
+  int32_t start, end, height;
+  const uint8_t *slice;
+  size_t count, length;
+  uint8_t *data, *zp;
 
-static void
-btc_pool_on_ping(btc_pool_t *pool,
-                 btc_peer_t *peer,
-                 const btc_ping_t *ping) {
-  (void)pool;
-  (void)peer;
-  (void)ping;
-}
+  if (!btc_chain_synced(pool->chain))
+    return;
 
-static void
-btc_pool_on_pong(btc_pool_t *pool,
-                 btc_peer_t *peer,
-                 const btc_pong_t *pong) {
-  (void)pool;
-  (void)peer;
-  (void)pong;
-}
+  if (msg->locator.length > 0) {
+    entry = btc_chain_find_locator(pool->chain, &msg->locator);
 
-static void
-btc_pool_on_getaddr(btc_pool_t *pool, btc_peer_t *peer) {
-  btc_vector_t *snapshot;
-  btc_addrs_t addrs;
-  size_t i;
+    if (entry != NULL)
+      entry = entry->next;
 
-  if (peer->outbound) {
-    btc_pool_log(pool, "Ignoring getaddr from outbound node (%N).",
-                       &peer->addr);
-    return;
+    stop = btc_chain_by_hash(pool->chain, msg->stop);
+  } else {
+    entry = btc_chain_by_hash(pool->chain, msg->stop);
+    stop = entry;
   }
 
-  if (peer->sent_addr) {
-    btc_pool_log(pool, "Ignoring repeated getaddr (%N).",
-                       &peer->addr);
+  if (entry == NULL)
+    return;
+
+  /* A stale header asked for by hash. */
+  if (!btc_chain_is_main(pool->chain, entry)) {
+    btc_filter_add(&peer->inv_filter, entry->hash, 32);
+    btc_peer_send_headers_1(peer, &entry->header);
     return;
   }
 
-  peer->sent_addr = 1;
+  if (stop != NULL && !btc_chain_is_main(pool->chain, stop))
+    stop = NULL;
 
-  btc_addrs_init(&addrs);
+  count = btc_pool_inv_size(pool, entry, stop, 2000);
+  start = entry->height;
+  end = start + (int32_t)count - 1;
 
-  snapshot = btc_addrman_getaddr(pool->addrman);
+  for (height = start; height <= end; height++) {
+    entry = btc_chain_by_height(pool->chain, height);
+    btc_filter_add(&peer->inv_filter, entry->hash, 32);
+  }
 
-  for (i = 0; i < snapshot->length; i++) {
-    const btc_netaddr_t *addr = snapshot->items[i];
+  slice = btc_hdrarray_slice(&pool->header_array, pool->chain, start, end);
 
-    if (btc_filter_has_addr(&peer->addr_filter, addr))
-      continue;
+  length = btc_size_size(count) + count * HEADER_RECORD_SIZE;
+  data = (uint8_t *)btc_malloc(24 + length);
 
-    btc_filter_add_addr(&peer->addr_filter, addr);
+  zp = btc_uint32_write(data, pool->network->magic);
+  zp = btc_nullstr_write(zp, 12, "headers");
+  zp = btc_uint32_write(zp, length);
+  zp = btc_uint32_write(zp, 0);
 
-    btc_addrs_push(&addrs, (btc_netaddr_t *)addr);
+  zp = btc_size_write(zp, count);
+  memcpy(zp, slice, count * HEADER_RECORD_SIZE);
 
-    if (addrs.length == 1000)
-      break;
-  }
+  btc_uint32_write(data + 20, btc_checksum(data + 24, length));
 
-  btc_pool_log(pool, "Sending %zu addrs to peer (%N)",
-                     addrs.length, &peer->addr);
+  btc_peer_write(peer, data, 24 + length);
+}
 
-  if (addrs.length > 0) {
-    btc_peer_send_addr(peer, &addrs);
-    addrs.length = 0;
-  }
+/* Blocks are fetched in a window of heights above
+ * the tip. Each outbound peer takes as many of the
+ * unrequested blocks as its limit allows, and the
+ * limit follows the rate at which it delivers.
+ *
+ * The window is also capped in bytes: blocks held
+ * ahead of the tip plus the expected size of those
+ * in flight may not exceed the block buffer. The
+ * blocks just above the tip are always requested,
+ * so a full buffer can't starve the tip.
+ */
 
-  btc_vector_destroy(snapshot);
-  btc_addrs_clear(&addrs);
+static size_t
+btc_pool_block_budget(btc_pool_t *pool) {
+  size_t avg = pool->block_avg > 0 ? (size_t)pool->block_avg : 0;
+  size_t used = pool->block_buffer;
+
+  used += btc_hashset_size(pool->block_map) * avg;
+
+  if (used >= pool->block_buffer_max)
+    return 0;
+
+  return pool->block_buffer_max - used;
 }
 
 static void
-btc_pool_on_addr(btc_pool_t *pool,
-                 btc_peer_t *peer,
-                 const btc_addrs_t *addrs) {
-  uint64_t services = pool->required_services;
-  int64_t now = btc_timedata_now(pool->timedata);
-  int64_t since = now - 10 * 60;
-  btc_vector_t relay;
-  size_t i;
+btc_pool_request_window(btc_pool_t *pool) {
+  int32_t tip = btc_chain_height(pool->chain);
+  int32_t end = tip + BLOCK_WINDOW;
+  btc_hdrnode_t *start, *prev, *node;
+  btc_vector_t peers, items;
+  size_t i, count, avg, budget;
+  btc_peer_t *peer;
 
-  if (addrs->length > 1000) {
-    btc_peer_increase_ban(peer, 20);
+  if (!pool->checkpoints)
     return;
-  }
 
-  btc_vector_init(&relay);
+  avg = pool->block_avg > 0 ? (size_t)pool->block_avg : 0;
+  budget = btc_pool_block_budget(pool);
 
-  for (i = 0; i < addrs->length; i++) {
-    btc_netaddr_t *addr = addrs->items[i];
+  pool->window_full = 0;
+  pool->window_throttled = 0;
 
-    btc_filter_add_addr(&peer->addr_filter, addr);
+  start = pool->header_head;
 
-    if (!btc_netaddr_is_routable(addr))
-      continue;
+  btc_vector_init(&peers);
+  btc_vector_init(&items);
 
-    if ((addr->services & services) != services)
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (peer->state != BTC_PEER_CONNECTED)
       continue;
 
-    if (addr->port == 0)
+    if (!peer->outbound)
       continue;
 
-    if (btc_addrman_is_banned(pool->addrman, addr))
+    if ((peer->services & pool->required_services)
+        != pool->required_services) {
       continue;
-
-    if (addr->time <= 100000000 || addr->time > now + 10 * 60)
-      addr->time = now - 5 * 24 * 60 * 60;
-
-    if (!peer->getting_addr && addrs->length < 10) {
-      if (addr->time > since)
-        btc_vector_push(&relay, addr);
     }
 
-    btc_addrman_add(pool->addrman, addr, &peer->addr);
+    btc_vector_push(&peers, peer);
   }
 
-  if (addrs->length < 1000)
-    peer->getting_addr = 0;
-
-  btc_pool_log(pool,
-    "Received %zu addrs (hosts=%zu, peers=%zu) (%N).",
-    addrs->length,
-    btc_addrman_total(pool->addrman),
-    pool->peers.length,
-    &peer->addr);
+  /* The fastest peers get the lowest heights,
+     which are the ones holding up the tip. */
+  qsort(peers.items, peers.length, sizeof(void *), peer_cmp);
 
-  if (relay.length > 0) {
-    btc_vector_t peers;
-    btc_peer_t *it;
+  for (i = 0; i < peers.length; i++) {
+    peer = peers.items[i];
+    count = btc_hashtab_size(peer->block_map);
 
-    btc_pool_log(pool, "Relaying %zu addrs to random peers.", relay.length);
+    if (count >= (size_t)peer->block_limit)
+      continue;
 
-    btc_vector_init(&peers);
+    prev = start;
 
-    for (it = pool->peers.head; it != NULL; it = it->next) {
-      if (it->state == BTC_PEER_CONNECTED)
-        btc_vector_push(&peers, it);
-    }
+    for (node = prev->next; node != NULL; node = node->next) {
+      if (node->height > end || node->height > peer->height)
+        break;
 
-    if (peers.length > 0) {
-      for (i = 0; i < relay.length; i++) {
-        const btc_netaddr_t *addr = relay.items[i];
-        btc_peer_t *peer1 = peers.items[btc_uniform(peers.length)];
-        btc_peer_t *peer2 = peers.items[btc_uniform(peers.length)];
+      /* Skip blocks in flight or already held.
+         A leading run of these is skipped for
+         the remaining peers too. */
+      if (btc_hashset_has(pool->block_map, node->hash)
+          || btc_hashmap_has(pool->block_pending, prev->hash)) {
+        if (prev == start)
+          start = node;
 
-        if (!btc_filter_has_addr(&peer1->addr_filter, addr)) {
-          btc_filter_add_addr(&peer1->addr_filter, addr);
-          btc_peer_send_addr_1(peer1, addr);
-        }
+        prev = node;
 
-        if (!btc_filter_has_addr(&peer2->addr_filter, addr)) {
-          btc_filter_add_addr(&peer2->addr_filter, addr);
-          btc_peer_send_addr_1(peer2, addr);
-        }
+        continue;
       }
-    }
 
-    btc_vector_clear(&peers);
-  }
+      if (count + items.length >= (size_t)peer->block_limit)
+        break;
 
-  btc_vector_clear(&relay);
+      if (node->height > tip + BLOCK_BUFFER_RESERVE && budget < avg) {
+        pool->window_throttled = 1;
+        break;
+      }
 
-  btc_pool_fill_outbound(pool);
-}
+      btc_vector_push(&items, node->hash);
 
-static void
-btc_pool_resolve_orphan(btc_pool_t *pool,
-                        btc_peer_t *peer,
-                        const uint8_t *orphan) {
-  const uint8_t *root = btc_chain_get_orphan_root(pool->chain, orphan);
-  btc_vector_t locator;
+      budget -= budget < avg ? budget : avg;
 
-  CHECK(root != NULL);
+      prev = node;
+    }
 
-  btc_vector_init(&locator);
-  btc_chain_get_locator(pool->chain, &locator, NULL);
-  btc_peer_send_getblocks(peer, &locator, root);
-  btc_vector_clear(&locator);
-}
+    /* A peer had room but we had nothing to give. */
+    if (node == NULL || node->height > end || pool->window_throttled)
+      pool->window_full = 1;
 
-static void
-btc_pool_getblocks(btc_pool_t *pool,
-                   btc_peer_t *peer,
-                   const uint8_t *tip,
-                   const uint8_t *stop) {
-  btc_vector_t locator;
+    if (items.length > 0) {
+      btc_pool_request_blocks(pool, peer, &items);
+      items.length = 0;
+    }
+  }
 
-  btc_vector_init(&locator);
-  btc_chain_get_locator(pool->chain, &locator, tip);
-  btc_peer_send_getblocks(peer, &locator, stop);
-  btc_vector_clear(&locator);
+  btc_vector_clear(&peers);
+  btc_vector_clear(&items);
 }
 
 static void
-btc_pool_request_blocks(btc_pool_t *pool,
-                        btc_peer_t *peer,
-                        const btc_vector_t *hashes) {
-  const uint8_t *hash;
-  btc_zinv_t inv;
-  uint8_t *key;
-  int64_t now;
-  size_t i;
+btc_pool_check_window(btc_pool_t *pool, int64_t now) {
+  btc_hdrnode_t *node;
+  btc_peer_t *peer;
 
-  if (peer->state != BTC_PEER_CONNECTED) {
-    btc_pool_log(pool, "Peer handshake not complete (getdata) (%N).",
-                       &peer->addr);
+  if (!pool->checkpoints)
     return;
-  }
-
-  now = btc_time_msec();
-
-  btc_zinv_init(&inv);
-  btc_zinv_grow(&inv, hashes->length);
-
-  for (i = 0; i < hashes->length; i++) {
-    hash = (const uint8_t *)hashes->items[i];
-
-    if (btc_hashset_has(pool->block_map, hash))
-      continue;
 
-    key = btc_hash_clone(hash);
+  btc_pool_request_window(pool);
 
-    btc_hashset_put(pool->block_map, key);
-    btc_hashtab_put(peer->block_map, key, now);
+  node = pool->header_head->next;
 
-    if (btc_chain_synced(pool->chain))
-      now += 100;
+  /* A peer holding the block after our tip stalls the
+     whole window once everything else is handed out. */
+  if (!pool->window_full || node == NULL
+      || !btc_hashset_has(pool->block_map, node->hash)) {
+    pool->stall_time = -1;
+    return;
+  }
 
-    btc_zinv_push(&inv, btc_peer_block_type(peer), hash);
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (btc_hashtab_has(peer->block_map, node->hash))
+      break;
   }
 
-  if (inv.length == 0) {
-    btc_zinv_clear(&inv);
+  CHECK(peer != NULL);
+
+  if (pool->stall_time == -1
+      || pool->stall_id != peer->id
+      || pool->stall_height != node->height) {
+    pool->stall_time = now;
+    pool->stall_id = peer->id;
+    pool->stall_height = node->height;
     return;
   }
 
-  if (btc_hashtab_size(peer->block_map) >= BTC_NET_MAX_BLOCK_REQUEST) {
-    btc_zinv_clear(&inv);
-    btc_pool_log(pool, "Peer advertised too many blocks (%N).",
-                       &peer->addr);
-    btc_peer_close(peer);
+  if (now < pool->stall_time + pool->stall_timeout)
     return;
-  }
 
-  btc_pool_log(pool, "Requesting %zu/%zu blocks from peer with getdata (%N).",
-                     inv.length, btc_hashset_size(pool->block_map), &peer->addr);
+  btc_pool_log(pool, "Peer is stalling the block window at %d (%N).",
+                     node->height, &peer->addr);
 
-  btc_peer_send_getdata(peer, &inv);
+  /* Be more patient with the next one. */
+  pool->stall_time = -1;
+  pool->stall_timeout *= 2;
 
-  btc_zinv_clear(&inv);
+  if (pool->stall_timeout > MAX_STALL_TIMEOUT)
+    pool->stall_timeout = MAX_STALL_TIMEOUT;
+
+  /* Counts against it as a failed attempt, so we
+     are slower to pick it again. */
+  btc_addrman_mark_attempt(pool->addrman, &peer->addr);
+
+  btc_peer_close(peer);
 }
 
 static void
-btc_pool_on_blockinv(btc_pool_t *pool,
-                     btc_peer_t *peer,
-                     const btc_vector_t *hashes) {
-  const uint8_t *hash;
-  btc_vector_t out;
-  size_t i;
+btc_pool_shift_header(btc_pool_t *pool) {
+  btc_hdrnode_t *node = pool->header_head;
 
-  CHECK(hashes->length > 0);
+  pool->header_head = node->next;
 
-  peer->gb_time = -1;
+  btc_hdrnode_destroy(node);
 
-  /* Ignore for now if we're still syncing. */
-  if (!btc_chain_synced(pool->chain) && !peer->loader)
-    return;
+  if (pool->header_head == NULL)
+    pool->header_tail = NULL;
+}
 
-  /* Request headers instead. */
-  if (pool->checkpoints)
-    return;
+static void
+btc_pool_extend_chain(btc_pool_t *pool) {
+  int32_t height = btc_chain_height(pool->chain);
+  btc_peer_t *loader = pool->peers.load;
+  btc_hdrrange_t *range;
+  int moved = 0;
+
+  /* Move on to the next checkpoint once the headers
+     reach this one, unless a window's worth is queued. */
+  while (pool->header_tail->height == pool->header_tip->height) {
+    if (pool->header_tip->height >= pool->network->last_checkpoint)
+      return;
 
-  btc_pool_log(pool, "Received %zu block hashes from peer (%N).",
-                     hashes->length, &peer->addr);
+    if (pool->header_tail->height > height + BLOCK_WINDOW)
+      return;
 
-  btc_vector_init(&out);
+    range = pool->header_ranges.head;
+    moved = 1;
 
-  for (i = 0; i < hashes->length; i++) {
-    hash = (const uint8_t *)hashes->items[i];
+    if (range == NULL || range->start != pool->header_tip) {
+      pool->header_tip = btc_pool_next_tip(pool, pool->header_tip->height);
+      btc_pool_fill_ranges(pool);
+      break;
+    }
 
-    /* Ignore invalid (maybe ban?). */
-    if (btc_chain_has_invalid(pool->chain, hash))
-      continue;
+    btc_queue_shift(&pool->header_ranges);
+    btc_hdrrange_release(range);
 
-    /* Resolve orphan chain. */
-    if (btc_chain_has_orphan(pool->chain, hash)) {
-      btc_pool_log(pool, "Received known orphan hash (%N).", &peer->addr);
-      btc_pool_resolve_orphan(pool, peer, hash);
-      continue;
+    /* Take whatever was prefetched. */
+    if (range->head != NULL) {
+      pool->header_tail->next = range->head;
+      pool->header_tail = range->tail;
     }
 
-    /* Request the block if we don't have it. */
-    if (!btc_chain_has_hash(pool->chain, hash)) {
-      btc_vector_push(&out, hash);
-      continue;
-    }
+    pool->header_tip = range->stop;
 
-    /* Normally we request the hashContinue.
-       In the odd case where we already have
-       it, we can do one of two things: either
-       force re-downloading of the block to
-       continue the sync, or do a getblocks
-       from the last hash. */
-    if (i == hashes->length - 1) {
-      btc_pool_log(pool, "Received existing hash (%N).", &peer->addr);
-      btc_pool_getblocks(pool, peer, hash, NULL);
+    if (range->complete) {
+      btc_pool_log(pool, "Using prefetched headers up to %d.",
+                         range->stop->height);
     }
+
+    range->head = NULL;
+    range->tail = NULL;
+
+    btc_hdrrange_destroy(range);
+    btc_pool_fill_ranges(pool);
   }
 
-  btc_pool_request_blocks(pool, peer, &out);
+  if (!moved)
+    return;
 
-  btc_vector_clear(&out);
+  btc_pool_assign_ranges(pool);
+
+  /* The loader fetches the rest. */
+  if (pool->header_tail->height < pool->header_tip->height) {
+    if (loader != NULL && loader->state == BTC_PEER_CONNECTED) {
+      btc_peer_send_getheaders_1(loader, pool->header_tail->hash,
+                                         pool->header_tip->hash);
+    }
+  }
 }
 
 static void
-btc_pool_request_txs(btc_pool_t *pool,
-                     btc_peer_t *peer,
-                     const btc_vector_t *hashes) {
-  const uint8_t *hash;
-  btc_zinv_t inv;
-  uint8_t *key;
-  int64_t now;
-  size_t i;
+btc_pool_resolve_chain(btc_pool_t *pool) {
+  const btc_entry_t *tip = btc_chain_tip(pool->chain);
+  btc_peer_t *loader = pool->peers.load;
+  btc_hdrnode_t *node;
 
-  if (peer->state != BTC_PEER_CONNECTED) {
-    btc_pool_log(pool, "Peer handshake not complete (getdata) (%N).",
-                       &peer->addr);
+  if (!pool->checkpoints)
     return;
+
+  /* Drop the headers the chain has connected. */
+  while ((node = pool->header_head->next) != NULL) {
+    if (node->height > tip->height)
+      break;
+
+    btc_pool_shift_header(pool);
+
+    if (pool->stall_timeout > MIN_STALL_TIMEOUT) {
+      pool->stall_timeout = pool->stall_timeout * 85 / 100;
+
+      if (pool->stall_timeout < MIN_STALL_TIMEOUT)
+        pool->stall_timeout = MIN_STALL_TIMEOUT;
+    }
   }
 
-  now = btc_time_msec();
+  if (pool->header_head->height < pool->network->last_checkpoint) {
+    btc_pool_extend_chain(pool);
+    btc_pool_request_window(pool);
+    return;
+  }
 
-  btc_zinv_init(&inv);
-  btc_zinv_grow(&inv, hashes->length);
+  btc_pool_log(pool, "Switching to getblocks.");
 
-  for (i = 0; i < hashes->length; i++) {
-    hash = (const uint8_t *)hashes->items[i];
+  btc_pool_clear_chain(pool);
+  btc_pool_clear_ranges(pool);
 
-    if (btc_hashset_has(pool->tx_map, hash))
-      continue;
+  if (loader != NULL && loader->state == BTC_PEER_CONNECTED) {
+    btc_pool_request_assumed(pool, loader);
+    btc_pool_getblocks(pool, loader, tip->hash, NULL);
+  }
+}
 
-    key = btc_hash_clone(hash);
+static int
+btc_header_check(uint8_t *hash, const btc_header_t *hdr) {
+  uint8_t target[32];
 
-    btc_hashset_put(pool->tx_map, key);
-    btc_hashtab_put(peer->tx_map, key, now);
+  btc_header_hash(hash, hdr);
 
-    if (btc_chain_synced(pool->chain))
-      now += 50;
+  if (!btc_compact_export(target, hdr->bits))
+    return 0;
+
+  return btc_hash_compare(hash, target) <= 0;
+}
+
+static void
+btc_hdrjob_run(btc_hdrjob_t *job) {
+  size_t i;
 
-    btc_zinv_push(&inv, btc_peer_tx_type(peer), hash);
+  job->valid = 1;
+
+  for (i = 0; i < job->length; i++) {
+    if (!btc_header_check(job->hashes + i * 32, job->items[i]))
+      job->valid = 0;
   }
+}
 
-  if (inv.length == 0) {
-    btc_zinv_clear(&inv);
-    return;
+static void
+btc_hdrjob_work(void *arg) {
+  btc_hdrjob_t *job = (btc_hdrjob_t *)arg;
+
+  btc_hdrjob_run(job);
+
+  btc_mutex_lock(job->lock);
+
+  if (--*job->pending == 0)
+    btc_cond_signal(job->cond);
+
+  btc_mutex_unlock(job->lock);
+}
+
+static int
+btc_pool_verify_headers(btc_pool_t *pool,
+                        uint8_t *hashes,
+                        const btc_headers_t *msg) {
+  /* Hash and check the proof of work of a batch,
+     splitting it across the workers if we have
+     them. The last slice runs on this thread. */
+  btc_hdrjob_t jobs[16 + 1];
+  btc_mutex_t *lock = NULL;
+  btc_cond_t *cond = NULL;
+  size_t count = 1;
+  size_t i, pos, size;
+  int pending = 0;
+  int valid = 1;
+
+  if (pool->workers != NULL && msg->length >= 2 * HEADER_JOB_SIZE) {
+    count = msg->length / HEADER_JOB_SIZE;
+
+    if (count > (size_t)pool->threads + 1)
+      count = pool->threads + 1;
   }
 
-  if (btc_hashtab_size(peer->tx_map) >= BTC_NET_MAX_TX_REQUEST) {
-    btc_zinv_clear(&inv);
-    btc_pool_log(pool, "Peer advertised too many txs (%N).",
-                       &peer->addr);
-    btc_peer_close(peer);
-    return;
+  size = (msg->length + count - 1) / count;
+
+  if (count > 1) {
+    lock = btc_mutex_create();
+    cond = btc_cond_create();
+    pending = count - 1;
   }
 
-  btc_pool_log(pool, "Requesting %zu/%zu txs from peer with getdata (%N).",
-                     inv.length, btc_hashset_size(pool->tx_map), &peer->addr);
+  for (i = 0, pos = 0; i < count; i++, pos += size) {
+    btc_hdrjob_t *job = &jobs[i];
 
-  btc_peer_send_getdata(peer, &inv);
+    if (size > msg->length - pos)
+      size = msg->length - pos;
 
-  btc_zinv_clear(&inv);
-}
+    job->items = msg->items + pos;
+    job->length = size;
+    job->hashes = hashes + pos * 32;
+    job->valid = 0;
+    job->lock = lock;
+    job->cond = cond;
+    job->pending = &pending;
 
-static int
-btc_pool_has_tx(btc_pool_t *pool, const uint8_t *hash) {
-  /* Check the mempool. */
-  if (btc_mempool_has(pool->mempool, hash))
-    return 1;
+    if (i < count - 1)
+      btc_workers_add(pool->workers, btc_hdrjob_work, job);
+  }
 
-  /* Check for orphans. */
-  if (btc_mempool_has_orphan(pool->mempool, hash))
-    return 1;
+  btc_hdrjob_run(&jobs[count - 1]);
 
-  /* If we recently rejected this item. Ignore. */
-  if (btc_mempool_has_reject(pool->mempool, hash)) {
-    btc_pool_log(pool, "Saw known reject of %H.", hash);
-    return 1;
+  if (count > 1) {
+    btc_mutex_lock(lock);
+
+    while (pending > 0)
+      btc_cond_wait(cond, lock);
+
+    btc_mutex_unlock(lock);
+
+    btc_cond_destroy(cond);
+    btc_mutex_destroy(lock);
   }
 
-  return 0;
+  for (i = 0; i < count; i++)
+    valid &= jobs[i].valid;
+
+  return valid;
 }
 
 static void
-btc_pool_on_txinv(btc_pool_t *pool,
-                  btc_peer_t *peer,
-                  const btc_vector_t *hashes) {
-  const uint8_t *hash;
-  btc_vector_t out;
+btc_pool_add_range(btc_pool_t *pool,
+                   btc_peer_t *peer,
+                   const btc_headers_t *msg,
+                   const uint8_t *hashes) {
+  btc_hdrrange_t *range = peer->range;
+  const uint8_t *last = range->start->hash;
+  int32_t height = range->start->height;
+  btc_hdrnode_t *node;
   size_t i;
 
-  CHECK(hashes->length > 0);
+  if (range->tail != NULL) {
+    last = range->tail->hash;
+    height = range->tail->height;
+  }
 
-  if (!btc_chain_synced(pool->chain))
-    return;
+  for (i = 0; i < msg->length; i++) {
+    const btc_header_t *hdr = msg->items[i];
+    const uint8_t *hash = hashes + i * 32;
 
-  if (pool->flags & BTC_POOL_BLOCKSONLY)
-    return;
+    height += 1;
 
-  btc_vector_init(&out);
+    if (!btc_hash_equal(hdr->prev_block, last)
+        || height > range->stop->height
+        || (height == range->stop->height
+            && !btc_hash_equal(hash, range->stop->hash))) {
+      btc_pool_log(pool, "Peer sent a bad header range (%N).",
+                         &peer->addr);
+      btc_hdrrange_release(range);
+      btc_hdrrange_reset(range);
+      btc_peer_close(peer);
+      return;
+    }
 
-  for (i = 0; i < hashes->length; i++) {
-    hash = (const uint8_t *)hashes->items[i];
+    node = btc_hdrnode_create(hash, height);
 
-    if (btc_pool_has_tx(pool, hash))
-      continue;
+    if (range->head == NULL)
+      range->head = node;
 
-    btc_vector_push(&out, hash);
+    if (range->tail != NULL)
+      range->tail->next = node;
+
+    range->tail = node;
+
+    last = node->hash;
+  }
+
+  if (height < range->stop->height) {
+    btc_peer_send_getheaders_1(peer, last, range->stop->hash);
+    return;
   }
 
-  btc_pool_request_txs(pool, peer, &out);
+  btc_pool_log(pool, "Received headers %d-%d (%N).",
+                     range->start->height,
+                     range->stop->height,
+                     &peer->addr);
 
-  btc_vector_clear(&out);
+  range->complete = 1;
+
+  btc_hdrrange_release(range);
+  btc_pool_assign_ranges(pool);
 }
 
 static void
-btc_pool_on_inv(btc_pool_t *pool,
-                btc_peer_t *peer,
-                const btc_zinv_t *inv) {
-  const btc_zinvitem_t *item;
-  int64_t unknown = -1;
-  btc_vector_t blocks;
-  btc_vector_t txs;
+btc_pool_add_headers(btc_pool_t *pool,
+                     btc_peer_t *peer,
+                     const btc_headers_t *msg,
+                     const uint8_t *hashes) {
+  btc_hdrnode_t *node = NULL;
+  int checkpoint = 0;
   size_t i;
 
-  if (inv->length > BTC_NET_MAX_INV) {
-    btc_peer_increase_ban(peer, 20);
-    return;
-  }
+  CHECK(pool->header_head != NULL);
 
-  btc_vector_init(&blocks);
-  btc_vector_init(&txs);
+  for (i = 0; i < msg->length; i++) {
+    const btc_header_t *hdr = msg->items[i];
+    const uint8_t *hash = hashes + i * 32;
+    btc_hdrnode_t *last = pool->header_tail;
+    int32_t height = last->height + 1;
 
-  for (i = 0; i < inv->length; i++) {
-    item = &inv->items[i];
+    if (!btc_hash_equal(hdr->prev_block, last->hash)) {
+      btc_pool_log(pool, "Peer sent a bad header chain (%N).",
+                         &peer->addr);
+      btc_peer_close(peer);
+      return;
+    }
 
-    switch (item->type) {
-      case BTC_INV_BLOCK:
-        btc_vector_push(&blocks, item->hash);
-        break;
-      case BTC_INV_TX:
-        btc_vector_push(&txs, item->hash);
-        break;
-      default:
-        unknown = item->type;
-        break;
+    if (height == pool->header_tip->height) {
+      if (!btc_hash_equal(hash, pool->header_tip->hash)) {
+        btc_pool_log(pool, "Peer sent an invalid checkpoint (%N).",
+                           &peer->addr);
+        btc_peer_close(peer);
+        return;
+      }
+      checkpoint = 1;
     }
 
-    btc_filter_add(&peer->inv_filter, item->hash, 32);
+    node = btc_hdrnode_create(hash, height);
+
+    pool->header_tail->next = node;
+    pool->header_tail = node;
   }
 
-  btc_pool_log(pool,
-    "Received inv message with %zu items: blocks=%zu txs=%zu (%N).",
-    inv->length, blocks.length, txs.length, &peer->addr);
+  btc_pool_debug(pool, "Received %zu headers from peer (%N).",
+                       msg->length, &peer->addr);
 
-  if (unknown != -1) {
-    btc_pool_log(pool,
-      "Peer sent an unknown inv type: %u (%N).",
-      (uint32_t)unknown, &peer->addr);
+  /* If we received a valid header
+     chain, consider this a "block". */
+  peer->block_time = btc_time_msec();
+
+  /* Request more headers. */
+  if (checkpoint)
+    btc_pool_extend_chain(pool);
+  else
+    btc_peer_send_getheaders_1(peer, node->hash, pool->header_tip->hash);
+
+  /* Request the blocks we just added. */
+  btc_pool_request_window(pool);
+}
+
+static void
+btc_pool_add_assumed(btc_pool_t *pool,
+                     btc_peer_t *peer,
+                     const btc_headers_t *msg) {
+  uint8_t *hashes = NULL;
+
+  if (!peer->loader)
+    return;
+
+  if (msg->length > 2000) {
+    btc_peer_increase_ban(peer, 20);
+    return;
   }
 
-  if (blocks.length > 0)
-    btc_pool_on_blockinv(pool, peer, &blocks);
+  if (msg->length > 0) {
+    hashes = (uint8_t *)btc_malloc(msg->length * 32);
 
-  if (txs.length > 0)
-    btc_pool_on_txinv(pool, peer, &txs);
+    if (!btc_pool_verify_headers(pool, hashes, msg)) {
+      btc_pool_log(pool, "Peer sent an invalid header (%N).",
+                         &peer->addr);
+      btc_peer_increase_ban(peer, 100);
+      btc_free(hashes);
+      return;
+    }
+  }
 
-  btc_vector_clear(&blocks);
-  btc_vector_clear(&txs);
+  if (btc_chain_add_assumed(pool->chain, msg->items, hashes, msg->length))
+    btc_pool_request_assumed(pool, peer);
+  else
+    btc_pool_log(pool, "Peer sent unconnected headers (%N).", &peer->addr);
+
+  if (hashes != NULL)
+    btc_free(hashes);
 }
 
 static void
-btc_pool_on_getdata(btc_pool_t *pool,
+btc_pool_on_headers(btc_pool_t *pool,
                     btc_peer_t *peer,
-                    const btc_zinv_t *msg) {
-  size_t i;
+                    const btc_headers_t *msg) {
+  uint8_t *hashes;
 
-  if (msg->length > BTC_NET_MAX_INV) {
-    btc_pool_log(pool, "Peer sent inv with >50k items (%n).",
-                       &peer->addr);
-    btc_peer_increase_ban(peer, 20);
+  peer->gh_time = -1;
+
+  if (!pool->checkpoints) {
+    btc_pool_add_assumed(pool, peer, msg);
     return;
   }
 
-  for (i = 0; i < msg->length; i++)
-    btc_peer_send_data(peer, btc_zinv_get(msg, i));
+  if (!peer->loader && peer->range == NULL)
+    return;
 
-  btc_peer_flush_data(peer);
+  if (msg->length == 0) {
+    /* Let someone else try. */
+    if (peer->range != NULL)
+      btc_hdrrange_release(peer->range);
 
-  if (peer->sending.length > BTC_NET_MAX_INV) {
-    btc_peer_log(peer, "Peer exceeded getdata queue (%N).", &peer->addr);
-    btc_peer_close(peer);
     return;
   }
+
+  if (msg->length > 2000) {
+    btc_peer_increase_ban(peer, 20);
+    return;
+  }
+
+  hashes = (uint8_t *)btc_malloc(msg->length * 32);
+
+  if (!btc_pool_verify_headers(pool, hashes, msg)) {
+    btc_pool_log(pool, "Peer sent an invalid header (%N).",
+                       &peer->addr);
+    btc_peer_increase_ban(peer, 100);
+    btc_free(hashes);
+    return;
+  }
+
+  if (peer->range != NULL)
+    btc_pool_add_range(pool, peer, msg, hashes);
+  else
+    btc_pool_add_headers(pool, peer, msg, hashes);
+
+  btc_free(hashes);
 }
 
 static void
-btc_pool_on_notfound(btc_pool_t *pool,
-                     btc_peer_t *peer,
-                     const btc_zinv_t *msg) {
-  const btc_zinvitem_t *item;
-  size_t i;
+btc_pool_on_sendheaders(btc_pool_t *pool, btc_peer_t *peer) {
+  (void)pool;
+  (void)peer;
+}
 
-  for (i = 0; i < msg->length; i++) {
-    item = &msg->items[i];
+/* Fast relay: new blocks are pushed to a fixed
+ * set of trusted peers over UDP as witness compact
+ * blocks (the cmpctblock payload), cut into
+ * shards and Reed-Solomon parity is appended, so
+ * any k of the k + m datagrams rebuild it without
+ * a round trip. Each datagram is:
+ *
+ *   magic (4) || hash (32) || length (4) ||
+ *   k (1) || m (1) || index (1) || shard
+ *
+ * The receiver only listens to the addresses it
+ * was configured with and hands a decoded block
+ * to the TCP peer at the same address, which
+ * answers getblocktxn for anything our mempool
+ * is missing.
+ */
 
-    if (!btc_pool_resolve_item(pool, peer, item)) {
-      btc_pool_log(pool,
-        "Peer sent notfound for unrequested item: %H (%N).",
-        item->hash, &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
-  }
+static size_t
+btc_relay_shards(size_t length) {
+  return (length + RELAY_SHARD_SIZE - 1) / RELAY_SHARD_SIZE;
 }
 
 static size_t
-btc_pool_inv_size(btc_pool_t *pool,
-                  const btc_entry_t *start,
-                  const btc_entry_t *stop,
-                  size_t max) {
-  size_t length;
+btc_relay_parity(size_t k) {
+  return k / 2 + 1;
+}
 
-  if (start == NULL)
-    return 0;
+static void
+btc_pool_relay_send(btc_pool_t *pool,
+                    const uint8_t *hash,
+                    const uint8_t *data,
+                    size_t length,
+                    const btc_netaddr_t *from) {
+  btc_sockaddr_t addrs[RELAY_MAX_PEERS];
+  uint8_t *shards[BTC_FEC_MAX_SHARDS];
+  size_t k = btc_relay_shards(length);
+  size_t m = btc_relay_parity(k);
+  size_t i, j, count = 0;
+  uint8_t *buf;
+
+  if (length == 0 || k + m > BTC_FEC_MAX_SHARDS) {
+    btc_pool_debug(pool, "Block %H is too large to relay.", hash);
+    return;
+  }
 
-  if (stop == NULL || stop->height < start->height)
-    stop = btc_chain_tip(pool->chain);
+  for (i = 0; i < pool->relay_length; i++) {
+    const btc_netaddr_t *peer = &pool->relay_peers[i];
+    btc_sockaddr_t *addr = &addrs[count];
 
-  length = stop->height - start->height + 1;
+    /* Don't echo a block back to its sender. */
+    if (from != NULL && memcmp(peer->raw, from->raw, 16) == 0)
+      continue;
 
-  if (length > max)
-    length = max;
+    btc_netaddr_get_sockaddr(addr, peer);
 
-  return length;
-}
+    /* A dual-stack socket wants mapped addresses. */
+    if (pool->bind.family == BTC_AF_INET6 && addr->family == BTC_AF_INET) {
+      addr->family = BTC_AF_INET6;
+      memcpy(addr->raw, peer->raw, 16);
+    }
 
-static void
-btc_pool_on_getblocks(btc_pool_t *pool,
-                      btc_peer_t *peer,
-                      const btc_getblocks_t *msg) {
-  const btc_entry_t *entry, *stop;
-  btc_zinv_t blocks;
+    count++;
+  }
 
-  if (!btc_chain_synced(pool->chain))
+  if (count == 0)
     return;
 
-  if (btc_chain_pruned(pool->chain))
-    return;
+  buf = (uint8_t *)btc_malloc((k + m) * RELAY_SHARD_SIZE);
 
-  entry = btc_chain_find_locator(pool->chain, &msg->locator);
+  memcpy(buf, data, length);
+  memset(buf + length, 0, k * RELAY_SHARD_SIZE - length);
 
-  if (entry != NULL)
-    entry = entry->next;
+  for (i = 0; i < k + m; i++)
+    shards[i] = buf + i * RELAY_SHARD_SIZE;
 
-  stop = btc_chain_by_hash(pool->chain, msg->stop);
+  btc_fec_encode(shards, k, m, RELAY_SHARD_SIZE);
 
-  btc_zinv_init(&blocks);
-  btc_zinv_grow(&blocks, btc_pool_inv_size(pool, entry, stop, 500));
+  for (i = 0; i < count; i++) {
+    for (j = 0; j < k + m; j++) {
+      uint8_t *zp = (uint8_t *)btc_malloc(RELAY_HEADER_SIZE
+                                        + RELAY_SHARD_SIZE);
 
-  while (entry != NULL) {
-    if (entry == stop)
-      break;
+      btc_write32le(zp + 0, pool->network->magic);
+      btc_hash_copy(zp + 4, hash);
+      btc_write32le(zp + 36, length);
 
-    btc_zinv_push(&blocks, BTC_INV_BLOCK, entry->hash);
+      zp[40] = k;
+      zp[41] = m;
+      zp[42] = j;
 
-    if (blocks.length == 500) {
-      btc_hash_copy(peer->hash_continue, entry->hash);
-      break;
-    }
+      memcpy(zp + RELAY_HEADER_SIZE, shards[j], RELAY_SHARD_SIZE);
 
-    entry = entry->next;
+      btc_socket_send(pool->relay, zp,
+                      RELAY_HEADER_SIZE + RELAY_SHARD_SIZE,
+                      &addrs[i]);
+    }
   }
 
-  if (blocks.length > 0)
-    btc_peer_send_inv(peer, &blocks);
+  btc_free(buf);
 
-  btc_zinv_clear(&blocks);
+  btc_pool_debug(pool, "Relayed block %H to %zu peers (shards=%zu+%zu).",
+                       hash, count, k, m);
 }
 
 static void
-btc_pool_on_getheaders(btc_pool_t *pool,
-                       btc_peer_t *peer,
-                       const btc_getblocks_t *msg) {
-  const btc_entry_t *entry, *stop;
-  btc_headers_t blocks;
+btc_pool_relay(btc_pool_t *pool,
+               const uint8_t *hash,
+               const btc_rawmsg_t *raw,
+               const btc_netaddr_t *from) {
+  btc_cachedblock_t *item;
 
-  if (!btc_chain_synced(pool->chain))
-    return;
-
-  if (btc_chain_pruned(pool->chain))
+  if (pool->relay == NULL || pool->relay_length == 0 || raw == NULL)
     return;
 
-  if (msg->locator.length > 0) {
-    entry = btc_chain_find_locator(pool->chain, &msg->locator);
-
-    if (entry != NULL)
-      entry = entry->next;
+  item = btc_blockcache_get(&pool->block_cache, hash);
 
-    stop = btc_chain_by_hash(pool->chain, msg->stop);
-  } else {
-    entry = btc_chain_by_hash(pool->chain, msg->stop);
-    stop = entry;
-  }
+  if (item == NULL || item->relayed)
+    return;
 
-  btc_headers_init(&blocks);
-  btc_headers_grow(&blocks, btc_pool_inv_size(pool, entry, stop, 2000));
+  item->relayed = 1;
 
-  while (entry != NULL) {
-    btc_headers_push(&blocks, (btc_header_t *)&entry->header);
+  /* Strip the message header. */
+  btc_pool_relay_send(pool, hash, raw->data + 24, raw->length - 24, from);
+}
 
-    btc_filter_add(&peer->inv_filter, entry->hash, 32);
+static void
+btc_pool_announce_block(btc_pool_t *pool,
+                        const btc_block_t *block,
+                        const uint8_t *hash) {
+  btc_rawmsg_t *raw;
+  btc_peer_t *peer;
 
-    if (entry == stop)
-      break;
+  btc_blockcache_add(&pool->block_cache, hash);
 
-    if (blocks.length == 2000)
-      break;
+  if (pool->relay != NULL && pool->relay_length > 0) {
+    raw = btc_blockcache_encode(&pool->block_cache, hash,
+                                BTC_BLOCKENC_CMPCT, block,
+                                pool->network->magic);
 
-    entry = entry->next;
+    btc_pool_relay(pool, hash, raw, NULL);
   }
 
-  if (blocks.length > 0) {
-    btc_peer_send_headers(peer, &blocks);
-    blocks.length = 0;
-  }
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (peer->state != BTC_PEER_CONNECTED)
+      continue;
 
-  btc_headers_clear(&blocks);
+    btc_peer_announce_block(peer, block, hash);
+  }
 }
 
 static void
-btc_pool_resolve_headers(btc_pool_t *pool, btc_peer_t *peer) {
-  btc_hdrnode_t *node;
-  btc_vector_t items;
-
-  btc_vector_init(&items);
+btc_pool_select_cmpct(btc_pool_t *pool, btc_peer_t *peer) {
+  /* Ask the peers that most recently gave us a new
+     block first to push compact blocks unprompted
+     (bip152 high bandwidth mode). */
+  int64_t now = btc_time_msec();
+  btc_peer_t *oldest = NULL;
+  btc_peer_t *it;
+  int count = 0;
 
-  for (node = pool->header_next; node != NULL; node = node->next) {
-    pool->header_next = node->next;
+  if (!(pool->flags & BTC_POOL_BIP152) || pool->block_mode == 1)
+    return;
 
-    btc_vector_push(&items, node->hash);
+  if (!btc_peer_has_compact_support(peer) || !btc_peer_has_compact(peer))
+    return;
 
-    if (items.length == BTC_NET_MAX_INV)
-      break;
+  if (peer->compact_hb != 0) {
+    peer->compact_hb = now;
+    return;
   }
 
-  btc_pool_request_blocks(pool, peer, &items);
-  btc_vector_clear(&items);
-}
+  for (it = pool->peers.head; it != NULL; it = it->next) {
+    if (it->state != BTC_PEER_CONNECTED || it->compact_hb == 0)
+      continue;
 
-static void
-btc_pool_shift_header(btc_pool_t *pool) {
-  btc_hdrnode_t *node = pool->header_head;
+    if (oldest == NULL || it->compact_hb < oldest->compact_hb)
+      oldest = it;
 
-  pool->header_head = node->next;
+    count++;
+  }
 
-  if (node == pool->header_next)
-    pool->header_next = NULL;
+  if (count >= MAX_CMPCT_HB) {
+    btc_peer_log(oldest, "Dropping high bandwidth compact blocks (%N).",
+                         &oldest->addr);
 
-  btc_hdrnode_destroy(node);
+    oldest->compact_hb = 0;
 
-  if (pool->header_head == NULL) {
-    pool->header_tail = NULL;
-    pool->header_next = NULL;
+    btc_peer_send_sendcmpct(oldest, 0);
   }
+
+  btc_peer_log(peer, "Requesting high bandwidth compact blocks (%N).",
+                     &peer->addr);
+
+  peer->compact_hb = now;
+
+  btc_peer_send_sendcmpct(peer, 1);
 }
 
 static void
-btc_pool_resolve_chain(btc_pool_t *pool,
+btc_pool_forward_cmpct(btc_pool_t *pool,
                        btc_peer_t *peer,
-                       const uint8_t *hash) {
-  btc_hdrnode_t *node;
+                       const btc_cmpct_t *block) {
+  /* Pass a compact block on to our high bandwidth
+     peers as soon as the header checks out, before
+     the block is reconstructed or its inputs are
+     validated (permitted by bip152). */
+  const btc_entry_t *tip = btc_chain_tip(pool->chain);
+  enum btc_blockenc enc = BTC_BLOCKENC_CMPCT_BASE;
+  btc_cachedblock_t *item;
+  btc_rawmsg_t *raw;
+  btc_peer_t *it;
+  btc_msg_t msg;
+  size_t length;
+  uint8_t *data;
 
-  if (!pool->checkpoints)
+  if (!btc_chain_synced(pool->chain))
     return;
 
-  if (!peer->loader)
+  if (!btc_hash_equal(block->header.prev_block, tip->hash))
     return;
 
-  if (peer->state != BTC_PEER_CONNECTED)
+  if (block->header.bits != btc_chain_get_target(pool->chain,
+                                                 block->header.time,
+                                                 tip)) {
     return;
+  }
 
-  node = pool->header_head;
+  if (peer->compact_witness)
+    enc = BTC_BLOCKENC_CMPCT;
 
-  CHECK(node != NULL);
+  btc_blockcache_add(&pool->block_cache, block->hash);
 
-  if (!btc_hash_equal(hash, node->hash)) {
-    btc_pool_log(pool, "Header hash mismatch %H != %H (%N).",
-                       hash, node->hash, &peer->addr);
+  item = btc_blockcache_get(&pool->block_cache, block->hash);
 
-    btc_peer_close(peer);
+  if (item->msgs[enc] == NULL) {
+    if (enc == BTC_BLOCKENC_CMPCT)
+      btc_msg_set_type(&msg, BTC_MSG_CMPCTBLOCK);
+    else
+      btc_msg_set_type(&msg, BTC_MSG_CMPCTBLOCK_BASE);
 
-    return;
-  }
+    msg.body = (void *)block;
 
-  if (node->height < pool->network->last_checkpoint) {
-    if (node->height == pool->header_tip->height) {
-      btc_pool_log(pool, "Received checkpoint %H (%d).",
-                         node->hash, node->height);
+    data = btc_msg_frame(&length, &msg, pool->network->magic);
 
-      pool->header_tip = btc_pool_next_tip(pool, node->height);
+    item->msgs[enc] = btc_rawmsg_create(data, length);
+  }
 
-      btc_peer_send_getheaders_1(peer, hash, pool->header_tip->hash);
+  raw = item->msgs[enc];
 
-      return;
-    }
+  if (enc == BTC_BLOCKENC_CMPCT)
+    btc_pool_relay(pool, block->hash, raw, &peer->addr);
 
-    btc_pool_resolve_headers(pool, peer);
-    btc_pool_shift_header(pool);
+  for (it = pool->peers.head; it != NULL; it = it->next) {
+    if (it == peer || it->state != BTC_PEER_CONNECTED)
+      continue;
 
-    return;
-  }
+    if (it->compact_mode != 1)
+      continue;
 
-  btc_pool_log(pool, "Switching to getblocks (%N).",
-                     &peer->addr);
+    if (it->compact_witness != peer->compact_witness)
+      continue;
 
-  btc_pool_clear_chain(pool);
+    if (btc_filter_has(&it->inv_filter, block->hash, 32))
+      continue;
 
-  btc_pool_getblocks(pool, peer, hash, NULL);
+    btc_filter_add(&it->inv_filter, block->hash, 32);
+    btc_peer_write_shared(it, raw);
+  }
 }
 
 static void
-btc_pool_on_headers(btc_pool_t *pool,
-                    btc_peer_t *peer,
-                    const btc_headers_t *msg) {
-  btc_hdrnode_t *node = NULL;
-  int checkpoint = 0;
-  size_t i;
-
-  peer->gh_time = -1;
-
-  if (!pool->checkpoints)
+btc_pool_announce_tx(btc_pool_t *pool, const uint8_t *hash) {
+  if (!btc_mempool_has(pool->mempool, hash))
     return;
 
-  if (!peer->loader)
-    return;
+  /* Peers pick it up on their next flush. */
+  btc_txqueue_push(&pool->tx_queue, hash);
+}
 
-  if (msg->length == 0)
-    return;
+static void
+btc_peer_measure_block(btc_peer_t *peer, int64_t now, size_t size) {
+  int64_t interval = now - peer->block_mark;
+  int64_t rate, limit;
 
-  if (msg->length > 2000) {
-    btc_peer_increase_ban(peer, 20);
+  if (peer->block_mark == -1)
     return;
-  }
-
-  CHECK(pool->header_head != NULL);
 
-  for (i = 0; i < msg->length; i++) {
-    const btc_header_t *hdr = msg->items[i];
-    btc_hdrnode_t *last = pool->header_tail;
-    int32_t height = last->height + 1;
-    uint8_t hash[32];
+  /* Average time between deliveries. */
+  if (peer->block_interval == -1)
+    peer->block_interval = interval;
+  else
+    peer->block_interval = (peer->block_interval * 3 + interval) / 4;
 
-    if (!btc_header_verify(hdr)) {
-      btc_pool_log(pool, "Peer sent an invalid header (%N).",
-                         &peer->addr);
-      btc_peer_increase_ban(peer, 100);
-      return;
-    }
+  /* And the bytes per second they amount to. */
+  rate = ((int64_t)size * 1000) / (interval + 1);
 
-    if (!btc_hash_equal(hdr->prev_block, last->hash)) {
-      btc_pool_log(pool, "Peer sent a bad header chain (%N).",
-                         &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+  if (peer->block_rate == -1)
+    peer->block_rate = rate;
+  else
+    peer->block_rate = (peer->block_rate * 3 + rate) / 4;
 
-    btc_header_hash(hash, hdr);
+  peer->block_mark = now;
 
-    if (height == pool->header_tip->height) {
-      if (!btc_hash_equal(hash, pool->header_tip->hash)) {
-        btc_pool_log(pool, "Peer sent an invalid checkpoint (%N).",
-                           &peer->addr);
-        btc_peer_close(peer);
-        return;
-      }
-      checkpoint = 1;
-    }
+  /* Keep a few seconds worth of blocks in flight. */
+  limit = BLOCK_BUFFER_TIME / (peer->block_interval + 1);
 
-    node = btc_hdrnode_create(hash, height);
+  if (limit < MIN_BLOCK_INFLIGHT)
+    limit = MIN_BLOCK_INFLIGHT;
 
-    if (pool->header_next == NULL)
-      pool->header_next = node;
+  if (limit > MAX_BLOCK_INFLIGHT)
+    limit = MAX_BLOCK_INFLIGHT;
 
-    if (pool->header_head == NULL)
-      pool->header_head = node;
+  peer->block_limit = limit;
+}
 
-    if (pool->header_tail != NULL)
-      pool->header_tail->next = node;
+static void
+btc_pool_hold_block(btc_pool_t *pool,
+                    btc_peer_t *peer,
+                    const btc_block_t *block,
+                    unsigned int flags) {
+  const uint8_t *prev = block->header.prev_block;
+  btc_pendblock_t *item;
+  int tag;
 
-    pool->header_tail = node;
-  }
+  if (btc_hashmap_has(pool->block_pending, prev))
+    return;
 
-  btc_pool_log(pool, "Received %zu headers from peer (%N).",
-                     msg->length, &peer->addr);
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_ORPHANS);
 
-  /* If we received a valid header
-     chain, consider this a "block". */
-  peer->block_time = btc_time_msec();
+  item = btc_pendblock_create(block, flags, peer->id);
 
-  /* Request the blocks we just added. */
-  if (checkpoint) {
-    btc_pool_resolve_headers(pool, peer);
-    btc_pool_shift_header(pool);
-    return;
-  }
+  pool->block_buffer += btc_block_size(block);
 
-  /* Request more headers. */
-  btc_peer_send_getheaders_1(peer, node->hash, pool->header_tip->hash);
-}
+  /* Keyed by the block's own copy of the hash. */
+  CHECK(btc_hashmap_put(pool->block_pending, item->block->header.prev_block,
+                                             item));
 
-static void
-btc_pool_on_sendheaders(btc_pool_t *pool, btc_peer_t *peer) {
-  (void)pool;
-  (void)peer;
+  BTC_MEMTAG_POP(tag);
 }
 
 static void
-btc_pool_announce_block(btc_pool_t *pool,
-                        const btc_block_t *block,
-                        const uint8_t *hash) {
+btc_pool_connect_pending(btc_pool_t *pool) {
+  const btc_entry_t *tip = btc_chain_tip(pool->chain);
+  btc_pendblock_t *item;
   btc_peer_t *peer;
+  int ok;
 
-  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
-    if (peer->state != BTC_PEER_CONNECTED)
-      continue;
+  while ((item = btc_hashmap_get(pool->block_pending, tip->hash)) != NULL) {
+    btc_hashmap_del(pool->block_pending, tip->hash);
 
-    btc_peer_announce_block(peer, block, hash);
-  }
-}
+    pool->block_buffer -= btc_block_size(item->block);
 
-static void
-btc_pool_announce_tx(btc_pool_t *pool, const uint8_t *hash) {
-  const btc_mpentry_t *entry = btc_mempool_get(pool->mempool, hash);
-  btc_peer_t *peer;
+    ok = btc_chain_add(pool->chain, item->block, item->flags, item->id);
 
-  if (entry == NULL)
-    return;
+    if (!ok) {
+      peer = btc_peers_find(&pool->peers, item->id);
 
-  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
-    if (peer->state != BTC_PEER_CONNECTED)
-      continue;
+      if (peer != NULL)
+        btc_peer_reject(peer, "block", btc_chain_error(pool->chain));
+    }
+
+    btc_pendblock_destroy(item);
 
-    btc_peer_announce_tx(peer, entry);
+    if (!ok)
+      break;
+
+    tip = btc_chain_tip(pool->chain);
   }
 }
 
@@ -3829,25 +8737,46 @@ btc_pool_add_block(btc_pool_t *pool,
                    btc_peer_t *peer,
                    const btc_block_t *block,
                    unsigned int flags) {
+  int64_t now = btc_time_msec();
   uint8_t hash[32];
   int32_t height;
 
   btc_header_hash(hash, &block->header);
 
   if (!btc_pool_resolve_block(pool, peer, hash)) {
-    btc_pool_log(pool, "Received unrequested block: %H (%N).",
-                       hash, &peer->addr);
+    btc_pool_debug(pool, "Received unrequested block: %H (%N).",
+                         hash, &peer->addr);
     btc_peer_close(peer);
     return;
   }
 
-  peer->block_time = btc_time_msec();
+  btc_peer_measure_block(peer, now, btc_block_size(block));
+
+  /* Sizes to expect for the blocks still in flight. */
+  if (pool->block_avg == -1)
+    pool->block_avg = btc_block_size(block);
+  else
+    pool->block_avg = (pool->block_avg * 7 + btc_block_size(block)) / 8;
+
+  peer->block_time = now;
+
+  /* Ahead of the tip. Hold it until the tip gets here. */
+  if (pool->checkpoints) {
+    if (!btc_chain_has_hash(pool->chain, block->header.prev_block)) {
+      btc_pool_hold_block(pool, peer, block, flags);
+      btc_pool_request_window(pool);
+      return;
+    }
+  }
 
   if (!btc_chain_add(pool->chain, block, flags, peer->id)) {
     btc_peer_reject(peer, "block", btc_chain_error(pool->chain));
+    btc_pool_request_window(pool);
     return;
   }
 
+  btc_pool_connect_pending(pool);
+
   /* Block was orphaned. */
   if (btc_chain_has_orphan(pool->chain, hash)) {
     if (pool->checkpoints) {
@@ -3856,12 +8785,14 @@ btc_pool_add_block(btc_pool_t *pool,
       return;
     }
 
-    btc_pool_log(pool, "Peer sent an orphan block. Resolving.");
+    btc_pool_debug(pool, "Peer sent an orphan block. Resolving.");
     btc_pool_resolve_orphan(pool, peer, hash);
 
     return;
   }
 
+  peer->last_block = now;
+
   if (!pool->synced && btc_chain_synced(pool->chain)) {
     pool->synced = 1;
     btc_pool_resync(pool, 0);
@@ -3872,13 +8803,16 @@ btc_pool_add_block(btc_pool_t *pool,
   if (height % 20 == 0) {
     btc_pool_log(pool, "Status:"
                        " time=%D height=%d progress=%.2f%%"
-                       " orphans=%d active=%zu"
-                       " target=%#.8x peers=%zu",
+                       " orphans=%d active=%zu held=%zu"
+                       " buffer=%zu/%zumb target=%#.8x peers=%zu",
       block->header.time,
       height,
       btc_chain_progress(pool->chain) * 100.0,
       0,
       btc_hashset_size(pool->block_map),
+      btc_hashmap_size(pool->block_pending),
+      pool->block_buffer >> 20,
+      pool->block_buffer_max >> 20,
       block->header.bits,
       pool->peers.length);
   }
@@ -3888,10 +8822,12 @@ btc_pool_add_block(btc_pool_t *pool,
                        height, hash);
   }
 
-  btc_pool_resolve_chain(pool, peer, hash);
+  btc_pool_resolve_chain(pool);
 
-  if (btc_chain_synced(pool->chain))
+  if (btc_chain_synced(pool->chain)) {
     btc_pool_announce_block(pool, block, hash);
+    btc_pool_select_cmpct(pool, peer);
+  }
 }
 
 static void
@@ -3903,26 +8839,56 @@ btc_pool_on_block(btc_pool_t *pool,
 
 static void
 btc_pool_on_tx(btc_pool_t *pool, btc_peer_t *peer, const btc_tx_t *tx) {
-  if (!btc_pool_resolve_tx(pool, peer, tx->hash)) {
-    btc_pool_log(pool, "Peer sent unrequested tx: %H (%N).",
-                       tx->hash, &peer->addr);
+  /* Parents are requested by txid even with BIP339. */
+  if (!btc_pool_resolve_tx(pool, peer, tx->whash)
+      && !btc_pool_resolve_tx(pool, peer, tx->hash)) {
+    btc_pool_debug(pool, "Peer sent unrequested tx: %H (%N).",
+                         tx->hash, &peer->addr);
     btc_peer_close(peer);
     return;
   }
 
-  if (!btc_mempool_add(pool->mempool, tx, peer->id)) {
-    btc_peer_reject(peer, "tx", btc_mempool_error(pool->mempool));
+  /* Scripts are verified off the loop thread. */
+  btc_mempool_submit(pool->mempool, tx, peer->id, on_tx_result, pool);
+}
+
+static void
+btc_pool_handle_tx(btc_pool_t *pool,
+                   const btc_tx_t *tx,
+                   int result,
+                   unsigned int id) {
+  btc_peer_t *peer = btc_peers_find(&pool->peers, id);
+  btc_vector_t *missing;
+
+  /* The mempool already serves expensive peers last. If
+     one is still burning this much of our time, valid
+     txs or not, it is not relaying in good faith. */
+  if (peer != NULL && btc_mempool_cost(pool->mempool, id) > TX_CPU_BUDGET) {
+    btc_pool_log(pool, "Peer exceeded validation budget (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    peer = NULL;
+  }
+
+  if (!result) {
+    if (peer != NULL)
+      btc_peer_reject(peer, "tx", btc_mempool_error(pool->mempool));
+
     return;
   }
 
   if (btc_mempool_has_orphan(pool->mempool, tx->hash)) {
-    btc_vector_t *missing = btc_mempool_missing(pool->mempool, tx);
+    if (peer == NULL)
+      return;
+
+    missing = btc_mempool_missing(pool->mempool, tx);
 
     if (missing->length > 0) {
       btc_pool_log(pool, "Requesting %zu missing transactions (%N).",
                          missing->length, &peer->addr);
 
-      btc_pool_request_txs(pool, peer, missing);
+      btc_pool_request_txs(pool, peer, missing,
+                           btc_peer_txid_type(peer), 1);
     }
 
     btc_vector_destroy(missing);
@@ -3930,6 +8896,9 @@ btc_pool_on_tx(btc_pool_t *pool, btc_peer_t *peer, const btc_tx_t *tx) {
     return;
   }
 
+  if (peer != NULL)
+    peer->last_tx = btc_time_msec();
+
   btc_pool_announce_tx(pool, tx->hash);
 }
 
@@ -3961,6 +8930,9 @@ btc_pool_on_mempool(btc_pool_t *pool, btc_peer_t *peer) {
     return;
   }
 
+  if (peer->block_relay)
+    return;
+
   btc_pool_log(pool, "Sending mempool snapshot (%N).", &peer->addr);
 
   btc_zinv_init(&items);
@@ -3969,7 +8941,12 @@ btc_pool_on_mempool(btc_pool_t *pool, btc_peer_t *peer) {
   btc_mempool_iterate(&iter, pool->mempool);
 
   while (btc_mempool_next(&entry, &iter)) {
-    btc_zinv_push(&items, BTC_INV_TX, entry->hash);
+    /* Only what the peer's filters let through. */
+    if (!btc_peer_wants_tx(peer, entry))
+      continue;
+
+    btc_zinv_push(&items, peer->wtxid_relay ? BTC_INV_WTX : BTC_INV_TX,
+                          btc_peer_tx_hash(peer, entry));
 
     if (items.length == 1000) {
       btc_peer_send_inv(peer, &items);
@@ -4007,43 +8984,122 @@ btc_pool_on_filterclear(btc_pool_t *pool, btc_peer_t *peer) {
   (void)peer;
 }
 
-static void
-btc_pool_on_merkleblock(btc_pool_t *pool,
-                        btc_peer_t *peer,
-                        const btc_merkleblock_t *msg) {
-  (void)msg;
+static void
+btc_pool_on_merkleblock(btc_pool_t *pool,
+                        btc_peer_t *peer,
+                        const btc_merkleblock_t *msg) {
+  (void)msg;
+
+  btc_pool_log(pool, "Peer sent unsolicited merkleblock (%N).",
+                     &peer->addr);
+
+  btc_peer_increase_ban(peer, 100);
+}
+
+static void
+btc_pool_on_feefilter(btc_pool_t *pool,
+                      btc_peer_t *peer,
+                      const btc_feefilter_t *msg) {
+  (void)pool;
+  (void)peer;
+  (void)msg;
+}
+
+static void
+btc_pool_on_sendcmpct(btc_pool_t *pool,
+                      btc_peer_t *peer,
+                      const btc_sendcmpct_t *msg) {
+  (void)pool;
+  (void)peer;
+  (void)msg;
+}
+
+static void
+btc_pool_handle_cmpct(btc_pool_t *pool,
+                      btc_peer_t *peer,
+                      btc_cmpct_t *block) {
+  btc_mpiter_t iter;
+  int rc, filled;
+
+  if (!btc_header_verify(&block->header)) {
+    btc_pool_log(pool,
+      "Peer sent an invalid compact block (%N).",
+      &peer->addr);
+    btc_peer_increase_ban(peer, 100);
+    return;
+  }
+
+  rc = btc_cmpct_setup(block);
+
+  if (rc == -1) {
+    btc_pool_log(pool,
+      "Peer sent an invalid compact block (%N).",
+      &peer->addr);
+    btc_peer_increase_ban(peer, 100);
+    return;
+  }
+
+  if (rc == 0) {
+    btc_pool_log(pool,
+      "Siphash collision for %H. Requesting full block (%N).",
+      block->hash, &peer->addr);
+    btc_peer_get_full_block(peer, block->hash);
+    btc_peer_increase_ban(peer, 10);
+    return;
+  }
+
+  btc_pool_forward_cmpct(pool, peer, block);
+
+  if (peer->compact_witness) {
+    const btc_mpentry_t *const *entries;
+    const uint8_t *hashes;
+    size_t count;
+
+    count = btc_mempool_wtxids(&hashes, &entries, pool->mempool);
+    filled = btc_cmpct_fill_wtxids(block, hashes, entries, count);
+  } else {
+    btc_mempool_iterate(&iter, pool->mempool);
+    filled = btc_cmpct_fill_mempool(block, &iter, 0);
+  }
+
+  if (filled) {
+    btc_block_t *blk = btc_block_create();
+
+    btc_pool_debug(pool,
+      "Received full compact block %H (%N).",
+      block->hash, &peer->addr);
+
+    btc_cmpct_finalize(blk, block);
+    btc_pool_add_block(pool, peer, blk, BTC_BLOCK_VERIFY_BODY);
+    btc_block_destroy(blk);
+
+    return;
+  }
+
+  if (btc_hashmap_size(peer->compact_map) >= 15) {
+    btc_pool_log(pool, "Compact block DoS attempt (%N).", &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
 
-  btc_pool_log(pool, "Peer sent unsolicited merkleblock (%N).",
-                     &peer->addr);
+  block->now = btc_time_msec();
 
-  btc_peer_increase_ban(peer, 100);
-}
+  CHECK(btc_hashset_put(pool->compact_map, block->hash));
+  CHECK(btc_hashmap_put(peer->compact_map, block->hash, btc_cmpct_ref(block)));
 
-static void
-btc_pool_on_feefilter(btc_pool_t *pool,
-                      btc_peer_t *peer,
-                      const btc_feefilter_t *msg) {
-  (void)pool;
-  (void)peer;
-  (void)msg;
-}
+  btc_peer_stall_at(peer, block->now + 30000);
 
-static void
-btc_pool_on_sendcmpct(btc_pool_t *pool,
-                      btc_peer_t *peer,
-                      const btc_sendcmpct_t *msg) {
-  (void)pool;
-  (void)peer;
-  (void)msg;
+  btc_pool_debug(pool,
+    "Received non-full compact block %H tx=%zu/%zu (%N).",
+    block->hash, block->count, block->avail.length, &peer->addr);
+
+  btc_peer_send_getblocktxn(peer, block);
 }
 
 static void
 btc_pool_on_cmpctblock(btc_pool_t *pool,
                        btc_peer_t *peer,
                        btc_cmpct_t *block) {
-  btc_mpiter_t iter;
-  int rc;
-
   if (!(pool->flags & BTC_POOL_BIP152)) {
     btc_pool_log(pool, "Peer sent unsolicited cmpctblock (%N).",
                        &peer->addr);
@@ -4076,7 +9132,7 @@ btc_pool_on_cmpctblock(btc_pool_t *pool,
   if (!btc_hashtab_has(peer->block_map, block->hash)) {
     uint8_t *hash;
 
-    if (pool->block_mode != 1) {
+    if (pool->block_mode != 1 && peer->compact_hb == 0) {
       btc_pool_log(pool,
         "Peer sent us an unrequested compact block (%N).",
         &peer->addr);
@@ -4086,73 +9142,225 @@ btc_pool_on_cmpctblock(btc_pool_t *pool,
 
     btc_filter_add(&peer->inv_filter, block->hash, 32);
 
+    /* Several high bandwidth peers race
+       to push us the same new block. */
+    if (btc_chain_has_hash(pool->chain, block->hash)
+        || btc_hashset_has(pool->block_map, block->hash)) {
+      return;
+    }
+
     CHECK(!btc_hashset_has(pool->block_map, block->hash));
 
     hash = btc_hash_clone(block->hash);
 
     btc_hashset_put(pool->block_map, hash);
     btc_hashtab_put(peer->block_map, hash, btc_time_msec());
+
+    btc_peer_stall_at(peer, btc_time_msec() + 120000);
   }
 
-  if (!btc_header_verify(&block->header)) {
-    btc_pool_log(pool,
-      "Peer sent an invalid compact block (%N).",
-      &peer->addr);
-    btc_peer_increase_ban(peer, 100);
-    return;
+  btc_pool_handle_cmpct(pool, peer, block);
+}
+
+static void
+btc_relayslot_reset(btc_relayslot_t *slot) {
+  if (slot->data != NULL)
+    btc_free(slot->data);
+
+  slot->state = 0;
+  slot->count = 0;
+  slot->data = NULL;
+}
+
+static void
+btc_pool_reset_relay(btc_pool_t *pool) {
+  size_t i;
+
+  for (i = 0; i < RELAY_SLOTS; i++)
+    btc_relayslot_reset(&pool->relay_slots[i]);
+
+  pool->relay_index = 0;
+}
+
+static btc_relayslot_t *
+btc_pool_relay_slot(btc_pool_t *pool, const uint8_t *hash) {
+  btc_relayslot_t *slot;
+  size_t i;
+
+  for (i = 0; i < RELAY_SLOTS; i++) {
+    slot = &pool->relay_slots[i];
+
+    if (slot->state != 0 && btc_hash_equal(slot->hash, hash))
+      return slot;
   }
 
-  rc = btc_cmpct_setup(block);
+  slot = &pool->relay_slots[pool->relay_index];
 
-  if (rc == -1) {
-    btc_pool_log(pool,
-      "Peer sent an invalid compact block (%N).",
-      &peer->addr);
-    btc_peer_increase_ban(peer, 100);
+  btc_relayslot_reset(slot);
+  btc_hash_copy(slot->hash, hash);
+
+  pool->relay_index = (pool->relay_index + 1) % RELAY_SLOTS;
+
+  return slot;
+}
+
+static int
+btc_pool_is_relay(btc_pool_t *pool, const btc_netaddr_t *addr) {
+  size_t i;
+
+  for (i = 0; i < pool->relay_length; i++) {
+    if (memcmp(pool->relay_peers[i].raw, addr->raw, 16) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+static void
+btc_pool_on_relay_block(btc_pool_t *pool,
+                        const btc_netaddr_t *addr,
+                        btc_cmpct_t *block) {
+  btc_peer_t *peer;
+  uint8_t *hash;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (peer->state != BTC_PEER_CONNECTED)
+      continue;
+
+    if (memcmp(peer->addr.raw, addr->raw, 16) == 0)
+      break;
+  }
+
+  /* Missing transactions come over TCP. */
+  if (peer == NULL || !peer->compact_witness) {
+    btc_pool_debug(pool, "No compact peer for relayed block %H (%N).",
+                         block->hash, addr);
     return;
   }
 
-  if (rc == 0) {
-    btc_pool_log(pool,
-      "Siphash collision for %H. Requesting full block (%N).",
-      block->hash, &peer->addr);
-    btc_peer_get_full_block(peer, block->hash);
-    btc_peer_increase_ban(peer, 10);
+  btc_filter_add(&peer->inv_filter, block->hash, 32);
+
+  if (btc_chain_has_hash(pool->chain, block->hash)
+      || btc_hashset_has(pool->block_map, block->hash)) {
     return;
   }
 
-  btc_mempool_iterate(&iter, pool->mempool);
+  btc_pool_debug(pool, "Received relayed block %H (%N).",
+                       block->hash, &peer->addr);
 
-  if (btc_cmpct_fill_mempool(block, &iter, peer->compact_witness)) {
-    btc_block_t *blk = btc_block_create();
+  hash = btc_hash_clone(block->hash);
 
-    btc_pool_log(pool,
-      "Received full compact block %H (%N).",
-      block->hash, &peer->addr);
+  btc_hashset_put(pool->block_map, hash);
+  btc_hashtab_put(peer->block_map, hash, btc_time_msec());
 
-    btc_cmpct_finalize(blk, block);
-    btc_pool_add_block(pool, peer, blk, BTC_BLOCK_VERIFY_BODY);
-    btc_block_destroy(blk);
+  btc_peer_stall_at(peer, btc_time_msec() + 120000);
+
+  btc_pool_handle_cmpct(pool, peer, block);
+}
 
+static void
+btc_pool_on_relay(btc_pool_t *pool,
+                  const uint8_t *data,
+                  size_t size,
+                  const btc_sockaddr_t *addr) {
+  uint8_t *shards[BTC_FEC_MAX_SHARDS];
+  size_t length, k, m, index, i;
+  btc_relayslot_t *slot;
+  const uint8_t *hash;
+  btc_cmpct_t *block;
+  btc_netaddr_t from;
+
+  if (size != RELAY_HEADER_SIZE + RELAY_SHARD_SIZE)
     return;
-  }
 
-  if (btc_hashmap_size(peer->compact_map) >= 15) {
-    btc_pool_log(pool, "Compact block DoS attempt (%N).", &peer->addr);
-    btc_peer_close(peer);
+  if (addr->family != BTC_AF_INET && addr->family != BTC_AF_INET6)
+    return;
+
+  btc_netaddr_set_sockaddr(&from, addr);
+
+  if (!btc_pool_is_relay(pool, &from))
+    return;
+
+  if (btc_read32le(data) != pool->network->magic)
+    return;
+
+  hash = data + 4;
+  length = btc_read32le(data + 36);
+  k = data[40];
+  m = data[41];
+  index = data[42];
+
+  if (length == 0 || k != btc_relay_shards(length))
+    return;
+
+  if (m != btc_relay_parity(k) || k + m > BTC_FEC_MAX_SHARDS)
+    return;
+
+  if (index >= k + m)
+    return;
+
+  if (!(pool->flags & BTC_POOL_BIP152))
+    return;
+
+  if (btc_chain_has_hash(pool->chain, hash))
     return;
+
+  slot = btc_pool_relay_slot(pool, hash);
+
+  if (slot->state == 0) {
+    slot->state = 1;
+    slot->length = length;
+    slot->k = k;
+    slot->m = m;
+    slot->count = 0;
+    slot->data = (uint8_t *)btc_malloc((k + m) * RELAY_SHARD_SIZE);
+
+    memset(slot->present, 0, sizeof(slot->present));
   }
 
-  block->now = btc_time_msec();
+  if (slot->state != 1)
+    return;
 
-  CHECK(btc_hashset_put(pool->compact_map, block->hash));
-  CHECK(btc_hashmap_put(peer->compact_map, block->hash, btc_cmpct_ref(block)));
+  if (slot->length != length || slot->k != k || slot->m != m)
+    return;
 
-  btc_pool_log(pool,
-    "Received non-full compact block %H tx=%zu/%zu (%N).",
-    block->hash, block->count, block->avail.length, &peer->addr);
+  if (slot->present[index])
+    return;
 
-  btc_peer_send_getblocktxn(peer, block);
+  memcpy(slot->data + index * RELAY_SHARD_SIZE,
+         data + RELAY_HEADER_SIZE,
+         RELAY_SHARD_SIZE);
+
+  slot->present[index] = 1;
+
+  if (++slot->count < k)
+    return;
+
+  for (i = 0; i < k + m; i++)
+    shards[i] = slot->data + i * RELAY_SHARD_SIZE;
+
+  block = NULL;
+
+  if (btc_fec_decode(shards, slot->present, k, m, RELAY_SHARD_SIZE))
+    block = btc_cmpct_decode(slot->data, length);
+
+  /* Later shards of this block are dropped. */
+  btc_free(slot->data);
+
+  slot->data = NULL;
+  slot->state = 2;
+
+  if (block == NULL || !btc_hash_equal(block->hash, hash)) {
+    btc_pool_log(pool, "Relay peer sent an invalid block (%N).", &from);
+
+    if (block != NULL)
+      btc_cmpct_destroy(block);
+
+    return;
+  }
+
+  btc_pool_on_relay_block(pool, &from, block);
+  btc_cmpct_destroy(block);
 }
 
 static void
@@ -4162,9 +9370,6 @@ btc_pool_on_getblocktxn(btc_pool_t *pool,
   const btc_entry_t *entry;
   btc_block_t *block;
 
-  if (btc_chain_pruned(pool->chain))
-    return;
-
   entry = btc_chain_by_hash(pool->chain, req->hash);
 
   if (entry == NULL) {
@@ -4233,6 +9438,188 @@ btc_pool_on_blocktxn(btc_pool_t *pool,
   btc_cmpct_destroy(block);
 }
 
+static const btc_entry_t *
+btc_pool_filter_stop(btc_pool_t *pool,
+                     btc_peer_t *peer,
+                     uint8_t filter_type,
+                     const uint8_t *stop_hash) {
+  const btc_entry_t *stop;
+
+  if (!(pool->services & BTC_NET_SERVICE_COMPACT_FILTERS)) {
+    btc_pool_log(pool, "Peer requested filters without bip157 enabled (%N).",
+                       &peer->addr);
+    btc_peer_close(peer);
+    return NULL;
+  }
+
+  if (filter_type != BTC_GCS_BASIC) {
+    btc_pool_log(pool, "Peer requested unknown filter type %u (%N).",
+                       filter_type, &peer->addr);
+    btc_peer_close(peer);
+    return NULL;
+  }
+
+  stop = btc_chain_by_hash(pool->chain, stop_hash);
+
+  if (stop == NULL || !btc_chain_is_main(pool->chain, stop)) {
+    btc_pool_log(pool, "Peer requested filters for unknown block %H (%N).",
+                       stop_hash, &peer->addr);
+    btc_peer_close(peer);
+    return NULL;
+  }
+
+  /* Not an error: we may still be catching up. */
+  if (stop->height > btc_filterdb_height(pool->filterdb))
+    return NULL;
+
+  return stop;
+}
+
+static const btc_entry_t *
+btc_pool_filter_range(btc_pool_t *pool,
+                      btc_peer_t *peer,
+                      const btc_getcfilters_t *req,
+                      int32_t max) {
+  const btc_entry_t *stop = btc_pool_filter_stop(pool,
+                                                 peer,
+                                                 req->filter_type,
+                                                 req->stop_hash);
+
+  if (stop == NULL)
+    return NULL;
+
+  if (req->start_height > (uint32_t)stop->height
+      || stop->height - (int32_t)req->start_height >= max) {
+    btc_pool_log(pool, "Peer requested invalid filter range %u-%d (%N).",
+                       req->start_height, stop->height, &peer->addr);
+    btc_peer_close(peer);
+    return NULL;
+  }
+
+  return stop;
+}
+
+static void
+btc_pool_on_getcfilters(btc_pool_t *pool,
+                        btc_peer_t *peer,
+                        const btc_getcfilters_t *req) {
+  const btc_entry_t *stop, *entry;
+  btc_cfilter_t msg;
+  int32_t height;
+
+  stop = btc_pool_filter_range(pool, peer, req, BTC_NET_MAX_CFILTERS);
+
+  if (stop == NULL)
+    return;
+
+  btc_cfilter_init(&msg);
+
+  msg.filter_type = req->filter_type;
+
+  for (height = req->start_height; height <= stop->height; height++) {
+    entry = btc_chain_by_height(pool->chain, height);
+
+    CHECK(entry != NULL);
+
+    if (!btc_filterdb_get_filter(pool->filterdb, &msg.filter, entry)) {
+      btc_pool_log(pool, "Filter not found for %H (%N).",
+                         entry->hash, &peer->addr);
+      break;
+    }
+
+    btc_hash_copy(msg.block_hash, entry->hash);
+
+    btc_peer_sendmsg(peer, BTC_MSG_CFILTER, &msg);
+  }
+
+  btc_cfilter_clear(&msg);
+}
+
+static void
+btc_pool_on_getcfheaders(btc_pool_t *pool,
+                         btc_peer_t *peer,
+                         const btc_getcfheaders_t *req) {
+  const btc_entry_t *stop, *entry;
+  btc_cfheaders_t msg;
+  int32_t height;
+  size_t i = 0;
+
+  stop = btc_pool_filter_range(pool, peer, req, BTC_NET_MAX_CFHEADERS);
+
+  if (stop == NULL)
+    return;
+
+  btc_cfheaders_init(&msg);
+
+  msg.filter_type = req->filter_type;
+
+  btc_hash_copy(msg.stop_hash, stop->hash);
+
+  if (req->start_height > 0) {
+    entry = btc_chain_by_height(pool->chain, req->start_height - 1);
+
+    CHECK(entry != NULL);
+    CHECK(btc_filterdb_get_header(pool->filterdb, msg.prev_header, entry));
+  }
+
+  btc_cfheaders_resize(&msg, stop->height - req->start_height + 1);
+
+  for (height = req->start_height; height <= stop->height; height++) {
+    entry = btc_chain_by_height(pool->chain, height);
+
+    CHECK(entry != NULL);
+
+    if (!btc_filterdb_get_hash(pool->filterdb, msg.hashes + i * 32, entry)) {
+      btc_pool_log(pool, "Filter not found for %H (%N).",
+                         entry->hash, &peer->addr);
+      btc_cfheaders_clear(&msg);
+      return;
+    }
+
+    i++;
+  }
+
+  btc_peer_sendmsg(peer, BTC_MSG_CFHEADERS, &msg);
+
+  btc_cfheaders_clear(&msg);
+}
+
+static void
+btc_pool_on_getcfcheckpt(btc_pool_t *pool,
+                         btc_peer_t *peer,
+                         const btc_getcfcheckpt_t *req) {
+  const btc_entry_t *stop, *entry;
+  btc_cfcheckpt_t msg;
+  size_t i;
+
+  stop = btc_pool_filter_stop(pool, peer, req->filter_type, req->stop_hash);
+
+  if (stop == NULL)
+    return;
+
+  btc_cfcheckpt_init(&msg);
+
+  msg.filter_type = req->filter_type;
+
+  btc_hash_copy(msg.stop_hash, stop->hash);
+
+  btc_cfcheckpt_resize(&msg, stop->height / BTC_NET_CFCHECKPT_INTERVAL);
+
+  for (i = 0; i < msg.length; i++) {
+    entry = btc_chain_by_height(pool->chain,
+                                (i + 1) * BTC_NET_CFCHECKPT_INTERVAL);
+
+    CHECK(entry != NULL);
+    CHECK(btc_filterdb_get_header(pool->filterdb,
+                                  msg.headers + i * 32,
+                                  entry));
+  }
+
+  btc_peer_sendmsg(peer, BTC_MSG_CFCHECKPT, &msg);
+
+  btc_cfcheckpt_clear(&msg);
+}
+
 static void
 btc_pool_on_unknown(btc_pool_t *pool,
                     btc_peer_t *peer,
@@ -4324,6 +9711,17 @@ btc_pool_on_msg(btc_pool_t *pool, btc_peer_t *peer, btc_msg_t *msg) {
     case BTC_MSG_BLOCKTXN:
       btc_pool_on_blocktxn(pool, peer, (const btc_blocktxn_t *)msg->body);
       break;
+    case BTC_MSG_GETCFILTERS:
+      btc_pool_on_getcfilters(pool, peer, (const btc_getcfilters_t *)msg->body);
+      break;
+    case BTC_MSG_GETCFHEADERS:
+      btc_pool_on_getcfheaders(pool, peer,
+                               (const btc_getcfheaders_t *)msg->body);
+      break;
+    case BTC_MSG_GETCFCHECKPT:
+      btc_pool_on_getcfcheckpt(pool, peer,
+                               (const btc_getcfcheckpt_t *)msg->body);
+      break;
     case BTC_MSG_UNKNOWN:
       btc_pool_on_unknown(pool, peer, msg);
       break;
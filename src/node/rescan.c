@@ -0,0 +1,684 @@
+/*!
+ * rescan.c - script rescanner for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <io/workers.h>
+
+#include <node/chain.h>
+#include <node/rescan.h>
+
+#include <mako/block.h>
+#include <mako/coins.h>
+#include <mako/crypto/hash.h>
+#include <mako/map.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+
+#include "../bio.h"
+#include "../impl.h"
+#include "../internal.h"
+
+/*
+ * Rescan
+ *
+ * Finds the history of a set of scripts (a wallet)
+ * in stored blocks without an address index. The
+ * scripts are held in a salted hash table keyed by
+ * their SHA256, and blocks are walked in place by
+ * btc_block_scan rather than decoded: a block costs
+ * one hash per output and nothing else unless it
+ * pays us.
+ *
+ * Blocks are taken a batch at a time. The loop
+ * thread maps them along with their undo records
+ * (finalized files stay mapped for the lifetime of
+ * the chain) and the worker pool scans them. The
+ * undo coins line up with the block's inputs, so
+ * each input is matched by the script it spends
+ * and a coin created before the start height is
+ * still seen leaving the wallet.
+ *
+ * A block without usable undo coins (pruned below
+ * the last checkpoint) falls back to a second pass
+ * which only knows the coins the rescan itself
+ * found: spends of older coins are missed. Such
+ * blocks are counted (btc_rescancursor_missing) so
+ * that the caller can tell. Matches are reported
+ * from the loop thread in chain order.
+ *
+ * A cursor takes one batch per step, so several
+ * rescans (one per wallet, say) can be interleaved
+ * on the loop thread without any of them holding
+ * it for the whole range. The watched set must not
+ * change while a cursor is open.
+ */
+
+/* Blocks scanned per parallel pass. */
+#define BTC_RESCAN_BATCH 256
+
+/*
+ * Types
+ */
+
+typedef struct btc_watched_s {
+  uint8_t hash[32];
+  btc_script_t script;
+} btc_watched_t;
+
+typedef struct btc_rescancoin_s {
+  int64_t value;
+  const btc_script_t *script;
+} btc_rescancoin_t;
+
+typedef struct btc_matchvec_s {
+  btc_rescanmatch_t *items;
+  size_t alloc;
+  size_t length;
+} btc_matchvec_t;
+
+typedef struct btc_rescanblock_s {
+  const btc_entry_t *entry;
+  const uint8_t *data;
+  size_t length;
+  uint8_t *owned;
+  const uint8_t *undo_data;
+  size_t undo_length;
+  uint8_t *undo_owned;
+  btc_undo_t *undo;
+  size_t inputs;
+  btc_matchvec_t outputs;
+  btc_matchvec_t spends;
+  int resolved;
+  int ok;
+} btc_rescanblock_t;
+
+typedef struct btc_rescanjob_s {
+  const btc_rescan_t *scan;
+  const btc_prevmap_t *coins;
+  btc_rescanblock_t *blocks;
+} btc_rescanjob_t;
+
+typedef struct btc_rescanctx_s {
+  const btc_rescanjob_t *job;
+  btc_rescanblock_t *block;
+  uint8_t txid[32];
+  size_t hashed;
+} btc_rescanctx_t;
+
+struct btc_rescan_s {
+  btc_hashmap_t *map;
+};
+
+struct btc_rescancursor_s {
+  btc_chain_t *chain;
+  btc_rescanjob_t job;
+  btc_rescanblock_t *blocks;
+  btc_prevmap_t *coins;
+  int32_t height;
+  int32_t end;
+  int32_t missing;
+};
+
+/*
+ * Match Vector
+ */
+
+static void
+btc_matchvec_init(btc_matchvec_t *z) {
+  z->items = NULL;
+  z->alloc = 0;
+  z->length = 0;
+}
+
+static void
+btc_matchvec_clear(btc_matchvec_t *z) {
+  if (z->alloc > 0)
+    btc_free(z->items);
+
+  btc_matchvec_init(z);
+}
+
+static btc_rescanmatch_t *
+btc_matchvec_push(btc_matchvec_t *z) {
+  if (z->length == z->alloc) {
+    z->alloc = z->alloc == 0 ? 4 : z->alloc * 2;
+    z->items = btc_realloc(z->items, z->alloc * sizeof(btc_rescanmatch_t));
+  }
+
+  return &z->items[z->length++];
+}
+
+/*
+ * Scanning
+ */
+
+static const uint8_t *
+btc_rescanctx_txid(btc_rescanctx_t *ctx, const btc_rawtx_t *tx) {
+  /* Callbacks for one transaction arrive together. */
+  if (ctx->hashed != tx->index + 1) {
+    btc_rawtx_txid(ctx->txid, tx);
+    ctx->hashed = tx->index + 1;
+  }
+
+  return ctx->txid;
+}
+
+static void
+btc_rescan_on_output(const btc_rawtx_t *tx,
+                     size_t index,
+                     int64_t value,
+                     const uint8_t *script,
+                     size_t length,
+                     void *arg) {
+  btc_rescanctx_t *ctx = arg;
+  const btc_watched_t *item;
+  btc_rescanmatch_t *match;
+  uint8_t hash[32];
+
+  btc_sha256(hash, script, length);
+
+  item = btc_hashmap_get(ctx->job->scan->map, hash);
+
+  if (item == NULL)
+    return;
+
+  match = btc_matchvec_push(&ctx->block->outputs);
+
+  match->entry = ctx->block->entry;
+  match->index = tx->index;
+  match->spend = 0;
+  match->value = value;
+  match->script = &item->script;
+
+  memcpy(match->hash, btc_rescanctx_txid(ctx, tx), 32);
+
+  btc_outpoint_set(&match->prevout, match->hash, index);
+}
+
+static void
+btc_rescan_on_undo(const btc_rawtx_t *tx,
+                   size_t index,
+                   const uint8_t *prevout,
+                   void *arg) {
+  btc_rescanctx_t *ctx = arg;
+  btc_rescanblock_t *block = ctx->block;
+  const btc_watched_t *item;
+  btc_rescanmatch_t *match;
+  const btc_coin_t *coin;
+  uint8_t hash[32];
+  size_t k;
+
+  (void)index;
+
+  if (tx->index == 0)
+    return;
+
+  k = block->inputs++;
+
+  if (block->undo == NULL || k >= block->undo->length)
+    return;
+
+  coin = block->undo->items[k];
+
+  btc_sha256(hash, coin->output.script.data, coin->output.script.length);
+
+  item = btc_hashmap_get(ctx->job->scan->map, hash);
+
+  if (item == NULL)
+    return;
+
+  match = btc_matchvec_push(&block->spends);
+
+  match->entry = block->entry;
+  match->index = tx->index;
+  match->spend = 1;
+  match->value = coin->output.value;
+  match->script = &item->script;
+
+  btc_outpoint_set(&match->prevout, prevout, btc_read32le(prevout + 32));
+
+  memcpy(match->hash, btc_rescanctx_txid(ctx, tx), 32);
+}
+
+static void
+btc_rescan_on_input(const btc_rawtx_t *tx,
+                    size_t index,
+                    const uint8_t *prevout,
+                    void *arg) {
+  btc_rescanctx_t *ctx = arg;
+  const btc_rescancoin_t *coin;
+  btc_rescanmatch_t *match;
+  btc_outpoint_t key;
+
+  (void)index;
+
+  btc_outpoint_set(&key, prevout, btc_read32le(prevout + 32));
+
+  coin = btc_prevmap_get(ctx->job->coins, &key);
+
+  if (coin == NULL)
+    return;
+
+  match = btc_matchvec_push(&ctx->block->spends);
+
+  match->entry = ctx->block->entry;
+  match->index = tx->index;
+  match->spend = 1;
+  match->prevout = key;
+  match->value = coin->value;
+  match->script = coin->script;
+
+  memcpy(match->hash, btc_rescanctx_txid(ctx, tx), 32);
+}
+
+static void
+btc_rescan_outputs(size_t start, size_t end, void *arg) {
+  btc_rescanjob_t *job = arg;
+  btc_rescanctx_t ctx;
+  size_t i;
+
+  for (i = start; i < end; i++) {
+    btc_rescanblock_t *block = &job->blocks[i];
+
+    ctx.job = job;
+    ctx.block = block;
+    ctx.hashed = 0;
+
+    if (block->undo_data != NULL) {
+      block->undo = btc_chain_decode_undo(block->undo_data,
+                                          block->undo_length,
+                                          block->entry);
+
+      if (block->undo == NULL) {
+        block->ok = 0;
+        continue;
+      }
+    }
+
+    block->ok = btc_block_scan(block->data,
+                               block->length,
+                               btc_rescan_on_undo,
+                               btc_rescan_on_output,
+                               &ctx);
+
+    /* A block with no spends has no undo record. */
+    if (block->undo != NULL)
+      block->resolved = (block->inputs == block->undo->length);
+    else
+      block->resolved = (block->inputs == 0);
+
+    if (!block->resolved)
+      block->spends.length = 0;
+
+    if (block->undo != NULL) {
+      btc_undo_destroy(block->undo);
+      block->undo = NULL;
+    }
+  }
+}
+
+static void
+btc_rescan_inputs(size_t start, size_t end, void *arg) {
+  btc_rescanjob_t *job = arg;
+  btc_rescanctx_t ctx;
+  size_t i;
+
+  for (i = start; i < end; i++) {
+    btc_rescanblock_t *block = &job->blocks[i];
+
+    ctx.job = job;
+    ctx.block = block;
+    ctx.hashed = 0;
+
+    if (block->ok && !block->resolved) {
+      block->ok = btc_block_scan(block->data,
+                                 block->length,
+                                 btc_rescan_on_input,
+                                 NULL,
+                                 &ctx);
+    }
+  }
+}
+
+static void
+btc_rescan_parallel(btc_workers_t *pool,
+                    size_t length,
+                    btc_range_f *func,
+                    btc_rescanjob_t *job) {
+  if (pool != NULL)
+    btc_parallel_for_ex(pool, BTC_WORK_LOW, length, 0, func, job);
+  else
+    func(0, length, job);
+}
+
+/*
+ * Rescan
+ */
+
+btc_rescan_t *
+btc_rescan_create(void) {
+  btc_rescan_t *scan = btc_malloc(sizeof(btc_rescan_t));
+
+  scan->map = btc_hashmap_create();
+
+  return scan;
+}
+
+void
+btc_rescan_destroy(btc_rescan_t *scan) {
+  btc_hashmapiter_t iter;
+
+  btc_hashmap_iterate(&iter, scan->map);
+
+  while (btc_hashmap_next(&iter)) {
+    btc_watched_t *item = iter.val;
+
+    btc_script_clear(&item->script);
+    btc_free(item);
+  }
+
+  btc_hashmap_destroy(scan->map);
+  btc_free(scan);
+}
+
+int
+btc_rescan_watch(btc_rescan_t *scan, const btc_script_t *script) {
+  btc_watched_t *item;
+  uint8_t hash[32];
+
+  btc_sha256(hash, script->data, script->length);
+
+  if (btc_hashmap_has(scan->map, hash))
+    return 0;
+
+  item = btc_malloc(sizeof(btc_watched_t));
+
+  memcpy(item->hash, hash, 32);
+
+  btc_script_init(&item->script);
+  btc_script_copy(&item->script, script);
+
+  CHECK(btc_hashmap_put(scan->map, item->hash, item));
+
+  return 1;
+}
+
+size_t
+btc_rescan_size(const btc_rescan_t *scan) {
+  return btc_hashmap_size(scan->map);
+}
+
+static void
+btc_rescan_report(btc_rescanblock_t *block,
+                  btc_prevmap_t *coins,
+                  btc_rescan_f *callback,
+                  void *arg) {
+  const btc_matchvec_t *outputs = &block->outputs;
+  const btc_matchvec_t *spends = &block->spends;
+  size_t i = 0;
+  size_t j = 0;
+
+  /* Transaction order; a transaction's
+     spends come before its outputs. */
+  while (i < spends->length || j < outputs->length) {
+    if (i < spends->length && (j == outputs->length
+        || spends->items[i].index <= outputs->items[j].index)) {
+      const btc_rescanmatch_t *match = &spends->items[i++];
+      void *coin = btc_prevmap_rem(coins, &match->prevout);
+
+      /* Coins from before the start are not in the set. */
+      if (coin != NULL)
+        btc_free(coin);
+
+      callback(match, arg);
+    } else {
+      callback(&outputs->items[j++], arg);
+    }
+  }
+}
+
+static void
+btc_rescan_release(btc_rescanblock_t *block) {
+  if (block->owned != NULL)
+    free(block->owned);
+
+  if (block->undo_owned != NULL)
+    free(block->undo_owned);
+
+  btc_matchvec_clear(&block->outputs);
+  btc_matchvec_clear(&block->spends);
+}
+
+static int
+btc_rescan_load(btc_rescanblock_t *block,
+                btc_chain_t *chain,
+                const btc_entry_t *entry) {
+  block->entry = entry;
+  block->owned = NULL;
+  block->undo_data = NULL;
+  block->undo_length = 0;
+  block->undo_owned = NULL;
+  block->undo = NULL;
+  block->inputs = 0;
+  block->resolved = 0;
+  block->ok = 0;
+
+  btc_matchvec_init(&block->outputs);
+  btc_matchvec_init(&block->spends);
+
+  if (entry == NULL)
+    return 0;
+
+  block->data = btc_chain_map_raw_block(chain, &block->length, entry);
+
+  if (block->data == NULL) {
+    if (!btc_chain_get_raw_block(chain, &block->owned,
+                                        &block->length,
+                                        entry)) {
+      return 0;
+    }
+
+    block->data = block->owned;
+  }
+
+  /* Skip the record header. */
+  block->data += 24;
+  block->length -= 24;
+
+  /* Decoded by the workers (the header stays). */
+  block->undo_data = btc_chain_map_raw_undo(chain, &block->undo_length,
+                                                   entry);
+
+  if (block->undo_data == NULL) {
+    if (btc_chain_get_raw_undo(chain, &block->undo_owned,
+                                      &block->undo_length,
+                                      entry)) {
+      block->undo_data = block->undo_owned;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Rescan Cursor
+ */
+
+btc_rescancursor_t *
+btc_rescancursor_create(const btc_rescan_t *scan,
+                        btc_chain_t *chain,
+                        int32_t start,
+                        int32_t end) {
+  btc_rescancursor_t *cur = btc_malloc(sizeof(btc_rescancursor_t));
+
+  cur->chain = chain;
+  cur->blocks = btc_malloc(BTC_RESCAN_BATCH * sizeof(btc_rescanblock_t));
+  cur->coins = btc_prevmap_create();
+  cur->height = start < 0 ? 0 : start;
+  cur->end = end;
+  cur->missing = 0;
+
+  cur->job.scan = scan;
+  cur->job.coins = cur->coins;
+  cur->job.blocks = cur->blocks;
+
+  return cur;
+}
+
+void
+btc_rescancursor_destroy(btc_rescancursor_t *cur) {
+  btc_prevmapiter_t iter;
+
+  btc_prevmap_iterate(&iter, cur->coins);
+
+  while (btc_prevmap_next(&iter))
+    btc_free(iter.val);
+
+  btc_prevmap_destroy(cur->coins);
+  btc_free(cur->blocks);
+  btc_free(cur);
+}
+
+static int32_t
+btc_rescancursor_end(const btc_rescancursor_t *cur) {
+  /* A negative end follows the tip. */
+  int32_t height = btc_chain_height(cur->chain);
+
+  if (cur->end < 0 || cur->end > height)
+    return height;
+
+  return cur->end;
+}
+
+int
+btc_rescancursor_done(const btc_rescancursor_t *cur) {
+  return cur->height > btc_rescancursor_end(cur);
+}
+
+int32_t
+btc_rescancursor_height(const btc_rescancursor_t *cur) {
+  return cur->height;
+}
+
+int32_t
+btc_rescancursor_missing(const btc_rescancursor_t *cur) {
+  return cur->missing;
+}
+
+int
+btc_rescancursor_next(btc_rescancursor_t *cur,
+                      btc_rescan_f *callback,
+                      void *arg) {
+  btc_workers_t *pool = btc_chain_workers(cur->chain);
+  btc_rescanblock_t *blocks = cur->blocks;
+  int32_t end = btc_rescancursor_end(cur);
+  size_t i, count;
+  int unresolved = 0;
+
+  if (cur->height > end)
+    return 1;
+
+  count = end - cur->height + 1;
+
+  if (count > BTC_RESCAN_BATCH)
+    count = BTC_RESCAN_BATCH;
+
+  for (i = 0; i < count; i++) {
+    int32_t height = cur->height + (int32_t)i;
+    const btc_entry_t *entry = btc_chain_by_height(cur->chain, height);
+
+    if (!btc_rescan_load(&blocks[i], cur->chain, entry)) {
+      count = i + 1;
+      goto fail;
+    }
+  }
+
+  btc_rescan_parallel(pool, count, btc_rescan_outputs, &cur->job);
+
+  for (i = 0; i < count; i++) {
+    const btc_matchvec_t *outputs = &blocks[i].outputs;
+    size_t j;
+
+    if (!blocks[i].ok)
+      goto fail;
+
+    if (!blocks[i].resolved) {
+      cur->missing += 1;
+      unresolved = 1;
+    }
+
+    for (j = 0; j < outputs->length; j++) {
+      const btc_rescanmatch_t *match = &outputs->items[j];
+      btc_rescancoin_t *coin = btc_malloc(sizeof(btc_rescancoin_t));
+
+      coin->value = match->value;
+      coin->script = match->script;
+
+      /* Duplicate txids (BIP30) overwrite nothing. */
+      if (!btc_prevmap_put(cur->coins, &match->prevout, coin))
+        btc_free(coin);
+    }
+  }
+
+  if (unresolved && btc_prevmap_size(cur->coins) > 0)
+    btc_rescan_parallel(pool, count, btc_rescan_inputs, &cur->job);
+
+  for (i = 0; i < count; i++) {
+    if (!blocks[i].ok)
+      goto fail;
+  }
+
+  for (i = 0; i < count; i++) {
+    btc_rescan_report(&blocks[i], cur->coins, callback, arg);
+    btc_rescan_release(&blocks[i]);
+  }
+
+  cur->height += (int32_t)count;
+
+  return 1;
+fail:
+  for (i = 0; i < count; i++)
+    btc_rescan_release(&blocks[i]);
+
+  return 0;
+}
+
+/*
+ * Rescan (Blocking)
+ */
+
+int
+btc_rescan_run(btc_rescan_t *scan,
+               btc_chain_t *chain,
+               int32_t start,
+               int32_t end,
+               btc_rescan_f *callback,
+               void *arg) {
+  btc_rescancursor_t *cur;
+  int ret = 1;
+
+  /* The tip cannot move while we hold the loop. */
+  if (end < 0)
+    end = btc_chain_height(chain);
+
+  cur = btc_rescancursor_create(scan, chain, start, end);
+
+  while (!btc_rescancursor_done(cur)) {
+    if (!btc_rescancursor_next(cur, callback, arg)) {
+      ret = 0;
+      break;
+    }
+  }
+
+  btc_rescancursor_destroy(cur);
+
+  return ret;
+}
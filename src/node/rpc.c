@@ -13,13 +13,19 @@
 #include <io/core.h>
 #include <io/http.h>
 #include <io/loop.h>
+#include <io/trace.h>
+#include <io/workers.h>
 
+#include <node/addrindex.h>
 #include <node/addrman.h>
 #include <node/chain.h>
+#include <node/chaindb.h>
+#include <node/fees.h>
 #include <node/logger.h>
 #include <node/mempool.h>
 #include <node/miner.h>
 #include <node/node.h>
+#include <node/perf.h>
 #include <node/pool.h>
 #include <node/rpc.h>
 #include <node/timedata.h>
@@ -28,6 +34,7 @@
 #include <mako/block.h>
 #include <mako/coins.h>
 #include <mako/consensus.h>
+#include <mako/cpu.h>
 #include <mako/crypto/hash.h>
 #include <mako/encoding.h>
 #include <mako/entry.h>
@@ -38,17 +45,35 @@
 #include <mako/netaddr.h>
 #include <mako/netmsg.h>
 #include <mako/network.h>
+#include <mako/policy.h>
 #include <mako/script.h>
 #include <mako/tx.h>
 #include <mako/util.h>
 #include <mako/vector.h>
 
+#include "../bio.h"
+#include "../impl.h"
 #include "../internal.h"
 
 /*
  * Constants
  */
 
+/* Output a worker may produce ahead of the socket. */
+#define RPC_BODY_BUFFER (1 << 20)
+
+/* Same limits as bitcoin core. */
+#define REST_MAX_HEADERS 2000
+#define REST_MAX_OUTPOINTS 15
+#define REST_MEMPOOL_HEIGHT 0x7fffffff
+
+/* A long-polled template is returned early once
+   its fees grow by this fraction (1/10th). */
+#define RPC_LONGPOLL_FEES 10
+
+/* Or once this long has passed with any change. */
+#define RPC_LONGPOLL_REFRESH (60 * 1000)
+
 enum rpc_error {
   /* Standard JSON-RPC 2.0 errors */
   RPC_INVALID_REQUEST = -32600,
@@ -135,23 +160,40 @@ rpc_req_init(rpc_req_t *req) {
 
 static int
 rpc_req_set(rpc_req_t *req, const json_value *obj) {
-  const json_value *method, *params, *id;
+  const json_value *method = NULL;
+  const json_value *params = NULL;
+  const json_value *id = NULL;
+  unsigned int i;
 
   if (obj == NULL || obj->type != json_object)
     return 0;
 
-  method = json_object_get(obj, "method");
+  /* The envelope keys, in one pass. Like
+     json_object_get, the first match wins. */
+  for (i = 0; i < obj->u.object.length; i++) {
+    const json_object_entry *entry = &obj->u.object.values[i];
+    const char *name = entry->name;
+
+    switch (entry->name_length) {
+      case 2:
+        if (id == NULL && memcmp(name, "id", 2) == 0)
+          id = entry->value;
+        break;
+      case 6:
+        if (method == NULL && memcmp(name, "method", 6) == 0)
+          method = entry->value;
+        else if (params == NULL && memcmp(name, "params", 6) == 0)
+          params = entry->value;
+        break;
+    }
+  }
 
   if (method == NULL || method->type != json_string)
     return 0;
 
-  params = json_object_get(obj, "params");
-
   if (params == NULL || params->type != json_array)
     return 0;
 
-  id = json_object_get(obj, "id");
-
   if (id == NULL || id->type != json_integer)
     return 0;
 
@@ -166,17 +208,44 @@ rpc_req_set(rpc_req_t *req, const json_value *obj) {
  * RPC Response
  */
 
+struct rpc_res_s;
+
+typedef int rpc_stream_cb(json_writer *, void *);
+typedef int rpc_wait_cb(struct rpc_res_s *, void *, int);
+typedef void rpc_free_cb(void *);
+
 typedef struct rpc_res_s {
   json_value *result;
+  rpc_stream_cb *stream;
+  rpc_wait_cb *wait;
+  rpc_free_cb *free_cb;
+  void *arg;
   const char *msg;
   int code;
+  btc_chainreader_t *reader;
 } rpc_res_t;
 
 static void
 rpc_res_init(rpc_res_t *res) {
   res->result = NULL;
+  res->stream = NULL;
+  res->wait = NULL;
+  res->free_cb = NULL;
+  res->arg = NULL;
   res->msg = NULL;
   res->code = 0;
+  res->reader = NULL;
+}
+
+static void
+rpc_res_unstream(rpc_res_t *res) {
+  if (res->free_cb != NULL)
+    res->free_cb(res->arg);
+
+  res->stream = NULL;
+  res->wait = NULL;
+  res->free_cb = NULL;
+  res->arg = NULL;
 }
 
 static void
@@ -184,16 +253,96 @@ rpc_res_error(rpc_res_t *res, int code, const char *msg) {
   if (res->result != NULL)
     json_builder_free(res->result);
 
+  rpc_res_unstream(res);
+
   res->result = NULL;
   res->msg = msg;
   res->code = code;
 }
 
+static void
+rpc_res_stream(rpc_res_t *res,
+               rpc_stream_cb *stream,
+               rpc_free_cb *free_cb,
+               void *arg) {
+  /* Large results are written incrementally rather
+     than built as a tree. `stream` writes the next
+     piece of the result and returns zero when done. */
+  res->stream = stream;
+  res->free_cb = free_cb;
+  res->arg = arg;
+}
+
+static void
+rpc_res_defer(rpc_res_t *res,
+              rpc_wait_cb *wait,
+              rpc_free_cb *free_cb,
+              void *arg) {
+  /* The result is not ready yet (long-polling).
+     `wait` fills in the response and returns
+     non-zero once it is, or when forced to. */
+  res->wait = wait;
+  res->free_cb = free_cb;
+  res->arg = arg;
+}
+
+static int
+rpc_res_settle(rpc_res_t *res, int force) {
+  rpc_wait_cb *wait = res->wait;
+  rpc_free_cb *free_cb = res->free_cb;
+  void *arg = res->arg;
+
+  /* Detached so that `wait` may set a result. */
+  res->wait = NULL;
+  res->free_cb = NULL;
+  res->arg = NULL;
+
+  if (!wait(res, arg, force)) {
+    res->wait = wait;
+    res->free_cb = free_cb;
+    res->arg = arg;
+    return 0;
+  }
+
+  if (free_cb != NULL)
+    free_cb(arg);
+
+  return 1;
+}
+
+static json_value *
+rpc_res_collect(rpc_res_t *res) {
+  json_value *result;
+  json_writer w;
+
+  json_writer_init(&w, NULL, NULL);
+
+  while (res->stream(&w, res->arg))
+    ;
+
+  result = json_decode(w.data, w.length);
+
+  CHECK(result != NULL);
+
+  json_writer_clear(&w);
+
+  rpc_res_unstream(res);
+
+  return result;
+}
+
 static json_value *
 rpc_res_encode(rpc_res_t *res, int64_t id) {
   json_value *obj = json_object_new(3);
   json_value *err;
 
+  /* Nothing to wait on outside of a connection. */
+  if (res->wait != NULL)
+    rpc_res_settle(res, 1);
+
+  if (res->stream != NULL)
+    res->result = rpc_res_collect(res);
+
   if (res->result == NULL)
     res->result = json_null_new();
 
@@ -218,6 +367,384 @@ rpc_res_encode(rpc_res_t *res, int64_t id) {
   return obj;
 }
 
+/*
+ * RPC Body
+ */
+
+typedef struct rpc_chunk_s {
+  struct rpc_chunk_s *next;
+  size_t length;
+  char *data;
+} rpc_chunk_t;
+
+typedef struct rpc_body_s {
+  rpc_stream_cb *stream;
+  rpc_free_cb *free_cb;
+  void *arg;
+  int64_t id;
+  int batch;
+  json_writer writer;
+  http_res_t *res;
+  int failed;
+  btc_workers_t *workers;
+  btc_mutex_t *lock;
+  rpc_chunk_t *head;
+  rpc_chunk_t *tail;
+  size_t queued;
+  size_t written;
+  int running;
+  int done;
+  int orphan;
+} rpc_body_t;
+
+static void
+rpc_body_sink(void *arg, const char *data, size_t length) {
+  rpc_body_t *body = arg;
+  rpc_chunk_t *chunk;
+
+  if (body->workers == NULL) {
+    if (!body->failed && !http_res_chunk(body->res, data, length))
+      body->failed = 1;
+    body->written += length;
+    return;
+  }
+
+  chunk = btc_malloc(sizeof(rpc_chunk_t) + length);
+  chunk->next = NULL;
+  chunk->length = length;
+  chunk->data = (char *)(chunk + 1);
+
+  memcpy(chunk->data, data, length);
+
+  btc_mutex_lock(body->lock);
+
+  if (body->head == NULL)
+    body->head = chunk;
+  else
+    body->tail->next = chunk;
+
+  body->tail = chunk;
+  body->queued += length;
+
+  btc_mutex_unlock(body->lock);
+}
+
+static int
+rpc_body_step(rpc_body_t *body) {
+  json_writer *w = &body->writer;
+  int more = body->stream(w, body->arg);
+
+  /* The writer hands full chunks to the sink. */
+  if (!more) {
+    if (!body->batch) {
+      json_writer_key(w, "error");
+      json_writer_null(w);
+      json_writer_key(w, "id");
+      json_writer_integer(w, body->id);
+      json_writer_object_end(w);
+    }
+
+    json_writer_flush(w);
+
+    rpc_body_sink(body, "\n", 1);
+  }
+
+  return more;
+}
+
+static rpc_body_t *
+rpc_body_create(rpc_res_t *rres,
+                int64_t id,
+                int batch,
+                http_res_t *res,
+                btc_workers_t *workers) {
+  rpc_body_t *body = btc_malloc(sizeof(rpc_body_t));
+
+  body->stream = rres->stream;
+  body->free_cb = rres->free_cb;
+  body->arg = rres->arg;
+  body->id = id;
+  body->batch = batch;
+  body->res = res;
+  body->failed = 0;
+  body->workers = workers;
+  body->lock = workers != NULL ? btc_mutex_create() : NULL;
+  body->head = NULL;
+  body->tail = NULL;
+  body->queued = 0;
+  body->written = 0;
+  body->running = 0;
+  body->done = 0;
+  body->orphan = 0;
+
+  json_writer_init(&body->writer, rpc_body_sink, body);
+
+  rres->stream = NULL;
+  rres->free_cb = NULL;
+  rres->arg = NULL;
+
+  /* A batch writes the whole document itself. */
+  if (!batch) {
+    json_writer_object_begin(&body->writer);
+    json_writer_key(&body->writer, "result");
+  }
+
+  /* The first step runs on the loop so that it may
+     read node state. Later steps may run on an RPC
+     worker and must only touch their own argument. */
+  if (workers != NULL)
+    body->done = !rpc_body_step(body);
+
+  return body;
+}
+
+static void
+rpc_body_destroy(rpc_body_t *body) {
+  rpc_chunk_t *chunk, *next;
+
+  if (body->free_cb != NULL)
+    body->free_cb(body->arg);
+
+  for (chunk = body->head; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    btc_free(chunk);
+  }
+
+  if (body->lock != NULL)
+    btc_mutex_destroy(body->lock);
+
+  json_writer_clear(&body->writer);
+
+  btc_free(body);
+}
+
+static void
+rpc_body_produce(void *arg) {
+  /* Runs on an RPC worker. */
+  rpc_body_t *body = arg;
+  int orphan = 0;
+  int more = 1;
+  int stop;
+
+  for (;;) {
+    btc_mutex_lock(body->lock);
+
+    stop = !more || body->orphan || body->queued >= RPC_BODY_BUFFER;
+
+    if (stop) {
+      if (!more)
+        body->done = 1;
+
+      body->running = 0;
+
+      orphan = body->orphan;
+    }
+
+    btc_mutex_unlock(body->lock);
+
+    if (stop)
+      break;
+
+    more = rpc_body_step(body);
+  }
+
+  /* The connection went away while we were running. */
+  if (orphan)
+    rpc_body_destroy(body);
+}
+
+static int
+rpc_body_pull(http_res_t *res, void *arg) {
+  rpc_body_t *body = arg;
+  rpc_chunk_t *chunk, *next;
+  int submit = 0;
+  int done;
+
+  if (body->workers == NULL) {
+    size_t written = body->written;
+    int more;
+
+    /* Small steps (e.g. batch responses) may all sit
+       in the writer. Keep going until something hits
+       the socket, otherwise we wait for the next tick. */
+    do {
+      more = rpc_body_step(body);
+    } while (more && !body->failed && body->written == written);
+
+    if (body->failed)
+      return -1;
+
+    return more;
+  }
+
+  btc_mutex_lock(body->lock);
+
+  chunk = body->head;
+  done = body->done;
+
+  body->head = NULL;
+  body->tail = NULL;
+  body->queued = 0;
+
+  if (!done && !body->running) {
+    body->running = 1;
+    submit = 1;
+  }
+
+  btc_mutex_unlock(body->lock);
+
+  for (; chunk != NULL; chunk = next) {
+    next = chunk->next;
+
+    if (!body->failed && !http_res_chunk(res, chunk->data, chunk->length))
+      body->failed = 1;
+
+    btc_free(chunk);
+  }
+
+  if (submit)
+    btc_workers_add(body->workers, rpc_body_produce, body);
+
+  if (body->failed)
+    return -1;
+
+  return !done;
+}
+
+static void
+rpc_body_free(void *arg) {
+  rpc_body_t *body = arg;
+  int running = 0;
+
+  if (body->lock != NULL) {
+    btc_mutex_lock(body->lock);
+
+    running = body->running;
+
+    if (running)
+      body->orphan = 1;
+
+    btc_mutex_unlock(body->lock);
+  }
+
+  /* Otherwise the worker frees it. */
+  if (!running)
+    rpc_body_destroy(body);
+}
+
+/*
+ * RPC Wait
+ */
+
+typedef struct rpc_wait_s {
+  rpc_res_t rres;
+  int64_t id;
+} rpc_wait_t;
+
+static rpc_wait_t *
+rpc_wait_create(rpc_res_t *rres, int64_t id) {
+  rpc_wait_t *wait = btc_malloc(sizeof(rpc_wait_t));
+
+  wait->rres = *rres;
+  wait->id = id;
+
+  rpc_res_init(rres);
+
+  return wait;
+}
+
+static int
+rpc_wait_pull(http_res_t *res, void *arg) {
+  /* Polled on every loop tick until ready. */
+  rpc_wait_t *wait = arg;
+  json_value *obj;
+  size_t length;
+  char *body;
+  int ok;
+
+  if (!rpc_res_settle(&wait->rres, 0))
+    return 1;
+
+  obj = rpc_res_encode(&wait->rres, wait->id);
+  body = json_encode(obj);
+  length = strlen(body);
+
+  body[length++] = '\n';
+
+  ok = http_res_chunk(res, body, length);
+
+  json_builder_free(obj);
+  free(body);
+
+  return ok ? 0 : -1;
+}
+
+static void
+rpc_wait_free(void *arg) {
+  rpc_wait_t *wait = arg;
+
+  rpc_res_unstream(&wait->rres);
+
+  if (wait->rres.result != NULL)
+    json_builder_free(wait->rres.result);
+
+  btc_free(wait);
+}
+
+/*
+ * RPC Batch
+ */
+
+typedef struct rpc_batch_s {
+  json_value **items;
+  size_t length;
+  size_t index;
+} rpc_batch_t;
+
+static rpc_batch_t *
+rpc_batch_create(size_t length) {
+  rpc_batch_t *batch = btc_malloc(sizeof(rpc_batch_t));
+
+  /* Kept as separate roots: the serializer
+     walks up through parent pointers. */
+  batch->items = btc_malloc(length * sizeof(json_value *));
+  batch->length = 0;
+  batch->index = 0;
+
+  return batch;
+}
+
+static int
+rpc_batch_stream(json_writer *w, void *arg) {
+  rpc_batch_t *batch = arg;
+
+  if (batch->index == 0)
+    json_writer_array_begin(w);
+
+  /* One response per call. */
+  if (batch->index < batch->length)
+    json_writer_value(w, batch->items[batch->index++]);
+
+  if (batch->index == batch->length) {
+    json_writer_array_end(w);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void
+rpc_batch_free(void *arg) {
+  rpc_batch_t *batch = arg;
+  size_t i;
+
+  for (i = 0; i < batch->length; i++)
+    json_builder_free(batch->items[i]);
+
+  btc_free(batch->items);
+  btc_free(batch);
+}
+
 /*
  * RPC
  */
@@ -233,9 +760,21 @@ struct btc_rpc_s {
   btc_miner_t *miner;
   btc_pool_t *pool;
   http_server_t *http;
+  btc_workers_t *workers;
+  btc_mutex_t *lock;
+  btc_vector_t readers;
+  btc_coinscan_t *scan;
+  btc_hashmap_t *stats;
+  const char *warmup;
+  int threads;
   unsigned int flags;
   btc_sockaddr_t bind;
   uint8_t auth_hash[32];
+  struct btc_rpcbuf_s {
+    char *data;
+    size_t length;
+    size_t alloc;
+  } metrics;
 };
 
 static int
@@ -258,8 +797,11 @@ btc_rpc_create(btc_node_t *node) {
   rpc->miner = node->miner;
   rpc->pool = node->pool;
   rpc->http = http_server_create(node->loop);
+  rpc->stats = btc_hashmap_create();
   rpc->flags = BTC_RPC_DEFAULT_FLAGS;
 
+  btc_vector_init(&rpc->readers);
+
   btc_sockaddr_import(&rpc->bind, "127.0.0.1", network->rpc_port);
 
   rpc->http->on_request = on_request;
@@ -270,7 +812,22 @@ btc_rpc_create(btc_node_t *node) {
 
 void
 btc_rpc_destroy(btc_rpc_t *rpc) {
+  btc_hashmapiter_t iter;
+
+  btc_hashmap_iterate(&iter, rpc->stats);
+
+  while (btc_hashmap_next(&iter))
+    btc_free(iter.val);
+
+  btc_hashmap_destroy(rpc->stats);
+
+  btc_vector_clear(&rpc->readers);
+
   http_server_destroy(rpc->http);
+
+  if (rpc->metrics.alloc > 0)
+    btc_free(rpc->metrics.data);
+
   btc_free(rpc);
 }
 
@@ -279,6 +836,17 @@ btc_rpc_set_bind(btc_rpc_t *rpc, const btc_netaddr_t *addr) {
   btc_netaddr_get_sockaddr(&rpc->bind, addr);
 }
 
+void
+btc_rpc_set_threads(btc_rpc_t *rpc, int threads) {
+  if (threads < 0)
+    threads = 0;
+
+  if (threads > 16)
+    threads = 16;
+
+  rpc->threads = threads;
+}
+
 void
 btc_rpc_set_credentials(btc_rpc_t *rpc, const char *user, const char *pass) {
   btc_hmac256_t hmac;
@@ -292,6 +860,12 @@ btc_rpc_set_credentials(btc_rpc_t *rpc, const char *user, const char *pass) {
   }
 }
 
+void
+btc_rpc_set_warmup(btc_rpc_t *rpc, const char *status) {
+  /* Calls fail with RPC_IN_WARMUP while this is set. */
+  rpc->warmup = status;
+}
+
 static void
 btc_rpc_log(btc_rpc_t *rpc, const char *fmt, ...) {
   va_list ap;
@@ -309,6 +883,12 @@ btc_rpc_open(btc_rpc_t *rpc, unsigned int flags) {
   if (!http_server_open(rpc->http, &rpc->bind))
     return 0;
 
+  if (rpc->threads > 0) {
+    rpc->workers = btc_workers_create(rpc->threads, 1);
+    rpc->lock = btc_mutex_create();
+    btc_workers_notify(rpc->workers, rpc->loop);
+  }
+
   btc_rpc_log(rpc, "RPC listening on %S.", &rpc->bind);
 
   return 1;
@@ -319,6 +899,48 @@ btc_rpc_close(btc_rpc_t *rpc) {
   btc_rpc_log(rpc, "Closing RPC.");
 
   http_server_close(rpc->http);
+
+  /* Orphaned bodies are freed by their jobs. */
+  if (rpc->workers != NULL) {
+    btc_workers_wait(rpc->workers);
+    btc_workers_destroy(rpc->workers);
+    rpc->workers = NULL;
+  }
+
+  /* The readers hold the chain open. */
+  while (rpc->readers.length > 0)
+    btc_chainreader_destroy(btc_vector_pop(&rpc->readers));
+
+  if (rpc->lock != NULL) {
+    btc_mutex_destroy(rpc->lock);
+    rpc->lock = NULL;
+  }
+}
+
+static btc_chainreader_t *
+btc_rpc_reader(btc_rpc_t *rpc) {
+  /* Called from the RPC workers. Readers are
+     opened on demand and kept until close. */
+  btc_chainreader_t *reader = NULL;
+
+  btc_mutex_lock(rpc->lock);
+
+  if (rpc->readers.length > 0)
+    reader = btc_vector_pop(&rpc->readers);
+
+  btc_mutex_unlock(rpc->lock);
+
+  if (reader == NULL)
+    reader = btc_chain_reader(rpc->chain);
+
+  return reader;
+}
+
+static void
+btc_rpc_unreader(btc_rpc_t *rpc, btc_chainreader_t *reader) {
+  btc_mutex_lock(rpc->lock);
+  btc_vector_push(&rpc->readers, reader);
+  btc_mutex_unlock(rpc->lock);
 }
 
 /*
@@ -339,11 +961,50 @@ btc_rpc_close(btc_rpc_t *rpc) {
  * Call Helpers
  */
 
+/* Handlers marked RPC_WORKER read the chain through
+   these: on an RPC worker, `res->reader` is set and
+   the chain itself must not be touched. */
+
+static const btc_entry_t *
+btc_rpc_by_height(btc_rpc_t *rpc, rpc_res_t *res, int32_t height) {
+  if (res->reader != NULL)
+    return btc_chainreader_by_height(res->reader, height);
+
+  return btc_chain_by_height(rpc->chain, height);
+}
+
+static const btc_entry_t *
+btc_rpc_by_hash(btc_rpc_t *rpc, rpc_res_t *res, const uint8_t *hash) {
+  if (res->reader != NULL)
+    return btc_chainreader_by_hash(res->reader, hash);
+
+  return btc_chain_by_hash(rpc->chain, hash);
+}
+
+static btc_block_t *
+btc_rpc_get_block(btc_rpc_t *rpc, rpc_res_t *res, const btc_entry_t *entry) {
+  btc_block_t *block;
+
+  if (res->reader == NULL)
+    return btc_chain_get_block(rpc->chain, entry);
+
+  if (!btc_chainreader_read(res->reader, &block, NULL, entry))
+    return NULL;
+
+  return block;
+}
+
 static int32_t
 btc_rpc_get_depth(btc_rpc_t *rpc,
+                  rpc_res_t *res,
                   const btc_entry_t *entry,
                   const uint8_t **next) {
-  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  const btc_entry_t *tip;
+
+  if (res->reader != NULL)
+    return btc_chainreader_depth(res->reader, entry, next);
+
+  tip = btc_chain_tip(rpc->chain);
 
   if (entry == tip) {
     *next = NULL;
@@ -380,51 +1041,328 @@ btc_rpc_getinfo(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
   res->result = result;
 }
 
-/*
- * Blockchain
- */
+static json_value *
+json_hist_new(const btc_hist_t *hist) {
+  json_value *obj = json_object_new(6);
+
+  /* Nanoseconds in, microseconds out. */
+  json_object_push(obj, "count", json_integer_new(hist->count));
+  json_object_push(obj, "mean_us",
+                   json_integer_new(btc_hist_mean(hist) / 1000));
+  json_object_push(obj, "p50_us",
+                   json_integer_new(btc_hist_percentile(hist, 0.50) / 1000));
+  json_object_push(obj, "p90_us",
+                   json_integer_new(btc_hist_percentile(hist, 0.90) / 1000));
+  json_object_push(obj, "p99_us",
+                   json_integer_new(btc_hist_percentile(hist, 0.99) / 1000));
+  json_object_push(obj, "max_us", json_integer_new(hist->max / 1000));
+
+  return obj;
+}
 
 static void
-btc_rpc_getblockchaininfo(btc_rpc_t *rpc,
-                          const json_params *params,
-                          rpc_res_t *res) {
-  const btc_network_t *network = rpc->network;
-  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
-  double diff, prog;
-  json_value *obj;
-  int64_t mtp;
+btc_rpc_getdbstats(btc_rpc_t *rpc,
+                   const json_params *params,
+                   rpc_res_t *res) {
+  const btc_dbtune_t *tune = btc_chain_tune(rpc->chain);
+  json_value *result, *obj;
+  btc_dbstats_t stats;
+  char *structure;
 
   if (params->help || params->length != 0)
-    THROW_MISC("getblockchaininfo");
+    THROW_MISC("getdbstats");
 
-  diff = btc_difficulty(tip->header.bits);
-  prog = btc_chain_progress(rpc->chain);
-  mtp = btc_entry_median_time(tip);
+  /* Database sizes are in kilobytes, as lsm reports
+     them. The coin cache is measured in bytes. */
+  btc_chain_stats(rpc->chain, &stats);
+
+  result = json_object_new(6);
 
   obj = json_object_new(7);
 
-  json_object_push(obj, "chain", json_string_new(network->name));
-  json_object_push(obj, "blocks", json_integer_new(tip->height));
-  json_object_push(obj, "bestblockhash", json_hash_new(tip->hash));
-  json_object_push(obj, "difficulty", json_double_new(diff));
-  json_object_push(obj, "mediantime", json_integer_new(mtp));
-  json_object_push(obj, "verificationprogress", json_double_new(prog));
-  json_object_push(obj, "chainwork", json_hash_new(tip->chainwork));
+  json_object_push(obj, "autoflush", json_integer_new(tune->autoflush));
+  json_object_push(obj, "bulkflush", json_integer_new(tune->bulk_flush));
+  json_object_push(obj, "autocheckpoint",
+                   json_integer_new(tune->autocheckpoint));
+  json_object_push(obj, "automerge", json_integer_new(tune->automerge));
+  json_object_push(obj, "blockcache", json_integer_new(tune->cache_size));
+  json_object_push(obj, "buffer", json_integer_new(tune->buffer_size));
+  json_object_push(obj, "mmap", json_integer_new(tune->mmap));
+  json_object_push(result, "tuning", obj);
 
-  res->result = obj;
-}
+  obj = json_object_new(4);
 
-static void
-btc_rpc_getbestblockhash(btc_rpc_t *rpc,
-                         const json_params *params,
-                         rpc_res_t *res) {
-  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  json_object_push(obj, "levels", json_integer_new(stats.levels));
+  json_object_push(obj, "segments", json_integer_new(stats.segments));
+  json_object_push(obj, "old", json_integer_new(stats.tree_old));
+  json_object_push(obj, "new", json_integer_new(stats.tree_new));
+  json_object_push(result, "tree", obj);
 
-  if (params->help || params->length != 0)
-    THROW_MISC("getbestblockhash");
+  json_object_push(result, "checkpoint", json_integer_new(stats.checkpoint));
 
-  res->result = json_hash_new(tip->hash);
-}
+  obj = json_object_new(2);
+
+  json_object_push(obj, "read", json_integer_new(stats.pages_read));
+  json_object_push(obj, "written", json_integer_new(stats.pages_written));
+  json_object_push(result, "pages", obj);
+
+  obj = json_object_new(4);
+
+  json_object_push(obj, "usage", json_integer_new(stats.cache_usage));
+  json_object_push(obj, "limit", json_integer_new(stats.cache_limit));
+  json_object_push(obj, "hits", json_integer_new(stats.cache_hits));
+  json_object_push(obj, "misses", json_integer_new(stats.cache_misses));
+  json_object_push(result, "coincache", obj);
+
+  structure = btc_chain_structure(rpc->chain);
+
+  if (structure != NULL) {
+    json_object_push(result, "structure", json_string_new(structure));
+    btc_free(structure);
+  } else {
+    json_object_push(result, "structure", json_null_new());
+  }
+
+  res->result = result;
+}
+
+static void
+btc_rpc_getperfstats(btc_rpc_t *rpc,
+                     const json_params *params,
+                     rpc_res_t *res) {
+  const btc_perf_t *perf = rpc->node->perf;
+  json_value *result;
+  btc_hist_t syncs;
+  int i;
+
+  if (params->help || params->length != 0)
+    THROW_MISC("getperfstats");
+
+  /* Block file syncs happen on the chaindb's writer thread. */
+  btc_chain_sync_stats(rpc->chain, &syncs);
+
+  result = json_object_new(BTC_PERF_MAX + 1);
+
+  for (i = 0; i < BTC_PERF_MAX; i++) {
+    json_object_push(result, btc_perf_name((enum btc_perf_stage)i),
+                             json_hist_new(&perf->stages[i]));
+
+    if (i == BTC_PERF_BLOCK_SAVE)
+      json_object_push(result, "block_sync", json_hist_new(&syncs));
+  }
+
+  res->result = result;
+}
+
+static void
+btc_rpc_getcpuinfo(btc_rpc_t *rpc,
+                   const json_params *params,
+                   rpc_res_t *res) {
+  unsigned int detected = btc_cpu_detected();
+  unsigned int enabled = btc_cpu_features();
+  json_value *result, *obj;
+  const char *name;
+  size_t i;
+
+  (void)rpc;
+
+  if (params->help || params->length != 0)
+    THROW_MISC("getcpuinfo");
+
+  result = json_object_new(2);
+
+  /* Detected, and whether the dispatchers may use it. */
+  obj = json_object_new(8);
+
+  for (i = 0; (name = btc_cpu_feature_name(i)) != NULL; i++) {
+    if (detected & (1u << i))
+      json_object_push(obj, name, json_boolean_new((enabled >> i) & 1));
+  }
+
+  json_object_push(result, "features", obj);
+
+  /* The code each primitive runs on this host. */
+  obj = json_object_new(8);
+
+  for (i = 0; (name = btc_cpu_backend_name(i)) != NULL; i++)
+    json_object_push(obj, name, json_string_new(btc_cpu_backend(i)));
+
+  json_object_push(result, "backends", obj);
+
+  res->result = result;
+}
+
+static void
+btc_rpc_getmemoryinfo(btc_rpc_t *rpc,
+                      const json_params *params,
+                      rpc_res_t *res) {
+  btc_memstat_t stats[BTC_MEMTAG_MAX];
+  json_value *result, *obj, *item;
+  btc_nettotals_t totals;
+  btc_dbstats_t db;
+  int enabled, i;
+
+  if (params->help || params->length != 0)
+    THROW_MISC("getmemoryinfo");
+
+  btc_chain_stats(rpc->chain, &db);
+  btc_pool_nettotals(rpc->pool, &totals);
+
+  enabled = btc_memstats(stats);
+
+  result = json_object_new(4);
+
+  json_object_push(result, "accounting", json_boolean_new(enabled));
+
+  /* Measured by the subsystems themselves. */
+  obj = json_object_new(5);
+
+  json_object_push(obj, "coins", json_integer_new(db.cache_usage));
+  json_object_push(obj, "mempool",
+                   json_integer_new(btc_mempool_usage(rpc->mempool)));
+  json_object_push(obj, "send_queue", json_integer_new(totals.send_queue));
+  json_object_push(obj, "recv_buffer", json_integer_new(totals.recv_buffer));
+  json_object_push(obj, "block_buffer", json_integer_new(totals.block_buffer));
+
+  json_object_push(result, "usage", obj);
+
+  /* Blocks downloaded but not yet connected. */
+  obj = json_object_new(5);
+
+  json_object_push(obj, "bytes", json_integer_new(totals.block_buffer));
+  json_object_push(obj, "limit", json_integer_new(totals.block_buffer_max));
+  json_object_push(obj, "held", json_integer_new(totals.blocks_held));
+  json_object_push(obj, "inflight", json_integer_new(totals.blocks_inflight));
+  json_object_push(obj, "throttled", json_boolean_new(totals.throttled));
+
+  json_object_push(result, "blockbuffer", obj);
+
+  /* Heap bytes by tag (only with BTC_MEMSTATS). */
+  if (enabled) {
+    obj = json_object_new(BTC_MEMTAG_MAX);
+
+    for (i = 0; i < BTC_MEMTAG_MAX; i++) {
+      item = json_object_new(2);
+
+      json_object_push(item, "bytes", json_integer_new(stats[i].bytes));
+      json_object_push(item, "allocs", json_integer_new(stats[i].count));
+
+      json_object_push(obj, btc_memtag_name(i), item);
+    }
+
+    json_object_push(result, "allocated", obj);
+  }
+
+  res->result = result;
+}
+
+static void
+btc_rpc_starttrace(btc_rpc_t *rpc,
+                   const json_params *params,
+                   rpc_res_t *res) {
+  int events = 0;
+
+  if (params->help || params->length > 1)
+    THROW_MISC("starttrace ( events )");
+
+  if (params->length > 0) {
+    if (!json_unsigned_get(&events, params->values[0]))
+      THROW_TYPE(events, integer);
+  }
+
+#ifndef BTC_TRACE
+  THROW_MISC("Tracing is not compiled in");
+#endif
+
+  if (btc_trace_active())
+    THROW_MISC("Trace already running");
+
+  if (!btc_node_start_trace(rpc->node, events))
+    THROW_MISC("Could not start trace");
+
+  res->result = json_boolean_new(1);
+}
+
+static void
+btc_rpc_stoptrace(btc_rpc_t *rpc,
+                  const json_params *params,
+                  rpc_res_t *res) {
+  const char *path = NULL;
+  json_value *obj;
+  size_t events;
+
+  if (params->help || params->length > 1)
+    THROW_MISC("stoptrace ( path )");
+
+  if (params->length > 0) {
+    if (params->values[0]->type != json_string)
+      THROW_TYPE(path, string);
+
+    path = params->values[0]->u.string.ptr;
+  }
+
+  if (!btc_trace_active())
+    THROW_MISC("No trace running");
+
+  if (path == NULL)
+    path = rpc->node->trace_file;
+
+  if (!btc_node_stop_trace(rpc->node, path, &events))
+    THROW_MISC("Could not write trace");
+
+  obj = json_object_new(2);
+
+  json_object_push(obj, "events", json_integer_new(events));
+  json_object_push(obj, "path", json_string_new(path));
+
+  res->result = obj;
+}
+
+/*
+ * Blockchain
+ */
+
+static void
+btc_rpc_getblockchaininfo(btc_rpc_t *rpc,
+                          const json_params *params,
+                          rpc_res_t *res) {
+  const btc_network_t *network = rpc->network;
+  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  double diff, prog;
+  json_value *obj;
+  int64_t mtp;
+
+  if (params->help || params->length != 0)
+    THROW_MISC("getblockchaininfo");
+
+  diff = btc_difficulty(tip->header.bits);
+  prog = btc_chain_progress(rpc->chain);
+  mtp = btc_chain_median_time(rpc->chain, tip);
+
+  obj = json_object_new(7);
+
+  json_object_push(obj, "chain", json_string_new(network->name));
+  json_object_push(obj, "blocks", json_integer_new(tip->height));
+  json_object_push(obj, "bestblockhash", json_hash_new(tip->hash));
+  json_object_push(obj, "difficulty", json_double_new(diff));
+  json_object_push(obj, "mediantime", json_integer_new(mtp));
+  json_object_push(obj, "verificationprogress", json_double_new(prog));
+  json_object_push(obj, "chainwork", json_hash_new(tip->chainwork));
+
+  res->result = obj;
+}
+
+static void
+btc_rpc_getbestblockhash(btc_rpc_t *rpc,
+                         const json_params *params,
+                         rpc_res_t *res) {
+  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+
+  if (params->help || params->length != 0)
+    THROW_MISC("getbestblockhash");
+
+  res->result = json_hash_new(tip->hash);
+}
 
 static void
 btc_rpc_getblockcount(btc_rpc_t *rpc,
@@ -466,7 +1404,7 @@ btc_rpc_getblockhash(btc_rpc_t *rpc,
   if (!json_unsigned_get(&height, params->values[0]))
     THROW_TYPE(index, integer);
 
-  entry = btc_chain_by_height(rpc->chain, height);
+  entry = btc_rpc_by_height(rpc, res, height);
 
   if (entry == NULL)
     THROW(RPC_INVALID_PARAMETER, "Block height out of range");
@@ -492,7 +1430,7 @@ btc_rpc_getblockheader(btc_rpc_t *rpc,
     if (!json_unsigned_get(&height, params->values[0]))
       THROW(RPC_INVALID_PARAMETER, "Target block height out of range");
 
-    entry = btc_chain_by_height(rpc->chain, height);
+    entry = btc_rpc_by_height(rpc, res, height);
 
     if (entry == NULL)
       THROW(RPC_INVALID_PARAMETER, "Target block height after current tip");
@@ -500,7 +1438,7 @@ btc_rpc_getblockheader(btc_rpc_t *rpc,
     if (!json_hash_get(hash, params->values[0]))
       THROW_TYPE(hash, hash_or_height);
 
-    entry = btc_chain_by_hash(rpc->chain, hash);
+    entry = btc_rpc_by_hash(rpc, res, hash);
 
     if (entry == NULL)
       THROW(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
@@ -512,7 +1450,7 @@ btc_rpc_getblockheader(btc_rpc_t *rpc,
   }
 
   if (verbose) {
-    confirmations = btc_rpc_get_depth(rpc, entry, &next);
+    confirmations = btc_rpc_get_depth(rpc, res, entry, &next);
 
     res->result = json_entry_new_ex(entry, confirmations, next);
   } else {
@@ -520,10 +1458,62 @@ btc_rpc_getblockheader(btc_rpc_t *rpc,
   }
 }
 
+typedef struct rpc_getblock_s {
+  btc_block_t *block;
+  const btc_entry_t *entry;
+  int32_t confirmations;
+  const uint8_t *next;
+  int details;
+  const btc_network_t *network;
+  ptrdiff_t index;
+} rpc_getblock_t;
+
+static int
+rpc_getblock_stream(json_writer *w, void *arg) {
+  rpc_getblock_t *state = arg;
+  const btc_block_t *block = state->block;
+  const btc_tx_t *tx;
+
+  /* The entry is only read on the first call, which
+     happens before control returns to the loop (or
+     on the worker that ran the call). */
+  if (state->index < 0) {
+    json_block_write_begin(w, block,
+                              state->entry,
+                              state->confirmations,
+                              state->next);
+    state->index = 0;
+    return 1;
+  }
+
+  /* One transaction per call. */
+  if ((size_t)state->index < block->txs.length) {
+    tx = block->txs.items[state->index++];
+
+    if (state->details)
+      json_tx_write(w, tx, NULL, state->network);
+    else
+      json_writer_hash(w, tx->hash);
+
+    return 1;
+  }
+
+  json_block_write_end(w);
+
+  return 0;
+}
+
+static void
+rpc_getblock_free(void *arg) {
+  rpc_getblock_t *state = arg;
+
+  btc_block_destroy(state->block);
+  btc_free(state);
+}
+
 static void
 btc_rpc_getblock(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
   const btc_entry_t *entry;
-  int32_t confirmations;
   const uint8_t *next;
   btc_block_t *block;
   int verbosity = 1;
@@ -537,7 +1527,7 @@ btc_rpc_getblock(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
     if (!json_unsigned_get(&height, params->values[0]))
       THROW(RPC_INVALID_PARAMETER, "Target block height out of range");
 
-    entry = btc_chain_by_height(rpc->chain, height);
+    entry = btc_rpc_by_height(rpc, res, height);
 
     if (entry == NULL)
       THROW(RPC_INVALID_PARAMETER, "Target block height after current tip");
@@ -545,7 +1535,7 @@ btc_rpc_getblock(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
     if (!json_hash_get(hash, params->values[0]))
       THROW_TYPE(hash, hash_or_height);
 
-    entry = btc_chain_by_hash(rpc->chain, hash);
+    entry = btc_rpc_by_hash(rpc, res, hash);
 
     if (entry == NULL)
       THROW(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
@@ -556,194 +1546,2636 @@ btc_rpc_getblock(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
       THROW_TYPE(verbosity, integer);
   }
 
-  block = btc_chain_get_block(rpc->chain, entry);
+  block = btc_rpc_get_block(rpc, res, entry);
 
   if (block == NULL)
     THROW_MISC("Can't read block from disk");
 
   if (verbosity > 0) {
-    confirmations = btc_rpc_get_depth(rpc, entry, &next);
-
-    res->result = json_block_new_ex(block,
-                                    entry,
-                                    NULL,
-                                    confirmations,
-                                    next,
-                                    verbosity > 1,
-                                    rpc->network);
+    rpc_getblock_t *state = btc_malloc(sizeof(rpc_getblock_t));
+
+    state->block = block;
+    state->entry = entry;
+    state->confirmations = btc_rpc_get_depth(rpc, res, entry, &next);
+    state->next = next;
+    state->details = verbosity > 1;
+    state->network = rpc->network;
+    state->index = -1;
+
+    rpc_res_stream(res, rpc_getblock_stream, rpc_getblock_free, state);
   } else {
     res->result = json_block_raw(block);
-  }
 
-  btc_block_destroy(block);
+    btc_block_destroy(block);
+  }
 }
 
 /*
- * Mining
+ * Block Stats
  */
 
-static void
-btc_rpc_getgenerate(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
-  int mining;
-
-  if (params->help || params->length != 0)
-    THROW_MISC("getgenerate");
+#define RPC_STATS_CACHE 4096
+#define RPC_STATS_RANGE 1000
+#define RPC_UTXO_OVERHEAD 41 /* outpoint + height + value */
 
-  mining = btc_miner_getgenerate(rpc->miner);
+typedef struct rpc_blockstats_s {
+  uint8_t hash[32];
+  int32_t height;
+  int64_t time;
+  int64_t mediantime;
+  int64_t subsidy;
+  int64_t txs;
+  int64_t ins;
+  int64_t outs;
+  int64_t total_out;
+  int64_t totalfee;
+  int64_t minfee;
+  int64_t maxfee;
+  int64_t medianfee;
+  int64_t avgfee;
+  int64_t minfeerate;
+  int64_t maxfeerate;
+  int64_t avgfeerate;
+  int64_t feerate_percentiles[5];
+  int64_t mintxsize;
+  int64_t maxtxsize;
+  int64_t mediantxsize;
+  int64_t avgtxsize;
+  int64_t total_size;
+  int64_t total_weight;
+  int64_t swtxs;
+  int64_t swtotal_size;
+  int64_t swtotal_weight;
+  int64_t utxo_increase;
+  int64_t utxo_size_inc;
+  int64_t utxo_increase_actual;
+  int64_t utxo_size_inc_actual;
+} rpc_blockstats_t;
+
+typedef struct rpc_feerate_s {
+  int64_t rate;
+  int64_t weight;
+} rpc_feerate_t;
+
+typedef struct rpc_statsjob_s {
+  btc_chain_t *chain;
+  const btc_entry_t **entries;
+  rpc_blockstats_t **items;
+} rpc_statsjob_t;
+
+static const char *rpc_stats_names[] = {
+  "avgfee",
+  "avgfeerate",
+  "avgtxsize",
+  "blockhash",
+  "feerate_percentiles",
+  "height",
+  "ins",
+  "maxfee",
+  "maxfeerate",
+  "maxtxsize",
+  "medianfee",
+  "mediantime",
+  "mediantxsize",
+  "minfee",
+  "minfeerate",
+  "mintxsize",
+  "outs",
+  "subsidy",
+  "swtotal_size",
+  "swtotal_weight",
+  "swtxs",
+  "time",
+  "total_out",
+  "total_size",
+  "total_weight",
+  "totalfee",
+  "txs",
+  "utxo_increase",
+  "utxo_increase_actual",
+  "utxo_size_inc",
+  "utxo_size_inc_actual"
+};
 
-  res->result = json_boolean_new(mining);
+static int
+rpc_int64_cmp(const void *x, const void *y) {
+  int64_t a = *((const int64_t *)x);
+  int64_t b = *((const int64_t *)y);
+  return (a > b) - (a < b);
 }
 
-static void
-btc_rpc_setgenerate(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
-  int active = 1;
-  int mine;
-
-  if (params->help || params->length < 1 || params->length > 2)
-    THROW_MISC("setgenerate mine ( active )");
-
-  if (!json_boolean_get(&mine, params->values[0]))
-    THROW_TYPE(mine, boolean);
+static int
+rpc_feerate_cmp(const void *x, const void *y) {
+  const rpc_feerate_t *a = x;
+  const rpc_feerate_t *b = y;
+  return (a->rate > b->rate) - (a->rate < b->rate);
+}
 
-  if (params->length > 1) {
-    if (!json_unsigned_get(&active, params->values[1]))
-      THROW_TYPE(active, integer);
+static int64_t
+rpc_median(int64_t *items, size_t length) {
+  if (length == 0)
+    return 0;
 
-    if (active == 0)
-      active = 1;
-  }
+  qsort(items, length, sizeof(int64_t), rpc_int64_cmp);
 
-  btc_miner_setgenerate(rpc->miner, mine, active);
+  if ((length & 1) == 0)
+    return (items[length / 2 - 1] + items[length / 2]) / 2;
 
-  res->result = json_boolean_new(mine);
+  return items[length / 2];
 }
 
 static void
-btc_rpc_generate(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
-  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
-  int blocks;
+rpc_percentiles(int64_t *out, rpc_feerate_t *items,
+                size_t length, int64_t total) {
+  /* 10th, 25th, 50th, 75th and 90th, in twentieths. */
+  static const int64_t points[5] = { 2, 5, 10, 15, 18 };
+  int64_t cumulative = 0;
+  size_t i, j = 0;
 
-  if (params->help || params->length != 1)
-    THROW_MISC("generate numblocks");
+  memset(out, 0, 5 * sizeof(int64_t));
 
-  if (!json_unsigned_get(&blocks, params->values[0]))
-    THROW_TYPE(numblocks, integer);
+  if (length == 0)
+    return;
 
-  btc_miner_generate(rpc->miner, blocks, NULL);
+  qsort(items, length, sizeof(rpc_feerate_t), rpc_feerate_cmp);
 
-  res->result = json_array_new(blocks);
+  for (i = 0; i < length; i++) {
+    cumulative += items[i].weight;
 
-  while (blocks--) {
-    tip = tip->next;
-    json_array_push(res->result, json_hash_new(tip->hash));
+    while (j < 5 && cumulative * 20 >= total * points[j])
+      out[j++] = items[i].rate;
   }
+
+  while (j < 5)
+    out[j++] = items[length - 1].rate;
 }
 
-static void
-btc_rpc_generatetoaddress(btc_rpc_t *rpc,
-                          const json_params *params,
-                          rpc_res_t *res) {
-  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
-  btc_address_t addr;
-  int blocks;
+static int
+rpc_blockstats_compute(rpc_blockstats_t *st,
+                       const btc_block_t *block,
+                       const btc_undo_t *undo) {
+  size_t count = block->txs.length;
+  rpc_feerate_t *rates;
+  int64_t *fees, *sizes;
+  size_t i, j, k = 0;
+  int64_t utxos = 0;
+
+  if (count == 0)
+    return 0;
 
-  if (params->help || params->length != 2)
-    THROW_MISC("generatetoaddress numblocks address");
+  for (i = 1; i < count; i++)
+    k += block->txs.items[i]->inputs.length;
 
-  if (!json_unsigned_get(&blocks, params->values[0]))
-    THROW_TYPE(numblocks, integer);
+  if (undo->length != k)
+    return 0;
 
-  if (!json_address_get(&addr, params->values[1], rpc->network))
-    THROW_TYPE(address, address);
+  fees = btc_malloc(count * sizeof(int64_t));
+  sizes = btc_malloc(count * sizeof(int64_t));
+  rates = btc_malloc(count * sizeof(rpc_feerate_t));
 
-  btc_miner_generate(rpc->miner, blocks, &addr);
+  st->txs = count;
+  st->minfee = INT64_MAX;
+  st->minfeerate = INT64_MAX;
+  st->mintxsize = INT64_MAX;
 
-  res->result = json_array_new(blocks);
+  k = 0;
 
-  while (blocks--) {
-    tip = tip->next;
-    json_array_push(res->result, json_hash_new(tip->hash));
-  }
-}
+  for (i = 0; i < count; i++) {
+    const btc_tx_t *tx = block->txs.items[i];
+    int64_t size, weight, fee, rate;
+    int64_t in = 0, out = 0;
 
-/*
- * Wallet
- */
+    st->outs += tx->outputs.length;
 
-static void
-btc_rpc_sendtoaddress(btc_rpc_t *rpc,
-                      const json_params *params,
-                      rpc_res_t *res) {
-  btc_address_t addr;
-  json_value *obj;
-  int64_t value;
+    for (j = 0; j < tx->outputs.length; j++) {
+      const btc_output_t *output = tx->outputs.items[j];
+      int64_t len = btc_output_size(output) + RPC_UTXO_OVERHEAD;
 
-  if (params->help || params->length != 2)
-    THROW_MISC("sendtoaddress address amount");
+      out += output->value;
 
-  if (!json_address_get(&addr, params->values[0], rpc->network))
-    THROW(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+      st->utxo_size_inc += len;
+
+      if (btc_script_is_unspendable(&output->script))
+        continue;
+
+      st->utxo_size_inc_actual += len;
+
+      utxos += 1;
+    }
+
+    if (i == 0)
+      continue;
+
+    size = btc_tx_size(tx);
+    weight = btc_tx_weight(tx);
+
+    st->ins += tx->inputs.length;
+    st->total_out += out;
+    st->total_size += size;
+    st->total_weight += weight;
+
+    if (size < st->mintxsize)
+      st->mintxsize = size;
+
+    if (size > st->maxtxsize)
+      st->maxtxsize = size;
+
+    if (btc_tx_has_witness(tx)) {
+      st->swtxs += 1;
+      st->swtotal_size += size;
+      st->swtotal_weight += weight;
+    }
+
+    for (j = 0; j < tx->inputs.length; j++) {
+      const btc_output_t *prev = &undo->items[k++]->output;
+      int64_t len = btc_output_size(prev) + RPC_UTXO_OVERHEAD;
+
+      in += prev->value;
+
+      st->utxo_size_inc -= len;
+      st->utxo_size_inc_actual -= len;
+    }
+
+    fee = in - out;
+    rate = weight ? (fee * BTC_WITNESS_SCALE_FACTOR) / weight : 0;
+
+    st->totalfee += fee;
+
+    if (fee < st->minfee)
+      st->minfee = fee;
+
+    if (fee > st->maxfee)
+      st->maxfee = fee;
+
+    if (rate < st->minfeerate)
+      st->minfeerate = rate;
+
+    if (rate > st->maxfeerate)
+      st->maxfeerate = rate;
+
+    fees[i - 1] = fee;
+    sizes[i - 1] = size;
+    rates[i - 1].rate = rate;
+    rates[i - 1].weight = weight;
+  }
+
+  if (count == 1) {
+    st->minfee = 0;
+    st->minfeerate = 0;
+    st->mintxsize = 0;
+  } else {
+    st->avgfee = st->totalfee / (int64_t)(count - 1);
+    st->avgtxsize = st->total_size / (int64_t)(count - 1);
+  }
+
+  if (st->total_weight > 0) {
+    st->avgfeerate = (st->totalfee * BTC_WITNESS_SCALE_FACTOR)
+                   / st->total_weight;
+  }
+
+  st->medianfee = rpc_median(fees, count - 1);
+  st->mediantxsize = rpc_median(sizes, count - 1);
+
+  rpc_percentiles(st->feerate_percentiles, rates,
+                  count - 1, st->total_weight);
+
+  st->utxo_increase = st->outs - st->ins;
+  st->utxo_increase_actual = utxos - st->ins;
+
+  btc_free(fees);
+  btc_free(sizes);
+  btc_free(rates);
+
+  return 1;
+}
+
+static void
+rpc_blockstats_range(size_t start, size_t end, void *arg) {
+  /* Every range gets its own reader (and database
+     handle), as readers are not safe to share. */
+  rpc_statsjob_t *job = arg;
+  btc_chainreader_t *reader = btc_chain_reader(job->chain);
+  size_t i;
+
+  for (i = start; i < end; i++) {
+    rpc_blockstats_t *st = job->items[i];
+    btc_block_t *block;
+    btc_undo_t *undo;
+
+    if (reader == NULL
+        || !btc_chainreader_read(reader, &block, &undo, job->entries[i])) {
+      job->items[i] = NULL;
+      btc_free(st);
+      continue;
+    }
+
+    if (!rpc_blockstats_compute(st, block, undo)) {
+      job->items[i] = NULL;
+      btc_free(st);
+    }
+
+    btc_block_destroy(block);
+    btc_undo_destroy(undo);
+  }
+
+  if (reader != NULL)
+    btc_chainreader_destroy(reader);
+}
+
+static void
+rpc_blockstats_reset(btc_rpc_t *rpc) {
+  btc_hashmapiter_t iter;
+
+  btc_hashmap_iterate(&iter, rpc->stats);
+
+  while (btc_hashmap_next(&iter))
+    btc_free(iter.val);
+
+  btc_hashmap_reset(rpc->stats);
+}
+
+static int
+rpc_blockstats_fetch(btc_rpc_t *rpc,
+                     rpc_blockstats_t **out,
+                     const btc_entry_t **entries,
+                     size_t length) {
+  /* Cached stats are returned as-is. The rest are
+     computed from block and undo data in parallel. */
+  btc_workers_t *pool = btc_chain_workers(rpc->chain);
+  rpc_statsjob_t job;
+  size_t i, n = 0;
+  int ret = 1;
+
+  /* Make room up front so that cached hits survive. */
+  if (btc_hashmap_size(rpc->stats) + length > RPC_STATS_CACHE)
+    rpc_blockstats_reset(rpc);
+
+  job.chain = rpc->chain;
+  job.entries = btc_malloc(length * sizeof(btc_entry_t *));
+  job.items = btc_malloc(length * sizeof(rpc_blockstats_t *));
+
+  for (i = 0; i < length; i++) {
+    const btc_entry_t *entry = entries[i];
+    rpc_blockstats_t *st = btc_hashmap_get(rpc->stats, entry->hash);
+
+    out[i] = st;
+
+    if (st != NULL)
+      continue;
+
+    st = btc_malloc(sizeof(rpc_blockstats_t));
+
+    memset(st, 0, sizeof(*st));
+    memcpy(st->hash, entry->hash, 32);
+
+    st->height = entry->height;
+    st->time = entry->header.time;
+    st->mediantime = btc_entry_median_time(entry);
+    st->subsidy = btc_get_reward(entry->height,
+                                 rpc->network->halving_interval);
+
+    job.entries[n] = entry;
+    job.items[n] = st;
+
+    n++;
+  }
+
+  if (n > 0) {
+    if (pool != NULL)
+      btc_parallel_for_ex(pool, BTC_WORK_LOW, n, 0,
+                          rpc_blockstats_range, &job);
+    else
+      rpc_blockstats_range(0, n, &job);
+  }
+
+  for (i = 0; i < n; i++) {
+    rpc_blockstats_t *st = job.items[i];
+
+    if (st == NULL) {
+      ret = 0;
+      continue;
+    }
+
+    CHECK(btc_hashmap_put(rpc->stats, st->hash, st));
+  }
+
+  for (i = 0; i < length && ret; i++) {
+    if (out[i] == NULL)
+      out[i] = btc_hashmap_get(rpc->stats, entries[i]->hash);
+
+    ret = (out[i] != NULL);
+  }
+
+  btc_free(job.entries);
+  btc_free(job.items);
+
+  return ret;
+}
+
+static int
+rpc_stats_selected(const json_value *select, const char *name) {
+  size_t i;
+
+  if (select == NULL)
+    return 1;
+
+  for (i = 0; i < select->u.array.length; i++) {
+    const json_value *item = select->u.array.values[i];
+
+    if (strcmp(item->u.string.ptr, name) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+static int
+rpc_stats_check(const json_value *select) {
+  const json_value *item;
+  size_t i, j;
+
+  if (select->type != json_array)
+    return 0;
+
+  for (i = 0; i < select->u.array.length; i++) {
+    item = select->u.array.values[i];
+
+    if (item->type != json_string)
+      return 0;
+
+    for (j = 0; j < lengthof(rpc_stats_names); j++) {
+      if (strcmp(item->u.string.ptr, rpc_stats_names[j]) == 0)
+        break;
+    }
+
+    if (j == lengthof(rpc_stats_names))
+      return 0;
+  }
+
+  return 1;
+}
+
+static void
+rpc_stats_push(json_value *obj,
+               const json_value *select,
+               const char *name,
+               json_value *val) {
+  if (rpc_stats_selected(select, name))
+    json_object_push(obj, name, val);
+  else
+    json_builder_free(val);
+}
+
+static json_value *
+json_blockstats_new(const rpc_blockstats_t *st, const json_value *select) {
+  json_value *obj = json_object_new(lengthof(rpc_stats_names));
+  json_value *arr = json_array_new(5);
+  size_t i;
+
+  for (i = 0; i < 5; i++)
+    json_array_push(arr, json_integer_new(st->feerate_percentiles[i]));
+
+#define PUSH(name, val) rpc_stats_push(obj, select, name, val)
+  PUSH("avgfee", json_integer_new(st->avgfee));
+  PUSH("avgfeerate", json_integer_new(st->avgfeerate));
+  PUSH("avgtxsize", json_integer_new(st->avgtxsize));
+  PUSH("blockhash", json_hash_new(st->hash));
+  PUSH("feerate_percentiles", arr);
+  PUSH("height", json_integer_new(st->height));
+  PUSH("ins", json_integer_new(st->ins));
+  PUSH("maxfee", json_integer_new(st->maxfee));
+  PUSH("maxfeerate", json_integer_new(st->maxfeerate));
+  PUSH("maxtxsize", json_integer_new(st->maxtxsize));
+  PUSH("medianfee", json_integer_new(st->medianfee));
+  PUSH("mediantime", json_integer_new(st->mediantime));
+  PUSH("mediantxsize", json_integer_new(st->mediantxsize));
+  PUSH("minfee", json_integer_new(st->minfee));
+  PUSH("minfeerate", json_integer_new(st->minfeerate));
+  PUSH("mintxsize", json_integer_new(st->mintxsize));
+  PUSH("outs", json_integer_new(st->outs));
+  PUSH("subsidy", json_integer_new(st->subsidy));
+  PUSH("swtotal_size", json_integer_new(st->swtotal_size));
+  PUSH("swtotal_weight", json_integer_new(st->swtotal_weight));
+  PUSH("swtxs", json_integer_new(st->swtxs));
+  PUSH("time", json_integer_new(st->time));
+  PUSH("total_out", json_integer_new(st->total_out));
+  PUSH("total_size", json_integer_new(st->total_size));
+  PUSH("total_weight", json_integer_new(st->total_weight));
+  PUSH("totalfee", json_integer_new(st->totalfee));
+  PUSH("txs", json_integer_new(st->txs));
+  PUSH("utxo_increase", json_integer_new(st->utxo_increase));
+  PUSH("utxo_increase_actual", json_integer_new(st->utxo_increase_actual));
+  PUSH("utxo_size_inc", json_integer_new(st->utxo_size_inc));
+  PUSH("utxo_size_inc_actual", json_integer_new(st->utxo_size_inc_actual));
+#undef PUSH
+
+  return obj;
+}
+
+static void
+btc_rpc_getblockstats(btc_rpc_t *rpc,
+                      const json_params *params,
+                      rpc_res_t *res) {
+  const json_value *select = NULL;
+  const btc_entry_t *entry;
+  rpc_blockstats_t *st;
+  uint8_t hash[32];
+  int height;
+
+  if (params->help || params->length < 1 || params->length > 2)
+    THROW_MISC("getblockstats hash_or_height ( stats )");
+
+  if (params->values[0]->type == json_integer) {
+    if (!json_unsigned_get(&height, params->values[0]))
+      THROW(RPC_INVALID_PARAMETER, "Target block height out of range");
+
+    entry = btc_chain_by_height(rpc->chain, height);
+
+    if (entry == NULL)
+      THROW(RPC_INVALID_PARAMETER, "Target block height after current tip");
+  } else {
+    if (!json_hash_get(hash, params->values[0]))
+      THROW_TYPE(hash_or_height, hash_or_height);
+
+    entry = btc_chain_by_hash(rpc->chain, hash);
+
+    if (entry == NULL)
+      THROW(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+  }
+
+  if (params->length > 1 && params->values[1]->type != json_null) {
+    select = params->values[1];
+
+    if (!rpc_stats_check(select))
+      THROW(RPC_INVALID_PARAMETER, "Invalid selected statistic");
+  }
+
+  if (!rpc_blockstats_fetch(rpc, &st, &entry, 1)) {
+    if (!btc_chain_has_undo(rpc->chain, entry))
+      THROW_MISC("Undo data for this block was pruned");
+
+    THROW_MISC("Can't read undo data from disk");
+  }
+
+  res->result = json_blockstats_new(st, select);
+}
+
+static void
+btc_rpc_getblockstatsrange(btc_rpc_t *rpc,
+                           const json_params *params,
+                           rpc_res_t *res) {
+  const json_value *select = NULL;
+  const btc_entry_t **entries;
+  rpc_blockstats_t **items;
+  int start, end;
+  size_t i, count;
+  int ok;
+
+  if (params->help || params->length < 2 || params->length > 3)
+    THROW_MISC("getblockstatsrange start end ( stats )");
+
+  if (!json_unsigned_get(&start, params->values[0]))
+    THROW_TYPE(start, integer);
+
+  if (!json_unsigned_get(&end, params->values[1]))
+    THROW_TYPE(end, integer);
+
+  if (end < start)
+    THROW(RPC_INVALID_PARAMETER, "End height is below start height");
+
+  if (end > btc_chain_height(rpc->chain))
+    THROW(RPC_INVALID_PARAMETER, "Target block height after current tip");
+
+  if (end - start >= RPC_STATS_RANGE)
+    THROW(RPC_INVALID_PARAMETER, "Range too large");
+
+  if (params->length > 2 && params->values[2]->type != json_null) {
+    select = params->values[2];
+
+    if (!rpc_stats_check(select))
+      THROW(RPC_INVALID_PARAMETER, "Invalid selected statistic");
+  }
+
+  count = end - start + 1;
+  entries = btc_malloc(count * sizeof(btc_entry_t *));
+  items = btc_malloc(count * sizeof(rpc_blockstats_t *));
+
+  for (i = 0; i < count; i++)
+    entries[i] = btc_chain_by_height(rpc->chain, start + i);
+
+  ok = rpc_blockstats_fetch(rpc, items, entries, count);
+
+  if (ok) {
+    res->result = json_array_new(count);
+
+    for (i = 0; i < count; i++)
+      json_array_push(res->result, json_blockstats_new(items[i], select));
+  } else {
+    for (i = 0; i < count; i++) {
+      if (!btc_chain_has_undo(rpc->chain, entries[i]))
+        break;
+    }
+  }
+
+  btc_free(entries);
+  btc_free(items);
+
+  if (!ok && i < count)
+    THROW_MISC("Undo data for this range was pruned");
+
+  if (!ok)
+    THROW_MISC("Can't read undo data from disk");
+}
+
+static void
+btc_rpc_dumptxoutset(btc_rpc_t *rpc,
+                     const json_params *params,
+                     rpc_res_t *res) {
+  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  uint8_t checksum[32];
+  const char *path;
+  uint64_t count;
+  json_value *obj;
+
+  if (params->help || params->length != 1)
+    THROW_MISC("dumptxoutset path");
+
+  if (params->values[0]->type != json_string)
+    THROW_TYPE(path, string);
+
+  path = params->values[0]->u.string.ptr;
+
+  if (!btc_chain_write_snapshot(rpc->chain, path, checksum, &count))
+    THROW_MISC("Could not write snapshot");
+
+  obj = json_object_new(5);
+
+  json_object_push(obj, "coins_written", json_integer_new(count));
+  json_object_push(obj, "base_hash", json_hash_new(tip->hash));
+  json_object_push(obj, "base_height", json_integer_new(tip->height));
+  json_object_push(obj, "path", json_string_new(path));
+  json_object_push(obj, "txoutset_hash", json_hash_new(checksum));
+
+  res->result = obj;
+}
+
+static void
+btc_rpc_gettxoutsetinfo(btc_rpc_t *rpc,
+                        const json_params *params,
+                        rpc_res_t *res) {
+  btc_utxostats_t stats;
+  json_value *obj;
+
+  if (params->help || params->length > 1)
+    THROW_MISC("gettxoutsetinfo ( \"hash_type\" )");
+
+  if (params->length > 0) {
+    if (params->values[0]->type != json_string)
+      THROW_TYPE(hash_type, string);
+
+    if (strcmp(params->values[0]->u.string.ptr, "muhash") != 0)
+      THROW(RPC_INVALID_PARAMETER, "Unsupported hash_type");
+  }
+
+  if (!btc_chain_utxo_stats(rpc->chain, &stats))
+    THROW_MISC("Coin statistics are disabled (use -coinstatsindex)");
+
+  obj = json_object_new(5);
+
+  json_object_push(obj, "height", json_integer_new(stats.height));
+  json_object_push(obj, "bestblock", json_hash_new(stats.hash));
+  json_object_push(obj, "txouts", json_integer_new(stats.count));
+  json_object_push(obj, "muhash", json_hash_new(stats.muhash));
+  json_object_push(obj, "total_amount", json_amount_new(stats.amount));
+
+  res->result = obj;
+}
+
+static json_value *
+btc_rpc_scanresult(btc_coinscan_t *scan, int success) {
+  size_t i, len = btc_coinscan_length(scan);
+  const btc_scanitem_t *item;
+  json_value *obj, *unspents;
+  const uint8_t *tip;
+  int64_t total = 0;
+  int32_t height;
+
+  tip = btc_coinscan_tip(scan, &height);
+  unspents = json_array_new(len);
+
+  for (i = 0; i < len; i++) {
+    item = btc_coinscan_item(scan, i);
+    obj = json_object_new(6);
+
+    json_object_push(obj, "txid", json_hash_new(item->prevout.hash));
+    json_object_push(obj, "vout", json_integer_new(item->prevout.index));
+    json_object_push(obj, "scriptPubKey",
+                     json_buffer_new(&item->coin->output.script));
+    json_object_push(obj, "amount", json_amount_new(item->coin->output.value));
+    json_object_push(obj, "coinbase", json_boolean_new(item->coin->coinbase));
+    json_object_push(obj, "height", json_integer_new(item->coin->height));
+
+    json_array_push(unspents, obj);
+
+    total += item->coin->output.value;
+  }
+
+  obj = json_object_new(6);
+
+  json_object_push(obj, "success", json_boolean_new(success));
+  json_object_push(obj, "txouts", json_integer_new(btc_coinscan_count(scan)));
+  json_object_push(obj, "height", json_integer_new(height));
+  json_object_push(obj, "bestblock", json_hash_new(tip));
+  json_object_push(obj, "unspents", unspents);
+  json_object_push(obj, "total_amount", json_amount_new(total));
+
+  return obj;
+}
+
+static int
+rpc_scan_wait(rpc_res_t *res, void *arg, int force) {
+  btc_rpc_t *rpc = arg;
+  btc_coinscan_t *scan = rpc->scan;
+
+  if (!force && !btc_coinscan_done(scan))
+    return 0;
+
+  res->result = btc_rpc_scanresult(scan, btc_coinscan_wait(scan));
+
+  return 1;
+}
+
+static void
+rpc_scan_free(void *arg) {
+  btc_rpc_t *rpc = arg;
+
+  /* Aborts the scan if the caller went away. */
+  btc_coinscan_destroy(rpc->scan);
+
+  rpc->scan = NULL;
+}
+
+static void
+btc_rpc_scantxoutset(btc_rpc_t *rpc,
+                     const json_params *params,
+                     rpc_res_t *res) {
+  const json_value *objects, *item;
+  const char *action;
+  btc_coinscan_t *scan;
+  btc_address_t addr;
+  btc_script_t script;
+  json_value *obj;
+  unsigned int i;
+
+  if (params->help || params->length < 1 || params->length > 2)
+    THROW_MISC("scantxoutset \"action\" ( [address|script,...] )");
+
+  if (params->values[0]->type != json_string)
+    THROW_TYPE(action, string);
+
+  action = params->values[0]->u.string.ptr;
+
+  if (strcmp(action, "status") == 0) {
+    if (rpc->scan == NULL) {
+      res->result = json_null_new();
+      return;
+    }
+
+    obj = json_object_new(1);
+
+    json_object_push(obj, "progress",
+      json_double_new(btc_coinscan_progress(rpc->scan) * 100.0));
+
+    res->result = obj;
+
+    return;
+  }
+
+  if (strcmp(action, "abort") == 0) {
+    if (rpc->scan != NULL)
+      btc_coinscan_abort(rpc->scan);
+
+    res->result = json_boolean_new(rpc->scan != NULL);
+
+    return;
+  }
+
+  if (strcmp(action, "start") != 0)
+    THROW(RPC_INVALID_PARAMETER, "Invalid action");
+
+  if (params->length < 2)
+    THROW(RPC_MISC_ERROR, "Scan objects are required for \"start\"");
+
+  objects = params->values[1];
+
+  if (objects->type != json_array)
+    THROW_TYPE(scanobjects, array);
+
+  if (rpc->scan != NULL)
+    THROW(RPC_MISC_ERROR, "Scan already in progress");
+
+  scan = btc_chain_coinscan(rpc->chain);
+
+  btc_script_init(&script);
+
+  for (i = 0; i < objects->u.array.length; i++) {
+    item = objects->u.array.values[i];
+
+    if (json_address_get(&addr, item, rpc->network)) {
+      btc_address_get_script(&script, &addr);
+    } else if (!json_buffer_get(&script, item)) {
+      btc_script_clear(&script);
+      btc_coinscan_destroy(scan);
+      THROW(RPC_INVALID_PARAMETER, "Invalid scan object");
+    }
+
+    btc_coinscan_add(scan, &script);
+  }
+
+  btc_script_clear(&script);
+
+  /* One range per core, each on its own cursor. */
+  if (!btc_coinscan_start(scan, btc_sys_numcpu())) {
+    btc_coinscan_destroy(scan);
+    THROW(RPC_DATABASE_ERROR, "Could not open coin database");
+  }
+
+  rpc->scan = scan;
+
+  rpc_res_defer(res, rpc_scan_wait, rpc_scan_free, rpc);
+}
+
+/*
+ * Mempool
+ */
+
+static void
+btc_rpc_estimatesmartfee(btc_rpc_t *rpc,
+                         const json_params *params,
+                         rpc_res_t *res) {
+  const btc_fees_t *fees = btc_mempool_fees(rpc->mempool);
+  json_value *obj, *errors;
+  int64_t rate;
+  int target;
+  int blocks;
+
+  if (params->help || params->length < 1 || params->length > 2)
+    THROW_MISC("estimatesmartfee conf_target ( estimate_mode )");
+
+  if (!json_unsigned_get(&target, params->values[0]))
+    THROW_TYPE(conf_target, integer);
+
+  if (target < 1)
+    THROW(RPC_INVALID_PARAMETER, "Invalid conf_target");
+
+  if (params->length > 1) {
+    if (params->values[1]->type != json_string)
+      THROW_TYPE(estimate_mode, string);
+  }
+
+  rate = btc_fees_estimate_smart(fees, target, &blocks);
+
+  obj = json_object_new(2);
+
+  if (rate >= 0) {
+    json_object_push(obj, "feerate", json_amount_new(rate));
+  } else {
+    errors = json_array_new(1);
+
+    json_array_push(errors,
+      json_string_new("Insufficient data or no feerate found"));
+
+    json_object_push(obj, "errors", errors);
+  }
+
+  json_object_push(obj, "blocks", json_integer_new(blocks));
+
+  res->result = obj;
+}
+
+static void
+btc_rpc_submitpackage(btc_rpc_t *rpc,
+                      const json_params *params,
+                      rpc_res_t *res) {
+  const json_value *list;
+  json_value *obj, *results;
+  btc_buffer_t raw;
+  btc_txvec_t txs;
+  btc_tx_t *tx;
+  unsigned int i;
+
+  if (params->help || params->length != 1)
+    THROW_MISC("submitpackage [\"rawtx\",...]");
+
+  list = params->values[0];
+
+  if (list->type != json_array)
+    THROW_TYPE(package, array);
+
+  if (list->u.array.length == 0
+      || list->u.array.length > BTC_MEMPOOL_MAX_PACKAGE) {
+    THROW(RPC_INVALID_PARAMETER, "Invalid package size");
+  }
+
+  btc_buffer_init(&raw);
+  btc_txvec_init(&txs);
+
+  for (i = 0; i < list->u.array.length; i++) {
+    if (!json_buffer_get(&raw, list->u.array.values[i]))
+      break;
+
+    tx = btc_tx_decode(raw.data, raw.length);
+
+    if (tx == NULL)
+      break;
+
+    btc_txvec_push(&txs, tx);
+  }
+
+  btc_buffer_clear(&raw);
+
+  if (i < list->u.array.length) {
+    btc_txvec_clear(&txs);
+    THROW(RPC_DESERIALIZATION_ERROR, "TX decode failed");
+  }
+
+  if (!btc_mempool_add_package(rpc->mempool, &txs, (unsigned int)-1)) {
+    const btc_verify_error_t *err = btc_mempool_error(rpc->mempool);
+
+    btc_txvec_clear(&txs);
+    THROW(RPC_VERIFY_REJECTED, err->reason);
+  }
+
+  results = json_object_new(txs.length);
+
+  for (i = 0; i < txs.length; i++) {
+    const btc_mpentry_t *entry = btc_mempool_get(rpc->mempool,
+                                                 txs.items[i]->hash);
+    json_value *item, *fees;
+    char hex[65];
+
+    if (entry == NULL)
+      continue;
+
+    item = json_object_new(3);
+    fees = json_object_new(1);
+
+    json_object_push(fees, "base", json_amount_new(entry->fee));
+
+    json_object_push(item, "txid", json_hash_new(entry->hash));
+    json_object_push(item, "vsize", json_integer_new(entry->size));
+    json_object_push(item, "fees", fees);
+
+    btc_hash_export(hex, entry->whash);
+
+    json_object_push(results, hex, item);
+  }
+
+  btc_txvec_clear(&txs);
+
+  obj = json_object_new(2);
+
+  json_object_push(obj, "package_msg", json_string_new("success"));
+  json_object_push(obj, "tx-results", results);
+
+  res->result = obj;
+}
+
+/*
+ * Mining
+ */
+
+static void
+btc_rpc_getgenerate(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
+  int mining;
+
+  if (params->help || params->length != 0)
+    THROW_MISC("getgenerate");
+
+  mining = btc_miner_getgenerate(rpc->miner);
+
+  res->result = json_boolean_new(mining);
+}
+
+static void
+btc_rpc_setgenerate(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
+  int active = 1;
+  int mine;
+
+  if (params->help || params->length < 1 || params->length > 2)
+    THROW_MISC("setgenerate mine ( active )");
+
+  if (!json_boolean_get(&mine, params->values[0]))
+    THROW_TYPE(mine, boolean);
+
+  if (params->length > 1) {
+    if (!json_unsigned_get(&active, params->values[1]))
+      THROW_TYPE(active, integer);
+
+    if (active == 0)
+      active = 1;
+  }
+
+  btc_miner_setgenerate(rpc->miner, mine, active);
+
+  res->result = json_boolean_new(mine);
+}
+
+static void
+btc_rpc_generate(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
+  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  int blocks;
+
+  if (params->help || params->length != 1)
+    THROW_MISC("generate numblocks");
+
+  if (!json_unsigned_get(&blocks, params->values[0]))
+    THROW_TYPE(numblocks, integer);
+
+  btc_miner_generate(rpc->miner, blocks, NULL);
+
+  res->result = json_array_new(blocks);
+
+  while (blocks--) {
+    tip = tip->next;
+    json_array_push(res->result, json_hash_new(tip->hash));
+  }
+}
+
+static void
+btc_rpc_generatetoaddress(btc_rpc_t *rpc,
+                          const json_params *params,
+                          rpc_res_t *res) {
+  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  btc_address_t addr;
+  int blocks;
+
+  if (params->help || params->length != 2)
+    THROW_MISC("generatetoaddress numblocks address");
+
+  if (!json_unsigned_get(&blocks, params->values[0]))
+    THROW_TYPE(numblocks, integer);
+
+  if (!json_address_get(&addr, params->values[1], rpc->network))
+    THROW_TYPE(address, address);
+
+  btc_miner_generate(rpc->miner, blocks, &addr);
+
+  res->result = json_array_new(blocks);
+
+  while (blocks--) {
+    tip = tip->next;
+    json_array_push(res->result, json_hash_new(tip->hash));
+  }
+}
+
+typedef struct rpc_longpoll_s {
+  btc_rpc_t *rpc;
+  uint8_t tip[32];
+  unsigned int updates;
+  int64_t fees;
+  int64_t start;
+} rpc_longpoll_t;
+
+static json_value *
+json_longpollid_new(const uint8_t *hash, unsigned int updates) {
+  char str[64 + 10 + 1];
+
+  btc_hash_export(str, hash);
+
+  sprintf(str + 64, "%u", updates);
+
+  return json_string_new(str);
+}
+
+static int
+json_longpollid_get(uint8_t *hash,
+                    unsigned int *updates,
+                    const json_value *obj) {
+  const char *xp;
+  uint64_t num = 0;
+  size_t i;
+
+  if (obj->type != json_string)
+    return 0;
+
+  if (obj->u.string.length < 65 || obj->u.string.length > 64 + 10)
+    return 0;
+
+  xp = obj->u.string.ptr;
+
+  if (!btc_base16le_decode(hash, xp, 64))
+    return 0;
+
+  for (i = 64; i < obj->u.string.length; i++) {
+    if (xp[i] < '0' || xp[i] > '9')
+      return 0;
+
+    num = num * 10 + (xp[i] - '0');
+  }
+
+  if (num > UINT32_MAX)
+    return 0;
+
+  *updates = num;
+
+  return 1;
+}
+
+static json_value *
+btc_rpc_blocktemplate(btc_rpc_t *rpc) {
+  const btc_tmpl_t *bt = btc_miner_get_template(rpc->miner);
+  unsigned int updates = btc_miner_updates(rpc->miner);
+  btc_hashtab_t *index = btc_hashtab_create();
+  json_value *obj, *rules, *txs, *aux, *mut;
+  uint8_t target[32];
+  char bits[9];
+  size_t i, j;
+
+  rules = json_array_new(0);
+
+  if (bt->flags & BTC_SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)
+    json_array_push(rules, json_string_new("csv"));
+
+  if (bt->flags & BTC_SCRIPT_VERIFY_WITNESS)
+    json_array_push(rules, json_string_new("!segwit"));
+
+  if (bt->flags & BTC_SCRIPT_VERIFY_TAPROOT)
+    json_array_push(rules, json_string_new("taproot"));
+
+  txs = json_array_new(bt->txs.length);
+
+  for (i = 0; i < bt->txs.length; i++) {
+    const btc_blockentry_t *item = bt->txs.items[i];
+    json_value *tx = json_object_new(7);
+    json_value *deps = json_array_new(0);
+
+    /* Depends are 1-based indices of in-template parents. */
+    for (j = 0; j < item->tx->inputs.length; j++) {
+      const btc_input_t *input = item->tx->inputs.items[j];
+      const uint8_t *hash = input->prevout.hash;
+      int64_t pos;
+      size_t k;
+
+      if (!btc_hashtab_has(index, hash))
+        continue;
+
+      pos = btc_hashtab_get(index, hash);
+
+      for (k = 0; k < deps->u.array.length; k++) {
+        if (deps->u.array.values[k]->u.integer == pos)
+          break;
+      }
+
+      if (k == deps->u.array.length)
+        json_array_push(deps, json_integer_new(pos));
+    }
+
+    btc_hashtab_put(index, item->hash, i + 1);
+
+    json_object_push(tx, "data", json_tx_raw(item->tx));
+    json_object_push(tx, "txid", json_hash_new(item->hash));
+    json_object_push(tx, "hash", json_hash_new(item->whash));
+    json_object_push(tx, "depends", deps);
+    json_object_push(tx, "fee", json_integer_new(item->fee));
+    json_object_push(tx, "sigops", json_integer_new(item->sigops));
+    json_object_push(tx, "weight", json_integer_new(item->weight));
+
+    json_array_push(txs, tx);
+  }
+
+  btc_hashtab_destroy(index);
+
+  aux = json_object_new(1);
+
+  json_object_push(aux, "flags", json_buffer_new(&bt->cbflags));
+
+  mut = json_array_new(3);
+
+  json_array_push(mut, json_string_new("time"));
+  json_array_push(mut, json_string_new("transactions"));
+  json_array_push(mut, json_string_new("prevblock"));
+
+  CHECK(btc_compact_export(target, bt->bits));
+
+  sprintf(bits, "%08lx", (unsigned long)bt->bits);
+
+  obj = json_object_new(20);
+
+  json_object_push(obj, "version", json_integer_new(bt->version));
+  json_object_push(obj, "rules", rules);
+  json_object_push(obj, "vbavailable", json_object_new(0));
+  json_object_push(obj, "vbrequired", json_integer_new(0));
+  json_object_push(obj, "previousblockhash", json_hash_new(bt->prev_block));
+  json_object_push(obj, "transactions", txs);
+  json_object_push(obj, "coinbaseaux", aux);
+  json_object_push(obj, "coinbasevalue",
+                   json_integer_new(btc_tmpl_reward(bt)));
+  json_object_push(obj, "longpollid",
+                   json_longpollid_new(bt->prev_block, updates));
+  json_object_push(obj, "target", json_hash_new(target));
+  json_object_push(obj, "mintime", json_integer_new(bt->mtp + 1));
+  json_object_push(obj, "mutable", mut);
+  json_object_push(obj, "noncerange", json_string_new("00000000ffffffff"));
+  json_object_push(obj, "sigoplimit",
+                   json_integer_new(BTC_MAX_BLOCK_SIGOPS_COST));
+  json_object_push(obj, "sizelimit", json_integer_new(BTC_MAX_BLOCK_WEIGHT));
+  json_object_push(obj, "weightlimit",
+                   json_integer_new(BTC_MAX_BLOCK_WEIGHT));
+  json_object_push(obj, "curtime", json_integer_new(bt->time));
+  json_object_push(obj, "bits", json_string_new(bits));
+  json_object_push(obj, "height", json_integer_new(bt->height));
+
+  if (btc_tmpl_witness(bt)) {
+    btc_script_t script;
+
+    btc_script_init(&script);
+    btc_script_set_commitment(&script, bt->commitment);
+
+    json_object_push(obj, "default_witness_commitment",
+                     json_buffer_new(&script));
+
+    btc_script_clear(&script);
+  }
+
+  return obj;
+}
+
+static int
+rpc_longpoll_wait(rpc_res_t *res, void *arg, int force) {
+  rpc_longpoll_t *lp = arg;
+  btc_rpc_t *rpc = lp->rpc;
+  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  int ready = force;
+
+  if (!btc_hash_equal(tip->hash, lp->tip))
+    ready = 1;
+
+  if (!ready && btc_miner_updates(rpc->miner) != lp->updates) {
+    const btc_tmpl_t *bt = btc_miner_get_template(rpc->miner);
+
+    if (bt->fees > lp->fees + lp->fees / RPC_LONGPOLL_FEES)
+      ready = 1;
+
+    if (btc_time_msec() >= lp->start + RPC_LONGPOLL_REFRESH)
+      ready = 1;
+  }
+
+  if (!ready)
+    return 0;
+
+  res->result = btc_rpc_blocktemplate(rpc);
+
+  return 1;
+}
+
+static void
+rpc_longpoll_free(void *arg) {
+  btc_free(arg);
+}
+
+static void
+btc_rpc_getblocktemplate(btc_rpc_t *rpc,
+                         const json_params *params,
+                         rpc_res_t *res) {
+  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  const json_value *opts, *mode, *rules, *lpid;
+  const btc_tmpl_t *bt;
+  rpc_longpoll_t *lp;
+  unsigned int updates;
+  uint8_t hash[32];
+  int segwit = 0;
+  unsigned int i;
+
+  if (params->help || params->length > 1)
+    THROW_MISC("getblocktemplate ( \"template_request\" )");
+
+  opts = NULL;
+  lpid = NULL;
+
+  if (params->length > 0) {
+    opts = params->values[0];
+
+    if (opts->type != json_object)
+      THROW_TYPE(template_request, object);
+
+    mode = json_object_get(opts, "mode");
+
+    if (mode != NULL) {
+      if (mode->type != json_string)
+        THROW_TYPE(mode, string);
+
+      if (strcmp(mode->u.string.ptr, "template") != 0)
+        THROW(RPC_INVALID_PARAMETER, "Invalid mode");
+    }
+
+    rules = json_object_get(opts, "rules");
+
+    if (rules != NULL && rules->type == json_array) {
+      for (i = 0; i < rules->u.array.length; i++) {
+        const json_value *rule = rules->u.array.values[i];
+
+        if (rule->type == json_string
+            && strcmp(rule->u.string.ptr, "segwit") == 0) {
+          segwit = 1;
+        }
+      }
+    }
+
+    lpid = json_object_get(opts, "longpollid");
+  }
+
+  if (!btc_chain_synced(rpc->chain))
+    THROW(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Chain is not synced");
+
+  bt = btc_miner_get_template(rpc->miner);
+
+  if (btc_tmpl_witness(bt) && !segwit)
+    THROW(RPC_INVALID_PARAMETER, "Segwit rule must be set");
+
+  if (lpid != NULL) {
+    if (!json_longpollid_get(hash, &updates, lpid))
+      THROW(RPC_INVALID_PARAMETER, "Invalid longpollid");
+
+    /* An outdated tip is answered right away. */
+    if (btc_hash_equal(hash, tip->hash)) {
+      lp = btc_malloc(sizeof(rpc_longpoll_t));
+      lp->rpc = rpc;
+      lp->updates = updates;
+      lp->fees = bt->fees;
+      lp->start = btc_time_msec();
+
+      btc_hash_copy(lp->tip, tip->hash);
+
+      rpc_res_defer(res, rpc_longpoll_wait, rpc_longpoll_free, lp);
+
+      return;
+    }
+  }
+
+  res->result = btc_rpc_blocktemplate(rpc);
+}
+
+static void
+btc_rpc_submitblock(btc_rpc_t *rpc,
+                    const json_params *params,
+                    rpc_res_t *res) {
+  const btc_verify_error_t *err;
+  btc_block_t *block;
+  btc_buffer_t raw;
+  int orphan, ok;
+
+  if (params->help || params->length < 1 || params->length > 2)
+    THROW_MISC("submitblock \"hexdata\" ( \"dummy\" )");
+
+  btc_buffer_init(&raw);
+
+  if (json_buffer_get(&raw, params->values[0]))
+    block = btc_block_decode(raw.data, raw.length);
+  else
+    block = NULL;
+
+  btc_buffer_clear(&raw);
+
+  if (block == NULL)
+    THROW(RPC_DESERIALIZATION_ERROR, "Block decode failed");
+
+  if (block->txs.length == 0 || !btc_tx_is_coinbase(block->txs.items[0])) {
+    btc_block_destroy(block);
+    THROW(RPC_DESERIALIZATION_ERROR, "Block does not start with a coinbase");
+  }
+
+  orphan = btc_chain_by_hash(rpc->chain, block->header.prev_block) == NULL;
+
+  ok = btc_chain_add(rpc->chain, block, BTC_BLOCK_DEFAULT_FLAGS, 0);
+
+  btc_block_destroy(block);
+
+  /* BIP22 results: null on success, otherwise a reason. */
+  if (!ok) {
+    err = btc_chain_error(rpc->chain);
+    res->result = json_string_new(err->reason);
+    return;
+  }
+
+  if (orphan)
+    res->result = json_string_new("inconclusive");
+}
+
+/*
+ * Network
+ */
+
+static int64_t
+wall_time(int64_t msec) {
+  /* Peer timestamps are monotonic milliseconds. */
+  if (msec <= 0)
+    return 0;
+
+  return btc_now() - (btc_time_msec() - msec) / 1000;
+}
+
+static json_value *
+json_netstats_new(const btc_netstat_t *stats, int msgs) {
+  json_value *obj = json_object_new(0);
+  btc_msg_t msg;
+  int type;
+
+  for (type = 0; type < BTC_NETSTAT_TYPES; type++) {
+    uint64_t val = msgs ? stats[type].msgs : stats[type].bytes;
+
+    if (val == 0)
+      continue;
+
+    btc_msg_set_type(&msg, (enum btc_msgtype)type);
+
+    json_object_push(obj, msg.cmd, json_integer_new(val));
+  }
+
+  return obj;
+}
+
+static void
+btc_rpc_getpeerinfo(btc_rpc_t *rpc,
+                    const json_params *params,
+                    rpc_res_t *res) {
+  char str[BTC_ADDRSTRLEN + 1];
+  btc_peerinfo_t *items;
+  const char *type;
+  json_value *obj;
+  size_t i, len;
+
+  if (params->help || params->length != 0)
+    THROW_MISC("getpeerinfo");
+
+  len = btc_pool_peerinfo(rpc->pool, &items);
+
+  res->result = json_array_new(len);
+
+  for (i = 0; i < len; i++) {
+    const btc_peerinfo_t *info = &items[i];
+
+    obj = json_object_new(20);
+
+    json_object_push(obj, "id", json_integer_new(info->id));
+
+    btc_netaddr_get_str(str, &info->addr);
+    json_object_push(obj, "addr", json_string_new(str));
+
+    btc_netaddr_get_str(str, &info->local);
+    json_object_push(obj, "addrlocal", json_string_new(str));
+
+    sprintf(str, "%08lx%08lx", (unsigned long)(info->services >> 32),
+                               (unsigned long)(info->services & 0xffffffff));
+    json_object_push(obj, "services", json_string_new(str));
+
+    json_object_push(obj, "lastsend",
+                     json_integer_new(wall_time(info->last_send)));
+    json_object_push(obj, "lastrecv",
+                     json_integer_new(wall_time(info->last_recv)));
+    json_object_push(obj, "bytessent", json_integer_new(info->bytes_sent));
+    json_object_push(obj, "bytesrecv", json_integer_new(info->bytes_recv));
+    json_object_push(obj, "conntime", json_integer_new(wall_time(info->time)));
+
+    if (info->min_ping != -1) {
+      json_object_push(obj, "minping",
+                       json_double_new((double)info->min_ping / 1000.0));
+    }
+
+    json_object_push(obj, "version", json_integer_new(info->version));
+    json_object_push(obj, "subver", json_string_new(info->agent));
+    json_object_push(obj, "inbound", json_boolean_new(info->inbound));
+
+    if (info->inbound)
+      type = "inbound";
+    else if (info->block_relay)
+      type = "block-relay-only";
+    else
+      type = "outbound-full-relay";
+
+    json_object_push(obj, "connection_type", json_string_new(type));
+    json_object_push(obj, "connected", json_boolean_new(info->connected));
+    json_object_push(obj, "startingheight", json_integer_new(info->height));
+    json_object_push(obj, "banscore", json_integer_new(info->ban_score));
+    json_object_push(obj, "addr_processed",
+                     json_integer_new(info->addr_processed));
+    json_object_push(obj, "addr_rate_limited",
+                     json_integer_new(info->addr_rate_limited));
+    json_object_push(obj, "bytessent_per_msg",
+                     json_netstats_new(info->sent, 0));
+    json_object_push(obj, "bytesrecv_per_msg",
+                     json_netstats_new(info->recv, 0));
+    json_object_push(obj, "msgssent_per_msg",
+                     json_netstats_new(info->sent, 1));
+    json_object_push(obj, "msgsrecv_per_msg",
+                     json_netstats_new(info->recv, 1));
+
+    json_array_push(res->result, obj);
+  }
+
+  if (items != NULL)
+    btc_free(items);
+}
+
+static void
+btc_rpc_getnettotals(btc_rpc_t *rpc,
+                     const json_params *params,
+                     rpc_res_t *res) {
+  btc_nettotals_t totals;
+  json_value *obj, *target;
+  btc_timespec_t ts;
+  uint64_t left = 0;
+
+  if (params->help || params->length != 0)
+    THROW_MISC("getnettotals");
+
+  btc_pool_nettotals(rpc->pool, &totals);
+  btc_time_get(&ts);
+
+  if (totals.target > totals.cycle_sent)
+    left = totals.target - totals.cycle_sent;
+
+  target = json_object_new(6);
+
+  json_object_push(target, "timeframe", json_integer_new(totals.timeframe));
+  json_object_push(target, "target", json_integer_new(totals.target));
+  json_object_push(target, "target_reached",
+                   json_boolean_new(totals.target_reached));
+  json_object_push(target, "serve_historical_blocks",
+                   json_boolean_new(totals.serve_historical));
+  json_object_push(target, "bytes_left_in_cycle",
+                   json_integer_new(totals.target ? left : 0));
+  json_object_push(target, "time_left_in_cycle",
+                   json_integer_new(totals.target ? totals.time_left : 0));
+
+  obj = json_object_new(4);
+
+  json_object_push(obj, "totalbytesrecv", json_integer_new(totals.bytes_recv));
+  json_object_push(obj, "totalbytessent", json_integer_new(totals.bytes_sent));
+  json_object_push(obj, "timemillis",
+                   json_integer_new(ts.tv_sec * 1000 + ts.tv_nsec / 1000000));
+  json_object_push(obj, "uploadtarget", target);
+
+  res->result = obj;
+}
+
+/*
+ * Raw Transactions
+ */
+
+static void
+btc_rpc_getrawtransaction(btc_rpc_t *rpc,
+                          const json_params *params,
+                          rpc_res_t *res) {
+  const btc_entry_t *entry = NULL;
+  const btc_mpentry_t *mpentry;
+  btc_block_t *block = NULL;
+  const btc_tx_t *tx = NULL;
+  btc_tx_t *owned = NULL;
+  uint8_t hash[32];
+  uint8_t block_hash[32];
+  int verbose = 0;
+  uint8_t *raw;
+  size_t i, len;
+
+  if (params->help || params->length < 1 || params->length > 3)
+    THROW_MISC("getrawtransaction txid ( verbose blockhash )");
+
+  if (!json_hash_get(hash, params->values[0]))
+    THROW_TYPE(txid, hash);
+
+  if (params->length > 1) {
+    if (params->values[1]->type == json_integer) {
+      if (!json_unsigned_get(&verbose, params->values[1]))
+        THROW_TYPE(verbose, boolean);
+    } else {
+      if (!json_boolean_get(&verbose, params->values[1]))
+        THROW_TYPE(verbose, boolean);
+    }
+  }
+
+  if (params->length > 2) {
+    if (!json_hash_get(block_hash, params->values[2]))
+      THROW_TYPE(blockhash, hash);
+
+    entry = btc_chain_by_hash(rpc->chain, block_hash);
+
+    if (entry == NULL)
+      THROW(RPC_INVALID_ADDRESS_OR_KEY, "Block hash not found");
+
+    block = btc_chain_get_block(rpc->chain, entry);
+
+    if (block == NULL)
+      THROW_MISC("Can't read block from disk");
+
+    for (i = 0; i < block->txs.length; i++) {
+      if (btc_hash_equal(block->txs.items[i]->hash, hash)) {
+        tx = block->txs.items[i];
+        break;
+      }
+    }
+
+    if (tx == NULL) {
+      btc_block_destroy(block);
+      THROW(RPC_INVALID_ADDRESS_OR_KEY,
+            "No such transaction found in the provided block");
+    }
+  } else if ((mpentry = btc_mempool_get(rpc->mempool, hash)) != NULL) {
+    tx = mpentry->tx;
+  } else if (!verbose) {
+    /* Hand back the stored bytes as they are. */
+    if (!btc_chain_get_raw_tx(rpc->chain, &raw, &len, NULL, hash))
+      goto missing;
+
+    {
+      char *str = btc_malloc(len * 2 + 1);
+
+      btc_base16_encode(str, raw, len);
+
+      free(raw);
+
+      res->result = json_string_new_nocopy(len * 2, str);
+    }
+
+    return;
+  } else {
+    owned = btc_chain_get_tx(rpc->chain, &entry, hash);
+
+    if (owned == NULL)
+      goto missing;
+
+    tx = owned;
+  }
+
+  if (verbose) {
+    json_value *obj;
+
+    obj = json_tx_new_ex(tx, NULL, entry != NULL ? entry->hash : NULL,
+                         1, rpc->network);
+
+    if (entry != NULL) {
+      const uint8_t *next;
+      int32_t depth = btc_rpc_get_depth(rpc, res, entry, &next);
+
+      json_object_push(obj, "confirmations", json_integer_new(depth));
+      json_object_push(obj, "time", json_integer_new(entry->header.time));
+      json_object_push(obj, "blocktime",
+                       json_integer_new(entry->header.time));
+    }
+
+    res->result = obj;
+  } else {
+    res->result = json_tx_raw(tx);
+  }
+
+  if (owned != NULL)
+    btc_tx_destroy(owned);
+
+  if (block != NULL)
+    btc_block_destroy(block);
+
+  return;
+missing:
+  THROW(RPC_INVALID_ADDRESS_OR_KEY,
+        "No such mempool or blockchain transaction. "
+        "Use -txindex or provide a block hash.");
+}
+
+/*
+ * Address Index
+ */
+
+static int
+btc_rpc_get_scripthash(btc_rpc_t *rpc, uint8_t *hash, const json_value *val) {
+  btc_address_t addr;
+  btc_script_t script;
+
+  if (json_address_get(&addr, val, rpc->network)) {
+    btc_script_init(&script);
+    btc_address_get_script(&script, &addr);
+    btc_addrindex_hash(hash, &script);
+    btc_script_clear(&script);
+    return 1;
+  }
+
+  return json_hash_get(hash, val);
+}
+
+static void
+btc_rpc_getaddresshistory(btc_rpc_t *rpc,
+                          const json_params *params,
+                          rpc_res_t *res) {
+  btc_addrindex_t *index = rpc->node->addrindex;
+  int start = 0, count = 1000;
+  btc_addrtx_t *items;
+  uint8_t hash[32];
+  json_value *obj;
+  size_t i, len;
+
+  if (params->help || params->length < 1 || params->length > 3)
+    THROW_MISC("getaddresshistory address|scripthash ( from_height count )");
+
+  if (!btc_rpc_get_scripthash(rpc, hash, params->values[0]))
+    THROW_TYPE(address, address_or_scripthash);
+
+  if (params->length > 1) {
+    if (!json_unsigned_get(&start, params->values[1]))
+      THROW_TYPE(from_height, integer);
+  }
+
+  if (params->length > 2) {
+    if (!json_unsigned_get(&count, params->values[2]) || count == 0)
+      THROW_TYPE(count, integer);
+  }
+
+  if (!btc_addrindex_enabled(index))
+    THROW_MISC("Address index is disabled (use -addrindex)");
+
+  len = btc_addrindex_history(index, &items, hash, start, count);
+
+  res->result = json_array_new(len);
+
+  for (i = 0; i < len; i++) {
+    obj = json_object_new(3);
+
+    json_object_push(obj, "txid", json_hash_new(items[i].hash));
+    json_object_push(obj, "height", json_integer_new(items[i].height));
+    json_object_push(obj, "index", json_integer_new(items[i].index));
+
+    json_array_push(res->result, obj);
+  }
+
+  if (items != NULL)
+    btc_free(items);
+}
+
+static void
+btc_rpc_getaddressutxos(btc_rpc_t *rpc,
+                        const json_params *params,
+                        rpc_res_t *res) {
+  btc_addrindex_t *index = rpc->node->addrindex;
+  btc_addrcoin_t *items;
+  uint8_t hash[32];
+  json_value *obj;
+  size_t i, len;
+
+  if (params->help || params->length != 1)
+    THROW_MISC("getaddressutxos address|scripthash");
+
+  if (!btc_rpc_get_scripthash(rpc, hash, params->values[0]))
+    THROW_TYPE(address, address_or_scripthash);
+
+  if (!btc_addrindex_enabled(index))
+    THROW_MISC("Address index is disabled (use -addrindex)");
+
+  len = btc_addrindex_unspents(index, &items, hash, (size_t)-1);
+
+  res->result = json_array_new(len);
+
+  for (i = 0; i < len; i++) {
+    obj = json_object_new(4);
+
+    json_object_push(obj, "txid", json_hash_new(items[i].prevout.hash));
+    json_object_push(obj, "vout", json_integer_new(items[i].prevout.index));
+    json_object_push(obj, "height", json_integer_new(items[i].height));
+    json_object_push(obj, "value", json_amount_new(items[i].value));
+
+    json_array_push(res->result, obj);
+  }
+
+  if (items != NULL)
+    btc_free(items);
+}
+
+/*
+ * Wallet
+ */
+
+static void
+btc_rpc_sendtoaddress(btc_rpc_t *rpc,
+                      const json_params *params,
+                      rpc_res_t *res) {
+  btc_address_t addr;
+  json_value *obj;
+  int64_t value;
+
+  if (params->help || params->length != 2)
+    THROW_MISC("sendtoaddress address amount");
+
+  if (!json_address_get(&addr, params->values[0], rpc->network))
+    THROW(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
 
   if (!json_amount_get(&value, params->values[1]))
     THROW_TYPE(amount, amount);
 
-  obj = json_object_new(2);
+  obj = json_object_new(2);
+
+  json_object_push(obj, "address", json_address_new(&addr, rpc->network));
+  json_object_push(obj, "amount", json_amount_new(value));
+
+  res->result = obj;
+}
+
+/*
+ * Registry
+ */
+
+static void
+btc_rpc_help(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res);
+
+/* Changes chain state: refused on a replica. */
+#define RPC_WRITES 1
+
+/* Only reads the chain, through `res->reader` (see
+   the call helpers). Runs on an RPC worker if any. */
+#define RPC_WORKER 2
+
+static const struct {
+  const char *method;
+  void (*handler)(btc_rpc_t *,
+                  const json_params *,
+                  rpc_res_t *);
+  unsigned int flags;
+} btc_rpc_methods[] = {
+  { "dumptxoutset", btc_rpc_dumptxoutset, 0 },
+  { "estimatesmartfee", btc_rpc_estimatesmartfee, 0 },
+  { "generate", btc_rpc_generate, RPC_WRITES },
+  { "generatetoaddress", btc_rpc_generatetoaddress, RPC_WRITES },
+  { "getaddresshistory", btc_rpc_getaddresshistory, 0 },
+  { "getaddressutxos", btc_rpc_getaddressutxos, 0 },
+  { "getbestblockhash", btc_rpc_getbestblockhash, 0 },
+  { "getblock", btc_rpc_getblock, RPC_WORKER },
+  { "getblockchaininfo", btc_rpc_getblockchaininfo, 0 },
+  { "getblockcount", btc_rpc_getblockcount, 0 },
+  { "getblockhash", btc_rpc_getblockhash, RPC_WORKER },
+  { "getblockheader", btc_rpc_getblockheader, RPC_WORKER },
+  { "getblockstats", btc_rpc_getblockstats, 0 },
+  { "getblockstatsrange", btc_rpc_getblockstatsrange, 0 },
+  { "getblocktemplate", btc_rpc_getblocktemplate, 0 },
+  { "getcpuinfo", btc_rpc_getcpuinfo, 0 },
+  { "getdbstats", btc_rpc_getdbstats, 0 },
+  { "getdifficulty", btc_rpc_getdifficulty, 0 },
+  { "getgenerate", btc_rpc_getgenerate, 0 },
+  { "getinfo", btc_rpc_getinfo, 0 },
+  { "getmemoryinfo", btc_rpc_getmemoryinfo, 0 },
+  { "getnettotals", btc_rpc_getnettotals, 0 },
+  { "getpeerinfo", btc_rpc_getpeerinfo, 0 },
+  { "getperfstats", btc_rpc_getperfstats, 0 },
+  { "getrawtransaction", btc_rpc_getrawtransaction, 0 },
+  { "gettxoutsetinfo", btc_rpc_gettxoutsetinfo, 0 },
+  { "help", btc_rpc_help, 0 },
+  { "scantxoutset", btc_rpc_scantxoutset, 0 },
+  { "sendtoaddress", btc_rpc_sendtoaddress, RPC_WRITES },
+  { "setgenerate", btc_rpc_setgenerate, RPC_WRITES },
+  { "starttrace", btc_rpc_starttrace, 0 },
+  { "stoptrace", btc_rpc_stoptrace, 0 },
+  { "submitblock", btc_rpc_submitblock, RPC_WRITES },
+  { "submitpackage", btc_rpc_submitpackage, RPC_WRITES }
+};
+
+static int
+btc_rpc_find_handler(const char *method) {
+  int end = lengthof(btc_rpc_methods) - 1;
+  int start = 0;
+  int pos, cmp;
+
+  while (start <= end) {
+    pos = (start + end) >> 1;
+    cmp = strcmp(btc_rpc_methods[pos].method, method);
+
+    if (cmp == 0)
+      return pos;
+
+    if (cmp < 0)
+      start = pos + 1;
+    else
+      end = pos - 1;
+  }
+
+  return -1;
+}
+
+/*
+ * REST
+ */
+
+enum rest_format {
+  REST_BIN,
+  REST_HEX
+};
+
+static int
+rest_parse_uint(int *z, const char *xp) {
+  int n = 0;
+  int x = 0;
+
+  if (*xp == '\0')
+    return 0;
+
+  while (*xp) {
+    int ch = *xp++;
+
+    if (ch < '0' || ch > '9')
+      return 0;
+
+    if (++n > 9)
+      return 0;
+
+    x *= 10;
+    x += (ch - '0');
+  }
+
+  *z = x;
+
+  return 1;
+}
+
+static int
+rest_parse_outpoint(btc_outpoint_t *z, char *xp) {
+  char *sp = strchr(xp, '-');
+  int index;
+
+  if (sp == NULL)
+    return 0;
+
+  *sp++ = '\0';
+
+  if (!btc_hash_import(z->hash, xp))
+    return 0;
+
+  if (!rest_parse_uint(&index, sp))
+    return 0;
+
+  z->index = index;
+
+  return 1;
+}
+
+static void
+rest_send(http_res_t *res,
+          enum rest_format format,
+          const uint8_t *data,
+          size_t length,
+          void *ptr) {
+  /* `data` points into `ptr`, which we take ownership of. */
+  if (format == REST_HEX) {
+    char *str = btc_malloc(length * 2 + 2);
+
+    btc_base16_encode(str, data, length);
+
+    str[length * 2] = '\n';
+
+    btc_free(ptr);
+
+    http_res_send_data(res, 200, "text/plain", str, length * 2 + 1);
+  } else {
+    http_res_send_shared(res, 200, "application/octet-stream",
+                         data, length, NULL, ptr);
+  }
+}
+
+static void
+btc_rest_block(btc_rpc_t *rpc,
+               char **args,
+               int argc,
+               enum rest_format format,
+               http_res_t *res) {
+  const btc_entry_t *entry;
+  uint8_t hash[32];
+  uint8_t *data;
+  size_t length;
+
+  if (argc != 1 || !btc_hash_import(hash, args[0])) {
+    http_res_error(res, 400);
+    return;
+  }
+
+  entry = btc_chain_by_hash(rpc->chain, hash);
+
+  if (entry == NULL) {
+    http_res_error(res, 404);
+    return;
+  }
+
+  /* Straight from the block file (no decoding). The
+     stored record is prefixed with a message header. */
+  if (!btc_chain_get_raw_block(rpc->chain, &data, &length, entry)) {
+    http_res_error(res, 404);
+    return;
+  }
+
+  CHECK(length >= 24);
+
+  rest_send(res, format, data + 24, length - 24, data);
+}
+
+static void
+btc_rest_headers(btc_rpc_t *rpc,
+                 char **args,
+                 int argc,
+                 enum rest_format format,
+                 http_res_t *res) {
+  const btc_entry_t *entry;
+  uint8_t hash[32];
+  uint8_t *data, *zp;
+  int count, i;
+
+  if (argc != 2
+      || !rest_parse_uint(&count, args[0])
+      || !btc_hash_import(hash, args[1])) {
+    http_res_error(res, 400);
+    return;
+  }
+
+  if (count < 1 || count > REST_MAX_HEADERS) {
+    http_res_error(res, 400);
+    return;
+  }
+
+  entry = btc_chain_by_hash(rpc->chain, hash);
+
+  if (entry == NULL) {
+    http_res_error(res, 404);
+    return;
+  }
+
+  data = btc_malloc(count * 80);
+  zp = data;
+
+  if (btc_chain_is_main(rpc->chain, entry)) {
+    for (i = 0; i < count && entry != NULL; i++) {
+      zp = btc_header_write(zp, &entry->header);
+      entry = entry->next;
+    }
+  }
+
+  rest_send(res, format, data, zp - data, data);
+}
+
+static void
+btc_rest_getutxos(btc_rpc_t *rpc,
+                  char **args,
+                  int argc,
+                  enum rest_format format,
+                  http_res_t *res) {
+  const btc_entry_t *tip = btc_chain_tip(rpc->chain);
+  const btc_output_t *outputs[REST_MAX_OUTPOINTS];
+  int32_t heights[REST_MAX_OUTPOINTS];
+  uint8_t bitmap[(REST_MAX_OUTPOINTS + 7) / 8];
+  size_t size, bytes, found;
+  int checkmempool = 0;
+  btc_view_t *view;
+  uint8_t *data, *zp;
+  btc_tx_t *tx;
+  int i;
+
+  if (argc > 0 && strcmp(args[0], "checkmempool") == 0) {
+    checkmempool = 1;
+    args++;
+    argc--;
+  }
+
+  if (argc < 1 || argc > REST_MAX_OUTPOINTS) {
+    http_res_error(res, 400);
+    return;
+  }
+
+  /* The chain fills a view from a transaction's inputs. */
+  tx = btc_tx_create();
+
+  for (i = 0; i < argc; i++) {
+    btc_input_t *input = btc_input_create();
+
+    btc_inpvec_push(&tx->inputs, input);
+
+    if (!rest_parse_outpoint(&input->prevout, args[i])) {
+      btc_tx_destroy(tx);
+      http_res_error(res, 400);
+      return;
+    }
+  }
+
+  view = btc_view_create();
+
+  btc_chain_get_coins(rpc->chain, view, tx);
+
+  memset(bitmap, 0, sizeof(bitmap));
+
+  bytes = (argc + 7) / 8;
+  size = 4 + 32 + btc_size_size(bytes) + bytes;
+  found = 0;
+
+  for (i = 0; i < argc; i++) {
+    const btc_outpoint_t *prevout = &tx->inputs.items[i]->prevout;
+    const btc_coin_t *coin = btc_view_get(view, prevout);
+    const btc_mpentry_t *entry;
+
+    outputs[i] = NULL;
+
+    if (checkmempool) {
+      if (btc_mempool_has_spent(rpc->mempool, prevout))
+        continue;
+
+      entry = btc_mempool_get(rpc->mempool, prevout->hash);
+
+      if (entry != NULL && prevout->index < entry->tx->outputs.length) {
+        outputs[i] = entry->tx->outputs.items[prevout->index];
+        heights[i] = REST_MEMPOOL_HEIGHT;
+      }
+    }
+
+    if (outputs[i] == NULL && coin != NULL && !coin->spent) {
+      outputs[i] = &coin->output;
+      heights[i] = coin->height;
+    }
+
+    if (outputs[i] != NULL) {
+      bitmap[i >> 3] |= 1 << (i & 7);
+      size += 8 + btc_output_size(outputs[i]);
+      found += 1;
+    }
+  }
+
+  size += btc_size_size(found);
+
+  /* Same layout as bitcoin core's getutxos. */
+  data = btc_malloc(size);
+  zp = data;
+
+  zp = btc_int32_write(zp, tip->height);
+  zp = btc_raw_write(zp, tip->hash, 32);
+  zp = btc_size_write(zp, bytes);
+  zp = btc_raw_write(zp, bitmap, bytes);
+  zp = btc_size_write(zp, found);
+
+  for (i = 0; i < argc; i++) {
+    if (outputs[i] == NULL)
+      continue;
+
+    zp = btc_uint32_write(zp, 0);
+    zp = btc_int32_write(zp, heights[i]);
+    zp = btc_output_write(zp, outputs[i]);
+  }
 
-  json_object_push(obj, "address", json_address_new(&addr, rpc->network));
-  json_object_push(obj, "amount", json_amount_new(value));
+  CHECK((size_t)(zp - data) == size);
 
-  res->result = obj;
+  btc_view_destroy(view);
+  btc_tx_destroy(tx);
+
+  rest_send(res, format, data, size, data);
+}
+
+static int
+btc_rest_handle(btc_rpc_t *rpc, const http_req_t *req, http_res_t *res) {
+  enum rest_format format;
+  char *args[REST_MAX_OUTPOINTS + 2];
+  char *path, *ext, *sp;
+  int argc = 0;
+
+  if (req->path.length < 6 || memcmp(req->path.data, "/rest/", 6) != 0)
+    return 0;
+
+  path = btc_strdup(req->path.data + 6);
+  ext = strrchr(path, '.');
+
+  if (ext != NULL && strcmp(ext, ".bin") == 0) {
+    format = REST_BIN;
+  } else if (ext != NULL && strcmp(ext, ".hex") == 0) {
+    format = REST_HEX;
+  } else {
+    http_res_error(res, 404);
+    goto done;
+  }
+
+  *ext = '\0';
+
+  /* Split into `<method>/<arg>/...`. */
+  for (sp = path; sp != NULL && argc < (int)lengthof(args); argc++) {
+    args[argc] = sp;
+    sp = strchr(sp, '/');
+
+    if (sp != NULL)
+      *sp++ = '\0';
+  }
+
+  if (sp != NULL) {
+    http_res_error(res, 400);
+    goto done;
+  }
+
+  if (strcmp(args[0], "block") == 0)
+    btc_rest_block(rpc, args + 1, argc - 1, format, res);
+  else if (strcmp(args[0], "headers") == 0)
+    btc_rest_headers(rpc, args + 1, argc - 1, format, res);
+  else if (strcmp(args[0], "getutxos") == 0)
+    btc_rest_getutxos(rpc, args + 1, argc - 1, format, res);
+  else
+    http_res_error(res, 404);
+
+done:
+  btc_free(path);
+  return 1;
 }
 
 /*
- * Registry
+ * Metrics
+ */
+
+/* Prometheus text exposition at `GET /metrics`.
+ * Everything is read straight out of the node on
+ * the loop thread and written into one buffer kept
+ * across scrapes, so once that buffer has grown to
+ * size a scrape allocates nothing of its own. Rates
+ * (cache hit rate, bytes per second) are left to
+ * the scraper.
  */
 
+#define METRICS_MIN_SHIFT 10 /* ~1us */
+#define METRICS_MAX_SHIFT 36 /* ~69s */
+
 static void
-btc_rpc_help(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res);
+metrics_put(btc_rpc_t *rpc, const char *xp, size_t xn) {
+  struct btc_rpcbuf_s *buf = &rpc->metrics;
 
-static const struct {
-  const char *method;
-  void (*handler)(btc_rpc_t *,
-                  const json_params *,
-                  rpc_res_t *);
-} btc_rpc_methods[] = {
-  { "generate", btc_rpc_generate },
-  { "generatetoaddress", btc_rpc_generatetoaddress },
-  { "getbestblockhash", btc_rpc_getbestblockhash },
-  { "getblock", btc_rpc_getblock },
-  { "getblockchaininfo", btc_rpc_getblockchaininfo },
-  { "getblockcount", btc_rpc_getblockcount },
-  { "getblockhash", btc_rpc_getblockhash },
-  { "getblockheader", btc_rpc_getblockheader },
-  { "getdifficulty", btc_rpc_getdifficulty },
-  { "getgenerate", btc_rpc_getgenerate },
-  { "getinfo", btc_rpc_getinfo },
-  { "help", btc_rpc_help },
-  { "sendtoaddress", btc_rpc_sendtoaddress },
-  { "setgenerate", btc_rpc_setgenerate }
-};
+  if (buf->length + xn > buf->alloc) {
+    size_t alloc = buf->alloc == 0 ? 65536 : buf->alloc;
 
-static int
-btc_rpc_find_handler(const char *method) {
-  int end = lengthof(btc_rpc_methods) - 1;
-  int start = 0;
-  int pos, cmp;
+    while (alloc < buf->length + xn)
+      alloc *= 2;
 
-  while (start <= end) {
-    pos = (start + end) >> 1;
-    cmp = strcmp(btc_rpc_methods[pos].method, method);
+    buf->data = (char *)btc_realloc(buf->data, alloc);
+    buf->alloc = alloc;
+  }
 
-    if (cmp == 0)
-      return pos;
+  memcpy(buf->data + buf->length, xp, xn);
 
-    if (cmp < 0)
-      start = pos + 1;
-    else
-      end = pos - 1;
+  buf->length += xn;
+}
+
+static void
+metrics_str(btc_rpc_t *rpc, const char *str) {
+  metrics_put(rpc, str, strlen(str));
+}
+
+static void
+metrics_uint(btc_rpc_t *rpc, uint64_t x) {
+  char tmp[20];
+  size_t i = sizeof(tmp);
+
+  do {
+    tmp[--i] = '0' + (int)(x % 10);
+    x /= 10;
+  } while (x != 0);
+
+  metrics_put(rpc, tmp + i, sizeof(tmp) - i);
+}
+
+static void
+metrics_secs(btc_rpc_t *rpc, uint64_t ns) {
+  uint64_t frac = ns % 1000000000;
+  char tmp[10];
+  int i;
+
+  tmp[0] = '.';
+
+  for (i = 9; i >= 1; i--) {
+    tmp[i] = '0' + (int)(frac % 10);
+    frac /= 10;
   }
 
-  return -1;
+  metrics_uint(rpc, ns / 1000000000);
+  metrics_put(rpc, tmp, sizeof(tmp));
+}
+
+static void
+metrics_head(btc_rpc_t *rpc,
+             const char *name,
+             const char *type,
+             const char *help) {
+  metrics_str(rpc, "# HELP ");
+  metrics_str(rpc, name);
+  metrics_str(rpc, " ");
+  metrics_str(rpc, help);
+  metrics_str(rpc, "\n# TYPE ");
+  metrics_str(rpc, name);
+  metrics_str(rpc, " ");
+  metrics_str(rpc, type);
+  metrics_str(rpc, "\n");
+}
+
+static void
+metrics_name(btc_rpc_t *rpc,
+             const char *name,
+             const char *key,
+             const char *val) {
+  metrics_str(rpc, name);
+
+  if (key != NULL) {
+    metrics_str(rpc, "{");
+    metrics_str(rpc, key);
+    metrics_str(rpc, "=\"");
+    metrics_str(rpc, val);
+    metrics_str(rpc, "\"}");
+  }
+
+  metrics_str(rpc, " ");
+}
+
+static void
+metrics_value(btc_rpc_t *rpc,
+              const char *name,
+              const char *key,
+              const char *val,
+              uint64_t value) {
+  metrics_name(rpc, name, key, val);
+  metrics_uint(rpc, value);
+  metrics_str(rpc, "\n");
+}
+
+static void
+metrics_hist(btc_rpc_t *rpc, const char *stage, const btc_hist_t *hist) {
+  const char *name = "mako_stage_duration_seconds";
+  int shift;
+
+  for (shift = METRICS_MIN_SHIFT; shift <= METRICS_MAX_SHIFT; shift += 2) {
+    uint64_t le = (uint64_t)1 << shift;
+
+    metrics_str(rpc, name);
+    metrics_str(rpc, "_bucket{stage=\"");
+    metrics_str(rpc, stage);
+    metrics_str(rpc, "\",le=\"");
+    metrics_secs(rpc, le);
+    metrics_str(rpc, "\"} ");
+    metrics_uint(rpc, btc_hist_below(hist, le));
+    metrics_str(rpc, "\n");
+  }
+
+  metrics_str(rpc, name);
+  metrics_str(rpc, "_bucket{stage=\"");
+  metrics_str(rpc, stage);
+  metrics_str(rpc, "\",le=\"+Inf\"} ");
+  metrics_uint(rpc, hist->count);
+  metrics_str(rpc, "\n");
+
+  metrics_str(rpc, name);
+  metrics_str(rpc, "_sum{stage=\"");
+  metrics_str(rpc, stage);
+  metrics_str(rpc, "\"} ");
+  metrics_secs(rpc, hist->total);
+  metrics_str(rpc, "\n");
+
+  metrics_str(rpc, name);
+  metrics_str(rpc, "_count{stage=\"");
+  metrics_str(rpc, stage);
+  metrics_str(rpc, "\"} ");
+  metrics_uint(rpc, hist->count);
+  metrics_str(rpc, "\n");
+}
+
+static void
+metrics_netstats(btc_rpc_t *rpc,
+                 const char *name,
+                 const char *help,
+                 const btc_netstat_t *stats,
+                 int bytes) {
+  const char *type;
+  btc_msg_t msg;
+  int i;
+
+  metrics_head(rpc, name, "counter", help);
+
+  for (i = 0; i < BTC_NETSTAT_TYPES; i++) {
+    uint64_t value = bytes ? stats[i].bytes : stats[i].msgs;
+
+    if (value == 0)
+      continue;
+
+    btc_msg_set_type(&msg, (enum btc_msgtype)i);
+
+    type = i == BTC_MSG_UNKNOWN ? "unknown" : msg.cmd;
+
+    metrics_value(rpc, name, "command", type, value);
+  }
+}
+
+static void
+metrics_queued(btc_rpc_t *rpc, const char *pool, btc_workers_t *workers) {
+  /* Ordered as in io/workers.h. */
+  static const char *classes[BTC_WORK_PRIORITIES] = {
+    "high",
+    "normal",
+    "low"
+  };
+  const char *name = "mako_worker_queued";
+  int i;
+
+  if (workers == NULL)
+    return;
+
+  for (i = 0; i < BTC_WORK_PRIORITIES; i++) {
+    metrics_str(rpc, name);
+    metrics_str(rpc, "{pool=\"");
+    metrics_str(rpc, pool);
+    metrics_str(rpc, "\",class=\"");
+    metrics_str(rpc, classes[i]);
+    metrics_str(rpc, "\"} ");
+    metrics_uint(rpc, btc_workers_queued(workers, i));
+    metrics_str(rpc, "\n");
+  }
+}
+
+static void
+metrics_features(btc_rpc_t *rpc) {
+  unsigned int detected = btc_cpu_detected();
+  unsigned int enabled = btc_cpu_features();
+  const char *name;
+  size_t i;
+
+  for (i = 0; (name = btc_cpu_feature_name(i)) != NULL; i++) {
+    if (detected & (1u << i)) {
+      metrics_value(rpc, "mako_cpu_feature", "feature", name,
+                    (enabled >> i) & 1);
+    }
+  }
+}
+
+static void
+metrics_backends(btc_rpc_t *rpc) {
+  const char *name = "mako_crypto_backend";
+  const char *prim;
+  size_t i;
+
+  for (i = 0; (prim = btc_cpu_backend_name(i)) != NULL; i++) {
+    metrics_str(rpc, name);
+    metrics_str(rpc, "{primitive=\"");
+    metrics_str(rpc, prim);
+    metrics_str(rpc, "\",backend=\"");
+    metrics_str(rpc, btc_cpu_backend(i));
+    metrics_str(rpc, "\"} 1\n");
+  }
+}
+
+static void
+btc_metrics_collect(btc_rpc_t *rpc) {
+  const btc_perf_t *perf = rpc->node->perf;
+  btc_nettotals_t totals;
+  btc_dbstats_t stats;
+  btc_hist_t syncs;
+  int i;
+
+  rpc->metrics.length = 0;
+
+  /* Chain */
+  metrics_head(rpc, "mako_chain_height", "gauge",
+               "Height of the chain tip.");
+  metrics_value(rpc, "mako_chain_height", NULL, NULL,
+                btc_chain_height(rpc->chain));
+
+  metrics_head(rpc, "mako_chain_synced", "gauge",
+               "Whether the chain is fully synced.");
+  metrics_value(rpc, "mako_chain_synced", NULL, NULL,
+                btc_chain_synced(rpc->chain));
+
+  /* Latency */
+  btc_chain_sync_stats(rpc->chain, &syncs);
+
+  metrics_head(rpc, "mako_stage_duration_seconds", "histogram",
+               "Time spent in each stage of block and tx processing.");
+
+  for (i = 0; i < BTC_PERF_MAX; i++) {
+    metrics_hist(rpc, btc_perf_name((enum btc_perf_stage)i),
+                      &perf->stages[i]);
+
+    if (i == BTC_PERF_BLOCK_SAVE)
+      metrics_hist(rpc, "block_sync", &syncs);
+  }
+
+  /* Mempool */
+  metrics_head(rpc, "mako_mempool_transactions", "gauge",
+               "Transactions in the mempool.");
+  metrics_value(rpc, "mako_mempool_transactions", NULL, NULL,
+                btc_mempool_size(rpc->mempool));
+
+  metrics_head(rpc, "mako_mempool_usage_bytes", "gauge",
+               "Memory used by the mempool.");
+  metrics_value(rpc, "mako_mempool_usage_bytes", NULL, NULL,
+                btc_mempool_usage(rpc->mempool));
+
+  /* Network */
+  btc_pool_nettotals(rpc->pool, &totals);
+
+  metrics_head(rpc, "mako_peers", "gauge", "Connected peers.");
+  metrics_value(rpc, "mako_peers", "direction", "inbound", totals.inbound);
+  metrics_value(rpc, "mako_peers", "direction", "outbound", totals.outbound);
+
+  metrics_head(rpc, "mako_block_buffer_bytes", "gauge",
+               "Blocks downloaded ahead of the tip.");
+  metrics_value(rpc, "mako_block_buffer_bytes", NULL, NULL,
+                totals.block_buffer);
+
+  metrics_head(rpc, "mako_block_buffer_limit_bytes", "gauge",
+               "Size the block download is throttled at.");
+  metrics_value(rpc, "mako_block_buffer_limit_bytes", NULL, NULL,
+                totals.block_buffer_max);
+
+  metrics_head(rpc, "mako_blocks_inflight", "gauge",
+               "Blocks requested from peers.");
+  metrics_value(rpc, "mako_blocks_inflight", NULL, NULL,
+                totals.blocks_inflight);
+
+  metrics_netstats(rpc, "mako_net_sent_bytes_total",
+                   "Bytes sent, by command.", totals.sent, 1);
+  metrics_netstats(rpc, "mako_net_received_bytes_total",
+                   "Bytes received, by command.", totals.recv, 1);
+  metrics_netstats(rpc, "mako_net_sent_messages_total",
+                   "Messages sent, by command.", totals.sent, 0);
+  metrics_netstats(rpc, "mako_net_received_messages_total",
+                   "Messages received, by command.", totals.recv, 0);
+
+  /* Workers */
+  metrics_head(rpc, "mako_worker_backlog", "gauge",
+               "Jobs queued or running on a worker pool.");
+  metrics_value(rpc, "mako_worker_backlog", "pool", "net", totals.decoding);
+
+  if (rpc->workers != NULL) {
+    metrics_value(rpc, "mako_worker_backlog", "pool", "rpc",
+                  btc_workers_backlog(rpc->workers));
+  }
+
+  metrics_head(rpc, "mako_worker_queued", "gauge",
+               "Jobs waiting on a worker pool, by priority class.");
+  metrics_queued(rpc, "chain", btc_chain_workers(rpc->chain));
+  metrics_queued(rpc, "mempool", btc_mempool_workers(rpc->mempool));
+  metrics_queued(rpc, "rpc", rpc->workers);
+
+  /* Database */
+  btc_chain_counters(rpc->chain, &stats);
+
+  metrics_head(rpc, "mako_coincache_hits_total", "counter",
+               "Coin lookups served from the cache.");
+  metrics_value(rpc, "mako_coincache_hits_total", NULL, NULL,
+                stats.cache_hits);
+
+  metrics_head(rpc, "mako_coincache_misses_total", "counter",
+               "Coin lookups which went to the database.");
+  metrics_value(rpc, "mako_coincache_misses_total", NULL, NULL,
+                stats.cache_misses);
+
+  metrics_head(rpc, "mako_coincache_usage_bytes", "gauge",
+               "Memory used by the coin cache.");
+  metrics_value(rpc, "mako_coincache_usage_bytes", NULL, NULL,
+                stats.cache_usage);
+
+  metrics_head(rpc, "mako_coincache_limit_bytes", "gauge",
+               "Size the coin cache is flushed at.");
+  metrics_value(rpc, "mako_coincache_limit_bytes", NULL, NULL,
+                stats.cache_limit);
+
+  metrics_head(rpc, "mako_lsm_tree_bytes", "gauge",
+               "Size of the in-memory trees.");
+  metrics_value(rpc, "mako_lsm_tree_bytes", "tree", "old",
+                (uint64_t)stats.tree_old << 10);
+  metrics_value(rpc, "mako_lsm_tree_bytes", "tree", "new",
+                (uint64_t)stats.tree_new << 10);
+
+  metrics_head(rpc, "mako_lsm_checkpoint_bytes", "gauge",
+               "Data written since the last checkpoint.");
+  metrics_value(rpc, "mako_lsm_checkpoint_bytes", NULL, NULL,
+                (uint64_t)stats.checkpoint << 10);
+
+  metrics_head(rpc, "mako_lsm_pages_read_total", "counter",
+               "Database pages read.");
+  metrics_value(rpc, "mako_lsm_pages_read_total", NULL, NULL,
+                stats.pages_read);
+
+  metrics_head(rpc, "mako_lsm_pages_written_total", "counter",
+               "Database pages written.");
+  metrics_value(rpc, "mako_lsm_pages_written_total", NULL, NULL,
+                stats.pages_written);
+
+  /* CPU */
+  metrics_head(rpc, "mako_cpu_feature", "gauge",
+               "CPU features in use (0 if detected but disabled).");
+  metrics_features(rpc);
+
+  metrics_head(rpc, "mako_crypto_backend", "gauge",
+               "Backend selected for each hashing/encoding primitive.");
+  metrics_backends(rpc);
+
+  /* Process */
+  metrics_head(rpc, "process_resident_memory_bytes", "gauge",
+               "Resident memory size in bytes.");
+  metrics_value(rpc, "process_resident_memory_bytes", NULL, NULL,
+                btc_ps_rss());
+}
+
+static void
+btc_metrics_handle(btc_rpc_t *rpc, http_res_t *res) {
+  btc_metrics_collect(rpc);
+
+  http_res_send_data(res, 200, "text/plain; version=0.0.4",
+                     btc_memdup(rpc->metrics.data, rpc->metrics.length),
+                     rpc->metrics.length);
 }
 
 /*
@@ -754,19 +4186,289 @@ static void
 btc_rpc_handle(btc_rpc_t *rpc, const rpc_req_t *req, rpc_res_t *res) {
   int index = btc_rpc_find_handler(req->method);
   json_params params;
+  int tag;
 
   if (index < 0) {
     rpc_res_error(res, RPC_METHOD_NOT_FOUND, "Method not found");
     return;
   }
 
+  if (rpc->warmup != NULL) {
+    rpc_res_error(res, RPC_IN_WARMUP, rpc->warmup);
+    return;
+  }
+
+  if ((btc_rpc_methods[index].flags & RPC_WRITES)
+      && (rpc->flags & BTC_CHAIN_READONLY)) {
+    rpc_res_error(res, RPC_MISC_ERROR, "Not available on a read-only replica");
+    return;
+  }
+
   btc_rpc_log(rpc, "Incoming RPC request: %s.", req->method);
 
   params.length = req->params->u.array.length;
   params.values = req->params->u.array.values;
   params.help = 0;
 
+  BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_RPC);
+
   btc_rpc_methods[index].handler(rpc, &params, res);
+
+  BTC_MEMTAG_POP(tag);
+}
+
+/*
+ * Worker Calls
+ */
+
+typedef struct rpc_job_s {
+  btc_rpc_t *rpc;
+  int index;
+  json_value *params;
+  int64_t id;
+  btc_mutex_t *lock;
+  json_writer writer;
+  int done;
+  int orphan;
+} rpc_job_t;
+
+static json_value *
+rpc_value_clone(const json_value *val) {
+  /* The request is parsed in place and freed with
+     the call, so a job gets its own copy of it. */
+  json_value *out;
+  unsigned int i;
+
+  switch (val->type) {
+    case json_object: {
+      out = json_object_new(val->u.object.length);
+
+      for (i = 0; i < val->u.object.length; i++) {
+        const json_object_entry *entry = &val->u.object.values[i];
+
+        json_object_push_length(out, entry->name_length, entry->name,
+                                rpc_value_clone(entry->value));
+      }
+
+      return out;
+    }
+
+    case json_array: {
+      out = json_array_new(val->u.array.length);
+
+      for (i = 0; i < val->u.array.length; i++)
+        json_array_push(out, rpc_value_clone(val->u.array.values[i]));
+
+      return out;
+    }
+
+    case json_integer:
+      return json_integer_new(val->u.integer);
+
+    case json_amount:
+      return json_amount_new(val->u.integer);
+
+    case json_double:
+      return json_double_new(val->u.dbl);
+
+    case json_string:
+      return json_string_new_length(val->u.string.length, val->u.string.ptr);
+
+    case json_boolean:
+      return json_boolean_new(val->u.boolean);
+
+    default:
+      return json_null_new();
+  }
+}
+
+static void
+rpc_job_destroy(rpc_job_t *job) {
+  json_builder_free(job->params);
+  json_writer_clear(&job->writer);
+  btc_mutex_destroy(job->lock);
+  btc_free(job);
+}
+
+static void
+rpc_job_run(void *arg) {
+  /* Runs on an RPC worker. */
+  rpc_job_t *job = arg;
+  btc_rpc_t *rpc = job->rpc;
+  json_writer *w = &job->writer;
+  json_params params;
+  json_value *obj;
+  rpc_res_t rres;
+  int orphan;
+  int tag;
+
+  rpc_res_init(&rres);
+
+  rres.reader = btc_rpc_reader(rpc);
+
+  if (rres.reader != NULL) {
+    params.length = job->params->u.array.length;
+    params.values = job->params->u.array.values;
+    params.help = 0;
+
+    BTC_MEMTAG_PUSH(tag, BTC_MEMTAG_RPC);
+
+    btc_rpc_methods[job->index].handler(rpc, &params, &rres);
+
+    BTC_MEMTAG_POP(tag);
+
+    btc_rpc_unreader(rpc, rres.reader);
+
+    rres.reader = NULL;
+  } else {
+    rpc_res_error(&rres, RPC_DATABASE_ERROR, "Cannot open chain reader");
+  }
+
+  /* The response is written out whole: the loop only
+     copies it to the socket once we are done. */
+  if (rres.code == 0 && rres.stream != NULL) {
+    json_writer_object_begin(w);
+    json_writer_key(w, "result");
+
+    while (rres.stream(w, rres.arg))
+      ;
+
+    json_writer_key(w, "error");
+    json_writer_null(w);
+    json_writer_key(w, "id");
+    json_writer_integer(w, job->id);
+    json_writer_object_end(w);
+
+    rpc_res_unstream(&rres);
+  } else {
+    obj = rpc_res_encode(&rres, job->id);
+
+    json_writer_value(w, obj);
+
+    json_builder_free(obj);
+  }
+
+  btc_mutex_lock(job->lock);
+
+  job->done = 1;
+
+  orphan = job->orphan;
+
+  btc_mutex_unlock(job->lock);
+
+  /* The connection went away while we were running. */
+  if (orphan)
+    rpc_job_destroy(job);
+}
+
+static int
+rpc_job_pull(http_res_t *res, void *arg) {
+  /* Polled on every loop tick until done. */
+  rpc_job_t *job = arg;
+  int done;
+
+  btc_mutex_lock(job->lock);
+
+  done = job->done;
+
+  btc_mutex_unlock(job->lock);
+
+  if (!done)
+    return 1;
+
+  if (!http_res_chunk(res, job->writer.data, job->writer.length))
+    return -1;
+
+  if (!http_res_chunk(res, "\n", 1))
+    return -1;
+
+  return 0;
+}
+
+static void
+rpc_job_free(void *arg) {
+  rpc_job_t *job = arg;
+  int done;
+
+  btc_mutex_lock(job->lock);
+
+  done = job->done;
+
+  if (!done)
+    job->orphan = 1;
+
+  btc_mutex_unlock(job->lock);
+
+  /* Otherwise the worker frees it. */
+  if (done)
+    rpc_job_destroy(job);
+}
+
+static int
+btc_rpc_dispatch(btc_rpc_t *rpc, const rpc_req_t *req, http_res_t *res) {
+  /* Calls which only read the chain run on an RPC
+     worker, off the loop. Everything else (and any
+     error) is left to btc_rpc_handle. */
+  int index = btc_rpc_find_handler(req->method);
+  rpc_job_t *job;
+
+  if (rpc->workers == NULL || index < 0 || rpc->warmup != NULL)
+    return 0;
+
+  if (!(btc_rpc_methods[index].flags & RPC_WORKER))
+    return 0;
+
+  btc_rpc_log(rpc, "Incoming RPC request: %s.", req->method);
+
+  job = btc_malloc(sizeof(rpc_job_t));
+  job->rpc = rpc;
+  job->index = index;
+  job->params = rpc_value_clone(req->params);
+  job->id = req->id;
+  job->lock = btc_mutex_create();
+  job->done = 0;
+  job->orphan = 0;
+
+  json_writer_init(&job->writer, NULL, NULL);
+
+  btc_workers_add(rpc->workers, rpc_job_run, job);
+
+  http_res_stream(res, 200, "application/json",
+                  rpc_job_pull, rpc_job_free, job);
+
+  return 1;
+}
+
+static void
+btc_rpc_handle_batch(btc_rpc_t *rpc, const json_value *obj, http_res_t *res) {
+  rpc_batch_t *batch = rpc_batch_create(obj->u.array.length);
+  rpc_body_t *body;
+  rpc_req_t rreq;
+  rpc_res_t rres;
+  unsigned int i;
+
+  /* Calls run in order on the loop. Writing out
+     the responses is left to the body (and thus
+     the RPC workers, if any). */
+  for (i = 0; i < obj->u.array.length; i++) {
+    rpc_req_init(&rreq);
+    rpc_res_init(&rres);
+
+    if (!rpc_req_set(&rreq, obj->u.array.values[i]))
+      rpc_res_error(&rres, RPC_INVALID_REQUEST, "Invalid request");
+    else
+      btc_rpc_handle(rpc, &rreq, &rres);
+
+    batch->items[batch->length++] = rpc_res_encode(&rres, rreq.id);
+  }
+
+  rpc_res_init(&rres);
+  rpc_res_stream(&rres, rpc_batch_stream, rpc_batch_free, batch);
+
+  body = rpc_body_create(&rres, 0, 1, res, rpc->workers);
+
+  http_res_stream(res, 200, "application/json",
+                  rpc_body_pull, rpc_body_free, body);
 }
 
 static void
@@ -797,10 +4499,30 @@ static int
 on_request(http_server_t *server, http_req_t *req, http_res_t *res) {
   btc_rpc_t *rpc = server->data;
   json_settings settings;
+  json_arena arena;
   json_value *obj;
   rpc_req_t rreq;
   rpc_res_t rres;
 
+  if (req->method == HTTP_METHOD_GET && rpc->warmup != NULL) {
+    if (rpc->flags & (BTC_RPC_REST | BTC_RPC_METRICS)) {
+      http_res_error(res, 503);
+      return 1;
+    }
+  }
+
+  if (req->method == HTTP_METHOD_GET && (rpc->flags & BTC_RPC_REST)) {
+    if (btc_rest_handle(rpc, req, res))
+      return 1;
+  }
+
+  if (req->method == HTTP_METHOD_GET && (rpc->flags & BTC_RPC_METRICS)) {
+    if (req->path.length == 8 && memcmp(req->path.data, "/metrics", 8) == 0) {
+      btc_metrics_handle(rpc, res);
+      return 1;
+    }
+  }
+
   if (req->method != HTTP_METHOD_POST) {
     http_res_error(res, 400);
     return 1;
@@ -818,15 +4540,47 @@ on_request(http_server_t *server, http_req_t *req, http_res_t *res) {
 
   settings.settings = json_enable_amounts;
 
-  obj = json_parse_ex(&settings, req->body.data, req->body.length, NULL);
+  /* Parsed in place: large hex strings stay in
+     the body and the tree is freed all at once.
+     Nothing outlives the call but the response. */
+  obj = json_parse_insitu(&settings, &arena, req->body.data,
+                                             req->body.length, NULL);
+
+  /* An empty batch is an invalid request. */
+  if (obj != NULL && obj->type == json_array && obj->u.array.length > 0) {
+    btc_rpc_handle_batch(rpc, obj, res);
+    json_arena_free(&arena);
+    return 1;
+  }
 
-  if (!rpc_req_set(&rreq, obj))
+  if (!rpc_req_set(&rreq, obj)) {
     rpc_res_error(&rres, RPC_INVALID_REQUEST, "Invalid request");
-  else
+  } else if (btc_rpc_dispatch(rpc, &rreq, res)) {
+    json_arena_free(&arena);
+    return 1;
+  } else {
     btc_rpc_handle(rpc, &rreq, &rres);
+  }
+
+  json_arena_free(&arena);
+
+  if (rres.code == 0 && rres.wait != NULL) {
+    rpc_wait_t *wait = rpc_wait_create(&rres, rreq.id);
 
-  if (obj != NULL)
-    json_value_free(obj);
+    http_res_stream(res, 200, "application/json",
+                    rpc_wait_pull, rpc_wait_free, wait);
+
+    return 1;
+  }
+
+  if (rres.code == 0 && rres.stream != NULL) {
+    rpc_body_t *body = rpc_body_create(&rres, rreq.id, 0, res, rpc->workers);
+
+    http_res_stream(res, 200, "application/json",
+                    rpc_body_pull, rpc_body_free, body);
+
+    return 1;
+  }
 
   obj = rpc_res_encode(&rres, rreq.id);
 
@@ -850,6 +4604,11 @@ btc_rpc_call(btc_rpc_t *rpc, const char *method, const json_value *params) {
 
   if (index < 0) {
     rpc_res_error(&res, RPC_METHOD_NOT_FOUND, "Method not found");
+  } else if (rpc->warmup != NULL) {
+    rpc_res_error(&res, RPC_IN_WARMUP, rpc->warmup);
+  } else if ((btc_rpc_methods[index].flags & RPC_WRITES)
+             && (rpc->flags & BTC_CHAIN_READONLY)) {
+    rpc_res_error(&res, RPC_MISC_ERROR, "Not available on a read-only replica");
   } else if (params->type != json_array) {
     rpc_res_error(&res, RPC_INVALID_REQUEST, "Invalid request");
   } else {
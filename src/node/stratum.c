@@ -0,0 +1,925 @@
+/*!
+ * stratum.c - stratum server for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <io/core.h>
+#include <io/loop.h>
+
+#include <node/chain.h>
+#include <node/logger.h>
+#include <node/miner.h>
+#include <node/stratum.h>
+
+#include <mako/block.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/rand.h>
+#include <mako/encoding.h>
+#include <mako/entry.h>
+#include <mako/header.h>
+#include <mako/json.h>
+#include <mako/list.h>
+#include <mako/map.h>
+#include <mako/netaddr.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include <mako/vector.h>
+
+#include "../bio.h"
+#include "../impl.h"
+#include "../internal.h"
+
+/*
+ * Protocol
+ *
+ * Stratum v1: newline-delimited JSON-RPC over TCP.
+ *
+ * Each connection gets its own extranonce1, which
+ * fills the first half of the 8 byte extra nonce in
+ * the coinbase script (see btc_tmpl_coinbase). The
+ * miner rolls the second half (extranonce2).
+ */
+
+/*
+ * Constants
+ */
+
+/* Longest request line we accept. */
+#define STRATUM_MAX_LINE (16 << 10)
+
+/* Output queued for a client before we drop it. */
+#define STRATUM_MAX_BUFFER (1 << 20)
+
+/* Jobs kept around for late shares. */
+#define STRATUM_MAX_JOBS 8
+
+/* New transactions are picked up this often. */
+#define STRATUM_REFRESH (30 * 1000)
+
+/* Size of extranonce2. */
+#define STRATUM_NONCE2_SIZE 4
+
+enum stratum_error {
+  STRATUM_ERR_OTHER = 20,
+  STRATUM_ERR_STALE = 21,
+  STRATUM_ERR_DUPLICATE = 22,
+  STRATUM_ERR_LOW_DIFFICULTY = 23,
+  STRATUM_ERR_UNAUTHORIZED = 24,
+  STRATUM_ERR_UNSUBSCRIBED = 25
+};
+
+/*
+ * Types
+ */
+
+typedef struct btc_job_s {
+  uint32_t id;
+  btc_tmpl_t *tmpl;
+  uint8_t *branch;
+  size_t length;
+  char *coinb1;
+  char *coinb2;
+  btc_vector_t shares;
+  btc_hashset_t *seen;
+} btc_job_t;
+
+typedef struct btc_stratumconn_s {
+  btc_stratum_t *stratum;
+  btc_socket_t *socket;
+  uint32_t nonce1;
+  int subscribed;
+  int authorized;
+  char *buf;
+  size_t len;
+  struct btc_stratumconn_s *prev;
+  struct btc_stratumconn_s *next;
+} btc_stratumconn_t;
+
+typedef struct btc_stratumconns_s {
+  btc_stratumconn_t *head;
+  btc_stratumconn_t *tail;
+  size_t length;
+} btc_stratumconns_t;
+
+struct btc_stratum_s {
+  const btc_network_t *network;
+  btc_loop_t *loop;
+  btc_logger_t *logger;
+  btc_chain_t *chain;
+  btc_miner_t *miner;
+  btc_socket_t *server;
+  btc_stratumconns_t conns;
+  btc_sockaddr_t bind;
+  double difficulty;
+  double job_difficulty;
+  uint8_t share_target[32];
+  uint8_t block_target[32];
+  btc_vector_t jobs;
+  uint32_t job_id;
+  uint32_t nonce1;
+  int64_t last_job;
+  int64_t last_check;
+  int ticking;
+};
+
+/*
+ * Helpers
+ */
+
+static void
+stratum_target(uint8_t *target, double difficulty) {
+  /* target = (0xffff << 208) / difficulty */
+  double value = 65535.0 / difficulty;
+  int shift = 208;
+  uint64_t word;
+  int i;
+
+  memset(target, 0, 32);
+
+  while (value >= 18446744073709551616.0) {
+    value /= 256.0;
+    shift += 8;
+  }
+
+  /* Keep some precision for tiny targets. */
+  while (value < 72057594037927936.0 && shift >= 8) {
+    value *= 256.0;
+    shift -= 8;
+  }
+
+  word = (uint64_t)value;
+
+  for (i = 0; i < 8; i++) {
+    if (shift / 8 + i >= 32) {
+      if (word != 0)
+        memset(target, 0xff, 32);
+      break;
+    }
+
+    target[shift / 8 + i] = word & 0xff;
+    word >>= 8;
+  }
+}
+
+static json_value *
+json_hex32_new(uint32_t x) {
+  char str[9];
+
+  sprintf(str, "%08lx", (unsigned long)x);
+
+  return json_string_new_length(8, str);
+}
+
+static int
+json_hex32_get(uint32_t *z, const json_value *obj) {
+  uint8_t raw[4];
+
+  if (obj->type != json_string || obj->u.string.length != 8)
+    return 0;
+
+  if (!btc_base16_decode(raw, obj->u.string.ptr, 8))
+    return 0;
+
+  *z = btc_read32be(raw);
+
+  return 1;
+}
+
+static json_value *
+json_hex_new(const uint8_t *data, size_t length) {
+  char *str = btc_malloc(length * 2 + 1);
+
+  btc_base16_encode(str, data, length);
+
+  return json_string_new_nocopy(length * 2, str);
+}
+
+static json_value *
+json_prevhash_new(const uint8_t *hash) {
+  /* Stratum swaps each 32 bit word of the hash. */
+  uint8_t raw[32];
+  int i;
+
+  for (i = 0; i < 32; i += 4) {
+    raw[i + 0] = hash[i + 3];
+    raw[i + 1] = hash[i + 2];
+    raw[i + 2] = hash[i + 1];
+    raw[i + 3] = hash[i + 0];
+  }
+
+  return json_hex_new(raw, 32);
+}
+
+/*
+ * Job
+ */
+
+static btc_job_t *
+btc_job_create(uint32_t id, btc_tmpl_t *bt) {
+  btc_job_t *job = btc_malloc(sizeof(btc_job_t));
+  btc_tx_t *cb = btc_tmpl_coinbase(bt, 0, 0);
+  const btc_input_t *input = cb->inputs.items[0];
+  size_t size = btc_tx_base_size(cb);
+  uint8_t *raw = btc_malloc(size);
+  size_t pos;
+
+  btc_tx_base_write(raw, cb);
+
+  /* The extra nonce is the last push of the
+     coinbase script: [version][1][prevout][script]. */
+  pos = 4 + 1 + 36 + btc_size_size(input->script.length)
+      + input->script.length - 8;
+
+  CHECK(raw[pos - 1] == 8);
+
+  job->id = id;
+  job->tmpl = bt;
+  job->branch = btc_tmpl_branch(&job->length, bt);
+  job->coinb1 = btc_malloc(pos * 2 + 1);
+  job->coinb2 = btc_malloc((size - pos - 8) * 2 + 1);
+  job->seen = btc_hashset_create();
+
+  btc_base16_encode(job->coinb1, raw, pos);
+  btc_base16_encode(job->coinb2, raw + pos + 8, size - pos - 8);
+
+  btc_vector_init(&job->shares);
+
+  btc_free(raw);
+  btc_tx_destroy(cb);
+
+  return job;
+}
+
+static void
+btc_job_destroy(btc_job_t *job) {
+  size_t i;
+
+  for (i = 0; i < job->shares.length; i++)
+    btc_free(job->shares.items[i]);
+
+  btc_vector_clear(&job->shares);
+  btc_hashset_destroy(job->seen);
+  btc_tmpl_destroy(job->tmpl);
+  btc_free(job->branch);
+  btc_free(job->coinb1);
+  btc_free(job->coinb2);
+  btc_free(job);
+}
+
+static int
+btc_job_add_share(btc_job_t *job, const uint8_t *hash) {
+  uint8_t *share;
+
+  if (btc_hashset_has(job->seen, hash))
+    return 0;
+
+  share = btc_malloc(32);
+
+  btc_hash_copy(share, hash);
+  btc_hashset_put(job->seen, share);
+  btc_vector_push(&job->shares, share);
+
+  return 1;
+}
+
+static json_value *
+btc_job_notify(const btc_job_t *job, int clean) {
+  const btc_tmpl_t *bt = job->tmpl;
+  json_value *branch = json_array_new(job->length);
+  json_value *params = json_array_new(9);
+  json_value *obj = json_object_new(3);
+  size_t i;
+
+  for (i = 0; i < job->length; i++)
+    json_array_push(branch, json_hex_new(&job->branch[i * 32], 32));
+
+  json_array_push(params, json_hex32_new(job->id));
+  json_array_push(params, json_prevhash_new(bt->prev_block));
+  json_array_push(params, json_string_new(job->coinb1));
+  json_array_push(params, json_string_new(job->coinb2));
+  json_array_push(params, branch);
+  json_array_push(params, json_hex32_new(bt->version));
+  json_array_push(params, json_hex32_new(bt->bits));
+  json_array_push(params, json_hex32_new(bt->time));
+  json_array_push(params, json_boolean_new(clean));
+
+  json_object_push(obj, "id", json_null_new());
+  json_object_push(obj, "method", json_string_new("mining.notify"));
+  json_object_push(obj, "params", params);
+
+  return obj;
+}
+
+/*
+ * Connection
+ */
+
+static btc_stratumconn_t *
+btc_stratumconn_create(btc_stratum_t *stratum, btc_socket_t *socket) {
+  btc_stratumconn_t *conn = btc_malloc(sizeof(btc_stratumconn_t));
+
+  conn->stratum = stratum;
+  conn->socket = socket;
+  conn->nonce1 = 0;
+  conn->subscribed = 0;
+  conn->authorized = 0;
+  conn->buf = NULL;
+  conn->len = 0;
+  conn->prev = NULL;
+  conn->next = NULL;
+
+  return conn;
+}
+
+static void
+btc_stratumconn_destroy(btc_stratumconn_t *conn) {
+  if (conn->buf != NULL)
+    btc_free(conn->buf);
+
+  btc_free(conn);
+}
+
+static void
+btc_stratumconn_send(btc_stratumconn_t *conn, json_value *obj) {
+  char *data = json_encode(obj);
+  size_t length = strlen(data);
+
+  data[length++] = '\n';
+
+  /* Never buffer without bound for a slow miner. */
+  if (btc_socket_buffered(conn->socket) > STRATUM_MAX_BUFFER) {
+    btc_socket_close(conn->socket);
+    free(data);
+    return;
+  }
+
+  btc_socket_write(conn->socket, data, length);
+}
+
+static void
+btc_stratumconn_respond(btc_stratumconn_t *conn,
+                        json_value *id,
+                        json_value *result) {
+  json_value *obj = json_object_new(3);
+
+  json_object_push(obj, "id", id);
+  json_object_push(obj, "result", result);
+  json_object_push(obj, "error", json_null_new());
+
+  btc_stratumconn_send(conn, obj);
+
+  json_builder_free(obj);
+}
+
+static void
+btc_stratumconn_error(btc_stratumconn_t *conn,
+                      json_value *id,
+                      int code,
+                      const char *msg) {
+  json_value *obj = json_object_new(3);
+  json_value *err = json_array_new(3);
+
+  json_array_push(err, json_integer_new(code));
+  json_array_push(err, json_string_new(msg));
+  json_array_push(err, json_null_new());
+
+  json_object_push(obj, "id", id);
+  json_object_push(obj, "result", json_null_new());
+  json_object_push(obj, "error", err);
+
+  btc_stratumconn_send(conn, obj);
+
+  json_builder_free(obj);
+}
+
+static void
+btc_stratumconn_difficulty(btc_stratumconn_t *conn) {
+  btc_stratum_t *stratum = conn->stratum;
+  json_value *obj = json_object_new(3);
+  json_value *params = json_array_new(1);
+
+  json_array_push(params, json_double_new(stratum->job_difficulty));
+
+  json_object_push(obj, "id", json_null_new());
+  json_object_push(obj, "method", json_string_new("mining.set_difficulty"));
+  json_object_push(obj, "params", params);
+
+  btc_stratumconn_send(conn, obj);
+
+  json_builder_free(obj);
+}
+
+/*
+ * Stratum
+ */
+
+btc_stratum_t *
+btc_stratum_create(const btc_network_t *network,
+                   btc_loop_t *loop,
+                   btc_chain_t *chain,
+                   btc_miner_t *miner) {
+  btc_stratum_t *stratum = btc_malloc(sizeof(btc_stratum_t));
+
+  memset(stratum, 0, sizeof(*stratum));
+
+  stratum->network = network;
+  stratum->loop = loop;
+  stratum->logger = NULL;
+  stratum->chain = chain;
+  stratum->miner = miner;
+  stratum->server = NULL;
+  stratum->difficulty = 1.0;
+  stratum->nonce1 = btc_random();
+
+  btc_list_init(&stratum->conns);
+  btc_sockaddr_init(&stratum->bind);
+  btc_vector_init(&stratum->jobs);
+
+  return stratum;
+}
+
+static void
+btc_stratum_clear_jobs(btc_stratum_t *stratum) {
+  size_t i;
+
+  for (i = 0; i < stratum->jobs.length; i++)
+    btc_job_destroy(stratum->jobs.items[i]);
+
+  btc_vector_reset(&stratum->jobs);
+}
+
+void
+btc_stratum_destroy(btc_stratum_t *stratum) {
+  btc_stratum_clear_jobs(stratum);
+  btc_vector_clear(&stratum->jobs);
+  btc_free(stratum);
+}
+
+void
+btc_stratum_set_logger(btc_stratum_t *stratum, btc_logger_t *logger) {
+  stratum->logger = logger;
+}
+
+void
+btc_stratum_set_bind(btc_stratum_t *stratum, const btc_netaddr_t *addr) {
+  btc_netaddr_get_sockaddr(&stratum->bind, addr);
+}
+
+void
+btc_stratum_set_difficulty(btc_stratum_t *stratum, double difficulty) {
+  if (difficulty > 0.0)
+    stratum->difficulty = difficulty;
+}
+
+static void
+btc_stratum_log(btc_stratum_t *stratum, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_write(stratum->logger, "stratum", fmt, ap);
+  va_end(ap);
+}
+
+static btc_job_t *
+btc_stratum_job(btc_stratum_t *stratum) {
+  if (stratum->jobs.length == 0)
+    return NULL;
+
+  return btc_vector_top(&stratum->jobs);
+}
+
+static btc_job_t *
+btc_stratum_find(btc_stratum_t *stratum, uint32_t id) {
+  size_t i;
+
+  for (i = 0; i < stratum->jobs.length; i++) {
+    btc_job_t *job = stratum->jobs.items[i];
+
+    if (job->id == id)
+      return job;
+  }
+
+  return NULL;
+}
+
+static void
+btc_stratum_refresh(btc_stratum_t *stratum, int clean) {
+  btc_tmpl_t *bt = btc_miner_template(stratum->miner);
+  double difficulty = stratum->difficulty;
+  btc_vector_t *jobs = &stratum->jobs;
+  btc_stratumconn_t *conn;
+  btc_job_t *job;
+  json_value *msg;
+  int changed;
+
+  if (clean)
+    btc_stratum_clear_jobs(stratum);
+
+  if (jobs->length == STRATUM_MAX_JOBS) {
+    btc_job_destroy(jobs->items[0]);
+
+    memmove(jobs->items, jobs->items + 1,
+            (jobs->length - 1) * sizeof(void *));
+
+    jobs->length--;
+  }
+
+  job = btc_job_create(++stratum->job_id, bt);
+
+  btc_vector_push(&stratum->jobs, job);
+
+  stratum->last_job = btc_time_msec();
+
+  /* Shares are never harder than blocks. */
+  CHECK(btc_compact_export(stratum->block_target, bt->bits));
+
+  stratum_target(stratum->share_target, difficulty);
+
+  if (btc_hash_compare(stratum->block_target, stratum->share_target) > 0) {
+    btc_hash_copy(stratum->share_target, stratum->block_target);
+    difficulty = btc_difficulty(bt->bits);
+  }
+
+  changed = (difficulty != stratum->job_difficulty);
+
+  stratum->job_difficulty = difficulty;
+
+  msg = btc_job_notify(job, clean);
+
+  for (conn = stratum->conns.head; conn != NULL; conn = conn->next) {
+    if (!conn->subscribed)
+      continue;
+
+    if (changed)
+      btc_stratumconn_difficulty(conn);
+
+    btc_stratumconn_send(conn, msg);
+  }
+
+  json_builder_free(msg);
+}
+
+static void
+on_tick(void *arg) {
+  btc_stratum_t *stratum = arg;
+  const btc_entry_t *tip = btc_chain_tip(stratum->chain);
+  int64_t now = btc_time_msec();
+  btc_job_t *job;
+
+  if (now < stratum->last_check + 100)
+    return;
+
+  stratum->last_check = now;
+
+  job = btc_stratum_job(stratum);
+
+  /* Nobody to hand work to yet. */
+  if (job == NULL)
+    return;
+
+  if (!btc_hash_equal(job->tmpl->prev_block, tip->hash)) {
+    btc_stratum_refresh(stratum, 1);
+    return;
+  }
+
+  if (now >= stratum->last_job + STRATUM_REFRESH)
+    btc_stratum_refresh(stratum, 0);
+}
+
+static void
+btc_stratum_subscribe(btc_stratum_t *stratum,
+                      btc_stratumconn_t *conn,
+                      json_value *id) {
+  json_value *result = json_array_new(3);
+  json_value *subs = json_array_new(2);
+  json_value *sub;
+  uint8_t nonce1[4];
+  char subid[9];
+  btc_job_t *job;
+  json_value *msg;
+
+  if (!conn->subscribed)
+    conn->nonce1 = stratum->nonce1++;
+
+  btc_write32be(nonce1, conn->nonce1);
+
+  sprintf(subid, "%08lx", (unsigned long)conn->nonce1);
+
+  sub = json_array_new(2);
+  json_array_push(sub, json_string_new("mining.set_difficulty"));
+  json_array_push(sub, json_string_new(subid));
+  json_array_push(subs, sub);
+
+  sub = json_array_new(2);
+  json_array_push(sub, json_string_new("mining.notify"));
+  json_array_push(sub, json_string_new(subid));
+  json_array_push(subs, sub);
+
+  json_array_push(result, subs);
+  json_array_push(result, json_hex_new(nonce1, 4));
+  json_array_push(result, json_integer_new(STRATUM_NONCE2_SIZE));
+
+  btc_stratumconn_respond(conn, id, result);
+
+  /* Work is only assembled once someone asks. */
+  if (btc_stratum_job(stratum) == NULL)
+    btc_stratum_refresh(stratum, 1);
+
+  job = btc_stratum_job(stratum);
+  msg = btc_job_notify(job, 1);
+
+  conn->subscribed = 1;
+
+  btc_stratumconn_difficulty(conn);
+  btc_stratumconn_send(conn, msg);
+
+  json_builder_free(msg);
+}
+
+static void
+btc_stratum_submit(btc_stratum_t *stratum,
+                   btc_stratumconn_t *conn,
+                   const json_value *params,
+                   json_value *id) {
+  uint32_t job_id, nonce2, time, nonce;
+  btc_blockproof_t proof;
+  uint8_t root[32];
+  uint8_t hash[32];
+  const btc_tmpl_t *bt;
+  btc_header_t hdr;
+  btc_job_t *job;
+
+  if (!conn->subscribed) {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_UNSUBSCRIBED,
+                                    "Not subscribed");
+    return;
+  }
+
+  if (!conn->authorized) {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_UNAUTHORIZED,
+                                    "Unauthorized worker");
+    return;
+  }
+
+  if (params->u.array.length < 5
+      || !json_hex32_get(&job_id, params->u.array.values[1])
+      || !json_hex32_get(&nonce2, params->u.array.values[2])
+      || !json_hex32_get(&time, params->u.array.values[3])
+      || !json_hex32_get(&nonce, params->u.array.values[4])) {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_OTHER, "Invalid parameters");
+    return;
+  }
+
+  job = btc_stratum_find(stratum, job_id);
+
+  if (job == NULL) {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_STALE, "Job not found");
+    return;
+  }
+
+  bt = job->tmpl;
+
+  if ((int64_t)time <= bt->mtp || (int64_t)time > btc_now() + 2 * 60 * 60) {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_OTHER, "Time out of range");
+    return;
+  }
+
+  btc_tmpl_root(root, bt, conn->nonce1, nonce2);
+  btc_tmpl_header(&hdr, bt, root, time, nonce);
+  btc_header_hash(hash, &hdr);
+
+  if (btc_hash_compare(hash, stratum->share_target) > 0
+      && btc_hash_compare(hash, stratum->block_target) > 0) {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_LOW_DIFFICULTY,
+                                    "Low difficulty share");
+    return;
+  }
+
+  if (!btc_job_add_share(job, hash)) {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_DUPLICATE, "Duplicate share");
+    return;
+  }
+
+  if (btc_tmpl_prove(&proof, bt, conn->nonce1, nonce2, time, nonce)) {
+    btc_block_t *block = btc_tmpl_commit(bt, &proof);
+
+    btc_stratum_log(stratum, "Block found by %s: %H.",
+                    params->u.array.values[0]->type == json_string
+                      ? params->u.array.values[0]->u.string.ptr
+                      : "unknown",
+                    proof.hash);
+
+    if (!btc_chain_add(stratum->chain, block, BTC_BLOCK_DEFAULT_FLAGS, 0)) {
+      const btc_verify_error_t *err = btc_chain_error(stratum->chain);
+
+      btc_stratum_log(stratum, "Block rejected: %s.", err->reason);
+    }
+
+    btc_block_destroy(block);
+  }
+
+  btc_stratumconn_respond(conn, id, json_boolean_new(1));
+}
+
+static json_value *
+json_id_new(const json_value *id) {
+  if (id == NULL)
+    return json_null_new();
+
+  if (id->type == json_integer)
+    return json_integer_new(id->u.integer);
+
+  if (id->type == json_string)
+    return json_string_new_length(id->u.string.length, id->u.string.ptr);
+
+  return json_null_new();
+}
+
+static int
+btc_stratum_handle(btc_stratum_t *stratum,
+                   btc_stratumconn_t *conn,
+                   const char *line,
+                   size_t length) {
+  const json_value *method, *params;
+  json_value *obj, *id;
+  const char *name;
+
+  obj = json_decode(line, length);
+
+  if (obj == NULL || obj->type != json_object) {
+    if (obj != NULL)
+      json_builder_free(obj);
+    return 0;
+  }
+
+  method = json_object_get(obj, "method");
+  params = json_object_get(obj, "params");
+  id = json_id_new(json_object_get(obj, "id"));
+
+  if (method == NULL || method->type != json_string
+      || params == NULL || params->type != json_array) {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_OTHER, "Invalid request");
+    json_builder_free(obj);
+    return 1;
+  }
+
+  name = method->u.string.ptr;
+
+  if (strcmp(name, "mining.subscribe") == 0) {
+    btc_stratum_subscribe(stratum, conn, id);
+  } else if (strcmp(name, "mining.authorize") == 0) {
+    conn->authorized = 1;
+    btc_stratumconn_respond(conn, id, json_boolean_new(1));
+  } else if (strcmp(name, "mining.submit") == 0) {
+    btc_stratum_submit(stratum, conn, params, id);
+  } else {
+    btc_stratumconn_error(conn, id, STRATUM_ERR_OTHER, "Method not found");
+  }
+
+  json_builder_free(obj);
+
+  return 1;
+}
+
+static int
+on_conn_data(btc_socket_t *socket, const void *data, size_t size) {
+  btc_stratumconn_t *conn = btc_socket_get_data(socket);
+  btc_stratum_t *stratum = conn->stratum;
+  size_t start = 0;
+  size_t i;
+
+  if (conn->len + size > STRATUM_MAX_LINE) {
+    btc_socket_close(socket);
+    return 1;
+  }
+
+  conn->buf = btc_realloc(conn->buf, conn->len + size);
+
+  memcpy(conn->buf + conn->len, data, size);
+
+  conn->len += size;
+
+  for (i = 0; i < conn->len; i++) {
+    size_t end = i;
+
+    if (conn->buf[i] != '\n')
+      continue;
+
+    if (end > start && conn->buf[end - 1] == '\r')
+      end--;
+
+    if (end > start) {
+      if (!btc_stratum_handle(stratum, conn, conn->buf + start,
+                                             end - start)) {
+        btc_socket_close(socket);
+        return 1;
+      }
+    }
+
+    start = i + 1;
+  }
+
+  memmove(conn->buf, conn->buf + start, conn->len - start);
+
+  conn->len -= start;
+
+  return 1;
+}
+
+static void
+on_conn_close(btc_socket_t *socket) {
+  btc_stratumconn_t *conn = btc_socket_get_data(socket);
+  btc_stratum_t *stratum = conn->stratum;
+
+  btc_list_remove(&stratum->conns, conn, btc_stratumconn_t);
+
+  btc_stratumconn_destroy(conn);
+}
+
+static void
+on_conn_error(btc_socket_t *socket) {
+  btc_socket_close(socket);
+}
+
+static void
+on_socket(btc_socket_t *server, btc_socket_t *socket) {
+  btc_stratum_t *stratum = btc_socket_get_data(server);
+  btc_stratumconn_t *conn = btc_stratumconn_create(stratum, socket);
+
+  btc_socket_set_nodelay(socket, 1);
+  btc_socket_set_data(socket, conn);
+  btc_socket_on_data(socket, on_conn_data);
+  btc_socket_on_close(socket, on_conn_close);
+  btc_socket_on_error(socket, on_conn_error);
+
+  btc_list_push(&stratum->conns, conn, btc_stratumconn_t);
+}
+
+static void
+on_server_close(btc_socket_t *socket) {
+  btc_stratum_t *stratum = btc_socket_get_data(socket);
+  stratum->server = NULL;
+}
+
+int
+btc_stratum_open(btc_stratum_t *stratum, unsigned int flags) {
+  if (!(flags & BTC_STRATUM_LISTEN))
+    return 1;
+
+  btc_stratum_log(stratum, "Opening stratum server.");
+
+  if (stratum->bind.port == 0) {
+    btc_stratum_log(stratum, "No port given for stratum.");
+    return 0;
+  }
+
+  stratum->server = btc_loop_listen(stratum->loop, &stratum->bind);
+
+  if (stratum->server == NULL) {
+    const char *msg = btc_loop_strerror(stratum->loop);
+
+    btc_stratum_log(stratum, "Could not listen on %S: %s.",
+                    &stratum->bind, msg);
+
+    return 0;
+  }
+
+  btc_socket_set_data(stratum->server, stratum);
+  btc_socket_on_socket(stratum->server, on_socket);
+  btc_socket_on_close(stratum->server, on_server_close);
+
+  btc_loop_on_tick(stratum->loop, on_tick, stratum);
+
+  stratum->ticking = 1;
+
+  btc_stratum_log(stratum, "Stratum listening on %S.", &stratum->bind);
+
+  return 1;
+}
+
+void
+btc_stratum_close(btc_stratum_t *stratum) {
+  btc_stratumconn_t *conn;
+
+  if (stratum->server != NULL)
+    btc_stratum_log(stratum, "Closing stratum server.");
+
+  if (stratum->ticking)
+    btc_loop_off_tick(stratum->loop, on_tick, stratum);
+
+  stratum->ticking = 0;
+
+  if (stratum->server != NULL)
+    btc_socket_close(stratum->server);
+
+  for (conn = stratum->conns.head; conn != NULL; conn = conn->next)
+    btc_socket_close(conn->socket);
+
+  btc_stratum_clear_jobs(stratum);
+}
@@ -44,7 +44,7 @@ btc_outpoint_set(btc_outpoint_t *z, const uint8_t *hash, uint32_t index) {
 
 uint32_t
 btc_outpoint_hash(const btc_outpoint_t *x) {
-  return btc_murmur3_sum(x->hash, 32, x->index ^ 0xfba4c795);
+  return btc_hash_key(x->hash, x->index);
 }
 
 int
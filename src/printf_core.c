@@ -16,20 +16,81 @@
 #include "printf_core.h"
 
 /*
- * Base16
+ * Tables
  */
 
-static const char *base16_charset = "0123456789abcdef";
+static const char base16_charset[] = "0123456789abcdef";
+
+static const char base16_pairs[256][2] = {
+  "00", "01", "02", "03", "04", "05", "06", "07", "08", "09", "0a", "0b",
+  "0c", "0d", "0e", "0f", "10", "11", "12", "13", "14", "15", "16", "17",
+  "18", "19", "1a", "1b", "1c", "1d", "1e", "1f", "20", "21", "22", "23",
+  "24", "25", "26", "27", "28", "29", "2a", "2b", "2c", "2d", "2e", "2f",
+  "30", "31", "32", "33", "34", "35", "36", "37", "38", "39", "3a", "3b",
+  "3c", "3d", "3e", "3f", "40", "41", "42", "43", "44", "45", "46", "47",
+  "48", "49", "4a", "4b", "4c", "4d", "4e", "4f", "50", "51", "52", "53",
+  "54", "55", "56", "57", "58", "59", "5a", "5b", "5c", "5d", "5e", "5f",
+  "60", "61", "62", "63", "64", "65", "66", "67", "68", "69", "6a", "6b",
+  "6c", "6d", "6e", "6f", "70", "71", "72", "73", "74", "75", "76", "77",
+  "78", "79", "7a", "7b", "7c", "7d", "7e", "7f", "80", "81", "82", "83",
+  "84", "85", "86", "87", "88", "89", "8a", "8b", "8c", "8d", "8e", "8f",
+  "90", "91", "92", "93", "94", "95", "96", "97", "98", "99", "9a", "9b",
+  "9c", "9d", "9e", "9f", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+  "a8", "a9", "aa", "ab", "ac", "ad", "ae", "af", "b0", "b1", "b2", "b3",
+  "b4", "b5", "b6", "b7", "b8", "b9", "ba", "bb", "bc", "bd", "be", "bf",
+  "c0", "c1", "c2", "c3", "c4", "c5", "c6", "c7", "c8", "c9", "ca", "cb",
+  "cc", "cd", "ce", "cf", "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+  "d8", "d9", "da", "db", "dc", "dd", "de", "df", "e0", "e1", "e2", "e3",
+  "e4", "e5", "e6", "e7", "e8", "e9", "ea", "eb", "ec", "ed", "ee", "ef",
+  "f0", "f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8", "f9", "fa", "fb",
+  "fc", "fd", "fe", "ff"
+};
+
+static const char digit_pairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+#define DIGIT_POW_COUNT 20
+
+static const unsigned long long digit_pow[DIGIT_POW_COUNT] = {
+  1ull,
+  10ull,
+  100ull,
+  1000ull,
+  10000ull,
+  100000ull,
+  1000000ull,
+  10000000ull,
+  100000000ull,
+  1000000000ull,
+  10000000000ull,
+  100000000000ull,
+  1000000000000ull,
+  10000000000000ull,
+  100000000000000ull,
+  1000000000000000ull,
+  10000000000000000ull,
+  100000000000000000ull,
+  1000000000000000000ull,
+  10000000000000000000ull
+};
+
+/*
+ * Base16
+ */
 
 static size_t
 base16_encode(char *zp, const unsigned char *xp, size_t xn) {
   size_t zn = xn * 2;
 
   while (xn--) {
-    int ch = *xp++;
+    const char *pair = base16_pairs[*xp++];
 
-    *zp++ = base16_charset[ch >> 4];
-    *zp++ = base16_charset[ch & 15];
+    *zp++ = pair[0];
+    *zp++ = pair[1];
   }
 
   *zp = '\0';
@@ -44,10 +105,10 @@ base16le_encode(char *zp, const unsigned char *xp, size_t xn) {
   xp += xn;
 
   while (xn--) {
-    int ch = *--xp;
+    const char *pair = base16_pairs[*--xp];
 
-    *zp++ = base16_charset[ch >> 4];
-    *zp++ = base16_charset[ch & 15];
+    *zp++ = pair[0];
+    *zp++ = pair[1];
   }
 
   *zp = '\0';
@@ -59,26 +120,6 @@ base16le_encode(char *zp, const unsigned char *xp, size_t xn) {
  * State
  */
 
-static void
-state_puts(state_t *st, const char *xp) {
-  size_t xn;
-
-  if (xp == NULL)
-    xp = "(null)";
-
-  xn = strlen(xp);
-
-  if (st->flags & PRINTF_PRECISION) {
-    if (xn > (size_t)st->prec)
-      xn = st->prec;
-
-    if (xn == 0)
-      return;
-  }
-
-  st->write(st, xp, xn);
-}
-
 static void
 state_raw(state_t *st, const unsigned char *xp, size_t xn) {
   char zp[1024 + 1];
@@ -108,6 +149,37 @@ state_grow(state_t *st, size_t n) {
     state_flush(st);
 }
 
+static void
+state_puts(state_t *st, const char *xp) {
+  size_t xn;
+
+  if (xp == NULL)
+    xp = "(null)";
+
+  xn = strlen(xp);
+
+  if (st->flags & PRINTF_PRECISION) {
+    if (xn > (size_t)st->prec)
+      xn = st->prec;
+
+    if (xn == 0)
+      return;
+  }
+
+  /* Short strings (most of a log line) are
+     batched with the rest of the output. */
+  if (xn <= sizeof(st->buf) / 4) {
+    state_grow(st, xn);
+    memcpy(st->ptr, xp, xn);
+    st->ptr += xn;
+    return;
+  }
+
+  state_flush(st);
+
+  st->write(st, xp, xn);
+}
+
 static void
 state_need(state_t *st, size_t n) {
   if (st->flags & PRINTF_PRECISION) {
@@ -133,27 +205,45 @@ state_need(state_t *st, size_t n) {
 
 static int
 btc_uint_size(unsigned long long x) {
-  int n = 0;
+  int n = 1;
 
-  do {
+  while (n < DIGIT_POW_COUNT && x >= digit_pow[n])
     n++;
-    x /= 10;
-  } while (x != 0);
 
   return n;
 }
 
+static void
+btc_uint_fill(char *zp, int n, unsigned long long x) {
+  /* Two digits per division, from the end. Any
+     room left over (precision) is zero-filled. */
+  while (x >= 100) {
+    const char *pair = &digit_pairs[(x % 100) * 2];
+
+    zp[--n] = pair[1];
+    zp[--n] = pair[0];
+
+    x /= 100;
+  }
+
+  if (x >= 10) {
+    zp[--n] = digit_pairs[x * 2 + 1];
+    zp[--n] = digit_pairs[x * 2 + 0];
+  } else {
+    zp[--n] = '0' + (int)x;
+  }
+
+  while (n > 0)
+    zp[--n] = '0';
+}
+
 static int
 btc_uint_write(char *zp, unsigned long long x) {
   int n = btc_uint_size(x);
-  int i;
 
-  zp[n] = '\0';
+  btc_uint_fill(zp, n, x);
 
-  for (i = n - 1; i >= 0; i--) {
-    zp[i] = '0' + (int)(x % 10);
-    x /= 10;
-  }
+  zp[n] = '\0';
 
   return n;
 }
@@ -161,19 +251,15 @@ btc_uint_write(char *zp, unsigned long long x) {
 static int
 btc_unsigned(char *zp, unsigned long long x, const state_t *st) {
   int n = btc_uint_size(x);
-  int i;
 
   if (st->flags & PRINTF_PRECISION) {
     if (n < st->prec)
       n = st->prec;
   }
 
-  zp[n] = '\0';
+  btc_uint_fill(zp, n, x);
 
-  for (i = n - 1; i >= 0; i--) {
-    zp[i] = '0' + (int)(x % 10);
-    x /= 10;
-  }
+  zp[n] = '\0';
 
   return n;
 }
@@ -361,8 +447,26 @@ btc_date(char *zp, int64_t x) {
 
   y += (m <= 2);
 
-  return btc_sprintf(zp, "%.4u-%.2u-%.2uT%.2u:%.2u:%.2uZ",
-                         y, m, d, hr, min, sec);
+  /* Same as "%.4u-%.2u-%.2uT%.2u:%.2u:%.2uZ". */
+  if (y < 0 || y > 9999)
+    return btc_sprintf(zp, "%.4u-%.2u-%.2uT%.2u:%.2u:%.2uZ",
+                           y, m, d, hr, min, sec);
+
+  btc_uint_fill(zp + 0, 4, y);
+  zp[4] = '-';
+  btc_uint_fill(zp + 5, 2, m);
+  zp[7] = '-';
+  btc_uint_fill(zp + 8, 2, d);
+  zp[10] = 'T';
+  btc_uint_fill(zp + 11, 2, hr);
+  zp[13] = ':';
+  btc_uint_fill(zp + 14, 2, min);
+  zp[16] = ':';
+  btc_uint_fill(zp + 17, 2, sec);
+  zp[19] = 'Z';
+  zp[20] = '\0';
+
+  return 20;
 }
 
 static int
@@ -438,6 +542,20 @@ clamp16(int x) {
  * Core
  */
 
+/* GCC's format attribute cannot describe our
+   conversions (%H, %v, %N...), so bad formats
+   are caught at runtime in debug builds. */
+#ifdef BTC_DEBUG
+#  define PRINTF_INVALID(ch) printf_invalid(ch)
+static void
+printf_invalid(int ch) {
+  fprintf(stderr, "printf: invalid conversion `%c'.\n", ch);
+  abort();
+}
+#else
+#  define PRINTF_INVALID(ch) (void)(ch)
+#endif
+
 int
 btc_printf_core(state_t *st, const char *fmt, va_list ap) {
   while (*fmt) {
@@ -573,7 +691,6 @@ btc_printf_core(state_t *st, const char *fmt, va_list ap) {
             break;
           }
           case 's': {
-            state_flush(st);
             state_puts(st, va_arg(ap, char *));
             st->state = PRINTF_STATE_NONE;
             break;
@@ -589,7 +706,6 @@ btc_printf_core(state_t *st, const char *fmt, va_list ap) {
             break;
           }
           case 'm': {
-            state_flush(st);
             state_puts(st, strerror(errno));
             st->state = PRINTF_STATE_NONE;
             break;
@@ -702,6 +818,7 @@ btc_printf_core(state_t *st, const char *fmt, va_list ap) {
             break;
           }
           default: {
+            PRINTF_INVALID(ch);
             st->state = PRINTF_STATE_NONE;
             break;
           }
@@ -751,6 +868,7 @@ btc_printf_core(state_t *st, const char *fmt, va_list ap) {
             break;
           }
           default: {
+            PRINTF_INVALID(ch);
             st->state = PRINTF_STATE_NONE;
             break;
           }
@@ -796,6 +914,7 @@ btc_printf_core(state_t *st, const char *fmt, va_list ap) {
             break;
           }
           default: {
+            PRINTF_INVALID(ch);
             st->state = PRINTF_STATE_NONE;
             break;
           }
@@ -845,6 +964,7 @@ btc_printf_core(state_t *st, const char *fmt, va_list ap) {
             break;
           }
           default: {
+            PRINTF_INVALID(ch);
             st->state = PRINTF_STATE_NONE;
             break;
           }
@@ -890,6 +1010,7 @@ btc_printf_core(state_t *st, const char *fmt, va_list ap) {
             break;
           }
           default: {
+            PRINTF_INVALID(ch);
             st->state = PRINTF_STATE_NONE;
             break;
           }
@@ -944,6 +1065,7 @@ btc_printf_core(state_t *st, const char *fmt, va_list ap) {
             break;
           }
           default: {
+            PRINTF_INVALID(ch);
             st->state = PRINTF_STATE_NONE;
             break;
           }
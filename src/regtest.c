@@ -111,6 +111,15 @@ static const btc_network_t regtest = {
     /* .length = */ lengthof(regtest_checkpoints)
   },
   /* .last_checkpoint = */ 0,
+  /* .assume_valid = */ {
+    0,
+    {
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    }
+  },
   /* .halving_interval = */ 150,
   /* .genesis = */ {
     /* .hash = */ {
@@ -215,6 +224,15 @@ static const btc_network_t regtest = {
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
       }
+    },
+    /* .taproot = */ {
+      -1,
+      {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+      }
     }
   },
   /* .activation_threshold = */ 108, /* 75% for testchains */
@@ -227,7 +245,8 @@ static const btc_network_t regtest = {
     /* .data = */ NULL,
     /* .alloc = */ 0,
     /* .length = */ 0,
-    /* ._refs = */ 0
+    /* ._refs = */ 0,
+    /* .small = */ {0}
   },
   /* .key = */ {
     /* .privkey = */ 0xef,
@@ -17,6 +17,7 @@
 #include <mako/policy.h>
 #include <mako/script.h>
 #include <mako/tx.h>
+#include <mako/util.h>
 #include <mako/vector.h>
 #include "impl.h"
 #include "internal.h"
@@ -92,11 +93,179 @@ btc_scriptnum_import(const uint8_t *xp, size_t xn) {
   return z;
 }
 
+/*
+ * Stack Item Pool
+ */
+
+/* Stack items are recycled through a per-thread
+ * pool. Every pooled item is an ordinary heap
+ * buffer owning exactly BTC_STACK_ITEM_SIZE bytes,
+ * so an item released through btc_buffer_destroy
+ * (or on another thread) is still freed correctly.
+ * Items larger than that are never recycled.
+ *
+ * The arrays backing the interpreter's stacks are
+ * cached the same way. Once a worker thread has
+ * warmed up, executing a script does not touch the
+ * heap for pushes of up to BTC_STACK_ITEM_SIZE bytes.
+ *
+ * The pool is released by a pthread key destructor
+ * when its thread exits; without pthreads (or TLS)
+ * items are simply allocated and freed as before.
+ */
+
+#define BTC_STACK_ITEM_SIZE 80
+#define BTC_STACK_POOL_ITEMS 256
+#define BTC_STACK_POOL_STACKS 4
+
+#if defined(BTC_TLS) && defined(BTC_HAVE_PTHREAD)
+#  define BTC_STACK_POOL
+#  include <pthread.h>
+#endif
+
+#ifdef BTC_STACK_POOL
+
+typedef struct btc_stackpool_s {
+  btc_buffer_t *items[BTC_STACK_POOL_ITEMS];
+  size_t length;
+  btc_stack_t stacks[BTC_STACK_POOL_STACKS];
+  size_t count;
+} btc_stackpool_t;
+
+static pthread_key_t stack_key;
+static pthread_once_t stack_once = PTHREAD_ONCE_INIT;
+static BTC_TLS btc_stackpool_t *stack_pool;
+
+static void
+stack_pool_destroy(void *ptr) {
+  btc_stackpool_t *pool = ptr;
+  size_t i;
+
+  for (i = 0; i < pool->length; i++)
+    btc_buffer_destroy(pool->items[i]);
+
+  for (i = 0; i < pool->count; i++)
+    btc_free(pool->stacks[i].items);
+
+  btc_free(pool);
+
+  stack_pool = NULL;
+}
+
+static void
+stack_pool_setup(void) {
+  if (pthread_key_create(&stack_key, stack_pool_destroy) != 0)
+    btc_abort(); /* LCOV_EXCL_LINE */
+}
+
+static btc_stackpool_t *
+stack_pool_get(void) {
+  if (stack_pool == NULL) {
+    if (pthread_once(&stack_once, stack_pool_setup) != 0)
+      btc_abort(); /* LCOV_EXCL_LINE */
+
+    stack_pool = btc_malloc(sizeof(btc_stackpool_t));
+    stack_pool->length = 0;
+    stack_pool->count = 0;
+
+    if (pthread_setspecific(stack_key, stack_pool) != 0)
+      btc_abort(); /* LCOV_EXCL_LINE */
+  }
+
+  return stack_pool;
+}
+
+#endif /* BTC_STACK_POOL */
+
+typedef btc_buffer_t btc_stackitem_t;
+
+#define btc_stackitem_create btc_buffer_create
+#define btc_stackitem_clone btc_buffer_clone
+#define btc_stackitem_size btc_buffer_size
+#define btc_stackitem_write btc_buffer_write
+#define btc_stackitem_read btc_buffer_read
+#define btc_stackitem_update btc_buffer_update
+
+static btc_buffer_t *
+btc_stackitem_alloc(size_t length) {
+  btc_buffer_t *item;
+
+  if (length > BTC_STACK_ITEM_SIZE) {
+    item = btc_buffer_create();
+    btc_buffer_grow(item, length);
+    return item;
+  }
+
+#ifdef BTC_STACK_POOL
+  {
+    btc_stackpool_t *pool = stack_pool_get();
+
+    if (pool->length > 0)
+      return pool->items[--pool->length];
+  }
+#endif
+
+  item = btc_buffer_create();
+
+  btc_buffer_grow(item, BTC_STACK_ITEM_SIZE);
+
+  return item;
+}
+
+static void
+btc_stackitem_destroy(btc_buffer_t *item) {
+#ifdef BTC_STACK_POOL
+  if (item->_refs == 1 && item->alloc == BTC_STACK_ITEM_SIZE) {
+    btc_stackpool_t *pool = stack_pool_get();
+
+    if (pool->length < BTC_STACK_POOL_ITEMS) {
+      item->length = 0;
+      pool->items[pool->length++] = item;
+      return;
+    }
+  }
+#endif
+
+  btc_buffer_destroy(item);
+}
+
 /*
  * Stack
  */
 
-DEFINE_HASHABLE_VECTOR(btc_stack, btc_buffer, SCOPE_EXTERN)
+DEFINE_HASHABLE_VECTOR(btc_stack, btc_stackitem, SCOPE_EXTERN)
+
+static void
+btc_stack_open(btc_stack_t *stack) {
+  btc_stack_init(stack);
+
+#ifdef BTC_STACK_POOL
+  {
+    btc_stackpool_t *pool = stack_pool_get();
+
+    if (pool->count > 0)
+      *stack = pool->stacks[--pool->count];
+  }
+#endif
+}
+
+static void
+btc_stack_close(btc_stack_t *stack) {
+#ifdef BTC_STACK_POOL
+  if (stack->alloc > 0) {
+    btc_stackpool_t *pool = stack_pool_get();
+
+    if (pool->count < BTC_STACK_POOL_STACKS) {
+      btc_stack_reset(stack);
+      pool->stacks[pool->count++] = *stack;
+      btc_stack_init(stack);
+      return;
+    }
+  }
+#endif
+
+  btc_stack_clear(stack);
+}
 
 void
 btc_stack_assign(btc_stack_t *z, const btc_stack_t *x) {
@@ -180,23 +349,29 @@ btc_stack_get_bool(const btc_stack_t *stack, int index) {
 
 void
 btc_stack_push_data(btc_stack_t *stack, const uint8_t *data, size_t length) {
-  btc_buffer_t *item = btc_buffer_create();
+  btc_buffer_t *item = btc_stackitem_alloc(length);
   btc_buffer_set(item, data, length);
   btc_stack_push(stack, item);
 }
 
 static void
 btc_stack_push_rodata(btc_stack_t *stack, const uint8_t *data, size_t length) {
-  btc_buffer_t *item = btc_buffer_create();
+  btc_buffer_t *item;
+
+  /* Copying a small push is cheaper than allocating. */
+  if (length <= BTC_STACK_ITEM_SIZE) {
+    btc_stack_push_data(stack, data, length);
+    return;
+  }
+
+  item = btc_buffer_create();
   btc_buffer_roset(item, data, length);
   btc_stack_push(stack, item);
 }
 
 void
 btc_stack_push_num(btc_stack_t *stack, int64_t num) {
-  btc_buffer_t *item = btc_buffer_create();
-
-  btc_buffer_grow(item, 9);
+  btc_buffer_t *item = btc_stackitem_alloc(9);
 
   item->length = btc_scriptnum_export(item->data, num);
 
@@ -205,7 +380,7 @@ btc_stack_push_num(btc_stack_t *stack, int64_t num) {
 
 void
 btc_stack_push_bool(btc_stack_t *stack, int value) {
-  btc_buffer_t *item = btc_buffer_create();
+  btc_buffer_t *item = btc_stackitem_alloc(1);
 
   if (value)
     btc_buffer_resize(item, 1)[0] = 1;
@@ -213,17 +388,6 @@ btc_stack_push_bool(btc_stack_t *stack, int value) {
   btc_stack_push(stack, item);
 }
 
-static void
-btc_stack_push_robool(btc_stack_t *stack, int value) {
-  static const uint8_t one[1] = {1};
-  btc_buffer_t *item = btc_buffer_create();
-
-  if (value)
-    btc_buffer_roset(item, one, 1);
-
-  btc_stack_push(stack, item);
-}
-
 static void
 btc_stack_insert(btc_stack_t *stack, int index, btc_buffer_t *item) {
   size_t i;
@@ -396,6 +560,20 @@ btc_opcode_is_branch(const btc_opcode_t *x) {
   return x->value >= BTC_OP_IF && x->value <= BTC_OP_ENDIF;
 }
 
+static int
+btc_opcode_is_success(const btc_opcode_t *x) {
+  /* [BIP342] "Specification". */
+  int op = x->value;
+
+  return op == 80 || op == 98
+      || (op >= 126 && op <= 129)
+      || (op >= 131 && op <= 134)
+      || (op >= 137 && op <= 138)
+      || (op >= 141 && op <= 142)
+      || (op >= 149 && op <= 153)
+      || (op >= 187 && op <= 254);
+}
+
 static int
 btc_opcode_is_key(const btc_opcode_t *op) {
   if (op->length == 33)
@@ -1584,7 +1762,10 @@ validate_key(const btc_buffer_t *key, unsigned int flags, int version) {
 }
 
 static int
-checksig(const uint8_t *msg, const btc_buffer_t *sig, const btc_buffer_t *key) {
+checksig(const uint8_t *msg,
+         const btc_buffer_t *sig,
+         const btc_buffer_t *key,
+         btc_tx_cache_t *cache) {
   uint8_t tmp[64];
 
   if (sig->length == 0)
@@ -1596,20 +1777,143 @@ checksig(const uint8_t *msg, const btc_buffer_t *sig, const btc_buffer_t *key) {
   if (!btc_ecdsa_sig_normalize(tmp, tmp))
     return 0;
 
+  /* The caller only passes a cache when a failing
+     signature would fail the script (NULLFAIL). */
+  if (cache != NULL && cache->batch != NULL && key->length <= 65) {
+    btc_sigbatch_push_ecdsa(cache->batch, msg, tmp, key->data, key->length);
+    return 1;
+  }
+
   return btc_ecdsa_verify(msg, 32, tmp, key->data, key->length);
 }
 
-#define THROW(x) do { err = (x); goto done; } while (0)
+/*
+ * Taproot
+ */
 
-int
-btc_script_execute(const btc_script_t *script,
-                   btc_stack_t *stack,
+typedef struct btc_tapexec_s {
+  const btc_script_t *output;
+  const uint8_t *annex;
+  const uint8_t *leaf;
+  uint8_t annex_hash[32];
+  uint8_t leaf_hash[32];
+  uint32_t codesep;
+  int64_t weight;
+} btc_tapexec_t;
+
+static void
+btc_tapexec_init(btc_tapexec_t *tap, const btc_script_t *output) {
+  tap->output = output;
+  tap->annex = NULL;
+  tap->leaf = NULL;
+  tap->codesep = 0xffffffff;
+  tap->weight = 0;
+}
+
+static int
+checksig_schnorr(const uint8_t *msg,
+                 const uint8_t *sig,
+                 const uint8_t *key,
+                 btc_tx_cache_t *cache) {
+  /* A failing signature fails the entire script in
+     taproot, so verification can be deferred. */
+  if (cache != NULL && cache->batch != NULL) {
+    btc_sigbatch_push(cache->batch, msg, sig, key);
+    return 1;
+  }
+
+  return btc_bip340_verify(msg, 32, sig, key);
+}
+
+static int
+verify_schnorr(const btc_buffer_t *sig,
+               const uint8_t *key,
+               const btc_tx_t *tx,
+               size_t index,
+               int64_t value,
+               const btc_tapexec_t *tap,
+               btc_tx_cache_t *cache) {
+  uint8_t hash[32];
+  int type = 0;
+
+  if (sig->length == 65) {
+    type = sig->data[64];
+
+    if (type == 0)
+      return BTC_SCRIPT_ERR_SCHNORR_SIG_HASHTYPE;
+  } else if (sig->length != 64) {
+    return BTC_SCRIPT_ERR_SCHNORR_SIG_SIZE;
+  }
+
+  if (!btc_tx_sighash_taproot(hash, tx, index, tap->output, value, type,
+                              tap->annex, tap->leaf, tap->codesep, cache)) {
+    return BTC_SCRIPT_ERR_SCHNORR_SIG_HASHTYPE;
+  }
+
+  if (!checksig_schnorr(hash, sig->data, key, cache))
+    return BTC_SCRIPT_ERR_SCHNORR_SIG;
+
+  return BTC_SCRIPT_ERR_OK;
+}
+
+static int
+checksig_tapscript(int *res,
+                   const btc_buffer_t *sig,
+                   const btc_buffer_t *key,
                    unsigned int flags,
                    const btc_tx_t *tx,
                    size_t index,
                    int64_t value,
-                   int version,
+                   btc_tapexec_t *tap,
                    btc_tx_cache_t *cache) {
+  /* [BIP342] "Rules for signature opcodes". */
+  int success = (sig->length > 0);
+  int err;
+
+  if (success) {
+    tap->weight -= 50;
+
+    if (tap->weight < 0)
+      return BTC_SCRIPT_ERR_TAPSCRIPT_VALIDATION_WEIGHT;
+  }
+
+  if (key->length == 0)
+    return BTC_SCRIPT_ERR_PUBKEYTYPE;
+
+  if (key->length == 32) {
+    if (success) {
+      err = verify_schnorr(sig, key->data, tx, index, value, tap, cache);
+
+      if (err != BTC_SCRIPT_ERR_OK)
+        return err;
+    }
+  } else {
+    if (flags & BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_PUBKEYTYPE)
+      return BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_PUBKEYTYPE;
+  }
+
+  *res = success;
+
+  return BTC_SCRIPT_ERR_OK;
+}
+
+#define THROW(x) do { err = (x); goto done; } while (0)
+
+static int
+btc_script_execute_internal(const btc_script_t *script,
+                            btc_stack_t *stack,
+                            unsigned int flags,
+                            const btc_tx_t *tx,
+                            size_t index,
+                            int64_t value,
+                            int version,
+                            btc_tx_cache_t *cache,
+                            btc_tapexec_t *tap,
+                            const btc_opvec_t *ops) {
+  /* Versions: 0 = legacy, 1 = segwit v0, 2 = tapscript.
+     If `ops` is non-null it must be `script` decoded. */
+  uint32_t position = (uint32_t)-1;
+  size_t cursor = 0;
   int err = BTC_SCRIPT_ERR_OK;
   int opcount = 0;
   int negate = 0;
@@ -1622,7 +1926,9 @@ btc_script_execute(const btc_script_t *script,
   btc_script_t subscript;
   btc_opcode_t op;
 
-  if (script->length > BTC_MAX_SCRIPT_SIZE)
+  CHECK(version != 2 || tap != NULL);
+
+  if (version <= 1 && script->length > BTC_MAX_SCRIPT_SIZE)
     return BTC_SCRIPT_ERR_SCRIPT_SIZE;
 
   if (flags & BTC_SCRIPT_VERIFY_MINIMALDATA)
@@ -1635,13 +1941,26 @@ btc_script_execute(const btc_script_t *script,
   btc_reader_init(&begin, script);
 
   while (reader.length > 0) {
-    if (!btc_reader_next(&op, &reader))
+    if (ops != NULL) {
+      /* Decoding stopped short at a parse error. */
+      if (cursor == ops->length)
+        THROW(BTC_SCRIPT_ERR_BAD_OPCODE);
+
+      op = ops->items[cursor++];
+
+      /* Keep the reader in step for OP_CODESEPARATOR. */
+      reader.data += btc_opcode_size(&op);
+      reader.length -= btc_opcode_size(&op);
+    } else if (!btc_reader_next(&op, &reader)) {
       THROW(BTC_SCRIPT_ERR_BAD_OPCODE);
+    }
+
+    position += 1;
 
     if (op.length > BTC_MAX_SCRIPT_PUSH)
       THROW(BTC_SCRIPT_ERR_PUSH_SIZE);
 
-    if (op.value > BTC_OP_16 && ++opcount > BTC_MAX_SCRIPT_OPS)
+    if (version <= 1 && op.value > BTC_OP_16 && ++opcount > BTC_MAX_SCRIPT_OPS)
       THROW(BTC_SCRIPT_ERR_OP_COUNT);
 
     if (btc_opcode_is_disabled(&op))
@@ -1776,6 +2095,17 @@ btc_script_execute(const btc_script_t *script,
               THROW(BTC_SCRIPT_ERR_MINIMALIF);
           }
 
+          /* Consensus in tapscript. */
+          if (version == 2) {
+            const btc_buffer_t *item = btc_stack_get(stack, -1);
+
+            if (item->length > 1)
+              THROW(BTC_SCRIPT_ERR_TAPSCRIPT_MINIMALIF);
+
+            if (item->length == 1 && item->data[0] != 1)
+              THROW(BTC_SCRIPT_ERR_TAPSCRIPT_MINIMALIF);
+          }
+
           val = btc_stack_get_bool(stack, -1);
 
           if (op.value == BTC_OP_NOTIF)
@@ -1966,7 +2296,7 @@ btc_script_execute(const btc_script_t *script,
 
         val = btc_stack_remove(stack, -2);
 
-        btc_buffer_destroy(val);
+        btc_stackitem_destroy(val);
 
         break;
       }
@@ -2064,7 +2394,7 @@ btc_script_execute(const btc_script_t *script,
         btc_stack_drop(stack);
         btc_stack_drop(stack);
 
-        btc_stack_push_robool(stack, res);
+        btc_stack_push_bool(stack, res);
 
         if (op.value == BTC_OP_EQUALVERIFY) {
           if (!res)
@@ -2224,7 +2554,7 @@ btc_script_execute(const btc_script_t *script,
         btc_stack_drop(stack);
         btc_stack_drop(stack);
 
-        btc_stack_push_robool(stack, val);
+        btc_stack_push_bool(stack, val);
 
         break;
       }
@@ -2311,6 +2641,10 @@ btc_script_execute(const btc_script_t *script,
       case BTC_OP_CODESEPARATOR: {
         begin.data = reader.data;
         begin.length = reader.length;
+
+        if (version == 2)
+          tap->codesep = position;
+
         break;
       }
       case BTC_OP_CHECKSIG:
@@ -2328,6 +2662,29 @@ btc_script_execute(const btc_script_t *script,
         sig = btc_stack_get(stack, -2);
         key = btc_stack_get(stack, -1);
 
+        if (version == 2) {
+          res = 0;
+
+          if ((err = checksig_tapscript(&res, sig, key, flags,
+                                        tx, index, value, tap, cache))) {
+            goto done;
+          }
+
+          btc_stack_drop(stack);
+          btc_stack_drop(stack);
+
+          btc_stack_push_bool(stack, res);
+
+          if (op.value == BTC_OP_CHECKSIGVERIFY) {
+            if (!res)
+              THROW(BTC_SCRIPT_ERR_CHECKSIGVERIFY);
+
+            btc_stack_drop(stack);
+          }
+
+          break;
+        }
+
         btc_script_set(&subscript, begin.data, begin.length);
 
         if (version == 0)
@@ -2347,7 +2704,11 @@ btc_script_execute(const btc_script_t *script,
           btc_tx_sighash(hash, tx, index, &subscript,
                          value, type, version, cache);
 
-          res = checksig(hash, sig, key);
+          /* Deferrable only when failure is fatal. */
+          if (flags & BTC_SCRIPT_VERIFY_NULLFAIL)
+            res = checksig(hash, sig, key, cache);
+          else
+            res = checksig(hash, sig, key, NULL);
         }
 
         if (!res && (flags & BTC_SCRIPT_VERIFY_NULLFAIL)) {
@@ -2358,7 +2719,7 @@ btc_script_execute(const btc_script_t *script,
         btc_stack_drop(stack);
         btc_stack_drop(stack);
 
-        btc_stack_push_robool(stack, res);
+        btc_stack_push_bool(stack, res);
 
         if (op.value == BTC_OP_CHECKSIGVERIFY) {
           if (!res)
@@ -2369,6 +2730,36 @@ btc_script_execute(const btc_script_t *script,
 
         break;
       }
+      case BTC_OP_CHECKSIGADD: {
+        const btc_buffer_t *sig, *key;
+        int64_t num;
+        int res = 0;
+
+        if (version != 2)
+          THROW(BTC_SCRIPT_ERR_BAD_OPCODE);
+
+        if (stack->length < 3)
+          THROW(BTC_SCRIPT_ERR_INVALID_STACK_OPERATION);
+
+        sig = btc_stack_get(stack, -3);
+        key = btc_stack_get(stack, -1);
+
+        if (!btc_stack_get_num(&num, stack, -2, minimal, 4))
+          THROW(BTC_SCRIPT_ERR_UNKNOWN_ERROR);
+
+        if ((err = checksig_tapscript(&res, sig, key, flags,
+                                      tx, index, value, tap, cache))) {
+          goto done;
+        }
+
+        btc_stack_drop(stack);
+        btc_stack_drop(stack);
+        btc_stack_drop(stack);
+
+        btc_stack_push_num(stack, num + res);
+
+        break;
+      }
       case BTC_OP_CHECKMULTISIG:
       case BTC_OP_CHECKMULTISIGVERIFY: {
         int i, j, m, n, okey, ikey, isig;
@@ -2376,6 +2767,9 @@ btc_script_execute(const btc_script_t *script,
         uint8_t hash[32];
         int res, type;
 
+        if (version == 2)
+          THROW(BTC_SCRIPT_ERR_TAPSCRIPT_CHECKMULTISIG);
+
         if (tx == NULL)
           THROW(BTC_SCRIPT_ERR_UNKNOWN_ERROR);
 
@@ -2443,7 +2837,7 @@ btc_script_execute(const btc_script_t *script,
             btc_tx_sighash(hash, tx, index, &subscript,
                            value, type, version, cache);
 
-            if (checksig(hash, sig, key)) {
+            if (checksig(hash, sig, key, NULL)) {
               isig += 1;
               m -= 1;
             }
@@ -2479,7 +2873,7 @@ btc_script_execute(const btc_script_t *script,
         }
 
         btc_stack_drop(stack);
-        btc_stack_push_robool(stack, res);
+        btc_stack_push_bool(stack, res);
 
         if (op.value == BTC_OP_CHECKMULTISIGVERIFY) {
           if (!res)
@@ -2509,52 +2903,242 @@ done:
   return err;
 }
 
+int
+btc_script_execute(const btc_script_t *script,
+                   btc_stack_t *stack,
+                   unsigned int flags,
+                   const btc_tx_t *tx,
+                   size_t index,
+                   int64_t value,
+                   int version,
+                   btc_tx_cache_t *cache) {
+  return btc_script_execute_internal(script, stack, flags, tx, index,
+                                     value, version, cache, NULL, NULL);
+}
+
 static int
-btc_script_verify_program(const btc_stack_t *witness,
+btc_script_execute_tapscript(const btc_script_t *script,
+                             btc_stack_t *stack,
+                             unsigned int flags,
+                             const btc_tx_t *tx,
+                             size_t index,
+                             int64_t value,
+                             btc_tapexec_t *tap,
+                             btc_tx_cache_t *cache) {
+  btc_reader_t reader;
+  btc_opcode_t op;
+  size_t i;
+  int err;
+
+  /* OP_SUCCESSx overrides everything, including parse errors
+     which occur _after_ it and the stack element size limits. */
+  btc_reader_init(&reader, script);
+
+  while (reader.length > 0) {
+    if (!btc_reader_next(&op, &reader))
+      return BTC_SCRIPT_ERR_BAD_OPCODE;
+
+    if (btc_opcode_is_success(&op)) {
+      if (flags & BTC_SCRIPT_VERIFY_DISCOURAGE_OP_SUCCESS)
+        return BTC_SCRIPT_ERR_DISCOURAGE_OP_SUCCESS;
+
+      return BTC_SCRIPT_ERR_OK;
+    }
+  }
+
+  /* Tapscript enforces initial stack size limits. */
+  if (stack->length > BTC_MAX_SCRIPT_STACK)
+    return BTC_SCRIPT_ERR_STACK_SIZE;
+
+  for (i = 0; i < stack->length; i++) {
+    if (stack->items[i]->length > BTC_MAX_SCRIPT_PUSH)
+      return BTC_SCRIPT_ERR_PUSH_SIZE;
+  }
+
+  if ((err = btc_script_execute_internal(script, stack, flags, tx,
+                                         index, value, 2, cache, tap,
+                                         NULL))) {
+    return err;
+  }
+
+  /* Implicit cleanstack. */
+  if (stack->length != 1)
+    return BTC_SCRIPT_ERR_CLEANSTACK;
+
+  if (!btc_stack_get_bool(stack, -1))
+    return BTC_SCRIPT_ERR_EVAL_FALSE;
+
+  return BTC_SCRIPT_ERR_OK;
+}
+
+static int
+btc_script_verify_taproot(const btc_stack_t *witness,
                           const btc_script_t *output,
+                          const uint8_t *key,
                           unsigned int flags,
                           const btc_tx_t *tx,
                           size_t index,
                           int64_t value,
                           btc_tx_cache_t *cache) {
-  int err = BTC_SCRIPT_ERR_OK;
-  btc_script_t *redeem = NULL;
-  btc_program_t program;
+  /* [BIP341] "Script validation rules". */
+  const btc_buffer_t *control, *annex;
+  const btc_script_t *script;
+  size_t length = witness->length;
+  btc_hash256_t ctx;
+  btc_tapexec_t tap;
   btc_stack_t stack;
   uint8_t hash[32];
-  size_t i;
+  size_t i, nodes;
+  int version, err;
 
-  CHECK((flags & BTC_SCRIPT_VERIFY_WITNESS) != 0);
-  CHECK(btc_script_get_program(&program, output));
+  if (length == 0)
+    return BTC_SCRIPT_ERR_WITNESS_PROGRAM_WITNESS_EMPTY;
 
-  btc_stack_init(&stack);
-  btc_stack_assign(&stack, witness);
+  btc_tapexec_init(&tap, output);
 
-  if (program.version == 0) {
-    if (program.length == 32) {
-      if (stack.length == 0)
-        THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_WITNESS_EMPTY);
+  /* Strip the annex. */
+  if (length >= 2) {
+    annex = witness->items[length - 1];
 
-      redeem = btc_stack_pop(&stack);
+    if (annex->length > 0 && annex->data[0] == 0x50) {
+      btc_sha256_init(&ctx);
+      btc_buffer_update(&ctx, annex);
+      btc_sha256_final(&ctx, tap.annex_hash);
 
-      btc_sha256(hash, redeem->data, redeem->length);
+      tap.annex = tap.annex_hash;
 
-      if (memcmp(hash, program.data, 32) != 0)
-        THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH);
-    } else if (program.length == 20) {
-      if (stack.length != 2)
-        THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH);
+      length -= 1;
+    }
+  }
 
-      redeem = btc_script_create();
+  /* Key path spend. */
+  if (length == 1)
+    return verify_schnorr(witness->items[0], key, tx, index, value, &tap, cache);
 
-      btc_script_set_p2pkh(redeem, program.data);
+  /* Script path spend. */
+  control = witness->items[length - 1];
+  script = witness->items[length - 2];
+
+  if (control->length < 33 || control->length > 33 + 128 * 32)
+    return BTC_SCRIPT_ERR_TAPROOT_WRONG_CONTROL_SIZE;
+
+  if ((control->length - 33) % 32 != 0)
+    return BTC_SCRIPT_ERR_TAPROOT_WRONG_CONTROL_SIZE;
+
+  version = control->data[0] & 0xfe;
+  nodes = (control->length - 33) / 32;
+
+  btc_tagged_init(&ctx, "TapLeaf");
+  btc_uint8_update(&ctx, version);
+  btc_script_update(&ctx, script);
+  btc_sha256_final(&ctx, tap.leaf_hash);
+
+  tap.leaf = tap.leaf_hash;
+
+  /* Walk the merkle path up to the root. */
+  memcpy(hash, tap.leaf_hash, 32);
+
+  for (i = 0; i < nodes; i++) {
+    const uint8_t *node = control->data + 33 + i * 32;
+
+    btc_tagged_init(&ctx, "TapBranch");
+
+    if (memcmp(hash, node, 32) < 0) {
+      btc_raw_update(&ctx, hash, 32);
+      btc_raw_update(&ctx, node, 32);
     } else {
-      THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_WRONG_LENGTH);
+      btc_raw_update(&ctx, node, 32);
+      btc_raw_update(&ctx, hash, 32);
     }
-  } else {
-    if (flags & BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM)
-      THROW(BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM);
-    goto done;
+
+    btc_sha256_final(&ctx, hash);
+  }
+
+  btc_tagged_init(&ctx, "TapTweak");
+  btc_raw_update(&ctx, control->data + 1, 32);
+  btc_raw_update(&ctx, hash, 32);
+  btc_sha256_final(&ctx, hash);
+
+  if (!btc_bip340_pubkey_tweak_add_check(control->data + 1, hash, key,
+                                         control->data[0] & 1)) {
+    return BTC_SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH;
+  }
+
+  if (version != 0xc0) {
+    if (flags & BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION)
+      return BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION;
+
+    return BTC_SCRIPT_ERR_OK;
+  }
+
+  /* Tapscript (leaf version 0xc0). */
+  tap.weight = (int64_t)btc_stack_size(witness) + 50;
+
+  btc_stack_open(&stack);
+  btc_stack_assign(&stack, witness);
+  btc_stack_resize(&stack, length - 2);
+
+  err = btc_script_execute_tapscript(script, &stack, flags,
+                                     tx, index, value, &tap, cache);
+
+  btc_stack_close(&stack);
+
+  return err;
+}
+
+static int
+btc_script_verify_program(const btc_stack_t *witness,
+                          const btc_script_t *output,
+                          unsigned int flags,
+                          const btc_tx_t *tx,
+                          size_t index,
+                          int64_t value,
+                          int p2sh,
+                          btc_tx_cache_t *cache) {
+  int err = BTC_SCRIPT_ERR_OK;
+  btc_script_t *redeem = NULL;
+  btc_program_t program;
+  btc_stack_t stack;
+  uint8_t hash[32];
+  size_t i;
+
+  CHECK((flags & BTC_SCRIPT_VERIFY_WITNESS) != 0);
+  CHECK(btc_script_get_program(&program, output));
+
+  btc_stack_open(&stack);
+  btc_stack_assign(&stack, witness);
+
+  if (program.version == 0) {
+    if (program.length == 32) {
+      if (stack.length == 0)
+        THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_WITNESS_EMPTY);
+
+      redeem = btc_stack_pop(&stack);
+
+      btc_sha256(hash, redeem->data, redeem->length);
+
+      if (memcmp(hash, program.data, 32) != 0)
+        THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH);
+    } else if (program.length == 20) {
+      if (stack.length != 2)
+        THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH);
+
+      redeem = btc_script_create();
+
+      btc_script_set_p2pkh(redeem, program.data);
+    } else {
+      THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_WRONG_LENGTH);
+    }
+  } else if (program.version == 1 && program.length == 32 && !p2sh) {
+    if (flags & BTC_SCRIPT_VERIFY_TAPROOT) {
+      err = btc_script_verify_taproot(witness, output, program.data, flags,
+                                      tx, index, value, cache);
+    }
+    goto done;
+  } else {
+    if (flags & BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM)
+      THROW(BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM);
+    goto done;
   }
 
   /* Witnesses still have push limits. */
@@ -2574,12 +3158,256 @@ btc_script_verify_program(const btc_stack_t *witness,
     THROW(BTC_SCRIPT_ERR_EVAL_FALSE);
 
 done:
-  btc_stack_clear(&stack);
+  btc_stack_close(&stack);
   if (redeem != NULL)
-    btc_script_destroy(redeem);
+    btc_stackitem_destroy(redeem);
   return err;
 }
 
+static int
+btc_script_verify_p2pkh(const btc_buffer_t *sig,
+                        const btc_buffer_t *key,
+                        const btc_script_t *code,
+                        unsigned int flags,
+                        const btc_tx_t *tx,
+                        size_t index,
+                        int64_t value,
+                        int version,
+                        btc_tx_cache_t *cache) {
+  /**
+   * Equivalent to executing `code` (a canonically
+   * encoded pay-to-pubkey-hash script) against a
+   * stack of [sig, key] and requiring a true result.
+   *
+   * The caller guarantees that OP_CHECKSIG's
+   * find-and-delete is a no-op for this signature.
+   */
+  uint8_t hash[32];
+  int res = 0;
+  int err;
+
+  btc_hash160(hash, key->data, key->length);
+
+  if (memcmp(hash, code->data + 3, 20) != 0)
+    return BTC_SCRIPT_ERR_EQUALVERIFY;
+
+  if (tx == NULL)
+    return BTC_SCRIPT_ERR_UNKNOWN_ERROR;
+
+  if ((err = validate_signature(sig, flags)))
+    return err;
+
+  if ((err = validate_key(key, flags, version)))
+    return err;
+
+  if (sig->length > 0) {
+    int type = sig->data[sig->length - 1];
+
+    btc_tx_sighash(hash, tx, index, code, value, type, version, cache);
+
+    /* Deferrable only when failure is fatal. */
+    if (flags & BTC_SCRIPT_VERIFY_NULLFAIL)
+      res = checksig(hash, sig, key, cache);
+    else
+      res = checksig(hash, sig, key, NULL);
+  }
+
+  if (!res && (flags & BTC_SCRIPT_VERIFY_NULLFAIL)) {
+    if (sig->length != 0)
+      return BTC_SCRIPT_ERR_SIG_NULLFAIL;
+  }
+
+  if (!res)
+    return BTC_SCRIPT_ERR_EVAL_FALSE;
+
+  return BTC_SCRIPT_ERR_OK;
+}
+
+static int
+btc_script_verify_p2wpkh(const btc_stack_t *witness,
+                         const uint8_t *hash,
+                         unsigned int flags,
+                         const btc_tx_t *tx,
+                         size_t index,
+                         int64_t value,
+                         btc_tx_cache_t *cache) {
+  const btc_buffer_t *sig, *key;
+  btc_script_t code;
+  uint8_t raw[25];
+
+  if (witness->length != 2)
+    return -1;
+
+  sig = witness->items[0];
+  key = witness->items[1];
+
+  if (sig->length > BTC_MAX_SCRIPT_PUSH || key->length > BTC_MAX_SCRIPT_PUSH)
+    return -1;
+
+  raw[0] = BTC_OP_DUP;
+  raw[1] = BTC_OP_HASH160;
+  raw[2] = 20;
+
+  memcpy(raw + 3, hash, 20);
+
+  raw[23] = BTC_OP_EQUALVERIFY;
+  raw[24] = BTC_OP_CHECKSIG;
+
+  btc_script_init(&code);
+  btc_script_roset(&code, raw, sizeof(raw));
+
+  return btc_script_verify_p2pkh(sig, key, &code, flags,
+                                 tx, index, value, 1, cache);
+}
+
+static int
+is_truthy(const uint8_t *xp, size_t xn) {
+  size_t i;
+
+  for (i = 0; i < xn; i++) {
+    if (xp[i] != 0)
+      return i != xn - 1 || xp[i] != 0x80;
+  }
+
+  return 0;
+}
+
+static int
+btc_script_verify_standard(const btc_script_t *input,
+                           const btc_stack_t *witness,
+                           const btc_script_t *output,
+                           const btc_tx_t *tx,
+                           size_t index,
+                           int64_t value,
+                           unsigned int flags,
+                           btc_tx_cache_t *cache) {
+  /**
+   * Fast paths for P2PKH, P2WPKH, and P2SH-P2WPKH.
+   *
+   * These produce exactly the result the general
+   * interpreter would, without building a stack.
+   * Returns -1 if the spend is not one we handle,
+   * in which case the caller falls back to the
+   * interpreter (this includes every spend which
+   * would fail before reaching OP_CHECKSIG for a
+   * reason other than a hash mismatch).
+   */
+  if ((flags & BTC_SCRIPT_VERIFY_CLEANSTACK)
+      && !(flags & BTC_SCRIPT_VERIFY_P2SH)) {
+    return -1;
+  }
+
+  if ((flags & BTC_SCRIPT_VERIFY_WITNESS)
+      && !(flags & BTC_SCRIPT_VERIFY_P2SH)) {
+    return -1;
+  }
+
+  if (output->length == 25 && output->data[2] == 20
+                           && btc_script_is_p2pkh(output)) {
+    const uint8_t *xp = input->data;
+    size_t xn = input->length;
+    btc_opcode_t op1, op2;
+    btc_buffer_t sig, key;
+
+    if (witness->length > 0 && (flags & BTC_SCRIPT_VERIFY_WITNESS))
+      return -1;
+
+    if (!btc_opcode_read(&op1, &xp, &xn) || op1.value > BTC_OP_PUSHDATA4)
+      return -1;
+
+    if (!btc_opcode_read(&op2, &xp, &xn) || op2.value > BTC_OP_PUSHDATA4)
+      return -1;
+
+    if (xn != 0)
+      return -1;
+
+    if (op1.length > BTC_MAX_SCRIPT_PUSH || op2.length > BTC_MAX_SCRIPT_PUSH)
+      return -1;
+
+    if (flags & BTC_SCRIPT_VERIFY_MINIMALDATA) {
+      if (!btc_opcode_is_minimal(&op1) || !btc_opcode_is_minimal(&op2))
+        return -1;
+    }
+
+    /* OP_CHECKSIG would find-and-delete the hash push. */
+    if (op1.length == 20)
+      return -1;
+
+    btc_buffer_init(&sig);
+    btc_buffer_init(&key);
+    btc_buffer_roset(&sig, op1.data, op1.length);
+    btc_buffer_roset(&key, op2.data, op2.length);
+
+    return btc_script_verify_p2pkh(&sig, &key, output, flags,
+                                   tx, index, value, 0, cache);
+  }
+
+  if (!(flags & BTC_SCRIPT_VERIFY_WITNESS))
+    return -1;
+
+  if (btc_script_is_p2wpkh(output)) {
+    if (input->length != 0)
+      return -1;
+
+    if (!is_truthy(output->data + 2, 20))
+      return -1;
+
+    return btc_script_verify_p2wpkh(witness, output->data + 2, flags,
+                                    tx, index, value, cache);
+  }
+
+  if (btc_script_is_p2sh(output)) {
+    uint8_t hash[20];
+
+    /* Must be exactly one minimal push of `OP_0 <20>`. */
+    if (input->length != 23 || input->data[0] != 22)
+      return -1;
+
+    if (input->data[1] != BTC_OP_0 || input->data[2] != 20)
+      return -1;
+
+    btc_hash160(hash, input->data + 1, 22);
+
+    if (memcmp(hash, output->data + 2, 20) != 0)
+      return -1;
+
+    if (!is_truthy(input->data + 3, 20))
+      return -1;
+
+    return btc_script_verify_p2wpkh(witness, input->data + 3, flags,
+                                    tx, index, value, cache);
+  }
+
+  return -1;
+}
+
+static const btc_opvec_t *
+btc_script_decoded(const btc_script_t *input,
+                   const btc_tx_t *tx,
+                   size_t index,
+                   const btc_tx_cache_t *cache) {
+  /* The precomputed form of the tx's own input script. */
+  if (cache == NULL || cache->scripts == NULL || tx == NULL)
+    return NULL;
+
+  if (index >= tx->inputs.length)
+    return NULL;
+
+  if (input != &tx->inputs.items[index]->script)
+    return NULL;
+
+  return &cache->scripts[index];
+}
+
+static int
+btc_script_is_push_only_decoded(const btc_script_t *script,
+                                const btc_opvec_t *ops) {
+  if (ops != NULL)
+    return btc_opvec_is_push_only(ops);
+
+  return btc_script_is_push_only(script);
+}
+
 int
 btc_script_verify(const btc_script_t *input,
                   const btc_stack_t *witness,
@@ -2589,23 +3417,33 @@ btc_script_verify(const btc_script_t *input,
                   int64_t value,
                   unsigned int flags,
                   btc_tx_cache_t *cache) {
+  const btc_opvec_t *ops = btc_script_decoded(input, tx, index, cache);
   int err = BTC_SCRIPT_ERR_OK;
   btc_script_t *redeem = NULL;
   btc_stack_t stack, copy;
   int had_witness;
 
+  /* Try the standard templates first. */
+  err = btc_script_verify_standard(input, witness, output,
+                                   tx, index, value, flags, cache);
+
+  if (err >= 0)
+    return err;
+
+  err = BTC_SCRIPT_ERR_OK;
+
   /* Setup a stack. */
-  btc_stack_init(&stack);
-  btc_stack_init(&copy);
+  btc_stack_open(&stack);
+  btc_stack_open(&copy);
 
   if (flags & BTC_SCRIPT_VERIFY_SIGPUSHONLY) {
-    if (!btc_script_is_push_only(input))
+    if (!btc_script_is_push_only_decoded(input, ops))
       THROW(BTC_SCRIPT_ERR_SIG_PUSHONLY);
   }
 
   /* Execute the input script. */
-  if ((err = btc_script_execute(input, &stack, flags,
-                                tx, index, value, 0, cache))) {
+  if ((err = btc_script_execute_internal(input, &stack, flags, tx, index,
+                                         value, 0, cache, NULL, ops))) {
     goto done;
   }
 
@@ -2635,7 +3473,7 @@ btc_script_verify(const btc_script_t *input,
 
     /* Verify the program in the output script. */
     if ((err = btc_script_verify_program(witness, output, flags,
-                                         tx, index, value, cache))) {
+                                         tx, index, value, 0, cache))) {
       goto done;
     }
 
@@ -2646,7 +3484,7 @@ btc_script_verify(const btc_script_t *input,
   /* If the script is P2SH, execute the real output script. */
   if ((flags & BTC_SCRIPT_VERIFY_P2SH) && btc_script_is_p2sh(output)) {
     /* P2SH can only have push ops in the scriptSig. */
-    if (!btc_script_is_push_only(input))
+    if (!btc_script_is_push_only_decoded(input, ops))
       THROW(BTC_SCRIPT_ERR_SIG_PUSHONLY);
 
     /* Reset the stack */
@@ -2678,7 +3516,7 @@ btc_script_verify(const btc_script_t *input,
 
       /* Verify the program in the redeem script. */
       if ((err = btc_script_verify_program(witness, redeem, flags,
-                                           tx, index, value, cache))) {
+                                           tx, index, value, 1, cache))) {
         goto done;
       }
 
@@ -2702,15 +3540,219 @@ btc_script_verify(const btc_script_t *input,
   }
 
 done:
-  btc_stack_clear(&stack);
-  btc_stack_clear(&copy);
+  btc_stack_close(&stack);
+  btc_stack_close(&copy);
   if (redeem != NULL)
-    btc_script_destroy(redeem);
+    btc_stackitem_destroy(redeem);
   return err;
 }
 
 #undef THROW
 
+/*
+ * Signature Batch
+ */
+
+typedef struct btc_sigitem_s {
+  uint8_t msg[32];
+  uint8_t sig[64];
+  uint8_t pub[32];
+} btc_sigitem_t;
+
+typedef struct btc_ecitem_s {
+  uint8_t msg[32];
+  uint8_t sig[64];
+  uint8_t pub[65];
+  size_t pub_len;
+} btc_ecitem_t;
+
+struct btc_sigbatch_s {
+  btc_sigitem_t *items;
+  size_t alloc;
+  size_t length;
+  btc_ecitem_t *ecitems;
+  size_t ecalloc;
+  size_t eclength;
+  btc_scratch_t *scratch;
+};
+
+btc_sigbatch_t *
+btc_sigbatch_create(void) {
+  btc_sigbatch_t *batch = btc_malloc(sizeof(btc_sigbatch_t));
+
+  batch->items = NULL;
+  batch->alloc = 0;
+  batch->length = 0;
+  batch->ecitems = NULL;
+  batch->ecalloc = 0;
+  batch->eclength = 0;
+  batch->scratch = NULL;
+
+  return batch;
+}
+
+void
+btc_sigbatch_destroy(btc_sigbatch_t *batch) {
+  if (batch->scratch != NULL)
+    btc_scratch_destroy(batch->scratch);
+
+  if (batch->items != NULL)
+    btc_free(batch->items);
+
+  if (batch->ecitems != NULL)
+    btc_free(batch->ecitems);
+
+  btc_free(batch);
+}
+
+void
+btc_sigbatch_reset(btc_sigbatch_t *batch) {
+  batch->length = 0;
+  batch->eclength = 0;
+}
+
+size_t
+btc_sigbatch_length(const btc_sigbatch_t *batch) {
+  return batch->length + batch->eclength;
+}
+
+void
+btc_sigbatch_push(btc_sigbatch_t *batch,
+                  const uint8_t *msg,
+                  const uint8_t *sig,
+                  const uint8_t *pub) {
+  btc_sigitem_t *item;
+
+  if (batch->length == batch->alloc) {
+    batch->alloc = batch->alloc == 0 ? 16 : batch->alloc * 2;
+    batch->items = btc_realloc(batch->items,
+                               batch->alloc * sizeof(btc_sigitem_t));
+  }
+
+  item = &batch->items[batch->length++];
+
+  memcpy(item->msg, msg, 32);
+  memcpy(item->sig, sig, 64);
+  memcpy(item->pub, pub, 32);
+}
+
+void
+btc_sigbatch_push_ecdsa(btc_sigbatch_t *batch,
+                        const uint8_t *msg,
+                        const uint8_t *sig,
+                        const uint8_t *pub,
+                        size_t pub_len) {
+  btc_ecitem_t *item;
+
+  CHECK(pub_len <= 65);
+
+  if (batch->eclength == batch->ecalloc) {
+    batch->ecalloc = batch->ecalloc == 0 ? 16 : batch->ecalloc * 2;
+    batch->ecitems = btc_realloc(batch->ecitems,
+                                 batch->ecalloc * sizeof(btc_ecitem_t));
+  }
+
+  item = &batch->ecitems[batch->eclength++];
+
+  memcpy(item->msg, msg, 32);
+  memcpy(item->sig, sig, 64);
+  memcpy(item->pub, pub, pub_len);
+
+  item->pub_len = pub_len;
+}
+
+static int
+btc_sigbatch_verify_schnorr(btc_sigbatch_t *batch) {
+  const uint8_t **msgs, **sigs, **pubs;
+  size_t i, *lens;
+  int ret = 1;
+
+  if (batch->length == 0)
+    return 1;
+
+  if (batch->length == 1) {
+    const btc_sigitem_t *item = &batch->items[0];
+    return btc_bip340_verify(item->msg, 32, item->sig, item->pub);
+  }
+
+  if (batch->scratch == NULL)
+    batch->scratch = btc_scratch_create(64);
+
+  msgs = btc_malloc(batch->length * sizeof(uint8_t *));
+  sigs = btc_malloc(batch->length * sizeof(uint8_t *));
+  pubs = btc_malloc(batch->length * sizeof(uint8_t *));
+  lens = btc_malloc(batch->length * sizeof(size_t));
+
+  for (i = 0; i < batch->length; i++) {
+    msgs[i] = batch->items[i].msg;
+    sigs[i] = batch->items[i].sig;
+    pubs[i] = batch->items[i].pub;
+    lens[i] = 32;
+  }
+
+  ret = btc_bip340_verify_batch(msgs, lens, sigs, pubs,
+                                batch->length, batch->scratch);
+
+  btc_free(msgs);
+  btc_free(sigs);
+  btc_free(pubs);
+  btc_free(lens);
+
+  return ret;
+}
+
+static int
+btc_sigbatch_verify_ecdsa(btc_sigbatch_t *batch) {
+  const uint8_t **msgs, **sigs, **pubs;
+  size_t i, *msg_lens, *pub_lens;
+  int ret = 1;
+
+  if (batch->eclength == 0)
+    return 1;
+
+  if (batch->eclength == 1) {
+    const btc_ecitem_t *item = &batch->ecitems[0];
+    return btc_ecdsa_verify(item->msg, 32, item->sig,
+                            item->pub, item->pub_len);
+  }
+
+  msgs = btc_malloc(batch->eclength * sizeof(uint8_t *));
+  sigs = btc_malloc(batch->eclength * sizeof(uint8_t *));
+  pubs = btc_malloc(batch->eclength * sizeof(uint8_t *));
+  msg_lens = btc_malloc(batch->eclength * sizeof(size_t));
+  pub_lens = btc_malloc(batch->eclength * sizeof(size_t));
+
+  for (i = 0; i < batch->eclength; i++) {
+    msgs[i] = batch->ecitems[i].msg;
+    sigs[i] = batch->ecitems[i].sig;
+    pubs[i] = batch->ecitems[i].pub;
+    msg_lens[i] = 32;
+    pub_lens[i] = batch->ecitems[i].pub_len;
+  }
+
+  ret = btc_ecdsa_verify_batch(msgs, msg_lens, sigs, pubs,
+                               pub_lens, batch->eclength);
+
+  btc_free(msgs);
+  btc_free(sigs);
+  btc_free(pubs);
+  btc_free(msg_lens);
+  btc_free(pub_lens);
+
+  return ret;
+}
+
+int
+btc_sigbatch_verify(btc_sigbatch_t *batch) {
+  int ret = btc_sigbatch_verify_ecdsa(batch)
+         && btc_sigbatch_verify_schnorr(batch);
+
+  batch->length = 0;
+  batch->eclength = 0;
+
+  return ret;
+}
+
 /*
  * Reader
  */
@@ -2733,6 +3775,155 @@ btc_reader_op(btc_reader_t *z) {
   return op.value;
 }
 
+/*
+ * Opcode Vector
+ */
+
+/* A script decoded once so that several passes
+ * (execution, sigop counting, push-only checks)
+ * need not re-parse it. Opcodes point into the
+ * script's buffer, which must outlive the vector.
+ * Decoding stops at the first parse error, which
+ * is recorded in `malformed`.
+ */
+
+void
+btc_opvec_init(btc_opvec_t *z) {
+  z->items = NULL;
+  z->alloc = 0;
+  z->length = 0;
+  z->malformed = 0;
+}
+
+void
+btc_opvec_clear(btc_opvec_t *z) {
+  if (z->alloc > 0)
+    btc_free(z->items);
+
+  btc_opvec_init(z);
+}
+
+void
+btc_opvec_grow(btc_opvec_t *z, size_t zn) {
+  if (zn > z->alloc) {
+    z->items = (btc_opcode_t *)btc_realloc(z->items,
+                                           zn * sizeof(btc_opcode_t));
+    z->alloc = zn;
+  }
+}
+
+void
+btc_opvec_rwset(btc_opvec_t *z, btc_opcode_t *items, size_t alloc) {
+  z->items = items;
+  z->alloc = alloc;
+  z->length = 0;
+  z->malformed = 0;
+}
+
+size_t
+btc_opvec_count(const btc_script_t *x) {
+  btc_reader_t reader;
+  btc_opcode_t op;
+  size_t count = 0;
+
+  btc_reader_init(&reader, x);
+
+  while (reader.length > 0) {
+    if (!btc_reader_next(&op, &reader))
+      break;
+
+    count++;
+  }
+
+  return count;
+}
+
+void
+btc_opvec_set(btc_opvec_t *z, const btc_script_t *x) {
+  btc_reader_t reader;
+  btc_opcode_t op;
+
+  btc_reader_init(&reader, x);
+
+  z->length = 0;
+  z->malformed = 0;
+
+  while (reader.length > 0) {
+    if (!btc_reader_next(&op, &reader)) {
+      z->malformed = 1;
+      break;
+    }
+
+    if (z->length == z->alloc)
+      btc_opvec_grow(z, (z->alloc * 3) / 2 + (z->alloc <= 1));
+
+    z->items[z->length++] = op;
+  }
+}
+
+int
+btc_opvec_is_push_only(const btc_opvec_t *x) {
+  size_t i;
+
+  if (x->malformed)
+    return 0;
+
+  for (i = 0; i < x->length; i++) {
+    if (x->items[i].value > BTC_OP_16)
+      return 0;
+  }
+
+  return 1;
+}
+
+int
+btc_opvec_get_redeem(btc_script_t *redeem, const btc_opvec_t *x) {
+  const btc_opcode_t *last;
+
+  if (!btc_opvec_is_push_only(x))
+    return 0;
+
+  if (x->length == 0) {
+    btc_script_roset(redeem, NULL, 0);
+    return 1;
+  }
+
+  last = &x->items[x->length - 1];
+
+  btc_script_roset(redeem, last->data, last->length);
+
+  return 1;
+}
+
+int
+btc_opvec_sigops(const btc_opvec_t *x, int accurate) {
+  int last = BTC_OP_INVALIDOPCODE;
+  int total = 0;
+  size_t i;
+
+  for (i = 0; i < x->length; i++) {
+    int value = x->items[i].value;
+
+    switch (value) {
+      case BTC_OP_CHECKSIG:
+      case BTC_OP_CHECKSIGVERIFY:
+        total += 1;
+        break;
+      case BTC_OP_CHECKMULTISIG:
+      case BTC_OP_CHECKMULTISIGVERIFY:
+        if (accurate && last >= BTC_OP_1 && last <= BTC_OP_16)
+          total += btc_smi_decode(last);
+        else
+          total += BTC_MAX_MULTISIG_PUBKEYS;
+        break;
+    }
+
+    last = value;
+  }
+
+  return total;
+}
+
 /*
  * Writer
  */
@@ -2934,6 +4125,9 @@ asm_opcode(int value) {
     X(OP_NOP9);
     X(OP_NOP10);
 
+    /* tapscript */
+    X(OP_CHECKSIGADD);
+
     X(OP_INVALIDOPCODE);
 #undef X
   }
@@ -22,6 +22,16 @@
 #include "impl.h"
 #include "internal.h"
 
+/*
+ * Constants
+ */
+
+/* Branch and bound gives up after this many steps. */
+#define BTC_BNB_TRIES 100000
+
+/* Estimated size of the input spending our change. */
+#define BTC_CHANGE_SPEND_SIZE 68
+
 /*
  * Types
  */
@@ -221,6 +231,7 @@ void
 btc_selopt_init(btc_selopt_t *opt) {
   opt->strategy = BTC_SELECT_VALUE;
   opt->rate = 10000;
+  opt->ltrate = 10000;
   opt->fee = -1;
   opt->maxfee = -1;
   opt->height = -1;
@@ -240,6 +251,7 @@ btc_selector_init(btc_selector_t *sel, const btc_selopt_t *opt, btc_tx_t *tx) {
   sel->opt = opt;
   sel->strategy = opt->strategy;
   sel->subtract = (opt->subfee || opt->subpos >= 0);
+  sel->changeless = 0;
   sel->tx = tx;
   sel->inpval = 0;
   sel->outval = btc_tx_output_value(tx);
@@ -290,7 +302,8 @@ btc_selector_push(btc_selector_t *sel,
   utxo->size = btc_estimate_input_size(&coin->output.script);
 
   switch (sel->strategy) {
-    case BTC_SELECT_ALL: {
+    case BTC_SELECT_ALL:
+    case BTC_SELECT_BNB: {
       btc_vector_push(&sel->utxos, utxo);
       break;
     }
@@ -331,6 +344,7 @@ static btc_utxo_t *
 btc_selector_shift(btc_selector_t *sel) {
   switch (sel->strategy) {
     case BTC_SELECT_ALL:
+    case BTC_SELECT_BNB:
     case BTC_SELECT_RANDOM:
       return btc_vector_pop(&sel->utxos);
     case BTC_SELECT_AGE:
@@ -402,10 +416,218 @@ btc_selector_fund(btc_selector_t *sel, int64_t fee) {
   }
 }
 
+static void
+btc_selector_sort(btc_selector_t *sel) {
+  /* Fall back to largest-first. */
+  btc_vector_t utxos = sel->utxos;
+  size_t i;
+
+  btc_vector_init(&sel->utxos);
+  btc_vector_grow(&sel->utxos, utxos.length);
+
+  for (i = 0; i < utxos.length; i++)
+    btc_heap_insert(&sel->utxos, utxos.items[i], cmp_value);
+
+  btc_vector_clear(&utxos);
+
+  sel->strategy = BTC_SELECT_VALUE;
+}
+
+static int64_t
+input_fee(size_t size, int64_t rate) {
+  /* Round up so that the sum never undershoots. */
+  return (rate * (int64_t)size + 999) / 1000;
+}
+
+typedef struct btc_bnbitem_s {
+  btc_utxo_t *utxo;
+  int64_t value; /* effective value */
+  int64_t waste; /* fee now minus fee later */
+} btc_bnbitem_t;
+
+static int
+cmp_effective(const void *xp, const void *yp) {
+  const btc_bnbitem_t *x = xp;
+  const btc_bnbitem_t *y = yp;
+
+  if (x->value != y->value)
+    return x->value < y->value ? 1 : -1;
+
+  if (x->waste != y->waste)
+    return x->waste < y->waste ? -1 : 1;
+
+  return 0;
+}
+
+static int
+btc_selector_bnb(btc_selector_t *sel, int64_t rate) {
+  /* Depth-first search for an input set whose effective
+     value lands within the cost of a change output above
+     the target, minimizing waste (see bitcoin core). */
+  int64_t ltrate = sel->opt->ltrate >= 0 ? sel->opt->ltrate : rate;
+  int64_t target, cost, avail, value, waste, best_waste;
+  size_t base = sel->size - 34;
+  uint8_t *curr, *best;
+  btc_bnbitem_t *items;
+  size_t i, n, depth;
+  int64_t fee;
+  int found = 0;
+  long tries;
+
+  if (sel->subtract)
+    return 0;
+
+  target = sel->outval + input_fee(base, rate) - sel->inpval;
+
+  if (target <= 0)
+    return 0;
+
+  cost = input_fee(34, rate) + input_fee(BTC_CHANGE_SPEND_SIZE, ltrate);
+
+  items = btc_malloc((sel->utxos.length + 1) * sizeof(btc_bnbitem_t));
+  avail = 0;
+  n = 0;
+
+  for (i = 0; i < sel->utxos.length; i++) {
+    btc_utxo_t *utxo = sel->utxos.items[i];
+    btc_bnbitem_t *item = &items[n];
+
+    if (!btc_selector_spendable(sel, utxo))
+      continue;
+
+    item->utxo = utxo;
+    item->value = utxo->value - input_fee(utxo->size, rate);
+    item->waste = input_fee(utxo->size, rate)
+                - input_fee(utxo->size, ltrate);
+
+    if (item->value <= 0)
+      continue;
+
+    avail += item->value;
+    n += 1;
+  }
+
+  if (avail < target) {
+    btc_free(items);
+    return 0;
+  }
+
+  qsort(items, n, sizeof(btc_bnbitem_t), cmp_effective);
+
+  curr = btc_malloc(n + 1);
+  best = btc_malloc(n + 1);
+
+  best_waste = BTC_MAX_MONEY;
+  value = 0;
+  waste = 0;
+  depth = 0;
+
+  for (tries = 0; tries < BTC_BNB_TRIES; tries++) {
+    int backtrack = 0;
+
+    if (value + avail < target || value > target + cost
+        || (waste > best_waste && items[0].waste > 0)) {
+      backtrack = 1;
+    } else if (value >= target) {
+      if (waste + (value - target) <= best_waste) {
+        memcpy(best, curr, depth);
+        memset(best + depth, 0, n - depth);
+        best_waste = waste + (value - target);
+        found = 1;
+
+        if (best_waste == 0)
+          break;
+      }
+
+      backtrack = 1;
+    }
+
+    if (backtrack) {
+      /* Find the last inclusion and try omitting it. */
+      while (depth > 0 && !curr[depth - 1]) {
+        depth -= 1;
+        avail += items[depth].value;
+      }
+
+      if (depth == 0)
+        break;
+
+      curr[depth - 1] = 0;
+      value -= items[depth - 1].value;
+      waste -= items[depth - 1].waste;
+    } else {
+      const btc_bnbitem_t *item = &items[depth];
+
+      avail -= item->value;
+
+      /* Skip a branch equivalent to one just omitted. */
+      if (depth > 0 && !curr[depth - 1]
+          && item->value == items[depth - 1].value
+          && item->waste == items[depth - 1].waste) {
+        curr[depth++] = 0;
+      } else {
+        curr[depth++] = 1;
+        value += item->value;
+        waste += item->waste;
+      }
+    }
+  }
+
+  if (found) {
+    int64_t inpval = sel->inpval;
+    size_t size = base;
+
+    for (i = 0; i < n; i++) {
+      if (best[i]) {
+        inpval += items[i].utxo->value;
+        size += items[i].utxo->size;
+      }
+    }
+
+    /* The absolute fee floor may still get in the way. */
+    fee = btc_fee_range(btc_get_min_fee(size, rate));
+
+    if (inpval < sel->outval + fee)
+      found = 0;
+  }
+
+  if (found) {
+    for (i = 0; i < n; i++) {
+      btc_utxo_t *utxo = items[i].utxo;
+
+      if (best[i]) {
+        btc_tx_add_outpoint(sel->tx, &utxo->prevout);
+
+        sel->inpval += utxo->value;
+        sel->size += utxo->size;
+      }
+    }
+
+    for (i = 0; i < sel->utxos.length; i++)
+      btc_free(sel->utxos.items[i]);
+
+    btc_vector_reset(&sel->utxos);
+
+    sel->size -= 34;
+    sel->changeless = 1;
+  }
+
+  btc_free(best);
+  btc_free(curr);
+  btc_free(items);
+
+  return found;
+}
+
 static int64_t
 btc_selector_select_rate(btc_selector_t *sel, int64_t rate) {
   int64_t fee;
 
+  if (sel->strategy == BTC_SELECT_BNB) {
+    if (!btc_selector_bnb(sel, rate))
+      btc_selector_sort(sel);
+  }
+
   if (sel->strategy == BTC_SELECT_ALL) {
     btc_selector_fund(sel, BTC_MAX_MONEY);
   } else {
@@ -429,6 +651,9 @@ btc_selector_select_rate(btc_selector_t *sel, int64_t rate) {
 
 static int64_t
 btc_selector_select_fee(btc_selector_t *sel, int64_t fee) {
+  if (sel->strategy == BTC_SELECT_BNB)
+    btc_selector_sort(sel);
+
   if (sel->strategy == BTC_SELECT_ALL)
     btc_selector_fund(sel, BTC_MAX_MONEY);
   else
@@ -464,6 +689,12 @@ btc_selector_fill(btc_selector_t *sel, const btc_address_t *addr) {
   if (change < 0)
     return 0;
 
+  /* Branch and bound pays the excess as fee. */
+  if (sel->changeless) {
+    fee += change;
+    change = 0;
+  }
+
   if (opt->maxfee > 0 && fee > opt->maxfee)
     return 0;
 
@@ -476,6 +707,9 @@ btc_selector_fill(btc_selector_t *sel, const btc_address_t *addr) {
       return 0;
   }
 
+  if (sel->changeless)
+    return 1;
+
   /* Add a change output. */
   output = btc_output_create();
   output->value = change;
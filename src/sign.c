@@ -31,6 +31,9 @@ typedef struct btc_keypair_s {
   uint8_t pub65[65];
   uint8_t hash33[20];
   uint8_t hash65[20];
+  /* Map keys (zero padded): P2PKH, P2WPKH and nested. */
+  uint8_t keys[4][32];
+  const btc_precomp_t *pre;
 } btc_keypair_t;
 
 static int
@@ -46,6 +49,8 @@ btc_keypair_init(btc_keypair_t *key, const uint8_t *priv) {
 
   memcpy(key->priv, priv, 32);
 
+  key->pre = NULL;
+
   return 1;
 }
 
@@ -119,7 +124,7 @@ btc_tx_signature(uint8_t *sig,
                  size_t index,
                  const btc_script_t *prev,
                  int64_t value,
-                 const uint8_t *priv,
+                 const btc_keypair_t *key,
                  int type,
                  int version,
                  btc_tx_cache_t *cache) {
@@ -135,7 +140,7 @@ btc_tx_signature(uint8_t *sig,
                  version,
                  cache);
 
-  if (!btc_ecdsa_sign(tmp, NULL, msg, 32, priv))
+  if (!btc_ecdsa_sign_precomp(tmp, NULL, msg, 32, key->priv, key->pre))
     return 0;
 
   CHECK(btc_ecdsa_sig_export(sig, sig_len, tmp));
@@ -170,7 +175,7 @@ btc_tx_sign_p2pk(btc_tx_t *tx,
                          index,
                          &coin->script,
                          coin->value,
-                         key->priv,
+                         key,
                          type,
                          0,
                          cache));
@@ -208,7 +213,7 @@ btc_tx_sign_p2pkh(btc_tx_t *tx,
                          index,
                          &coin->script,
                          coin->value,
-                         key->priv,
+                         key,
                          type,
                          0,
                          cache));
@@ -251,7 +256,7 @@ btc_tx_sign_p2wpkh(btc_tx_t *tx,
                          index,
                          &redeem,
                          coin->value,
-                         key->priv,
+                         key,
                          type,
                          1,
                          cache));
@@ -349,6 +354,10 @@ btc_tx_sign_step(btc_tx_t *tx,
 
   btc_keypair_clear(&key);
 
+  /* Scripts changed; drop memoized sizes. */
+  if (total > 0)
+    btc_tx_uncache(tx);
+
   return total;
 }
 
@@ -358,28 +367,211 @@ btc_tx_sign(btc_tx_t *tx,
             btc_derive_f *derive,
             void *arg) {
   btc_vector_t *addrs = btc_tx_input_addrs(tx, view);
-  btc_tx_cache_t cache;
+  btc_signer_t *signer = btc_signer_create();
   uint8_t priv[32];
   int total = 0;
   size_t i;
 
-  memset(&cache, 0, sizeof(cache));
-
   for (i = 0; i < addrs->length; i++) {
     const btc_address_t *addr = addrs->items[i];
 
     if (!derive(priv, addr, arg))
       continue;
 
-    total += btc_tx_sign_step(tx, view, priv, &cache);
-
+    btc_signer_add(signer, priv);
     btc_memzero(priv, 32);
   }
 
+  /* One pass over the inputs for all keys. */
+  if (btc_signer_size(signer) > 0)
+    total = btc_signer_sign_tx(signer, tx, view);
+
   for (i = 0; i < addrs->length; i++)
     btc_address_destroy(addrs->items[i]);
 
   btc_vector_destroy(addrs);
+  btc_signer_destroy(signer);
+
+  return total;
+}
+
+/*
+ * Signer
+ */
+
+struct btc_signer_s {
+  btc_hashmap_t *map; /* padded hash160 -> keypair */
+  btc_vector_t keys;
+  const btc_precomp_t *pre;
+};
+
+btc_signer_t *
+btc_signer_create(void) {
+  btc_signer_t *signer = btc_malloc(sizeof(btc_signer_t));
+
+  signer->map = btc_hashmap_create();
+
+  btc_vector_init(&signer->keys);
+
+  signer->pre = NULL;
+
+  return signer;
+}
+
+void
+btc_signer_destroy(btc_signer_t *signer) {
+  size_t i;
+
+  for (i = 0; i < signer->keys.length; i++) {
+    btc_keypair_t *key = signer->keys.items[i];
+
+    btc_keypair_clear(key);
+    btc_free(key);
+  }
+
+  btc_hashmap_destroy(signer->map);
+  btc_vector_clear(&signer->keys);
+  btc_free(signer);
+}
+
+int
+btc_signer_add(btc_signer_t *signer, const uint8_t *priv) {
+  btc_keypair_t *key = btc_malloc(sizeof(btc_keypair_t));
+  btc_script_t script;
+  uint8_t raw[22];
+  int i;
+
+  if (!btc_keypair_init(key, priv)) {
+    btc_free(key);
+    return 0;
+  }
+
+  memset(key->keys, 0, sizeof(key->keys));
+
+  key->pre = signer->pre;
+
+  memcpy(key->keys[0], key->hash33, 20);
+  memcpy(key->keys[1], key->hash65, 20);
+
+  btc_script_rwset(&script, raw, sizeof(raw));
+
+  btc_script_set_p2wpkh(&script, key->hash33);
+  btc_script_hash160(key->keys[2], &script);
+
+  btc_script_set_p2wpkh(&script, key->hash65);
+  btc_script_hash160(key->keys[3], &script);
+
+  if (btc_hashmap_has(signer->map, key->keys[0])) {
+    btc_keypair_clear(key);
+    btc_free(key);
+    return 1;
+  }
+
+  for (i = 0; i < 4; i++)
+    btc_hashmap_put(signer->map, key->keys[i], key);
+
+  btc_vector_push(&signer->keys, key);
+
+  return 1;
+}
+
+void
+btc_signer_set_precomp(btc_signer_t *signer, const btc_precomp_t *pre) {
+  /* Borrowed; must outlive the signer. */
+  size_t i;
+
+  for (i = 0; i < signer->keys.length; i++) {
+    btc_keypair_t *key = signer->keys.items[i];
+
+    key->pre = pre;
+  }
+
+  signer->pre = pre;
+}
+
+size_t
+btc_signer_size(const btc_signer_t *signer) {
+  return signer->keys.length;
+}
+
+static const btc_keypair_t *
+btc_signer_find(const btc_signer_t *signer, const btc_script_t *script) {
+  const uint8_t *hash, *pub;
+  uint8_t key[32];
+  size_t pub_len;
+
+  memset(key, 0, 32);
+
+  if (btc_script_get_p2pk(&pub, &pub_len, script))
+    btc_hash160(key, pub, pub_len);
+  else if (btc_script_get_p2pkh(&hash, script))
+    memcpy(key, hash, 20);
+  else if (btc_script_get_p2wpkh(&hash, script))
+    memcpy(key, hash, 20);
+  else if (btc_script_get_p2sh(&hash, script))
+    memcpy(key, hash, 20);
+  else
+    return NULL;
+
+  return btc_hashmap_get(signer->map, key);
+}
+
+int
+btc_signer_sign(const btc_signer_t *signer,
+                btc_tx_t *tx,
+                const btc_view_t *view,
+                const btc_tx_cache_t *cache,
+                size_t start,
+                size_t end) {
+  /* Inputs in disjoint ranges may be signed from several
+     threads at once, given a cache from btc_tx_cache_init.
+     The caller must call btc_tx_uncache once all are done. */
+  btc_tx_cache_t local = *cache;
+  const btc_keypair_t *key;
+  const btc_input_t *input;
+  const btc_coin_t *coin;
+  int total = 0;
+  size_t i;
+
+  if (end > tx->inputs.length)
+    end = tx->inputs.length;
+
+  for (i = start; i < end; i++) {
+    input = tx->inputs.items[i];
+    coin = btc_view_get(view, &input->prevout);
+
+    if (coin == NULL)
+      continue;
+
+    key = btc_signer_find(signer, &coin->output.script);
+
+    if (key == NULL)
+      continue;
+
+    total += btc_tx_sign_input(tx,
+                               i,
+                               &coin->output,
+                               key,
+                               BTC_SIGHASH_ALL,
+                               &local);
+  }
+
+  return total;
+}
+
+int
+btc_signer_sign_tx(const btc_signer_t *signer,
+                   btc_tx_t *tx,
+                   const btc_view_t *view) {
+  btc_tx_cache_t cache;
+  int total;
+
+  btc_tx_cache_init(&cache, tx, NULL);
+
+  total = btc_signer_sign(signer, tx, view, &cache, 0, tx->inputs.length);
+
+  if (total > 0)
+    btc_tx_uncache(tx);
 
   return total;
 }
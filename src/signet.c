@@ -149,6 +149,15 @@ static const btc_network_t signet = {
     /* .length = */ lengthof(signet_checkpoints)
   },
   /* .last_checkpoint = */ 60000,
+  /* .assume_valid = */ {
+    0,
+    {
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    }
+  },
   /* .halving_interval = */ 210000,
   /* .genesis = */ {
     /* .hash = */ {
@@ -253,6 +262,15 @@ static const btc_network_t signet = {
         0xc5, 0x4e, 0xdc, 0x5e, 0xd4, 0x92, 0xa3, 0xb2,
         0x6c, 0x63, 0xb2, 0xd6, 0x86, 0x00, 0x00, 0x00
       }
+    },
+    /* .taproot = */ {
+      1,
+      {
+        0x53, 0x3b, 0x53, 0xde, 0xd9, 0xbf, 0xf4, 0xad,
+        0xc9, 0x41, 0x01, 0xd3, 0x24, 0x00, 0xa1, 0x44,
+        0xc5, 0x4e, 0xdc, 0x5e, 0xd4, 0x92, 0xa3, 0xb2,
+        0x6c, 0x63, 0xb2, 0xd6, 0x86, 0x00, 0x00, 0x00
+      }
     }
   },
   /* .activation_threshold = */ 1815, /* 90% of 2016 */
@@ -265,7 +283,8 @@ static const btc_network_t signet = {
     /* .data = */ signet_challenge,
     /* .alloc = */ 0,
     /* .length = */ sizeof(signet_challenge),
-    /* ._refs = */ 0
+    /* ._refs = */ 0,
+    /* .small = */ {0}
   },
   /* .key = */ {
     /* .privkey = */ 0xef,
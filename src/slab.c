@@ -0,0 +1,142 @@
+/*!
+ * slab.c - slab allocator for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include "internal.h"
+#include "slab.h"
+
+/*
+ * Helpers
+ */
+
+typedef union slab_align_u {
+  void *p;
+  double d;
+  long l;
+  size_t z;
+} slab_align_t;
+
+typedef struct slab_chunk_s {
+  struct slab_chunk_s *next;
+  btc_slab_unmap_f *unmap; /* NULL if on the heap. */
+  size_t size;
+} slab_chunk_t;
+
+#define SLAB_ALIGN sizeof(slab_align_t)
+#define SLAB_HEADER slab_round(sizeof(slab_chunk_t))
+
+static size_t
+slab_round(size_t size) {
+  return ((size + SLAB_ALIGN - 1) / SLAB_ALIGN) * SLAB_ALIGN;
+}
+
+static void
+slab_chunk(btc_slab_t *z) {
+  size_t size = SLAB_HEADER + z->size * z->count;
+  slab_chunk_t *chunk = NULL;
+
+  if (z->map != NULL)
+    chunk = z->map(&size);
+
+  if (chunk != NULL) {
+    chunk->unmap = z->unmap;
+  } else {
+    chunk = btc_malloc(size);
+    chunk->unmap = NULL;
+  }
+
+  chunk->next = z->chunks;
+  chunk->size = size;
+
+  z->chunks = chunk;
+  z->ptr = (unsigned char *)chunk + SLAB_HEADER;
+  z->avail = (size - SLAB_HEADER) / z->size;
+}
+
+/*
+ * Slab Allocator
+ */
+
+void
+btc_slab_init(btc_slab_t *z, size_t size, size_t count) {
+  CHECK(size > 0 && count > 0);
+
+  /* Free objects store the list link in place. */
+  if (size < sizeof(void *))
+    size = sizeof(void *);
+
+  z->size = slab_round(size);
+  z->count = count;
+  z->chunks = NULL;
+  z->free = NULL;
+  z->used = 0;
+  z->avail = 0;
+  z->ptr = NULL;
+  z->map = NULL;
+  z->unmap = NULL;
+}
+
+void
+btc_slab_clear(btc_slab_t *z) {
+  slab_chunk_t *chunk, *next;
+
+  for (chunk = z->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+
+    if (chunk->unmap != NULL)
+      chunk->unmap(chunk, chunk->size);
+    else
+      btc_free(chunk);
+  }
+
+  z->chunks = NULL;
+  z->free = NULL;
+  z->used = 0;
+  z->avail = 0;
+  z->ptr = NULL;
+}
+
+void
+btc_slab_backing(btc_slab_t *z, btc_slab_map_f *map, btc_slab_unmap_f *unmap) {
+  /* Existing chunks remember how to release themselves. */
+  CHECK((map == NULL) == (unmap == NULL));
+
+  z->map = map;
+  z->unmap = unmap;
+}
+
+void *
+btc_slab_alloc(btc_slab_t *z) {
+  void *ptr;
+
+  z->used++;
+
+  if (z->free != NULL) {
+    ptr = z->free;
+    z->free = *((void **)ptr);
+    return ptr;
+  }
+
+  if (z->avail == 0)
+    slab_chunk(z);
+
+  ptr = z->ptr;
+
+  z->ptr += z->size;
+  z->avail--;
+
+  return ptr;
+}
+
+void
+btc_slab_free(btc_slab_t *z, void *ptr) {
+  CHECK(z->used > 0);
+
+  *((void **)ptr) = z->free;
+
+  z->free = ptr;
+  z->used--;
+}
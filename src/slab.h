@@ -0,0 +1,74 @@
+/*!
+ * slab.h - slab allocator for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_SLAB_H
+#define BTC_SLAB_H
+
+#include <stddef.h>
+#include "internal.h"
+
+/*
+ * Slab Allocator
+ */
+
+/* Fixed-size objects carved out of large
+ * contiguous chunks. Freed objects go on a
+ * free list; chunks are only returned to the
+ * system when the whole slab is cleared.
+ * Not thread-safe.
+ *
+ * Chunks come from the heap unless a backing
+ * allocator is installed, in which case it may
+ * round the chunk size up (e.g. to a huge page)
+ * and the slab fills whatever it is given. A
+ * NULL return falls back to the heap.
+ */
+
+typedef void *btc_slab_map_f(size_t *size);
+typedef void btc_slab_unmap_f(void *ptr, size_t size);
+
+typedef struct btc_slab_s {
+  size_t size;
+  size_t count;
+  void *chunks;
+  void *free;
+  size_t used;
+  size_t avail;
+  unsigned char *ptr;
+  btc_slab_map_f *map;
+  btc_slab_unmap_f *unmap;
+} btc_slab_t;
+
+#define btc_slab_init btc__slab_init
+#define btc_slab_clear btc__slab_clear
+#define btc_slab_backing btc__slab_backing
+#define btc_slab_alloc btc__slab_alloc
+#define btc_slab_free btc__slab_free
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BTC_EXTERN void
+btc_slab_init(btc_slab_t *z, size_t size, size_t count);
+
+BTC_EXTERN void
+btc_slab_clear(btc_slab_t *z);
+
+BTC_EXTERN void
+btc_slab_backing(btc_slab_t *z, btc_slab_map_f *map, btc_slab_unmap_f *unmap);
+
+BTC_EXTERN BTC_MALLOC void *
+btc_slab_alloc(btc_slab_t *z);
+
+BTC_EXTERN void
+btc_slab_free(btc_slab_t *z, void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_SLAB_H */
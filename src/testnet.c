@@ -376,6 +376,16 @@ static const btc_deployment_t testnet_deployments[] = {
     /* .required = */ 1,
     /* .force = */ 0
   },
+  {
+    /* .name = */ "taproot",
+    /* .bit = */ 2,
+    /* .start_time = */ 1619222400, /* April 24th, 2021 */
+    /* .timeout = */ 1628640000, /* August 11th, 2021 */
+    /* .threshold = */ -1,
+    /* .window = */ -1,
+    /* .required = */ 0,
+    /* .force = */ 0
+  },
   {
     /* .name = */ "testdummy",
     /* .bit = */ 28,
@@ -402,6 +412,15 @@ static const btc_network_t testnet = {
     /* .length = */ lengthof(testnet_checkpoints)
   },
   /* .last_checkpoint = */ 1050000,
+  /* .assume_valid = */ {
+    2164464,
+    {
+      0xb0, 0xb3, 0xd7, 0x7b, 0x97, 0x01, 0x5b, 0x51,
+      0x95, 0x53, 0x42, 0x3c, 0x96, 0x64, 0x2b, 0x33,
+      0xca, 0x53, 0x4c, 0x50, 0xec, 0xef, 0xd1, 0x33,
+      0x64, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    }
+  },
   /* .halving_interval = */ 210000,
   /* .genesis = */ {
     /* .hash = */ {
@@ -506,6 +525,15 @@ static const btc_network_t testnet = {
         0x93, 0xfd, 0x48, 0xa2, 0xaa, 0x9d, 0x72, 0xcd,
         0x0f, 0x98, 0x2b, 0x00, 0x00, 0x00, 0x00, 0x00
       }
+    },
+    /* .taproot = */ {
+      -1,
+      {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+      }
     }
   },
   /* .activation_threshold = */ 1512, /* 75% for testchains */
@@ -518,7 +546,8 @@ static const btc_network_t testnet = {
     /* .data = */ NULL,
     /* .alloc = */ 0,
     /* .length = */ 0,
-    /* ._refs = */ 0
+    /* ._refs = */ 0,
+    /* .small = */ {0}
   },
   /* .key = */ {
     /* .privkey = */ 0xef,
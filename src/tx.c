@@ -38,22 +38,64 @@ btc_tx_init(btc_tx_t *tx) {
   tx->locktime = 0;
   tx->_index = 0;
   tx->_refs = 0;
+  tx->_cache = NULL;
+  tx->_base_size = 0;
+  tx->_witness_size = 0;
+  tx->_sigops = -1;
+  tx->_slab = NULL;
+}
+
+static void
+btc_tx_release(btc_tx_t *tx) {
+  /* Slab objects are freed all at once. */
+  if (tx->_slab != NULL) {
+    btc_free(tx->_slab);
+    btc_inpvec_init(&tx->inputs);
+    btc_outvec_init(&tx->outputs);
+    tx->_slab = NULL;
+  }
+}
+
+void
+btc_tx_uncache(btc_tx_t *tx) {
+  if (tx->_cache != NULL) {
+    if (tx->_cache->scripts != NULL)
+      btc_free(tx->_cache->scripts);
+
+    if (tx->_cache->info != NULL)
+      btc_free(tx->_cache->info);
+
+    btc_free(tx->_cache);
+
+    tx->_cache = NULL;
+  }
+
+  tx->_base_size = 0;
+  tx->_witness_size = 0;
+  tx->_sigops = -1;
 }
 
 void
 btc_tx_clear(btc_tx_t *tx) {
+  btc_tx_release(tx);
   btc_inpvec_clear(&tx->inputs);
   btc_outvec_clear(&tx->outputs);
+  btc_tx_uncache(tx);
 }
 
 void
 btc_tx_copy(btc_tx_t *z, const btc_tx_t *x) {
+  btc_tx_release(z);
   btc_hash_copy(z->hash, x->hash);
   btc_hash_copy(z->whash, x->whash);
   z->version = x->version;
   btc_inpvec_copy(&z->inputs, &x->inputs);
   btc_outvec_copy(&z->outputs, &x->outputs);
   z->locktime = x->locktime;
+  btc_tx_uncache(z);
+  z->_base_size = x->_base_size;
+  z->_witness_size = x->_witness_size;
+  z->_sigops = x->_sigops;
 }
 
 int
@@ -113,6 +155,8 @@ btc_tx_wtxid(uint8_t *hash, const btc_tx_t *tx) {
 
 void
 btc_tx_refresh(btc_tx_t *tx) {
+  btc_tx_uncache(tx);
+
   if (btc_tx_has_witness(tx)) {
     btc_tx_txid(tx->hash, tx);
     btc_tx_wtxid(tx->whash, tx);
@@ -120,6 +164,10 @@ btc_tx_refresh(btc_tx_t *tx) {
     btc_tx_txid(tx->hash, tx);
     btc_hash_copy(tx->whash, tx->hash);
   }
+
+  tx->_witness_size = btc_tx_witness_size(tx);
+  tx->_base_size = btc_tx_base_size(tx);
+  tx->_sigops = btc_tx_legacy_sigops(tx);
 }
 
 static void
@@ -250,6 +298,45 @@ btc_tx_sighash_v0(uint8_t *hash,
   btc_hash256_final(&ctx, hash);
 }
 
+static void
+btc_tx_hash_prevouts(uint8_t *hash, const btc_tx_t *tx) {
+  btc_hash256_t ctx;
+  size_t i;
+
+  btc_hash256_init(&ctx);
+
+  for (i = 0; i < tx->inputs.length; i++)
+    btc_outpoint_update(&ctx, &tx->inputs.items[i]->prevout);
+
+  btc_hash256_final(&ctx, hash);
+}
+
+static void
+btc_tx_hash_sequences(uint8_t *hash, const btc_tx_t *tx) {
+  btc_hash256_t ctx;
+  size_t i;
+
+  btc_hash256_init(&ctx);
+
+  for (i = 0; i < tx->inputs.length; i++)
+    btc_uint32_update(&ctx, tx->inputs.items[i]->sequence);
+
+  btc_hash256_final(&ctx, hash);
+}
+
+static void
+btc_tx_hash_outputs(uint8_t *hash, const btc_tx_t *tx) {
+  btc_hash256_t ctx;
+  size_t i;
+
+  btc_hash256_init(&ctx);
+
+  for (i = 0; i < tx->outputs.length; i++)
+    btc_output_update(&ctx, tx->outputs.items[i]);
+
+  btc_hash256_final(&ctx, hash);
+}
+
 static void
 btc_tx_sighash_v1(uint8_t *hash,
                   const btc_tx_t *tx,
@@ -263,7 +350,6 @@ btc_tx_sighash_v1(uint8_t *hash,
   uint8_t sequences[32];
   uint8_t outputs[32];
   btc_hash256_t ctx;
-  size_t i;
 
   btc_hash_init(prevouts);
   btc_hash_init(sequences);
@@ -273,12 +359,7 @@ btc_tx_sighash_v1(uint8_t *hash,
     if (cache != NULL && cache->has_prevouts) {
       btc_hash_copy(prevouts, cache->prevouts);
     } else {
-      btc_hash256_init(&ctx);
-
-      for (i = 0; i < tx->inputs.length; i++)
-        btc_outpoint_update(&ctx, &tx->inputs.items[i]->prevout);
-
-      btc_hash256_final(&ctx, prevouts);
+      btc_tx_hash_prevouts(prevouts, tx);
 
       if (cache != NULL) {
         btc_hash_copy(cache->prevouts, prevouts);
@@ -293,12 +374,7 @@ btc_tx_sighash_v1(uint8_t *hash,
     if (cache != NULL && cache->has_sequences) {
       btc_hash_copy(sequences, cache->sequences);
     } else {
-      btc_hash256_init(&ctx);
-
-      for (i = 0; i < tx->inputs.length; i++)
-        btc_uint32_update(&ctx, tx->inputs.items[i]->sequence);
-
-      btc_hash256_final(&ctx, sequences);
+      btc_tx_hash_sequences(sequences, tx);
 
       if (cache != NULL) {
         btc_hash_copy(cache->sequences, sequences);
@@ -312,12 +388,7 @@ btc_tx_sighash_v1(uint8_t *hash,
     if (cache != NULL && cache->has_outputs) {
       btc_hash_copy(outputs, cache->outputs);
     } else {
-      btc_hash256_init(&ctx);
-
-      for (i = 0; i < tx->outputs.length; i++)
-        btc_output_update(&ctx, tx->outputs.items[i]);
-
-      btc_hash256_final(&ctx, outputs);
+      btc_tx_hash_outputs(outputs, tx);
 
       if (cache != NULL) {
         btc_hash_copy(cache->outputs, outputs);
@@ -372,14 +443,414 @@ btc_tx_sighash(uint8_t *hash,
   btc_abort(); /* LCOV_EXCL_LINE */
 }
 
+int
+btc_tx_sighash_taproot(uint8_t *hash,
+                       const btc_tx_t *tx,
+                       size_t index,
+                       const btc_script_t *prev,
+                       int64_t value,
+                       int type,
+                       const uint8_t *annex,
+                       const uint8_t *leaf,
+                       uint32_t codesep,
+                       const btc_tx_cache_t *cache) {
+  /* BIP341 signature message (with the BIP342
+     extension if `leaf` is non-null). */
+  const btc_input_t *input = tx->inputs.items[index];
+  int output_type = (type == 0) ? BTC_SIGHASH_ALL : (type & 3);
+  int anyonecanpay = (type & BTC_SIGHASH_ANYONECANPAY);
+  btc_hash256_t ctx;
+
+  if (cache == NULL || !cache->has_taproot)
+    return 0;
+
+  if (type > 0x03 && (type < 0x81 || type > 0x83))
+    return 0;
+
+  if (output_type == BTC_SIGHASH_SINGLE && index >= tx->outputs.length)
+    return 0;
+
+  btc_tagged_init(&ctx, "TapSighash");
+
+  btc_uint8_update(&ctx, 0); /* epoch */
+  btc_uint8_update(&ctx, type);
+  btc_uint32_update(&ctx, tx->version);
+  btc_uint32_update(&ctx, tx->locktime);
+
+  if (!anyonecanpay) {
+    btc_raw_update(&ctx, cache->tap_prevouts, 32);
+    btc_raw_update(&ctx, cache->tap_amounts, 32);
+    btc_raw_update(&ctx, cache->tap_scripts, 32);
+    btc_raw_update(&ctx, cache->tap_sequences, 32);
+  }
+
+  if (output_type == BTC_SIGHASH_ALL)
+    btc_raw_update(&ctx, cache->tap_outputs, 32);
+
+  btc_uint8_update(&ctx, (leaf != NULL) * 2 + (annex != NULL));
+
+  if (anyonecanpay) {
+    btc_outpoint_update(&ctx, &input->prevout);
+    btc_int64_update(&ctx, value);
+    btc_script_update(&ctx, prev);
+    btc_uint32_update(&ctx, input->sequence);
+  } else {
+    btc_uint32_update(&ctx, index);
+  }
+
+  if (annex != NULL)
+    btc_raw_update(&ctx, annex, 32);
+
+  if (output_type == BTC_SIGHASH_SINGLE) {
+    btc_hash256_t out;
+    uint8_t tmp[32];
+
+    btc_sha256_init(&out);
+    btc_output_update(&out, tx->outputs.items[index]);
+    btc_sha256_final(&out, tmp);
+
+    btc_raw_update(&ctx, tmp, 32);
+  }
+
+  if (leaf != NULL) {
+    btc_raw_update(&ctx, leaf, 32);
+    btc_uint8_update(&ctx, 0); /* key_version */
+    btc_uint32_update(&ctx, codesep);
+  }
+
+  btc_sha256_final(&ctx, hash);
+
+  return 1;
+}
+
+static void
+btc_tx_cache_taproot(btc_tx_cache_t *cache,
+                     const btc_tx_t *tx,
+                     const btc_view_t *view) {
+  /* Taproot commits to every spent output, so
+     only do the extra hashing when one is spent. */
+  btc_hash256_t prevouts, amounts, scripts, sequences, outputs;
+  const btc_input_t *input;
+  const btc_coin_t *coin;
+  btc_program_t program;
+  int found = 0;
+  size_t i;
+
+  cache->has_taproot = 0;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    input = tx->inputs.items[i];
+    coin = btc_view_get(view, &input->prevout);
+
+    if (coin == NULL)
+      return;
+
+    if (btc_script_get_program(&program, &coin->output.script))
+      found |= (program.version == 1);
+  }
+
+  if (!found)
+    return;
+
+  btc_sha256_init(&prevouts);
+  btc_sha256_init(&amounts);
+  btc_sha256_init(&scripts);
+  btc_sha256_init(&sequences);
+  btc_sha256_init(&outputs);
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    input = tx->inputs.items[i];
+    coin = btc_view_get(view, &input->prevout);
+
+    btc_outpoint_update(&prevouts, &input->prevout);
+    btc_int64_update(&amounts, coin->output.value);
+    btc_script_update(&scripts, &coin->output.script);
+    btc_uint32_update(&sequences, input->sequence);
+  }
+
+  for (i = 0; i < tx->outputs.length; i++)
+    btc_output_update(&outputs, tx->outputs.items[i]);
+
+  btc_sha256_final(&prevouts, cache->tap_prevouts);
+  btc_sha256_final(&amounts, cache->tap_amounts);
+  btc_sha256_final(&scripts, cache->tap_scripts);
+  btc_sha256_final(&sequences, cache->tap_sequences);
+  btc_sha256_final(&outputs, cache->tap_outputs);
+
+  cache->has_taproot = 1;
+}
+
+void
+btc_tx_cache_init(btc_tx_cache_t *cache,
+                  const btc_tx_t *tx,
+                  const btc_view_t *view) {
+  /* Precompute the BIP143 (and BIP341) midstates so
+     the cache can be shared (read-only) between threads. */
+  btc_tx_hash_prevouts(cache->prevouts, tx);
+  btc_tx_hash_sequences(cache->sequences, tx);
+  btc_tx_hash_outputs(cache->outputs, tx);
+
+  cache->has_prevouts = 1;
+  cache->has_sequences = 1;
+  cache->has_outputs = 1;
+  cache->has_taproot = 0;
+  cache->batch = NULL;
+  cache->scripts = NULL;
+  cache->info = NULL;
+
+  if (view != NULL)
+    btc_tx_cache_taproot(cache, tx, view);
+}
+
+static btc_opvec_t *
+btc_tx_decode_scripts(const btc_tx_t *tx) {
+  /* One allocation: the vectors followed by their opcodes. */
+  size_t length = tx->inputs.length;
+  btc_opvec_t *scripts;
+  btc_opcode_t *items;
+  size_t i, total = 0;
+
+  if (length == 0)
+    return NULL;
+
+  for (i = 0; i < length; i++)
+    total += btc_opvec_count(&tx->inputs.items[i]->script);
+
+  scripts = btc_malloc(length * sizeof(btc_opvec_t)
+                     + total * sizeof(btc_opcode_t));
+
+  items = (btc_opcode_t *)(scripts + length);
+
+  for (i = 0; i < length; i++) {
+    btc_opvec_rwset(&scripts[i], items, total);
+    btc_opvec_set(&scripts[i], &tx->inputs.items[i]->script);
+
+    items += scripts[i].length;
+    total -= scripts[i].length;
+  }
+
+  return scripts;
+}
+
+static void
+btc_txin_analyze(btc_txin_info_t *info,
+                 const btc_tx_t *tx,
+                 size_t index,
+                 const btc_script_t *prev,
+                 const btc_opvec_t *ops) {
+  /* Everything the policy and sigop checks want
+     to know about an input, from one decoding. */
+  const btc_input_t *input = tx->inputs.items[index];
+  const btc_stack_t *witness = &input->witness;
+  const btc_script_t *script = prev;
+  btc_program_t program;
+  size_t i;
+
+  info->type = BTC_PREVOUT_STANDARD;
+  info->has_redeem = 0;
+  info->version = -1;
+  info->program_len = 0;
+  info->p2sh_sigops = 0;
+  info->witness_sigops = 0;
+  info->standard_witness = 1;
+
+  btc_script_init(&info->redeem);
+
+  if (btc_script_is_p2pkh(prev)) {
+    info->type = BTC_PREVOUT_P2PKH;
+  } else if (btc_script_is_p2sh(prev)) {
+    info->type = BTC_PREVOUT_P2SH;
+
+    if (ops != NULL)
+      info->has_redeem = btc_opvec_get_redeem(&info->redeem, ops);
+    else
+      info->has_redeem = btc_script_get_redeem(&info->redeem, &input->script);
+
+    if (info->has_redeem)
+      info->p2sh_sigops = btc_script_sigops(&info->redeem, 1);
+
+    script = info->has_redeem ? &info->redeem : NULL;
+  } else if (btc_script_is_unknown(prev)) {
+    info->type = BTC_PREVOUT_UNKNOWN;
+  }
+
+  if (script != NULL && btc_script_get_program(&program, script)) {
+    info->version = program.version;
+    info->program_len = program.length;
+  }
+
+  if (info->version == 0) {
+    if (info->program_len == 20)
+      info->witness_sigops = 1;
+    else if (info->program_len == 32 && witness->length > 0)
+      info->witness_sigops = btc_script_sigops(btc_stack_top(witness), 1);
+  }
+
+  if (witness->length == 0)
+    return;
+
+  if (info->version < 0) {
+    info->standard_witness = 0;
+    return;
+  }
+
+  /* The annex is reserved for future upgrades. */
+  if (info->type != BTC_PREVOUT_P2SH
+      && info->version == 1 && info->program_len == 32) {
+    const btc_buffer_t *top = btc_stack_top(witness);
+
+    if (witness->length >= 2 && top->length > 0 && top->data[0] == 0x50)
+      info->standard_witness = 0;
+
+    return;
+  }
+
+  if (info->version == 0 && info->program_len == 32) {
+    if (btc_stack_top(witness)->length > BTC_MAX_P2WSH_SIZE)
+      info->standard_witness = 0;
+
+    if (witness->length - 1 > BTC_MAX_P2WSH_STACK)
+      info->standard_witness = 0;
+
+    for (i = 0; i < witness->length - 1; i++) {
+      if (witness->items[i]->length > BTC_MAX_P2WSH_PUSH)
+        info->standard_witness = 0;
+    }
+  }
+}
+
+const btc_tx_cache_t *
+btc_tx_precompute(const btc_tx_t *tx, const btc_view_t *view) {
+  /* Computed once per tx and read-only afterwards. Must be
+     called before the tx is shared with other threads. */
+  btc_tx_t *self = (btc_tx_t *)tx;
+  const btc_coin_t *coin;
+  btc_tx_cache_t *cache;
+  size_t i;
+
+  if (tx->_cache != NULL)
+    return tx->_cache;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    if (!btc_view_has(view, &tx->inputs.items[i]->prevout))
+      return NULL;
+  }
+
+  cache = (btc_tx_cache_t *)btc_malloc(sizeof(btc_tx_cache_t));
+
+  /* Only segwit spends use the midstates. */
+  if (btc_tx_has_witness(tx))
+    btc_tx_cache_init(cache, tx, view);
+  else
+    memset(cache, 0, sizeof(*cache));
+
+  /* Decode each input script once for the interpreter,
+     sigop counting and the standardness checks. */
+  cache->scripts = btc_tx_decode_scripts(tx);
+  cache->info = NULL;
+
+  if (tx->inputs.length > 0) {
+    cache->info = btc_malloc(tx->inputs.length * sizeof(btc_txin_info_t));
+
+    for (i = 0; i < tx->inputs.length; i++) {
+      coin = btc_view_get(view, &tx->inputs.items[i]->prevout);
+
+      btc_txin_analyze(&cache->info[i], tx, i,
+                       &coin->output.script,
+                       &cache->scripts[i]);
+    }
+  }
+
+  self->_cache = cache;
+
+  return cache;
+}
+
+size_t
+btc_tx_cache_usage(const btc_tx_t *tx) {
+  /* What btc_tx_precompute allocates. Derived from the tx
+     alone so that it is stable whether or not the cache
+     has been built yet. */
+  size_t usage = btc_malloc_usage(sizeof(btc_tx_cache_t));
+  size_t i, count = 0;
+
+  for (i = 0; i < tx->inputs.length; i++)
+    count += btc_opvec_count(&tx->inputs.items[i]->script);
+
+  usage += btc_malloc_usage(tx->inputs.length * sizeof(btc_opvec_t)
+                          + count * sizeof(btc_opcode_t));
+
+  usage += btc_malloc_usage(tx->inputs.length * sizeof(btc_txin_info_t));
+
+  return usage;
+}
+
+static const btc_opvec_t *
+btc_tx_decoded(const btc_tx_t *tx, size_t index) {
+  if (tx->_cache == NULL || tx->_cache->scripts == NULL)
+    return NULL;
+
+  return &tx->_cache->scripts[index];
+}
+
+static int
+btc_tx_is_push_only(const btc_tx_t *tx, size_t index) {
+  const btc_opvec_t *ops = btc_tx_decoded(tx, index);
+
+  if (ops != NULL)
+    return btc_opvec_is_push_only(ops);
+
+  return btc_script_is_push_only(&tx->inputs.items[index]->script);
+}
+
+static const btc_txin_info_t *
+btc_tx_info(btc_txin_info_t *tmp,
+            const btc_tx_t *tx,
+            size_t index,
+            const btc_view_t *view) {
+  /* The precomputed analysis, or a fresh one. */
+  const btc_input_t *input = tx->inputs.items[index];
+  const btc_coin_t *coin;
+
+  if (tx->_cache != NULL && tx->_cache->info != NULL)
+    return &tx->_cache->info[index];
+
+  coin = btc_view_get(view, &input->prevout);
+
+  if (coin == NULL)
+    return NULL;
+
+  btc_txin_analyze(tmp, tx, index, &coin->output.script, NULL);
+
+  return tmp;
+}
+
 int
 btc_tx_verify(const btc_tx_t *tx, const btc_view_t *view, unsigned int flags) {
+  return btc_tx_verify_batch(tx, view, flags, NULL);
+}
+
+int
+btc_tx_verify_batch(const btc_tx_t *tx,
+                    const btc_view_t *view,
+                    unsigned int flags,
+                    btc_sigbatch_t *batch) {
   const btc_input_t *input;
   const btc_coin_t *coin;
   btc_tx_cache_t cache;
   size_t i;
 
-  memset(&cache, 0, sizeof(cache));
+  if (tx->_cache != NULL) {
+    /* Our own copy so that it can hold the batch. */
+    cache = *tx->_cache;
+  } else {
+    memset(&cache, 0, sizeof(cache));
+
+    if (btc_tx_has_witness(tx))
+      btc_tx_cache_taproot(&cache, tx, view);
+  }
+
+  cache.batch = batch;
 
   for (i = 0; i < tx->inputs.length; i++) {
     input = tx->inputs.items[i];
@@ -537,16 +1008,22 @@ btc_tx_fee(const btc_tx_t *tx, const btc_view_t *view) {
   return inpval - btc_tx_output_value(tx);
 }
 
-int
-btc_tx_legacy_sigops(const btc_tx_t *tx) {
+static int
+btc_tx__legacy_sigops(const btc_tx_t *tx) {
   const btc_input_t *input;
   const btc_output_t *output;
   int total = 0;
   size_t i;
 
   for (i = 0; i < tx->inputs.length; i++) {
+    const btc_opvec_t *ops = btc_tx_decoded(tx, i);
+
     input = tx->inputs.items[i];
-    total += btc_script_sigops(&input->script, 0);
+
+    if (ops != NULL)
+      total += btc_opvec_sigops(ops, 0);
+    else
+      total += btc_script_sigops(&input->script, 0);
   }
 
   for (i = 0; i < tx->outputs.length; i++) {
@@ -557,10 +1034,23 @@ btc_tx_legacy_sigops(const btc_tx_t *tx) {
   return total;
 }
 
+int
+btc_tx_legacy_sigops(const btc_tx_t *tx) {
+  if (tx->_sigops < 0)
+    return btc_tx__legacy_sigops(tx);
+
+#ifdef BTC_DEBUG
+  /* Mutated without a refresh? */
+  ASSERT(tx->_sigops == btc_tx__legacy_sigops(tx));
+#endif
+
+  return tx->_sigops;
+}
+
 int
 btc_tx_p2sh_sigops(const btc_tx_t *tx, const btc_view_t *view) {
-  const btc_input_t *input;
-  const btc_coin_t *coin;
+  const btc_txin_info_t *info;
+  btc_txin_info_t tmp;
   int total = 0;
   size_t i;
 
@@ -568,16 +1058,10 @@ btc_tx_p2sh_sigops(const btc_tx_t *tx, const btc_view_t *view) {
     return 0;
 
   for (i = 0; i < tx->inputs.length; i++) {
-    input = tx->inputs.items[i];
-    coin = btc_view_get(view, &input->prevout);
-
-    if (coin == NULL)
-      continue;
-
-    if (!btc_script_is_p2sh(&coin->output.script))
-      continue;
+    info = btc_tx_info(&tmp, tx, i, view);
 
-    total += btc_script_p2sh_sigops(&coin->output.script, &input->script);
+    if (info != NULL)
+      total += info->p2sh_sigops;
   }
 
   return total;
@@ -585,8 +1069,8 @@ btc_tx_p2sh_sigops(const btc_tx_t *tx, const btc_view_t *view) {
 
 int
 btc_tx_witness_sigops(const btc_tx_t *tx, const btc_view_t *view) {
-  const btc_input_t *input;
-  const btc_coin_t *coin;
+  const btc_txin_info_t *info;
+  btc_txin_info_t tmp;
   int total = 0;
   size_t i;
 
@@ -594,15 +1078,10 @@ btc_tx_witness_sigops(const btc_tx_t *tx, const btc_view_t *view) {
     return 0;
 
   for (i = 0; i < tx->inputs.length; i++) {
-    input = tx->inputs.items[i];
-    coin = btc_view_get(view, &input->prevout);
-
-    if (coin == NULL)
-      continue;
+    info = btc_tx_info(&tmp, tx, i, view);
 
-    total += btc_script_witness_sigops(&coin->output.script,
-                                       &input->script,
-                                       &input->witness);
+    if (info != NULL)
+      total += info->witness_sigops;
   }
 
   return total;
@@ -779,7 +1258,7 @@ btc_tx_check_standard(btc_verify_error_t *err, const btc_tx_t *tx) {
     if (input->script.length > 1650)
       THROW("scriptsig-size", 0, 0);
 
-    if (!btc_script_is_push_only(&input->script))
+    if (!btc_tx_is_push_only(tx, i))
       THROW("scriptsig-not-pushonly", 0, 0);
   }
 
@@ -813,36 +1292,31 @@ btc_tx_check_standard(btc_verify_error_t *err, const btc_tx_t *tx) {
 
 int
 btc_tx_has_standard_inputs(const btc_tx_t *tx, const btc_view_t *view) {
-  const btc_input_t *input;
-  const btc_coin_t *coin;
-  btc_script_t redeem;
+  const btc_txin_info_t *info;
+  btc_txin_info_t tmp;
   size_t i;
 
   if (btc_tx_is_coinbase(tx))
     return 1;
 
   for (i = 0; i < tx->inputs.length; i++) {
-    input = tx->inputs.items[i];
-    coin = btc_view_get(view, &input->prevout);
+    info = btc_tx_info(&tmp, tx, i, view);
 
-    if (coin == NULL)
+    if (info == NULL)
       return 0;
 
-    if (btc_script_is_p2pkh(&coin->output.script))
-      continue;
-
-    if (btc_script_is_p2sh(&coin->output.script)) {
-      if (!btc_script_get_redeem(&redeem, &input->script))
+    switch (info->type) {
+      case BTC_PREVOUT_UNKNOWN:
         return 0;
+      case BTC_PREVOUT_P2SH:
+        if (!info->has_redeem)
+          return 0;
 
-      if (btc_script_sigops(&redeem, 1) > BTC_MAX_P2SH_SIGOPS)
-        return 0;
+        if (info->p2sh_sigops > BTC_MAX_P2SH_SIGOPS)
+          return 0;
 
-      continue;
+        break;
     }
-
-    if (btc_script_is_unknown(&coin->output.script))
-      return 0;
   }
 
   return 1;
@@ -850,51 +1324,21 @@ btc_tx_has_standard_inputs(const btc_tx_t *tx, const btc_view_t *view) {
 
 int
 btc_tx_has_standard_witness(const btc_tx_t *tx, const btc_view_t *view) {
-  const btc_input_t *input;
-  const btc_stack_t *witness;
-  const btc_coin_t *coin;
-  btc_script_t prev;
-  size_t i, j;
+  const btc_txin_info_t *info;
+  btc_txin_info_t tmp;
+  size_t i;
 
   if (btc_tx_is_coinbase(tx))
     return 1;
 
   for (i = 0; i < tx->inputs.length; i++) {
-    input = tx->inputs.items[i];
-    witness = &input->witness;
-
-    if (witness->length == 0)
+    if (tx->inputs.items[i]->witness.length == 0)
       continue;
 
-    coin = btc_view_get(view, &input->prevout);
-
-    if (coin == NULL)
-      return 0;
-
-    btc_script_rocopy(&prev, &coin->output.script);
-
-    if (btc_script_is_p2sh(&prev)) {
-      if (!btc_script_get_redeem(&prev, &input->script))
-        return 0;
-    }
+    info = btc_tx_info(&tmp, tx, i, view);
 
-    if (!btc_script_is_program(&prev))
+    if (info == NULL || !info->standard_witness)
       return 0;
-
-    if (btc_script_is_p2wsh(&prev)) {
-      if (btc_stack_top(witness)->length > BTC_MAX_P2WSH_SIZE)
-        return 0;
-
-      if (witness->length - 1 > BTC_MAX_P2WSH_STACK)
-        return 0;
-
-      for (j = 0; j < witness->length - 1; j++) {
-        if (witness->items[j]->length > BTC_MAX_P2WSH_PUSH)
-          return 0;
-      }
-
-      continue;
-    }
   }
 
   return 1;
@@ -1076,6 +1520,8 @@ btc_tx_add_input(btc_tx_t *tx, const uint8_t *hash, uint32_t index) {
   btc_outpoint_set(&input->prevout, hash, index);
 
   btc_inpvec_push(&tx->inputs, input);
+
+  btc_tx_uncache(tx);
 }
 
 void
@@ -1085,6 +1531,8 @@ btc_tx_add_outpoint(btc_tx_t *tx, const btc_outpoint_t *prevout) {
   btc_outpoint_copy(&input->prevout, prevout);
 
   btc_inpvec_push(&tx->inputs, input);
+
+  btc_tx_uncache(tx);
 }
 
 void
@@ -1096,6 +1544,8 @@ btc_tx_add_output(btc_tx_t *tx, const btc_address_t *addr, int64_t value) {
   output->value = value;
 
   btc_outvec_push(&tx->outputs, output);
+
+  btc_tx_uncache(tx);
 }
 
 void
@@ -1105,6 +1555,8 @@ btc_tx_add_nulldata(btc_tx_t *tx, const uint8_t *data, size_t length) {
   btc_script_set_nulldata(&output->script, data, length);
 
   btc_outvec_push(&tx->outputs, output);
+
+  btc_tx_uncache(tx);
 }
 
 void
@@ -1165,10 +1617,13 @@ btc_tx_sort(btc_tx_t *tx) {
         tx->outputs.length,
         sizeof(btc_output_t *),
         output_compare);
+
+  /* The script cache is kept by input index. */
+  btc_tx_uncache(tx);
 }
 
-size_t
-btc_tx_base_size(const btc_tx_t *tx) {
+static size_t
+btc_tx__base_size(const btc_tx_t *tx) {
   size_t size = 0;
 
   size += 4;
@@ -1180,7 +1635,21 @@ btc_tx_base_size(const btc_tx_t *tx) {
 }
 
 size_t
-btc_tx_witness_size(const btc_tx_t *tx) {
+btc_tx_base_size(const btc_tx_t *tx) {
+  /* Memoized by btc_tx_read and btc_tx_refresh. */
+  if (tx->_base_size == 0)
+    return btc_tx__base_size(tx);
+
+#ifdef BTC_DEBUG
+  /* Mutated without a refresh? */
+  ASSERT(tx->_base_size == btc_tx__base_size(tx));
+#endif
+
+  return tx->_base_size;
+}
+
+static size_t
+btc_tx__witness_size(const btc_tx_t *tx) {
   size_t size = 0;
   size_t i;
 
@@ -1194,6 +1663,18 @@ btc_tx_witness_size(const btc_tx_t *tx) {
   return size;
 }
 
+size_t
+btc_tx_witness_size(const btc_tx_t *tx) {
+  if (tx->_base_size == 0)
+    return btc_tx__witness_size(tx);
+
+#ifdef BTC_DEBUG
+  ASSERT(tx->_witness_size == btc_tx__witness_size(tx));
+#endif
+
+  return tx->_witness_size;
+}
+
 size_t
 btc_tx_size(const btc_tx_t *tx) {
   return btc_tx_base_size(tx) + btc_tx_witness_size(tx);
@@ -1224,6 +1705,45 @@ btc_tx_sigops_size(const btc_tx_t *tx, int sigops) {
   return (weight + BTC_WITNESS_SCALE_FACTOR - 1) / BTC_WITNESS_SCALE_FACTOR;
 }
 
+static size_t
+btc_stack_usage(const btc_stack_t *stack) {
+  size_t usage = btc_malloc_usage(stack->alloc * sizeof(btc_buffer_t *));
+  size_t i;
+
+  for (i = 0; i < stack->length; i++) {
+    usage += btc_malloc_usage(sizeof(btc_buffer_t));
+    usage += btc_buffer_usage(stack->items[i]);
+  }
+
+  return usage;
+}
+
+size_t
+btc_tx_usage(const btc_tx_t *tx) {
+  size_t usage = btc_malloc_usage(sizeof(btc_tx_t));
+  size_t i;
+
+  usage += btc_malloc_usage(tx->inputs.alloc * sizeof(btc_input_t *));
+  usage += btc_malloc_usage(tx->outputs.alloc * sizeof(btc_output_t *));
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    usage += btc_malloc_usage(sizeof(btc_input_t));
+    usage += btc_script_usage(&input->script);
+    usage += btc_stack_usage(&input->witness);
+  }
+
+  for (i = 0; i < tx->outputs.length; i++) {
+    const btc_output_t *output = tx->outputs.items[i];
+
+    usage += btc_malloc_usage(sizeof(btc_output_t));
+    usage += btc_script_usage(&output->script);
+  }
+
+  return usage;
+}
+
 uint8_t *
 btc_tx_base_write(uint8_t *zp, const btc_tx_t *tx) {
   zp = btc_uint32_write(zp, tx->version);
@@ -1258,13 +1778,42 @@ btc_tx_write(uint8_t *zp, const btc_tx_t *tx) {
   return zp;
 }
 
+static void
+btc_tx_finish(btc_tx_t *z, const uint8_t *sp, const uint8_t *ep, size_t wit) {
+  if (wit) {
+    /* Hash the stripped encoding in place: it is the
+       witness encoding minus the marker and witness. */
+    size_t base = (ep - sp) - wit;
+    btc_hash256_t ctx;
+
+    btc_hash256_init(&ctx);
+    btc_hash256_update(&ctx, sp, 4);
+    btc_hash256_update(&ctx, sp + 6, base - 8);
+    btc_hash256_update(&ctx, ep - 4, 4);
+    btc_hash256_final(&ctx, z->hash);
+
+    btc_hash256(z->whash, sp, ep - sp);
+  } else {
+    btc_hash256(z->hash, sp, ep - sp);
+    btc_hash_copy(z->whash, z->hash);
+  }
+
+  z->_base_size = (ep - sp) - wit;
+  z->_witness_size = wit;
+  z->_sigops = btc_tx__legacy_sigops(z);
+}
+
 int
 btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
   const uint8_t *sp = *xp;
   unsigned int flags = 0;
-  int witness = 0;
+  size_t witness = 0;
+  const uint8_t *wp;
   size_t i;
 
+  btc_tx_release(z);
+  btc_tx_uncache(z);
+
   if (!btc_uint32_read(&z->version, xp, xn))
     return 0;
 
@@ -1282,6 +1831,7 @@ btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
 
   if (flags & 1) {
     flags ^= 1;
+    wp = *xp;
 
     for (i = 0; i < z->inputs.length; i++) {
       if (!btc_stack_read(&z->inputs.items[i]->witness, xp, xn))
@@ -1291,7 +1841,253 @@ btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
     if (!btc_tx_has_witness(z))
       return 0;
 
-    witness = 1;
+    /* Marker, flag and the witness stacks. */
+    witness = 2 + (*xp - wp);
+  }
+
+  if (flags != 0)
+    return 0;
+
+  if (!btc_uint32_read(&z->locktime, xp, xn))
+    return 0;
+
+  btc_tx_finish(z, sp, *xp, witness);
+
+  return 1;
+}
+
+/*
+ * Transaction Slab
+ */
+
+/* Decoding one object at a time costs a malloc per
+ * input, output, script and witness item, and the
+ * same again in free. Block transactions are read
+ * into a single allocation instead: a first pass
+ * sizes the object graph, a second lays it out.
+ *
+ * Slab transactions must not be edited in place.
+ * btc_tx_copy and btc_tx_read release the slab
+ * before writing; nothing else mutates a decoded
+ * block transaction.
+ */
+
+typedef struct btc_txshape_s {
+  size_t inputs;
+  size_t outputs;
+  size_t items;
+  size_t bytes;
+} btc_txshape_t;
+
+static int
+btc_slab_skip(size_t *bytes, const uint8_t **xp, size_t *xn) {
+  const uint8_t *zp;
+  size_t zn;
+
+  if (!btc_size_read(&zn, xp, xn))
+    return 0;
+
+  if (!btc_zraw_read(&zp, zn, xp, xn))
+    return 0;
+
+  *bytes += zn;
+
+  return 1;
+}
+
+static int
+btc_tx_measure(btc_txshape_t *shape, const uint8_t *xp, size_t xn) {
+  unsigned int flags = 0;
+  size_t i, j, count;
+
+  memset(shape, 0, sizeof(*shape));
+
+  if (xn < 4)
+    return 0;
+
+  xp += 4;
+  xn -= 4;
+
+  if (xn >= 2 && xp[0] == 0 && xp[1] != 0) {
+    flags = xp[1];
+    xp += 2;
+    xn -= 2;
+  }
+
+  if (!btc_size_read(&shape->inputs, &xp, &xn))
+    return 0;
+
+  for (i = 0; i < shape->inputs; i++) {
+    if (xn < 36)
+      return 0;
+
+    xp += 36;
+    xn -= 36;
+
+    if (!btc_slab_skip(&shape->bytes, &xp, &xn) || xn < 4)
+      return 0;
+
+    xp += 4;
+    xn -= 4;
+  }
+
+  if (!btc_size_read(&shape->outputs, &xp, &xn))
+    return 0;
+
+  for (i = 0; i < shape->outputs; i++) {
+    if (xn < 8)
+      return 0;
+
+    xp += 8;
+    xn -= 8;
+
+    if (!btc_slab_skip(&shape->bytes, &xp, &xn))
+      return 0;
+  }
+
+  if (flags & 1) {
+    for (i = 0; i < shape->inputs; i++) {
+      if (!btc_size_read(&count, &xp, &xn))
+        return 0;
+
+      for (j = 0; j < count; j++) {
+        if (!btc_slab_skip(&shape->bytes, &xp, &xn))
+          return 0;
+      }
+
+      shape->items += count;
+    }
+  }
+
+  return 1;
+}
+
+static void
+btc_slab_buffer(btc_buffer_t *z, uint8_t **bp,
+                const uint8_t **xp, size_t *xn) {
+  size_t zn;
+
+  CHECK(btc_size_read(&zn, xp, xn));
+
+  btc_buffer_init(z);
+
+  if (zn > 0) {
+    CHECK(btc_raw_read(*bp, zn, xp, xn));
+
+    z->data = *bp;
+    z->length = zn;
+
+    *bp += zn;
+  }
+
+  z->_refs = 1;
+}
+
+int
+btc_tx_read_slab(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
+  const uint8_t *sp = *xp;
+  unsigned int flags = 0;
+  btc_buffer_t **items;
+  btc_buffer_t *bufs;
+  btc_txshape_t shape;
+  size_t witness = 0;
+  btc_input_t *ins;
+  btc_output_t *outs;
+  const uint8_t *wp;
+  uint8_t *slab, *bp;
+  size_t i, j, size, count;
+
+  if (!btc_tx_measure(&shape, *xp, *xn))
+    return 0;
+
+  btc_tx_clear(z);
+
+  size = shape.inputs * sizeof(btc_input_t)
+       + shape.outputs * sizeof(btc_output_t)
+       + shape.items * sizeof(btc_buffer_t)
+       + shape.inputs * sizeof(btc_input_t *)
+       + shape.outputs * sizeof(btc_output_t *)
+       + shape.items * sizeof(btc_buffer_t *)
+       + shape.bytes;
+
+  /* Widest members first so nothing is misaligned. */
+  slab = (uint8_t *)btc_malloc(size > 0 ? size : 1);
+
+  ins = (btc_input_t *)slab;
+  outs = (btc_output_t *)(ins + shape.inputs);
+  bufs = (btc_buffer_t *)(outs + shape.outputs);
+  z->inputs.items = (btc_input_t **)(bufs + shape.items);
+  z->outputs.items = (btc_output_t **)(z->inputs.items + shape.inputs);
+  items = (btc_buffer_t **)(z->outputs.items + shape.outputs);
+  bp = (uint8_t *)(items + shape.items);
+
+  z->_slab = slab;
+
+  /* The shape pass validated the framing. */
+  CHECK(btc_uint32_read(&z->version, xp, xn));
+
+  if (*xn >= 2 && (*xp)[0] == 0 && (*xp)[1] != 0) {
+    flags = (*xp)[1];
+    *xp += 2;
+    *xn -= 2;
+  }
+
+  CHECK(btc_size_read(&count, xp, xn));
+
+  for (i = 0; i < shape.inputs; i++) {
+    btc_input_t *input = &ins[i];
+
+    CHECK(btc_outpoint_read(&input->prevout, xp, xn));
+
+    btc_slab_buffer(&input->script, &bp, xp, xn);
+
+    CHECK(btc_uint32_read(&input->sequence, xp, xn));
+
+    btc_stack_init(&input->witness);
+
+    z->inputs.items[i] = input;
+  }
+
+  z->inputs.length = shape.inputs;
+
+  CHECK(btc_size_read(&count, xp, xn));
+
+  for (i = 0; i < shape.outputs; i++) {
+    btc_output_t *output = &outs[i];
+
+    CHECK(btc_int64_read(&output->value, xp, xn));
+
+    btc_slab_buffer(&output->script, &bp, xp, xn);
+
+    z->outputs.items[i] = output;
+  }
+
+  z->outputs.length = shape.outputs;
+
+  if (flags & 1) {
+    flags ^= 1;
+    wp = *xp;
+
+    for (i = 0; i < shape.inputs; i++) {
+      btc_stack_t *stack = &ins[i].witness;
+
+      CHECK(btc_size_read(&count, xp, xn));
+
+      if (count > 0)
+        stack->items = items;
+
+      stack->length = count;
+
+      for (j = 0; j < count; j++) {
+        btc_slab_buffer(bufs, &bp, xp, xn);
+        *items++ = bufs++;
+      }
+    }
+
+    if (!btc_tx_has_witness(z))
+      return 0;
+
+    witness = 2 + (*xp - wp);
   }
 
   if (flags != 0)
@@ -1300,17 +2096,177 @@ btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
   if (!btc_uint32_read(&z->locktime, xp, xn))
     return 0;
 
+  btc_tx_finish(z, sp, *xp, witness);
+
+  return 1;
+}
+
+/*
+ * Raw Transaction Scanning
+ */
+
+/* Walks the inputs and outputs of a serialized
+ * transaction in place, without allocating. This
+ * is for scanning many blocks for a handful of
+ * scripts, where decoding every transaction would
+ * dominate. The first pass validates the framing
+ * and records where the witness begins, so that
+ * callbacks can compute the txid on a match.
+ */
+
+static int
+btc_rawtx_skip(const uint8_t **xp, size_t *xn) {
+  const uint8_t *zp;
+  size_t zn;
+
+  if (!btc_size_read(&zn, xp, xn))
+    return 0;
+
+  return btc_zraw_read(&zp, zn, xp, xn);
+}
+
+static int
+btc_rawtx_frame(btc_rawtx_t *tx, const uint8_t **xp, size_t *xn) {
+  const uint8_t *sp = *xp;
+  size_t i, j, inputs, outputs, count;
+  int witness = 0;
+
+  if (*xn < 4)
+    return 0;
+
+  *xp += 4;
+  *xn -= 4;
+
+  if (*xn >= 2 && (*xp)[0] == 0 && (*xp)[1] != 0) {
+    if ((*xp)[1] != 1)
+      return 0;
+
+    witness = 1;
+
+    *xp += 2;
+    *xn -= 2;
+  }
+
+  tx->body = *xp - sp;
+
+  if (!btc_size_read(&inputs, xp, xn))
+    return 0;
+
+  for (i = 0; i < inputs; i++) {
+    if (*xn < 36)
+      return 0;
+
+    *xp += 36;
+    *xn -= 36;
+
+    if (!btc_rawtx_skip(xp, xn) || *xn < 4)
+      return 0;
+
+    *xp += 4;
+    *xn -= 4;
+  }
+
+  if (!btc_size_read(&outputs, xp, xn))
+    return 0;
+
+  for (i = 0; i < outputs; i++) {
+    if (*xn < 8)
+      return 0;
+
+    *xp += 8;
+    *xn -= 8;
+
+    if (!btc_rawtx_skip(xp, xn))
+      return 0;
+  }
+
+  tx->witness = *xp - sp;
+
   if (witness) {
-    btc_tx_txid(z->hash, z);
-    btc_hash256(z->whash, sp, *xp - sp);
-  } else {
-    btc_hash256(z->hash, sp, *xp - sp);
-    btc_hash_copy(z->whash, z->hash);
+    for (i = 0; i < inputs; i++) {
+      if (!btc_size_read(&count, xp, xn))
+        return 0;
+
+      for (j = 0; j < count; j++) {
+        if (!btc_rawtx_skip(xp, xn))
+          return 0;
+      }
+    }
+  }
+
+  if (*xn < 4)
+    return 0;
+
+  *xp += 4;
+  *xn -= 4;
+
+  tx->data = sp;
+  tx->length = *xp - sp;
+
+  return 1;
+}
+
+int
+btc_tx_scan(btc_rawtx_t *tx,
+            const uint8_t **xp,
+            size_t *xn,
+            btc_rawin_f *on_input,
+            btc_rawout_f *on_output,
+            void *arg) {
+  const uint8_t *zp, *script;
+  size_t i, zn, count, len;
+  uint64_t value;
+
+  if (!btc_rawtx_frame(tx, xp, xn))
+    return 0;
+
+  /* The framing pass validated everything below. */
+  zp = tx->data + tx->body;
+  zn = tx->witness - tx->body;
+
+  CHECK(btc_size_read(&count, &zp, &zn));
+
+  for (i = 0; i < count; i++) {
+    if (on_input != NULL)
+      on_input(tx, i, zp, arg);
+
+    zp += 36;
+    zn -= 36;
+
+    CHECK(btc_rawtx_skip(&zp, &zn));
+
+    zp += 4;
+    zn -= 4;
+  }
+
+  if (on_output == NULL)
+    return 1;
+
+  CHECK(btc_size_read(&count, &zp, &zn));
+
+  for (i = 0; i < count; i++) {
+    CHECK(btc_uint64_read(&value, &zp, &zn));
+    CHECK(btc_size_read(&len, &zp, &zn));
+    CHECK(btc_zraw_read(&script, len, &zp, &zn));
+
+    on_output(tx, i, (int64_t)value, script, len, arg);
   }
 
   return 1;
 }
 
+void
+btc_rawtx_txid(uint8_t *hash, const btc_rawtx_t *tx) {
+  btc_hash256_t ctx;
+
+  /* Version, inputs and outputs, locktime. */
+  btc_hash256_init(&ctx);
+  btc_hash256_update(&ctx, tx->data, 4);
+  btc_hash256_update(&ctx, tx->data + tx->body, tx->witness - tx->body);
+  btc_hash256_update(&ctx, tx->data + tx->length - 4, 4);
+  btc_hash256_final(&ctx, hash);
+}
+
 /*
  * Transaction Vector
  */
@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <mako/coins.h>
+#include <mako/tx.h>
 #include "impl.h"
 #include "internal.h"
 
@@ -16,3 +17,97 @@
  */
 
 DEFINE_SERIALIZABLE_VECTOR(btc_undo, btc_coin, SCOPE_EXTERN)
+
+/*
+ * Undo Compression
+ *
+ * Coin heights are stored relative to the
+ * height of the block which spent them. Most
+ * spends are of recent outputs, so the delta
+ * usually fits in a byte or two where an
+ * absolute height would take three or four.
+ */
+
+size_t
+btc_undo_deflate(const btc_undo_t *x, int32_t height) {
+  const btc_coin_t *coin;
+  size_t size = 0;
+  uint32_t flags;
+  size_t i;
+
+  size += btc_size_size(x->length);
+
+  for (i = 0; i < x->length; i++) {
+    coin = x->items[i];
+    flags = ((uint32_t)height - (uint32_t)coin->height) * 2 + coin->coinbase;
+
+    size += btc_varint_size(coin->version);
+    size += btc_varint_size(flags);
+    size += btc_output_deflate(&coin->output);
+  }
+
+  return size;
+}
+
+uint8_t *
+btc_undo_compress(uint8_t *zp, const btc_undo_t *x, int32_t height) {
+  const btc_coin_t *coin;
+  uint32_t flags;
+  size_t i;
+
+  zp = btc_size_write(zp, x->length);
+
+  for (i = 0; i < x->length; i++) {
+    coin = x->items[i];
+    flags = ((uint32_t)height - (uint32_t)coin->height) * 2 + coin->coinbase;
+
+    zp = btc_varint_write(zp, coin->version);
+    zp = btc_varint_write(zp, flags);
+    zp = btc_output_compress(zp, &coin->output);
+  }
+
+  return zp;
+}
+
+int
+btc_undo_decompress(btc_undo_t *z,
+                    const uint8_t **xp,
+                    size_t *xn,
+                    int32_t height) {
+  uint64_t version, flags;
+  btc_coin_t *coin;
+  size_t i, count;
+
+  btc_undo_reset(z);
+
+  if (!btc_size_read(&count, xp, xn))
+    return 0;
+
+  for (i = 0; i < count; i++) {
+    if (!btc_varint_read(&version, xp, xn))
+      return 0;
+
+    if (version > UINT32_MAX)
+      return 0;
+
+    if (!btc_varint_read(&flags, xp, xn))
+      return 0;
+
+    if (flags > UINT32_MAX)
+      return 0;
+
+    coin = btc_coin_create();
+    coin->version = version;
+    coin->height = (int32_t)((uint32_t)height - (uint32_t)(flags >> 1));
+    coin->coinbase = flags & 1;
+
+    if (!btc_output_decompress(&coin->output, xp, xn)) {
+      btc_coin_destroy(coin);
+      return 0;
+    }
+
+    btc_undo_push(z, coin);
+  }
+
+  return 1;
+}
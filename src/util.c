@@ -11,8 +11,13 @@
 #ifdef _WIN32
 #  include <windows.h> /* SecureZeroMemory */
 #endif
+#ifdef BTC_HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+#include <mako/crypto/rand.h>
 #include <mako/encoding.h>
 #include <mako/util.h>
+#include "bio.h"
 #include "internal.h"
 
 /*
@@ -134,6 +139,19 @@ btc_memdup(const void *xp, size_t xn) {
   return memcpy(btc_malloc(xn), xp, xn);
 }
 
+/*
+ * Memory Usage
+ */
+
+size_t
+btc_malloc_usage(size_t size) {
+  /* Approximate glibc: a two word header, rounded to 16 bytes. */
+  if (size == 0)
+    return 0;
+
+  return (size + 2 * sizeof(size_t) + 15) & ~(size_t)15;
+}
+
 /*
  * String
  */
@@ -195,6 +213,59 @@ btc_hash_export(char *zp, const uint8_t *xp) {
   btc_base16le_encode(zp, xp, 32);
 }
 
+/*
+ * Hash Key
+ */
+
+/* Keys are hash digests (or outpoints thereof),
+ * so there is nothing left for a full murmur3
+ * pass to mix. Instead we take the first 16
+ * bytes (the trailing bytes of a block hash are
+ * zero) through a salted NH round and a final
+ * multiply. The salt is drawn once per process:
+ * a peer cannot grind txids into one bucket
+ * without knowing it.
+ */
+
+static uint32_t hash_salt[4];
+
+static void
+hash_salt_init(void) {
+  btc_getrandom(hash_salt, sizeof(hash_salt));
+}
+
+#ifdef BTC_HAVE_PTHREAD
+static pthread_once_t hash_once = PTHREAD_ONCE_INIT;
+#else
+static int hash_once = 0;
+#endif
+
+uint32_t
+btc_hash_key(const uint8_t *xp, uint32_t tweak) {
+  uint64_t z;
+
+#ifdef BTC_HAVE_PTHREAD
+  if (pthread_once(&hash_once, hash_salt_init) != 0)
+    btc_abort(); /* LCOV_EXCL_LINE */
+#else
+  if (hash_once == 0) {
+    hash_salt_init();
+    hash_once = 1;
+  }
+#endif
+
+  z = (uint64_t)(btc_read32le(xp + 0) + hash_salt[0])
+    * (uint64_t)(btc_read32le(xp + 4) + hash_salt[1]);
+
+  z += (uint64_t)(btc_read32le(xp + 8) + hash_salt[2])
+     * (uint64_t)((btc_read32le(xp + 12) ^ tweak) + hash_salt[3]);
+
+  z ^= z >> 32;
+  z *= UINT64_C(0x9e3779b97f4a7c15);
+
+  return (uint32_t)(z >> 32);
+}
+
 /*
  * Time
  */
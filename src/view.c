@@ -12,142 +12,140 @@
 #include <mako/tx.h>
 #include "impl.h"
 #include "internal.h"
-#include "map/map.h"
 
 /*
- * Coins
+ * Coin View
  */
 
-KHASH_MAP_INIT_INT(coins, btc_coin_t *)
-
-typedef struct btc_coins_s {
-  uint8_t hash[32];
-  khash_t(coins) *map;
-} btc_coins_t;
-
-static btc_coins_t *
-btc_coins_create(void) {
-  btc_coins_t *coins = (btc_coins_t *)btc_malloc(sizeof(btc_coins_t));
-
-  coins->map = kh_init(coins);
+/* Coins are kept in a single open-addressed table
+ * keyed on the full outpoint (linear probing, no
+ * deletions). An empty slot has a NULL coin.
+ */
 
-  CHECK(coins->map != NULL);
+#define VIEW_MIN_SIZE 8
 
-  return coins;
-}
+typedef struct btc_viewslot_s {
+  btc_outpoint_t key;
+  btc_coin_t *coin;
+} btc_viewslot_t;
 
-static void
-btc_coins_destroy(btc_coins_t *coins) {
-  khiter_t it = kh_begin(coins->map);
+struct btc_view_s {
+  btc_viewslot_t *slots;
+  size_t size;
+  size_t length;
+  btc_undo_t undo;
+};
 
-  for (; it != kh_end(coins->map); it++) {
-    if (!kh_exist(coins->map, it))
-      continue;
+btc_view_t *
+btc_view_create(void) {
+  btc_view_t *view = (btc_view_t *)btc_malloc(sizeof(btc_view_t));
 
-    btc_coin_destroy(kh_value(coins->map, it));
-  }
+  view->slots = NULL;
+  view->size = 0;
+  view->length = 0;
 
-  kh_destroy(coins, coins->map);
+  btc_undo_init(&view->undo);
 
-  btc_free(coins);
+  return view;
 }
 
-static btc_coin_t *
-btc_coins_get(const btc_coins_t *coins, uint32_t index) {
-  khiter_t it = kh_get(coins, coins->map, index);
-
-  if (it == kh_end(coins->map))
-    return NULL;
-
-  return kh_value(coins->map, it);
-}
+void
+btc_view_destroy(btc_view_t *view) {
+  size_t i;
 
-static void
-btc_coins_put(btc_coins_t *coins, uint32_t index, btc_coin_t *coin) {
-  int ret = -1;
-  khiter_t it = kh_put(coins, coins->map, index, &ret);
+  for (i = 0; i < view->size; i++) {
+    if (view->slots[i].coin != NULL)
+      btc_coin_destroy(view->slots[i].coin);
+  }
 
-  CHECK(ret != -1);
+  if (view->slots != NULL)
+    btc_free(view->slots);
 
-  if (ret == 0)
-    btc_coin_destroy(kh_value(coins->map, it));
+  btc_undo_clear(&view->undo);
 
-  kh_value(coins->map, it) = coin;
+  btc_free(view);
 }
 
-/*
- * Coin View
- */
+static btc_viewslot_t *
+btc_view_slot(const btc_viewslot_t *slots,
+              size_t size,
+              const btc_outpoint_t *key) {
+  size_t mask = size - 1;
+  size_t i = btc_outpoint_hash(key) & mask;
+  const btc_viewslot_t *slot;
 
-KHASH_INIT(view, const uint8_t *, btc_coins_t *, 1, kh_hash_hash_func,
-                                                    kh_hash_hash_equal)
+  for (;;) {
+    slot = &slots[i];
 
-struct btc_view_s {
-  khash_t(view) *map;
-  btc_undo_t undo;
-};
+    if (slot->coin == NULL)
+      break;
 
-btc_view_t *
-btc_view_create(void) {
-  btc_view_t *view = (btc_view_t *)btc_malloc(sizeof(btc_view_t));
+    if (btc_outpoint_equal(&slot->key, key))
+      break;
 
-  view->map = kh_init(view);
+    i = (i + 1) & mask;
+  }
 
-  CHECK(view->map != NULL);
+  return (btc_viewslot_t *)slot;
+}
 
-  btc_undo_init(&view->undo);
+static void
+btc_view_grow(btc_view_t *view) {
+  size_t size = view->size == 0 ? VIEW_MIN_SIZE : view->size * 2;
+  btc_viewslot_t *slots, *slot;
+  size_t i;
 
-  return view;
-}
+  slots = (btc_viewslot_t *)btc_malloc(size * sizeof(btc_viewslot_t));
 
-void
-btc_view_destroy(btc_view_t *view) {
-  khiter_t it = kh_begin(view->map);
+  for (i = 0; i < size; i++)
+    slots[i].coin = NULL;
 
-  for (; it != kh_end(view->map); it++) {
-    if (!kh_exist(view->map, it))
+  for (i = 0; i < view->size; i++) {
+    if (view->slots[i].coin == NULL)
       continue;
 
-    btc_coins_destroy(kh_value(view->map, it));
-  }
+    slot = btc_view_slot(slots, size, &view->slots[i].key);
 
-  kh_destroy(view, view->map);
+    *slot = view->slots[i];
+  }
 
-  btc_undo_clear(&view->undo);
+  if (view->slots != NULL)
+    btc_free(view->slots);
 
-  btc_free(view);
+  view->slots = slots;
+  view->size = size;
 }
 
-static btc_coins_t *
-btc_view_coins(const btc_view_t *view, const uint8_t *hash) {
-  khiter_t it = kh_get(view, view->map, hash);
-
-  if (it == kh_end(view->map))
+static btc_coin_t *
+btc_view_lookup(const btc_view_t *view, const btc_outpoint_t *key) {
+  if (view->length == 0)
     return NULL;
 
-  return kh_value(view->map, it);
+  return btc_view_slot(view->slots, view->size, key)->coin;
 }
 
-static btc_coins_t *
-btc_view_ensure(btc_view_t *view, const uint8_t *hash) {
-  int ret = -1;
-  khiter_t it = kh_put(view, view->map, hash, &ret);
-  btc_coins_t *coins;
+static void
+btc_view_insert(btc_view_t *view,
+                const btc_outpoint_t *key,
+                btc_coin_t *coin) {
+  btc_viewslot_t *slot;
 
-  CHECK(ret != -1);
+  CHECK(coin != NULL);
 
-  if (ret == 0) {
-    coins = kh_value(view->map, it);
-  } else {
-    coins = btc_coins_create();
+  /* Keep the load factor under 3/4. */
+  if ((view->length + 1) * 4 > view->size * 3)
+    btc_view_grow(view);
 
-    btc_hash_copy(coins->hash, hash);
+  slot = btc_view_slot(view->slots, view->size, key);
 
-    kh_key(view->map, it) = coins->hash;
-    kh_value(view->map, it) = coins;
+  if (slot->coin != NULL) {
+    btc_coin_destroy(slot->coin);
+  } else {
+    btc_outpoint_copy(&slot->key, key);
+    view->length++;
   }
 
-  return coins;
+  slot->coin = coin;
 }
 
 int
@@ -157,20 +155,14 @@ btc_view_has(const btc_view_t *view, const btc_outpoint_t *outpoint) {
 
 const btc_coin_t *
 btc_view_get(const btc_view_t *view, const btc_outpoint_t *outpoint) {
-  btc_coins_t *coins = btc_view_coins(view, outpoint->hash);
-
-  if (coins == NULL)
-    return NULL;
-
-  return btc_coins_get(coins, outpoint->index);
+  return btc_view_lookup(view, outpoint);
 }
 
 void
 btc_view_put(btc_view_t *view,
              const btc_outpoint_t *outpoint,
              btc_coin_t *coin) {
-  btc_coins_t *coins = btc_view_ensure(view, outpoint->hash);
-  btc_coins_put(coins, outpoint->index, coin);
+  btc_view_insert(view, outpoint, coin);
 }
 
 int
@@ -180,14 +172,12 @@ btc_view_spend(btc_view_t *view,
                void *arg1,
                void *arg2) {
   const btc_outpoint_t *prevout;
-  btc_coins_t *coins;
   btc_coin_t *coin;
   size_t i;
 
   for (i = 0; i < tx->inputs.length; i++) {
     prevout = &tx->inputs.items[i]->prevout;
-    coins = btc_view_ensure(view, prevout->hash);
-    coin = btc_coins_get(coins, prevout->index);
+    coin = btc_view_lookup(view, prevout);
 
     if (coin == NULL) {
       coin = read_coin(prevout, arg1, arg2);
@@ -195,7 +185,7 @@ btc_view_spend(btc_view_t *view,
       if (coin == NULL)
         return 0;
 
-      btc_coins_put(coins, prevout->index, coin);
+      btc_view_insert(view, prevout, coin);
     }
 
     if (coin->spent)
@@ -216,15 +206,13 @@ btc_view_fill(btc_view_t *view,
               void *arg1,
               void *arg2) {
   const btc_outpoint_t *prevout;
-  btc_coins_t *coins;
   btc_coin_t *coin;
   int ret = 1;
   size_t i;
 
   for (i = 0; i < tx->inputs.length; i++) {
     prevout = &tx->inputs.items[i]->prevout;
-    coins = btc_view_ensure(view, prevout->hash);
-    coin = btc_coins_get(coins, prevout->index);
+    coin = btc_view_lookup(view, prevout);
 
     if (coin == NULL) {
       coin = read_coin(prevout, arg1, arg2);
@@ -234,7 +222,7 @@ btc_view_fill(btc_view_t *view,
         continue;
       }
 
-      btc_coins_put(coins, prevout->index, coin);
+      btc_view_insert(view, prevout, coin);
     }
   }
 
@@ -244,12 +232,10 @@ btc_view_fill(btc_view_t *view,
 void
 btc_view_add(btc_view_t *view, const btc_tx_t *tx, int32_t height, int spent) {
   const btc_output_t *output;
-  btc_coins_t *coins;
+  btc_outpoint_t key;
   btc_coin_t *coin;
   size_t i;
 
-  coins = btc_view_ensure(view, tx->hash);
-
   for (i = 0; i < tx->outputs.length; i++) {
     output = tx->outputs.items[i];
 
@@ -259,16 +245,16 @@ btc_view_add(btc_view_t *view, const btc_tx_t *tx, int32_t height, int spent) {
     coin = btc_tx_coin(tx, i, height);
     coin->spent = spent;
 
-    btc_coins_put(coins, i, coin);
+    btc_outpoint_set(&key, tx->hash, i);
+
+    btc_view_insert(view, &key, coin);
   }
 }
 
 void
 btc_view_iterate(btc_viewiter_t *iter, const btc_view_t *view) {
   iter->view = view;
-  iter->itv = kh_begin(view->map);
-  iter->itc = 0;
-  iter->coins = NULL;
+  iter->pos = 0;
   iter->hash = NULL;
   iter->index = 0;
 }
@@ -276,34 +262,17 @@ btc_view_iterate(btc_viewiter_t *iter, const btc_view_t *view) {
 int
 btc_view_next(const btc_coin_t **coin, btc_viewiter_t *iter) {
   const btc_view_t *view = iter->view;
+  const btc_viewslot_t *slot;
 
-  for (;;) {
-    if (iter->coins == NULL) {
-      for (; iter->itv != kh_end(view->map); iter->itv++) {
-        if (kh_exist(view->map, iter->itv)) {
-          iter->coins = kh_value(view->map, iter->itv);
-          iter->itv++;
-          break;
-        }
-      }
-
-      if (iter->coins == NULL)
-        break;
+  while (iter->pos < view->size) {
+    slot = &view->slots[iter->pos++];
 
-      iter->itc = kh_begin(iter->coins->map);
+    if (slot->coin != NULL) {
+      iter->hash = slot->key.hash;
+      iter->index = slot->key.index;
+      *coin = slot->coin;
+      return 1;
     }
-
-    for (; iter->itc != kh_end(iter->coins->map); iter->itc++) {
-      if (kh_exist(iter->coins->map, iter->itc)) {
-        iter->hash = iter->coins->hash;
-        iter->index = kh_key(iter->coins->map, iter->itc);
-        *coin = kh_value(iter->coins->map, iter->itc);
-        iter->itc++;
-        return 1;
-      }
-    }
-
-    iter->coins = NULL;
   }
 
   return 0;
@@ -0,0 +1,1346 @@
+/*!
+ * bench.c - benchmarks for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <mako/block.h>
+#include <mako/bloom.h>
+#include <mako/coins.h>
+#include <mako/crypto/drbg.h>
+#include <mako/crypto/ecc.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/siphash.h>
+#include <mako/encoding.h>
+#include <mako/header.h>
+#include <mako/heap.h>
+#include <mako/map.h>
+#include <mako/mpi.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include <mako/vector.h>
+#include "../src/map/map.h"
+#include "lib/tests.h"
+#include "data/chain_vectors_main.h"
+#include "data/script_vectors.h"
+#include "data/tx_valid_vectors.h"
+
+/*
+ * Fixtures
+ */
+
+#define BENCH_KEYS 128
+#define BENCH_DATA 1024
+
+static uint8_t ecdsa_msgs[BENCH_KEYS][32];
+static uint8_t ecdsa_sigs[BENCH_KEYS][64];
+static uint8_t ecdsa_pubs[BENCH_KEYS][33];
+static uint8_t ecdsa_priv[32];
+
+static uint8_t bip340_msgs[BENCH_KEYS][32];
+static uint8_t bip340_sigs[BENCH_KEYS][64];
+static uint8_t bip340_pubs[BENCH_KEYS][32];
+
+static const uint8_t *ecdsa_msg_ptrs[BENCH_KEYS];
+static const uint8_t *ecdsa_sig_ptrs[BENCH_KEYS];
+static const uint8_t *ecdsa_pub_ptrs[BENCH_KEYS];
+static size_t ecdsa_pub_lens[BENCH_KEYS];
+
+static const uint8_t *msg_ptrs[BENCH_KEYS];
+static const uint8_t *sig_ptrs[BENCH_KEYS];
+static const uint8_t *pub_ptrs[BENCH_KEYS];
+static size_t msg_lens[BENCH_KEYS];
+
+static uint8_t bench_data[BENCH_DATA];
+static btc_scratch_t *bench_scratch;
+static btc_precomp_t *bench_precomp;
+static volatile uint32_t bench_sink;
+
+static void
+bench_setup(void) {
+  static const uint8_t seed[32] = {0x6d, 0x61, 0x6b, 0x6f};
+  uint8_t priv[32], aux[32];
+  btc_drbg_t rng;
+  size_t i;
+
+  /* Fixed seed: every run measures the same inputs. */
+  btc_drbg_init(&rng, seed, sizeof(seed));
+
+  for (i = 0; i < BENCH_KEYS; i++) {
+    btc_drbg_generate(&rng, priv, 32);
+    btc_drbg_generate(&rng, aux, 32);
+    btc_drbg_generate(&rng, ecdsa_msgs[i], 32);
+    btc_drbg_generate(&rng, bip340_msgs[i], 32);
+
+    priv[0] &= 0x7f;
+
+    if (!btc_ecdsa_sign(ecdsa_sigs[i], NULL, ecdsa_msgs[i], 32, priv))
+      abort(); /* LCOV_EXCL_LINE */
+
+    if (!btc_ecdsa_pubkey_create(ecdsa_pubs[i], priv, 1))
+      abort(); /* LCOV_EXCL_LINE */
+
+    if (!btc_bip340_sign(bip340_sigs[i], bip340_msgs[i], 32, priv, aux))
+      abort(); /* LCOV_EXCL_LINE */
+
+    if (!btc_bip340_pubkey_create(bip340_pubs[i], priv))
+      abort(); /* LCOV_EXCL_LINE */
+
+    ecdsa_msg_ptrs[i] = ecdsa_msgs[i];
+    ecdsa_sig_ptrs[i] = ecdsa_sigs[i];
+    ecdsa_pub_ptrs[i] = ecdsa_pubs[i];
+    ecdsa_pub_lens[i] = 33;
+
+    msg_ptrs[i] = bip340_msgs[i];
+    sig_ptrs[i] = bip340_sigs[i];
+    pub_ptrs[i] = bip340_pubs[i];
+    msg_lens[i] = 32;
+  }
+
+  memcpy(ecdsa_priv, priv, 32);
+
+  btc_drbg_generate(&rng, bench_data, sizeof(bench_data));
+
+  bench_scratch = btc_scratch_create(64);
+  bench_precomp = btc_precomp_create(seed);
+}
+
+static void
+bench_cleanup(void) {
+  btc_scratch_destroy(bench_scratch);
+  btc_precomp_destroy(bench_precomp);
+}
+
+/*
+ * Benchmarks
+ */
+
+static void
+bench_ecdsa_sign(size_t iters) {
+  uint8_t sig[64];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_ecdsa_sign(sig, NULL, ecdsa_msgs[i % BENCH_KEYS], 32, ecdsa_priv);
+    bench_sink += sig[0];
+  }
+}
+
+static void
+bench_ecdsa_sign_precomp(size_t iters) {
+  uint8_t sig[64];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_ecdsa_sign_precomp(sig, NULL, ecdsa_msgs[i % BENCH_KEYS], 32,
+                           ecdsa_priv, bench_precomp);
+    bench_sink += sig[0];
+  }
+}
+
+static void
+bench_ecdsa_verify(size_t iters) {
+  size_t i, j;
+
+  for (i = 0; i < iters; i++) {
+    j = i % BENCH_KEYS;
+    bench_sink += btc_ecdsa_verify(ecdsa_msgs[j], 32, ecdsa_sigs[j],
+                                   ecdsa_pubs[j], 33);
+  }
+}
+
+static void
+bench_ecdsa_batch(size_t iters, size_t size) {
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    bench_sink += btc_ecdsa_verify_batch(ecdsa_msg_ptrs, msg_lens,
+                                         ecdsa_sig_ptrs, ecdsa_pub_ptrs,
+                                         ecdsa_pub_lens, size);
+  }
+}
+
+static void
+bench_ecdsa_batch_8(size_t iters) {
+  bench_ecdsa_batch(iters, 8);
+}
+
+static void
+bench_ecdsa_batch_64(size_t iters) {
+  bench_ecdsa_batch(iters, 64);
+}
+
+static void
+bench_bip340_sign(size_t iters) {
+  uint8_t sig[64];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_bip340_sign(sig, bip340_msgs[i % BENCH_KEYS], 32, ecdsa_priv, NULL);
+    bench_sink += sig[0];
+  }
+}
+
+static void
+bench_bip340_verify(size_t iters) {
+  size_t i, j;
+
+  for (i = 0; i < iters; i++) {
+    j = i % BENCH_KEYS;
+    bench_sink += btc_bip340_verify(bip340_msgs[j], 32,
+                                    bip340_sigs[j], bip340_pubs[j]);
+  }
+}
+
+static void
+bench_bip340_batch(size_t iters, size_t size) {
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    bench_sink += btc_bip340_verify_batch(msg_ptrs, msg_lens, sig_ptrs,
+                                          pub_ptrs, size, bench_scratch);
+  }
+}
+
+static void
+bench_bip340_batch_2(size_t iters) {
+  bench_bip340_batch(iters, 2);
+}
+
+static void
+bench_bip340_batch_8(size_t iters) {
+  bench_bip340_batch(iters, 8);
+}
+
+static void
+bench_bip340_batch_32(size_t iters) {
+  bench_bip340_batch(iters, 32);
+}
+
+static void
+bench_bip340_batch_128(size_t iters) {
+  bench_bip340_batch(iters, 128);
+}
+
+static void
+bench_sha256_32(size_t iters) {
+  uint8_t out[32];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_sha256(out, bench_data + (i & 63), 32);
+    bench_sink += out[0];
+  }
+}
+
+static void
+bench_sha256_1k(size_t iters) {
+  uint8_t out[32];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_sha256(out, bench_data, BENCH_DATA);
+    bench_sink += out[0];
+  }
+}
+
+static void
+bench_hash256_64(size_t iters) {
+  uint8_t out[32];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_hash256(out, bench_data + (i & 63), 64);
+    bench_sink += out[0];
+  }
+}
+
+static void
+bench_header_mine_1k(size_t iters) {
+  btc_header_t hdr;
+  size_t i;
+
+  btc_header_init(&hdr);
+
+  memcpy(hdr.prev_block, bench_data, 32);
+  memcpy(hdr.merkle_root, bench_data + 32, 32);
+
+  hdr.bits = 0x1d00ffff;
+
+  for (i = 0; i < iters; i++)
+    bench_sink += btc_header_mine(&hdr, 1024);
+}
+
+static void
+bench_ripemd160_32(size_t iters) {
+  uint8_t out[20];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_ripemd160(out, bench_data + (i & 63), 32);
+    bench_sink += out[0];
+  }
+}
+
+static void
+bench_hash160_33(size_t iters) {
+  uint8_t out[20];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_hash160(out, bench_data + (i & 63), 33);
+    bench_sink += out[0];
+  }
+}
+
+static void
+bench_hash160_many_33(size_t iters) {
+  /* Keys from a derivation range, 16 at a time. */
+  uint8_t out[16 * 20];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_hash160_many(out, bench_data, 33, 16);
+    bench_sink += out[0];
+  }
+}
+
+static void
+bench_siphash_32(size_t iters) {
+  size_t i;
+
+  for (i = 0; i < iters; i++)
+    bench_sink += btc_siphash_sum(bench_data + (i & 63), 32, bench_data);
+}
+
+static void
+bench_murmur3_32(size_t iters) {
+  size_t i;
+
+  for (i = 0; i < iters; i++)
+    bench_sink += btc_murmur3_sum(bench_data + (i & 63), 32, (uint32_t)i);
+}
+
+static void
+bench_hash_key_32(size_t iters) {
+  size_t i;
+
+  for (i = 0; i < iters; i++)
+    bench_sink += btc_hash_key(bench_data + (i & 63), (uint32_t)i);
+}
+
+static void
+bench_murmur3_tweaks_20(size_t iters) {
+  /* A typical SPV filter: 20 hash functions per element. */
+  uint32_t hashes[20];
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_murmur3_tweaks(hashes, bench_data + (i & 63), 32, 0, 20, (uint32_t)i);
+    bench_sink += hashes[19];
+  }
+}
+
+static void
+bench_filter_has_32(size_t iters) {
+  /* Sized like a peer's known-inventory filter. */
+  btc_filter_t filter;
+  size_t i;
+
+  btc_filter_init(&filter);
+  btc_filter_set(&filter, 50000, 0.000001);
+
+  for (i = 0; i < 64; i++)
+    btc_filter_add(&filter, bench_data + i, 32);
+
+  for (i = 0; i < iters; i++)
+    bench_sink += btc_filter_has(&filter, bench_data + (i & 63), 32);
+
+  btc_filter_clear(&filter);
+}
+
+/*
+ * Maps
+ */
+
+/* khash and the swiss table side by side, over the
+   key shapes the node sees: a block index of hashes
+   ending in zeroes, txid misses, mempool churn and
+   spent outpoints (several per txid). */
+
+#define BENCH_INDEX (1 << 20)
+#define BENCH_CHURN (1 << 16)
+
+DEFINE_MAP_TYPES(bench_khmap, uint8_t *, void *);
+DEFINE_MAP(bench_khmap, uint8_t *, void *,
+           kh_hash_hash_func, kh_hash_hash_equal, NULL, MAP_STATIC)
+
+DEFINE_MAP_TYPES(bench_swmap, uint8_t *, void *);
+DEFINE_SWISS_MAP(bench_swmap, uint8_t *, void *,
+                 kh_hash_hash_func, kh_hash_hash_equal, NULL, MAP_STATIC)
+
+DEFINE_MAP_TYPES(bench_khout, btc_outpoint_t *, void *);
+DEFINE_MAP(bench_khout, btc_outpoint_t *, void *,
+           btc_outpoint_hash, btc_outpoint_equal, NULL, MAP_STATIC)
+
+DEFINE_MAP_TYPES(bench_swout, btc_outpoint_t *, void *);
+DEFINE_SWISS_MAP(bench_swout, btc_outpoint_t *, void *,
+                 btc_outpoint_hash, btc_outpoint_equal, NULL, MAP_STATIC)
+
+static uint8_t (*map_hashes)[32];
+static uint8_t (*map_misses)[32];
+static btc_outpoint_t *map_outs;
+
+static void
+bench_map_setup(void) {
+  static const uint8_t seed[32] = {0x6d, 0x61, 0x70};
+  btc_drbg_t rng;
+  size_t i;
+
+  if (map_hashes != NULL)
+    return;
+
+  map_hashes = malloc(BENCH_INDEX * 32);
+  map_misses = malloc(BENCH_INDEX * 32);
+  map_outs = malloc(BENCH_INDEX * sizeof(btc_outpoint_t));
+
+  if (!map_hashes || !map_misses || !map_outs)
+    abort(); /* LCOV_EXCL_LINE */
+
+  btc_drbg_init(&rng, seed, sizeof(seed));
+  btc_drbg_generate(&rng, map_hashes, BENCH_INDEX * 32);
+  btc_drbg_generate(&rng, map_misses, BENCH_INDEX * 32);
+
+  for (i = 0; i < BENCH_INDEX; i++) {
+    memset(map_hashes[i] + 24, 0, 8);
+    btc_outpoint_set(&map_outs[i], map_misses[i / 4], i % 4);
+  }
+}
+
+/* Visit the keys in a scattered order. */
+#define bench_map_key(i) (((i) * 0x9e3779b1) & (BENCH_INDEX - 1))
+
+/* Visit every output of a tx in turn. */
+#define bench_map_walk(i) ((bench_map_key((i) >> 2) & ~3) | ((i) & 3))
+
+#define DEFINE_MAP_BENCH(impl)                                    \
+static void                                                       \
+bench_##impl##_get(size_t iters) {                                \
+  static bench_##impl##map_t *map = NULL;                         \
+  size_t i;                                                       \
+                                                                  \
+  if (map == NULL) {                                              \
+    bench_map_setup();                                            \
+                                                                  \
+    map = bench_##impl##map_create();                             \
+                                                                  \
+    for (i = 0; i < BENCH_INDEX; i++)                             \
+      bench_##impl##map_put(map, map_hashes[i], map_hashes[i]);   \
+  }                                                               \
+                                                                  \
+  for (i = 0; i < iters; i++) {                                   \
+    uint8_t *key = map_hashes[bench_map_key(i)];                  \
+    bench_sink += (bench_##impl##map_get(map, key) == key);       \
+  }                                                               \
+}                                                                 \
+                                                                  \
+static void                                                       \
+bench_##impl##_miss(size_t iters) {                               \
+  static bench_##impl##map_t *map = NULL;                         \
+  size_t i;                                                       \
+                                                                  \
+  if (map == NULL) {                                              \
+    bench_map_setup();                                            \
+                                                                  \
+    map = bench_##impl##map_create();                             \
+                                                                  \
+    for (i = 0; i < BENCH_INDEX; i++)                             \
+      bench_##impl##map_put(map, map_hashes[i], map_hashes[i]);   \
+  }                                                               \
+                                                                  \
+  for (i = 0; i < iters; i++) {                                   \
+    uint8_t *key = map_misses[bench_map_key(i)];                  \
+    bench_sink += bench_##impl##map_has(map, key);                \
+  }                                                               \
+}                                                                 \
+                                                                  \
+static void                                                       \
+bench_##impl##_churn(size_t iters) {                              \
+  bench_##impl##map_t *map = bench_##impl##map_create();          \
+  size_t i;                                                       \
+                                                                  \
+  bench_map_setup();                                              \
+                                                                  \
+  /* A mempool: one tx in, one tx out. */                         \
+  for (i = 0; i < iters; i++) {                                   \
+    uint8_t *key = map_misses[i & (BENCH_INDEX - 1)];             \
+                                                                  \
+    bench_##impl##map_put(map, key, key);                         \
+                                                                  \
+    if (i >= BENCH_CHURN) {                                       \
+      key = map_misses[(i - BENCH_CHURN) & (BENCH_INDEX - 1)];    \
+      bench_sink += (bench_##impl##map_del(map, key) == key);     \
+    }                                                             \
+  }                                                               \
+                                                                  \
+  bench_##impl##map_destroy(map);                                 \
+}                                                                 \
+                                                                  \
+static bench_##impl##out_t *                                      \
+bench_##impl##_outmap(void) {                                     \
+  static bench_##impl##out_t *map = NULL;                         \
+  size_t i;                                                       \
+                                                                  \
+  if (map == NULL) {                                              \
+    bench_map_setup();                                            \
+                                                                  \
+    map = bench_##impl##out_create();                             \
+                                                                  \
+    for (i = 0; i < BENCH_INDEX; i++)                             \
+      bench_##impl##out_put(map, &map_outs[i], &map_outs[i]);     \
+  }                                                               \
+                                                                  \
+  return map;                                                     \
+}                                                                 \
+                                                                  \
+static void                                                       \
+bench_##impl##_outs(size_t iters) {                               \
+  bench_##impl##out_t *map = bench_##impl##_outmap();             \
+  size_t i;                                                       \
+                                                                  \
+  for (i = 0; i < iters; i++) {                                   \
+    btc_outpoint_t *key = &map_outs[bench_map_key(i)];            \
+    bench_sink += (bench_##impl##out_get(map, key) == key);       \
+  }                                                               \
+}                                                                 \
+                                                                  \
+static void                                                       \
+bench_##impl##_walk(size_t iters) {                               \
+  bench_##impl##out_t *map = bench_##impl##_outmap();             \
+  size_t i;                                                       \
+                                                                  \
+  for (i = 0; i < iters; i++) {                                   \
+    btc_outpoint_t *key = &map_outs[bench_map_walk(i)];           \
+    bench_sink += (bench_##impl##out_get(map, key) == key);       \
+  }                                                               \
+}
+
+DEFINE_MAP_BENCH(kh)
+DEFINE_MAP_BENCH(sw)
+
+static btc_prevmap_t *
+bench_prevmap(void) {
+  static btc_prevmap_t *map = NULL;
+  size_t i;
+
+  if (map == NULL) {
+    bench_map_setup();
+
+    map = btc_prevmap_create();
+
+    for (i = 0; i < BENCH_INDEX; i++)
+      btc_prevmap_put(map, &map_outs[i], &map_outs[i]);
+  }
+
+  return map;
+}
+
+static void
+bench_prev_outs(size_t iters) {
+  btc_prevmap_t *map = bench_prevmap();
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_outpoint_t *key = &map_outs[bench_map_key(i)];
+    bench_sink += (btc_prevmap_get(map, key) == key);
+  }
+}
+
+static void
+bench_prev_walk(size_t iters) {
+  btc_prevmap_t *map = bench_prevmap();
+  size_t i;
+
+  for (i = 0; i < iters; i++) {
+    btc_outpoint_t *key = &map_outs[bench_map_walk(i)];
+    bench_sink += (btc_prevmap_get(map, key) == key);
+  }
+}
+
+/*
+ * Containers
+ */
+
+#define BENCH_ITEMS 1024
+
+static int64_t
+bench_heap_cmp(const void *x, const void *y) {
+  return (int64_t)*((const uint32_t *)x) - (int64_t)*((const uint32_t *)y);
+}
+
+static void
+bench_vector_push(size_t iters) {
+  btc_vector_t vec;
+  size_t i, j;
+
+  btc_vector_init(&vec);
+
+  for (i = 0; i < iters; i++) {
+    for (j = 0; j < BENCH_ITEMS; j++)
+      btc_vector_push(&vec, &bench_data[j]);
+
+    while (vec.length > 0)
+      bench_sink += *((uint8_t *)btc_vector_pop(&vec));
+  }
+
+  btc_vector_clear(&vec);
+}
+
+static void
+bench_heap_sort(size_t iters) {
+  /* A mempool-style priority queue: fill, then drain. */
+  static uint32_t keys[BENCH_ITEMS];
+  btc_vector_t heap;
+  size_t i, j;
+
+  for (j = 0; j < BENCH_ITEMS; j++)
+    keys[j] = (uint32_t)j * 0x9e3779b1;
+
+  btc_vector_init(&heap);
+
+  for (i = 0; i < iters; i++) {
+    for (j = 0; j < BENCH_ITEMS; j++)
+      btc_heap_insert(&heap, &keys[j], bench_heap_cmp);
+
+    while (heap.length > 0)
+      bench_sink += *((uint32_t *)btc_heap_shift(&heap, bench_heap_cmp));
+  }
+
+  btc_vector_clear(&heap);
+}
+
+/*
+ * Serialization
+ */
+
+/* The first blocks of mainnet. Mostly coinbases, with
+   the first spends (p2pk, from block 170) mixed in. */
+
+typedef struct bench_raw_s {
+  uint8_t *data;
+  size_t length;
+} bench_raw_t;
+
+static bench_raw_t *chain_raw;
+static btc_block_t **chain_blocks;
+static size_t chain_length;
+static const btc_tx_t **chain_txs;
+static bench_raw_t *chain_txraw;
+static size_t chain_txlen;
+static btc_coin_t **chain_coins;
+static bench_raw_t *chain_coinraw;
+static size_t chain_coinlen;
+static btc_view_t *chain_view;
+static uint8_t *chain_out;
+
+static void
+bench_raw_set(bench_raw_t *raw, size_t length) {
+  raw->data = malloc(length);
+  raw->length = length;
+
+  if (raw->data == NULL)
+    abort(); /* LCOV_EXCL_LINE */
+}
+
+static void
+bench_chain_setup(void) {
+  size_t i, j, k, max = 0;
+
+  if (chain_raw != NULL)
+    return;
+
+  chain_length = lengthof(chain_vectors_main);
+  chain_raw = malloc(chain_length * sizeof(bench_raw_t));
+  chain_blocks = malloc(chain_length * sizeof(btc_block_t *));
+
+  if (chain_raw == NULL || chain_blocks == NULL)
+    abort(); /* LCOV_EXCL_LINE */
+
+  for (i = 0; i < chain_length; i++) {
+    const char *hex = chain_vectors_main[i];
+    size_t len = strlen(hex);
+    bench_raw_t *raw = &chain_raw[i];
+
+    bench_raw_set(raw, len / 2);
+
+    if (!btc_base16_decode(raw->data, hex, len))
+      abort(); /* LCOV_EXCL_LINE */
+
+    chain_blocks[i] = btc_block_decode(raw->data, raw->length);
+
+    if (chain_blocks[i] == NULL)
+      abort(); /* LCOV_EXCL_LINE */
+
+    chain_txlen += chain_blocks[i]->txs.length;
+
+    for (j = 0; j < chain_blocks[i]->txs.length; j++)
+      chain_coinlen += chain_blocks[i]->txs.items[j]->outputs.length;
+
+    if (raw->length > max)
+      max = raw->length;
+  }
+
+  chain_txs = malloc(chain_txlen * sizeof(btc_tx_t *));
+  chain_txraw = malloc(chain_txlen * sizeof(bench_raw_t));
+  chain_coins = malloc(chain_coinlen * sizeof(btc_coin_t *));
+  chain_coinraw = malloc(chain_coinlen * sizeof(bench_raw_t));
+  chain_view = btc_view_create();
+  chain_out = malloc(max);
+
+  if (!chain_txs || !chain_txraw || !chain_coins
+      || !chain_coinraw || !chain_out) {
+    abort(); /* LCOV_EXCL_LINE */
+  }
+
+  chain_txlen = 0;
+  chain_coinlen = 0;
+
+  for (i = 0; i < chain_length; i++) {
+    const btc_block_t *block = chain_blocks[i];
+
+    for (j = 0; j < block->txs.length; j++) {
+      const btc_tx_t *tx = block->txs.items[j];
+      bench_raw_t *raw = &chain_txraw[chain_txlen];
+
+      bench_raw_set(raw, btc_tx_size(tx));
+      btc_tx_write(raw->data, tx);
+
+      chain_txs[chain_txlen++] = tx;
+
+      /* The genesis block is not included. */
+      btc_view_add(chain_view, tx, i + 1, 0);
+
+      for (k = 0; k < tx->outputs.length; k++) {
+        btc_coin_t *coin = btc_tx_coin(tx, k, i + 1);
+
+        raw = &chain_coinraw[chain_coinlen];
+
+        bench_raw_set(raw, btc_coin_size(coin));
+        btc_coin_write(raw->data, coin);
+
+        chain_coins[chain_coinlen++] = coin;
+      }
+    }
+  }
+}
+
+static void
+bench_block_read(size_t iters) {
+  size_t i;
+
+  bench_chain_setup();
+
+  for (i = 0; i < iters; i++) {
+    const bench_raw_t *raw = &chain_raw[i % chain_length];
+    btc_block_t *block = btc_block_decode(raw->data, raw->length);
+
+    bench_sink += block->txs.length;
+
+    btc_block_destroy(block);
+  }
+}
+
+static void
+bench_block_write(size_t iters) {
+  size_t i;
+
+  bench_chain_setup();
+
+  for (i = 0; i < iters; i++) {
+    const btc_block_t *block = chain_blocks[i % chain_length];
+
+    bench_sink += btc_block_export(chain_out, block);
+  }
+}
+
+static void
+bench_tx_read(size_t iters) {
+  size_t i;
+
+  bench_chain_setup();
+
+  for (i = 0; i < iters; i++) {
+    const bench_raw_t *raw = &chain_txraw[i % chain_txlen];
+    btc_tx_t *tx = btc_tx_decode(raw->data, raw->length);
+
+    bench_sink += tx->hash[0];
+
+    btc_tx_destroy(tx);
+  }
+}
+
+static void
+bench_tx_write(size_t iters) {
+  size_t i;
+
+  bench_chain_setup();
+
+  for (i = 0; i < iters; i++) {
+    const btc_tx_t *tx = chain_txs[i % chain_txlen];
+
+    bench_sink += (uint32_t)(btc_tx_write(chain_out, tx) - chain_out);
+  }
+}
+
+static void
+bench_coin_read(size_t iters) {
+  btc_coin_t coin;
+  size_t i;
+
+  bench_chain_setup();
+
+  btc_coin_init(&coin);
+
+  for (i = 0; i < iters; i++) {
+    const bench_raw_t *raw = &chain_coinraw[i % chain_coinlen];
+
+    if (!btc_coin_import(&coin, raw->data, raw->length))
+      abort(); /* LCOV_EXCL_LINE */
+
+    bench_sink += (uint32_t)coin.output.value;
+  }
+
+  btc_coin_clear(&coin);
+}
+
+static void
+bench_coin_write(size_t iters) {
+  size_t i;
+
+  bench_chain_setup();
+
+  for (i = 0; i < iters; i++) {
+    const btc_coin_t *coin = chain_coins[i % chain_coinlen];
+
+    bench_sink += (uint32_t)(btc_coin_write(chain_out, coin) - chain_out);
+  }
+}
+
+/*
+ * Coin View
+ */
+
+static btc_coin_t *
+bench_read_coin(const btc_outpoint_t *prevout, void *arg1, void *arg2) {
+  const btc_coin_t *coin = btc_view_get(chain_view, prevout);
+
+  (void)arg1;
+  (void)arg2;
+
+  if (coin == NULL)
+    return NULL;
+
+  return btc_coin_clone(coin);
+}
+
+static void
+bench_view_connect(size_t iters) {
+  /* What connecting a block does to a fresh view:
+     read and spend the inputs, then add the outputs. */
+  size_t i, j;
+
+  bench_chain_setup();
+
+  for (i = 0; i < iters; i++) {
+    const btc_block_t *block = chain_blocks[i % chain_length];
+    btc_view_t *view = btc_view_create();
+
+    for (j = 0; j < block->txs.length; j++) {
+      const btc_tx_t *tx = block->txs.items[j];
+
+      if (j > 0 && !btc_view_spend(view, tx, bench_read_coin, NULL, NULL))
+        abort(); /* LCOV_EXCL_LINE */
+
+      btc_view_add(view, tx, (i % chain_length) + 1, 0);
+    }
+
+    btc_view_destroy(view);
+  }
+}
+
+/*
+ * Script
+ */
+
+typedef struct bench_script_s {
+  btc_tx_t *prev;
+  btc_tx_t *tx;
+  unsigned int flags;
+} bench_script_t;
+
+typedef struct bench_verify_s {
+  btc_tx_t *tx;
+  btc_view_t *view;
+  unsigned int flags;
+} bench_verify_t;
+
+static bench_script_t *script_items;
+static size_t script_length;
+static bench_verify_t *verify_items;
+static size_t verify_length;
+
+static int
+bench_has_sigop(const btc_script_t *script) {
+  /* Conservative: pushed data may trip this too. */
+  size_t i;
+
+  for (i = 0; i < script->length; i++) {
+    switch (script->data[i]) {
+      case BTC_OP_CHECKSIG:
+      case BTC_OP_CHECKSIGVERIFY:
+      case BTC_OP_CHECKMULTISIG:
+      case BTC_OP_CHECKMULTISIGVERIFY:
+      case BTC_OP_CHECKSIGADD:
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int
+bench_script_run(const bench_script_t *item) {
+  const btc_input_t *input = item->tx->inputs.items[0];
+  const btc_output_t *output = item->prev->outputs.items[0];
+  btc_tx_cache_t cache;
+
+  memset(&cache, 0, sizeof(cache));
+
+  return btc_script_verify(&input->script,
+                           &input->witness,
+                           &output->script,
+                           item->tx,
+                           0,
+                           output->value,
+                           item->flags,
+                           &cache);
+}
+
+static void
+bench_script_setup(void) {
+  size_t i;
+
+  if (script_items != NULL)
+    return;
+
+  script_items = malloc(lengthof(test_script_vectors)
+                        * sizeof(bench_script_t));
+
+  if (script_items == NULL)
+    abort(); /* LCOV_EXCL_LINE */
+
+  /* Passing scripts only, and nothing that is
+     bound by signature checks. */
+  for (i = 0; i < lengthof(test_script_vectors); i++) {
+    const test_script_vector_t *vec = &test_script_vectors[i];
+    bench_script_t *item = &script_items[script_length];
+
+    if (vec->expected != BTC_SCRIPT_ERR_OK)
+      continue;
+
+    item->prev = btc_tx_decode(vec->prev_raw, vec->prev_len);
+    item->tx = btc_tx_decode(vec->tx_raw, vec->tx_len);
+    item->flags = vec->flags;
+
+    if (item->prev == NULL || item->tx == NULL)
+      abort(); /* LCOV_EXCL_LINE */
+
+    if (bench_has_sigop(&item->tx->inputs.items[0]->script)
+        || bench_has_sigop(&item->prev->outputs.items[0]->script)
+        || item->tx->inputs.items[0]->witness.length > 0
+        || bench_script_run(item) != BTC_SCRIPT_ERR_OK) {
+      btc_tx_destroy(item->prev);
+      btc_tx_destroy(item->tx);
+      continue;
+    }
+
+    script_length++;
+  }
+}
+
+static void
+bench_verify_setup(void) {
+  size_t i, j;
+
+  if (verify_items != NULL)
+    return;
+
+  verify_items = malloc(lengthof(test_valid_vectors)
+                        * sizeof(bench_verify_t));
+
+  if (verify_items == NULL)
+    abort(); /* LCOV_EXCL_LINE */
+
+  for (i = 0; i < lengthof(test_valid_vectors); i++) {
+    const test_valid_vector_t *vec = &test_valid_vectors[i];
+    bench_verify_t *item = &verify_items[verify_length];
+
+    item->tx = btc_tx_decode(vec->tx_raw, vec->tx_len);
+    item->view = btc_view_create();
+    item->flags = vec->flags;
+
+    if (item->tx == NULL)
+      abort(); /* LCOV_EXCL_LINE */
+
+    for (j = 0; j < vec->coins_len; j++) {
+      btc_coin_t *coin = btc_coin_create();
+
+      if (!btc_output_import(&coin->output, vec->coins[j].output_raw,
+                                            vec->coins[j].output_len)) {
+        abort(); /* LCOV_EXCL_LINE */
+      }
+
+      btc_view_put(item->view, &vec->coins[j].outpoint, coin);
+    }
+
+    if (btc_tx_is_coinbase(item->tx)
+        || !btc_tx_verify(item->tx, item->view, item->flags)) {
+      btc_tx_destroy(item->tx);
+      btc_view_destroy(item->view);
+      continue;
+    }
+
+    verify_length++;
+  }
+}
+
+static void
+bench_script_verify(size_t iters) {
+  size_t i;
+
+  bench_script_setup();
+
+  for (i = 0; i < iters; i++)
+    bench_sink += bench_script_run(&script_items[i % script_length]);
+}
+
+static void
+bench_tx_verify(size_t iters) {
+  size_t i;
+
+  bench_verify_setup();
+
+  for (i = 0; i < iters; i++) {
+    const bench_verify_t *item = &verify_items[i % verify_length];
+
+    bench_sink += btc_tx_verify(item->tx, item->view, item->flags);
+  }
+}
+
+/*
+ * Multiplication
+ */
+
+/* Products around the Karatsuba crossovers. Rebuild with
+   -DMP_MUL_KARATSUBA_THRESHOLD=n (or the SQR variant) and
+   compare to place them. 48 limbs is a MuHash3072 element. */
+
+#define BENCH_LIMBS 128
+
+static mp_limb_t mpn_x[BENCH_LIMBS];
+static mp_limb_t mpn_y[BENCH_LIMBS];
+static mp_limb_t mpn_z[2 * BENCH_LIMBS];
+static mp_limb_t mpn_t[2 * BENCH_LIMBS];
+
+static void
+bench_mpn_setup(void) {
+  size_t i;
+
+  memcpy(mpn_x, bench_data, sizeof(mpn_x));
+
+  for (i = 0; i < BENCH_LIMBS; i++)
+    mpn_y[i] = mpn_x[BENCH_LIMBS - 1 - i];
+}
+
+#define DEFINE_MPN_BENCH(n)                                       \
+static void                                                       \
+bench_mpn_mul_##n(size_t iters) {                                 \
+  size_t i;                                                       \
+                                                                  \
+  bench_mpn_setup();                                              \
+                                                                  \
+  for (i = 0; i < iters; i++) {                                   \
+    mpn_mul_n(mpn_z, mpn_x, mpn_y, n);                            \
+    bench_sink += (uint32_t)mpn_z[n];                             \
+  }                                                               \
+}                                                                 \
+                                                                  \
+static void                                                       \
+bench_mpn_sqr_##n(size_t iters) {                                 \
+  size_t i;                                                       \
+                                                                  \
+  bench_mpn_setup();                                              \
+                                                                  \
+  for (i = 0; i < iters; i++) {                                   \
+    mpn_sqr(mpn_z, mpn_x, n, mpn_t);                              \
+    bench_sink += (uint32_t)mpn_z[n];                             \
+  }                                                               \
+}
+
+DEFINE_MPN_BENCH(8)
+DEFINE_MPN_BENCH(16)
+DEFINE_MPN_BENCH(24)
+DEFINE_MPN_BENCH(32)
+DEFINE_MPN_BENCH(48)
+DEFINE_MPN_BENCH(64)
+DEFINE_MPN_BENCH(128)
+
+/*
+ * Registry
+ */
+
+typedef struct bench_s {
+  const char *name;
+  void (*run)(size_t iters);
+  size_t items; /* Items processed per iteration. */
+  size_t bytes; /* Bytes hashed per item. */
+} bench_t;
+
+static const bench_t benchmarks[] = {
+  { "ecdsa_sign", bench_ecdsa_sign, 1, 0 },
+  { "ecdsa_sign_precomp", bench_ecdsa_sign_precomp, 1, 0 },
+  { "ecdsa_verify", bench_ecdsa_verify, 1, 0 },
+  { "ecdsa_verify_batch_8", bench_ecdsa_batch_8, 8, 0 },
+  { "ecdsa_verify_batch_64", bench_ecdsa_batch_64, 64, 0 },
+  { "bip340_sign", bench_bip340_sign, 1, 0 },
+  { "bip340_verify", bench_bip340_verify, 1, 0 },
+  { "bip340_verify_batch_2", bench_bip340_batch_2, 2, 0 },
+  { "bip340_verify_batch_8", bench_bip340_batch_8, 8, 0 },
+  { "bip340_verify_batch_32", bench_bip340_batch_32, 32, 0 },
+  { "bip340_verify_batch_128", bench_bip340_batch_128, 128, 0 },
+  { "sha256_32", bench_sha256_32, 1, 32 },
+  { "sha256_1024", bench_sha256_1k, 1, BENCH_DATA },
+  { "hash256_64", bench_hash256_64, 1, 64 },
+  { "header_mine_1024", bench_header_mine_1k, 1024, 80 },
+  { "ripemd160_32", bench_ripemd160_32, 1, 32 },
+  { "hash160_33", bench_hash160_33, 1, 33 },
+  { "hash160_many_33", bench_hash160_many_33, 16, 33 },
+  { "siphash_32", bench_siphash_32, 1, 32 },
+  { "murmur3_32", bench_murmur3_32, 1, 32 },
+  { "hash_key_32", bench_hash_key_32, 1, 32 },
+  { "murmur3_tweaks_20", bench_murmur3_tweaks_20, 20, 32 },
+  { "filter_has_32", bench_filter_has_32, 1, 32 },
+  { "mpn_mul_8", bench_mpn_mul_8, 1, 0 },
+  { "mpn_mul_16", bench_mpn_mul_16, 1, 0 },
+  { "mpn_mul_24", bench_mpn_mul_24, 1, 0 },
+  { "mpn_mul_32", bench_mpn_mul_32, 1, 0 },
+  { "mpn_mul_48", bench_mpn_mul_48, 1, 0 },
+  { "mpn_mul_64", bench_mpn_mul_64, 1, 0 },
+  { "mpn_mul_128", bench_mpn_mul_128, 1, 0 },
+  { "mpn_sqr_8", bench_mpn_sqr_8, 1, 0 },
+  { "mpn_sqr_16", bench_mpn_sqr_16, 1, 0 },
+  { "mpn_sqr_24", bench_mpn_sqr_24, 1, 0 },
+  { "mpn_sqr_32", bench_mpn_sqr_32, 1, 0 },
+  { "mpn_sqr_48", bench_mpn_sqr_48, 1, 0 },
+  { "mpn_sqr_64", bench_mpn_sqr_64, 1, 0 },
+  { "mpn_sqr_128", bench_mpn_sqr_128, 1, 0 },
+  { "map_get_khash", bench_kh_get, 1, 0 },
+  { "map_get_swiss", bench_sw_get, 1, 0 },
+  { "map_miss_khash", bench_kh_miss, 1, 0 },
+  { "map_miss_swiss", bench_sw_miss, 1, 0 },
+  { "map_churn_khash", bench_kh_churn, 1, 0 },
+  { "map_churn_swiss", bench_sw_churn, 1, 0 },
+  { "outmap_get_khash", bench_kh_outs, 1, 0 },
+  { "outmap_get_swiss", bench_sw_outs, 1, 0 },
+  { "outmap_get_prevmap", bench_prev_outs, 1, 0 },
+  { "outmap_walk_khash", bench_kh_walk, 1, 0 },
+  { "outmap_walk_swiss", bench_sw_walk, 1, 0 },
+  { "outmap_walk_prevmap", bench_prev_walk, 1, 0 },
+  { "vector_push_pop", bench_vector_push, BENCH_ITEMS, 0 },
+  { "heap_insert_shift", bench_heap_sort, BENCH_ITEMS, 0 },
+  { "block_read", bench_block_read, 1, 0 },
+  { "block_write", bench_block_write, 1, 0 },
+  { "tx_read", bench_tx_read, 1, 0 },
+  { "tx_write", bench_tx_write, 1, 0 },
+  { "coin_read", bench_coin_read, 1, 0 },
+  { "coin_write", bench_coin_write, 1, 0 },
+  { "view_connect", bench_view_connect, 1, 0 },
+  { "script_verify", bench_script_verify, 1, 0 },
+  { "tx_verify", bench_tx_verify, 1, 0 }
+};
+
+/*
+ * Runner
+ */
+
+#define BENCH_SAMPLES 5
+
+static int64_t
+bench_time(const bench_t *bench, size_t iters) {
+  int64_t start = btc_time_nsec();
+
+  bench->run(iters);
+
+  return btc_time_nsec() - start;
+}
+
+static size_t
+bench_calibrate(const bench_t *bench, int64_t target) {
+  size_t iters = 1;
+  int64_t elapsed;
+
+  /* Double until a run is long enough to extrapolate from. */
+  for (;;) {
+    elapsed = bench_time(bench, iters);
+
+    if (elapsed >= target / 10 || iters >= ((size_t)1 << 30))
+      break;
+
+    iters *= 2;
+  }
+
+  if (elapsed <= 0)
+    elapsed = 1;
+
+  iters = (size_t)((double)iters * ((double)target / (double)elapsed));
+
+  return iters == 0 ? 1 : iters;
+}
+
+static int
+compare_i64(const void *x, const void *y) {
+  int64_t a = *((const int64_t *)x);
+  int64_t b = *((const int64_t *)y);
+  return (a > b) - (a < b);
+}
+
+static void
+bench_run(const bench_t *bench, int64_t target, size_t fixed, int first) {
+  int64_t samples[BENCH_SAMPLES];
+  double items, best, median;
+  size_t iters;
+  int i;
+
+  /* Fixtures built lazily stay out of the timings. */
+  bench->run(0);
+
+  /* A fixed count keeps runs comparable across builds. */
+  if (fixed > 0)
+    iters = fixed;
+  else
+    iters = bench_calibrate(bench, target / BENCH_SAMPLES);
+
+  for (i = 0; i < BENCH_SAMPLES; i++)
+    samples[i] = bench_time(bench, iters);
+
+  qsort(samples, BENCH_SAMPLES, sizeof(int64_t), compare_i64);
+
+  items = (double)iters * (double)bench->items;
+  best = (double)samples[0] / items;
+  median = (double)samples[BENCH_SAMPLES / 2] / items;
+
+  printf("%s\n    {\n", first ? "" : ",");
+  printf("      \"name\": \"%s\",\n", bench->name);
+  printf("      \"iterations\": %lu,\n", (unsigned long)iters);
+  printf("      \"items_per_iteration\": %lu,\n", (unsigned long)bench->items);
+  printf("      \"samples\": %d,\n", BENCH_SAMPLES);
+  printf("      \"ns_per_item\": %.2f,\n", median);
+  printf("      \"ns_per_item_min\": %.2f,\n", best);
+  printf("      \"items_per_sec\": %.2f", 1e9 / median);
+
+  if (bench->bytes > 0) {
+    printf(",\n      \"bytes_per_item\": %lu,\n", (unsigned long)bench->bytes);
+    printf("      \"mib_per_sec\": %.2f",
+           ((double)bench->bytes * 1e9 / median) / (1024.0 * 1024.0));
+  }
+
+  printf("\n    }");
+
+  fflush(stdout);
+}
+
+static int
+bench_match(const char *name, int argc, char **argv, int start) {
+  int i;
+
+  if (start >= argc)
+    return 1;
+
+  for (i = start; i < argc; i++) {
+    if (strstr(name, argv[i]) != NULL)
+      return 1;
+  }
+
+  return 0;
+}
+
+static void
+bench_usage(void) {
+  fprintf(stderr, "Usage: mako_bench [-t msec] [-n iters] [-l] [filter ...]\n");
+  exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv) {
+  int64_t target = 1000;
+  size_t fixed = 0;
+  int first = 1;
+  int start = 1;
+  size_t i;
+
+  while (start < argc && argv[start][0] == '-') {
+    if (strcmp(argv[start], "-l") == 0) {
+      for (i = 0; i < lengthof(benchmarks); i++)
+        puts(benchmarks[i].name);
+      return EXIT_SUCCESS;
+    }
+
+    if (strcmp(argv[start], "-t") == 0 && start + 1 < argc) {
+      target = atoi(argv[start + 1]);
+
+      if (target <= 0)
+        bench_usage();
+
+      start += 2;
+      continue;
+    }
+
+    if (strcmp(argv[start], "-n") == 0 && start + 1 < argc) {
+      if (atol(argv[start + 1]) <= 0)
+        bench_usage();
+
+      fixed = (size_t)atol(argv[start + 1]);
+
+      start += 2;
+      continue;
+    }
+
+    bench_usage();
+  }
+
+  bench_setup();
+
+  printf("{\n  \"benchmarks\": [");
+
+  for (i = 0; i < lengthof(benchmarks); i++) {
+    if (!bench_match(benchmarks[i].name, argc, argv, start))
+      continue;
+
+    bench_run(&benchmarks[i], target * 1000000, fixed, first);
+
+    first = 0;
+  }
+
+  printf("\n  ]\n}\n");
+
+  bench_cleanup();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,416 @@
+/*!
+ * bip324_vectors.h - bip324 test vectors for mako
+ *
+ * The entries marked "official" are copied from the BIP324
+ * test vectors in the bips repository (BSD-3-Clause):
+ *   https://github.com/bitcoin/bips/tree/master/bip-0324
+ *
+ *   - ellswift_decode_test_vectors.csv
+ *   - xswiftec_inv_test_vectors.csv
+ *   - packet_encoding_test_vectors.csv
+ *
+ * Only a few rows of each file are included so far. The
+ * complete files should replace the synthetic entries.
+ *
+ * The entries marked "synthetic" are NOT official. They were
+ * generated for mako (MIT License) with an independent Python
+ * port of the BIP324 reference code, and they follow the
+ * layout and edge cases of the official files. The official
+ * rows above them check that port.
+ */
+
+typedef struct ellswift_decode_vector_s {
+  const char *ellswift;
+  const char *x;
+  const char *comment;
+} ellswift_decode_vector_t;
+
+typedef struct ellswift_inv_vector_s {
+  const char *u;
+  const char *x;
+  const char *t[8];
+  const char *comment;
+} ellswift_inv_vector_t;
+
+typedef struct bip324_packet_vector_s {
+  uint32_t idx;
+  const char *priv_ours;
+  const char *ellswift_ours;
+  const char *ellswift_theirs;
+  int initiating;
+  const char *contents;
+  size_t multiply;
+  const char *aad;
+  int ignore;
+  const char *send_garbage_terminator;
+  const char *recv_garbage_terminator;
+  const char *session_id;
+  const char *ciphertext;
+  const char *ciphertext_endswith;
+} bip324_packet_vector_t;
+
+static const ellswift_decode_vector_t ellswift_decode_vectors[] = {
+  /* Official (ellswift_decode_test_vectors.csv). */
+  {
+    "0000000000000000000000000000000000000000000000000000000000000000"
+    "01d3475bf7655b0fb2d852921035b2ef607f49069b97454e6795251062741771",
+    "b5da00b73cd6560520e7c364086e7cd23a34bf60d0e707be9fc34d4cd5fdfa2c",
+    "u%p=0;valid_x(x1)"
+  },
+  {
+    "0000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "edd1fd3e327ce90cc7a3542614289aee9682003e9cf7dcc9cf2ca9743be5aa0c",
+    "u%p=0;t%p=0;valid_x(x2)"
+  },
+  /* Synthetic. */
+  {
+    "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f"
+    "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f",
+    "edd1fd3e327ce90cc7a3542614289aee9682003e9cf7dcc9cf2ca9743be5aa0c",
+    "u = p, t = p"
+  },
+  {
+    "0000000000000000000000000000000000000000000000000000000000000000"
+    "6998e423b750263b88ec269b140813a22e3cea300bb9ed509735e3eb424a5463",
+    "a493946ae3e9fc518e271a90608aa2f4acaa86294cffb65eb5d4c24a3f6a5dbe",
+    "u%p = 0"
+  },
+  {
+    "ba21853053b38ea2e418c4f7bfb8f0bebd2ffba9e86d2ab6a48dec26538bccdb"
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "c980f6b52989e89737167796a3707eb292665c9140a1aca441896e891595cc5d",
+    "t%p = 0"
+  },
+  {
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+    "e00a510c460e067461612a1b71515fca7c009b1ee6cccc1c88d26cce69305a79",
+    "be57185d059be6b4ae7d69437c7300c85f2aedfa52a268a8f9dec55457953bb4",
+    "u >= p"
+  },
+  {
+    "00f2adbf91cdd3d98a702a15d4563658cb699c0a0a6d05214d79ddcf556a0d68"
+    "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc34",
+    "a74f39c6d8f068f2dbd39070ec42d920f0d5c637efed201eda1f4c8f549c008b",
+    "t >= p"
+  },
+  {
+    "d191975424b888ff4382547d00258a4ab3a6d79847badca1fb3fc039074eddcc"
+    "9c85020cc985b0994b33003f8f2cc8e2ff4b00b913aa00afe47638384b02f504",
+    "ddaf5e33a4379430240807ff229d8286b70662488aaaf69713921a51b855d93d",
+    "u^3 + t^2 + 7 = 0"
+  },
+  {
+    "4f9f803464b67792dd26822a889ff9dd0afef0266ab74a2814621736ee8fa02a"
+    "49b45ca68c7d744d85b9fe4c1f7b9e707ebf579a3a1889fdc465db67ea8fa18c",
+    "0f870f694d1f3287bd1e0291a0ce0f9973b888ba9409eb17be1ec09b84a5a4ac",
+    "u^3 + t^2 + 7 = 0"
+  },
+  {
+    "e9f3c108b109711f33a31c008799794ec59aa3c9be59fba4be3693f047679e88"
+    "1df48d50419c89ce860806951606129716bf751a244e582f2d60be5c6aec0cb0",
+    "2a7b1ba07c45733c0926077dccaf4a8536b40183e5100c4e44e8b1f74503f994",
+    "selects x1 = u + 4Y^2"
+  },
+  {
+    "e804930e2bc78831081a398975fe5015835fcd291b490cadf32b9752ce97ac59"
+    "4efc4aba7785ab032ab3f3393488fdc19aafd9f05beb7accc6213b36b5a1c893",
+    "25f081ee9fcdd0335784dd967ca50d25f90467b999da0e25bafce09032b1e431",
+    "selects x2 = (-X/Y - u)/2"
+  },
+  {
+    "d5659fb4e70d6241419df6f8eb9ee2604b6c990b4aec91f21eb839348cee1894"
+    "f77e47dde033da22313fbb783e1e4bbcd212c8d8fd64ae07f621dc499a5c3bb5",
+    "9280a97a7092122c2c8d2e087681dd83485477807a2df3ab47a65ed5e90bc5da",
+    "selects x1 = u + 4Y^2"
+  },
+  {
+    "d0eee1c686e4b4ffd26398f4267a62ef8d694f362dd692d45ce75ac520a0b62a"
+    "6712b060bb049124ac1b33d5ad7c5bab8eb92e33481d6821455bda5d92ad7018",
+    "9bf51d15006652f16357cbe3b4212a3f7985c9409fd32d9cf3580a27a44134c4",
+    "selects x3 = (X/Y - u)/2"
+  }
+};
+
+static const ellswift_inv_vector_t ellswift_inv_vectors[] = {
+  /* Official (xswiftec_inv_test_vectors.csv). */
+  {
+    "05ff6bdad900fc3261bc7fe34e2fb0f569f06e091ae437d3a52e9da0cbfb9590",
+    "80cdf63774ec7022c89a5a8558e373a279170285e0ab27412dbce510bdfe23fc",
+    {
+      NULL,
+      NULL,
+      "45654798ece071ba79286d04f7f3eb1c3f1d17dd883610f2ad2efd82a287466b",
+      "0aeaa886f6b76c7158452418cbf5033adc5747e9e9b5d3b2303db96936528557",
+      NULL,
+      NULL,
+      "ba9ab867131f8e4586d792fb080c14e3c0e2e82277c9ef0d52d1027c5d78b5c4",
+      "f51557790948938ea7badbe7340afcc523a8b816164a2c4dcfc24695c9ad76d8"
+    },
+    ""
+  },
+  /* Synthetic. */
+  {
+    "a46a7e68697e61daa30fad5f1f52b0309c3de5a4861214e9cb3405c3a576a69c",
+    "83de95a92e5ef72dffbc387aac7159e991553f84174c76a327c050d88305f9f4",
+    {
+      NULL,
+      NULL,
+      "13b9cbe8cc59826f4e6225309cb29f3bcfe06d470172f74fbf1ca4cdbefd0f36",
+      "20f3ef878084069d6483a6b2601d34ee38998ef69d0b17aa7604f8f9aa82aa00",
+      NULL,
+      NULL,
+      "ec46341733a67d90b19ddacf634d60c4301f92b8fe8d08b040e35b314102ecf9",
+      "df0c10787f7bf9629b7c594d9fe2cb11c766710962f4e85589fb0705557d522f"
+    },
+    ""
+  },
+  {
+    "6a59029dbb694f5a03e0e2134ac007f0a32ec78bf4917b34c5f60d08e7d45bf0",
+    "1f89b3d5bc67b055ed75a1f90f31e0f7a3fabef3b157ec64f2f8c78d9d07939e",
+    {
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL
+    },
+    ""
+  },
+  {
+    "32920730502b3bf522b522408f4e1e61843234fc671222acb1b18fef4e936f7e",
+    "6f354827479b237cd1188394defd687a51ddd0c75c9651841fb3b98f65abad0d",
+    {
+      "2c48f68f058d94102a43ce5fb674abaaf8f0141c134d481a5e2e115a6feab4d7",
+      "9fc240a97894efa4b3d4159902ef9140f73a6eeb8353efc7a0460ec094e4dedf",
+      "2dd6f9281de2a9bb72b830eb3a7005b0d00353cefa3d05b26e5764afa520bcd1",
+      "e303ab96d18f070174493f5d7a19abf52f446695d330531cb089f38408e0bb5a",
+      "d3b70970fa726befd5bc31a0498b5455070febe3ecb2b7e5a1d1eea490154758",
+      "603dbf56876b105b4c2bea66fd106ebf08c591147cac10385fb9f13e6b1b1d50",
+      "d22906d7e21d56448d47cf14c58ffa4f2ffcac3105c2fa4d91a89b4f5adf3f5e",
+      "1cfc54692e70f8fe8bb6c0a285e6540ad0bb996a2ccface34f760c7af71f40d5"
+    },
+    ""
+  },
+  {
+    "f750f5dddffbd08c6629186f88e14966200fceb916fbf8e8df0cca0b21660ba9",
+    "cf02e0a20dd1b757d587762c183d48efc0ab7bde34f9a3df9633ed84d8582372",
+    {
+      "f7c62bcb6dd31af421339688de03b0bdb9fd56658b7fa6ca7ac92421059746cd",
+      "42ba5993c9da9ac9cd82a5841e9a0291f0d3724a5f5da548f4bc4f831c98cfdb",
+      NULL,
+      NULL,
+      "0839d434922ce50bdecc697721fc4f424602a99a748059358536dbddfa68b562",
+      "bd45a66c36256536327d5a7be165fd6e0f2c8db5a0a25ab70b43b07be3672c54",
+      NULL,
+      NULL
+    },
+    ""
+  },
+  {
+    "834dcd7101ae13feff91b2f629c247854eb912c6b7ed97f8eeb9cfee23fb8a81",
+    "834dcd7101ae13feff91b2f629c247854eb912c6b7ed97f8eeb9cfee23fb8a81",
+    {
+      "85732ee74a5559f1194a6023b7677d320644033d9f5bc9c6416e29b06f177f79",
+      "ae37047d17d7b63e5b2f619f5232b12db53518d77fe5c34ebe6e97c8c783237c",
+      NULL,
+      NULL,
+      "7a8cd118b5aaa60ee6b59fdc489882cdf9bbfcc260a43639be91d64e90e87cb6",
+      "51c8fb82e82849c1a4d09e60adcd4ed24acae728801a3cb141916836387cd8b3",
+      NULL,
+      NULL
+    },
+    "x = u"
+  },
+  {
+    "8b5782f795474adce496565ef4082c2b65fff0014ca679f0d1764b37c622ccdd",
+    "ff81cb947e198d1f099881bbde9fd25cd76a9d3370b627d67c3fbea154857a36",
+    {
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL,
+      NULL
+    },
+    "no preimage"
+  }
+};
+
+static const bip324_packet_vector_t bip324_packet_vectors[] = {
+  /* Official (packet_encoding_test_vectors.csv). */
+  {
+    1,
+    "61062ea5071d800bbfd59e2e8b53d47d194b095ae5a4df04936b49772ef0d4d7",
+    "ec0adff257bbfe500c188c80b4fdd640f6b45a482bbc15fc7cef5931deff0aa1"
+    "86f6eb9bba7b85dc4dcc28b28722de1e3d9108b985e2967045668f66098e475b",
+    "a4a94dfce69b4a2a0a099313d10f9f7e7d649d60501c9e1d274c300e0d89aafa"
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffff8faf88d5",
+    1,
+    "8e",
+    1,
+    "",
+    0,
+    "faef555dfcdb936425d84aba524758f3",
+    "02cb8ff24307a6e27de3b4e7ea3fa65b",
+    "ce72dffb015da62b0d0f5474cab8bc72605225b0cee3f62312ec680ec5f41ba5",
+    "7530d2a18720162ac09c25329a60d75adf36eda3c3",
+    ""
+  },
+  /* Synthetic. */
+  {
+    1,
+    "2f4bc47bc25c783bb44547801566d69f4ab482163ca66c5aef08d01f4cc31569",
+    "6069009b51c1c1f67e03a063c96a48ca2aa6762ea5de76f96f971cab332649e8"
+    "85a1ab5c3b638a9f1c64d14fad89b2082da1dfdacce36f941a0afa28ac8f35c4",
+    "e0dce30dfad701a1538f194c4162d80f672e9c8d50f7c5c2e078440dd3146a30"
+    "ee870d27934df353efc963ebddb1aa99561b29d5c17df21402964e46eba605d6",
+    1,
+    "8e",
+    1,
+    "",
+    0,
+    "c3daa4ce105bf0c0ded5d8ff91936396",
+    "a8ef3a0cadf8a62e40df75305501bdd9",
+    "8596c127af0a7f2019e0358eb0338b6aadb6799810cc8bc636d889256fa284c1",
+    "f4f3fa5dff0c251661b8274a0e18c3d679984305ec",
+    ""
+  },
+  {
+    999,
+    "1e8767d67105208f9cc16c7a0df24defc0b69b5366dec8d6d3e38f9c1aa02cf9",
+    "9e6fc0310324b3831f4f57031a4b37707e1773a5cac7409de11cd4d489df7743"
+    "9aab8dde02bdaff5c63f0667daea7fd0f4f4a05dae1a73ff7eae9a40cb2093b3",
+    "57213c747de4ce0605944efb765df3e7bf4ec06e269c41567f508f825e420eb9"
+    "bc6985257d33a35407261bb0f094238308172e1b50b710cdeb0516755d281eda",
+    0,
+    "3eb1d4e98035cfd8eeb29bac969ed3824a",
+    1,
+    "",
+    0,
+    "08deb5357068bd6540dbb5f63cdaa434",
+    "7058091f53ecfb7187a1b1bf81ca930b",
+    "52b94bd9c2c9d77a076b7e5e07ed76dcb0660f5f1cfe84cf2b290dbdb718ca8c",
+    "3e65bd1df232f3dae41ab89c8a5d8300d8349c21d90495e365e22290a8ea9aa4"
+    "393c8f824f",
+    ""
+  },
+  {
+    0,
+    "ce40b491f336753a477eae0f742126f0ef302d53faa2b2f928aa0318223ad112",
+    "c124fe7bfe5e60de1ca8e91c3151fa3d0d538af23a4a10ed2b9da3317a01b52e"
+    "ed0a31097a58a85c2c70f19762dd7ea2769f33ce0814dc41a78b8b1d729a1404",
+    "b700e78065b47984689445d1a2ceeae38ef75635fcbb1a524dafbb22d5937364"
+    "ff69c7f7ff94a24d861ddea972a62a52cd6e68e11f51733f0ed3e4db94d41250",
+    1,
+    "054290a6c6ba8d80478172e89d32bf690913ae9835de6dcf206ff1f4d652286f"
+    "e0ddf74deba41d55de3edc77c42a32af79bbea2c00bae7492264c60866ae5a",
+    1,
+    "84932a55aac22b51e7b128d31d9f0550da28e6a3f394224707d878603386b2f9"
+    "d0c6bcd8046679bfed7b68c517e7431e75d9dd34605727d2ef1c2babbf680ecc"
+    "8d68d2c4886e9953a4034abde6da4189cd47c6bb3192242cc4d5f1888e77",
+    0,
+    "d9906fea6f8349ee54dc48676bedc1d8",
+    "97f2607a1e0ffdd1be1630429f7f006e",
+    "ad6a2f158cb984250f722c0df595094f7a671e61693403c39c9c1e49cb9ad21d",
+    "d6c837994d79ec988ad0bbe20ae7576b40872a7e7ba9a27efb04861ca5389dc6"
+    "b2e3a6d939c594557fd4c753a046c11002d4562192461ee684bbc82b4b139c1b"
+    "6ca84144e7b81c3a7bf92db2f1c074b00e857c",
+    ""
+  },
+  {
+    223,
+    "a5f313f951cb3c1e4d13284d495be337f0d3b43dc6e537fb8c13fc33f6751ebb",
+    "b6ad0600f66a4d6d6e835b99f0c6b098b116a6241be79a6b0f2861d9c08d6791"
+    "9a656b8eafa1ccdfe73e2ede0fa193ec9276292ed7d63345fa58298e1f2655a8",
+    "dba04911df46ebe7d18e6bcef54b02ea0162774f6c600f05fd1be378d28fea55"
+    "d6de75b3b2e3fbd4a7c4e921db2d5708a10284a1154f458c9817e32dbdac86db",
+    1,
+    "",
+    1,
+    "",
+    1,
+    "4f1399d9a2c5b2807039d4cbd603b662",
+    "195d4b4fb41d4c324896ca58f2928cb9",
+    "0acdbf912b48292508f3537f1e34b8bd450792efad525d1a677b6d9fbe028ba1",
+    "f5661fcc4acdbc7534739705cdf31ca969a19665",
+    ""
+  },
+  {
+    224,
+    "9517c59508f15f23b55a3ee318571f1fdff83ce62d6b782059d9b1fe52ec86cb",
+    "6ee857d516edf66e5a050fa35a6f26b2148e3d8290a49c8df7d84b8ce53718c4"
+    "e69ebc866faadef9ad3c8e3ea30b696b9ec8cc90d99b9c2e98d4cb34927a1c45",
+    "decb7a4b48bfbd55ddd41aa9e2c05749d8386421d7030115092e299d588bfeb5"
+    "e384c2557782644c2cc81f20ce6a914fd258f14aee33ade105bc7223c4fe77da",
+    0,
+    "5bcf",
+    1,
+    "",
+    0,
+    "87544af5556462ab28e595fe07cc779d",
+    "e64fd040145f2e0416812f42ad76c466",
+    "0eceda7ab2d03b5a7f9e97b7cd237ec7d0a190619b99de1c112b93d7046d181c",
+    "572abd84b049a195c5b474ebe8e280a79d9e530af718",
+    ""
+  },
+  {
+    448,
+    "cf53590379651cb8ea4ae807fec2d3173aaf3f9fd19fa68b560910d464894b2b",
+    "8edaf710477aa6ce3849e2064282869a4fcefee6b997573ac1658ebec6b1efe8"
+    "f43959763693937916b4670cbf95f93136c7bef88621d75b2496a7a46cb65aa5",
+    "0ca468c8e55e4daa90daadb793d20c34254045c47fd4ba8929d6c7de4550d795"
+    "183f4ab9bee5c00789f69b8ed10189bb3c58bffb7794e6c1dc9e7070c92931f3",
+    1,
+    "c4",
+    1,
+    "9b25",
+    1,
+    "164741e72289fa78b05bd05c9865a8ed",
+    "1e3af0cfe9c38b674593a6258f9383db",
+    "d673064cca1aa4f2d0ead844354c34045f73a5dad83be99679b03cfb2eba1743",
+    "303bb622e1b5d08d4034aa2cbc64e028ec1769f57e",
+    ""
+  },
+  {
+    3,
+    "2651437e27040b50abf506eed931dd9409604a031bfeb521ed63e94c1cbbde1c",
+    "9899977fd59f73192925ea2a6e7c236dc47b215d85940e9c9b190574e6a951f8"
+    "fc3ddce05e7a19ef687f24a75aa7802af4a56dec115da597c7a334942903eb66",
+    "1938fc540bcbbec307259bce350b269aa150a7291d7428ae099e053b8b6d889d"
+    "7a05edbe04466a8be0e24962a77140ca0d2285dd7b2c8b4502945134ef2aa88a",
+    0,
+    "7c",
+    4000,
+    "",
+    0,
+    "70cf994d551630c934936fa3e4d138c9",
+    "0de51fbabbbb386b33062357ad3a6a88",
+    "ec0c122c8ae77534425a9a7b577bf27a39f23d38d9755e06a61e8986cd12fa72",
+    "",
+    "d98c20c1c97124e38f6455eaa36cbdb2b10513b5c8780a817a66ee54108c1e71"
+  },
+  {
+    2,
+    "ef6728a8c861aa2649c0e5e977a0414a5fc5754d36c4c69d901cbb7f90854897",
+    "c289613cbd380d40a35ed6c4a0a608c9ce5eb17f2288b9b6468a1938d8cc47c2"
+    "3c9eb1808e2c0abc683857fd6378c7fb2a8140a9682ad6edcf553d713012d488",
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+    1,
+    "00",
+    16384,
+    "d5",
+    0,
+    "c0f099b904a9cc3a5e7b61913e003f37",
+    "cfb15364deaa33e5cc1f990f8b9ca9e4",
+    "424a385ed6c6f9f78265b7edee40cfb1b6437388b18f7f0aa25e4d4316870ade",
+    "",
+    "318b3272fb18c4c6904f01005610bd96f18d3849454eb7bd4b642d3e995a7c44"
+  }
+};
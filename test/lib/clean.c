@@ -45,6 +45,10 @@ btc_clean(const char *prefix) {
 
   btc_rmdir_r(path);
 
+  ASSERT(btc_path_join(path, sizeof(path), prefix, "blocks.reindex", 0));
+
+  btc_rmdir_r(path);
+
   ASSERT(btc_path_join(path, sizeof(path), prefix, "chain", 0));
 
   btc_rmdir_r(path);
@@ -57,6 +61,18 @@ btc_clean(const char *prefix) {
 
   btc_fs_unlink(path);
 
+  ASSERT(btc_path_join(path, sizeof(path), prefix, "chain.mdb", 0));
+
+  btc_fs_unlink(path);
+
+  ASSERT(btc_path_join(path, sizeof(path), prefix, "chain.mdb-lock", 0));
+
+  btc_fs_unlink(path);
+
+  ASSERT(btc_path_join(path, sizeof(path), prefix, "index.dat", 0));
+
+  btc_fs_unlink(path);
+
   ASSERT(btc_path_join(path, sizeof(path), prefix, "debug.log", 0));
 
   btc_fs_unlink(path);
@@ -0,0 +1,535 @@
+/*!
+ * replay.c - p2p traffic replay for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <io/loop.h>
+#include <mako/netaddr.h>
+#include <mako/netmsg.h>
+#include <mako/network.h>
+#include <node/chain.h>
+#include <node/logger.h>
+#include <node/mempool.h>
+#include <node/pool.h>
+#include <node/types.h>
+#include "lib/tests.h"
+
+/*
+ * Constants
+ */
+
+#define RP_PORT 28444
+#define RP_MAX_BUFFERED (4 << 20)
+#define RP_MAX_PEERS 1024
+#define RP_QUIET 500 /* msec without progress before we stop */
+
+/*
+ * Types
+ */
+
+typedef struct rp_record_s {
+  int64_t time;
+  size_t conn;
+  int kind;
+  const uint8_t *data;
+  size_t length;
+} rp_record_t;
+
+typedef struct rp_conn_s {
+  uint32_t id;
+  btc_socket_t *socket;
+  int ending;
+  int closed;
+} rp_conn_t;
+
+typedef struct rp_options_s {
+  const char *prefix;
+  const char *file;
+  int port;
+  int realtime;
+  int memory;
+  int verbose;
+} rp_options_t;
+
+typedef struct replay_s {
+  rp_options_t opt;
+  const btc_network_t *network;
+  uint8_t *data;
+  size_t size;
+  rp_record_t *records;
+  size_t length;
+  size_t index;
+  rp_conn_t *conns;
+  size_t peers;
+  btc_loop_t *loop;
+  btc_logger_t *logger;
+  btc_chain_t *chain;
+  btc_mempool_t *mempool;
+  btc_pool_t *pool;
+  int64_t start; /* usec, when feeding began */
+  int64_t base; /* usec, first record */
+  int64_t finish; /* usec, last progress */
+  uint64_t fed;
+  uint64_t seen;
+} replay_t;
+
+/*
+ * Capture
+ */
+
+static uint32_t
+rp_read32(const uint8_t *xp) {
+  return ((uint32_t)xp[0] <<  0)
+       | ((uint32_t)xp[1] <<  8)
+       | ((uint32_t)xp[2] << 16)
+       | ((uint32_t)xp[3] << 24);
+}
+
+static int64_t
+rp_read64(const uint8_t *xp) {
+  return (int64_t)(((uint64_t)rp_read32(xp + 4) << 32) | rp_read32(xp));
+}
+
+static const btc_network_t *
+rp_network(uint32_t magic) {
+  const btc_network_t *networks[5];
+  size_t i;
+
+  networks[0] = btc_mainnet;
+  networks[1] = btc_testnet;
+  networks[2] = btc_regtest;
+  networks[3] = btc_simnet;
+  networks[4] = btc_signet;
+
+  for (i = 0; i < lengthof(networks); i++) {
+    if (networks[i]->magic == magic)
+      return networks[i];
+  }
+
+  return NULL;
+}
+
+static size_t
+rp_conn(replay_t *rp, uint32_t id) {
+  size_t i;
+
+  for (i = 0; i < rp->peers; i++) {
+    if (rp->conns[i].id == id)
+      return i;
+  }
+
+  rp->conns = realloc(rp->conns, (i + 1) * sizeof(rp_conn_t));
+
+  ASSERT(rp->conns != NULL);
+
+  rp->conns[i].id = id;
+  rp->conns[i].socket = NULL;
+  rp->conns[i].ending = 0;
+  rp->conns[i].closed = 0;
+
+  rp->peers++;
+
+  return i;
+}
+
+static int
+rp_load(replay_t *rp, const char *file) {
+  const uint8_t *xp;
+  size_t xn, len;
+  rp_record_t *rec;
+
+  if (!btc_fs_alloc_file(&rp->data, &rp->size, file))
+    return 0;
+
+  xp = rp->data;
+  xn = rp->size;
+
+  if (xn < 8 || rp_read32(xp) != BTC_CAPTURE_MAGIC)
+    return 0;
+
+  rp->network = rp_network(rp_read32(xp + 4));
+
+  if (rp->network == NULL)
+    return 0;
+
+  xp += 8;
+  xn -= 8;
+
+  /* A capture cut short keeps whatever is whole. */
+  while (xn >= BTC_CAPTURE_HEADER) {
+    len = rp_read32(xp + 13);
+
+    if (xn - BTC_CAPTURE_HEADER < len)
+      break;
+
+    if ((rp->length & (rp->length - 1)) == 0) {
+      size_t alloc = rp->length == 0 ? 1 : rp->length * 2;
+
+      rp->records = realloc(rp->records, alloc * sizeof(rp_record_t));
+
+      ASSERT(rp->records != NULL);
+    }
+
+    rec = &rp->records[rp->length++];
+    rec->time = rp_read64(xp);
+    rec->conn = rp_conn(rp, rp_read32(xp + 8));
+    rec->kind = xp[12];
+    rec->data = xp + BTC_CAPTURE_HEADER;
+    rec->length = len;
+
+    xp += BTC_CAPTURE_HEADER + len;
+    xn -= BTC_CAPTURE_HEADER + len;
+  }
+
+  if (rp->length > 0)
+    rp->base = rp->records[0].time;
+
+  return 1;
+}
+
+/*
+ * Connections
+ */
+
+static void
+on_close(btc_socket_t *socket) {
+  rp_conn_t *conn = (rp_conn_t *)btc_socket_get_data(socket);
+
+  conn->socket = NULL;
+  conn->closed = 1;
+}
+
+static void
+on_error(btc_socket_t *socket) {
+  btc_socket_close(socket);
+}
+
+static int
+on_data(btc_socket_t *socket, const void *data, size_t size) {
+  /* Whatever the node says back is dropped. */
+  (void)data;
+
+  if (size == 0) {
+    btc_socket_close(socket);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int
+rp_connect(replay_t *rp, rp_conn_t *conn) {
+  btc_sockaddr_t addr;
+
+  btc_sockaddr_import(&addr, "127.0.0.1", rp->opt.port);
+
+  conn->socket = btc_loop_connect(rp->loop, &addr);
+
+  if (conn->socket == NULL) {
+    conn->closed = 1;
+    return 0;
+  }
+
+  btc_socket_set_data(conn->socket, conn);
+  btc_socket_on_close(conn->socket, on_close);
+  btc_socket_on_error(conn->socket, on_error);
+  btc_socket_on_data(conn->socket, on_data);
+
+  return 1;
+}
+
+/*
+ * Replay
+ */
+
+static int
+rp_feed(replay_t *rp, int64_t now) {
+  /* Streams go out in capture order. A backed up
+     connection holds up everyone behind it. */
+  while (rp->index < rp->length) {
+    const rp_record_t *rec = &rp->records[rp->index];
+    rp_conn_t *conn = &rp->conns[rec->conn];
+
+    if (rp->opt.realtime && rec->time - rp->base > now - rp->start)
+      return 0;
+
+    if (rec->kind == BTC_CAPTURE_RECV && !conn->closed) {
+      if (conn->socket == NULL && !rp_connect(rp, conn))
+        goto next;
+
+      if (btc_socket_buffered(conn->socket) >= RP_MAX_BUFFERED)
+        return 0;
+
+      btc_socket_write_static(conn->socket, rec->data, rec->length);
+
+      rp->fed += rec->length;
+    } else if (rec->kind == BTC_CAPTURE_CLOSE) {
+      conn->ending = 1;
+    }
+
+next:
+    rp->index++;
+  }
+
+  return 1;
+}
+
+static int
+rp_flush(replay_t *rp) {
+  int done = 1;
+  size_t i;
+
+  for (i = 0; i < rp->peers; i++) {
+    rp_conn_t *conn = &rp->conns[i];
+
+    if (conn->socket == NULL)
+      continue;
+
+    if (btc_socket_buffered(conn->socket) > 0) {
+      done = 0;
+      continue;
+    }
+
+    /* The kernel still delivers what we wrote. */
+    if (conn->ending)
+      btc_socket_close(conn->socket);
+  }
+
+  return done;
+}
+
+static void
+on_tick(void *arg) {
+  replay_t *rp = (replay_t *)arg;
+  int64_t now = btc_time_usec();
+  btc_nettotals_t totals;
+
+  btc_pool_nettotals(rp->pool, &totals);
+
+  if (totals.bytes_recv != rp->seen || totals.decoding > 0) {
+    rp->seen = totals.bytes_recv;
+    rp->finish = now;
+  }
+
+  if (!rp_feed(rp, now) || !rp_flush(rp)) {
+    rp->finish = now;
+    return;
+  }
+
+  if (now - rp->finish >= RP_QUIET * 1000)
+    btc_loop_stop(rp->loop);
+}
+
+/*
+ * Setup
+ */
+
+static void
+rp_open(replay_t *rp) {
+  const btc_network_t *network = rp->network;
+  unsigned int chain_flags = BTC_CHAIN_DEFAULT_FLAGS;
+  unsigned int pool_flags = BTC_POOL_DEFAULT_FLAGS | BTC_POOL_NOCONNECT;
+  btc_netaddr_t bind;
+
+  if (rp->opt.memory)
+    chain_flags |= BTC_CHAIN_MEMORY;
+
+  pool_flags &= ~BTC_POOL_DISCOVER;
+
+  ASSERT(btc_fs_mkdirp(rp->opt.prefix, 0755));
+
+  rp->logger = btc_logger_create();
+
+  btc_logger_set_silent(rp->logger, !rp->opt.verbose);
+
+  rp->loop = btc_loop_create();
+  rp->chain = btc_chain_create(network);
+  rp->mempool = btc_mempool_create(network, rp->chain);
+  rp->pool = btc_pool_create(network, rp->loop, rp->chain, rp->mempool);
+
+  btc_chain_set_logger(rp->chain, rp->logger);
+  btc_mempool_set_logger(rp->mempool, rp->logger);
+  btc_pool_set_logger(rp->pool, rp->logger);
+
+  btc_netaddr_set(&bind, "127.0.0.1", rp->opt.port);
+
+  btc_pool_set_bind(rp->pool, &bind);
+  btc_pool_set_port(rp->pool, rp->opt.port);
+  btc_pool_set_maxinbound(rp->pool, RP_MAX_PEERS);
+
+  /* Every stream comes from the same address; one
+     misbehaving peer mustn't lock out the rest. */
+  btc_pool_set_bantime(rp->pool, -1);
+
+  ASSERT(btc_chain_open(rp->chain, rp->opt.prefix, chain_flags));
+  ASSERT(btc_mempool_open(rp->mempool, rp->opt.prefix, 0));
+  ASSERT(btc_pool_open(rp->pool, rp->opt.prefix, pool_flags));
+
+  btc_loop_on_tick(rp->loop, on_tick, rp);
+}
+
+static void
+rp_close(replay_t *rp) {
+  btc_pool_close(rp->pool);
+  btc_mempool_close(rp->mempool);
+  btc_chain_close(rp->chain);
+
+  btc_pool_destroy(rp->pool);
+  btc_mempool_destroy(rp->mempool);
+  btc_chain_destroy(rp->chain);
+  btc_loop_destroy(rp->loop);
+  btc_logger_destroy(rp->logger);
+
+  free(rp->records);
+  free(rp->conns);
+  free(rp->data);
+}
+
+/*
+ * Report
+ */
+
+static void
+rp_report(const replay_t *rp, const btc_nettotals_t *totals) {
+  int64_t elapsed = rp->finish - rp->start;
+  uint64_t msgs = 0;
+  int first = 1;
+  btc_msg_t msg;
+  int i;
+
+  for (i = 0; i < BTC_NETSTAT_TYPES; i++)
+    msgs += totals->recv[i].msgs;
+
+  printf("{\n");
+  printf("  \"network\": \"%s\",\n", rp->network->name);
+  printf("  \"records\": %lu,\n", (unsigned long)rp->length);
+  printf("  \"peers\": %lu,\n", (unsigned long)rp->peers);
+  printf("  \"bytes\": %lu,\n", (unsigned long)rp->fed);
+  printf("  \"messages\": %lu,\n", (unsigned long)msgs);
+  printf("  \"elapsed_ms\": %ld,\n", (long)(elapsed / 1000));
+  printf("  \"handling\": {\n");
+
+  for (i = 0; i < BTC_NETSTAT_TYPES; i++) {
+    const btc_netstat_t *st = &totals->recv[i];
+
+    if (st->msgs == 0)
+      continue;
+
+    btc_msg_set_type(&msg, (enum btc_msgtype)i);
+
+    printf("%s    \"%s\": {\n", first ? "" : ",\n",
+           i == BTC_MSG_UNKNOWN ? "unknown" : msg.cmd);
+    printf("      \"count\": %lu,\n", (unsigned long)st->msgs);
+    printf("      \"bytes\": %lu,\n", (unsigned long)st->bytes);
+    printf("      \"total_us\": %lu,\n", (unsigned long)(st->time / 1000));
+    printf("      \"mean_ns\": %lu\n", (unsigned long)(st->time / st->msgs));
+    printf("    }");
+
+    first = 0;
+  }
+
+  printf("%s  }\n", first ? "" : "\n");
+  printf("}\n");
+}
+
+/*
+ * Main
+ */
+
+static void
+rp_usage(void) {
+  fprintf(stderr,
+    "Usage: mako_replay [-p prefix] [-P port] [-e] [-t] [-v] capture\n");
+  exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv) {
+  static replay_t rp;
+  rp_options_t *opt = &rp.opt;
+  btc_nettotals_t totals;
+  int i;
+
+  opt->prefix = BTC_PREFIX "/replay";
+  opt->file = NULL;
+  opt->port = RP_PORT;
+  opt->realtime = 0;
+  opt->memory = 0;
+  opt->verbose = 0;
+
+  for (i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "-e") == 0) {
+      opt->memory = 1;
+      continue;
+    }
+
+    /* Keep the original spacing between reads. */
+    if (strcmp(arg, "-t") == 0) {
+      opt->realtime = 1;
+      continue;
+    }
+
+    if (strcmp(arg, "-v") == 0) {
+      opt->verbose = 1;
+      continue;
+    }
+
+    if (arg[0] != '-') {
+      if (opt->file != NULL)
+        rp_usage();
+
+      opt->file = arg;
+
+      continue;
+    }
+
+    if (val == NULL)
+      rp_usage();
+
+    if (strcmp(arg, "-p") == 0) {
+      opt->prefix = val;
+    } else if (strcmp(arg, "-P") == 0) {
+      opt->port = atoi(val);
+
+      if (opt->port <= 0 || opt->port > 0xffff)
+        rp_usage();
+    } else {
+      rp_usage();
+    }
+
+    i++;
+  }
+
+  if (opt->file == NULL)
+    rp_usage();
+
+  if (!rp_load(&rp, opt->file)) {
+    fprintf(stderr, "Could not load capture: %s\n", opt->file);
+    return EXIT_FAILURE;
+  }
+
+  rp_open(&rp);
+
+  rp.start = btc_time_usec();
+  rp.finish = rp.start;
+
+  btc_loop_start(rp.loop);
+
+  btc_pool_nettotals(rp.pool, &totals);
+
+  rp_report(&rp, &totals);
+
+  rp_close(&rp);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+/*!
+ * t-addrindex.c - address index test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <node/addrindex.h>
+#include <node/chain.h>
+#include <mako/block.h>
+#include <mako/buffer.h>
+#include <mako/coins.h>
+#include <mako/consensus.h>
+#include <mako/entry.h>
+#include <mako/network.h>
+#include <mako/tx.h>
+#include "lib/tests.h"
+#include "data/chain_vectors_main.h"
+
+/* Block 170 holds the first spend: block 9's
+   coinbase pays 10 BTC to Hal and 40 back. */
+static btc_script_t satoshi;
+static btc_script_t hal;
+static uint8_t spend_hash[32];
+static uint8_t coinbase_hash[32];
+
+static void
+on_connect(const btc_entry_t *entry,
+           const btc_block_t *block,
+           const btc_view_t *view,
+           void *arg) {
+  btc_addrindex_connect((btc_addrindex_t *)arg, entry, block, view);
+}
+
+static void
+add_blocks(btc_chain_t *chain, size_t start, size_t end) {
+  unsigned char data[65536];
+  btc_block_t block;
+  size_t i;
+
+  for (i = start; i < end; i++) {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, chain_vectors_main[i]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+    ASSERT(btc_chain_add(chain, &block, BTC_BLOCK_DEFAULT_FLAGS, -1));
+
+    btc_block_clear(&block);
+  }
+}
+
+static void
+sync_index(btc_addrindex_t *index, int32_t height) {
+  int i;
+
+  for (i = 0; i < 1000 && btc_addrindex_syncing(index); i++)
+    btc_time_sleep(10);
+
+  ASSERT(!btc_addrindex_syncing(index));
+  ASSERT(btc_addrindex_height(index) == height);
+}
+
+static void
+check_spent(btc_addrindex_t *index) {
+  btc_addrcoin_t *coins;
+  btc_addrtx_t *txs;
+  uint8_t hash[32];
+
+  /* Satoshi's key: funded at 9, spent (and
+     refunded) at 170, paid to Hal at 170. */
+  btc_addrindex_hash(hash, &satoshi);
+
+  ASSERT(btc_addrindex_history(index, &txs, hash, 0, 10) == 2);
+  ASSERT(txs[0].height == 9 && txs[0].index == 0);
+  ASSERT(txs[1].height == 170 && txs[1].index == 1);
+  ASSERT(memcmp(txs[0].hash, coinbase_hash, 32) == 0);
+  ASSERT(memcmp(txs[1].hash, spend_hash, 32) == 0);
+
+  free(txs);
+
+  /* Range queries. */
+  ASSERT(btc_addrindex_history(index, &txs, hash, 10, 10) == 1);
+  ASSERT(txs[0].height == 170);
+
+  free(txs);
+
+  ASSERT(btc_addrindex_history(index, &txs, hash, 0, 1) == 1);
+  ASSERT(txs[0].height == 9);
+
+  free(txs);
+
+  ASSERT(btc_addrindex_unspents(index, &coins, hash, 10) == 1);
+  ASSERT(memcmp(coins[0].prevout.hash, spend_hash, 32) == 0);
+  ASSERT(coins[0].prevout.index == 1);
+  ASSERT(coins[0].height == 170);
+  ASSERT(coins[0].value == 40 * BTC_COIN);
+
+  free(coins);
+
+  btc_addrindex_hash(hash, &hal);
+
+  ASSERT(btc_addrindex_history(index, &txs, hash, 0, 10) == 1);
+  ASSERT(txs[0].height == 170);
+
+  free(txs);
+
+  ASSERT(btc_addrindex_unspents(index, &coins, hash, 10) == 1);
+  ASSERT(coins[0].prevout.index == 0);
+  ASSERT(coins[0].value == 10 * BTC_COIN);
+
+  free(coins);
+}
+
+static void
+check_unspent(btc_addrindex_t *index) {
+  btc_addrcoin_t *coins;
+  btc_addrtx_t *txs;
+  uint8_t hash[32];
+
+  btc_addrindex_hash(hash, &satoshi);
+
+  ASSERT(btc_addrindex_history(index, &txs, hash, 0, 10) == 1);
+  ASSERT(txs[0].height == 9);
+
+  free(txs);
+
+  ASSERT(btc_addrindex_unspents(index, &coins, hash, 10) == 1);
+  ASSERT(memcmp(coins[0].prevout.hash, coinbase_hash, 32) == 0);
+  ASSERT(coins[0].prevout.index == 0);
+  ASSERT(coins[0].height == 9);
+  ASSERT(coins[0].value == 50 * BTC_COIN);
+
+  free(coins);
+
+  btc_addrindex_hash(hash, &hal);
+
+  ASSERT(btc_addrindex_history(index, &txs, hash, 0, 10) == 0);
+  ASSERT(txs == NULL);
+  ASSERT(btc_addrindex_unspents(index, &coins, hash, 10) == 0);
+  ASSERT(coins == NULL);
+}
+
+int
+main(void) {
+  btc_chain_t *chain = btc_chain_create(btc_mainnet);
+  btc_addrindex_t *index = btc_addrindex_create(chain);
+  const btc_entry_t *entry;
+  btc_block_t *block;
+  int32_t height;
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+
+  /* Built on its own thread on first enable... */
+  add_blocks(chain, 0, 160);
+
+  ASSERT(btc_addrindex_open(index, BTC_PREFIX, BTC_ADDR_INDEX));
+
+  sync_index(index, 160);
+
+  /* ...then maintained on connect. */
+  btc_chain_set_context(chain, index);
+  btc_chain_on_connect(chain, on_connect);
+
+  add_blocks(chain, 160, 180);
+
+  ASSERT(btc_addrindex_height(index) == 180);
+
+  block = btc_chain_get_block(chain, btc_chain_by_height(chain, 9));
+
+  ASSERT(block != NULL);
+
+  btc_buffer_copy(&satoshi, &block->txs.items[0]->outputs.items[0]->script);
+  memcpy(coinbase_hash, block->txs.items[0]->hash, 32);
+
+  btc_block_destroy(block);
+
+  block = btc_chain_get_block(chain, btc_chain_by_height(chain, 170));
+
+  ASSERT(block != NULL);
+  ASSERT(block->txs.length == 2);
+
+  btc_buffer_copy(&hal, &block->txs.items[1]->outputs.items[0]->script);
+  memcpy(spend_hash, block->txs.items[1]->hash, 32);
+
+  btc_block_destroy(block);
+
+  check_spent(index);
+
+  /* Rewind past the spend. */
+  for (height = 180; height >= 170; height--) {
+    entry = btc_chain_by_height(chain, height);
+    block = btc_chain_get_block(chain, entry);
+
+    ASSERT(block != NULL);
+
+    btc_addrindex_disconnect(index, entry, block);
+    btc_block_destroy(block);
+  }
+
+  ASSERT(btc_addrindex_height(index) == 169);
+
+  check_unspent(index);
+
+  /* Survives a restart and catches up again. */
+  btc_addrindex_close(index);
+
+  ASSERT(btc_addrindex_open(index, BTC_PREFIX, BTC_ADDR_INDEX));
+
+  sync_index(index, 180);
+
+  check_spent(index);
+
+  btc_addrindex_close(index);
+  btc_chain_close(chain);
+
+  btc_buffer_clear(&satoshi);
+  btc_buffer_clear(&hal);
+
+  btc_addrindex_destroy(index);
+  btc_chain_destroy(chain);
+
+  btc_clean(BTC_PREFIX);
+
+  return 0;
+}
@@ -1,14 +1,205 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-addrman.c - address manager test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <io/core.h>
+#include <node/addrman.h>
+#include <mako/net.h>
+#include <mako/netaddr.h>
+#include <mako/network.h>
+#include <mako/util.h>
+#include <mako/vector.h>
 #include "lib/tests.h"
 
-int main(void) {
+#define NUM_ADDRS 2000
+
+static btc_netaddr_t addrs[NUM_ADDRS];
+static btc_netaddr_t srcs[4];
+
+static void
+init_addrs(void) {
+  int64_t now = btc_now();
+  char str[64];
+  int i;
+
+  for (i = 0; i < NUM_ADDRS; i++) {
+    sprintf(str, "%d.%d.%d.%d", 11 + i % 200, (i * 7) & 255, i >> 8, i & 255);
+
+    ASSERT(btc_netaddr_set(&addrs[i], str, 8333));
+
+    addrs[i].services = BTC_NET_DEFAULT_SERVICES;
+    addrs[i].time = now;
+  }
+
+  for (i = 0; i < (int)lengthof(srcs); i++) {
+    sprintf(str, "%d.1.2.3", 60 + i);
+
+    ASSERT(btc_netaddr_set(&srcs[i], str, 8333));
+  }
+}
+
+static size_t
+count_used(btc_addrman_t *man) {
+  const btc_addrent_t *entry;
+  btc_addriter_t iter;
+  size_t total = 0;
+
+  btc_addrman_iterate(&iter, man);
+
+  while (btc_addrman_next(&entry, &iter))
+    total += entry->used;
+
+  return total;
+}
+
+static void
+check_roundtrip(btc_addrman_t *man) {
+  btc_addrman_t *copy = btc_addrman_create(btc_mainnet);
+  size_t size = btc_addrman_size(man);
+  uint8_t *raw1 = malloc(size);
+  uint8_t *raw2 = malloc(size);
+
+  ASSERT(raw1 != NULL && raw2 != NULL);
+  ASSERT(btc_addrman_export(raw1, man) == size);
+
+  ASSERT(btc_addrman_import(copy, raw1, size));
+  ASSERT(btc_addrman_total(copy) == btc_addrman_total(man));
+  ASSERT(count_used(copy) == count_used(man));
+
+  ASSERT(btc_addrman_size(copy) == size);
+  ASSERT(btc_addrman_export(raw2, copy) == size);
+  ASSERT(memcmp(raw1, raw2, size) == 0);
+
+  /* Truncated. */
+  ASSERT(!btc_addrman_import(copy, raw1, size - 1));
+  ASSERT(btc_addrman_total(copy) == 0);
+
+  btc_addrman_destroy(copy);
+
+  free(raw1);
+  free(raw2);
+}
+
+static void
+check_batch(void) {
+  /* Same key, same table, whichever way it was filled. */
+  btc_addrman_t *man1 = btc_addrman_create(btc_mainnet);
+  btc_addrman_t *man2 = btc_addrman_create(btc_mainnet);
+  size_t size = btc_addrman_size(man1);
+  uint8_t *raw1 = malloc(size);
+  uint8_t *raw2;
+  btc_vector_t batch;
+  size_t i, j, total;
+
+  ASSERT(raw1 != NULL);
+  ASSERT(btc_addrman_export(raw1, man1) == size);
+  ASSERT(btc_addrman_import(man2, raw1, size));
+
+  free(raw1);
+
+  btc_vector_init(&batch);
+
+  total = 0;
+
+  for (j = 0; j < lengthof(srcs); j++) {
+    btc_vector_reset(&batch);
+
+    for (i = j; i < NUM_ADDRS; i += lengthof(srcs)) {
+      total += btc_addrman_add(man1, &addrs[i], &srcs[j]);
+      btc_vector_push(&batch, &addrs[i]);
+    }
+
+    ASSERT(btc_addrman_add_many(man2, &batch, &srcs[j]) > 0);
+  }
+
+  ASSERT(btc_addrman_total(man2) == total);
+
+  size = btc_addrman_size(man1);
+
+  ASSERT(btc_addrman_size(man2) == size);
+
+  raw1 = malloc(size);
+  raw2 = malloc(size);
+
+  ASSERT(raw1 != NULL && raw2 != NULL);
+  ASSERT(btc_addrman_export(raw1, man1) == size);
+  ASSERT(btc_addrman_export(raw2, man2) == size);
+  ASSERT(memcmp(raw1, raw2, size) == 0);
+
+  btc_vector_clear(&batch);
+  btc_addrman_destroy(man1);
+  btc_addrman_destroy(man2);
+
+  free(raw1);
+  free(raw2);
+}
+
+int
+main(void) {
+  btc_addrman_t *man = btc_addrman_create(btc_mainnet);
+  size_t i, total, used;
+
+  init_addrs();
+
+  ASSERT(btc_addrman_get(man) == NULL);
+
+  /* Fill the fresh table. Some slots collide. */
+  total = 0;
+
+  for (i = 0; i < NUM_ADDRS; i++)
+    total += btc_addrman_add(man, &addrs[i], &srcs[i % lengthof(srcs)]);
+
+  ASSERT(total > NUM_ADDRS / 2);
+  ASSERT(btc_addrman_total(man) == total);
+  ASSERT(count_used(man) == 0);
+
+  for (i = 0; i < NUM_ADDRS; i++)
+    ASSERT(!btc_addrman_add(man, &addrs[i], &srcs[i % lengthof(srcs)]));
+
+  ASSERT(btc_addrman_total(man) == total);
+
+  for (i = 0; i < 100; i++) {
+    const btc_addrent_t *entry = btc_addrman_get(man);
+
+    ASSERT(entry != NULL);
+    ASSERT(!entry->used);
+  }
+
+  check_roundtrip(man);
+
+  /* Promote some to the used table. An occupied
+     used slot sends its old entry back to fresh. */
+  for (i = 0; i < NUM_ADDRS; i += 4)
+    btc_addrman_mark_ack(man, &addrs[i], 0);
+
+  used = count_used(man);
+
+  ASSERT(used > 0 && used <= NUM_ADDRS / 4);
+  ASSERT(btc_addrman_total(man) <= total);
+
+  for (i = 0; i < 100; i++)
+    ASSERT(btc_addrman_get(man) != NULL);
+
+  check_roundtrip(man);
+
+  /* Empty it out again. */
+  for (i = 0; i < NUM_ADDRS; i++)
+    btc_addrman_remove(man, &addrs[i]);
+
+  ASSERT(btc_addrman_total(man) == 0);
+  ASSERT(btc_addrman_get(man) == NULL);
+  ASSERT(btc_addrman_size(man) == 4 + 4 + 32 + 1 + 1024 + 64);
+
+  btc_addrman_destroy(man);
+
+  check_batch();
+
   return 0;
 }
@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-base16.c - base16 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,127 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/encoding.h>
 #include "lib/tests.h"
 
-int main(void) {
+static const char *charset = "0123456789abcdef";
+
+static void
+test_base16_vectors(void) {
+  static const uint8_t data[4] = {0x00, 0x1f, 0xa0, 0xff};
+  uint8_t out[4];
+  char str[9];
+
+  btc_base16_encode(str, data, 4);
+
+  ASSERT(strcmp(str, "001fa0ff") == 0);
+
+  btc_base16le_encode(str, data, 4);
+
+  ASSERT(strcmp(str, "ffa01f00") == 0);
+
+  ASSERT(btc_base16_decode(out, "001FA0fF", 8));
+  ASSERT(memcmp(out, data, 4) == 0);
+
+  ASSERT(btc_base16le_decode(out, "fFa01F00", 8));
+  ASSERT(memcmp(out, data, 4) == 0);
+
+  ASSERT(!btc_base16_decode(out, "001fa0f", 7));
+  ASSERT(!btc_base16le_decode(out, "001fa0f", 7));
+
+  ASSERT(btc_base16_test("001FA0fF"));
+  ASSERT(!btc_base16_test("001fa0f"));
+  ASSERT(!btc_base16_test("001fa0fg"));
+}
+
+static void
+test_base16_lengths(void) {
+  /* Long enough to cover every block size, plus tails. */
+  static uint8_t data[300], out[300];
+  static char expect[601], expect_le[601], str[601];
+  size_t i, j, len;
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = (uint8_t)(i * 97 + 13);
+
+  for (len = 0; len <= sizeof(data); len++) {
+    for (i = 0; i < len; i++) {
+      expect[i * 2 + 0] = charset[data[i] >> 4];
+      expect[i * 2 + 1] = charset[data[i] & 15];
+
+      j = len - 1 - i;
+
+      expect_le[j * 2 + 0] = charset[data[i] >> 4];
+      expect_le[j * 2 + 1] = charset[data[i] & 15];
+    }
+
+    expect[len * 2] = '\0';
+    expect_le[len * 2] = '\0';
+
+    btc_base16_encode(str, data, len);
+
+    ASSERT(strcmp(str, expect) == 0);
+
+    memset(out, 0, sizeof(out));
+
+    ASSERT(btc_base16_decode(out, str, len * 2));
+    ASSERT(memcmp(out, data, len) == 0);
+
+    btc_base16le_encode(str, data, len);
+
+    ASSERT(strcmp(str, expect_le) == 0);
+
+    memset(out, 0, sizeof(out));
+
+    ASSERT(btc_base16le_decode(out, str, len * 2));
+    ASSERT(memcmp(out, data, len) == 0);
+  }
+}
+
+static void
+test_base16_invalid(void) {
+  /* Characters adjacent to each valid range, and
+     ones with the high bit set. */
+  static const char bad[] = {'/', ':', '@', 'G', '`', 'g', ' ',
+                             (char)0x80, (char)0xb0, (char)0xc1,
+                             (char)0xe6, (char)0xff};
+  static const uint8_t all[16] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab,
+                                  0xcd, 0xef, 0x01, 0x23, 0x45, 0x67,
+                                  0x89, 0xab, 0xcd, 0xef};
+  uint8_t out[100];
+  char str[201];
+  size_t i, j;
+
+  for (i = 0; i < 200; i++)
+    str[i] = "0123456789abcdefABCDEF"[i % 22];
+
+  str[200] = '\0';
+
+  ASSERT(btc_base16_decode(out, str, 200));
+  ASSERT(btc_base16le_decode(out, str, 200));
+
+  for (i = 0; i < 200; i++) {
+    for (j = 0; j < sizeof(bad); j++) {
+      char ch = str[i];
+
+      str[i] = bad[j];
+
+      ASSERT(!btc_base16_decode(out, str, 200));
+      ASSERT(!btc_base16le_decode(out, str, 200));
+
+      str[i] = ch;
+    }
+  }
+
+  btc_base16_encode(str, all, 16);
+
+  ASSERT(strcmp(str, "0123456789abcdef0123456789abcdef") == 0);
+}
+
+int
+main(void) {
+  test_base16_vectors();
+  test_base16_lengths();
+  test_base16_invalid();
   return 0;
 }
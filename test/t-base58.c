@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-base58.c - base58 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,136 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/drbg.h>
+#include <mako/encoding.h>
 #include "lib/tests.h"
 
-int main(void) {
+/* From bitcoin core's base58_encode_decode.json. */
+static const char *base58_vectors[][2] = {
+  {"", ""},
+  {"61", "2g"},
+  {"626262", "a3gV"},
+  {"636363", "aPEr"},
+  {"73696d706c792061206c6f6e6720737472696e67",
+   "2cFupjhnEsSn59qHXstmK2ffpLv2"},
+  {"00eb15231dfceb60925886b67d065299925915aeb172c06647",
+   "1NS17iag9jJgTHD1VXjvLCEnZuQ3rJDE9L"},
+  {"516b6fcd0f", "ABnLTmg"},
+  {"bf4f89001e670274dd", "3SEo3LWLoPntC"},
+  {"572e4794", "3EFU7m"},
+  {"ecac89cad93923c02321", "EJDM8drfXA6uyA"},
+  {"10c8511e", "Rt5zm"},
+  {"00000000000000000000", "1111111111"},
+  {"000111d38e5fc9071ffcd20b4a763cc9ae4f252bb4e48fd66a835e252ada93ff"
+   "480d6dd43dc62a641155a5",
+   "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz"}
+};
+
+static void
+test_base58_vectors(void) {
+  uint8_t data[64], out[64];
+  size_t i, len, out_len;
+  char str[128];
+
+  for (i = 0; i < lengthof(base58_vectors); i++) {
+    const char *hex = base58_vectors[i][0];
+    const char *expect = base58_vectors[i][1];
+
+    len = sizeof(data);
+
+    hex_decode(data, &len, hex);
+
+    btc_base58_encode(str, data, len);
+
+    ASSERT(strcmp(str, expect) == 0);
+
+    ASSERT(btc_base58_decode(out, &out_len, expect, strlen(expect)));
+    ASSERT(out_len == len);
+    ASSERT(memcmp(out, data, len) == 0);
+  }
+
+  ASSERT(!btc_base58_decode(out, &out_len, "3SEo3LWLoPn0C", 13));
+  ASSERT(!btc_base58_decode(out, &out_len, "3SEo3LWLoPntC ", 14));
+  ASSERT(!btc_base58_decode(out, &out_len, "l", 1));
+}
+
+static size_t
+base58_naive_encode(char *zp, const uint8_t *xp, size_t xn) {
+  static const char *charset =
+    "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+  uint8_t b58[1024];
+  size_t i, j, size = 0;
+  int carry;
+
+  /* Digit at a time, least significant first. */
+  for (i = 0; i < xn; i++) {
+    carry = xp[i];
+
+    for (j = 0; j < size; j++) {
+      carry += (int)b58[j] << 8;
+      b58[j] = carry % 58;
+      carry /= 58;
+    }
+
+    while (carry > 0) {
+      b58[size++] = carry % 58;
+      carry /= 58;
+    }
+  }
+
+  for (i = 0; i < xn && xp[i] == 0; i++)
+    *zp++ = '1';
+
+  for (j = size; j-- > 0;)
+    *zp++ = charset[b58[j]];
+
+  *zp = '\0';
+
+  return i + size;
+}
+
+static void
+test_base58_random(void) {
+  static const uint8_t seed[32] = {0x62, 0x35, 0x38};
+  uint8_t data[512], out[512];
+  char expect[1024], str[1024];
+  size_t i, j, len, out_len;
+  btc_drbg_t rng;
+
+  btc_drbg_init(&rng, seed, sizeof(seed));
+
+  for (i = 0; i < 2000; i++) {
+    uint8_t r[3];
+
+    btc_drbg_generate(&rng, r, 3);
+
+    len = i < 600 ? i % 100 : ((size_t)r[0] << 8 | r[1]) % 513;
+
+    btc_drbg_generate(&rng, data, len);
+
+    /* Runs of leading zeroes. */
+    for (j = 0; j < len && j < (size_t)(r[2] & 7); j++)
+      data[j] = 0;
+
+    /* All 0xff, the longest output for its size. */
+    if (i % 97 == 0)
+      memset(data, 0xff, len);
+
+    ASSERT(base58_naive_encode(expect, data, len) == strlen(expect));
+
+    btc_base58_encode(str, data, len);
+
+    ASSERT(strcmp(str, expect) == 0);
+
+    ASSERT(btc_base58_decode(out, &out_len, str, strlen(str)));
+    ASSERT(out_len == len);
+    ASSERT(memcmp(out, data, len) == 0);
+  }
+}
+
+int
+main(void) {
+  test_base58_vectors();
+  test_base58_random();
   return 0;
 }
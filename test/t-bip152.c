@@ -1,14 +1,121 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-bip152.c - bip152 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/bip152.h>
+#include <mako/block.h>
+#include <mako/crypto/siphash.h>
+#include <mako/tx.h>
 #include "lib/tests.h"
 
+static btc_tx_t *
+create_tx(uint32_t seed) {
+  btc_tx_t *tx = btc_tx_create();
+  btc_output_t *output;
+  btc_input_t *input;
+
+  input = btc_input_create();
+  input->prevout.index = seed;
+
+  btc_inpvec_push(&tx->inputs, input);
+
+  output = btc_output_create();
+  output->value = (int64_t)seed * 1000;
+
+  btc_outvec_push(&tx->outputs, output);
+
+  btc_tx_refresh(tx);
+
+  return tx;
+}
+
+static void
+test_siphash_batch(void) {
+  static const uint8_t key[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+  };
+  uint8_t data[32 * 5];
+  uint64_t out[5];
+  size_t i;
+
+  printf("siphash batch\n");
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i * 7;
+
+  btc_siphash_batch(out, data, 5, key);
+
+  for (i = 0; i < 5; i++)
+    ASSERT(out[i] == btc_siphash_sum(data + i * 32, 32, key));
+}
+
+static void
+test_cmpct_fill(void) {
+  btc_block_t *block = btc_block_create();
+  btc_mpentry_t entries[300];
+  const btc_mpentry_t *ptrs[300];
+  btc_cmpct_t *cmpct;
+  uint8_t *hashes;
+  size_t i;
+
+  printf("cmpct fill\n");
+
+  /* Coinbase plus more txs than one batch. */
+  for (i = 0; i <= lengthof(entries); i++)
+    btc_txvec_push(&block->txs, create_tx(i + 1));
+
+  hashes = malloc(lengthof(entries) * 32);
+
+  ASSERT(hashes != NULL);
+
+  /* A mempool in a different order to the block. */
+  for (i = 0; i < lengthof(entries); i++) {
+    btc_tx_t *tx = block->txs.items[lengthof(entries) - i];
+
+    memset(&entries[i], 0, sizeof(entries[i]));
+
+    entries[i].tx = tx;
+    entries[i].hash = tx->hash;
+    entries[i].whash = tx->whash;
+
+    memcpy(hashes + i * 32, tx->whash, 32);
+
+    ptrs[i] = &entries[i];
+  }
+
+  cmpct = btc_cmpct_create();
+
+  btc_cmpct_set_block(cmpct, block, 1);
+
+  ASSERT(btc_cmpct_setup(cmpct) == 1);
+
+  /* Missing the last tx. */
+  ASSERT(!btc_cmpct_fill_wtxids(cmpct, hashes + 32, ptrs + 1,
+                                lengthof(entries) - 1));
+
+  ASSERT(btc_cmpct_fill_wtxids(cmpct, hashes, ptrs, lengthof(entries)));
+
+  for (i = 0; i < block->txs.length; i++) {
+    const btc_tx_t *tx = cmpct->avail.items[i];
+
+    ASSERT(tx != NULL);
+    ASSERT(memcmp(tx->whash, block->txs.items[i]->whash, 32) == 0);
+  }
+
+  btc_cmpct_destroy(cmpct);
+  btc_block_destroy(block);
+  free(hashes);
+}
+
 int main(void) {
+  test_siphash_batch();
+  test_cmpct_fill();
   return 0;
 }
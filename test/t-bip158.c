@@ -0,0 +1,232 @@
+/*!
+ * t-bip158.c - bip158 test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/bip158.h>
+#include <mako/block.h>
+#include <mako/buffer.h>
+#include <mako/coins.h>
+#include <mako/crypto/hash.h>
+#include <mako/header.h>
+#include <mako/netmsg.h>
+#include <mako/network.h>
+#include <mako/tx.h>
+#include "lib/tests.h"
+
+static void
+test_genesis(const btc_network_t *network,
+             const char *filter_hex,
+             const char *header_hex) {
+  uint8_t expect[64];
+  uint8_t prev[32];
+  uint8_t hash[32];
+  uint8_t header[32];
+  btc_buffer_t filter;
+  btc_block_t *block;
+  size_t len = sizeof(expect);
+  int i;
+
+  printf("genesis filter (%s)\n", network->name);
+
+  block = btc_block_decode(network->genesis.data, network->genesis.length);
+
+  ASSERT(block != NULL);
+
+  btc_buffer_init(&filter);
+  btc_gcs_build(&filter, block, NULL);
+
+  hex_decode(expect, &len, filter_hex);
+
+  ASSERT(filter.length == len);
+  ASSERT(memcmp(filter.data, expect, len) == 0);
+
+  if (header_hex != NULL) {
+    hex_parse(expect, 32, header_hex);
+
+    memset(prev, 0, 32);
+
+    btc_hash256(hash, filter.data, filter.length);
+    btc_gcs_header(header, hash, prev);
+
+    for (i = 0; i < 32; i++)
+      ASSERT(header[i] == expect[31 - i]);
+  }
+
+  btc_buffer_clear(&filter);
+  btc_block_destroy(block);
+}
+
+static void
+test_match(void) {
+  uint8_t hash[32];
+  uint8_t item[22];
+  btc_buffer_t filter;
+  btc_block_t *block;
+  btc_undo_t *undo;
+  btc_tx_t *tx;
+  size_t i;
+
+  printf("match\n");
+
+  block = btc_block_create();
+  block->header.time = 1231006505;
+
+  tx = btc_tx_create();
+
+  for (i = 0; i < 50; i++) {
+    btc_output_t *output = btc_output_create();
+
+    memset(item, 0, sizeof(item));
+
+    item[0] = 0x00;
+    item[1] = 0x14;
+    item[2] = i;
+
+    btc_buffer_set(&output->script, item, sizeof(item));
+    btc_outvec_push(&tx->outputs, output);
+  }
+
+  /* Duplicates, OP_RETURN and empty scripts. */
+  btc_outvec_push(&tx->outputs, btc_output_clone(tx->outputs.items[0]));
+
+  {
+    btc_output_t *output = btc_output_create();
+
+    btc_buffer_set(&output->script, (const uint8_t *)"\x6a\x01\x01", 3);
+    btc_outvec_push(&tx->outputs, output);
+    btc_outvec_push(&tx->outputs, btc_output_create());
+  }
+
+  btc_tx_refresh(tx);
+  btc_txvec_push(&block->txs, tx);
+
+  undo = btc_undo_create();
+
+  for (i = 0; i < 20; i++) {
+    btc_coin_t *coin = btc_coin_create();
+
+    memset(item, 0xff, sizeof(item));
+
+    item[2] = i;
+
+    btc_buffer_set(&coin->output.script, item, sizeof(item));
+    btc_undo_push(undo, coin);
+  }
+
+  btc_buffer_init(&filter);
+  btc_gcs_build(&filter, block, undo);
+
+  btc_header_hash(hash, &block->header);
+
+  /* 50 outputs and 20 spent scripts. */
+  ASSERT(filter.length > 0 && filter.data[0] == 70);
+
+  for (i = 0; i < 50; i++) {
+    memset(item, 0, sizeof(item));
+
+    item[0] = 0x00;
+    item[1] = 0x14;
+    item[2] = i;
+
+    ASSERT(btc_gcs_match(filter.data, filter.length, hash, item, 22));
+  }
+
+  for (i = 0; i < 20; i++) {
+    memset(item, 0xff, sizeof(item));
+
+    item[2] = i;
+
+    ASSERT(btc_gcs_match(filter.data, filter.length, hash, item, 22));
+  }
+
+  ASSERT(!btc_gcs_match(filter.data, filter.length, hash,
+                        (const uint8_t *)"\x6a\x01\x01", 3));
+
+  ASSERT(!btc_gcs_match(filter.data, filter.length, hash,
+                        (const uint8_t *)"nothing", 7));
+
+  /* Truncated filters never match. */
+  ASSERT(!btc_gcs_match(filter.data, 1, hash, item, 22));
+
+  btc_buffer_clear(&filter);
+  btc_undo_destroy(undo);
+  btc_block_destroy(block);
+}
+
+static void
+test_messages(void) {
+  btc_cfheaders_t *hdrs = btc_cfheaders_create();
+  btc_cfheaders_t *copy;
+  btc_msg_t msg;
+  uint8_t *raw;
+  size_t len;
+
+  printf("messages\n");
+
+  hdrs->filter_type = BTC_GCS_BASIC;
+  hdrs->stop_hash[0] = 1;
+  hdrs->prev_header[0] = 2;
+
+  btc_cfheaders_resize(hdrs, 3);
+
+  memset(hdrs->hashes, 0xaa, 3 * 32);
+
+  btc_msg_init(&msg);
+  btc_msg_set_cmd(&msg, "cfheaders");
+
+  ASSERT(msg.type == BTC_MSG_CFHEADERS);
+
+  msg.body = hdrs;
+
+  len = btc_msg_size(&msg);
+  raw = malloc(len);
+
+  ASSERT(len == 65 + 1 + 3 * 32);
+  ASSERT(btc_msg_write(raw, &msg) == raw + len);
+
+  copy = btc_cfheaders_decode(raw, len);
+
+  ASSERT(copy != NULL);
+  ASSERT(copy->length == 3);
+  ASSERT(copy->stop_hash[0] == 1);
+  ASSERT(copy->prev_header[0] == 2);
+  ASSERT(memcmp(copy->hashes, hdrs->hashes, 3 * 32) == 0);
+
+  /* Truncated hashes. */
+  ASSERT(btc_cfheaders_decode(raw, len - 1) == NULL);
+
+  btc_msg_set_cmd(&msg, "getcfilters");
+  ASSERT(msg.type == BTC_MSG_GETCFILTERS);
+
+  btc_msg_set_cmd(&msg, "getcfcheckpt");
+  ASSERT(msg.type == BTC_MSG_GETCFCHECKPT);
+
+  btc_msg_set_cmd(&msg, "cfilter");
+  ASSERT(msg.type == BTC_MSG_CFILTER);
+
+  btc_msg_set_cmd(&msg, "cmpctblock");
+  ASSERT(msg.type == BTC_MSG_CMPCTBLOCK);
+
+  btc_msg_set_cmd(&msg, "getdata");
+  ASSERT(msg.type == BTC_MSG_GETDATA);
+
+  btc_cfheaders_destroy(copy);
+  btc_cfheaders_destroy(hdrs);
+  free(raw);
+}
+
+int
+main(void) {
+  test_genesis(btc_mainnet, "017fa880", NULL);
+  test_genesis(btc_testnet, "019dfca8",
+    "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750");
+  test_match();
+  test_messages();
+  return 0;
+}
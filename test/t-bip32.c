@@ -91,6 +91,38 @@ test_bip44(void) {
   ASSERT(btc_hdpub_equal(&pub, &prv));
 }
 
+static void
+test_derive_range(void) {
+  static btc_hdnode_t children[70];
+  btc_hdnode_t master, account, child;
+  size_t i;
+
+  btc_hdpriv_generate(&master, BTC_BIP32_STANDARD);
+
+  ASSERT(btc_hdpriv_account(&account, &master, 44, 0, 0));
+
+  /* Spans more than one chunk. */
+  ASSERT(btc_hdpub_derive_range(children, &account, 1000, 70));
+
+  for (i = 0; i < 70; i++) {
+    ASSERT(btc_hdpub_derive(&child, &account, 1000 + i));
+    ASSERT(btc_hdpub_equal(&children[i], &child));
+    ASSERT(children[i].type == child.type);
+  }
+
+  /* The parent may be overwritten. */
+  children[0] = account;
+
+  ASSERT(btc_hdpub_derive_range(children, &children[0], 1000, 2));
+  ASSERT(btc_hdpub_derive(&child, &account, 1001));
+  ASSERT(btc_hdpub_equal(&children[1], &child));
+
+  ASSERT(btc_hdpub_derive_range(children, &account, 0, 0));
+  ASSERT(!btc_hdpub_derive_range(children, &account, BTC_BIP32_HARDEN, 1));
+  ASSERT(!btc_hdpub_derive_range(children, &account,
+                                 BTC_BIP32_HARDEN - 1, 2));
+}
+
 /*
  * Main
  */
@@ -99,5 +131,6 @@ int main(void) {
   test_vectors();
   test_derive();
   test_bip44();
+  test_derive_range();
   return 0;
 }
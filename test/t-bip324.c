@@ -0,0 +1,360 @@
+/*!
+ * t-bip324.c - v2 transport test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/bip324.h>
+#include <mako/crypto/ecc.h>
+#include <mako/crypto/mac.h>
+#include "lib/tests.h"
+
+#include "data/bip324_vectors.h"
+
+static void
+test_poly1305_vector(void) {
+  /* RFC 8439, section 2.5.2. */
+  static const char *key_hex =
+    "85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b";
+  static const char *expect_hex = "a8061dc1305136c6c22b8baf0c0127a9";
+  static const char *msg = "Cryptographic Forum Research Group";
+  uint8_t key[32], expect[16], mac[16];
+  btc_poly1305_t ctx;
+  size_t i, len = strlen(msg);
+
+  hex_parse(key, 32, key_hex);
+  hex_parse(expect, 16, expect_hex);
+
+  btc_poly1305_init(&ctx, key);
+  btc_poly1305_update(&ctx, (const uint8_t *)msg, len);
+  btc_poly1305_final(&ctx, mac);
+
+  ASSERT(memcmp(mac, expect, 16) == 0);
+
+  /* Byte at a time. */
+  btc_poly1305_init(&ctx, key);
+
+  for (i = 0; i < len; i++)
+    btc_poly1305_update(&ctx, (const uint8_t *)msg + i, 1);
+
+  btc_poly1305_final(&ctx, mac);
+
+  ASSERT(memcmp(mac, expect, 16) == 0);
+}
+
+static void
+test_aead_vector(void) {
+  /* RFC 8439, section 2.8.2. */
+  static const char *key_hex =
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f";
+  static const char *nonce_hex = "070000004041424344454647";
+  static const char *aad_hex = "50515253c0c1c2c3c4c5c6c7";
+  static const char *head_hex = "d31a8d34648e60db7b86afbc53ef7ec2";
+  static const char *tag_hex = "1ae10b594f09e26a7e902ecbd0600691";
+  static const char *msg = "Ladies and Gentlemen of the class of '99: "
+                           "If I could offer you only one tip for the "
+                           "future, sunscreen would be it.";
+  uint8_t key[32], nonce[12], aad[12], head[16], expect[16];
+  uint8_t out[128], tag[16];
+  size_t len = strlen(msg);
+  btc_aead_t ctx;
+
+  hex_parse(key, 32, key_hex);
+  hex_parse(nonce, 12, nonce_hex);
+  hex_parse(aad, 12, aad_hex);
+  hex_parse(head, 16, head_hex);
+  hex_parse(expect, 16, tag_hex);
+
+  btc_aead_init(&ctx, key, nonce);
+  btc_aead_aad(&ctx, aad, 12);
+  btc_aead_encrypt(&ctx, out, (const uint8_t *)msg, len);
+  btc_aead_final(&ctx, tag);
+
+  ASSERT(memcmp(out, head, 16) == 0);
+  ASSERT(btc_aead_verify(tag, expect));
+
+  btc_aead_init(&ctx, key, nonce);
+  btc_aead_aad(&ctx, aad, 12);
+  btc_aead_decrypt(&ctx, out, out, len);
+  btc_aead_final(&ctx, tag);
+
+  ASSERT(memcmp(out, msg, len) == 0);
+  ASSERT(btc_aead_verify(tag, expect));
+}
+
+static void
+test_ellswift(void) {
+  /* u = 0 and t = 0 both map to 1. */
+  static const char *expect_hex =
+    "edd1fd3e327ce90cc7a3542614289aee9682003e9cf7dcc9cf2ca9743be5aa0c";
+  uint8_t one[32], zero[64], expect[32], x[32];
+  uint8_t a[32], b[32], ea[64], eb[64], pub[33], sa[32], sb[32], sc[33];
+  int i;
+
+  memset(one, 0, 32);
+  memset(zero, 0, 64);
+
+  one[31] = 1;
+
+  hex_parse(expect, 32, expect_hex);
+
+  ASSERT(btc_ellswift_derive(x, zero, one));
+  ASSERT(memcmp(x, expect, 32) == 0);
+
+  /* Any 64 bytes decode to some point. */
+  memset(zero, 0xff, 64);
+
+  ASSERT(btc_ellswift_derive(x, zero, one));
+
+  for (i = 0; i < 16; i++) {
+    memset(a, i + 1, 32);
+    memset(b, i + 101, 32);
+    memset(ea, i, 32);
+    memset(eb, i + 7, 32);
+
+    ASSERT(btc_ellswift_create(ea, a, ea));
+    ASSERT(btc_ellswift_create(eb, b, eb));
+
+    ASSERT(btc_ellswift_derive(sa, eb, a));
+    ASSERT(btc_ellswift_derive(sb, ea, b));
+
+    ASSERT(memcmp(sa, sb, 32) == 0);
+
+    /* Same as plain ECDH. */
+    ASSERT(btc_ecdsa_pubkey_create(pub, a, 1));
+    ASSERT(btc_ecdsa_derive(sc, pub, 33, b, 1));
+
+    ASSERT(memcmp(sa, sc + 1, 32) == 0);
+  }
+}
+
+static void
+test_ellswift_decode(void) {
+  uint8_t one[32], ell[64], expect[32], x[32];
+  size_t i;
+
+  memset(one, 0, 32);
+
+  one[31] = 1;
+
+  for (i = 0; i < lengthof(ellswift_decode_vectors); i++) {
+    const ellswift_decode_vector_t *vec = &ellswift_decode_vectors[i];
+
+    hex_parse(ell, 64, vec->ellswift);
+    hex_parse(expect, 32, vec->x);
+
+    /* The shared x with a key of one is the decoded x. */
+    ASSERT(btc_ellswift_derive(x, ell, one));
+    ASSERT(memcmp(x, expect, 32) == 0);
+  }
+}
+
+static void
+test_ellswift_inv(void) {
+  uint8_t one[32], u[32], x[32], t[32], expect[32], ell[64], y[32];
+  unsigned int hint;
+  size_t i;
+
+  memset(one, 0, 32);
+
+  one[31] = 1;
+
+  for (i = 0; i < lengthof(ellswift_inv_vectors); i++) {
+    const ellswift_inv_vector_t *vec = &ellswift_inv_vectors[i];
+
+    hex_parse(u, 32, vec->u);
+    hex_parse(x, 32, vec->x);
+
+    for (hint = 0; hint < 8; hint++) {
+      if (vec->t[hint] == NULL) {
+        ASSERT(!btc_ellswift_invert(t, x, u, hint));
+        continue;
+      }
+
+      hex_parse(expect, 32, vec->t[hint]);
+
+      ASSERT(btc_ellswift_invert(t, x, u, hint));
+      ASSERT(memcmp(t, expect, 32) == 0);
+
+      /* And back again. */
+      memcpy(ell + 0, u, 32);
+      memcpy(ell + 32, t, 32);
+
+      ASSERT(btc_ellswift_derive(y, ell, one));
+      ASSERT(memcmp(y, x, 32) == 0);
+    }
+  }
+}
+
+static void
+test_bip324_packet_vectors(void) {
+  static uint8_t packet[BTC_BIP324_EXPANSION + 16384];
+  uint8_t entropy[64], theirs[64], contents[64], aad[128];
+  uint8_t expect[BTC_BIP324_EXPANSION + 64];
+  size_t i, j, len, contents_len, aad_len, expect_len;
+  btc_bip324_t ctx;
+
+  memset(entropy, 0, 64);
+
+  for (i = 0; i < lengthof(bip324_packet_vectors); i++) {
+    const bip324_packet_vector_t *vec = &bip324_packet_vectors[i];
+
+    btc_bip324_init(&ctx, 0xd9b4bef9, vec->initiating, entropy);
+
+    hex_parse(ctx.priv, 32, vec->priv_ours);
+    hex_parse(ctx.ours, 64, vec->ellswift_ours);
+    hex_parse(theirs, 64, vec->ellswift_theirs);
+
+    ASSERT(btc_bip324_derive(&ctx, theirs));
+
+    hex_parse(expect, 16, vec->send_garbage_terminator);
+    ASSERT(memcmp(ctx.send_term, expect, 16) == 0);
+
+    hex_parse(expect, 16, vec->recv_garbage_terminator);
+    ASSERT(memcmp(ctx.recv_term, expect, 16) == 0);
+
+    hex_parse(expect, 32, vec->session_id);
+    ASSERT(memcmp(ctx.session_id, expect, 32) == 0);
+
+    /* Seek to the numbered packet. */
+    for (j = 0; j < vec->idx; j++)
+      btc_bip324_seal(&ctx, packet, 0, NULL, 0, 0);
+
+    contents_len = sizeof(contents);
+    aad_len = sizeof(aad);
+
+    hex_decode(contents, &contents_len, vec->contents);
+    hex_decode(aad, &aad_len, vec->aad);
+
+    len = contents_len * vec->multiply;
+
+    ASSERT(len <= sizeof(packet) - BTC_BIP324_EXPANSION);
+
+    for (j = 0; j < vec->multiply; j++)
+      memcpy(packet + 4 + j * contents_len, contents, contents_len);
+
+    ASSERT(btc_bip324_seal(&ctx, packet, len,
+                           aad, aad_len, vec->ignore) == len + 20);
+
+    if (*vec->ciphertext) {
+      expect_len = sizeof(expect);
+
+      hex_decode(expect, &expect_len, vec->ciphertext);
+
+      ASSERT(expect_len == len + 20);
+      ASSERT(memcmp(packet, expect, expect_len) == 0);
+    } else {
+      expect_len = sizeof(expect);
+
+      hex_decode(expect, &expect_len, vec->ciphertext_endswith);
+
+      ASSERT(expect_len <= len + 20);
+      ASSERT(memcmp(packet + len + 20 - expect_len, expect, expect_len) == 0);
+    }
+  }
+}
+
+static void
+test_bip324_types(void) {
+  static const char *cmds[] = {"addr", "tx", "addrv2", "version", "wtxidrelay"};
+  uint8_t raw[13];
+  const uint8_t *xp;
+  char cmd[13];
+  size_t i, xn;
+
+  for (i = 0; i < lengthof(cmds); i++) {
+    size_t size = btc_bip324_type_size(cmds[i]);
+
+    ASSERT(btc_bip324_type_write(raw, cmds[i]) == raw + size);
+
+    xp = raw;
+    xn = size;
+
+    ASSERT(btc_bip324_type_read(cmd, &xp, &xn));
+    ASSERT(strcmp(cmd, cmds[i]) == 0);
+    ASSERT(xn == 0);
+  }
+
+  ASSERT(btc_bip324_type_size("tx") == 1);
+  ASSERT(btc_bip324_type_size("version") == 13);
+
+  /* Unassigned short ids. */
+  raw[0] = 200;
+  xp = raw;
+  xn = 1;
+
+  ASSERT(!btc_bip324_type_read(cmd, &xp, &xn));
+}
+
+static void
+test_bip324_session(void) {
+  static uint8_t packet[BTC_BIP324_EXPANSION + 1000];
+  static const uint8_t garbage[5] = {1, 2, 3, 4, 5};
+  uint8_t entropy[64];
+  btc_bip324_t a, b;
+  size_t i, len, size;
+
+  memset(entropy, 0x11, 64);
+  btc_bip324_init(&a, 0xd9b4bef9, 1, entropy);
+
+  memset(entropy, 0x22, 64);
+  btc_bip324_init(&b, 0xd9b4bef9, 0, entropy);
+
+  ASSERT(btc_bip324_derive(&a, b.ours));
+  ASSERT(btc_bip324_derive(&b, a.ours));
+
+  ASSERT(memcmp(a.session_id, b.session_id, 32) == 0);
+  ASSERT(memcmp(a.send_term, b.recv_term, 16) == 0);
+  ASSERT(memcmp(a.recv_term, b.send_term, 16) == 0);
+  ASSERT(memcmp(a.send_term, a.recv_term, 16) != 0);
+
+  /* Enough packets to rekey both ciphers twice. */
+  for (i = 0; i < 500; i++) {
+    const uint8_t *aad = i == 0 ? garbage : NULL;
+    size_t aad_len = i == 0 ? sizeof(garbage) : 0;
+
+    len = i % 1000;
+
+    memset(packet + 4, i & 0xff, len);
+
+    size = btc_bip324_seal(&a, packet, len, aad, aad_len, i & 1);
+
+    ASSERT(size == BTC_BIP324_EXPANSION + len);
+    ASSERT(btc_bip324_length(&b, packet) == len);
+
+    ASSERT(btc_bip324_open(&b, packet + 3, packet + 3, len, aad, aad_len));
+
+    ASSERT(packet[3] == ((i & 1) ? BTC_BIP324_IGNORE : 0));
+
+    if (len > 0) {
+      ASSERT(packet[4] == (i & 0xff));
+      ASSERT(packet[3 + len] == (i & 0xff));
+    }
+  }
+
+  /* Tampering is caught. */
+  memset(packet + 4, 0, 10);
+
+  size = btc_bip324_seal(&b, packet, 10, NULL, 0, 0);
+
+  packet[size - 1] ^= 1;
+
+  ASSERT(btc_bip324_length(&a, packet) == 10);
+  ASSERT(!btc_bip324_open(&a, packet + 3, packet + 3, 10, NULL, 0));
+}
+
+int
+main(void) {
+  test_poly1305_vector();
+  test_aead_vector();
+  test_ellswift();
+  test_ellswift_decode();
+  test_ellswift_inv();
+  test_bip324_types();
+  test_bip324_session();
+  test_bip324_packet_vectors();
+  return 0;
+}
@@ -1,14 +1,138 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-bip37.c - bip37 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/bip37.h>
+#include <mako/block.h>
+#include <mako/header.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include <mako/vector.h>
 #include "lib/tests.h"
 
-int main(void) {
+static btc_block_t *
+make_block(size_t count) {
+  btc_block_t *block = btc_block_create();
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    btc_output_t *output = btc_output_create();
+    btc_tx_t *tx = btc_tx_create();
+
+    output->value = (int64_t)i;
+
+    btc_outvec_push(&tx->outputs, output);
+    btc_tx_refresh(tx);
+    btc_txvec_push(&block->txs, tx);
+  }
+
+  block->header.version = 1;
+  block->header.time = 1231006505;
+  block->header.bits = 0x207fffff;
+
+  ASSERT(btc_block_merkle_root(block->header.merkle_root, block));
+  ASSERT(btc_header_mine(&block->header, 0));
+
+  return block;
+}
+
+static void
+test_merkletree(void) {
+  size_t count;
+
+  printf("merkle tree\n");
+
+  for (count = 1; count <= 70; count++) {
+    btc_block_t *block = make_block(count);
+    btc_merkletree_t *tree = btc_merkletree_create(block);
+    size_t i;
+
+    ASSERT(tree->total == count);
+    ASSERT(memcmp(btc_merkletree_root(tree),
+                  block->header.merkle_root, 32) == 0);
+
+    for (i = 0; i < count; i++) {
+      ASSERT(memcmp(btc_merkletree_node(tree, 0, i),
+                    block->txs.items[i]->hash, 32) == 0);
+    }
+
+    btc_merkletree_destroy(tree);
+    btc_block_destroy(block);
+  }
+}
+
+static void
+test_merkleblock(void) {
+  static const size_t counts[] = { 1, 2, 3, 7, 8, 9, 33, 100 };
+  uint32_t state = 0x12345678;
+  size_t i, j, k, n;
+
+  printf("merkle block\n");
+
+  for (i = 0; i < lengthof(counts); i++) {
+    btc_block_t *block = make_block(counts[i]);
+    btc_merkletree_t *tree = btc_merkletree_create(block);
+
+    for (j = 0; j < 20; j++) {
+      btc_merkleblock_t mrkl, copy;
+      btc_vector_t hashes;
+      uint8_t *raw;
+      size_t len;
+
+      btc_vector_init(&hashes);
+
+      /* None, all, and random subsets. */
+      for (k = 0; k < counts[i]; k++) {
+        state = state * 1103515245 + 12345;
+
+        if (j == 1 || (j > 1 && ((state >> 16) % (j + 1)) == 0))
+          btc_vector_push(&hashes, block->txs.items[k]->hash);
+      }
+
+      btc_merkleblock_init(&mrkl);
+      btc_merkleblock_set_hashes(&mrkl, block, &hashes);
+
+      ASSERT(btc_merkleblock_verify(&mrkl));
+      ASSERT(mrkl.matches.length == hashes.length);
+
+      for (n = 0; n < hashes.length; n++)
+        ASSERT(memcmp(mrkl.matches.items[n], hashes.items[n], 32) == 0);
+
+      if (hashes.length == 0) {
+        const uint8_t *root = btc_merkletree_root(tree);
+
+        ASSERT(mrkl.hashes.length == 1);
+        ASSERT(memcmp(mrkl.hashes.items[0], root, 32) == 0);
+      }
+
+      /* Round trip. */
+      btc_merkleblock_encode(&raw, &len, &mrkl);
+      btc_merkleblock_init(&copy);
+
+      ASSERT(btc_merkleblock_import(&copy, raw, len));
+      ASSERT(btc_merkleblock_verify(&copy));
+      ASSERT(copy.matches.length == hashes.length);
+
+      btc_merkleblock_clear(&copy);
+      btc_merkleblock_clear(&mrkl);
+      btc_vector_clear(&hashes);
+      free(raw);
+    }
+
+    btc_merkletree_destroy(tree);
+    btc_block_destroy(block);
+  }
+}
+
+int
+main(void) {
+  test_merkletree();
+  test_merkleblock();
   return 0;
 }
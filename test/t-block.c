@@ -1,14 +1,172 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-block.c - block test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/block.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
 #include "lib/tests.h"
 
-int main(void) {
+static btc_tx_t *
+make_tx(int seed, int witness) {
+  btc_tx_t *tx = btc_tx_create();
+  uint8_t data[40];
+  int i;
+
+  memset(data, seed, sizeof(data));
+
+  for (i = 0; i < 3; i++) {
+    btc_input_t *input = btc_input_create();
+
+    btc_outpoint_set(&input->prevout, data, i);
+    btc_buffer_set(&input->script, data, 10 + i);
+
+    if (witness && i != 1) {
+      btc_stack_push_data(&input->witness, data, 33);
+      btc_stack_push_data(&input->witness, data, 1 + i);
+    }
+
+    btc_inpvec_push(&tx->inputs, input);
+  }
+
+  for (i = 0; i < 2; i++) {
+    btc_output_t *output = btc_output_create();
+
+    output->value = seed * 1000 + i;
+
+    btc_buffer_set(&output->script, data, 22 + i);
+    btc_outvec_push(&tx->outputs, output);
+  }
+
+  tx->locktime = seed;
+
+  btc_tx_refresh(tx);
+
+  return tx;
+}
+
+static btc_block_t *
+make_block(int witness) {
+  btc_block_t *block = btc_block_create();
+  int i;
+
+  for (i = 0; i < 5; i++)
+    btc_txvec_push(&block->txs, make_tx(i + 1, witness && (i & 1)));
+
+  block->header.version = 0x20000000;
+  block->header.time = 1231006505;
+  block->header.bits = 0x1d00ffff;
+  block->header.nonce = 7;
+
+  ASSERT(btc_block_merkle_root(block->header.merkle_root, block));
+
+  return block;
+}
+
+static void
+test_block_raw(int witness) {
+  btc_block_t *block = make_block(witness);
+  uint8_t *raw, *base, *out;
+  size_t i, len, base_len;
+  btc_block_t *copy;
+
+  printf("block raw (witness=%d)\n", witness);
+
+  /* Serialized from the transactions. */
+  btc_block_encode(&raw, &len, block);
+
+  base_len = btc_block_base_size(block);
+  base = (uint8_t *)malloc(base_len);
+
+  ASSERT(btc_block_base_write(base, block) == base + base_len);
+  ASSERT((base_len != len) == witness);
+
+  /* Re-encoded from the wire bytes. */
+  copy = btc_block_decode(raw, len);
+
+  ASSERT(copy != NULL);
+  ASSERT(btc_block_size(copy) == len);
+  ASSERT(btc_block_base_size(copy) == base_len);
+  ASSERT(btc_block_weight(copy) == btc_block_weight(block));
+
+  out = (uint8_t *)malloc(len);
+
+  ASSERT(btc_block_export(out, copy) == len);
+  ASSERT(memcmp(out, raw, len) == 0);
+
+  ASSERT(btc_block_base_write(out, copy) == out + base_len);
+  ASSERT(memcmp(out, base, base_len) == 0);
+
+  for (i = 0; i < block->txs.length; i++) {
+    const btc_tx_t *x = block->txs.items[i];
+    const btc_tx_t *y = copy->txs.items[i];
+
+    ASSERT(memcmp(x->hash, y->hash, 32) == 0);
+    ASSERT(memcmp(x->whash, y->whash, 32) == 0);
+  }
+
+  /* Header changes are always reflected. */
+  copy->header.nonce++;
+
+  ASSERT(btc_block_export(out, copy) == len);
+  ASSERT(memcmp(out + 80, raw + 80, len - 80) == 0);
+  ASSERT(memcmp(out, raw, 80) != 0);
+
+  copy->header.nonce--;
+
+  /* Modified transactions require an uncache. */
+  btc_tx_destroy(btc_txvec_pop(&copy->txs));
+  btc_txvec_push(&copy->txs, btc_tx_clone(block->txs.items[4]));
+
+  btc_block_uncache(copy);
+
+  ASSERT(btc_block_size(copy) == len);
+  ASSERT(btc_block_export(out, copy) == len);
+  ASSERT(memcmp(out, raw, len) == 0);
+
+  btc_block_destroy(copy);
+
+  /* Clones keep the encoding. */
+  copy = btc_block_decode(raw, len);
+
+  ASSERT(copy != NULL);
+
+  {
+    btc_block_t *clone = btc_block_clone(copy);
+
+    ASSERT(btc_block_export(out, clone) == len);
+    ASSERT(memcmp(out, raw, len) == 0);
+
+    ASSERT(btc_block_base_write(out, clone) == out + base_len);
+    ASSERT(memcmp(out, base, base_len) == 0);
+
+    btc_block_destroy(clone);
+  }
+
+  /* Reading into a used block. */
+  ASSERT(btc_block_import(copy, base, base_len));
+  ASSERT(btc_block_size(copy) == base_len);
+  ASSERT(btc_block_export(out, copy) == base_len);
+  ASSERT(memcmp(out, base, base_len) == 0);
+
+  btc_block_destroy(copy);
+  btc_block_destroy(block);
+
+  free(raw);
+  free(base);
+  free(out);
+}
+
+int
+main(void) {
+  test_block_raw(0);
+  test_block_raw(1);
   return 0;
 }
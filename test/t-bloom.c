@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <mako/bloom.h>
+#include <mako/util.h>
 #include "lib/tests.h"
 
 /*
@@ -147,6 +148,48 @@ test_bloom3(void) {
  * Rolling Filter Tests
  */
 
+static void
+test_bloom4(void) {
+  /* More hash functions than a single lane group. */
+  btc_bloom_t bloom;
+  uint32_t i, j;
+  uint8_t raw[4];
+  size_t bit;
+  int fp = 0;
+
+  btc_bloom_init(&bloom);
+  btc_bloom_set(&bloom, 100, 0.0000000001, BTC_BLOOM_INTERNAL);
+
+  ASSERT(bloom.n > 16);
+
+  for (i = 0; i < 100; i++) {
+    memcpy(raw, &i, 4);
+    btc_bloom_add(&bloom, raw, 4);
+  }
+
+  for (i = 0; i < 100; i++) {
+    memcpy(raw, &i, 4);
+
+    ASSERT(btc_bloom_has(&bloom, raw, 4));
+
+    /* Same bits as hashing one seed at a time. */
+    for (j = 0; j < bloom.n; j++) {
+      bit = btc_murmur3_tweak(raw, 4, j, bloom.tweak) % (bloom.size * 8);
+
+      ASSERT(bloom.data[bit >> 3] & (1 << (bit & 7)));
+    }
+  }
+
+  for (i = 100; i < 10100; i++) {
+    memcpy(raw, &i, 4);
+    fp += btc_bloom_has(&bloom, raw, 4);
+  }
+
+  ASSERT(fp == 0);
+
+  btc_bloom_clear(&bloom);
+}
+
 static void
 test_filter1(void) {
   btc_filter_t filter;
@@ -237,6 +280,7 @@ main(void) {
   test_bloom1();
   test_bloom2();
   test_bloom3();
+  test_bloom4();
   test_filter1();
   test_filter2();
   return 0;
@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-chacha20.c - chacha20 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,78 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/stream.h>
 #include "lib/tests.h"
 
-int main(void) {
+static void
+test_chacha20_vector(void) {
+  /* RFC 7539, section 2.4.2. */
+  static const uint8_t key[32] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+  };
+  static const uint8_t nonce[12] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x4a, 0x00, 0x00, 0x00, 0x00
+  };
+  static const uint8_t expect[16] = {
+    0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80,
+    0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81
+  };
+  static const char *msg = "Ladies and Gentlemen of the class of '99";
+  uint8_t out[64];
+  btc_chacha20_t ctx;
+  size_t len = strlen(msg);
+
+  btc_chacha20_init(&ctx, key, 32, nonce, 12, 1);
+  btc_chacha20_crypt(&ctx, out, (const uint8_t *)msg, len);
+
+  ASSERT(memcmp(out, expect, 16) == 0);
+
+  btc_chacha20_init(&ctx, key, 32, nonce, 12, 1);
+  btc_chacha20_crypt(&ctx, out, out, len);
+
+  ASSERT(memcmp(out, msg, len) == 0);
+}
+
+static void
+test_chacha20_keystream(void) {
+  static const size_t sizes[] = {1, 63, 64, 65, 255, 256, 300, 1000};
+  static uint8_t zero[2048];
+  static uint8_t a[2048];
+  static uint8_t b[2048];
+  static const uint8_t key[32] = {1, 2, 3};
+  static const uint8_t nonce[8] = {4, 5, 6};
+  btc_chacha20_t x, y;
+  size_t i, j, pos;
+
+  for (i = 0; i < lengthof(sizes); i++) {
+    /* Unaligned reads straddling the 4-block path. */
+    btc_chacha20_init(&x, key, 32, nonce, 8, 0xfffffffe);
+    btc_chacha20_init(&y, key, 32, nonce, 8, 0xfffffffe);
+
+    for (pos = 0; pos + sizes[i] <= sizeof(a); pos += sizes[i]) {
+      btc_chacha20_keystream(&x, a + pos, sizes[i]);
+      btc_chacha20_crypt(&y, b + pos, zero, sizes[i]);
+    }
+
+    ASSERT(memcmp(a, b, pos) == 0);
+
+    /* Block-at-a-time reference. */
+    btc_chacha20_init(&y, key, 32, nonce, 8, 0xfffffffe);
+
+    for (j = 0; j < pos; j += 64)
+      btc_chacha20_crypt(&y, b + j, zero, 64);
+
+    ASSERT(memcmp(a, b, pos) == 0);
+  }
+}
+
+int
+main(void) {
+  test_chacha20_vector();
+  test_chacha20_keystream();
   return 0;
 }
@@ -5,16 +5,28 @@
  */
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <io/core.h>
 #include <node/chain.h>
 #include <mako/block.h>
+#include <mako/crypto/hash.h>
+#include <mako/header.h>
 #include <mako/network.h>
+#include <mako/script.h>
+#include <mako/tx.h>
 #include "lib/tests.h"
 #include "data/chain_vectors_main.h"
 #include "data/chain_vectors_testnet.h"
 
 static void
-test_chain(const btc_network_t *network, const char **vectors, size_t length) {
+test_chain(const btc_network_t *network,
+           const char **vectors,
+           size_t length,
+           size_t cache,
+           int threads,
+           unsigned int chain_flags,
+           int assume_valid) {
   unsigned int flags = BTC_BLOCK_DEFAULT_FLAGS;
   btc_chain_t *chain = btc_chain_create(network);
   unsigned char data[65536];
@@ -23,6 +35,208 @@ test_chain(const btc_network_t *network, const char **vectors, size_t length) {
 
   btc_clean(BTC_PREFIX);
 
+  btc_chain_set_cache(chain, cache);
+  btc_chain_set_threads(chain, threads);
+
+  if (!assume_valid)
+    btc_chain_set_assume_valid(chain, NULL, -1);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, chain_flags));
+
+  for (i = 0; i < length; i++) {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, vectors[i]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+    ASSERT(btc_chain_add(chain, &block, flags, -1));
+
+    btc_block_clear(&block);
+  }
+
+  /* Without a header chain leading to the default
+     assumed-valid block, every script is verified. */
+  ASSERT(btc_chain_assumed(chain) == -1);
+
+  btc_chain_close(chain);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, chain_flags));
+  ASSERT(btc_chain_height(chain) == (int32_t)length);
+
+  /* Read everything back. */
+  for (i = 1; i <= length; i++) {
+    const btc_entry_t *entry = btc_chain_by_height(chain, i);
+    unsigned char hash[32];
+    btc_block_t *blk;
+    uint8_t *raw;
+    size_t len;
+
+    ASSERT(entry != NULL);
+
+    blk = btc_chain_get_block(chain, entry);
+
+    ASSERT(blk != NULL);
+
+    btc_header_hash(hash, &blk->header);
+
+    ASSERT(memcmp(hash, entry->hash, 32) == 0);
+
+    btc_block_destroy(blk);
+
+    ASSERT(btc_chain_get_raw_block(chain, &raw, &len, entry));
+    ASSERT(len >= 24 + 80);
+
+    btc_hash256(hash, raw + 24, 80);
+
+    ASSERT(memcmp(hash, entry->hash, 32) == 0);
+
+    free(raw);
+  }
+
+  btc_chain_close(chain);
+  btc_chain_destroy(chain);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static int32_t
+run_assume(const btc_network_t *network,
+           const char **vectors,
+           size_t length,
+           const uint8_t *hash,
+           int32_t height,
+           size_t skip,
+           int connects) {
+  unsigned int flags = BTC_BLOCK_DEFAULT_FLAGS;
+  btc_chain_t *chain = btc_chain_create(network);
+  btc_header_t *headers = malloc(length * sizeof(btc_header_t));
+  btc_header_t **items = malloc(length * sizeof(btc_header_t *));
+  uint8_t *hashes = malloc(length * 32);
+  unsigned char data[65536];
+  btc_block_t block;
+  int32_t assumed;
+  size_t i, n;
+
+  ASSERT(headers != NULL && items != NULL && hashes != NULL);
+
+  btc_clean(BTC_PREFIX);
+
+  btc_chain_set_assume_valid(chain, hash, height);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+
+  /* The header chain, as a peer would send it. */
+  for (i = 0; i < length; i++) {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, vectors[i]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+
+    headers[i] = block.header;
+    items[i] = &headers[i];
+
+    btc_header_hash(hashes + i * 32, &headers[i]);
+    btc_block_clear(&block);
+  }
+
+  /* In batches of at most 2000. */
+  for (i = skip; i < length; i += n) {
+    n = length - i < 2000 ? length - i : 2000;
+
+    ASSERT(btc_chain_add_assumed(chain, items + i, hashes + i * 32, n)
+           == (i == skip ? connects : 1));
+
+    if (!connects)
+      break;
+  }
+
+  free(headers);
+  free(items);
+  free(hashes);
+
+  for (i = 0; i < length; i++) {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, vectors[i]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+    ASSERT(btc_chain_add(chain, &block, flags, -1));
+
+    btc_block_clear(&block);
+  }
+
+  ASSERT(btc_chain_height(chain) == (int32_t)length);
+
+  assumed = btc_chain_assumed(chain);
+
+  btc_chain_close(chain);
+  btc_chain_destroy(chain);
+
+  btc_clean(BTC_PREFIX);
+
+  return assumed;
+}
+
+static void
+test_assume(const btc_network_t *network,
+            const char **vectors,
+            size_t length) {
+  int32_t height = (int32_t)length / 2;
+  unsigned char data[65536];
+  size_t size = sizeof(data);
+  uint8_t hash[32], other[32];
+  btc_block_t block;
+
+  hex_decode(data, &size, vectors[height - 1]);
+
+  btc_block_init(&block);
+
+  ASSERT(btc_block_import(&block, data, size));
+
+  btc_header_hash(hash, &block.header);
+  btc_block_clear(&block);
+
+  memset(other, 0x11, 32);
+
+  /* Skipping stops at the assumed block. */
+  ASSERT(run_assume(network, vectors, length, hash, height, 0, 1) == height);
+
+  /* The header chain supplies a missing height. */
+  ASSERT(run_assume(network, vectors, length, hash, -1, 0, 1) == height);
+
+  /* Nothing is skipped for a block not in the header
+     chain, whether or not we were told its height. */
+  ASSERT(run_assume(network, vectors, length, other, height, 0, 1) == -1);
+  ASSERT(run_assume(network, vectors, length, other, -1, 0, 1) == -1);
+
+  /* Nor for headers which don't connect to our chain. */
+  ASSERT(run_assume(network, vectors, length, hash, height, 1, 0) == -1);
+
+  /* Nor without the minimum chainwork. */
+  ASSERT(run_assume(btc_mainnet, vectors, length, hash, height, 0, 1) == -1);
+}
+
+static void
+test_reindex(const btc_network_t *network,
+             const char **vectors,
+             size_t length) {
+  unsigned int flags = BTC_BLOCK_DEFAULT_FLAGS;
+  btc_chain_t *chain = btc_chain_create(network);
+  unsigned char data[65536];
+  char path[BTC_PATH_MAX];
+  btc_replay_t stats;
+  btc_block_t block;
+  size_t i;
+
+  btc_clean(BTC_PREFIX);
+
   ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
 
   for (i = 0; i < length; i++) {
@@ -38,19 +252,399 @@ test_chain(const btc_network_t *network, const char **vectors, size_t length) {
     btc_block_clear(&block);
   }
 
+  btc_chain_close(chain);
+
+  /* Nothing to do without the flag. */
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+  ASSERT(!btc_chain_reindex(chain, &stats));
+  btc_chain_close(chain);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, BTC_CHAIN_REINDEX));
+  ASSERT(btc_chain_height(chain) == 0);
+  ASSERT(btc_chain_reindex(chain, &stats));
+  ASSERT(btc_chain_height(chain) == (int32_t)length);
+  ASSERT(stats.files == 1);
+  ASSERT(stats.blocks == (int64_t)length);
+  ASSERT(stats.txs >= stats.blocks);
+
+  ASSERT(btc_path_join(path, sizeof(path), BTC_PREFIX, "blocks.reindex", 0));
+  ASSERT(!btc_fs_exists(path));
+
+  btc_chain_close(chain);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+  ASSERT(btc_chain_height(chain) == (int32_t)length);
+
   btc_chain_close(chain);
   btc_chain_destroy(chain);
 
   btc_clean(BTC_PREFIX);
 }
 
+typedef struct snapshot_args_s {
+  btc_chain_t *chain;
+  volatile long done;
+  long reads;
+} snapshot_args_t;
+
+static void
+snapshot_thread(void *arg) {
+  snapshot_args_t *args = arg;
+  unsigned long generation = 0;
+  int32_t height = 0;
+  btc_chaintip_t tip;
+
+  while (!btc_atomic_load(&args->done)) {
+    btc_chain_snapshot(args->chain, &tip);
+
+    /* Never torn, never behind a previous read. */
+    ASSERT(tip.entry != NULL);
+    ASSERT(tip.entry->height == tip.height);
+    ASSERT(tip.generation >= generation);
+    ASSERT(tip.height >= height);
+    ASSERT(btc_chaintip_by_height(&tip, tip.height) == tip.entry);
+    ASSERT(btc_chaintip_by_height(&tip, 0)->height == 0);
+    ASSERT(btc_chaintip_by_height(&tip, tip.height + 1) == NULL);
+    ASSERT(btc_chaintip_is_main(&tip, tip.entry));
+
+    generation = tip.generation;
+    height = tip.height;
+
+    args->reads++;
+  }
+}
+
+static void
+test_snapshot(const btc_network_t *network,
+              const char **vectors,
+              size_t length) {
+  unsigned int flags = BTC_BLOCK_DEFAULT_FLAGS;
+  btc_chain_t *chain = btc_chain_create(network);
+  btc_thread_t *thread = btc_thread_alloc();
+  unsigned char data[65536];
+  snapshot_args_t args;
+  btc_chaintip_t tip;
+  btc_block_t block;
+  size_t i;
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+
+  btc_chain_snapshot(chain, &tip);
+
+  ASSERT(tip.entry == btc_chain_tip(chain));
+  ASSERT(tip.height == 0);
+
+  args.chain = chain;
+  args.done = 0;
+  args.reads = 0;
+
+  btc_thread_create(thread, snapshot_thread, &args);
+
+  for (i = 0; i < length; i++) {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, vectors[i]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+    ASSERT(btc_chain_add(chain, &block, flags, -1));
+
+    btc_block_clear(&block);
+  }
+
+  btc_atomic_store(&args.done, 1);
+  btc_thread_join(thread);
+  btc_thread_free(thread);
+
+  ASSERT(args.reads > 0);
+
+  btc_chain_snapshot(chain, &tip);
+
+  ASSERT(tip.entry == btc_chain_tip(chain));
+  ASSERT(tip.height == (int32_t)length);
+  ASSERT(tip.generation == (unsigned long)length + 1);
+
+  for (i = 0; i <= length; i++)
+    ASSERT(btc_chaintip_by_height(&tip, i) == btc_chain_by_height(chain, i));
+
+  btc_chain_close(chain);
+  btc_chain_destroy(chain);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static size_t
+count_files(const char *dir) {
+  btc_dirent_t **list;
+  size_t i, count;
+
+  if (!btc_fs_scandir(dir, &list, &count))
+    return 0;
+
+  for (i = 0; i < count; i++)
+    free(list[i]);
+
+  free(list);
+
+  return count;
+}
+
+static void
+test_orphans(const btc_network_t *network,
+             const char **vectors,
+             size_t length) {
+  unsigned int flags = BTC_BLOCK_DEFAULT_FLAGS;
+  btc_chain_t *chain = btc_chain_create(network);
+  unsigned char data[65536];
+  uint8_t hashes[64][32];
+  char dir[BTC_PATH_MAX];
+  btc_block_t block;
+  size_t i;
+
+  ASSERT(length >= 3 && length <= 64);
+  ASSERT(btc_path_join(dir, sizeof(dir), BTC_PREFIX, "orphans", 0));
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+  ASSERT(btc_fs_exists(dir));
+
+  /* Everything but the first block arrives early. */
+  for (i = length - 1; i >= 1; i--) {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, vectors[i]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+    ASSERT(btc_chain_add(chain, &block, flags, -1));
+
+    btc_header_hash(hashes[i], &block.header);
+
+    btc_block_clear(&block);
+
+    ASSERT(btc_chain_has_orphan(chain, hashes[i]));
+  }
+
+  ASSERT(btc_chain_height(chain) == 0);
+  ASSERT(count_files(dir) == length - 1);
+
+  /* The root is the oldest orphan we know of. */
+  ASSERT(memcmp(btc_chain_get_orphan_root(chain, hashes[length - 1]),
+                hashes[1], 32) == 0);
+
+  {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, vectors[0]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+    ASSERT(btc_chain_add(chain, &block, flags, -1));
+
+    btc_block_clear(&block);
+  }
+
+  /* Read back and connected in order. */
+  ASSERT(btc_chain_height(chain) == (int32_t)length);
+  ASSERT(count_files(dir) == 0);
+
+  for (i = 1; i < length; i++) {
+    ASSERT(!btc_chain_has_orphan(chain, hashes[i]));
+    ASSERT(memcmp(btc_chain_by_height(chain, i + 1)->hash,
+                  hashes[i], 32) == 0);
+  }
+
+  btc_chain_close(chain);
+
+  ASSERT(!btc_fs_exists(dir));
+
+  /* A leftover store is cleared on open. */
+  ASSERT(btc_fs_mkdir(dir, 0755));
+  ASSERT(btc_path_join(dir, sizeof(dir), dir, "stale.blk", 0));
+  ASSERT(btc_fs_write_file(dir, 0644, data, 8));
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+  ASSERT(!btc_fs_exists(dir));
+
+  btc_chain_close(chain);
+  btc_chain_destroy(chain);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+test_memory(const btc_network_t *network,
+            const char **vectors,
+            size_t length) {
+  unsigned int flags = BTC_BLOCK_DEFAULT_FLAGS;
+  btc_chain_t *chain = btc_chain_create(network);
+  unsigned char data[65536];
+  char path[BTC_PATH_MAX];
+  btc_block_t block;
+  size_t i;
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, BTC_CHAIN_MEMORY));
+
+  for (i = 0; i < length; i++) {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, vectors[i]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+    ASSERT(btc_chain_add(chain, &block, flags, -1));
+
+    btc_block_clear(&block);
+  }
+
+  ASSERT(btc_chain_height(chain) == (int32_t)length);
+
+  for (i = 1; i <= length; i++) {
+    const btc_entry_t *entry = btc_chain_by_height(chain, i);
+    btc_block_t *blk = btc_chain_get_block(chain, entry);
+
+    ASSERT(blk != NULL);
+
+    btc_block_destroy(blk);
+  }
+
+  /* Nothing lands under the prefix. */
+  ASSERT(btc_path_join(path, sizeof(path), BTC_PREFIX, "chain.dat", 0));
+  ASSERT(!btc_fs_exists(path));
+
+  btc_chain_close(chain);
+
+  /* Nor does anything outlive a close. */
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, BTC_CHAIN_MEMORY));
+  ASSERT(btc_chain_height(chain) == 0);
+
+  btc_chain_close(chain);
+  btc_chain_destroy(chain);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+test_scriptcache(const btc_network_t *network) {
+  unsigned int a = BTC_SCRIPT_VERIFY_P2SH;
+  unsigned int b = BTC_SCRIPT_VERIFY_WITNESS;
+  btc_chain_t *chain = btc_chain_create(network);
+  btc_tx_t *tx = btc_tx_create();
+
+  btc_tx_refresh(tx);
+
+  ASSERT(!btc_chain_has_scripts(chain, tx, a));
+
+  btc_chain_cache_scripts(chain, tx, a);
+
+  ASSERT(btc_chain_has_scripts(chain, tx, 0));
+  ASSERT(btc_chain_has_scripts(chain, tx, a));
+  ASSERT(!btc_chain_has_scripts(chain, tx, a | b));
+
+  /* Two passes under different flags prove nothing about both. */
+  btc_chain_cache_scripts(chain, tx, b);
+
+  ASSERT(btc_chain_has_scripts(chain, tx, b));
+  ASSERT(!btc_chain_has_scripts(chain, tx, a | b));
+
+  /* A stricter pass covers the looser ones. */
+  btc_chain_cache_scripts(chain, tx, a | b);
+  btc_chain_cache_scripts(chain, tx, a);
+
+  ASSERT(btc_chain_has_scripts(chain, tx, a));
+  ASSERT(btc_chain_has_scripts(chain, tx, b));
+  ASSERT(btc_chain_has_scripts(chain, tx, a | b));
+
+  btc_tx_destroy(tx);
+  btc_chain_destroy(chain);
+}
+
 int
 main(void) {
+  static btc_network_t assume_main;
+
   test_chain(btc_mainnet, chain_vectors_main,
-                          lengthof(chain_vectors_main));
+                          lengthof(chain_vectors_main),
+                          (size_t)16 << 20,
+                          0,
+                          0,
+                          0);
 
   test_chain(btc_testnet, chain_vectors_testnet,
-                          lengthof(chain_vectors_testnet));
+                          lengthof(chain_vectors_testnet),
+                          (size_t)16 << 20,
+                          0,
+                          0,
+                          0);
+
+  /* Force a flush on every block. */
+  test_chain(btc_mainnet, chain_vectors_main,
+                          lengthof(chain_vectors_main),
+                          0,
+                          0,
+                          0,
+                          0);
+
+  /* Force parallel script verification. */
+  test_chain(btc_testnet, chain_vectors_testnet,
+                          lengthof(chain_vectors_testnet),
+                          (size_t)16 << 20,
+                          4,
+                          0,
+                          0);
+
+  /* Serve finalized block files from a mapping. */
+  test_chain(btc_mainnet, chain_vectors_main,
+                          lengthof(chain_vectors_main),
+                          (size_t)16 << 20,
+                          0,
+                          BTC_CHAIN_MMAP,
+                          0);
+
+  /* Skip scripts below the default assumed-valid block. */
+  test_chain(btc_mainnet, chain_vectors_main,
+                          lengthof(chain_vectors_main),
+                          (size_t)16 << 20,
+                          0,
+                          0,
+                          1);
+
+  test_chain(btc_testnet, chain_vectors_testnet,
+                          lengthof(chain_vectors_testnet),
+                          (size_t)16 << 20,
+                          0,
+                          0,
+                          1);
+
+  /* Early blocks carry far less than the minimum chainwork. */
+  assume_main = *btc_mainnet;
+
+  memset(assume_main.pow.chainwork, 0, 32);
+
+  test_assume(&assume_main, chain_vectors_main,
+                            lengthof(chain_vectors_main));
+
+  test_reindex(btc_mainnet, chain_vectors_main,
+                            lengthof(chain_vectors_main));
+
+  test_snapshot(btc_mainnet, chain_vectors_main,
+                             lengthof(chain_vectors_main));
+
+  test_orphans(btc_mainnet, chain_vectors_main, 32);
+
+  test_memory(btc_mainnet, chain_vectors_main,
+                           lengthof(chain_vectors_main));
+
+  test_scriptcache(btc_mainnet);
 
   return 0;
 }
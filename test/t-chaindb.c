@@ -5,11 +5,1418 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <io/core.h>
+#include <node/chain.h>
 #include <node/chaindb.h>
+#include <mako/block.h>
+#include <mako/coins.h>
+#include <mako/entry.h>
+#include <mako/header.h>
 #include <mako/network.h>
+#include <mako/script.h>
+#include <mako/tx.h>
 #include "lib/tests.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#  include <sys/types.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#  define HAVE_FORK
+#endif
+
+static btc_entry_t *
+add_padded(btc_chaindb_t *db,
+           const btc_entry_t *prev,
+           uint32_t nonce,
+           int main,
+           size_t pad) {
+  btc_entry_t *entry = btc_chaindb_create_entry(db);
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *tx = btc_tx_create();
+  btc_output_t *output;
+  btc_input_t *input;
+  btc_block_t block;
+
+  btc_block_init(&block);
+
+  /* Give every block a unique coinbase. */
+  input = btc_input_create();
+  input->prevout.index = UINT32_MAX;
+  input->sequence = (uint32_t)prev->height + 1;
+
+  /* Coinbase scripts are the one place filler costs no coins. */
+  if (pad > 0)
+    memset(btc_script_resize(&input->script, pad), 0x51, pad);
+
+  btc_inpvec_push(&tx->inputs, input);
+
+  output = btc_output_create();
+  output->value = 1000 + nonce;
+
+  btc_outvec_push(&tx->outputs, output);
+
+  btc_tx_refresh(tx);
+  btc_txvec_push(&block.txs, tx);
+
+  block.header.version = 1;
+  block.header.time = prev->header.time + 600;
+  block.header.bits = prev->header.bits;
+  block.header.nonce = nonce;
+
+  memcpy(block.header.prev_block, prev->hash, 32);
+
+  ASSERT(btc_block_merkle_root(block.header.merkle_root, &block));
+  ASSERT(btc_header_mine(&block.header, 0));
+
+  btc_entry_set_block(entry, &block, prev);
+
+  if (main)
+    btc_view_add(view, tx, entry->height, 0);
+
+  ASSERT(btc_chaindb_save(db, entry, &block, main ? view : NULL));
+
+  btc_block_clear(&block);
+  btc_view_destroy(view);
+
+  return entry;
+}
+
+static btc_entry_t *
+add_block(btc_chaindb_t *db, const btc_entry_t *prev, uint32_t nonce, int main) {
+  return add_padded(db, prev, nonce, main, 0);
+}
+
+static void
+test_index(const char *index_path, int remove_index, unsigned int flags) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  const btc_entry_t *entry, *fork;
+  btc_dbstats_t stats;
+  uint8_t main_tip[32];
+  uint8_t side_tip[32];
+  int32_t i;
+
+  printf("chaindb index (remove=%d, flags=%x)\n", remove_index, flags);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  /* Main chain of 20 blocks with a 3 block side chain forking at 10. */
+  entry = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 20; i++)
+    entry = add_block(db, entry, 0, 1);
+
+  memcpy(main_tip, entry->hash, 32);
+
+  entry = btc_chaindb_by_height(db, 10);
+
+  for (i = 0; i < 3; i++)
+    entry = add_block(db, entry, 1, 0);
+
+  memcpy(side_tip, entry->hash, 32);
+
+  btc_chaindb_close(db);
+
+  if (remove_index)
+    ASSERT(remove(index_path) == 0);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+  ASSERT(btc_chaindb_height(db) == 20);
+  ASSERT(memcmp(btc_chaindb_tail(db)->hash, main_tip, 32) == 0);
+
+  for (i = 0; i <= 20; i++) {
+    entry = btc_chaindb_by_height(db, i);
+
+    ASSERT(entry != NULL);
+    ASSERT(entry->height == i);
+    ASSERT(btc_chaindb_by_hash(db, entry->hash) == entry);
+    ASSERT(btc_chaindb_is_main(db, entry));
+    ASSERT(i == 0 || entry->prev == btc_chaindb_by_height(db, i - 1));
+    ASSERT(i == 20 || entry->next == btc_chaindb_by_height(db, i + 1));
+    ASSERT(btc_chaindb_median_time(db, entry)
+           == btc_entry_median_time(entry));
+  }
+
+  /* Side chain must link back into the main chain. */
+  entry = btc_chaindb_by_hash(db, side_tip);
+  fork = btc_chaindb_by_height(db, 10);
+
+  ASSERT(entry != NULL);
+  ASSERT(entry->height == 13);
+  ASSERT(!btc_chaindb_is_main(db, entry));
+  ASSERT(entry->prev->prev->prev == fork);
+  ASSERT(btc_chaindb_median_time(db, entry)
+         == btc_entry_median_time(entry));
+
+  btc_chaindb_close(db);
+
+  /* A rebuilt index must load the same way. */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+  ASSERT(btc_chaindb_height(db) == 20);
+  ASSERT(btc_chaindb_by_hash(db, side_tip) != NULL);
+
+  btc_chaindb_stats(db, &stats);
+
+  ASSERT(stats.tree_old >= 0 && stats.tree_new >= 0);
+
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+test_snapshot(const char *path) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  const btc_entry_t *entry;
+  uint8_t checksum[32];
+  uint8_t expect[32];
+  uint8_t tip[32];
+  uint64_t count;
+  FILE *fp;
+  int32_t i;
+
+  printf("chaindb snapshot\n");
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+
+  entry = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 20; i++)
+    entry = add_block(db, entry, 0, 1);
+
+  memcpy(tip, entry->hash, 32);
+
+  ASSERT(btc_chaindb_write_snapshot(db, path, expect, &count));
+  ASSERT(count == 20);
+
+  btc_chaindb_close(db);
+  btc_clean(BTC_PREFIX);
+
+  /* Load into a fresh database. */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+  ASSERT(btc_chaindb_read_snapshot(db, path));
+  ASSERT(btc_chaindb_height(db) == 20);
+  ASSERT(memcmp(btc_chaindb_tail(db)->hash, tip, 32) == 0);
+
+  /* History is headers only. */
+  ASSERT(btc_chaindb_get_block(db, btc_chaindb_tail(db)) == NULL);
+
+  btc_chaindb_close(db);
+
+  /* The result survives a restart and dumps identically. */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+  ASSERT(btc_chaindb_height(db) == 20);
+
+  for (i = 1; i <= 20; i++) {
+    entry = btc_chaindb_by_height(db, i);
+
+    ASSERT(entry->prev == btc_chaindb_by_height(db, i - 1));
+  }
+
+  ASSERT(btc_chaindb_write_snapshot(db, path, checksum, &count));
+  ASSERT(memcmp(checksum, expect, 32) == 0);
+  ASSERT(count == 20);
+
+  btc_chaindb_close(db);
+  btc_clean(BTC_PREFIX);
+
+  /* A corrupt snapshot is rejected up front. */
+  fp = fopen(path, "r+b");
+
+  ASSERT(fp != NULL);
+  ASSERT(fseek(fp, 100, SEEK_SET) == 0);
+  ASSERT(fputc(0xff, fp) != EOF);
+  ASSERT(fclose(fp) == 0);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+  ASSERT(!btc_chaindb_read_snapshot(db, path));
+  ASSERT(btc_chaindb_height(db) == 0);
+
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(remove(path) == 0);
+}
+
+static void
+test_undo(void) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  btc_entry_t *entry = btc_chaindb_create_entry(db);
+  const btc_entry_t *prev;
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *cb = btc_tx_create();
+  btc_tx_t *tx = btc_tx_create();
+  btc_outpoint_t prevout;
+  const btc_coin_t *coin;
+  btc_block_t *block;
+  btc_input_t *input;
+  int32_t i;
+
+  printf("chaindb undo\n");
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+
+  prev = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 5; i++)
+    prev = add_block(db, prev, 0, 1);
+
+  /* Spend the first block's coinbase. */
+  block = btc_chaindb_get_block(db, btc_chaindb_by_height(db, 1));
+
+  ASSERT(block != NULL);
+
+  btc_outpoint_set(&prevout, block->txs.items[0]->hash, 0);
+  btc_block_destroy(block);
+
+  block = btc_block_create();
+
+  input = btc_input_create();
+  input->prevout.index = UINT32_MAX;
+  input->sequence = 6;
+
+  btc_inpvec_push(&cb->inputs, input);
+  btc_outvec_push(&cb->outputs, btc_output_create());
+  btc_tx_refresh(cb);
+
+  input = btc_input_create();
+  input->prevout = prevout;
+
+  btc_inpvec_push(&tx->inputs, input);
+  btc_outvec_push(&tx->outputs, btc_output_create());
+  btc_tx_refresh(tx);
+
+  btc_txvec_push(&block->txs, cb);
+  btc_txvec_push(&block->txs, tx);
+
+  block->header.version = 1;
+  block->header.time = prev->header.time + 600;
+  block->header.bits = prev->header.bits;
+  block->header.nonce = 0;
+
+  memcpy(block->header.prev_block, prev->hash, 32);
+
+  ASSERT(btc_block_merkle_root(block->header.merkle_root, block));
+  ASSERT(btc_header_mine(&block->header, 0));
+
+  btc_entry_set_block(entry, block, prev);
+
+  ASSERT(btc_chaindb_spend(db, view, tx));
+
+  btc_view_add(view, cb, entry->height, 0);
+  btc_view_add(view, tx, entry->height, 0);
+
+  ASSERT(btc_chaindb_save(db, entry, block, view));
+  ASSERT(btc_chaindb_flush(db));
+
+  btc_view_destroy(view);
+
+  /* The spent coin comes back as it was. */
+  view = btc_chaindb_disconnect(db, entry, block);
+
+  ASSERT(view != NULL);
+  ASSERT(btc_chaindb_height(db) == 5);
+
+  coin = btc_view_get(view, &prevout);
+
+  ASSERT(coin != NULL);
+  ASSERT(!coin->spent);
+  ASSERT(coin->height == 1);
+  ASSERT(coin->coinbase == 1);
+  ASSERT(coin->output.value == 1000);
+
+  btc_view_destroy(view);
+  btc_block_destroy(block);
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+check_fill(btc_view_t *view, const btc_tx_t *tx, size_t expect) {
+  size_t i, found = 0;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_outpoint_t *prevout = &tx->inputs.items[i]->prevout;
+    const btc_coin_t *coin = btc_view_get(view, prevout);
+
+    if (prevout->index >= 20 || prevout->hash[0] == 0xab) {
+      ASSERT(coin == NULL);
+      continue;
+    }
+
+    ASSERT(coin != NULL);
+    ASSERT(coin->output.value == (int64_t)prevout->index + 1);
+
+    found++;
+  }
+
+  ASSERT(found == expect);
+}
+
+static void
+test_fill(void) {
+  static const uint32_t indices[] = {17, 3, 4, 0, 5, 3, 25, 9, 19};
+  static const uint8_t other[32] = {0xab};
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  btc_entry_t *entry = btc_chaindb_create_entry(db);
+  btc_view_t *view = btc_view_create();
+  btc_chainreader_t *reader;
+  btc_tx_t *cb = btc_tx_create();
+  btc_tx_t *tx = btc_tx_create();
+  const btc_entry_t *prev;
+  btc_output_t *output;
+  btc_input_t *input;
+  btc_block_t block;
+  uint8_t hash[32];
+  size_t i;
+
+  printf("chaindb fill\n");
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+
+  prev = btc_chaindb_tail(db);
+
+  /* One coinbase with many outputs. */
+  btc_block_init(&block);
+
+  input = btc_input_create();
+  input->prevout.index = UINT32_MAX;
+  input->sequence = 1;
+
+  btc_inpvec_push(&cb->inputs, input);
+
+  for (i = 0; i < 20; i++) {
+    output = btc_output_create();
+    output->value = i + 1;
+    btc_outvec_push(&cb->outputs, output);
+  }
+
+  btc_tx_refresh(cb);
+  btc_txvec_push(&block.txs, cb);
+
+  block.header.version = 1;
+  block.header.time = prev->header.time + 600;
+  block.header.bits = prev->header.bits;
+
+  memcpy(block.header.prev_block, prev->hash, 32);
+
+  ASSERT(btc_block_merkle_root(block.header.merkle_root, &block));
+  ASSERT(btc_header_mine(&block.header, 0));
+
+  btc_entry_set_block(entry, &block, prev);
+  btc_view_add(view, cb, entry->height, 0);
+
+  ASSERT(btc_chaindb_save(db, entry, &block, view));
+
+  memcpy(hash, cb->hash, 32);
+
+  btc_block_clear(&block);
+  btc_view_destroy(view);
+
+  /* Reopen so that every coin comes from disk. */
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  db = btc_chaindb_create(btc_regtest);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+
+  btc_chaindb_set_cache(db, 0);
+
+  /* Unsorted, with a duplicate and two missing coins. */
+  for (i = 0; i < lengthof(indices); i++) {
+    input = btc_input_create();
+    btc_outpoint_set(&input->prevout, hash, indices[i]);
+    btc_inpvec_push(&tx->inputs, input);
+  }
+
+  input = btc_input_create();
+  btc_outpoint_set(&input->prevout, other, 0);
+  btc_inpvec_push(&tx->inputs, input);
+
+  view = btc_view_create();
+
+  ASSERT(!btc_chaindb_fill(db, view, tx));
+
+  check_fill(view, tx, 8);
+
+  btc_view_destroy(view);
+
+  reader = btc_chainreader_create(db);
+  view = btc_view_create();
+
+  ASSERT(reader != NULL);
+  ASSERT(!btc_chainreader_fill(reader, view, tx));
+
+  check_fill(view, tx, 8);
+
+  btc_view_destroy(view);
+  btc_chainreader_destroy(reader);
+
+  /* Replace the duplicate and the missing coins. */
+  tx->inputs.items[5]->prevout.index = 1;
+  tx->inputs.items[6]->prevout.index = 2;
+  tx->inputs.items[9]->prevout = tx->inputs.items[1]->prevout;
+  tx->inputs.items[9]->prevout.index = 7;
+
+  view = btc_view_create();
+
+  ASSERT(btc_chaindb_fill(db, view, tx));
+
+  check_fill(view, tx, 10);
+
+  btc_view_destroy(view);
+
+  view = btc_view_create();
+
+  ASSERT(btc_chaindb_spend(db, view, tx));
+  ASSERT(btc_view_undo(view)->length == 10);
+
+  btc_view_destroy(view);
+  btc_tx_destroy(tx);
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+check_tx(btc_chaindb_t *db, const btc_tx_t *tx, const btc_entry_t *expect) {
+  const btc_entry_t *entry;
+  btc_tx_t *got;
+
+  got = btc_chaindb_get_tx(db, &entry, tx->hash);
+
+  ASSERT(got != NULL);
+  ASSERT(entry == expect);
+  ASSERT(btc_tx_size(got) == btc_tx_size(tx));
+  ASSERT(memcmp(got->whash, tx->whash, 32) == 0);
+
+  btc_tx_destroy(got);
+}
+
+static void
+test_txindex(unsigned int flags) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  btc_entry_t *entry = btc_chaindb_create_entry(db);
+  const btc_entry_t *prev;
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *cb = btc_tx_create();
+  btc_tx_t *tx = btc_tx_create();
+  btc_block_t *block, *other;
+  btc_input_t *input;
+  int32_t i;
+
+  printf("chaindb txindex (flags=%x)\n", flags);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  prev = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 5; i++)
+    prev = add_block(db, prev, 0, 1);
+
+  /* A block with two transactions, so the
+     second one sits at a non-trivial offset. */
+  block = btc_chaindb_get_block(db, btc_chaindb_by_height(db, 1));
+
+  ASSERT(block != NULL);
+
+  input = btc_input_create();
+  btc_outpoint_set(&input->prevout, block->txs.items[0]->hash, 0);
+
+  btc_inpvec_push(&tx->inputs, input);
+  btc_outvec_push(&tx->outputs, btc_output_create());
+  btc_tx_refresh(tx);
+
+  btc_block_destroy(block);
+
+  input = btc_input_create();
+  input->prevout.index = UINT32_MAX;
+  input->sequence = 6;
+
+  btc_inpvec_push(&cb->inputs, input);
+  btc_outvec_push(&cb->outputs, btc_output_create());
+  btc_tx_refresh(cb);
+
+  block = btc_block_create();
+
+  btc_txvec_push(&block->txs, cb);
+  btc_txvec_push(&block->txs, tx);
+
+  block->header.version = 1;
+  block->header.time = prev->header.time + 600;
+  block->header.bits = prev->header.bits;
+
+  memcpy(block->header.prev_block, prev->hash, 32);
+
+  ASSERT(btc_block_merkle_root(block->header.merkle_root, block));
+  ASSERT(btc_header_mine(&block->header, 0));
+
+  btc_entry_set_block(entry, block, prev);
+
+  ASSERT(btc_chaindb_spend(db, view, tx));
+
+  btc_view_add(view, cb, entry->height, 0);
+  btc_view_add(view, tx, entry->height, 0);
+
+  ASSERT(btc_chaindb_save(db, entry, block, view));
+
+  btc_view_destroy(view);
+
+  /* Served from the pending batch, then from disk. */
+  check_tx(db, cb, entry);
+  check_tx(db, tx, entry);
+
+  ASSERT(btc_chaindb_flush(db));
+
+  check_tx(db, cb, entry);
+  check_tx(db, tx, entry);
+
+  other = btc_chaindb_get_block(db, prev);
+
+  ASSERT(other != NULL);
+
+  check_tx(db, other->txs.items[0], prev);
+
+  btc_block_destroy(other);
+
+  /* Disconnected transactions are forgotten. */
+  view = btc_chaindb_disconnect(db, entry, block);
+
+  ASSERT(view != NULL);
+  ASSERT(btc_chaindb_get_tx(db, NULL, tx->hash) == NULL);
+  ASSERT(btc_chaindb_get_tx(db, NULL, cb->hash) == NULL);
+
+  btc_view_destroy(view);
+
+  /* Reconnect and survive a restart. */
+  view = btc_view_create();
+
+  ASSERT(btc_chaindb_spend(db, view, tx));
+
+  btc_view_add(view, cb, entry->height, 0);
+  btc_view_add(view, tx, entry->height, 0);
+
+  ASSERT(btc_chaindb_reconnect(db, entry, block, view));
+
+  btc_view_destroy(view);
+  btc_chaindb_close(db);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  prev = btc_chaindb_tail(db);
+
+  check_tx(db, tx, prev);
+
+  btc_chaindb_close(db);
+
+  /* Disabled, the index is dropped... */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags & ~BTC_CHAIN_TXINDEX));
+  ASSERT(btc_chaindb_get_tx(db, NULL, tx->hash) == NULL);
+
+  btc_chaindb_close(db);
+
+  /* ...and rebuilt from the block files. */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  prev = btc_chaindb_tail(db);
+
+  check_tx(db, cb, prev);
+  check_tx(db, tx, prev);
+
+  btc_block_destroy(block);
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+test_coinstats(unsigned int flags) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  btc_entry_t *entry = btc_chaindb_create_entry(db);
+  btc_utxostats_t before, after, stats;
+  const btc_entry_t *prev;
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *cb = btc_tx_create();
+  btc_tx_t *tx = btc_tx_create();
+  btc_tx_t *child = btc_tx_create();
+  btc_output_t *output;
+  btc_input_t *input;
+  btc_block_t *block;
+  int32_t i;
+
+  printf("chaindb coinstats (flags=%x)\n", flags);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+  ASSERT(btc_chaindb_utxo_stats(db, &stats));
+  ASSERT(stats.height == 0);
+  ASSERT(stats.count == 0);
+
+  prev = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 5; i++)
+    prev = add_block(db, prev, 0, 1);
+
+  ASSERT(btc_chaindb_utxo_stats(db, &before));
+  ASSERT(before.height == 5);
+  ASSERT(before.count == 5);
+  ASSERT(before.amount == 5 * 1000);
+
+  /* Spend a coinbase, and spend the result
+     again within the same block. */
+  block = btc_chaindb_get_block(db, btc_chaindb_by_height(db, 1));
+
+  ASSERT(block != NULL);
+
+  input = btc_input_create();
+  btc_outpoint_set(&input->prevout, block->txs.items[0]->hash, 0);
+
+  output = btc_output_create();
+  output->value = 600;
+
+  btc_inpvec_push(&tx->inputs, input);
+  btc_outvec_push(&tx->outputs, output);
+  btc_tx_refresh(tx);
+
+  btc_block_destroy(block);
+
+  input = btc_input_create();
+  btc_outpoint_set(&input->prevout, tx->hash, 0);
+
+  output = btc_output_create();
+  output->value = 500;
+
+  btc_inpvec_push(&child->inputs, input);
+  btc_outvec_push(&child->outputs, output);
+  btc_tx_refresh(child);
+
+  input = btc_input_create();
+  input->prevout.index = UINT32_MAX;
+  input->sequence = 6;
+
+  output = btc_output_create();
+  output->value = 2000;
+
+  btc_inpvec_push(&cb->inputs, input);
+  btc_outvec_push(&cb->outputs, output);
+  btc_tx_refresh(cb);
+
+  block = btc_block_create();
+
+  btc_txvec_push(&block->txs, cb);
+  btc_txvec_push(&block->txs, tx);
+  btc_txvec_push(&block->txs, child);
+
+  block->header.version = 1;
+  block->header.time = prev->header.time + 600;
+  block->header.bits = prev->header.bits;
+
+  memcpy(block->header.prev_block, prev->hash, 32);
+
+  ASSERT(btc_block_merkle_root(block->header.merkle_root, block));
+  ASSERT(btc_header_mine(&block->header, 0));
+
+  btc_entry_set_block(entry, block, prev);
+
+  btc_view_add(view, cb, entry->height, 0);
+
+  ASSERT(btc_chaindb_spend(db, view, tx));
+
+  btc_view_add(view, tx, entry->height, 0);
+
+  ASSERT(btc_chaindb_spend(db, view, child));
+
+  btc_view_add(view, child, entry->height, 0);
+
+  ASSERT(btc_chaindb_save(db, entry, block, view));
+
+  btc_view_destroy(view);
+
+  ASSERT(btc_chaindb_utxo_stats(db, &after));
+  ASSERT(after.height == 6);
+  ASSERT(after.count == 6);
+  ASSERT(after.amount == 4 * 1000 + 2000 + 500);
+  ASSERT(memcmp(after.muhash, before.muhash, 32) != 0);
+
+  /* Disconnecting restores the old commitment. */
+  view = btc_chaindb_disconnect(db, entry, block);
+
+  ASSERT(view != NULL);
+  ASSERT(btc_chaindb_utxo_stats(db, &stats));
+  ASSERT(stats.count == before.count);
+  ASSERT(stats.amount == before.amount);
+  ASSERT(memcmp(stats.muhash, before.muhash, 32) == 0);
+
+  btc_view_destroy(view);
+
+  view = btc_view_create();
+
+  btc_view_add(view, cb, entry->height, 0);
+
+  ASSERT(btc_chaindb_spend(db, view, tx));
+
+  btc_view_add(view, tx, entry->height, 0);
+
+  ASSERT(btc_chaindb_spend(db, view, child));
+
+  btc_view_add(view, child, entry->height, 0);
+
+  ASSERT(btc_chaindb_reconnect(db, entry, block, view));
+
+  btc_view_destroy(view);
+  btc_chaindb_close(db);
+
+  /* Persisted with the tip. */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+  ASSERT(btc_chaindb_utxo_stats(db, &stats));
+  ASSERT(stats.height == 6);
+  ASSERT(memcmp(stats.muhash, after.muhash, 32) == 0);
+
+  btc_chaindb_close(db);
+
+  /* Disabled, the record is dropped... */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags & ~BTC_CHAIN_COINSTATS));
+  ASSERT(!btc_chaindb_utxo_stats(db, &stats));
+
+  btc_chaindb_close(db);
+
+  /* ...and rebuilt from the coin set. */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+  ASSERT(btc_chaindb_utxo_stats(db, &stats));
+  ASSERT(stats.count == after.count);
+  ASSERT(stats.amount == after.amount);
+  ASSERT(memcmp(stats.muhash, after.muhash, 32) == 0);
+
+  btc_block_destroy(block);
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+typedef struct reader_args_s {
+  btc_chainreader_t *reader;
+  btc_outpoint_t prevouts[10];
+  int32_t height;
+} reader_args_t;
+
+static void
+reader_thread(void *arg) {
+  reader_args_t *args = (reader_args_t *)arg;
+  btc_coin_t *coin;
+  int32_t height;
+  size_t i, j;
+
+  for (i = 0; i < 100; i++) {
+    for (j = 0; j < lengthof(args->prevouts); j++) {
+      coin = btc_chainreader_get(args->reader, &args->prevouts[j]);
+
+      ASSERT(coin != NULL);
+      ASSERT(coin->height == (int32_t)j + 1);
+
+      btc_coin_destroy(coin);
+
+      btc_chainreader_tip(args->reader, &height);
+
+      /* The tip only moves forward. */
+      ASSERT(height >= args->height);
+
+      args->height = height;
+    }
+  }
+}
+
+static void
+test_reader(unsigned int flags) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  btc_thread_t *thread = btc_thread_alloc();
+  btc_chainreader_t *reader;
+  const btc_entry_t *entry;
+  btc_outpoint_t prevout;
+  reader_args_t args;
+  btc_block_t *block;
+  int32_t i, height;
+
+  printf("chaindb reader (flags=%x)\n", flags);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  /* Keep everything in the cache at first. */
+  btc_chaindb_set_cache(db, 64 << 20);
+
+  entry = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 10; i++) {
+    entry = add_block(db, entry, 0, 1);
+    block = btc_chaindb_get_block(db, entry);
+
+    ASSERT(block != NULL);
+
+    btc_outpoint_set(&args.prevouts[i - 1], block->txs.items[0]->hash, 0);
+    btc_block_destroy(block);
+  }
+
+  reader = btc_chainreader_create(db);
+
+  ASSERT(reader != NULL);
+
+  /* Nothing has been flushed yet. */
+  btc_outpoint_set(&prevout, args.prevouts[0].hash, 1);
+
+  ASSERT(btc_chainreader_get(reader, &prevout) == NULL);
+  ASSERT(btc_chainreader_tip(reader, &height) != NULL);
+  ASSERT(height == 10);
+
+  args.reader = reader;
+  args.height = 10;
+
+  btc_thread_create(thread, reader_thread, &args);
+
+  /* Advance the tip and flush underneath the reader. */
+  for (i = 11; i <= 40; i++) {
+    entry = add_block(db, entry, 0, 1);
+
+    if (i % 10 == 0)
+      ASSERT(btc_chaindb_flush(db));
+  }
+
+  btc_thread_join(thread);
+  btc_thread_free(thread);
+
+  /* And again against the final tip. */
+  args.height = 0;
+
+  reader_thread(&args);
+
+  ASSERT(args.height == 40);
+
+  /* Blocks and undo coins, as an index reads them. */
+  for (i = 0; i <= 40; i++) {
+    uint8_t hash[32];
+    btc_undo_t *undo;
+
+    entry = btc_chainreader_by_height(reader, i);
+
+    ASSERT(entry != NULL);
+    ASSERT(btc_chainreader_is_main(reader, entry));
+    ASSERT(btc_chainreader_read(reader, &block, &undo, entry));
+
+    btc_header_hash(hash, &block->header);
+
+    ASSERT(memcmp(hash, entry->hash, 32) == 0);
+    ASSERT(undo->length == 0);
+
+    btc_undo_destroy(undo);
+    btc_block_destroy(block);
+  }
+
+  ASSERT(btc_chainreader_by_height(reader, 41) == NULL);
+
+  btc_chainreader_destroy(reader);
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+check_block(btc_chaindb_t *db, int32_t height) {
+  const btc_entry_t *entry = btc_chaindb_by_height(db, height);
+  btc_block_t *block;
+  uint8_t hash[32];
+
+  ASSERT(entry != NULL);
+
+  block = btc_chaindb_get_block(db, entry);
+
+  ASSERT(block != NULL);
+
+  btc_header_hash(hash, &block->header);
+
+  ASSERT(memcmp(hash, entry->hash, 32) == 0);
+
+  btc_block_destroy(block);
+}
+
+static void
+test_coinscan(unsigned int flags) {
+  static const int ranges[] = { 1, 3, 16 };
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  const btc_scanitem_t *item, *prev;
+  const btc_entry_t *entry;
+  btc_coinscan_t *scan;
+  btc_script_t script;
+  int64_t total = 0;
+  int32_t height;
+  size_t i, j;
+
+  printf("chaindb coinscan (flags=%x)\n", flags);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  /* Unflushed coins must be seen too. */
+  btc_chaindb_set_cache(db, 64 << 20);
+
+  entry = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 40; i++) {
+    entry = add_block(db, entry, 0, 1);
+    total += 1000;
+  }
+
+  btc_script_init(&script);
+
+  for (i = 0; i < lengthof(ranges); i++) {
+    int64_t amount = 0;
+
+    scan = btc_coinscan_create(db);
+
+    /* Every coinbase pays to the empty script. */
+    btc_coinscan_add(scan, &script);
+
+    ASSERT(btc_coinscan_start(scan, ranges[i]));
+    ASSERT(btc_coinscan_wait(scan));
+    ASSERT(btc_coinscan_done(scan));
+    ASSERT(btc_coinscan_progress(scan) == 1.0);
+    ASSERT(btc_coinscan_count(scan) == 40);
+    ASSERT(btc_coinscan_length(scan) == 40);
+    ASSERT(btc_coinscan_tip(scan, &height) != NULL);
+    ASSERT(height == 40);
+
+    prev = NULL;
+
+    for (j = 0; j < btc_coinscan_length(scan); j++) {
+      item = btc_coinscan_item(scan, j);
+
+      /* Results come back in key order. */
+      if (prev != NULL)
+        ASSERT(memcmp(prev->prevout.hash, item->prevout.hash, 32) < 0);
+
+      ASSERT(item->prevout.index == 0);
+      ASSERT(item->coin->coinbase);
+
+      amount += item->coin->output.value;
+      prev = item;
+    }
+
+    ASSERT(amount == total);
+
+    btc_coinscan_destroy(scan);
+  }
+
+  /* Nothing pays to this one. */
+  btc_script_set_p2pkh(&script, entry->hash);
+
+  scan = btc_coinscan_create(db);
+
+  btc_coinscan_add(scan, &script);
+
+  ASSERT(btc_coinscan_start(scan, 4));
+  ASSERT(btc_coinscan_wait(scan));
+  ASSERT(btc_coinscan_count(scan) == 40);
+  ASSERT(btc_coinscan_length(scan) == 0);
+
+  btc_coinscan_destroy(scan);
+
+  /* An aborted scan stops early. */
+  scan = btc_coinscan_create(db);
+
+  btc_coinscan_add(scan, &script);
+
+  ASSERT(btc_coinscan_start(scan, 4));
+
+  btc_coinscan_abort(scan);
+
+  ASSERT(!btc_coinscan_wait(scan));
+  ASSERT(btc_coinscan_done(scan));
+
+  btc_coinscan_destroy(scan);
+
+  /* Destroying a running scan aborts it. */
+  scan = btc_coinscan_create(db);
+
+  ASSERT(btc_coinscan_start(scan, 4));
+
+  btc_coinscan_destroy(scan);
+
+  btc_script_clear(&script);
+
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+test_batch(unsigned int flags) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  const btc_entry_t *entry;
+  FILE *stream;
+  int32_t i;
+
+  printf("chaindb batch (flags=%x)\n", flags);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  /* Saves are grouped while syncing. */
+  btc_chaindb_set_bulk(db, 1);
+
+  entry = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 100; i++)
+    entry = add_block(db, entry, 0, 1);
+
+  btc_chaindb_close(db);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+  ASSERT(btc_chaindb_height(db) == 100);
+
+  check_block(db, 64);
+  check_block(db, 100);
+
+  btc_chaindb_close(db);
+
+  /* Data from a batch which never committed. */
+  stream = fopen(BTC_PREFIX "/blocks/blk00000.dat", "ab");
+
+  ASSERT(stream != NULL);
+  ASSERT(fwrite("garbage", 1, 7, stream) == 7);
+  ASSERT(fclose(stream) == 0);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  entry = add_block(db, btc_chaindb_tail(db), 0, 1);
+
+  ASSERT(entry->height == 101);
+
+  check_block(db, 101);
+
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+test_tune(unsigned int flags) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  btc_dbtune_t small, large;
+  const btc_entry_t *entry;
+  btc_dbstats_t stats;
+  char *structure;
+  int32_t i;
+
+  printf("chaindb tune (flags=%x)\n", flags);
+
+  btc_dbtune_init(&small, BTC_DBPROFILE_SMALL);
+  btc_dbtune_init(&large, BTC_DBPROFILE_LARGE);
+
+  ASSERT(small.bulk_flush < large.bulk_flush);
+  ASSERT(small.autocheckpoint < large.autocheckpoint);
+  ASSERT(small.cache_size < large.cache_size);
+
+  small.automerge = 2;
+
+  btc_chaindb_set_tune(db, &small);
+
+  ASSERT(memcmp(btc_chaindb_tune(db), &small, sizeof(small)) == 0);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  entry = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 20; i++) {
+    entry = add_block(db, entry, 0, 1);
+
+    if (i == 10)
+      btc_chaindb_set_bulk(db, 1);
+  }
+
+  btc_chaindb_set_bulk(db, 0);
+
+  ASSERT(btc_chaindb_flush(db));
+
+  btc_chaindb_stats(db, &stats);
+
+  ASSERT(stats.levels >= 0);
+  ASSERT(stats.segments >= stats.levels);
+  ASSERT(stats.cache_usage > 0);
+
+  structure = btc_chaindb_structure(db);
+
+  free(structure);
+
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+test_state(unsigned int flags) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  btc_deployment_t deploy = btc_regtest->deployments.items[0];
+  const btc_entry_t *entry;
+  int32_t i;
+
+  printf("chaindb state (flags=%x)\n", flags);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  entry = btc_chaindb_tail(db);
+
+  for (i = 1; i <= 10; i++)
+    entry = add_block(db, entry, 0, 1);
+
+  ASSERT(btc_chaindb_get_state(db, &deploy, entry) == -1);
+
+  btc_chaindb_put_state(db, &deploy, entry, BTC_STATE_LOCKED_IN);
+
+  /* Written while syncing as well. */
+  btc_chaindb_set_bulk(db, 1);
+
+  entry = add_block(db, entry, 0, 1);
+
+  btc_chaindb_put_state(db, &deploy, entry, BTC_STATE_ACTIVE);
+  btc_chaindb_set_bulk(db, 0);
+  btc_chaindb_close(db);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  entry = btc_chaindb_by_height(db, 10);
+
+  ASSERT(btc_chaindb_get_state(db, &deploy, entry) == BTC_STATE_LOCKED_IN);
+
+  entry = btc_chaindb_by_height(db, 11);
+
+  ASSERT(btc_chaindb_get_state(db, &deploy, entry) == BTC_STATE_ACTIVE);
+
+  /* Other parameters must not reuse the state. */
+  deploy.timeout += 1;
+
+  ASSERT(btc_chaindb_get_state(db, &deploy, entry) == -1);
+
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+static void
+test_reorg(unsigned int flags) {
+  btc_chaindb_t *db = btc_chaindb_create(btc_regtest);
+  btc_entry_t *side[7];
+  btc_utxostats_t stats;
+  uint8_t old_tip[32];
+  uint8_t new_tip[32];
+  btc_entry_t *entry;
+  btc_block_t *block;
+  btc_view_t *view;
+  int32_t i;
+
+  printf("chaindb reorg (flags=%x)\n", flags);
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+
+  /* Main chain of 10 blocks, side chain of 7 forking at 5. */
+  entry = (btc_entry_t *)btc_chaindb_tail(db);
+
+  for (i = 1; i <= 10; i++)
+    entry = add_block(db, entry, 0, 1);
+
+  memcpy(old_tip, entry->hash, 32);
+
+  entry = (btc_entry_t *)btc_chaindb_by_height(db, 5);
+
+  for (i = 0; i < 7; i++)
+    entry = side[i] = add_block(db, entry, 1, 0);
+
+  ASSERT(btc_chaindb_begin_reorg(db));
+
+  for (i = 10; i > 5; i--) {
+    entry = (btc_entry_t *)btc_chaindb_by_height(db, i);
+    block = btc_chaindb_get_block(db, entry);
+
+    ASSERT(block != NULL);
+
+    view = btc_chaindb_disconnect(db, entry, block);
+
+    ASSERT(view != NULL);
+
+    btc_view_destroy(view);
+    btc_block_destroy(block);
+  }
+
+  for (i = 0; i < 7; i++) {
+    block = btc_chaindb_get_block(db, side[i]);
+    view = btc_view_create();
+
+    ASSERT(block != NULL);
+
+    btc_view_add(view, block->txs.items[0], side[i]->height, 0);
+
+    ASSERT(btc_chaindb_reconnect(db, side[i], block, view));
+
+    btc_view_destroy(view);
+    btc_block_destroy(block);
+  }
+
+  ASSERT(btc_chaindb_end_reorg(db));
+  ASSERT(btc_chaindb_tail(db) == side[6]);
+
+  memcpy(new_tip, side[6]->hash, 32);
+
+  btc_chaindb_close(db);
+
+  /* Everything landed in the single commit. */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags));
+  ASSERT(btc_chaindb_height(db) == 12);
+  ASSERT(memcmp(btc_chaindb_tail(db)->hash, new_tip, 32) == 0);
+  ASSERT(btc_chaindb_utxo_stats(db, &stats));
+  ASSERT(stats.height == 12);
+  ASSERT(stats.count == 12);
+  ASSERT(stats.amount == 5 * 1000 + 7 * 1001);
+
+  block = btc_chaindb_get_block(db, btc_chaindb_tail(db));
+
+  ASSERT(block != NULL);
+  ASSERT(btc_chaindb_has_coins(db, block->txs.items[0]));
+
+  btc_block_destroy(block);
+
+  entry = (btc_entry_t *)btc_chaindb_by_hash(db, old_tip);
+  block = btc_chaindb_get_block(db, entry);
+
+  ASSERT(block != NULL);
+  ASSERT(!btc_chaindb_is_main(db, entry));
+  ASSERT(!btc_chaindb_has_coins(db, block->txs.items[0]));
+
+  btc_block_destroy(block);
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+
+#ifdef HAVE_FORK
+static void
+test_prune(unsigned int flags, int64_t target) {
+  /* Roughly 1mb per block: the first block file
+     fills up after about 128 of them. */
+  static btc_network_t network;
+  const btc_entry_t *entry;
+  btc_chaindb_t *db;
+  btc_block_t *block;
+  int status;
+  pid_t pid;
+  int32_t i;
+
+  printf("chaindb prune (flags=%x, target=%d)\n", flags, (int)target);
+
+  network = *btc_regtest;
+  network.block.keep_blocks = 10;
+  network.block.prune_after_height = 0;
+
+  btc_clean(BTC_PREFIX);
+
+  pid = fork();
+
+  ASSERT(pid >= 0);
+
+  if (pid == 0) {
+    /* Sync past the first file with unflushed coins, then crash. */
+    db = btc_chaindb_create(&network);
+
+    ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags | BTC_CHAIN_PRUNE));
+
+    btc_chaindb_set_cache(db, (size_t)1 << 30);
+    btc_chaindb_set_prune(db, target);
+
+    entry = btc_chaindb_tail(db);
+
+    for (i = 1; i <= 160; i++) {
+      entry = add_padded(db, entry, 0, 1, 1 << 20);
+
+      if (i == 5)
+        ASSERT(btc_chaindb_flush(db));
+    }
+
+    /* Reading the tip waits for the block writer. */
+    block = btc_chaindb_get_block(db, entry);
+
+    ASSERT(block != NULL);
+
+    _exit(0);
+  }
+
+  ASSERT(waitpid(pid, &status, 0) == pid);
+  ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  db = btc_chaindb_create(&network);
+
+  /* Blocks past the flush are replayed from disk. */
+  ASSERT(btc_chaindb_open(db, BTC_PREFIX, flags | BTC_CHAIN_PRUNE));
+  ASSERT(btc_chaindb_height(db) == 160);
+
+  btc_chaindb_set_prune(db, target);
+
+  entry = btc_chaindb_by_height(db, 100);
+
+  if (target > 0) {
+    /* Over the target, the coins were flushed early to let the file go. */
+    ASSERT(btc_chaindb_get_block(db, entry) == NULL);
+  } else {
+    check_block(db, 100);
+
+    /* Once the coins are flushed, the file can go. */
+    add_padded(db, btc_chaindb_tail(db), 0, 1, 0);
+
+    ASSERT(btc_chaindb_get_block(db, entry) == NULL);
+  }
+
+  check_block(db, btc_chaindb_height(db));
+
+  btc_chaindb_close(db);
+  btc_chaindb_destroy(db);
+
+  btc_clean(BTC_PREFIX);
+}
+#endif
+
 int main(void) {
   btc_chaindb_t *db = btc_chaindb_create(btc_mainnet);
 
@@ -22,5 +1429,40 @@ int main(void) {
 
   btc_clean(BTC_PREFIX);
 
+  test_index(BTC_PREFIX "/index.dat", 0, BTC_CHAIN_DEFAULT_FLAGS);
+  test_index(BTC_PREFIX "/index.dat", 1, BTC_CHAIN_DEFAULT_FLAGS);
+  test_index(BTC_PREFIX "/index.dat", 0, BTC_CHAIN_DEFAULT_FLAGS
+                                       | BTC_CHAIN_WORKER);
+  test_snapshot(BTC_PREFIX ".snapshot");
+  test_undo();
+  test_fill();
+  test_txindex(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_TXINDEX);
+  test_txindex(BTC_CHAIN_CHECKPOINTS | BTC_CHAIN_TXINDEX);
+  test_coinstats(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_COINSTATS);
+  test_reader(BTC_CHAIN_DEFAULT_FLAGS);
+  test_reader(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_WORKER);
+  test_coinscan(BTC_CHAIN_DEFAULT_FLAGS);
+  test_batch(BTC_CHAIN_DEFAULT_FLAGS);
+  test_batch(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_WORKER);
+  test_tune(BTC_CHAIN_DEFAULT_FLAGS);
+  test_tune(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_WORKER);
+  test_state(BTC_CHAIN_DEFAULT_FLAGS);
+  test_reorg(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_COINSTATS);
+  test_reorg(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_COINSTATS
+                                     | BTC_CHAIN_TXINDEX);
+  test_coinstats(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_COINSTATS
+                                         | BTC_CHAIN_COINGROUPS);
+  test_reader(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_COINGROUPS);
+  test_coinscan(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_COINGROUPS);
+  test_reorg(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_COINSTATS
+                                     | BTC_CHAIN_COINGROUPS);
+  test_reader(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_HUGEPAGES);
+  test_reorg(BTC_CHAIN_DEFAULT_FLAGS | BTC_CHAIN_COINSTATS
+                                     | BTC_CHAIN_HUGEPAGES);
+#ifdef HAVE_FORK
+  test_prune(BTC_CHAIN_DEFAULT_FLAGS, 0);
+  test_prune(BTC_CHAIN_DEFAULT_FLAGS, 64 << 20);
+#endif
+
   return 0;
 }
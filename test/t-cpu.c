@@ -0,0 +1,112 @@
+/*!
+ * t-cpu.c - cpu test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/cpu.h>
+#include <mako/crypto/hash.h>
+#include <mako/encoding.h>
+#include <mako/mpi.h>
+#include "lib/tests.h"
+
+#define DATA_SIZE (64 * 37)
+#define MAX_LIMBS 64
+
+typedef struct result_s {
+  uint8_t sha256[32];
+  uint8_t sha256_many[32 * 37];
+  uint8_t sha256d64[32 * 37];
+  uint8_t ripemd160_many[20 * 37];
+  uint8_t hash160_many[20 * 37];
+  uint8_t pbkdf512[64 * 5];
+  char base16[DATA_SIZE * 2 + 1];
+  uint8_t unhex[DATA_SIZE];
+  mp_limb_t product[2 * MAX_LIMBS];
+} result_t;
+
+static uint8_t data[DATA_SIZE];
+
+static void
+compute(result_t *r) {
+  static mp_limb_t xp[MAX_LIMBS], yp[MAX_LIMBS];
+  size_t i;
+
+  for (i = 0; i < MAX_LIMBS; i++) {
+    memcpy(&xp[i], data + i * sizeof(mp_limb_t), sizeof(mp_limb_t));
+    memcpy(&yp[i], data + 1024 + i * sizeof(mp_limb_t), sizeof(mp_limb_t));
+  }
+
+  btc_sha256(r->sha256, data, sizeof(data));
+  btc_sha256_many(r->sha256_many, data, 64, 37);
+  btc_sha256d64(r->sha256d64, data, 37);
+  btc_ripemd160_many(r->ripemd160_many, data, 64, 37);
+  btc_hash160_many(r->hash160_many, data, 33, 37);
+  btc_pbkdf512_derive(r->pbkdf512, data, 32, data + 32, 16, 2, 64 * 5);
+  btc_base16_encode(r->base16, data, sizeof(data));
+
+  ASSERT(btc_base16_decode(r->unhex, r->base16, sizeof(data) * 2));
+
+  mpn_mul(r->product, xp, MAX_LIMBS, yp, MAX_LIMBS);
+}
+
+static void
+test_cpu_names(void) {
+  unsigned int detected = btc_cpu_detected();
+  const char *name;
+  size_t i;
+
+  printf("cpu names\n");
+
+  for (i = 0; (name = btc_cpu_feature_name(i)) != NULL; i++)
+    ASSERT(strlen(name) > 0);
+
+  ASSERT(i < 32);
+  ASSERT((detected >> i) == 0);
+  ASSERT(btc_cpu_features() == detected);
+
+  for (i = 0; (name = btc_cpu_backend_name(i)) != NULL; i++)
+    ASSERT(btc_cpu_backend(i) != NULL);
+
+  ASSERT(i > 0);
+}
+
+static void
+test_cpu_dispatch(void) {
+  static result_t fast, slow;
+  size_t i;
+
+  printf("cpu dispatch\n");
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = (uint8_t)(i * 29 + 3);
+
+  compute(&fast);
+
+  /* Every primitive must agree with its portable code. */
+  btc_cpu_disable((unsigned int)-1);
+
+  ASSERT(btc_cpu_features() == 0);
+  ASSERT(strcmp(btc_sha512_pbkdf2_backend(), "generic") == 0);
+
+  compute(&slow);
+
+  btc_cpu_disable(0);
+
+  ASSERT(btc_cpu_features() == btc_cpu_detected());
+
+  ASSERT(memcmp(&fast, &slow, sizeof(fast)) == 0);
+  ASSERT(memcmp(fast.unhex, data, sizeof(data)) == 0);
+}
+
+int
+main(void) {
+  test_cpu_names();
+  test_cpu_dispatch();
+  return 0;
+}
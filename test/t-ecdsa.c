@@ -257,6 +257,99 @@ test_ecdsa_random(void) {
   }
 }
 
+static void
+test_ecdsa_batch(void) {
+  unsigned char msgs[20][32];
+  unsigned char sigs[20][64];
+  unsigned char pubs[20][65];
+  const unsigned char *msgp[20];
+  const unsigned char *sigp[20];
+  const unsigned char *pubp[20];
+  size_t msg_lens[20];
+  size_t pub_lens[20];
+  btc_drbg_t rng;
+  size_t i;
+
+  btc_drbg_init(&rng, NULL, 0);
+
+  /* More than two chunks, mixing key encodings. */
+  for (i = 0; i < lengthof(msgs); i++) {
+    unsigned char priv[32];
+
+    btc_drbg_generate(&rng, priv, sizeof(priv));
+    btc_drbg_generate(&rng, msgs[i], 32);
+
+    priv[0] &= 0x7f;
+
+    pub_lens[i] = (i & 1) ? 65 : 33;
+
+    ASSERT(btc_ecdsa_sign(sigs[i], NULL, msgs[i], 32, priv));
+    ASSERT(btc_ecdsa_pubkey_create(pubs[i], priv, pub_lens[i] == 33));
+
+    msgp[i] = msgs[i];
+    sigp[i] = sigs[i];
+    pubp[i] = pubs[i];
+    msg_lens[i] = 32;
+  }
+
+  for (i = 0; i <= lengthof(msgs); i++)
+    ASSERT(btc_ecdsa_verify_batch(msgp, msg_lens, sigp, pubp, pub_lens, i));
+
+  for (i = 0; i < lengthof(msgs); i++) {
+    msgs[i][i] ^= 1;
+
+    ASSERT(!btc_ecdsa_verify_batch(msgp, msg_lens, sigp, pubp,
+                                   pub_lens, lengthof(msgs)));
+
+    msgs[i][i] ^= 1;
+  }
+}
+
+static void
+test_ecdsa_precomp(void) {
+  unsigned char entropy[32];
+  btc_precomp_t *pre;
+  btc_drbg_t rng;
+  int i;
+
+  btc_drbg_init(&rng, NULL, 0);
+  btc_drbg_generate(&rng, entropy, sizeof(entropy));
+
+  pre = btc_precomp_create(entropy);
+
+  /* Nonces are deterministic: the table must not change the result. */
+  for (i = 0; i < 100; i++) {
+    unsigned char priv[32];
+    unsigned char msg[32];
+    unsigned char sig1[64];
+    unsigned char sig2[64];
+    unsigned int param1, param2;
+
+    btc_drbg_generate(&rng, priv, sizeof(priv));
+    btc_drbg_generate(&rng, msg, sizeof(msg));
+
+    priv[0] &= 0x7f;
+
+    if (i == 0) {
+      memset(priv, 0, 32);
+      priv[31] = 1;
+    }
+
+    if (i % 10 == 9) {
+      btc_drbg_generate(&rng, entropy, sizeof(entropy));
+      btc_precomp_randomize(pre, entropy);
+    }
+
+    ASSERT(btc_ecdsa_sign(sig1, &param1, msg, 32, priv));
+    ASSERT(btc_ecdsa_sign_precomp(sig2, &param2, msg, 32, priv, pre));
+
+    ASSERT(memcmp(sig1, sig2, 64) == 0);
+    ASSERT(param1 == param2);
+  }
+
+  btc_precomp_destroy(pre);
+}
+
 static void
 test_ecdsa_svdw(void) {
   static const unsigned char bytes[32] = {
@@ -286,6 +379,8 @@ test_ecdsa_svdw(void) {
 int main(void) {
   test_ecdsa_vectors();
   test_ecdsa_random();
+  test_ecdsa_batch();
+  test_ecdsa_precomp();
   test_ecdsa_svdw();
   return 0;
 }
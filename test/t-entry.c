@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-entry.c - entry test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,126 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/block.h>
+#include <mako/consensus.h>
+#include <mako/entry.h>
+#include <mako/tx.h>
 #include "lib/tests.h"
 
-int main(void) {
+#define CHAIN_LENGTH 5000
+
+static btc_entry_t chain[CHAIN_LENGTH];
+static btc_entry_t fork[100];
+
+static void
+link_entry(btc_entry_t *entry, btc_entry_t *prev) {
+  btc_entry_init(entry);
+
+  entry->height = prev != NULL ? prev->height + 1 : 0;
+  entry->prev = prev;
+
+  btc_entry_build_skip(entry);
+}
+
+static void
+test_ancestor(void) {
+  int32_t i, j;
+
+  for (i = 0; i < CHAIN_LENGTH; i++)
+    link_entry(&chain[i], i > 0 ? &chain[i - 1] : NULL);
+
+  ASSERT(chain[0].skip == NULL);
+
+  for (i = 1; i < CHAIN_LENGTH; i++) {
+    ASSERT(chain[i].skip != NULL);
+    ASSERT(chain[i].skip->height < i);
+    ASSERT(chain[i].skip == &chain[chain[i].skip->height]);
+  }
+
+  for (i = 0; i < CHAIN_LENGTH; i += 7) {
+    for (j = 0; j <= i; j += 13)
+      ASSERT(btc_entry_get_ancestor(&chain[i], j) == &chain[j]);
+
+    ASSERT(btc_entry_get_ancestor(&chain[i], i) == &chain[i]);
+    ASSERT(btc_entry_get_ancestor(&chain[i], i + 1) == NULL);
+    ASSERT(btc_entry_get_ancestor(&chain[i], -1) == NULL);
+  }
+
+  /* A side chain forking off at 4000. */
+  for (i = 0; i < 100; i++)
+    link_entry(&fork[i], i > 0 ? &fork[i - 1] : &chain[4000]);
+
+  for (j = 0; j <= 4100; j++) {
+    const btc_entry_t *entry = btc_entry_get_ancestor(&fork[99], j);
+
+    if (j <= 4000)
+      ASSERT(entry == &chain[j]);
+    else
+      ASSERT(entry == &fork[j - 4001]);
+  }
+}
+
+static int
+cmptime(const void *x, const void *y) {
+  int64_t a = *((const int64_t *)x);
+  int64_t b = *((const int64_t *)y);
+  return (a > b) - (a < b);
+}
+
+static void
+test_metadata(void) {
+  uint8_t raw[BTC_ENTRY_SIZE];
+  int64_t tvec[BTC_MEDIAN_TIMESPAN];
+  uint64_t total = 0;
+  btc_block_t block;
+  btc_entry_t copy;
+  int32_t i, j;
+  int len;
+
+  for (i = 0; i < 100; i++) {
+    btc_entry_t *prev = i > 0 ? &chain[i - 1] : NULL;
+
+    btc_block_init(&block);
+
+    /* Timestamps out of order. */
+    block.header.time = 1000 + ((i * 7919) % 97);
+    block.header.bits = 0x207fffff;
+
+    for (j = 0; j <= i % 5; j++)
+      btc_txvec_push(&block.txs, btc_tx_create());
+
+    btc_entry_set_block(&chain[i], &block, prev);
+
+    total += block.txs.length;
+
+    ASSERT(chain[i].tx_count == block.txs.length);
+    ASSERT(chain[i].chain_tx == total);
+
+    len = 0;
+
+    for (j = i; j >= 0 && len < BTC_MEDIAN_TIMESPAN; j--)
+      tvec[len++] = chain[j].header.time;
+
+    qsort(tvec, len, sizeof(int64_t), cmptime);
+
+    ASSERT(btc_entry_median_time(&chain[i]) == tvec[len >> 1]);
+
+    btc_block_clear(&block);
+  }
+
+  btc_entry_export(raw, &chain[99]);
+
+  ASSERT(btc_entry_size(&chain[99]) == BTC_ENTRY_SIZE);
+  ASSERT(btc_entry_import(&copy, raw, sizeof(raw)));
+
+  ASSERT(copy.median_time == chain[99].median_time);
+  ASSERT(copy.tx_count == chain[99].tx_count);
+  ASSERT(copy.chain_tx == chain[99].chain_tx);
+}
+
+int
+main(void) {
+  test_ancestor();
+  test_metadata();
   return 0;
 }
@@ -0,0 +1,92 @@
+/*!
+ * t-fec.c - erasure coding test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/fec.h>
+#include "lib/tests.h"
+
+static uint32_t g_seed = 1;
+
+static uint32_t
+next_rand(void) {
+  g_seed = g_seed * 1103515245 + 12345;
+  return g_seed >> 8;
+}
+
+static void
+test_fec(size_t k, size_t m, size_t size, size_t lose) {
+  uint8_t *shards[BTC_FEC_MAX_SHARDS];
+  uint8_t present[BTC_FEC_MAX_SHARDS];
+  uint8_t *data = malloc(k * size);
+  uint8_t *buf = malloc((k + m) * size);
+  size_t i, lost = 0;
+
+  ASSERT(data != NULL && buf != NULL);
+
+  for (i = 0; i < k * size; i++)
+    data[i] = next_rand() & 0xff;
+
+  for (i = 0; i < k + m; i++)
+    shards[i] = buf + i * size;
+
+  memcpy(buf, data, k * size);
+
+  btc_fec_encode(shards, k, m, size);
+
+  /* Systematic: the data shards are untouched. */
+  ASSERT(memcmp(buf, data, k * size) == 0);
+
+  memset(present, 1, sizeof(present));
+
+  while (lost < lose) {
+    i = next_rand() % (k + m);
+
+    if (present[i]) {
+      present[i] = 0;
+      memset(shards[i], 0xaa, size);
+      lost++;
+    }
+  }
+
+  if (lose > m) {
+    /* Only fails if a data shard went missing. */
+    for (i = 0; i < k; i++) {
+      if (!present[i])
+        break;
+    }
+
+    ASSERT(btc_fec_decode(shards, present, k, m, size) == (i == k));
+  } else {
+    ASSERT(btc_fec_decode(shards, present, k, m, size));
+    ASSERT(memcmp(buf, data, k * size) == 0);
+  }
+
+  free(data);
+  free(buf);
+}
+
+int
+main(void) {
+  size_t i;
+
+  test_fec(1, 0, 100, 0);
+  test_fec(1, 1, 100, 1);
+  test_fec(4, 2, 37, 2);
+  test_fec(20, 10, 1152, 10);
+  test_fec(20, 10, 1152, 11);
+  test_fec(200, 55, 64, 55);
+
+  for (i = 0; i < 50; i++) {
+    size_t k = 1 + next_rand() % 40;
+    size_t m = next_rand() % 20;
+
+    test_fec(k, m, 1 + next_rand() % 300, next_rand() % (m + 1));
+  }
+
+  return 0;
+}
@@ -0,0 +1,111 @@
+/*!
+ * t-fees.c - fee estimation test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <node/fees.h>
+#include <mako/block.h>
+#include <mako/policy.h>
+#include <mako/tx.h>
+#include "lib/tests.h"
+
+#define BLOCKS 300
+#define FAST_RATE 20000
+#define SLOW_RATE 2000
+#define SLOW_DELAY 10
+
+static btc_tx_t *
+create_tx(uint32_t seed) {
+  btc_tx_t *tx = btc_tx_create();
+  btc_input_t *input = btc_input_create();
+
+  input->prevout.index = seed;
+
+  btc_inpvec_push(&tx->inputs, input);
+  btc_tx_refresh(tx);
+
+  return tx;
+}
+
+static void
+test_estimate(void) {
+  btc_block_t *blocks[BLOCKS + SLOW_DELAY];
+  btc_fees_t *fees = btc_fees_create();
+  uint32_t seed = 0;
+  int32_t height;
+  int i, blks;
+
+  printf("fees estimate\n");
+
+  for (i = 0; i < (int)lengthof(blocks); i++) {
+    blocks[i] = btc_block_create();
+    btc_txvec_push(&blocks[i]->txs, btc_tx_create());
+  }
+
+  /* No data yet. */
+  ASSERT(btc_fees_estimate(fees, 1) == -1);
+  ASSERT(btc_fees_estimate_smart(fees, 1, &blks) == -1);
+  ASSERT(blks == BTC_FEES_MAX_TARGET);
+
+  btc_fees_add_block(fees, 0, blocks[0]);
+
+  /* Half the txs confirm in the next block,
+     the other half sit for several blocks. */
+  for (height = 1; height < BLOCKS; height++) {
+    for (i = 0; i < 20; i++) {
+      btc_tx_t *tx = create_tx(seed++);
+
+      if (i & 1) {
+        btc_fees_add_tx(fees, tx->hash, height - 1, FAST_RATE);
+        btc_txvec_push(&blocks[height]->txs, tx);
+      } else {
+        btc_fees_add_tx(fees, tx->hash, height - 1, SLOW_RATE);
+        btc_txvec_push(&blocks[height + SLOW_DELAY - 1]->txs, tx);
+      }
+    }
+
+    btc_fees_add_block(fees, height, blocks[height]);
+  }
+
+  ASSERT(btc_fees_estimate(fees, 1) == FAST_RATE);
+  ASSERT(btc_fees_estimate(fees, SLOW_DELAY - 1) == FAST_RATE);
+  ASSERT(btc_fees_estimate(fees, SLOW_DELAY) == SLOW_RATE);
+  ASSERT(btc_fees_estimate(fees, BTC_FEES_MAX_TARGET) == SLOW_RATE);
+  ASSERT(btc_fees_estimate(fees, 0) == -1);
+  ASSERT(btc_fees_estimate(fees, BTC_FEES_MAX_TARGET + 1) == -1);
+
+  ASSERT(btc_fees_estimate_smart(fees, 100, &blks) == SLOW_RATE);
+  ASSERT(blks == BTC_FEES_MAX_TARGET);
+
+  /* Replaying an old block changes nothing. */
+  btc_fees_add_block(fees, 5, blocks[5]);
+
+  ASSERT(btc_fees_estimate(fees, 1) == FAST_RATE);
+
+  /* Removed txs are forgotten. */
+  {
+    btc_tx_t *tx = create_tx(seed++);
+
+    btc_fees_add_tx(fees, tx->hash, height - 1, FAST_RATE);
+
+    ASSERT(btc_fees_remove_tx(fees, tx->hash));
+    ASSERT(!btc_fees_remove_tx(fees, tx->hash));
+
+    btc_tx_destroy(tx);
+  }
+
+  for (i = 0; i < (int)lengthof(blocks); i++)
+    btc_block_destroy(blocks[i]);
+
+  btc_fees_destroy(fees);
+}
+
+int main(void) {
+  test_estimate();
+  return 0;
+}
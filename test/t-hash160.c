@@ -1,14 +1,106 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-hash160.c - hash160 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/hash.h>
 #include "lib/tests.h"
 
-int main(void) {
+static void
+test_hash160_vector(void) {
+  /* The generator point, compressed. */
+  static const char *pub_hex =
+    "0279be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798";
+  static const char *expect_hex = "751e76e8199196d454941c45d1b3a323f1433bd6";
+  uint8_t pub[33], expect[20], out[20];
+
+  printf("hash160 vector\n");
+
+  hex_parse(pub, 33, pub_hex);
+  hex_parse(expect, 20, expect_hex);
+
+  btc_hash160(out, pub, 33);
+
+  ASSERT(memcmp(out, expect, 20) == 0);
+
+  btc_hash160_many(out, pub, 33, 1);
+
+  ASSERT(memcmp(out, expect, 20) == 0);
+}
+
+static void
+test_hash160_many(void) {
+  /* Keys, script hashes and both sides of every block boundary. */
+  static const size_t lens[] = { 0, 20, 32, 33, 55, 56, 64, 65, 119, 120 };
+  static uint8_t in[120 * 37];
+  static uint8_t out[32 * 37];
+  uint8_t expect[32];
+  size_t i, j, n, len;
+
+  printf("hash160 many\n");
+
+  for (i = 0; i < sizeof(in); i++)
+    in[i] = (uint8_t)(i * 11 + 7);
+
+  for (i = 0; i < lengthof(lens); i++) {
+    len = lens[i];
+
+    for (n = 0; n <= 37; n++) {
+      memset(out, 0, sizeof(out));
+
+      btc_sha256_many(out, in, len, n);
+
+      for (j = 0; j < n; j++) {
+        btc_sha256(expect, in + j * len, len);
+
+        ASSERT(memcmp(out + j * 32, expect, 32) == 0);
+      }
+
+      btc_ripemd160_many(out, in, len, n);
+
+      for (j = 0; j < n; j++) {
+        btc_ripemd160(expect, in + j * len, len);
+
+        ASSERT(memcmp(out + j * 20, expect, 20) == 0);
+      }
+
+      btc_hash160_many(out, in, len, n);
+
+      for (j = 0; j < n; j++) {
+        btc_hash160(expect, in + j * len, len);
+
+        ASSERT(memcmp(out + j * 20, expect, 20) == 0);
+      }
+    }
+  }
+
+  /* More than one internal chunk. */
+  {
+    static uint8_t keys[65 * 150];
+    static uint8_t hashes[20 * 150];
+
+    for (i = 0; i < sizeof(keys); i++)
+      keys[i] = (uint8_t)(i * 3 + 1);
+
+    btc_hash160_many(hashes, keys, 65, 150);
+
+    for (j = 0; j < 150; j++) {
+      btc_hash160(expect, keys + j * 65, 65);
+
+      ASSERT(memcmp(hashes + j * 20, expect, 20) == 0);
+    }
+  }
+}
+
+int
+main(void) {
+  test_hash160_vector();
+  test_hash160_many();
   return 0;
 }
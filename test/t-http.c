@@ -32,10 +32,45 @@ get_recv(btc_mutex_t *lock) {
   return value;
 }
 
+#define STREAM_PIECE 4096
+#define STREAM_PIECES 1024 /* 4mb */
+
+static int g_freed = 0;
+
+static int
+on_stream(http_res_t *res, void *arg) {
+  int *count = arg;
+  char piece[STREAM_PIECE];
+
+  memset(piece, 'a' + (*count % 26), sizeof(piece));
+
+  ASSERT(http_res_chunk(res, piece, sizeof(piece)));
+
+  return ++*count < STREAM_PIECES;
+}
+
+static void
+on_stream_free(void *arg) {
+  free(arg);
+  g_freed = 1;
+}
+
 static int
 on_request(http_server_t *server, http_req_t *req, http_res_t *res) {
   (void)server;
 
+  if (strcmp(req->path.data, "/stream") == 0) {
+    int *count = malloc(sizeof(int));
+
+    ASSERT(count != NULL);
+
+    *count = 0;
+
+    http_res_stream(res, 200, "text/plain", on_stream, on_stream_free, count);
+
+    return 1;
+  }
+
   ASSERT(req->method == HTTP_METHOD_GET);
   ASSERT(strcmp(req->path.data, "/") == 0);
   ASSERT(req->headers.length == 3);
@@ -79,6 +114,54 @@ send_request(void *lock) {
 
   http_msg_destroy(msg);
 
+  msg = http_get("localhost", 1337, "/stream", BTC_AF_INET);
+
+  ASSERT(msg != NULL);
+  ASSERT(msg->status == 200);
+  ASSERT(msg->headers.length == 4);
+
+  ASSERT(strcmp(msg->headers.items[2]->field.data, "transfer-encoding") == 0);
+  ASSERT(strcmp(msg->headers.items[2]->value.data, "chunked") == 0);
+
+  ASSERT(msg->body.length == STREAM_PIECE * STREAM_PIECES);
+
+  {
+    size_t i;
+
+    for (i = 0; i < msg->body.length; i++)
+      ASSERT(msg->body.data[i] == 'a' + (int)((i / STREAM_PIECE) % 26));
+  }
+
+  http_msg_destroy(msg);
+
+  /* One connection for several requests. */
+  {
+    http_client_t *client = http_client_create();
+    http_options_t options;
+    int i;
+
+    http_options_init(&options);
+
+    ASSERT(http_client_open(client, "localhost", 1337, BTC_AF_INET));
+
+    for (i = 0; i < 4; i++) {
+      /* Force a reconnect for the last one. */
+      if (i == 3)
+        http_client_set_idle(client, -1);
+
+      msg = http_client_request(client, &options);
+
+      ASSERT(msg != NULL);
+      ASSERT(msg->status == 200);
+      ASSERT(strcmp(msg->body.data, "Hello world\n") == 0);
+
+      http_msg_destroy(msg);
+    }
+
+    http_client_close(client);
+    http_client_destroy(client);
+  }
+
   set_recv(lock, 1);
 }
 
@@ -107,7 +190,7 @@ int main(void) {
   while (!get_recv(lock)) {
     ASSERT(btc_time_msec() < start + 10 * 1000);
 
-    btc_loop_poll(loop, 1000);
+    btc_loop_poll(loop, 10);
   }
 
   btc_thread_join(thread);
@@ -123,6 +206,7 @@ int main(void) {
 
   ASSERT(g_sent == 1);
   ASSERT(g_recv == 1);
+  ASSERT(g_freed == 1);
 
   btc_net_cleanup();
 
@@ -0,0 +1,114 @@
+/*!
+ * t-logger.c - logger test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <node/logger.h>
+#include "lib/tests.h"
+
+static void
+test_log(btc_logger_t *logger,
+         enum btc_log_level level,
+         const char *pre,
+         const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  btc_logger_log(logger, level, pre, fmt, ap);
+  va_end(ap);
+}
+
+static void
+test_filter(void) {
+  btc_logger_t *logger = btc_logger_create();
+
+  ASSERT(btc_logger_enabled(NULL, BTC_LOG_INFO, "chain"));
+  ASSERT(!btc_logger_enabled(NULL, BTC_LOG_DEBUG, "chain"));
+
+  ASSERT(btc_logger_enabled(logger, BTC_LOG_ERROR, "chain"));
+  ASSERT(btc_logger_enabled(logger, BTC_LOG_INFO, "chain"));
+  ASSERT(!btc_logger_enabled(logger, BTC_LOG_DEBUG, "chain"));
+
+  btc_logger_set_debug(logger, "mempool,chain");
+
+  ASSERT(btc_logger_enabled(logger, BTC_LOG_DEBUG, "chain"));
+  ASSERT(btc_logger_enabled(logger, BTC_LOG_DEBUG, "mempool"));
+  ASSERT(!btc_logger_enabled(logger, BTC_LOG_DEBUG, "pool"));
+  ASSERT(!btc_logger_enabled(logger, BTC_LOG_SPAM, "chain"));
+
+  btc_logger_set_debug(logger, "all");
+
+  ASSERT(btc_logger_enabled(logger, BTC_LOG_DEBUG, "pool"));
+
+  btc_logger_set_debug(logger, "");
+  btc_logger_set_level(logger, BTC_LOG_WARNING);
+
+  ASSERT(btc_logger_enabled(logger, BTC_LOG_WARNING, "chain"));
+  ASSERT(!btc_logger_enabled(logger, BTC_LOG_INFO, "chain"));
+
+  btc_logger_set_level(logger, BTC_LOG_SPAM);
+
+  ASSERT(btc_logger_enabled(logger, BTC_LOG_SPAM, "chain"));
+
+  btc_logger_destroy(logger);
+}
+
+static void
+test_flush(const char *file) {
+  btc_logger_t *logger = btc_logger_create();
+  static char buf[1 << 16];
+  FILE *stream;
+  size_t len;
+  int i;
+
+  btc_logger_set_silent(logger, 1);
+  btc_logger_set_debug(logger, "chain");
+
+  ASSERT(btc_logger_open(logger, file));
+
+  for (i = 0; i < 1000; i++)
+    test_log(logger, BTC_LOG_INFO, "node", "line %d", i);
+
+  test_log(logger, BTC_LOG_DEBUG, "chain", "shown");
+  test_log(logger, BTC_LOG_DEBUG, "pool", "hidden");
+
+  /* Everything queued is written out on close. */
+  btc_logger_close(logger);
+  btc_logger_destroy(logger);
+
+  stream = fopen(file, "rb");
+
+  ASSERT(stream != NULL);
+
+  len = fread(buf, 1, sizeof(buf) - 1, stream);
+
+  fclose(stream);
+
+  buf[len] = '\0';
+
+  ASSERT(strncmp(buf, "[node] line 0\n", 14) == 0);
+  ASSERT(strstr(buf, "[node] line 999\n[chain] shown\n") != NULL);
+  ASSERT(strstr(buf, "hidden") == NULL);
+}
+
+int
+main(void) {
+  char file[BTC_PATH_MAX];
+
+  ASSERT(btc_fs_mkdirp(BTC_PREFIX, 0755));
+  ASSERT(btc_path_join(file, sizeof(file), BTC_PREFIX, "debug.log", 0));
+
+  btc_fs_unlink(file);
+
+  test_filter();
+  test_flush(file);
+
+  btc_clean(BTC_PREFIX);
+
+  return 0;
+}
@@ -1,14 +1,301 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-loop.c - event loop test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <io/core.h>
+#include <io/loop.h>
 #include "lib/tests.h"
 
+/* Enough to overflow the socket buffer and
+   split the queue across several writes. */
+#define CHUNKS 5000
+#define TOTAL (CHUNKS * 1024)
+
+static unsigned char g_data[TOTAL];
+static size_t g_recv = 0;
+static int g_closed = 0;
+static int g_shared = 0;
+static int g_freed = 0;
+static int g_ticks = 0;
+static int g_order = 0;
+static int g_file = -1;
+
+typedef struct ttimer_s {
+  btc_timer_t *timer;
+  int64_t delay;
+  int64_t due;
+  int fired;
+  int order;
+  int repeat;
+} ttimer_t;
+
+static int
+on_data(btc_socket_t *socket, const void *data, size_t size) {
+  (void)socket;
+
+  ASSERT(g_recv + size <= TOTAL);
+  ASSERT(memcmp(g_data + g_recv, data, size) == 0);
+
+  g_recv += size;
+
+  return 1;
+}
+
+static void
+on_free(void *arg) {
+  ASSERT(arg == &g_shared);
+  g_freed++;
+}
+
+static void
+on_close(btc_socket_t *socket) {
+  (void)socket;
+  g_closed++;
+}
+
+static void
+on_error(btc_socket_t *socket) {
+  fprintf(stderr, "%s\n", btc_socket_strerror(socket));
+  ASSERT(0);
+}
+
+static void
+on_socket(btc_socket_t *server, btc_socket_t *socket) {
+  (void)server;
+
+  btc_socket_on_data(socket, on_data);
+  btc_socket_on_close(socket, on_close);
+  btc_socket_on_error(socket, on_error);
+}
+
+static void
+on_connect(btc_socket_t *socket) {
+  size_t pos = 0;
+  size_t i, len;
+  void *copy;
+
+  /* Mix owned, borrowed, shared and
+     file chunks of varying sizes. */
+  for (i = 0; pos < TOTAL; i++) {
+    len = 1 + (i * 7919) % 2047;
+
+    if (len > TOTAL - pos)
+      len = TOTAL - pos;
+
+    if (i % 4 == 3) {
+      ASSERT(btc_socket_write_file(socket, g_file, pos, len,
+                                   on_free, &g_shared) != -1);
+      g_shared++;
+    } else if (i % 4 == 0) {
+      copy = malloc(len);
+
+      ASSERT(copy != NULL);
+
+      memcpy(copy, g_data + pos, len);
+
+      ASSERT(btc_socket_write(socket, copy, len) != -1);
+    } else if (i % 4 == 1) {
+      ASSERT(btc_socket_write_static(socket, g_data + pos, len) != -1);
+    } else {
+      ASSERT(btc_socket_write_shared(socket, g_data + pos, len,
+                                     on_free, &g_shared) != -1);
+      g_shared++;
+    }
+
+    pos += len;
+  }
+}
+
+static void
+on_tick(void *arg) {
+  (void)arg;
+  g_ticks++;
+}
+
+static void
+wake_thread(void *arg) {
+  btc_time_sleep(50);
+  btc_loop_wakeup(arg);
+}
+
+static void
+test_wakeup(void) {
+  btc_loop_t *loop = btc_loop_create();
+  btc_thread_t *thread = btc_thread_alloc();
+  int64_t start;
+
+  btc_loop_on_tick(loop, on_tick, NULL);
+
+  /* Another thread cuts a long wait short. */
+  start = btc_time_msec();
+
+  btc_thread_create(thread, wake_thread, loop);
+  btc_loop_poll(loop, 10 * 1000);
+  btc_thread_join(thread);
+
+  ASSERT(btc_time_msec() < start + 5 * 1000);
+  ASSERT(g_ticks == 1);
+
+  /* Wakeups coalesce and are drained. */
+  btc_loop_wakeup(loop);
+  btc_loop_wakeup(loop);
+  btc_loop_poll(loop, 0);
+
+  start = btc_time_msec();
+
+  btc_loop_poll(loop, 50);
+
+  ASSERT(btc_time_msec() >= start + 25);
+  ASSERT(g_ticks == 3);
+
+  btc_thread_free(thread);
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+}
+
+static void
+on_timer(void *arg) {
+  ttimer_t *t = arg;
+
+  ASSERT(!btc_timer_active(t->timer));
+  ASSERT(btc_time_msec() >= t->due);
+
+  t->fired++;
+  t->order = g_order++;
+
+  if (t->fired < t->repeat) {
+    t->due = btc_time_msec() + t->delay;
+    btc_timer_start(t->timer, t->delay);
+  }
+}
+
+static void
+test_timers(void) {
+  static const int64_t delays[] = {0, 10, 100, 300, 200};
+  btc_loop_t *loop = btc_loop_create();
+  ttimer_t timers[5];
+  int64_t start;
+  size_t i;
+
+  for (i = 0; i < lengthof(timers); i++) {
+    ttimer_t *t = &timers[i];
+
+    t->timer = btc_timer_create(loop, on_timer, t);
+    t->delay = delays[i];
+    t->due = btc_time_msec() + t->delay;
+    t->fired = 0;
+    t->order = -1;
+    t->repeat = 1;
+
+    btc_timer_start(t->timer, t->delay);
+
+    ASSERT(btc_timer_active(t->timer));
+  }
+
+  /* Re-arms itself: 10, 20, 30ms. */
+  timers[1].repeat = 3;
+
+  /* Stopped before it fires. */
+  btc_timer_stop(timers[4].timer);
+
+  ASSERT(!btc_timer_active(timers[4].timer));
+  ASSERT(btc_timer_expires(timers[4].timer) == -1);
+
+  start = btc_time_msec();
+
+  while (timers[3].fired == 0) {
+    ASSERT(btc_time_msec() < start + 10 * 1000);
+    btc_loop_poll(loop, 5);
+  }
+
+  ASSERT(timers[0].fired == 1);
+  ASSERT(timers[1].fired == 3);
+  ASSERT(timers[2].fired == 1);
+  ASSERT(timers[3].fired == 1);
+  ASSERT(timers[4].fired == 0);
+
+  ASSERT(timers[0].order < timers[1].order);
+  ASSERT(timers[1].order < timers[2].order);
+  ASSERT(timers[2].order < timers[3].order);
+
+  for (i = 0; i < lengthof(timers); i++)
+    btc_timer_destroy(timers[i].timer);
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+}
+
 int main(void) {
+  btc_socket_t *server, *client;
+  btc_sockaddr_t addr;
+  btc_loop_t *loop;
+  int64_t start;
+  size_t i;
+
+  btc_net_startup();
+
+  for (i = 0; i < TOTAL; i++)
+    g_data[i] = (i * 31 + (i >> 11)) & 0xff;
+
+  btc_clean(BTC_PREFIX);
+
+  ASSERT(btc_fs_mkdirp(BTC_PREFIX, 0755));
+  ASSERT(btc_fs_write_file(BTC_PREFIX "/loop.dat", 0644, g_data, TOTAL));
+
+  g_file = btc_fs_open(BTC_PREFIX "/loop.dat", BTC_O_RDONLY, 0);
+
+  ASSERT(g_file != -1);
+
+  ASSERT(btc_sockaddr_import(&addr, "127.0.0.1", 1338));
+
+  loop = btc_loop_create();
+
+  server = btc_loop_listen(loop, &addr);
+
+  ASSERT(server != NULL);
+
+  btc_socket_on_socket(server, on_socket);
+  btc_socket_on_close(server, on_close);
+  btc_socket_on_error(server, on_error);
+
+  client = btc_loop_connect(loop, &addr);
+
+  ASSERT(client != NULL);
+
+  btc_socket_on_connect(client, on_connect);
+  btc_socket_on_close(client, on_close);
+  btc_socket_on_error(client, on_error);
+
+  start = btc_time_msec();
+
+  while (g_recv < TOTAL) {
+    ASSERT(btc_time_msec() < start + 10 * 1000);
+
+    btc_loop_poll(loop, 100);
+  }
+
+  ASSERT(btc_socket_buffered(client) == 0);
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+
+  ASSERT(g_recv == TOTAL);
+  ASSERT(g_closed == 3);
+  ASSERT(g_freed == g_shared);
+
+  btc_fs_close(g_file);
+  btc_clean(BTC_PREFIX);
+
+  test_wakeup();
+  test_timers();
+
+  btc_net_cleanup();
+
   return 0;
 }
@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-map.c - map test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,221 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/drbg.h>
+#include <mako/map.h>
+#include <mako/tx.h>
+#include <mako/util.h>
 #include "lib/tests.h"
 
-int main(void) {
+#define NUM_KEYS 20000
+
+static uint8_t keys[NUM_KEYS][32];
+static int live[NUM_KEYS];
+
+static void
+test_hashmap(btc_drbg_t *rng) {
+  btc_hashmap_t *map = btc_hashmap_create();
+  btc_hashmapiter_t iter;
+  size_t i, size = 0;
+  int round;
+
+  for (i = 0; i < NUM_KEYS; i++) {
+    btc_drbg_generate(rng, keys[i], 32);
+
+    /* Block hashes end in zeroes. */
+    if (i & 1)
+      memset(keys[i] + 24, 0, 8);
+
+    live[i] = 0;
+  }
+
+  ASSERT(btc_hashmap_size(map) == 0);
+  ASSERT(btc_hashmap_get(map, keys[0]) == NULL);
+  ASSERT(btc_hashmap_del(map, keys[0]) == NULL);
+
+  /* Churn: insertions and deletions leave tombstones behind. */
+  for (round = 0; round < 4; round++) {
+    for (i = 0; i < NUM_KEYS; i++) {
+      uint8_t r;
+
+      btc_drbg_generate(rng, &r, 1);
+
+      if (r & 1) {
+        int ret = btc_hashmap_put(map, keys[i], &live[i]);
+
+        ASSERT(ret == !live[i]);
+
+        if (ret) {
+          live[i] = 1;
+          size++;
+        }
+      } else if (live[i] && (r & 2)) {
+        ASSERT(btc_hashmap_del(map, keys[i]) == keys[i]);
+        live[i] = 0;
+        size--;
+      }
+    }
+
+    ASSERT(btc_hashmap_size(map) == size);
+
+    for (i = 0; i < NUM_KEYS; i++) {
+      ASSERT(btc_hashmap_has(map, keys[i]) == live[i]);
+
+      if (live[i])
+        ASSERT(btc_hashmap_get(map, keys[i]) == &live[i]);
+    }
+  }
+
+  btc_hashmap_resize(map, NUM_KEYS * 4);
+
+  ASSERT(btc_hashmap_buckets(map) >= NUM_KEYS * 4);
+  ASSERT(btc_hashmap_size(map) == size);
+
+  i = 0;
+
+  btc_hashmap_iterate(&iter, map);
+
+  while (btc_hashmap_next(&iter)) {
+    ASSERT(*((int *)iter.val) == 1);
+    ASSERT(iter.val == btc_hashmap_get(map, iter.key));
+    i++;
+  }
+
+  ASSERT(i == size);
+
+  for (i = 0; i < NUM_KEYS; i++) {
+    if (live[i])
+      ASSERT(btc_hashmap_rem(map, keys[i]) == &live[i]);
+
+    ASSERT(!btc_hashmap_has(map, keys[i]));
+  }
+
+  ASSERT(btc_hashmap_size(map) == 0);
+
+  btc_hashmap_destroy(map);
+}
+
+static void
+test_hashset(void) {
+  btc_hashset_t *set = btc_hashset_create();
+  size_t i;
+
+  for (i = 0; i < NUM_KEYS; i++)
+    ASSERT(btc_hashset_put(set, keys[i]));
+
+  for (i = 0; i < NUM_KEYS; i++)
+    ASSERT(!btc_hashset_put(set, keys[i]));
+
+  ASSERT(btc_hashset_size(set) == NUM_KEYS);
+
+  btc_hashset_reset(set);
+
+  ASSERT(btc_hashset_size(set) == 0);
+
+  for (i = 0; i < NUM_KEYS; i++)
+    ASSERT(!btc_hashset_has(set, keys[i]));
+
+  btc_hashset_destroy(set);
+}
+
+static void
+test_outmap(void) {
+  static btc_outpoint_t outs[NUM_KEYS];
+  btc_outmap_t *map = btc_outmap_create();
+  size_t i;
+
+  /* Many outputs per txid, as with spents. */
+  for (i = 0; i < NUM_KEYS; i++)
+    btc_outpoint_set(&outs[i], keys[i / 16], i % 16);
+
+  for (i = 0; i < NUM_KEYS; i++)
+    ASSERT(btc_outmap_put(map, &outs[i], &outs[i]));
+
+  for (i = 0; i < NUM_KEYS; i += 2)
+    ASSERT(btc_outmap_del(map, &outs[i]) == &outs[i]);
+
+  for (i = 0; i < NUM_KEYS; i++) {
+    void *val = btc_outmap_get(map, &outs[i]);
+    ASSERT(val == ((i & 1) ? &outs[i] : NULL));
+  }
+
+  ASSERT(btc_outmap_size(map) == NUM_KEYS / 2);
+
+  btc_outmap_destroy(map);
+}
+
+static void
+test_prevmap(void) {
+  btc_prevmap_t *map = btc_prevmap_create();
+  btc_prevmapiter_t iter;
+  btc_outpoint_t key;
+  size_t i, total = 0;
+
+  /* One tx with thousands of outputs beside many small ones. */
+  for (i = 0; i < NUM_KEYS; i++) {
+    if (i < 4000)
+      btc_outpoint_set(&key, keys[0], i);
+    else
+      btc_outpoint_set(&key, keys[i % 1000 + 1], i / 1000);
+
+    ASSERT(btc_prevmap_put(map, &key, &live[i]));
+    ASSERT(!btc_prevmap_put(map, &key, NULL));
+  }
+
+  ASSERT(btc_prevmap_size(map) == NUM_KEYS);
+
+  for (i = 0; i < 4000; i += 3) {
+    btc_outpoint_set(&key, keys[0], i);
+    ASSERT(btc_prevmap_rem(map, &key) == &live[i]);
+    ASSERT(!btc_prevmap_del(map, &key));
+    total++;
+  }
+
+  for (i = 0; i < 4000; i++) {
+    btc_outpoint_set(&key, keys[0], i);
+    ASSERT(btc_prevmap_get(map, &key) == ((i % 3) ? &live[i] : NULL));
+  }
+
+  /* Same txid, other index; same index, other txid. */
+  btc_outpoint_set(&key, keys[0], 4000);
+  ASSERT(!btc_prevmap_has(map, &key));
+  btc_outpoint_set(&key, keys[5000], 1);
+  ASSERT(!btc_prevmap_has(map, &key));
+
+  btc_prevmap_resize(map, NUM_KEYS * 2);
+
+  ASSERT(btc_prevmap_buckets(map) >= NUM_KEYS * 2);
+
+  i = 0;
+
+  btc_prevmap_iterate(&iter, map);
+
+  while (btc_prevmap_next(&iter)) {
+    ASSERT(btc_prevmap_get(map, iter.key) == iter.val);
+    i++;
+  }
+
+  ASSERT(i == NUM_KEYS - total);
+
+  btc_prevmap_reset(map);
+
+  ASSERT(btc_prevmap_size(map) == 0);
+  ASSERT(!btc_prevmap_has(map, iter.key));
+
+  btc_prevmap_destroy(map);
+}
+
+int
+main(void) {
+  static const uint8_t seed[32] = {0x6d, 0x61, 0x70};
+  btc_drbg_t rng;
+
+  btc_drbg_init(&rng, seed, sizeof(seed));
+
+  test_hashmap(&rng);
+  test_hashset();
+  test_outmap();
+  test_prevmap();
+
   return 0;
 }
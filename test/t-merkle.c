@@ -1,14 +1,121 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-merkle.c - merkle test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
+#include <stddef.h>
 #include <stdint.h>
-#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/merkle.h>
 #include "lib/tests.h"
 
-int main(void) {
+static int
+merkle_root_scalar(uint8_t *root, uint8_t *nodes, size_t size) {
+  int malleated = 0;
+  size_t i;
+
+  if (size == 0) {
+    memset(root, 0, 32);
+    return 1;
+  }
+
+  while (size > 1) {
+    for (i = 0; i < size; i += 2) {
+      uint8_t *left = &nodes[i * 32];
+      uint8_t *right = left;
+
+      if (i + 1 < size) {
+        right = &nodes[(i + 1) * 32];
+
+        if (i + 2 == size && memcmp(left, right, 32) == 0)
+          malleated = 1;
+      }
+
+      btc_hash256_root(&nodes[(i / 2) * 32], left, right);
+    }
+
+    size = (size + 1) / 2;
+  }
+
+  memcpy(root, nodes, 32);
+
+  return malleated == 0;
+}
+
+static void
+test_merkle_level(void) {
+  uint8_t nodes[32 * 41];
+  uint8_t out[32 * 21];
+  uint8_t expect[32];
+  size_t i, n;
+
+  printf("merkle level\n");
+
+  for (i = 0; i < 41; i++)
+    btc_hash256(&nodes[i * 32], &i, sizeof(i));
+
+  for (n = 1; n <= 41; n++) {
+    ASSERT(btc_merkle_level(out, nodes, n));
+
+    for (i = 0; i < n; i += 2) {
+      const uint8_t *left = &nodes[i * 32];
+      const uint8_t *right = i + 1 < n ? left + 32 : left;
+
+      btc_hash256_root(expect, left, right);
+
+      ASSERT(memcmp(&out[(i / 2) * 32], expect, 32) == 0);
+    }
+  }
+
+  /* Duplicated trailing pair. */
+  memcpy(&nodes[9 * 32], &nodes[8 * 32], 32);
+
+  ASSERT(!btc_merkle_level(out, nodes, 10));
+  ASSERT(btc_merkle_level(out, nodes, 11));
+}
+
+static void
+test_merkle_root(void) {
+  uint8_t nodes[32 * 67];
+  uint8_t copy[32 * 67];
+  uint8_t root1[32];
+  uint8_t root2[32];
+  size_t i, n;
+
+  printf("merkle root\n");
+
+  for (i = 0; i < 67; i++)
+    btc_hash256(&nodes[i * 32], &i, sizeof(i));
+
+  for (n = 0; n <= 67; n++) {
+    memcpy(copy, nodes, n * 32);
+
+    ASSERT(btc_merkle_root(root1, copy, n) == 1);
+
+    memcpy(copy, nodes, n * 32);
+
+    ASSERT(merkle_root_scalar(root2, copy, n) == 1);
+    ASSERT(memcmp(root1, root2, 32) == 0);
+  }
+
+  /* CVE-2012-2459: [a b c] and [a b c c] share a root. */
+  memcpy(copy, nodes, 3 * 32);
+
+  ASSERT(btc_merkle_root(root1, copy, 3));
+
+  memcpy(copy, nodes, 3 * 32);
+  memcpy(&copy[3 * 32], &nodes[2 * 32], 32);
+
+  ASSERT(!btc_merkle_root(root2, copy, 4));
+  ASSERT(memcmp(root1, root2, 32) == 0);
+}
+
+int
+main(void) {
+  test_merkle_level();
+  test_merkle_root();
   return 0;
 }
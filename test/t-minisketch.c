@@ -0,0 +1,131 @@
+/*!
+ * t-minisketch.c - set sketch test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/minisketch.h>
+#include "lib/tests.h"
+
+static uint32_t g_seed = 1;
+
+static uint32_t
+next_rand(void) {
+  g_seed ^= g_seed << 13;
+  g_seed ^= g_seed >> 17;
+  g_seed ^= g_seed << 5;
+  return g_seed;
+}
+
+static int
+cmp_u32(const void *x, const void *y) {
+  uint32_t a = *((const uint32_t *)x);
+  uint32_t b = *((const uint32_t *)y);
+  return (a > b) - (a < b);
+}
+
+static void
+test_sketch(size_t capacity, size_t shared, size_t diff) {
+  uint32_t *expect = malloc((diff + 1) * sizeof(uint32_t));
+  uint32_t *out = malloc((capacity + 1) * sizeof(uint32_t));
+  btc_minisketch_t a, b;
+  size_t i, len;
+
+  ASSERT(expect != NULL && out != NULL);
+
+  btc_minisketch_init(&a, capacity);
+  btc_minisketch_init(&b, capacity);
+
+  for (i = 0; i < shared; i++) {
+    uint32_t x = next_rand();
+
+    btc_minisketch_add(&a, x);
+    btc_minisketch_add(&b, x);
+  }
+
+  for (i = 0; i < diff; i++) {
+    expect[i] = next_rand();
+
+    if (i & 1)
+      btc_minisketch_add(&a, expect[i]);
+    else
+      btc_minisketch_add(&b, expect[i]);
+  }
+
+  btc_minisketch_merge(&a, &b);
+
+  if (diff > capacity) {
+    ASSERT(!btc_minisketch_decode(out, &len, &a));
+  } else {
+    ASSERT(btc_minisketch_decode(out, &len, &a));
+    ASSERT(len == diff);
+
+    qsort(expect, diff, sizeof(uint32_t), cmp_u32);
+    qsort(out, len, sizeof(uint32_t), cmp_u32);
+
+    ASSERT(memcmp(out, expect, diff * sizeof(uint32_t)) == 0);
+  }
+
+  btc_minisketch_clear(&a);
+  btc_minisketch_clear(&b);
+
+  free(expect);
+  free(out);
+}
+
+static void
+test_serialize(void) {
+  uint8_t raw[16 * 4];
+  btc_minisketch_t a, b;
+  uint32_t out[16];
+  size_t i, len;
+
+  btc_minisketch_init(&a, 16);
+  btc_minisketch_init(&b, 0);
+
+  for (i = 0; i < 10; i++)
+    btc_minisketch_add(&a, 1000 + i);
+
+  ASSERT(btc_minisketch_size(&a) == sizeof(raw));
+  ASSERT(btc_minisketch_write(raw, &a) == raw + sizeof(raw));
+
+  ASSERT(!btc_minisketch_import(&b, raw, sizeof(raw) - 1));
+  ASSERT(btc_minisketch_import(&b, raw, sizeof(raw)));
+  ASSERT(b.capacity == 16);
+  ASSERT(memcmp(a.items, b.items, sizeof(raw)) == 0);
+
+  ASSERT(btc_minisketch_decode(out, &len, &b));
+  ASSERT(len == 10);
+
+  qsort(out, len, sizeof(uint32_t), cmp_u32);
+
+  for (i = 0; i < 10; i++)
+    ASSERT(out[i] == 1000 + i);
+
+  btc_minisketch_clear(&a);
+  btc_minisketch_clear(&b);
+}
+
+int
+main(void) {
+  size_t i;
+
+  test_sketch(0, 10, 0);
+  test_sketch(1, 10, 0);
+  test_sketch(1, 10, 1);
+  test_sketch(8, 100, 8);
+  test_sketch(8, 100, 9);
+  test_sketch(8, 100, 20);
+  test_sketch(40, 1000, 37);
+  test_sketch(BTC_MINISKETCH_MAX, 500, BTC_MINISKETCH_MAX);
+
+  for (i = 0; i < 50; i++)
+    test_sketch(20, 50, next_rand() % 21);
+
+  test_serialize();
+
+  return 0;
+}
@@ -1,14 +1,99 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-mpi.c - mpi test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/mpi.h>
 #include "lib/tests.h"
 
-int main(void) {
+#define MAX_LIMBS 300
+
+static uint64_t test_state = 0x9e3779b97f4a7c15;
+
+static void
+test_limbs(mp_limb_t *zp, mp_size_t zn, int mode) {
+  /* Random limbs, or runs of all-ones to stress the carries. */
+  mp_size_t i;
+
+  for (i = 0; i < zn; i++) {
+    test_state ^= test_state << 13;
+    test_state ^= test_state >> 7;
+    test_state ^= test_state << 17;
+
+    if (mode == 1 || (mode == 2 && (test_state & 3) != 0))
+      zp[i] = (mp_limb_t)-1;
+    else
+      zp[i] = (mp_limb_t)test_state;
+  }
+}
+
+static void
+test_schoolbook(mp_limb_t *zp, const mp_limb_t *xp, mp_size_t xn,
+                               const mp_limb_t *yp, mp_size_t yn) {
+  mp_size_t i;
+
+  zp[xn] = mpn_mul_1(zp, xp, xn, yp[0]);
+
+  for (i = 1; i < yn; i++)
+    zp[xn + i] = mpn_addmul_1(zp + i, xp, xn, yp[i]);
+}
+
+static void
+test_mpn_mul(void) {
+  static mp_limb_t xp[MAX_LIMBS], yp[MAX_LIMBS];
+  static mp_limb_t zp[2 * MAX_LIMBS], ep[2 * MAX_LIMBS];
+  static mp_limb_t tp[2 * MAX_LIMBS];
+  static const mp_size_t pairs[][2] = {
+    { 100, 30 }, { 77, 25 }, { 200, 24 }, { 61, 60 },
+    { 30, 100 }, { 241, 80 }, { 300, 299 }, { 49, 48 }
+  };
+  mp_size_t n, xn, yn;
+  size_t i;
+  int mode;
+
+  printf("mpn_mul\n");
+
+  for (mode = 0; mode < 3; mode++) {
+    for (n = 1; n <= 160; n++) {
+      test_limbs(xp, n, mode);
+      test_limbs(yp, n, mode);
+
+      test_schoolbook(ep, xp, n, yp, n);
+
+      mpn_mul_n(zp, xp, yp, n);
+
+      ASSERT(mpn_cmp(zp, ep, 2 * n) == 0);
+
+      test_schoolbook(ep, xp, n, xp, n);
+
+      mpn_sqr(zp, xp, n, tp);
+
+      ASSERT(mpn_cmp(zp, ep, 2 * n) == 0);
+    }
+
+    for (i = 0; i < lengthof(pairs); i++) {
+      xn = pairs[i][0];
+      yn = pairs[i][1];
+
+      test_limbs(xp, xn, mode);
+      test_limbs(yp, yn, mode);
+
+      test_schoolbook(ep, xp, xn, yp, yn);
+
+      mpn_mul(zp, xp, xn, yp, yn);
+
+      ASSERT(mpn_cmp(zp, ep, xn + yn) == 0);
+    }
+  }
+}
+
+int
+main(void) {
+  test_mpn_mul();
   return 0;
 }
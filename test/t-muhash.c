@@ -0,0 +1,128 @@
+/*!
+ * t-muhash.c - muhash3072 test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/muhash.h>
+#include "lib/tests.h"
+
+static void
+element(uint8_t *out, int i) {
+  memset(out, 0, 32);
+  out[0] = i;
+}
+
+static void
+test_muhash_vector(void) {
+  /* From Bitcoin Core's crypto_tests.cpp. */
+  static const char *expect_hex =
+    "63587d602a00105f62d2683610fffc82340de446664a02da2ad3cb00b112d310";
+  uint8_t expect[32];
+  uint8_t data[32];
+  uint8_t out[32];
+  btc_muhash_t ctx;
+
+  hex_parse(expect, 32, expect_hex);
+
+  btc_muhash_init(&ctx);
+
+  element(data, 0);
+  btc_muhash_insert(&ctx, data, 32);
+
+  element(data, 1);
+  btc_muhash_insert(&ctx, data, 32);
+
+  element(data, 2);
+  btc_muhash_remove(&ctx, data, 32);
+
+  btc_muhash_final(&ctx, out);
+
+  ASSERT(memcmp(out, expect, 32) == 0);
+}
+
+static void
+test_muhash_set(void) {
+  btc_muhash_t a, b, c, empty;
+  uint8_t x[32], y[32];
+  uint8_t data[32];
+  int i;
+
+  btc_muhash_init(&a);
+  btc_muhash_init(&b);
+  btc_muhash_init(&c);
+  btc_muhash_init(&empty);
+
+  /* Order does not matter. */
+  for (i = 0; i < 8; i++) {
+    element(data, i);
+    btc_muhash_insert(&a, data, 32);
+
+    element(data, 7 - i);
+    btc_muhash_insert(&b, data, 32);
+  }
+
+  btc_muhash_final(&a, x);
+  btc_muhash_final(&b, y);
+
+  ASSERT(memcmp(x, y, 32) == 0);
+
+  /* Removal undoes insertion. */
+  for (i = 0; i < 8; i++) {
+    element(data, i);
+    btc_muhash_remove(&b, data, 32);
+  }
+
+  btc_muhash_final(&b, x);
+  btc_muhash_final(&empty, y);
+
+  ASSERT(memcmp(x, y, 32) == 0);
+
+  /* Sets combine by union. */
+  for (i = 0; i < 4; i++) {
+    element(data, i);
+    btc_muhash_insert(&b, data, 32);
+
+    element(data, i + 4);
+    btc_muhash_insert(&c, data, 32);
+  }
+
+  btc_muhash_combine(&b, &c);
+
+  btc_muhash_final(&a, x);
+  btc_muhash_final(&b, y);
+
+  ASSERT(memcmp(x, y, 32) == 0);
+
+  /* A removal may precede its insertion. */
+  element(data, 9);
+  btc_muhash_remove(&c, data, 32);
+  btc_muhash_insert(&c, data, 32);
+
+  btc_muhash_final(&c, x);
+
+  btc_muhash_init(&b);
+
+  for (i = 4; i < 8; i++) {
+    element(data, i);
+    btc_muhash_insert(&b, data, 32);
+  }
+
+  btc_muhash_final(&b, y);
+
+  ASSERT(memcmp(x, y, 32) == 0);
+
+  btc_muhash_final(&a, y);
+
+  ASSERT(memcmp(x, y, 32) != 0);
+}
+
+int
+main(void) {
+  test_muhash_vector();
+  test_muhash_set();
+  return 0;
+}
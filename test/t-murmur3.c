@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-murmur3.c - murmur3 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,73 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/util.h>
 #include "lib/tests.h"
 
-int main(void) {
+static void
+test_murmur3_vectors(void) {
+  /* From bitcoin core's hash_tests.cpp. */
+  static const struct {
+    uint32_t expect;
+    uint32_t seed;
+    const char *data;
+  } vectors[] = {
+    { 0x00000000, 0x00000000, "" },
+    { 0x6a396f08, 0xfba4c795, "" },
+    { 0x81f16f39, 0xffffffff, "" },
+    { 0x514e28b7, 0x00000000, "00" },
+    { 0xea3f0b17, 0xfba4c795, "00" },
+    { 0xfd6cf10d, 0x00000000, "ff" },
+    { 0x16c6b7ab, 0x00000000, "0011" },
+    { 0x8eb51c3d, 0x00000000, "001122" },
+    { 0xb4471bf8, 0x00000000, "00112233" },
+    { 0xe2301fa8, 0x00000000, "0011223344" },
+    { 0xfc2e4a15, 0x00000000, "001122334455" },
+    { 0xb074502c, 0x00000000, "00112233445566" },
+    { 0x8034d2a0, 0x00000000, "0011223344556677" },
+    { 0xb4698def, 0x00000000, "001122334455667788" }
+  };
+
+  uint8_t data[16];
+  size_t i, len;
+
+  for (i = 0; i < lengthof(vectors); i++) {
+    len = sizeof(data);
+
+    hex_decode(data, &len, vectors[i].data);
+    ASSERT(btc_murmur3_sum(data, len, vectors[i].seed) == vectors[i].expect);
+  }
+}
+
+static void
+test_murmur3_tweaks(void) {
+  /* Every lane must agree with the single-seed hash,
+     whatever the group and tail lengths. */
+  uint32_t hashes[53];
+  uint8_t data[67];
+  size_t len, count;
+  uint32_t n, j;
+
+  for (len = 0; len < sizeof(data); len++)
+    data[len] = (uint8_t)(len * 37 + 11);
+
+  for (len = 0; len <= sizeof(data); len++) {
+    for (count = 0; count <= lengthof(hashes); count += 1 + (count > 9) * 7) {
+      for (n = 0; n < 3; n++) {
+        uint32_t tweak = (uint32_t)len * UINT32_C(0x9e3779b9) + n;
+
+        btc_murmur3_tweaks(hashes, data, len, n, count, tweak);
+
+        for (j = 0; j < count; j++)
+          ASSERT(hashes[j] == btc_murmur3_tweak(data, len, n + j, tweak));
+      }
+    }
+  }
+}
+
+int
+main(void) {
+  test_murmur3_vectors();
+  test_murmur3_tweaks();
   return 0;
 }
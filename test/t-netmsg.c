@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-netmsg.c - netmsg test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,102 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/netmsg.h>
+#include <mako/util.h>
 #include "lib/tests.h"
 
-int main(void) {
+static void
+test_inv_view(void) {
+  uint8_t hashes[3][32];
+  uint8_t *data, *copy;
+  btc_zinvitem_t item;
+  btc_zinv_t inv;
+  btc_msg_t msg, dup;
+  size_t i, len;
+
+  for (i = 0; i < 3; i++)
+    memset(hashes[i], (int)i + 1, 32);
+
+  btc_zinv_init(&inv);
+  btc_zinv_push(&inv, BTC_INV_TX, hashes[0]);
+  btc_zinv_push(&inv, BTC_INV_BLOCK, hashes[1]);
+  btc_zinv_push(&inv, BTC_INV_WITNESS_TX, hashes[2]);
+
+  btc_msg_init(&msg);
+  btc_msg_set_type(&msg, BTC_MSG_INV);
+
+  msg.body = &inv;
+
+  btc_msg_encode(&data, &len, &msg);
+
+  btc_zinv_clear(&inv);
+
+  btc_msg_init(&msg);
+  btc_msg_set_cmd(&msg, "inv");
+  btc_msg_alloc(&msg);
+
+  /* Decoded in place: no body or item list on the heap. */
+  ASSERT(msg.body == (void *)&msg.local);
+  ASSERT(btc_msg_import(&msg, data, len));
+  ASSERT(msg.local.zinv.items == NULL);
+  ASSERT(msg.local.zinv.length == 3);
+
+  btc_zinv_item(&item, &msg.local.zinv, 1);
+
+  ASSERT(item.type == BTC_INV_BLOCK);
+  ASSERT(memcmp(item.hash, hashes[1], 32) == 0);
+  ASSERT(item.hash >= data && item.hash < data + len);
+
+  /* Views re-serialize as-is. */
+  copy = (uint8_t *)malloc(btc_msg_size(&msg));
+
+  ASSERT(copy != NULL);
+  ASSERT(btc_msg_export(copy, &msg) == len);
+  ASSERT(memcmp(copy, data, len) == 0);
+
+  btc_msg_copy(&dup, &msg);
+
+  ASSERT(dup.body == (void *)&dup.local);
+
+  btc_zinv_item(&item, dup.body, 2);
+
+  ASSERT(item.type == BTC_INV_WITNESS_TX);
+
+  /* Truncated. */
+  btc_msg_clear(&msg);
+  btc_msg_alloc(&msg);
+
+  ASSERT(!btc_msg_import(&msg, data, len - 1));
+
+  btc_msg_clear(&msg);
+
+  ASSERT(msg.body == NULL);
+
+  free(copy);
+  free(data);
+}
+
+static void
+test_ping_local(void) {
+  static const uint8_t raw[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  btc_msg_t msg;
+
+  btc_msg_init(&msg);
+  btc_msg_set_type(&msg, BTC_MSG_PING);
+  btc_msg_alloc(&msg);
+
+  ASSERT(msg.body == (void *)&msg.local);
+  ASSERT(btc_msg_import(&msg, raw, sizeof(raw)));
+  ASSERT(msg.local.ping.nonce == UINT64_C(0x0807060504030201));
+
+  btc_msg_clear(&msg);
+
+  ASSERT(msg.body == NULL);
+}
+
+int
+main(void) {
+  test_inv_view();
+  test_ping_local();
   return 0;
 }
@@ -0,0 +1,275 @@
+/*!
+ * t-notify.c - notify test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <io/loop.h>
+#include <mako/block.h>
+#include <mako/entry.h>
+#include <mako/netaddr.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include <mako/vector.h>
+#include <node/notify.h>
+#include <node/types.h>
+#include "data/tx_valid_vectors.h"
+#include "lib/tests.h"
+
+typedef struct test_client_s {
+  const char *subs;
+  size_t subs_len;
+  uint8_t *data;
+  size_t length;
+  int connected;
+} test_client_t;
+
+static void
+test_reverse(uint8_t *zp, const uint8_t *xp) {
+  int i;
+
+  for (i = 0; i < 32; i++)
+    zp[i] = xp[31 - i];
+}
+
+static uint32_t
+test_read32(const uint8_t *xp) {
+  return ((uint32_t)xp[0] <<  0)
+       | ((uint32_t)xp[1] <<  8)
+       | ((uint32_t)xp[2] << 16)
+       | ((uint32_t)xp[3] << 24);
+}
+
+static int
+on_data(btc_socket_t *socket, const void *data, size_t size) {
+  test_client_t *client = btc_socket_get_data(socket);
+
+  client->data = realloc(client->data, client->length + size);
+
+  ASSERT(client->data != NULL);
+
+  memcpy(client->data + client->length, data, size);
+
+  client->length += size;
+
+  return 1;
+}
+
+static void
+on_connect(btc_socket_t *socket) {
+  test_client_t *client = btc_socket_get_data(socket);
+
+  ASSERT(btc_socket_write_static(socket, client->subs,
+                                 client->subs_len) != -1);
+
+  client->connected = 1;
+}
+
+static void
+on_close(btc_socket_t *socket) {
+  (void)socket;
+}
+
+static void
+on_error(btc_socket_t *socket) {
+  fprintf(stderr, "%s\n", btc_socket_strerror(socket));
+  ASSERT(0);
+}
+
+static const uint8_t *
+expect_msg(const uint8_t *xp,
+           const char *topic,
+           const uint8_t *body,
+           size_t length,
+           uint32_t seq) {
+  size_t tlen = strlen(topic);
+
+  ASSERT(test_read32(xp) == 1 + tlen + length + 4);
+  xp += 4;
+
+  ASSERT(xp[0] == tlen);
+  ASSERT(memcmp(xp + 1, topic, tlen) == 0);
+  xp += 1 + tlen;
+
+  ASSERT(memcmp(xp, body, length) == 0);
+  xp += length;
+
+  ASSERT(test_read32(xp) == seq);
+  xp += 4;
+
+  return xp;
+}
+
+static size_t
+msg_size(const char *topic, size_t length) {
+  return 4 + 1 + strlen(topic) + length + 4;
+}
+
+int
+main(void) {
+  static const char subs_a[] = "\x06hashtx\x08rawblock\x04nope";
+  static const char subs_b[] = "\x00";
+  const test_valid_vector_t *vec = &test_valid_vectors[0];
+  test_client_t a, b;
+  btc_socket_t *sa, *sb;
+  btc_block_t *block;
+  btc_notify_t *notify;
+  btc_entry_t entry;
+  btc_sockaddr_t addr;
+  btc_netaddr_t bind;
+  uint8_t txid[32];
+  uint8_t hash[32];
+  uint8_t *raw_tx;
+  uint8_t *raw_block;
+  size_t tx_len, block_len;
+  size_t size_a, size_b;
+  const uint8_t *xp;
+  btc_loop_t *loop;
+  btc_tx_t *tx;
+  int64_t start;
+
+  btc_net_startup();
+
+  /* Setup. */
+  tx = btc_tx_create();
+
+  ASSERT(btc_tx_import(tx, vec->tx_raw, vec->tx_len));
+
+  block = btc_block_create();
+  block->header.version = 0x20000000;
+  block->header.time = 1231006505;
+  block->header.bits = 0x1d00ffff;
+
+  btc_txvec_push(&block->txs, btc_tx_clone(tx));
+
+  btc_entry_set_block(&entry, block, NULL);
+
+  raw_tx = malloc(btc_tx_size(tx));
+  tx_len = btc_tx_write(raw_tx, tx) - raw_tx;
+
+  raw_block = malloc(btc_block_size(block));
+  block_len = btc_block_write(raw_block, block) - raw_block;
+
+  test_reverse(txid, tx->hash);
+  test_reverse(hash, entry.hash);
+
+  /* Notifier. */
+  ASSERT(btc_sockaddr_import(&addr, "127.0.0.1", 1339));
+
+  btc_netaddr_set_sockaddr(&bind, &addr);
+
+  loop = btc_loop_create();
+  notify = btc_notify_create(loop);
+
+  btc_notify_set_bind(notify, &bind);
+
+  ASSERT(btc_notify_open(notify, BTC_NOTIFY_LISTEN));
+
+  /* Nothing is published without subscribers. */
+  btc_notify_tx(notify, tx);
+
+  /* Subscribers. */
+  memset(&a, 0, sizeof(a));
+  memset(&b, 0, sizeof(b));
+
+  a.subs = subs_a;
+  a.subs_len = sizeof(subs_a) - 1;
+  b.subs = subs_b;
+  b.subs_len = 1;
+
+  sa = btc_loop_connect(loop, &addr);
+  sb = btc_loop_connect(loop, &addr);
+
+  ASSERT(sa != NULL && sb != NULL);
+
+  btc_socket_set_data(sa, &a);
+  btc_socket_on_connect(sa, on_connect);
+  btc_socket_on_data(sa, on_data);
+  btc_socket_on_close(sa, on_close);
+  btc_socket_on_error(sa, on_error);
+
+  btc_socket_set_data(sb, &b);
+  btc_socket_on_connect(sb, on_connect);
+  btc_socket_on_data(sb, on_data);
+  btc_socket_on_close(sb, on_close);
+  btc_socket_on_error(sb, on_error);
+
+  start = btc_time_msec();
+
+  while (!a.connected || !b.connected) {
+    ASSERT(btc_time_msec() < start + 10 * 1000);
+    btc_loop_poll(loop, 100);
+  }
+
+  /* Let the subscription frames arrive. */
+  start = btc_time_msec();
+
+  while (btc_time_msec() < start + 200)
+    btc_loop_poll(loop, 10);
+
+  /* Publish. */
+  btc_notify_tx(notify, tx);
+  btc_notify_block(notify, &entry, block);
+
+  size_a = msg_size("hashtx", 32) * 2
+         + msg_size("rawblock", block_len);
+
+  size_b = msg_size("hashtx", 32) * 2
+         + msg_size("rawtx", tx_len) * 2
+         + msg_size("hashblock", 32)
+         + msg_size("rawblock", block_len);
+
+  start = btc_time_msec();
+
+  while (a.length < size_a || b.length < size_b) {
+    ASSERT(btc_time_msec() < start + 10 * 1000);
+    btc_loop_poll(loop, 100);
+  }
+
+  ASSERT(a.length == size_a);
+  ASSERT(b.length == size_b);
+
+  /* Topic subscriber. */
+  xp = a.data;
+  xp = expect_msg(xp, "hashtx", txid, 32, 0);
+  xp = expect_msg(xp, "hashtx", txid, 32, 1);
+  xp = expect_msg(xp, "rawblock", raw_block, block_len, 0);
+
+  ASSERT(xp == a.data + a.length);
+
+  /* Catch-all subscriber. */
+  xp = b.data;
+  xp = expect_msg(xp, "hashtx", txid, 32, 0);
+  xp = expect_msg(xp, "rawtx", raw_tx, tx_len, 0);
+  xp = expect_msg(xp, "hashtx", txid, 32, 1);
+  xp = expect_msg(xp, "rawtx", raw_tx, tx_len, 1);
+  xp = expect_msg(xp, "hashblock", hash, 32, 0);
+  xp = expect_msg(xp, "rawblock", raw_block, block_len, 0);
+
+  ASSERT(xp == b.data + b.length);
+
+  /* Cleanup. */
+  btc_notify_close(notify);
+  btc_loop_close(loop);
+  btc_notify_destroy(notify);
+  btc_loop_destroy(loop);
+
+  free(a.data);
+  free(b.data);
+  free(raw_tx);
+  free(raw_block);
+
+  btc_block_destroy(block);
+  btc_tx_destroy(tx);
+
+  btc_net_cleanup();
+
+  return 0;
+}
@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-pbkdf2.c - pbkdf2 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,111 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/hash.h>
 #include "lib/tests.h"
 
-int main(void) {
+static void
+pbkdf512_naive(uint8_t *out,
+               const uint8_t *pass,
+               size_t pass_len,
+               const uint8_t *salt,
+               size_t salt_len,
+               uint32_t iter,
+               size_t len) {
+  uint8_t block[64], mac[64], ctr[4];
+  btc_hmac512_t hmac;
+  uint32_t i, j;
+  size_t k, n;
+
+  for (i = 1; len > 0; i++) {
+    ctr[0] = i >> 24;
+    ctr[1] = i >> 16;
+    ctr[2] = i >> 8;
+    ctr[3] = i;
+
+    btc_hmac512_init(&hmac, pass, pass_len);
+    btc_hmac512_update(&hmac, salt, salt_len);
+    btc_hmac512_update(&hmac, ctr, 4);
+    btc_hmac512_final(&hmac, mac);
+
+    memcpy(block, mac, 64);
+
+    for (j = 1; j < iter; j++) {
+      btc_hmac512_init(&hmac, pass, pass_len);
+      btc_hmac512_update(&hmac, mac, 64);
+      btc_hmac512_final(&hmac, mac);
+
+      for (k = 0; k < 64; k++)
+        block[k] ^= mac[k];
+    }
+
+    n = len < 64 ? len : 64;
+
+    memcpy(out, block, n);
+
+    out += n;
+    len -= n;
+  }
+}
+
+static void
+test_pbkdf512_vector(void) {
+  /* PBKDF2-HMAC-SHA512, P="password", S="salt", c=1. */
+  static const uint8_t expect[64] = {
+    0x86, 0x7f, 0x70, 0xcf, 0x1a, 0xde, 0x02, 0xcf,
+    0xf3, 0x75, 0x25, 0x99, 0xa3, 0xa5, 0x3d, 0xc4,
+    0xaf, 0x34, 0xc7, 0xa6, 0x69, 0x81, 0x5a, 0xe5,
+    0xd5, 0x13, 0x55, 0x4e, 0x1c, 0x8c, 0xf2, 0x52,
+    0xc0, 0x2d, 0x47, 0x0a, 0x28, 0x5a, 0x05, 0x01,
+    0xba, 0xd9, 0x99, 0xbf, 0xe9, 0x43, 0xc0, 0x8f,
+    0x05, 0x02, 0x35, 0xd7, 0xd6, 0x8b, 0x1d, 0xa5,
+    0x5e, 0x63, 0xf7, 0x3b, 0x60, 0xa5, 0x7f, 0xce
+  };
+  uint8_t out[64];
+
+  btc_pbkdf512_derive(out, (const uint8_t *)"password", 8,
+                           (const uint8_t *)"salt", 4,
+                           1, 64);
+
+  ASSERT(memcmp(out, expect, 64) == 0);
+}
+
+static void
+test_pbkdf512_lanes(void) {
+  /* Output lengths covering 1-7 blocks and partial
+     blocks, which exercise every lane width. */
+  static const size_t sizes[] = {1, 64, 100, 128, 192, 256, 300, 448};
+  static const uint32_t iters[] = {1, 2, 3, 50};
+  static const uint8_t pass[200] = {0x70, 0x61, 0x73, 0x73};
+  uint8_t expect[448], out[448];
+  size_t i, j;
+
+  for (i = 0; i < lengthof(sizes); i++) {
+    for (j = 0; j < lengthof(iters); j++) {
+      /* Long passwords are hashed down first. */
+      size_t pass_len = (j & 1) ? sizeof(pass) : 4;
+
+      pbkdf512_naive(expect, pass, pass_len,
+                     (const uint8_t *)"mnemonic", 8,
+                     iters[j], sizes[i]);
+
+      memset(out, 0xff, sizeof(out));
+
+      btc_pbkdf512_derive(out, pass, pass_len,
+                          (const uint8_t *)"mnemonic", 8,
+                          iters[j], sizes[i]);
+
+      ASSERT(memcmp(out, expect, sizes[i]) == 0);
+
+      if (sizes[i] < sizeof(out))
+        ASSERT(out[sizes[i]] == 0xff);
+    }
+  }
+}
+
+int
+main(void) {
+  test_pbkdf512_vector();
+  test_pbkdf512_lanes();
   return 0;
 }
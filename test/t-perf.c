@@ -0,0 +1,119 @@
+/*!
+ * t-perf.c - latency histogram test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <node/perf.h>
+#include "lib/tests.h"
+
+static void
+test_small(void) {
+  btc_hist_t hist;
+  int i;
+
+  btc_hist_init(&hist);
+
+  ASSERT(btc_hist_percentile(&hist, 0.5) == 0);
+  ASSERT(btc_hist_mean(&hist) == 0);
+
+  /* Exact below the first power of two. */
+  for (i = 0; i < 8; i++)
+    btc_hist_record(&hist, i);
+
+  ASSERT(hist.count == 8);
+  ASSERT(hist.max == 7);
+  ASSERT(btc_hist_mean(&hist) == 3);
+  ASSERT(btc_hist_percentile(&hist, 0.0) == 0);
+  ASSERT(btc_hist_percentile(&hist, 0.5) == 3);
+  ASSERT(btc_hist_percentile(&hist, 1.0) == 7);
+
+  /* Negative spans clamp to zero. */
+  btc_hist_record(&hist, -5);
+
+  ASSERT(hist.count == 9);
+  ASSERT(hist.buckets[0] == 2);
+}
+
+static void
+test_error(void) {
+  uint64_t value, got;
+  btc_hist_t hist;
+
+  /* Every bucket is within 1/8th of its value. */
+  for (value = 1; value < ((uint64_t)1 << 40); value = value * 3 + 1) {
+    btc_hist_init(&hist);
+    btc_hist_record(&hist, value);
+    btc_hist_record(&hist, value * 2);
+
+    got = btc_hist_percentile(&hist, 0.5);
+
+    ASSERT(got >= value);
+    ASSERT(got - value <= value / 8);
+    ASSERT(btc_hist_percentile(&hist, 1.0) == value * 2);
+  }
+}
+
+static void
+test_percentiles(void) {
+  btc_hist_t hist, copy;
+  uint64_t p50, p99;
+  int i;
+
+  btc_hist_init(&hist);
+
+  for (i = 1; i <= 10000; i++)
+    btc_hist_record(&hist, i * 1000);
+
+  p50 = btc_hist_percentile(&hist, 0.50);
+  p99 = btc_hist_percentile(&hist, 0.99);
+
+  ASSERT(p50 >= 5000000 && p50 <= 5000000 + 5000000 / 8);
+  ASSERT(p99 >= 9900000 && p99 <= 10000000);
+  ASSERT(btc_hist_mean(&hist) == 5000500);
+  ASSERT(hist.max == 10000000);
+
+  /* Merging doubles the counts, not the shape. */
+  copy = hist;
+
+  btc_hist_merge(&copy, &hist);
+
+  ASSERT(copy.count == 20000);
+  ASSERT(btc_hist_percentile(&copy, 0.50) == p50);
+  ASSERT(btc_hist_percentile(&copy, 0.99) == p99);
+
+  /* Huge values land in the last bucket. */
+  btc_hist_record(&hist, INT64_MAX);
+
+  ASSERT(hist.buckets[BTC_HIST_BUCKETS - 1] == 1);
+  ASSERT(btc_hist_percentile(&hist, 1.0) == (uint64_t)INT64_MAX);
+}
+
+static void
+test_perf(void) {
+  btc_perf_t *perf = btc_perf_create();
+  int i;
+
+  for (i = 0; i < BTC_PERF_MAX; i++)
+    ASSERT(strcmp(btc_perf_name((enum btc_perf_stage)i), "unknown") != 0);
+
+  btc_perf_record(perf, BTC_PERF_BLOCK_SCRIPTS, 1000);
+  btc_perf_record(NULL, BTC_PERF_BLOCK_SCRIPTS, 1000);
+
+  ASSERT(perf->stages[BTC_PERF_BLOCK_SCRIPTS].count == 1);
+  ASSERT(perf->stages[BTC_PERF_BLOCK_SAVE].count == 0);
+
+  btc_perf_destroy(perf);
+}
+
+int
+main(void) {
+  test_small();
+  test_error();
+  test_percentiles();
+  test_perf();
+  return 0;
+}
@@ -1,14 +1,111 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-printf.c - printf test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/printf.h>
 #include "lib/tests.h"
 
-int main(void) {
+static void
+check(const char *expect, const char *fmt, ...) {
+  char buf[1024];
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = btc_vsprintf(buf, fmt, ap);
+  va_end(ap);
+
+  ASSERT(len == (int)strlen(expect));
+  ASSERT(strcmp(buf, expect) == 0);
+}
+
+static void
+test_integers(void) {
+  static const unsigned long long values[] = {
+    0, 1, 9, 10, 99, 100, 101, 999, 1000, 65535, 4294967295u,
+    4294967296ull, 9999999999999999999ull, 10000000000000000000ull,
+    18446744073709551615ull
+  };
+  char expect[64];
+  size_t i;
+
+  for (i = 0; i < lengthof(values); i++) {
+    sprintf(expect, "%llu", values[i]);
+    check(expect, "%llu", values[i]);
+
+    sprintf(expect, "%.25llu", values[i]);
+    check(expect, "%.25llu", values[i]);
+
+    sprintf(expect, "%lld", -(long long)(values[i] / 2));
+    check(expect, "%lld", -(long long)(values[i] / 2));
+  }
+
+  check("-2147483648 +7 00042", "%d %+d %.5u", -2147483647 - 1, 7, 42u);
+  check("12345", "%zu", (size_t)12345);
+  check("ff 0xff 0000FF", "%x %#x %.6X", 255u, 255u, 255u);
+}
+
+static void
+test_custom(void) {
+  unsigned char hash[32];
+  char expect[65];
+  int i;
+
+  for (i = 0; i < 32; i++)
+    hash[i] = i * 8 + 1;
+
+  for (i = 0; i < 32; i++)
+    sprintf(expect + i * 2, "%02x", hash[31 - i]);
+
+  check(expect, "%H", hash);
+  check("NULL", "%H", NULL);
+  check("0109", "%.2R", hash);
+
+  check("0", "%v", (int64_t)0);
+  check("21000000", "%v", (int64_t)21000000 * 100000000);
+  check("-0.00000001", "%v", (int64_t)-1);
+  check("12.3456", "%v", (int64_t)1234560000);
+
+  check("1970-01-01T00:00:00Z", "%D", (int64_t)0);
+  check("2009-01-03T18:15:05Z", "%D", (int64_t)1231006505);
+  check("2106-02-07T06:28:15Z", "%D", (int64_t)4294967295u);
+}
+
+static void
+test_strings(void) {
+  char big[2048];
+  char *out;
+
+  memset(big, 'a', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+
+  check("a:(null):abc:ab", "%s:%s:%s:%.2s", "a", (char *)NULL, "abc", "abc");
+
+  /* Longer than the internal buffer. */
+  out = malloc(sizeof(big) + 4);
+
+  ASSERT(out != NULL);
+  ASSERT(btc_sprintf(out, "<%s>", big) == (int)sizeof(big) + 1);
+  ASSERT(out[0] == '<' && out[sizeof(big)] == '>');
+  ASSERT(strspn(out + 1, "a") == sizeof(big) - 1);
+
+  free(out);
+
+  ASSERT(btc_snprintf(big, 6, "%s%d", "abc", 1234) == 7);
+  ASSERT(strcmp(big, "abc12") == 0);
+}
+
+int
+main(void) {
+  test_integers();
+  test_custom();
+  test_strings();
   return 0;
 }
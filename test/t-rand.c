@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-rand.c - rand test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,109 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/rand.h>
 #include "lib/tests.h"
 
-int main(void) {
+#if defined(__unix__) || defined(__APPLE__)
+#  include <sys/types.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#  define HAVE_FORK
+#endif
+
+static void
+test_random(void) {
+  static const uint8_t zero[64];
+  uint8_t a[64], b[64];
+  uint8_t big[4096];
+  uint64_t x, y;
+  size_t i, count;
+
+  /* Pool path. */
+  for (i = 1; i <= 64; i++) {
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+
+    btc_getrandom(a, i);
+    btc_getrandom(b, i);
+
+    ASSERT(memcmp(a + i, zero, 64 - i) == 0);
+    ASSERT(i < 8 || memcmp(a, b, i) != 0);
+  }
+
+  /* Direct path. */
+  memset(big, 0, sizeof(big));
+
+  btc_getrandom(big, sizeof(big));
+
+  count = 0;
+
+  for (i = 0; i < sizeof(big); i++)
+    count += (big[i] == 0);
+
+  ASSERT(count < 64);
+
+  /* Enough draws to cross many refills. */
+  x = btc_nonce();
+
+  for (i = 0; i < 10000; i++) {
+    y = btc_nonce();
+    ASSERT(y != x);
+    x = y;
+  }
+
+  for (i = 0; i < 10000; i++)
+    ASSERT(btc_uniform(10) < 10);
+
+  ASSERT(btc_uniform(0) == 0);
+  ASSERT(btc_uniform(1) == 0);
+}
+
+#ifdef HAVE_FORK
+static void
+test_fork(void) {
+  uint64_t child, parent;
+  int fds[2];
+  int status;
+  pid_t pid;
+
+  /* Make sure the pool is warm before forking. */
+  btc_nonce();
+
+  ASSERT(pipe(fds) == 0);
+
+  pid = fork();
+
+  ASSERT(pid >= 0);
+
+  if (pid == 0) {
+    child = btc_nonce();
+
+    if (write(fds[1], &child, sizeof(child)) != sizeof(child))
+      _exit(1);
+
+    _exit(0);
+  }
+
+  parent = btc_nonce();
+
+  ASSERT(read(fds[0], &child, sizeof(child)) == sizeof(child));
+  ASSERT(waitpid(pid, &status, 0) == pid);
+  ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  /* The child must not replay the parent's stream. */
+  ASSERT(child != parent);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+#endif
+
+int
+main(void) {
+  test_random();
+#ifdef HAVE_FORK
+  test_fork();
+#endif
   return 0;
 }
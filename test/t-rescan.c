@@ -0,0 +1,241 @@
+/*!
+ * t-rescan.c - rescan test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <node/chain.h>
+#include <node/rescan.h>
+#include <mako/block.h>
+#include <mako/buffer.h>
+#include <mako/consensus.h>
+#include <mako/entry.h>
+#include <mako/network.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include "lib/tests.h"
+#include "data/chain_vectors_main.h"
+
+/* Block 170 holds the first spend: block 9's
+   coinbase pays 10 BTC to Hal and 40 back. */
+static btc_script_t satoshi;
+static btc_script_t hal;
+static uint8_t spend_hash[32];
+static uint8_t coinbase_hash[32];
+
+typedef struct result_s {
+  btc_rescanmatch_t items[8];
+  size_t length;
+} result_t;
+
+static void
+add_blocks(btc_chain_t *chain, size_t start, size_t end) {
+  unsigned char data[65536];
+  btc_block_t block;
+  size_t i;
+
+  for (i = start; i < end; i++) {
+    size_t size = sizeof(data);
+
+    hex_decode(data, &size, chain_vectors_main[i]);
+
+    btc_block_init(&block);
+
+    ASSERT(btc_block_import(&block, data, size));
+    ASSERT(btc_chain_add(chain, &block, BTC_BLOCK_DEFAULT_FLAGS, -1));
+
+    btc_block_clear(&block);
+  }
+}
+
+static void
+on_match(const btc_rescanmatch_t *match, void *arg) {
+  result_t *res = arg;
+
+  ASSERT(res->length < lengthof(res->items));
+
+  res->items[res->length++] = *match;
+}
+
+static void
+check_match(const btc_rescanmatch_t *match,
+            int32_t height,
+            uint32_t index,
+            int spend,
+            const uint8_t *hash,
+            uint32_t vout,
+            int64_t value,
+            const btc_script_t *script) {
+  ASSERT(match->entry->height == height);
+  ASSERT(match->index == index);
+  ASSERT(match->spend == spend);
+  ASSERT(match->prevout.index == vout);
+  ASSERT(match->value == value);
+  ASSERT(btc_script_equal(match->script, script));
+
+  if (spend) {
+    ASSERT(memcmp(match->hash, spend_hash, 32) == 0);
+    ASSERT(memcmp(match->prevout.hash, hash, 32) == 0);
+  } else {
+    ASSERT(memcmp(match->hash, hash, 32) == 0);
+    ASSERT(memcmp(match->prevout.hash, hash, 32) == 0);
+  }
+}
+
+static void
+test_rescan(btc_chain_t *chain) {
+  btc_rescan_t *scan = btc_rescan_create();
+  result_t res;
+
+  ASSERT(btc_rescan_watch(scan, &satoshi));
+  ASSERT(btc_rescan_watch(scan, &hal));
+  ASSERT(!btc_rescan_watch(scan, &hal));
+  ASSERT(btc_rescan_size(scan) == 2);
+
+  /* Whole chain: the coinbase, its spend, and the
+     two outputs of the spend, in that order. */
+  res.length = 0;
+
+  ASSERT(btc_rescan_run(scan, chain, 0, -1, on_match, &res));
+  ASSERT(res.length == 4);
+
+  check_match(&res.items[0], 9, 0, 0, coinbase_hash, 0,
+              50 * BTC_COIN, &satoshi);
+
+  check_match(&res.items[1], 170, 1, 1, coinbase_hash, 0,
+              50 * BTC_COIN, &satoshi);
+
+  check_match(&res.items[2], 170, 1, 0, spend_hash, 0,
+              10 * BTC_COIN, &hal);
+
+  check_match(&res.items[3], 170, 1, 0, spend_hash, 1,
+              40 * BTC_COIN, &satoshi);
+
+  /* Starting after the coinbase: its spend is
+     resolved from the undo coins. */
+  res.length = 0;
+
+  ASSERT(btc_rescan_run(scan, chain, 100, 175, on_match, &res));
+  ASSERT(res.length == 3);
+
+  check_match(&res.items[0], 170, 1, 1, coinbase_hash, 0,
+              50 * BTC_COIN, &satoshi);
+
+  check_match(&res.items[1], 170, 1, 0, spend_hash, 0,
+              10 * BTC_COIN, &hal);
+
+  check_match(&res.items[2], 170, 1, 0, spend_hash, 1,
+              40 * BTC_COIN, &satoshi);
+
+  /* Stopping before the spend. */
+  res.length = 0;
+
+  ASSERT(btc_rescan_run(scan, chain, 0, 169, on_match, &res));
+  ASSERT(res.length == 1);
+  ASSERT(res.items[0].entry->height == 9);
+
+  btc_rescan_destroy(scan);
+}
+
+static void
+test_cursor(btc_chain_t *chain) {
+  btc_rescan_t *scan = btc_rescan_create();
+  btc_rescancursor_t *x, *y;
+  result_t rx, ry;
+
+  ASSERT(btc_rescan_watch(scan, &hal));
+
+  /* Independent cursors over one watched set. */
+  x = btc_rescancursor_create(scan, chain, 0, -1);
+  y = btc_rescancursor_create(scan, chain, 170, 170);
+
+  rx.length = 0;
+  ry.length = 0;
+
+  ASSERT(!btc_rescancursor_done(x));
+  ASSERT(!btc_rescancursor_done(y));
+  ASSERT(btc_rescancursor_height(y) == 170);
+
+  ASSERT(btc_rescancursor_next(y, on_match, &ry));
+  ASSERT(btc_rescancursor_done(y));
+  ASSERT(btc_rescancursor_height(y) == 171);
+
+  while (!btc_rescancursor_done(x))
+    ASSERT(btc_rescancursor_next(x, on_match, &rx));
+
+  ASSERT(btc_rescancursor_height(x) == btc_chain_height(chain) + 1);
+
+  /* Nothing is pruned, so every spend had its undo coins. */
+  ASSERT(btc_rescancursor_missing(x) == 0);
+  ASSERT(btc_rescancursor_missing(y) == 0);
+
+  ASSERT(rx.length == 1);
+  ASSERT(ry.length == 1);
+
+  check_match(&rx.items[0], 170, 1, 0, spend_hash, 0,
+              10 * BTC_COIN, &hal);
+
+  check_match(&ry.items[0], 170, 1, 0, spend_hash, 0,
+              10 * BTC_COIN, &hal);
+
+  /* A finished cursor has nothing more to say. */
+  ASSERT(btc_rescancursor_next(y, on_match, &ry));
+  ASSERT(ry.length == 1);
+
+  btc_rescancursor_destroy(x);
+  btc_rescancursor_destroy(y);
+  btc_rescan_destroy(scan);
+}
+
+int
+main(void) {
+  btc_chain_t *chain = btc_chain_create(btc_mainnet);
+  btc_block_t *block;
+
+  btc_clean(BTC_PREFIX);
+
+  btc_chain_set_threads(chain, 2);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+
+  add_blocks(chain, 0, 180);
+
+  block = btc_chain_get_block(chain, btc_chain_by_height(chain, 9));
+
+  ASSERT(block != NULL);
+
+  btc_buffer_copy(&satoshi, &block->txs.items[0]->outputs.items[0]->script);
+  memcpy(coinbase_hash, block->txs.items[0]->hash, 32);
+
+  btc_block_destroy(block);
+
+  block = btc_chain_get_block(chain, btc_chain_by_height(chain, 170));
+
+  ASSERT(block != NULL);
+  ASSERT(block->txs.length == 2);
+
+  btc_buffer_copy(&hal, &block->txs.items[1]->outputs.items[0]->script);
+  memcpy(spend_hash, block->txs.items[1]->hash, 32);
+
+  btc_block_destroy(block);
+
+  test_rescan(chain);
+  test_cursor(chain);
+
+  btc_chain_close(chain);
+
+  btc_buffer_clear(&satoshi);
+  btc_buffer_clear(&hal);
+
+  btc_chain_destroy(chain);
+
+  btc_clean(BTC_PREFIX);
+
+  return 0;
+}
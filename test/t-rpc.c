@@ -1,14 +1,339 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-rpc.c - rpc test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/block.h>
+#include <mako/entry.h>
+#include <mako/json.h>
+#include <mako/network.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include <mako/vector.h>
+#include "data/tx_valid_vectors.h"
 #include "lib/tests.h"
 
-int main(void) {
+typedef struct test_sink_s {
+  char *data;
+  size_t length;
+  size_t calls;
+} test_sink_t;
+
+static void
+test_sink_write(void *arg, const char *data, size_t length) {
+  test_sink_t *sink = arg;
+
+  ASSERT(length <= JSON_WRITER_CHUNK);
+
+  sink->data = realloc(sink->data, sink->length + length);
+
+  ASSERT(sink->data != NULL);
+
+  memcpy(sink->data + sink->length, data, length);
+
+  sink->length += length;
+  sink->calls++;
+}
+
+static btc_block_t *
+test_block_create(void) {
+  btc_block_t *block = btc_block_create();
+  size_t i;
+
+  block->header.version = 0x20000000;
+  block->header.time = 1231006505;
+  block->header.bits = 0x1d00ffff;
+
+  for (i = 0; i < lengthof(test_valid_vectors); i++) {
+    const test_valid_vector_t *vec = &test_valid_vectors[i];
+    btc_tx_t *tx = btc_tx_create();
+
+    ASSERT(btc_tx_import(tx, vec->tx_raw, vec->tx_len));
+
+    btc_txvec_push(&block->txs, tx);
+  }
+
+  return block;
+}
+
+static void
+test_block_stream(int details) {
+  btc_block_t *block = test_block_create();
+  const btc_network_t *network = btc_mainnet;
+  uint8_t next[32];
+  btc_entry_t entry;
+  json_value *obj;
+  test_sink_t sink;
+  json_writer w;
+  char *expect;
+  size_t i;
+
+  printf("block stream (details=%d)\n", details);
+
+  btc_entry_set_block(&entry, block, NULL);
+  memset(next, 0xaa, 32);
+
+  /* Tree. */
+  obj = json_block_new_ex(block, &entry, NULL, 7, next, details, network);
+  expect = json_encode(obj);
+
+  json_builder_free(obj);
+
+  /* Stream. */
+  memset(&sink, 0, sizeof(sink));
+
+  json_writer_init(&w, test_sink_write, &sink);
+
+  json_block_write_begin(&w, block, &entry, 7, next);
+
+  for (i = 0; i < block->txs.length; i++) {
+    if (details)
+      json_tx_write(&w, block->txs.items[i], NULL, network);
+    else
+      json_writer_hash(&w, block->txs.items[i]->hash);
+  }
+
+  json_block_write_end(&w);
+  json_writer_flush(&w);
+  json_writer_clear(&w);
+
+  ASSERT(sink.length == strlen(expect));
+  ASSERT(memcmp(sink.data, expect, sink.length) == 0);
+
+  if (details)
+    ASSERT(sink.calls > 1);
+
+  free(sink.data);
+  free(expect);
+
+  btc_block_destroy(block);
+}
+
+static void
+test_writer_scalars(void) {
+  json_value *obj = json_object_new(0);
+  json_value *arr = json_array_new(0);
+  json_writer w;
+  char *expect;
+
+  printf("writer scalars\n");
+
+  json_array_push(arr, json_amount_new(150000000));
+  json_array_push(arr, json_amount_new(-1));
+  json_array_push(arr, json_double_new(1.5));
+  json_array_push(arr, json_double_new(4.656542373906925e-10));
+  json_array_push(arr, json_boolean_new(1));
+  json_array_push(arr, json_null_new());
+  json_array_push(arr, json_object_new(0));
+
+  json_object_push(obj, "a\"b", json_string_new("x\n\\y"));
+  json_object_push(obj, "int", json_integer_new(-42));
+  json_object_push(obj, "list", arr);
+  json_object_push(obj, "empty", json_array_new(0));
+
+  expect = json_encode(obj);
+
+  json_writer_init(&w, NULL, NULL);
+
+  json_writer_object_begin(&w);
+  json_writer_key(&w, "a\"b");
+  json_writer_string(&w, "x\n\\y");
+  json_writer_key(&w, "int");
+  json_writer_integer(&w, -42);
+  json_writer_key(&w, "list");
+  json_writer_array_begin(&w);
+  json_writer_amount(&w, 150000000);
+  json_writer_amount(&w, -1);
+  json_writer_double(&w, 1.5);
+  json_writer_double(&w, 4.656542373906925e-10);
+  json_writer_boolean(&w, 1);
+  json_writer_null(&w);
+  json_writer_object_begin(&w);
+  json_writer_object_end(&w);
+  json_writer_array_end(&w);
+  json_writer_key(&w, "empty");
+  json_writer_array_begin(&w);
+  json_writer_array_end(&w);
+  json_writer_object_end(&w);
+
+  ASSERT(w.length == strlen(expect));
+  ASSERT(memcmp(w.data, expect, w.length) == 0);
+
+  json_writer_clear(&w);
+  json_builder_free(obj);
+  free(expect);
+}
+
+static void
+test_writer_long_array(void) {
+  json_value *arr = json_array_new(0);
+  json_writer w;
+  char *expect;
+  int i;
+
+  printf("writer long array\n");
+
+  json_writer_init(&w, NULL, NULL);
+  json_writer_array_begin(&w);
+
+  for (i = 0; i < 1000; i++) {
+    json_array_push(arr, json_integer_new(i));
+    json_writer_integer(&w, i);
+  }
+
+  json_writer_array_end(&w);
+
+  expect = json_encode(arr);
+
+  ASSERT(w.length == strlen(expect));
+  ASSERT(memcmp(w.data, expect, w.length) == 0);
+
+  json_writer_clear(&w);
+  json_builder_free(arr);
+  free(expect);
+}
+
+static int
+test_value_equal(const json_value *x, const json_value *y) {
+  unsigned int i;
+
+  if (x->type != y->type)
+    return 0;
+
+  switch (x->type) {
+    case json_object:
+      if (x->u.object.length != y->u.object.length)
+        return 0;
+
+      for (i = 0; i < x->u.object.length; i++) {
+        const json_object_entry *a = &x->u.object.values[i];
+        const json_object_entry *b = &y->u.object.values[i];
+
+        if (a->name_length != b->name_length)
+          return 0;
+
+        if (memcmp(a->name, b->name, a->name_length + 1) != 0)
+          return 0;
+
+        if (!test_value_equal(a->value, b->value))
+          return 0;
+      }
+
+      return 1;
+    case json_array:
+      if (x->u.array.length != y->u.array.length)
+        return 0;
+
+      for (i = 0; i < x->u.array.length; i++) {
+        if (!test_value_equal(x->u.array.values[i], y->u.array.values[i]))
+          return 0;
+      }
+
+      return 1;
+    case json_integer:
+    case json_amount:
+      return x->u.integer == y->u.integer;
+    case json_double:
+      return x->u.dbl == y->u.dbl;
+    case json_string:
+      return x->u.string.length == y->u.string.length
+          && memcmp(x->u.string.ptr, y->u.string.ptr,
+                    x->u.string.length + 1) == 0;
+    case json_boolean:
+      return x->u.boolean == y->u.boolean;
+    default:
+      return 1;
+  }
+}
+
+static void
+test_parse_insitu(void) {
+  static const char body[] = "{\"method\": \"sendrawtransaction\", "
+                             "\"params\": [\"0100ab\", \"a\\nb\", "
+                             "\"\\u00e9\\\"\", 1.5, [true, null]], "
+                             "\"id\": 7, \"\\u0078\": {\"k\": -3}}";
+  json_settings settings;
+  json_value *expect, *obj, *params;
+  json_arena arena;
+  char data[sizeof(body)];
+  char *big, *ptr;
+  int i;
+
+  printf("parse insitu\n");
+
+  memset(&settings, 0, sizeof(settings));
+
+  settings.settings = json_enable_amounts;
+
+  expect = json_parse_ex(&settings, body, sizeof(body) - 1, NULL);
+
+  ASSERT(expect != NULL);
+
+  memcpy(data, body, sizeof(body));
+
+  obj = json_parse_insitu(&settings, &arena, data, sizeof(body) - 1, NULL);
+
+  ASSERT(obj != NULL);
+  ASSERT(test_value_equal(obj, expect));
+
+  params = json_object_get(obj, "params");
+
+  /* Plain strings are borrowed; escaped ones are copied. */
+  ptr = params->u.array.values[0]->u.string.ptr;
+
+  ASSERT(ptr == data + (strstr(body, "0100ab") - body));
+  ASSERT(ptr[6] == '\0');
+
+  ptr = params->u.array.values[1]->u.string.ptr;
+
+  ASSERT(ptr < data || ptr >= data + sizeof(data));
+
+  json_arena_free(&arena);
+  json_value_free(expect);
+
+  /* Failures leave nothing behind but the arena. */
+  memcpy(data, body, sizeof(body));
+
+  ASSERT(json_parse_insitu(&settings, &arena, data, 60, NULL) == NULL);
+
+  json_arena_free(&arena);
+
+  /* Many small values outgrow the first chunk. */
+  big = malloc(2 * 5000 + 1);
+
+  ASSERT(big != NULL);
+
+  for (i = 0; i < 5000; i++) {
+    big[i * 2 + 0] = i == 0 ? '[' : ',';
+    big[i * 2 + 1] = '1';
+  }
+
+  big[2 * 5000] = ']';
+
+  obj = json_parse_insitu(&settings, &arena, big, 2 * 5000 + 1, NULL);
+
+  ASSERT(obj != NULL);
+  ASSERT(obj->type == json_array);
+  ASSERT(obj->u.array.length == 5000);
+  ASSERT(obj->u.array.values[4999]->u.integer == 1);
+
+  json_arena_free(&arena);
+  free(big);
+}
+
+int
+main(void) {
+  test_writer_scalars();
+  test_writer_long_array();
+  test_block_stream(0);
+  test_block_stream(1);
+  test_parse_insitu();
   return 0;
 }
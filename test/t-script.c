@@ -48,6 +48,60 @@ test_script_vector(const test_script_vector_t *vec, size_t index) {
                             &cache);
 
     ASSERT(ret == vec->expected);
+
+    /* Signatures are deferred when failure is fatal. */
+    if (flags & BTC_SCRIPT_VERIFY_NULLFAIL) {
+      btc_sigbatch_t *batch = btc_sigbatch_create();
+
+      memset(&cache, 0, sizeof(cache));
+
+      cache.batch = batch;
+
+      ret = btc_script_verify(input,
+                              witness,
+                              output,
+                              &tx,
+                              0,
+                              value,
+                              flags,
+                              &cache);
+
+      if (ret == BTC_SCRIPT_ERR_OK && !btc_sigbatch_verify(batch))
+        ret = BTC_SCRIPT_ERR_SIG_NULLFAIL;
+
+      ASSERT((ret == BTC_SCRIPT_ERR_OK)
+          == (vec->expected == BTC_SCRIPT_ERR_OK));
+
+      btc_sigbatch_destroy(batch);
+    }
+
+    /* Same result when executing the decoded input script. */
+    {
+      btc_opvec_t ops;
+
+      btc_opvec_init(&ops);
+      btc_opvec_set(&ops, input);
+
+      memset(&cache, 0, sizeof(cache));
+
+      cache.scripts = &ops;
+
+      ret = btc_script_verify(input,
+                              witness,
+                              output,
+                              &tx,
+                              0,
+                              value,
+                              flags,
+                              &cache);
+
+      ASSERT(ret == vec->expected);
+
+      ASSERT(btc_opvec_is_push_only(&ops) == btc_script_is_push_only(input));
+      ASSERT(btc_opvec_sigops(&ops, 1) == btc_script_sigops(input, 1));
+
+      btc_opvec_clear(&ops);
+    }
   }
 
   btc_tx_clear(&prev);
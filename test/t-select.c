@@ -0,0 +1,105 @@
+/*!
+ * t-select.c - coin selector test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/address.h>
+#include <mako/coins.h>
+#include <mako/script.h>
+#include <mako/select.h>
+#include <mako/tx.h>
+#include "lib/tests.h"
+
+static const uint8_t key_hash[20] = {1, 2, 3};
+
+static void
+push_coin(btc_selector_t *sel, uint32_t index, int64_t value, int coinbase) {
+  uint8_t hash[32];
+  btc_outpoint_t prevout;
+  btc_coin_t coin;
+
+  memset(hash, 0xaa, 32);
+
+  btc_outpoint_set(&prevout, hash, index);
+
+  btc_coin_init(&coin);
+
+  coin.height = 150;
+  coin.coinbase = coinbase;
+  coin.output.value = value;
+
+  btc_script_set_p2wpkh(&coin.output.script, key_hash);
+
+  btc_selector_push(sel, &prevout, &coin);
+
+  btc_coin_clear(&coin);
+}
+
+static btc_tx_t *
+fund(const int64_t *values, size_t len) {
+  btc_tx_t *tx = btc_tx_create();
+  btc_selector_t sel;
+  btc_address_t addr;
+  btc_selopt_t opt;
+  size_t i;
+
+  btc_address_init(&addr);
+  btc_address_set_p2wpkh(&addr, key_hash);
+
+  btc_tx_add_output(tx, &addr, 100000);
+
+  btc_selopt_init(&opt);
+
+  opt.strategy = BTC_SELECT_BNB;
+  opt.rate = 10000;
+  opt.ltrate = 10000;
+  opt.height = 200;
+
+  btc_selector_init(&sel, &opt, tx);
+
+  /* An immature coinbase that would match on its own. */
+  push_coin(&sel, 100, 101120, 1);
+
+  for (i = 0; i < len; i++)
+    push_coin(&sel, i, values[i], 0);
+
+  ASSERT(btc_selector_fill(&sel, &addr));
+
+  btc_selector_clear(&sel);
+
+  return tx;
+}
+
+static void
+test_bnb(void) {
+  /* 60680 + 41120 pays the output and the fee exactly
+     (68 vbytes per input, 44 for the rest at 10 sat/vb). */
+  static const int64_t exact[] = {30000, 60680, 1000000, 41120, 500};
+  static const int64_t none[] = {1000000, 500};
+  btc_tx_t *tx;
+
+  tx = fund(exact, lengthof(exact));
+
+  ASSERT(tx->inputs.length == 2);
+  ASSERT(tx->outputs.length == 1);
+
+  btc_tx_destroy(tx);
+
+  /* No changeless solution: largest-first with change. */
+  tx = fund(none, lengthof(none));
+
+  ASSERT(tx->inputs.length == 1);
+  ASSERT(tx->outputs.length == 2);
+
+  btc_tx_destroy(tx);
+}
+
+int
+main(void) {
+  test_bnb();
+  return 0;
+}
@@ -1,14 +1,190 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-sha256.c - sha256 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/hash.h>
+#include <mako/encoding.h>
 #include "lib/tests.h"
 
-int main(void) {
+static const struct {
+  const char *msg;
+  size_t repeat;
+  const char *expect;
+} test_sha256_vectors[] = {
+  {
+    "",
+    1,
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+  },
+  {
+    "abc",
+    1,
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+  },
+  {
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    1,
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+  },
+  {
+    "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+    "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+    1,
+    "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"
+  },
+  {
+    "a",
+    1000000,
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"
+  }
+};
+
+static void
+test_sha256_vector(size_t index) {
+  const char *msg = test_sha256_vectors[index].msg;
+  size_t repeat = test_sha256_vectors[index].repeat;
+  size_t len = strlen(msg);
+  uint8_t expect[32];
+  uint8_t out[32];
+  btc_sha256_t ctx;
+  uint8_t *data;
+  size_t i;
+
+  printf("sha256 vector #%d\n", (int)index);
+
+  ASSERT(btc_base16_decode(expect, test_sha256_vectors[index].expect, 64));
+
+  /* Incremental. */
+  btc_sha256_init(&ctx);
+
+  for (i = 0; i < repeat; i++)
+    btc_sha256_update(&ctx, msg, len);
+
+  btc_sha256_final(&ctx, out);
+
+  ASSERT(memcmp(out, expect, 32) == 0);
+
+  /* One shot (exercises multi-block updates). */
+  data = malloc(len * repeat + 1);
+
+  ASSERT(data != NULL);
+
+  for (i = 0; i < repeat; i++)
+    memcpy(data + i * len, msg, len);
+
+  btc_sha256(out, data, len * repeat);
+
+  ASSERT(memcmp(out, expect, 32) == 0);
+
+  free(data);
+}
+
+static void
+test_sha256d64(void) {
+  uint8_t in[64 * 37];
+  uint8_t out[32 * 37];
+  uint8_t expect[32];
+  size_t i, n;
+
+  printf("sha256d64\n");
+
+  for (i = 0; i < sizeof(in); i++)
+    in[i] = (uint8_t)(i * 7 + 3);
+
+  for (n = 0; n <= 37; n++) {
+    memset(out, 0, sizeof(out));
+
+    btc_sha256d64(out, in, n);
+
+    for (i = 0; i < n; i++) {
+      btc_hash256(expect, in + i * 64, 64);
+
+      ASSERT(memcmp(out + i * 32, expect, 32) == 0);
+    }
+  }
+
+  /* In-place (merkle tree levels). */
+  memcpy(out, in, 64 * 18);
+
+  btc_sha256d64(out, out, 18);
+
+  for (i = 0; i < 18; i++) {
+    btc_hash256(expect, in + i * 64, 64);
+
+    ASSERT(memcmp(out + i * 32, expect, 32) == 0);
+  }
+}
+
+static void
+test_sha256d80_scan(void) {
+  static const uint32_t his[] = { 0xffffffff, 0x0fffffff, 0x00ffffff, 0 };
+  uint8_t hdr[80];
+  uint8_t expect[32];
+  uint8_t out[32];
+  btc_sha256_t ctx;
+  uint32_t nonce, count, n, hi;
+  size_t i, j;
+
+  printf("sha256d80_scan\n");
+
+  for (i = 0; i < 80; i++)
+    hdr[i] = (uint8_t)(i * 13 + 5);
+
+  btc_sha256_init(&ctx);
+  btc_sha256_update(&ctx, hdr, 76);
+
+  for (i = 0; i < lengthof(his); i++) {
+    hi = his[i];
+
+    for (count = 1; count <= 37; count += 9) {
+      /* Start near the top to exercise wrapping. */
+      for (j = 0; j < 2; j++) {
+        nonce = j ? 0xfffffff0 : 1000;
+        n = nonce;
+
+        for (; n != nonce + count; n++) {
+          hdr[76] = n;
+          hdr[77] = n >> 8;
+          hdr[78] = n >> 16;
+          hdr[79] = n >> 24;
+
+          btc_hash256(expect, hdr, 80);
+
+          if ((((uint32_t)expect[31] << 24) | ((uint32_t)expect[30] << 16)
+             | ((uint32_t)expect[29] << 8) | expect[28]) <= hi) {
+            break;
+          }
+        }
+
+        if (n == nonce + count) {
+          ASSERT(!btc_sha256d80_scan(out, &nonce, count, &ctx, hi));
+        } else {
+          ASSERT(btc_sha256d80_scan(out, &nonce, count, &ctx, hi));
+          ASSERT(memcmp(out, expect, 32) == 0);
+        }
+
+        ASSERT(nonce == n);
+      }
+    }
+  }
+}
+
+int
+main(void) {
+  size_t i;
+
+  for (i = 0; i < lengthof(test_sha256_vectors); i++)
+    test_sha256_vector(i);
+
+  test_sha256d64();
+  test_sha256d80_scan();
+
   return 0;
 }
@@ -0,0 +1,460 @@
+/*!
+ * t-stratum.c - stratum test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <io/loop.h>
+#include <mako/crypto/hash.h>
+#include <mako/encoding.h>
+#include <mako/header.h>
+#include <mako/json.h>
+#include <mako/netaddr.h>
+#include <mako/network.h>
+#include <mako/util.h>
+#include <node/chain.h>
+#include <node/miner.h>
+#include <node/stratum.h>
+#include <node/types.h>
+#include "lib/tests.h"
+
+typedef struct test_client_s {
+  char *data;
+  size_t length;
+  int connected;
+} test_client_t;
+
+typedef struct test_job_s {
+  char id[9];
+  uint8_t prev_block[32];
+  char coinb1[1024];
+  char coinb2[1024];
+  uint8_t branch[32][32];
+  size_t length;
+  uint32_t version;
+  uint32_t bits;
+  uint32_t time;
+} test_job_t;
+
+static int
+on_data(btc_socket_t *socket, const void *data, size_t size) {
+  test_client_t *client = btc_socket_get_data(socket);
+
+  client->data = realloc(client->data, client->length + size);
+
+  ASSERT(client->data != NULL);
+
+  memcpy(client->data + client->length, data, size);
+
+  client->length += size;
+
+  return 1;
+}
+
+static void
+on_connect(btc_socket_t *socket) {
+  test_client_t *client = btc_socket_get_data(socket);
+  client->connected = 1;
+}
+
+static void
+on_close(btc_socket_t *socket) {
+  (void)socket;
+}
+
+static void
+on_error(btc_socket_t *socket) {
+  fprintf(stderr, "%s\n", btc_socket_strerror(socket));
+  ASSERT(0);
+}
+
+static void
+send_line(btc_socket_t *socket, const char *line) {
+  ASSERT(btc_socket_write_static(socket, line, strlen(line)) != -1);
+}
+
+static json_value *
+recv_line(btc_loop_t *loop, test_client_t *client) {
+  int64_t start = btc_time_msec();
+  json_value *obj;
+  char *nl;
+  size_t n;
+
+  for (;;) {
+    nl = client->length > 0 ? memchr(client->data, '\n', client->length)
+                            : NULL;
+
+    if (nl != NULL)
+      break;
+
+    ASSERT(btc_time_msec() < start + 10 * 1000);
+
+    btc_loop_poll(loop, 10);
+  }
+
+  n = nl - client->data;
+  obj = json_decode(client->data, n);
+
+  ASSERT(obj != NULL && obj->type == json_object);
+
+  memmove(client->data, nl + 1, client->length - n - 1);
+
+  client->length -= n + 1;
+
+  return obj;
+}
+
+static const json_value *
+get_param(const json_value *obj, size_t index) {
+  const json_value *params = json_object_get(obj, "params");
+
+  ASSERT(params != NULL && params->type == json_array);
+  ASSERT(index < params->u.array.length);
+
+  return params->u.array.values[index];
+}
+
+static uint32_t
+get_hex32(const json_value *val) {
+  uint8_t raw[4];
+
+  ASSERT(val->type == json_string && val->u.string.length == 8);
+  ASSERT(btc_base16_decode(raw, val->u.string.ptr, 8));
+
+  return ((uint32_t)raw[0] << 24)
+       | ((uint32_t)raw[1] << 16)
+       | ((uint32_t)raw[2] <<  8)
+       | ((uint32_t)raw[3] <<  0);
+}
+
+static void
+expect_method(const json_value *obj, const char *method) {
+  const json_value *val = json_object_get(obj, "method");
+
+  ASSERT(val != NULL && val->type == json_string);
+  ASSERT(strcmp(val->u.string.ptr, method) == 0);
+}
+
+static void
+expect_result(const json_value *obj, int id, int error) {
+  const json_value *val = json_object_get(obj, "id");
+  const json_value *err = json_object_get(obj, "error");
+
+  ASSERT(val != NULL && val->type == json_integer);
+  ASSERT(val->u.integer == id);
+  ASSERT(err != NULL);
+
+  if (error == 0) {
+    ASSERT(err->type == json_null);
+  } else {
+    ASSERT(err->type == json_array && err->u.array.length == 3);
+    ASSERT(err->u.array.values[0]->type == json_integer);
+    ASSERT(err->u.array.values[0]->u.integer == error);
+  }
+}
+
+static void
+read_job(test_job_t *job, const json_value *obj) {
+  const json_value *val;
+  size_t i;
+
+  expect_method(obj, "mining.notify");
+
+  val = get_param(obj, 0);
+  ASSERT(val->type == json_string && val->u.string.length == 8);
+  memcpy(job->id, val->u.string.ptr, 9);
+
+  /* Undo the word swap on the previous hash. */
+  val = get_param(obj, 1);
+  ASSERT(val->type == json_string && val->u.string.length == 64);
+  ASSERT(btc_base16_decode(job->prev_block, val->u.string.ptr, 64));
+
+  for (i = 0; i < 32; i += 4) {
+    uint8_t *p = &job->prev_block[i];
+    uint8_t t;
+
+    t = p[0]; p[0] = p[3]; p[3] = t;
+    t = p[1]; p[1] = p[2]; p[2] = t;
+  }
+
+  val = get_param(obj, 2);
+  ASSERT(val->u.string.length < sizeof(job->coinb1));
+  strcpy(job->coinb1, val->u.string.ptr);
+
+  val = get_param(obj, 3);
+  ASSERT(val->u.string.length < sizeof(job->coinb2));
+  strcpy(job->coinb2, val->u.string.ptr);
+
+  val = get_param(obj, 4);
+  ASSERT(val->type == json_array && val->u.array.length <= 32);
+
+  job->length = val->u.array.length;
+
+  for (i = 0; i < job->length; i++) {
+    const json_value *item = val->u.array.values[i];
+
+    ASSERT(item->u.string.length == 64);
+    ASSERT(btc_base16_decode(job->branch[i], item->u.string.ptr, 64));
+  }
+
+  job->version = get_hex32(get_param(obj, 5));
+  job->bits = get_hex32(get_param(obj, 6));
+  job->time = get_hex32(get_param(obj, 7));
+}
+
+static uint32_t
+solve_job(const test_job_t *job,
+          const char *nonce1,
+          const char *nonce2,
+          int want) {
+  uint8_t raw[2048];
+  uint8_t target[32];
+  uint8_t hash[32];
+  btc_header_t hdr;
+  char hex[4096];
+  size_t i, len;
+
+  /* Rebuild the coinbase. */
+  sprintf(hex, "%s%s%s%s", job->coinb1, nonce1, nonce2, job->coinb2);
+
+  len = strlen(hex) / 2;
+
+  ASSERT(btc_base16_decode(raw, hex, len * 2));
+
+  btc_header_init(&hdr);
+
+  btc_hash256(hdr.merkle_root, raw, len);
+
+  for (i = 0; i < job->length; i++)
+    btc_hash256_root(hdr.merkle_root, hdr.merkle_root, job->branch[i]);
+
+  hdr.version = job->version;
+  hdr.time = job->time;
+  hdr.bits = job->bits;
+
+  btc_hash_copy(hdr.prev_block, job->prev_block);
+
+  ASSERT(btc_compact_export(target, job->bits));
+
+  /* Find a nonce that does (or does not) meet the target. */
+  for (hdr.nonce = 0;; hdr.nonce++) {
+    btc_header_hash(hash, &hdr);
+
+    if ((btc_hash_compare(hash, target) <= 0) == want)
+      break;
+  }
+
+  return hdr.nonce;
+}
+
+int
+main(void) {
+  const btc_network_t *network = btc_regtest;
+  char nonce1[9], line[256], pair[512];
+  test_client_t client;
+  btc_stratum_t *stratum;
+  const json_value *val;
+  btc_sockaddr_t addr;
+  btc_netaddr_t bind;
+  btc_socket_t *sock;
+  btc_chain_t *chain;
+  btc_miner_t *miner;
+  btc_loop_t *loop;
+  json_value *obj;
+  test_job_t job;
+  uint32_t nonce;
+  int64_t start;
+
+  btc_net_startup();
+
+  btc_clean(BTC_PREFIX);
+
+  /* Setup. */
+  loop = btc_loop_create();
+  chain = btc_chain_create(network);
+  miner = btc_miner_create(network, loop, chain, NULL);
+  stratum = btc_stratum_create(network, loop, chain, miner);
+
+  ASSERT(btc_sockaddr_import(&addr, "127.0.0.1", 1340));
+
+  btc_netaddr_set_sockaddr(&bind, &addr);
+
+  btc_stratum_set_bind(stratum, &bind);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, BTC_CHAIN_DEFAULT_FLAGS));
+  ASSERT(btc_miner_open(miner, 0));
+  ASSERT(btc_stratum_open(stratum, BTC_STRATUM_LISTEN));
+
+  /* Client. */
+  memset(&client, 0, sizeof(client));
+
+  sock = btc_loop_connect(loop, &addr);
+
+  ASSERT(sock != NULL);
+
+  btc_socket_set_data(sock, &client);
+  btc_socket_on_connect(sock, on_connect);
+  btc_socket_on_data(sock, on_data);
+  btc_socket_on_close(sock, on_close);
+  btc_socket_on_error(sock, on_error);
+
+  start = btc_time_msec();
+
+  while (!client.connected) {
+    ASSERT(btc_time_msec() < start + 10 * 1000);
+    btc_loop_poll(loop, 100);
+  }
+
+  /* Shares before subscribing are refused. */
+  send_line(sock, "{\"id\":1,\"method\":\"mining.submit\","
+                  "\"params\":[\"w\",\"00000001\",\"00000000\","
+                  "\"00000000\",\"00000000\"]}\n");
+
+  obj = recv_line(loop, &client);
+  expect_result(obj, 1, 25);
+  json_builder_free(obj);
+
+  /* Subscribe. */
+  send_line(sock, "{\"id\":2,\"method\":\"mining.subscribe\","
+                  "\"params\":[]}\n");
+
+  obj = recv_line(loop, &client);
+  expect_result(obj, 2, 0);
+
+  val = json_object_get(obj, "result");
+
+  ASSERT(val != NULL && val->type == json_array);
+  ASSERT(val->u.array.length == 3);
+  ASSERT(val->u.array.values[1]->type == json_string);
+  ASSERT(val->u.array.values[1]->u.string.length == 8);
+  ASSERT(val->u.array.values[2]->u.integer == 4);
+
+  memcpy(nonce1, val->u.array.values[1]->u.string.ptr, 9);
+
+  json_builder_free(obj);
+
+  obj = recv_line(loop, &client);
+  expect_method(obj, "mining.set_difficulty");
+  ASSERT(get_param(obj, 0)->type == json_double);
+  json_builder_free(obj);
+
+  obj = recv_line(loop, &client);
+  read_job(&job, obj);
+  ASSERT(get_param(obj, 8)->type == json_boolean);
+  ASSERT(get_param(obj, 8)->u.boolean == 1);
+  json_builder_free(obj);
+
+  ASSERT(job.bits == network->pow.bits);
+  ASSERT(btc_hash_equal(job.prev_block, btc_chain_tip(chain)->hash));
+
+  /* Unauthorized. */
+  nonce = solve_job(&job, nonce1, "00000000", 1);
+
+  sprintf(line, "{\"id\":3,\"method\":\"mining.submit\","
+                "\"params\":[\"w\",\"%s\",\"00000000\","
+                "\"%08lx\",\"%08lx\"]}\n",
+                job.id, (unsigned long)job.time, (unsigned long)nonce);
+
+  send_line(sock, line);
+
+  obj = recv_line(loop, &client);
+  expect_result(obj, 3, 24);
+  json_builder_free(obj);
+
+  /* Authorize. */
+  send_line(sock, "{\"id\":4,\"method\":\"mining.authorize\","
+                  "\"params\":[\"w\",\"x\"]}\n");
+
+  obj = recv_line(loop, &client);
+  expect_result(obj, 4, 0);
+  ASSERT(json_object_get(obj, "result")->type == json_boolean);
+  json_builder_free(obj);
+
+  /* Unknown job. */
+  send_line(sock, "{\"id\":5,\"method\":\"mining.submit\","
+                  "\"params\":[\"w\",\"ffffffff\",\"00000000\","
+                  "\"00000000\",\"00000000\"]}\n");
+
+  obj = recv_line(loop, &client);
+  expect_result(obj, 5, 21);
+  json_builder_free(obj);
+
+  /* Low difficulty. */
+  nonce = solve_job(&job, nonce1, "00000001", 0);
+
+  sprintf(line, "{\"id\":6,\"method\":\"mining.submit\","
+                "\"params\":[\"w\",\"%s\",\"00000001\","
+                "\"%08lx\",\"%08lx\"]}\n",
+                job.id, (unsigned long)job.time, (unsigned long)nonce);
+
+  send_line(sock, line);
+
+  obj = recv_line(loop, &client);
+  expect_result(obj, 6, 23);
+  json_builder_free(obj);
+
+  ASSERT(btc_chain_height(chain) == 0);
+
+  /* Block. */
+  nonce = solve_job(&job, nonce1, "00000002", 1);
+
+  sprintf(line, "{\"id\":7,\"method\":\"mining.submit\","
+                "\"params\":[\"w\",\"%s\",\"00000002\","
+                "\"%08lx\",\"%08lx\"]}\n",
+                job.id, (unsigned long)job.time, (unsigned long)nonce);
+
+  /* Send it twice in one go so the job is
+     still around for the duplicate check. */
+  sprintf(pair, "%s%s", line, line);
+
+  send_line(sock, pair);
+
+  obj = recv_line(loop, &client);
+  expect_result(obj, 7, 0);
+  ASSERT(json_object_get(obj, "result")->u.boolean == 1);
+  json_builder_free(obj);
+
+  obj = recv_line(loop, &client);
+  expect_result(obj, 7, 22);
+  json_builder_free(obj);
+
+  ASSERT(btc_chain_height(chain) == 1);
+
+  /* The new tip produces clean work. */
+  obj = recv_line(loop, &client);
+
+  if (strcmp(json_object_get(obj, "method")->u.string.ptr,
+             "mining.set_difficulty") == 0) {
+    json_builder_free(obj);
+    obj = recv_line(loop, &client);
+  }
+
+  read_job(&job, obj);
+  ASSERT(get_param(obj, 8)->u.boolean == 1);
+  json_builder_free(obj);
+
+  ASSERT(btc_hash_equal(job.prev_block, btc_chain_tip(chain)->hash));
+
+  /* Cleanup. */
+  btc_stratum_close(stratum);
+  btc_miner_close(miner);
+  btc_chain_close(chain);
+  btc_loop_close(loop);
+
+  btc_stratum_destroy(stratum);
+  btc_miner_destroy(miner);
+  btc_chain_destroy(chain);
+  btc_loop_destroy(loop);
+
+  free(client.data);
+
+  btc_net_cleanup();
+
+  return 0;
+}
@@ -0,0 +1,366 @@
+/*!
+ * t-taproot.c - taproot test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <mako/coins.h>
+#include <mako/crypto/ecc.h>
+#include <mako/crypto/hash.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include "lib/tests.h"
+
+/*
+ * Helpers
+ */
+
+static void
+tagged_hash(uint8_t *out,
+            const char *tag,
+            const uint8_t *x, size_t xn,
+            const uint8_t *y, size_t yn) {
+  btc_sha256_t ctx;
+  uint8_t tmp[32];
+
+  btc_sha256(tmp, tag, strlen(tag));
+
+  btc_sha256_init(&ctx);
+  btc_sha256_update(&ctx, tmp, 32);
+  btc_sha256_update(&ctx, tmp, 32);
+  btc_sha256_update(&ctx, x, xn);
+  btc_sha256_update(&ctx, y, yn);
+  btc_sha256_final(&ctx, out);
+}
+
+static void
+leaf_hash(uint8_t *out, const btc_script_t *script) {
+  uint8_t tmp[2];
+
+  ASSERT(script->length < 0xfd);
+
+  tmp[0] = 0xc0;
+  tmp[1] = script->length;
+
+  tagged_hash(out, "TapLeaf", tmp, 2, script->data, script->length);
+}
+
+static void
+branch_hash(uint8_t *out, const uint8_t *x, const uint8_t *y) {
+  if (memcmp(x, y, 32) < 0)
+    tagged_hash(out, "TapBranch", x, 32, y, 32);
+  else
+    tagged_hash(out, "TapBranch", y, 32, x, 32);
+}
+
+/*
+ * Context
+ */
+
+typedef struct test_ctx_s {
+  uint8_t priv[32];
+  uint8_t pub[32];
+  uint8_t leaf_priv[32];
+  uint8_t leaf_pub[32];
+  uint8_t tweak[32];
+  uint8_t output_priv[32];
+  uint8_t output_pub[32];
+  uint8_t leaf[32];
+  uint8_t other[32];
+  int negated;
+  btc_script_t script;
+  btc_tx_t prev;
+  btc_tx_t tx;
+  btc_view_t *view;
+} test_ctx_t;
+
+static void
+test_ctx_init(test_ctx_t *ctx) {
+  static const uint8_t other_code[1] = { BTC_OP_1 };
+  btc_program_t program;
+  btc_output_t *output;
+  btc_input_t *input;
+  btc_script_t other;
+  uint8_t root[32];
+  uint8_t hash[32];
+  uint8_t check[32];
+  int i;
+
+  memset(ctx->priv, 0x01, 32);
+  memset(ctx->leaf_priv, 0x02, 32);
+
+  ASSERT(btc_bip340_pubkey_create(ctx->pub, ctx->priv));
+  ASSERT(btc_bip340_pubkey_create(ctx->leaf_pub, ctx->leaf_priv));
+
+  /* Leaf A: <leaf_pub> OP_CHECKSIG */
+  btc_script_init(&ctx->script);
+  btc_script_grow(&ctx->script, 34);
+
+  ctx->script.data[0] = 32;
+  memcpy(ctx->script.data + 1, ctx->leaf_pub, 32);
+  ctx->script.data[33] = BTC_OP_CHECKSIG;
+  ctx->script.length = 34;
+
+  /* Leaf B: OP_1 */
+  btc_script_roset(&other, other_code, sizeof(other_code));
+
+  leaf_hash(ctx->leaf, &ctx->script);
+  leaf_hash(ctx->other, &other);
+  branch_hash(root, ctx->leaf, ctx->other);
+
+  tagged_hash(ctx->tweak, "TapTweak", ctx->pub, 32, root, 32);
+
+  ASSERT(btc_bip340_pubkey_tweak_add(ctx->output_pub, &ctx->negated,
+                                     ctx->pub, ctx->tweak));
+
+  ASSERT(btc_bip340_privkey_tweak_add(ctx->output_priv,
+                                      ctx->priv, ctx->tweak));
+
+  ASSERT(btc_bip340_pubkey_create(check, ctx->output_priv));
+  ASSERT(memcmp(check, ctx->output_pub, 32) == 0);
+
+  /* Funding transaction. */
+  btc_tx_init(&ctx->prev);
+
+  input = btc_input_create();
+  btc_inpvec_push(&ctx->prev.inputs, input);
+
+  program.version = 1;
+  program.data = ctx->output_pub;
+  program.length = 32;
+
+  for (i = 0; i < 2; i++) {
+    output = btc_output_create();
+    output->value = 50000;
+    btc_script_set_program(&output->script, &program);
+    btc_outvec_push(&ctx->prev.outputs, output);
+  }
+
+  btc_tx_refresh(&ctx->prev);
+  btc_tx_txid(hash, &ctx->prev);
+
+  /* Spending transaction. */
+  btc_tx_init(&ctx->tx);
+
+  for (i = 0; i < 2; i++) {
+    input = btc_input_create();
+    btc_outpoint_set(&input->prevout, hash, i);
+    btc_inpvec_push(&ctx->tx.inputs, input);
+  }
+
+  for (i = 0; i < 2; i++) {
+    output = btc_output_create();
+    output->value = 45000;
+    btc_script_set_program(&output->script, &program);
+    btc_outvec_push(&ctx->tx.outputs, output);
+  }
+
+  ctx->view = btc_view_create();
+
+  btc_view_add(ctx->view, &ctx->prev, 1, 0);
+}
+
+static void
+test_ctx_clear(test_ctx_t *ctx) {
+  btc_script_clear(&ctx->script);
+  btc_tx_clear(&ctx->prev);
+  btc_tx_clear(&ctx->tx);
+  btc_view_destroy(ctx->view);
+}
+
+static void
+test_ctx_sign(test_ctx_t *ctx, int type) {
+  const btc_script_t *prev = &ctx->prev.outputs.items[0]->script;
+  btc_stack_t *witness;
+  btc_tx_cache_t cache;
+  uint8_t control[65];
+  uint8_t sig[65];
+  uint8_t msg[32];
+  uint8_t aux[32];
+  size_t len = 64 + (type != 0);
+
+  memset(aux, 0, 32);
+
+  btc_tx_cache_init(&cache, &ctx->tx, ctx->view);
+
+  ASSERT(cache.has_taproot);
+
+  /* Input 0: key path. */
+  ASSERT(btc_tx_sighash_taproot(msg, &ctx->tx, 0, prev, 50000, type,
+                                NULL, NULL, 0xffffffff, &cache));
+
+  ASSERT(btc_bip340_sign(sig, msg, 32, ctx->output_priv, aux));
+
+  sig[64] = type;
+
+  witness = &ctx->tx.inputs.items[0]->witness;
+
+  btc_stack_push_data(witness, sig, len);
+
+  /* Input 1: script path (leaf A). */
+  ASSERT(btc_tx_sighash_taproot(msg, &ctx->tx, 1, prev, 50000, type,
+                                NULL, ctx->leaf, 0xffffffff, &cache));
+
+  ASSERT(btc_bip340_sign(sig, msg, 32, ctx->leaf_priv, aux));
+
+  sig[64] = type;
+
+  control[0] = 0xc0 | ctx->negated;
+  memcpy(control + 1, ctx->pub, 32);
+  memcpy(control + 33, ctx->other, 32);
+
+  witness = &ctx->tx.inputs.items[1]->witness;
+
+  btc_stack_push_data(witness, sig, len);
+  btc_stack_push_data(witness, ctx->script.data, ctx->script.length);
+  btc_stack_push_data(witness, control, 65);
+
+  btc_tx_refresh(&ctx->tx);
+}
+
+/*
+ * Tests
+ */
+
+static void
+test_taproot_valid(int type) {
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+  btc_sigbatch_t *batch = btc_sigbatch_create();
+  test_ctx_t ctx;
+
+  printf("taproot valid (type=%d)\n", type);
+
+  test_ctx_init(&ctx);
+  test_ctx_sign(&ctx, type);
+
+  ASSERT(btc_tx_verify(&ctx.tx, ctx.view, flags));
+
+  ASSERT(btc_tx_verify_batch(&ctx.tx, ctx.view, flags, batch));
+  ASSERT(btc_sigbatch_length(batch) == 2);
+  ASSERT(btc_sigbatch_verify(batch));
+  ASSERT(btc_sigbatch_length(batch) == 0);
+
+  btc_sigbatch_destroy(batch);
+  test_ctx_clear(&ctx);
+}
+
+static void
+test_taproot_invalid(size_t index) {
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+  btc_sigbatch_t *batch = btc_sigbatch_create();
+  btc_buffer_t *sig;
+  test_ctx_t ctx;
+
+  printf("taproot invalid signature (input=%d)\n", (int)index);
+
+  test_ctx_init(&ctx);
+  test_ctx_sign(&ctx, 0);
+
+  sig = ctx.tx.inputs.items[index]->witness.items[0];
+  sig->data[5] ^= 1;
+
+  ASSERT(!btc_tx_verify(&ctx.tx, ctx.view, flags));
+
+  /* Failure is deferred to the batch. */
+  ASSERT(btc_tx_verify_batch(&ctx.tx, ctx.view, flags, batch));
+  ASSERT(!btc_sigbatch_verify(batch));
+
+  /* Unknown witness program without taproot. */
+  flags &= ~BTC_SCRIPT_VERIFY_TAPROOT;
+  flags &= ~BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM;
+
+  ASSERT(btc_tx_verify(&ctx.tx, ctx.view, flags));
+
+  btc_sigbatch_destroy(batch);
+  test_ctx_clear(&ctx);
+}
+
+static void
+test_taproot_shared(void) {
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+  btc_sigbatch_t *batch = btc_sigbatch_create();
+  const btc_tx_cache_t *cache;
+  btc_buffer_t *sig;
+  test_ctx_t ctx;
+
+  printf("taproot shared midstates\n");
+
+  test_ctx_init(&ctx);
+  test_ctx_sign(&ctx, 0);
+
+  cache = btc_tx_precompute(&ctx.tx, ctx.view);
+
+  ASSERT(cache != NULL);
+  ASSERT(cache->has_prevouts && cache->has_taproot);
+  ASSERT(cache->batch == NULL);
+  ASSERT(btc_tx_precompute(&ctx.tx, ctx.view) == cache);
+
+  ASSERT(btc_tx_verify(&ctx.tx, ctx.view, flags));
+  ASSERT(btc_tx_verify_batch(&ctx.tx, ctx.view, flags, batch));
+  ASSERT(btc_sigbatch_verify(batch));
+
+  /* The shared copy is never written to. */
+  ASSERT(cache->batch == NULL);
+
+  sig = ctx.tx.inputs.items[0]->witness.items[0];
+  sig->data[5] ^= 1;
+
+  ASSERT(!btc_tx_verify(&ctx.tx, ctx.view, flags));
+
+  /* Mutations drop the midstates. */
+  btc_tx_refresh(&ctx.tx);
+
+  ASSERT(ctx.tx._cache == NULL);
+
+  btc_sigbatch_destroy(batch);
+  test_ctx_clear(&ctx);
+}
+
+static void
+test_taproot_control(void) {
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+  btc_buffer_t *control;
+  test_ctx_t ctx;
+
+  printf("taproot invalid control block\n");
+
+  test_ctx_init(&ctx);
+  test_ctx_sign(&ctx, 0);
+
+  control = ctx.tx.inputs.items[1]->witness.items[2];
+
+  /* Wrong parity. */
+  control->data[0] ^= 1;
+
+  ASSERT(!btc_tx_verify(&ctx.tx, ctx.view, flags));
+
+  control->data[0] ^= 1;
+
+  /* Wrong size. */
+  control->length -= 1;
+
+  ASSERT(!btc_tx_verify(&ctx.tx, ctx.view, flags));
+
+  control->length += 1;
+
+  ASSERT(btc_tx_verify(&ctx.tx, ctx.view, flags));
+
+  test_ctx_clear(&ctx);
+}
+
+int
+main(void) {
+  test_taproot_valid(0);
+  test_taproot_valid(BTC_SIGHASH_ALL);
+  test_taproot_valid(BTC_SIGHASH_SINGLE | BTC_SIGHASH_ANYONECANPAY);
+  test_taproot_invalid(0);
+  test_taproot_invalid(1);
+  test_taproot_shared();
+  test_taproot_control();
+  return 0;
+}
@@ -0,0 +1,132 @@
+/*!
+ * t-trace.c - trace test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <io/trace.h>
+#include <io/workers.h>
+#include "lib/tests.h"
+
+#define NUM_TASKS 100
+
+static char trace_buf[1 << 16];
+
+static void
+noop_work(void *arg) {
+  (void)arg;
+}
+
+static const char *
+read_trace(const char *file) {
+  FILE *stream = fopen(file, "rb");
+  size_t len;
+
+  ASSERT(stream != NULL);
+
+  len = fread(trace_buf, 1, sizeof(trace_buf) - 1, stream);
+
+  fclose(stream);
+
+  trace_buf[len] = '\0';
+
+  return trace_buf;
+}
+
+static void
+test_trace(const char *file) {
+  btc_workers_t *pool = btc_workers_create(2, 1);
+  const char *json;
+  size_t events;
+  int i;
+
+  ASSERT(!btc_trace_active());
+  ASSERT(!btc_trace_stop(file, &events));
+  ASSERT(events == 0);
+
+  ASSERT(btc_trace_start(0));
+  ASSERT(!btc_trace_start(0));
+  ASSERT(btc_trace_active());
+
+  BTC_TRACE_BEGIN("test", "main");
+
+  for (i = 0; i < NUM_TASKS; i++)
+    btc_workers_add(pool, noop_work, NULL);
+
+  btc_workers_wait(pool);
+
+  BTC_TRACE_BEGIN("test", "bad name\"");
+  BTC_TRACE_END("test", "bad name\"");
+
+  BTC_TRACE_END("test", "main");
+
+  ASSERT(btc_trace_stop(file, &events));
+  ASSERT(events == 4 + 2 * NUM_TASKS);
+  ASSERT(!btc_trace_active());
+
+  /* Nothing is recorded once stopped. */
+  BTC_TRACE_BEGIN("test", "late");
+
+  json = read_trace(file);
+
+  ASSERT(strncmp(json, "{\"traceEvents\":[\n", 17) == 0);
+  ASSERT(strstr(json, "\"name\":\"main\",\"cat\":\"test\",\"ph\":\"B\"")
+         != NULL);
+  ASSERT(strstr(json, "\"name\":\"task\",\"cat\":\"workers\"") != NULL);
+  ASSERT(strstr(json, "\"name\":\"bad?name?\"") != NULL);
+  ASSERT(strstr(json, "late") == NULL);
+
+  btc_workers_destroy(pool);
+}
+
+static void
+test_ring(const char *file) {
+  const char *json;
+  size_t events;
+  char name[8];
+  int i;
+
+  ASSERT(btc_trace_start(4));
+
+  for (i = 0; i < 10; i++) {
+    sprintf(name, "e%d", i);
+    BTC_TRACE_BEGIN("test", name);
+  }
+
+  ASSERT(btc_trace_stop(file, &events));
+  ASSERT(events == 4);
+
+  /* The newest events survive. */
+  json = read_trace(file);
+
+  ASSERT(strstr(json, "\"e5\"") == NULL);
+  ASSERT(strstr(json, "\"e6\"") != NULL);
+  ASSERT(strstr(json, "\"e9\"") != NULL);
+}
+
+int
+main(void) {
+  char file[BTC_PATH_MAX];
+
+#ifndef BTC_TRACE
+  ASSERT(!btc_trace_start(0));
+  ASSERT(!btc_trace_active());
+  return 0;
+#endif
+
+  ASSERT(btc_fs_mkdirp(BTC_PREFIX, 0755));
+  ASSERT(btc_path_join(file, sizeof(file), BTC_PREFIX, "trace.json", 0));
+
+  test_trace(file);
+  test_ring(file);
+
+  btc_fs_unlink(file);
+
+  return 0;
+}
@@ -8,7 +8,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <io/core.h>
+#include <io/workers.h>
 #include <mako/coins.h>
+#include <mako/crypto/ecc.h>
+#include <mako/crypto/hash.h>
 #include <mako/network.h>
 #include <mako/script.h>
 #include <mako/tx.h>
@@ -17,13 +21,71 @@
 #include "data/tx_invalid_vectors.h"
 #include "lib/tests.h"
 
+static btc_tx_t *
+slab_import(const btc_tx_t *tx, const uint8_t *raw, size_t len) {
+  btc_tx_t *slab = btc_tx_create();
+  btc_tx_t *copy = btc_tx_create();
+  const uint8_t *xp = raw;
+  size_t xn = len;
+  uint8_t *out;
+
+  ASSERT(btc_tx_read_slab(slab, &xp, &xn));
+  ASSERT(xn == 0);
+
+  ASSERT(btc_hash_equal(slab->hash, tx->hash));
+  ASSERT(btc_hash_equal(slab->whash, tx->whash));
+  ASSERT(btc_tx_base_size(slab) == btc_tx_base_size(tx));
+  ASSERT(btc_tx_witness_size(slab) == btc_tx_witness_size(tx));
+  ASSERT(btc_tx_legacy_sigops(slab) == btc_tx_legacy_sigops(tx));
+
+  out = malloc(len);
+
+  ASSERT(out != NULL);
+  ASSERT(btc_tx_export(out, slab) == len);
+  ASSERT(memcmp(out, raw, len) == 0);
+
+  /* Copies are ordinary heap objects. */
+  btc_tx_copy(copy, slab);
+
+  ASSERT(btc_tx_export(out, copy) == len);
+  ASSERT(memcmp(out, raw, len) == 0);
+
+  /* A slab tx can be overwritten. */
+  btc_tx_copy(slab, copy);
+
+  ASSERT(btc_tx_export(out, slab) == len);
+  ASSERT(memcmp(out, raw, len) == 0);
+
+  xp = raw;
+  xn = len;
+
+  ASSERT(btc_tx_read_slab(slab, &xp, &xn));
+
+  /* Truncation. */
+  if (len > 0) {
+    xp = raw;
+    xn = len - 1;
+
+    ASSERT(!btc_tx_read_slab(copy, &xp, &xn));
+  }
+
+  btc_tx_destroy(copy);
+
+  free(out);
+
+  return slab;
+}
+
 static void
 test_tx_valid_vector(const test_valid_vector_t *vec, size_t index) {
   uint8_t hash[32];
   uint8_t whash[32];
+  size_t base, wit;
+  btc_tx_t *slab;
   btc_coin_t *coin;
   btc_view_t *view;
   btc_tx_t tx;
+  int sigops;
   size_t i;
 
   printf("tx valid vector #%d: %s\n", (int)index, vec->comments);
@@ -40,11 +102,21 @@ test_tx_valid_vector(const test_valid_vector_t *vec, size_t index) {
   ASSERT(btc_hash_equal(tx.hash, hash));
   ASSERT(btc_hash_equal(tx.whash, whash));
 
+  base = btc_tx_base_size(&tx);
+  wit = btc_tx_witness_size(&tx);
+  sigops = btc_tx_legacy_sigops(&tx);
+
+  ASSERT(base + wit == vec->tx_len);
+
   btc_tx_refresh(&tx);
 
   ASSERT(btc_hash_equal(tx.hash, hash));
   ASSERT(btc_hash_equal(tx.whash, whash));
 
+  ASSERT(btc_tx_base_size(&tx) == base);
+  ASSERT(btc_tx_witness_size(&tx) == wit);
+  ASSERT(btc_tx_legacy_sigops(&tx) == sigops);
+
   for (i = 0; i < vec->coins_len; i++) {
     coin = btc_coin_create();
 
@@ -54,11 +126,38 @@ test_tx_valid_vector(const test_valid_vector_t *vec, size_t index) {
     btc_view_put(view, &vec->coins[i].outpoint, coin);
   }
 
-  if (strstr(vec->comments, "Coinbase") == vec->comments)
+  slab = slab_import(&tx, vec->tx_raw, vec->tx_len);
+
+  if (strstr(vec->comments, "Coinbase") == vec->comments) {
     ASSERT(btc_tx_check_sanity(NULL, &tx));
-  else
+    ASSERT(btc_tx_check_sanity(NULL, slab));
+  } else {
+    int cost = btc_tx_sigops_cost(&tx, view, vec->flags);
+    int inputs = btc_tx_has_standard_inputs(&tx, view);
+    int witness = btc_tx_has_standard_witness(&tx, view);
+
+    ASSERT(btc_tx_verify(&tx, view, vec->flags));
+    ASSERT(btc_tx_verify(slab, view, vec->flags));
+
+    /* The precomputed analysis agrees with a fresh one. */
+    ASSERT(btc_tx_precompute(&tx, view) != NULL);
+    ASSERT(btc_tx_sigops_cost(&tx, view, vec->flags) == cost);
+    ASSERT(btc_tx_has_standard_inputs(&tx, view) == inputs);
+    ASSERT(btc_tx_has_standard_witness(&tx, view) == witness);
     ASSERT(btc_tx_verify(&tx, view, vec->flags));
+  }
+
+  /* Mutators drop the memoized sizes. A 32 byte
+     nulldata output takes 8 + 1 + 34 bytes. */
+  if (tx.outputs.length < 0xfc) {
+    btc_tx_add_nulldata(&tx, hash, 32);
+
+    ASSERT(btc_tx_base_size(&tx) == base + 43);
+    ASSERT(btc_tx_witness_size(&tx) == wit);
+    ASSERT(btc_tx_legacy_sigops(&tx) == sigops);
+  }
 
+  btc_tx_destroy(slab);
   btc_tx_clear(&tx);
   btc_view_destroy(view);
 }
@@ -116,6 +215,204 @@ test_tx_invalid_vector(const test_invalid_vector_t *vec, size_t index) {
   btc_view_destroy(view);
 }
 
+/*
+ * Signing
+ */
+
+#define SIGN_INPUTS 64
+
+typedef struct sign_ctx_s {
+  const btc_signer_t *signer;
+  btc_tx_t *tx;
+  const btc_view_t *view;
+  btc_tx_cache_t cache;
+  btc_mutex_t *lock;
+  int total;
+} sign_ctx_t;
+
+static void
+sign_range(size_t start, size_t end, void *arg) {
+  sign_ctx_t *ctx = arg;
+  int total = btc_signer_sign(ctx->signer, ctx->tx, ctx->view,
+                              &ctx->cache, start, end);
+
+  btc_mutex_lock(ctx->lock);
+  ctx->total += total;
+  btc_mutex_unlock(ctx->lock);
+}
+
+static uint8_t sign_keys[3][32];
+
+static int
+derive_key(uint8_t *priv, const btc_address_t *addr, void *arg) {
+  uint8_t pub[33], h160[20];
+  btc_script_t redeem;
+  size_t i;
+
+  (void)arg;
+
+  btc_script_init(&redeem);
+
+  for (i = 0; i < 3; i++) {
+    ASSERT(btc_ecdsa_pubkey_create(pub, sign_keys[i], 1));
+
+    btc_hash160(h160, pub, 33);
+    btc_script_set_p2wpkh(&redeem, h160);
+
+    if (memcmp(addr->hash, h160, 20) != 0) {
+      btc_script_hash160(h160, &redeem);
+
+      if (memcmp(addr->hash, h160, 20) != 0)
+        continue;
+    }
+
+    memcpy(priv, sign_keys[i], 32);
+
+    break;
+  }
+
+  btc_script_clear(&redeem);
+
+  return i < 3;
+}
+
+static btc_tx_t *
+sign_tx(btc_view_t *view) {
+  btc_tx_t *tx = btc_tx_create();
+  uint8_t hash[32], h160[20];
+  btc_output_t *output;
+  btc_script_t redeem;
+  uint8_t pub[33];
+  size_t i;
+
+  memset(hash, 0x11, 32);
+
+  btc_script_init(&redeem);
+
+  for (i = 0; i < SIGN_INPUTS; i++) {
+    btc_coin_t *coin = btc_coin_create();
+    btc_outpoint_t prevout;
+
+    ASSERT(btc_ecdsa_pubkey_create(pub, sign_keys[i % 3], 1));
+
+    btc_hash160(h160, pub, 33);
+
+    switch (i % 5) {
+      case 0:
+        btc_script_set_p2pk(&coin->output.script, pub, 33);
+        break;
+      case 1:
+        btc_script_set_p2pkh(&coin->output.script, h160);
+        break;
+      case 2:
+        btc_script_set_p2wpkh(&coin->output.script, h160);
+        break;
+      case 3:
+        btc_script_set_p2wpkh(&redeem, h160);
+        btc_script_hash160(h160, &redeem);
+        btc_script_set_p2sh(&coin->output.script, h160);
+        break;
+      case 4:
+        /* Nobody's key. */
+        h160[0] ^= 1;
+        btc_script_set_p2pkh(&coin->output.script, h160);
+        break;
+    }
+
+    coin->output.value = 1000 + i;
+
+    btc_outpoint_set(&prevout, hash, i);
+    btc_tx_add_outpoint(tx, &prevout);
+    btc_view_put(view, &prevout, coin);
+  }
+
+  btc_script_clear(&redeem);
+
+  output = btc_output_create();
+  output->value = 1000;
+
+  btc_script_set_p2wpkh(&output->script, hash);
+  btc_outvec_push(&tx->outputs, output);
+
+  return tx;
+}
+
+static void
+test_sign(void) {
+  unsigned int flags = BTC_SCRIPT_STANDARD_VERIFY_FLAGS;
+  btc_workers_t *pool = btc_workers_create(4, 16);
+  btc_signer_t *signer = btc_signer_create();
+  int expect = SIGN_INPUTS - SIGN_INPUTS / 5;
+  uint8_t entropy[32];
+  btc_precomp_t *pre;
+  btc_view_t *view;
+  sign_ctx_t ctx;
+  btc_tx_t *tx;
+  size_t i;
+
+  printf("tx sign\n");
+
+  memset(entropy, 0xaa, 32);
+
+  pre = btc_precomp_create(entropy);
+
+  /* Shared by all threads, set before and after some keys. */
+  for (i = 0; i < 3; i++) {
+    memset(sign_keys[i], (int)i + 1, 32);
+    ASSERT(btc_signer_add(signer, sign_keys[i]));
+
+    if (i == 1)
+      btc_signer_set_precomp(signer, pre);
+  }
+
+  ASSERT(btc_signer_add(signer, sign_keys[0]));
+  ASSERT(btc_signer_size(signer) == 3);
+
+  view = btc_view_create();
+  tx = sign_tx(view);
+
+  /* Sign from the worker pool. */
+  ctx.signer = signer;
+  ctx.tx = tx;
+  ctx.view = view;
+  ctx.lock = btc_mutex_create();
+  ctx.total = 0;
+
+  btc_tx_cache_init(&ctx.cache, tx, NULL);
+  btc_parallel_for(pool, tx->inputs.length, 4, sign_range, &ctx);
+  btc_tx_uncache(tx);
+
+  ASSERT(ctx.total == expect);
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+    const btc_coin_t *coin = btc_view_get(view, &input->prevout);
+    int signed_ = (input->script.length > 0 || input->witness.length > 0);
+
+    ASSERT(signed_ == (i % 5 != 4));
+
+    if (signed_)
+      ASSERT(btc_tx_verify_input(tx, i, &coin->output, flags, NULL));
+  }
+
+  btc_mutex_destroy(ctx.lock);
+  btc_tx_destroy(tx);
+  btc_view_destroy(view);
+
+  /* The derive-based entry point. */
+  view = btc_view_create();
+  tx = sign_tx(view);
+
+  ASSERT(btc_tx_sign(tx, view, derive_key, NULL) == expect);
+
+  btc_tx_destroy(tx);
+  btc_view_destroy(view);
+
+  btc_signer_destroy(signer);
+  btc_precomp_destroy(pre);
+  btc_workers_destroy(pool);
+}
+
 int
 main(void) {
   size_t i;
@@ -126,5 +423,7 @@ main(void) {
   for (i = 0; i < lengthof(test_invalid_vectors); i++)
     test_tx_invalid_vector(&test_invalid_vectors[i], i);
 
+  test_sign();
+
   return 0;
 }
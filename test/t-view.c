@@ -1,14 +1,196 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-view.c - view test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/coins.h>
+#include <mako/tx.h>
 #include "lib/tests.h"
 
+static btc_tx_t *
+create_tx(uint32_t seed, size_t outputs) {
+  btc_tx_t *tx = btc_tx_create();
+  btc_output_t *output;
+  btc_input_t *input;
+  size_t i;
+
+  input = btc_input_create();
+  input->prevout.index = seed;
+
+  btc_inpvec_push(&tx->inputs, input);
+
+  for (i = 0; i < outputs; i++) {
+    output = btc_output_create();
+    output->value = (int64_t)(i + 1) * 1000;
+    btc_outvec_push(&tx->outputs, output);
+  }
+
+  btc_tx_refresh(tx);
+
+  return tx;
+}
+
+static btc_coin_t *
+read_none(const btc_outpoint_t *prevout, void *arg1, void *arg2) {
+  (void)prevout;
+  (void)arg1;
+  (void)arg2;
+  return NULL;
+}
+
+static void
+test_view_add(void) {
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *txs[20];
+  const btc_coin_t *coin;
+  btc_outpoint_t key;
+  btc_viewiter_t iter;
+  size_t i, j, count;
+
+  printf("view add/get\n");
+
+  /* Enough coins to force several resizes. */
+  for (i = 0; i < lengthof(txs); i++) {
+    txs[i] = create_tx(i, 50);
+    btc_view_add(view, txs[i], (int32_t)i, 0);
+  }
+
+  for (i = 0; i < lengthof(txs); i++) {
+    for (j = 0; j < 50; j++) {
+      btc_outpoint_set(&key, txs[i]->hash, j);
+
+      coin = btc_view_get(view, &key);
+
+      ASSERT(coin != NULL);
+      ASSERT(coin->height == (int32_t)i);
+      ASSERT(coin->output.value == (int64_t)(j + 1) * 1000);
+    }
+
+    btc_outpoint_set(&key, txs[i]->hash, 50);
+
+    ASSERT(!btc_view_has(view, &key));
+  }
+
+  count = 0;
+
+  btc_view_iterate(&iter, view);
+
+  while (btc_view_next(&coin, &iter)) {
+    btc_outpoint_set(&key, iter.hash, iter.index);
+
+    ASSERT(btc_view_get(view, &key) == coin);
+
+    count++;
+  }
+
+  ASSERT(count == lengthof(txs) * 50);
+
+  /* Replacing a coin must not add a slot. */
+  btc_outpoint_set(&key, txs[0]->hash, 0);
+  btc_view_put(view, &key, btc_tx_coin(txs[0], 1, 99));
+
+  ASSERT(btc_view_get(view, &key)->height == 99);
+
+  for (i = 0; i < lengthof(txs); i++)
+    btc_tx_destroy(txs[i]);
+
+  btc_view_destroy(view);
+}
+
+static void
+test_view_spend(void) {
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *prev = create_tx(1, 3);
+  btc_tx_t *tx = create_tx(2, 1);
+  btc_input_t *input;
+  size_t i;
+
+  printf("view spend\n");
+
+  btc_view_add(view, prev, 1, 0);
+
+  btc_outpoint_set(&tx->inputs.items[0]->prevout, prev->hash, 0);
+
+  for (i = 1; i < 3; i++) {
+    input = btc_input_create();
+    btc_outpoint_set(&input->prevout, prev->hash, i);
+    btc_inpvec_push(&tx->inputs, input);
+  }
+
+  ASSERT(btc_view_fill(view, tx, read_none, NULL, NULL));
+  ASSERT(btc_view_spend(view, tx, read_none, NULL, NULL));
+  ASSERT(btc_view_undo(view)->length == 3);
+
+  /* Double spend. */
+  ASSERT(!btc_view_spend(view, tx, read_none, NULL, NULL));
+
+  /* Missing coin. */
+  tx->inputs.items[0]->prevout.index = 3;
+
+  ASSERT(!btc_view_fill(view, tx, read_none, NULL, NULL));
+
+  btc_tx_destroy(prev);
+  btc_tx_destroy(tx);
+  btc_view_destroy(view);
+}
+
+static void
+test_undo_compress(void) {
+  btc_undo_t *undo = btc_undo_create();
+  btc_undo_t *out = btc_undo_create();
+  btc_tx_t *tx = create_tx(3, 4);
+  const uint8_t *xp;
+  uint8_t *data;
+  size_t i, xn;
+
+  printf("undo compress\n");
+
+  for (i = 0; i < 4; i++)
+    btc_undo_push(undo, btc_tx_coin(tx, i, 700000 - (int32_t)i * 100));
+
+  undo->items[0]->coinbase = 1;
+
+  xn = btc_undo_deflate(undo, 700001);
+  data = malloc(xn);
+
+  ASSERT(data != NULL);
+  ASSERT(btc_undo_compress(data, undo, 700001) == data + xn);
+  ASSERT(xn < btc_undo_size(undo));
+
+  xp = data;
+
+  ASSERT(btc_undo_decompress(out, &xp, &xn, 700001));
+  ASSERT(xn == 0);
+  ASSERT(out->length == undo->length);
+
+  for (i = 0; i < undo->length; i++) {
+    ASSERT(out->items[i]->height == undo->items[i]->height);
+    ASSERT(out->items[i]->coinbase == undo->items[i]->coinbase);
+    ASSERT(out->items[i]->version == undo->items[i]->version);
+    ASSERT(btc_output_equal(&out->items[i]->output,
+                            &undo->items[i]->output));
+  }
+
+  /* Truncated. */
+  xp = data;
+  xn = 3;
+
+  ASSERT(!btc_undo_decompress(out, &xp, &xn, 700001));
+
+  free(data);
+  btc_tx_destroy(tx);
+  btc_undo_destroy(undo);
+  btc_undo_destroy(out);
+}
+
 int main(void) {
+  test_view_add();
+  test_view_spend();
+  test_undo_compress();
   return 0;
 }
@@ -1,14 +1,434 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-workers.c - thread pool test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <io/core.h>
+#include <io/workers.h>
 #include "lib/tests.h"
 
-int main(void) {
+#define NUM_ITEMS 5000
+
+typedef struct item_s {
+  btc_work_t work;
+  btc_mutex_t *lock;
+  int *total;
+  int hits;
+} item_t;
+
+static void
+item_work(void *arg) {
+  item_t *item = arg;
+
+  item->hits++;
+
+  btc_mutex_lock(item->lock);
+  *item->total += 1;
+  btc_mutex_unlock(item->lock);
+}
+
+static void
+init_items(item_t *items, btc_mutex_t *lock, int *total) {
+  int i;
+
+  *total = 0;
+
+  for (i = 0; i < NUM_ITEMS; i++) {
+    items[i].lock = lock;
+    items[i].total = total;
+    items[i].hits = 0;
+  }
+}
+
+static void
+check_items(item_t *items, int hits) {
+  int i;
+
+  for (i = 0; i < NUM_ITEMS; i++)
+    ASSERT(items[i].hits == hits);
+}
+
+static void
+test_add(int threads, int max_batch) {
+  btc_workers_t *pool = btc_workers_create(threads, max_batch);
+  btc_mutex_t *lock = btc_mutex_create();
+  item_t *items = malloc(NUM_ITEMS * sizeof(item_t));
+  int total = 0;
+  int i;
+
+  ASSERT(items != NULL);
+
+  init_items(items, lock, &total);
+
+  for (i = 0; i < NUM_ITEMS; i++)
+    btc_workers_add(pool, item_work, &items[i]);
+
+  btc_workers_wait(pool);
+
+  ASSERT(total == NUM_ITEMS);
+
+  check_items(items, 1);
+
+  btc_workers_destroy(pool);
+  btc_mutex_destroy(lock);
+
+  free(items);
+}
+
+static void
+test_batch(int threads, int max_batch) {
+  btc_workers_t *pool = btc_workers_create(threads, max_batch);
+  btc_mutex_t *lock = btc_mutex_create();
+  item_t *items = malloc(NUM_ITEMS * sizeof(item_t));
+  btc_workq_t batch;
+  int total = 0;
+  int round, i;
+
+  ASSERT(items != NULL);
+
+  init_items(items, lock, &total);
+
+  btc_workq_init(&batch);
+
+  /* Repeated rounds of varying size, as the chain does per block. */
+  for (round = 1; round <= 20; round++) {
+    int length = (round * 997) % NUM_ITEMS;
+
+    for (i = 0; i < length; i++)
+      btc_workq_append(&batch, &items[i].work, item_work, &items[i]);
+
+    ASSERT(batch.length == length);
+
+    btc_workers_batch(pool, &batch);
+
+    ASSERT(batch.length == 0);
+    ASSERT(batch.head == NULL);
+
+    btc_workers_wait(pool);
+
+    ASSERT(total == length);
+
+    for (i = 0; i < NUM_ITEMS; i++)
+      ASSERT(items[i].hits == (i < length));
+
+    init_items(items, lock, &total);
+  }
+
+  /* Allocating and intrusive items mixed. */
+  for (i = 0; i < NUM_ITEMS; i++) {
+    if (i & 1)
+      btc_workq_push(&batch, item_work, &items[i]);
+    else
+      btc_workq_append(&batch, &items[i].work, item_work, &items[i]);
+  }
+
+  btc_workers_batch(pool, &batch);
+  btc_workers_wait(pool);
+
+  ASSERT(total == NUM_ITEMS);
+
+  check_items(items, 1);
+
+  /* Cleared without running. */
+  for (i = 0; i < 10; i++)
+    btc_workq_push(&batch, item_work, &items[i]);
+
+  btc_workq_clear(&batch);
+
+  ASSERT(batch.length == 0);
+
+  btc_workers_batch(pool, &batch);
+  btc_workers_wait(pool);
+
+  ASSERT(total == NUM_ITEMS);
+
+  btc_workers_destroy(pool);
+  btc_mutex_destroy(lock);
+
+  free(items);
+}
+
+static void
+test_group(int threads, int max_batch) {
+  btc_workers_t *pool = btc_workers_create(threads, max_batch);
+  btc_taskgroup_t *group1 = btc_taskgroup_create(pool);
+  btc_taskgroup_t *group2 = btc_taskgroup_create(pool);
+  btc_mutex_t *lock = btc_mutex_create();
+  item_t *items = malloc(NUM_ITEMS * sizeof(item_t));
+  btc_workq_t batch;
+  int total = 0;
+  int i;
+
+  ASSERT(items != NULL);
+
+  init_items(items, lock, &total);
+
+  btc_workq_init(&batch);
+
+  /* Nothing queued. */
+  btc_taskgroup_wait(group1);
+
+  /* Two groups sharing one pool. */
+  for (i = 0; i < NUM_ITEMS / 2; i++)
+    btc_workq_append(&batch, &items[i].work, item_work, &items[i]);
+
+  btc_taskgroup_batch(group1, &batch);
+
+  for (i = NUM_ITEMS / 2; i < NUM_ITEMS; i++)
+    btc_taskgroup_add(group2, item_work, &items[i]);
+
+  btc_taskgroup_wait(group1);
+
+  for (i = 0; i < NUM_ITEMS / 2; i++)
+    ASSERT(items[i].hits == 1);
+
+  btc_taskgroup_wait(group2);
+
+  ASSERT(total == NUM_ITEMS);
+
+  check_items(items, 1);
+
+  /* Plain submissions are still tracked by the pool. */
+  btc_workers_add(pool, item_work, &items[0]);
+  btc_taskgroup_add(group1, item_work, &items[1]);
+  btc_workers_wait(pool);
+
+  ASSERT(items[0].hits == 2);
+  ASSERT(items[1].hits == 2);
+
+  btc_taskgroup_wait(group1);
+  btc_taskgroup_destroy(group1);
+  btc_taskgroup_destroy(group2);
+  btc_workers_destroy(pool);
+  btc_mutex_destroy(lock);
+
+  free(items);
+}
+
+typedef struct order_s {
+  btc_mutex_t *lock;
+  btc_cond_t *cond;
+  int started;
+  int open;
+  int seq;
+} order_t;
+
+typedef struct ordered_s {
+  order_t *order;
+  int seq;
+} ordered_t;
+
+static void
+gate_work(void *arg) {
+  order_t *order = arg;
+
+  btc_mutex_lock(order->lock);
+
+  order->started++;
+
+  btc_cond_broadcast(order->cond);
+
+  while (!order->open)
+    btc_cond_wait(order->cond, order->lock);
+
+  btc_mutex_unlock(order->lock);
+}
+
+static void
+ordered_work(void *arg) {
+  ordered_t *item = arg;
+
+  btc_mutex_lock(item->order->lock);
+  item->seq = item->order->seq++;
+  btc_mutex_unlock(item->order->lock);
+}
+
+static void
+test_priority(int threads) {
+  btc_workers_t *pool = btc_workers_create(threads, 128);
+  btc_taskgroup_t *high = btc_taskgroup_create(pool);
+  btc_taskgroup_t *low = btc_taskgroup_create(pool);
+  ordered_t items[200];
+  order_t order;
+  int i, j;
+
+  order.lock = btc_mutex_create();
+  order.cond = btc_cond_create();
+  order.started = 0;
+  order.open = 0;
+  order.seq = 0;
+
+  btc_taskgroup_set_priority(high, BTC_WORK_HIGH);
+  btc_taskgroup_set_priority(low, BTC_WORK_LOW);
+
+  /* Hold every worker so that both classes queue up. */
+  for (i = 0; i < threads; i++)
+    btc_workers_add(pool, gate_work, &order);
+
+  btc_mutex_lock(order.lock);
+
+  while (order.started < threads)
+    btc_cond_wait(order.cond, order.lock);
+
+  btc_mutex_unlock(order.lock);
+
+  /* Background work first, then the urgent work. */
+  for (i = 0; i < 100; i++) {
+    items[i].order = &order;
+    btc_taskgroup_add(low, ordered_work, &items[i]);
+  }
+
+  for (i = 100; i < 200; i++) {
+    items[i].order = &order;
+    btc_taskgroup_add(high, ordered_work, &items[i]);
+  }
+
+  ASSERT(btc_workers_queued(pool, BTC_WORK_LOW) == 100);
+  ASSERT(btc_workers_queued(pool, BTC_WORK_HIGH) == 100);
+  ASSERT(btc_workers_queued(pool, BTC_WORK_NORMAL) == 0);
+
+  /* With every worker held, the waiter drains the queue
+     alone, taking work in the order a worker would. */
+  btc_taskgroup_wait(low);
+
+  for (i = 0; i < 100; i++) {
+    for (j = 100; j < 200; j++)
+      ASSERT(items[i].seq > items[j].seq);
+  }
+
+  ASSERT(btc_workers_queued(pool, BTC_WORK_LOW) == 0);
+  ASSERT(btc_workers_queued(pool, BTC_WORK_HIGH) == 0);
+
+  btc_mutex_lock(order.lock);
+  order.open = 1;
+  btc_cond_broadcast(order.cond);
+  btc_mutex_unlock(order.lock);
+
+  btc_workers_wait(pool);
+
+  btc_taskgroup_destroy(high);
+  btc_taskgroup_destroy(low);
+  btc_workers_destroy(pool);
+  btc_mutex_destroy(order.lock);
+  btc_cond_destroy(order.cond);
+}
+
+typedef struct range_s {
+  btc_mutex_t *lock;
+  unsigned char *seen;
+  size_t calls;
+} range_t;
+
+static void
+range_work(size_t start, size_t end, void *arg) {
+  range_t *range = arg;
+  size_t i;
+
+  ASSERT(start < end);
+
+  for (i = start; i < end; i++)
+    range->seen[i]++;
+
+  btc_mutex_lock(range->lock);
+  range->calls++;
+  btc_mutex_unlock(range->lock);
+}
+
+static void
+test_parallel_for(int threads) {
+  static const size_t lengths[] = { 0, 1, 7, 100, 4096, 10007 };
+  static const size_t grains[] = { 0, 1, 3, 64, 20000 };
+  btc_workers_t *pool = btc_workers_create(threads, 16);
+  unsigned char *seen = malloc(10007);
+  range_t range;
+  size_t i, j, k;
+
+  ASSERT(seen != NULL);
+
+  range.lock = btc_mutex_create();
+  range.seen = seen;
+
+  for (i = 0; i < lengthof(lengths); i++) {
+    for (j = 0; j < lengthof(grains); j++) {
+      size_t length = lengths[i];
+      size_t grain = grains[j];
+
+      memset(seen, 0, 10007);
+
+      range.calls = 0;
+
+      btc_parallel_for(pool, length, grain, range_work, &range);
+
+      for (k = 0; k < length; k++)
+        ASSERT(seen[k] == 1);
+
+      if (length == 0)
+        ASSERT(range.calls == 0);
+      else if (grain != 0)
+        ASSERT(range.calls == (length + grain - 1) / grain);
+    }
+  }
+
+  btc_mutex_destroy(range.lock);
+  btc_workers_destroy(pool);
+
+  free(seen);
+}
+
+static void
+test_pin(int threads) {
+  btc_workers_t *pool = btc_workers_create(threads, 1);
+  btc_mutex_t *lock = btc_mutex_create();
+  item_t *items = malloc(NUM_ITEMS * sizeof(item_t));
+  int ncpu = btc_sys_numcpu();
+  int cpus[2];
+  int i, total;
+
+  ASSERT(items != NULL);
+
+  cpus[0] = 0;
+  cpus[1] = ncpu > 1 ? 1 : 0;
+
+  /* The set may be off-limits here; work must run either way. */
+  ASSERT(btc_workers_pin(pool, cpus, 0) == 0);
+
+  btc_workers_pin(pool, cpus, 2);
+
+  init_items(items, lock, &total);
+
+  for (i = 0; i < NUM_ITEMS; i++)
+    btc_workers_add(pool, item_work, &items[i]);
+
+  btc_workers_wait(pool);
+
+  ASSERT(total == NUM_ITEMS);
+
+  check_items(items, 1);
+
+  btc_mutex_destroy(lock);
+  btc_workers_destroy(pool);
+
+  free(items);
+}
+
+int
+main(void) {
+  test_add(2, 1);
+  test_add(8, 1);
+  test_batch(2, 1);
+  test_batch(4, 128);
+  test_batch(16, 128);
+  test_group(2, 1);
+  test_group(8, 128);
+  test_parallel_for(2);
+  test_parallel_for(8);
+  test_pin(4);
+  test_priority(2);
+  test_priority(4);
   return 0;
 }
@@ -0,0 +1,968 @@
+/*!
+ * workload.c - synthetic regtest workload for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <io/loop.h>
+#include <mako/address.h>
+#include <mako/block.h>
+#include <mako/consensus.h>
+#include <mako/crypto/drbg.h>
+#include <mako/crypto/ecc.h>
+#include <mako/crypto/hash.h>
+#include <mako/network.h>
+#include <mako/policy.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include <node/chain.h>
+#include <node/logger.h>
+#include <node/mempool.h>
+#include <node/miner.h>
+#include <node/perf.h>
+#include "lib/tests.h"
+
+/*
+ * Constants
+ */
+
+#define WL_P2PKH 0
+#define WL_P2WPKH 1
+#define WL_P2SH 2
+#define WL_P2WSH 3
+#define WL_TYPES 4
+
+#define WL_FEE_RATE 10 /* sat/vbyte */
+#define WL_MIN_VALUE 10000
+#define WL_PICKS 4
+
+static const char *wl_names[WL_TYPES] = {
+  "p2pkh",
+  "p2wpkh",
+  "p2sh_multisig",
+  "p2wsh_multisig"
+};
+
+/* Rough vsizes, used to price a tx before it is signed. */
+static const int wl_input_size[WL_TYPES] = { 148, 68, 297, 105 };
+static const int wl_output_size[WL_TYPES] = { 34, 31, 32, 43 };
+
+/*
+ * Types
+ */
+
+typedef struct wl_coin_s {
+  btc_outpoint_t prevout;
+  int64_t value;
+  int type;
+  int32_t height; /* coinbases only */
+  int depth; /* unconfirmed generations, 0 once mined */
+  int ancestors; /* upper bound on unconfirmed ancestors */
+} wl_coin_t;
+
+typedef struct wl_pool_s {
+  wl_coin_t *items;
+  size_t alloc;
+  size_t length;
+} wl_pool_t;
+
+typedef struct wl_options_s {
+  const char *prefix;
+  int setup;
+  int blocks;
+  int txs;
+  int mix[WL_TYPES];
+  int fanin;
+  int fanout;
+  int depth;
+  int churn;
+  int memory;
+  int verbose;
+} wl_options_t;
+
+typedef struct wl_stats_s {
+  int64_t accepted;
+  int64_t replaced;
+  int64_t rejected;
+  int64_t starved;
+  int64_t inputs[WL_TYPES];
+  int64_t outputs;
+  int64_t blocks;
+  int64_t confirmed;
+  int64_t spent;
+  int64_t accept_time;
+  int64_t connect_time;
+  btc_hist_t accept;
+  btc_hist_t replace;
+  btc_hist_t assemble;
+  btc_hist_t connect;
+} wl_stats_t;
+
+typedef struct workload_s {
+  wl_options_t opt;
+  btc_drbg_t rng;
+  uint8_t priv[3][32];
+  uint8_t pub[3][33];
+  btc_script_t scripts[WL_TYPES];
+  btc_script_t multisig;
+  wl_pool_t pools[WL_TYPES];
+  wl_pool_t immature;
+  btc_loop_t *loop;
+  btc_chain_t *chain;
+  btc_mempool_t *mempool;
+  btc_miner_t *miner;
+  btc_logger_t *logger;
+  uint32_t signal;
+  wl_stats_t stats;
+} workload_t;
+
+/*
+ * Coin Pool
+ */
+
+static void
+wl_pool_push(wl_pool_t *pool, const wl_coin_t *coin) {
+  if (pool->length == pool->alloc) {
+    pool->alloc = pool->alloc == 0 ? 64 : pool->alloc * 2;
+    pool->items = (wl_coin_t *)realloc(pool->items,
+                                       pool->alloc * sizeof(wl_coin_t));
+
+    ASSERT(pool->items != NULL);
+  }
+
+  pool->items[pool->length++] = *coin;
+}
+
+static void
+wl_pool_take(wl_coin_t *coin, wl_pool_t *pool, size_t index) {
+  *coin = pool->items[index];
+  pool->items[index] = pool->items[--pool->length];
+}
+
+/*
+ * Randomness
+ */
+
+static uint32_t
+wl_uniform(workload_t *wl, uint32_t max) {
+  uint32_t x;
+
+  if (max <= 1)
+    return 0;
+
+  btc_drbg_generate(&wl->rng, &x, sizeof(x));
+
+  return x % max;
+}
+
+static int
+wl_pick_type(workload_t *wl) {
+  int total = 0;
+  int i, x;
+
+  for (i = 0; i < WL_TYPES; i++)
+    total += wl->opt.mix[i];
+
+  x = wl_uniform(wl, total);
+
+  for (i = 0; i < WL_TYPES; i++) {
+    if (x < wl->opt.mix[i])
+      return i;
+
+    x -= wl->opt.mix[i];
+  }
+
+  return WL_P2WPKH;
+}
+
+/*
+ * Keys & Scripts
+ */
+
+static void
+wl_init_keys(workload_t *wl) {
+  static const uint8_t seed[32] = {0x77, 0x6c};
+  btc_multikey_t keys[3];
+  uint8_t hash[32];
+  int i;
+
+  /* Fixed seed: every run replays the same workload. */
+  btc_drbg_init(&wl->rng, seed, sizeof(seed));
+
+  for (i = 0; i < 3; i++) {
+    btc_drbg_generate(&wl->rng, wl->priv[i], 32);
+
+    wl->priv[i][0] &= 0x7f;
+
+    ASSERT(btc_ecdsa_pubkey_create(wl->pub[i], wl->priv[i], 1));
+
+    keys[i].data = wl->pub[i];
+    keys[i].length = 33;
+  }
+
+  for (i = 0; i < WL_TYPES; i++)
+    btc_script_init(&wl->scripts[i]);
+
+  btc_script_init(&wl->multisig);
+  btc_script_set_multisig(&wl->multisig, 2, keys, 3);
+
+  btc_hash160(hash, wl->pub[0], 33);
+
+  btc_script_set_p2pkh(&wl->scripts[WL_P2PKH], hash);
+  btc_script_set_p2wpkh(&wl->scripts[WL_P2WPKH], hash);
+
+  btc_script_hash160(hash, &wl->multisig);
+  btc_script_set_p2sh(&wl->scripts[WL_P2SH], hash);
+
+  btc_script_sha256(hash, &wl->multisig);
+  btc_script_set_p2wsh(&wl->scripts[WL_P2WSH], hash);
+}
+
+static size_t
+wl_signature(uint8_t *sig,
+             const btc_tx_t *tx,
+             size_t index,
+             const btc_script_t *prev,
+             int64_t value,
+             const uint8_t *priv,
+             int version,
+             btc_tx_cache_t *cache) {
+  uint8_t msg[32], tmp[64];
+  size_t len;
+
+  btc_tx_sighash(msg, tx, index, prev, value,
+                 BTC_SIGHASH_ALL, version, cache);
+
+  ASSERT(btc_ecdsa_sign(tmp, NULL, msg, 32, priv));
+  ASSERT(btc_ecdsa_sig_export(sig, &len, tmp));
+
+  sig[len++] = BTC_SIGHASH_ALL;
+
+  return len;
+}
+
+static void
+wl_sign(workload_t *wl, btc_tx_t *tx, const wl_coin_t *coins) {
+  /* The signer in sign.c only knows single-key
+     scripts, so the 2-of-3 spends are built here. */
+  const btc_script_t *p2pkh = &wl->scripts[WL_P2PKH];
+  const btc_script_t *ms = &wl->multisig;
+  uint8_t sig1[74], sig2[74];
+  size_t len1, len2, i;
+  btc_tx_cache_t cache;
+  btc_writer_t writer;
+
+  memset(&cache, 0, sizeof(cache));
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    btc_input_t *input = tx->inputs.items[i];
+    const wl_coin_t *coin = &coins[i];
+
+    switch (coin->type) {
+      case WL_P2PKH:
+      case WL_P2WPKH: {
+        int version = (coin->type == WL_P2WPKH);
+
+        len1 = wl_signature(sig1, tx, i, p2pkh, coin->value,
+                            wl->priv[0], version, &cache);
+
+        if (version == 0) {
+          btc_writer_init(&writer);
+          btc_writer_push_data(&writer, sig1, len1);
+          btc_writer_push_data(&writer, wl->pub[0], 33);
+          btc_writer_compile(&input->script, &writer);
+          btc_writer_clear(&writer);
+        } else {
+          btc_stack_push_data(&input->witness, sig1, len1);
+          btc_stack_push_data(&input->witness, wl->pub[0], 33);
+        }
+
+        break;
+      }
+
+      case WL_P2SH: {
+        len1 = wl_signature(sig1, tx, i, ms, coin->value,
+                            wl->priv[0], 0, &cache);
+        len2 = wl_signature(sig2, tx, i, ms, coin->value,
+                            wl->priv[1], 0, &cache);
+
+        btc_writer_init(&writer);
+        btc_writer_push_op(&writer, BTC_OP_0);
+        btc_writer_push_data(&writer, sig1, len1);
+        btc_writer_push_data(&writer, sig2, len2);
+        btc_writer_push_data(&writer, ms->data, ms->length);
+        btc_writer_compile(&input->script, &writer);
+        btc_writer_clear(&writer);
+
+        break;
+      }
+
+      case WL_P2WSH: {
+        len1 = wl_signature(sig1, tx, i, ms, coin->value,
+                            wl->priv[0], 1, &cache);
+        len2 = wl_signature(sig2, tx, i, ms, coin->value,
+                            wl->priv[1], 1, &cache);
+
+        btc_stack_push_data(&input->witness, sig1, 0);
+        btc_stack_push_data(&input->witness, sig1, len1);
+        btc_stack_push_data(&input->witness, sig2, len2);
+        btc_stack_push_data(&input->witness, ms->data, ms->length);
+
+        break;
+      }
+
+      default: {
+        ASSERT(0);
+        break;
+      }
+    }
+  }
+
+  btc_tx_refresh(tx);
+}
+
+/*
+ * Transactions
+ */
+
+static int
+wl_select(workload_t *wl, wl_coin_t *coin, int ancestors, size_t cluster) {
+  int type = wl_pick_type(wl);
+  int i, j;
+
+  /* Fall back to any type with coins left. */
+  for (i = 0; i < WL_TYPES; i++) {
+    wl_pool_t *pool = &wl->pools[(type + i) % WL_TYPES];
+
+    for (j = 0; j < WL_PICKS && pool->length > 0; j++) {
+      size_t index = wl_uniform(wl, pool->length);
+      const wl_coin_t *item = &pool->items[index];
+
+      if (item->depth >= wl->opt.depth)
+        continue;
+
+      if (ancestors + item->ancestors + (item->depth > 0)
+          >= BTC_MEMPOOL_MAX_ANCESTORS) {
+        continue;
+      }
+
+      if (item->depth > 0) {
+        if (cluster + btc_mempool_cluster(wl->mempool, item->prevout.hash)
+            >= BTC_MEMPOOL_MAX_CLUSTER) {
+          continue;
+        }
+      }
+
+      wl_pool_take(coin, pool, index);
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static btc_tx_t *
+wl_build(workload_t *wl,
+         const wl_coin_t *coins,
+         size_t inputs,
+         const int *types,
+         size_t outputs,
+         int64_t fee) {
+  btc_tx_t *tx = btc_tx_create();
+  int64_t total = 0;
+  int64_t value;
+  size_t i;
+
+  tx->version = 2;
+
+  for (i = 0; i < inputs; i++) {
+    btc_tx_add_outpoint(tx, &coins[i].prevout);
+
+    /* Everything signals BIP125 so churn can replace it. */
+    tx->inputs.items[i]->sequence = 0xfffffffd;
+
+    total += coins[i].value;
+  }
+
+  value = (total - fee) / (int64_t)outputs;
+
+  for (i = 0; i < outputs; i++) {
+    btc_output_t *output = btc_output_create();
+
+    btc_script_copy(&output->script, &wl->scripts[types[i]]);
+
+    output->value = value;
+
+    if (i == 0)
+      output->value += (total - fee) % (int64_t)outputs;
+
+    btc_outvec_push(&tx->outputs, output);
+  }
+
+  wl_sign(wl, tx, coins);
+
+  return tx;
+}
+
+static int
+wl_submit(workload_t *wl, const btc_tx_t *tx, btc_hist_t *hist) {
+  int64_t start = btc_time_usec();
+  int ret = btc_mempool_add(wl->mempool, tx, 0);
+  int64_t elapsed = btc_time_usec() - start;
+
+  btc_hist_record(hist, elapsed);
+
+  wl->stats.accept_time += elapsed;
+
+  if (!ret) {
+    const btc_verify_error_t *err = btc_mempool_error(wl->mempool);
+
+    wl->stats.rejected++;
+
+    if (wl->opt.verbose)
+      fprintf(stderr, "reject: %s\n", err->reason);
+  }
+
+  return ret;
+}
+
+static int
+wl_spend(workload_t *wl) {
+  size_t inputs = 1 + wl_uniform(wl, wl->opt.fanin);
+  size_t outputs = 1 + wl_uniform(wl, wl->opt.fanout);
+  wl_coin_t coins[16];
+  int types[16], rtypes[16];
+  int *otypes = types;
+  btc_tx_t *tx, *rtx;
+  int64_t total = 0;
+  int64_t fee, size;
+  size_t cluster = 0;
+  int depth = 0;
+  int ancestors = 0;
+  size_t i;
+
+  for (i = 0; i < inputs; i++) {
+    if (!wl_select(wl, &coins[i], ancestors, cluster))
+      break;
+
+    /* Coins of one cluster are counted twice. */
+    if (coins[i].depth > 0) {
+      ancestors += coins[i].ancestors + 1;
+      cluster += btc_mempool_cluster(wl->mempool, coins[i].prevout.hash);
+    }
+
+    if (coins[i].depth > depth)
+      depth = coins[i].depth;
+
+    total += coins[i].value;
+  }
+
+  inputs = i;
+
+  if (inputs == 0) {
+    wl->stats.starved++;
+    return 0;
+  }
+
+  size = 11;
+
+  for (i = 0; i < inputs; i++)
+    size += wl_input_size[coins[i].type];
+
+  for (i = 0; i < outputs; i++) {
+    types[i] = wl_pick_type(wl);
+    size += wl_output_size[types[i]];
+  }
+
+  fee = size * WL_FEE_RATE;
+
+  /* Leave room to double the fee on replacement. */
+  while (outputs > 1 && total - fee * 2 < (int64_t)outputs * WL_MIN_VALUE)
+    outputs--;
+
+  if (total - fee * 2 < WL_MIN_VALUE) {
+    /* Dust: drop the coins rather than spin on them. */
+    return 1;
+  }
+
+  tx = wl_build(wl, coins, inputs, types, outputs, fee);
+
+  if (!wl_submit(wl, tx, &wl->stats.accept)) {
+    for (i = 0; i < inputs; i++)
+      wl_pool_push(&wl->pools[coins[i].type], &coins[i]);
+
+    btc_tx_destroy(tx);
+
+    return 1;
+  }
+
+  wl->stats.accepted++;
+
+  if ((int)wl_uniform(wl, 100) < wl->opt.churn) {
+    /* Same inputs, new outputs, twice the fee (BIP125). */
+    for (i = 0; i < outputs; i++)
+      rtypes[i] = wl_pick_type(wl);
+
+    rtx = wl_build(wl, coins, inputs, rtypes, outputs, fee * 2);
+
+    if (wl_submit(wl, rtx, &wl->stats.replace)) {
+      wl->stats.replaced++;
+      btc_tx_destroy(tx);
+      otypes = rtypes;
+      tx = rtx;
+    } else {
+      btc_tx_destroy(rtx);
+    }
+  }
+
+  for (i = 0; i < inputs; i++)
+    wl->stats.inputs[coins[i].type]++;
+
+  for (i = 0; i < tx->outputs.length; i++) {
+    wl_coin_t coin;
+
+    btc_outpoint_set(&coin.prevout, tx->hash, i);
+
+    coin.value = tx->outputs.items[i]->value;
+    coin.type = otypes[i];
+    coin.height = -1;
+    coin.depth = depth + 1;
+    coin.ancestors = ancestors;
+
+    wl_pool_push(&wl->pools[coin.type], &coin);
+  }
+
+  wl->stats.outputs += tx->outputs.length;
+
+  btc_tx_destroy(tx);
+
+  return 1;
+}
+
+/*
+ * Blocks
+ */
+
+static void
+wl_refresh(workload_t *wl) {
+  int32_t height = btc_chain_height(wl->chain);
+  wl_pool_t *immature = &wl->immature;
+  wl_coin_t coin;
+  size_t i, j;
+
+  i = 0;
+
+  while (i < immature->length) {
+    if (height - immature->items[i].height < BTC_COINBASE_MATURITY) {
+      i++;
+      continue;
+    }
+
+    wl_pool_take(&coin, immature, i);
+    wl_pool_push(&wl->pools[coin.type], &coin);
+  }
+
+  /* Anything the block left behind stays unconfirmed. */
+  for (i = 0; i < WL_TYPES; i++) {
+    wl_pool_t *pool = &wl->pools[i];
+
+    for (j = 0; j < pool->length; j++) {
+      wl_coin_t *item = &pool->items[j];
+
+      if (item->depth == 0)
+        continue;
+
+      if (btc_mempool_has(wl->mempool, item->prevout.hash))
+        continue;
+
+      item->depth = 0;
+      item->ancestors = 0;
+    }
+  }
+}
+
+static void
+wl_mine(workload_t *wl, int record) {
+  const btc_tx_t *cb;
+  btc_block_t *block;
+  int64_t start, end;
+  btc_tmpl_t *bt;
+  wl_coin_t coin;
+  size_t i;
+
+  start = btc_time_usec();
+  bt = btc_miner_template(wl->miner);
+  end = btc_time_usec();
+
+  if (record)
+    btc_hist_record(&wl->stats.assemble, end - start);
+
+  bt->version |= wl->signal;
+
+  block = btc_tmpl_mine(bt);
+
+  start = btc_time_usec();
+  ASSERT(btc_chain_add(wl->chain, block, BTC_BLOCK_DEFAULT_FLAGS, 0));
+  end = btc_time_usec();
+
+  if (record) {
+    btc_hist_record(&wl->stats.connect, end - start);
+
+    wl->stats.connect_time += end - start;
+    wl->stats.blocks++;
+    wl->stats.confirmed += block->txs.length - 1;
+
+    for (i = 1; i < block->txs.length; i++)
+      wl->stats.spent += block->txs.items[i]->inputs.length;
+  }
+
+  cb = block->txs.items[0];
+
+  for (i = 0; i < cb->outputs.length; i++) {
+    const btc_output_t *output = cb->outputs.items[i];
+
+    if (!btc_script_equal(&output->script, &wl->scripts[WL_P2WPKH]))
+      continue;
+
+    btc_outpoint_set(&coin.prevout, cb->hash, i);
+
+    coin.value = output->value;
+    coin.type = WL_P2WPKH;
+    coin.height = btc_chain_height(wl->chain);
+    coin.depth = 0;
+    coin.ancestors = 0;
+
+    wl_pool_push(&wl->immature, &coin);
+  }
+
+  btc_block_destroy(block);
+  btc_tmpl_destroy(bt);
+
+  wl_refresh(wl);
+}
+
+static void
+on_connect(const btc_entry_t *entry,
+           const btc_block_t *block,
+           const btc_view_t *view,
+           void *arg) {
+  workload_t *wl = (workload_t *)arg;
+
+  (void)view;
+
+  btc_mempool_add_block(wl->mempool, entry, block);
+}
+
+/*
+ * Workload
+ */
+
+static void
+wl_open(workload_t *wl) {
+  const btc_network_t *network = btc_regtest;
+  const btc_deployment_t *deploy;
+  btc_address_t addr;
+  unsigned int flags;
+  uint8_t hash[20];
+
+  wl_init_keys(wl);
+
+  btc_clean(wl->opt.prefix);
+
+  ASSERT(btc_fs_mkdirp(wl->opt.prefix, 0755));
+
+  /* Regtest segwit is a BIP9 deployment the
+     miner won't vote for on its own. */
+  deploy = btc_network_deployment(network, "segwit");
+
+  if (deploy != NULL)
+    wl->signal = UINT32_C(1) << deploy->bit;
+
+  /* Keep the report the only thing on stdout. */
+  wl->logger = btc_logger_create();
+
+  btc_logger_set_silent(wl->logger, 1);
+
+  wl->loop = btc_loop_create();
+  wl->chain = btc_chain_create(network);
+  wl->mempool = btc_mempool_create(network, wl->chain);
+  wl->miner = btc_miner_create(network, wl->loop, wl->chain, wl->mempool);
+
+  btc_chain_set_logger(wl->chain, wl->logger);
+  btc_mempool_set_logger(wl->mempool, wl->logger);
+  btc_miner_set_logger(wl->miner, wl->logger);
+
+  btc_chain_on_connect(wl->chain, on_connect);
+  btc_chain_set_context(wl->chain, wl);
+
+  flags = BTC_CHAIN_DEFAULT_FLAGS;
+
+  if (wl->opt.memory)
+    flags |= BTC_CHAIN_MEMORY;
+
+  ASSERT(btc_chain_open(wl->chain, wl->opt.prefix, flags));
+  ASSERT(btc_mempool_open(wl->mempool, wl->opt.prefix, 0));
+  ASSERT(btc_miner_open(wl->miner, BTC_MINER_DEFAULT_FLAGS));
+
+  btc_hash160(hash, wl->pub[0], 33);
+  btc_address_set_p2wpkh(&addr, hash);
+  btc_miner_add_address(wl->miner, &addr);
+}
+
+static void
+wl_close(workload_t *wl) {
+  int i;
+
+  btc_miner_close(wl->miner);
+  btc_mempool_close(wl->mempool);
+  btc_chain_close(wl->chain);
+
+  btc_miner_destroy(wl->miner);
+  btc_mempool_destroy(wl->mempool);
+  btc_chain_destroy(wl->chain);
+  btc_loop_destroy(wl->loop);
+  btc_logger_destroy(wl->logger);
+
+  for (i = 0; i < WL_TYPES; i++) {
+    free(wl->pools[i].items);
+    btc_script_clear(&wl->scripts[i]);
+  }
+
+  free(wl->immature.items);
+
+  btc_script_clear(&wl->multisig);
+
+  btc_clean(wl->opt.prefix);
+  btc_fs_rmdir(wl->opt.prefix);
+}
+
+static void
+wl_run(workload_t *wl) {
+  int i, j;
+
+  /* Activate segwit and mature the first coinbases. */
+  for (i = 0; i < wl->opt.setup; i++)
+    wl_mine(wl, 0);
+
+  for (i = 0; i < wl->opt.blocks; i++) {
+    for (j = 0; j < wl->opt.txs; j++) {
+      if (!wl_spend(wl))
+        break;
+    }
+
+    wl_mine(wl, 1);
+  }
+}
+
+/*
+ * Report
+ */
+
+static double
+wl_rate(int64_t count, int64_t usec) {
+  if (usec <= 0)
+    return 0.0;
+
+  return (double)count * 1e6 / (double)usec;
+}
+
+static void
+wl_hist(const char *name, const btc_hist_t *hist, int last) {
+  printf("    \"%s\": {\n", name);
+  printf("      \"count\": %lu,\n", (unsigned long)hist->count);
+  printf("      \"mean_us\": %lu,\n", (unsigned long)btc_hist_mean(hist));
+  printf("      \"p50_us\": %lu,\n",
+         (unsigned long)btc_hist_percentile(hist, 0.50));
+  printf("      \"p90_us\": %lu,\n",
+         (unsigned long)btc_hist_percentile(hist, 0.90));
+  printf("      \"p99_us\": %lu,\n",
+         (unsigned long)btc_hist_percentile(hist, 0.99));
+  printf("      \"max_us\": %lu\n", (unsigned long)hist->max);
+  printf("    }%s\n", last ? "" : ",");
+}
+
+static void
+wl_report(const workload_t *wl, int64_t elapsed) {
+  const wl_stats_t *st = &wl->stats;
+  int i;
+
+  printf("{\n");
+  printf("  \"blocks\": %ld,\n", (long)st->blocks);
+  printf("  \"elapsed_ms\": %ld,\n", (long)(elapsed / 1000));
+  printf("  \"txs_accepted\": %ld,\n", (long)st->accepted);
+  printf("  \"txs_replaced\": %ld,\n", (long)st->replaced);
+  printf("  \"txs_rejected\": %ld,\n", (long)st->rejected);
+  printf("  \"txs_confirmed\": %ld,\n", (long)st->confirmed);
+  printf("  \"starved\": %ld,\n", (long)st->starved);
+  printf("  \"outputs\": %ld,\n", (long)st->outputs);
+  printf("  \"inputs\": {\n");
+
+  for (i = 0; i < WL_TYPES; i++) {
+    printf("    \"%s\": %ld%s\n", wl_names[i], (long)st->inputs[i],
+                                  i == WL_TYPES - 1 ? "" : ",");
+  }
+
+  printf("  },\n");
+  printf("  \"mempool_txs_per_sec\": %.2f,\n",
+         wl_rate(st->accepted + st->replaced + st->rejected,
+                 st->accept_time));
+  printf("  \"chain_blocks_per_sec\": %.2f,\n",
+         wl_rate(st->blocks, st->connect_time));
+  printf("  \"chain_txs_per_sec\": %.2f,\n",
+         wl_rate(st->confirmed, st->connect_time));
+  printf("  \"chain_inputs_per_sec\": %.2f,\n",
+         wl_rate(st->spent, st->connect_time));
+  printf("  \"latency\": {\n");
+
+  wl_hist("mempool_add", &st->accept, 0);
+  wl_hist("mempool_replace", &st->replace, 0);
+  wl_hist("block_assemble", &st->assemble, 0);
+  wl_hist("chain_add", &st->connect, 1);
+
+  printf("  }\n");
+  printf("}\n");
+}
+
+/*
+ * Main
+ */
+
+static void
+wl_usage(void) {
+  fprintf(stderr,
+    "Usage: mako_workload [-p prefix] [-b blocks] [-n txs]\n"
+    "                     [-m p2pkh,p2wpkh,p2sh,p2wsh] [-i fanin]\n"
+    "                     [-o fanout] [-d depth] [-r churn%%] [-e] [-v]\n");
+  exit(EXIT_FAILURE);
+}
+
+static int
+wl_parse_mix(int *mix, const char *str) {
+  int total = 0;
+  int i;
+
+  for (i = 0; i < WL_TYPES; i++) {
+    char *end;
+    long x = strtol(str, &end, 10);
+
+    if (end == str || x < 0 || x > 1000)
+      return 0;
+
+    mix[i] = x;
+    total += x;
+
+    if (i < WL_TYPES - 1) {
+      if (*end != ',')
+        return 0;
+
+      end++;
+    }
+
+    str = end;
+  }
+
+  return *str == '\0' && total > 0;
+}
+
+static int
+wl_parse_int(int *z, const char *str, int min, int max) {
+  char *end;
+  long x = strtol(str, &end, 10);
+
+  if (end == str || *end != '\0' || x < min || x > max)
+    return 0;
+
+  *z = x;
+
+  return 1;
+}
+
+int
+main(int argc, char **argv) {
+  static workload_t wl;
+  wl_options_t *opt = &wl.opt;
+  int64_t start;
+  int i, ok;
+
+  opt->prefix = BTC_PREFIX "/workload";
+  /* One BIP9 window each to start, lock in
+     and activate segwit. */
+  opt->setup = 3 * btc_regtest->miner_window;
+  opt->blocks = 50;
+  opt->txs = 200;
+  opt->mix[WL_P2PKH] = 25;
+  opt->mix[WL_P2WPKH] = 25;
+  opt->mix[WL_P2SH] = 25;
+  opt->mix[WL_P2WSH] = 25;
+  opt->fanin = 3;
+  opt->fanout = 3;
+  opt->depth = 5;
+  opt->churn = 10;
+  opt->memory = 0;
+  opt->verbose = 0;
+
+  for (i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "-v") == 0) {
+      opt->verbose = 1;
+      continue;
+    }
+
+    /* Keep the chain in memory. */
+    if (strcmp(arg, "-e") == 0) {
+      opt->memory = 1;
+      continue;
+    }
+
+    if (val == NULL)
+      wl_usage();
+
+    ok = 1;
+
+    if (strcmp(arg, "-p") == 0)
+      opt->prefix = val;
+    else if (strcmp(arg, "-b") == 0)
+      ok = wl_parse_int(&opt->blocks, val, 1, 100000);
+    else if (strcmp(arg, "-n") == 0)
+      ok = wl_parse_int(&opt->txs, val, 0, 100000);
+    else if (strcmp(arg, "-m") == 0)
+      ok = wl_parse_mix(opt->mix, val);
+    else if (strcmp(arg, "-i") == 0)
+      ok = wl_parse_int(&opt->fanin, val, 1, 16);
+    else if (strcmp(arg, "-o") == 0)
+      ok = wl_parse_int(&opt->fanout, val, 1, 16);
+    else if (strcmp(arg, "-d") == 0)
+      ok = wl_parse_int(&opt->depth, val, 1, BTC_MEMPOOL_MAX_ANCESTORS);
+    else if (strcmp(arg, "-r") == 0)
+      ok = wl_parse_int(&opt->churn, val, 0, 100);
+    else
+      ok = 0;
+
+    if (!ok)
+      wl_usage();
+
+    i++;
+  }
+
+  wl_open(&wl);
+
+  start = btc_time_usec();
+
+  wl_run(&wl);
+
+  wl_report(&wl, btc_time_usec() - start);
+
+  wl_close(&wl);
+
+  return EXIT_SUCCESS;
+}